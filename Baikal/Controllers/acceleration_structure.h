@@ -0,0 +1,104 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+
+
+
+/**
+ \file acceleration_structure.h
+ \version 1.0
+ \brief Intersector acceleration structure presets.
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace Baikal
+{
+    // Trade off between intersector build time and traversal speed
+    enum class AccelerationStructure
+    {
+        // Chosen per scene by triangle count and by whether its shapes are being edited
+        kAuto,
+        // Linear BVH built on the device, for interactive editing
+        kFastBuild,
+        // Binned SAH BVH
+        kBalanced,
+        // SAH BVH with spatial splits and finer binning, for final frames
+        kHighQuality
+    };
+
+    // RadeonRays options of a preset
+    struct AccelerationStructureOptions
+    {
+        std::string type;
+        std::string builder;
+        float num_bins = 0.f;
+        bool use_splits = false;
+
+        bool operator == (AccelerationStructureOptions const& other) const
+        {
+            return type == other.type && builder == other.builder &&
+                num_bins == other.num_bins && use_splits == other.use_splits;
+        }
+    };
+
+    // Edited scenes above this size are rebuilt with the fast builder
+    static std::size_t constexpr kAutoFastBuildEditedTriangles = 1u << 17;
+    // Build time and memory of spatial splits limit them to scenes up to this size
+    static std::size_t constexpr kAutoHighQualityTriangles = 1u << 20;
+    // SAH build takes too long above this size even for final frames
+    static std::size_t constexpr kAutoFastBuildTriangles = 1u << 24;
+
+    // Resolve kAuto, edited tells if shapes of the scene have changed since its first compile
+    inline AccelerationStructure ChooseAccelerationStructure(AccelerationStructure requested, std::size_t num_triangles, bool edited)
+    {
+        if (requested != AccelerationStructure::kAuto)
+        {
+            return requested;
+        }
+
+        if (num_triangles > kAutoFastBuildTriangles || (edited && num_triangles > kAutoFastBuildEditedTriangles))
+        {
+            return AccelerationStructure::kFastBuild;
+        }
+
+        return (!edited && num_triangles <= kAutoHighQualityTriangles) ?
+            AccelerationStructure::kHighQuality : AccelerationStructure::kBalanced;
+    }
+
+    // Two level structures are needed for instances and ray masks, HLBVH builds flat ones only,
+    // so they fall back to the spatial median builder which is still much faster than SAH
+    inline AccelerationStructureOptions GetAccelerationStructureOptions(AccelerationStructure type, bool two_level)
+    {
+        switch (type)
+        {
+        case AccelerationStructure::kFastBuild:
+            return two_level ? AccelerationStructureOptions{ "fatbvh", "median", 16.f, false } :
+                AccelerationStructureOptions{ "hlbvh", "median", 16.f, false };
+        case AccelerationStructure::kHighQuality:
+            return AccelerationStructureOptions{ "fatbvh", "sah", 64.f, true };
+        default:
+            return AccelerationStructureOptions{ "fatbvh", "sah", 16.f, false };
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#include "Controllers/clw_resource_registry.h"
+
+#include <cassert>
+
+namespace Baikal
+{
+    ClwScene::GeometryRange const* ClwResourceRegistry::AcquireGeometry(std::shared_ptr<Mesh> const& mesh, std::uint32_t revision)
+    {
+        auto iter = geometry.find(std::make_pair(mesh, revision));
+
+        if (iter == geometry.end())
+        {
+            return nullptr;
+        }
+
+        ++iter->second.refcount;
+        return &iter->second.range;
+    }
+
+    void ClwResourceRegistry::AddGeometry(std::shared_ptr<Mesh> const& mesh, ClwScene::GeometryRange const& range)
+    {
+        assert(geometry.find(std::make_pair(mesh, range.revision)) == geometry.end());
+        geometry[std::make_pair(mesh, range.revision)] = GeometryEntry{ range, 1u };
+    }
+
+    void ClwResourceRegistry::ReleaseGeometry(std::shared_ptr<Mesh> const& mesh, std::uint32_t revision)
+    {
+        auto iter = geometry.find(std::make_pair(mesh, revision));
+
+        // Not registered yet if the compile has failed half way
+        if (iter == geometry.end())
+        {
+            return;
+        }
+
+        if (--iter->second.refcount == 0)
+        {
+            auto const& range = iter->second.range;
+            vertex_allocator.Free(range.vertex_offset, range.vertex_count);
+            index_allocator.Free(range.index_offset, range.index_count);
+            geometry.erase(iter);
+        }
+    }
+
+    bool ClwResourceRegistry::IsGeometryExclusive(std::shared_ptr<Mesh> const& mesh, std::uint32_t revision) const
+    {
+        auto iter = geometry.find(std::make_pair(mesh, revision));
+        return iter != geometry.end() && iter->second.refcount == 1;
+    }
+
+    void ClwResourceRegistry::RenameGeometry(std::shared_ptr<Mesh> const& mesh, std::uint32_t from, std::uint32_t to)
+    {
+        auto iter = geometry.find(std::make_pair(mesh, from));
+        assert(iter != geometry.end() && iter->second.refcount == 1);
+
+        auto entry = iter->second;
+        entry.range.revision = to;
+        geometry.erase(iter);
+        geometry[std::make_pair(mesh, to)] = entry;
+    }
+
+    ClwScene::TextureSlot const* ClwResourceRegistry::AcquireTexture(std::shared_ptr<Texture> const& texture, std::uint32_t revision)
+    {
+        auto iter = textures.find(std::make_pair(texture, revision));
+
+        if (iter == textures.end())
+        {
+            return nullptr;
+        }
+
+        ++iter->second.refcount;
+        return &iter->second.slot;
+    }
+
+    void ClwResourceRegistry::AddTexture(std::shared_ptr<Texture> const& texture, ClwScene::TextureSlot const& slot)
+    {
+        assert(textures.find(std::make_pair(texture, slot.revision)) == textures.end());
+        textures[std::make_pair(texture, slot.revision)] = TextureEntry{ slot, 1u };
+    }
+
+    void ClwResourceRegistry::ReleaseTexture(std::shared_ptr<Texture> const& texture, std::uint32_t revision)
+    {
+        auto iter = textures.find(std::make_pair(texture, revision));
+
+        // Not registered yet if the compile has failed half way
+        if (iter == textures.end())
+        {
+            return;
+        }
+
+        if (--iter->second.refcount == 0)
+        {
+            texture_allocator.Free(iter->second.slot.offset, iter->second.slot.size);
+            textures.erase(iter);
+        }
+    }
+
+    bool ClwResourceRegistry::IsTextureExclusive(std::shared_ptr<Texture> const& texture, std::uint32_t revision) const
+    {
+        auto iter = textures.find(std::make_pair(texture, revision));
+        return iter != textures.end() && iter->second.refcount == 1;
+    }
+
+    void ClwResourceRegistry::RenameTexture(std::shared_ptr<Texture> const& texture, std::uint32_t from, std::uint32_t to)
+    {
+        auto iter = textures.find(std::make_pair(texture, from));
+        assert(iter != textures.end() && iter->second.refcount == 1);
+
+        auto entry = iter->second;
+        entry.slot.revision = to;
+        textures.erase(iter);
+        textures[std::make_pair(texture, to)] = entry;
+    }
+
+    void ClwResourceRegistry::BindGeometry(ClwScene& scene) const
+    {
+        scene.vertices = vertices;
+        scene.normals = normals;
+        scene.uvs = uvs;
+        scene.tangents = tangents;
+        scene.indices = indices;
+    }
+
+    void ClwResourceRegistry::BindTextures(ClwScene& scene) const
+    {
+        scene.texturedata = texturedata;
+    }
+}
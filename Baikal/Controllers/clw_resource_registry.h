@@ -0,0 +1,107 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+
+/**
+ \file clw_resource_registry.h
+ \version 1.0
+ \brief Contains ClwResourceRegistry structure.
+ */
+#pragma once
+
+#include "CLW.h"
+#include "SceneGraph/clwscene.h"
+#include "Utils/range_allocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+
+namespace Baikal
+{
+    class Mesh;
+    class Texture;
+
+    /**
+     \brief Device geometry and texture data shared by all scenes compiled with one controller.
+
+     Mesh geometry and texel data are stored once per data revision and referenced by every
+     compiled scene using them. Stored data is immutable while more than one scene references it,
+     edits go to a new revision, so scenes which have not been recompiled yet keep rendering the old one.
+     Growing a pool recreates its buffers, scenes holding the old buffers still see valid data for
+     everything they reference until they are rebound.
+     */
+    struct ClwResourceRegistry
+    {
+        using MeshKey = std::pair<std::shared_ptr<Mesh>, std::uint32_t>;
+        using TextureKey = std::pair<std::shared_ptr<Texture>, std::uint32_t>;
+
+        struct GeometryEntry
+        {
+            ClwScene::GeometryRange range;
+            std::size_t refcount;
+        };
+
+        struct TextureEntry
+        {
+            ClwScene::TextureSlot slot;
+            std::size_t refcount;
+        };
+
+        // Geometry pool, normals, UVs and tangents are addressed with the vertex offset
+        CLWBuffer<RadeonRays::float3> vertices;
+        CLWBuffer<ClwScene::NormalData> normals;
+        CLWBuffer<ClwScene::UVData> uvs;
+        CLWBuffer<std::uint32_t> tangents;
+        CLWBuffer<int> indices;
+        RangeAllocator vertex_allocator;
+        RangeAllocator index_allocator;
+        std::map<MeshKey, GeometryEntry> geometry;
+
+        // Texel data pool, slots are 16 bytes aligned
+        CLWBuffer<char> texturedata;
+        RangeAllocator texture_allocator;
+        std::map<TextureKey, TextureEntry> textures;
+
+        // Add a reference to stored geometry, returns nullptr if the revision is not stored
+        ClwScene::GeometryRange const* AcquireGeometry(std::shared_ptr<Mesh> const& mesh, std::uint32_t revision);
+        // Store newly written geometry with a single reference
+        void AddGeometry(std::shared_ptr<Mesh> const& mesh, ClwScene::GeometryRange const& range);
+        // Drop a reference, the range is freed with the last one
+        void ReleaseGeometry(std::shared_ptr<Mesh> const& mesh, std::uint32_t revision);
+        // True if the scene holding a reference is the only user, i.e. geometry can be rewritten in place
+        bool IsGeometryExclusive(std::shared_ptr<Mesh> const& mesh, std::uint32_t revision) const;
+        // Move exclusive geometry to another revision without reallocation
+        void RenameGeometry(std::shared_ptr<Mesh> const& mesh, std::uint32_t from, std::uint32_t to);
+
+        ClwScene::TextureSlot const* AcquireTexture(std::shared_ptr<Texture> const& texture, std::uint32_t revision);
+        void AddTexture(std::shared_ptr<Texture> const& texture, ClwScene::TextureSlot const& slot);
+        void ReleaseTexture(std::shared_ptr<Texture> const& texture, std::uint32_t revision);
+        bool IsTextureExclusive(std::shared_ptr<Texture> const& texture, std::uint32_t revision) const;
+        void RenameTexture(std::shared_ptr<Texture> const& texture, std::uint32_t from, std::uint32_t to);
+
+        // Point scene buffers to the pools
+        void BindGeometry(ClwScene& scene) const;
+        void BindTextures(ClwScene& scene) const;
+    };
+}
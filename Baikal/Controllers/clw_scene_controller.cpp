@@ -9,15 +9,36 @@
 #include "SceneGraph/iterator.h"
 #include "SceneGraph/uberv2material.h"
 #include "SceneGraph/inputmaps.h"
+#include "Utils/curve_bvh.h"
 #include "Utils/distribution1d.h"
+#include "Utils/geometry_compression.h"
+#include "Utils/light_bvh.h"
+#include "Utils/light_grid.h"
 #include "Utils/log.h"
+#include "Utils/majorant_grid.h"
+#include "Utils/mesh_tangents.h"
+#include "Utils/sh.h"
+#include "Utils/sparse_volume_grid.h"
 #include "Utils/cl_inputmap_generator.h"
 #include "Utils/cl_program_manager.h"
 #include "Utils/cl_uberv2_generator.h"
+#include "Utils/clw_class.h"
+#include "Utils/task_scheduler.h"
+
+#ifdef BAIKAL_EMBED_KERNELS
+#include "embed_kernels.h"
+#endif
 
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
 #include <chrono>
+#include <cstring>
+#include <map>
 #include <memory>
+#include <numeric>
 #include <stack>
 #include <vector>
 #include <array>
@@ -26,11 +47,330 @@ using namespace RadeonRays;
 
 namespace Baikal
 {
+    // Power based light selection is good enough for small light counts,
+    // light BVH is only built if the scene has more local lights than this
+    static std::uint32_t const kLightBvhMinLights = 64u;
+
+    // Last revision assigned to a compiled scene
+    static std::atomic<std::uint32_t> s_scene_revision(0u);
+    // Last camera revision assigned to a compiled scene
+    static std::atomic<std::uint32_t> s_camera_revision(0u);
+
+    // Heterogeneous volume grid layout, see volumetrics.cl
+    static std::size_t const kVolumeGridHeaderSize = 16u;
+    // Number of density voxels along each axis covered by a majorant cell
+    static std::uint32_t const kVolumeMajorantBlock = 8u;
+    // Volume::extra of heterogeneous volumes with sparse grids, VOLUME_GRID_SPARSE in volumetrics.cl
+    static int const kVolumeGridSparse = 1;
+
+    // Number of items serialized by a single task of the scheduler
+    static std::size_t const kSerializationBatchSize = 64u;
+
+    // Camera buffers written round robin, a camera change goes to a buffer no queued frame reads
+    static std::size_t const kCameraRingSize = 3u;
+
+    // Write Distribution1D in the layout expected by Distribution1D_* kernel functions,
+    // returns pointer past the written data
+    static int* WriteDistribution(Distribution1D const& distribution, int* current)
+    {
+        // Write the number of segments first
+        *current++ = (int)distribution.m_num_segments;
+
+        // Then write num_segments  + 1 CDF values
+        auto values = reinterpret_cast<float*>(current);
+        for (auto i = 0u; i < distribution.m_num_segments + 1; ++i)
+        {
+            values[i] = distribution.m_cdf[i];
+        }
+
+        // Then write num_segments PDF values
+        values += distribution.m_num_segments + 1;
+
+        for (auto i = 0u; i < distribution.m_num_segments; ++i)
+        {
+            values[i] = distribution.m_func_values[i] / distribution.m_func_sum;
+        }
+
+        // Then write num_segments alias probabilities and num_segments aliases
+        values += distribution.m_num_segments;
+        std::copy(distribution.m_alias_probabilities.begin(), distribution.m_alias_probabilities.end(), values);
+
+        current = reinterpret_cast<int*>(values + distribution.m_num_segments);
+        std::transform(distribution.m_aliases.begin(), distribution.m_aliases.end(), current,
+            [](std::uint32_t alias) { return (int)alias; });
+
+        return current + distribution.m_num_segments;
+    }
+
+    // Number of ints written by WriteDistribution
+    static std::size_t GetDistributionSize(std::size_t num_segments)
+    {
+        return 1 + (num_segments + 1) + 3 * num_segments;
+    }
+
     static std::size_t align16(std::size_t value)
     {
         return (value + 0xF) / 0x10 * 0x10;
     }
 
+    // Tangent pool follows the vertex pool only if tangents are used, kernels get a placeholder otherwise
+    static std::size_t GetTangentPoolSize(std::size_t num_vertices)
+    {
+#ifdef BAIKAL_VERTEX_TANGENTS
+        return num_vertices;
+#else
+        return std::min<std::size_t>(num_vertices, 1u);
+#endif
+    }
+
+#if defined(BAIKAL_TEXTURE_MIPMAPS) || defined(BAIKAL_TEXTURE_CONVERSION)
+    // Mip levels and expanded texels are written by the kernels right in the texture data buffer
+    static cl_mem_flags const kTextureDataFlags = CL_MEM_READ_WRITE;
+#else
+    static cl_mem_flags const kTextureDataFlags = CL_MEM_READ_ONLY;
+#endif
+
+    // Number of mip levels down to 1x1, mip chains are only built for uncompressed 2D textures
+    static int GetTextureLevelCount(Texture const& texture)
+    {
+        int levels = 1;
+
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+        auto dim = texture.GetSize();
+
+        if (dim.z == 1 && !texture.IsCompressed())
+        {
+            for (auto size = std::max(dim.x, dim.y); size > 1; size >>= 1)
+            {
+                ++levels;
+            }
+        }
+#endif
+
+        return levels;
+    }
+
+    // Environment irradiance is kept up to the second SH band
+    static const std::uint32_t kNumIrradianceCoeffs = 9;
+#ifdef BAIKAL_SH_IRRADIANCE
+    // Largest width of the lat-long grid environment texels are summed into before SH projection
+    static const std::uint32_t kIrradianceGridWidth = 256;
+#endif
+
+    static bool IsThreeChannelFormat(Texture::Format format)
+    {
+        return format == Texture::Format::kRgb8 || format == Texture::Format::kRgb16 || format == Texture::Format::kRgb32;
+    }
+
+    // Size of a device texel of an uncompressed texture, three channel formats are expanded to RGBA
+    static std::size_t GetTexelSize(Texture const& texture)
+    {
+        auto dim = texture.GetSize();
+        auto texel_size = texture.GetSizeInBytes() / (static_cast<std::size_t>(dim.x) * dim.y * dim.z);
+        return IsThreeChannelFormat(texture.GetFormat()) ? texel_size / 3 * 4 : texel_size;
+    }
+
+    // Number of texels stored for a level of an uncompressed texture, tiled data is padded to 8x8 tiles.
+    // Has to match TextureData_GetStoredTexelCount in texture.cl.
+    static std::size_t GetStoredTexelCount(int width, int height)
+    {
+#ifdef BAIKAL_TILED_TEXTURES
+        return static_cast<std::size_t>((width + 7) & ~7) * static_cast<std::size_t>((height + 7) & ~7);
+#else
+        return static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+#endif
+    }
+
+    // Size of device texel data of the first level
+    static std::size_t GetTextureDataSize(Texture const& texture)
+    {
+        if (texture.IsCompressed())
+        {
+            return texture.GetSizeInBytes();
+        }
+
+        auto dim = texture.GetSize();
+        return GetTexelSize(texture) * GetStoredTexelCount(dim.x, dim.y) * dim.z;
+    }
+
+    // Size of texel data of all mip levels, see Texture::levels in payload.cl for the layout
+    static std::size_t GetTextureSlotSize(Texture const& texture)
+    {
+        auto size = align16(GetTextureDataSize(texture));
+        auto levels = GetTextureLevelCount(texture);
+
+        if (levels > 1)
+        {
+            auto dim = texture.GetSize();
+            auto texel_size = GetTexelSize(texture);
+
+            for (auto level = 1; level < levels; ++level)
+            {
+                auto width = std::max(dim.x >> level, 1);
+                auto height = std::max(dim.y >> level, 1);
+                size += align16(GetStoredTexelCount(width, height) * texel_size);
+            }
+        }
+
+        return size;
+    }
+
+    // Rough intersector memory per triangle: its own vertex and face copies and BVH nodes
+    static std::size_t const kIntersectorBytesPerTriangle = 128;
+
+    // Largest dimension of the low resolution copies paged out textures are sampled from
+    static int const kTextureFallbackSize = 32;
+
+    // Only 2D textures larger than their low resolution copy are paged by the texture cache
+    static bool IsTextureStreamable(Texture const& texture)
+    {
+        auto dim = texture.GetSize();
+        return dim.z == 1 && std::max(dim.x, dim.y) > kTextureFallbackSize;
+    }
+
+    // Box filtered RGBA32 copy of the texture no larger than kTextureFallbackSize, alpha is set to one
+    static Texture::Ptr CreateTextureFallback(Texture const& texture)
+    {
+        auto dim = texture.GetSize();
+        auto scale = (std::max(dim.x, dim.y) + kTextureFallbackSize - 1) / kTextureFallbackSize;
+        auto width = (dim.x + scale - 1) / scale;
+        auto height = (dim.y + scale - 1) / scale;
+
+        auto data = new char[4 * sizeof(float) * width * height];
+        auto texels = reinterpret_cast<float*>(data);
+
+        for (auto y = 0; y < height; ++y)
+        {
+            auto y0 = y * dim.y / height;
+            auto y1 = std::max((y + 1) * dim.y / height, y0 + 1);
+
+            for (auto x = 0; x < width; ++x)
+            {
+                auto x0 = x * dim.x / width;
+                auto x1 = std::max((x + 1) * dim.x / width, x0 + 1);
+
+                float3 sum(0.f, 0.f, 0.f);
+                for (auto j = y0; j < y1; ++j)
+                {
+                    for (auto i = x0; i < x1; ++i)
+                    {
+                        sum += texture.GetTexel(i, j);
+                    }
+                }
+
+                sum *= 1.f / ((x1 - x0) * (y1 - y0));
+
+                auto texel = texels + 4 * (y * width + x);
+                texel[0] = sum.x;
+                texel[1] = sum.y;
+                texel[2] = sum.z;
+                texel[3] = 1.f;
+            }
+        }
+
+        return Texture::Create(data, int3(width, height, 1), Texture::Format::kRgba32);
+    }
+
+#ifndef BAIKAL_TEXTURE_CONVERSION
+    // RGBA copy of a three channel texture with zero alpha, matches the ExpandTextureChannels kernel
+    static Texture::Ptr ExpandTextureChannels(Texture const& texture)
+    {
+        auto dim = texture.GetSize();
+        auto num_texels = static_cast<std::size_t>(dim.x) * dim.y * dim.z;
+        auto component_size = texture.GetSizeInBytes() / (3 * num_texels);
+
+        auto data = new char[4 * component_size * num_texels];
+        auto src = texture.GetData();
+
+        for (std::size_t i = 0; i < num_texels; ++i)
+        {
+            std::memcpy(data + 4 * component_size * i, src + 3 * component_size * i, 3 * component_size);
+            std::memset(data + 4 * component_size * i + 3 * component_size, 0, component_size);
+        }
+
+        auto format = texture.GetFormat() == Texture::Format::kRgb8 ? Texture::Format::kRgba8 :
+            (texture.GetFormat() == Texture::Format::kRgb16 ? Texture::Format::kRgba16 : Texture::Format::kRgba32);
+
+        return Texture::Create(data, dim, format);
+    }
+#endif
+
+#ifdef BAIKAL_AREA_LIGHT_IMPORTANCE
+    // Textured emission is averaged over kEmissionSamples x kEmissionSamples stratified points of the triangle
+    static const int kEmissionSamples = 4;
+
+    // Luminance of the material emission of an area light triangle, 1 if it can't be evaluated on host
+    static float GetAreaLightEmission(AreaLight const& light)
+    {
+        auto mesh = std::dynamic_pointer_cast<Mesh>(light.GetShape());
+        auto material = mesh ? std::dynamic_pointer_cast<UberV2Material>(mesh->GetMaterial()) : nullptr;
+
+        if (!material)
+        {
+            return 1.f;
+        }
+
+        auto emission = material->GetInputValue("uberv2.emission.color").input_map_value;
+
+        if (!emission)
+        {
+            return 1.f;
+        }
+
+        std::set<Texture::Ptr> textures;
+        emission->CollectTextures(textures);
+
+        RadeonRays::float3 value(1.f, 1.f, 1.f);
+
+        if (textures.empty())
+        {
+            auto constant = CLInputMapGenerator::EvaluateConstant(emission);
+            value = RadeonRays::float3(constant.x, constant.y, constant.z);
+        }
+        else if (emission->m_type == InputMap::InputMapType::kSampler && mesh->GetNumUVs() > 0)
+        {
+            auto texture = std::static_pointer_cast<InputMap_Sampler>(emission)->GetTexture();
+            auto size = texture->GetSize();
+            auto indices = mesh->GetIndices();
+            auto uvs = mesh->GetUVs();
+            auto prim_idx = light.GetPrimitiveIdx();
+
+            auto uv0 = uvs[indices[prim_idx * 3]];
+            auto uv1 = uvs[indices[prim_idx * 3 + 1]];
+            auto uv2 = uvs[indices[prim_idx * 3 + 2]];
+
+            value = RadeonRays::float3(0.f, 0.f, 0.f);
+
+            for (auto i = 0; i < kEmissionSamples; ++i)
+            {
+                for (auto j = 0; j < kEmissionSamples; ++j)
+                {
+                    // Uniform barycentrics, same mapping as AreaLight_Sample
+                    auto r0 = (i + 0.5f) / kEmissionSamples;
+                    auto r1 = (j + 0.5f) / kEmissionSamples;
+                    auto b1 = 1.f - std::sqrt(r0);
+                    auto b2 = std::sqrt(r0) * r1;
+                    auto b0 = 1.f - b1 - b2;
+
+                    // Wrap and flip V the way TextureData_Sample2D does
+                    auto u = b0 * uv0.x + b1 * uv1.x + b2 * uv2.x;
+                    auto v = b0 * uv0.y + b1 * uv1.y + b2 * uv2.y;
+                    u -= std::floor(u);
+                    v = 1.f - (v - std::floor(v));
+
+                    auto x = std::min(static_cast<int>(u * size.x), size.x - 1);
+                    auto y = std::min(static_cast<int>(v * size.y), size.y - 1);
+                    value += texture->GetTexel(static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y));
+                }
+            }
+
+            value *= 1.f / (kEmissionSamples * kEmissionSamples);
+        }
+
+        return std::max(0.2126f * value.x + 0.7152f * value.y + 0.0722f * value.z, 0.f);
+    }
+#endif
+
     static CameraType GetCameraType(Camera& camera)
     {
         auto perspective = dynamic_cast<PerspectiveCamera*>(&camera);
@@ -51,23 +391,83 @@ namespace Baikal
     }
 
 
-    ClwSceneController::ClwSceneController(CLWContext context, RadeonRays::IntersectionApi* api, const CLProgramManager *program_manager)
+    ClwSceneController::ClwSceneController(CLWContext context, RadeonRays::IntersectionApi* api, const CLProgramManager *program_manager,
+                                           RadeonRays::IntersectionApi* background_api)
     : m_context(context)
     , m_api(api)
+    , m_background_api(background_api)
+    , m_current_api(api)
     , m_default_material(UberV2Material::Create())
     , m_program_manager(program_manager)
+    , m_uploader(context)
     {
-        auto acc_type = "fatbvh";
-        auto builder_type = "sah";
-        LogInfo("Configuring acceleration structure: ", acc_type, " with ", builder_type, " builder\n");
-        m_api->SetOption("acc.type", acc_type);
+#if defined(BAIKAL_TEXTURE_MIPMAPS) || defined(BAIKAL_TEXTURE_CONVERSION)
+#ifdef BAIKAL_EMBED_KERNELS
+        m_texture_kernels.reset(new ClwClass(context, program_manager, "texture_mips", g_texture_mips_opencl, g_texture_mips_opencl_headers));
+#else
+        m_texture_kernels.reset(new ClwClass(context, program_manager, "../Baikal/Kernels/CL/texture_mips.cl"));
+#endif
+#endif
+
+        for (auto intersector : { m_api, m_background_api })
+        {
+            if (!intersector)
+            {
+                continue;
+            }
 
 #ifdef ENABLE_RAYMASK
-        m_api->SetOption("bvh.force2level", 1.f);
+            intersector->SetOption("bvh.force2level", 1.f);
 #endif
 
-        m_api->SetOption("bvh.builder", builder_type);
-        m_api->SetOption("bvh.sah.num_bins", 16.f);
+            ApplyIntersectorOptions(intersector, GetAccelerationStructureOptions(m_acceleration_structure, false));
+        }
+    }
+
+    void ClwSceneController::SetAccelerationStructure(AccelerationStructure type)
+    {
+        m_acceleration_structure = type;
+    }
+
+    void ClwSceneController::ApplyIntersectorOptions(RadeonRays::IntersectionApi* api, AccelerationStructureOptions const& options) const
+    {
+        auto current = m_intersector_options.find(api);
+        if (current != m_intersector_options.cend() && options == current->second)
+        {
+            return;
+        }
+
+        LogInfo("Configuring acceleration structure: ", options.type, " with ", options.builder, " builder\n");
+        api->SetOption("acc.type", options.type.c_str());
+        api->SetOption("bvh.builder", options.builder.c_str());
+        api->SetOption("bvh.sah.num_bins", options.num_bins);
+        api->SetOption("bvh.sah.use_splits", options.use_splits ? 1.f : 0.f);
+
+        m_intersector_options[api] = options;
+    }
+
+    void ClwSceneController::CommitIntersector(ClwScene& scene) const
+    {
+        auto api = GetSceneIntersector(scene);
+
+        scene.acceleration_structure = ChooseAccelerationStructure(m_acceleration_structure, scene.intersector_triangles, scene.shapes_edited);
+        ApplyIntersectorOptions(api, GetAccelerationStructureOptions(scene.acceleration_structure, scene.intersector_two_level));
+
+        api->Commit();
+    }
+
+    RadeonRays::IntersectionApi* ClwSceneController::GetSceneIntersector(ClwScene& scene) const
+    {
+        if (!scene.intersector)
+        {
+            // Compiles on the render thread go to the primary intersector. Background ones take the
+            // intersector not being rendered with, so the whole build can run on the worker.
+            // Current intersector only changes under the compile lock, which the worker holds
+            auto use_background = IsCompilingInBackground() && m_background_api;
+            scene.intersector = use_background && m_current_api == m_api ? m_background_api : m_api;
+        }
+
+        return scene.intersector;
     }
 
     Material::Ptr ClwSceneController::GetDefaultMaterial() const
@@ -77,6 +477,180 @@ namespace Baikal
 
     ClwSceneController::~ClwSceneController()
     {
+        // Background compiles use the context and the intersector
+        WaitForPendingCompiles();
+
+        // Scene objects outlive the pools
+        RestoreHostData();
+    }
+
+    // Indices of small meshes are stored in 16 bits with compressed geometry
+    static bool UsesShortIndices(Mesh const& mesh)
+    {
+#ifdef BAIKAL_COMPRESSED_GEOMETRY
+        return GeometryCompression::CanUseShortIndices(mesh.GetNumVertices());
+#else
+        (void)mesh;
+        return false;
+#endif
+    }
+
+    // Size of mesh indices in indices buffer elements
+    static std::size_t GetIndexStorageSize(Mesh const& mesh)
+    {
+        return GeometryCompression::GetIndexStorageSize(mesh.GetNumIndices(), UsesShortIndices(mesh));
+    }
+
+    // Allocated size of the buffer, unallocated buffers have no elements
+    template <typename T>
+    static std::size_t GetBufferBytes(CLWBuffer<T> const& buffer)
+    {
+        return buffer.GetElementCount() * sizeof(T);
+    }
+
+    // Shape flags of curves, they are kept by geometry residency changes
+    static int GetCurveFlags(Mesh const& mesh)
+    {
+        auto curves = dynamic_cast<Curves const*>(&mesh);
+
+        if (!curves)
+        {
+            return 0;
+        }
+
+        return ClwScene::kShapeCurves | (curves->GetBasis() == Curves::Basis::kBSpline ? ClwScene::kShapeBSplineCurves : 0);
+    }
+
+    // Instance transforms are affine, so only 3 rows are stored
+    // Rigid shape motion over the shutter interval: linear velocity moves the shape origin,
+    // angular velocity is the (x, y, z, w) quaternion rotating shape axes from shutter open to close
+    static void GetShapeMotion(Shape const& shape, RadeonRays::float3& linear_velocity, RadeonRays::float4& angular_velocity)
+    {
+        linear_velocity = float3(0.f, 0.f, 0.f);
+        angular_velocity = float4(0.f, 0.f, 0.f, 1.f);
+
+#ifdef BAIKAL_MOTION_BLUR
+        if (!shape.HasMotion())
+        {
+            return;
+        }
+
+        auto open = shape.GetTransform();
+        auto close = shape.GetMotionTransform();
+        linear_velocity = float3(close.m03 - open.m03, close.m13 - open.m13, close.m23 - open.m23);
+
+        // Rotation taking shutter open axes to shutter close ones
+        open.m03 = open.m13 = open.m23 = 0.f;
+        close.m03 = close.m13 = close.m23 = 0.f;
+        auto r = close * inverse(open);
+
+        float trace = r.m00 + r.m11 + r.m22;
+        float4 q;
+
+        if (trace > 0.f)
+        {
+            float s = 0.5f / std::sqrt(trace + 1.f);
+            q = float4((r.m21 - r.m12) * s, (r.m02 - r.m20) * s, (r.m10 - r.m01) * s, 0.25f / s);
+        }
+        else if (r.m00 > r.m11 && r.m00 > r.m22)
+        {
+            float s = 2.f * std::sqrt(1.f + r.m00 - r.m11 - r.m22);
+            q = float4(0.25f * s, (r.m01 + r.m10) / s, (r.m02 + r.m20) / s, (r.m21 - r.m12) / s);
+        }
+        else if (r.m11 > r.m22)
+        {
+            float s = 2.f * std::sqrt(1.f + r.m11 - r.m00 - r.m22);
+            q = float4((r.m01 + r.m10) / s, 0.25f * s, (r.m12 + r.m21) / s, (r.m02 - r.m20) / s);
+        }
+        else
+        {
+            float s = 2.f * std::sqrt(1.f + r.m22 - r.m00 - r.m11);
+            q = float4((r.m02 + r.m20) / s, (r.m12 + r.m21) / s, 0.25f * s, (r.m10 - r.m01) / s);
+        }
+
+        float length = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+        angular_velocity = length > 0.f ? (1.f / length) * q : float4(0.f, 0.f, 0.f, 1.f);
+#else
+        (void)shape;
+#endif
+    }
+
+    // Set intersector shape transform, moving shapes are intersected at the time carried by rays
+    static void SetIntersectorTransform(RadeonRays::Shape* rr_shape, Shape const& shape)
+    {
+        auto transform = shape.GetTransform();
+        rr_shape->SetTransform(transform, inverse(transform));
+
+#ifdef BAIKAL_MOTION_BLUR
+        float3 linear_velocity;
+        float4 angular_velocity;
+        GetShapeMotion(shape, linear_velocity, angular_velocity);
+        rr_shape->SetLinearVelocity(linear_velocity);
+        rr_shape->SetAngularVelocity(quaternion(angular_velocity.x, angular_velocity.y, angular_velocity.z, angular_velocity.w));
+#endif
+    }
+
+    // Create intersector shape from mesh positions, intersector keeps its own copy of them
+    static RadeonRays::Shape* CreateIntersectorMesh(RadeonRays::IntersectionApi* api, Mesh const& mesh)
+    {
+        return api->CreateMesh(
+                               // Vertices starting from the first one
+                               (float*)mesh.GetVertices(),
+                               // Number of vertices
+                               static_cast<int>(mesh.GetNumVertices()),
+                               // Stride
+                               sizeof(float3),
+                               // TODO: make API signature const
+                               reinterpret_cast<int const*>(mesh.GetIndices()),
+                               // Index stride
+                               0,
+                               // All triangles
+                               nullptr,
+                               // Number of primitives
+                               static_cast<int>(mesh.GetNumIndices() / 3)
+                               );
+    }
+
+    static void WriteInstanceTransform(RadeonRays::matrix const& transform, RadeonRays::float4* rows)
+    {
+        rows[0] = { transform.m00, transform.m01, transform.m02, transform.m03 };
+        rows[1] = { transform.m10, transform.m11, transform.m12, transform.m13 };
+        rows[2] = { transform.m20, transform.m21, transform.m22, transform.m23 };
+    }
+
+    // Upload elements of the host copy at the given indices, stride buffer elements per index.
+    // Runs of close indices go as a single write, small gaps are uploaded along
+    template <typename T>
+    static void UploadElements(ClwUploader& uploader, ClwUploader::Category category, CLWBuffer<T> buffer,
+        std::vector<T> const& data, std::size_t stride, std::vector<std::uint32_t>& indices)
+    {
+        std::size_t constexpr kMaxGap = 64;
+
+        if (indices.empty())
+        {
+            return;
+        }
+
+        std::sort(indices.begin(), indices.end());
+
+        std::size_t begin = indices[0];
+        std::size_t end = begin + 1;
+        for (std::size_t i = 1; i <= indices.size(); ++i)
+        {
+            if (i < indices.size() && indices[i] <= end + kMaxGap)
+            {
+                end = std::max<std::size_t>(end, indices[i] + 1);
+                continue;
+            }
+
+            uploader.Write(category, buffer, data.data() + begin * stride, (end - begin) * stride, begin * stride);
+
+            if (i < indices.size())
+            {
+                begin = indices[i];
+                end = begin + 1;
+            }
+        }
     }
 
     static void SplitMeshesAndInstances(Iterator& shape_iter, std::set<Mesh::Ptr>& meshes, std::set<Instance::Ptr>& instances, std::set<Mesh::Ptr>& excluded_meshes)
@@ -166,21 +740,17 @@ namespace Baikal
 
     void ClwSceneController::UpdateIntersector(Scene1 const& scene, ClwScene& out) const
     {
-        // Detach and delete all shapes
-        for (auto& shape : out.isect_shapes)
-        {
-            m_api->DetachShape(shape);
-            m_api->DeleteShape(shape);
-        }
-
-        // Clear shapes cache
+        // Serialized order changes with every added or removed shape, so slots are rebuilt,
+        // while intersector shapes are taken over from the previous compile where possible
+        out.shapes_edited = out.shapes_edited || !out.intersector_shapes.empty();
         out.isect_shapes.clear();
         // Only visible shapes are attached to the API.
         // So excluded meshes are pushed into isect_shapes, but
         // not to visible_shapes.
         out.visible_shapes.clear();
+        out.shape_slots.clear();
+        out.excluded_meshes.clear();
 
-        // Create new shapes
         auto shape_iter = scene.CreateShapeIterator();
 
         if (!shape_iter->IsValid())
@@ -196,137 +766,145 @@ namespace Baikal
         std::set<Instance::Ptr> instances;
         SplitMeshesAndInstances(*shape_iter, meshes, instances, excluded_meshes);
 
-        // Keep shape->rr shape association for
-        // instance base shape lookup.
-        std::map<Shape::Ptr, RadeonRays::Shape*> rr_shapes;
+        // Curves are intersected by the renderer, the intersector only sees triangle meshes
+        out.intersector_triangles = 0;
+        for (auto const& mesh : meshes)
+        {
+            out.intersector_triangles += GetCurveFlags(*mesh) ? 0 : mesh->GetNumIndices() / 3;
+        }
 
-        // Start from ID 1
-        // Handle meshes
-        int id = 1;
-        for (auto& iter : meshes)
+        for (auto const& mesh : excluded_meshes)
         {
-            auto mesh = iter;
+            out.intersector_triangles += mesh->GetNumIndices() / 3;
+        }
+
+#ifdef ENABLE_RAYMASK
+        out.intersector_two_level = true;
+#else
+        out.intersector_two_level = !instances.empty();
+#endif
 
-            auto shape = m_api->CreateMesh(
-                                           // Vertices starting from the first one
-                                           (float*)mesh->GetVertices(),
-                                           // Number of vertices
-                                           static_cast<int>(mesh->GetNumVertices()),
-                                           // Stride
-                                           sizeof(float3),
-                                           // TODO: make API signature const
-                                           reinterpret_cast<int const*>(mesh->GetIndices()),
-                                           // Index stride
-                                           0,
-                                           // All triangles
-                                           nullptr,
-                                           // Number of primitives
-                                           static_cast<int>(mesh->GetNumIndices() / 3)
-                                           );
+        auto api = GetSceneIntersector(out);
 
-            auto transform = mesh->GetTransform();
-            shape->SetTransform(transform, inverse(transform));
-            shape->SetId(id++);
-            shape->SetMask(iter->GetVisibilityMask());
+        auto previous_shapes = std::move(out.intersector_shapes);
+        out.intersector_shapes.clear();
 
-            out.isect_shapes.push_back(shape);
-            out.visible_shapes.push_back(shape);
-            rr_shapes[mesh] = shape;
-        }
+        // Replaced and removed shapes, deleted once nothing refers to them
+        std::vector<ClwScene::IntersectorShape> stale_shapes;
 
-        // Handle excluded meshes
-        for (auto& iter : excluded_meshes)
+        auto get_mesh_shape = [api, &previous_shapes, &stale_shapes, &out](Mesh::Ptr const& mesh)
         {
-            auto mesh = iter;
+            auto revision = mesh->GetGeometryRevision();
+            auto iter = previous_shapes.find(mesh);
 
-            auto shape = m_api->CreateMesh(
-                                           // Vertices starting from the first one
-                                           (float*)mesh->GetVertices(),
-                                           // Number of vertices
-                                           static_cast<int>(mesh->GetNumVertices()),
-                                           // Stride
-                                           sizeof(float3),
-                                           // TODO: make API signature const
-                                           reinterpret_cast<int const*>(mesh->GetIndices()),
-                                           // Index stride
-                                           0,
-                                           // All triangles
-                                           nullptr,
-                                           // Number of primitives
-                                           static_cast<int>(mesh->GetNumIndices() / 3)
-                                           );
-
-            auto transform = mesh->GetTransform();
-            shape->SetTransform(transform, inverse(transform));
-            shape->SetId(id++);
-            out.isect_shapes.push_back(shape);
-            rr_shapes[mesh] = shape;
-        }
+            if (iter != previous_shapes.end())
+            {
+                auto previous = iter->second;
+                previous_shapes.erase(iter);
 
-        // Handle instances
-        for (auto& iter: instances)
+                if (previous.revision == revision)
+                {
+                    out.intersector_shapes[mesh] = previous;
+                    return previous.shape;
+                }
+
+                stale_shapes.push_back(previous);
+            }
+
+            auto shape = CreateIntersectorMesh(api, *mesh);
+            out.intersector_shapes[mesh] = ClwScene::IntersectorShape{ shape, revision, nullptr };
+            return shape;
+        };
+
+        // Start from ID 1
+        // Handle meshes
+        int id = 1;
+        for (auto& mesh : meshes)
         {
-            auto instance = iter;
-            auto rr_mesh = rr_shapes[instance->GetBaseShape()];
-            auto shape = m_api->CreateInstance(rr_mesh);
+            // Curves keep their slot without intersector shape, so ids of the rest stay shape indices
+            if (GetCurveFlags(*mesh))
+            {
+                ++id;
+                out.shape_slots[mesh.get()] = static_cast<std::uint32_t>(out.isect_shapes.size());
+                out.isect_shapes.push_back(nullptr);
+                continue;
+            }
+
+            auto shape = get_mesh_shape(mesh);
 
-            auto transform = instance->GetTransform();
-            shape->SetTransform(transform, inverse(transform));
+            SetIntersectorTransform(shape, *mesh);
             shape->SetId(id++);
+            shape->SetMask(mesh->GetVisibilityMask());
+
+            out.shape_slots[mesh.get()] = static_cast<std::uint32_t>(out.isect_shapes.size());
             out.isect_shapes.push_back(shape);
             out.visible_shapes.push_back(shape);
         }
-    }
 
-    void ClwSceneController::UpdateIntersectorTransforms(Scene1 const& scene, ClwScene& out) const
-    {
-        // Create new shapes
-        auto shape_iter = scene.CreateShapeIterator();
-
-        if (!shape_iter->IsValid())
+        // Handle excluded meshes
+        for (auto& mesh : excluded_meshes)
         {
-            throw std::runtime_error("No shapes in the scene");
+            auto shape = get_mesh_shape(mesh);
+
+            SetIntersectorTransform(shape, *mesh);
+            shape->SetId(id++);
+            out.shape_slots[mesh.get()] = static_cast<std::uint32_t>(out.isect_shapes.size());
+            out.excluded_meshes.push_back(mesh.get());
+            out.isect_shapes.push_back(shape);
         }
 
-        // Split all shapes into meshes and instances sets.
-        std::set<Mesh::Ptr> meshes;
-        // Excluded shapes are shapes which are not in the scene,
-        // but references by at least one instance.
-        std::set<Mesh::Ptr> excluded_meshes;
-        std::set<Instance::Ptr> instances;
-        SplitMeshesAndInstances(*shape_iter, meshes, instances, excluded_meshes);
+        // Handle instances, the ones of recreated base meshes are recreated as well
+        for (auto& instance : instances)
+        {
+            auto rr_mesh = out.intersector_shapes[instance->GetBaseShape()].shape;
+            RadeonRays::Shape* shape = nullptr;
 
-        auto rr_iter = out.isect_shapes.begin();
+            auto iter = previous_shapes.find(instance);
+            if (iter != previous_shapes.end())
+            {
+                if (iter->second.base == rr_mesh)
+                {
+                    shape = iter->second.shape;
+                }
+                else
+                {
+                    stale_shapes.push_back(iter->second);
+                }
 
-        // Start from ID 1
-        // Handle meshes
-        for (auto& iter : meshes)
-        {
-            auto mesh = iter;
-            auto transform = mesh->GetTransform();
-            (*rr_iter)->SetTransform(transform, inverse(transform));
-            ++rr_iter;
+                previous_shapes.erase(iter);
+            }
+
+            if (!shape)
+            {
+                shape = api->CreateInstance(rr_mesh);
+            }
+
+            out.intersector_shapes[instance] = ClwScene::IntersectorShape{ shape, 0u, rr_mesh };
+
+            SetIntersectorTransform(shape, *instance);
+            shape->SetId(id++);
+            out.shape_slots[instance.get()] = static_cast<std::uint32_t>(out.isect_shapes.size());
+            out.isect_shapes.push_back(shape);
+            out.visible_shapes.push_back(shape);
         }
 
-        // Handle excluded meshes
-        for (auto& iter : excluded_meshes)
+        // Shapes left are not in the scene anymore
+        for (auto& previous : previous_shapes)
         {
-            auto mesh = iter;
-            auto transform = mesh->GetTransform();
-            (*rr_iter)->SetTransform(transform, inverse(transform));
-            ++rr_iter;
+            stale_shapes.push_back(previous.second);
         }
 
-        // Handle instances
-        for (auto& iter : instances)
+        // Instances go before the meshes they refer to
+        std::stable_partition(stale_shapes.begin(), stale_shapes.end(), [](ClwScene::IntersectorShape const& s)
         {
-            auto instance = iter;
-            auto transform = instance->GetTransform();
-            (*rr_iter)->SetTransform(transform, inverse(transform));
-            ++rr_iter;
-        }
+            return s.base != nullptr;
+        });
 
-        m_api->Commit();
+        for (auto& stale : stale_shapes)
+        {
+            api->DetachShape(stale.shape);
+            api->DeleteShape(stale.shape);
+        }
     }
 
     void ClwSceneController::UpdateCamera(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, Collector& vol_collector, ClwScene& out) const
@@ -334,57 +912,64 @@ namespace Baikal
         // TODO: support different camera types here
         auto camera = scene.GetCamera();
 
-        // Create light buffer if needed
-        if (out.camera.GetElementCount() == 0)
+        // Driver orders a write after the kernels using its buffer, so every update moves to the next slot
+        if (out.camera_ring.size() != kCameraRingSize)
+        {
+            out.camera_ring.resize(kCameraRingSize);
+
+            for (auto& slot : out.camera_ring)
+            {
+                slot = m_context.CreateBuffer<ClwScene::Camera>(1, CL_MEM_READ_ONLY);
+            }
+
+            out.camera_slot = 0;
+        }
+        else
         {
-            out.camera = m_context.CreateBuffer<ClwScene::Camera>(1, CL_MEM_READ_ONLY);
+            out.camera_slot = (out.camera_slot + 1) % kCameraRingSize;
         }
 
         // TODO: remove this
         out.camera_type = GetCameraType(*camera);
 
         // Update camera data
-        ClwScene::Camera* data = nullptr;
-
-        // Map GPU camera buffer
-        m_context.MapBuffer(0, out.camera, CL_MAP_WRITE, &data).Wait();
+        ClwScene::Camera data;
 
         // Copy camera parameters
-        data->forward = camera->GetForwardVector();
-        data->up = camera->GetUpVector();
-        data->right = camera->GetRightVector();
-        data->p = camera->GetPosition();
-        data->aspect_ratio = camera->GetAspectRatio();
-        data->dim = camera->GetSensorSize();
-        data->zcap = camera->GetDepthRange();
+        data.forward = camera->GetForwardVector();
+        data.up = camera->GetUpVector();
+        data.right = camera->GetRightVector();
+        data.p = camera->GetPosition();
+        data.motion_forward = camera->GetMotionForwardVector();
+        data.motion_up = camera->GetMotionUpVector();
+        data.motion_right = camera->GetMotionRightVector();
+        data.motion_p = camera->GetMotionPosition();
+        data.aspect_ratio = camera->GetAspectRatio();
+        data.dim = camera->GetSensorSize();
+        data.zcap = camera->GetDepthRange();
+        data.num_views = static_cast<int>(camera->GetNumViews());
+        data.view_separation = camera->GetViewSeparation();
 
         if (out.camera_type == CameraType::kPerspective ||
             out.camera_type == CameraType::kPhysicalPerspective)
         {
             auto physical_camera = std::static_pointer_cast<PerspectiveCamera>(camera);
-            data->aperture = physical_camera->GetAperture();
-            data->focal_length = physical_camera->GetFocalLength();
-            data->focus_distance = physical_camera->GetFocusDistance();
+            data.aperture = physical_camera->GetAperture();
+            data.focal_length = physical_camera->GetFocalLength();
+            data.focus_distance = physical_camera->GetFocusDistance();
         }
 
-        // Unmap camera buffer
-        m_context.UnmapBuffer(0, out.camera, data);
+        out.camera = out.camera_ring[out.camera_slot];
+        m_uploader.Write(ClwUploader::Category::kCamera, out.camera, &data, 1);
+        out.camera_revision = ++s_camera_revision;
 
         // Update volume index
         out.camera_volume_index = GetVolumeIndex(vol_collector, camera->GetVolume());
+        out.camera_num_views = data.num_views;
     }
 
     void ClwSceneController::UpdateShapes(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, Collector& vol_collector, ClwScene& out) const
     {
-        std::size_t num_vertices = 0;
-        std::size_t num_normals = 0;
-        std::size_t num_uvs = 0;
-        std::size_t num_indices = 0;
-
-        std::size_t num_vertices_written = 0;
-        std::size_t num_normals_written = 0;
-        std::size_t num_uvs_written = 0;
-        std::size_t num_indices_written = 0;
         std::size_t num_shapes_written = 0;
 
         auto shape_iter = scene.CreateShapeIterator();
@@ -397,163 +982,273 @@ namespace Baikal
         std::set<Instance::Ptr> instances;
         SplitMeshesAndInstances(*shape_iter, meshes, instances, excluded_meshes);
 
-        // Calculate GPU array sizes. Do that only for meshes,
-        // since instances do not occupy space in vertex buffers.
-        // However instances still have their own material ids.
-        for (auto& iter : meshes)
+        // Curves are intersected in object space of their own shape only
+        for (auto const& instance : instances)
         {
-            auto mesh = iter;
-
-            num_vertices += mesh->GetNumVertices();
-            num_normals += mesh->GetNumNormals();
-            num_uvs += mesh->GetNumUVs();
-            num_indices += mesh->GetNumIndices();
+            if (GetCurveFlags(*std::static_pointer_cast<Mesh>(instance->GetBaseShape())))
+            {
+                throw std::runtime_error("ClwSceneController::UpdateShapes(...): curves can not be instanced");
+            }
         }
 
-        // Excluded meshes still occupy space in vertex buffers.
-        for (auto& iter : excluded_meshes)
-        {
-            auto mesh = iter;
+        // Excluded meshes still occupy space in vertex buffers,
+        // they go after scene meshes (same order as in the intersector).
+        std::vector<Mesh::Ptr> geometry_meshes(meshes.begin(), meshes.end());
+        geometry_meshes.insert(geometry_meshes.end(), excluded_meshes.begin(), excluded_meshes.end());
 
-            num_vertices += mesh->GetNumVertices();
-            num_normals += mesh->GetNumNormals();
-            num_uvs += mesh->GetNumUVs();
-            num_indices += mesh->GetNumIndices();
+        // Drop references to geometry of meshes which have left the scene
+        for (auto iter = out.geometry_ranges.begin(); iter != out.geometry_ranges.end();)
+        {
+            if (meshes.find(iter->first) == meshes.cend() &&
+                excluded_meshes.find(iter->first) == excluded_meshes.cend())
+            {
+                m_resources.ReleaseGeometry(iter->first, iter->second.revision);
+                iter = out.geometry_ranges.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
         }
 
-        // Instances only occupy material IDs space.
-        for (auto& iter : instances)
+        for (auto iter = out.geometry_last_used.begin(); iter != out.geometry_last_used.end();)
         {
-            auto instance = iter;
-            auto mesh = std::static_pointer_cast<Mesh>(instance->GetBaseShape());
+            if (meshes.find(iter->first) == meshes.cend() &&
+                excluded_meshes.find(iter->first) == excluded_meshes.cend())
+            {
+                iter = out.geometry_last_used.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
         }
 
-        LogInfo("Creating vertex buffer...\n");
-        // Create CL arrays
-        out.vertices = m_context.CreateBuffer<float3>(num_vertices, CL_MEM_READ_ONLY);
+        // Find meshes which are new or have been edited since the last upload.
+        // Edited meshes are rewritten in place as long as their sizes stay the same
+        // and no other compiled scene uses the old geometry. Geometry already uploaded
+        // for another scene is referenced instead of being uploaded again.
+        std::vector<Mesh::Ptr> pending_upload;
+        std::vector<Mesh::Ptr> pending_allocation;
 
-        LogInfo("Creating normal buffer...\n");
-        out.normals = m_context.CreateBuffer<float3>(num_normals, CL_MEM_READ_ONLY);
+        for (auto& mesh : geometry_meshes)
+        {
+            auto revision = mesh->GetGeometryRevision();
+            auto iter = out.geometry_ranges.find(mesh);
 
-        LogInfo("Creating UV buffer...\n");
-        out.uvs = m_context.CreateBuffer<float2>(num_uvs, CL_MEM_READ_ONLY);
+            if (iter != out.geometry_ranges.end())
+            {
+                auto& range = iter->second;
 
-        LogInfo("Creating index buffer...\n");
-        out.indices = m_context.CreateBuffer<int>(num_indices, CL_MEM_READ_ONLY);
+                if (range.revision == revision)
+                {
+                    continue;
+                }
 
-        // Total number of entries in shapes GPU array
-        auto num_shapes = meshes.size() + excluded_meshes.size() + instances.size();
-        out.shapes = m_context.CreateBuffer<ClwScene::Shape>(num_shapes, CL_MEM_READ_ONLY);
-        out.shapes_additional = m_context.CreateBuffer<ClwScene::ShapeAdditionalData>(num_shapes, CL_MEM_READ_ONLY);
+                if (range.vertex_count == mesh->GetNumVertices() && range.index_count == GetIndexStorageSize(*mesh) &&
+                    m_resources.IsGeometryExclusive(mesh, range.revision) &&
+                    m_resources.geometry.find(std::make_pair(mesh, revision)) == m_resources.geometry.cend())
+                {
+                    m_resources.RenameGeometry(mesh, range.revision, revision);
+                    range.revision = revision;
+                    pending_upload.push_back(mesh);
+                    continue;
+                }
 
-        float3* vertices = nullptr;
-        float3* normals = nullptr;
-        float2* uvs = nullptr;
-        int* indices = nullptr;
-        ClwScene::Shape* shapes = nullptr;
-        ClwScene::ShapeAdditionalData* shapes_additional = nullptr;
+                m_resources.ReleaseGeometry(mesh, range.revision);
+                out.geometry_ranges.erase(iter);
+            }
 
-        // Map arrays and prepare to write data
-        LogInfo("Mapping buffers...\n");
-        m_context.MapBuffer(0, out.vertices, CL_MAP_WRITE, &vertices);
-        m_context.MapBuffer(0, out.normals, CL_MAP_WRITE, &normals);
-        m_context.MapBuffer(0, out.uvs, CL_MAP_WRITE, &uvs);
-        m_context.MapBuffer(0, out.indices, CL_MAP_WRITE, &indices);
-        m_context.MapBuffer(0, out.shapes, CL_MAP_WRITE, &shapes).Wait();
-        m_context.MapBuffer(0, out.shapes_additional, CL_MAP_WRITE, &shapes_additional).Wait();
+            if (auto shared = m_resources.AcquireGeometry(mesh, revision))
+            {
+                out.geometry_ranges[mesh] = *shared;
+                continue;
+            }
 
-        // Keep associated shapes data for instance look up.
-        // We retrieve data from here while serializing instances,
-        // using base shape lookup.
-        std::map<Mesh::Ptr, ClwScene::Shape> shape_data;
+            pending_allocation.push_back(mesh);
+            pending_upload.push_back(mesh);
+        }
 
-        // Handle meshes
-        //int shape_id = 0;
-        for (auto& iter : meshes)
+        // Geometry cache buffers have fixed size, meshes are placed as long as they fit
+        // and the rest is paged in by UpdateGeometryResidency once rays hit it
+        if (IsGeometryCacheEnabled())
         {
-            auto mesh = iter;
+            // Cache buffers are shared by all scenes, they are only recreated once nothing references them
+            if (m_resources.vertices.GetElementCount() == 0 ||
+                (m_resources.geometry.empty() && m_resources.vertex_allocator.GetCapacity() != m_geometry_cache_vertices))
+            {
+                LogInfo("Creating geometry cache buffers...\n");
+                m_resources.vertices = m_context.CreateBuffer<float3>(m_geometry_cache_vertices, CL_MEM_READ_ONLY);
+                m_resources.normals = m_context.CreateBuffer<ClwScene::NormalData>(m_geometry_cache_vertices, CL_MEM_READ_ONLY);
+                m_resources.uvs = m_context.CreateBuffer<ClwScene::UVData>(m_geometry_cache_vertices, CL_MEM_READ_ONLY);
+                m_resources.tangents = m_context.CreateBuffer<std::uint32_t>(GetTangentPoolSize(m_geometry_cache_vertices), CL_MEM_READ_ONLY);
+                m_resources.indices = m_context.CreateBuffer<int>(m_geometry_cache_indices, CL_MEM_READ_ONLY);
+                m_resources.vertex_allocator.Reset(m_geometry_cache_vertices);
+                m_resources.index_allocator.Reset(m_geometry_cache_indices);
+                RebindSharedBuffers();
+            }
 
-            // Get pointers data
-            auto mesh_vertex_array = mesh->GetVertices();
-            auto mesh_num_vertices = mesh->GetNumVertices();
+            m_resources.BindGeometry(out);
 
-            auto mesh_normal_array = mesh->GetNormals();
-            auto mesh_num_normals = mesh->GetNumNormals();
+            for (auto& mesh : pending_allocation)
+            {
+                AllocateCachedGeometry(mesh, out);
+                out.geometry_last_used.emplace(mesh, out.geometry_frame);
+            }
 
-            auto mesh_uv_array = mesh->GetUVs();
-            auto mesh_num_uvs = mesh->GetNumUVs();
+            pending_allocation.clear();
 
-            auto mesh_index_array = mesh->GetIndices();
-            auto mesh_num_indices = mesh->GetNumIndices();
+            pending_upload.erase(std::remove_if(pending_upload.begin(), pending_upload.end(),
+                [&out](Mesh::Ptr const& mesh) { return out.geometry_ranges.find(mesh) == out.geometry_ranges.cend(); }),
+                pending_upload.end());
+        }
 
-            // Prepare shape descriptor
-            ClwScene::Shape shape;
+        // Allocate ranges for new meshes, remember how much space is missing
+        std::size_t missing_vertices = 0;
+        std::size_t missing_indices = 0;
 
-            shape.id = iter->GetId();
+        for (auto& mesh : pending_allocation)
+        {
+            ClwScene::GeometryRange range;
+            range.vertex_count = mesh->GetNumVertices();
+            range.index_count = GetIndexStorageSize(*mesh);
+            range.short_indices = UsesShortIndices(*mesh);
+            range.vertex_offset = m_resources.vertex_allocator.Allocate(range.vertex_count);
+            range.index_offset = m_resources.index_allocator.Allocate(range.index_count);
+            range.revision = mesh->GetGeometryRevision();
+
+            if (range.vertex_offset == RangeAllocator::kInvalidOffset)
+            {
+                missing_vertices += range.vertex_count;
+            }
 
-            shape.startvtx = static_cast<int>(num_vertices_written);
-            shape.startidx = static_cast<int>(num_indices_written);
+            if (range.index_offset == RangeAllocator::kInvalidOffset)
+            {
+                missing_indices += range.index_count;
+            }
 
-            auto transform = mesh->GetTransform();
-            shape.transform.m0 = { transform.m00, transform.m01, transform.m02, transform.m03 };
-            shape.transform.m1 = { transform.m10, transform.m11, transform.m12, transform.m13 };
-            shape.transform.m2 = { transform.m20, transform.m21, transform.m22, transform.m23 };
-            shape.transform.m3 = { transform.m30, transform.m31, transform.m32, transform.m33 };
+            out.geometry_ranges[mesh] = range;
+        }
 
-            shape.linearvelocity = float3(0.0f, 0.f, 0.f);
-            shape.angularvelocity = float3(0.f, 0.f, 0.f, 1.f);
-            shape.material.offset = GetMaterialIndex(mat_collector, mesh->GetMaterial());
-            shape.material.layers = GetMaterialLayers(mesh->GetMaterial());
+        // Grow geometry buffers if needed. Existing content is copied on the device,
+        // so it does not count as uploaded. Some headroom is kept to make
+        // several consecutive additions cheap.
+        bool pools_recreated = false;
 
-            shape.volume_idx = GetVolumeIndex(vol_collector, mesh->GetVolumeMaterial());
+        if (missing_vertices > 0 || m_resources.vertices.GetElementCount() == 0)
+        {
+            auto capacity = m_resources.vertex_allocator.GetCapacity();
+            auto new_capacity = std::max<std::size_t>(capacity + std::max(missing_vertices, capacity / 4), 1u);
 
-            shape_data[mesh] = shape;
+            LogInfo("Creating vertex, normal and UV buffers...\n");
+            auto vertices = m_context.CreateBuffer<float3>(new_capacity, CL_MEM_READ_ONLY);
+            auto normals = m_context.CreateBuffer<ClwScene::NormalData>(new_capacity, CL_MEM_READ_ONLY);
+            auto uvs = m_context.CreateBuffer<ClwScene::UVData>(new_capacity, CL_MEM_READ_ONLY);
+            auto tangents = m_context.CreateBuffer<std::uint32_t>(GetTangentPoolSize(new_capacity), CL_MEM_READ_ONLY);
 
-            std::copy(mesh_vertex_array, mesh_vertex_array + mesh_num_vertices, vertices + num_vertices_written);
-            num_vertices_written += mesh_num_vertices;
+            if (capacity > 0)
+            {
+                m_context.CopyBuffer(0u, m_resources.vertices, vertices, 0, 0, capacity);
+                m_context.CopyBuffer(0u, m_resources.normals, normals, 0, 0, capacity);
+                m_context.CopyBuffer(0u, m_resources.uvs, uvs, 0, 0, capacity);
+                m_context.CopyBuffer(0u, m_resources.tangents, tangents, 0, 0, GetTangentPoolSize(capacity));
+            }
 
-            std::copy(mesh_normal_array, mesh_normal_array + mesh_num_normals, normals + num_normals_written);
-            num_normals_written += mesh_num_normals;
+            m_resources.vertices = vertices;
+            m_resources.normals = normals;
+            m_resources.uvs = uvs;
+            m_resources.tangents = tangents;
+            m_resources.vertex_allocator.Grow(new_capacity);
+            pools_recreated = true;
+        }
 
-            std::copy(mesh_uv_array, mesh_uv_array + mesh_num_uvs, uvs + num_uvs_written);
-            num_uvs_written += mesh_num_uvs;
+        if (missing_indices > 0 || m_resources.indices.GetElementCount() == 0)
+        {
+            auto capacity = m_resources.index_allocator.GetCapacity();
+            auto new_capacity = std::max<std::size_t>(capacity + std::max(missing_indices, capacity / 4), 1u);
 
-            std::copy(mesh_index_array, mesh_index_array + mesh_num_indices, indices + num_indices_written);
-            num_indices_written += mesh_num_indices;
+            LogInfo("Creating index buffer...\n");
+            auto indices = m_context.CreateBuffer<int>(new_capacity, CL_MEM_READ_ONLY);
 
-            shapes[num_shapes_written] = shape;
+            if (capacity > 0)
+            {
+                m_context.CopyBuffer(0u, m_resources.indices, indices, 0, 0, capacity);
+            }
 
-            ClwScene::ShapeAdditionalData shape_additional;
-            shape_additional.group_id = mesh->GetGroupId();
-            shapes_additional[num_shapes_written++] = shape_additional;
+            m_resources.indices = indices;
+            m_resources.index_allocator.Grow(new_capacity);
+            pools_recreated = true;
         }
 
-        // Excluded shapes are handled in almost the same way
-        // except materials.
-        for (auto& iter : excluded_meshes)
+        if (pools_recreated)
         {
-            auto mesh = iter;
+            RebindSharedBuffers();
+        }
+
+        m_resources.BindGeometry(out);
+
+        // Place meshes which did not fit. Buffers have been grown by the total missing
+        // size, so the free tail is large enough for all of them.
+        for (auto& mesh : pending_allocation)
+        {
+            auto& range = out.geometry_ranges[mesh];
+
+            if (range.vertex_offset == RangeAllocator::kInvalidOffset)
+            {
+                range.vertex_offset = m_resources.vertex_allocator.Allocate(range.vertex_count);
+            }
+
+            if (range.index_offset == RangeAllocator::kInvalidOffset)
+            {
+                range.index_offset = m_resources.index_allocator.Allocate(range.index_count);
+            }
+
+            assert(range.vertex_offset != RangeAllocator::kInvalidOffset);
+            assert(range.index_offset != RangeAllocator::kInvalidOffset);
+
+            m_resources.AddGeometry(mesh, range);
+        }
+
+        // Write geometry of new and edited meshes only.
+        // Normals, UVs and tangents are addressed with the vertex offset.
+        LogInfo("Uploading geometry...\n");
+        out.geometry_bytes_uploaded = 0;
+
+        for (auto& mesh : pending_upload)
+        {
+            out.geometry_bytes_uploaded += UploadGeometry(*mesh, out.geometry_ranges[mesh], out);
+        }
 
-            // Get pointers data
-            auto mesh_vertex_array = mesh->GetVertices();
-            auto mesh_num_vertices = mesh->GetNumVertices();
+        LogInfo("Uploaded ", out.geometry_bytes_uploaded, " bytes of geometry for ", pending_upload.size(), " meshes\n");
 
-            auto mesh_normal_array = mesh->GetNormals();
-            auto mesh_num_normals = mesh->GetNumNormals();
+        // Only meshes get full descriptors, instances are written as compact records
+        auto num_shapes = geometry_meshes.size();
 
-            auto mesh_uv_array = mesh->GetUVs();
-            auto mesh_num_uvs = mesh->GetNumUVs();
+        // Shape descriptors are small, so they are always rewritten
+        if (num_shapes > out.shapes.GetElementCount() || out.shapes.GetElementCount() == 0)
+        {
+            out.shapes = m_context.CreateBuffer<ClwScene::Shape>(std::max<std::size_t>(num_shapes, 1u), CL_MEM_READ_ONLY);
+            out.shapes_additional = m_context.CreateBuffer<ClwScene::ShapeAdditionalData>(std::max<std::size_t>(num_shapes, 1u), CL_MEM_READ_ONLY);
+        }
 
-            auto mesh_index_array = mesh->GetIndices();
-            auto mesh_num_indices = mesh->GetNumIndices();
+        // Descriptors are built on the host and uploaded in one go
+        out.shape_descriptors.resize(num_shapes);
+        std::vector<ClwScene::ShapeAdditionalData> shapes_additional(num_shapes);
+        auto shapes = out.shape_descriptors.data();
+
+        // Handle meshes, excluded ones are handled in the same way
+        for (auto& iter : geometry_meshes)
+        {
+            auto mesh = iter;
+            auto range = out.geometry_ranges.find(mesh);
 
             // Prepare shape descriptor
             ClwScene::Shape shape;
 
-            shape.id = mesh->GetId();
+            shape.id = iter->GetId();
+            shape.flags = GetCurveFlags(*mesh);
 
-            shape.startvtx = static_cast<int>(num_vertices_written);
-            shape.startidx = static_cast<int>(num_indices_written);
+            WriteShapeGeometry(range != out.geometry_ranges.cend() ? &range->second : nullptr, shape);
 
             auto transform = mesh->GetTransform();
             shape.transform.m0 = { transform.m00, transform.m01, transform.m02, transform.m03 };
@@ -561,26 +1256,16 @@ namespace Baikal
             shape.transform.m2 = { transform.m20, transform.m21, transform.m22, transform.m23 };
             shape.transform.m3 = { transform.m30, transform.m31, transform.m32, transform.m33 };
 
-            shape.linearvelocity = float3(0.0f, 0.f, 0.f);
-            shape.angularvelocity = float3(0.f, 0.f, 0.f, 1.f);
+            GetShapeMotion(*mesh, shape.linearvelocity, shape.angularvelocity);
             shape.material.offset = GetMaterialIndex(mat_collector, mesh->GetMaterial());
             shape.material.layers = GetMaterialLayers(mesh->GetMaterial());
 
             shape.volume_idx = GetVolumeIndex(vol_collector, mesh->GetVolumeMaterial());
+            shape.light_mask = static_cast<int>(mesh->GetLightLinkMask());
 
-            shape_data[mesh] = shape;
-
-            std::copy(mesh_vertex_array, mesh_vertex_array + mesh_num_vertices, vertices + num_vertices_written);
-            num_vertices_written += mesh_num_vertices;
-
-            std::copy(mesh_normal_array, mesh_normal_array + mesh_num_normals, normals + num_normals_written);
-            num_normals_written += mesh_num_normals;
-
-            std::copy(mesh_uv_array, mesh_uv_array + mesh_num_uvs, uvs + num_uvs_written);
-            num_uvs_written += mesh_num_uvs;
-
-            std::copy(mesh_index_array, mesh_index_array + mesh_num_indices, indices + num_indices_written);
-            num_indices_written += mesh_num_indices;
+            // Set by BuildCurves
+            shape.curve_root = -1;
+            shape.curve_mask = static_cast<int>(mesh->GetVisibilityMask());
 
             shapes[num_shapes_written] = shape;
 
@@ -589,47 +1274,26 @@ namespace Baikal
             shapes_additional[num_shapes_written++] = shape_additional;
         }
 
-        // Handle instances
-        for (auto& iter : instances)
-        {
-            auto instance = iter;
-            auto base_shape = std::static_pointer_cast<Mesh>(instance->GetBaseShape());
-            auto transform = instance->GetTransform();
-
-            // Here shape_data is guaranteed to contain
-            // info for base_shape since we have serialized it
-            // above in a different pass.
-            ClwScene::Shape shape = shape_data[base_shape];
-
-            shape.id = iter->GetId();
+        out.num_base_shapes = static_cast<int>(num_shapes_written);
+        out.base_meshes = geometry_meshes;
 
-            // Instance has its own transform.
-            shape.transform.m0 = { transform.m00, transform.m01, transform.m02, transform.m03 };
-            shape.transform.m1 = { transform.m10, transform.m11, transform.m12, transform.m13 };
-            shape.transform.m2 = { transform.m20, transform.m21, transform.m22, transform.m23 };
-            shape.transform.m3 = { transform.m30, transform.m31, transform.m32, transform.m33 };
+        // Shape indices might have moved, so hits are collected from scratch
+        if (num_shapes > out.geometry_requests.GetElementCount() || out.geometry_requests.GetElementCount() == 0)
+        {
+            out.geometry_requests = m_context.CreateBuffer<int>(std::max<std::size_t>(num_shapes, 1u), CL_MEM_READ_WRITE);
+        }
 
-            shape.linearvelocity = float3(0.0f, 0.f, 0.f);
-            shape.angularvelocity = float3(0.f, 0.f, 0.f, 1.f);
-            shape.material.offset = GetMaterialIndex(mat_collector, instance->GetMaterial());
-            shape.material.layers = std::static_pointer_cast<UberV2Material>(instance->GetMaterial())->GetLayers();
+        m_context.FillBuffer(0, out.geometry_requests, 0, out.geometry_requests.GetElementCount());
 
-            shape.volume_idx = GetVolumeIndex(vol_collector, instance->GetVolumeMaterial());
+        BuildCurves(geometry_meshes, out);
 
-            shapes[num_shapes_written] = shape;
+        m_uploader.Write(ClwUploader::Category::kShapes, out.shapes, out.shape_descriptors.data(), num_shapes_written);
+        m_uploader.Write(ClwUploader::Category::kShapes, out.shapes_additional, shapes_additional.data(), num_shapes_written);
 
-            ClwScene::ShapeAdditionalData shape_additional;
-            shape_additional.group_id = iter->GetGroupId();
-            shapes_additional[num_shapes_written++] = shape_additional;
-        }
+        // Instances follow base shapes in shape index space
+        UpdateInstances(geometry_meshes, instances, mat_collector, vol_collector, out);
 
-        LogInfo("Unmapping buffers...\n");
-        m_context.UnmapBuffer(0, out.vertices, vertices);
-        m_context.UnmapBuffer(0, out.normals, normals);
-        m_context.UnmapBuffer(0, out.uvs, uvs);
-        m_context.UnmapBuffer(0, out.indices, indices);
-        m_context.UnmapBuffer(0, out.shapes, shapes).Wait();
-        m_context.UnmapBuffer(0, out.shapes_additional, shapes_additional).Wait();
+        out.world_aabb = scene.GetWorldAABB();
 
         LogInfo("Updating intersector...\n");
 
@@ -638,603 +1302,2747 @@ namespace Baikal
         ReloadIntersector(scene, out);
     }
 
-    void ClwSceneController::UpdateShapeProperties(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, Collector& volume_collector, ClwScene& out) const
+    std::size_t ClwSceneController::UploadGeometry(Mesh const& mesh, ClwScene::GeometryRange const& range, ClwScene& out) const
     {
-        auto shape_iter = scene.CreateShapeIterator();
-
-        // Sort shapes into meshes and instances sets.
-        std::set<Mesh::Ptr> meshes;
-        // Excluded meshes are meshes which are not in the scene,
-        // but are references by at least one instance.
-        std::set<Mesh::Ptr> excluded_meshes;
-        std::set<Instance::Ptr> instances;
-        SplitMeshesAndInstances(*shape_iter, meshes, instances, excluded_meshes);
-
-        ClwScene::Shape* shapes = nullptr;
-        ClwScene::ShapeAdditionalData* shapes_additional = nullptr;
+        auto num_vertices = range.vertex_count;
+        auto num_normals = std::min(mesh.GetNumNormals(), range.vertex_count);
+        auto num_uvs = std::min(mesh.GetNumUVs(), range.vertex_count);
+        auto num_indices = range.index_count;
 
-        // Map arrays and prepare to write data
-        m_context.MapBuffer(0, out.shapes, CL_MAP_READ | CL_MAP_WRITE, &shapes).Wait();
-        m_context.MapBuffer(0, out.shapes_additional, CL_MAP_READ | CL_MAP_WRITE, &shapes_additional).Wait();
+        if (num_vertices > 0)
+        {
+            m_uploader.Write(ClwUploader::Category::kGeometry, out.vertices, mesh.GetVertices(), num_vertices, range.vertex_offset);
+        }
 
-        auto current_shape = shapes;
-        auto current_shape_additional = shapes_additional;
-        for (auto& iter : meshes)
+#ifdef BAIKAL_COMPRESSED_GEOMETRY
+        if (num_normals > 0)
         {
-            auto mesh = iter;
+            std::vector<ClwScene::NormalData> normals(num_normals);
+            std::transform(mesh.GetNormals(), mesh.GetNormals() + num_normals, normals.begin(), GeometryCompression::EncodeNormal);
+            m_uploader.Write(ClwUploader::Category::kGeometry, out.normals, normals.data(), num_normals, range.vertex_offset);
+        }
 
-            auto transform = mesh->GetTransform();
-            current_shape->transform.m0 = { transform.m00, transform.m01, transform.m02, transform.m03 };
-            current_shape->transform.m1 = { transform.m10, transform.m11, transform.m12, transform.m13 };
-            current_shape->transform.m2 = { transform.m20, transform.m21, transform.m22, transform.m23 };
-            current_shape->transform.m3 = { transform.m30, transform.m31, transform.m32, transform.m33 };
-            current_shape->material.offset = GetMaterialIndex(mat_collector, mesh->GetMaterial());
-            current_shape->material.layers = GetMaterialLayers(mesh->GetMaterial());
+        if (num_uvs > 0)
+        {
+            std::vector<ClwScene::UVData> uvs(num_uvs);
+            std::transform(mesh.GetUVs(), mesh.GetUVs() + num_uvs, uvs.begin(), GeometryCompression::EncodeUV);
+            m_uploader.Write(ClwUploader::Category::kGeometry, out.uvs, uvs.data(), num_uvs, range.vertex_offset);
+        }
+#else
+        if (num_normals > 0)
+        {
+            m_uploader.Write(ClwUploader::Category::kGeometry, out.normals, mesh.GetNormals(), num_normals, range.vertex_offset);
+        }
 
-            current_shape->volume_idx = GetVolumeIndex(volume_collector, mesh->GetVolumeMaterial());
+        if (num_uvs > 0)
+        {
+            m_uploader.Write(ClwUploader::Category::kGeometry, out.uvs, mesh.GetUVs(), num_uvs, range.vertex_offset);
+        }
+#endif
 
-            current_shape->id = iter->GetId();
-            current_shape_additional->group_id = iter->GetGroupId();
+        if (num_indices > 0 && range.short_indices)
+        {
+            // Two indices per element, odd count is padded with zero
+            std::vector<std::uint16_t> short_indices(2 * num_indices, 0);
+            std::copy(mesh.GetIndices(), mesh.GetIndices() + mesh.GetNumIndices(), short_indices.begin());
 
-            ++current_shape;
-            ++current_shape_additional;
+            std::vector<int> packed(num_indices);
+            std::memcpy(packed.data(), short_indices.data(), num_indices * sizeof(int));
+            m_uploader.Write(ClwUploader::Category::kGeometry, out.indices, packed.data(), num_indices, range.index_offset);
         }
-
-        // Excluded shapes are handled in almost the same way
-        // except materials.
-        for (auto& iter : excluded_meshes)
+        else if (num_indices > 0)
         {
-            auto mesh = iter;
+            // Mesh keeps unsigned indices, device buffer is int
+            m_uploader.Write(ClwUploader::Category::kGeometry, out.indices, reinterpret_cast<int const*>(mesh.GetIndices()), num_indices, range.index_offset);
+        }
 
-            auto transform = mesh->GetTransform();
-            current_shape->transform.m0 = { transform.m00, transform.m01, transform.m02, transform.m03 };
-            current_shape->transform.m1 = { transform.m10, transform.m11, transform.m12, transform.m13 };
-            current_shape->transform.m2 = { transform.m20, transform.m21, transform.m22, transform.m23 };
-            current_shape->transform.m3 = { transform.m30, transform.m31, transform.m32, transform.m33 };
-            current_shape->material.offset = GetMaterialIndex(mat_collector, mesh->GetMaterial());
-            current_shape->material.layers = GetMaterialLayers(mesh->GetMaterial());
+        auto num_tangents = UploadTangents(mesh, range, out);
 
-            current_shape->volume_idx = GetVolumeIndex(volume_collector, mesh->GetVolumeMaterial());
+        return num_vertices * sizeof(float3) + num_normals * sizeof(ClwScene::NormalData) +
+            num_uvs * sizeof(ClwScene::UVData) + num_tangents * sizeof(std::uint32_t) + num_indices * sizeof(int);
+    }
 
-            current_shape->id = iter->GetId();
-            current_shape_additional->group_id = iter->GetGroupId();
+    std::size_t ClwSceneController::UploadVertices(Mesh const& mesh, ClwScene::GeometryRange const& range, ClwScene& out) const
+    {
+        auto num_vertices = range.vertex_count;
+        auto num_normals = mesh.IsNormalsDirty() ? std::min(mesh.GetNumNormals(), range.vertex_count) : 0;
 
-            ++current_shape;
-            ++current_shape_additional;
-        }
+        m_uploader.Write(ClwUploader::Category::kGeometry, out.vertices, mesh.GetVertices(), num_vertices, range.vertex_offset);
 
-        // Handle instances
-        for (auto& iter : instances)
+        if (num_normals > 0)
         {
-            auto instance = iter;
-            auto base_shape = std::static_pointer_cast<Mesh>(instance->GetBaseShape());
-            auto transform = instance->GetTransform();
+#ifdef BAIKAL_COMPRESSED_GEOMETRY
+            std::vector<ClwScene::NormalData> normals(num_normals);
+            std::transform(mesh.GetNormals(), mesh.GetNormals() + num_normals, normals.begin(), GeometryCompression::EncodeNormal);
+            m_uploader.Write(ClwUploader::Category::kGeometry, out.normals, normals.data(), num_normals, range.vertex_offset);
+#else
+            m_uploader.Write(ClwUploader::Category::kGeometry, out.normals, mesh.GetNormals(), num_normals, range.vertex_offset);
+#endif
+        }
 
-            current_shape->transform.m0 = { transform.m00, transform.m01, transform.m02, transform.m03 };
-            current_shape->transform.m1 = { transform.m10, transform.m11, transform.m12, transform.m13 };
-            current_shape->transform.m2 = { transform.m20, transform.m21, transform.m22, transform.m23 };
-            current_shape->transform.m3 = { transform.m30, transform.m31, transform.m32, transform.m33 };
-            current_shape->material.offset = GetMaterialIndex(mat_collector, instance->GetMaterial());
-            current_shape->material.layers = std::static_pointer_cast<UberV2Material>(instance->GetMaterial())->GetLayers();
+        // Tangents follow deformed positions
+        auto num_tangents = UploadTangents(mesh, range, out);
 
-            current_shape->volume_idx = GetVolumeIndex(volume_collector, instance->GetVolumeMaterial());
+        return num_vertices * sizeof(float3) + num_normals * sizeof(ClwScene::NormalData) +
+            num_tangents * sizeof(std::uint32_t);
+    }
 
-            current_shape->id = iter->GetId();
-            current_shape_additional->group_id = iter->GetGroupId();
+    std::size_t ClwSceneController::UploadTangents(Mesh const& mesh, ClwScene::GeometryRange const& range, ClwScene& out) const
+    {
+#ifdef BAIKAL_VERTEX_TANGENTS
+        auto num_vertices = range.vertex_count;
 
-            ++current_shape;
-            ++current_shape_additional;
+        if (num_vertices == 0)
+        {
+            return 0;
         }
 
-        m_context.UnmapBuffer(0, out.shapes, shapes).Wait();
-        m_context.UnmapBuffer(0, out.shapes_additional, shapes_additional).Wait();
-    }
+        // Attributes are per vertex, missing ones are not used
+        auto normals = mesh.GetNumNormals() >= num_vertices ? mesh.GetNormals() : nullptr;
+        auto uvs = mesh.GetNumUVs() >= num_vertices ? mesh.GetUVs() : nullptr;
 
-    void ClwSceneController::UpdateCurrentScene(Scene1 const& scene, ClwScene& out) const
-    {
-        ReloadIntersector(scene, out);
+        std::vector<RadeonRays::float4> tangents(num_vertices);
+        MeshTangents::Compute(mesh.GetVertices(), normals, uvs, num_vertices, mesh.GetIndices(), mesh.GetNumIndices(), tangents.data());
+
+        std::vector<std::uint32_t> encoded(num_vertices);
+        std::transform(tangents.begin(), tangents.end(), encoded.begin(), [](RadeonRays::float4 const& t)
+        {
+            return GeometryCompression::EncodeTangent(RadeonRays::float3(t.x, t.y, t.z), t.w);
+        });
+
+        m_uploader.Write(ClwUploader::Category::kGeometry, out.tangents, encoded.data(), num_vertices, range.vertex_offset);
+        return num_vertices;
+#else
+        (void)mesh;
+        (void)range;
+        (void)out;
+        return 0;
+#endif
     }
 
-    void ClwSceneController::UpdateMaterials(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, ClwScene& out) const
+    void ClwSceneController::WriteShapeGeometry(ClwScene::GeometryRange const* range, ClwScene::Shape& shape)
     {
-        // Get new buffer size
-        std::vector<int> mat_buffer;
-        mat_buffer.reserve(1024 * 1024); //Reserv 1M of ints for material buffer.
-
-        // Cleanup material mapping
-        m_materialid_to_offset.clear();
-
-        CLUberV2Generator uberv2_generator;
+        auto curve_flags = shape.flags & (ClwScene::kShapeCurves | ClwScene::kShapeBSplineCurves);
 
-        // Serialize materials
+        if (!range)
         {
-            // Update material bundle first to be able to track differences
-            out.material_bundle.reset(mat_collector.CreateBundle());
+            shape.startvtx = 0;
+            shape.startidx = 0;
+            shape.flags = curve_flags | ClwScene::kShapeNotResident;
+            return;
+        }
 
-            // Create material iterator
-            auto mat_iter = mat_collector.CreateIterator();
+        shape.startvtx = static_cast<int>(range->vertex_offset);
+        // Short indices are addressed in 16 bit units
+        shape.startidx = static_cast<int>(range->short_indices ? 2 * range->index_offset : range->index_offset);
+        shape.flags = curve_flags | (range->short_indices ? ClwScene::kShapeShortIndices : 0);
+    }
 
-            // Iterate and serialize
-            for (; mat_iter->IsValid(); mat_iter->Next())
+    bool ClwSceneController::AllocateCachedGeometry(Mesh::Ptr const& mesh, ClwScene& out) const
+    {
+        ClwScene::GeometryRange range;
+        range.vertex_count = mesh->GetNumVertices();
+        range.index_count = GetIndexStorageSize(*mesh);
+        range.short_indices = UsesShortIndices(*mesh);
+        range.vertex_offset = m_resources.vertex_allocator.Allocate(range.vertex_count);
+        range.index_offset = m_resources.index_allocator.Allocate(range.index_count);
+        range.revision = mesh->GetGeometryRevision();
+
+        if (range.vertex_offset == RangeAllocator::kInvalidOffset || range.index_offset == RangeAllocator::kInvalidOffset)
+        {
+            if (range.vertex_offset != RangeAllocator::kInvalidOffset)
             {
-                WriteMaterial(*mat_iter->ItemAs<Material>(), mat_collector, tex_collector, mat_buffer);
+                m_resources.vertex_allocator.Free(range.vertex_offset, range.vertex_count);
+            }
 
-                uberv2_generator.AddMaterial(mat_iter->ItemAs<UberV2Material>());
+            if (range.index_offset != RangeAllocator::kInvalidOffset)
+            {
+                m_resources.index_allocator.Free(range.index_offset, range.index_count);
             }
 
+            return false;
         }
 
-        std::string uberv2_source = uberv2_generator.BuildSource();
-        m_program_manager->AddHeader("uberv2_generated.cl", uberv2_source);
+        m_resources.AddGeometry(mesh, range);
+        out.geometry_ranges[mesh] = range;
+        return true;
+    }
 
+    ClwSceneController::MemoryEstimate ClwSceneController::EstimateSceneMemory(Scene1 const& scene) const
+    {
+        MemoryEstimate estimate;
 
-        // Recreate material buffer if it needs resize
-        if (mat_buffer.size() > out.material_attributes.GetElementCount())
+        // Instances share the geometry of their base meshes
+        std::set<Mesh const*> meshes;
+        for (auto const& shape : scene.GetShapes())
         {
-            // Create material buffer
-            out.material_attributes = m_context.CreateBuffer<int32_t>(mat_buffer.size(), CL_MEM_READ_ONLY);
+            auto instance = dynamic_cast<Instance const*>(shape.get());
+            auto mesh = dynamic_cast<Mesh const*>(instance ? instance->GetBaseShape().get() : shape.get());
+
+            if (mesh && meshes.insert(mesh).second)
+            {
+                estimate.num_vertices += mesh->GetNumVertices();
+                estimate.num_indices += mesh->GetNumIndices();
+            }
         }
 
-        int32_t *materials = nullptr;
+        auto vertex_bytes = sizeof(RadeonRays::float3) + sizeof(ClwScene::NormalData) + sizeof(ClwScene::UVData);
+        estimate.geometry_bytes = estimate.num_vertices * vertex_bytes + estimate.num_indices * sizeof(int) +
+                                  estimate.num_indices / 3 * kIntersectorBytesPerTriangle;
 
-        // Map GPU materials buffer
-        m_context.MapBuffer(0, out.material_attributes, CL_MAP_WRITE, &materials).Wait();
+        for (auto const& texture : CollectTextures(scene))
+        {
+            // Tiles of UDIM sets are collected by themselves, the set only has a header
+            if (std::dynamic_pointer_cast<UdimTexture>(texture))
+            {
+                continue;
+            }
+
+            auto size = GetTextureSlotSize(*texture);
+            estimate.texture_bytes += size;
+            estimate.textures.emplace_back(texture, size);
+        }
 
-        memcpy(materials, mat_buffer.data(), mat_buffer.size() * sizeof(int32_t));
+        std::stable_sort(estimate.textures.begin(), estimate.textures.end(),
+                         [](std::pair<Texture::Ptr, std::size_t> const& lhs, std::pair<Texture::Ptr, std::size_t> const& rhs)
+                         {
+                             return lhs.second > rhs.second;
+                         });
 
-        // Unmap material buffer
-        m_context.UnmapBuffer(0, out.material_attributes, materials);
+        return estimate;
     }
 
-    void ClwSceneController::UpdateVolumes(Scene1 const& scene, Collector& volume_collector, Collector& tex_collector, ClwScene& out) const
+    std::size_t ClwSceneController::GetTextureMemorySize(Texture const& texture)
     {
-        if (!volume_collector.GetNumItems())
-            return;
+        return GetTextureSlotSize(texture);
+    }
 
-        // Get new buffer size
-        std::size_t vol_buffer_size = volume_collector.GetNumItems();
+    void ClwSceneController::SetTextureCacheSize(std::size_t max_bytes)
+    {
+        m_texture_cache_bytes = max_bytes;
+    }
 
-        // Recreate material buffer if it needs resize
-        if (vol_buffer_size > out.volumes.GetElementCount())
+    void ClwSceneController::SetGeometryCacheSize(std::size_t max_vertices, std::size_t max_indices)
+    {
+        if ((max_vertices == 0) != (max_indices == 0))
         {
-            // Create material buffer
-            out.volumes = m_context.CreateBuffer<ClwScene::Volume>(vol_buffer_size, CL_MEM_READ_ONLY);
+            throw std::runtime_error("ClwSceneController: geometry cache requires both vertex and index limits");
         }
 
-        ClwScene::Volume* volumes = nullptr;
+        m_geometry_cache_vertices = max_vertices;
+        m_geometry_cache_indices = max_indices;
+    }
 
-        // Map GPU materials buffer
-        m_context.MapBuffer(0, out.volumes, CL_MAP_WRITE, &volumes).Wait();
+    bool ClwSceneController::UpdateGeometryResidency(Scene1::Ptr scene) const
+    {
+        if (!IsGeometryCacheEnabled())
+        {
+            return false;
+        }
 
-        // Create volume iterator
-        auto volume_iter = volume_collector.CreateIterator();
+        auto& out = GetCachedScene(scene);
+        auto num_shapes = out.base_meshes.size();
 
-        out.volume_bundle.reset(volume_collector.CreateBundle());
-        // Serialize
-        size_t num_volumes_copied = 0;
-        for (; volume_iter->IsValid(); volume_iter->Next())
+        if (num_shapes == 0)
         {
-            WriteVolume(*volume_iter->ItemAs<VolumeMaterial>(), tex_collector, volumes + num_volumes_copied);
-            ++num_volumes_copied;
+            return false;
         }
 
-        // Unmap serial buffer
-        m_context.UnmapBuffer(0, out.volumes, volumes);
-
-        // Update number of volumes
-        out.num_volumes = static_cast<int>(num_volumes_copied);
-    }
+        std::vector<int> requests(num_shapes);
+        m_context.ReadBuffer(0, out.geometry_requests, requests.data(), num_shapes).Wait();
+        m_context.FillBuffer(0, out.geometry_requests, 0, out.geometry_requests.GetElementCount());
 
-    void ClwSceneController::ReloadIntersector(Scene1 const& scene, ClwScene& inout) const
-    {
-        m_api->DetachAll();
+        auto frame = ++out.geometry_frame;
+        std::vector<Mesh::Ptr> missing;
 
-        for (auto& s : inout.visible_shapes)
+        for (auto i = 0u; i < num_shapes; ++i)
         {
-            m_api->AttachShape(s);
+            if (requests[i] == 0)
+            {
+                continue;
+            }
+
+            auto const& mesh = out.base_meshes[i];
+            out.geometry_last_used[mesh] = frame;
+
+            if (out.geometry_ranges.find(mesh) == out.geometry_ranges.cend())
+            {
+                missing.push_back(mesh);
+            }
         }
 
-        m_api->Commit();
-    }
+        std::size_t num_paged_in = 0;
+        std::size_t num_evicted = 0;
+        out.geometry_bytes_uploaded = 0;
 
-    void ClwSceneController::UpdateTextures(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, ClwScene& out) const
-    {
-        // Get new buffer size
-        std::size_t tex_buffer_size = tex_collector.GetNumItems();
-        std::size_t tex_data_buffer_size = 0;
+        for (auto& mesh : missing)
+        {
+            // Resident for another scene, nothing to upload
+            if (auto shared = m_resources.AcquireGeometry(mesh, mesh->GetGeometryRevision()))
+            {
+                out.geometry_ranges[mesh] = *shared;
+                ++num_paged_in;
+                continue;
+            }
 
-        if (tex_buffer_size == 0)
+            // Would evict everything and still fail
+            if (mesh->GetNumVertices() > m_geometry_cache_vertices || GetIndexStorageSize(*mesh) > m_geometry_cache_indices)
+            {
+                continue;
+            }
+
+            bool allocated = AllocateCachedGeometry(mesh, out);
+
+            // Evict least recently hit meshes until the mesh fits,
+            // meshes hit since the last update are never evicted.
+            // Geometry used by other scenes would not free any space.
+            while (!allocated)
+            {
+                auto victim = out.geometry_ranges.end();
+                auto oldest = frame;
+
+                for (auto iter = out.geometry_ranges.begin(); iter != out.geometry_ranges.end(); ++iter)
+                {
+                    if (!m_resources.IsGeometryExclusive(iter->first, iter->second.revision))
+                    {
+                        continue;
+                    }
+
+                    auto last_used = out.geometry_last_used[iter->first];
+
+                    if (last_used < oldest)
+                    {
+                        oldest = last_used;
+                        victim = iter;
+                    }
+                }
+
+                if (victim == out.geometry_ranges.end())
+                {
+                    break;
+                }
+
+                m_resources.ReleaseGeometry(victim->first, victim->second.revision);
+                out.geometry_ranges.erase(victim);
+                ++num_evicted;
+
+                allocated = AllocateCachedGeometry(mesh, out);
+            }
+
+            if (allocated)
+            {
+                out.geometry_bytes_uploaded += UploadGeometry(*mesh, out.geometry_ranges[mesh], out);
+                ++num_paged_in;
+            }
+        }
+
+        if (num_paged_in == 0 && num_evicted == 0)
         {
-            out.textures = m_context.CreateBuffer<ClwScene::Texture>(1, CL_MEM_READ_ONLY);
-            out.texturedata = m_context.CreateBuffer<char>(1, CL_MEM_READ_ONLY);
-            return;
+            return false;
         }
 
-        // Recreate material buffer if it needs resize
-        if (tex_buffer_size > out.textures.GetElementCount())
+        LogInfo("Geometry cache: paged in ", num_paged_in, " meshes (", out.geometry_bytes_uploaded, " bytes), evicted ", num_evicted, "\n");
+
+        // Evicted meshes have to be marked too, so all the descriptors are rewritten
+        for (auto i = 0u; i < num_shapes; ++i)
         {
-            // Create material buffer
-            out.textures = m_context.CreateBuffer<ClwScene::Texture>(tex_buffer_size, CL_MEM_READ_ONLY);
+            auto range = out.geometry_ranges.find(out.base_meshes[i]);
+            WriteShapeGeometry(range != out.geometry_ranges.cend() ? &range->second : nullptr, out.shape_descriptors[i]);
         }
 
-        ClwScene::Texture* textures = nullptr;
-        std::size_t num_textures_written = 0;
+        m_uploader.Write(ClwUploader::Category::kShapes, out.shapes, out.shape_descriptors.data(), num_shapes);
 
-        // Map GPU materials buffer
-        m_context.MapBuffer(0, out.textures, CL_MAP_WRITE, &textures).Wait();
+        return true;
+    }
 
-        // Update material bundle first to be able to track differences
-        out.texture_bundle.reset(tex_collector.CreateBundle());
+    void ClwSceneController::UpdateShapeProperties(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, Collector& volume_collector, ClwScene& out) const
+    {
+        auto shape_iter = scene.CreateShapeIterator();
 
-        // Create material iterator
-        std::unique_ptr<Iterator> tex_iter(tex_collector.CreateIterator());
+        // Sort shapes into meshes and instances sets.
+        std::set<Mesh::Ptr> meshes;
+        // Excluded meshes are meshes which are not in the scene,
+        // but are references by at least one instance.
+        std::set<Mesh::Ptr> excluded_meshes;
+        std::set<Instance::Ptr> instances;
+        SplitMeshesAndInstances(*shape_iter, meshes, instances, excluded_meshes);
 
-        // Iterate and serialize
-        for (; tex_iter->IsValid(); tex_iter->Next())
+        // Edited geometry has to go through UpdateShapes, which only writes changed meshes
+        // and rebuilds the intersector. Material and other property changes are handled here.
+        auto geometry_changed = [&out](Mesh::Ptr const& mesh)
         {
-            auto tex = tex_iter->ItemAs<Texture>();
+            auto iter = out.geometry_ranges.find(mesh);
 
-            WriteTexture(*tex, tex_data_buffer_size, textures + num_textures_written);
+            // Paged out meshes are uploaded with their current geometry once they are paged in
+            if (iter == out.geometry_ranges.cend())
+            {
+                return out.geometry_last_used.find(mesh) == out.geometry_last_used.cend();
+            }
 
-            ++num_textures_written;
+            return iter->second.revision != mesh->GetGeometryRevision();
+        };
 
-            tex_data_buffer_size += align16(tex->GetSizeInBytes());
+        if (std::any_of(meshes.cbegin(), meshes.cend(), geometry_changed) ||
+            std::any_of(excluded_meshes.cbegin(), excluded_meshes.cend(), geometry_changed))
+        {
+            UpdateShapes(scene, mat_collector, tex_collector, volume_collector, out);
+            return;
         }
 
-        // Unmap material buffer
-        m_context.UnmapBuffer(0, out.textures, textures);
+        out.geometry_bytes_uploaded = 0;
 
-        // Recreate material buffer if it needs resize
-        if (tex_data_buffer_size > out.texturedata.GetElementCount())
+        // Descriptors are edited in the host copy and written back,
+        // so nothing has to be read from the device
+        std::vector<ClwScene::ShapeAdditionalData> shapes_additional(out.shape_descriptors.size());
+
+        auto current_shape = out.shape_descriptors.data();
+        auto current_shape_additional = shapes_additional.data();
+        for (auto& iter : meshes)
         {
-            // Create material buffer
-            out.texturedata = m_context.CreateBuffer<char>(tex_data_buffer_size, CL_MEM_READ_ONLY);
-        }
+            auto mesh = iter;
+
+            auto transform = mesh->GetTransform();
+            current_shape->transform.m0 = { transform.m00, transform.m01, transform.m02, transform.m03 };
+            current_shape->transform.m1 = { transform.m10, transform.m11, transform.m12, transform.m13 };
+            current_shape->transform.m2 = { transform.m20, transform.m21, transform.m22, transform.m23 };
+            current_shape->transform.m3 = { transform.m30, transform.m31, transform.m32, transform.m33 };
+            current_shape->material.offset = GetMaterialIndex(mat_collector, mesh->GetMaterial());
+            current_shape->material.layers = GetMaterialLayers(mesh->GetMaterial());
 
-        char* data = nullptr;
-        std::size_t num_bytes_written = 0;
+            current_shape->volume_idx = GetVolumeIndex(volume_collector, mesh->GetVolumeMaterial());
+            current_shape->light_mask = static_cast<int>(mesh->GetLightLinkMask());
+            current_shape->curve_mask = static_cast<int>(mesh->GetVisibilityMask());
 
-        tex_iter->Reset();
+            current_shape->id = iter->GetId();
+            current_shape_additional->group_id = iter->GetGroupId();
 
-        // Map GPU materials buffer
-        m_context.MapBuffer(0, out.texturedata, CL_MAP_WRITE, &data).Wait();
+            ++current_shape;
+            ++current_shape_additional;
+        }
 
-        // Write texture data for all textures
-        for (; tex_iter->IsValid(); tex_iter->Next())
+        // Excluded shapes are handled in almost the same way
+        // except materials.
+        for (auto& iter : excluded_meshes)
         {
-            auto tex = tex_iter->ItemAs<Texture>();
+            auto mesh = iter;
+
+            auto transform = mesh->GetTransform();
+            current_shape->transform.m0 = { transform.m00, transform.m01, transform.m02, transform.m03 };
+            current_shape->transform.m1 = { transform.m10, transform.m11, transform.m12, transform.m13 };
+            current_shape->transform.m2 = { transform.m20, transform.m21, transform.m22, transform.m23 };
+            current_shape->transform.m3 = { transform.m30, transform.m31, transform.m32, transform.m33 };
+            current_shape->material.offset = GetMaterialIndex(mat_collector, mesh->GetMaterial());
+            current_shape->material.layers = GetMaterialLayers(mesh->GetMaterial());
+
+            current_shape->volume_idx = GetVolumeIndex(volume_collector, mesh->GetVolumeMaterial());
+            current_shape->light_mask = static_cast<int>(mesh->GetLightLinkMask());
+            current_shape->curve_mask = static_cast<int>(mesh->GetVisibilityMask());
 
-            WriteTextureData(*tex, data + num_bytes_written);
+            current_shape->id = iter->GetId();
+            current_shape_additional->group_id = iter->GetGroupId();
 
-            num_bytes_written += align16(tex->GetSizeInBytes());
+            ++current_shape;
+            ++current_shape_additional;
         }
 
-        // Unmap material buffer
-        m_context.UnmapBuffer(0, out.texturedata, data);
+        m_uploader.Write(ClwUploader::Category::kShapes, out.shapes, out.shape_descriptors.data(), out.shape_descriptors.size());
+        m_uploader.Write(ClwUploader::Category::kShapes, out.shapes_additional, shapes_additional.data(), shapes_additional.size());
+
+        // Base shapes of instances might have been switched, so records are rebuilt
+        std::vector<Mesh::Ptr> geometry_meshes(meshes.begin(), meshes.end());
+        geometry_meshes.insert(geometry_meshes.end(), excluded_meshes.begin(), excluded_meshes.end());
+        UpdateInstances(geometry_meshes, instances, mat_collector, volume_collector, out);
+
+        // Transforms might have changed
+        out.world_aabb = scene.GetWorldAABB();
     }
 
-#ifndef NDEBUG
-    // We're not using this function on release
-    // Convert Material:: types to ClwScene:: types
-    static ClwScene::Bxdf GetMaterialType(Material const& material)
+    void ClwSceneController::UpdateShapeTransforms(Scene1 const& scene, ClwScene& out) const
     {
-        // Distinguish between single bxdf materials and compound ones
-        if (dynamic_cast<UberV2Material const*>(&material))
+        auto num_shapes = out.shape_descriptors.size();
+        assert(out.shape_slots.size() == num_shapes + out.instance_descriptors.size());
+
+        // Slots of moved shapes, only their descriptors and intersector shapes are touched
+        std::vector<std::uint32_t> moved_shapes;
+        std::vector<std::uint32_t> moved_instances;
+
+        auto move = [&](Shape const& shape)
         {
-            return ClwScene::Bxdf::kUberV2;
+            auto slot = out.shape_slots.at(&shape);
+
+            if (slot < num_shapes)
+            {
+                auto& descriptor = out.shape_descriptors[slot];
+                auto transform = shape.GetTransform();
+                descriptor.transform.m0 = { transform.m00, transform.m01, transform.m02, transform.m03 };
+                descriptor.transform.m1 = { transform.m10, transform.m11, transform.m12, transform.m13 };
+                descriptor.transform.m2 = { transform.m20, transform.m21, transform.m22, transform.m23 };
+                descriptor.transform.m3 = { transform.m30, transform.m31, transform.m32, transform.m33 };
+                GetShapeMotion(shape, descriptor.linearvelocity, descriptor.angularvelocity);
+                moved_shapes.push_back(slot);
+            }
+            else
+            {
+                // Instance records keep their transform slots, only the rows are rewritten
+                auto& instance = out.instance_descriptors[slot - num_shapes];
+                WriteInstanceTransform(shape.GetTransform(), &out.instance_transform_data[3 * instance.transform_idx]);
+                GetShapeMotion(shape, instance.linearvelocity, instance.angularvelocity);
+                moved_instances.push_back(slot - static_cast<std::uint32_t>(num_shapes));
+            }
+
+            // Curves are transformed by the kernels intersecting them
+            if (out.isect_shapes[slot])
+            {
+                SetIntersectorTransform(out.isect_shapes[slot], shape);
+            }
+        };
+
+        // Scene wide flag moves everything
+        auto move_all = (scene.GetDirtyFlags() & Scene1::kShapeTransforms) != 0;
+
+        for (auto const& shape : scene.GetShapes())
+        {
+            if (move_all || shape->IsTransformDirty())
+            {
+                move(*shape);
+            }
         }
 
-        return ClwScene::Bxdf::kZero;
-    }
+        // Excluded meshes are not in the scene, so nobody else drops their flags
+        for (auto mesh : out.excluded_meshes)
+        {
+            if (move_all || mesh->IsTransformDirty())
+            {
+                move(*mesh);
+                mesh->SetTransformDirty(false);
+            }
+        }
+
+        // Descriptors come from the host copies: write only, no read back
+        UploadElements(m_uploader, ClwUploader::Category::kShapes, out.shapes, out.shape_descriptors, 1, moved_shapes);
+
+        // Transform rows are indexed by the transform slot, which is the record index
+        UploadElements(m_uploader, ClwUploader::Category::kShapes, out.instance_transforms, out.instance_transform_data, 3, moved_instances);
+#ifdef BAIKAL_MOTION_BLUR
+        // Instance velocities live in the records
+        UploadElements(m_uploader, ClwUploader::Category::kShapes, out.instances, out.instance_descriptors, 1, moved_instances);
 #endif
 
-    void ClwSceneController::WriteMaterial(Material const& material, Collector& mat_collector, Collector& tex_collector, std::vector<std::int32_t> &material_data) const
-    {
-        assert(GetMaterialType(material) == ClwScene::Bxdf::kUberV2);
-        const UberV2Material &uber_material = static_cast<const UberV2Material&>(material);
+        // Only instance transforms change in the intersector, no geometry is reloaded
+        if (!moved_shapes.empty() || !moved_instances.empty())
+        {
+            out.shapes_edited = true;
+            CommitIntersector(out);
+        }
 
-        std::uint32_t layers = uber_material.GetLayers();
-        
-        m_materialid_to_offset[material.GetId()] = static_cast<int>(material_data.size());
+        out.world_aabb = scene.GetWorldAABB();
+    }
 
-        // Pack material parameters
-        std::int32_t params = 0;
-        params |= ((uber_material.IsLinkRefractionIOR()) ? 1 : 0) << 0;
-        params |= ((uber_material.IsThin()) ? 1 : 0) << 1;
-        params |= ((uber_material.isDoubleSided()) ? 1 : 0) << 2;
-        params |= ((uber_material.IsMultiscatter()) ? 1 : 0) << 3;
-        material_data.push_back(params);
+    void ClwSceneController::UpdateShapeVertices(Scene1 const& scene, ClwScene& out) const
+    {
+        // Instances deform along with their base meshes, excluded meshes are only reached through them
+        std::set<Mesh::Ptr> deformed_meshes;
 
-        // Describe order of fields and layers
-        static const std::vector<std::pair<UberV2Material::Layers, std::vector<std::string>>> uberv2_ordered_fields =
+        auto shape_iter = scene.CreateShapeIterator();
+        for (; shape_iter->IsValid(); shape_iter->Next())
         {
+            auto shape = shape_iter->ItemAs<Shape>();
+
+            if (auto instance = std::dynamic_pointer_cast<Instance>(shape))
             {
-                UberV2Material::Layers::kEmissionLayer,
-                { "uberv2.emission.color" }
-            },
+                shape = instance->GetBaseShape();
+            }
+
+            auto mesh = std::dynamic_pointer_cast<Mesh>(shape);
+            if (mesh && mesh->IsVerticesDirty())
             {
-                UberV2Material::Layers::kCoatingLayer,
-                { "uberv2.coating.color", "uberv2.coating.ior"}
-            },
+                deformed_meshes.insert(mesh);
+            }
+        }
+
+        auto api = GetSceneIntersector(out);
+
+        // Old intersector shape -> new one, old ones are deleted once nothing refers to them
+        std::map<RadeonRays::Shape*, RadeonRays::Shape*> replaced_meshes;
+        std::map<RadeonRays::Shape*, RadeonRays::Shape*> replaced_instances;
+        bool curves_deformed = false;
+
+        for (auto const& mesh : deformed_meshes)
+        {
+            // Paged out meshes get current positions when they are paged back in
+            auto range = out.geometry_ranges.find(mesh);
+            if (range != out.geometry_ranges.end() && range->second.revision == mesh->GetGeometryRevision())
             {
-                UberV2Material::Layers::kReflectionLayer,
-                {
-                    "uberv2.reflection.color",
-                    "uberv2.reflection.roughness",
-                    "uberv2.reflection.anisotropy",
-                    "uberv2.reflection.anisotropy_rotation",
-                    "uberv2.reflection.ior",
-                    "uberv2.reflection.metalness",
-                }
-            },
+                out.geometry_bytes_uploaded += UploadVertices(*mesh, range->second, out);
+            }
+
+            curves_deformed = curves_deformed || GetCurveFlags(*mesh);
+
+            auto iter = out.intersector_shapes.find(mesh);
+            if (iter == out.intersector_shapes.end())
             {
-                UberV2Material::Layers::kDiffuseLayer,
-                { "uberv2.diffuse.color"}
-            },
-            {
-                UberV2Material::Layers::kRefractionLayer,
-                {
-                    "uberv2.refraction.color",
-                    "uberv2.refraction.roughness",
-                    "uberv2.refraction.ior"
-                }
-            },
+                continue;
+            }
+
+            // RadeonRays has no refit, so the bottom level BVH of the deformed mesh alone is rebuilt
+            auto slot = out.shape_slots.at(mesh.get());
+            auto shape = CreateIntersectorMesh(api, *mesh);
+
+            SetIntersectorTransform(shape, *mesh);
+            // Ids follow the shape slots, see UpdateIntersector
+            shape->SetId(static_cast<int>(slot) + 1);
+
+            if (std::find(out.excluded_meshes.cbegin(), out.excluded_meshes.cend(), mesh.get()) == out.excluded_meshes.cend())
             {
-                UberV2Material::Layers::kTransparencyLayer,
-                { "uberv2.transparency" }
-            },
+                shape->SetMask(mesh->GetVisibilityMask());
+            }
+
+            replaced_meshes[iter->second.shape] = shape;
+            iter->second.shape = shape;
+            out.isect_shapes[slot] = shape;
+        }
+
+        // Curve BVHs are small, so all of them are rebuilt, descriptors get new roots
+        if (curves_deformed)
+        {
+            BuildCurves(out.base_meshes, out);
+            m_uploader.Write(ClwUploader::Category::kShapes, out.shapes, out.shape_descriptors.data(), out.shape_descriptors.size());
+            out.world_aabb = scene.GetWorldAABB();
+        }
+
+        if (replaced_meshes.empty())
+        {
+            return;
+        }
+
+        // Instances of deformed meshes are recreated on the new shapes
+        for (auto& iter : out.intersector_shapes)
+        {
+            auto base = iter.second.base ? replaced_meshes.find(iter.second.base) : replaced_meshes.end();
+            if (base == replaced_meshes.end())
             {
-                UberV2Material::Layers::kShadingNormalLayer,
-                { "uberv2.shading_normal" }
-            },
+                continue;
+            }
+
+            auto slot = out.shape_slots.at(iter.first.get());
+            auto shape = api->CreateInstance(base->second);
+
+            SetIntersectorTransform(shape, *iter.first);
+            shape->SetId(static_cast<int>(slot) + 1);
+
+            replaced_instances[iter.second.shape] = shape;
+            iter.second = ClwScene::IntersectorShape{ shape, 0u, base->second };
+            out.isect_shapes[slot] = shape;
+        }
+
+        for (auto& shape : out.visible_shapes)
+        {
+            auto mesh = replaced_meshes.find(shape);
+            auto instance = replaced_instances.find(shape);
+
+            shape = mesh != replaced_meshes.end() ? mesh->second :
+                instance != replaced_instances.end() ? instance->second : shape;
+        }
+
+        // Instances go before the meshes they refer to
+        for (auto const* replaced : { &replaced_instances, &replaced_meshes })
+        {
+            for (auto& stale : *replaced)
             {
-                UberV2Material::Layers::kSSSLayer,
-                {
-                    "uberv2.sss.absorption_color",
-                    "uberv2.sss.scatter_color",
-                    "uberv2.sss.subsurface_color",
-                    "uberv2.sss.absorption_distance",
-                    "uberv2.sss.scatter_distance",
-                    "uberv2.sss.scatter_direction"
-                }
-            },
-        };
+                api->DetachShape(stale.first);
+                api->DeleteShape(stale.first);
+            }
+        }
 
-        // Write material layers. Order matters.
-        for (auto &layer_info : uberv2_ordered_fields)
+        out.shapes_edited = true;
+        ReloadIntersector(scene, out);
+
+        out.world_aabb = scene.GetWorldAABB();
+    }
+
+    void ClwSceneController::BuildCurves(std::vector<Mesh::Ptr> const& base_shapes, ClwScene& out) const
+    {
+        std::vector<CurveBvh::Node> nodes;
+        std::vector<std::int32_t> segments;
+        std::vector<int> curve_shapes;
+
+        std::vector<RadeonRays::float3> pmin;
+        std::vector<RadeonRays::float3> pmax;
+        CurveBvh bvh;
+
+        for (auto i = 0u; i < base_shapes.size(); ++i)
         {
-            if ((layers & layer_info.first) == layer_info.first)
+            auto curves = std::dynamic_pointer_cast<Curves>(base_shapes[i]);
+
+            if (!curves || curves->GetNumSegments() == 0)
             {
-                for (auto &layer_param : layer_info.second)
+                continue;
+            }
+
+            auto vertices = curves->GetVertices();
+            auto first_points = curves->GetIndices();
+            auto num_segments = curves->GetNumSegments();
+            auto points_per_segment = Curves::GetPointsPerSegment(curves->GetBasis());
+
+            // Segments are bound by their control points grown by the largest radius,
+            // B-spline segments stay in the convex hull of theirs
+            pmin.resize(num_segments);
+            pmax.resize(num_segments);
+
+            for (std::size_t j = 0; j < num_segments; ++j)
+            {
+                auto const* points = vertices + first_points[j];
+                auto r = 0.f;
+
+                pmin[j] = pmax[j] = points[0];
+                for (std::size_t k = 0; k < points_per_segment; ++k)
                 {
-                    auto value = material.GetInputValue(layer_param);
-                    assert(value.type == Material::InputType::kInputMap);
-                    material_data.push_back(value.input_map_value ? value.input_map_value->GetId() : -1);
+                    pmin[j] = RadeonRays::vmin(pmin[j], points[k]);
+                    pmax[j] = RadeonRays::vmax(pmax[j], points[k]);
+                    r = std::max(r, points[k].w);
                 }
+
+                pmin[j] = pmin[j] - float3(r, r, r);
+                pmax[j] = pmax[j] + float3(r, r, r);
+            }
+
+            bvh.Build(pmin.data(), pmax.data(), reinterpret_cast<std::int32_t const*>(first_points), static_cast<std::uint32_t>(num_segments));
+
+            // Nodes of all shapes share the buffers, so child indices are made absolute
+            auto node_offset = static_cast<std::int32_t>(nodes.size());
+            auto segment_offset = static_cast<std::int32_t>(segments.size());
+
+            for (auto node : bvh.m_nodes)
+            {
+                node.child = node.count > 0 ? node.child - segment_offset : node.child + node_offset;
+                nodes.push_back(node);
             }
+
+            segments.insert(segments.end(), bvh.m_segments.cbegin(), bvh.m_segments.cend());
+
+            out.shape_descriptors[i].curve_root = node_offset;
+            curve_shapes.push_back(static_cast<int>(i));
         }
-    }
 
-    // Convert Light:: types to ClwScene:: types
-    static int GetLightType(Light const& light)
-    {
+        out.num_curve_shapes = static_cast<int>(curve_shapes.size());
 
-        if (dynamic_cast<PointLight const*>(&light))
+        if (curve_shapes.empty())
         {
-            return ClwScene::kPoint;
+            return;
         }
-        else if (dynamic_cast<DirectionalLight const*>(&light))
+
+        if (nodes.size() > out.curve_nodes.GetElementCount())
         {
-            return ClwScene::kDirectional;
+            out.curve_nodes = m_context.CreateBuffer<ClwScene::CurveNode>(nodes.size(), CL_MEM_READ_ONLY);
         }
-        else if (dynamic_cast<SpotLight const*>(&light))
+
+        if (segments.size() > out.curve_segments.GetElementCount())
         {
-            return ClwScene::kSpot;
+            out.curve_segments = m_context.CreateBuffer<int>(segments.size(), CL_MEM_READ_ONLY);
         }
-        else if (dynamic_cast<ImageBasedLight const*>(&light))
+
+        if (curve_shapes.size() > out.curve_shapes.GetElementCount())
         {
-            return ClwScene::kIbl;
+            out.curve_shapes = m_context.CreateBuffer<int>(curve_shapes.size(), CL_MEM_READ_ONLY);
         }
-        else
+
+        static_assert(sizeof(ClwScene::CurveNode) == sizeof(CurveBvh::Node), "Curve BVH node layout differs from the kernel one");
+        m_uploader.Write(ClwUploader::Category::kShapes, out.curve_nodes, reinterpret_cast<ClwScene::CurveNode const*>(nodes.data()), nodes.size());
+        m_uploader.Write(ClwUploader::Category::kShapes, out.curve_segments, segments.data(), segments.size());
+        m_uploader.Write(ClwUploader::Category::kShapes, out.curve_shapes, curve_shapes.data(), curve_shapes.size());
+    }
+
+    void ClwSceneController::UpdateInstances(std::vector<Mesh::Ptr> const& base_shapes, std::set<Instance::Ptr> const& instances, Collector& mat_collector, Collector& vol_collector, ClwScene& out) const
+    {
+        // Base shape -> index in shapes buffer
+        std::map<Mesh::Ptr, int> base_indices;
+        for (auto i = 0u; i < base_shapes.size(); ++i)
         {
-            return ClwScene::LightType::kArea;
+            base_indices[base_shapes[i]] = static_cast<int>(i);
+        }
+
+        out.instance_descriptors.resize(instances.size());
+        out.instance_transform_data.resize(3 * instances.size());
+
+        auto current_instance = out.instance_descriptors.data();
+        for (auto& iter : instances)
+        {
+            auto instance = iter;
+            auto base_shape = std::static_pointer_cast<Mesh>(instance->GetBaseShape());
+            auto transform_idx = static_cast<int>(current_instance - out.instance_descriptors.data());
+
+            // Base shape is either a scene mesh or an excluded one,
+            // both have been serialized before instances
+            current_instance->base_idx = base_indices.at(base_shape);
+            current_instance->transform_idx = transform_idx;
+            current_instance->id = instance->GetId();
+            current_instance->volume_idx = GetVolumeIndex(vol_collector, instance->GetVolumeMaterial());
+            current_instance->group_id = instance->GetGroupId();
+            current_instance->material_offset = GetMaterialIndex(mat_collector, instance->GetMaterial());
+            current_instance->material_layers = std::static_pointer_cast<UberV2Material>(instance->GetMaterial())->GetLayers();
+            current_instance->light_mask = static_cast<int>(instance->GetLightLinkMask());
+            GetShapeMotion(*instance, current_instance->linearvelocity, current_instance->angularvelocity);
+
+            WriteInstanceTransform(instance->GetTransform(), &out.instance_transform_data[3 * transform_idx]);
+
+            ++current_instance;
+        }
+
+        // Kernels always get valid buffers, even if there are no instances
+        if (instances.size() > out.instances.GetElementCount() || out.instances.GetElementCount() == 0)
+        {
+            out.instances = m_context.CreateBuffer<ClwScene::ShapeInstance>(std::max<std::size_t>(instances.size(), 1u), CL_MEM_READ_ONLY);
+            out.instance_transforms = m_context.CreateBuffer<RadeonRays::float4>(3 * std::max<std::size_t>(instances.size(), 1u), CL_MEM_READ_ONLY);
         }
+
+        m_uploader.Write(ClwUploader::Category::kShapes, out.instances, out.instance_descriptors.data(), out.instance_descriptors.size());
+        m_uploader.Write(ClwUploader::Category::kShapes, out.instance_transforms, out.instance_transform_data.data(), out.instance_transform_data.size());
     }
 
-    void ClwSceneController::WriteLight(Scene1 const& scene, Light const& light, Collector& tex_collector, void* data) const
+    void ClwSceneController::UpdateCurrentScene(Scene1 const& scene, ClwScene& out) const
     {
-        auto clw_light = reinterpret_cast<ClwScene::Light*>(data);
+        // Shadow scenes built into the other intersector are swapped in without a rebuild
+        if (out.intersector_attached && !IsCompilingInBackground())
+        {
+            m_current_api = GetSceneIntersector(out);
+            return;
+        }
 
-        auto type = GetLightType(light);
+        ReloadIntersector(scene, out);
+    }
 
-        clw_light->type = type;
+    void ClwSceneController::UpdateMaterials(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, ClwScene& out) const
+    {
+        std::vector<int> mat_buffer;
 
-        switch (type)
+        // Cleanup material mapping
+        m_materialid_to_offset.clear();
+
+        // Generated UberV2 code only depends on layer combinations
+        std::set<std::uint32_t> uberv2_layers;
+        std::vector<UberV2Material::Ptr> uberv2_materials;
+
+        // Serialize materials
         {
-            case ClwScene::kPoint:
+            // Update material bundle first to be able to track differences
+            out.material_bundle.reset(mat_collector.CreateBundle());
+
+            // Create material iterator
+            auto mat_iter = mat_collector.CreateIterator();
+
+            // Material sizes are known up front, offsets are their prefix sums
+            std::vector<Material::Ptr> materials;
+            std::vector<std::size_t> offsets(1, 0);
+
+            for (; mat_iter->IsValid(); mat_iter->Next())
             {
-                clw_light->p = light.GetPosition();
-                clw_light->intensity = light.GetEmittedRadiance();
-                break;
+                auto material = mat_iter->ItemAs<Material>();
+
+                m_materialid_to_offset[material->GetId()] = static_cast<std::int32_t>(offsets.back());
+                offsets.push_back(offsets.back() + GetMaterialSize(*material));
+                materials.push_back(material);
+
+                auto uberv2_material = mat_iter->ItemAs<UberV2Material>();
+
+                if (uberv2_layers.insert(uberv2_material->GetLayers()).second)
+                {
+                    uberv2_materials.push_back(uberv2_material);
+                }
             }
 
-            case ClwScene::kDirectional:
+            mat_buffer.resize(offsets.back());
+
+            // Every material goes to its own range, so they are written independently
+            ParallelFor(materials.size(), [&](std::size_t i)
             {
-                clw_light->d = light.GetDirection();
-                clw_light->intensity = light.GetEmittedRadiance();
-                break;
+                WriteMaterial(*materials[i], mat_collector, tex_collector, mat_buffer.data() + offsets[i]);
+            });
+        }
+
+        // Value edits keep the layers, so the source is neither regenerated nor the program rebuilt.
+        // Header is checked as well since other controllers might share the program manager.
+        if (m_uberv2_source.empty() || uberv2_layers != m_uberv2_layers ||
+            m_program_manager->ReadHeader("uberv2_generated.cl") != m_uberv2_source)
+        {
+            CLUberV2Generator uberv2_generator;
+
+            for (auto& material : uberv2_materials)
+            {
+                uberv2_generator.AddMaterial(material);
             }
 
-            case ClwScene::kSpot:
+            m_uberv2_source = uberv2_generator.BuildSource();
+            m_uberv2_layers = uberv2_layers;
+            m_program_manager->AddHeader("uberv2_generated.cl", m_uberv2_source);
+        }
+
+        // Recreate material buffer if it needs resize
+        if (mat_buffer.size() > out.material_attributes.GetElementCount())
+        {
+            // Create material buffer
+            out.material_attributes = m_context.CreateBuffer<int32_t>(mat_buffer.size(), CL_MEM_READ_ONLY);
+        }
+
+        m_uploader.Write(ClwUploader::Category::kMaterials, out.material_attributes, mat_buffer.data(), mat_buffer.size());
+    }
+
+    void ClwSceneController::UpdateVolumes(Scene1 const& scene, Collector& volume_collector, Collector& tex_collector, ClwScene& out) const
+    {
+        if (!volume_collector.GetNumItems())
+        {
+            out.num_volumes = 0;
+            out.features &= ~ClwScene::kFeatureVolumes;
+            return;
+        }
+
+        // Get new buffer size
+        std::size_t vol_buffer_size = volume_collector.GetNumItems();
+
+        // Recreate material buffer if it needs resize
+        if (vol_buffer_size > out.volumes.GetElementCount())
+        {
+            // Create material buffer
+            out.volumes = m_context.CreateBuffer<ClwScene::Volume>(vol_buffer_size, CL_MEM_READ_ONLY);
+        }
+
+        std::vector<ClwScene::Volume> volumes(vol_buffer_size);
+        std::vector<int> grids;
+
+        // Create volume iterator
+        auto volume_iter = volume_collector.CreateIterator();
+
+        out.volume_bundle.reset(volume_collector.CreateBundle());
+        // Serialize
+        size_t num_volumes_copied = 0;
+        for (; volume_iter->IsValid(); volume_iter->Next())
+        {
+            WriteVolume(*volume_iter->ItemAs<VolumeMaterial>(), tex_collector, grids, volumes.data() + num_volumes_copied);
+            ++num_volumes_copied;
+        }
+
+        m_uploader.Write(ClwUploader::Category::kVolumes, out.volumes, volumes.data(), num_volumes_copied);
+
+        if (!grids.empty())
+        {
+            if (grids.size() > out.volume_grids.GetElementCount())
             {
-                clw_light->p = light.GetPosition();
-                clw_light->d = light.GetDirection();
-                clw_light->intensity = light.GetEmittedRadiance();
+                out.volume_grids = m_context.CreateBuffer<int>(grids.size(), CL_MEM_READ_ONLY);
+            }
 
-                auto cone_shape = static_cast<SpotLight const&>(light).GetConeShape();
-                clw_light->ia = cone_shape.x;
-                clw_light->oa = cone_shape.y;
-                break;
+            m_uploader.Write(ClwUploader::Category::kVolumes, out.volume_grids, grids.data(), grids.size());
+        }
+
+        // Update number of volumes
+        out.num_volumes = static_cast<int>(num_volumes_copied);
+
+        // Shapes reference volumes by index, so volume code is only needed while there are volumes
+        out.features = num_volumes_copied > 0 ? (out.features | ClwScene::kFeatureVolumes) : (out.features & ~ClwScene::kFeatureVolumes);
+    }
+
+    void ClwSceneController::ReloadIntersector(Scene1 const& scene, ClwScene& inout) const
+    {
+        auto api = GetSceneIntersector(inout);
+
+        // Shapes of a shadow scene sharing the intersector with rendering are attached when it is swapped in
+        if (IsCompilingInBackground() && api == m_current_api)
+        {
+            return;
+        }
+
+        // Other scenes of the intersector have to be attached again before they are rendered
+        ForEachCachedScene([api](ClwScene& cached)
+        {
+            if (cached.intersector == api)
+            {
+                cached.intersector_attached = false;
             }
+        });
 
-            case ClwScene::kIbl:
+        api->DetachAll();
+
+        for (auto& s : inout.visible_shapes)
+        {
+            api->AttachShape(s);
+        }
+
+        CommitIntersector(inout);
+        inout.intersector_attached = true;
+
+        if (!IsCompilingInBackground())
+        {
+            m_current_api = api;
+        }
+    }
+
+    void ClwSceneController::ReleaseCompiledScene(ClwScene& scene) const
+    {
+        // Released data might be stored in the ranges dropped here only
+        RestoreHostData();
+
+        auto api = GetSceneIntersector(scene);
+
+        for (auto& shape : scene.isect_shapes)
+        {
+            if (shape)
             {
-                auto& ibl = static_cast<ImageBasedLight const&>(light);
-                clw_light->multiplier = ibl.GetMultiplier();
-                auto main_tex = ibl.GetTexture();
-                clw_light->tex = main_tex ? tex_collector.GetItemIndex(main_tex) : -1;
-                auto reflection_tex = ibl.GetReflectionTexture();
-                clw_light->tex_reflection = reflection_tex ? tex_collector.GetItemIndex(reflection_tex) : -1;
-                auto refraction_tex = ibl.GetRefractionTexture();
-                clw_light->tex_refraction = refraction_tex ? tex_collector.GetItemIndex(refraction_tex) : -1;
-                auto transparency_tex = ibl.GetTransparencyTexture();
-                clw_light->tex_transparency = transparency_tex ? tex_collector.GetItemIndex(transparency_tex) : -1;
-                auto background_tex = ibl.GetBackgroundTexture();
-                clw_light->tex_background = background_tex ? tex_collector.GetItemIndex(background_tex) : -1;
-                clw_light->ibl_mirror_x = ibl.GetMirrorX();
+                api->DetachShape(shape);
+                api->DeleteShape(shape);
+            }
+        }
+
+        scene.isect_shapes.clear();
+        scene.visible_shapes.clear();
+        scene.shape_slots.clear();
+        scene.excluded_meshes.clear();
+        scene.intersector_shapes.clear();
+        scene.intersector_attached = false;
+        scene.shapes_edited = false;
+
+        ReleaseGeometry(scene);
+        ReleaseTextures(scene);
+    }
+
+    void ClwSceneController::ReleaseGeometry(ClwScene& scene) const
+    {
+        for (auto const& range : scene.geometry_ranges)
+        {
+            m_resources.ReleaseGeometry(range.first, range.second.revision);
+        }
+
+        scene.geometry_ranges.clear();
+
+        // Cache buffers keep their fixed size, grown pools are dropped once nothing references them
+        if (m_resources.geometry.empty() && !IsGeometryCacheEnabled())
+        {
+            m_resources.vertices = CLWBuffer<float3>();
+            m_resources.normals = CLWBuffer<ClwScene::NormalData>();
+            m_resources.uvs = CLWBuffer<ClwScene::UVData>();
+            m_resources.tangents = CLWBuffer<std::uint32_t>();
+            m_resources.indices = CLWBuffer<int>();
+            m_resources.vertex_allocator.Reset(0);
+            m_resources.index_allocator.Reset(0);
+        }
+    }
+
+    void ClwSceneController::ReleaseTextures(ClwScene& scene) const
+    {
+        for (auto const& slot : scene.texture_slots)
+        {
+            m_resources.ReleaseTexture(slot.first, slot.second.revision);
+        }
+
+        scene.texture_slots.clear();
+        scene.texture_fallbacks.clear();
+        scene.texture_last_used.clear();
+        scene.collected_textures.clear();
+
+        if (m_resources.textures.empty())
+        {
+            m_resources.texturedata = CLWBuffer<char>();
+            m_resources.texture_allocator.Reset(0);
+        }
+    }
+
+    void ClwSceneController::RebindSharedBuffers() const
+    {
+        // Scenes in use by the renderer are left alone during background compiles,
+        // their buffers still hold valid data for everything they reference
+        if (IsCompilingInBackground())
+        {
+            return;
+        }
+
+        ForEachCachedScene([this](ClwScene& scene)
+        {
+            if (!scene.geometry_ranges.empty())
+            {
+                m_resources.BindGeometry(scene);
+            }
+
+            if (!scene.texture_slots.empty())
+            {
+                m_resources.BindTextures(scene);
+            }
+        });
+    }
+
+    void ClwSceneController::UpdateCompileStats(Scene1 const& scene, ClwScene& out) const
+    {
+        auto& stats = out.compile_stats;
+
+        // Scenes might be compiled in the background, so revisions come from a shared counter
+        for (auto step = 0u; step < SceneCompileStats::kStepCount; ++step)
+        {
+            if (step != SceneCompileStats::kCamera && stats.step_runs[step] > 0)
+            {
+                out.revision = ++s_scene_revision;
+                break;
+            }
+        }
+
+        // Geometry and texel pools are shared with the other compiled scenes
+        stats.AddSharedBuffer("vertices", GetBufferBytes(out.vertices));
+        stats.AddSharedBuffer("normals", GetBufferBytes(out.normals));
+        stats.AddSharedBuffer("uvs", GetBufferBytes(out.uvs));
+        stats.AddSharedBuffer("tangents", GetBufferBytes(out.tangents));
+        stats.AddSharedBuffer("indices", GetBufferBytes(out.indices));
+        stats.AddBuffer("shapes", GetBufferBytes(out.shapes));
+        stats.AddBuffer("shapes_additional", GetBufferBytes(out.shapes_additional));
+        stats.AddBuffer("instances", GetBufferBytes(out.instances));
+        stats.AddBuffer("instance_transforms", GetBufferBytes(out.instance_transforms));
+        stats.AddBuffer("geometry_requests", GetBufferBytes(out.geometry_requests));
+        stats.AddBuffer("curve_nodes", GetBufferBytes(out.curve_nodes));
+        stats.AddBuffer("curve_segments", GetBufferBytes(out.curve_segments));
+        stats.AddBuffer("curve_shapes", GetBufferBytes(out.curve_shapes));
+        stats.AddBuffer("material_attributes", GetBufferBytes(out.material_attributes));
+        stats.AddBuffer("lights", GetBufferBytes(out.lights));
+        stats.AddBuffer("volumes", GetBufferBytes(out.volumes));
+        stats.AddBuffer("volume_grids", GetBufferBytes(out.volume_grids));
+        stats.AddBuffer("textures", GetBufferBytes(out.textures));
+        stats.AddSharedBuffer("texturedata", GetBufferBytes(out.texturedata));
+        stats.AddBuffer("texture_requests", GetBufferBytes(out.texture_requests));
+        stats.AddBuffer("camera", GetBufferBytes(out.camera) * out.camera_ring.size());
+        stats.AddBuffer("light_distributions", GetBufferBytes(out.light_distributions));
+        stats.AddBuffer("area_light_map", GetBufferBytes(out.area_light_map));
+        stats.AddBuffer("envmap_distribution", GetBufferBytes(out.envmap_distribution));
+        stats.AddBuffer("env_irradiance", GetBufferBytes(out.env_irradiance));
+        stats.AddBuffer("input_map_data", GetBufferBytes(out.input_map_data));
+
+        stats.num_shapes = static_cast<std::size_t>(out.num_base_shapes);
+        stats.num_instances = out.instance_descriptors.size();
+        stats.num_lights = static_cast<std::size_t>(out.num_lights);
+
+        stats.num_vertices = 0;
+        stats.num_triangles = 0;
+        for (auto const& range : out.geometry_ranges)
+        {
+            stats.num_vertices += range.second.vertex_count;
+            stats.num_triangles += range.second.index_count * (range.second.short_indices ? 2 : 1) / 3;
+        }
+    }
+
+    void ClwSceneController::UpdateTextures(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, ClwScene& out) const
+    {
+        // Get new buffer size
+        std::size_t tex_buffer_size = tex_collector.GetNumItems();
+
+        out.texture_bytes_uploaded = 0;
+
+        if (tex_buffer_size == 0)
+        {
+            out.textures = m_context.CreateBuffer<ClwScene::Texture>(1, CL_MEM_READ_ONLY);
+            out.texturedata = m_context.CreateBuffer<char>(1, CL_MEM_READ_ONLY);
+            out.texture_requests = m_context.CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+            m_context.FillBuffer(0, out.texture_requests, 0, 1);
+            ReleaseTextures(out);
+
+            std::vector<ClwScene::Texture> headers;
+            UpdateTextureImages({}, headers, out);
+            return;
+        }
+
+        // Texture indices change with the collector, so pending requests are dropped
+        if (tex_buffer_size > out.texture_requests.GetElementCount())
+        {
+            out.texture_requests = m_context.CreateBuffer<int>(tex_buffer_size, CL_MEM_READ_WRITE);
+        }
+
+        m_context.FillBuffer(0, out.texture_requests, 0, out.texture_requests.GetElementCount());
+
+        // Update material bundle first to be able to track differences
+        out.texture_bundle.reset(tex_collector.CreateBundle());
+
+        // Textures in collector order, which defines texture indices
+        auto& collected_textures = out.collected_textures;
+        collected_textures.clear();
+        collected_textures.reserve(tex_buffer_size);
+
+        std::unique_ptr<Iterator> tex_iter(tex_collector.CreateIterator());
+
+        for (; tex_iter->IsValid(); tex_iter->Next())
+        {
+            collected_textures.push_back(tex_iter->ItemAs<Texture>());
+        }
+
+        // UDIM sets only have headers, their tiles are collected as regular textures
+        std::set<Texture::Ptr> texture_set;
+        for (auto const& tex : collected_textures)
+        {
+            if (!std::dynamic_pointer_cast<UdimTexture>(tex))
+            {
+                texture_set.insert(tex);
+            }
+        }
+
+        // Textures which have their texels in texture data, with limited texture cache
+        // some of them are replaced by their low resolution copies
+        if (IsTextureCacheEnabled())
+        {
+            texture_set = UpdateTextureFallbacks(texture_set, out);
+        }
+
+        // Drop references to texel data of textures which are not used anymore
+        for (auto iter = out.texture_slots.begin(); iter != out.texture_slots.end();)
+        {
+            if (texture_set.find(iter->first) == texture_set.cend())
+            {
+                m_resources.ReleaseTexture(iter->first, iter->second.revision);
+                iter = out.texture_slots.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+
+        // Find textures which are new or have been modified since the last upload.
+        // Modified textures are rewritten in place as long as they fit into their slot
+        // and no other compiled scene uses the old texels.
+        std::vector<Texture::Ptr> pending_upload;
+        std::vector<Texture::Ptr> pending_allocation;
+
+        for (auto& tex : texture_set)
+        {
+            auto revision = tex->GetDataRevision();
+            auto iter = out.texture_slots.find(tex);
+
+            if (iter != out.texture_slots.end())
+            {
+                auto& slot = iter->second;
+
+                if (slot.revision == revision)
+                {
+                    continue;
+                }
+
+                if (slot.size == GetTextureSlotSize(*tex) &&
+                    m_resources.IsTextureExclusive(tex, slot.revision) &&
+                    m_resources.textures.find(std::make_pair(tex, revision)) == m_resources.textures.cend())
+                {
+                    m_resources.RenameTexture(tex, slot.revision, revision);
+                    slot.revision = revision;
+                    pending_upload.push_back(tex);
+                    continue;
+                }
+
+                m_resources.ReleaseTexture(tex, slot.revision);
+                out.texture_slots.erase(iter);
+            }
+
+            if (auto shared = m_resources.AcquireTexture(tex, revision))
+            {
+                out.texture_slots[tex] = *shared;
+                continue;
+            }
+
+            pending_allocation.push_back(tex);
+            pending_upload.push_back(tex);
+        }
+
+        // Allocate slots for new textures, remember how much space is missing.
+        // Slot sizes are multiples of 16, so all offsets stay 16 bytes aligned.
+        std::size_t missing_bytes = 0;
+
+        for (auto& tex : pending_allocation)
+        {
+            ClwScene::TextureSlot slot;
+            slot.size = GetTextureSlotSize(*tex);
+            slot.offset = m_resources.texture_allocator.Allocate(slot.size);
+            slot.revision = tex->GetDataRevision();
+
+            if (slot.offset == RangeAllocator::kInvalidOffset)
+            {
+                missing_bytes += slot.size;
+            }
+
+            out.texture_slots[tex] = slot;
+        }
+
+        if (missing_bytes > 0 || m_resources.texturedata.GetElementCount() == 0)
+        {
+            GrowTextureData(missing_bytes);
+        }
+
+        m_resources.BindTextures(out);
+
+        // Place textures which did not fit into the free tail
+        for (auto& tex : pending_allocation)
+        {
+            auto& slot = out.texture_slots[tex];
+
+            if (slot.offset == RangeAllocator::kInvalidOffset)
+            {
+                slot.offset = m_resources.texture_allocator.Allocate(slot.size);
+            }
+
+            assert(slot.offset != RangeAllocator::kInvalidOffset);
+
+            m_resources.AddTexture(tex, slot);
+        }
+
+        // Headers are small, so they are always rewritten
+        WriteTextureHeaders(out);
+
+        // Write texel data of new and modified textures only, data is staged directly from the texture
+        for (auto& tex : pending_upload)
+        {
+            UploadTextureData(*tex, out.texture_slots[tex], out);
+        }
+
+        LogInfo("Uploaded ", out.texture_bytes_uploaded, " bytes of texture data for ", pending_upload.size(), " textures\n");
+    }
+
+    void ClwSceneController::GrowTextureData(std::size_t missing_bytes) const
+    {
+        // Existing texels are copied on the device
+        auto capacity = m_resources.texture_allocator.GetCapacity();
+        auto new_capacity = align16(std::max<std::size_t>(capacity + std::max(missing_bytes, capacity / 4), 16u));
+
+        LogInfo("Creating texture data buffer...\n");
+        auto texturedata = m_context.CreateBuffer<char>(new_capacity, kTextureDataFlags);
+
+        if (capacity > 0)
+        {
+            m_context.CopyBuffer(0u, m_resources.texturedata, texturedata, 0, 0, capacity);
+        }
+
+        m_resources.texturedata = texturedata;
+        m_resources.texture_allocator.Grow(new_capacity);
+        RebindSharedBuffers();
+    }
+
+    void ClwSceneController::UploadTextureData(Texture const& texture, ClwScene::TextureSlot const& slot, ClwScene& out) const
+    {
+        WriteTextureData(texture, slot.offset, out);
+
+        out.texture_bytes_uploaded += texture.GetSizeInBytes();
+
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+        // Uploads are enqueued on the same queue, so the first level is in place when the kernels run
+        GenerateTextureMips(texture, slot.offset, out);
+#endif
+    }
+
+    void ClwSceneController::WriteTextureHeaders(ClwScene& out) const
+    {
+        auto const& collected_textures = out.collected_textures;
+
+        // Paged out textures point at their low resolution copies
+        std::vector<Texture::Ptr> resident_textures(collected_textures.size());
+        std::vector<ClwScene::Texture> textures(collected_textures.size());
+
+        ParallelFor(collected_textures.size(), [&](std::size_t i)
+        {
+            auto const& tex = collected_textures[i];
+
+            if (std::dynamic_pointer_cast<UdimTexture>(tex))
+            {
+                resident_textures[i] = tex;
+                return;
+            }
+
+            auto iter = out.texture_slots.find(tex);
+            auto paged_out = iter == out.texture_slots.cend();
+
+            resident_textures[i] = paged_out ? out.texture_fallbacks.at(tex).texture : tex;
+
+            auto const& slot = paged_out ? out.texture_slots.at(resident_textures[i]) : iter->second;
+            WriteTexture(*resident_textures[i], slot.offset, textures.data() + i);
+
+            if (paged_out)
+            {
+                textures[i].flags |= ClwScene::kTextureNotResident;
+            }
+        });
+
+        // Tile tables of UDIM sets follow the headers, every header sized entry holds 8 texture indices
+        static_assert(sizeof(ClwScene::Texture) == 8 * sizeof(int), "UDIM tile tables expect 32 byte texture headers");
+
+        std::map<Texture::Ptr, int> texture_indices;
+
+        for (auto i = 0u; i < collected_textures.size(); ++i)
+        {
+            auto udim = std::dynamic_pointer_cast<UdimTexture>(collected_textures[i]);
+
+            if (!udim)
+            {
+                continue;
+            }
+
+            if (texture_indices.empty())
+            {
+                for (auto j = 0u; j < collected_textures.size(); ++j)
+                {
+                    texture_indices[collected_textures[j]] = static_cast<int>(j);
+                }
+            }
+
+            auto num_rows = udim->GetNumRows();
+            std::vector<int> tiles((UdimTexture::kNumColumns * num_rows + 7) & ~7, -1);
+
+            for (auto const& tile : udim->GetTiles())
+            {
+                tiles[tile.first - UdimTexture::kFirstTile] = texture_indices.at(tile.second);
+            }
+
+            auto table_offset = textures.size();
+            textures.resize(table_offset + tiles.size() * sizeof(int) / sizeof(ClwScene::Texture));
+            std::memcpy(textures.data() + table_offset, tiles.data(), tiles.size() * sizeof(int));
+
+            auto& header = textures[i];
+            header.w = UdimTexture::kNumColumns;
+            header.h = num_rows;
+            header.d = 1;
+            header.dataoffset = static_cast<int>(table_offset);
+            header.fmt = ClwScene::TextureFormat::UDIM;
+            header.levels = 1;
+            header.layer = -1;
+            header.flags = 0;
+        }
+
+        if (textures.size() > out.textures.GetElementCount())
+        {
+            out.textures = m_context.CreateBuffer<ClwScene::Texture>(textures.size(), CL_MEM_READ_ONLY);
+        }
+
+        UpdateTextureImages(resident_textures, textures, out);
+
+        m_uploader.Write(ClwUploader::Category::kTextures, out.textures, textures.data(), textures.size());
+    }
+
+    std::set<Texture::Ptr> ClwSceneController::UpdateTextureFallbacks(std::set<Texture::Ptr> const& textures, ClwScene& out) const
+    {
+        // Forget textures which have been removed or shrunk
+        for (auto iter = out.texture_fallbacks.begin(); iter != out.texture_fallbacks.end();)
+        {
+            if (textures.find(iter->first) == textures.cend() || !IsTextureStreamable(*iter->first))
+            {
+                out.texture_last_used.erase(iter->first);
+                iter = out.texture_fallbacks.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+
+        auto cache_usage = GetTextureCacheUsage();
+
+        std::set<Texture::Ptr> resident;
+
+        for (auto& tex : textures)
+        {
+            if (!IsTextureStreamable(*tex))
+            {
+                resident.insert(tex);
+                continue;
+            }
+
+            // Copies follow texture edits
+            auto& fallback = out.texture_fallbacks[tex];
+            if (!fallback.texture || fallback.revision != tex->GetDataRevision())
+            {
+                fallback.texture = CreateTextureFallback(*tex);
+                fallback.revision = tex->GetDataRevision();
+            }
+
+            resident.insert(fallback.texture);
+
+            // Textures stay where they are, new ones are placed as long as they fit
+            // and the rest is paged in by UpdateTextureResidency once rays sample it
+            auto known = out.texture_last_used.find(tex) != out.texture_last_used.cend();
+
+            if (out.texture_slots.find(tex) != out.texture_slots.cend())
+            {
+                resident.insert(tex);
+            }
+            else if (!known)
+            {
+                auto size = GetTextureSlotSize(*tex);
+
+                if (m_resources.textures.find(std::make_pair(tex, tex->GetDataRevision())) != m_resources.textures.cend())
+                {
+                    resident.insert(tex);
+                }
+                else if (cache_usage + size <= m_texture_cache_bytes)
+                {
+                    cache_usage += size;
+                    resident.insert(tex);
+                }
+            }
+
+            if (!known)
+            {
+                out.texture_last_used.emplace(tex, out.texture_frame);
+            }
+        }
+
+        return resident;
+    }
+
+    std::size_t ClwSceneController::GetTextureCacheUsage() const
+    {
+        // Full resolution texels of all the compiled scenes count, low resolution copies are never streamable
+        std::size_t usage = 0;
+
+        for (auto const& entry : m_resources.textures)
+        {
+            if (IsTextureStreamable(*entry.first.first))
+            {
+                usage += entry.second.slot.size;
+            }
+        }
+
+        return usage;
+    }
+
+    bool ClwSceneController::UpdateTextureResidency(Scene1::Ptr scene) const
+    {
+        if (!IsTextureCacheEnabled())
+        {
+            return false;
+        }
+
+        auto& out = GetCachedScene(scene);
+        auto num_textures = out.collected_textures.size();
+
+        if (num_textures == 0)
+        {
+            return false;
+        }
+
+        std::vector<int> requests(num_textures);
+        m_context.ReadBuffer(0, out.texture_requests, requests.data(), num_textures).Wait();
+        m_context.FillBuffer(0, out.texture_requests, 0, out.texture_requests.GetElementCount());
+
+        auto frame = ++out.texture_frame;
+        std::vector<Texture::Ptr> missing;
+
+        for (auto i = 0u; i < num_textures; ++i)
+        {
+            if (requests[i] == 0)
+            {
+                continue;
+            }
+
+            auto const& tex = out.collected_textures[i];
+            out.texture_last_used[tex] = frame;
+
+            if (out.texture_slots.find(tex) == out.texture_slots.cend() &&
+                std::find(missing.cbegin(), missing.cend(), tex) == missing.cend())
+            {
+                missing.push_back(tex);
+            }
+        }
+
+        auto cache_usage = GetTextureCacheUsage();
+
+        std::size_t num_paged_in = 0;
+        std::size_t num_evicted = 0;
+        out.texture_bytes_uploaded = 0;
+
+        for (auto& tex : missing)
+        {
+            auto revision = tex->GetDataRevision();
+
+            // Resident for another scene, nothing to upload
+            if (auto shared = m_resources.AcquireTexture(tex, revision))
+            {
+                out.texture_slots[tex] = *shared;
+                ++num_paged_in;
+                continue;
+            }
+
+            auto size = GetTextureSlotSize(*tex);
+
+            // Would evict everything and still not fit
+            if (size > m_texture_cache_bytes)
+            {
+                continue;
+            }
+
+            // Evict least recently sampled textures until the texture fits,
+            // textures sampled since the last update are never evicted.
+            // Texels used by other scenes would not free any space.
+            while (cache_usage + size > m_texture_cache_bytes)
+            {
+                auto victim = out.texture_slots.end();
+                auto oldest = frame;
+
+                for (auto iter = out.texture_slots.begin(); iter != out.texture_slots.end(); ++iter)
+                {
+                    auto last_used = out.texture_last_used.find(iter->first);
+
+                    // Low resolution copies and small textures are always resident
+                    if (last_used == out.texture_last_used.cend() ||
+                        !m_resources.IsTextureExclusive(iter->first, iter->second.revision))
+                    {
+                        continue;
+                    }
+
+                    if (last_used->second < oldest)
+                    {
+                        oldest = last_used->second;
+                        victim = iter;
+                    }
+                }
+
+                if (victim == out.texture_slots.end())
+                {
+                    break;
+                }
+
+                cache_usage -= victim->second.size;
+                m_resources.ReleaseTexture(victim->first, victim->second.revision);
+                out.texture_slots.erase(victim);
+                ++num_evicted;
+            }
+
+            if (cache_usage + size > m_texture_cache_bytes)
+            {
+                continue;
+            }
+
+            ClwScene::TextureSlot slot;
+            slot.size = size;
+            slot.offset = m_resources.texture_allocator.Allocate(size);
+            slot.revision = revision;
+
+            // Freed ranges might be too fragmented, the pool is not limited by the cache size
+            if (slot.offset == RangeAllocator::kInvalidOffset)
+            {
+                GrowTextureData(size);
+                m_resources.BindTextures(out);
+                slot.offset = m_resources.texture_allocator.Allocate(size);
+            }
+
+            assert(slot.offset != RangeAllocator::kInvalidOffset);
+
+            m_resources.AddTexture(tex, slot);
+            out.texture_slots[tex] = slot;
+            cache_usage += size;
+
+            UploadTextureData(*tex, slot, out);
+            ++num_paged_in;
+        }
+
+        if (num_paged_in == 0 && num_evicted == 0)
+        {
+            return false;
+        }
+
+        LogInfo("Texture cache: paged in ", num_paged_in, " textures (", out.texture_bytes_uploaded, " bytes), evicted ", num_evicted, "\n");
+
+        // Evicted textures have to be marked too, so all the headers are rewritten
+        WriteTextureHeaders(out);
+
+        return true;
+    }
+
+#ifndef NDEBUG
+    // We're not using this function on release
+    // Convert Material:: types to ClwScene:: types
+    static ClwScene::Bxdf GetMaterialType(Material const& material)
+    {
+        // Distinguish between single bxdf materials and compound ones
+        if (dynamic_cast<UberV2Material const*>(&material))
+        {
+            return ClwScene::Bxdf::kUberV2;
+        }
+
+        return ClwScene::Bxdf::kZero;
+    }
+#endif
+
+    // Describe order of fields and layers
+    static std::vector<std::pair<UberV2Material::Layers, std::vector<std::string>>> const& GetUberV2OrderedFields()
+    {
+        static const std::vector<std::pair<UberV2Material::Layers, std::vector<std::string>>> uberv2_ordered_fields =
+        {
+            {
+                UberV2Material::Layers::kEmissionLayer,
+                { "uberv2.emission.color" }
+            },
+            {
+                UberV2Material::Layers::kCoatingLayer,
+                { "uberv2.coating.color", "uberv2.coating.ior"}
+            },
+            {
+                UberV2Material::Layers::kReflectionLayer,
+                {
+                    "uberv2.reflection.color",
+                    "uberv2.reflection.roughness",
+                    "uberv2.reflection.anisotropy",
+                    "uberv2.reflection.anisotropy_rotation",
+                    "uberv2.reflection.ior",
+                    "uberv2.reflection.metalness",
+                }
+            },
+            {
+                UberV2Material::Layers::kDiffuseLayer,
+                { "uberv2.diffuse.color"}
+            },
+            {
+                UberV2Material::Layers::kRefractionLayer,
+                {
+                    "uberv2.refraction.color",
+                    "uberv2.refraction.roughness",
+                    "uberv2.refraction.ior"
+                }
+            },
+            {
+                UberV2Material::Layers::kTransparencyLayer,
+                { "uberv2.transparency" }
+            },
+            {
+                UberV2Material::Layers::kShadingNormalLayer,
+                { "uberv2.shading_normal" }
+            },
+            {
+                UberV2Material::Layers::kSSSLayer,
+                {
+                    "uberv2.sss.absorption_color",
+                    "uberv2.sss.scatter_color",
+                    "uberv2.sss.subsurface_color",
+                    "uberv2.sss.absorption_distance",
+                    "uberv2.sss.scatter_distance",
+                    "uberv2.sss.scatter_direction"
+                }
+            },
+        };
+
+        return uberv2_ordered_fields;
+    }
+
+    std::size_t ClwSceneController::GetMaterialSize(Material const& material) const
+    {
+        assert(GetMaterialType(material) == ClwScene::Bxdf::kUberV2);
+        std::uint32_t layers = static_cast<const UberV2Material&>(material).GetLayers();
+
+        // Packed parameters and input map ids of enabled layers
+        std::size_t size = 1;
+
+        for (auto &layer_info : GetUberV2OrderedFields())
+        {
+            if ((layers & layer_info.first) == layer_info.first)
+            {
+                size += layer_info.second.size();
+            }
+        }
+
+        return size;
+    }
+
+    void ClwSceneController::WriteMaterial(Material const& material, Collector& mat_collector, Collector& tex_collector, std::int32_t* data) const
+    {
+        assert(GetMaterialType(material) == ClwScene::Bxdf::kUberV2);
+        const UberV2Material &uber_material = static_cast<const UberV2Material&>(material);
+
+        std::uint32_t layers = uber_material.GetLayers();
+
+        // Pack material parameters
+        std::int32_t params = 0;
+        params |= ((uber_material.IsLinkRefractionIOR()) ? 1 : 0) << 0;
+        params |= ((uber_material.IsThin()) ? 1 : 0) << 1;
+        params |= ((uber_material.isDoubleSided()) ? 1 : 0) << 2;
+        params |= ((uber_material.IsMultiscatter()) ? 1 : 0) << 3;
+        params |= ((uber_material.GetSSSMode() == UberV2Material::kSSSDiffusion) ? 1 : 0) << 4;
+        *data++ = params;
+
+        // Distinct samplers of the same texture share the id of the first one,
+        // so generated UberV2PrepareInputs fetches the texture once
+        std::map<std::pair<InputMap::InputMapType, Texture const*>, std::int32_t> samplers;
+
+        // Write material layers. Order matters.
+        for (auto &layer_info : GetUberV2OrderedFields())
+        {
+            if ((layers & layer_info.first) == layer_info.first)
+            {
+                for (auto &layer_param : layer_info.second)
+                {
+                    auto value = material.GetInputValue(layer_param);
+                    assert(value.type == Material::InputType::kInputMap);
+
+                    auto input_map = value.input_map_value;
+                    std::int32_t id = input_map ? input_map->GetId() : -1;
+
+                    if (input_map && (input_map->m_type == InputMap::InputMapType::kSampler ||
+                                      input_map->m_type == InputMap::InputMapType::kSamplerBumpmap))
+                    {
+                        auto texture = static_cast<InputMap_Sampler const&>(*input_map).GetTexture().get();
+                        id = samplers.emplace(std::make_pair(input_map->m_type, texture), id).first->second;
+                    }
+
+                    *data++ = id;
+                }
+            }
+        }
+    }
+
+    // Convert Light:: types to ClwScene:: types
+    static int GetLightType(Light const& light)
+    {
+
+        if (dynamic_cast<PointLight const*>(&light))
+        {
+            return ClwScene::kPoint;
+        }
+        else if (dynamic_cast<DirectionalLight const*>(&light))
+        {
+            return ClwScene::kDirectional;
+        }
+        else if (dynamic_cast<SpotLight const*>(&light))
+        {
+            return ClwScene::kSpot;
+        }
+        else if (dynamic_cast<ImageBasedLight const*>(&light))
+        {
+            return ClwScene::kIbl;
+        }
+        else
+        {
+            return ClwScene::LightType::kArea;
+        }
+    }
+
+    void ClwSceneController::WriteLight(Scene1 const& scene, Light const& light, Collector& tex_collector, void* data) const
+    {
+        auto clw_light = reinterpret_cast<ClwScene::Light*>(data);
+
+        auto type = GetLightType(light);
+
+        clw_light->type = type;
+        clw_light->link_mask = static_cast<int>(light.GetLinkMask());
+        clw_light->profile = -1;
+        clw_light->profile_distribution = 0;
+        clw_light->padding2 = 0;
+
+        switch (type)
+        {
+            case ClwScene::kPoint:
+            {
+                clw_light->p = light.GetPosition();
+                clw_light->d = light.GetDirection();
+                clw_light->intensity = light.GetEmittedRadiance();
+                auto profile = light.GetProfile();
+                clw_light->profile = profile ? tex_collector.GetItemIndex(profile) : -1;
+                break;
+            }
+
+            case ClwScene::kDirectional:
+            {
+                clw_light->d = light.GetDirection();
+                clw_light->intensity = light.GetEmittedRadiance();
+                break;
+            }
+
+            case ClwScene::kSpot:
+            {
+                clw_light->p = light.GetPosition();
+                clw_light->d = light.GetDirection();
+                clw_light->intensity = light.GetEmittedRadiance();
+
+                auto cone_shape = static_cast<SpotLight const&>(light).GetConeShape();
+                clw_light->ia = cone_shape.x;
+                clw_light->oa = cone_shape.y;
+                auto profile = light.GetProfile();
+                clw_light->profile = profile ? tex_collector.GetItemIndex(profile) : -1;
+                break;
+            }
+
+            case ClwScene::kIbl:
+            {
+                auto& ibl = static_cast<ImageBasedLight const&>(light);
+                clw_light->multiplier = ibl.GetMultiplier();
+                auto main_tex = ibl.GetTexture();
+                clw_light->tex = main_tex ? tex_collector.GetItemIndex(main_tex) : -1;
+                auto reflection_tex = ibl.GetReflectionTexture();
+                clw_light->tex_reflection = reflection_tex ? tex_collector.GetItemIndex(reflection_tex) : -1;
+                auto refraction_tex = ibl.GetRefractionTexture();
+                clw_light->tex_refraction = refraction_tex ? tex_collector.GetItemIndex(refraction_tex) : -1;
+                auto transparency_tex = ibl.GetTransparencyTexture();
+                clw_light->tex_transparency = transparency_tex ? tex_collector.GetItemIndex(transparency_tex) : -1;
+                auto background_tex = ibl.GetBackgroundTexture();
+                clw_light->tex_background = background_tex ? tex_collector.GetItemIndex(background_tex) : -1;
+                clw_light->ibl_mirror_x = ibl.GetMirrorX();
+                break;
+            }
+
+            case ClwScene::kArea:
+            {
+                // TODO: optimize this linear search
+                auto shape = static_cast<AreaLight const&>(light).GetShape();
+
+                auto shape_iter = scene.CreateShapeIterator();
+
+                auto idx = GetShapeIdx(*shape_iter, shape);
+
+                clw_light->id = shape->GetId();
+                clw_light->shapeidx = static_cast<int>(idx);
+                clw_light->primidx = static_cast<int>(static_cast<AreaLight const&>(light).GetPrimitiveIdx());
+                break;
+            }
+
+            default:
+            assert(false);
+            break;
+        }
+    }
+
+    // Append luminance distribution of lat-long texture: width, height, marginal distribution over rows,
+    // then conditional distribution over columns for each row
+    static void WriteLatLongDistribution(Texture const& texture, std::vector<int>& data)
+    {
+        auto size = texture.GetSize();
+        auto width = static_cast<std::uint32_t>(size.x);
+        auto height = static_cast<std::uint32_t>(size.y);
+
+        auto start = data.size();
+        data.resize(start + 2 + GetDistributionSize(height) + height * GetDistributionSize(width));
+        data[start] = static_cast<int>(width);
+        data[start + 1] = static_cast<int>(height);
+
+        std::vector<float> luminance(width);
+        std::vector<float> row_weights(height);
+        Distribution1D row_distribution;
+
+        auto current = &data[start + 2 + GetDistributionSize(height)];
+
+        for (auto y = 0u; y < height; ++y)
+        {
+            for (auto x = 0u; x < width; ++x)
+            {
+                auto texel = texture.GetTexel(x, y);
+                luminance[x] = 0.2126f * texel.x + 0.7152f * texel.y + 0.0722f * texel.z;
+            }
+
+            auto row_sum = std::accumulate(luminance.begin(), luminance.end(), 0.f);
+
+            // Black rows are never selected, but still need a valid distribution
+            if (row_sum <= 0.f)
+            {
+                std::fill(luminance.begin(), luminance.end(), 1.f);
+            }
+
+            row_distribution.Set(&luminance[0], width);
+            current = WriteDistribution(row_distribution, current);
+
+            // Account for the solid angle of the row in lat-long mapping:
+            // texture rows go from the top (theta = 0) to the bottom (theta = PI)
+            auto sin_theta = std::sin(PI * (y + 0.5f) / height);
+            row_weights[y] = std::max(row_sum, 0.f) / width * sin_theta;
+        }
+
+        if (std::accumulate(row_weights.begin(), row_weights.end(), 0.f) <= 0.f)
+        {
+            std::fill(row_weights.begin(), row_weights.end(), 1.f);
+        }
+
+        Distribution1D marginal_distribution(&row_weights[0], height);
+        WriteDistribution(marginal_distribution, &data[start + 2]);
+    }
+
+    // Area lights by the primitives they are attached to, layout expected by AreaLightMap_Find: number of shapes,
+    // num_shapes + 1 offsets of the shape entries, then (primitive, light index) pairs sorted by primitive per shape
+    static void WriteAreaLightMap(ClwScene::Light const* lights, std::size_t num_lights, std::vector<int>& data)
+    {
+        std::vector<std::array<int, 3>> entries;
+
+        for (auto i = 0u; i < num_lights; ++i)
+        {
+            if (lights[i].type == ClwScene::kArea)
+            {
+                entries.push_back({ { lights[i].shapeidx, lights[i].primidx, static_cast<int>(i) } });
+            }
+        }
+
+        std::sort(entries.begin(), entries.end());
+
+        auto num_shapes = entries.empty() ? 0 : entries.back()[0] + 1;
+        data.assign(2 + num_shapes + 2 * entries.size(), 0);
+        data[0] = num_shapes;
+
+        // Count entries of every shape, then turn counts into offsets
+        for (auto const& entry : entries)
+        {
+            ++data[2 + entry[0]];
+        }
+
+        std::partial_sum(data.begin() + 1, data.begin() + 2 + num_shapes, data.begin() + 1);
+
+        auto pairs = &data[2 + num_shapes];
+        for (auto const& entry : entries)
+        {
+            *pairs++ = entry[1];
+            *pairs++ = entry[2];
+        }
+    }
+
+    // Infinite lights are selected by power, with the probability of their share of the total power
+    static float BuildInfiniteLightDistribution(std::vector<float> const& light_power,
+        std::vector<float> infinite_light_power, Distribution1D& infinite_light_distribution)
+    {
+        auto infinite_power = std::accumulate(infinite_light_power.begin(), infinite_light_power.end(), 0.f);
+        auto total_power = std::accumulate(light_power.begin(), light_power.end(), 0.f);
+        auto infinite_light_probability = 0.f;
+
+        if (infinite_power > 0.f)
+        {
+            infinite_light_probability = infinite_power / total_power;
+        }
+        else
+        {
+            std::fill(infinite_light_power.begin(), infinite_light_power.end(), 1.f);
+        }
+
+        infinite_light_distribution.Set(&infinite_light_power[0], (std::uint32_t)infinite_light_power.size());
+        return infinite_light_probability;
+    }
+
+#ifndef BAIKAL_LIGHT_GRID
+    // Power distribution, then light BVH section: number of nodes, infinite light probability,
+    // infinite light distribution, nodes, parent indices and light to leaf node mapping
+    static std::vector<int> BuildLightDistributions(
+        std::vector<float> const& light_power,
+        std::vector<RadeonRays::float3> const& local_light_pmin,
+        std::vector<RadeonRays::float3> const& local_light_pmax,
+        std::vector<float> const& local_light_power,
+        std::vector<std::uint32_t> const& local_light_indices,
+        std::vector<float> infinite_light_power)
+    {
+        // Create distribution over light sources based on their power
+        Distribution1D light_distribution(light_power.data(), (std::uint32_t)light_power.size());
+
+        // Build light BVH over local lights for scenes with many lights
+        LightBvh light_bvh;
+        Distribution1D infinite_light_distribution;
+        float infinite_light_probability = 0.f;
+
+        if (local_light_indices.size() > kLightBvhMinLights)
+        {
+            light_bvh.Build(&local_light_pmin[0], &local_light_pmax[0], &local_light_power[0],
+                &local_light_indices[0], (std::uint32_t)local_light_indices.size());
+
+            infinite_light_probability = BuildInfiniteLightDistribution(light_power, std::move(infinite_light_power), infinite_light_distribution);
+        }
+
+        auto num_lights = light_power.size();
+        auto num_nodes = light_bvh.m_nodes.size();
+        auto distribution_buffer_size = GetDistributionSize(num_lights) + 2;
+        if (num_nodes > 0)
+        {
+            distribution_buffer_size += GetDistributionSize(num_lights) +
+                num_nodes * sizeof(LightBvh::Node) / sizeof(int) + num_nodes + num_lights;
+        }
+
+        // Write distribution data
+        std::vector<int> distribution_data(distribution_buffer_size);
+        auto current = WriteDistribution(light_distribution, distribution_data.data());
+
+        *current++ = (int)num_nodes;
+        *reinterpret_cast<float*>(current++) = infinite_light_probability;
+
+        if (num_nodes > 0)
+        {
+            current = WriteDistribution(infinite_light_distribution, current);
+
+            std::copy(light_bvh.m_nodes.begin(), light_bvh.m_nodes.end(), reinterpret_cast<LightBvh::Node*>(current));
+            current += num_nodes * sizeof(LightBvh::Node) / sizeof(int);
+
+            std::copy(light_bvh.m_parents.begin(), light_bvh.m_parents.end(), current);
+            current += num_nodes;
+
+            // Infinite lights are not in the tree
+            std::fill(current, current + num_lights, -1);
+            for (auto i = 0u; i < num_nodes; ++i)
+            {
+                if (light_bvh.m_nodes[i].child < 0)
+                {
+                    current[-light_bvh.m_nodes[i].child - 1] = (int)i;
+                }
+            }
+        }
+
+        return distribution_data;
+    }
+#else
+    // Power distribution, then light grid section: number of cells, infinite light probability,
+    // infinite and local light distributions, grid origin, cell size and resolution,
+    // cell list offsets, cell list probabilities, cell light indices and CDF values
+    static std::vector<int> BuildLightDistributions(
+        std::vector<float> const& light_power,
+        std::vector<RadeonRays::float3> const& local_light_pmin,
+        std::vector<RadeonRays::float3> const& local_light_pmax,
+        std::vector<float> const& local_light_power,
+        std::vector<std::uint32_t> const& local_light_indices,
+        std::vector<float> infinite_light_power)
+    {
+        // Create distribution over light sources based on their power
+        Distribution1D light_distribution(light_power.data(), (std::uint32_t)light_power.size());
+
+        // Build light grid over local lights for scenes with many lights
+        LightGrid light_grid;
+        Distribution1D infinite_light_distribution;
+        Distribution1D local_light_distribution;
+        float infinite_light_probability = 0.f;
+
+        auto num_lights = light_power.size();
+
+        if (local_light_indices.size() > kLightBvhMinLights)
+        {
+            light_grid.Build(&local_light_pmin[0], &local_light_pmax[0], &local_light_power[0],
+                &local_light_indices[0], (std::uint32_t)local_light_indices.size());
+
+            // Lights left out of cell lists are selected by power
+            std::vector<float> power(num_lights, 0.f);
+            for (auto i = 0u; i < local_light_indices.size(); ++i)
+            {
+                power[local_light_indices[i]] = local_light_power[i];
+            }
+
+            if (std::accumulate(power.begin(), power.end(), 0.f) <= 0.f)
+            {
+                std::fill(power.begin(), power.end(), 1.f);
+            }
+
+            local_light_distribution.Set(&power[0], (std::uint32_t)num_lights);
+
+            infinite_light_probability = BuildInfiniteLightDistribution(light_power, std::move(infinite_light_power), infinite_light_distribution);
+        }
+
+        auto num_cells = light_grid.GetNumCells();
+        auto num_entries = light_grid.m_light_indices.size();
+        auto distribution_buffer_size = GetDistributionSize(num_lights) + 2;
+        if (num_cells > 0)
+        {
+            distribution_buffer_size += 2 * GetDistributionSize(num_lights) + 9 +
+                (num_cells + 1) + num_cells + 2 * num_entries;
+        }
+
+        // Write distribution data
+        std::vector<int> distribution_data(distribution_buffer_size);
+        auto current = WriteDistribution(light_distribution, distribution_data.data());
+
+        *current++ = (int)num_cells;
+        *reinterpret_cast<float*>(current++) = infinite_light_probability;
+
+        if (num_cells > 0)
+        {
+            current = WriteDistribution(infinite_light_distribution, current);
+            current = WriteDistribution(local_light_distribution, current);
+
+            auto header = reinterpret_cast<float*>(current);
+            header[0] = light_grid.m_pmin.x;
+            header[1] = light_grid.m_pmin.y;
+            header[2] = light_grid.m_pmin.z;
+            header[3] = light_grid.m_cell_size.x;
+            header[4] = light_grid.m_cell_size.y;
+            header[5] = light_grid.m_cell_size.z;
+            current += 6;
+
+            for (auto axis = 0u; axis < 3; ++axis)
+            {
+                *current++ = (int)light_grid.m_resolution[axis];
+            }
+
+            current = std::copy(light_grid.m_cell_offsets.begin(), light_grid.m_cell_offsets.end(), current);
+            current = reinterpret_cast<int*>(std::copy(light_grid.m_list_probabilities.begin(),
+                light_grid.m_list_probabilities.end(), reinterpret_cast<float*>(current)));
+            current = std::copy(light_grid.m_light_indices.begin(), light_grid.m_light_indices.end(), current);
+            std::copy(light_grid.m_cdf.begin(), light_grid.m_cdf.end(), reinterpret_cast<float*>(current));
+        }
+
+        return distribution_data;
+    }
+#endif
+
+    void ClwSceneController::UpdateLights(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, ClwScene& out) const
+    {
+        std::size_t num_lights_written = 0;
+
+        auto env_override = scene.GetEnvironmentOverride();
+
+        auto num_lights = scene.GetNumLights();
+
+        // Create light buffer if needed
+        if (num_lights > out.lights.GetElementCount())
+        {
+            out.lights = m_context.CreateBuffer<ClwScene::Light>(num_lights, CL_MEM_READ_ONLY);
+        }
+
+        std::vector<ClwScene::Light> lights(num_lights);
+
+        std::unique_ptr<Iterator> light_iter(scene.CreateLightIterator());
+
+        // Light records have fixed size, so they are written independently
+        {
+            std::vector<Light::Ptr> scene_lights;
+            scene_lights.reserve(num_lights);
+
+            for (; light_iter->IsValid(); light_iter->Next())
+            {
+                scene_lights.push_back(light_iter->ItemAs<Light>());
+            }
+
+            ParallelFor(scene_lights.size(), [&](std::size_t i)
+            {
+                WriteLight(scene, *scene_lights[i], tex_collector, lights.data() + i);
+            });
+
+            light_iter->Reset();
+        }
+
+        // Disable IBL by default
+        out.envmapidx = -1;
+
+        // Allocate intermediate storage for lights power distribution
+        std::vector<float> light_power(num_lights);
+        std::uint32_t k = 0;
+
+        // Texture used to build environment light distribution
+        Texture::Ptr env_texture;
+
+        // Bounds of local lights for light BVH, infinite lights only enter power distribution
+        std::vector<RadeonRays::float3> local_light_pmin;
+        std::vector<RadeonRays::float3> local_light_pmax;
+        std::vector<float> local_light_power;
+        std::vector<std::uint32_t> local_light_indices;
+        std::vector<float> infinite_light_power(num_lights, 0.f);
+
+        // Intensity profiles of written lights, their distributions follow the light distributions
+        std::vector<Texture const*> light_profiles(num_lights, nullptr);
+
+        // Serialize
+        {
+            for (; light_iter->IsValid(); light_iter->Next())
+            {
+                auto light = light_iter->ItemAs<Light>();
+
+                // Find and update IBL idx
+                auto ibl = std::dynamic_pointer_cast<ImageBasedLight>(light_iter->ItemAs<Light>());
+                if (ibl)
+                {
+                    out.envmapidx = static_cast<int>(num_lights_written);
+                    env_texture = ibl->GetTexture();
+                }
+
+                if (lights[k].profile != -1)
+                {
+                    light_profiles[k] = light->GetProfile().get();
+                }
+
+                ++num_lights_written;
+
+                auto power = light->GetPower(scene);
+
+                // TODO: move luminance calculation into utility function
+                light_power[k] = 0.2126f * power.x + 0.7152f * power.y + 0.0722f * power.z;
+
+                auto area_light = std::dynamic_pointer_cast<AreaLight>(light);
+                bool is_infinite = ibl || std::dynamic_pointer_cast<DirectionalLight>(light);
+
+#ifdef BAIKAL_AREA_LIGHT_IMPORTANCE
+                // Emission comes from the mesh material rather than the light,
+                // so triangles are selected by their area times emitted luminance
+                if (area_light)
+                {
+                    light_power[k] *= GetAreaLightEmission(*area_light);
+                }
+#endif
+
+                if (is_infinite)
+                {
+                    infinite_light_power[k] = light_power[k];
+                }
+                else
+                {
+                    RadeonRays::bbox bounds;
+
+                    if (area_light)
+                    {
+                        auto mesh = std::static_pointer_cast<Mesh>(area_light->GetShape());
+                        auto indices = mesh->GetIndices();
+                        auto vertices = mesh->GetVertices();
+                        auto transform = mesh->GetTransform();
+                        auto prim_idx = area_light->GetPrimitiveIdx();
+
+                        for (auto v = 0u; v < 3; ++v)
+                        {
+                            bounds.grow(transform * vertices[indices[prim_idx * 3 + v]]);
+                        }
+                    }
+                    else
+                    {
+                        bounds.grow(light->GetPosition());
+                    }
+
+                    local_light_pmin.push_back(bounds.pmin);
+                    local_light_pmax.push_back(bounds.pmax);
+                    local_light_power.push_back(light_power[k]);
+                    local_light_indices.push_back(k);
+                }
+
+                ++k;
+            }
+        }
+
+        // Distributions and light BVH only depend on light bounds and power,
+        // so they are taken from the compile cache when the lights have not changed
+        ContentHash light_hash;
+
+        if (m_compile_cache.IsEnabled())
+        {
+            light_hash.Add(kLightBvhMinLights);
+#ifdef BAIKAL_LIGHT_GRID
+            // Grid and BVH layouts must not be mixed up
+            light_hash.Add(true);
+#endif
+            light_hash.Add(light_power);
+            light_hash.Add(local_light_pmin);
+            light_hash.Add(local_light_pmax);
+            light_hash.Add(local_light_power);
+            light_hash.Add(local_light_indices);
+            light_hash.Add(infinite_light_power);
+        }
+
+        std::vector<int> distribution_data;
+
+        if (!m_compile_cache.Load("lights", light_hash.Get(), distribution_data))
+        {
+            distribution_data = BuildLightDistributions(light_power, local_light_pmin, local_light_pmax,
+                local_light_power, local_light_indices, std::move(infinite_light_power));
+            m_compile_cache.Save("lights", light_hash.Get(), distribution_data);
+        }
+
+        // Profile distributions are appended in the order of lights, lights sharing a profile share its distribution
+        std::map<Texture const*, int> profile_offsets;
+
+        for (auto i = 0u; i < num_lights_written; ++i)
+        {
+            if (!light_profiles[i])
+            {
+                continue;
+            }
+
+            auto iter = profile_offsets.find(light_profiles[i]);
+
+            if (iter == profile_offsets.end())
+            {
+                iter = profile_offsets.emplace(light_profiles[i], static_cast<int>(distribution_data.size())).first;
+                WriteLatLongDistribution(*light_profiles[i], distribution_data);
+            }
+
+            lights[i].profile_distribution = iter->second;
+        }
+
+        m_uploader.Write(ClwUploader::Category::kLights, out.lights, lights.data(), num_lights_written);
+
+        // Emissive hits find their light through the map instead of scanning all the lights
+        std::vector<int> area_light_map;
+        WriteAreaLightMap(lights.data(), num_lights_written, area_light_map);
+
+        if (area_light_map.size() > out.area_light_map.GetElementCount())
+        {
+            out.area_light_map = m_context.CreateBuffer<int>(area_light_map.size(), CL_MEM_READ_ONLY);
+        }
+
+        m_uploader.Write(ClwUploader::Category::kLights, out.area_light_map, area_light_map.data(), area_light_map.size());
+
+        if (distribution_data.size() > out.light_distributions.GetElementCount())
+        {
+            out.light_distributions = m_context.CreateBuffer<int>(distribution_data.size(), CL_MEM_READ_ONLY);
+        }
+
+        m_uploader.Write(ClwUploader::Category::kLights, out.light_distributions, distribution_data.data(), distribution_data.size());
+
+        // Build importance sampling data for the environment light
+        UpdateEnvironmentDistribution(env_texture.get(), out);
+        UpdateEnvironmentIrradiance(env_texture.get(), out);
+
+        out.num_lights = static_cast<int>(num_lights_written);
+
+        // Light types present, estimator kernels are specialized for them
+        out.features &= ~(ClwScene::kFeatureEnvironmentLight | ClwScene::kFeatureAreaLights | ClwScene::kFeatureSingularLights);
+        for (std::size_t i = 0; i < num_lights_written; ++i)
+        {
+            switch (lights[i].type)
+            {
+            case ClwScene::kIbl:
+                out.features |= ClwScene::kFeatureEnvironmentLight;
+                break;
+            case ClwScene::kArea:
+                out.features |= ClwScene::kFeatureAreaLights;
+                break;
+            default:
+                out.features |= ClwScene::kFeatureSingularLights;
                 break;
             }
+        }
+    }
+
+    void ClwSceneController::UpdateEnvironmentDistribution(Texture const* texture, ClwScene& out) const
+    {
+        // Rebuild only if the texture or its texels have been changed, the revision also catches
+        // changes the dirty flag of a texture shared with another scene has already been cleared for
+        auto revision = texture ? texture->GetDataRevision() : 0u;
+
+        if (out.envmap_distribution.GetElementCount() > 0 &&
+            out.envmap_distribution_texture == texture &&
+            out.envmap_distribution_revision == revision &&
+            !(texture && texture->IsDirty()))
+        {
+            return;
+        }
+
+        out.envmap_distribution_texture = texture;
+        out.envmap_distribution_revision = revision;
+
+        // Zero width and height tell the kernels to sample environment uniformly
+        std::vector<int> data(2, 0);
+
+        auto size = texture ? texture->GetSize() : RadeonRays::int3(0, 0, 0);
+
+        // Building takes a single pass over the texels, as would hashing them for the compile cache
+        if (size.x > 0 && size.y > 0)
+        {
+            data.clear();
+            WriteLatLongDistribution(*texture, data);
+        }
+
+        if (data.size() > out.envmap_distribution.GetElementCount())
+        {
+            out.envmap_distribution = m_context.CreateBuffer<int>(data.size(), CL_MEM_READ_ONLY);
+        }
+
+        m_uploader.Write(ClwUploader::Category::kLights, out.envmap_distribution, data.data(), data.size());
+    }
+
+
+    void ClwSceneController::UpdateEnvironmentIrradiance(Texture const* texture, ClwScene& out) const
+    {
+        // Kernels take the buffer even if irradiance is not used
+        if (out.env_irradiance.GetElementCount() == 0)
+        {
+            out.env_irradiance = m_context.CreateBuffer<RadeonRays::float3>(kNumIrradianceCoeffs, CL_MEM_READ_ONLY);
+        }
+        else if (out.env_irradiance_texture == texture &&
+            out.env_irradiance_revision == (texture ? texture->GetDataRevision() : 0u) &&
+            !(texture && texture->IsDirty()))
+        {
+            return;
+        }
+
+        out.env_irradiance_texture = texture;
+        out.env_irradiance_revision = texture ? texture->GetDataRevision() : 0u;
+
+        std::array<RadeonRays::float3, kNumIrradianceCoeffs> irradiance;
+        irradiance.fill(RadeonRays::float3(0.f, 0.f, 0.f));
+
+#ifdef BAIKAL_SH_IRRADIANCE
+        auto size = texture ? texture->GetSize() : RadeonRays::int3(0, 0, 0);
+
+        if (size.x > 0 && size.y > 0)
+        {
+            auto width = static_cast<std::uint32_t>(size.x);
+            auto height = static_cast<std::uint32_t>(size.y);
+
+            // Texels weighted by their solid angle are summed into a coarse lat-long grid first,
+            // so SH functions are only evaluated once per cell
+            auto cells_x = std::min(width, kIrradianceGridWidth);
+            auto cells_y = std::min(height, kIrradianceGridWidth / 2);
+            std::vector<RadeonRays::float3> cells(cells_x * cells_y, RadeonRays::float3(0.f, 0.f, 0.f));
+
+            auto texel_solid_angle = (PI / height) * (2.f * PI / width);
+
+            for (auto y = 0u; y < height; ++y)
+            {
+                auto weight = std::sin(PI * (y + 0.5f) / height) * texel_solid_angle;
+                auto row = &cells[(y * cells_y / height) * cells_x];
+
+                for (auto x = 0u; x < width; ++x)
+                {
+                    row[x * cells_x / width] += weight * texture->GetTexel(x, y);
+                }
+            }
 
-            case ClwScene::kArea:
+            // Directions follow Texture_SampleEnvMap: texture rows go from theta = 0 to theta = PI,
+            // columns map to phi = atan2(x, z)
+            std::array<RadeonRays::float3, kNumIrradianceCoeffs> radiance;
+            radiance.fill(RadeonRays::float3(0.f, 0.f, 0.f));
+            float ylm[kNumIrradianceCoeffs];
+
+            for (auto y = 0u; y < cells_y; ++y)
             {
-                // TODO: optimize this linear search
-                auto shape = static_cast<AreaLight const&>(light).GetShape();
+                auto theta = PI * (y + 0.5f) / cells_y;
 
-                auto shape_iter = scene.CreateShapeIterator();
+                for (auto x = 0u; x < cells_x; ++x)
+                {
+                    auto phi = 2.f * PI * (x + 0.5f) / cells_x;
+                    RadeonRays::float3 w(std::sin(theta) * std::sin(phi), std::cos(theta), std::sin(theta) * std::cos(phi));
 
-                auto idx = GetShapeIdx(*shape_iter, shape);
+                    ShEvaluate(w, 2, ylm);
 
-                clw_light->id = shape->GetId();
-                clw_light->shapeidx = static_cast<int>(idx);
-                clw_light->primidx = static_cast<int>(static_cast<AreaLight const&>(light).GetPrimitiveIdx());
-                break;
+                    for (auto i = 0u; i < kNumIrradianceCoeffs; ++i)
+                    {
+                        radiance[i] += ylm[i] * cells[y * cells_x + x];
+                    }
+                }
             }
 
-            default:
-            assert(false);
-            break;
+            ShConvolveCosTheta(2, radiance.data(), irradiance.data());
         }
+#endif
+
+        m_uploader.Write(ClwUploader::Category::kLights, out.env_irradiance, irradiance.data(), irradiance.size());
     }
 
-    void ClwSceneController::UpdateLights(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, ClwScene& out) const
+    // Convert texture format into ClwScene:: types
+    static ClwScene::TextureFormat GetTextureFormat(Texture const& texture)
     {
-        std::size_t num_lights_written = 0;
+        switch (texture.GetFormat())
+        {
+            case Texture::Format::kRgba8: return ClwScene::TextureFormat::RGBA8;
+            case Texture::Format::kRgba16: return ClwScene::TextureFormat::RGBA16;
+            case Texture::Format::kRgba32: return ClwScene::TextureFormat::RGBA32;
+            case Texture::Format::kBc1: return ClwScene::TextureFormat::BC1;
+            case Texture::Format::kBc5: return ClwScene::TextureFormat::BC5;
+            case Texture::Format::kR8: return ClwScene::TextureFormat::R8;
+            case Texture::Format::kR16: return ClwScene::TextureFormat::R16;
+            case Texture::Format::kRg8: return ClwScene::TextureFormat::RG8;
+            case Texture::Format::kRg16: return ClwScene::TextureFormat::RG16;
+            case Texture::Format::kRgb8: return ClwScene::TextureFormat::RGBA8;
+            case Texture::Format::kRgb16: return ClwScene::TextureFormat::RGBA16;
+            case Texture::Format::kRgb32: return ClwScene::TextureFormat::RGBA32;
+            default: return ClwScene::TextureFormat::RGBA8;
+        }
+    }
 
-        auto env_override = scene.GetEnvironmentOverride();
+    void ClwSceneController::WriteTexture(Texture const& texture, std::size_t data_offset, void* data) const
+    {
+        auto clw_texture = reinterpret_cast<ClwScene::Texture*>(data);
 
-        auto num_lights = scene.GetNumLights();
-        auto distribution_buffer_size = (1 + 1 + num_lights + num_lights);
+        auto dim = texture.GetSize();
 
-        // Create light buffer if needed
-        if (num_lights > out.lights.GetElementCount())
+        clw_texture->w = dim.x;
+        clw_texture->h = dim.y;
+        clw_texture->d = dim.z;
+        clw_texture->fmt = GetTextureFormat(texture);
+        clw_texture->dataoffset = static_cast<int>(data_offset);
+        clw_texture->levels = GetTextureLevelCount(texture);
+        clw_texture->layer = -1;
+        clw_texture->flags = 0;
+    }
+
+    void ClwSceneController::WriteTextureData(Texture const& texture, std::size_t data_offset, ClwScene& out) const
+    {
+        if (IsThreeChannelFormat(texture.GetFormat()))
         {
-            out.lights = m_context.CreateBuffer<ClwScene::Light>(num_lights, CL_MEM_READ_ONLY);
-            out.light_distributions = m_context.CreateBuffer<int>(distribution_buffer_size, CL_MEM_READ_ONLY);
+#ifdef BAIKAL_TEXTURE_CONVERSION
+            // Texels are uploaded as they are and expanded by the kernel,
+            // the launch is enqueued after the upload on the same queue
+            auto dim = texture.GetSize();
+            auto source = m_context.CreateBuffer<char>(texture.GetSizeInBytes(), CL_MEM_READ_ONLY);
+            m_uploader.Write(ClwUploader::Category::kTextures, source, texture.GetData(), texture.GetSizeInBytes());
+
+            auto kernel = m_texture_kernels->GetKernel("ExpandTextureChannels");
+
+            int argc = 0;
+            kernel.SetArg(argc++, static_cast<int>(GetTextureFormat(texture)));
+            kernel.SetArg(argc++, dim.x);
+            kernel.SetArg(argc++, dim.y);
+            kernel.SetArg(argc++, dim.z);
+            kernel.SetArg(argc++, source);
+            kernel.SetArg(argc++, static_cast<int>(data_offset));
+            kernel.SetArg(argc++, out.texturedata);
+
+            int num_texels = dim.x * dim.y * dim.z;
+            m_context.Launch1D(0, ((num_texels + 63) / 64) * 64, 64, kernel);
+#else
+            WriteTextureData(*ExpandTextureChannels(texture), data_offset, out);
+#endif
+            return;
         }
 
-        ClwScene::Light* lights = nullptr;
+#ifdef BAIKAL_TILED_TEXTURES
+        if (!texture.IsCompressed())
+        {
+            auto dim = texture.GetSize();
+            auto texel_size = texture.GetSizeInBytes() / (dim.x * dim.y * dim.z);
+            auto slice_size = texel_size * GetStoredTexelCount(dim.x, dim.y);
+            auto tiles_x = (dim.x + 7) / 8;
 
-        m_context.MapBuffer(0, out.lights, CL_MAP_WRITE, &lights).Wait();
-        std::unique_ptr<Iterator> light_iter(scene.CreateLightIterator());
+            // Rows of 8 texels are copied into their tiles, padding texels are never sampled
+            std::vector<char> data(slice_size * dim.z);
+            auto src = texture.GetData();
 
-        // Disable IBL by default
-        out.envmapidx = -1;
+            for (auto z = 0; z < dim.z; ++z)
+            {
+                auto slice = data.data() + slice_size * z;
 
-        // Allocate intermediate storage for lights power distribution
-        std::vector<float> light_power(num_lights);
-        std::uint32_t k = 0;
+                for (auto y = 0; y < dim.y; ++y)
+                {
+                    for (auto tile_x = 0; tile_x < tiles_x; ++tile_x)
+                    {
+                        auto dst_idx = static_cast<std::size_t>(((y / 8) * tiles_x + tile_x) * 64 + (y % 8) * 8);
+                        auto src_idx = (static_cast<std::size_t>(z) * dim.y + y) * dim.x + tile_x * 8;
+                        auto count = static_cast<std::size_t>(std::min(8, dim.x - tile_x * 8));
+                        std::memcpy(slice + dst_idx * texel_size, src + src_idx * texel_size, count * texel_size);
+                    }
+                }
+            }
 
-        // Serialize
+            m_uploader.Write(ClwUploader::Category::kTextures, out.texturedata, data.data(), data.size(), data_offset);
+            return;
+        }
+#endif
+
+        m_uploader.Write(ClwUploader::Category::kTextures, out.texturedata, texture.GetData(), texture.GetSizeInBytes(), data_offset);
+    }
+
+    void ClwSceneController::UpdateTextureImages(std::vector<Texture::Ptr> const& textures, std::vector<ClwScene::Texture>& headers, ClwScene& out) const
+    {
+        if (!ClwClass::UsesTextureImages(m_context))
         {
-            for (; light_iter->IsValid(); light_iter->Next())
-            {
-                auto light = light_iter->ItemAs<Light>();
-                WriteLight(scene, *light, tex_collector, lights + num_lights_written);
+            return;
+        }
 
+        auto device = m_context.GetDevice(0).GetID();
 
-                // Find and update IBL idx
-                auto ibl = std::dynamic_pointer_cast<ImageBasedLight>(light_iter->ItemAs<Light>());
-                if (ibl)
-                {
-                    out.envmapidx = static_cast<int>(num_lights_written);
-                }
+        std::size_t max_width = 0;
+        std::size_t max_height = 0;
+        std::size_t max_layers = 0;
+        clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_WIDTH, sizeof(max_width), &max_width, nullptr);
+        clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_HEIGHT, sizeof(max_height), &max_height, nullptr);
+        clGetDeviceInfo(device, CL_DEVICE_IMAGE_MAX_ARRAY_SIZE, sizeof(max_layers), &max_layers, nullptr);
 
-                ++num_lights_written;
+        // Hardware filtering covers single level RGBA8 2D textures, mip chains stay in texture data
+        auto is_eligible = [&](std::size_t i)
+        {
+            auto size = textures[i]->GetSize();
+            return textures[i]->GetFormat() == Texture::Format::kRgba8 && headers[i].fmt == ClwScene::TextureFormat::RGBA8 &&
+                size.z == 1 && headers[i].levels == 1 &&
+                static_cast<std::size_t>(size.x) <= max_width && static_cast<std::size_t>(size.y) <= max_height;
+        };
 
-                auto power = light->GetPower(scene);
+        // All layers have the size of the largest texture
+        std::size_t width = 1;
+        std::size_t height = 1;
 
-                // TODO: move luminance calculation into utility function
-                light_power[k++] = 0.2126f * power.x + 0.7152f * power.y + 0.0722f * power.z;
+        for (auto i = 0u; i < textures.size(); ++i)
+        {
+            if (is_eligible(i))
+            {
+                width = std::max(width, static_cast<std::size_t>(textures[i]->GetSize().x));
+                height = std::max(height, static_cast<std::size_t>(textures[i]->GetSize().y));
             }
         }
 
-        m_context.UnmapBuffer(0, out.lights, lights);
+        // Textures covering less than a quarter of a layer would waste too much memory
+        std::vector<std::pair<Texture::Ptr, std::uint32_t>> layers;
+        std::vector<std::size_t> layer_headers;
 
-        // Create distribution over light sources based on their power
-        Distribution1D light_distribution(&light_power[0], (std::uint32_t)light_power.size());
+        for (auto i = 0u; i < textures.size() && layers.size() < max_layers; ++i)
+        {
+            auto size = textures[i]->GetSize();
 
-        // Write distribution data
-        int* distribution_ptr = nullptr;
-        m_context.MapBuffer(0, out.light_distributions, CL_MAP_WRITE, &distribution_ptr).Wait();
-        auto current = distribution_ptr;
+            if (is_eligible(i) && 4u * static_cast<std::size_t>(size.x) * static_cast<std::size_t>(size.y) >= width * height)
+            {
+                layers.emplace_back(textures[i], textures[i]->GetDataRevision());
+                layer_headers.push_back(i);
+            }
+        }
 
-        // Write the number of segments first
-        *current++ = (int)light_distribution.m_num_segments;
+        for (auto i = 0u; i < layer_headers.size(); ++i)
+        {
+            headers[layer_headers[i]].layer = static_cast<int>(i);
+        }
 
-        // Then write num_segments  + 1 CDF values
-        auto values = reinterpret_cast<float*>(current);
-        for (auto i = 0u; i < light_distribution.m_num_segments + 1; ++i)
+        if (out.texture_images && layers == out.texture_image_layers)
         {
-            values[i] = light_distribution.m_cdf[i];
+            return;
         }
 
-        // Then write num_segments PDF values
-        values += light_distribution.m_num_segments + 1;
+        cl_image_format format = { CL_RGBA, CL_UNORM_INT8 };
+
+        // Kernels need a valid image even if there is nothing to sample from it
+        cl_image_desc desc = {};
+        desc.image_type = CL_MEM_OBJECT_IMAGE2D_ARRAY;
+        desc.image_width = layers.empty() ? 1 : width;
+        desc.image_height = layers.empty() ? 1 : height;
+        desc.image_array_size = std::max<std::size_t>(layers.size(), 1u);
+
+        cl_int status = CL_SUCCESS;
+        auto image = clCreateImage(m_context, CL_MEM_READ_ONLY, &format, &desc, nullptr, &status);
 
-        for (auto i = 0u; i < light_distribution.m_num_segments; ++i)
+        if (status != CL_SUCCESS)
         {
-            values[i] = light_distribution.m_func_values[i] / light_distribution.m_func_sum;
+            throw std::runtime_error("ClwSceneController: can't create texture images array");
         }
 
-        m_context.UnmapBuffer(0, out.light_distributions, distribution_ptr);
+        out.texture_images.reset(image, clReleaseMemObject);
+        out.texture_image_layers = layers;
 
-        out.num_lights = static_cast<int>(num_lights_written);
-    }
+        // Blocking writes, texel data is read right from the textures
+        for (auto i = 0u; i < layers.size(); ++i)
+        {
+            auto size = layers[i].first->GetSize();
+            std::size_t origin[3] = { 0, 0, i };
+            std::size_t region[3] = { static_cast<std::size_t>(size.x), static_cast<std::size_t>(size.y), 1 };
+
+            clEnqueueWriteImage(m_context.GetCommandQueue(0), image, CL_TRUE, origin, region, 4 * size.x, 0, layers[i].first->GetData(), 0, nullptr, nullptr);
+        }
 
+        LogInfo("Copied ", layers.size(), " textures into ", width, "x", height, " texture images\n");
+    }
 
-    // Convert texture format into ClwScene:: types
-    static ClwScene::TextureFormat GetTextureFormat(Texture const& texture)
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+    void ClwSceneController::GenerateTextureMips(Texture const& texture, std::size_t data_offset, ClwScene& out) const
     {
-        switch (texture.GetFormat())
+        auto levels = GetTextureLevelCount(texture);
+
+        if (levels < 2)
         {
-            case Texture::Format::kRgba8: return ClwScene::TextureFormat::RGBA8;
-            case Texture::Format::kRgba16: return ClwScene::TextureFormat::RGBA16;
-            case Texture::Format::kRgba32: return ClwScene::TextureFormat::RGBA32;
-            default: return ClwScene::TextureFormat::RGBA8;
+            return;
         }
-    }
 
-    void ClwSceneController::WriteTexture(Texture const& texture, std::size_t data_offset, void* data) const
-    {
-        auto clw_texture = reinterpret_cast<ClwScene::Texture*>(data);
+        auto kernel = m_texture_kernels->GetKernel("GenerateMipLevel");
 
         auto dim = texture.GetSize();
+        auto texel_size = GetTexelSize(texture);
+        int fmt = static_cast<int>(GetTextureFormat(texture));
 
-        clw_texture->w = dim.x;
-        clw_texture->h = dim.y;
-        clw_texture->d = dim.z;
-        clw_texture->fmt = GetTextureFormat(texture);
-        clw_texture->dataoffset = static_cast<int>(data_offset);
-    }
+        int width = dim.x;
+        int height = dim.y;
+        auto offset = data_offset;
 
-    void ClwSceneController::WriteTextureData(Texture const& texture, void* data) const
-    {
-        auto begin = texture.GetData();
-        auto end = begin + texture.GetSizeInBytes();
-        std::copy(begin, end, static_cast<char*>(data));
+        // Every level is built from the previous one, launches on the same queue run in order
+        for (auto level = 1; level < levels; ++level)
+        {
+            auto next_offset = offset + align16(GetStoredTexelCount(width, height) * texel_size);
+            int next_width = std::max(width >> 1, 1);
+            int next_height = std::max(height >> 1, 1);
+
+            int argc = 0;
+            kernel.SetArg(argc++, fmt);
+            kernel.SetArg(argc++, static_cast<int>(offset));
+            kernel.SetArg(argc++, width);
+            kernel.SetArg(argc++, height);
+            kernel.SetArg(argc++, static_cast<int>(next_offset));
+            kernel.SetArg(argc++, next_width);
+            kernel.SetArg(argc++, next_height);
+            kernel.SetArg(argc++, out.texturedata);
+
+            int num_texels = next_width * next_height;
+            m_context.Launch1D(0, ((num_texels + 63) / 64) * 64, 64, kernel);
+
+            width = next_width;
+            height = next_height;
+            offset = next_offset;
+        }
     }
+#endif
 
-    void ClwSceneController::WriteVolume(VolumeMaterial const& volume, Collector& tex_collector, void* data) const
+    void ClwSceneController::WriteVolume(VolumeMaterial const& volume, Collector& tex_collector, std::vector<int>& grids, void* data) const
     {
         auto clw_volume = reinterpret_cast<ClwScene::Volume*>(data);
 
@@ -1242,6 +4050,63 @@ namespace Baikal
         clw_volume->data = -1;
         clw_volume->extra = -1;
 
+        // Header holds the bounds, the voxel resolution, the resolution of majorant cells or tree nodes
+        // and the number of voxels per majorant cell or brick
+        auto write_header = [&grids](RadeonRays::bbox const& bounds, std::uint32_t const resolution[3], std::uint32_t const cells[3], std::uint32_t block)
+        {
+            auto offset = grids.size();
+            grids.resize(offset + kVolumeGridHeaderSize, 0);
+
+            auto header = reinterpret_cast<float*>(&grids[offset]);
+            auto pmin = bounds.pmin;
+            auto extents = bounds.pmax - bounds.pmin;
+            float const e[3] = { extents.x, extents.y, extents.z };
+
+            header[0] = pmin.x;
+            header[1] = pmin.y;
+            header[2] = pmin.z;
+
+            for (auto axis = 0u; axis < 3; ++axis)
+            {
+                header[3 + axis] = e[axis] > 0.f ? 1.f / e[axis] : 0.f;
+                grids[offset + 6 + axis] = static_cast<int>(resolution[axis]);
+                grids[offset + 9 + axis] = static_cast<int>(cells[axis]);
+            }
+
+            grids[offset + 12] = static_cast<int>(block);
+            return offset;
+        };
+
+        if (auto density_grid = volume.GetDensityGrid())
+        {
+            MajorantGrid majorants;
+            majorants.Build(density_grid->density.data(), density_grid->resolution, kVolumeMajorantBlock);
+
+            // Header is followed by densities and majorants
+            auto offset = write_header(density_grid->bounds, density_grid->resolution, majorants.m_resolution, kVolumeMajorantBlock);
+            auto num_voxels = density_grid->density.size();
+            grids.resize(offset + kVolumeGridHeaderSize + num_voxels + majorants.m_majorants.size(), 0);
+
+            std::memcpy(&grids[offset + kVolumeGridHeaderSize], density_grid->density.data(), num_voxels * sizeof(float));
+            std::memcpy(&grids[offset + kVolumeGridHeaderSize + num_voxels], majorants.m_majorants.data(), majorants.m_majorants.size() * sizeof(float));
+
+            clw_volume->type = ClwScene::VolumeType::kHeterogeneous;
+            clw_volume->data = static_cast<int>(offset);
+        }
+        else if (auto sparse_grid = volume.GetSparseDensityGrid())
+        {
+            SparseVolumeGrid tree;
+            tree.Build(sparse_grid->bricks.data(), sparse_grid->density.data(), sparse_grid->bricks.size() / 3, sparse_grid->resolution);
+
+            // Header is followed by the tree
+            auto offset = write_header(sparse_grid->bounds, sparse_grid->resolution, tree.m_resolution, SparseVolumeGrid::kBrickSize);
+            grids.insert(grids.end(), tree.m_data.begin(), tree.m_data.end());
+
+            clw_volume->type = ClwScene::VolumeType::kHeterogeneous;
+            clw_volume->data = static_cast<int>(offset);
+            clw_volume->extra = kVolumeGridSparse;
+        }
+
         auto absorption_value = volume.GetInputValue("absorption");
 
         if (absorption_value.type == Material::InputType::kFloat4)
@@ -1298,42 +4163,65 @@ namespace Baikal
         m_program_manager->AddHeader("inputmaps.cl", source);
     }
 
-    void Baikal::ClwSceneController::UpdateLeafsData(Scene1 const& scene, Collector& input_map_leafs_collector, Collector& tex_collector, ClwScene& out) const
+    void Baikal::ClwSceneController::UpdateLeafsData(Scene1 const& scene, Collector& input_map_collector, Collector& input_map_leafs_collector, Collector& tex_collector, ClwScene& out) const
     {
-        // Get new buffer size
-        std::size_t buffer_size = input_map_leafs_collector.GetNumItems();
+        // Header entry, leafs, matrix rows, folded constants and interpreter code, see CLInputMapGenerator
+        auto matrices = CLInputMapGenerator::CollectMatrices(input_map_collector);
+        auto constants = CLInputMapGenerator::CollectConstantSubtrees(input_map_collector);
 
-        // Recreate input map leafs buffer if it needs resize
-        if (buffer_size > out.input_map_data.GetElementCount())
+        std::size_t num_leafs = input_map_leafs_collector.GetNumItems();
+        std::size_t matrices_offset = CLInputMapGenerator::kLeafsOffset + num_leafs;
+        std::size_t constants_offset = matrices_offset + 4 * matrices.size();
+
+        std::vector<ClwScene::InputMapData> input_map_data(constants_offset + constants.size());
+
+        // Update input map leafs bundle to be able to track differences
+        out.input_map_leafs_bundle.reset(input_map_leafs_collector.CreateBundle());
+
+        // leaf iterator
+        auto iter = input_map_leafs_collector.CreateIterator();
+        std::vector<InputMap::Ptr> leafs;
+        leafs.reserve(num_leafs);
+
+        for (; iter->IsValid(); iter->Next())
         {
-            // Create material buffer
-            out.input_map_data = m_context.CreateBuffer<ClwScene::InputMapData>(buffer_size, CL_MEM_READ_ONLY);
+            leafs.push_back(iter->ItemAs<InputMap>());
         }
 
-        if (buffer_size > 0)
+        // Serialize, leafs have fixed size
+        ParallelFor(leafs.size(), [&](std::size_t i)
         {
-            ClwScene::InputMapData *input_map_data = nullptr;
+            WriteInputMapLeaf(*leafs[i], tex_collector, input_map_data.data() + CLInputMapGenerator::kLeafsOffset + i);
+        });
 
-            // Map GPU input map buffer
-            m_context.MapBuffer(0, out.input_map_data, CL_MAP_WRITE, &input_map_data).Wait();
+        for (auto i = 0u; i < matrices.size(); ++i)
+        {
+            auto matrix = static_cast<InputMap_MatMul const&>(*matrices[i]).GetMatrix();
+            auto rows = input_map_data.data() + matrices_offset + 4 * i;
 
-            // Update input map leafs bundle to be able to track differences
-            out.input_map_leafs_bundle.reset(input_map_leafs_collector.CreateBundle());
+            rows[0].float4_value.value = { matrix.m00, matrix.m01, matrix.m02, matrix.m03 };
+            rows[1].float4_value.value = { matrix.m10, matrix.m11, matrix.m12, matrix.m13 };
+            rows[2].float4_value.value = { matrix.m20, matrix.m21, matrix.m22, matrix.m23 };
+            rows[3].float4_value.value = { matrix.m30, matrix.m31, matrix.m32, matrix.m33 };
+        }
 
-            // leaf iterator
-            auto iter = input_map_leafs_collector.CreateIterator();
-            std::size_t num_inputmap_leafs_written = 0;
+        // Constant subtrees are evaluated here, so kernels read a single value
+        ParallelFor(constants.size(), [&](std::size_t i)
+        {
+            input_map_data[constants_offset + i].float4_value.value = CLInputMapGenerator::EvaluateConstant(constants[i]);
+        });
 
-            // Iterate and serialize
-            for (; iter->IsValid(); iter->Next())
-            {
-                WriteInputMapLeaf(*iter->ItemAs<InputMap>(), tex_collector, input_map_data + num_inputmap_leafs_written);
-                ++num_inputmap_leafs_written;
-            }
+        // Generic UberV2 kernels evaluate input maps from this code while specialized ones compile
+        CLInputMapGenerator::GenerateInterpreterCode(input_map_collector, input_map_leafs_collector, input_map_data);
 
-            //Unmap buffer
-            m_context.UnmapBuffer(0, out.input_map_data, input_map_data);
+        // Recreate input map leafs buffer if it needs resize
+        if (input_map_data.size() > out.input_map_data.GetElementCount())
+        {
+            // Create material buffer
+            out.input_map_data = m_context.CreateBuffer<ClwScene::InputMapData>(input_map_data.size(), CL_MEM_READ_ONLY);
         }
+
+        m_uploader.Write(ClwUploader::Category::kInputMaps, out.input_map_data, input_map_data.data(), input_map_data.size());
     }
 
     void Baikal::ClwSceneController::WriteInputMapLeaf(InputMap const& leaf, Collector& tex_collector, void* data) const
@@ -1374,7 +4262,7 @@ namespace Baikal
             case InputMap::InputMapType::kSamplerBumpmap:
             {
                 const InputMap_SamplerBumpMap &i = static_cast<const InputMap_SamplerBumpMap&>(leaf);
-                data_pointer->int_values.idx = tex_collector.GetItemIndex(i.GetTexture());
+                data_pointer->int_values.idx = tex_collector.GetItemIndex(i.GetDerivativeTexture());
                 data_pointer->int_values.type = ClwScene::InputMapDataType::kInt;
                 break;
             }
@@ -1384,6 +4272,177 @@ namespace Baikal
         }
     }
 
+    void ClwSceneController::SetParallelSerialization(bool enable)
+    {
+        m_parallel_serialization = enable;
+    }
+
+    void ClwSceneController::SetDeviceResident(bool enable)
+    {
+        m_device_resident = enable;
+
+        if (!enable)
+        {
+            RestoreHostData();
+        }
+    }
+
+    void ClwSceneController::RestoreHostData() const
+    {
+        if (m_released_meshes.empty() && m_released_textures.empty())
+        {
+            return;
+        }
+
+        // Arrays and textures set again since they were released are skipped
+        for (auto const& released : m_released_meshes)
+        {
+            auto& mesh = *released.first;
+            auto const& range = released.second;
+
+            std::vector<RadeonRays::float3> vertices(mesh.GetVertices() ? 0 : mesh.GetNumVertices());
+            std::vector<RadeonRays::float3> normals(mesh.GetNormals() ? 0 : mesh.GetNumNormals());
+            std::vector<RadeonRays::float2> uvs(mesh.GetUVs() ? 0 : mesh.GetNumUVs());
+            std::vector<std::uint32_t> indices(mesh.GetIndices() ? 0 : mesh.GetNumIndices());
+
+            if (!vertices.empty())
+            {
+                m_context.ReadBuffer(0, m_resources.vertices, vertices.data(), range.vertex_offset, vertices.size());
+            }
+
+            // Only meshes with attributes stored as they are have been released
+            if (!normals.empty())
+            {
+                m_context.ReadBuffer(0, m_resources.normals, reinterpret_cast<ClwScene::NormalData*>(normals.data()), range.vertex_offset, normals.size());
+            }
+
+            if (!uvs.empty())
+            {
+                m_context.ReadBuffer(0, m_resources.uvs, reinterpret_cast<ClwScene::UVData*>(uvs.data()), range.vertex_offset, uvs.size());
+            }
+
+            if (!indices.empty())
+            {
+                // Mesh keeps unsigned indices, device buffer is int
+                m_context.ReadBuffer(0, m_resources.indices, reinterpret_cast<int*>(indices.data()), range.index_offset, indices.size());
+            }
+
+            m_context.Finish(0);
+
+            mesh.RestoreData(std::move(vertices), std::move(normals), std::move(uvs), std::move(indices));
+        }
+
+        for (auto const& released : m_released_textures)
+        {
+            auto& texture = *released.first;
+
+            if (!texture.IsDataReleased())
+            {
+                continue;
+            }
+
+            auto size = texture.GetSizeInBytes();
+            std::unique_ptr<char[]> data(new char[size]);
+            m_context.ReadBuffer(0, m_resources.texturedata, data.get(), released.second.offset, size).Wait();
+            texture.RestoreData(data.release());
+        }
+
+        LogInfo("Restored host data of ", m_released_meshes.size(), " meshes and ", m_released_textures.size(), " textures\n");
+
+        m_released_meshes.clear();
+        m_released_textures.clear();
+    }
+
+    void ClwSceneController::ReleaseHostData(ClwScene& scene) const
+    {
+        // Shadow scenes are released once they are compiled in the foreground
+        if (!m_device_resident || IsCompilingInBackground())
+        {
+            return;
+        }
+
+        // Cached meshes are paged in from host copies
+        if (!IsGeometryCacheEnabled())
+        {
+            for (auto const& entry : scene.geometry_ranges)
+            {
+                auto const& mesh = entry.first;
+                auto const& range = entry.second;
+
+#ifdef BAIKAL_COMPRESSED_GEOMETRY
+                // Normals and UVs are stored encoded
+                if (mesh->GetNumNormals() > 0 || mesh->GetNumUVs() > 0)
+                {
+                    continue;
+                }
+#endif
+
+                // Packed indices, attribute arrays of other sizes than vertex one and curves which
+                // compute their bounds from control points can't be restored as they are
+                if (mesh->IsDataReleased() || mesh->IsVerticesDirty() || range.revision != mesh->GetGeometryRevision() ||
+                    range.short_indices || mesh->GetNumVertices() != range.vertex_count ||
+                    mesh->GetNumIndices() != range.index_count ||
+                    (mesh->GetNumNormals() > 0 && mesh->GetNumNormals() != range.vertex_count) ||
+                    (mesh->GetNumUVs() > 0 && mesh->GetNumUVs() != range.vertex_count) ||
+                    std::dynamic_pointer_cast<Curves>(mesh))
+                {
+                    continue;
+                }
+
+                m_released_meshes[mesh] = range;
+                mesh->ReleaseData();
+            }
+        }
+
+        // Paged out textures get their low resolution copies from host texels
+        if (!IsTextureCacheEnabled())
+        {
+            for (auto const& entry : scene.texture_slots)
+            {
+                auto const& texture = entry.first;
+
+#ifdef BAIKAL_TILED_TEXTURES
+                // Texels are reordered into tiles
+                if (!texture->IsCompressed())
+                {
+                    continue;
+                }
+#endif
+
+                // Three channel texels are expanded to four on upload
+                if (texture->IsDataReleased() || entry.second.revision != texture->GetDataRevision() ||
+                    IsThreeChannelFormat(texture->GetFormat()))
+                {
+                    continue;
+                }
+
+                m_released_textures[texture] = entry.second;
+                texture->ReleaseData();
+            }
+        }
+    }
+
+    void ClwSceneController::ParallelFor(std::size_t count, std::function<void(std::size_t)> func) const
+    {
+        if (!m_parallel_serialization)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                func(i);
+            }
+
+            return;
+        }
+
+        TaskScheduler::Get().ParallelFor(count, kSerializationBatchSize, [&func](std::size_t begin, std::size_t end)
+        {
+            for (auto i = begin; i < end; ++i)
+            {
+                func(i);
+            }
+        });
+    }
+
     std::int32_t ClwSceneController::ResolveMaterialPtr(Material::Ptr material) const
     {
         auto it = m_materialid_to_offset.find(material->GetId());
@@ -29,12 +29,21 @@
 #pragma once
 
 #include "scene_controller.h"
+#include "clw_resource_registry.h"
 #include "CLW.h"
 
 #include "SceneGraph/clwscene.h"
+#include "Utils/clw_uploader.h"
+#include "Utils/compile_cache.h"
 
 #include "radeon_rays_cl.h"
 
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
 namespace Baikal
 {
     class Scene1;
@@ -44,6 +53,7 @@ namespace Baikal
     class Light;
     class Texture;
     class CLProgramManager;
+    class ClwClass;
 
 
     /**
@@ -57,25 +67,91 @@ namespace Baikal
     class ClwSceneController : public SceneController<ClwScene>
     {
     public:
-        // Constructor
-        ClwSceneController(CLWContext context, RadeonRays::IntersectionApi* api, const CLProgramManager *program_manager);
+        // Constructor, scenes compiled in the background build their acceleration structures
+        // in background_api if it is given, rendering goes on against api meanwhile
+        ClwSceneController(CLWContext context, RadeonRays::IntersectionApi* api, const CLProgramManager *program_manager,
+                           RadeonRays::IntersectionApi* background_api = nullptr);
         // Destructor
         virtual ~ClwSceneController();
 
         // Get underlying intersection API.
         RadeonRays::IntersectionApi* GetIntersectionApi() { return  m_api; }
+        // Get staging uploader used for all scene data writes, e.g. to query upload statistics.
+        ClwUploader& GetUploader() const { return m_uploader; }
+        // Materials, lights, texture headers and input map leafs are serialized on a thread pool by default.
+        // Each item is written at an offset computed up front, so the output is byte-identical in both modes,
+        // disabling only forces deterministic single threaded execution order.
+        void SetParallelSerialization(bool enable);
+        // Keep light BVH and distributions in an on-disk cache keyed by the content of their inputs,
+        // so reopening an unchanged scene skips building them. Empty path disables the cache.
+        void SetCompileCachePath(std::string const& path) { m_compile_cache.SetPath(path); }
+        // Limit device geometry to a fixed size cache of max_vertices vertices and max_indices index buffer elements.
+        // Meshes which do not fit are paged in once rays hit them, see UpdateGeometryResidency.
+        // Zero for both (default) keeps all the geometry resident. Has to be set before scenes are compiled.
+        void SetGeometryCacheSize(std::size_t max_vertices, std::size_t max_indices);
+        bool IsGeometryCacheEnabled() const { return m_geometry_cache_vertices > 0; }
+        // Page in meshes hit by rays since the last call evicting least recently hit ones, should be called
+        // between frames when no asynchronous compile is running. Paths hitting paged out geometry are dropped,
+        // so returns true if residency has changed and accumulated output should be cleared.
+        bool UpdateGeometryResidency(Scene1::Ptr scene) const;
+        // Limit full resolution texels of large 2D textures to max_bytes of texture data. Textures which do not fit
+        // are sampled from low resolution copies until UpdateTextureResidency pages them in once rays sample them.
+        // Zero (default) keeps all the textures resident. Has to be set before scenes are compiled.
+        void SetTextureCacheSize(std::size_t max_bytes);
+        bool IsTextureCacheEnabled() const { return m_texture_cache_bytes > 0; }
+        // Page in textures sampled from their low resolution copies since the last call evicting least recently
+        // sampled ones, should be called between frames when no asynchronous compile is running.
+        // Returns true if residency has changed and accumulated output should be cleared.
+        bool UpdateTextureResidency(Scene1::Ptr scene) const;
+        // Free host copies of mesh geometry and texel data once a compile has uploaded them. Copies are read back
+        // from the device before a compile step needs them again, so camera and transform changes alone do not.
+        // Data with limited caches and data stored in another layout on the device (compressed geometry, expanded
+        // or tiled texels) keeps its copies. Released objects can't be compiled by other controllers until
+        // they are restored. Disabling restores all released copies. Off by default.
+        void SetDeviceResident(bool enable);
+        bool IsDeviceResident() const { return m_device_resident; }
+        // Acceleration structure scenes are committed with from their next compile on, kBalanced by default
+        void SetAccelerationStructure(AccelerationStructure type);
+        AccelerationStructure GetAccelerationStructure() const { return m_acceleration_structure; }
+
+        struct MemoryEstimate
+        {
+            // Vertices and indices of unique meshes, including what the intersector keeps for them
+            std::size_t geometry_bytes = 0;
+            std::size_t num_vertices = 0;
+            std::size_t num_indices = 0;
+            // Texel data of all mip levels
+            std::size_t texture_bytes = 0;
+            // Textures and their device size, largest first
+            std::vector<std::pair<std::shared_ptr<Texture>, std::size_t>> textures;
+        };
+        // Rough device memory the scene takes once compiled with all of its geometry and textures resident.
+        // Nothing is allocated, so it can be checked against the device before the first compile.
+        MemoryEstimate EstimateSceneMemory(Scene1 const& scene) const;
+        // Device memory of texel data of the texture and all its mip levels
+        static std::size_t GetTextureMemorySize(Texture const& texture);
 
     protected:
         // Clear intersector and load meshes into it.
         void ReloadIntersector(Scene1 const& scene, ClwScene& inout) const;
+        // Commit attached shapes with the acceleration structure chosen for the scene.
+        void CommitIntersector(ClwScene& scene) const;
+        // Set intersector options which differ from the current ones.
+        void ApplyIntersectorOptions(RadeonRays::IntersectionApi* api, AccelerationStructureOptions const& options) const;
+        // Intersector holding the scene shapes, picked on the first call for the scene.
+        RadeonRays::IntersectionApi* GetSceneIntersector(ClwScene& scene) const;
 
     public:
         // Update camera data only.
         void UpdateCamera(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, Collector& vol_collector, ClwScene& out) const override;
         // Update shape data only.
         void UpdateShapes(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, Collector& vol_collector, ClwScene& out) const override;
-        // Update transform data only
+        // Update shape properties
         void UpdateShapeProperties(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, Collector& volume_collector, ClwScene& out) const override;
+        // Update transform data only
+        void UpdateShapeTransforms(Scene1 const& scene, ClwScene& out) const override;
+        // Update positions of deformed meshes only
+        void UpdateShapeVertices(Scene1 const& scene, ClwScene& out) const override;
         // Update lights data only.
         void UpdateLights(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, ClwScene& out) const override;
         // Update material data.
@@ -85,7 +161,7 @@ namespace Baikal
         // Update input maps only
         void UpdateInputMaps(Scene1 const& scene, Collector& input_map_collector, Collector& input_map_leafs_collector, ClwScene& out) const override;
         // Update input map leafs only
-        void UpdateLeafsData(Scene1 const& scene, Collector& input_map_leafs_collector, Collector& tex_collector, ClwScene& out) const override;
+        void UpdateLeafsData(Scene1 const& scene, Collector& input_map_collector, Collector& input_map_leafs_collector, Collector& tex_collector, ClwScene& out) const override;
         // Get default material
         Material::Ptr GetDefaultMaterial() const override;
         // If m_current_scene changes
@@ -94,23 +170,75 @@ namespace Baikal
         void UpdateVolumes(Scene1 const& scene, Collector& volume_collector, Collector& tex_collector, ClwScene& out) const override;
         // If scene attributes changed
         void UpdateSceneAttributes(Scene1 const& scene, Collector& tex_collector, ClwScene& out) const override;
+        // Delete intersector shapes of replaced scene version and drop its shared data references
+        void ReleaseCompiledScene(ClwScene& scene) const override;
+        // Report buffer sizes and object counts
+        void UpdateCompileStats(Scene1 const& scene, ClwScene& out) const override;
+        // Read released geometry and texels back from the shared pools
+        void RestoreHostData() const override;
+        // Release host copies of geometry and texels stored as they are in the shared pools
+        void ReleaseHostData(ClwScene& scene) const override;
 
         // Update intersection API
         void UpdateIntersector(Scene1 const& scene, ClwScene& out) const;
-        void UpdateIntersectorTransforms(Scene1 const& scene, ClwScene& out) const;
+        // Write geometry of the mesh into its range, returns number of bytes written.
+        std::size_t UploadGeometry(Mesh const& mesh, ClwScene::GeometryRange const& range, ClwScene& out) const;
+        // Write positions and, if they have been updated, normals of the mesh, returns number of bytes written.
+        std::size_t UploadVertices(Mesh const& mesh, ClwScene::GeometryRange const& range, ClwScene& out) const;
+        // Compute and write tangent frames of the mesh with BAIKAL_VERTEX_TANGENTS, returns number of tangents written.
+        std::size_t UploadTangents(Mesh const& mesh, ClwScene::GeometryRange const& range, ClwScene& out) const;
+        // Try to place the mesh into geometry cache free space.
+        bool AllocateCachedGeometry(Mesh::Ptr const& mesh, ClwScene& out) const;
+        // Drop all references of the scene to shared geometry or texel data.
+        void ReleaseGeometry(ClwScene& scene) const;
+        void ReleaseTextures(ClwScene& scene) const;
+        // Point buffers of cached scenes to recreated shared pools.
+        void RebindSharedBuffers() const;
+        // Set geometry location of the shape, range is null for paged out meshes.
+        static void WriteShapeGeometry(ClwScene::GeometryRange const* range, ClwScene::Shape& shape);
+        // Build object space BVHs of curve shapes among base_shapes (shapes buffer order) and upload them,
+        // curve_root of their descriptors is set, descriptors themselves are not uploaded.
+        void BuildCurves(std::vector<Mesh::Ptr> const& base_shapes, ClwScene& out) const;
+        // Write compact instance records, base_shapes are in shapes buffer order.
+        void UpdateInstances(std::vector<Mesh::Ptr> const& base_shapes, std::set<Instance::Ptr> const& instances, Collector& mat_collector, Collector& vol_collector, ClwScene& out) const;
+        // Number of ints WriteMaterial writes for the material.
+        std::size_t GetMaterialSize(Material const& material) const;
         // Write out single material at data pointer.
         // Collectors are required to convert texture and material pointers into indices.
-        void WriteMaterial(Material const& material, Collector& mat_collector, Collector& tex_collector, std::vector<std::int32_t> &material_data) const;
+        void WriteMaterial(Material const& material, Collector& mat_collector, Collector& tex_collector, std::int32_t* data) const;
+        // Build luminance based distribution for environment light sampling.
+        void UpdateEnvironmentDistribution(Texture const* texture, ClwScene& out) const;
+        // Project environment light onto SH irradiance coefficients used with BAIKAL_SH_IRRADIANCE.
+        void UpdateEnvironmentIrradiance(Texture const* texture, ClwScene& out) const;
         // Write out single light at data pointer.
         // Collector is required to convert texture pointers into indices.
         void WriteLight(Scene1 const& scene, Light const& light, Collector& tex_collector, void* data) const;
         // Write out single texture header at data pointer.
         // Header requires texture data offset, so it is passed in.
         void WriteTexture(Texture const& texture, std::size_t data_offset, void* data) const;
-        // Write out texture data at data pointer.
-        void WriteTextureData(Texture const& texture, void* data) const;
-        // Write single volume at data pointer
-        void WriteVolume(VolumeMaterial const& volume, Collector& tex_collector, void* data) const;
+        // Upload texels of the first level to texture data, in 8x8 tiles with BAIKAL_TILED_TEXTURES.
+        // Three channel formats are expanded to RGBA on the host or, with BAIKAL_TEXTURE_CONVERSION, by a kernel.
+        void WriteTextureData(Texture const& texture, std::size_t data_offset, ClwScene& out) const;
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+        // Build mip levels of the texture from its uploaded first level.
+        void GenerateTextureMips(Texture const& texture, std::size_t data_offset, ClwScene& out) const;
+#endif
+        // Copy RGBA8 textures into layers of texture images array and set their header layers,
+        // does nothing if the device has no image support.
+        void UpdateTextureImages(std::vector<Texture::Ptr> const& textures, std::vector<ClwScene::Texture>& headers, ClwScene& out) const;
+        // Rewrite headers of all the scene textures, paged out ones point at their low resolution copies.
+        void WriteTextureHeaders(ClwScene& out) const;
+        // Upload texels and build mips of the texture in its slot.
+        void UploadTextureData(Texture const& texture, ClwScene::TextureSlot const& slot, ClwScene& out) const;
+        // Grow shared texture data by at least missing_bytes.
+        void GrowTextureData(std::size_t missing_bytes) const;
+        // Make low resolution copies of streamable textures and pick which textures fit into the texture cache,
+        // returns the textures to keep in texture data.
+        std::set<Texture::Ptr> UpdateTextureFallbacks(std::set<Texture::Ptr> const& textures, ClwScene& out) const;
+        // Bytes of texture data used by streamable textures of all the compiled scenes.
+        std::size_t GetTextureCacheUsage() const;
+        // Write single volume at data pointer, density grids of heterogeneous volumes are appended to grids
+        void WriteVolume(VolumeMaterial const& volume, Collector& tex_collector, std::vector<int>& grids, void* data) const;
         // Write single input map leaf at data pointer
         // Collectore is required to convert texture pointers into indices.
         void WriteInputMapLeaf(InputMap const& leaf, Collector& tex_collector, void* data) const;
@@ -119,6 +247,9 @@ namespace Baikal
         std::int32_t ResolveMaterialPtr(Material::Ptr material) const;
 
     private:
+        // Run func for [0, count) on the serialization thread pool or serially
+        void ParallelFor(std::size_t count, std::function<void(std::size_t)> func) const;
+
         int GetMaterialIndex(Collector const& collector, Material::Ptr material) const;
         int GetTextureIndex(Collector const& collector, Texture::Ptr material) const;
         int GetVolumeIndex(Collector const& collector, VolumeMaterial::Ptr volume) const;
@@ -128,11 +259,44 @@ namespace Baikal
         CLWContext m_context;
         // Intersection API
         RadeonRays::IntersectionApi* m_api;
+        // Second intersector for background compiles, might be null
+        RadeonRays::IntersectionApi* m_background_api;
+        // Intersector of the scene being rendered, background compiles use the other one
+        mutable RadeonRays::IntersectionApi* m_current_api;
         // Default material
         Material::Ptr m_default_material;
         // CL Program manager
         const CLProgramManager *m_program_manager;
         // Material to device material map
         mutable std::unordered_map<std::uint32_t, std::int32_t> m_materialid_to_offset;
+        // Layer combinations and source of the last generated UberV2 header
+        mutable std::set<std::uint32_t> m_uberv2_layers;
+        mutable std::string m_uberv2_source;
+        // Staging uploader for scene data
+        mutable ClwUploader m_uploader;
+        // Serialize items on the thread pool
+        bool m_parallel_serialization = true;
+        // On-disk cache of expensive derived scene data
+        CompileCache m_compile_cache;
+        // Geometry cache size, zero if all the geometry is resident
+        std::size_t m_geometry_cache_vertices = 0;
+        std::size_t m_geometry_cache_indices = 0;
+        // Texture cache size in bytes, zero if all the textures are resident
+        std::size_t m_texture_cache_bytes = 0;
+        // Release host copies after compiles
+        bool m_device_resident = false;
+        // Released data and pool locations holding it, locations stay valid until the next compile step
+        // which might rewrite the pools, these restore the data first
+        mutable std::map<std::shared_ptr<Mesh>, ClwScene::GeometryRange> m_released_meshes;
+        mutable std::map<std::shared_ptr<Texture>, ClwScene::TextureSlot> m_released_textures;
+        // Requested acceleration structure and options the intersector has now
+        AccelerationStructure m_acceleration_structure = AccelerationStructure::kBalanced;
+        mutable std::map<RadeonRays::IntersectionApi*, AccelerationStructureOptions> m_intersector_options;
+        // Geometry and texel data shared by all compiled scenes
+        mutable ClwResourceRegistry m_resources;
+#if defined(BAIKAL_TEXTURE_MIPMAPS) || defined(BAIKAL_TEXTURE_CONVERSION)
+        // Mip chain generation and texel expansion kernels
+        std::unique_ptr<ClwClass> m_texture_kernels;
+#endif
     };
 }
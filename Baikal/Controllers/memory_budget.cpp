@@ -0,0 +1,328 @@
+#include "Controllers/memory_budget.h"
+#include "Controllers/clw_scene_controller.h"
+#include "Renderers/monte_carlo_renderer.h"
+#include "SceneGraph/scene1.h"
+#include "SceneGraph/texture.h"
+#include "Utils/half_conversion.h"
+#include "Utils/texture_compression.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <vector>
+
+namespace Baikal
+{
+    namespace
+    {
+        // Textures are not downscaled below this size
+        int constexpr kMinDownscaledTextureSize = 256;
+
+        std::string ToMegabytes(std::size_t bytes)
+        {
+            std::ostringstream stream;
+            stream.precision(1);
+            stream << std::fixed << bytes / (1024.f * 1024.f) << "MB";
+            return stream.str();
+        }
+
+        // Size of a single channel of an uncompressed format
+        std::size_t GetChannelSize(Texture::Format format)
+        {
+            switch (format)
+            {
+            case Texture::Format::kRgba8:
+            case Texture::Format::kR8:
+            case Texture::Format::kRg8:
+            case Texture::Format::kRgb8:
+                return 1u;
+            case Texture::Format::kRgba16:
+            case Texture::Format::kR16:
+            case Texture::Format::kRg16:
+            case Texture::Format::kRgb16:
+                return 2u;
+            case Texture::Format::kRgba32:
+            case Texture::Format::kRgb32:
+                return 4u;
+            default:
+                return 0u;
+            }
+        }
+
+        bool IsOpaque(Texture const& texture)
+        {
+            auto size = texture.GetSize();
+            auto texels = reinterpret_cast<std::uint8_t const*>(texture.GetData());
+            auto num_texels = static_cast<std::size_t>(size.x) * size.y * size.z;
+
+            for (std::size_t i = 0; i < num_texels; ++i)
+            {
+                if (texels[4 * i + 3] != 255u)
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        bool CanCompress(Texture const& texture)
+        {
+            return texture.GetFormat() == Texture::Format::kRgba8 && IsOpaque(texture);
+        }
+
+        bool CanDownscale(Texture const& texture)
+        {
+            auto size = texture.GetSize();
+            return !texture.IsCompressed() && GetChannelSize(texture.GetFormat()) > 0 &&
+                   size.z == 1 && std::max(size.x, size.y) > kMinDownscaledTextureSize;
+        }
+
+        template <typename T>
+        float LoadChannel(char const* data, std::size_t index)
+        {
+            return static_cast<float>(reinterpret_cast<T const*>(data)[index]);
+        }
+
+        template <typename T>
+        void StoreChannel(char* data, std::size_t index, float value)
+        {
+            reinterpret_cast<T*>(data)[index] = static_cast<T>(value);
+        }
+
+        // 2x2 box filter of 2D texels, odd edges repeat the last row and column
+        template <typename T>
+        void DownscaleTexels(char const* src, RadeonRays::int3 size, std::size_t channels, char* data, float rounding)
+        {
+            auto width = std::max(size.x / 2, 1);
+            auto height = std::max(size.y / 2, 1);
+
+            for (auto y = 0; y < height; ++y)
+            {
+                auto y0 = std::min(2 * y, size.y - 1);
+                auto y1 = std::min(2 * y + 1, size.y - 1);
+
+                for (auto x = 0; x < width; ++x)
+                {
+                    auto x0 = std::min(2 * x, size.x - 1);
+                    auto x1 = std::min(2 * x + 1, size.x - 1);
+
+                    for (std::size_t c = 0; c < channels; ++c)
+                    {
+                        auto value = LoadChannel<T>(src, (static_cast<std::size_t>(y0) * size.x + x0) * channels + c) +
+                                     LoadChannel<T>(src, (static_cast<std::size_t>(y0) * size.x + x1) * channels + c) +
+                                     LoadChannel<T>(src, (static_cast<std::size_t>(y1) * size.x + x0) * channels + c) +
+                                     LoadChannel<T>(src, (static_cast<std::size_t>(y1) * size.x + x1) * channels + c);
+
+                        StoreChannel<T>(data, (static_cast<std::size_t>(y) * width + x) * channels + c, 0.25f * value + rounding);
+                    }
+                }
+            }
+        }
+
+        // Downscaled copy of a 2D texture of the same format
+        template <typename T>
+        Texture::Ptr Downscale(Texture const& texture, float rounding)
+        {
+            auto size = texture.GetSize();
+            auto width = std::max(size.x / 2, 1);
+            auto height = std::max(size.y / 2, 1);
+            auto channels = texture.GetSizeInBytes() / (static_cast<std::size_t>(size.x) * size.y * sizeof(T));
+
+            auto data = new char[channels * sizeof(T) * width * height];
+            DownscaleTexels<T>(texture.GetData(), size, channels, data, rounding);
+
+            return Texture::Create(data, RadeonRays::int3(width, height, 1), texture.GetFormat());
+        }
+
+        // Half textures are filtered in single precision, converting all texels at once
+        Texture::Ptr DownscaleHalf(Texture const& texture)
+        {
+            auto size = texture.GetSize();
+            auto width = std::max(size.x / 2, 1);
+            auto height = std::max(size.y / 2, 1);
+            auto num_values = texture.GetSizeInBytes() / sizeof(std::uint16_t);
+            auto channels = num_values / (static_cast<std::size_t>(size.x) * size.y);
+
+            std::vector<float> values(num_values);
+            HalfConversion::HalfToFloat(reinterpret_cast<std::uint16_t const*>(texture.GetData()), values.data(), num_values);
+
+            std::vector<float> filtered(channels * width * height);
+            DownscaleTexels<float>(reinterpret_cast<char const*>(values.data()), size, channels,
+                reinterpret_cast<char*>(filtered.data()), 0.f);
+
+            auto data = new char[filtered.size() * sizeof(std::uint16_t)];
+            HalfConversion::FloatToHalf(filtered.data(), reinterpret_cast<std::uint16_t*>(data), filtered.size());
+
+            return Texture::Create(data, RadeonRays::int3(width, height, 1), texture.GetFormat());
+        }
+
+        Texture::Ptr Downscale(Texture const& texture)
+        {
+            switch (GetChannelSize(texture.GetFormat()))
+            {
+            case 1u:
+                return Downscale<std::uint8_t>(texture, 0.5f);
+            case 2u:
+                return DownscaleHalf(texture);
+            default:
+                return Downscale<float>(texture, 0.f);
+            }
+        }
+    }
+
+    MemoryBudget::MemoryBudget(CLWContext const& context, float fraction)
+    {
+        cl_ulong global_mem_size = 0;
+        clGetDeviceInfo(context.GetDevice(0).GetID(), CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem_size), &global_mem_size, nullptr);
+
+        m_budget_bytes = static_cast<std::size_t>(global_mem_size * std::max(std::min(fraction, 1.f), 0.f));
+    }
+
+    MemoryBudget::MemoryBudget(std::size_t budget_bytes)
+        : m_budget_bytes(budget_bytes)
+    {
+    }
+
+    MemoryBudget::Report MemoryBudget::Fit(Scene1 const& scene, ClwSceneController& controller, MonteCarloRenderer& renderer) const
+    {
+        auto estimate = controller.EstimateSceneMemory(scene);
+        auto& textures = estimate.textures;
+
+        auto geometry_bytes = estimate.geometry_bytes;
+        auto texture_bytes = estimate.texture_bytes;
+        auto work_buffer_bytes = renderer.GetWorkBufferMemorySize();
+
+        auto get_total = [&]() { return geometry_bytes + texture_bytes + work_buffer_bytes; };
+        // Budget left for one part given the others
+        auto get_available = [this](std::size_t others) { return m_budget_bytes > others ? m_budget_bytes - others : 0u; };
+
+        Report report;
+        report.budget_bytes = m_budget_bytes;
+        report.requested_bytes = get_total();
+
+        // Replace texture data keeping its size in the estimate up to date
+        auto replace_texture = [&](std::pair<Texture::Ptr, std::size_t>& entry, Texture& replacement)
+        {
+            entry.first->TakeData(replacement);
+            auto size = ClwSceneController::GetTextureMemorySize(*entry.first);
+            texture_bytes = texture_bytes - entry.second + size;
+            entry.second = size;
+        };
+
+        // BC1 keeps RGB at 4 bits per texel, it is the smallest loss of quality
+        if (get_total() > m_budget_bytes)
+        {
+            auto num_compressed = 0u;
+            auto texture_bytes_before = texture_bytes;
+
+            for (auto& entry : textures)
+            {
+                if (get_total() <= m_budget_bytes)
+                {
+                    break;
+                }
+
+                if (CanCompress(*entry.first))
+                {
+                    auto compressed = TextureCompression::Compress(*entry.first, Texture::Format::kBc1);
+                    replace_texture(entry, *compressed);
+                    ++num_compressed;
+                }
+            }
+
+            if (num_compressed > 0)
+            {
+                report.actions.push_back("Compressed " + std::to_string(num_compressed) + " textures to BC1, saved " +
+                                         ToMegabytes(texture_bytes_before - texture_bytes));
+            }
+        }
+
+        // Smaller work buffer only costs rendering speed
+        if (get_total() > m_budget_bytes)
+        {
+            auto work_buffer_bytes_before = work_buffer_bytes;
+
+            renderer.LimitWorkBufferMemory(get_available(geometry_bytes + texture_bytes));
+            work_buffer_bytes = renderer.GetWorkBufferMemorySize();
+
+            if (work_buffer_bytes < work_buffer_bytes_before)
+            {
+                report.actions.push_back("Reduced work buffer from " + ToMegabytes(work_buffer_bytes_before) + " to " +
+                                         ToMegabytes(work_buffer_bytes));
+            }
+        }
+
+        // Halve the largest texture until everything fits
+        if (get_total() > m_budget_bytes)
+        {
+            std::vector<Texture*> downscaled;
+            auto texture_bytes_before = texture_bytes;
+
+            while (get_total() > m_budget_bytes)
+            {
+                auto largest = textures.end();
+
+                for (auto iter = textures.begin(); iter != textures.end(); ++iter)
+                {
+                    if (CanDownscale(*iter->first) && (largest == textures.end() || iter->second > largest->second))
+                    {
+                        largest = iter;
+                    }
+                }
+
+                if (largest == textures.end())
+                {
+                    break;
+                }
+
+                auto smaller = Downscale(*largest->first);
+                replace_texture(*largest, *smaller);
+
+                if (std::find(downscaled.cbegin(), downscaled.cend(), largest->first.get()) == downscaled.cend())
+                {
+                    downscaled.push_back(largest->first.get());
+                }
+            }
+
+            if (!downscaled.empty())
+            {
+                report.actions.push_back("Downscaled " + std::to_string(downscaled.size()) + " textures, saved " +
+                                         ToMegabytes(texture_bytes_before - texture_bytes));
+            }
+        }
+
+        // Page out the rest, textures first since their low resolution copies are sampled in the meantime
+        if (get_total() > m_budget_bytes && !controller.IsTextureCacheEnabled())
+        {
+            auto cache_bytes = get_available(geometry_bytes + work_buffer_bytes);
+
+            if (cache_bytes > 0)
+            {
+                controller.SetTextureCacheSize(cache_bytes);
+                texture_bytes = std::min(texture_bytes, cache_bytes);
+                report.actions.push_back("Enabled " + ToMegabytes(cache_bytes) + " texture cache");
+            }
+        }
+
+        if (get_total() > m_budget_bytes && !controller.IsGeometryCacheEnabled() && geometry_bytes > 0)
+        {
+            auto cache_bytes = get_available(texture_bytes + work_buffer_bytes);
+            // Keep the vertex to index ratio of the scene
+            auto max_vertices = static_cast<std::size_t>(static_cast<double>(cache_bytes) * estimate.num_vertices / geometry_bytes);
+            auto max_indices = static_cast<std::size_t>(static_cast<double>(cache_bytes) * estimate.num_indices / geometry_bytes);
+
+            if (max_vertices > 0 && max_indices > 0)
+            {
+                controller.SetGeometryCacheSize(max_vertices, max_indices);
+                geometry_bytes = cache_bytes;
+                report.actions.push_back("Enabled " + ToMegabytes(cache_bytes) + " geometry cache");
+            }
+        }
+
+        report.fitted_bytes = get_total();
+        report.work_buffer_bytes = work_buffer_bytes;
+        report.fits = report.fitted_bytes <= m_budget_bytes;
+        return report;
+    }
+}
@@ -0,0 +1,79 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+
+
+/**
+ \file memory_budget.h
+ \version 1.0
+ \brief Contains MemoryBudget class.
+ */
+#pragma once
+
+#include "CLW.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Baikal
+{
+    class Scene1;
+    class ClwSceneController;
+    class MonteCarloRenderer;
+
+    /**
+     \brief Fits a scene and the renderer working set into device memory.
+
+     Device memory of the compiled scene is estimated before anything is allocated. While the estimate
+     does not fit, the scene and renderer are degraded step by step, cheapest loss of quality first:
+     opaque 8 bit textures are block compressed, the work buffer is shrunk, the largest textures are
+     downscaled and finally geometry and texture caches are enabled for what is left over.
+     Texture changes are made to the scene itself, so Fit has to be called before the scene is compiled.
+     */
+    class MemoryBudget
+    {
+    public:
+        struct Report
+        {
+            std::size_t budget_bytes = 0;
+            // Estimated device memory of the scene and the work buffer before and after Fit
+            std::size_t requested_bytes = 0;
+            std::size_t fitted_bytes = 0;
+            std::size_t work_buffer_bytes = 0;
+            // Human readable description of every step taken
+            std::vector<std::string> actions;
+            bool fits = false;
+        };
+
+        // Budget is the fraction of global memory of the first device of the context
+        MemoryBudget(CLWContext const& context, float fraction);
+        explicit MemoryBudget(std::size_t budget_bytes);
+
+        std::size_t GetBudget() const { return m_budget_bytes; }
+
+        // Degrade the scene until it fits into the budget, caches are only enabled if not set up already
+        Report Fit(Scene1 const& scene, ClwSceneController& controller, MonteCarloRenderer& renderer) const;
+
+    private:
+        std::size_t m_budget_bytes;
+    };
+}
@@ -0,0 +1,141 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+
+/**
+ \file scene_compile_stats.h
+ \version 1.0
+ \brief Contains SceneCompileStats structure.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Baikal
+{
+    /**
+     \brief Timings, device memory and object counts of the last scene compile.
+
+     Filled by SceneController on every CompileScene call and kept with the compiled scene.
+     */
+    struct SceneCompileStats
+    {
+        // Compile steps, one per SceneController::Update* method
+        enum Step
+        {
+            kCamera,
+            kMaterials,
+            kLights,
+            kShapes,
+            kShapeProperties,
+            kShapeTransforms,
+            kShapeVertices,
+            kTextures,
+            kVolumes,
+            kInputMapLeafs,
+            kInputMaps,
+            kCurrentScene,
+            kSceneAttributes,
+
+            kStepCount
+        };
+
+        // Device buffer of the compiled scene
+        struct Buffer
+        {
+            char const* name;
+            std::size_t bytes;
+        };
+
+        // Wall time of each step in milliseconds, zero for steps which have not run
+        std::array<double, kStepCount> step_milliseconds = {};
+        // Number of times each step has run during the compile
+        std::array<std::uint32_t, kStepCount> step_runs = {};
+        // Wall time of the whole compile including object collection
+        double total_milliseconds = 0.0;
+        // True if the scene has been compiled from scratch
+        bool full_recompile = false;
+        // True if nothing has changed since the previous compile, which then has been returned as is.
+        // Buffers and counts are the ones of the previous compile
+        bool unchanged = false;
+
+        // Allocated size of every buffer, buffers might be larger than their content
+        std::vector<Buffer> buffers;
+        std::size_t total_bytes = 0;
+        // Part of total_bytes in buffers shared with other compiled scenes
+        std::size_t shared_bytes = 0;
+
+        std::size_t num_shapes = 0;
+        std::size_t num_instances = 0;
+        std::size_t num_vertices = 0;
+        std::size_t num_triangles = 0;
+        std::size_t num_lights = 0;
+        std::size_t num_materials = 0;
+        std::size_t num_textures = 0;
+        std::size_t num_volumes = 0;
+        std::size_t num_input_maps = 0;
+        // Instances bound to another level of detail by the compile
+        std::size_t num_lod_switches = 0;
+
+        void Reset(bool full)
+        {
+            *this = SceneCompileStats();
+            full_recompile = full;
+        }
+
+        void AddBuffer(char const* name, std::size_t bytes)
+        {
+            buffers.push_back({ name, bytes });
+            total_bytes += bytes;
+        }
+
+        void AddSharedBuffer(char const* name, std::size_t bytes)
+        {
+            AddBuffer(name, bytes);
+            shared_bytes += bytes;
+        }
+
+        static char const* GetStepName(Step step)
+        {
+            static char const* const kNames[kStepCount] =
+            {
+                "Camera",
+                "Materials",
+                "Lights",
+                "Shapes",
+                "Shape properties",
+                "Shape transforms",
+                "Shape vertices",
+                "Textures",
+                "Volumes",
+                "Input map leafs",
+                "Input maps",
+                "Current scene",
+                "Scene attributes"
+            };
+
+            return kNames[step];
+        }
+    };
+}
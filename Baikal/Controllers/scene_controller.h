@@ -28,12 +28,22 @@
  */
 #pragma once
 
+#include "Controllers/scene_compile_stats.h"
 #include "SceneGraph/Collector/collector.h"
 #include "SceneGraph/material.h"
 #include "SceneGraph/scene1.h"
+#include "SceneGraph/texture.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace Baikal
 {
@@ -59,9 +69,46 @@ namespace Baikal
         virtual ~SceneController() = default;
 
         // Given a scene this method produces (or loads from cache) corresponding GPU representation.
+        // Timings, memory and counts of the compile are returned in compile_stats of the result.
         CompiledScene& CompileScene(Scene1::Ptr scene) const;
 
         CompiledScene& GetCachedScene(Scene1::Ptr scene) const;
+        // Check if the scene has a compiled version in the cache
+        bool IsSceneCached(Scene1::Ptr scene) const { return m_scene_cache.find(scene) != m_scene_cache.cend(); }
+
+        // Start compiling the scene from scratch into a shadow copy on a worker thread.
+        // Previously compiled version stays in the cache and can be rendered meanwhile.
+        // The scene must not be changed until the compile is finished. Dirty flags are
+        // dropped by TrySwapScene, objects changed anyway stay dirty for the next compile.
+        void CompileSceneAsync(Scene1::Ptr scene) const;
+        // Check if background compile of the scene is in progress or waits for a swap.
+        bool IsCompilePending(Scene1::Ptr scene) const;
+        // If background compile of the scene is finished, replace cached version
+        // with the new one and return true. Compile errors are rethrown from here.
+        // Controller methods are expected to be called from one (rendering) thread,
+        // the swap should happen between frames.
+        bool TrySwapScene(Scene1::Ptr scene) const;
+
+        // Limit device memory of all compiled scenes, as reported by their compile stats.
+        // Least recently compiled or fetched scenes are evicted once a compile exceeds the budget,
+        // the scene being compiled and scenes with a pending background compile are kept.
+        // Zero (default) disables eviction.
+        void SetMemoryBudget(std::size_t bytes) { m_memory_budget = bytes; }
+        std::size_t GetMemoryBudget() const { return m_memory_budget; }
+        // Drop compiled version of the scene, references to it become invalid.
+        // Next CompileScene call for the scene compiles it from scratch.
+        void EvictScene(Scene1::Ptr scene) const;
+        // Drop compiled versions of all the scenes, none of them may have a pending background compile
+        void EvictAllScenes() const;
+        // Device memory of all compiled scenes
+        std::size_t GetCachedSceneMemory() const;
+        std::size_t GetNumCachedScenes() const { return m_scene_cache.size(); }
+
+        // Instances with levels of detail only switch once their projected size is past the level
+        // threshold by this fraction of it, so sizes around a threshold do not rebuild shapes every frame
+        void SetLodHysteresis(float fraction) { m_lod_hysteresis = fraction; m_journal_valid = false; }
+        float GetLodHysteresis() const { return m_lod_hysteresis; }
+
     protected:
         // Recompile the scene from scratch, i.e. not loading from cache.
         // All the buffers are recreated and reloaded.
@@ -73,13 +120,57 @@ namespace Baikal
         void DropCameraDirty(Scene1 const& scene) const;
         // set dirty flag to false for iterator
         void DropDirty(Iterator& light_iterator) const;
+        // set transform dirty flag to false for shape iterator
+        void DropTransformDirty(Iterator& shape_iterator) const;
+        // set vertices dirty flag to false for meshes and instance base meshes of shape iterator
+        void DropVerticesDirty(Iterator& shape_iterator) const;
+        // check vertices dirty flag of a mesh or of the base mesh of an instance
+        static bool IsVerticesDirty(Shape const& shape);
+        // Bind instances with levels of detail to the level of their projected size from the scene camera,
+        // returns number of instances which have switched
+        std::size_t SelectInstanceLods(Scene1 const& scene) const;
+        // Fill collectors with scene materials, volumes, textures and input maps
+        void CollectObjects(Scene1 const& scene) const;
+        void CollectObjects(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector,
+                            Collector& vol_collector, Collector& input_maps_collector,
+                            Collector& input_map_leafs_collector) const;
+        // Textures the scene would be compiled with, collected without touching the controller state
+        std::vector<Texture::Ptr> CollectTextures(Scene1 const& scene) const;
+        // set dirty flag to false for all collected objects
+        void DropCollectedDirty() const;
+        // set dirty flags to false for camera, lights and shapes of the scene
+        void DropSceneObjectsDirty(Scene1 const& scene) const;
+        // True on the worker thread while CompileSceneAsync is running. Implementations
+        // should not change state shared with rendering (e.g. attached intersector shapes).
+        bool IsCompilingInBackground() const { return m_background_thread.load() == std::this_thread::get_id(); }
+        // Block until all background compiles are finished, derived classes
+        // should call this in their destructors
+        void WaitForPendingCompiles() const;
+        // Run single Update* step and add its wall time to out.compile_stats
+        template <typename Func>
+        void RunCompileStep(SceneCompileStats::Step step, CompiledScene& out, Func&& func) const;
+        // Fill counts, memory and total time of compile started at start
+        void FinishCompileStats(Scene1 const& scene, std::chrono::high_resolution_clock::time_point start, CompiledScene& out) const;
+        // Mark the scene as most recently used
+        void TouchScene(Scene1::Ptr const& scene) const;
+        // Evict least recently used scenes other than keep until cached scenes fit into the budget
+        void EnforceMemoryBudget(Scene1::Ptr const& keep) const;
+        // Release and remove cache entry, m_compile_mutex should be held
+        void EraseCachedScene(Scene1::Ptr const& scene) const;
+        // Run func for every cached compiled scene
+        template <typename Func>
+        void ForEachCachedScene(Func&& func) const;
     public:
         // Update camera data only.
         virtual void UpdateCamera(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, Collector& vol_collector, CompiledScene& out) const = 0;
         // Update shape data only.
         virtual void UpdateShapes(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, Collector& volume_collector, CompiledScene& out) const = 0;
-        // Update shape transforms
+        // Update shape properties (materials, volumes, ids)
         virtual void UpdateShapeProperties(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, Collector& volume_collector, CompiledScene& out) const = 0;
+        // Update shape transforms only
+        virtual void UpdateShapeTransforms(Scene1 const& scene, CompiledScene& out) const = 0;
+        // Update vertex positions of deformed meshes only
+        virtual void UpdateShapeVertices(Scene1 const& scene, CompiledScene& out) const = 0;
         // Update lights data only.
         virtual void UpdateLights(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, CompiledScene& out) const = 0;
         // Update material data.
@@ -88,8 +179,8 @@ namespace Baikal
         virtual void UpdateTextures(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector, CompiledScene& out) const = 0;
         // Update input maps only
         virtual void UpdateInputMaps(Scene1 const& scene, Collector& input_map_collector, Collector& input_map_leafs_collector, CompiledScene& out) const = 0;
-        // Update input map leafs only
-        virtual void UpdateLeafsData(Scene1 const& scene, Collector& input_map_leafs_collector, Collector& tex_collector, CompiledScene& out) const = 0;
+        // Update input map values only: leafs and matrices of input_map_collector maps
+        virtual void UpdateLeafsData(Scene1 const& scene, Collector& input_map_collector, Collector& input_map_leafs_collector, Collector& tex_collector, CompiledScene& out) const = 0;
         // Default material
         virtual Material::Ptr GetDefaultMaterial() const = 0;
         // If m_current_scene changes
@@ -98,18 +189,58 @@ namespace Baikal
         virtual void UpdateVolumes(Scene1 const& scene, Collector& volume_collector, Collector& tex_collector, CompiledScene& out) const = 0;
         // If scene attributes changed
         virtual void UpdateSceneAttributes(Scene1 const& scene, Collector& tex_collector, CompiledScene& out) const = 0;
+        // Release resources of compiled scene version which is being replaced
+        virtual void ReleaseCompiledScene(CompiledScene& scene) const = 0;
+        // Fill device memory and object counts of out.compile_stats
+        virtual void UpdateCompileStats(Scene1 const& scene, CompiledScene& out) const = 0;
+        // Put back host copies of scene data released after previous compiles, called before compile steps reading them
+        virtual void RestoreHostData() const = 0;
+        // Release host copies of data uploaded for the compiled scene, if the implementation keeps data on the device
+        virtual void ReleaseHostData(CompiledScene& scene) const = 0;
 
 
     private:
+        // Return the current scene as is if neither it nor any scene object has changed since its compile
+        bool TryReuseCurrentScene(Scene1 const& scene, std::uint64_t change_count,
+                                  std::chrono::high_resolution_clock::time_point start) const;
+
         mutable Scene1::Ptr m_current_scene;
+        // Change journal position the current scene has been compiled at, see SceneObject::GetChangeCount.
+        // Not valid until a CompileScene call has compiled it or once another compile has used the collectors
+        mutable std::uint64_t m_journal_position = 0;
+        mutable bool m_journal_valid = false;
         // Scene cache map (CPU scene -> GPU scene mapping)
         mutable std::map<Scene1::Ptr, CompiledScene> m_scene_cache;
+        // Cached scene -> last use stamp, for LRU eviction
+        mutable std::map<Scene1::Ptr, std::uint64_t> m_scene_last_use;
+        mutable std::uint64_t m_use_clock = 0;
+        std::size_t m_memory_budget = 0;
+        float m_lod_hysteresis = 0.2f;
 
         mutable Collector m_material_collector;
         mutable Collector m_volume_collector;
         mutable Collector m_texture_collector;
         mutable Collector m_input_maps_collector;
         mutable Collector m_input_map_leafs_collector;
+
+        struct PendingScene
+        {
+            std::unique_ptr<CompiledScene> scene;
+            // Materials, textures, volumes and input maps the shadow version has been compiled with
+            std::future<std::vector<SceneObject::Ptr>> result;
+            // Change journal position and scene dirty flags when the compile was started
+            std::uint64_t change_count = 0;
+            Scene1::DirtyFlags dirty_flags = 0;
+        };
+
+        // Scenes being compiled in background (CPU scene -> shadow GPU scene)
+        mutable std::map<Scene1::Ptr, PendingScene> m_pending_scenes;
+        // Guards m_pending_scenes, never held while m_compile_mutex is being taken
+        mutable std::mutex m_pending_mutex;
+        // Collectors and intersector state are shared, so compiles are serialized
+        mutable std::mutex m_compile_mutex;
+        // Worker thread running CompileSceneAsync, default id if none
+        mutable std::atomic<std::thread::id> m_background_thread{ std::thread::id() };
     };
 }
 
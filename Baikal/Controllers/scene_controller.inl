@@ -7,15 +7,34 @@
 #include "SceneGraph/Collector/collector.h"
 #include "SceneGraph/iterator.h"
 #include "SceneGraph/uberv2material.h"
+#include "Utils/trace.h"
 
 #include <chrono>
+#include <cmath>
+#include <future>
 #include <memory>
+#include <set>
 #include <stack>
 #include <vector>
 #include <array>
+#include <algorithm>
 
 namespace Baikal
 {
+    // Add texture to the set, tiles of UDIM sets are sampled through the set and need indices too
+    inline void EmplaceTexture(std::set<SceneObject::Ptr>& textures, Texture::Ptr const& texture)
+    {
+        textures.emplace(texture);
+
+        if (auto udim = std::dynamic_pointer_cast<UdimTexture>(texture))
+        {
+            for (auto const& tile : udim->GetTiles())
+            {
+                textures.emplace(tile.second);
+            }
+        }
+    }
+
     template <typename CompiledScene>
     inline
     SceneController<CompiledScene>::SceneController() {}
@@ -27,6 +46,7 @@ namespace Baikal
         auto iter = m_scene_cache.find(scene);
 
         if (iter != m_scene_cache.cend()) {
+            TouchScene(scene);
             return iter->second;
         } else {
             throw std::runtime_error("Scene has not been compiled");
@@ -48,222 +68,29 @@ namespace Baikal
         // As soon as we have this mapping we are analyzing dirty flags and
         // updating necessary parts.
 
-        // We need to make sure collectors are empty before proceeding
-        m_material_collector.Clear();
-        m_texture_collector.Clear();
-        m_volume_collector.Clear();
-        m_input_maps_collector.Clear();
-        m_input_map_leafs_collector.Clear();
-
-        // Create shape and light iterators
-        auto shape_iter = scene->CreateShapeIterator();
-        auto light_iter = scene->CreateLightIterator();
-
-        auto default_material = GetDefaultMaterial();
-        // Collect materials from shapes first
-        m_material_collector.Collect(*shape_iter,
-                              // This function adds all materials to resulting map
-                              // recursively via Material dependency API
-                              [default_material](SceneObject::Ptr item) ->
-                              std::set<SceneObject::Ptr>
-                              {
-                                  // Resulting material set
-                                  std::set<SceneObject::Ptr> mats;
-                                  // Material stack
-                                  std::stack<Material::Ptr> material_stack;
-
-                                  // Get material from current shape
-                                  auto shape = std::static_pointer_cast<Shape>(item);
-                                  auto material = shape->GetMaterial();
-
-                                  // If shape does not have a material, use default one
-                                  if (!material)
-                                  {
-                                      material = default_material;
-                                  }
-
-                                  // Push to stack as an initializer
-                                  material_stack.push(material);
-
-                                  // Drain the stack
-                                  while (!material_stack.empty())
-                                  {
-                                      // Get current material
-                                      auto m = material_stack.top();
-                                      material_stack.pop();
-
-                                      // Emplace into the set
-                                      mats.emplace(m);
-
-                                      // Create dependency iterator
-                                      auto mat_iter = m->CreateMaterialIterator();
-
-                                      // Push all dependencies into the stack
-                                      for (; mat_iter->IsValid(); mat_iter->Next())
-                                      {
-                                          material_stack.push(
-                                            mat_iter->ItemAs<Material>()
-                                          );
-                                      }
-                                  }
-
-                                  // Return resulting set
-                                  return mats;
-                              });
-
-        // Commit stuff (we can iterate over it after commit has happened)
-        m_material_collector.Commit();
-
-        // set iterator position at begin
-        shape_iter->Reset();
-        // Collect volume materials from shapes first
-        m_volume_collector.Collect(*shape_iter,
-                                    [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
-                                    {
-                                        // Resulting material set
-                                        std::set<SceneObject::Ptr> vol_mats;
-
-                                        // Get volume material from current shape
-                                        auto shape = std::static_pointer_cast<Shape>(item);
-                                        auto volume_material = shape->GetVolumeMaterial();
-
-                                        if (volume_material)
-                                            vol_mats.emplace(volume_material);
-
-                                        return vol_mats;
-                                    });
-
-        // Commit stuff
-        m_volume_collector.Commit();
-
-        // Now we need to collect textures from our materials
-        // Create material iterator
-        auto mat_iter = m_material_collector.CreateIterator();
-
-        // Collect textures from materials
-        m_texture_collector.Collect(*mat_iter,
-                                    [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
-                              {
-                                  // Texture set
-                                  std::set<SceneObject::Ptr> textures;
-
-                                  auto material = std::static_pointer_cast<Material>(item);
-
-                                  // Create texture dependency iterator
-                                  auto tex_iter = material->CreateTextureIterator();
+        BAIKAL_TRACE_SCOPE("scene", "CompileScene");
 
-                                  // Emplace all dependent textures
-                                  for (; tex_iter->IsValid(); tex_iter->Next())
-                                  {
-                                      textures.emplace(tex_iter->ItemAs<Texture>());
-                                  }
+        std::lock_guard<std::mutex> lock(m_compile_mutex);
 
-                                  // Return resulting set
-                                  return textures;
-                              });
+        auto compile_start = std::chrono::high_resolution_clock::now();
 
-        // Now we need to collect textures from volumes
-        // Create volume iterator
-        auto vol_iter = m_volume_collector.CreateIterator();
+        // Taken before anything is checked, changes made during the compile are picked up by the next one
+        auto change_count = SceneObject::GetChangeCount();
 
-        // Collect textures from materials
-        m_texture_collector.Collect(*vol_iter,
-            [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
+        // Idle frames do not walk the objects at all
+        if (scene == m_current_scene && TryReuseCurrentScene(*scene, change_count, compile_start))
         {
-            // Texture set
-            std::set<SceneObject::Ptr> textures;
-
-            auto volume = std::static_pointer_cast<VolumeMaterial>(item);
-
-            // Create texture dependency iterator
-            auto tex_iter = volume->CreateTextureIterator();
-
-            // Emplace all dependent textures
-            for (; tex_iter->IsValid(); tex_iter->Next())
-            {
-                textures.emplace(tex_iter->ItemAs<Texture>());
-            }
-
-            // Return resulting set
-            return textures;
-        });
-
-        // Collect textures from lights
-        m_texture_collector.Collect(*light_iter,
-                                    [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
-                              {
-                                  // Resulting set
-                                  std::set<SceneObject::Ptr> textures;
-
-                                  auto light = std::static_pointer_cast<Light>(item);
-
-                                  // Create texture dependency iterator
-                                  auto tex_iter = light->CreateTextureIterator();
-
-                                  // Emplace all dependent textures
-                                  for (; tex_iter->IsValid(); tex_iter->Next())
-                                  {
-                                      textures.emplace(tex_iter->ItemAs<Texture>());
-                                  }
-
-                                  // Return resulting set
-                                  return textures;
-                              });
-
-        mat_iter->Reset();
-        m_input_maps_collector.Collect(*mat_iter,
-                                [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
-                                {
-                                    // Texture set
-                                    std::set<SceneObject::Ptr> input_maps;
-
-                                    auto material = std::static_pointer_cast<Material>(item);
-
-                                    // Create texture dependency iterator
-                                    auto input_map_iter = material->CreateInputMapsIterator();
-
-                                    // Emplace all dependent textures
-                                    for (; input_map_iter->IsValid(); input_map_iter->Next())
-                                    {
-                                        input_maps.emplace(input_map_iter->ItemAs<InputMap>());
-                                    }
-
-                                    // Return resulting set
-                                    return input_maps;
-                                });
-        m_input_maps_collector.Commit();
-
-        mat_iter->Reset();
-        m_input_map_leafs_collector.Collect(*mat_iter,
-                                [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
-                                {
-                                    // Texture set
-                                    std::set<SceneObject::Ptr> input_maps;
-
-                                    auto material = std::static_pointer_cast<Material>(item);
-
-                                    // Create texture dependency iterator
-                                    auto input_map_iter = material->CreateInputMapLeafsIterator();
-
-                                    // Emplace all dependent textures
-                                    for (; input_map_iter->IsValid(); input_map_iter->Next())
-                                    {
-                                        input_maps.emplace(input_map_iter->ItemAs<InputMap>());
-                                    }
-
-                                    // Return resulting set
-                                    return input_maps;
-                                });
-        m_input_map_leafs_collector.Commit();
-
+            return m_scene_cache.find(scene)->second;
+        }
 
-        // Add background texture from scene into texture collector
-        auto background_texture = scene->GetBackgroundImage();
-        if (background_texture)
-            m_texture_collector.Collect(background_texture);
+        // Switched instances have their base meshes changed, which adds and removes geometry
+        auto num_lod_switches = SelectInstanceLods(*scene);
+        if (num_lod_switches > 0)
+        {
+            scene->SetDirtyFlag(Scene1::kShapes);
+        }
 
-        // Commit textures
-        m_texture_collector.Commit();
+        CollectObjects(*scene);
 
         // Try to find scene in cache first
         auto iter = m_scene_cache.find(scene);
@@ -303,6 +130,16 @@ namespace Baikal
                 input_map->SetDirty(false);
             });
 
+            res.first->second.compile_stats.num_lod_switches = num_lod_switches;
+            FinishCompileStats(*scene, compile_start, res.first->second);
+
+            m_journal_position = change_count;
+            m_journal_valid = true;
+
+            TouchScene(scene);
+            EnforceMemoryBudget(scene);
+            ReleaseHostData(res.first->second);
+
             // Return the scene
             return res.first->second;
         }
@@ -312,6 +149,9 @@ namespace Baikal
             auto& out = iter->second;
             auto dirty = scene->GetDirtyFlags();
 
+            out.compile_stats.Reset(false);
+            out.compile_stats.num_lod_switches = num_lod_switches;
+
             bool should_update_materials = !out.material_bundle ||
                 m_material_collector.NeedsUpdate(out.material_bundle.get(),
                                                  [](SceneObject::Ptr ptr)->bool
@@ -348,6 +188,24 @@ namespace Baikal
                     return ptr->IsDirty();
                 }));
 
+            // Matrices of input maps are stored with the leaf values, input map source does not depend on them
+            should_update_leafs_data = should_update_leafs_data || should_update_input_maps;
+
+            // Materials, volumes and input map leafs refer to textures by index, shapes refer to volumes by index.
+            // Collector indices are stable, but removals move items, so dependent data has to be rewritten.
+            bool texture_indices_changed = m_texture_collector.GetNumItems() > 0 && out.texture_bundle &&
+                m_texture_collector.IndicesChanged(out.texture_bundle.get());
+
+            if (texture_indices_changed)
+            {
+                should_update_materials = true;
+                should_update_volumes = true;
+                should_update_leafs_data = m_input_map_leafs_collector.GetNumItems() > 0;
+            }
+
+            bool volume_indices_changed = m_volume_collector.GetNumItems() > 0 && out.volume_bundle &&
+                m_volume_collector.IndicesChanged(out.volume_bundle.get());
+
             // Check if we have valid camera
             auto camera = scene->GetCamera();
 
@@ -362,7 +220,10 @@ namespace Baikal
             // Update camera if needed
             if (dirty & Scene1::kCamera || camera_changed)
             {
-                UpdateCamera(*scene, m_material_collector, m_texture_collector, m_volume_collector, out);
+                RunCompileStep(SceneCompileStats::kCamera, out, [&]()
+                {
+                    UpdateCamera(*scene, m_material_collector, m_texture_collector, m_volume_collector, out);
+                });
                 DropCameraDirty(*scene);
             }
 
@@ -371,7 +232,10 @@ namespace Baikal
             // We update materials before lights and shapes since they depends on it.
             if (should_update_materials)
             {
-                UpdateMaterials(*scene, m_material_collector, m_texture_collector, out);
+                RunCompileStep(SceneCompileStats::kMaterials, out, [&]()
+                {
+                    UpdateMaterials(*scene, m_material_collector, m_texture_collector, out);
+                });
             }
 
             {
@@ -387,10 +251,8 @@ namespace Baikal
                 // Check if light parameters have been changed
                 bool lights_changed = false;
 
-                for (; light_iter->IsValid(); light_iter->Next())
+                for (auto const& light : scene->GetLights())
                 {
-                    auto light = light_iter->ItemAs<Light>();
-
                     if (light->IsDirty())
                     {
                         lights_changed = true;
@@ -403,7 +265,10 @@ namespace Baikal
                 if (dirty & Scene1::kLights || lights_changed ||
                     should_update_textures || should_update_materials)
                 {
-                    UpdateLights(*scene, m_material_collector, m_texture_collector, out);
+                    RunCompileStep(SceneCompileStats::kLights, out, [&]()
+                    {
+                        UpdateLights(*scene, m_material_collector, m_texture_collector, out);
+                    });
                     light_iter->Reset();
                     DropDirty(*light_iter);
                 }
@@ -418,53 +283,104 @@ namespace Baikal
                     throw std::runtime_error("No shapes in the scene");
                 }
 
-                // Check if shape parameters have been changed
+                // Check if shape parameters, transforms or vertices have been changed
                 bool shapes_changed = false;
+                bool transforms_changed = false;
+                bool vertices_changed = false;
 
-                for (; shape_iter->IsValid(); shape_iter->Next())
+                for (auto const& shape : scene->GetShapes())
                 {
-                    auto shape = shape_iter->ItemAs<Shape>();
-
-                    if (shape->IsDirty())
+                    if (shapes_changed && transforms_changed && vertices_changed)
                     {
-                        shapes_changed = true;
                         break;
                     }
+
+                    shapes_changed = shapes_changed || shape->IsDirty();
+                    transforms_changed = transforms_changed || shape->IsTransformDirty();
+                    vertices_changed = vertices_changed || IsVerticesDirty(*shape);
                 }
 
                 // Update shapes if needed
                 if (dirty & Scene1::kShapes)
                 {
-                    UpdateShapes(*scene, m_material_collector, m_texture_collector, m_volume_collector, out);
+                    RunCompileStep(SceneCompileStats::kShapes, out, [&]()
+                    {
+                        UpdateShapes(*scene, m_material_collector, m_texture_collector, m_volume_collector, out);
+                    });
                     shape_iter->Reset();
                     DropDirty(*shape_iter);
+                    shape_iter->Reset();
+                    DropTransformDirty(*shape_iter);
+                }
+                else
+                {
+                    if (shapes_changed || volume_indices_changed)
+                    {
+                        RunCompileStep(SceneCompileStats::kShapeProperties, out, [&]()
+                        {
+                            UpdateShapeProperties(*scene, m_material_collector, m_texture_collector, m_volume_collector, out);
+                        });
+                        shape_iter->Reset();
+                        DropDirty(*shape_iter);
+                    }
+
+                    // Moving shapes only touches transforms in shape descriptors and the intersector
+                    if (dirty & Scene1::kShapeTransforms || transforms_changed)
+                    {
+                        RunCompileStep(SceneCompileStats::kShapeTransforms, out, [&]()
+                        {
+                            UpdateShapeTransforms(*scene, out);
+                        });
+                        shape_iter->Reset();
+                        DropTransformDirty(*shape_iter);
+                    }
                 }
-                else if (shapes_changed)
+
+                // Deformed meshes keep their topology, only positions are uploaded and their BVHs rebuilt.
+                // Runs after shape updates, which might have shared geometry uploaded before the deformation
+                if (vertices_changed)
                 {
-                    UpdateShapeProperties(*scene, m_material_collector, m_texture_collector, m_volume_collector, out);
+                    RunCompileStep(SceneCompileStats::kShapeVertices, out, [&]()
+                    {
+                        UpdateShapeVertices(*scene, out);
+                    });
+                    shape_iter->Reset();
+                    DropVerticesDirty(*shape_iter);
                 }
             }
 
             // If textures need an update, do it.
             if (should_update_textures)
             {
-                UpdateTextures(*scene, m_material_collector, m_texture_collector, out);
+                RunCompileStep(SceneCompileStats::kTextures, out, [&]()
+                {
+                    UpdateTextures(*scene, m_material_collector, m_texture_collector, out);
+                });
             }
 
             // If volumes need an update, do it.
             if (should_update_volumes)
             {
-                UpdateVolumes(*scene, m_volume_collector, m_texture_collector, out);
+                RunCompileStep(SceneCompileStats::kVolumes, out, [&]()
+                {
+                    UpdateVolumes(*scene, m_volume_collector, m_texture_collector, out);
+                });
             }
 
             if (should_update_leafs_data)
             {
-                UpdateLeafsData(*scene, m_input_map_leafs_collector, m_texture_collector, out);
+                RunCompileStep(SceneCompileStats::kInputMapLeafs, out, [&]()
+                {
+                    UpdateLeafsData(*scene, m_input_maps_collector, m_input_map_leafs_collector, m_texture_collector, out);
+                });
             }
 
             if (should_update_input_maps)
             {
-                UpdateInputMaps(*scene, m_input_maps_collector, m_input_map_leafs_collector, out);
+                RunCompileStep(SceneCompileStats::kInputMaps, out, [&]()
+                {
+                    UpdateInputMaps(*scene, m_input_maps_collector, m_input_map_leafs_collector, out);
+                });
             }
 
             // Set current scene
@@ -472,43 +388,36 @@ namespace Baikal
             {
                 m_current_scene = scene;
 
-                UpdateCurrentScene(*scene, out);
+                RunCompileStep(SceneCompileStats::kCurrentScene, out, [&]()
+                {
+                    UpdateCurrentScene(*scene, out);
+                });
             }
 
-            // If background image need an update, do it.
-            if ((scene->GetDirtyFlags() & Scene1::kBackground) == Scene1::kBackground)
+            // If background image need an update, do it. Background refers to its texture by index as well
+            if ((scene->GetDirtyFlags() & Scene1::kBackground) == Scene1::kBackground || texture_indices_changed)
             {
-                UpdateSceneAttributes(*scene, m_texture_collector, out);
+                RunCompileStep(SceneCompileStats::kSceneAttributes, out, [&]()
+                {
+                    UpdateSceneAttributes(*scene, m_texture_collector, out);
+                });
             }
 
             // Make sure to clear dirty flags
             scene->ClearDirtyFlags();
 
-            // Clear material dirty flags
-            m_material_collector.Finalize([](SceneObject::Ptr item)
-            {
-                auto material = std::static_pointer_cast<Material>(item);
-                material->SetDirty(false);
-            });
+            // Clear material, texture, volume and input map dirty flags
+            DropCollectedDirty();
 
-            m_texture_collector.Finalize([](SceneObject::Ptr item)
-            {
-                auto tex = std::static_pointer_cast<Texture>(item);
-                tex->SetDirty(false);
-            });
+            FinishCompileStats(*scene, compile_start, out);
 
-            m_volume_collector.Finalize([](SceneObject::Ptr item)
-            {
-                auto volume = std::static_pointer_cast<VolumeMaterial>(item);
-                volume->SetDirty(false);
-            });
+            m_journal_position = change_count;
+            m_journal_valid = true;
 
-            // It will mark entire hierarchy as not dirty
-            m_input_maps_collector.Finalize([](SceneObject::Ptr item)
-            {
-                auto input_map = std::static_pointer_cast<InputMap>(item);
-                input_map->SetDirty(false);
-            });
+            // Scene might have grown
+            TouchScene(scene);
+            EnforceMemoryBudget(scene);
+            ReleaseHostData(out);
 
             // Return the scene
             return out;
@@ -521,29 +430,811 @@ namespace Baikal
         Scene1 const& scene, Collector& m_material_collector, Collector& m_texture_collector, Collector& vol_collector,
         Collector& input_maps_collector, Collector& input_map_leafs_collector, CompiledScene& out) const
     {
-        UpdateCamera(scene, m_material_collector, m_texture_collector, m_volume_collector, out);
-        DropCameraDirty(scene);
+        out.compile_stats.Reset(true);
+
+        RunCompileStep(SceneCompileStats::kCamera, out, [&]()
+        {
+            UpdateCamera(scene, m_material_collector, m_texture_collector, m_volume_collector, out);
+        });
+
+        // Background compiles leave dirty flags to TrySwapScene on the rendering thread
+        if (!IsCompilingInBackground())
+        {
+            DropCameraDirty(scene);
+        }
 
         //Lights and Shapes depends on Materials
-        UpdateMaterials(scene, m_material_collector, m_texture_collector, out);
+        RunCompileStep(SceneCompileStats::kMaterials, out, [&]()
+        {
+            UpdateMaterials(scene, m_material_collector, m_texture_collector, out);
+        });
 
-        UpdateLights(scene, m_material_collector, m_texture_collector, out);
+        RunCompileStep(SceneCompileStats::kLights, out, [&]()
+        {
+            UpdateLights(scene, m_material_collector, m_texture_collector, out);
+        });
         auto light_iterator = scene.CreateLightIterator();
-        DropDirty(*light_iterator);
+        if (!IsCompilingInBackground())
+        {
+            DropDirty(*light_iterator);
+        }
+
+        RunCompileStep(SceneCompileStats::kShapes, out, [&]()
+        {
+            UpdateShapes(scene, m_material_collector, m_texture_collector, vol_collector, out);
+        });
+        auto shape_iterator = scene.CreateShapeIterator();
+        if (!IsCompilingInBackground())
+        {
+            DropDirty(*shape_iterator);
+            shape_iterator->Reset();
+            DropTransformDirty(*shape_iterator);
+        }
+
+        // Geometry shared with other scenes might predate the deformation
+        bool vertices_changed = false;
+        for (shape_iterator->Reset(); shape_iterator->IsValid() && !vertices_changed; shape_iterator->Next())
+        {
+            vertices_changed = IsVerticesDirty(*shape_iterator->ItemAs<Shape>());
+        }
+
+        if (vertices_changed)
+        {
+            RunCompileStep(SceneCompileStats::kShapeVertices, out, [&]()
+            {
+                UpdateShapeVertices(scene, out);
+            });
+            if (!IsCompilingInBackground())
+            {
+                shape_iterator->Reset();
+                DropVerticesDirty(*shape_iterator);
+            }
+        }
+
+        RunCompileStep(SceneCompileStats::kTextures, out, [&]()
+        {
+            UpdateTextures(scene, m_material_collector, m_texture_collector, out);
+        });
+
+        RunCompileStep(SceneCompileStats::kInputMapLeafs, out, [&]()
+        {
+            UpdateLeafsData(scene, m_input_maps_collector, m_input_map_leafs_collector, m_texture_collector, out);
+        });
+
+        RunCompileStep(SceneCompileStats::kInputMaps, out, [&]()
+        {
+            UpdateInputMaps(scene, m_input_maps_collector, m_input_map_leafs_collector, out);
+        });
+
+        RunCompileStep(SceneCompileStats::kVolumes, out, [&]()
+        {
+            UpdateVolumes(scene, vol_collector, m_texture_collector, out);
+        });
+
+        RunCompileStep(SceneCompileStats::kSceneAttributes, out, [&]()
+        {
+            UpdateSceneAttributes(scene, m_texture_collector, out);
+        });
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::CollectObjects(Scene1 const& scene) const
+    {
+        CollectObjects(scene, m_material_collector, m_texture_collector, m_volume_collector,
+                       m_input_maps_collector, m_input_map_leafs_collector);
+    }
+
+    template <typename CompiledScene>
+    inline
+    std::vector<Texture::Ptr> SceneController<CompiledScene>::CollectTextures(Scene1 const& scene) const
+    {
+        // Separate collectors, so changes tracked by the controller ones are left for the next compile
+        Collector mat_collector;
+        Collector tex_collector;
+        Collector vol_collector;
+        Collector input_maps_collector;
+        Collector input_map_leafs_collector;
+
+        CollectObjects(scene, mat_collector, tex_collector, vol_collector, input_maps_collector, input_map_leafs_collector);
+
+        std::vector<Texture::Ptr> textures;
+        std::unique_ptr<Iterator> tex_iter(tex_collector.CreateIterator());
+
+        for (; tex_iter->IsValid(); tex_iter->Next())
+        {
+            textures.push_back(tex_iter->ItemAs<Texture>());
+        }
+
+        return textures;
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::CollectObjects(Scene1 const& scene, Collector& mat_collector, Collector& tex_collector,
+                                                        Collector& vol_collector, Collector& input_maps_collector,
+                                                        Collector& input_map_leafs_collector) const
+    {
+        // Start new collection pass, items collected before keep their indices
+        mat_collector.BeginCollect();
+        tex_collector.BeginCollect();
+        vol_collector.BeginCollect();
+        input_maps_collector.BeginCollect();
+        input_map_leafs_collector.BeginCollect();
+
+        // Create shape and light iterators
+        auto shape_iter = scene.CreateShapeIterator();
+        auto light_iter = scene.CreateLightIterator();
+
+        auto default_material = GetDefaultMaterial();
+        // Collect materials from shapes first
+        mat_collector.Collect(*shape_iter,
+                              // This function adds all materials to resulting map
+                              // recursively via Material dependency API
+                              [default_material](SceneObject::Ptr item) ->
+                              std::set<SceneObject::Ptr>
+                              {
+                                  // Resulting material set
+                                  std::set<SceneObject::Ptr> mats;
+                                  // Material stack
+                                  std::stack<Material::Ptr> material_stack;
+
+                                  // Get material from current shape
+                                  auto shape = std::static_pointer_cast<Shape>(item);
+                                  auto material = shape->GetMaterial();
+
+                                  // If shape does not have a material, use default one
+                                  if (!material)
+                                  {
+                                      material = default_material;
+                                  }
+
+                                  // Push to stack as an initializer
+                                  material_stack.push(material);
+
+                                  // Drain the stack
+                                  while (!material_stack.empty())
+                                  {
+                                      // Get current material
+                                      auto m = material_stack.top();
+                                      material_stack.pop();
+
+                                      // Emplace into the set
+                                      mats.emplace(m);
+
+                                      // Create dependency iterator
+                                      auto mat_iter = m->CreateMaterialIterator();
+
+                                      // Push all dependencies into the stack
+                                      for (; mat_iter->IsValid(); mat_iter->Next())
+                                      {
+                                          material_stack.push(
+                                            mat_iter->ItemAs<Material>()
+                                          );
+                                      }
+                                  }
+
+                                  // Return resulting set
+                                  return mats;
+                              });
+
+        // Commit stuff (we can iterate over it after commit has happened)
+        mat_collector.Commit();
+
+        // set iterator position at begin
+        shape_iter->Reset();
+        // Collect volume materials from shapes first
+        vol_collector.Collect(*shape_iter,
+                                    [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
+                                    {
+                                        // Resulting material set
+                                        std::set<SceneObject::Ptr> vol_mats;
+
+                                        // Get volume material from current shape
+                                        auto shape = std::static_pointer_cast<Shape>(item);
+                                        auto volume_material = shape->GetVolumeMaterial();
+
+                                        if (volume_material)
+                                            vol_mats.emplace(volume_material);
+
+                                        return vol_mats;
+                                    });
+
+        // Commit stuff
+        vol_collector.Commit();
+
+        // Now we need to collect textures from our materials
+        // Create material iterator
+        auto mat_iter = mat_collector.CreateIterator();
+
+        // Collect textures from materials
+        tex_collector.Collect(*mat_iter,
+                                    [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
+                              {
+                                  // Texture set
+                                  std::set<SceneObject::Ptr> textures;
+
+                                  auto material = std::static_pointer_cast<Material>(item);
+
+                                  // Create texture dependency iterator
+                                  auto tex_iter = material->CreateTextureIterator();
+
+                                  // Emplace all dependent textures
+                                  for (; tex_iter->IsValid(); tex_iter->Next())
+                                  {
+                                      EmplaceTexture(textures, tex_iter->ItemAs<Texture>());
+                                  }
+
+                                  // Return resulting set
+                                  return textures;
+                              });
+
+        // Now we need to collect textures from volumes
+        // Create volume iterator
+        auto vol_iter = vol_collector.CreateIterator();
+
+        // Collect textures from materials
+        tex_collector.Collect(*vol_iter,
+            [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
+        {
+            // Texture set
+            std::set<SceneObject::Ptr> textures;
+
+            auto volume = std::static_pointer_cast<VolumeMaterial>(item);
+
+            // Create texture dependency iterator
+            auto tex_iter = volume->CreateTextureIterator();
+
+            // Emplace all dependent textures
+            for (; tex_iter->IsValid(); tex_iter->Next())
+            {
+                EmplaceTexture(textures, tex_iter->ItemAs<Texture>());
+            }
+
+            // Return resulting set
+            return textures;
+        });
+
+        // Collect textures from lights
+        tex_collector.Collect(*light_iter,
+                                    [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
+                              {
+                                  // Resulting set
+                                  std::set<SceneObject::Ptr> textures;
+
+                                  auto light = std::static_pointer_cast<Light>(item);
+
+                                  // Create texture dependency iterator
+                                  auto tex_iter = light->CreateTextureIterator();
+
+                                  // Emplace all dependent textures
+                                  for (; tex_iter->IsValid(); tex_iter->Next())
+                                  {
+                                      EmplaceTexture(textures, tex_iter->ItemAs<Texture>());
+                                  }
+
+                                  // Return resulting set
+                                  return textures;
+                              });
+
+        mat_iter->Reset();
+        input_maps_collector.Collect(*mat_iter,
+                                [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
+                                {
+                                    // Texture set
+                                    std::set<SceneObject::Ptr> input_maps;
+
+                                    auto material = std::static_pointer_cast<Material>(item);
+
+                                    // Create texture dependency iterator
+                                    auto input_map_iter = material->CreateInputMapsIterator();
+
+                                    // Emplace all dependent textures
+                                    for (; input_map_iter->IsValid(); input_map_iter->Next())
+                                    {
+                                        input_maps.emplace(input_map_iter->ItemAs<InputMap>());
+                                    }
+
+                                    // Return resulting set
+                                    return input_maps;
+                                });
+        input_maps_collector.Commit();
+
+        mat_iter->Reset();
+        input_map_leafs_collector.Collect(*mat_iter,
+                                [](SceneObject::Ptr item) -> std::set<SceneObject::Ptr>
+                                {
+                                    // Texture set
+                                    std::set<SceneObject::Ptr> input_maps;
+
+                                    auto material = std::static_pointer_cast<Material>(item);
+
+                                    // Create texture dependency iterator
+                                    auto input_map_iter = material->CreateInputMapLeafsIterator();
+
+                                    // Emplace all dependent textures
+                                    for (; input_map_iter->IsValid(); input_map_iter->Next())
+                                    {
+                                        input_maps.emplace(input_map_iter->ItemAs<InputMap>());
+                                    }
+
+                                    // Return resulting set
+                                    return input_maps;
+                                });
+        input_map_leafs_collector.Commit();
+
+
+        // Add background texture from scene into texture collector
+        auto background_texture = scene.GetBackgroundImage();
+        if (background_texture)
+        {
+            std::set<SceneObject::Ptr> textures;
+            EmplaceTexture(textures, background_texture);
+
+            for (auto const& texture : textures)
+            {
+                tex_collector.Collect(texture);
+            }
+        }
+
+        // Commit textures
+        tex_collector.Commit();
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::DropCollectedDirty() const
+    {
+        m_material_collector.Finalize([](SceneObject::Ptr item)
+        {
+            auto material = std::static_pointer_cast<Material>(item);
+            material->SetDirty(false);
+        });
+
+        m_texture_collector.Finalize([](SceneObject::Ptr item)
+        {
+            auto tex = std::static_pointer_cast<Texture>(item);
+            tex->SetDirty(false);
+        });
+
+        m_volume_collector.Finalize([](SceneObject::Ptr item)
+        {
+            auto volume = std::static_pointer_cast<VolumeMaterial>(item);
+            volume->SetDirty(false);
+        });
+
+        // It will mark entire hierarchy as not dirty
+        m_input_maps_collector.Finalize([](SceneObject::Ptr item)
+        {
+            auto input_map = std::static_pointer_cast<InputMap>(item);
+            input_map->SetDirty(false);
+        });
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::CompileSceneAsync(Scene1::Ptr scene) const
+    {
+        std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
 
-        UpdateShapes(scene, m_material_collector, m_texture_collector, vol_collector, out);
-        auto shape_iterator = scene.CreateShapeIterator();
-        DropDirty(*shape_iterator);
+        if (m_pending_scenes.find(scene) != m_pending_scenes.cend())
+        {
+            throw std::runtime_error("SceneController::CompileSceneAsync(...): scene is already being compiled");
+        }
+
+        auto& pending = m_pending_scenes[scene];
+        pending.scene.reset(new CompiledScene());
+        pending.change_count = SceneObject::GetChangeCount();
+        pending.dirty_flags = scene->GetDirtyFlags();
+
+        auto shadow = pending.scene.get();
+        pending.result = std::async(std::launch::async, [this, scene, shadow]()
+        {
+            BAIKAL_TRACE_SCOPE("scene", "CompileSceneAsync");
+
+            std::lock_guard<std::mutex> lock(m_compile_mutex);
+
+            m_background_thread = std::this_thread::get_id();
+            // Collectors are left with the objects of the scene compiled here
+            m_journal_valid = false;
+
+            // Scene objects are only read here, their dirty flags are dropped by TrySwapScene
+            std::vector<SceneObject::Ptr> compiled_objects;
+
+            try
+            {
+                auto compile_start = std::chrono::high_resolution_clock::now();
+
+                CollectObjects(*scene);
+
+                RecompileFull(*scene, m_material_collector, m_texture_collector, m_volume_collector,
+                              m_input_maps_collector, m_input_map_leafs_collector, *shadow);
+
+                auto collect = [&compiled_objects](SceneObject::Ptr item) { compiled_objects.push_back(item); };
+                m_material_collector.Finalize(collect);
+                m_texture_collector.Finalize(collect);
+                m_volume_collector.Finalize(collect);
+                m_input_maps_collector.Finalize(collect);
+
+                FinishCompileStats(*scene, compile_start, *shadow);
+            }
+            catch (...)
+            {
+                m_background_thread = std::thread::id();
+                throw;
+            }
+
+            m_background_thread = std::thread::id();
+
+            return compiled_objects;
+        });
+    }
+
+    template <typename CompiledScene>
+    inline
+    bool SceneController<CompiledScene>::IsCompilePending(Scene1::Ptr scene) const
+    {
+        std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+
+        return m_pending_scenes.find(scene) != m_pending_scenes.cend();
+    }
+
+    template <typename CompiledScene>
+    inline
+    bool SceneController<CompiledScene>::TrySwapScene(Scene1::Ptr scene) const
+    {
+        PendingScene pending;
+
+        {
+            std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+
+            auto iter = m_pending_scenes.find(scene);
+
+            if (iter == m_pending_scenes.cend() ||
+                iter->second.result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                return false;
+            }
+
+            pending = std::move(iter->second);
+            m_pending_scenes.erase(iter);
+        }
+
+        std::lock_guard<std::mutex> lock(m_compile_mutex);
+
+        std::vector<SceneObject::Ptr> compiled_objects;
+
+        try
+        {
+            // Rethrows compile errors
+            compiled_objects = pending.result.get();
+        }
+        catch (...)
+        {
+            ReleaseCompiledScene(*pending.scene);
+            throw;
+        }
+
+        // Objects changed since the compile started might have been read half way, keep them dirty
+        if (SceneObject::GetChangeCount() == pending.change_count && scene->GetDirtyFlags() == pending.dirty_flags)
+        {
+            scene->ClearDirtyFlags();
+            DropSceneObjectsDirty(*scene);
+
+            for (auto& object : compiled_objects)
+            {
+                object->SetDirty(false);
+            }
+        }
+
+        auto cached = m_scene_cache.find(scene);
+
+        if (cached != m_scene_cache.cend())
+        {
+            ReleaseCompiledScene(cached->second);
+            cached->second = std::move(*pending.scene);
+        }
+        else
+        {
+            cached = m_scene_cache.emplace(std::make_pair(scene, std::move(*pending.scene))).first;
+        }
+
+        // Shadow version has not been made current on the worker
+        m_current_scene = scene;
+        m_journal_valid = false;
+        UpdateCurrentScene(*scene, cached->second);
+
+        TouchScene(scene);
+        EnforceMemoryBudget(scene);
+
+        return true;
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::EvictScene(Scene1::Ptr scene) const
+    {
+        if (IsCompilePending(scene))
+        {
+            throw std::runtime_error("SceneController::EvictScene(...): scene is being compiled");
+        }
+
+        std::lock_guard<std::mutex> lock(m_compile_mutex);
+
+        EraseCachedScene(scene);
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::EvictAllScenes() const
+    {
+        {
+            std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+
+            if (!m_pending_scenes.empty())
+            {
+                throw std::runtime_error("SceneController::EvictAllScenes(...): scene is being compiled");
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_compile_mutex);
+
+        while (!m_scene_cache.empty())
+        {
+            auto scene = m_scene_cache.begin()->first;
+            EraseCachedScene(scene);
+        }
+    }
+
+    template <typename CompiledScene>
+    inline
+    std::size_t SceneController<CompiledScene>::GetCachedSceneMemory() const
+    {
+        // Shared buffers are the same for all the scenes, so they are counted once
+        std::size_t bytes = 0;
+        std::size_t shared_bytes = 0;
+
+        for (auto const& cached : m_scene_cache)
+        {
+            auto const& stats = cached.second.compile_stats;
+            bytes += stats.total_bytes - stats.shared_bytes;
+            shared_bytes = std::max(shared_bytes, stats.shared_bytes);
+        }
+
+        return bytes + shared_bytes;
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::TouchScene(Scene1::Ptr const& scene) const
+    {
+        m_scene_last_use[scene] = ++m_use_clock;
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::EnforceMemoryBudget(Scene1::Ptr const& keep) const
+    {
+        if (m_memory_budget == 0)
+        {
+            return;
+        }
+
+        while (GetCachedSceneMemory() > m_memory_budget)
+        {
+            auto victim = m_scene_cache.end();
+            auto oldest = m_use_clock + 1;
+
+            for (auto iter = m_scene_cache.begin(); iter != m_scene_cache.end(); ++iter)
+            {
+                if (iter->first == keep || IsCompilePending(iter->first))
+                {
+                    continue;
+                }
+
+                auto last_use = m_scene_last_use[iter->first];
+
+                if (last_use < oldest)
+                {
+                    oldest = last_use;
+                    victim = iter;
+                }
+            }
+
+            // Only the kept scenes are left, they have to stay over the budget
+            if (victim == m_scene_cache.end())
+            {
+                break;
+            }
+
+            EraseCachedScene(victim->first);
+        }
+    }
+
+    template <typename CompiledScene>
+    template <typename Func>
+    inline
+    void SceneController<CompiledScene>::ForEachCachedScene(Func&& func) const
+    {
+        for (auto& cached : m_scene_cache)
+        {
+            func(cached.second);
+        }
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::EraseCachedScene(Scene1::Ptr const& scene) const
+    {
+        auto iter = m_scene_cache.find(scene);
+
+        if (iter == m_scene_cache.end())
+        {
+            return;
+        }
+
+        // Hold the key, erasing the entry might drop the last reference to it
+        auto evicted = iter->first;
+
+        ReleaseCompiledScene(iter->second);
+        m_scene_cache.erase(iter);
+        m_scene_last_use.erase(evicted);
+
+        // Next compile of any scene has to make it current again
+        if (m_current_scene == evicted)
+        {
+            m_current_scene = nullptr;
+        }
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::WaitForPendingCompiles() const
+    {
+        // Workers only take m_compile_mutex, so they finish while this is held
+        std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+
+        for (auto& pending : m_pending_scenes)
+        {
+            if (pending.second.result.valid())
+            {
+                pending.second.result.wait();
+            }
+        }
+    }
+
+    template <typename CompiledScene>
+    template <typename Func>
+    inline
+    void SceneController<CompiledScene>::RunCompileStep(SceneCompileStats::Step step, CompiledScene& out, Func&& func) const
+    {
+        // Camera and transforms updates do not read geometry or texels
+        if (step != SceneCompileStats::kCamera && step != SceneCompileStats::kShapeTransforms)
+        {
+            RestoreHostData();
+        }
+
+        BAIKAL_TRACE_SCOPE("scene", SceneCompileStats::GetStepName(step));
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        func();
+
+        // Some steps might run more than once per compile
+        out.compile_stats.step_milliseconds[step] +=
+            std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        ++out.compile_stats.step_runs[step];
+    }
+
+    template <typename CompiledScene>
+    inline
+    std::size_t SceneController<CompiledScene>::SelectInstanceLods(Scene1 const& scene) const
+    {
+        auto camera = scene.GetCamera();
+
+        if (!camera)
+        {
+            return 0;
+        }
+
+        // Image height in world units at unit distance, or at any distance for orthographic cameras
+        auto sensor_size = camera->GetSensorSize();
+        auto perspective = std::dynamic_pointer_cast<PerspectiveCamera>(camera);
+        auto orthographic = std::dynamic_pointer_cast<OrthographicCamera>(camera);
+        auto view_height = perspective ? sensor_size.y / perspective->GetFocalLength() :
+            (orthographic ? sensor_size.y : 2.f);
+
+        auto position = camera->GetPosition();
+        std::size_t num_switches = 0;
+
+        for (auto const& shape : scene.GetShapes())
+        {
+            auto instance = dynamic_cast<Instance*>(shape.get());
+
+            if (!instance || instance->GetLodLevels().empty())
+            {
+                continue;
+            }
+
+            // Projected diameter of the bounding sphere, levels share their bounds closely enough
+            auto aabb = instance->GetWorldAABB();
+            auto center = 0.5f * (aabb.pmin + aabb.pmax);
+            auto diameter = std::sqrt(RadeonRays::dot(aabb.pmax - aabb.pmin, aabb.pmax - aabb.pmin));
+            auto distance = std::sqrt(RadeonRays::dot(center - position, center - position));
+            auto size = orthographic ? diameter / view_height : diameter / (std::max(distance, 1e-6f) * view_height);
+
+            // Finer levels have to be exceeded and the current or coarser ones fallen short of by the margin
+            auto const& levels = instance->GetLodLevels();
+            auto current = instance->GetCurrentLod();
+            auto level = levels.size() - 1;
+
+            for (std::size_t i = 0; i + 1 < levels.size(); ++i)
+            {
+                auto margin = i < current ? 1.f + m_lod_hysteresis : 1.f - m_lod_hysteresis;
+                if (size >= levels[i].min_screen_size * margin)
+                {
+                    level = i;
+                    break;
+                }
+            }
+
+            if (level != current)
+            {
+                instance->SetCurrentLod(level);
+                ++num_switches;
+            }
+        }
+
+        return num_switches;
+    }
+
+    template <typename CompiledScene>
+    inline
+    bool SceneController<CompiledScene>::TryReuseCurrentScene(Scene1 const& scene, std::uint64_t change_count,
+                                                              std::chrono::high_resolution_clock::time_point start) const
+    {
+        // Scene flags cover attached and detached objects, the journal changes of the objects themselves
+        if (!m_journal_valid || change_count != m_journal_position || scene.GetDirtyFlags() != 0)
+        {
+            return false;
+        }
+
+        auto iter = m_scene_cache.find(m_current_scene);
+
+        if (iter == m_scene_cache.cend())
+        {
+            return false;
+        }
+
+        auto& stats = iter->second.compile_stats;
+        stats.step_milliseconds = {};
+        stats.step_runs = {};
+        stats.full_recompile = false;
+        stats.unchanged = true;
+        stats.num_lod_switches = 0;
+        stats.total_milliseconds =
+            std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-        UpdateTextures(scene, m_material_collector, m_texture_collector, out);
+        TouchScene(m_current_scene);
 
-        UpdateLeafsData(scene, m_input_map_leafs_collector, m_texture_collector, out);
+        return true;
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::FinishCompileStats(Scene1 const& scene, std::chrono::high_resolution_clock::time_point start, CompiledScene& out) const
+    {
+        auto& stats = out.compile_stats;
 
-        UpdateInputMaps(scene, m_input_maps_collector, m_input_map_leafs_collector, out);
+        stats.num_materials = m_material_collector.GetNumItems();
+        stats.num_textures = m_texture_collector.GetNumItems();
+        stats.num_volumes = m_volume_collector.GetNumItems();
+        stats.num_input_maps = m_input_maps_collector.GetNumItems();
 
-        UpdateVolumes(scene, vol_collector, m_texture_collector, out);
+        UpdateCompileStats(scene, out);
 
-        UpdateSceneAttributes(scene, m_texture_collector, out);
+        stats.total_milliseconds =
+            std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
     }
 
     template <typename CompiledScene>
@@ -558,6 +1249,23 @@ namespace Baikal
         camera->SetDirty(false);
     }
 
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::DropSceneObjectsDirty(Scene1 const& scene) const
+    {
+        DropCameraDirty(scene);
+
+        auto light_iterator = scene.CreateLightIterator();
+        DropDirty(*light_iterator);
+
+        auto shape_iterator = scene.CreateShapeIterator();
+        DropDirty(*shape_iterator);
+        shape_iterator->Reset();
+        DropTransformDirty(*shape_iterator);
+        shape_iterator->Reset();
+        DropVerticesDirty(*shape_iterator);
+    }
+
     template <typename CompiledScene>
     inline
     void SceneController<CompiledScene>::DropDirty(Iterator& iterator) const
@@ -565,4 +1273,47 @@ namespace Baikal
         for (; iterator.IsValid(); iterator.Next())
             iterator.ItemAs<SceneObject>()->SetDirty(false);
     }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::DropTransformDirty(Iterator& shape_iterator) const
+    {
+        for (; shape_iterator.IsValid(); shape_iterator.Next())
+            shape_iterator.ItemAs<Shape>()->SetTransformDirty(false);
+    }
+
+    template <typename CompiledScene>
+    inline
+    void SceneController<CompiledScene>::DropVerticesDirty(Iterator& shape_iterator) const
+    {
+        for (; shape_iterator.IsValid(); shape_iterator.Next())
+        {
+            auto shape = shape_iterator.ItemAs<Shape>();
+
+            if (auto instance = std::dynamic_pointer_cast<Instance>(shape))
+            {
+                shape = instance->GetBaseShape();
+            }
+
+            if (auto mesh = std::dynamic_pointer_cast<Mesh>(shape))
+            {
+                mesh->SetVerticesDirty(false);
+            }
+        }
+    }
+
+    template <typename CompiledScene>
+    inline
+    bool SceneController<CompiledScene>::IsVerticesDirty(Shape const& shape)
+    {
+        auto base = &shape;
+
+        if (auto instance = dynamic_cast<Instance const*>(base))
+        {
+            base = instance->GetBaseShape().get();
+        }
+
+        auto mesh = dynamic_cast<Mesh const*>(base);
+        return mesh && mesh->IsVerticesDirty();
+    }
 }
@@ -0,0 +1,503 @@
+/**********************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#include "ao_estimator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+#include "Utils/blue_noise.h"
+#include "Utils/trace.h"
+
+#ifndef BAIKAL_NO_SOBOL_LUT
+#include "Utils/sobol.h"
+#endif
+
+#ifdef BAIKAL_EMBED_KERNELS
+#include "embed_kernels.h"
+#endif
+
+namespace Baikal
+{
+    namespace
+    {
+        // Default occlusion distance relative to the scene diagonal
+        float const kDefaultRelativeRadius = 0.1f;
+    }
+
+    struct AoEstimator::RenderData
+    {
+        // OpenCL stuff
+        CLWBuffer<ray> rays;
+        CLWBuffer<Intersection> intersections;
+        CLWBuffer<int> output_indices;
+        CLWBuffer<int> iota;
+        CLWBuffer<int> hitcount;
+        CLWBuffer<std::uint32_t> random;
+        CLWBuffer<std::uint32_t> sobolmat;
+        // Created on first request
+        CLWBuffer<std::uint32_t> blue_noise;
+
+        // Occlusion rays of all hits, num_ao_rays per hit
+        CLWBuffer<ray> ao_rays;
+        CLWBuffer<int> ao_hits;
+        CLWBuffer<int> ao_count;
+
+        // RadeonRays stuff
+        Buffer* fr_rays;
+        Buffer* fr_intersections;
+        Buffer* fr_hitcount;
+        Buffer* fr_ao_rays;
+        Buffer* fr_ao_hits;
+        Buffer* fr_ao_count;
+
+        RenderData()
+            : fr_rays(nullptr)
+            , fr_intersections(nullptr)
+            , fr_hitcount(nullptr)
+            , fr_ao_rays(nullptr)
+            , fr_ao_hits(nullptr)
+            , fr_ao_count(nullptr)
+        {
+        }
+    };
+
+    AoEstimator::AoEstimator(
+        CLWContext context,
+        std::shared_ptr<RadeonRays::IntersectionApi> api,
+        const CLProgramManager *program_manager
+    ) :
+        Estimator(api)
+#ifdef BAIKAL_EMBED_KERNELS
+        , ClwClass(context, program_manager, "ao_estimator", g_ao_estimator_opencl, g_ao_estimator_opencl_headers, "")
+#else
+        , ClwClass(context, program_manager, "../Baikal/Kernels/CL/ao_estimator.cl", "")
+#endif
+        , m_render_data(new RenderData)
+        , m_sample_counter(0)
+        , m_random_seed(0u)
+        , m_num_ao_rays(4u)
+        , m_radius(0.f)
+        , m_background(1.f)
+    {
+#ifndef BAIKAL_NO_SOBOL_LUT
+        m_render_data->sobolmat = context.CreateBuffer<unsigned int>(1024 * 52, CL_MEM_READ_ONLY, &g_SobolMatrices[0]);
+#else
+        // Kernels still take the argument, bind a placeholder
+        m_render_data->sobolmat = context.CreateBuffer<unsigned int>(1, CL_MEM_READ_ONLY);
+#endif
+        m_render_data->ao_count = context.CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+        m_render_data->fr_ao_count = CreateFromOpenClBuffer(GetIntersector().get(), m_render_data->ao_count);
+    }
+
+    AoEstimator::~AoEstimator()
+    {
+        GetIntersector()->DeleteBuffer(m_render_data->fr_rays);
+        GetIntersector()->DeleteBuffer(m_render_data->fr_intersections);
+        GetIntersector()->DeleteBuffer(m_render_data->fr_hitcount);
+        GetIntersector()->DeleteBuffer(m_render_data->fr_ao_rays);
+        GetIntersector()->DeleteBuffer(m_render_data->fr_ao_hits);
+        GetIntersector()->DeleteBuffer(m_render_data->fr_ao_count);
+    }
+
+    void AoEstimator::SetWorkBufferSize(std::size_t size)
+    {
+        m_render_data->rays = GetContext().CreateBuffer<ray>(size, CL_MEM_READ_WRITE);
+        m_render_data->intersections = GetContext().CreateBuffer<Intersection>(size, CL_MEM_READ_WRITE);
+        m_render_data->output_indices = GetContext().CreateBuffer<int>(size, CL_MEM_READ_WRITE);
+        m_render_data->hitcount = GetContext().CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+
+        std::vector<int> initdata(size);
+        std::iota(initdata.begin(), initdata.end(), 0);
+        m_render_data->iota = GetContext().CreateBuffer<int>(size, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, &initdata[0]);
+
+        m_render_data->random = GetContext().CreateBuffer<std::uint32_t>(size, CL_MEM_READ_WRITE);
+        SetRandomSeed(m_random_seed);
+
+        GetIntersector()->DeleteBuffer(m_render_data->fr_rays);
+        GetIntersector()->DeleteBuffer(m_render_data->fr_intersections);
+        GetIntersector()->DeleteBuffer(m_render_data->fr_hitcount);
+
+        auto intersector = GetIntersector().get();
+        m_render_data->fr_rays = CreateFromOpenClBuffer(intersector, m_render_data->rays);
+        m_render_data->fr_intersections = CreateFromOpenClBuffer(intersector, m_render_data->intersections);
+        m_render_data->fr_hitcount = CreateFromOpenClBuffer(intersector, m_render_data->hitcount);
+
+        AllocateAoRays();
+    }
+
+    std::size_t AoEstimator::GetWorkBufferSize() const
+    {
+        return m_render_data->rays.GetElementCount();
+    }
+
+    void AoEstimator::AllocateAoRays()
+    {
+        auto size = GetWorkBufferSize() * m_num_ao_rays;
+
+        GetIntersector()->DeleteBuffer(m_render_data->fr_ao_rays);
+        GetIntersector()->DeleteBuffer(m_render_data->fr_ao_hits);
+        m_render_data->fr_ao_rays = nullptr;
+        m_render_data->fr_ao_hits = nullptr;
+
+        if (size == 0)
+        {
+            m_render_data->ao_rays = CLWBuffer<ray>();
+            m_render_data->ao_hits = CLWBuffer<int>();
+            return;
+        }
+
+        m_render_data->ao_rays = GetContext().CreateBuffer<ray>(size, CL_MEM_READ_WRITE);
+        m_render_data->ao_hits = GetContext().CreateBuffer<int>(size, CL_MEM_READ_WRITE);
+
+        auto intersector = GetIntersector().get();
+        m_render_data->fr_ao_rays = CreateFromOpenClBuffer(intersector, m_render_data->ao_rays);
+        m_render_data->fr_ao_hits = CreateFromOpenClBuffer(intersector, m_render_data->ao_hits);
+    }
+
+    void AoEstimator::SetRandomSeed(std::uint32_t seed)
+    {
+        m_random_seed = seed;
+
+        auto size = m_render_data->random.GetElementCount();
+
+        if (size != 0)
+        {
+            std::vector<std::uint32_t> random_buffer(size);
+
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                // Same values as the path tracer random buffer, sampler kernels avoid zero and small scrambles
+                auto value = Baikal::GetLaunchSeed(m_random_seed, static_cast<std::uint32_t>(i), LaunchSeed::kRandomBuffer);
+                random_buffer[i] = (value >> 1) + 3u;
+            }
+
+            GetContext().WriteBuffer(0, m_render_data->random, random_buffer.data(), size).Wait();
+        }
+    }
+
+    void AoEstimator::SetSampleIndex(std::uint32_t index)
+    {
+        m_sample_counter = index;
+    }
+
+    CLWBuffer<ray> AoEstimator::GetRayBuffer() const
+    {
+        return m_render_data->rays;
+    }
+
+    CLWBuffer<int> AoEstimator::GetOutputIndexBuffer() const
+    {
+        return m_render_data->output_indices;
+    }
+
+    CLWBuffer<int> AoEstimator::GetRayCountBuffer() const
+    {
+        return m_render_data->hitcount;
+    }
+
+    CLWBuffer<RadeonRays::Intersection> AoEstimator::GetFirstHitBuffer() const
+    {
+        return m_render_data->intersections;
+    }
+
+    bool AoEstimator::HasRandomBuffer(RandomBufferType buffer) const
+    {
+        switch (buffer)
+        {
+        case RandomBufferType::kRandomSeed:
+        case RandomBufferType::kBlueNoise:
+            return true;
+        case RandomBufferType::kSobolLUT:
+#ifndef BAIKAL_NO_SOBOL_LUT
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        return false;
+    }
+
+    CLWBuffer<std::uint32_t> AoEstimator::GetRandomBuffer(RandomBufferType buffer) const
+    {
+        switch (buffer)
+        {
+        case RandomBufferType::kRandomSeed:
+            return m_render_data->random;
+        case RandomBufferType::kSobolLUT:
+            return m_render_data->sobolmat;
+        case RandomBufferType::kBlueNoise:
+            if (m_render_data->blue_noise.GetElementCount() == 0)
+            {
+                auto const& tile = GetBlueNoiseTile();
+                m_render_data->blue_noise = GetContext().CreateBuffer<std::uint32_t>(tile.size(), CL_MEM_READ_ONLY,
+                    const_cast<std::uint32_t*>(tile.data()));
+            }
+            return m_render_data->blue_noise;
+        }
+
+        return CLWBuffer<std::uint32_t>();
+    }
+
+    std::string AoEstimator::GetBuildOptions(bool atomic_update) const
+    {
+#ifdef BAIKAL_NO_SOBOL_LUT
+        if (GetSamplerType() == SamplerType::kSobol || GetSamplerType() == SamplerType::kBlueNoiseSobol)
+        {
+            throw std::runtime_error("AoEstimator: Sobol matrices are not available in this build, use SamplerType::kOwenSobol");
+        }
+#endif
+        std::string atomic_opts = atomic_update ? " -D BAIKAL_ATOMIC_RESOLVE " : "";
+        return atomic_opts + GetSamplerBuildOptions();
+    }
+
+    float AoEstimator::GetRadius(ClwScene const& scene) const
+    {
+        if (m_radius > 0.f)
+        {
+            return m_radius;
+        }
+
+        auto diagonal = scene.world_aabb.pmax - scene.world_aabb.pmin;
+        return std::max(std::sqrt(diagonal.sqnorm()) * kDefaultRelativeRadius, 1e-4f);
+    }
+
+    void AoEstimator::CompileProgramsAsync(ClwScene const& scene, QualityLevel quality, bool atomic_update)
+    {
+        CompileProgramAsync(GetBuildOptions(atomic_update));
+    }
+
+    void AoEstimator::Estimate(
+        ClwScene const& scene,
+        std::size_t num_estimates,
+        QualityLevel quality,
+        CLWBuffer<RadeonRays::float3> output,
+        bool use_output_indices,
+        bool atomic_update,
+        MissedPrimaryRaysHandler missedPrimaryRaysHandler,
+        PrimaryHitsHandler primaryHitsHandler
+    )
+    {
+        BAIKAL_TRACE_SCOPE("estimator", "Estimate");
+
+        SetDefaultBuildOptions(GetBuildOptions(atomic_update));
+
+        auto output_indices = use_output_indices ? m_render_data->output_indices : m_render_data->iota;
+
+        {
+            BAIKAL_TRACE_SCOPE("radeonrays", "QueryIntersection");
+            TraceFirstHit(scene, num_estimates);
+        }
+        ProfileMark("intersect", 0);
+
+        // Primary hits come before the occlusion rays are generated into their slots
+        if (primaryHitsHandler)
+        {
+            primaryHitsHandler(m_render_data->rays, m_render_data->intersections, output_indices, num_estimates);
+            ProfileMark("primary_hits", 0);
+        }
+
+        if (m_num_ao_rays > 0)
+        {
+            auto generatekernel = GetKernel("GenerateAoRays");
+
+            int argc = 0;
+            generatekernel.SetArg(argc++, m_render_data->rays);
+            generatekernel.SetArg(argc++, m_render_data->intersections);
+            generatekernel.SetArg(argc++, m_render_data->hitcount);
+            generatekernel.SetArg(argc++, scene.vertices);
+            generatekernel.SetArg(argc++, scene.normals);
+            generatekernel.SetArg(argc++, scene.uvs);
+            generatekernel.SetArg(argc++, scene.tangents);
+            generatekernel.SetArg(argc++, scene.indices);
+            generatekernel.SetArg(argc++, scene.shapes);
+            generatekernel.SetArg(argc++, scene.instances);
+            generatekernel.SetArg(argc++, scene.instance_transforms);
+            generatekernel.SetArg(argc++, scene.num_base_shapes);
+            generatekernel.SetArg(argc++, (cl_int)m_num_ao_rays);
+            generatekernel.SetArg(argc++, GetRadius(scene));
+            generatekernel.SetArg(argc++, Baikal::GetLaunchSeed(m_random_seed, m_sample_counter, LaunchSeed::kAoGenerate));
+            generatekernel.SetArg(argc++, m_render_data->random);
+            generatekernel.SetArg(argc++, m_render_data->sobolmat);
+            generatekernel.SetArg(argc++, m_sample_counter);
+            generatekernel.SetArg(argc++, m_render_data->ao_rays);
+            generatekernel.SetArg(argc++, m_render_data->ao_count);
+
+            LaunchTuned(generatekernel, "GenerateAoRays", num_estimates);
+            ProfileMark("generate_ao_rays", 0);
+
+            {
+                BAIKAL_TRACE_SCOPE("radeonrays", "QueryOcclusion");
+                GetIntersector(scene)->QueryOcclusion(
+                    m_render_data->fr_ao_rays,
+                    m_render_data->fr_ao_count,
+                    (std::uint32_t)(num_estimates * m_num_ao_rays),
+                    m_render_data->fr_ao_hits,
+                    nullptr,
+                    nullptr
+                );
+            }
+            ProfileMark("occlude", 0);
+        }
+
+        // Handler shades missed primary rays and counts their samples itself
+        if (missedPrimaryRaysHandler)
+        {
+            missedPrimaryRaysHandler(m_render_data->rays, m_render_data->intersections, m_render_data->iota,
+                output_indices, num_estimates, output);
+            ProfileMark("shade_background", 0);
+        }
+
+        auto resolvekernel = GetKernel("ResolveAo");
+
+        int argc = 0;
+        resolvekernel.SetArg(argc++, m_render_data->intersections);
+        resolvekernel.SetArg(argc++, m_render_data->hitcount);
+        resolvekernel.SetArg(argc++, output_indices);
+        // Hits are not read without occlusion rays
+        resolvekernel.SetArg(argc++, m_num_ao_rays > 0 ? m_render_data->ao_hits : m_render_data->iota);
+        resolvekernel.SetArg(argc++, (cl_int)m_num_ao_rays);
+        resolvekernel.SetArg(argc++, m_background);
+        resolvekernel.SetArg(argc++, missedPrimaryRaysHandler ? 1 : 0);
+        resolvekernel.SetArg(argc++, output);
+
+        LaunchTuned(resolvekernel, "ResolveAo", num_estimates);
+        ProfileMark("resolve_ao", 0);
+    }
+
+    void AoEstimator::TraceFirstHit(
+        ClwScene const& scene,
+        std::size_t num_estimates
+    )
+    {
+        GetIntersector(scene)->QueryIntersection(
+            m_render_data->fr_rays,
+            m_render_data->fr_hitcount,
+            (std::uint32_t)num_estimates,
+            m_render_data->fr_intersections,
+            nullptr,
+            nullptr
+        );
+    }
+
+    void AoEstimator::Benchmark(
+        ClwScene const& scene,
+        std::size_t num_estimates,
+        RayTracingStats& stats
+    )
+    {
+        auto num_passes = 100u;
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (auto i = 0u; i < num_passes; ++i)
+        {
+            TraceFirstHit(scene, num_estimates);
+        }
+
+        GetContext().Finish(0);
+
+        auto delta = std::chrono::high_resolution_clock::now() - start;
+
+        stats.primary_throughput =
+            num_estimates / (((float)std::chrono::duration_cast<std::chrono::milliseconds>(delta).count()
+                / num_passes)
+                / 1000.f);
+
+        // There are no secondary rays, occlusion rays stand in for the shadow ones
+        stats.secondary_throughput = 0.f;
+        stats.shadow_throughput = 0.f;
+
+        if (m_num_ao_rays == 0)
+        {
+            return;
+        }
+
+        auto temporary = GetContext().CreateBuffer<float3>(num_estimates, CL_MEM_WRITE_ONLY);
+        Estimate(scene, num_estimates, QualityLevel::kRough, temporary, false);
+
+        start = std::chrono::high_resolution_clock::now();
+
+        for (auto i = 0u; i < num_passes; ++i)
+        {
+            GetIntersector(scene)->QueryOcclusion(
+                m_render_data->fr_ao_rays,
+                m_render_data->fr_ao_count,
+                (std::uint32_t)(num_estimates * m_num_ao_rays),
+                m_render_data->fr_ao_hits,
+                nullptr,
+                nullptr
+            );
+        }
+
+        GetContext().Finish(0);
+
+        delta = std::chrono::high_resolution_clock::now() - start;
+
+        stats.shadow_throughput =
+            num_estimates * m_num_ao_rays / (((float)std::chrono::duration_cast<std::chrono::milliseconds>(delta).count()
+                / num_passes)
+                / 1000.f);
+    }
+
+    void AoEstimator::SetNumAoRays(std::uint32_t num_rays)
+    {
+        if (num_rays != m_num_ao_rays)
+        {
+            m_num_ao_rays = num_rays;
+            AllocateAoRays();
+        }
+    }
+
+    std::uint32_t AoEstimator::GetNumAoRays() const
+    {
+        return m_num_ao_rays;
+    }
+
+    void AoEstimator::SetAoRadius(float radius)
+    {
+        if (radius < 0.f)
+        {
+            throw std::runtime_error("AoEstimator: radius should not be negative");
+        }
+
+        m_radius = radius;
+    }
+
+    float AoEstimator::GetAoRadius() const
+    {
+        return m_radius;
+    }
+
+    void AoEstimator::SetBackground(float value)
+    {
+        m_background = value;
+    }
+
+    float AoEstimator::GetBackground() const
+    {
+        return m_background;
+    }
+}
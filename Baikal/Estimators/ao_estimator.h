@@ -0,0 +1,133 @@
+/**********************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include "estimator.h"
+#include "radeon_rays_cl.h"
+#include "Utils/cl_program_manager.h"
+
+#include <memory>
+#include <vector>
+
+namespace Baikal
+{
+    /**
+    \brief Ambient occlusion estimator for layout and preview renders.
+
+    Estimates the unoccluded fraction of a cosine weighted hemisphere around the
+    first hit of every ray with a fixed number of occlusion rays of limited
+    length. Only scene geometry is read, so neither materials nor lights are
+    evaluated and the UberV2 programs are never built. Rays missing the scene
+    receive a constant background value.
+    */
+    class AoEstimator : public Estimator, protected ClwClass
+    {
+    public:
+        AoEstimator(
+            CLWContext context,
+            std::shared_ptr<RadeonRays::IntersectionApi> api,
+            const CLProgramManager *program_manager
+        );
+
+        ~AoEstimator() override;
+
+        void SetWorkBufferSize(std::size_t size) override;
+        std::size_t GetWorkBufferSize() const override;
+
+        void SetRandomSeed(std::uint32_t seed) override;
+        void SetSampleIndex(std::uint32_t index) override;
+
+        CLWBuffer<ray> GetRayBuffer() const override;
+        CLWBuffer<int> GetOutputIndexBuffer() const override;
+        CLWBuffer<int> GetRayCountBuffer() const override;
+        CLWBuffer<RadeonRays::Intersection> GetFirstHitBuffer() const override;
+
+        bool HasRandomBuffer(RandomBufferType buffer) const override;
+        CLWBuffer<std::uint32_t> GetRandomBuffer(RandomBufferType buffer) const override;
+
+        /**
+        \brief Evaluate single sample occlusion estimate for the rays in ray buffer.
+
+        Quality level and max bounces are ignored. Missed primary rays are resolved to the
+        background value unless missedPrimaryRaysHandler is given.
+        */
+        void Estimate(
+            ClwScene const& scene,
+            std::size_t num_estimates,
+            QualityLevel quality,
+            CLWBuffer<RadeonRays::float3> output,
+            bool use_output_indices = true,
+            bool atomic_update = false,
+            MissedPrimaryRaysHandler missedPrimaryRaysHandler = nullptr,
+            PrimaryHitsHandler primaryHitsHandler = nullptr
+        ) override;
+
+        void CompileProgramsAsync(ClwScene const& scene, QualityLevel quality, bool atomic_update) override;
+
+        void TraceFirstHit(
+            ClwScene const& scene,
+            std::size_t num_estimates
+        ) override;
+
+        void Benchmark(
+            ClwScene const& scene,
+            std::size_t num_estimates,
+            RayTracingStats& stats
+        ) override;
+
+        /**
+        \brief Set number of occlusion rays per hit, occlusion ray buffer is reallocated.
+        */
+        void SetNumAoRays(std::uint32_t num_rays);
+        std::uint32_t GetNumAoRays() const;
+
+        /**
+        \brief Set max length of occlusion rays in world units.
+
+        Zero radius is derived from the scene bounds.
+        */
+        void SetAoRadius(float radius);
+        float GetAoRadius() const;
+
+        /**
+        \brief Set value added for rays missing the scene.
+        */
+        void SetBackground(float value);
+        float GetBackground() const;
+
+    private:
+        std::string GetBuildOptions(bool atomic_update) const;
+
+        float GetRadius(ClwScene const& scene) const;
+
+        void AllocateAoRays();
+
+        struct RenderData;
+
+        std::unique_ptr<RenderData> m_render_data;
+        std::uint32_t m_sample_counter;
+        std::uint32_t m_random_seed;
+        std::uint32_t m_num_ao_rays;
+        float m_radius;
+        float m_background;
+    };
+}
@@ -0,0 +1,316 @@
+#include "bdpt_estimator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "Utils/trace.h"
+
+#ifdef BAIKAL_EMBED_KERNELS
+#include "embed_kernels.h"
+#endif
+
+namespace Baikal
+{
+    struct BdptEstimator::LightPathData
+    {
+        struct PathState
+        {
+#ifndef BAIKAL_COMPACT_PATH
+            float4 throughput;
+            int volume;
+            int flags;
+            int extra0;
+            int extra1;
+#else
+            // Half precision throughput, flags and volume index packed in state
+            std::uint16_t throughput[3];
+            std::uint16_t reserved;
+            std::uint32_t state;
+#endif
+        };
+
+        // OpenCL stuff
+        CLWBuffer<ray> rays;
+        CLWBuffer<Intersection> intersections;
+        CLWBuffer<PathState> paths;
+        CLWBuffer<std::uint32_t> random;
+        CLWBuffer<int> count;
+
+        CLWBuffer<ray> connection_rays;
+        CLWBuffer<int> connection_hits;
+        CLWBuffer<float3> contributions;
+        CLWBuffer<int> splat_indices;
+
+        // RadeonRays stuff
+        Buffer* fr_rays;
+        Buffer* fr_intersections;
+        Buffer* fr_count;
+        Buffer* fr_connection_rays;
+        Buffer* fr_connection_hits;
+
+        LightPathData()
+            : fr_rays(nullptr)
+            , fr_intersections(nullptr)
+            , fr_count(nullptr)
+            , fr_connection_rays(nullptr)
+            , fr_connection_hits(nullptr)
+        {
+        }
+    };
+
+    BdptEstimator::BdptEstimator(
+        CLWContext context,
+        std::shared_ptr<RadeonRays::IntersectionApi> api,
+        const CLProgramManager *program_manager
+    ) :
+        PathTracingEstimator(context, api, program_manager)
+        , m_light_path_data(new LightPathData)
+#ifdef BAIKAL_EMBED_KERNELS
+        , m_bdpt_kernels(context, program_manager, "integrator_bdpt", g_integrator_bdpt_opencl, g_integrator_bdpt_opencl_headers, "")
+#else
+        , m_bdpt_kernels(context, program_manager, "../Baikal/Kernels/CL/integrator_bdpt.cl", "")
+#endif
+        , m_width(0)
+        , m_height(0)
+        , m_frame(0)
+    {
+        m_light_path_data->count = context.CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+    }
+
+    BdptEstimator::~BdptEstimator()
+    {
+        GetIntersector()->DeleteBuffer(m_light_path_data->fr_rays);
+        GetIntersector()->DeleteBuffer(m_light_path_data->fr_intersections);
+        GetIntersector()->DeleteBuffer(m_light_path_data->fr_count);
+        GetIntersector()->DeleteBuffer(m_light_path_data->fr_connection_rays);
+        GetIntersector()->DeleteBuffer(m_light_path_data->fr_connection_hits);
+    }
+
+    void BdptEstimator::SetWorkBufferSize(std::size_t size)
+    {
+        PathTracingEstimator::SetWorkBufferSize(size);
+
+        auto context = m_bdpt_kernels.GetContext();
+
+        m_light_path_data->rays = context.CreateBuffer<ray>(size, CL_MEM_READ_WRITE);
+        m_light_path_data->intersections = context.CreateBuffer<Intersection>(size, CL_MEM_READ_WRITE);
+        m_light_path_data->paths = context.CreateBuffer<LightPathData::PathState>(size, CL_MEM_READ_WRITE);
+        m_light_path_data->connection_rays = context.CreateBuffer<ray>(size, CL_MEM_READ_WRITE);
+        m_light_path_data->connection_hits = context.CreateBuffer<int>(size, CL_MEM_READ_WRITE);
+        m_light_path_data->contributions = context.CreateBuffer<float3>(size, CL_MEM_READ_WRITE);
+        m_light_path_data->splat_indices = context.CreateBuffer<int>(size, CL_MEM_READ_WRITE);
+
+        // Light subpaths use their own seeds to stay uncorrelated with eye paths
+        auto random_buffer = GenerateRandomBuffer(size, 1u);
+
+        m_light_path_data->random = context.CreateBuffer<std::uint32_t>(size, CL_MEM_READ_WRITE, &random_buffer[0]);
+
+        // Recreate FR buffers
+        GetIntersector()->DeleteBuffer(m_light_path_data->fr_rays);
+        GetIntersector()->DeleteBuffer(m_light_path_data->fr_intersections);
+        GetIntersector()->DeleteBuffer(m_light_path_data->fr_count);
+        GetIntersector()->DeleteBuffer(m_light_path_data->fr_connection_rays);
+        GetIntersector()->DeleteBuffer(m_light_path_data->fr_connection_hits);
+
+        auto intersector = GetIntersector().get();
+        m_light_path_data->fr_rays = CreateFromOpenClBuffer(intersector, m_light_path_data->rays);
+        m_light_path_data->fr_intersections = CreateFromOpenClBuffer(intersector, m_light_path_data->intersections);
+        m_light_path_data->fr_count = CreateFromOpenClBuffer(intersector, m_light_path_data->count);
+        m_light_path_data->fr_connection_rays = CreateFromOpenClBuffer(intersector, m_light_path_data->connection_rays);
+        m_light_path_data->fr_connection_hits = CreateFromOpenClBuffer(intersector, m_light_path_data->connection_hits);
+    }
+
+    void BdptEstimator::SetOutputSize(std::uint32_t width, std::uint32_t height)
+    {
+        PathTracingEstimator::SetOutputSize(width, height);
+        m_width = width;
+        m_height = height;
+    }
+
+    void BdptEstimator::SetSampleIndex(std::uint32_t index)
+    {
+        PathTracingEstimator::SetSampleIndex(index);
+        m_frame = index;
+    }
+
+    void BdptEstimator::Estimate(
+        ClwScene const& scene,
+        std::size_t num_estimates,
+        QualityLevel quality,
+        CLWBuffer<RadeonRays::float3> output,
+        bool use_output_indices,
+        bool atomic_update,
+        MissedPrimaryRaysHandler missedPrimaryRaysHandler,
+        PrimaryHitsHandler primaryHitsHandler
+    )
+    {
+        // Splatting requires single view pinhole camera model and a scene with lights to start from
+        bool trace_light_paths = scene.camera_type == CameraType::kPerspective && scene.camera_num_views == 1 &&
+            scene.num_lights > 0 && m_width > 0 && m_height > 0;
+
+        SetCausticPathSplit(trace_light_paths);
+
+        PathTracingEstimator::Estimate(
+            scene,
+            num_estimates,
+            quality,
+            output,
+            use_output_indices,
+            atomic_update,
+            missedPrimaryRaysHandler,
+            primaryHitsHandler);
+
+        if (!trace_light_paths)
+        {
+            return;
+        }
+
+        BAIKAL_TRACE_SCOPE("estimator", "LightPaths");
+
+        auto context = m_bdpt_kernels.GetContext();
+
+        context.FillBuffer(0, m_light_path_data->count, (int)num_estimates, 1);
+
+        GenerateLightVertices(scene, num_estimates);
+
+        for (auto pass = 0u; pass < GetMaxBounces(); ++pass)
+        {
+            // Intersect light subpath rays
+            GetIntersector(scene)->QueryIntersection(
+                m_light_path_data->fr_rays,
+                m_light_path_data->fr_count,
+                (std::uint32_t)num_estimates,
+                m_light_path_data->fr_intersections,
+                nullptr,
+                nullptr
+            );
+
+            // Advance through specular vertices and connect diffuse ones to the camera
+            ShadeSurfaceLightTracing(scene, pass, num_estimates);
+
+            // Check camera connections visibility
+            GetIntersector(scene)->QueryOcclusion(
+                m_light_path_data->fr_connection_rays,
+                m_light_path_data->fr_count,
+                (std::uint32_t)num_estimates,
+                m_light_path_data->fr_connection_hits,
+                nullptr,
+                nullptr
+            );
+
+            GatherCausticContributions(num_estimates, output);
+
+            context.Flush(0);
+        }
+
+        ++m_frame;
+    }
+
+    void BdptEstimator::GenerateLightVertices(ClwScene const& scene, std::size_t size)
+    {
+        auto generate_kernel = m_bdpt_kernels.GetKernel("GenerateLightVertices");
+
+        int argc = 0;
+        generate_kernel.SetArg(argc++, (cl_int)size);
+        generate_kernel.SetArg(argc++, scene.vertices);
+        generate_kernel.SetArg(argc++, scene.normals);
+        generate_kernel.SetArg(argc++, scene.uvs);
+        generate_kernel.SetArg(argc++, scene.tangents);
+        generate_kernel.SetArg(argc++, scene.indices);
+        generate_kernel.SetArg(argc++, scene.shapes);
+        generate_kernel.SetArg(argc++, scene.instances);
+        generate_kernel.SetArg(argc++, scene.instance_transforms);
+        generate_kernel.SetArg(argc++, scene.num_base_shapes);
+        generate_kernel.SetArg(argc++, scene.material_attributes);
+        generate_kernel.SetArg(argc++, scene.textures);
+        generate_kernel.SetArg(argc++, scene.texturedata);
+        generate_kernel.SetArg(argc++, scene.texture_requests);
+        if (scene.texture_images)
+        {
+            generate_kernel.SetArg(argc++, scene.texture_images.get());
+        }
+        generate_kernel.SetArg(argc++, scene.envmapidx);
+        generate_kernel.SetArg(argc++, scene.lights);
+        generate_kernel.SetArg(argc++, scene.light_distributions);
+        generate_kernel.SetArg(argc++, scene.envmap_distribution);
+        generate_kernel.SetArg(argc++, scene.num_lights);
+        generate_kernel.SetArg(argc++, Baikal::GetLaunchSeed(GetRandomSeed(), m_frame, LaunchSeed::kBdptGenerate, 0u));
+        generate_kernel.SetArg(argc++, m_frame);
+        generate_kernel.SetArg(argc++, m_light_path_data->random);
+        generate_kernel.SetArg(argc++, GetRandomBuffer(RandomBufferType::kSobolLUT));
+        generate_kernel.SetArg(argc++, m_light_path_data->rays);
+        generate_kernel.SetArg(argc++, m_light_path_data->paths);
+        generate_kernel.SetArg(argc++, scene.input_map_data);
+
+        {
+            m_bdpt_kernels.GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, generate_kernel);
+        }
+    }
+
+    void BdptEstimator::ShadeSurfaceLightTracing(ClwScene const& scene, int pass, std::size_t size)
+    {
+        auto shade_kernel = m_bdpt_kernels.GetKernel("ShadeSurfaceLightTracing");
+
+        int argc = 0;
+        shade_kernel.SetArg(argc++, (cl_int)size);
+        shade_kernel.SetArg(argc++, m_light_path_data->rays);
+        shade_kernel.SetArg(argc++, m_light_path_data->intersections);
+        shade_kernel.SetArg(argc++, scene.vertices);
+        shade_kernel.SetArg(argc++, scene.normals);
+        shade_kernel.SetArg(argc++, scene.uvs);
+        shade_kernel.SetArg(argc++, scene.tangents);
+        shade_kernel.SetArg(argc++, scene.indices);
+        shade_kernel.SetArg(argc++, scene.shapes);
+        shade_kernel.SetArg(argc++, scene.instances);
+        shade_kernel.SetArg(argc++, scene.instance_transforms);
+        shade_kernel.SetArg(argc++, scene.num_base_shapes);
+        shade_kernel.SetArg(argc++, scene.material_attributes);
+        shade_kernel.SetArg(argc++, scene.textures);
+        shade_kernel.SetArg(argc++, scene.texturedata);
+        shade_kernel.SetArg(argc++, scene.texture_requests);
+        if (scene.texture_images)
+        {
+            shade_kernel.SetArg(argc++, scene.texture_images.get());
+        }
+        shade_kernel.SetArg(argc++, scene.envmapidx);
+        shade_kernel.SetArg(argc++, scene.lights);
+        shade_kernel.SetArg(argc++, scene.light_distributions);
+        shade_kernel.SetArg(argc++, scene.envmap_distribution);
+        shade_kernel.SetArg(argc++, scene.num_lights);
+        shade_kernel.SetArg(argc++, Baikal::GetLaunchSeed(GetRandomSeed(), m_frame, LaunchSeed::kBdptShade, static_cast<std::uint32_t>(pass)));
+        shade_kernel.SetArg(argc++, m_light_path_data->random);
+        shade_kernel.SetArg(argc++, GetRandomBuffer(RandomBufferType::kSobolLUT));
+        shade_kernel.SetArg(argc++, pass);
+        shade_kernel.SetArg(argc++, m_frame);
+        shade_kernel.SetArg(argc++, scene.camera);
+        shade_kernel.SetArg(argc++, (cl_int)m_width);
+        shade_kernel.SetArg(argc++, (cl_int)m_height);
+        shade_kernel.SetArg(argc++, m_light_path_data->paths);
+        shade_kernel.SetArg(argc++, m_light_path_data->connection_rays);
+        shade_kernel.SetArg(argc++, m_light_path_data->contributions);
+        shade_kernel.SetArg(argc++, m_light_path_data->splat_indices);
+        shade_kernel.SetArg(argc++, scene.input_map_data);
+
+        {
+            m_bdpt_kernels.GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, shade_kernel);
+        }
+    }
+
+    void BdptEstimator::GatherCausticContributions(std::size_t size, CLWBuffer<RadeonRays::float3> output)
+    {
+        auto gather_kernel = m_bdpt_kernels.GetKernel("GatherCausticContributions");
+
+        int argc = 0;
+        gather_kernel.SetArg(argc++, (cl_int)size);
+        gather_kernel.SetArg(argc++, m_light_path_data->connection_hits);
+        gather_kernel.SetArg(argc++, m_light_path_data->contributions);
+        gather_kernel.SetArg(argc++, m_light_path_data->splat_indices);
+        gather_kernel.SetArg(argc++, output);
+
+        {
+            m_bdpt_kernels.GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, gather_kernel);
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+
+#include "path_tracing_estimator.h"
+
+#include <memory>
+
+namespace Baikal
+{
+    /**
+    \brief Path tracing estimator extended with light subpaths for caustics.
+
+    Eye paths are traced by PathTracingEstimator except those which reach a light
+    through a chain of specular vertices after a diffuse bounce. Such paths
+    are instead generated from the lights, connected to the camera at the
+    first diffuse vertex and splatted into the output. Light subpaths are only
+    traced for the pinhole perspective camera, other cameras fall back to
+    plain path tracing.
+    */
+    class BdptEstimator : public PathTracingEstimator
+    {
+    public:
+        BdptEstimator(
+            CLWContext context,
+            std::shared_ptr<RadeonRays::IntersectionApi> api,
+            const CLProgramManager *program_manager
+        );
+
+        ~BdptEstimator() override;
+
+        /**
+        \brief Tells estimator about memory requirements (max number of entries in ray buffer).
+
+        One light subpath is traced per eye path, so light subpath buffers are
+        allocated with the same size.
+        */
+        void SetWorkBufferSize(std::size_t size) override;
+
+        /**
+        \brief Set output resolution used to splat light subpath contributions.
+        */
+        void SetOutputSize(std::uint32_t width, std::uint32_t height) override;
+
+        /**
+        \brief Light subpaths follow the sample index of eye paths.
+        */
+        void SetSampleIndex(std::uint32_t index) override;
+
+        /**
+        \brief Evaluate single sample radiance estimate for a given direction.
+
+        Runs path tracing estimate and then adds caustic contributions gathered
+        from light subpaths into the output.
+        */
+        void Estimate(
+            ClwScene const& scene,
+            std::size_t num_estimates,
+            QualityLevel quality,
+            CLWBuffer<RadeonRays::float3> output,
+            bool use_output_indices = true,
+            bool atomic_update = false,
+            MissedPrimaryRaysHandler missedPrimaryRaysHandler = nullptr,
+            PrimaryHitsHandler primaryHitsHandler = nullptr
+        ) override;
+
+    private:
+        void GenerateLightVertices(ClwScene const& scene, std::size_t size);
+
+        void ShadeSurfaceLightTracing(ClwScene const& scene, int pass, std::size_t size);
+
+        void GatherCausticContributions(std::size_t size, CLWBuffer<RadeonRays::float3> output);
+
+        struct LightPathData;
+
+        std::unique_ptr<LightPathData> m_light_path_data;
+        ClwClass m_bdpt_kernels;
+        std::uint32_t m_width;
+        std::uint32_t m_height;
+        std::uint32_t m_frame;
+    };
+}
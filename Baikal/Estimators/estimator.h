@@ -24,14 +24,56 @@ THE SOFTWARE.
 #include "radeon_rays.h"
 #include "SceneGraph/clwscene.h"
 #include "Utils/clw_class.h"
+#include "Utils/clw_profiler.h"
 
 #include "CLW.h"
 
 #include <array>
 #include <memory>
+#include <string>
 
 namespace Baikal
 {
+    // Kernel launches drawing their own seed, see GetLaunchSeed
+    enum class LaunchSeed : std::uint32_t
+    {
+        kRandomBuffer,
+        kGenerateTileDomain,
+        kGeneratePrimaryRays,
+        kFillAovs,
+        kShadeSurface,
+        kShadeVolume,
+        kSampleVolume,
+        kApplyVolumeTransmission,
+        kBdptGenerate,
+        kBdptShade,
+        kPhotonGenerate,
+        kPhotonTrace,
+        kAoGenerate,
+        kCullShadowRays
+    };
+
+    // Seed of a kernel launch, only depends on the random seed, the sample index and the launch itself,
+    // so a sample renders the same no matter how many launches came before it
+    inline std::uint32_t GetLaunchSeed(std::uint32_t seed, std::uint32_t sample_index, LaunchSeed launch, std::uint32_t pass = 0u)
+    {
+        auto hash = [](std::uint32_t value)
+        {
+            value = (value ^ 61u) ^ (value >> 16);
+            value *= 9u;
+            value ^= value >> 4;
+            value *= 0x27d4eb2du;
+            value ^= value >> 15;
+            return value;
+        };
+
+        auto value = hash(seed);
+        value = hash(value ^ sample_index);
+        value = hash(value ^ (static_cast<std::uint32_t>(launch) << 8 | (pass & 0xffu)));
+        // Kernels use the seed as a multiplier, keep it odd
+        return value | 1u;
+    }
+
     /**
     \brief Estimator calculates radiance estimates for a given set of directions in the scene.
 
@@ -54,13 +96,24 @@ namespace Baikal
             kIndirectRadiance,
             kVisibility,
             kOpacity,
+            kCost,
             kMax
         };
 
         enum class RandomBufferType
         {
             kRandomSeed,
-            kSobolLUT
+            kSobolLUT,
+            kBlueNoise
+        };
+
+        enum class SamplerType
+        {
+            kRandom,
+            kSobol,
+            kCmj,
+            kBlueNoiseSobol,
+            kOwenSobol
         };
 
         struct RayTracingStats
@@ -73,11 +126,17 @@ namespace Baikal
         using MissedPrimaryRaysHandler = std::function<void(
             CLWBuffer<ray> rays, CLWBuffer<Intersection> intersections, CLWBuffer<int> pixel_indices,
             CLWBuffer<int> output_indices, std::size_t size, CLWBuffer<RadeonRays::float3> output)>;
+
+        // Called once primary rays are intersected, before any bounce-0 shading modifies the hits
+        using PrimaryHitsHandler = std::function<void(
+            CLWBuffer<ray> rays, CLWBuffer<Intersection> intersections,
+            CLWBuffer<int> output_indices, std::size_t size)>;
         
         Estimator(std::shared_ptr<RadeonRays::IntersectionApi> api)
             : m_intersector(api)
             , m_max_bounces(5u)
             , m_max_shadow_ray_transmission_steps(2u)
+            , m_sampler_type(SamplerType::kCmj)
         {
         }
 
@@ -96,6 +155,14 @@ namespace Baikal
         */
         virtual std::size_t GetWorkBufferSize() const = 0;
 
+        /**
+        \brief Returns number of work buffer entries allocated for the work buffer size.
+
+        Estimators splitting the work buffer into batches with buffers of their own allocate
+        more entries than the work buffer size.
+        */
+        virtual std::size_t GetAllocatedWorkBufferSize() const { return GetWorkBufferSize(); }
+
         /**
         \brief Set random seed value for the renderer. Renders
         with the same random seed are guaranteed to be the same.
@@ -104,6 +171,17 @@ namespace Baikal
         */
         virtual void SetRandomSeed(std::uint32_t seed) = 0;
 
+        /**
+        \brief Set index of the sample the next Estimate call computes.
+
+        Random numbers of a sample only depend on the random seed and the sample index,
+        so sample ranges can be estimated separately, e.g. on different machines, and
+        summed up to the same result as a single render with the same work buffer size.
+
+        \param index Sample index
+        */
+        virtual void SetSampleIndex(std::uint32_t index) = 0;
+
         /**
         \brief Get ray buffer handle.
 
@@ -139,6 +217,30 @@ namespace Baikal
         */
         virtual CLWBuffer<int> GetRayCountBuffer() const = 0;
 
+        /**
+        \brief Get regeneration ray buffer handle.
+
+        Estimators regenerating paths start camera paths of another sample in the slots of
+        terminated ones. Clients generate rays of the sample following the one set via SetSampleIndex
+        into this buffer, in the same layout as the ray buffer, and skip that sample index afterwards.
+        Rays are only used by the next Estimate call. Returns an empty buffer if the estimator
+        does not regenerate paths.
+
+        IMPORTANT: SetWorkBufferSize should be called prior to calling this method.
+        */
+        virtual CLWBuffer<ray> GetRegenerationRayBuffer() const { return CLWBuffer<ray>(); }
+
+        /**
+        \brief Set primary hit buffer of the next Estimate call.
+
+        If hits_valid is set, hits of the primary rays are taken from the buffer instead of
+        intersecting the ray buffer, otherwise the hits found are copied into it, so clients
+        can keep them for estimates of the same rays. Hits include curve shapes. The buffer
+        should hold num_estimates hits of the next Estimate call, it is only used by that call.
+        Returns false if the estimator does not take primary hits, the buffer is not used then.
+        */
+        virtual bool SetPrimaryHitBuffer(CLWBuffer<RadeonRays::Intersection> hits, bool hits_valid) { return false; }
+
         /**
         \brief Returns first hit buffer
 
@@ -172,6 +274,21 @@ namespace Baikal
         */
         virtual bool SupportsIntermediateValue(IntermediateValue value) const { return false; }
 
+        /**
+        \brief Tells estimator about the resolution of the output it writes into.
+
+        Estimators which splat contributions into arbitrary output pixels (as
+        opposed to output[output_index[i]]) need to know output dimensions.
+        */
+        virtual void SetOutputSize(std::uint32_t width, std::uint32_t height) {}
+
+        /**
+        \brief Tells estimator all estimates of the current frame have been issued.
+
+        Estimators which keep per pixel data from frame to frame advance it here.
+        */
+        virtual void FinishFrame() {}
+
         /**
         \brief Set intermediate value buffer.
 
@@ -210,6 +327,8 @@ namespace Baikal
         \param use_output_indices If set to false assumes 1 to 1 correspondence between the ray and the output
         \param atomic_update Tells an estimator that indices might contain duplicate elements and
                 hence atomic update is required while updating output buffer.
+        \param missedPrimaryRaysHandler Replaces background shading of the primary rays missing the scene.
+        \param primaryHitsHandler Receives primary rays and their hits, e.g. to fill AOVs in the same pass.
         */
         virtual void Estimate(
             ClwScene const& scene,
@@ -218,9 +337,22 @@ namespace Baikal
             CLWBuffer<RadeonRays::float3> output,
             bool use_output_indices = true,
             bool atomic_update = false,
-            MissedPrimaryRaysHandler missedPrimaryRaysHandler = nullptr
+            MissedPrimaryRaysHandler missedPrimaryRaysHandler = nullptr,
+            PrimaryHitsHandler primaryHitsHandler = nullptr
         ) = 0;
 
+        /**
+        \brief Start compiling the programs Estimate would use with these settings.
+
+        Programs are compiled concurrently on worker threads, Estimate picks them up
+        or waits for them instead of compiling them one after another.
+
+        \param scene Compiled scene, programs specialized for its materials need it.
+        \param quality Quality of the estimates.
+        \param atomic_update Atomic update of the estimates.
+        */
+        virtual void CompileProgramsAsync(ClwScene const& scene, QualityLevel quality, bool atomic_update) {}
+
         /**
         \brief Find intersection points for the rays in ray buffer.
 
@@ -257,6 +389,16 @@ namespace Baikal
             return m_intersector;
         }
 
+        /**
+        \brief Get intersector holding the shapes of the scene.
+
+        Scenes compiled in the background are built into a second intersector,
+        rays are traced against the one of the scene being rendered.
+        */
+        RadeonRays::IntersectionApi* GetIntersector(ClwScene const& scene) const {
+            return scene.intersector ? scene.intersector : m_intersector.get();
+        }
+
         /**
         \brief Set max number of light bounces.
 
@@ -289,13 +431,80 @@ namespace Baikal
             return m_max_shadow_ray_transmission_steps;
         }
 
+        /**
+        \brief Set sampler used by the kernels.
+
+        kBlueNoiseSobol requires RandomBufferType::kBlueNoise buffer: its values are tiled over
+        the screen and used to shift Sobol sequence of each pixel, so at low sample counts
+        the error is distributed as blue noise.
+
+        kOwenSobol generates Owen scrambled Sobol points directly in the kernels and does not
+        read RandomBufferType::kSobolLUT buffer, so it is available when Baikal is built
+        without Sobol matrices table (BAIKAL_ENABLE_SOBOL_LUT=OFF).
+
+        \param type Sampler type
+        */
+        void SetSamplerType(SamplerType type) {
+            m_sampler_type = type;
+        }
+
+        /**
+        \brief Get sampler used by the kernels.
+        */
+        SamplerType GetSamplerType() const {
+            return m_sampler_type;
+        }
+
+        /**
+        \brief Get kernel build options selecting current sampler.
+
+        Clients generating samples in their own kernels (e.g. camera rays) should
+        build them with these options.
+        */
+        std::string GetSamplerBuildOptions() const {
+            switch (m_sampler_type)
+            {
+            case SamplerType::kRandom:
+                return " -D SAMPLER=RANDOM ";
+            case SamplerType::kSobol:
+                return " -D SAMPLER=SOBOL ";
+            case SamplerType::kBlueNoiseSobol:
+                return " -D SAMPLER=BLUE_NOISE_SOBOL ";
+            case SamplerType::kOwenSobol:
+                return " -D SAMPLER=OWEN_SOBOL ";
+            default:
+                return " -D SAMPLER=CMJ ";
+            }
+        }
+
+        /**
+        \brief Set profiler the estimator marks its steps with.
+
+        Steps are marked per pass, the profiler is owned by the caller and can be null.
+        */
+        void SetProfiler(ClwProfiler* profiler) {
+            m_profiler = profiler;
+        }
+
         Estimator(Estimator const&) = delete;
         Estimator& operator = (Estimator const&) = delete;
 
+    protected:
+        // End the profiled span of a step enqueued since the previous mark
+        void ProfileMark(char const* name, std::uint32_t pass) {
+            if (m_profiler) m_profiler->Mark(name, pass);
+        }
+
+        void ProfileCount(char const* name, std::uint32_t pass, std::uint64_t value) {
+            if (m_profiler) m_profiler->Count(name, pass, value);
+        }
+
     private:
         std::shared_ptr<RadeonRays::IntersectionApi> m_intersector;
+        ClwProfiler* m_profiler = nullptr;
         std::uint32_t m_max_bounces;
         std::uint32_t m_max_shadow_ray_transmission_steps;
+        SamplerType m_sampler_type;
         std::array<CLWBuffer<float3>, 
             static_cast<size_t>(IntermediateValue::kMax)> m_intermediate_value;
     };
@@ -2,13 +2,28 @@
 
 #include <numeric>
 #include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdlib>
 #include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <locale>
+#include <map>
 #include <random>
+#include <set>
+#include <sstream>
 #include <algorithm>
-
+#include <stdexcept>
+#include <string>
+
+#include "Utils/blue_noise.h"
+#include "Utils/cl_uberv2_generator.h"
+#include "Utils/log.h"
+#include "Utils/trace.h"
+#ifndef BAIKAL_NO_SOBOL_LUT
 #include "Utils/sobol.h"
+#endif
 
 #ifdef BAIKAL_EMBED_KERNELS
 #include "embed_kernels.h"
@@ -16,13 +31,81 @@
 
 namespace Baikal
 {
+    // Work-group size for persistent-threads kernels
+    static std::size_t constexpr kWorkGroupSize = 64;
+    // Number of resident work-groups per compute unit for persistent-threads kernels
+    static std::size_t constexpr kPersistentGroupsPerComputeUnit = 16;
+    // Path guiding layout, see path_guiding.cl
+    static std::size_t constexpr kPathGuidingHeaderSize = 12;
+    static std::size_t constexpr kPathGuidingNumBins = 64;
+    static std::size_t constexpr kPathGuidingMaxVertices = 4;
+    // Radiance estimates and CDF of every direction bin
+    static std::size_t constexpr kPathGuidingCellBytes = kPathGuidingNumBins * 2 * sizeof(float);
+    // Path guiding grid resolution along the largest scene extent is capped
+    static std::uint32_t constexpr kPathGuidingMaxResolution = 256;
+    // Radiance cache layout, see radiance_cache.cl
+    static std::size_t constexpr kRadianceCacheSize = 1u << 20;
+    static std::size_t constexpr kRadianceCacheTrainingStride = 16;
+    static std::size_t constexpr kRadianceCacheMaxVertices = 4;
+    // Default radiance cache cell size in fractions of the scene diagonal
+    static float constexpr kRadianceCacheCellsPerDiagonal = 256.f;
+    // Generated headers are replaced by generic ones, so the program does not depend on the scene
+    static const std::map<std::string, std::string> kGenericUberV2Headers =
+    {
+        { "uberv2_generated.cl", "../Baikal/Kernels/CL/uberv2_generic.cl" },
+        { "inputmaps.cl", "../Baikal/Kernels/CL/inputmaps_generic.cl" }
+    };
+
+    // Float literal for build options, independent of the global locale
+    static std::string ToFloatLiteral(float value)
+    {
+        std::ostringstream stream;
+        stream.imbue(std::locale::classic());
+        stream << std::showpoint << std::setprecision(std::numeric_limits<float>::max_digits10) << value << 'f';
+        return stream.str();
+    }
+
     struct PathTracingEstimator::PathState
     {
+#ifndef BAIKAL_COMPACT_PATH
         float4 throughput;
         int volume;
         int flags;
         int extra0;
-        int extra1;
+        int light_mask;
+#else
+        // Half precision throughput, flags and volume index packed in state
+        std::uint16_t throughput[3];
+        std::uint16_t light_mask;
+        std::uint32_t state;
+#endif
+    };
+
+    struct PathTracingEstimator::PathGuidingVertex
+    {
+        int bin;
+        float weight;
+        float radiance;
+        int padding;
+    };
+
+    struct PathTracingEstimator::RadianceCacheVertex
+    {
+        std::uint32_t key;
+        int padding[3];
+        RadeonRays::float3 throughput;
+        RadeonRays::float3 radiance;
+    };
+
+    // Light resampling layout, see light_resampling.cl
+    struct PathTracingEstimator::LightReservoir
+    {
+        RadeonRays::float3 p;
+        RadeonRays::float3 n;
+        RadeonRays::float3 sample;
+        float num_candidates;
+        float weight;
+        float padding[2];
     };
 
     struct PathTracingEstimator::RenderData
@@ -40,13 +123,71 @@ namespace Baikal
         CLWBuffer<int> output_indices;
         CLWBuffer<int> iota;
 
-        CLWBuffer<float3> lightsamples;
+        // Radiance of shadow rays if they are unoccluded, packed RGB
+        CLWBuffer<float> lightsamples;
         CLWBuffer<PathState> paths;
         CLWBuffer<std::uint32_t> random;
         CLWBuffer<std::uint32_t> sobolmat;
+        // Created on first request
+        CLWBuffer<std::uint32_t> blue_noise;
         CLWBuffer<int> hitcount;
+        CLWBuffer<int> shadowcount;
+        CLWBuffer<int> work_counter;
+
+        // Material sorting
+        CLWBuffer<int> sort_keys[2];
+        CLWBuffer<int> sort_values[2];
+        CLWBuffer<int> unsorted_compacted_indices;
+        CLWBuffer<int> unsorted_pixelindices;
+        CLWBuffer<int> divergence_counters;
         CLWParallelPrimitives pp;
 
+        // Indices of shadow rays left for the next volume transmission step
+        CLWBuffer<int> transmission_indices[2];
+        CLWBuffer<int> transmission_pending;
+        CLWBuffer<int> transmission_count;
+
+        // Path guiding
+        CLWBuffer<int> guiding;
+        CLWBuffer<float> guiding_radiance;
+        CLWBuffer<PathGuidingVertex> guiding_vertices;
+
+        // Radiance cache
+        CLWBuffer<std::uint32_t> cache_keys;
+        CLWBuffer<RadeonRays::float3> cache_accum;
+        CLWBuffer<RadeonRays::float3> cache_radiance;
+        CLWBuffer<RadianceCacheVertex> cache_vertices;
+
+        // Path regeneration, camera rays of the next sample and the first pass of the path in every slot.
+        // Start passes are zero outside of estimates.
+        CLWBuffer<ray> regeneration_rays;
+        CLWBuffer<int> path_start;
+        // Regeneration rays have been handed out for the next estimate
+        bool regeneration_pending;
+
+        // Primary hits of the next estimate, see SetPrimaryHitBuffer
+        CLWBuffer<Intersection> primary_hits;
+        bool primary_hits_valid;
+
+        // Light resampling, reservoirs and cameras of the current frame at reservoir_index and of the last
+        // frame at the other one. Reservoirs are sized by the output, placeholders until the first resampled estimate.
+        CLWBuffer<LightReservoir> reservoirs[2];
+        CLWBuffer<ClwScene::Camera> reservoir_cameras[2];
+        int reservoir_index;
+        // Reservoirs of the last frame are valid
+        bool reservoir_history;
+        // Current frame has resampled estimates
+        bool reservoirs_used;
+        // Current estimate resamples light samples of first hits
+        bool resample_lights;
+
+        // Number of paths alive after last compaction (host copy)
+        int num_alive;
+        // Number of shadow rays left for the next transmission step (host copy)
+        int num_transmission_rays;
+        // Light samples per vertex used by the current estimate
+        std::uint32_t num_light_samples;
+
         // RadeonRays stuff
         Buffer* fr_rays[2];
         Buffer* fr_shadowrays;
@@ -54,22 +195,92 @@ namespace Baikal
         Buffer* fr_hits;
         Buffer* fr_intersections;
         Buffer* fr_hitcount;
+        Buffer* fr_shadowcount;
+        Buffer* fr_transmission_count;
 
         Collector mat_collector;
         Collector tex_collector;
 
         RenderData()
-            : fr_shadowrays(nullptr)
+            : regeneration_pending(false)
+            , primary_hits_valid(false)
+            , reservoir_index(0)
+            , reservoir_history(false)
+            , reservoirs_used(false)
+            , resample_lights(false)
+            , num_alive(0)
+            , num_transmission_rays(0)
+            , num_light_samples(1u)
+            , fr_shadowrays(nullptr)
             , fr_shadowhits(nullptr)
             , fr_hits(nullptr)
             , fr_intersections(nullptr)
             , fr_hitcount(nullptr)
+            , fr_shadowcount(nullptr)
+            , fr_transmission_count(nullptr)
         {
             fr_rays[0] = nullptr;
             fr_rays[1] = nullptr;
         }
     };
 
+    struct PathTracingEstimator::Batch
+    {
+        std::unique_ptr<RenderData> data;
+        // Wraps the command queue of the batch, commands are queued to it while the batch is swapped in
+        CLWContext context;
+        cl_command_queue queue;
+        // Work buffer range of the batch
+        std::size_t offset;
+        // Number of estimates of the current estimate and its last live path count read
+        std::size_t size;
+        CLWEvent num_alive_event;
+        bool finished;
+
+        Batch()
+            : queue(nullptr)
+            , offset(0)
+            , size(0)
+            , finished(false)
+        {
+        }
+
+        ~Batch()
+        {
+            // Context wrapper holds its own reference
+            if (queue)
+            {
+                clReleaseCommandQueue(queue);
+            }
+        }
+    };
+
+    // Commands queued to to from now on wait for the ones queued to from so far, both queues are in order
+    static void OrderQueues(cl_command_queue from, cl_command_queue to)
+    {
+        if (from == to)
+        {
+            return;
+        }
+
+        cl_event marker = nullptr;
+        if (clEnqueueMarkerWithWaitList(from, 0, nullptr, &marker) != CL_SUCCESS)
+        {
+            throw std::runtime_error("PathTracingEstimator: cannot enqueue marker");
+        }
+
+        // Waiting for commands which have not been submitted might never finish
+        clFlush(from);
+
+        auto status = clEnqueueBarrierWithWaitList(to, 1, &marker, nullptr);
+        clReleaseEvent(marker);
+
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error("PathTracingEstimator: cannot enqueue barrier");
+        }
+    }
+
     PathTracingEstimator::PathTracingEstimator(
         CLWContext context,
         std::shared_ptr<RadeonRays::IntersectionApi> api,
@@ -83,20 +294,97 @@ namespace Baikal
 #endif
         , m_render_data(new RenderData)
         , m_sample_counter(0)
+        , m_random_seed(0u)
 #ifdef BAIKAL_EMBED_KERNELS
         , m_uberv2_kernels(context, program_manager, "path_tracing_estimator_uberv2", g_path_tracing_estimator_uberv2_opencl, g_path_tracing_estimator_uberv2_opencl_headers, "")
+        , m_uberv2_generic_kernels(context, program_manager, "path_tracing_estimator_uberv2_generic", g_path_tracing_estimator_uberv2_opencl, g_path_tracing_estimator_uberv2_opencl_headers, "", kGenericUberV2Headers)
 #else
         , m_uberv2_kernels(context, program_manager, "../Baikal/Kernels/CL/path_tracing_estimator_uberv2.cl", "")
+        , m_uberv2_generic_kernels(context, program_manager, "../Baikal/Kernels/CL/path_tracing_estimator_uberv2.cl", "", kGenericUberV2Headers)
 #endif
+        , m_async_shader_compilation(false)
+        , m_use_generic_kernels(false)
+        , m_scene_features(ClwScene::kFeatureAll)
+        , m_shading_mode(ShadingMode::kWavefront)
+        , m_sort_by_material(false)
+        , m_ray_sorting_mask(0u)
+        , m_rr_min_bounce(4u)
+        , m_caustic_path_split(false)
+        , m_regularization(Regularization::kNone)
+        , m_max_radiance(10.f)
+        , m_light_samples_per_vertex(1u)
+        , m_shadow_ray_culling(0.f)
+        , m_path_guiding(false)
+        , m_path_guiding_budget(16u * 1024u * 1024u)
+        , m_path_guiding_scene(nullptr)
+        , m_path_guiding_revision(0u)
+        , m_path_guiding_cells(0u)
+        , m_radiance_cache(false)
+        , m_radiance_cache_cell_size(0.f)
+        , m_radiance_cache_scene(nullptr)
+        , m_radiance_cache_revision(0u)
+        , m_radiance_cache_cell(1.f)
+        , m_stochastic_layer_selection(false)
+        , m_energy_compensation(false)
+        , m_path_regeneration(0.f)
+        , m_light_resampling(false)
+        , m_output_width(0u)
+        , m_output_height(0u)
+        , m_in_flight_batches(1u)
+        , m_intersector_queue(context.GetCommandQueue(0))
+    {
+        InitRenderData();
+    }
+
+    void PathTracingEstimator::InitRenderData()
     {
+        auto context = GetContext();
+
         // Create parallel primitives
         m_render_data->pp = CLWParallelPrimitives(context, GetFullBuildOpts().c_str());
+#ifndef BAIKAL_NO_SOBOL_LUT
         m_render_data->sobolmat = context.CreateBuffer<unsigned int>(1024 * 52, CL_MEM_READ_ONLY, &g_SobolMatrices[0]);
+#else
+        // Kernels still take the argument, bind a placeholder
+        m_render_data->sobolmat = context.CreateBuffer<unsigned int>(1, CL_MEM_READ_ONLY);
+#endif
+        m_render_data->work_counter = context.CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+        m_render_data->divergence_counters = context.CreateBuffer<int>(2, CL_MEM_READ_WRITE);
+        context.FillBuffer(0, m_render_data->divergence_counters, 0, 2);
+
+        // Kernels take path guiding buffers even if it is disabled, empty grid header disables guiding
+        std::vector<int> guiding_header(kPathGuidingHeaderSize, 0);
+        m_render_data->guiding = context.CreateBuffer<int>(kPathGuidingHeaderSize, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, &guiding_header[0]);
+        m_render_data->guiding_vertices = context.CreateBuffer<PathGuidingVertex>(1, CL_MEM_READ_WRITE);
+
+        // Same for radiance cache, an empty single slot table never hits
+        m_render_data->cache_keys = context.CreateBuffer<std::uint32_t>(1, CL_MEM_READ_WRITE);
+        context.FillBuffer(0, m_render_data->cache_keys, 0u, 1);
+        m_render_data->cache_radiance = context.CreateBuffer<RadeonRays::float3>(1, CL_MEM_READ_WRITE);
+        m_render_data->cache_vertices = context.CreateBuffer<RadianceCacheVertex>(1, CL_MEM_READ_WRITE);
+
+        // Light resampling placeholders are never read, since estimates without resampling have no history
+        for (auto i = 0; i < 2; ++i)
+        {
+            m_render_data->reservoirs[i] = context.CreateBuffer<LightReservoir>(1, CL_MEM_READ_WRITE);
+            m_render_data->reservoir_cameras[i] = context.CreateBuffer<ClwScene::Camera>(1, CL_MEM_READ_WRITE);
+        }
     }
 
     PathTracingEstimator::~PathTracingEstimator()
     {
-        // Recreate FR buffers
+        for (auto& batch : m_batches)
+        {
+            SwapBatch(*batch);
+            ReleaseIntersectorBuffers();
+            SwapBatch(*batch);
+        }
+
+        ReleaseIntersectorBuffers();
+    }
+
+    void PathTracingEstimator::ReleaseIntersectorBuffers()
+    {
         GetIntersector()->DeleteBuffer(m_render_data->fr_rays[0]);
         GetIntersector()->DeleteBuffer(m_render_data->fr_rays[1]);
         GetIntersector()->DeleteBuffer(m_render_data->fr_shadowrays);
@@ -104,6 +392,27 @@ namespace Baikal
         GetIntersector()->DeleteBuffer(m_render_data->fr_shadowhits);
         GetIntersector()->DeleteBuffer(m_render_data->fr_intersections);
         GetIntersector()->DeleteBuffer(m_render_data->fr_hitcount);
+        GetIntersector()->DeleteBuffer(m_render_data->fr_shadowcount);
+        GetIntersector()->DeleteBuffer(m_render_data->fr_transmission_count);
+
+        m_render_data->fr_rays[0] = nullptr;
+        m_render_data->fr_rays[1] = nullptr;
+        m_render_data->fr_shadowrays = nullptr;
+        m_render_data->fr_hits = nullptr;
+        m_render_data->fr_shadowhits = nullptr;
+        m_render_data->fr_intersections = nullptr;
+        m_render_data->fr_hitcount = nullptr;
+        m_render_data->fr_shadowcount = nullptr;
+        m_render_data->fr_transmission_count = nullptr;
+    }
+
+    void PathTracingEstimator::SwapBatch(Batch& batch)
+    {
+        std::swap(m_render_data, batch.data);
+
+        auto context = GetContext();
+        SetContext(batch.context);
+        batch.context = context;
     }
 
     std::size_t PathTracingEstimator::GetWorkBufferSize() const
@@ -111,19 +420,87 @@ namespace Baikal
         return m_render_data->rays[0].GetElementCount();
     }
 
+    std::size_t PathTracingEstimator::GetAllocatedWorkBufferSize() const
+    {
+        auto size = GetWorkBufferSize();
+
+        for (auto const& batch : m_batches)
+        {
+            size += batch->data->rays[0].GetElementCount();
+        }
+
+        return size;
+    }
+
+    template <typename T>
+    static std::size_t GetBufferMemorySize(CLWBuffer<T> const& buffer)
+    {
+        return buffer.GetElementCount() * sizeof(T);
+    }
+
+    PathTracingEstimator::WorkBufferMemory PathTracingEstimator::GetWorkBufferMemory() const
+    {
+        auto const& data = *m_render_data;
+
+        WorkBufferMemory memory;
+        memory.rays = GetBufferMemorySize(data.rays[0]) + GetBufferMemorySize(data.rays[1]) +
+                      GetBufferMemorySize(data.regeneration_rays);
+        memory.shadow_rays = GetBufferMemorySize(data.shadowrays) + GetBufferMemorySize(data.shadowhits) +
+                             GetBufferMemorySize(data.lightsamples);
+        memory.intersections = GetBufferMemorySize(data.intersections);
+        memory.paths = GetBufferMemorySize(data.paths);
+        memory.random = GetBufferMemorySize(data.random);
+        // Sorting buffers other than the last one are aliases
+        memory.indices = GetBufferMemorySize(data.hits) + GetBufferMemorySize(data.iota) +
+                         GetBufferMemorySize(data.compacted_indices) + GetBufferMemorySize(data.pixelindices[0]) +
+                         GetBufferMemorySize(data.pixelindices[1]) + GetBufferMemorySize(data.output_indices) +
+                         GetBufferMemorySize(data.sort_values[1]) + GetBufferMemorySize(data.transmission_indices[0]) +
+                         GetBufferMemorySize(data.transmission_indices[1]) + GetBufferMemorySize(data.transmission_pending);
+        // Path start buffer is a single slot placeholder unless paths are regenerated
+        if (data.regeneration_rays.GetElementCount() > 0)
+        {
+            memory.indices += GetBufferMemorySize(data.path_start);
+        }
+
+        // Batches hold the same buffers for their range of the work buffer
+        for (auto const& batch : m_batches)
+        {
+            auto const& batch_data = *batch->data;
+
+            memory.rays += GetBufferMemorySize(batch_data.rays[0]) + GetBufferMemorySize(batch_data.rays[1]);
+            memory.shadow_rays += GetBufferMemorySize(batch_data.shadowrays) + GetBufferMemorySize(batch_data.shadowhits) +
+                                  GetBufferMemorySize(batch_data.lightsamples);
+            memory.intersections += GetBufferMemorySize(batch_data.intersections);
+            memory.paths += GetBufferMemorySize(batch_data.paths);
+            memory.random += GetBufferMemorySize(batch_data.random);
+            memory.indices += GetBufferMemorySize(batch_data.hits) + GetBufferMemorySize(batch_data.iota) +
+                              GetBufferMemorySize(batch_data.compacted_indices) + GetBufferMemorySize(batch_data.pixelindices[0]) +
+                              GetBufferMemorySize(batch_data.pixelindices[1]) + GetBufferMemorySize(batch_data.output_indices) +
+                              GetBufferMemorySize(batch_data.sort_values[1]) + GetBufferMemorySize(batch_data.transmission_indices[0]) +
+                              GetBufferMemorySize(batch_data.transmission_indices[1]) + GetBufferMemorySize(batch_data.transmission_pending);
+        }
+        return memory;
+    }
+
     void PathTracingEstimator::SetWorkBufferSize(std::size_t size)
+    {
+        AllocateRenderData(size);
+        CreateBatches(size);
+    }
+
+    void PathTracingEstimator::AllocateRenderData(std::size_t size)
     {
         m_render_data->rays[0] = GetContext().CreateBuffer<ray>(size, CL_MEM_READ_WRITE);
         m_render_data->rays[1] = GetContext().CreateBuffer<ray>(size, CL_MEM_READ_WRITE);
         m_render_data->hits = GetContext().CreateBuffer<int>(size, CL_MEM_READ_WRITE);
         m_render_data->intersections = GetContext().CreateBuffer<Intersection>(size, CL_MEM_READ_WRITE);
-        m_render_data->shadowrays = GetContext().CreateBuffer<ray>(size, CL_MEM_READ_WRITE);
-        m_render_data->shadowhits = GetContext().CreateBuffer<int>(size, CL_MEM_READ_WRITE);
-        m_render_data->lightsamples = GetContext().CreateBuffer<float3>(size, CL_MEM_READ_WRITE);
+        // Each path might cast several shadow rays
+        m_render_data->shadowrays = GetContext().CreateBuffer<ray>(size * m_light_samples_per_vertex, CL_MEM_READ_WRITE);
+        m_render_data->shadowhits = GetContext().CreateBuffer<int>(size * m_light_samples_per_vertex, CL_MEM_READ_WRITE);
+        m_render_data->lightsamples = GetContext().CreateBuffer<float>(3 * size * m_light_samples_per_vertex, CL_MEM_READ_WRITE);
         m_render_data->paths = GetContext().CreateBuffer<PathState>(size, CL_MEM_READ_WRITE);
 
-        std::vector<std::uint32_t> random_buffer(size);
-        std::generate(random_buffer.begin(), random_buffer.end(), [](){return std::rand() + 3;});
+        auto random_buffer = GenerateRandomBuffer(size);
 
         m_render_data->random = GetContext().CreateBuffer<std::uint32_t>(size, CL_MEM_READ_WRITE, &random_buffer[0]);
 
@@ -136,15 +513,33 @@ namespace Baikal
         m_render_data->pixelindices[1] = GetContext().CreateBuffer<int>(size, CL_MEM_READ_WRITE);
         m_render_data->output_indices = GetContext().CreateBuffer<int>(size, CL_MEM_READ_WRITE);
         m_render_data->hitcount = GetContext().CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+        m_render_data->shadowcount = GetContext().CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+        m_render_data->transmission_indices[0] = GetContext().CreateBuffer<int>(size, CL_MEM_READ_WRITE);
+        m_render_data->transmission_indices[1] = GetContext().CreateBuffer<int>(size, CL_MEM_READ_WRITE);
+        m_render_data->transmission_pending = GetContext().CreateBuffer<int>(size, CL_MEM_READ_WRITE);
+        m_render_data->transmission_count = GetContext().CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+
+        // Hits are sorted after compaction and rays at the end of a pass. Transmission scratch is only
+        // used in between, hit flags are consumed by compaction and shadow hits are written after
+        // shading and read before the end of a pass, so sorting reuses their memory.
+        // Shadow rays and next bounce rays are written by the same shading kernels and cannot be shared.
+        m_render_data->sort_keys[0] = m_render_data->transmission_indices[0];
+        m_render_data->sort_keys[1] = m_render_data->transmission_indices[1];
+        m_render_data->sort_values[0] = m_render_data->transmission_pending;
+        m_render_data->sort_values[1] = GetContext().CreateBuffer<int>(size, CL_MEM_READ_WRITE);
+        m_render_data->unsorted_compacted_indices = m_render_data->hits;
+        m_render_data->unsorted_pixelindices = m_render_data->shadowhits;
+
+        // Kernels take path start buffer even if regeneration is disabled, a single slot isn't read then
+        auto regeneration_size = m_path_regeneration > 0.f ? size : 0;
+        m_render_data->regeneration_rays = regeneration_size > 0 ?
+            GetContext().CreateBuffer<ray>(regeneration_size, CL_MEM_READ_WRITE) : CLWBuffer<ray>();
+        m_render_data->path_start = GetContext().CreateBuffer<int>(std::max<std::size_t>(regeneration_size, 1u), CL_MEM_READ_WRITE);
+        GetContext().FillBuffer(0, m_render_data->path_start, 0, m_render_data->path_start.GetElementCount());
+        m_render_data->regeneration_pending = false;
 
         // Recreate FR buffers
-        GetIntersector()->DeleteBuffer(m_render_data->fr_rays[0]);
-        GetIntersector()->DeleteBuffer(m_render_data->fr_rays[1]);
-        GetIntersector()->DeleteBuffer(m_render_data->fr_shadowrays);
-        GetIntersector()->DeleteBuffer(m_render_data->fr_hits);
-        GetIntersector()->DeleteBuffer(m_render_data->fr_shadowhits);
-        GetIntersector()->DeleteBuffer(m_render_data->fr_intersections);
-        GetIntersector()->DeleteBuffer(m_render_data->fr_hitcount);
+        ReleaseIntersectorBuffers();
 
         auto intersector = GetIntersector().get();
         m_render_data->fr_rays[0] = CreateFromOpenClBuffer(intersector, m_render_data->rays[0]);
@@ -154,6 +549,83 @@ namespace Baikal
         m_render_data->fr_shadowhits = CreateFromOpenClBuffer(intersector, m_render_data->shadowhits);
         m_render_data->fr_intersections = CreateFromOpenClBuffer(intersector, m_render_data->intersections);
         m_render_data->fr_hitcount = CreateFromOpenClBuffer(intersector, m_render_data->hitcount);
+        m_render_data->fr_shadowcount = CreateFromOpenClBuffer(intersector, m_render_data->shadowcount);
+        m_render_data->fr_transmission_count = CreateFromOpenClBuffer(intersector, m_render_data->transmission_count);
+    }
+
+    void PathTracingEstimator::CreateBatches(std::size_t size)
+    {
+        for (auto& batch : m_batches)
+        {
+            SwapBatch(*batch);
+            ReleaseIntersectorBuffers();
+            SwapBatch(*batch);
+        }
+
+        m_batches.clear();
+
+        if (m_in_flight_batches < 2 || size < m_in_flight_batches)
+        {
+            return;
+        }
+
+        auto context = GetContext();
+        cl_device_id device = context.GetDevice(0).GetID();
+        auto batch_size = (size + m_in_flight_batches - 1) / m_in_flight_batches;
+
+        for (auto i = 0u; i < m_in_flight_batches; ++i)
+        {
+            std::unique_ptr<Batch> batch(new Batch);
+
+            cl_int status = CL_SUCCESS;
+            batch->queue = clCreateCommandQueue(context, device, 0, &status);
+
+            if (status != CL_SUCCESS)
+            {
+                throw std::runtime_error("PathTracingEstimator: cannot create command queue");
+            }
+
+            // References are handed over to the wrapper, the batch keeps its own one of the queue
+            cl_context cl_context_handle = context;
+            cl_command_queue queue = batch->queue;
+            clRetainContext(cl_context_handle);
+            clRetainCommandQueue(queue);
+            batch->context = CLWContext::Create(cl_context_handle, &device, &queue, 1);
+
+            batch->data.reset(new RenderData);
+            batch->offset = i * batch_size;
+
+            // Buffers are created and initialized through the batch context
+            SwapBatch(*batch);
+
+            try
+            {
+                InitRenderData();
+                AllocateRenderData(std::min(batch_size, size - batch->offset));
+            }
+            catch (...)
+            {
+                SwapBatch(*batch);
+                throw;
+            }
+
+            SwapBatch(*batch);
+
+            // Divergence counters are incremented atomically, all batches count into the estimator ones
+            batch->data->divergence_counters = m_render_data->divergence_counters;
+
+            m_batches.push_back(std::move(batch));
+        }
+    }
+
+    void PathTracingEstimator::EnterIntersectorQueue()
+    {
+        OrderQueues(GetContext().GetCommandQueue(0), m_intersector_queue);
+    }
+
+    void PathTracingEstimator::LeaveIntersectorQueue()
+    {
+        OrderQueues(m_intersector_queue, GetContext().GetCommandQueue(0));
     }
 
     CLWBuffer<ray> PathTracingEstimator::GetRayBuffer() const
@@ -171,6 +643,94 @@ namespace Baikal
         return m_render_data->hitcount;
     }
 
+    CLWBuffer<ray> PathTracingEstimator::GetRegenerationRayBuffer() const
+    {
+        // Client is going to fill the rays up for the next estimate
+        m_render_data->regeneration_pending = m_render_data->regeneration_rays.GetElementCount() > 0;
+        return m_render_data->regeneration_rays;
+    }
+
+    bool PathTracingEstimator::SetPrimaryHitBuffer(CLWBuffer<RadeonRays::Intersection> hits, bool hits_valid)
+    {
+        m_render_data->primary_hits = hits;
+        m_render_data->primary_hits_valid = hits_valid;
+        return true;
+    }
+
+    std::uint32_t PathTracingEstimator::GetSceneFeatures() const
+    {
+        return m_scene_features;
+    }
+
+    void PathTracingEstimator::GetBuildOptions(ClwScene const& scene, QualityLevel quality, bool atomic_update, std::string& opts, std::string& uberv2_opts) const
+    {
+        std::string atomic_opts = atomic_update ? " -D BAIKAL_ATOMIC_RESOLVE " : "";
+        std::string caustic_opts = m_caustic_path_split ? " -D BAIKAL_CAUSTIC_SPLIT " : "";
+        std::string guiding_opts = m_path_guiding ? " -D BAIKAL_PATH_GUIDING " : "";
+        std::string cache_opts = m_radiance_cache ? " -D BAIKAL_RADIANCE_CACHE " : "";
+        std::string layer_opts = m_stochastic_layer_selection ? " -D BAIKAL_UBERV2_STOCHASTIC_LAYERS " : "";
+        layer_opts += m_energy_compensation ? " -D BAIKAL_UBERV2_ENERGY_COMPENSATION " : "";
+        // Probes for diffusion subsurface scattering are only traced by this estimator
+        layer_opts += " -D BAIKAL_UBERV2_DIFFUSION_SSS ";
+        std::string regeneration_opts = m_path_regeneration > 0.f ? " -D BAIKAL_PATH_REGENERATION " : "";
+        std::string resampling_opts = m_light_resampling ? " -D BAIKAL_LIGHT_RESAMPLING " : "";
+
+        std::string regularization_opts;
+        if (m_regularization != Regularization::kNone)
+        {
+            regularization_opts = " -D BAIKAL_MAX_RADIANCE=" + ToFloatLiteral(m_max_radiance) + " ";
+
+            if (m_regularization == Regularization::kClampRadianceAndRoughness)
+            {
+                regularization_opts += " -D BAIKAL_REGULARIZE_ROUGHNESS ";
+            }
+        }
+
+        // Precise estimates weight emissive hits with the exact light selection probability
+        std::string quality_opts = (quality == QualityLevel::kPrecise) ? " -D BAIKAL_EXACT_LIGHT_PDF " : "";
+
+#ifdef BAIKAL_NO_SOBOL_LUT
+        if (GetSamplerType() == SamplerType::kSobol || GetSamplerType() == SamplerType::kBlueNoiseSobol)
+        {
+            throw std::runtime_error("PathTracingEstimator: Sobol matrices are not available in this build, use SamplerType::kOwenSobol");
+        }
+#endif
+
+        auto sampler_opts = GetSamplerBuildOptions();
+
+        // Features the scene does not have are compiled out
+        std::string feature_opts;
+        feature_opts += (scene.features & ClwScene::kFeatureVolumes) ? "" : " -D BAIKAL_SCENE_NO_VOLUMES ";
+        feature_opts += (scene.features & ClwScene::kFeatureEnvironmentLight) ? "" : " -D BAIKAL_SCENE_NO_ENVIRONMENT_LIGHT ";
+        feature_opts += (scene.features & ClwScene::kFeatureAreaLights) ? "" : " -D BAIKAL_SCENE_NO_AREA_LIGHTS ";
+        feature_opts += (scene.features & ClwScene::kFeatureSingularLights) ? "" : " -D BAIKAL_SCENE_NO_SINGULAR_LIGHTS ";
+
+        opts = atomic_opts + regeneration_opts + resampling_opts + regularization_opts + sampler_opts + feature_opts;
+        uberv2_opts = atomic_opts + caustic_opts + guiding_opts + cache_opts + layer_opts + regeneration_opts + resampling_opts + regularization_opts + quality_opts + sampler_opts + feature_opts;
+    }
+
+    void PathTracingEstimator::CompileProgramsAsync(ClwScene const& scene, QualityLevel quality, bool atomic_update)
+    {
+        std::string opts;
+        std::string uberv2_opts;
+        GetBuildOptions(scene, quality, atomic_update, opts, uberv2_opts);
+
+        CompileProgramAsync(opts);
+
+        // Generic kernels render until the specialized ones are ready
+        if (m_async_shader_compilation)
+        {
+            m_uberv2_generic_kernels.CompileProgramAsync(uberv2_opts);
+        }
+
+        // Volume kernels use default options even if surfaces are shaded per material variant
+        m_uberv2_kernels.CompileProgramAsync(uberv2_opts);
+        for (auto const& variant_opts : m_material_variant_opts)
+        {
+            m_uberv2_kernels.CompileProgramAsync(uberv2_opts + variant_opts);
+        }
+    }
+
     void PathTracingEstimator::Estimate(
         ClwScene const& scene,
         std::size_t num_estimates,
@@ -178,12 +738,33 @@ namespace Baikal
         CLWBuffer<RadeonRays::float3> output,
         bool use_output_indices,
         bool atomic_update,
-        MissedPrimaryRaysHandler missedPrimaryRaysHandler
+        MissedPrimaryRaysHandler missedPrimaryRaysHandler,
+        PrimaryHitsHandler primaryHitsHandler
     )
     {
-        if (atomic_update)
+        BAIKAL_TRACE_SCOPE("estimator", "Estimate");
+
+        // Programs are cached per option set, so switching is cheap
+        std::string opts;
+        std::string uberv2_opts;
+        GetBuildOptions(scene, quality, atomic_update, opts, uberv2_opts);
+
+        if (scene.features != m_scene_features)
+        {
+            LogInfo("PathTracingEstimator: kernels specialized for scene features 0x", std::hex, scene.features, std::dec, "\n");
+            m_scene_features = scene.features;
+        }
+
+        SetDefaultBuildOptions(opts);
+        m_uberv2_kernels.SetDefaultBuildOptions(uberv2_opts);
+        m_uberv2_generic_kernels.SetDefaultBuildOptions(uberv2_opts);
+
+        // Render with generic kernels until the ones specialized for current materials are compiled
+        m_use_generic_kernels = m_async_shader_compilation && !m_uberv2_kernels.IsProgramReady();
+
+        if (m_use_generic_kernels)
         {
-            SetDefaultBuildOptions(" -D BAIKAL_ATOMIC_RESOLVE ");
+            m_uberv2_kernels.CompileProgramAsync();
         }
 
         auto has_visibility_buffer = HasIntermediateValueBuffer(IntermediateValue::kVisibility);
@@ -192,55 +773,268 @@ namespace Baikal
         auto has_opacity_buffer = HasIntermediateValueBuffer(IntermediateValue::kOpacity);
         auto opacity_buffer = GetIntermediateValueBuffer(IntermediateValue::kOpacity);
 
-        InitPathData(num_estimates, scene.camera_volume_index);
+        auto has_cost_buffer = HasIntermediateValueBuffer(IntermediateValue::kCost);
+        auto cost_buffer = GetIntermediateValueBuffer(IntermediateValue::kCost);
+
+        // Shadow ray transmission only tracks a single light sample per vertex,
+        // so extra samples are only taken in scenes without volumes
+        m_render_data->num_light_samples = (quality == QualityLevel::kRough || scene.num_volumes > 0) ?
+            1u : m_light_samples_per_vertex;
+
+        // Batches trace their own range of the work buffer, features which gather over all the paths,
+        // keep state per work buffer slot or hand buffers out to the client are estimated in one batch.
+        // Random sampler seeds by slot, so batches would repeat the sequences of each other.
+        bool pipelined = m_batches.size() > 1 &&
+            !m_path_guiding && !m_radiance_cache && !m_light_resampling && !m_caustic_path_split &&
+            m_path_regeneration == 0.f && m_render_data->primary_hits.GetElementCount() == 0 &&
+            m_shading_mode == ShadingMode::kWavefront && GetSamplerType() != SamplerType::kRandom &&
+            !has_visibility_buffer && !has_opacity_buffer && !has_cost_buffer &&
+            !missedPrimaryRaysHandler && !primaryHitsHandler;
+
+        if (!pipelined)
+        {
+            InitPathData(num_estimates, scene.camera_volume_index);
+        }
+
+        if (m_path_guiding)
+        {
+            PreparePathGuiding(scene);
+        }
+
+        if (m_radiance_cache)
+        {
+            PrepareRadianceCache(scene);
+        }
+
+        // Duplicate output indices would mix radiance of different paths
+        bool learn_guiding = m_path_guiding && !atomic_update;
+
+        // Reservoirs are kept per output pixel and reprojected with the camera, so every estimate
+        // should go to its own pixel of a perspective camera image
+        bool resample_lights = m_light_resampling && use_output_indices && !atomic_update &&
+            m_output_width > 0 && m_output_height > 0 &&
+            (scene.camera_type == CameraType::kPerspective || scene.camera_type == CameraType::kPhysicalPerspective) &&
+            (scene.num_volumes == 0 || quality == QualityLevel::kRough);
+
+        if (resample_lights)
+        {
+            PrepareLightResampling(scene, num_estimates);
+        }
+        m_render_data->resample_lights = resample_lights;
+
+        // Regenerated paths need rays of the next sample generated for this estimate. Features which
+        // treat passes as bounces of all paths or follow every primary ray are estimated without it.
+        bool regenerate_paths = m_render_data->regeneration_pending &&
+            m_render_data->regeneration_rays.GetElementCount() >= num_estimates &&
+            (scene.num_volumes == 0 || quality == QualityLevel::kRough) &&
+            !m_path_guiding && !m_radiance_cache && !m_caustic_path_split &&
+            !has_visibility_buffer && !has_opacity_buffer && !has_cost_buffer &&
+            !missedPrimaryRaysHandler && !primaryHitsHandler && !resample_lights;
+        m_render_data->regeneration_pending = false;
+
+        // Primary hits are only handed over for this estimate
+        auto primary_hits = m_render_data->primary_hits;
+        bool primary_hits_valid = m_render_data->primary_hits_valid && primary_hits.GetElementCount() >= num_estimates;
+        bool keep_primary_hits = !m_render_data->primary_hits_valid && primary_hits.GetElementCount() >= num_estimates;
+        m_render_data->primary_hits = CLWBuffer<Intersection>();
+        m_render_data->primary_hits_valid = false;
+
+        // Regenerated paths extend the estimate by the bounces they still have to do
+        auto num_passes = GetMaxBounces();
+
+        // Binds a batch for the scope, its commands go to the batch queue
+        struct BatchScope
+        {
+            PathTracingEstimator& estimator;
+            Batch& batch;
+
+            BatchScope(PathTracingEstimator& estimator, Batch& batch)
+                : estimator(estimator)
+                , batch(batch)
+            {
+                estimator.SwapBatch(batch);
+            }
+
+            ~BatchScope()
+            {
+                estimator.SwapBatch(batch);
+            }
+        };
+
+        if (pipelined)
+        {
+            // Rays generated by the client are split between the batches on the intersector queue
+            auto split_kernel = GetKernel("SplitRayCount");
+
+            for (auto& batch : m_batches)
+            {
+                auto& data = *batch->data;
+
+                batch->size = batch->offset < num_estimates ?
+                    std::min(num_estimates - batch->offset, data.rays[0].GetElementCount()) : 0;
+                batch->finished = batch->size == 0;
 
-        GetContext().CopyBuffer(0u, m_render_data->iota, m_render_data->pixelindices[0], 0, 0, num_estimates);
-        GetContext().CopyBuffer(0u, m_render_data->iota, m_render_data->pixelindices[1], 0, 0, num_estimates);
+                if (batch->finished)
+                {
+                    continue;
+                }
+
+                GetContext().CopyBuffer(0u, m_render_data->rays[0], data.rays[0], batch->offset, 0, batch->size);
+                GetContext().CopyBuffer(0u, use_output_indices ? m_render_data->output_indices : m_render_data->iota,
+                                        data.output_indices, batch->offset, 0, batch->size);
+                GetContext().CopyBuffer(0u, m_render_data->random, data.random, batch->offset, 0, batch->size);
+
+                int argc = 0;
+                split_kernel.SetArg(argc++, m_render_data->hitcount);
+                split_kernel.SetArg(argc++, (cl_int)batch->offset);
+                split_kernel.SetArg(argc++, (cl_int)batch->size);
+                split_kernel.SetArg(argc++, data.hitcount);
+
+                GetContext().Launch1D(0, 1, 1, split_kernel);
+
+                data.num_light_samples = m_render_data->num_light_samples;
+            }
+
+            // Batches address the output through their range of the indices
+            use_output_indices = true;
+
+            for (auto& batch : m_batches)
+            {
+                if (batch->finished)
+                {
+                    continue;
+                }
+
+                BatchScope scope(*this, *batch);
+                LeaveIntersectorQueue();
+                InitPathData(batch->size, scene.camera_volume_index);
+                GetContext().CopyBuffer(0u, m_render_data->iota, m_render_data->pixelindices[0], 0, 0, batch->size);
+                GetContext().CopyBuffer(0u, m_render_data->iota, m_render_data->pixelindices[1], 0, 0, batch->size);
+            }
+        }
+        else
+        {
+            GetContext().CopyBuffer(0u, m_render_data->iota, m_render_data->pixelindices[0], 0, 0, num_estimates);
+            GetContext().CopyBuffer(0u, m_render_data->iota, m_render_data->pixelindices[1], 0, 0, num_estimates);
+        }
+        ProfileMark("init_paths", ClwProfiler::kNoPass);
 
-        // Initialize first pass
-        for (auto pass = 0u; pass < GetMaxBounces(); ++pass)
+        // Runs a pass over the paths of the bound render data, returns false once they are all terminated
+        auto estimate_pass = [&](std::uint32_t pass, std::size_t size, CLWEvent& num_alive_event) -> bool
         {
+            BAIKAL_TRACE_SCOPE("estimator", "Bounce");
+
+            // Stop once all paths are terminated. The read was issued a pass ago
+            // and the rest of that pass is already queued, so the device stays busy.
+            if (pass > 0)
+            {
+                BAIKAL_TRACE_SCOPE("estimator", "WaitAlivePaths");
+                num_alive_event.Wait();
+                ProfileCount("alive", pass - 1, m_render_data->num_alive);
+
+                if (m_render_data->num_alive == 0)
+                {
+                    return false;
+                }
+            }
+
+            // Only paths alive after previous compaction can be processed in this pass,
+            // so launch kernels for them instead of the whole work buffer
+            auto num_active = (pass == 0) ? size : (std::size_t)m_render_data->num_alive;
+            ProfileCount("rays", pass, num_active);
+
             // Clear ray hits buffer
             // TODO: make it a kernel
             GetContext().FillBuffer(
                 0,
                 m_render_data->hits,
                 0,
-                m_render_data->hits.GetElementCount()
+                num_active
             );
 
-            // Intersect ray batch
-            GetIntersector()->QueryIntersection(
-                m_render_data->fr_rays[pass & 0x1],
-                m_render_data->fr_hitcount, (std::uint32_t)num_estimates,
-                m_render_data->fr_intersections,
-                nullptr,
-                nullptr
-            );
+            if (pass == 0 && primary_hits_valid)
+            {
+                // Primary rays are the ones the hits have been found for
+                GetContext().CopyBuffer(0u, primary_hits, m_render_data->intersections, 0, 0, num_active);
+                ProfileMark("primary_hit_cache", pass);
+            }
+            else
+            {
+                // Intersect ray batch
+                {
+                    BAIKAL_TRACE_SCOPE("radeonrays", "QueryIntersection");
+                    EnterIntersectorQueue();
+                    GetIntersector(scene)->QueryIntersection(
+                        m_render_data->fr_rays[pass & 0x1],
+                        m_render_data->fr_hitcount, (std::uint32_t)num_active,
+                        m_render_data->fr_intersections,
+                        nullptr,
+                        nullptr
+                    );
+                    LeaveIntersectorQueue();
+                }
+                ProfileMark("intersect", pass);
+
+                // Curves are not in the intersector, closer hits on them replace the triangle ones
+                if (scene.num_curve_shapes > 0)
+                {
+                    IntersectCurves(scene, pass, num_active);
+                    ProfileMark("intersect_curves", pass);
+                }
+
+                if (pass == 0 && keep_primary_hits)
+                {
+                    GetContext().CopyBuffer(0u, m_render_data->intersections, primary_hits, 0, 0, num_active);
+                }
+            }
+
+            // Hand out primary hits before volumes get a chance to replace them
+            if (pass == 0 && primaryHitsHandler)
+            {
+                primaryHitsHandler(
+                    m_render_data->rays[0],
+                    m_render_data->intersections,
+                    use_output_indices ? m_render_data->output_indices : m_render_data->iota,
+                    size);
+                ProfileMark("primary_hits", pass);
+            }
 
+            // Radiance added from now on has arrived along the directions sampled by the last bounce
+            if (learn_guiding && pass > 0)
+            {
+                SnapshotPathGuidingRadiance(pass, num_active, output, use_output_indices);
+            }
 
-            // Apply scattering only if we have volumes
-            bool has_some_volume = scene.num_volumes > 0;
+            // Apply scattering only if we have volumes, rough estimates ignore them
+            bool has_some_volume = (scene.num_volumes > 0) && (quality != QualityLevel::kRough);
 
             if (has_some_volume)
             {
-                SampleVolume(scene, pass, num_estimates, output, use_output_indices);
+                SampleVolume(scene, pass, num_active, output, use_output_indices);
+                ProfileMark("sample_volume", pass);
             }
 
             bool has_some_environment = scene.envmapidx > -1;
 
             if ((pass > 0) && has_some_environment)
             {
-                ShadeMiss(scene, pass, num_estimates, output, use_output_indices);
+                ShadeMiss(scene, pass, num_active, output, use_output_indices);
+                ProfileMark("shade_miss", pass);
+            }
+
+            // Count rays of this pass before missed paths are terminated
+            if (has_cost_buffer)
+            {
+                AccumulateRayCost(pass, num_active, cost_buffer, use_output_indices);
             }
 
             // Convert intersections to predicates
-            FilterPathStream(pass, num_estimates);
+            FilterPathStream(pass, num_active);
             
             // Gather opacity if we have opacity buffer
             if ((pass > 0) && has_opacity_buffer)
             {
-                GatherOpacity(scene, pass, num_estimates, opacity_buffer, use_output_indices);
+                GatherOpacity(scene, pass, num_active, opacity_buffer, use_output_indices);
             }
 
             // Compact batch
@@ -249,12 +1043,16 @@ namespace Baikal
                 m_render_data->hits,
                 m_render_data->iota,
                 m_render_data->compacted_indices,
-                (std::uint32_t)num_estimates,
+                (std::uint32_t)num_active,
                 m_render_data->hitcount
             );
 
+            // Fetch live path count to allow early termination
+            num_alive_event = GetContext().ReadBuffer(0, m_render_data->hitcount, &m_render_data->num_alive, 1);
+
             // Advance indices to keep pixel indices up to date
-            RestorePixelIndices(pass, num_estimates);
+            RestorePixelIndices(pass, num_active);
+            ProfileMark("compact", pass);
 
             // Shade missing rays
             if (pass == 0)
@@ -265,60 +1063,182 @@ namespace Baikal
                         m_render_data->intersections,
                         m_render_data->pixelindices[1],
                         use_output_indices ? m_render_data->output_indices : m_render_data->iota,
-                        num_estimates, output);
+                        size, output);
                 else if (scene.envmapidx > -1)
-                    ShadeBackground(scene, 0, num_estimates, output, use_output_indices);
+                    ShadeBackground(scene, 0, size, output, use_output_indices);
                 else
-                    AdvanceIterationCount(0, num_estimates, output, use_output_indices);
+                    AdvanceIterationCount(0, size, output, use_output_indices);
+                ProfileMark("shade_background", pass);
+            }
+
+            // Group hits by material to reduce shading divergence
+            if (m_sort_by_material)
+            {
+                SortHitsByMaterial(scene, pass, num_active);
+                ProfileMark("sort_hits", pass);
             }
 
             if (has_some_volume)
             {
                 // Shade hits
-                ShadeVolume(scene, pass, num_estimates, output, use_output_indices);
+                ShadeVolume(scene, pass, num_active, output, use_output_indices);
+                ProfileMark("shade_volume", pass);
             }
 
             // Shade hits
-            ShadeSurface(scene, pass, num_estimates, output, use_output_indices);
+            ShadeSurface(scene, pass, num_active, output, use_output_indices);
 
+            // Derived estimators add their contributions at the hits
+            OnSurfaceShaded(scene, pass, num_active, output, use_output_indices);
+            ProfileMark("shade_surface", pass);
 
             if (has_some_volume && GetMaxShadowRayTransmissionSteps() > 0)
             {
-                for (auto i = 0u; i < GetMaxShadowRayTransmissionSteps(); ++i)
-                {
-                    // Intersect ray batch
-                    GetIntersector()->QueryIntersection(m_render_data->fr_shadowrays,
-                                                        m_render_data->fr_hitcount,
-                                                        (std::uint32_t)num_estimates,
-                                                        m_render_data->fr_intersections,
-                                                        nullptr,
-                                                        nullptr);
-
-                    ApplyVolumeTransmission(scene, pass, num_estimates, output, use_output_indices);
-                }
+                TraceShadowRayTransmission(scene, pass, num_active, output, use_output_indices);
+                ProfileMark("shadow_transmission", pass);
             }
 
-            // Intersect shadow rays
-            GetIntersector()->QueryOcclusion(
-                m_render_data->fr_shadowrays,
-                m_render_data->fr_hitcount,
-                (std::uint32_t)num_estimates,
-                m_render_data->fr_shadowhits,
-                nullptr,
-                nullptr
-            );
+            // Shadow rays of all the light samples are intersected in one batch
+            auto num_light_samples = m_render_data->num_light_samples;
+            if (num_light_samples > 1)
+            {
+                auto scalekernel = GetKernel("ScaleRayCount");
+
+                int argc = 0;
+                scalekernel.SetArg(argc++, m_render_data->hitcount);
+                scalekernel.SetArg(argc++, (cl_int)num_light_samples);
+                scalekernel.SetArg(argc++, m_render_data->shadowcount);
+
+                GetContext().Launch1D(0, 1, 1, scalekernel);
+            }
+
+            // Visibility and reservoirs of first hits read the shadow hits of unoccluded samples as well
+            if (m_shadow_ray_culling > 0.f &&
+                !(pass == 0 && (has_visibility_buffer || m_render_data->resample_lights)))
+            {
+                CullShadowRays(pass, num_light_samples > 1 ? m_render_data->shadowcount : m_render_data->hitcount,
+                               num_active * num_light_samples);
+                ProfileMark("cull_shadow_rays", pass);
+            }
+
+            // Intersect shadow rays
+            {
+                BAIKAL_TRACE_SCOPE("radeonrays", "QueryOcclusion");
+                EnterIntersectorQueue();
+                GetIntersector(scene)->QueryOcclusion(
+                    m_render_data->fr_shadowrays,
+                    num_light_samples > 1 ? m_render_data->fr_shadowcount : m_render_data->fr_hitcount,
+                    (std::uint32_t)(num_active * num_light_samples),
+                    m_render_data->fr_shadowhits,
+                    nullptr,
+                    nullptr
+                );
+                LeaveIntersectorQueue();
+            }
+            ProfileMark("occlude", pass);
+
+            if (scene.num_curve_shapes > 0)
+            {
+                OccludeCurves(scene, num_active * num_light_samples);
+                ProfileMark("occlude_curves", pass);
+            }
+
+            if (has_cost_buffer)
+            {
+                AccumulateShadowRayCost(pass, num_active, cost_buffer, use_output_indices);
+            }
+
+            // Gather light samples and account for visibility, visibility output is resolved in the same launch
+            GatherLightSamples(scene, pass, num_active, output, pass == 0 && has_visibility_buffer ? visibility_buffer : output,
+                               pass == 0 && has_visibility_buffer, use_output_indices);
+            ProfileMark("gather_lights", pass);
+
+            // Passes past max bounces are only run for regenerated paths, the others stop at their last bounce
+            if ((pass + 1 >= GetMaxBounces()) && (pass + 1 < num_passes))
+            {
+                LimitPathLength(pass, num_active);
+            }
+
+            // Refill slots of terminated paths once the wavefront runs low. Live paths are counted
+            // before the compaction of this pass, so the count is known without waiting for the device.
+            auto num_next_rays = num_active;
+            if (regenerate_paths && (pass + 1 < GetMaxBounces()) &&
+                (num_active < m_path_regeneration * size))
+            {
+                RegeneratePaths(scene, pass, size, output, use_output_indices);
+                ProfileMark("regenerate_paths", pass);
 
-            // Gather light samples and account for visibility
-            GatherLightSamples(scene, pass, num_estimates, output, use_output_indices);
+                num_passes = pass + 1 + GetMaxBounces();
+                num_next_rays = size;
 
-            if (pass == 0 && has_visibility_buffer)
+                // Live path count of the next pass includes regenerated paths
+                num_alive_event = GetContext().ReadBuffer(0, m_render_data->hitcount, &m_render_data->num_alive, 1);
+            }
+
+            // Improve coherence of the next bounce traversal
+            if ((pass + 1 < num_passes) && (pass < 32) && (m_ray_sorting_mask & (1u << pass)))
             {
-                // Run visibility resolve kernel
-                GatherVisibility(scene, pass, num_estimates, visibility_buffer, use_output_indices);
+                SortRays(scene, pass, num_next_rays);
+                ProfileMark("sort_rays", pass);
             }
 
             GetContext().Flush(0);
+            return true;
+        };
+
+        if (!pipelined)
+        {
+            CLWEvent num_alive_event;
+
+            for (auto pass = 0u; pass < num_passes; ++pass)
+            {
+                if (!estimate_pass(pass, num_estimates, num_alive_event))
+                {
+                    break;
+                }
+            }
+        }
+        else
+        {
+            // Passes of the batches are interleaved, so one is shaded on its queue while the rays of the other
+            // are traced. Every batch waits for its live path count a whole batch later than it has been read.
+            bool active = true;
+            for (auto pass = 0u; pass < num_passes && active; ++pass)
+            {
+                active = false;
+
+                for (auto& batch : m_batches)
+                {
+                    if (batch->finished)
+                    {
+                        continue;
+                    }
+
+                    BatchScope scope(*this, *batch);
+                    batch->finished = !estimate_pass(pass, batch->size, batch->num_alive_event);
+                    active = active || !batch->finished;
+                }
+            }
+
+            // Commands queued after the estimate should see the output of all the batches
+            for (auto& batch : m_batches)
+            {
+                BatchScope scope(*this, *batch);
+                EnterIntersectorQueue();
+            }
+        }
+
+        if (learn_guiding)
+        {
+            UpdatePathGuiding(num_estimates, output, use_output_indices);
         }
+
+        // Training paths are traced with the same rule, so they do not record under atomic update
+        if (m_radiance_cache && !atomic_update)
+        {
+            UpdateRadianceCache(num_estimates, output, use_output_indices);
+        }
+
         // Gather opacity if we have opacity buffer
         if (has_opacity_buffer)
         {
@@ -327,7 +1247,18 @@ namespace Baikal
             GatherOpacity(scene, GetMaxBounces(), num_estimates, opacity_buffer, use_output_indices);
             GetContext().Flush(0);
         }
-        ++m_sample_counter;
+        // Regenerated paths have taken the next sample index
+        bool regenerated = num_passes > GetMaxBounces();
+
+        if (regenerated)
+        {
+            GetContext().FillBuffer(0, m_render_data->path_start, 0, num_estimates);
+        }
+
+        m_render_data->resample_lights = false;
+
+        ProfileMark("finish_paths", ClwProfiler::kNoPass);
+        m_sample_counter += regenerated ? 2 : 1;
     }
 
     void PathTracingEstimator::InitPathData(std::size_t size, int volume_idx)
@@ -342,7 +1273,7 @@ namespace Baikal
         init_kernel.SetArg(argc++, m_render_data->paths);
 
         {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, init_kernel);
+            LaunchTuned(init_kernel, "InitPathData", size);
         }
     }
 
@@ -354,47 +1285,112 @@ namespace Baikal
         bool use_output_indices
     )
     {
-        // Fetch kernel
-        auto shadekernel = m_uberv2_kernels.GetKernel("ShadeSurfaceUberV2");
+        bool persistent = (m_shading_mode == ShadingMode::kPersistentThreads);
+        auto kernel_name = persistent ? "ShadeSurfaceUberV2Persistent" : "ShadeSurfaceUberV2";
+
+        // Fetch kernels, every material variant shades its own hits and skips the rest
+        std::vector<CLWKernel> shadekernels;
+
+        if (m_use_generic_kernels || m_material_variant_opts.empty())
+        {
+            shadekernels.push_back(GetUberV2Kernels().GetKernel(kernel_name));
+        }
+        else
+        {
+            // Explicit options replace the default ones
+            auto default_opts = m_uberv2_kernels.GetDefaultBuildOpts();
+
+            for (auto const& variant_opts : m_material_variant_opts)
+            {
+                shadekernels.push_back(m_uberv2_kernels.GetKernel(kernel_name, default_opts + variant_opts));
+            }
+        }
 
         auto output_indices = use_output_indices ? m_render_data->output_indices : m_render_data->iota;
 
-        // Set kernel parameters
-        int argc = 0;
-        shadekernel.SetArg(argc++, m_render_data->rays[pass & 0x1]);
-        shadekernel.SetArg(argc++, m_render_data->intersections);
-        shadekernel.SetArg(argc++, m_render_data->compacted_indices);
-        shadekernel.SetArg(argc++, m_render_data->pixelindices[pass & 0x1]);
-        shadekernel.SetArg(argc++, output_indices);
-        shadekernel.SetArg(argc++, m_render_data->hitcount);
-        shadekernel.SetArg(argc++, scene.vertices);
-        shadekernel.SetArg(argc++, scene.normals);
-        shadekernel.SetArg(argc++, scene.uvs);
-        shadekernel.SetArg(argc++, scene.indices);
-        shadekernel.SetArg(argc++, scene.shapes);
-        shadekernel.SetArg(argc++, scene.material_attributes);
-        shadekernel.SetArg(argc++, scene.textures);
-        shadekernel.SetArg(argc++, scene.texturedata);
-        shadekernel.SetArg(argc++, scene.envmapidx);
-        shadekernel.SetArg(argc++, scene.lights);
-        shadekernel.SetArg(argc++, scene.light_distributions);
-        shadekernel.SetArg(argc++, scene.num_lights);
-        shadekernel.SetArg(argc++, rand_uint());
-        shadekernel.SetArg(argc++, m_render_data->random);
-        shadekernel.SetArg(argc++, m_render_data->sobolmat);
-        shadekernel.SetArg(argc++, pass);
-        shadekernel.SetArg(argc++, m_sample_counter);
-        shadekernel.SetArg(argc++, scene.volumes);
-        shadekernel.SetArg(argc++, m_render_data->shadowrays);
-        shadekernel.SetArg(argc++, m_render_data->lightsamples);
-        shadekernel.SetArg(argc++, m_render_data->paths);
-        shadekernel.SetArg(argc++, m_render_data->rays[(pass + 1) & 0x1]);
-        shadekernel.SetArg(argc++, output);
-        shadekernel.SetArg(argc++, scene.input_map_data);
+        // Only first hits are resampled
+        bool resample_lights = m_render_data->resample_lights && pass == 0;
 
-        // Run shading kernel
+        for (auto& shadekernel : shadekernels)
         {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, shadekernel);
+            // Set kernel parameters
+            int argc = 0;
+            shadekernel.SetArg(argc++, m_render_data->rays[pass & 0x1]);
+            shadekernel.SetArg(argc++, m_render_data->intersections);
+            shadekernel.SetArg(argc++, m_render_data->compacted_indices);
+            shadekernel.SetArg(argc++, m_render_data->pixelindices[pass & 0x1]);
+            shadekernel.SetArg(argc++, output_indices);
+            shadekernel.SetArg(argc++, m_render_data->hitcount);
+            shadekernel.SetArg(argc++, scene.vertices);
+            shadekernel.SetArg(argc++, scene.normals);
+            shadekernel.SetArg(argc++, scene.uvs);
+            shadekernel.SetArg(argc++, scene.tangents);
+            shadekernel.SetArg(argc++, scene.indices);
+            shadekernel.SetArg(argc++, scene.shapes);
+            shadekernel.SetArg(argc++, scene.instances);
+            shadekernel.SetArg(argc++, scene.instance_transforms);
+            shadekernel.SetArg(argc++, scene.num_base_shapes);
+            shadekernel.SetArg(argc++, scene.material_attributes);
+            shadekernel.SetArg(argc++, scene.textures);
+            shadekernel.SetArg(argc++, scene.texturedata);
+            shadekernel.SetArg(argc++, scene.texture_requests);
+            if (scene.texture_images)
+            {
+                shadekernel.SetArg(argc++, scene.texture_images.get());
+            }
+            shadekernel.SetArg(argc++, scene.envmapidx);
+            shadekernel.SetArg(argc++, scene.lights);
+            shadekernel.SetArg(argc++, scene.light_distributions);
+            shadekernel.SetArg(argc++, scene.envmap_distribution);
+            shadekernel.SetArg(argc++, scene.env_irradiance);
+            shadekernel.SetArg(argc++, scene.area_light_map);
+            shadekernel.SetArg(argc++, scene.num_lights);
+            shadekernel.SetArg(argc++, GetLaunchSeed(LaunchSeed::kShadeSurface, pass));
+            shadekernel.SetArg(argc++, m_render_data->random);
+            shadekernel.SetArg(argc++, m_render_data->sobolmat);
+            shadekernel.SetArg(argc++, pass);
+            shadekernel.SetArg(argc++, m_sample_counter);
+            shadekernel.SetArg(argc++, (cl_int)m_rr_min_bounce);
+            shadekernel.SetArg(argc++, (cl_int)m_render_data->num_light_samples);
+            shadekernel.SetArg(argc++, scene.volumes);
+            shadekernel.SetArg(argc++, m_render_data->shadowrays);
+            shadekernel.SetArg(argc++, m_render_data->lightsamples);
+            shadekernel.SetArg(argc++, m_render_data->paths);
+            shadekernel.SetArg(argc++, m_render_data->path_start);
+            shadekernel.SetArg(argc++, m_render_data->rays[(pass + 1) & 0x1]);
+            shadekernel.SetArg(argc++, output);
+            shadekernel.SetArg(argc++, scene.input_map_data);
+            shadekernel.SetArg(argc++, scene.geometry_requests);
+            shadekernel.SetArg(argc++, m_render_data->guiding);
+            shadekernel.SetArg(argc++, m_render_data->guiding_vertices);
+            shadekernel.SetArg(argc++, m_render_data->cache_keys);
+            shadekernel.SetArg(argc++, m_render_data->cache_radiance);
+            shadekernel.SetArg(argc++, (cl_int)(m_render_data->cache_keys.GetElementCount() - 1));
+            shadekernel.SetArg(argc++, m_radiance_cache_cell);
+            shadekernel.SetArg(argc++, m_render_data->cache_vertices);
+            shadekernel.SetArg(argc++, m_render_data->reservoirs[m_render_data->reservoir_index ^ 1]);
+            shadekernel.SetArg(argc++, m_render_data->reservoirs[m_render_data->reservoir_index]);
+            shadekernel.SetArg(argc++, m_render_data->reservoir_cameras[m_render_data->reservoir_index ^ 1]);
+            shadekernel.SetArg(argc++, (cl_int)(resample_lights ? m_output_width : 0u));
+            shadekernel.SetArg(argc++, (cl_int)(resample_lights ? m_output_height : 0u));
+            shadekernel.SetArg(argc++, (cl_int)(resample_lights && m_render_data->reservoir_history));
+
+            if (persistent)
+            {
+                shadekernel.SetArg(argc++, m_render_data->work_counter);
+
+                // Reset work queue head
+                GetContext().FillBuffer(0, m_render_data->work_counter, 0, 1);
+
+                // Only launch as many threads as the device can keep resident,
+                // they will pull the hits from the queue themselves
+                GetContext().Launch1D(0, GetPersistentWorkSize(), kWorkGroupSize, shadekernel);
+            }
+            else
+            {
+                // Run shading kernel
+                LaunchTuned(shadekernel, "ShadeSurfaceUberV2", size);
+            }
         }
     }
 
@@ -407,7 +1403,7 @@ namespace Baikal
     )
     {
         // Fetch kernel
-        auto shadekernel = m_uberv2_kernels.GetKernel("ShadeVolumeUberV2");
+        auto shadekernel = GetUberV2Kernels().GetKernel("ShadeVolumeUberV2");
 
         auto output_indices = use_output_indices ? m_render_data->output_indices : m_render_data->iota;
 
@@ -422,16 +1418,26 @@ namespace Baikal
         shadekernel.SetArg(argc++, scene.vertices);
         shadekernel.SetArg(argc++, scene.normals);
         shadekernel.SetArg(argc++, scene.uvs);
+        shadekernel.SetArg(argc++, scene.tangents);
         shadekernel.SetArg(argc++, scene.indices);
         shadekernel.SetArg(argc++, scene.shapes);
+        shadekernel.SetArg(argc++, scene.instances);
+        shadekernel.SetArg(argc++, scene.instance_transforms);
+        shadekernel.SetArg(argc++, scene.num_base_shapes);
         shadekernel.SetArg(argc++, scene.material_attributes);
         shadekernel.SetArg(argc++, scene.textures);
         shadekernel.SetArg(argc++, scene.texturedata);
+        shadekernel.SetArg(argc++, scene.texture_requests);
+        if (scene.texture_images)
+        {
+            shadekernel.SetArg(argc++, scene.texture_images.get());
+        }
         shadekernel.SetArg(argc++, scene.envmapidx);
         shadekernel.SetArg(argc++, scene.lights);
         shadekernel.SetArg(argc++, scene.light_distributions);
+        shadekernel.SetArg(argc++, scene.envmap_distribution);
         shadekernel.SetArg(argc++, scene.num_lights);
-        shadekernel.SetArg(argc++, rand_uint());
+        shadekernel.SetArg(argc++, GetLaunchSeed(LaunchSeed::kShadeVolume, pass));
         shadekernel.SetArg(argc++, m_render_data->random);
         shadekernel.SetArg(argc++, m_render_data->sobolmat);
         shadekernel.SetArg(argc++, pass);
@@ -446,7 +1452,7 @@ namespace Baikal
 
         // Run shading kernel
         {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, shadekernel);
+            LaunchTuned(shadekernel, "ShadeVolumeUberV2", size);
         }
     }
 
@@ -470,9 +1476,15 @@ namespace Baikal
         sample_kernel.SetArg(argc++, output_indices);
         sample_kernel.SetArg(argc++, m_render_data->hitcount);
         sample_kernel.SetArg(argc++, scene.volumes);
+        sample_kernel.SetArg(argc++, scene.volume_grids);
         sample_kernel.SetArg(argc++, scene.textures);
         sample_kernel.SetArg(argc++, scene.texturedata);
-        sample_kernel.SetArg(argc++, rand_uint());
+        sample_kernel.SetArg(argc++, scene.texture_requests);
+        if (scene.texture_images)
+        {
+            sample_kernel.SetArg(argc++, scene.texture_images.get());
+        }
+        sample_kernel.SetArg(argc++, GetLaunchSeed(LaunchSeed::kSampleVolume, pass));
         sample_kernel.SetArg(argc++, m_render_data->random);
         sample_kernel.SetArg(argc++, m_render_data->sobolmat);
         sample_kernel.SetArg(argc++, pass);
@@ -483,7 +1495,7 @@ namespace Baikal
 
         // Run shading kernel
         {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, sample_kernel);
+            LaunchTuned(sample_kernel, "SampleVolume", size);
         }
     }
 
@@ -511,12 +1523,17 @@ namespace Baikal
         misskernel.SetArg(argc++, scene.envmapidx);
         misskernel.SetArg(argc++, scene.textures);
         misskernel.SetArg(argc++, scene.texturedata);
+        misskernel.SetArg(argc++, scene.texture_requests);
+        if (scene.texture_images)
+        {
+            misskernel.SetArg(argc++, scene.texture_images.get());
+        }
         misskernel.SetArg(argc++, m_render_data->paths);
         misskernel.SetArg(argc++, scene.volumes);
         misskernel.SetArg(argc++, output);
 
         {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, misskernel);
+            LaunchTuned(misskernel, "ShadeBackgroundEnvMap", size);
         }
     }
 
@@ -525,6 +1542,8 @@ namespace Baikal
         int pass,
         std::size_t size,
         CLWBuffer<RadeonRays::float3> output,
+        CLWBuffer<RadeonRays::float3> visibility,
+        bool gather_visibility,
         bool use_output_indices
     )
     {
@@ -540,12 +1559,90 @@ namespace Baikal
         gatherkernel.SetArg(argc++, m_render_data->hitcount);
         gatherkernel.SetArg(argc++, m_render_data->shadowhits);
         gatherkernel.SetArg(argc++, m_render_data->lightsamples);
+        gatherkernel.SetArg(argc++, (cl_int)m_render_data->num_light_samples);
         gatherkernel.SetArg(argc++, m_render_data->paths);
+        gatherkernel.SetArg(argc++, m_render_data->reservoirs[m_render_data->reservoir_index]);
+        gatherkernel.SetArg(argc++, (cl_int)(m_render_data->resample_lights && pass == 0));
+        gatherkernel.SetArg(argc++, (cl_int)gather_visibility);
+        gatherkernel.SetArg(argc++, visibility);
         gatherkernel.SetArg(argc++, output);
 
         // Run shading kernel
         {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, gatherkernel);
+            LaunchTuned(gatherkernel, "GatherLightSamples", size);
+        }
+    }
+
+    void PathTracingEstimator::TraceShadowRayTransmission(ClwScene const& scene, int pass, std::size_t size, CLWBuffer<RadeonRays::float3> output, bool use_output_indices)
+    {
+        // Rays of the current bounce are shaded already, remaining shadow rays are gathered into their buffer
+        CLWEvent num_rays_event;
+
+        for (auto i = 0u; i < GetMaxShadowRayTransmissionSteps(); ++i)
+        {
+            // Only the rays moved past a volume boundary are intersected again, with any other
+            // hit or a miss their visibility is known after the step
+            auto ray_indices = (i == 0) ? m_render_data->iota : m_render_data->transmission_indices[i & 0x1];
+            auto num_rays = (i == 0) ? m_render_data->hitcount : m_render_data->transmission_count;
+
+            if (i == 0)
+            {
+                EnterIntersectorQueue();
+                GetIntersector(scene)->QueryIntersection(m_render_data->fr_shadowrays,
+                                                    m_render_data->fr_hitcount,
+                                                    (std::uint32_t)size,
+                                                    m_render_data->fr_intersections,
+                                                    nullptr,
+                                                    nullptr);
+                LeaveIntersectorQueue();
+            }
+            else
+            {
+                num_rays_event.Wait();
+
+                if (m_render_data->num_transmission_rays == 0)
+                {
+                    break;
+                }
+
+                auto gather_kernel = GetKernel("GatherShadowRays");
+
+                int argc = 0;
+                gather_kernel.SetArg(argc++, ray_indices);
+                gather_kernel.SetArg(argc++, num_rays);
+                gather_kernel.SetArg(argc++, m_render_data->shadowrays);
+                gather_kernel.SetArg(argc++, m_render_data->rays[pass & 0x1]);
+
+                auto num_gathered = (std::size_t)m_render_data->num_transmission_rays;
+                LaunchTuned(gather_kernel, "GatherShadowRays", num_gathered);
+
+                EnterIntersectorQueue();
+                GetIntersector(scene)->QueryIntersection(m_render_data->fr_rays[pass & 0x1],
+                                                    m_render_data->fr_transmission_count,
+                                                    (std::uint32_t)num_gathered,
+                                                    m_render_data->fr_intersections,
+                                                    nullptr,
+                                                    nullptr);
+                LeaveIntersectorQueue();
+            }
+
+            GetContext().FillBuffer(0, m_render_data->transmission_pending, 0, size);
+
+            ApplyVolumeTransmission(scene, pass, size, ray_indices, num_rays, output, use_output_indices);
+
+            if (i + 1 < GetMaxShadowRayTransmissionSteps())
+            {
+                m_render_data->pp.Compact(
+                    0,
+                    m_render_data->transmission_pending,
+                    ray_indices,
+                    m_render_data->transmission_indices[(i + 1) & 0x1],
+                    (std::uint32_t)size,
+                    m_render_data->transmission_count
+                );
+
+                num_rays_event = GetContext().ReadBuffer(0, m_render_data->transmission_count, &m_render_data->num_transmission_rays, 1);
+            }
         }
     }
 
@@ -553,12 +1650,14 @@ namespace Baikal
         ClwScene const& scene,
         int pass,
         std::size_t size,
+        CLWBuffer<int> ray_indices,
+        CLWBuffer<int> num_rays,
         CLWBuffer<RadeonRays::float3> output,
         bool use_output_indices
     )
     {
         // Fetch kernel
-        auto volumekernel = m_uberv2_kernels.GetKernel("ApplyVolumeTransmissionUberV2");
+        auto volumekernel = GetUberV2Kernels().GetKernel("ApplyVolumeTransmissionUberV2");
 
         auto output_indices = use_output_indices ? m_render_data->output_indices : m_render_data->iota;
 
@@ -567,51 +1666,32 @@ namespace Baikal
         volumekernel.SetArg(argc++, m_render_data->pixelindices[pass & 0x1]);
         volumekernel.SetArg(argc++, output_indices);
         volumekernel.SetArg(argc++, m_render_data->shadowrays);
-        volumekernel.SetArg(argc++, m_render_data->hitcount);
+        volumekernel.SetArg(argc++, num_rays);
+        volumekernel.SetArg(argc++, ray_indices);
         volumekernel.SetArg(argc++, m_render_data->intersections);
         volumekernel.SetArg(argc++, m_render_data->paths);
         volumekernel.SetArg(argc++, scene.vertices);
         volumekernel.SetArg(argc++, scene.normals);
         volumekernel.SetArg(argc++, scene.uvs);
+        volumekernel.SetArg(argc++, scene.tangents);
         volumekernel.SetArg(argc++, scene.indices);
         volumekernel.SetArg(argc++, scene.shapes);
+        volumekernel.SetArg(argc++, scene.instances);
+        volumekernel.SetArg(argc++, scene.instance_transforms);
+        volumekernel.SetArg(argc++, scene.num_base_shapes);
         volumekernel.SetArg(argc++, scene.material_attributes);
         volumekernel.SetArg(argc++, scene.volumes);
+        volumekernel.SetArg(argc++, scene.volume_grids);
+        volumekernel.SetArg(argc++, GetLaunchSeed(LaunchSeed::kApplyVolumeTransmission, pass));
         volumekernel.SetArg(argc++, m_render_data->lightsamples);
         volumekernel.SetArg(argc++, m_render_data->shadowhits);
+        volumekernel.SetArg(argc++, m_render_data->transmission_pending);
         volumekernel.SetArg(argc++, output);
         volumekernel.SetArg(argc++, scene.input_map_data);
 
         // Run shading kernel
         {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, volumekernel);
-        }
-    }
-
-    void PathTracingEstimator::GatherVisibility(
-        ClwScene const& scene,
-        int pass,
-        std::size_t size,
-        CLWBuffer<RadeonRays::float3> output,
-        bool use_output_indices
-    )
-    {
-        // Fetch kernel
-        auto gatherkernel = GetKernel("GatherVisibility");
-
-        auto output_indices = use_output_indices ? m_render_data->output_indices : m_render_data->iota;
-
-        // Set kernel parameters
-        int argc = 0;
-        gatherkernel.SetArg(argc++, m_render_data->pixelindices[pass & 0x1]);
-        gatherkernel.SetArg(argc++, output_indices);
-        gatherkernel.SetArg(argc++, m_render_data->hitcount);
-        gatherkernel.SetArg(argc++, m_render_data->shadowhits);
-        gatherkernel.SetArg(argc++, output);
-
-        // Run shading kernel
-        {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, gatherkernel);
+            LaunchTuned(volumekernel, "ApplyVolumeTransmissionUberV2", size);
         }
     }
 
@@ -638,7 +1718,7 @@ namespace Baikal
 
         // Run shading kernel
         {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, gatherkernel);
+            LaunchTuned(gatherkernel, "GatherOpacity", size);
         }
     }
 
@@ -656,7 +1736,7 @@ namespace Baikal
 
         // Run shading kernel
         {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, restorekernel);
+            LaunchTuned(restorekernel, "RestorePixelIndices", size);
         }
     }
 
@@ -672,7 +1752,110 @@ namespace Baikal
         restorekernel.SetArg(argc++, m_render_data->hits);
 
         {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, restorekernel);
+            LaunchTuned(restorekernel, "FilterPathStream", size);
+        }
+    }
+
+    void PathTracingEstimator::RegeneratePaths(ClwScene const& scene, int pass, std::size_t size, CLWBuffer<RadeonRays::float3> output, bool use_output_indices)
+    {
+        auto output_indices = use_output_indices ? m_render_data->output_indices : m_render_data->iota;
+
+        // Paths terminated by this pass still have their entries in the next pass ray list, reuse them
+        {
+            auto regeneratekernel = GetKernel("RegenerateTerminatedPaths");
+
+            int argc = 0;
+            regeneratekernel.SetArg(argc++, m_render_data->regeneration_rays);
+            regeneratekernel.SetArg(argc++, m_render_data->hitcount);
+            regeneratekernel.SetArg(argc++, m_render_data->pixelindices[pass & 0x1]);
+            regeneratekernel.SetArg(argc++, output_indices);
+            regeneratekernel.SetArg(argc++, pass + 1);
+            regeneratekernel.SetArg(argc++, (cl_int)scene.camera_volume_index);
+            regeneratekernel.SetArg(argc++, m_render_data->path_start);
+            regeneratekernel.SetArg(argc++, m_render_data->paths);
+            regeneratekernel.SetArg(argc++, m_render_data->rays[(pass + 1) & 0x1]);
+            regeneratekernel.SetArg(argc++, output);
+
+            LaunchTuned(regeneratekernel, "RegenerateTerminatedPaths", size);
+        }
+
+        // Paths terminated earlier are appended to the list
+        {
+            auto regeneratekernel = GetKernel("RegenerateFreePaths");
+
+            int argc = 0;
+            regeneratekernel.SetArg(argc++, m_render_data->regeneration_rays);
+            regeneratekernel.SetArg(argc++, (cl_int)size);
+            regeneratekernel.SetArg(argc++, output_indices);
+            regeneratekernel.SetArg(argc++, pass + 1);
+            regeneratekernel.SetArg(argc++, (cl_int)scene.camera_volume_index);
+            regeneratekernel.SetArg(argc++, m_render_data->path_start);
+            regeneratekernel.SetArg(argc++, m_render_data->paths);
+            regeneratekernel.SetArg(argc++, m_render_data->hitcount);
+            regeneratekernel.SetArg(argc++, m_render_data->pixelindices[pass & 0x1]);
+            regeneratekernel.SetArg(argc++, m_render_data->rays[(pass + 1) & 0x1]);
+            regeneratekernel.SetArg(argc++, output);
+
+            LaunchTuned(regeneratekernel, "RegenerateFreePaths", size);
+        }
+    }
+
+    void PathTracingEstimator::LimitPathLength(int pass, std::size_t size)
+    {
+        auto limitkernel = GetKernel("LimitPathLength");
+
+        int argc = 0;
+        limitkernel.SetArg(argc++, m_render_data->hitcount);
+        limitkernel.SetArg(argc++, m_render_data->pixelindices[pass & 0x1]);
+        limitkernel.SetArg(argc++, m_render_data->path_start);
+        limitkernel.SetArg(argc++, pass + 1);
+        limitkernel.SetArg(argc++, (cl_int)GetMaxBounces());
+        limitkernel.SetArg(argc++, m_render_data->paths);
+        limitkernel.SetArg(argc++, m_render_data->rays[(pass + 1) & 0x1]);
+
+        {
+            LaunchTuned(limitkernel, "LimitPathLength", size);
+        }
+    }
+
+    void PathTracingEstimator::IntersectCurves(ClwScene const& scene, int pass, std::size_t size)
+    {
+        auto curvekernel = GetKernel("IntersectCurves");
+
+        int argc = 0;
+        curvekernel.SetArg(argc++, m_render_data->rays[pass & 0x1]);
+        curvekernel.SetArg(argc++, m_render_data->hitcount);
+        curvekernel.SetArg(argc++, scene.vertices);
+        curvekernel.SetArg(argc++, scene.shapes);
+        curvekernel.SetArg(argc++, scene.curve_nodes);
+        curvekernel.SetArg(argc++, scene.curve_segments);
+        curvekernel.SetArg(argc++, scene.curve_shapes);
+        curvekernel.SetArg(argc++, scene.num_curve_shapes);
+        curvekernel.SetArg(argc++, scene.geometry_requests);
+        curvekernel.SetArg(argc++, m_render_data->intersections);
+
+        {
+            LaunchTuned(curvekernel, "IntersectCurves", size);
+        }
+    }
+
+    void PathTracingEstimator::OccludeCurves(ClwScene const& scene, std::size_t size)
+    {
+        auto curvekernel = GetKernel("OccludeCurves");
+
+        int argc = 0;
+        curvekernel.SetArg(argc++, m_render_data->shadowrays);
+        curvekernel.SetArg(argc++, m_render_data->num_light_samples > 1 ? m_render_data->shadowcount : m_render_data->hitcount);
+        curvekernel.SetArg(argc++, scene.vertices);
+        curvekernel.SetArg(argc++, scene.shapes);
+        curvekernel.SetArg(argc++, scene.curve_nodes);
+        curvekernel.SetArg(argc++, scene.curve_segments);
+        curvekernel.SetArg(argc++, scene.curve_shapes);
+        curvekernel.SetArg(argc++, scene.num_curve_shapes);
+        curvekernel.SetArg(argc++, m_render_data->shadowhits);
+
+        {
+            LaunchTuned(curvekernel, "OccludeCurves", size);
         }
     }
 
@@ -696,40 +1879,78 @@ namespace Baikal
         misskernel.SetArg(argc++, m_render_data->hitcount);
         misskernel.SetArg(argc++, scene.lights);
         misskernel.SetArg(argc++, scene.light_distributions);
+        misskernel.SetArg(argc++, scene.envmap_distribution);
         misskernel.SetArg(argc++, scene.num_lights);
         misskernel.SetArg(argc++, scene.envmapidx);
+        misskernel.SetArg(argc++, (cl_int)m_render_data->num_light_samples);
         misskernel.SetArg(argc++, scene.textures);
         misskernel.SetArg(argc++, scene.texturedata);
+        misskernel.SetArg(argc++, scene.texture_requests);
+        if (scene.texture_images)
+        {
+            misskernel.SetArg(argc++, scene.texture_images.get());
+        }
         misskernel.SetArg(argc++, m_render_data->paths);
+        misskernel.SetArg(argc++, m_render_data->path_start);
+        misskernel.SetArg(argc++, pass);
         misskernel.SetArg(argc++, scene.volumes);
         misskernel.SetArg(argc++, output);
 
         {
-            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, misskernel);
+            LaunchTuned(misskernel, "ShadeMiss", size);
         }
     }
 
     void PathTracingEstimator::SetRandomSeed(std::uint32_t seed)
     {
-        std::srand(seed);
+        m_random_seed = seed;
 
         auto size = m_render_data->random.GetElementCount();
 
         if (size != 0)
         {
-            std::vector<std::uint32_t> random_buffer(size);
-            std::generate(random_buffer.begin(), random_buffer.end(), []() {return std::rand() + 3; });
+            auto random_buffer = GenerateRandomBuffer(size);
             GetContext().WriteBuffer(0, m_render_data->random, random_buffer.data(), size).Wait();
         }
     }
 
+    void PathTracingEstimator::SetSampleIndex(std::uint32_t index)
+    {
+        m_sample_counter = index;
+    }
+
+    std::uint32_t PathTracingEstimator::GetLaunchSeed(LaunchSeed launch, int pass) const
+    {
+        return Baikal::GetLaunchSeed(m_random_seed, m_sample_counter, launch, static_cast<std::uint32_t>(pass));
+    }
+
+    std::vector<std::uint32_t> PathTracingEstimator::GenerateRandomBuffer(std::size_t size, std::uint32_t stream) const
+    {
+        std::vector<std::uint32_t> random_buffer(size);
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            // Same range as the former std::rand() + 3 values, kernels avoid zero and small scrambles
+            auto seed = Baikal::GetLaunchSeed(m_random_seed, static_cast<std::uint32_t>(i), LaunchSeed::kRandomBuffer, stream);
+            random_buffer[i] = (seed >> 1) + 3u;
+        }
+
+        return random_buffer;
+    }
+
     bool PathTracingEstimator::HasRandomBuffer(RandomBufferType buffer) const
     {
         switch (buffer)
         {
         case RandomBufferType::kRandomSeed:
+        case RandomBufferType::kBlueNoise:
+            return true;
         case RandomBufferType::kSobolLUT:
+#ifndef BAIKAL_NO_SOBOL_LUT
             return true;
+#else
+            return false;
+#endif
         }
 
         return false;
@@ -743,6 +1964,14 @@ namespace Baikal
             return m_render_data->random;
         case RandomBufferType::kSobolLUT:
             return m_render_data->sobolmat;
+        case RandomBufferType::kBlueNoise:
+            if (m_render_data->blue_noise.GetElementCount() == 0)
+            {
+                auto const& tile = GetBlueNoiseTile();
+                m_render_data->blue_noise = GetContext().CreateBuffer<std::uint32_t>(tile.size(), CL_MEM_READ_ONLY,
+                    const_cast<std::uint32_t*>(tile.data()));
+            }
+            return m_render_data->blue_noise;
         }
 
         return CLWBuffer<std::uint32_t>();
@@ -759,7 +1988,7 @@ namespace Baikal
     )
     {
         // Intersect ray batch
-        GetIntersector()->QueryIntersection(
+        GetIntersector(scene)->QueryIntersection(
             m_render_data->fr_rays[0],
             m_render_data->fr_hitcount,
             (std::uint32_t)num_estimates,
@@ -786,7 +2015,7 @@ namespace Baikal
 
         for (auto i = 0u; i < num_passes; ++i)
         {
-            GetIntersector()->QueryIntersection(
+            GetIntersector(scene)->QueryIntersection(
                 m_render_data->fr_rays[0],
                 m_render_data->fr_hitcount,
                 (std::uint32_t)num_estimates,
@@ -831,7 +2060,7 @@ namespace Baikal
 
         for (auto i = 0U; i < num_passes; ++i)
         {
-            GetIntersector()->QueryOcclusion(
+            GetIntersector(scene)->QueryOcclusion(
                 m_render_data->fr_shadowrays,
                 m_render_data->fr_hitcount,
                 (std::uint32_t)num_estimates,
@@ -850,7 +2079,7 @@ namespace Baikal
                 / 1000.f);
 
         // Gather light samples and account for visibility
-        GatherLightSamples(scene, 0, num_estimates, temporary, false);
+        GatherLightSamples(scene, 0, num_estimates, temporary, temporary, false, false);
 
         //
         GetContext().Flush(0);
@@ -863,7 +2092,7 @@ namespace Baikal
 
         for (auto i = 0U; i < num_passes; ++i)
         {
-            GetIntersector()->QueryIntersection(
+            GetIntersector(scene)->QueryIntersection(
                 m_render_data->fr_rays[1],
                 m_render_data->fr_hitcount,
                 (std::uint32_t)num_estimates,
@@ -885,7 +2114,8 @@ namespace Baikal
 
     bool PathTracingEstimator::SupportsIntermediateValue(IntermediateValue value) const
     {
-        if (value == IntermediateValue::kVisibility || value == IntermediateValue::kOpacity)
+        if (value == IntermediateValue::kVisibility || value == IntermediateValue::kOpacity ||
+            value == IntermediateValue::kCost)
         {
             return true;
         }
@@ -915,4 +2145,777 @@ namespace Baikal
             GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, misskernel);
         }
     }
+
+    void PathTracingEstimator::AccumulateRayCost(
+        int pass,
+        std::size_t size,
+        CLWBuffer<RadeonRays::float3> cost,
+        bool use_output_indices)
+    {
+        auto costkernel = GetKernel("AccumulateRayCost");
+
+        auto output_indices = use_output_indices ? m_render_data->output_indices : m_render_data->iota;
+
+        int argc = 0;
+        costkernel.SetArg(argc++, m_render_data->pixelindices[(pass + 1) & 0x1]);
+        costkernel.SetArg(argc++, output_indices);
+        costkernel.SetArg(argc++, m_render_data->hitcount);
+        costkernel.SetArg(argc++, m_render_data->paths);
+        costkernel.SetArg(argc++, pass == 0 ? 1 : 0);
+        costkernel.SetArg(argc++, cost);
+
+        {
+            LaunchTuned(costkernel, "AccumulateRayCost", size);
+        }
+    }
+
+    void PathTracingEstimator::AccumulateShadowRayCost(
+        int pass,
+        std::size_t size,
+        CLWBuffer<RadeonRays::float3> cost,
+        bool use_output_indices)
+    {
+        auto costkernel = GetKernel("AccumulateShadowRayCost");
+
+        auto output_indices = use_output_indices ? m_render_data->output_indices : m_render_data->iota;
+
+        int argc = 0;
+        costkernel.SetArg(argc++, m_render_data->pixelindices[pass & 0x1]);
+        costkernel.SetArg(argc++, output_indices);
+        costkernel.SetArg(argc++, m_render_data->hitcount);
+        costkernel.SetArg(argc++, m_render_data->shadowrays);
+        costkernel.SetArg(argc++, (cl_int)m_render_data->num_light_samples);
+        costkernel.SetArg(argc++, cost);
+
+        {
+            LaunchTuned(costkernel, "AccumulateShadowRayCost", size);
+        }
+    }
+
+    void PathTracingEstimator::CullShadowRays(int pass, CLWBuffer<int> num_rays, std::size_t size)
+    {
+        auto cullkernel = GetKernel("CullShadowRays");
+
+        int argc = 0;
+        cullkernel.SetArg(argc++, num_rays);
+        cullkernel.SetArg(argc++, m_render_data->shadowrays);
+        cullkernel.SetArg(argc++, m_render_data->lightsamples);
+        cullkernel.SetArg(argc++, m_shadow_ray_culling);
+        cullkernel.SetArg(argc++, GetLaunchSeed(LaunchSeed::kCullShadowRays, pass));
+
+        {
+            LaunchTuned(cullkernel, "CullShadowRays", size);
+        }
+    }
+
+    void PathTracingEstimator::SetShadingMode(ShadingMode mode)
+    {
+        m_shading_mode = mode;
+    }
+
+    PathTracingEstimator::ShadingMode PathTracingEstimator::GetShadingMode() const
+    {
+        return m_shading_mode;
+    }
+
+    void PathTracingEstimator::SetRussianRouletteMinBounce(std::uint32_t bounce)
+    {
+        m_rr_min_bounce = bounce;
+    }
+
+    std::uint32_t PathTracingEstimator::GetRussianRouletteMinBounce() const
+    {
+        return m_rr_min_bounce;
+    }
+
+    void PathTracingEstimator::SetRegularization(Regularization regularization)
+    {
+        m_regularization = regularization;
+    }
+
+    PathTracingEstimator::Regularization PathTracingEstimator::GetRegularization() const
+    {
+        return m_regularization;
+    }
+
+    void PathTracingEstimator::SetMaxRadiance(float max_radiance)
+    {
+        if (!(max_radiance > 0.f))
+        {
+            throw std::runtime_error("PathTracingEstimator: max radiance should be positive");
+        }
+
+        m_max_radiance = max_radiance;
+    }
+
+    float PathTracingEstimator::GetMaxRadiance() const
+    {
+        return m_max_radiance;
+    }
+
+    void PathTracingEstimator::SetLightSamplesPerVertex(std::uint32_t num_samples)
+    {
+        if (num_samples == 0)
+        {
+            throw std::runtime_error("PathTracingEstimator: number of light samples should be positive");
+        }
+
+        if (num_samples == m_light_samples_per_vertex)
+        {
+            return;
+        }
+
+        m_light_samples_per_vertex = num_samples;
+
+        // Shadow buffers are sized by the number of light samples
+        auto size = GetWorkBufferSize();
+        if (size > 0)
+        {
+            SetWorkBufferSize(size);
+        }
+    }
+
+    std::uint32_t PathTracingEstimator::GetLightSamplesPerVertex() const
+    {
+        return m_light_samples_per_vertex;
+    }
+
+    void PathTracingEstimator::SetShadowRayCulling(float threshold)
+    {
+        if (!(threshold >= 0.f))
+        {
+            throw std::runtime_error("PathTracingEstimator: shadow ray culling threshold should be non-negative");
+        }
+
+        m_shadow_ray_culling = threshold;
+    }
+
+    float PathTracingEstimator::GetShadowRayCulling() const
+    {
+        return m_shadow_ray_culling;
+    }
+
+    void PathTracingEstimator::SetAsyncShaderCompilation(bool enable)
+    {
+        m_async_shader_compilation = enable;
+    }
+
+    bool PathTracingEstimator::GetAsyncShaderCompilation() const
+    {
+        return m_async_shader_compilation;
+    }
+
+    bool PathTracingEstimator::IsUsingGenericShaders() const
+    {
+        return m_use_generic_kernels;
+    }
+
+    void PathTracingEstimator::SetPathGuiding(bool enable)
+    {
+        m_path_guiding = enable;
+    }
+
+    bool PathTracingEstimator::GetPathGuiding() const
+    {
+        return m_path_guiding;
+    }
+
+    void PathTracingEstimator::SetPathGuidingMemoryBudget(std::size_t bytes)
+    {
+        if (bytes < kPathGuidingCellBytes)
+        {
+            throw std::runtime_error("PathTracingEstimator: path guiding memory budget should fit at least one cell");
+        }
+
+        if (bytes != m_path_guiding_budget)
+        {
+            m_path_guiding_budget = bytes;
+            // Grid is rebuilt on the next estimate
+            m_path_guiding_scene = nullptr;
+        }
+    }
+
+    std::size_t PathTracingEstimator::GetPathGuidingMemoryBudget() const
+    {
+        return m_path_guiding_budget;
+    }
+
+    void PathTracingEstimator::SetRadianceCache(bool enable)
+    {
+        m_radiance_cache = enable;
+    }
+
+    bool PathTracingEstimator::GetRadianceCache() const
+    {
+        return m_radiance_cache;
+    }
+
+    void PathTracingEstimator::SetRadianceCacheCellSize(float size)
+    {
+        if (size < 0.f)
+        {
+            throw std::runtime_error("PathTracingEstimator: radiance cache cell size should not be negative");
+        }
+
+        if (size != m_radiance_cache_cell_size)
+        {
+            m_radiance_cache_cell_size = size;
+            // Entries are keyed by cell, so the cache starts over on the next estimate
+            m_radiance_cache_scene = nullptr;
+        }
+    }
+
+    float PathTracingEstimator::GetRadianceCacheCellSize() const
+    {
+        return m_radiance_cache_cell_size;
+    }
+
+    void PathTracingEstimator::SetStochasticLayerSelection(bool enable)
+    {
+        m_stochastic_layer_selection = enable;
+    }
+
+    bool PathTracingEstimator::GetStochasticLayerSelection() const
+    {
+        return m_stochastic_layer_selection;
+    }
+
+    void PathTracingEstimator::SetEnergyCompensation(bool enable)
+    {
+        m_energy_compensation = enable;
+    }
+
+    bool PathTracingEstimator::GetEnergyCompensation() const
+    {
+        return m_energy_compensation;
+    }
+
+    void PathTracingEstimator::SetPathRegeneration(float threshold)
+    {
+        if (!(threshold >= 0.f && threshold < 1.f))
+        {
+            throw std::runtime_error("PathTracingEstimator: path regeneration threshold should be in [0, 1)");
+        }
+
+        bool reallocate = (threshold > 0.f) != (m_path_regeneration > 0.f);
+        m_path_regeneration = threshold;
+
+        // Regeneration buffers are sized by the work buffer
+        auto size = GetWorkBufferSize();
+        if (reallocate && size > 0)
+        {
+            SetWorkBufferSize(size);
+        }
+    }
+
+    float PathTracingEstimator::GetPathRegeneration() const
+    {
+        return m_path_regeneration;
+    }
+
+    void PathTracingEstimator::SetLightResampling(bool enable)
+    {
+        m_light_resampling = enable;
+    }
+
+    bool PathTracingEstimator::GetLightResampling() const
+    {
+        return m_light_resampling;
+    }
+
+    void PathTracingEstimator::SetInFlightBatches(std::uint32_t num_batches)
+    {
+        if (num_batches == 0)
+        {
+            throw std::runtime_error("PathTracingEstimator: number of in-flight batches should be positive");
+        }
+
+        if (num_batches == m_in_flight_batches)
+        {
+            return;
+        }
+
+        m_in_flight_batches = num_batches;
+
+        auto size = GetWorkBufferSize();
+        if (size > 0)
+        {
+            CreateBatches(size);
+        }
+    }
+
+    std::uint32_t PathTracingEstimator::GetInFlightBatches() const
+    {
+        return m_in_flight_batches;
+    }
+
+    void PathTracingEstimator::SetOutputSize(std::uint32_t width, std::uint32_t height)
+    {
+        m_output_width = width;
+        m_output_height = height;
+    }
+
+    void PathTracingEstimator::FinishFrame()
+    {
+        // Frames without resampled estimates break the history
+        m_render_data->reservoir_history = m_render_data->reservoirs_used;
+
+        if (m_render_data->reservoirs_used)
+        {
+            m_render_data->reservoir_index ^= 1;
+            m_render_data->reservoirs_used = false;
+        }
+    }
+
+    void PathTracingEstimator::PrepareLightResampling(ClwScene const& scene, std::size_t size)
+    {
+        auto& context = GetContext();
+        auto num_pixels = static_cast<std::size_t>(m_output_width) * m_output_height;
+
+        if (m_render_data->reservoirs[0].GetElementCount() != num_pixels)
+        {
+            for (auto i = 0; i < 2; ++i)
+            {
+                m_render_data->reservoirs[i] = context.CreateBuffer<LightReservoir>(num_pixels, CL_MEM_READ_WRITE);
+            }
+
+            m_render_data->reservoir_history = false;
+        }
+
+        auto index = m_render_data->reservoir_index;
+
+        // Next frame reprojects the first hits of this one with its camera
+        context.CopyBuffer(0, scene.camera, m_render_data->reservoir_cameras[index], 0, 0, 1);
+
+        auto clearkernel = GetKernel("ClearLightReservoirs");
+
+        int argc = 0;
+        clearkernel.SetArg(argc++, m_render_data->output_indices);
+        clearkernel.SetArg(argc++, (cl_int)size);
+        clearkernel.SetArg(argc++, m_render_data->reservoirs[index]);
+
+        {
+            LaunchTuned(clearkernel, "ClearLightReservoirs", size);
+        }
+
+        m_render_data->reservoirs_used = true;
+    }
+
+    ClwClass& PathTracingEstimator::GetUberV2Kernels()
+    {
+        return m_use_generic_kernels ? m_uberv2_generic_kernels : m_uberv2_kernels;
+    }
+
+    void PathTracingEstimator::SetCausticPathSplit(bool enable)
+    {
+        m_caustic_path_split = enable;
+    }
+
+    void PathTracingEstimator::OnSurfaceShaded(
+        ClwScene const& scene,
+        int pass,
+        std::size_t size,
+        CLWBuffer<RadeonRays::float3> output,
+        bool use_output_indices
+    )
+    {
+    }
+
+    void PathTracingEstimator::SetHitArgs(CLWKernel kernel, int& argc, int pass, bool use_output_indices) const
+    {
+        kernel.SetArg(argc++, m_render_data->rays[pass & 0x1]);
+        kernel.SetArg(argc++, m_render_data->intersections);
+        kernel.SetArg(argc++, m_render_data->compacted_indices);
+        kernel.SetArg(argc++, m_render_data->pixelindices[pass & 0x1]);
+        kernel.SetArg(argc++, use_output_indices ? m_render_data->output_indices : m_render_data->iota);
+        kernel.SetArg(argc++, m_render_data->hitcount);
+        kernel.SetArg(argc++, m_render_data->paths);
+    }
+
+    std::size_t PathTracingEstimator::GetPersistentWorkSize() const
+    {
+        cl_uint num_compute_units = 0;
+        clGetDeviceInfo(GetContext().GetDevice(0).GetID(), CL_DEVICE_MAX_COMPUTE_UNITS,
+            sizeof(num_compute_units), &num_compute_units, nullptr);
+
+        auto num_groups = std::max<std::size_t>(num_compute_units, 1u) * kPersistentGroupsPerComputeUnit;
+
+        // There is no point in launching more threads than the work buffer can hold
+        auto max_groups = (GetWorkBufferSize() + kWorkGroupSize - 1) / kWorkGroupSize;
+
+        return std::max<std::size_t>(std::min(num_groups, max_groups), 1u) * kWorkGroupSize;
+    }
+
+    void PathTracingEstimator::PreparePathGuiding(ClwScene const& scene)
+    {
+        auto context = GetContext();
+
+        // Vertex records are reset by the update kernel once consumed
+        auto num_vertices = GetWorkBufferSize() * kPathGuidingMaxVertices;
+        if (m_render_data->guiding_vertices.GetElementCount() != num_vertices)
+        {
+            std::vector<PathGuidingVertex> vertices(num_vertices, PathGuidingVertex{ -1, 0.f, 0.f, 0 });
+            m_render_data->guiding_vertices = context.CreateBuffer<PathGuidingVertex>(num_vertices, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, &vertices[0]);
+        }
+
+        // Radiance learned for the previous revision of the scene is dropped
+        if (m_path_guiding_scene != &scene || m_path_guiding_revision != scene.revision)
+        {
+            auto pmin = scene.world_aabb.pmin;
+            auto extents = scene.world_aabb.pmax - scene.world_aabb.pmin;
+            float const e[3] = { std::max(extents.x, 0.f), std::max(extents.y, 0.f), std::max(extents.z, 0.f) };
+            auto max_extent = std::max(std::max(e[0], e[1]), e[2]);
+            auto max_cells = m_path_guiding_budget / kPathGuidingCellBytes;
+
+            // Finest grid of nearly cubic cells fitting into the budget
+            std::uint32_t resolution[3] = { 1u, 1u, 1u };
+            for (auto r = 2u; r <= kPathGuidingMaxResolution && max_extent > 0.f; ++r)
+            {
+                std::uint32_t candidate[3];
+                std::size_t num_cells = 1;
+
+                for (auto axis = 0u; axis < 3; ++axis)
+                {
+                    candidate[axis] = std::max(1u, static_cast<std::uint32_t>(std::ceil(r * e[axis] / max_extent)));
+                    num_cells *= candidate[axis];
+                }
+
+                if (num_cells > max_cells)
+                {
+                    break;
+                }
+
+                std::copy(candidate, candidate + 3, resolution);
+            }
+
+            m_path_guiding_cells = resolution[0] * resolution[1] * resolution[2];
+
+            // Header is followed by zero CDFs of untrained cells
+            std::vector<int> guiding(kPathGuidingHeaderSize + m_path_guiding_cells * kPathGuidingNumBins, 0);
+
+            auto header = reinterpret_cast<float*>(&guiding[0]);
+            header[0] = pmin.x;
+            header[1] = pmin.y;
+            header[2] = pmin.z;
+
+            for (auto axis = 0u; axis < 3; ++axis)
+            {
+                header[3 + axis] = e[axis] > 0.f ? resolution[axis] / e[axis] : 0.f;
+                guiding[6 + axis] = static_cast<int>(resolution[axis]);
+            }
+
+            m_render_data->guiding = context.CreateBuffer<int>(guiding.size(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, &guiding[0]);
+            m_render_data->guiding_radiance = context.CreateBuffer<float>(m_path_guiding_cells * kPathGuidingNumBins, CL_MEM_READ_WRITE);
+            context.FillBuffer(0, m_render_data->guiding_radiance, 0.f, m_path_guiding_cells * kPathGuidingNumBins);
+
+            m_path_guiding_scene = &scene;
+            m_path_guiding_revision = scene.revision;
+        }
+
+        // Sample with the radiance learned by all previous estimates
+        auto build_kernel = GetKernel("BuildPathGuidingDistribution");
+
+        int argc = 0;
+        build_kernel.SetArg(argc++, m_render_data->guiding_radiance);
+        build_kernel.SetArg(argc++, (cl_int)m_path_guiding_cells);
+        build_kernel.SetArg(argc++, m_render_data->guiding);
+
+        {
+            context.Launch1D(0, ((m_path_guiding_cells + 63) / 64) * 64, 64, build_kernel);
+        }
+    }
+
+    void PathTracingEstimator::SnapshotPathGuidingRadiance(int pass, std::size_t size, CLWBuffer<RadeonRays::float3> output, bool use_output_indices)
+    {
+        auto snapshot_kernel = GetKernel("SnapshotPathGuidingRadiance");
+
+        auto output_indices = use_output_indices ? m_render_data->output_indices : m_render_data->iota;
+
+        int argc = 0;
+        snapshot_kernel.SetArg(argc++, m_render_data->pixelindices[(pass + 1) & 0x1]);
+        snapshot_kernel.SetArg(argc++, output_indices);
+        snapshot_kernel.SetArg(argc++, m_render_data->hitcount);
+        snapshot_kernel.SetArg(argc++, pass - 1);
+        snapshot_kernel.SetArg(argc++, output);
+        snapshot_kernel.SetArg(argc++, m_render_data->guiding_vertices);
+
+        {
+            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, snapshot_kernel);
+        }
+    }
+
+    void PathTracingEstimator::UpdatePathGuiding(std::size_t size, CLWBuffer<RadeonRays::float3> output, bool use_output_indices)
+    {
+        auto update_kernel = GetKernel("UpdatePathGuiding");
+
+        auto output_indices = use_output_indices ? m_render_data->output_indices : m_render_data->iota;
+
+        int argc = 0;
+        update_kernel.SetArg(argc++, output_indices);
+        update_kernel.SetArg(argc++, (cl_int)size);
+        update_kernel.SetArg(argc++, output);
+        update_kernel.SetArg(argc++, m_render_data->guiding_vertices);
+        update_kernel.SetArg(argc++, m_render_data->guiding_radiance);
+
+        {
+            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, update_kernel);
+        }
+    }
+
+    void PathTracingEstimator::PrepareRadianceCache(ClwScene const& scene)
+    {
+        auto context = GetContext();
+
+        // Vertex records are reset by the update kernel once consumed
+        auto num_vertices = ((GetWorkBufferSize() + kRadianceCacheTrainingStride - 1) / kRadianceCacheTrainingStride) * kRadianceCacheMaxVertices;
+        if (m_render_data->cache_vertices.GetElementCount() != num_vertices)
+        {
+            std::vector<RadianceCacheVertex> vertices(num_vertices, RadianceCacheVertex{ 0u, { 0, 0, 0 }, RadeonRays::float3(), RadeonRays::float3() });
+            m_render_data->cache_vertices = context.CreateBuffer<RadianceCacheVertex>(num_vertices, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, &vertices[0]);
+        }
+
+        // Radiance learned for the previous revision of the scene is dropped
+        if (m_radiance_cache_scene != &scene || m_radiance_cache_revision != scene.revision)
+        {
+            auto diagonal = std::sqrt(std::max((scene.world_aabb.pmax - scene.world_aabb.pmin).sqnorm(), 0.f));
+            m_radiance_cache_cell = m_radiance_cache_cell_size > 0.f ? m_radiance_cache_cell_size : diagonal / kRadianceCacheCellsPerDiagonal;
+            m_radiance_cache_cell = m_radiance_cache_cell > 0.f ? m_radiance_cache_cell : 1.f;
+
+            if (m_render_data->cache_keys.GetElementCount() != kRadianceCacheSize)
+            {
+                m_render_data->cache_keys = context.CreateBuffer<std::uint32_t>(kRadianceCacheSize, CL_MEM_READ_WRITE);
+                m_render_data->cache_accum = context.CreateBuffer<RadeonRays::float3>(kRadianceCacheSize, CL_MEM_READ_WRITE);
+                m_render_data->cache_radiance = context.CreateBuffer<RadeonRays::float3>(kRadianceCacheSize, CL_MEM_READ_WRITE);
+            }
+
+            context.FillBuffer(0, m_render_data->cache_keys, 0u, kRadianceCacheSize);
+            context.FillBuffer(0, m_render_data->cache_accum, RadeonRays::float3(), kRadianceCacheSize);
+            context.FillBuffer(0, m_render_data->cache_radiance, RadeonRays::float3(), kRadianceCacheSize);
+
+            m_radiance_cache_scene = &scene;
+            m_radiance_cache_revision = scene.revision;
+        }
+    }
+
+    void PathTracingEstimator::UpdateRadianceCache(std::size_t size, CLWBuffer<RadeonRays::float3> output, bool use_output_indices)
+    {
+        auto output_indices = use_output_indices ? m_render_data->output_indices : m_render_data->iota;
+
+        {
+            auto update_kernel = GetKernel("UpdateRadianceCache");
+
+            int argc = 0;
+            update_kernel.SetArg(argc++, output_indices);
+            update_kernel.SetArg(argc++, (cl_int)size);
+            update_kernel.SetArg(argc++, m_sample_counter);
+            update_kernel.SetArg(argc++, output);
+            update_kernel.SetArg(argc++, m_render_data->cache_vertices);
+            update_kernel.SetArg(argc++, m_render_data->cache_keys);
+            update_kernel.SetArg(argc++, (cl_int)(kRadianceCacheSize - 1));
+            update_kernel.SetArg(argc++, m_render_data->cache_accum);
+
+            auto num_training = (size + kRadianceCacheTrainingStride - 1) / kRadianceCacheTrainingStride;
+            GetContext().Launch1D(0, ((num_training + 63) / 64) * 64, 64, update_kernel);
+        }
+
+        {
+            auto resolve_kernel = GetKernel("ResolveRadianceCache");
+
+            int argc = 0;
+            resolve_kernel.SetArg(argc++, (cl_int)kRadianceCacheSize);
+            resolve_kernel.SetArg(argc++, m_render_data->cache_accum);
+            resolve_kernel.SetArg(argc++, m_render_data->cache_radiance);
+
+            GetContext().Launch1D(0, ((kRadianceCacheSize + 63) / 64) * 64, 64, resolve_kernel);
+        }
+    }
+
+    void PathTracingEstimator::SortHitsByMaterial(ClwScene const& scene, int pass, std::size_t size)
+    {
+        // Build keys for the whole stream, dead entries are pushed to the end
+        {
+            auto keykernel = GetKernel("BuildMaterialSortKeys");
+
+            int argc = 0;
+            keykernel.SetArg(argc++, m_render_data->intersections);
+            keykernel.SetArg(argc++, m_render_data->compacted_indices);
+            keykernel.SetArg(argc++, m_render_data->hitcount);
+            keykernel.SetArg(argc++, scene.shapes);
+            keykernel.SetArg(argc++, scene.instances);
+            keykernel.SetArg(argc++, scene.instance_transforms);
+            keykernel.SetArg(argc++, scene.num_base_shapes);
+            keykernel.SetArg(argc++, (cl_int)size);
+            keykernel.SetArg(argc++, m_render_data->sort_keys[0]);
+            keykernel.SetArg(argc++, m_render_data->sort_values[0]);
+
+            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, keykernel);
+        }
+
+        CountKeySegments(m_render_data->sort_keys[0], size, 0);
+
+        m_render_data->pp.SortRadix(
+            0,
+            m_render_data->sort_keys[0],
+            m_render_data->sort_keys[1],
+            m_render_data->sort_values[0],
+            m_render_data->sort_values[1],
+            (int)size
+        );
+
+        CountKeySegments(m_render_data->sort_keys[1], size, 1);
+
+        // Gather compacted and pixel indices in sorted order
+        GetContext().CopyBuffer(0u, m_render_data->compacted_indices, m_render_data->unsorted_compacted_indices, 0, 0, size);
+        GetContext().CopyBuffer(0u, m_render_data->pixelindices[pass & 0x1], m_render_data->unsorted_pixelindices, 0, 0, size);
+
+        {
+            auto permutekernel = GetKernel("PermuteHits");
+
+            int argc = 0;
+            permutekernel.SetArg(argc++, m_render_data->sort_values[1]);
+            permutekernel.SetArg(argc++, m_render_data->hitcount);
+            permutekernel.SetArg(argc++, m_render_data->unsorted_compacted_indices);
+            permutekernel.SetArg(argc++, m_render_data->unsorted_pixelindices);
+            permutekernel.SetArg(argc++, m_render_data->compacted_indices);
+            permutekernel.SetArg(argc++, m_render_data->pixelindices[pass & 0x1]);
+
+            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, permutekernel);
+        }
+    }
+
+    void PathTracingEstimator::SortRays(ClwScene const& scene, int pass, std::size_t size)
+    {
+        auto const& aabb = scene.world_aabb;
+        auto extent = aabb.pmax - aabb.pmin;
+
+        {
+            auto keykernel = GetKernel("BuildRaySortKeys");
+
+            int argc = 0;
+            keykernel.SetArg(argc++, m_render_data->rays[(pass + 1) & 0x1]);
+            keykernel.SetArg(argc++, m_render_data->hitcount);
+            keykernel.SetArg(argc++, (cl_int)size);
+            keykernel.SetArg(argc++, cl_float4{ { aabb.pmin.x, aabb.pmin.y, aabb.pmin.z, 0.f } });
+            keykernel.SetArg(argc++, cl_float4{ { extent.x, extent.y, extent.z, 0.f } });
+            keykernel.SetArg(argc++, m_render_data->sort_keys[0]);
+            keykernel.SetArg(argc++, m_render_data->sort_values[0]);
+
+            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, keykernel);
+        }
+
+        m_render_data->pp.SortRadix(
+            0,
+            m_render_data->sort_keys[0],
+            m_render_data->sort_keys[1],
+            m_render_data->sort_values[0],
+            m_render_data->sort_values[1],
+            (int)size
+        );
+
+        // Current ray buffer and previous pixel indices are not needed anymore,
+        // so use them to keep unsorted copies
+        GetContext().CopyBuffer(0u, m_render_data->rays[(pass + 1) & 0x1], m_render_data->rays[pass & 0x1], 0, 0, size);
+        GetContext().CopyBuffer(0u, m_render_data->pixelindices[pass & 0x1], m_render_data->pixelindices[(pass + 1) & 0x1], 0, 0, size);
+
+        {
+            auto permutekernel = GetKernel("PermuteRays");
+
+            int argc = 0;
+            permutekernel.SetArg(argc++, m_render_data->sort_values[1]);
+            permutekernel.SetArg(argc++, m_render_data->hitcount);
+            permutekernel.SetArg(argc++, m_render_data->rays[pass & 0x1]);
+            permutekernel.SetArg(argc++, m_render_data->pixelindices[(pass + 1) & 0x1]);
+            permutekernel.SetArg(argc++, m_render_data->rays[(pass + 1) & 0x1]);
+            permutekernel.SetArg(argc++, m_render_data->pixelindices[pass & 0x1]);
+
+            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, permutekernel);
+        }
+    }
+
+    void PathTracingEstimator::CountKeySegments(CLWBuffer<int> keys, std::size_t size, int counter_idx)
+    {
+        auto countkernel = GetKernel("CountKeySegments");
+
+        int argc = 0;
+        countkernel.SetArg(argc++, keys);
+        countkernel.SetArg(argc++, m_render_data->hitcount);
+        countkernel.SetArg(argc++, m_render_data->divergence_counters);
+        countkernel.SetArg(argc++, (cl_int)counter_idx);
+
+        {
+            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, countkernel);
+        }
+    }
+
+    void PathTracingEstimator::SetMaterialSorting(bool enable)
+    {
+        m_sort_by_material = enable;
+    }
+
+    bool PathTracingEstimator::GetMaterialSorting() const
+    {
+        return m_sort_by_material;
+    }
+
+    void PathTracingEstimator::SetMaterialVariants(std::vector<std::uint32_t> const& layer_masks)
+    {
+        m_material_variants = layer_masks;
+        m_material_variant_opts.clear();
+
+        if (layer_masks.empty())
+        {
+            return;
+        }
+
+        // Layer combinations owned by each variant, the last one is the catch-all
+        std::vector<std::set<std::uint32_t>> owned_layers(layer_masks.size() + 1);
+
+        for (std::uint32_t layers = 0; layers < 256; ++layers)
+        {
+            auto owner = static_cast<std::size_t>(std::find_if(layer_masks.cbegin(), layer_masks.cend(),
+                [layers](std::uint32_t mask) { return (layers & ~mask) == 0; }) - layer_masks.cbegin());
+
+            owned_layers[owner].insert(layers);
+        }
+
+        for (auto const& layers : owned_layers)
+        {
+            // Skip variants which would not shade anything
+            if (!layers.empty())
+            {
+                m_material_variant_opts.push_back(CLUberV2Generator::GetVariantBuildOptions(layers));
+            }
+        }
+    }
+
+    std::vector<std::uint32_t> const& PathTracingEstimator::GetMaterialVariants() const
+    {
+        return m_material_variants;
+    }
+
+    PathTracingEstimator::ShadingDivergenceStats PathTracingEstimator::GetShadingDivergenceStats() const
+    {
+        int counters[2] = { 0, 0 };
+        GetContext().ReadBuffer(0, m_render_data->divergence_counters, counters, 2).Wait();
+
+        ShadingDivergenceStats stats;
+        stats.unsorted_segments = static_cast<std::uint32_t>(counters[0]);
+        stats.sorted_segments = static_cast<std::uint32_t>(counters[1]);
+        return stats;
+    }
+
+    void PathTracingEstimator::ResetShadingDivergenceStats()
+    {
+        GetContext().FillBuffer(0, m_render_data->divergence_counters, 0, 2);
+    }
+
+    void PathTracingEstimator::SetRaySortingMask(std::uint32_t mask)
+    {
+        m_ray_sorting_mask = mask;
+    }
+
+    std::uint32_t PathTracingEstimator::GetRaySortingMask() const
+    {
+        return m_ray_sorting_mask;
+    }
 }
@@ -27,6 +27,7 @@ THE SOFTWARE.
 #include "Utils/cl_program_manager.h"
 
 #include <memory>
+#include <vector>
 
 namespace Baikal
 {
@@ -39,6 +40,47 @@ namespace Baikal
     class PathTracingEstimator : public Estimator, protected ClwClass
     {
     public:
+        /**
+        \brief Surface shading dispatch strategy.
+
+        kWavefront launches one thread per work buffer entry and relies on early
+        out for dead paths. kPersistentThreads launches enough work-groups to fill
+        the device and lets them pull batches of live hits from a global queue.
+        */
+        enum class ShadingMode
+        {
+            kWavefront,
+            kPersistentThreads
+        };
+
+        /**
+        \brief Path space regularization level.
+
+        Regularization trades bias for lower variance. kClampRadiance clamps every
+        indirect radiance sample to the maximum set via SetMaxRadiance.
+        kClampRadianceAndRoughness additionally raises the roughness of all surfaces
+        hit after the first glossy bounce, which blurs hard to sample caustics.
+        */
+        enum class Regularization
+        {
+            kNone,
+            kClampRadiance,
+            kClampRadianceAndRoughness
+        };
+
+        /**
+        \brief Shading divergence counters collected while sorting hits by material.
+
+        Both values count runs of identical material keys within 64-wide wavefronts,
+        summed over all shading passes. The difference between them is the number of
+        per-wavefront material switches saved by sorting.
+        */
+        struct ShadingDivergenceStats
+        {
+            std::uint32_t unsorted_segments;
+            std::uint32_t sorted_segments;
+        };
+
         PathTracingEstimator(
             CLWContext context,
             std::shared_ptr<RadeonRays::IntersectionApi> api,
@@ -60,6 +102,33 @@ namespace Baikal
         */
         std::size_t GetWorkBufferSize() const override;
 
+        /**
+        \brief Returns number of work buffer entries including the ones of batches in flight.
+        */
+        std::size_t GetAllocatedWorkBufferSize() const override;
+
+        /**
+        \brief Device memory of the buffers sized after the work buffer, in bytes.
+
+        Buffers sharing memory are counted once, under the one owning it.
+        */
+        struct WorkBufferMemory
+        {
+            // Ray buffers of the current and next bounce and camera rays of regenerated paths, transmission shadow rays are gathered into the current one
+            std::size_t rays;
+            // Shadow rays, their hits and light samples of all light samples per vertex
+            std::size_t shadow_rays;
+            std::size_t intersections;
+            std::size_t paths;
+            std::size_t random;
+            // Hit flags, compaction, pixel and output indices, sorting and transmission scratch
+            std::size_t indices;
+
+            std::size_t GetTotal() const { return rays + shadow_rays + intersections + paths + random + indices; }
+        };
+
+        WorkBufferMemory GetWorkBufferMemory() const;
+
         /**
         \brief Set random seed value for the estimator. Renders
         with the same random seed are guaranteed to be the same.
@@ -68,6 +137,8 @@ namespace Baikal
         */
         void SetRandomSeed(std::uint32_t seed) override;
 
+        void SetSampleIndex(std::uint32_t index) override;
+
         /**
         \brief Get ray buffer handle.
 
@@ -103,6 +174,23 @@ namespace Baikal
         */
         CLWBuffer<int> GetRayCountBuffer() const override;
 
+        /**
+        \brief Get regeneration ray buffer handle.
+
+        Only allocated if path regeneration is enabled, see SetPathRegeneration.
+
+        IMPORTANT: SetWorkBufferSize should be called prior to calling this method.
+        */
+        CLWBuffer<ray> GetRegenerationRayBuffer() const override;
+
+        /**
+        \brief Set primary hit buffer of the next Estimate call.
+
+        Primary hits are read from or written to the buffer right after the intersection of
+        the first pass, before volumes are sampled and hits are handed to primaryHitsHandler.
+        */
+        bool SetPrimaryHitBuffer(CLWBuffer<RadeonRays::Intersection> hits, bool hits_valid) override;
+
         /**
         \brief Returns first hit buffer
 
@@ -120,7 +208,8 @@ namespace Baikal
         \param scene Scene description.
         \param rays Ray buffer to estimate radiance for.
         \param indices Rays to output indices correspondence.
-        \param quality Quality of the estimate.
+        \param quality Quality of the estimate. kRough skips volumes and shadow ray transmission,
+        kPrecise weights emissive hits with exact light selection probabilities.
         \param output Output buffer.
         \param atomic_update Tells an estimator that indices might contain duplicate elements and
         hence atomic update is required while updating output buffer.
@@ -132,9 +221,20 @@ namespace Baikal
             CLWBuffer<RadeonRays::float3> output,
             bool use_output_indices = true,
             bool atomic_update = false,
-            MissedPrimaryRaysHandler missedPrimaryRaysHandler = nullptr
+            MissedPrimaryRaysHandler missedPrimaryRaysHandler = nullptr,
+            PrimaryHitsHandler primaryHitsHandler = nullptr
         ) override;
 
+        void CompileProgramsAsync(ClwScene const& scene, QualityLevel quality, bool atomic_update) override;
+
+        /**
+        \brief Get scene features the kernels of the last Estimate call are specialized for.
+
+        Kernels are built without the code of features the scene does not have,
+        see ClwScene::Feature.
+        */
+        std::uint32_t GetSceneFeatures() const;
+
         /**
         \brief Find intersection points for the rays in ray buffer.
 
@@ -185,10 +285,367 @@ namespace Baikal
         */
         bool SupportsIntermediateValue(IntermediateValue value) const override;
 
-    private:
-        void InitPathData(std::size_t size, int volume_idx);
+        /**
+        \brief Tells estimator about the resolution of the output it writes into.
 
-        void ShadeSurface(
+        Light resampling keeps its reservoirs per output pixel.
+        */
+        void SetOutputSize(std::uint32_t width, std::uint32_t height) override;
+
+        /**
+        \brief Swap light reservoirs of the frame with the ones of the last frame.
+        */
+        void FinishFrame() override;
+
+        /**
+        \brief Set surface shading dispatch strategy.
+
+        \param mode Shading mode
+        */
+        void SetShadingMode(ShadingMode mode);
+
+        /**
+        \brief Get surface shading dispatch strategy.
+        */
+        ShadingMode GetShadingMode() const;
+
+        /**
+        \brief Enable or disable sorting of hits by material before shading.
+
+        When enabled compacted hits are radix sorted by material layer mask and
+        material offset, so neighbouring threads run the same UberV2 code path.
+
+        \param enable Sort hits if true
+        */
+        void SetMaterialSorting(bool enable);
+
+        /**
+        \brief Check if hits are sorted by material before shading.
+        */
+        bool GetMaterialSorting() const;
+
+        /**
+        \brief Set material layer combinations compiled into separate surface shading kernels.
+
+        Every variant only contains UberV2 code of the layer combinations it owns, so simple
+        materials are not shaded with the register use of the most complex one in the scene.
+        Layer combination is owned by the first variant whose mask includes all of its layers,
+        combinations not covered by any mask are shaded by an implicit catch-all variant.
+        Works best together with material sorting. Empty set disables variants.
+
+        \param layer_masks UberV2Material::Layers bitmasks, one per variant
+        */
+        void SetMaterialVariants(std::vector<std::uint32_t> const& layer_masks);
+
+        /**
+        \brief Get material layer masks of surface shading kernel variants.
+        */
+        std::vector<std::uint32_t> const& GetMaterialVariants() const;
+
+        /**
+        \brief Read back divergence counters accumulated since the last reset.
+
+        IMPORTANT: this call blocks until all queued work is finished.
+        */
+        ShadingDivergenceStats GetShadingDivergenceStats() const;
+
+        /**
+        \brief Reset divergence counters.
+        */
+        void ResetShadingDivergenceStats();
+
+        /**
+        \brief Select bounces after which extension rays are sorted.
+
+        Bit i enables sorting of the rays generated by bounce i before they are
+        traced. Rays are sorted by the Morton code of their origin within the scene
+        bounds followed by octahedral direction.
+
+        \param mask Per-bounce sorting mask, 0 disables sorting
+        */
+        void SetRaySortingMask(std::uint32_t mask);
+
+        /**
+        \brief Get per-bounce ray sorting mask.
+        */
+        std::uint32_t GetRaySortingMask() const;
+
+        /**
+        \brief Set the first bounce Russian roulette is applied at.
+
+        Starting from this bounce paths are randomly terminated with probability
+        inversely related to their throughput. Values >= max bounces disable it.
+
+        \param bounce First bounce to apply Russian roulette at
+        */
+        void SetRussianRouletteMinBounce(std::uint32_t bounce);
+
+        /**
+        \brief Get the first bounce Russian roulette is applied at.
+        */
+        std::uint32_t GetRussianRouletteMinBounce() const;
+
+        /**
+        \brief Set path space regularization level.
+
+        \param regularization Regularization level
+        */
+        void SetRegularization(Regularization regularization);
+
+        /**
+        \brief Get path space regularization level.
+        */
+        Regularization GetRegularization() const;
+
+        /**
+        \brief Set maximum value of indirect radiance sample components.
+
+        Only used if regularization is enabled.
+
+        \param max_radiance Maximum radiance, should be positive
+        */
+        void SetMaxRadiance(float max_radiance);
+
+        /**
+        \brief Get maximum value of indirect radiance sample components.
+        */
+        float GetMaxRadiance() const;
+
+        /**
+        \brief Set number of light samples taken at each surface vertex.
+
+        Every sample casts its own shadow ray, shadow rays of all samples are
+        intersected in a single batch. Rough estimates and scenes with volumes
+        always use a single light sample. Changing this value reallocates work buffers.
+
+        \param num_samples Number of light samples, should be positive
+        */
+        void SetLightSamplesPerVertex(std::uint32_t num_samples);
+
+        /**
+        \brief Get number of light samples taken at each surface vertex.
+        */
+        std::uint32_t GetLightSamplesPerVertex() const;
+
+        /**
+        \brief Set luminance threshold of shadow ray culling.
+
+        Light samples with unoccluded contribution below the threshold luminance only keep their
+        shadow ray with probability of their luminance over the threshold, the kept ones are
+        divided by it, so the estimate stays unbiased while dim samples mostly skip the occlusion
+        query. Samples of first hits are not culled if visibility is gathered or lights resampled.
+
+        \param threshold Luminance threshold, 0 disables culling
+        */
+        void SetShadowRayCulling(float threshold);
+
+        /**
+        \brief Get luminance threshold of shadow ray culling, 0 if disabled.
+        */
+        float GetShadowRayCulling() const;
+
+        /**
+        \brief Enable or disable background compilation of UberV2 kernels.
+
+        When enabled, estimates do not block on compiling kernels specialized for
+        current materials. They are rendered with generic kernels, which check material
+        layers and interpret input maps at runtime, until the specialized program is ready.
+
+        \param enable Compile specialized kernels in background if true
+        */
+        void SetAsyncShaderCompilation(bool enable);
+
+        /**
+        \brief Check if UberV2 kernels are compiled in background.
+        */
+        bool GetAsyncShaderCompilation() const;
+
+        /**
+        \brief Check if the last estimate has been rendered with generic UberV2 kernels.
+        */
+        bool IsUsingGenericShaders() const;
+
+        /**
+        \brief Enable or disable path guiding.
+
+        Radiance gathered past the first path vertices is cached in a grid over the
+        scene bounds, every cell keeps a histogram of incident directions. The cache
+        is learned by every estimate and starts over once the scene revision changes.
+        Directions at non-singular vertices are sampled from either the BxDF or the
+        cell histogram with equal probability and weighted with one-sample MIS.
+        The cache only learns from estimates without atomic update, since duplicate
+        output indices mix radiance of different paths.
+
+        \param enable Guide paths if true
+        */
+        void SetPathGuiding(bool enable);
+
+        /**
+        \brief Check if paths are guided.
+        */
+        bool GetPathGuiding() const;
+
+        /**
+        \brief Set memory budget of path guiding cache, which determines its grid resolution.
+
+        Per path vertex records are sized by the work buffer and are not included.
+
+        \param bytes Cache size in bytes, should fit at least one grid cell
+        */
+        void SetPathGuidingMemoryBudget(std::size_t bytes);
+
+        /**
+        \brief Get memory budget of path guiding cache in bytes.
+        */
+        std::size_t GetPathGuidingMemoryBudget() const;
+
+        /**
+        \brief Enable or disable radiance cache for interactive preview.
+
+        Outgoing radiance of surface points is cached in a world space hash table,
+        entries are addressed by the cell of a point and the dominant axis of its
+        normal. Paths past their first non-singular vertex take radiance from the
+        cache instead of being traced further, except for a sixteenth of the paths,
+        which are traced in full and update the cache at the end of every estimate.
+        The cache starts over once the scene revision changes and only learns from
+        estimates without atomic update. Results are biased, at least by the cell size.
+
+        \param enable Terminate paths into the cache if true
+        */
+        void SetRadianceCache(bool enable);
+
+        /**
+        \brief Check if paths are terminated into radiance cache.
+        */
+        bool GetRadianceCache() const;
+
+        /**
+        \brief Set world space cell size of radiance cache.
+
+        \param size Cell size, 0 picks 1/256 of the scene bounds diagonal
+        */
+        void SetRadianceCacheCellSize(float size);
+
+        /**
+        \brief Get world space cell size of radiance cache, 0 if it is picked automatically.
+        */
+        float GetRadianceCacheCellSize() const;
+
+        /**
+        \brief Enable or disable stochastic layer selection of UberV2 materials.
+
+        Every hit already picks one layer to sample by the Fresnel weights of the layer stack.
+        If enabled, BxDF evaluation and PDF for light samples are restricted to that layer
+        instead of blending all layers, which makes the cost of a hit independent of the number
+        of layers. Results stay unbiased, but each sample carries more noise on layered materials.
+
+        \param enable Evaluate only the selected layer if true
+        */
+        void SetStochasticLayerSelection(bool enable);
+
+        /**
+        \brief Check if UberV2 materials evaluate only the selected layer.
+        */
+        bool GetStochasticLayerSelection() const;
+
+        /**
+        \brief Enable or disable energy compensation of rough UberV2 reflection.
+
+        Single scattering GGX loses energy as roughness grows. If enabled, the reflection lobe
+        is normalized by its directional albedo, taken from a precomputed table, and the layers
+        underneath get the energy the lobe does not reflect instead of all the energy Fresnel
+        transmits. Layer selection for sampling uses the same weights.
+
+        \param enable Compensate energy of rough reflection if true
+        */
+        void SetEnergyCompensation(bool enable);
+
+        /**
+        \brief Check if rough UberV2 reflection is energy compensated.
+        */
+        bool GetEnergyCompensation() const;
+
+        /**
+        \brief Enable or disable path regeneration.
+
+        Once the number of live paths drops below the threshold fraction of the work buffer,
+        slots of the terminated paths are refilled with camera paths of the next sample, taken
+        from the regeneration ray buffer, so later bounces don't run on small batches. Every slot
+        is refilled once per estimate and regenerated paths get the full number of bounces.
+        Paths are only regenerated by estimates without volumes, path guiding, radiance cache,
+        caustic path split, visibility and opacity outputs and primary ray handlers.
+        Enabling or disabling it reallocates work buffers.
+
+        \param threshold Fraction of live paths in [0, 1), 0 disables regeneration
+        */
+        void SetPathRegeneration(float threshold);
+
+        /**
+        \brief Get fraction of live paths below which paths are regenerated, 0 if disabled.
+        */
+        float GetPathRegeneration() const;
+
+        /**
+        \brief Enable or disable spatiotemporal light resampling at first hits.
+
+        Light sample of a first hit is picked out of several candidates by resampled importance
+        sampling and combined with the ones picked in the last frame at the reprojected pixel and
+        around it, samples found occluded are not reused. Reservoirs are kept per output pixel, so
+        only estimates into distinct output pixels of a perspective camera image set via SetOutputSize
+        are resampled, without volumes and path regeneration. Resampled sample replaces all light
+        samples of the vertex. Results are biased where reused samples differ in visibility.
+
+        \param enable Resample light samples of first hits if true
+        */
+        void SetLightResampling(bool enable);
+
+        /**
+        \brief Check if light samples of first hits are resampled.
+        */
+        bool GetLightResampling() const;
+
+        /**
+        \brief Set number of batches the work buffer is split into.
+
+        Every batch has work buffers and a command queue of its own. Passes of the batches are issued
+        in turn, so rays of one batch are intersected on the intersector queue while the others are
+        shaded on theirs. Estimates with path guiding, radiance cache, path regeneration, light resampling,
+        caustic path split, persistent threads, random sampler, intermediate value outputs, primary hit
+        buffers or primary ray handlers run as a single batch. Changing this value reallocates work buffers.
+
+        \param num_batches Number of batches in flight, should be positive, 1 disables pipelining
+        */
+        void SetInFlightBatches(std::uint32_t num_batches);
+
+        /**
+        \brief Get number of batches the work buffer is split into.
+        */
+        std::uint32_t GetInFlightBatches() const;
+
+    protected:
+        // Seed of a launch of the current sample, see GetLaunchSeed
+        std::uint32_t GetLaunchSeed(LaunchSeed launch, int pass = 0) const;
+        std::uint32_t GetRandomSeed() const { return m_random_seed; }
+        // Per work item scrambles of the random seed, derived from the index and the stream only
+        std::vector<std::uint32_t> GenerateRandomBuffer(std::size_t size, std::uint32_t stream = 0u) const;
+
+        /**
+        \brief Skip emission along camera -> diffuse -> specular+ -> light paths.
+
+        Used by estimators which gather these paths by tracing from the lights,
+        so they are not counted twice.
+
+        \param enable Skip caustic paths if true
+        */
+        void SetCausticPathSplit(bool enable);
+
+        /**
+        \brief Called after surface shading of every bounce.
+
+        Estimators add their own contributions at the hits of the bounce here,
+        SetHitArgs binds the hit buffers to their kernels.
+        */
+        virtual void OnSurfaceShaded(
             ClwScene const& scene,
             int pass,
             std::size_t size,
@@ -196,7 +653,37 @@ namespace Baikal
             bool use_output_indices
         );
 
-        void SampleVolume(
+        /**
+        \brief Bind rays, intersections, hit indices, pixel indices, output indices,
+        hit count and path states of a bounce as kernel arguments.
+
+        Arguments follow the order of surface shading kernels.
+
+        \param argc Index of the first argument, advanced past the last one
+        */
+        void SetHitArgs(CLWKernel kernel, int& argc, int pass, bool use_output_indices) const;
+
+    private:
+        // Create the buffers of the render data which do not depend on the work buffer size
+        void InitRenderData();
+        // Create the buffers of the render data sized after the work buffer
+        void AllocateRenderData(std::size_t size);
+        // Delete intersector views of the render data buffers
+        void ReleaseIntersectorBuffers();
+        // Recreate batches of pipelined estimates for the work buffer size, see SetInFlightBatches
+        void CreateBatches(std::size_t size);
+
+        // Commands queued to the intersector from now on wait for the ones queued to the estimator context so far
+        void EnterIntersectorQueue();
+        // Commands queued to the estimator context from now on wait for the ones queued to the intersector so far
+        void LeaveIntersectorQueue();
+
+        // Build options of the main program and of the UberV2 programs for Estimate settings
+        void GetBuildOptions(ClwScene const& scene, QualityLevel quality, bool atomic_update, std::string& opts, std::string& uberv2_opts) const;
+
+        void InitPathData(std::size_t size, int volume_idx);
+
+        void ShadeSurface(
             ClwScene const& scene,
             int pass,
             std::size_t size,
@@ -204,7 +691,7 @@ namespace Baikal
             bool use_output_indices
         );
 
-        void ShadeMiss(
+        void SampleVolume(
             ClwScene const& scene,
             int pass,
             std::size_t size,
@@ -212,7 +699,7 @@ namespace Baikal
             bool use_output_indices
         );
 
-        void GatherLightSamples(
+        void ShadeMiss(
             ClwScene const& scene,
             int pass,
             std::size_t size,
@@ -220,11 +707,15 @@ namespace Baikal
             bool use_output_indices
         );
 
-        void GatherVisibility(
+        // Visibility of the first light sample is added to the visibility buffer if gather_visibility is set,
+        // the buffer is not accessed otherwise
+        void GatherLightSamples(
             ClwScene const& scene,
             int pass,
             std::size_t size,
             CLWBuffer<RadeonRays::float3> output,
+            CLWBuffer<RadeonRays::float3> visibility,
+            bool gather_visibility,
             bool use_output_indices
         );
 
@@ -251,28 +742,135 @@ namespace Baikal
             bool use_output_indices
         );
 
+        // Shadow rays at ray_indices are processed in the order of intersections,
+        // the ones which need another intersection are flagged in transmission_pending
         void ApplyVolumeTransmission(
             ClwScene const& scene,
             int pass,
             std::size_t size,
+            CLWBuffer<int> ray_indices,
+            CLWBuffer<int> num_rays,
             CLWBuffer<RadeonRays::float3> output,
             bool use_output_indices
         );
 
+        // Trace shadow rays through volume boundaries, every step only intersects rays the previous one has moved
+        void TraceShadowRayTransmission(ClwScene const& scene, int pass, std::size_t size, CLWBuffer<RadeonRays::float3> output, bool use_output_indices);
+
 
         void AdvanceIterationCount(int pass, std::size_t size, CLWBuffer<RadeonRays::float3> output, bool use_output_indices);
 
+        // Add rays traced by live paths of the pass to the cost output
+        void AccumulateRayCost(int pass, std::size_t size, CLWBuffer<RadeonRays::float3> cost, bool use_output_indices);
+        // Add active shadow rays of the pass to the cost output
+        void AccumulateShadowRayCost(int pass, std::size_t size, CLWBuffer<RadeonRays::float3> cost, bool use_output_indices);
+
+        // Drop shadow rays of dim light samples by Russian roulette, num_rays holds the count of all shadow rays of the pass
+        void CullShadowRays(int pass, CLWBuffer<int> num_rays, std::size_t size);
+
         // Restore pixel indices after compaction
         void RestorePixelIndices(int pass, std::size_t size);
 
         // Convert intersection info to compaction predicate
         void FilterPathStream(int pass, std::size_t size);
 
+        // Start camera paths of the next sample in the slots of terminated paths, they begin with the next pass
+        void RegeneratePaths(ClwScene const& scene, int pass, std::size_t size, CLWBuffer<RadeonRays::float3> output, bool use_output_indices);
+
+        // Terminate paths with all their bounces done before the last pass
+        void LimitPathLength(int pass, std::size_t size);
+
+        // Allocate light reservoirs for the output, keep the camera of the frame and empty reservoirs of the estimated pixels
+        void PrepareLightResampling(ClwScene const& scene, std::size_t size);
+
+        // Intersect extension rays and shadow rays of the pass with curve shapes the intersector does not know about
+        void IntersectCurves(ClwScene const& scene, int pass, std::size_t size);
+        void OccludeCurves(ClwScene const& scene, std::size_t size);
+
+        // Reorder compacted hits by material
+        void SortHitsByMaterial(ClwScene const& scene, int pass, std::size_t size);
+
+        // Reorder extension rays by origin and direction
+        void SortRays(ClwScene const& scene, int pass, std::size_t size);
+
+        // Accumulate number of equal key runs per wavefront into divergence counter
+        void CountKeySegments(CLWBuffer<int> keys, std::size_t size, int counter_idx);
+
+        // Number of work items to launch for persistent-threads kernels
+        std::size_t GetPersistentWorkSize() const;
+
+        // Recreate path guiding grid for a new scene and build its distribution
+        void PreparePathGuiding(ClwScene const& scene);
+
+        // Store output values guided vertices gather their radiance from
+        void SnapshotPathGuidingRadiance(int pass, std::size_t size, CLWBuffer<RadeonRays::float3> output, bool use_output_indices);
+
+        // Splat radiance gathered by the paths into path guiding cache
+        void UpdatePathGuiding(std::size_t size, CLWBuffer<RadeonRays::float3> output, bool use_output_indices);
+
+        // Recreate radiance cache for a new scene
+        void PrepareRadianceCache(ClwScene const& scene);
+
+        // Splat radiance gathered by training paths into radiance cache and resolve it
+        void UpdateRadianceCache(std::size_t size, CLWBuffer<RadeonRays::float3> output, bool use_output_indices);
+
+        // UberV2 kernels used by the current estimate
+        ClwClass& GetUberV2Kernels();
+
         struct PathState;
+        struct PathGuidingVertex;
+        struct RadianceCacheVertex;
+        struct LightReservoir;
         struct RenderData;
+        struct Batch;
+
+        // Swap render data and context of the batch with the estimator ones
+        void SwapBatch(Batch& batch);
 
         std::unique_ptr<RenderData> m_render_data;
+        // Batches of pipelined estimates, empty unless more than one batch is in flight
+        std::vector<std::unique_ptr<Batch>> m_batches;
+        std::uint32_t m_in_flight_batches;
+        // Queue the intersectors are created on, RadeonRays queries are queued to it
+        CLWCommandQueue m_intersector_queue;
         mutable std::uint32_t m_sample_counter;
+        std::uint32_t m_random_seed;
         ClwClass m_uberv2_kernels;
+        ClwClass m_uberv2_generic_kernels;
+        bool m_async_shader_compilation;
+        bool m_use_generic_kernels;
+        // Scene features of the current kernel variant
+        std::uint32_t m_scene_features;
+        ShadingMode m_shading_mode;
+        bool m_sort_by_material;
+        std::vector<std::uint32_t> m_material_variants;
+        // Build options of each variant including the catch-all one
+        std::vector<std::string> m_material_variant_opts;
+        std::uint32_t m_ray_sorting_mask;
+        std::uint32_t m_rr_min_bounce;
+        bool m_caustic_path_split;
+        Regularization m_regularization;
+        float m_max_radiance;
+        std::uint32_t m_light_samples_per_vertex;
+        float m_shadow_ray_culling;
+        bool m_path_guiding;
+        std::size_t m_path_guiding_budget;
+        // Scene and its revision path guiding cache has been learned for
+        ClwScene const* m_path_guiding_scene;
+        std::uint32_t m_path_guiding_revision;
+        std::uint32_t m_path_guiding_cells;
+        bool m_radiance_cache;
+        float m_radiance_cache_cell_size;
+        // Scene and its revision radiance cache has been learned for
+        ClwScene const* m_radiance_cache_scene;
+        std::uint32_t m_radiance_cache_revision;
+        // Cell size used by the cache
+        float m_radiance_cache_cell;
+        bool m_stochastic_layer_selection;
+        bool m_energy_compensation;
+        float m_path_regeneration;
+        bool m_light_resampling;
+        std::uint32_t m_output_width;
+        std::uint32_t m_output_height;
     };
 }
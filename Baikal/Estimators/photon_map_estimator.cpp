@@ -0,0 +1,462 @@
+#include "photon_map_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "Utils/trace.h"
+
+#ifdef BAIKAL_EMBED_KERNELS
+#include "embed_kernels.h"
+#endif
+
+namespace Baikal
+{
+    namespace
+    {
+        // Default number of photon paths traced from the lights
+        std::size_t const kDefaultNumPhotonPaths = 256 * 1024;
+        // Default gather radius relative to the scene diagonal
+        float const kDefaultRelativeRadius = 0.002f;
+    }
+
+    struct PhotonMapEstimator::PhotonMapData
+    {
+        struct PathState
+        {
+#ifndef BAIKAL_COMPACT_PATH
+            float4 throughput;
+            int volume;
+            int flags;
+            int extra0;
+            int light_mask;
+#else
+            // Half precision throughput, flags and volume index packed in state
+            std::uint16_t throughput[3];
+            std::uint16_t light_mask;
+            std::uint32_t state;
+#endif
+        };
+
+        struct Photon
+        {
+            float4 p;
+            float4 wi;
+            float4 power;
+            float4 n;
+        };
+
+        // OpenCL stuff
+        CLWBuffer<ray> rays;
+        CLWBuffer<Intersection> intersections;
+        CLWBuffer<PathState> paths;
+        CLWBuffer<std::uint32_t> random;
+        CLWBuffer<int> count;
+
+        CLWBuffer<Photon> photons;
+        CLWBuffer<int> num_photons;
+        CLWBuffer<int> keys[2];
+        CLWBuffer<int> values[2];
+        CLWBuffer<int> cell_starts;
+        CLWBuffer<int> cell_ends;
+
+        CLWParallelPrimitives pp;
+
+        // RadeonRays stuff
+        Buffer* fr_rays;
+        Buffer* fr_intersections;
+        Buffer* fr_count;
+
+        PhotonMapData()
+            : fr_rays(nullptr)
+            , fr_intersections(nullptr)
+            , fr_count(nullptr)
+        {
+        }
+    };
+
+    PhotonMapEstimator::PhotonMapEstimator(
+        CLWContext context,
+        std::shared_ptr<RadeonRays::IntersectionApi> api,
+        const CLProgramManager *program_manager
+    ) :
+        PathTracingEstimator(context, api, program_manager)
+        , m_photon_map_data(new PhotonMapData)
+#ifdef BAIKAL_EMBED_KERNELS
+        , m_photon_map_kernels(context, program_manager, "photon_map", g_photon_map_opencl, g_photon_map_opencl_headers, "")
+#else
+        , m_photon_map_kernels(context, program_manager, "../Baikal/Kernels/CL/photon_map.cl", "")
+#endif
+        , m_num_photon_paths(kDefaultNumPhotonPaths)
+        , m_radius(0.f)
+        , m_gather_radius(0.f)
+        , m_scene(nullptr)
+        , m_scene_revision(0)
+        , m_num_photons(0)
+        , m_frame(0)
+    {
+        m_photon_map_data->count = context.CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+        m_photon_map_data->num_photons = context.CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+        m_photon_map_data->pp = CLWParallelPrimitives(context, m_photon_map_kernels.GetFullBuildOpts().c_str());
+    }
+
+    PhotonMapEstimator::~PhotonMapEstimator()
+    {
+        GetIntersector()->DeleteBuffer(m_photon_map_data->fr_rays);
+        GetIntersector()->DeleteBuffer(m_photon_map_data->fr_intersections);
+        GetIntersector()->DeleteBuffer(m_photon_map_data->fr_count);
+    }
+
+    void PhotonMapEstimator::SetNumPhotonPaths(std::size_t num_paths)
+    {
+        if (num_paths != m_num_photon_paths)
+        {
+            m_num_photon_paths = num_paths;
+            // Buffers are reallocated on the next trace
+            m_scene = nullptr;
+        }
+    }
+
+    std::size_t PhotonMapEstimator::GetNumPhotonPaths() const
+    {
+        return m_num_photon_paths;
+    }
+
+    void PhotonMapEstimator::SetPhotonRadius(float radius)
+    {
+        if (radius != m_radius)
+        {
+            m_radius = radius;
+            m_scene = nullptr;
+        }
+    }
+
+    float PhotonMapEstimator::GetPhotonRadius() const
+    {
+        return m_radius;
+    }
+
+    float PhotonMapEstimator::GetGatherRadius(ClwScene const& scene) const
+    {
+        if (m_radius > 0.f)
+        {
+            return m_radius;
+        }
+
+        auto diagonal = scene.world_aabb.pmax - scene.world_aabb.pmin;
+        return std::max(std::sqrt(diagonal.sqnorm()) * kDefaultRelativeRadius, 1e-4f);
+    }
+
+    void PhotonMapEstimator::AllocatePhotonBuffers()
+    {
+        auto context = m_photon_map_kernels.GetContext();
+        auto size = m_num_photon_paths;
+
+        m_photon_map_data->rays = context.CreateBuffer<ray>(size, CL_MEM_READ_WRITE);
+        m_photon_map_data->intersections = context.CreateBuffer<Intersection>(size, CL_MEM_READ_WRITE);
+        m_photon_map_data->paths = context.CreateBuffer<PhotonMapData::PathState>(size, CL_MEM_READ_WRITE);
+        m_photon_map_data->photons = context.CreateBuffer<PhotonMapData::Photon>(size, CL_MEM_READ_WRITE);
+
+        for (auto i = 0u; i < 2; ++i)
+        {
+            m_photon_map_data->keys[i] = context.CreateBuffer<int>(size, CL_MEM_READ_WRITE);
+            m_photon_map_data->values[i] = context.CreateBuffer<int>(size, CL_MEM_READ_WRITE);
+        }
+
+        // Hash table has at least as many entries as there are photons
+        std::size_t table_size = 1;
+        while (table_size < size)
+        {
+            table_size <<= 1;
+        }
+
+        m_photon_map_data->cell_starts = context.CreateBuffer<int>(table_size, CL_MEM_READ_WRITE);
+        m_photon_map_data->cell_ends = context.CreateBuffer<int>(table_size, CL_MEM_READ_WRITE);
+
+        // Photon paths use their own seeds to stay uncorrelated with eye paths
+        auto random_buffer = GenerateRandomBuffer(size, 2u);
+
+        m_photon_map_data->random = context.CreateBuffer<std::uint32_t>(size, CL_MEM_READ_WRITE, &random_buffer[0]);
+
+        // Recreate FR buffers
+        GetIntersector()->DeleteBuffer(m_photon_map_data->fr_rays);
+        GetIntersector()->DeleteBuffer(m_photon_map_data->fr_intersections);
+        GetIntersector()->DeleteBuffer(m_photon_map_data->fr_count);
+
+        auto intersector = GetIntersector().get();
+        m_photon_map_data->fr_rays = CreateFromOpenClBuffer(intersector, m_photon_map_data->rays);
+        m_photon_map_data->fr_intersections = CreateFromOpenClBuffer(intersector, m_photon_map_data->intersections);
+        m_photon_map_data->fr_count = CreateFromOpenClBuffer(intersector, m_photon_map_data->count);
+    }
+
+    void PhotonMapEstimator::Estimate(
+        ClwScene const& scene,
+        std::size_t num_estimates,
+        QualityLevel quality,
+        CLWBuffer<RadeonRays::float3> output,
+        bool use_output_indices,
+        bool atomic_update,
+        MissedPrimaryRaysHandler missedPrimaryRaysHandler,
+        PrimaryHitsHandler primaryHitsHandler
+    )
+    {
+        // Scene revision changes on every compile touching anything but the camera
+        if (m_scene != &scene || m_scene_revision != scene.revision)
+        {
+            m_num_photons = 0;
+
+            if (scene.num_lights > 0 && m_num_photon_paths > 0)
+            {
+                TracePhotonMap(scene);
+            }
+
+            m_scene = &scene;
+            m_scene_revision = scene.revision;
+        }
+
+        SetCausticPathSplit(m_num_photons > 0);
+
+        PathTracingEstimator::Estimate(
+            scene,
+            num_estimates,
+            quality,
+            output,
+            use_output_indices,
+            atomic_update,
+            missedPrimaryRaysHandler,
+            primaryHitsHandler);
+    }
+
+    void PhotonMapEstimator::TracePhotonMap(ClwScene const& scene)
+    {
+        BAIKAL_TRACE_SCOPE("estimator", "TracePhotonMap");
+
+        if (m_photon_map_data->photons.GetElementCount() != m_num_photon_paths)
+        {
+            AllocatePhotonBuffers();
+        }
+
+        auto context = m_photon_map_kernels.GetContext();
+        m_gather_radius = GetGatherRadius(scene);
+
+        context.FillBuffer(0, m_photon_map_data->count, (int)m_num_photon_paths, 1);
+        context.FillBuffer(0, m_photon_map_data->num_photons, 0, 1);
+
+        GenerateLightVertices(scene);
+
+        for (auto pass = 0u; pass < GetMaxBounces(); ++pass)
+        {
+            // Intersect photon rays
+            GetIntersector(scene)->QueryIntersection(
+                m_photon_map_data->fr_rays,
+                m_photon_map_data->fr_count,
+                (std::uint32_t)m_num_photon_paths,
+                m_photon_map_data->fr_intersections,
+                nullptr,
+                nullptr
+            );
+
+            // Advance through specular vertices and store photons at diffuse ones
+            TracePhotons(scene, pass);
+
+            context.Flush(0);
+        }
+
+        int num_photons = 0;
+        context.ReadBuffer(0, m_photon_map_data->num_photons, &num_photons, 1).Wait();
+
+        // Photons past the buffer are dropped by the kernel
+        m_num_photons = std::min(num_photons, (int)m_num_photon_paths);
+
+        if (m_num_photons > 0)
+        {
+            BuildPhotonCells(m_num_photons);
+        }
+
+        ++m_frame;
+    }
+
+    void PhotonMapEstimator::GenerateLightVertices(ClwScene const& scene)
+    {
+        auto generate_kernel = m_photon_map_kernels.GetKernel("GenerateLightVertices");
+        auto size = m_num_photon_paths;
+
+        int argc = 0;
+        generate_kernel.SetArg(argc++, (cl_int)size);
+        generate_kernel.SetArg(argc++, scene.vertices);
+        generate_kernel.SetArg(argc++, scene.normals);
+        generate_kernel.SetArg(argc++, scene.uvs);
+        generate_kernel.SetArg(argc++, scene.tangents);
+        generate_kernel.SetArg(argc++, scene.indices);
+        generate_kernel.SetArg(argc++, scene.shapes);
+        generate_kernel.SetArg(argc++, scene.instances);
+        generate_kernel.SetArg(argc++, scene.instance_transforms);
+        generate_kernel.SetArg(argc++, scene.num_base_shapes);
+        generate_kernel.SetArg(argc++, scene.material_attributes);
+        generate_kernel.SetArg(argc++, scene.textures);
+        generate_kernel.SetArg(argc++, scene.texturedata);
+        generate_kernel.SetArg(argc++, scene.texture_requests);
+        if (scene.texture_images)
+        {
+            generate_kernel.SetArg(argc++, scene.texture_images.get());
+        }
+        generate_kernel.SetArg(argc++, scene.envmapidx);
+        generate_kernel.SetArg(argc++, scene.lights);
+        generate_kernel.SetArg(argc++, scene.light_distributions);
+        generate_kernel.SetArg(argc++, scene.envmap_distribution);
+        generate_kernel.SetArg(argc++, scene.num_lights);
+        generate_kernel.SetArg(argc++, Baikal::GetLaunchSeed(GetRandomSeed(), m_frame, LaunchSeed::kPhotonGenerate, 0u));
+        generate_kernel.SetArg(argc++, m_frame);
+        generate_kernel.SetArg(argc++, m_photon_map_data->random);
+        generate_kernel.SetArg(argc++, GetRandomBuffer(RandomBufferType::kSobolLUT));
+        generate_kernel.SetArg(argc++, m_photon_map_data->rays);
+        generate_kernel.SetArg(argc++, m_photon_map_data->paths);
+        generate_kernel.SetArg(argc++, scene.input_map_data);
+
+        {
+            m_photon_map_kernels.GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, generate_kernel);
+        }
+    }
+
+    void PhotonMapEstimator::TracePhotons(ClwScene const& scene, int pass)
+    {
+        auto trace_kernel = m_photon_map_kernels.GetKernel("TracePhotons");
+        auto size = m_num_photon_paths;
+
+        int argc = 0;
+        trace_kernel.SetArg(argc++, (cl_int)size);
+        trace_kernel.SetArg(argc++, m_photon_map_data->rays);
+        trace_kernel.SetArg(argc++, m_photon_map_data->intersections);
+        trace_kernel.SetArg(argc++, scene.vertices);
+        trace_kernel.SetArg(argc++, scene.normals);
+        trace_kernel.SetArg(argc++, scene.uvs);
+        trace_kernel.SetArg(argc++, scene.tangents);
+        trace_kernel.SetArg(argc++, scene.indices);
+        trace_kernel.SetArg(argc++, scene.shapes);
+        trace_kernel.SetArg(argc++, scene.instances);
+        trace_kernel.SetArg(argc++, scene.instance_transforms);
+        trace_kernel.SetArg(argc++, scene.num_base_shapes);
+        trace_kernel.SetArg(argc++, scene.material_attributes);
+        trace_kernel.SetArg(argc++, scene.textures);
+        trace_kernel.SetArg(argc++, scene.texturedata);
+        trace_kernel.SetArg(argc++, scene.texture_requests);
+        if (scene.texture_images)
+        {
+            trace_kernel.SetArg(argc++, scene.texture_images.get());
+        }
+        trace_kernel.SetArg(argc++, scene.envmapidx);
+        trace_kernel.SetArg(argc++, scene.lights);
+        trace_kernel.SetArg(argc++, scene.light_distributions);
+        trace_kernel.SetArg(argc++, scene.envmap_distribution);
+        trace_kernel.SetArg(argc++, scene.num_lights);
+        trace_kernel.SetArg(argc++, Baikal::GetLaunchSeed(GetRandomSeed(), m_frame, LaunchSeed::kPhotonTrace, static_cast<std::uint32_t>(pass)));
+        trace_kernel.SetArg(argc++, m_photon_map_data->random);
+        trace_kernel.SetArg(argc++, GetRandomBuffer(RandomBufferType::kSobolLUT));
+        trace_kernel.SetArg(argc++, pass);
+        trace_kernel.SetArg(argc++, m_frame);
+        trace_kernel.SetArg(argc++, m_photon_map_data->paths);
+        trace_kernel.SetArg(argc++, m_photon_map_data->photons);
+        trace_kernel.SetArg(argc++, m_photon_map_data->num_photons);
+        trace_kernel.SetArg(argc++, scene.input_map_data);
+
+        {
+            m_photon_map_kernels.GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, trace_kernel);
+        }
+    }
+
+    void PhotonMapEstimator::BuildPhotonCells(int num_photons)
+    {
+        auto context = m_photon_map_kernels.GetContext();
+        auto table_mask = (cl_int)m_photon_map_data->cell_starts.GetElementCount() - 1;
+
+        {
+            auto hash_kernel = m_photon_map_kernels.GetKernel("HashPhotons");
+
+            int argc = 0;
+            hash_kernel.SetArg(argc++, m_photon_map_data->photons);
+            hash_kernel.SetArg(argc++, num_photons);
+            hash_kernel.SetArg(argc++, 2.f * m_gather_radius);
+            hash_kernel.SetArg(argc++, table_mask);
+            hash_kernel.SetArg(argc++, m_photon_map_data->keys[0]);
+            hash_kernel.SetArg(argc++, m_photon_map_data->values[0]);
+
+            context.Launch1D(0, ((num_photons + 63) / 64) * 64, 64, hash_kernel);
+        }
+
+        m_photon_map_data->pp.SortRadix(
+            0,
+            m_photon_map_data->keys[0],
+            m_photon_map_data->keys[1],
+            m_photon_map_data->values[0],
+            m_photon_map_data->values[1],
+            num_photons
+        );
+
+        context.FillBuffer(0, m_photon_map_data->cell_starts, -1, table_mask + 1);
+
+        {
+            auto cells_kernel = m_photon_map_kernels.GetKernel("FindPhotonCells");
+
+            int argc = 0;
+            cells_kernel.SetArg(argc++, m_photon_map_data->keys[1]);
+            cells_kernel.SetArg(argc++, num_photons);
+            cells_kernel.SetArg(argc++, m_photon_map_data->cell_starts);
+            cells_kernel.SetArg(argc++, m_photon_map_data->cell_ends);
+
+            context.Launch1D(0, ((num_photons + 63) / 64) * 64, 64, cells_kernel);
+        }
+    }
+
+    void PhotonMapEstimator::OnSurfaceShaded(
+        ClwScene const& scene,
+        int pass,
+        std::size_t size,
+        CLWBuffer<RadeonRays::float3> output,
+        bool use_output_indices
+    )
+    {
+        // Caustics are gathered at the first hit only
+        if (pass != 0 || m_num_photons == 0)
+        {
+            return;
+        }
+
+        auto gather_kernel = m_photon_map_kernels.GetKernel("GatherPhotons");
+
+        int argc = 0;
+        SetHitArgs(gather_kernel, argc, pass, use_output_indices);
+        gather_kernel.SetArg(argc++, scene.vertices);
+        gather_kernel.SetArg(argc++, scene.normals);
+        gather_kernel.SetArg(argc++, scene.uvs);
+        gather_kernel.SetArg(argc++, scene.tangents);
+        gather_kernel.SetArg(argc++, scene.indices);
+        gather_kernel.SetArg(argc++, scene.shapes);
+        gather_kernel.SetArg(argc++, scene.instances);
+        gather_kernel.SetArg(argc++, scene.instance_transforms);
+        gather_kernel.SetArg(argc++, scene.num_base_shapes);
+        gather_kernel.SetArg(argc++, scene.material_attributes);
+        gather_kernel.SetArg(argc++, scene.textures);
+        gather_kernel.SetArg(argc++, scene.texturedata);
+        gather_kernel.SetArg(argc++, scene.texture_requests);
+        if (scene.texture_images)
+        {
+            gather_kernel.SetArg(argc++, scene.texture_images.get());
+        }
+        gather_kernel.SetArg(argc++, m_photon_map_data->photons);
+        gather_kernel.SetArg(argc++, m_photon_map_data->values[1]);
+        gather_kernel.SetArg(argc++, m_photon_map_data->cell_starts);
+        gather_kernel.SetArg(argc++, m_photon_map_data->cell_ends);
+        gather_kernel.SetArg(argc++, (cl_int)m_photon_map_data->cell_starts.GetElementCount() - 1);
+        gather_kernel.SetArg(argc++, m_gather_radius);
+        gather_kernel.SetArg(argc++, 1.f / m_num_photon_paths);
+        gather_kernel.SetArg(argc++, output);
+        gather_kernel.SetArg(argc++, scene.input_map_data);
+
+        // Queued after the shading of the hits, that is to the queue of the batch being estimated
+        {
+            GetContext().Launch1D(0, ((size + 63) / 64) * 64, 64, gather_kernel);
+        }
+    }
+}
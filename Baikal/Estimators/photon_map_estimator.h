@@ -0,0 +1,118 @@
+#pragma once
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+
+#include "path_tracing_estimator.h"
+
+#include <memory>
+
+namespace Baikal
+{
+    /**
+    \brief Path tracing estimator with caustics gathered from a photon map.
+
+    Photons are traced from the lights through chains of specular vertices and
+    stored at the first diffuse vertex they reach. Eye paths reaching a light
+    through specular vertices after a diffuse first hit are skipped by
+    PathTracingEstimator and the radiance at the first hit is estimated from
+    the photons within a fixed radius instead, which trades unbiasedness for
+    noise free caustics. The photon map is kept between frames and is only
+    traced again once the scene changes.
+    */
+    class PhotonMapEstimator : public PathTracingEstimator
+    {
+    public:
+        PhotonMapEstimator(
+            CLWContext context,
+            std::shared_ptr<RadeonRays::IntersectionApi> api,
+            const CLProgramManager *program_manager
+        );
+
+        ~PhotonMapEstimator() override;
+
+        /**
+        \brief Evaluate single sample radiance estimate for a given direction.
+
+        Traces photon map first if the scene has changed since the last call.
+        */
+        void Estimate(
+            ClwScene const& scene,
+            std::size_t num_estimates,
+            QualityLevel quality,
+            CLWBuffer<RadeonRays::float3> output,
+            bool use_output_indices = true,
+            bool atomic_update = false,
+            MissedPrimaryRaysHandler missedPrimaryRaysHandler = nullptr,
+            PrimaryHitsHandler primaryHitsHandler = nullptr
+        ) override;
+
+        /**
+        \brief Set number of photon paths traced from the lights, photon map is traced again.
+        */
+        void SetNumPhotonPaths(std::size_t num_paths);
+        std::size_t GetNumPhotonPaths() const;
+
+        /**
+        \brief Set photon gather radius in world units.
+
+        Zero radius is derived from the scene bounds.
+        */
+        void SetPhotonRadius(float radius);
+        float GetPhotonRadius() const;
+
+    protected:
+        void OnSurfaceShaded(
+            ClwScene const& scene,
+            int pass,
+            std::size_t size,
+            CLWBuffer<RadeonRays::float3> output,
+            bool use_output_indices
+        ) override;
+
+    private:
+        void AllocatePhotonBuffers();
+
+        void TracePhotonMap(ClwScene const& scene);
+
+        void GenerateLightVertices(ClwScene const& scene);
+
+        void TracePhotons(ClwScene const& scene, int pass);
+
+        void BuildPhotonCells(int num_photons);
+
+        float GetGatherRadius(ClwScene const& scene) const;
+
+        struct PhotonMapData;
+
+        std::unique_ptr<PhotonMapData> m_photon_map_data;
+        ClwClass m_photon_map_kernels;
+        std::size_t m_num_photon_paths;
+        float m_radius;
+        // Radius the photon map cells are built for
+        float m_gather_radius;
+        // Scene and its revision the photon map has been traced for
+        ClwScene const* m_scene;
+        std::uint32_t m_scene_revision;
+        int m_num_photons;
+        std::uint32_t m_frame;
+    };
+}
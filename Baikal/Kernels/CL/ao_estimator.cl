@@ -0,0 +1,198 @@
+/**********************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef AO_ESTIMATOR_CL
+#define AO_ESTIMATOR_CL
+
+#include <../Baikal/Kernels/CL/common.cl>
+#include <../Baikal/Kernels/CL/ray.cl>
+#include <../Baikal/Kernels/CL/isect.cl>
+#include <../Baikal/Kernels/CL/utils.cl>
+#include <../Baikal/Kernels/CL/payload.cl>
+#include <../Baikal/Kernels/CL/sampling.cl>
+#include <../Baikal/Kernels/CL/scene.cl>
+
+///< Generate cosine distributed occlusion rays around primary hits, num_ao_rays rays per hit
+///< starting at index * num_ao_rays. Rays of missed primary rays are deactivated.
+KERNEL void GenerateAoRays(
+    // Primary rays
+    GLOBAL ray const* restrict rays,
+    // Primary hits
+    GLOBAL Intersection const* restrict isects,
+    // Number of primary rays
+    GLOBAL int const* restrict num_rays,
+    // Vertices
+    GLOBAL float3 const* restrict vertices,
+    // Normals
+    GLOBAL SceneNormal const* restrict normals,
+    // UVs
+    GLOBAL SceneUV const* restrict uvs,
+    // Tangents
+    GLOBAL SceneTangent const* restrict tangents,
+    // Indices
+    GLOBAL int const* restrict indices,
+    // Shapes
+    GLOBAL Shape const* restrict shapes,
+    // Instances
+    GLOBAL ShapeInstance const* restrict instances,
+    // Instance transforms
+    GLOBAL float4 const* restrict instance_transforms,
+    // Number of base shapes
+    int num_base_shapes,
+    // Occlusion rays per hit
+    int num_ao_rays,
+    // Occlusion distance
+    float ao_radius,
+    // RNG seed
+    uint rng_seed,
+    // Sampler state
+    GLOBAL uint const* restrict random,
+    // Sobol matrices
+    GLOBAL uint const* restrict sobol_mat,
+    // Current frame
+    int frame,
+    // Occlusion rays
+    GLOBAL ray* restrict ao_rays,
+    // Number of occlusion rays
+    GLOBAL int* restrict ao_ray_count
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id == 0)
+    {
+        *ao_ray_count = (*num_rays) * num_ao_rays;
+    }
+
+    if (global_id < *num_rays)
+    {
+        Intersection isect = isects[global_id];
+        GLOBAL ray* out = ao_rays + global_id * num_ao_rays;
+
+        if (isect.shapeid < 0)
+        {
+            for (int k = 0; k < num_ao_rays; ++k)
+            {
+                Ray_SetInactive(out + k);
+            }
+            return;
+        }
+
+        // Only geometry is required, materials are not evaluated
+        Scene scene =
+        {
+            vertices,
+            normals,
+            uvs,
+            tangents,
+            indices,
+            shapes,
+            instances,
+            instance_transforms,
+            num_base_shapes
+        };
+        scene.time = Ray_GetTime(&rays[global_id]);
+
+        Sampler sampler;
+#if SAMPLER == SOBOL
+        uint scramble = random[global_id] * 0x1fe3434f;
+        Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET, scramble);
+#elif SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+        // Per-pixel blue noise value or Owen scrambling seed is used as is
+        uint scramble = random[global_id];
+        Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET, scramble);
+#elif SAMPLER == RANDOM
+        uint scramble = global_id * rng_seed;
+        Sampler_Init(&sampler, scramble);
+#elif SAMPLER == CMJ
+        uint rnd = random[global_id];
+        uint scramble = rnd * 0x1fe3434f * ((frame + 331 * rnd) / (CMJ_DIM * CMJ_DIM));
+        Sampler_Init(&sampler, frame % (CMJ_DIM * CMJ_DIM), SAMPLE_DIM_SURFACE_OFFSET, scramble);
+#endif
+
+        DifferentialGeometry diffgeo;
+        Scene_FillDifferentialGeometry(&scene, &isect, &diffgeo);
+
+        // Occlusion is gathered on the side the ray arrives from
+        float3 wi = -normalize(rays[global_id].d.xyz);
+        float s = dot(diffgeo.ng, wi) < 0.f ? -1.f : 1.f;
+        float3 n = s * diffgeo.n;
+        n = dot(n, s * diffgeo.ng) < 0.f ? s * diffgeo.ng : n;
+        float3 o = diffgeo.p + CRAZY_LOW_DISTANCE * s * diffgeo.ng;
+
+        for (int k = 0; k < num_ao_rays; ++k)
+        {
+            float3 d = Sample_MapToHemisphere(Sampler_Sample2D(&sampler, SAMPLER_ARGS), n, 1.f);
+            Ray_Init(out + k, o, d, ao_radius, scene.time, VISIBILITY_MASK_BOUNCE_SHADOW(0));
+        }
+    }
+}
+
+///< Add unoccluded fraction of the occlusion rays of every hit to the output, misses add background value
+KERNEL void ResolveAo(
+    // Primary hits
+    GLOBAL Intersection const* restrict isects,
+    // Number of primary rays
+    GLOBAL int const* restrict num_rays,
+    // Output indices
+    GLOBAL int const* restrict output_indices,
+    // Occlusion ray hits
+    GLOBAL int const* restrict ao_hits,
+    // Occlusion rays per hit
+    int num_ao_rays,
+    // Value of missed primary rays
+    float background,
+    // Non-zero if missed primary rays have been shaded already
+    int skip_misses,
+    // Output
+    GLOBAL float4* restrict output
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_rays)
+    {
+        bool hit = isects[global_id].shapeid >= 0;
+
+        if (!hit && skip_misses)
+        {
+            return;
+        }
+
+        float value = background;
+
+        if (hit)
+        {
+            int num_unoccluded = 0;
+            for (int k = 0; k < num_ao_rays; ++k)
+            {
+                num_unoccluded += ao_hits[global_id * num_ao_rays + k] == -1 ? 1 : 0;
+            }
+
+            value = (float)num_unoccluded / num_ao_rays;
+        }
+
+        int output_index = output_indices[global_id];
+        ADD_FLOAT4(&output[output_index], make_float4(value, value, value, 1.f));
+    }
+}
+
+#endif // AO_ESTIMATOR_CL
@@ -43,7 +43,9 @@ enum BxdfUberV2SampledComponent
     kBxdfUberV2SampleCoating = 1,
     kBxdfUberV2SampleReflection = 2,
     kBxdfUberV2SampleRefraction = 3,
-    kBxdfUberV2SampleDiffuse = 4
+    kBxdfUberV2SampleDiffuse = 4,
+    // Diffuse layer of SSS material shaded by its diffusion profile
+    kBxdfUberV2SampleSubsurface = 5
 };
 
 /// Returns BxDF flags. Flags stored in first byte of bxdf_flags
@@ -30,6 +30,9 @@ typedef struct _UberV2ShaderData
     float sss_scatter_distance;
     float sss_scatter_direction;
 
+    // SSS layer is shaded by its diffusion profile, only set for materials with SSS layer
+    int sss_diffusion;
+
 } UberV2ShaderData;
 
 bool UberV2IsTransmissive(
@@ -0,0 +1,218 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef BXDF_UBERV2_ALBEDO_CL
+#define BXDF_UBERV2_ALBEDO_CL
+
+// Directional albedo of the UberV2 GGX reflection lobe without Fresnel, i.e. the energy
+// UberV2_MicrofacetGGX_Evaluate with unit color reflects into the upper hemisphere.
+// Rows are roughness and columns cosine of the incident angle, both from 0 to 1 in
+// UBERV2_ALBEDO_LUT_SIZE steps. Integrated numerically with 512x512 stratified samples
+// of the halfway vector. Fresnel is applied by layer blending, so there is no IOR dimension.
+#define UBERV2_ALBEDO_LUT_SIZE 32
+
+__constant float g_uberv2_ggx_albedo[UBERV2_ALBEDO_LUT_SIZE * UBERV2_ALBEDO_LUT_SIZE] =
+{
+    // Roughness 0
+    1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f,
+    1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f,
+    1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f,
+    1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f, 1.0000f,
+    // Roughness 1 / 31
+    0.9167f, 0.8743f, 0.9068f, 0.9408f, 0.9620f, 0.9743f, 0.9818f, 0.9865f,
+    0.9896f, 0.9917f, 0.9933f, 0.9944f, 0.9953f, 0.9960f, 0.9965f, 0.9970f,
+    0.9973f, 0.9976f, 0.9979f, 0.9981f, 0.9982f, 0.9984f, 0.9985f, 0.9986f,
+    0.9988f, 0.9988f, 0.9989f, 0.9990f, 0.9991f, 0.9991f, 0.9990f, 0.9980f,
+    // Roughness 2 / 31
+    0.9175f, 0.8829f, 0.8735f, 0.8861f, 0.9057f, 0.9244f, 0.9398f, 0.9519f,
+    0.9611f, 0.9681f, 0.9735f, 0.9777f, 0.9810f, 0.9836f, 0.9856f, 0.9873f,
+    0.9887f, 0.9898f, 0.9908f, 0.9915f, 0.9922f, 0.9927f, 0.9930f, 0.9933f,
+    0.9933f, 0.9937f, 0.9941f, 0.9945f, 0.9948f, 0.9951f, 0.9953f, 0.9957f,
+    // Roughness 3 / 31
+    0.9168f, 0.8917f, 0.8747f, 0.8715f, 0.8782f, 0.8899f, 0.9031f, 0.9158f,
+    0.9272f, 0.9371f, 0.9454f, 0.9524f, 0.9581f, 0.9629f, 0.9668f, 0.9701f,
+    0.9727f, 0.9748f, 0.9765f, 0.9785f, 0.9802f, 0.9817f, 0.9830f, 0.9841f,
+    0.9851f, 0.9858f, 0.9864f, 0.9871f, 0.9877f, 0.9882f, 0.9887f, 0.9891f,
+    // Roughness 4 / 31
+    0.9149f, 0.8955f, 0.8787f, 0.8694f, 0.8677f, 0.8716f, 0.8791f, 0.8882f,
+    0.8977f, 0.9071f, 0.9157f, 0.9235f, 0.9303f, 0.9362f, 0.9415f, 0.9467f,
+    0.9514f, 0.9554f, 0.9589f, 0.9619f, 0.9645f, 0.9667f, 0.9686f, 0.9706f,
+    0.9723f, 0.9737f, 0.9749f, 0.9761f, 0.9771f, 0.9781f, 0.9790f, 0.9797f,
+    // Roughness 5 / 31
+    0.9117f, 0.8957f, 0.8802f, 0.8689f, 0.8627f, 0.8611f, 0.8632f, 0.8678f,
+    0.8739f, 0.8807f, 0.8877f, 0.8947f, 0.9022f, 0.9096f, 0.9162f, 0.9223f,
+    0.9277f, 0.9325f, 0.9367f, 0.9407f, 0.9444f, 0.9477f, 0.9505f, 0.9532f,
+    0.9556f, 0.9577f, 0.9597f, 0.9614f, 0.9631f, 0.9646f, 0.9659f, 0.9672f,
+    // Roughness 6 / 31
+    0.9070f, 0.8930f, 0.8787f, 0.8668f, 0.8582f, 0.8531f, 0.8511f, 0.8517f,
+    0.8542f, 0.8583f, 0.8640f, 0.8708f, 0.8776f, 0.8842f, 0.8904f, 0.8963f,
+    0.9019f, 0.9075f, 0.9126f, 0.9171f, 0.9214f, 0.9255f, 0.9291f, 0.9325f,
+    0.9355f, 0.9384f, 0.9410f, 0.9434f, 0.9456f, 0.9476f, 0.9495f, 0.9512f,
+    // Roughness 7 / 31
+    0.9009f, 0.8881f, 0.8747f, 0.8625f, 0.8525f, 0.8451f, 0.8403f, 0.8380f,
+    0.8380f, 0.8407f, 0.8448f, 0.8495f, 0.8545f, 0.8598f, 0.8653f, 0.8710f,
+    0.8766f, 0.8818f, 0.8870f, 0.8920f, 0.8966f, 0.9010f, 0.9051f, 0.9090f,
+    0.9127f, 0.9161f, 0.9192f, 0.9222f, 0.9249f, 0.9275f, 0.9299f, 0.9321f,
+    // Roughness 8 / 31
+    0.8936f, 0.8814f, 0.8684f, 0.8561f, 0.8453f, 0.8365f, 0.8299f, 0.8257f,
+    0.8248f, 0.8255f, 0.8273f, 0.8298f, 0.8332f, 0.8373f, 0.8419f, 0.8465f,
+    0.8514f, 0.8564f, 0.8612f, 0.8660f, 0.8707f, 0.8752f, 0.8795f, 0.8837f,
+    0.8876f, 0.8914f, 0.8950f, 0.8983f, 0.9015f, 0.9045f, 0.9074f, 0.9100f,
+    // Roughness 9 / 31
+    0.8851f, 0.8733f, 0.8605f, 0.8481f, 0.8368f, 0.8271f, 0.8195f, 0.8149f,
+    0.8124f, 0.8110f, 0.8108f, 0.8116f, 0.8137f, 0.8163f, 0.8195f, 0.8232f,
+    0.8271f, 0.8313f, 0.8356f, 0.8400f, 0.8443f, 0.8486f, 0.8529f, 0.8570f,
+    0.8611f, 0.8650f, 0.8687f, 0.8723f, 0.8758f, 0.8791f, 0.8822f, 0.8853f,
+    // Roughness 10 / 31
+    0.8758f, 0.8641f, 0.8514f, 0.8389f, 0.8272f, 0.8170f, 0.8091f, 0.8038f,
+    0.7997f, 0.7967f, 0.7949f, 0.7946f, 0.7950f, 0.7963f, 0.7983f, 0.8007f,
+    0.8036f, 0.8069f, 0.8104f, 0.8141f, 0.8179f, 0.8218f, 0.8257f, 0.8296f,
+    0.8335f, 0.8373f, 0.8410f, 0.8447f, 0.8482f, 0.8517f, 0.8550f, 0.8582f,
+    // Roughness 11 / 31
+    0.8657f, 0.8539f, 0.8412f, 0.8285f, 0.8166f, 0.8062f, 0.7984f, 0.7921f,
+    0.7867f, 0.7825f, 0.7798f, 0.7779f, 0.7771f, 0.7771f, 0.7778f, 0.7791f,
+    0.7809f, 0.7831f, 0.7857f, 0.7886f, 0.7917f, 0.7949f, 0.7983f, 0.8018f,
+    0.8053f, 0.8088f, 0.8123f, 0.8158f, 0.8193f, 0.8227f, 0.8260f, 0.8293f,
+    // Roughness 12 / 31
+    0.8550f, 0.8430f, 0.8301f, 0.8173f, 0.8053f, 0.7949f, 0.7869f, 0.7796f,
+    0.7733f, 0.7684f, 0.7645f, 0.7615f, 0.7595f, 0.7583f, 0.7578f, 0.7580f,
+    0.7588f, 0.7600f, 0.7616f, 0.7636f, 0.7658f, 0.7683f, 0.7711f, 0.7739f,
+    0.7769f, 0.7800f, 0.7831f, 0.7863f, 0.7895f, 0.7927f, 0.7958f, 0.7990f,
+    // Roughness 13 / 31
+    0.8438f, 0.8316f, 0.8185f, 0.8055f, 0.7933f, 0.7832f, 0.7745f, 0.7665f,
+    0.7596f, 0.7539f, 0.7490f, 0.7452f, 0.7421f, 0.7399f, 0.7383f, 0.7374f,
+    0.7371f, 0.7373f, 0.7380f, 0.7390f, 0.7404f, 0.7421f, 0.7440f, 0.7462f,
+    0.7485f, 0.7510f, 0.7536f, 0.7563f, 0.7591f, 0.7619f, 0.7648f, 0.7677f,
+    // Roughness 14 / 31
+    0.8321f, 0.8196f, 0.8062f, 0.7930f, 0.7808f, 0.7708f, 0.7615f, 0.7529f,
+    0.7455f, 0.7390f, 0.7335f, 0.7287f, 0.7248f, 0.7216f, 0.7191f, 0.7172f,
+    0.7159f, 0.7152f, 0.7149f, 0.7150f, 0.7155f, 0.7163f, 0.7174f, 0.7188f,
+    0.7204f, 0.7223f, 0.7242f, 0.7264f, 0.7286f, 0.7309f, 0.7334f, 0.7359f,
+    // Roughness 15 / 31
+    0.8200f, 0.8072f, 0.7936f, 0.7801f, 0.7679f, 0.7577f, 0.7478f, 0.7389f,
+    0.7310f, 0.7239f, 0.7176f, 0.7122f, 0.7074f, 0.7034f, 0.7000f, 0.6973f,
+    0.6951f, 0.6934f, 0.6922f, 0.6914f, 0.6910f, 0.6910f, 0.6913f, 0.6919f,
+    0.6928f, 0.6938f, 0.6951f, 0.6966f, 0.6982f, 0.7000f, 0.7018f, 0.7038f,
+    // Roughness 16 / 31
+    0.8077f, 0.7945f, 0.7806f, 0.7669f, 0.7548f, 0.7441f, 0.7338f, 0.7246f,
+    0.7161f, 0.7085f, 0.7016f, 0.6955f, 0.6900f, 0.6853f, 0.6811f, 0.6776f,
+    0.6745f, 0.6720f, 0.6699f, 0.6683f, 0.6671f, 0.6662f, 0.6657f, 0.6655f,
+    0.6656f, 0.6659f, 0.6664f, 0.6672f, 0.6682f, 0.6693f, 0.6705f, 0.6719f,
+    // Roughness 17 / 31
+    0.7951f, 0.7816f, 0.7672f, 0.7533f, 0.7413f, 0.7300f, 0.7194f, 0.7098f,
+    0.7009f, 0.6928f, 0.6854f, 0.6787f, 0.6726f, 0.6672f, 0.6623f, 0.6580f,
+    0.6542f, 0.6510f, 0.6481f, 0.6457f, 0.6437f, 0.6420f, 0.6407f, 0.6397f,
+    0.6390f, 0.6386f, 0.6384f, 0.6384f, 0.6387f, 0.6391f, 0.6397f, 0.6405f,
+    // Roughness 18 / 31
+    0.7823f, 0.7684f, 0.7537f, 0.7396f, 0.7274f, 0.7157f, 0.7049f, 0.6948f,
+    0.6856f, 0.6770f, 0.6691f, 0.6618f, 0.6552f, 0.6492f, 0.6437f, 0.6387f,
+    0.6342f, 0.6302f, 0.6267f, 0.6235f, 0.6208f, 0.6184f, 0.6163f, 0.6146f,
+    0.6131f, 0.6119f, 0.6110f, 0.6103f, 0.6099f, 0.6096f, 0.6095f, 0.6096f,
+    // Roughness 19 / 31
+    0.7693f, 0.7550f, 0.7400f, 0.7257f, 0.7132f, 0.7012f, 0.6901f, 0.6796f,
+    0.6700f, 0.6610f, 0.6526f, 0.6449f, 0.6378f, 0.6312f, 0.6251f, 0.6196f,
+    0.6145f, 0.6099f, 0.6056f, 0.6018f, 0.5984f, 0.5953f, 0.5925f, 0.5901f,
+    0.5879f, 0.5860f, 0.5844f, 0.5830f, 0.5819f, 0.5809f, 0.5802f, 0.5796f,
+    // Roughness 20 / 31
+    0.7563f, 0.7416f, 0.7262f, 0.7117f, 0.6989f, 0.6865f, 0.6751f, 0.6644f,
+    0.6543f, 0.6449f, 0.6362f, 0.6280f, 0.6204f, 0.6133f, 0.6068f, 0.6007f,
+    0.5950f, 0.5898f, 0.5850f, 0.5806f, 0.5765f, 0.5728f, 0.5694f, 0.5663f,
+    0.5635f, 0.5609f, 0.5587f, 0.5566f, 0.5548f, 0.5532f, 0.5518f, 0.5506f,
+    // Roughness 21 / 31
+    0.7431f, 0.7280f, 0.7123f, 0.6977f, 0.6845f, 0.6718f, 0.6601f, 0.6490f,
+    0.6386f, 0.6289f, 0.6197f, 0.6112f, 0.6031f, 0.5956f, 0.5886f, 0.5820f,
+    0.5759f, 0.5701f, 0.5648f, 0.5598f, 0.5552f, 0.5509f, 0.5469f, 0.5432f,
+    0.5398f, 0.5367f, 0.5338f, 0.5311f, 0.5287f, 0.5265f, 0.5244f, 0.5226f,
+    // Roughness 22 / 31
+    0.7299f, 0.7144f, 0.6984f, 0.6836f, 0.6700f, 0.6571f, 0.6450f, 0.6336f,
+    0.6229f, 0.6128f, 0.6033f, 0.5944f, 0.5860f, 0.5781f, 0.5706f, 0.5636f,
+    0.5570f, 0.5508f, 0.5450f, 0.5395f, 0.5344f, 0.5296f, 0.5251f, 0.5209f,
+    0.5169f, 0.5132f, 0.5098f, 0.5066f, 0.5036f, 0.5008f, 0.4982f, 0.4958f,
+    // Roughness 23 / 31
+    0.7167f, 0.7008f, 0.6844f, 0.6695f, 0.6555f, 0.6424f, 0.6299f, 0.6182f,
+    0.6072f, 0.5968f, 0.5870f, 0.5777f, 0.5690f, 0.5607f, 0.5529f, 0.5455f,
+    0.5385f, 0.5319f, 0.5257f, 0.5198f, 0.5142f, 0.5089f, 0.5039f, 0.4992f,
+    0.4948f, 0.4906f, 0.4867f, 0.4830f, 0.4795f, 0.4762f, 0.4731f, 0.4701f,
+    // Roughness 24 / 31
+    0.7034f, 0.6872f, 0.6705f, 0.6554f, 0.6411f, 0.6276f, 0.6149f, 0.6030f,
+    0.5916f, 0.5810f, 0.5708f, 0.5612f, 0.5522f, 0.5436f, 0.5354f, 0.5277f,
+    0.5203f, 0.5134f, 0.5068f, 0.5005f, 0.4945f, 0.4889f, 0.4835f, 0.4784f,
+    0.4735f, 0.4689f, 0.4645f, 0.4604f, 0.4564f, 0.4526f, 0.4491f, 0.4457f,
+    // Roughness 25 / 31
+    0.6903f, 0.6737f, 0.6567f, 0.6413f, 0.6267f, 0.6130f, 0.6000f, 0.5878f,
+    0.5762f, 0.5652f, 0.5548f, 0.5450f, 0.5356f, 0.5267f, 0.5183f, 0.5102f,
+    0.5026f, 0.4953f, 0.4883f, 0.4817f, 0.4754f, 0.4694f, 0.4637f, 0.4582f,
+    0.4530f, 0.4480f, 0.4432f, 0.4387f, 0.4344f, 0.4302f, 0.4262f, 0.4224f,
+    // Roughness 26 / 31
+    0.6771f, 0.6603f, 0.6430f, 0.6274f, 0.6125f, 0.5985f, 0.5853f, 0.5728f,
+    0.5609f, 0.5497f, 0.5390f, 0.5289f, 0.5193f, 0.5101f, 0.5014f, 0.4931f,
+    0.4852f, 0.4776f, 0.4704f, 0.4635f, 0.4569f, 0.4506f, 0.4446f, 0.4388f,
+    0.4333f, 0.4280f, 0.4229f, 0.4180f, 0.4133f, 0.4088f, 0.4045f, 0.4004f,
+    // Roughness 27 / 31
+    0.6641f, 0.6469f, 0.6294f, 0.6135f, 0.5984f, 0.5841f, 0.5706f, 0.5579f,
+    0.5458f, 0.5344f, 0.5235f, 0.5131f, 0.5033f, 0.4939f, 0.4849f, 0.4764f,
+    0.4682f, 0.4604f, 0.4530f, 0.4458f, 0.4390f, 0.4324f, 0.4261f, 0.4201f,
+    0.4143f, 0.4087f, 0.4034f, 0.3982f, 0.3933f, 0.3885f, 0.3839f, 0.3795f,
+    // Roughness 28 / 31
+    0.6512f, 0.6337f, 0.6159f, 0.5998f, 0.5844f, 0.5699f, 0.5562f, 0.5432f,
+    0.5309f, 0.5193f, 0.5082f, 0.4976f, 0.4876f, 0.4780f, 0.4688f, 0.4601f,
+    0.4517f, 0.4437f, 0.4360f, 0.4287f, 0.4216f, 0.4149f, 0.4084f, 0.4021f,
+    0.3961f, 0.3903f, 0.3847f, 0.3794f, 0.3742f, 0.3692f, 0.3644f, 0.3597f,
+    // Roughness 29 / 31
+    0.6383f, 0.6205f, 0.6025f, 0.5862f, 0.5706f, 0.5559f, 0.5420f, 0.5288f,
+    0.5163f, 0.5044f, 0.4932f, 0.4824f, 0.4722f, 0.4624f, 0.4531f, 0.4442f,
+    0.4356f, 0.4274f, 0.4196f, 0.4121f, 0.4049f, 0.3979f, 0.3912f, 0.3848f,
+    0.3786f, 0.3727f, 0.3669f, 0.3614f, 0.3561f, 0.3509f, 0.3459f, 0.3411f,
+    // Roughness 30 / 31
+    0.6257f, 0.6076f, 0.5894f, 0.5728f, 0.5570f, 0.5421f, 0.5280f, 0.5146f,
+    0.5019f, 0.4899f, 0.4784f, 0.4675f, 0.4571f, 0.4472f, 0.4377f, 0.4287f,
+    0.4200f, 0.4117f, 0.4037f, 0.3960f, 0.3887f, 0.3816f, 0.3748f, 0.3682f,
+    0.3619f, 0.3558f, 0.3500f, 0.3443f, 0.3388f, 0.3335f, 0.3284f, 0.3235f,
+    // Roughness 1
+    0.6131f, 0.5948f, 0.5764f, 0.5596f, 0.5436f, 0.5285f, 0.5142f, 0.5007f,
+    0.4878f, 0.4756f, 0.4640f, 0.4530f, 0.4424f, 0.4324f, 0.4228f, 0.4136f,
+    0.4048f, 0.3964f, 0.3883f, 0.3805f, 0.3730f, 0.3659f, 0.3590f, 0.3523f,
+    0.3459f, 0.3397f, 0.3338f, 0.3280f, 0.3225f, 0.3171f, 0.3119f, 0.3069f
+};
+
+/// Directional albedo of the GGX reflection lobe, bilinearly interpolated
+float UberV2_GGX_GetAlbedo(
+    // Roughness
+    float roughness,
+    // Cosine of the incident angle
+    float costheta
+)
+{
+    float x = clamp(fabs(costheta), 0.f, 1.f) * (UBERV2_ALBEDO_LUT_SIZE - 1);
+    float y = clamp(roughness, 0.f, 1.f) * (UBERV2_ALBEDO_LUT_SIZE - 1);
+
+    int x0 = min((int)x, UBERV2_ALBEDO_LUT_SIZE - 2);
+    int y0 = min((int)y, UBERV2_ALBEDO_LUT_SIZE - 2);
+    float tx = x - x0;
+    float ty = y - y0;
+
+    __constant float const* row0 = g_uberv2_ggx_albedo + y0 * UBERV2_ALBEDO_LUT_SIZE;
+    __constant float const* row1 = row0 + UBERV2_ALBEDO_LUT_SIZE;
+
+    return mix(mix(row0[x0], row0[x0 + 1], tx), mix(row1[x0], row1[x0 + 1], tx), ty);
+}
+
+#endif // BXDF_UBERV2_ALBEDO_CL
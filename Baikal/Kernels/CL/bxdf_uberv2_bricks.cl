@@ -1,6 +1,8 @@
 #ifndef BXDF_UBERV2_BRICKS
 #define BXDF_UBERV2_BRICKS
 
+#include <../Baikal/Kernels/CL/bxdf_uberv2_albedo.cl>
+
 // Utility functions for Uberv2
 /// Calculates Fresnel for provided parameters. Swaps IORs if needed
 float CalculateFresnel(
@@ -72,6 +74,66 @@ float Fresnel_Blend_F(
     return fresnel * top_value + (1.f - fresnel) * bottom_value;
 }
 
+/// Calculates weight of the reflection layer over the layers underneath. With energy compensation
+/// the layer keeps only the energy its rough lobe reflects, the rest goes to the layers underneath.
+/// Layer selection in GetMaterialBxDFType uses the same weight, so blends stay unbiased.
+float UberV2_GetReflectionWeight(
+    // IORs
+    float top_ior,
+    float bottom_ior,
+    // Roughness of reflection lobe
+    float roughness,
+    // Angle between normal and incoming ray
+    float ndotwi
+)
+{
+    float weight = CalculateFresnel(top_ior, bottom_ior, ndotwi);
+#ifdef BAIKAL_UBERV2_ENERGY_COMPENSATION
+    if (roughness >= ROUGHNESS_EPS)
+    {
+        weight *= UberV2_GGX_GetAlbedo(roughness, ndotwi);
+    }
+#endif
+    return weight;
+}
+
+// Blends reflection layer over underlying value for float3 values.
+// W(top_ior, bottom_ior, roughness) * top_value + (1 - W(top_ior, bottom_ior, roughness)) * bottom_value
+float3 Reflection_Blend(
+    // IORs
+    float top_ior,
+    float bottom_ior,
+    // Roughness of reflection lobe
+    float roughness,
+    // Values to blend
+    float3 top_value,
+    float3 bottom_value,
+    // Incoming direction
+    float3 wi
+)
+{
+    float weight = UberV2_GetReflectionWeight(top_ior, bottom_ior, roughness, wi.y);
+    return weight * top_value + (1.f - weight) * bottom_value;
+}
+
+// Blends reflection layer over underlying value for float values.
+float Reflection_Blend_F(
+    // IORs
+    float top_ior,
+    float bottom_ior,
+    // Roughness of reflection lobe
+    float roughness,
+    // Values to blend
+    float top_value,
+    float bottom_value,
+    // Incoming direction
+    float3 wi
+)
+{
+    float weight = UberV2_GetReflectionWeight(top_ior, bottom_ior, roughness, wi.y);
+    return weight * top_value + (1.f - weight) * bottom_value;
+}
+
 // Diffuse layer
 float3 UberV2_Lambert_Evaluate(
     // Preprocessed shader input data
@@ -126,6 +188,138 @@ float3 UberV2_Lambert_Sample(
     return kd;
 }
 
+// Subsurface scattering
+/*
+Diffusion profile: Christensen-Burley normalized diffusion
+R(r) = A * (exp(-r / d) + exp(-r / 3d)) / (8 * PI * d * r)
+*/
+/// Checks if diffuse layer of SSS material is shaded by its diffusion profile.
+/// Only the path tracer traces probe rays, other integrators keep shading it as diffuse.
+bool UberV2_IsDiffusionSSS(
+    // Preprocessed shader input data
+    UberV2ShaderData const* shader_data
+)
+{
+#ifdef BAIKAL_UBERV2_DIFFUSION_SSS
+    return shader_data->sss_diffusion != 0;
+#else
+    return false;
+#endif
+}
+
+// Per channel shape parameter d of the profile fitted to the albedo
+float3 UberV2_DiffusionProfile_GetShape(
+    // Preprocessed shader input data
+    UberV2ShaderData const* shader_data
+)
+{
+    const float3 albedo = clamp(shader_data->sss_scatter_color.xyz, 0.f, 1.f);
+    const float3 a = albedo - 0.8f;
+    const float3 scale = 1.9f - albedo + 3.5f * a * a;
+    return max(shader_data->sss_scatter_distance, DENOM_EPS) / scale;
+}
+
+// PDF of the radius per channel, profile integrated over the angle and divided by albedo
+float3 UberV2_DiffusionProfile_GetRadiusPdf(
+    // Shape parameter
+    float3 d,
+    // Distance to the entry point
+    float r
+)
+{
+    return 0.25f * exp(-r / d) / d + 0.25f * exp(-r / (3.f * d)) / d;
+}
+
+/// Samples radius and angle of a probe around the entry point, sample.x picks the channel
+/// and the exponential of the profile. Returns the profile over PDF of the chosen radius
+/// for all channels, the exit point is assumed to lie in the tangent plane.
+float3 UberV2_DiffusionProfile_Sample(
+    // Preprocessed shader input data
+    UberV2ShaderData const* shader_data,
+    // Sample
+    float2 sample,
+    // Sampled radius
+    float* radius,
+    // Sampled angle
+    float* phi,
+    // Radius of the probe sphere
+    float* max_radius
+)
+{
+    const float3 d = UberV2_DiffusionProfile_GetShape(shader_data);
+
+    float u = sample.x * 3.f;
+    const int channel = min((int)u, 2);
+    u -= channel;
+
+    const float dc = channel == 0 ? d.x : (channel == 1 ? d.y : d.z);
+    const float mean = u < 0.25f ? dc : 3.f * dc;
+    u = u < 0.25f ? u * 4.f : (u - 0.25f) / 0.75f;
+
+    *radius = -mean * log(max(1.f - u, DENOM_EPS));
+    *phi = 2.f * PI * sample.y;
+    // Sphere keeps 99.7% of the energy of the widest channel
+    *max_radius = 16.6f * max(d.x, max(d.y, d.z));
+
+    const float3 pdf = UberV2_DiffusionProfile_GetRadiusPdf(d, *radius);
+    const float mixture_pdf = (pdf.x + pdf.y + pdf.z) / 3.f;
+
+    return (*radius < *max_radius && mixture_pdf > DENOM_EPS) ?
+        clamp(shader_data->sss_scatter_color.xyz, 0.f, 1.f) * pdf / mixture_pdf : 0.f;
+}
+
+// Exit of light scattered under the surface
+float3 UberV2_Subsurface_Evaluate(
+    // Preprocessed shader input data
+    UberV2ShaderData const* shader_data,
+    // Incoming direction
+    float3 wi,
+    // Outgoing direction
+    float3 wo,
+    // Texture args
+    TEXTURE_ARG_LIST
+)
+{
+    return shader_data->sss_subsurface_color.xyz / PI;
+}
+
+float UberV2_Subsurface_GetPdf(
+    // Preprocessed shader input data
+    UberV2ShaderData const* shader_data,
+    // Incoming direction
+    float3 wi,
+    // Outgoing direction
+    float3 wo,
+    // Texture args
+    TEXTURE_ARG_LIST
+)
+{
+    return fabs(wo.y) / PI;
+}
+
+/// Exit lobe sampling
+float3 UberV2_Subsurface_Sample(
+    // Preprocessed shader input data
+    UberV2ShaderData const* shader_data,
+    // Incoming direction
+    float3 wi,
+    // Texture args
+    TEXTURE_ARG_LIST,
+    // Sample
+    float2 sample,
+    // Outgoing direction
+    float3* wo,
+    // PDF at wo
+    float* pdf
+)
+{
+    *wo = Sample_MapToHemisphere(sample, make_float3(0.f, 1.f, 0.f), 1.f);
+
+    *pdf = fabs((*wo).y) / PI;
+
+    return UberV2_Subsurface_Evaluate(shader_data, wi, *wo, TEXTURE_ARGS);
+}
+
 // Reflection/Coating
 /*
 Microfacet GGX
@@ -620,6 +814,10 @@ float3 UberV2_Reflection_Evaluate(
     const float3 ks = shader_data->reflection_color.xyz;
 
     float3 color = mix((float3)(1.0f, 1.0f, 1.0f), ks, metalness);
+#ifdef BAIKAL_UBERV2_ENERGY_COMPENSATION
+    // Energy lost to single scattering is put back, see UberV2_GetReflectionWeight
+    color /= is_singular ? 1.f : UberV2_GGX_GetAlbedo(shader_data->reflection_roughness, wi.y);
+#endif
 
     return is_singular ?
         UberV2_IdealReflect_Evaluate(shader_data, wi, wo, TEXTURE_ARGS) :
@@ -700,6 +898,9 @@ float3 UberV2_Reflection_Sample(
     const float metalness = shader_data->reflection_metalness;
 
     float3 color = mix((float3)(1.0f, 1.0f, 1.0f), ks, metalness);
+#ifdef BAIKAL_UBERV2_ENERGY_COMPENSATION
+    color /= is_singular ? 1.f : UberV2_GGX_GetAlbedo(shader_data->reflection_roughness, wi.y);
+#endif
 
     return is_singular ?
         UberV2_IdealReflect_Sample(shader_data, wi, TEXTURE_ARGS, wo, pdf, color) :
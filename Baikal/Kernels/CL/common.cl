@@ -47,8 +47,13 @@ THE SOFTWARE.
 #define RANDOM 1
 #define SOBOL 2
 #define CMJ 3
+#define BLUE_NOISE_SOBOL 4
+#define OWEN_SOBOL 5
 
+// Can be overridden at build time (see Estimator::SetSamplerType)
+#ifndef SAMPLER
 #define SAMPLER CMJ
+#endif
 
 #define CMJ_DIM 16
 
@@ -69,4 +74,21 @@ THE SOFTWARE.
 #define VISIBILITY_MASK_BOUNCE(i) (VISIBILITY_MASK_PRIMARY << (i))
 #define VISIBILITY_MASK_BOUNCE_SHADOW(i) (VISIBILITY_MASK_SHADOW << (i))
 
+// Fast build profile maps these to native functions, see CLProgramManager::BuildProfile
+#ifdef BAIKAL_FAST_MATH
+#define FAST_SIN(x) native_sin(x)
+#define FAST_COS(x) native_cos(x)
+#define FAST_SQRT(x) native_sqrt(x)
+#define FAST_EXP(x) native_exp(x)
+#define FAST_LOG(x) native_log(x)
+#define FAST_POWR(x,y) native_powr((x),(y))
+#else
+#define FAST_SIN(x) sin(x)
+#define FAST_COS(x) cos(x)
+#define FAST_SQRT(x) sqrt(x)
+#define FAST_EXP(x) exp(x)
+#define FAST_LOG(x) log(x)
+#define FAST_POWR(x,y) pow((x),(y))
+#endif
+
 #endif // COMMON_CL
@@ -0,0 +1,284 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef CURVES_CL
+#define CURVES_CL
+
+#include <../Baikal/Kernels/CL/common.cl>
+#include <../Baikal/Kernels/CL/utils.cl>
+#include <../Baikal/Kernels/CL/payload.cl>
+
+// Curves are intersected by the renderer in a pass following the intersector one. Every segment
+// is a tube around its axis with the radius interpolated from control points (kept in w of vertices).
+// B-spline segments are subdivided into CURVES_BSPLINE_STEPS linear pieces for intersection.
+// Hits carry the position along the segment in u and the angle around the axis in v, relative
+// to the frame built from the axis tangent, so the normal is restored without extra storage.
+#define CURVES_BSPLINE_STEPS 8
+#define CURVES_STACK_SIZE 32
+// Hits closer than this fraction of the radius are taken for the surface the ray leaves
+#define CURVES_SELF_HIT_EPS 1e-3f
+
+// Point (xyz) and radius (w) of uniform cubic B-spline at u
+INLINE float4 Curves_EvaluateBSpline(float4 p0, float4 p1, float4 p2, float4 p3, float u)
+{
+    float s = 1.f - u;
+    float u2 = u * u;
+    float u3 = u2 * u;
+
+    return (s * s * s * p0 + (3.f * u3 - 6.f * u2 + 4.f) * p1 + (-3.f * u3 + 3.f * u2 + 3.f * u + 1.f) * p2 + u3 * p3) / 6.f;
+}
+
+// Derivative of uniform cubic B-spline at u
+INLINE float4 Curves_EvaluateBSplineDerivative(float4 p0, float4 p1, float4 p2, float4 p3, float u)
+{
+    float s = 1.f - u;
+    float u2 = u * u;
+
+    return (-s * s * p0 + (3.f * u2 - 4.f * u) * p1 + (-3.f * u2 + 2.f * u + 1.f) * p2 + u2 * p3) * 0.5f;
+}
+
+// Axis point with radius in w and axis tangent of the segment starting at the given control point
+INLINE float4 Curves_Evaluate(GLOBAL float4 const* restrict points, int first, bool bspline, float u, float3* tangent)
+{
+    if (bspline)
+    {
+        float4 p0 = points[first];
+        float4 p1 = points[first + 1];
+        float4 p2 = points[first + 2];
+        float4 p3 = points[first + 3];
+
+        *tangent = Curves_EvaluateBSplineDerivative(p0, p1, p2, p3, u).xyz;
+        return Curves_EvaluateBSpline(p0, p1, p2, p3, u);
+    }
+
+    *tangent = points[first + 1].xyz - points[first].xyz;
+    return mix(points[first], points[first + 1], u);
+}
+
+// Normal of the tube at the angle v (in turns) around the axis with the given tangent
+INLINE float3 Curves_GetNormal(float3 tangent, float v)
+{
+    float3 t = normalize(tangent);
+    float3 b1 = GetOrthoVector(t);
+    float3 b2 = cross(t, b1);
+    float phi = 2.f * PI * (v - 0.5f);
+    return cos(phi) * b1 + sin(phi) * b2;
+}
+
+// Angle in turns of the normal around the axis, inverse of Curves_GetNormal
+INLINE float Curves_GetAngle(float3 tangent, float3 n)
+{
+    float3 t = normalize(tangent);
+    float3 b1 = GetOrthoVector(t);
+    float3 b2 = cross(t, b1);
+    return atan2(dot(n, b2), dot(n, b1)) / (2.f * PI) + 0.5f;
+}
+
+// Inverse of an affine transform
+INLINE matrix4x4 Curves_InverseTransform(matrix4x4 m)
+{
+    float3 c0 = cross(m.m1.xyz, m.m2.xyz);
+    float3 c1 = cross(m.m2.xyz, m.m0.xyz);
+    float3 c2 = cross(m.m0.xyz, m.m1.xyz);
+    float inv_det = 1.f / dot(m.m0.xyz, c0);
+
+    matrix4x4 r = matrix_from_cols3(c0 * inv_det, c1 * inv_det, c2 * inv_det);
+    float3 t = -matrix_mul_vector3(r, make_float3(m.m0.w, m.m1.w, m.m2.w));
+    r.m0.w = t.x;
+    r.m1.w = t.y;
+    r.m2.w = t.z;
+    return r;
+}
+
+// Slab test of the ray against node bounds
+INLINE bool Curves_IntersectBounds(GLOBAL CurveNode const* node, float3 o, float3 invd, float tmax)
+{
+    float3 pmin = make_float3(node->pmin[0], node->pmin[1], node->pmin[2]);
+    float3 pmax = make_float3(node->pmax[0], node->pmax[1], node->pmax[2]);
+
+    float3 t0 = (pmin - o) * invd;
+    float3 t1 = (pmax - o) * invd;
+    float3 tn = fmin(t0, t1);
+    float3 tf = fmax(t0, t1);
+
+    float tenter = fmax(fmax(tn.x, tn.y), fmax(tn.z, 0.f));
+    float texit = fmin(fmin(tf.x, tf.y), fmin(tf.z, tmax));
+    return tenter <= texit;
+}
+
+// Ray against the tube around a linear piece from a to b, radii in w. Tube is taken as a cylinder
+// of the radius at the closest approach of the ray and the axis, which is exact for constant width.
+INLINE bool Curves_IntersectLinear(float3 o, float3 d, float4 a, float4 b, float tmax, float* t, float* u)
+{
+    float3 s = b.xyz - a.xyz;
+    float3 w = o - a.xyz;
+
+    float dd = dot(d, d);
+    float ds = dot(d, s);
+    float ss = dot(s, s);
+    float dw = dot(d, w);
+    float sw = dot(s, w);
+    float denom = dd * ss - ds * ds;
+
+    // Rays along the axis only graze the tube
+    if (ss <= 0.f || denom <= 1e-6f * dd * ss)
+    {
+        return false;
+    }
+
+    float uc = clamp((dd * sw - ds * dw) / denom, 0.f, 1.f);
+    float tc = (ds * uc - dw) / dd;
+
+    float3 delta = o + tc * d - (a.xyz + uc * s);
+    float r = mix(a.w, b.w, uc);
+    float dist2 = dot(delta, delta);
+
+    if (dist2 > r * r)
+    {
+        return false;
+    }
+
+    // Ray part inside the tube is stretched by the angle between the ray and the axis
+    float sin2 = denom / (dd * ss);
+    float th = native_sqrt((r * r - dist2) / (dd * sin2));
+    float tt = tc - th;
+
+    // Ray starts in the tube or at its surface, these are the hits it has just left
+    if (tt < CURVES_SELF_HIT_EPS * r * native_rsqrt(dd) || tt >= tmax)
+    {
+        return false;
+    }
+
+    *t = tt;
+    *u = clamp(dot(o + tt * d - a.xyz, s) / ss, 0.f, 1.f);
+    return true;
+}
+
+// Ray against the segment starting at the given control point, u is returned over the whole segment
+INLINE bool Curves_IntersectSegment(GLOBAL float4 const* restrict points, int first, bool bspline, float3 o, float3 d, float tmax, float* t, float* u)
+{
+    if (!bspline)
+    {
+        return Curves_IntersectLinear(o, d, points[first], points[first + 1], tmax, t, u);
+    }
+
+    float4 p0 = points[first];
+    float4 p1 = points[first + 1];
+    float4 p2 = points[first + 2];
+    float4 p3 = points[first + 3];
+
+    bool hit = false;
+    float4 a = Curves_EvaluateBSpline(p0, p1, p2, p3, 0.f);
+
+    for (int i = 0; i < CURVES_BSPLINE_STEPS; ++i)
+    {
+        float4 b = Curves_EvaluateBSpline(p0, p1, p2, p3, (float)(i + 1) / CURVES_BSPLINE_STEPS);
+
+        float tt, uu;
+        if (Curves_IntersectLinear(o, d, a, b, tmax, &tt, &uu))
+        {
+            tmax = tt;
+            *t = tt;
+            *u = (i + uu) / CURVES_BSPLINE_STEPS;
+            hit = true;
+        }
+
+        a = b;
+    }
+
+    return hit;
+}
+
+// Traverse curve BVH of the shape with object space ray. Closest hit is returned unless any_hit is set,
+// prim_idx is the first control point of the hit segment relative to shape startvtx.
+INLINE bool Curves_Intersect(
+    GLOBAL CurveNode const* restrict nodes,
+    GLOBAL int const* restrict segments,
+    GLOBAL float4 const* restrict points,
+    bool bspline,
+    int root,
+    float3 o,
+    float3 d,
+    bool any_hit,
+    float* tmax,
+    int* prim_idx,
+    float2* uv
+)
+{
+    float3 invd = native_recip(d);
+    int stack[CURVES_STACK_SIZE];
+    int top = 0;
+    int node_idx = root;
+    bool hit = false;
+
+    while (node_idx >= 0)
+    {
+        GLOBAL CurveNode const* node = nodes + node_idx;
+        node_idx = -1;
+
+        if (Curves_IntersectBounds(node, o, invd, *tmax))
+        {
+            if (node->count == 0)
+            {
+                node_idx = node->child;
+
+                if (top < CURVES_STACK_SIZE)
+                {
+                    stack[top++] = node_idx + 1;
+                }
+            }
+            else
+            {
+                int begin = -(node->child + 1);
+
+                for (int i = begin; i < begin + node->count; ++i)
+                {
+                    float t, u;
+                    if (Curves_IntersectSegment(points, segments[i], bspline, o, d, *tmax, &t, &u))
+                    {
+                        float3 tangent;
+                        float4 c = Curves_Evaluate(points, segments[i], bspline, u, &tangent);
+                        float3 n = o + t * d - c.xyz;
+
+                        *tmax = t;
+                        *prim_idx = segments[i];
+                        *uv = make_float2(u, Curves_GetAngle(tangent, n));
+                        hit = true;
+
+                        if (any_hit)
+                        {
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (node_idx < 0 && top > 0)
+        {
+            node_idx = stack[--top];
+        }
+    }
+
+    return hit;
+}
+
+#endif // CURVES_CL
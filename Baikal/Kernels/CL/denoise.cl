@@ -112,4 +112,150 @@ void BilateralDenoise_main(
     }
 }
 
+#define ATROUS_GROUP_SIZE 8
+// Steps up to this value are filtered from a local memory tile
+#ifdef BAIKAL_CPU_DEVICE
+// Local memory is emulated on CPUs, cached global reads are faster than the tile and its barriers
+#define ATROUS_MAX_TILED_STEP 0
+#else
+#define ATROUS_MAX_TILED_STEP 2
+#endif
+#define ATROUS_TILE_SIZE (ATROUS_GROUP_SIZE + 4 * ATROUS_MAX_TILED_STEP)
+
+INLINE float3 Atrous_Resolve(float4 value)
+{
+    return value.w > 0.f ? value.xyz / value.w : make_float3(0.f, 0.f, 0.f);
+}
+
+// One a-trous iteration: 5x5 B3 spline kernel dilated by step with edge-stopping weights
+KERNEL
+void AtrousDenoise_main(
+    // Color data
+    GLOBAL float4 const* restrict colors,
+    // Normal data
+    GLOBAL float4 const* restrict normals,
+    // Positional data
+    GLOBAL float4 const* restrict positions,
+    // Albedo data
+    GLOBAL float4 const* restrict albedos,
+    // Image resolution
+    int width,
+    int height,
+    // Distance between filter taps
+    int step,
+    // Filter kernel width
+    float sigma_color,
+    float sigma_normal,
+    float sigma_position,
+    float sigma_albedo,
+    // Resulting color
+    GLOBAL float4* restrict out_colors
+)
+{
+    __local float4 tile_colors[ATROUS_TILE_SIZE * ATROUS_TILE_SIZE];
+    __local float4 tile_normals[ATROUS_TILE_SIZE * ATROUS_TILE_SIZE];
+    __local float4 tile_positions[ATROUS_TILE_SIZE * ATROUS_TILE_SIZE];
+    __local float4 tile_albedos[ATROUS_TILE_SIZE * ATROUS_TILE_SIZE];
+
+    float const kernel_weights[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+    int2 global_id;
+    global_id.x = get_global_id(0);
+    global_id.y = get_global_id(1);
+
+    int2 local_id;
+    local_id.x = get_local_id(0);
+    local_id.y = get_local_id(1);
+
+    // Step is uniform across the launch, so is the barrier below
+    bool tiled = step <= ATROUS_MAX_TILED_STEP;
+    int halo = 2 * step;
+    int tile_size = ATROUS_GROUP_SIZE + 2 * halo;
+
+    if (tiled)
+    {
+        int tile_x = get_group_id(0) * ATROUS_GROUP_SIZE - halo;
+        int tile_y = get_group_id(1) * ATROUS_GROUP_SIZE - halo;
+
+        // Resolve tile with halo once, borders are clamped as in the untiled path
+        for (int i = local_id.y * ATROUS_GROUP_SIZE + local_id.x; i < tile_size * tile_size; i += ATROUS_GROUP_SIZE * ATROUS_GROUP_SIZE)
+        {
+            int cx = clamp(tile_x + i % tile_size, 0, width - 1);
+            int cy = clamp(tile_y + i / tile_size, 0, height - 1);
+            int ci = cy * width + cx;
+
+            tile_colors[i].xyz = Atrous_Resolve(colors[ci]);
+            tile_normals[i].xyz = Atrous_Resolve(normals[ci]);
+            tile_positions[i].xyz = Atrous_Resolve(positions[ci]);
+            tile_albedos[i].xyz = Atrous_Resolve(albedos[ci]);
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // Check borders
+    if (global_id.x < width && global_id.y < height)
+    {
+        int idx = global_id.y * width + global_id.x;
+
+        float3 color = Atrous_Resolve(colors[idx]);
+        float3 normal = Atrous_Resolve(normals[idx]);
+        float3 position = Atrous_Resolve(positions[idx]);
+        float3 albedo = Atrous_Resolve(albedos[idx]);
+
+        float3 filtered_color = make_float3(0.f, 0.f, 0.f);
+        float sum = 0.f;
+
+        if (length(position) > 0.f)
+        {
+            for (int j = -2; j <= 2; ++j)
+            {
+                for (int i = -2; i <= 2; ++i)
+                {
+                    float3 c, n, p, a;
+
+                    if (tiled)
+                    {
+                        int ti = (local_id.y + halo + j * step) * tile_size + local_id.x + halo + i * step;
+                        c = tile_colors[ti].xyz;
+                        n = tile_normals[ti].xyz;
+                        p = tile_positions[ti].xyz;
+                        a = tile_albedos[ti].xyz;
+                    }
+                    else
+                    {
+                        int cx = clamp(global_id.x + i * step, 0, width - 1);
+                        int cy = clamp(global_id.y + j * step, 0, height - 1);
+                        int ci = cy * width + cx;
+                        c = Atrous_Resolve(colors[ci]);
+                        n = Atrous_Resolve(normals[ci]);
+                        p = Atrous_Resolve(positions[ci]);
+                        a = Atrous_Resolve(albedos[ci]);
+                    }
+
+                    if (length(p) > 0.f)
+                    {
+                        float weight = kernel_weights[i + 2] * kernel_weights[j + 2] *
+                            C(p, position, sigma_position) *
+                            C(c, color, sigma_color) *
+                            C(n, normal, sigma_normal) *
+                            C(a, albedo, sigma_albedo);
+
+                        filtered_color += c * weight;
+                        sum += weight;
+                    }
+                }
+            }
+
+            out_colors[idx].xyz = sum > 0 ? filtered_color / sum : color;
+            out_colors[idx].w = 1.f;
+        }
+        else
+        {
+            out_colors[idx].xyz = color;
+            out_colors[idx].w = 1.f;
+        }
+    }
+}
+
 #endif
@@ -0,0 +1,56 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef EXTERNAL_DENOISE_CL
+#define EXTERNAL_DENOISE_CL
+
+#include <../Baikal/Kernels/CL/common.cl>
+
+INLINE float4 ExternalDenoiser_Resolve(float4 value)
+{
+    return value.w > 0.f ? make_float4(value.x / value.w, value.y / value.w, value.z / value.w, 1.f) : make_float4(0.f, 0.f, 0.f, 1.f);
+}
+
+// Resolve denoiser inputs into a single staging buffer: color, albedo and normal images one after another
+KERNEL void ExternalDenoiserResolve_main(
+    // Accumulated color
+    GLOBAL float4 const* restrict colors,
+    // Accumulated albedo
+    GLOBAL float4 const* restrict albedos,
+    // Accumulated shading normal
+    GLOBAL float4 const* restrict normals,
+    // Number of pixels
+    int num_pixels,
+    // Resolved images
+    GLOBAL float4* restrict staging
+)
+{
+    int idx = get_global_id(0);
+
+    if (idx < num_pixels)
+    {
+        staging[idx] = ExternalDenoiser_Resolve(colors[idx]);
+        staging[num_pixels + idx] = ExternalDenoiser_Resolve(albedos[idx]);
+        staging[2 * num_pixels + idx] = ExternalDenoiser_Resolve(normals[idx]);
+    }
+}
+
+#endif // EXTERNAL_DENOISE_CL
@@ -36,6 +36,126 @@ THE SOFTWARE.
 #include <../Baikal/Kernels/CL/path.cl>
 #include <../Baikal/Kernels/CL/vertex.cl>
 
+// AOV flags carry storage format of the output (Output::Format + 1), zero disables the AOV
+#define AOV_FORMAT_RGBA32F 1
+#define AOV_FORMAT_RGBA16F 2
+#define AOV_FORMAT_RG16F 3
+#define AOV_FORMAT_R32F 4
+#define AOV_FORMAT_R32UI 5
+#define AOV_FORMAT_RG16_OCT 6
+
+// Octahedral encoding of a unit vector matching GeometryCompression::EncodeNormal
+INLINE uint Aov_EncodeOctahedral(float3 n)
+{
+    float l1 = fabs(n.x) + fabs(n.y) + fabs(n.z);
+
+    if (l1 == 0.f)
+    {
+        return 0u;
+    }
+
+    float2 e = n.xy / l1;
+
+    // Lower hemisphere is folded over the diagonals
+    if (n.z < 0.f)
+    {
+        e = make_float2((1.f - fabs(e.y)) * (e.x >= 0.f ? 1.f : -1.f), (1.f - fabs(e.x)) * (e.y >= 0.f ? 1.f : -1.f));
+    }
+
+    short2 q = convert_short2_sat_rte(clamp(e, -1.f, 1.f) * 32767.f);
+    return (uint)as_ushort(q.x) | ((uint)as_ushort(q.y) << 16);
+}
+
+INLINE float3 Aov_DecodeOctahedral(uint packed)
+{
+    float2 e = max(make_float2(as_short((ushort)(packed & 0xffffu)), as_short((ushort)(packed >> 16))) / 32767.f, -1.f);
+    float3 n = make_float3(e.x, e.y, 1.f - fabs(e.x) - fabs(e.y));
+
+    if (n.z < 0.f)
+    {
+        n.x = (1.f - fabs(e.y)) * (e.x >= 0.f ? 1.f : -1.f);
+        n.y = (1.f - fabs(e.x)) * (e.y >= 0.f ? 1.f : -1.f);
+    }
+
+    return normalize(n);
+}
+
+// Blend value into packed AOV storage with a given weight, weight of 1 overwrites
+INLINE void Aov_Blend(GLOBAL float4* restrict aov, int format, int idx, float3 value, float weight)
+{
+    switch (format)
+    {
+    case AOV_FORMAT_RGBA16F:
+    {
+        GLOBAL half* data = (GLOBAL half*)aov;
+        float4 mean = vload_half4(idx, data);
+        vstore_half4(mix(mean, make_float4(value.x, value.y, value.z, 1.f), weight), idx, data);
+        break;
+    }
+    case AOV_FORMAT_RG16F:
+    {
+        GLOBAL half* data = (GLOBAL half*)aov;
+        float2 mean = vload_half2(idx, data);
+        vstore_half2(mix(mean, value.xy, weight), idx, data);
+        break;
+    }
+    case AOV_FORMAT_R32F:
+    {
+        GLOBAL float* data = (GLOBAL float*)aov;
+        data[idx] = mix(data[idx], value.x, weight);
+        break;
+    }
+    case AOV_FORMAT_R32UI:
+    {
+        GLOBAL int* data = (GLOBAL int*)aov;
+        data[idx] = (int)value.x;
+        break;
+    }
+    case AOV_FORMAT_RG16_OCT:
+    {
+        GLOBAL uint* data = (GLOBAL uint*)aov;
+        float3 mean = weight < 1.f ? Aov_DecodeOctahedral(data[idx]) : make_float3(0.f, 0.f, 0.f);
+        data[idx] = Aov_EncodeOctahedral(mix(mean, value, weight));
+        break;
+    }
+    default:
+        aov[idx] = make_float4(value.x, value.y, value.z, 1.f);
+        break;
+    }
+}
+
+// Add sample into AOV, RGBA32F sums samples with their count in w,
+// packed formats keep running mean over num_samples previous samples
+INLINE void Aov_Accumulate(GLOBAL float4* restrict aov, int format, int idx, float3 value, int num_samples)
+{
+    if (format == AOV_FORMAT_RGBA32F)
+    {
+        aov[idx].xyz += value;
+        aov[idx].w += 1.f;
+    }
+    else
+    {
+        Aov_Blend(aov, format, idx, value, 1.f / (float)(num_samples + 1));
+    }
+}
+
+// Write integer ID into AOV, only x is touched in RGBA32F
+INLINE void Aov_StoreId(GLOBAL float4* restrict aov, int format, int idx, int id)
+{
+    if (format == AOV_FORMAT_R32UI)
+    {
+        ((GLOBAL int*)aov)[idx] = id;
+    }
+    else if (format == AOV_FORMAT_RGBA32F)
+    {
+        aov[idx].x = (float)id;
+    }
+    else
+    {
+        Aov_Blend(aov, format, idx, make_float3((float)id, (float)id, (float)id), 1.f);
+    }
+}
+
 // Fill AOVs
 KERNEL void FillAOVsUberV2(
     // Ray batch
@@ -49,13 +169,21 @@ KERNEL void FillAOVsUberV2(
     // Vertices
     GLOBAL float3 const*restrict  vertices,
     // Normals
-    GLOBAL float3 const* restrict normals,
+    GLOBAL SceneNormal const* restrict normals,
     // UVs
-    GLOBAL float2 const* restrict uvs,
+    GLOBAL SceneUV const* restrict uvs,
+    // Tangents
+    GLOBAL SceneTangent const* restrict tangents,
     // Indices
     GLOBAL int const* restrict indices,
     // Shapes
     GLOBAL Shape const* restrict shapes,
+    // Instances
+    GLOBAL ShapeInstance const* restrict instances,
+    // Instance transforms
+    GLOBAL float4 const* restrict instance_transforms,
+    // Number of base shapes
+    int num_base_shapes,
     GLOBAL ShapeAdditionalData const* restrict shapes_additional,
     // Materials
     GLOBAL int const* restrict material_attributes,
@@ -80,6 +208,8 @@ KERNEL void FillAOVsUberV2(
     GLOBAL uint const* restrict sobol_mat, 
     // Frame
     int frame,
+    // Number of AOV samples accumulated so far
+    int num_aov_samples,
     // World position flag
     int world_position_enabled, 
     // World position AOV
@@ -147,8 +277,12 @@ KERNEL void FillAOVsUberV2(
         vertices,
         normals,
         uvs,
+        tangents,
         indices,
         shapes,
+        instances,
+        instance_transforms,
+        num_base_shapes,
         material_attributes,
         input_map_values,
         lights,
@@ -163,16 +297,17 @@ KERNEL void FillAOVsUberV2(
         int idx = pixel_idx[global_id];
 
         if (shape_ids_enabled)
-            aov_shape_ids[idx].x = -1;
+            Aov_StoreId(aov_shape_ids, shape_ids_enabled, idx, -1);
 
         if (background_enabled)
         {
+            float3 background = make_float3(0.f, 0.f, 0.f);
             if (background_idx != -1)
             {
                 float x = (float)(idx % width) / (float)width;
                 float y = (float)(idx / width) / (float)height;
                 float2 uv = make_float2(x, y);
-                aov_background[idx].xyz += Texture_Sample2D(uv, TEXTURE_ARGS_IDX(background_idx)).xyz;
+                background = Texture_Sample2D(uv, TEXTURE_ARGS_IDX(background_idx)).xyz;
             }
             else if (env_light_idx != -1)
             {
@@ -180,21 +315,26 @@ KERNEL void FillAOVsUberV2(
                 int tex = EnvironmentLight_GetBackgroundTexture(&light);
                 if (tex != -1)
                 {
-                    aov_background[idx].xyz += light.multiplier * Texture_SampleEnvMap(rays[global_id].d.xyz, TEXTURE_ARGS_IDX(tex), light.ibl_mirror_x);
+                    background = light.multiplier * Texture_SampleEnvMap(rays[global_id].d.xyz, TEXTURE_ARGS_IDX(tex), light.ibl_mirror_x);
                 }
             }
-            aov_background[idx].w += 1.0f;
+            Aov_Accumulate(aov_background, background_enabled, idx, background, num_aov_samples);
         }
 
         if (isect.shapeid > -1)
         {
             // Fetch incoming ray direction
             float3 wi = -normalize(rays[global_id].d.xyz);
+            scene.time = Ray_GetTime(&rays[global_id]);
 
             Sampler sampler;
 #if SAMPLER == SOBOL 
             uint scramble = random[global_id] * 0x1fe3434f;
             Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET, scramble);
+#elif SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+            // Per-pixel blue noise value or Owen scrambling seed is used as is
+            uint scramble = random[global_id];
+            Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET, scramble);
 #elif SAMPLER == RANDOM
             uint scramble = global_id * rngseed;
             Sampler_Init(&sampler, scramble);
@@ -210,8 +350,7 @@ KERNEL void FillAOVsUberV2(
 
             if (world_position_enabled)
             {
-                aov_world_position[idx].xyz += diffgeo.p;
-                aov_world_position[idx].w += 1.f;
+                Aov_Accumulate(aov_world_position, world_position_enabled, idx, diffgeo.p, num_aov_samples);
             }
 
             if (world_shading_normal_enabled)
@@ -238,28 +377,24 @@ KERNEL void FillAOVsUberV2(
                 UberV2_ApplyShadingNormal(&diffgeo, &uber_shader_data);
                 DifferentialGeometry_CalculateTangentTransforms(&diffgeo);
 
-                aov_world_shading_normal[idx].xyz += diffgeo.n;
-                aov_world_shading_normal[idx].w += 1.f;
+                Aov_Accumulate(aov_world_shading_normal, world_shading_normal_enabled, idx, diffgeo.n, num_aov_samples);
             }
 
             if (world_geometric_normal_enabled)
             {
-                aov_world_geometric_normal[idx].xyz += diffgeo.ng;
-                aov_world_geometric_normal[idx].w += 1.f;
+                Aov_Accumulate(aov_world_geometric_normal, world_geometric_normal_enabled, idx, diffgeo.ng, num_aov_samples);
             }
 
             if (wireframe_enabled)
             {
                 bool hit = (isect.uvwt.x < 1e-3) || (isect.uvwt.y < 1e-3) || (1.f - isect.uvwt.x - isect.uvwt.y < 1e-3);
                 float3 value = hit ? make_float3(1.f, 1.f, 1.f) : make_float3(0.f, 0.f, 0.f);
-                aov_wireframe[idx].xyz += value;
-                aov_wireframe[idx].w += 1.f;
+                Aov_Accumulate(aov_wireframe, wireframe_enabled, idx, value, num_aov_samples);
             }
 
             if (uv_enabled)
             {
-                aov_uv[idx].xy += diffgeo.uv.xy;
-                aov_uv[idx].w += 1.f;
+                Aov_Accumulate(aov_uv, uv_enabled, idx, make_float3(diffgeo.uv.x, diffgeo.uv.y, 0.f), num_aov_samples);
             }
 
             if (albedo_enabled)
@@ -274,8 +409,7 @@ KERNEL void FillAOVsUberV2(
                 const float3 kd = ((diffgeo.mat.layers & kDiffuseLayer) == kDiffuseLayer) ?
                     uber_shader_data.diffuse_color.xyz : (float3)(0.0f);
 
-                aov_albedo[idx].xyz += kd;
-                aov_albedo[idx].w += 1.f;
+                Aov_Accumulate(aov_albedo, albedo_enabled, idx, kd, num_aov_samples);
             }
 
             if (world_tangent_enabled)
@@ -303,8 +437,7 @@ KERNEL void FillAOVsUberV2(
                 UberV2_ApplyShadingNormal(&diffgeo, &uber_shader_data);
                 DifferentialGeometry_CalculateTangentTransforms(&diffgeo);
 
-                aov_world_tangent[idx].xyz += diffgeo.dpdu;
-                aov_world_tangent[idx].w += 1.f;
+                Aov_Accumulate(aov_world_tangent, world_tangent_enabled, idx, diffgeo.dpdu, num_aov_samples);
             }
 
             if (world_bitangent_enabled)
@@ -332,8 +465,7 @@ KERNEL void FillAOVsUberV2(
                 UberV2_ApplyShadingNormal(&diffgeo, &uber_shader_data);
                 DifferentialGeometry_CalculateTangentTransforms(&diffgeo);
 
-                aov_world_bitangent[idx].xyz += diffgeo.dpdv;
-                aov_world_bitangent[idx].w += 1.f;
+                Aov_Accumulate(aov_world_bitangent, world_bitangent_enabled, idx, diffgeo.dpdv, num_aov_samples);
             }
 
             if (gloss_enabled)
@@ -364,31 +496,52 @@ KERNEL void FillAOVsUberV2(
                     gloss = 1.0f - uber_shader_data.refraction_roughness;
                 }
 
-                aov_gloss[idx].xyz += gloss;
-                aov_gloss[idx].w += 1.f;
+                Aov_Accumulate(aov_gloss, gloss_enabled, idx, make_float3(gloss, gloss, gloss), num_aov_samples);
             }
             
-            if (mesh_id_enabled)
+            // Integer outputs get the ID itself instead of its color
+            if (mesh_id_enabled == AOV_FORMAT_R32UI)
+            {
+                Aov_StoreId(mesh_id, mesh_id_enabled, idx, Scene_GetShapeId(&scene, isect.shapeid - 1));
+            }
+            else if (mesh_id_enabled)
             {
                 Sampler shapeid_sampler;
-                shapeid_sampler.index = shapes[isect.shapeid - 1].id;
-                mesh_id[idx].xyz += clamp(make_float3(UniformSampler_Sample1D(&shapeid_sampler),
+                shapeid_sampler.index = Scene_GetShapeId(&scene, isect.shapeid - 1);
+                float3 color = clamp(make_float3(UniformSampler_Sample1D(&shapeid_sampler),
                     UniformSampler_Sample1D(&shapeid_sampler),
                     UniformSampler_Sample1D(&shapeid_sampler)), 0.0f, 1.0f);
-                mesh_id[idx].w += 1.0f;
+                Aov_Accumulate(mesh_id, mesh_id_enabled, idx, color, num_aov_samples);
             }
 
             if (group_id_enabled)
             {
-                Sampler groupid_sampler;
-                groupid_sampler.index = shapes_additional[isect.shapeid - 1].group_id;
-                group_id[idx].xyz += clamp(make_float3(UniformSampler_Sample1D(&groupid_sampler),
-                    UniformSampler_Sample1D(&groupid_sampler),
-                    UniformSampler_Sample1D(&groupid_sampler)), 0.0f, 1.0f);
-                group_id[idx].w += 1.0f;
+                // Additional data is stored for base shapes only, instances keep their own group
+                int shape_idx = isect.shapeid - 1;
+                int group = shape_idx < num_base_shapes ?
+                    shapes_additional[shape_idx].group_id :
+                    instances[shape_idx - num_base_shapes].group_id;
+
+                if (group_id_enabled == AOV_FORMAT_R32UI)
+                {
+                    Aov_StoreId(group_id, group_id_enabled, idx, group);
+                }
+                else
+                {
+                    Sampler groupid_sampler;
+                    groupid_sampler.index = group;
+                    float3 color = clamp(make_float3(UniformSampler_Sample1D(&groupid_sampler),
+                        UniformSampler_Sample1D(&groupid_sampler),
+                        UniformSampler_Sample1D(&groupid_sampler)), 0.0f, 1.0f);
+                    Aov_Accumulate(group_id, group_id_enabled, idx, color, num_aov_samples);
+                }
             }
 
-            if (depth_enabled)
+            if (depth_enabled && depth_enabled != AOV_FORMAT_RGBA32F)
+            {
+                Aov_Accumulate(aov_depth, depth_enabled, idx, make_float3(isect.uvwt.w, isect.uvwt.w, isect.uvwt.w), num_aov_samples);
+            }
+            else if (depth_enabled)
             {
                 float w = aov_depth[idx].w;
                 if (w == 0.f)
@@ -405,7 +558,7 @@ KERNEL void FillAOVsUberV2(
 
             if (shape_ids_enabled)
             {
-                aov_shape_ids[idx].x = shapes[isect.shapeid - 1].id;
+                Aov_StoreId(aov_shape_ids, shape_ids_enabled, idx, Scene_GetShapeId(&scene, isect.shapeid - 1));
             }
         }
     }
@@ -0,0 +1,242 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef INPUTMAPS_CL
+#define INPUTMAPS_CL
+
+// Generic replacement of generated inputmaps.cl, interprets the input map code
+// written into input map data by CLInputMapGenerator::GenerateInterpreterCode.
+
+// Maximum number of intermediate values, deeper graphs evaluate to zero
+#define INPUT_MAP_STACK_SIZE 16
+
+// Returns first instruction of the input map or -1 if there is no such input map
+int InputMap_FindCode(uint input_id, GLOBAL InputMapData const* restrict input_map_values)
+{
+    int first = input_map_values[0].instruction.arg0;
+    int last = first + input_map_values[0].instruction.arg1;
+
+    // Roots are sorted by id
+    while (first < last)
+    {
+        int middle = (first + last) / 2;
+        uint id = (uint)input_map_values[middle].instruction.arg0;
+
+        if (id == input_id)
+        {
+            return input_map_values[middle].instruction.arg1;
+        }
+
+        if (id < input_id)
+        {
+            first = middle + 1;
+        }
+        else
+        {
+            last = middle;
+        }
+    }
+
+    return -1;
+}
+
+float InputMap_GetComponent(float4 value, int component)
+{
+    switch (component)
+    {
+        case 0: return value.x;
+        case 1: return value.y;
+        case 2: return value.z;
+        default: return value.w;
+    }
+}
+
+uint4 InputMap_UnpackMask(int mask)
+{
+    return (uint4)(mask & 7, (mask >> 3) & 7, (mask >> 6) & 7, (mask >> 9) & 7);
+}
+
+float4 GetInputMapFloat4(uint input_id, DifferentialGeometry const* dg, GLOBAL InputMapData const* restrict input_map_values, TEXTURE_ARG_LIST)
+{
+    int pc = InputMap_FindCode(input_id, input_map_values);
+
+    if (pc < 0)
+    {
+        return 0.0f;
+    }
+
+    float4 stack[INPUT_MAP_STACK_SIZE];
+    int top = 0;
+
+    for (;;)
+    {
+        const int op = input_map_values[pc].instruction.op;
+        const int arg = input_map_values[pc].instruction.arg0;
+        ++pc;
+
+        // Only leafs push new values
+        if (op >= kInputMapOpConstant && op <= kInputMapOpConstant4 && top == INPUT_MAP_STACK_SIZE)
+        {
+            return 0.0f;
+        }
+
+        switch (op)
+        {
+            case kInputMapOpReturn:
+                return stack[top - 1];
+            case kInputMapOpConstant:
+                stack[top++] = (float4)(input_map_values[arg].float_value.value, 0.0f);
+                break;
+            case kInputMapOpSampler:
+                stack[top++] = Texture_Sample2DLod(dg->uv, dg->texture_lod, TEXTURE_ARGS_IDX(input_map_values[arg].int_values.idx));
+                break;
+            case kInputMapOpSamplerBumpmap:
+                stack[top++] = (float4)(Texture_SampleBump(dg->uv, TEXTURE_ARGS_IDX(input_map_values[arg].int_values.idx)), 1.0f);
+                break;
+            case kInputMapOpConstant4:
+                stack[top++] = input_map_values[arg].float4_value.value;
+                break;
+            // Two inputs
+            case kInputMapOpAdd:
+                --top;
+                stack[top - 1] = stack[top - 1] + stack[top];
+                break;
+            case kInputMapOpSub:
+                --top;
+                stack[top - 1] = stack[top - 1] - stack[top];
+                break;
+            case kInputMapOpMul:
+                --top;
+                stack[top - 1] = stack[top - 1] * stack[top];
+                break;
+            case kInputMapOpDiv:
+                --top;
+                stack[top - 1] = stack[top - 1] / stack[top];
+                break;
+            case kInputMapOpMin:
+                --top;
+                stack[top - 1] = min(stack[top - 1], stack[top]);
+                break;
+            case kInputMapOpMax:
+                --top;
+                stack[top - 1] = max(stack[top - 1], stack[top]);
+                break;
+            case kInputMapOpDot3:
+                --top;
+                stack[top - 1] = (float4)(dot(stack[top - 1].xyz, stack[top].xyz), 0.0f, 0.0f, 0.0f);
+                break;
+            case kInputMapOpDot4:
+                --top;
+                stack[top - 1] = (float4)(dot(stack[top - 1], stack[top]), 0.0f, 0.0f, 0.0f);
+                break;
+            case kInputMapOpCross3:
+                --top;
+                stack[top - 1] = (float4)(cross(stack[top - 1].xyz, stack[top].xyz), 0.0f);
+                break;
+            case kInputMapOpCross4:
+                --top;
+                stack[top - 1] = cross(stack[top - 1], stack[top]);
+                break;
+            case kInputMapOpPow:
+                --top;
+                stack[top - 1] = pow(stack[top - 1], (float4)(stack[top].x));
+                break;
+            case kInputMapOpMod:
+                --top;
+                stack[top - 1] = fmod(stack[top - 1], stack[top]);
+                break;
+            // Single input
+            case kInputMapOpSin:
+                stack[top - 1] = sin(stack[top - 1]);
+                break;
+            case kInputMapOpCos:
+                stack[top - 1] = cos(stack[top - 1]);
+                break;
+            case kInputMapOpTan:
+                stack[top - 1] = tan(stack[top - 1]);
+                break;
+            case kInputMapOpAsin:
+                stack[top - 1] = asin(stack[top - 1]);
+                break;
+            case kInputMapOpAcos:
+                stack[top - 1] = acos(stack[top - 1]);
+                break;
+            case kInputMapOpAtan:
+                stack[top - 1] = atan(stack[top - 1]);
+                break;
+            case kInputMapOpLength3:
+                stack[top - 1] = (float4)(length(stack[top - 1].xyz), 0.0f, 0.0f, 0.0f);
+                break;
+            case kInputMapOpNormalize3:
+                stack[top - 1] = (float4)(normalize(stack[top - 1].xyz), 0.0f);
+                break;
+            case kInputMapOpFloor:
+                stack[top - 1] = floor(stack[top - 1]);
+                break;
+            case kInputMapOpAbs:
+                stack[top - 1] = fabs(stack[top - 1]);
+                break;
+            // Specials
+            case kInputMapOpLerp:
+                top -= 2;
+                stack[top - 1] = mix(stack[top - 1], stack[top], stack[top + 1]);
+                break;
+            case kInputMapOpSelect:
+                stack[top - 1] = (float4)(InputMap_GetComponent(stack[top - 1], arg));
+                break;
+            case kInputMapOpShuffle:
+                stack[top - 1] = shuffle(stack[top - 1], InputMap_UnpackMask(arg));
+                break;
+            case kInputMapOpShuffle2:
+                --top;
+                stack[top - 1] = shuffle2(stack[top - 1], stack[top], InputMap_UnpackMask(arg));
+                break;
+            case kInputMapOpMatMul:
+            {
+                matrix4x4 m = matrix_from_rows(
+                    input_map_values[arg].float4_value.value,
+                    input_map_values[arg + 1].float4_value.value,
+                    input_map_values[arg + 2].float4_value.value,
+                    input_map_values[arg + 3].float4_value.value);
+                stack[top - 1] = matrix_mul_vector4(m, stack[top - 1]);
+                break;
+            }
+            case kInputMapOpRemap:
+            {
+                top -= 2;
+                const float4 src = stack[top - 1];
+                const float4 dest = stack[top];
+                const float4 data = stack[top + 1];
+                stack[top - 1] = mix((float4)(dest.x), (float4)(dest.y), (data - src.x) / (src.y - src.x));
+                break;
+            }
+            default:
+                return 0.0f;
+        }
+    }
+}
+
+float GetInputMapFloat(uint input_id, DifferentialGeometry const* dg, GLOBAL InputMapData const* restrict input_map_values, TEXTURE_ARG_LIST)
+{
+    return GetInputMapFloat4(input_id, dg, input_map_values, TEXTURE_ARGS).x;
+}
+
+#endif // INPUTMAPS_CL
@@ -115,6 +115,100 @@ float3 EnvironmentLight_GetLe(// Light
     return light->multiplier * Texture_SampleEnvMap(normalize(*wo), TEXTURE_ARGS_IDX(tex), light->ibl_mirror_x);
 }
 
+/*
+ Environment light distribution layout: width, height (both 0 if there is no distribution),
+ marginal distribution over texture rows followed by conditional distributions
+ over columns for each row, all in Distribution1D format.
+ */
+INLINE bool EnvironmentLight_HasDistribution(GLOBAL int const* distribution)
+{
+    return distribution && distribution[0] > 0;
+}
+
+INLINE GLOBAL int const* EnvironmentLight_GetConditionalDistribution(GLOBAL int const* distribution, int row)
+{
+    int width = distribution[0];
+    int height = distribution[1];
+    return distribution + 2 + Distribution1D_GetSize(height) + row * Distribution1D_GetSize(width);
+}
+
+/// Map lat-long map coordinates to a direction (inverse of Texture_SampleEnvMap mapping),
+/// v goes from the top (theta = 0) to the bottom of the map.
+INLINE float3 EnvironmentLight_MapToDirection(float2 uv, bool mirror_x, float* sin_theta)
+{
+    float phi = 2.f * PI * (mirror_x ? (1.f - uv.x) : uv.x);
+    float theta = PI * uv.y;
+    *sin_theta = FAST_SIN(theta);
+    return make_float3(*sin_theta * FAST_SIN(phi), FAST_COS(theta), *sin_theta * FAST_COS(phi));
+}
+
+/// Map a direction to lat-long map coordinates
+INLINE float2 EnvironmentLight_MapToUV(float3 d, bool mirror_x)
+{
+    float r, phi, theta;
+    CartesianToSpherical(d, &r, &phi, &theta);
+    float u = phi / (2.f * PI);
+    return make_float2(mirror_x ? (1.f - u) : u, theta / PI);
+}
+
+/// Sample direction proportionally to environment map luminance, pdf is w.r.t. solid angle
+INLINE float3 EnvironmentLight_SampleDistribution(GLOBAL int const* distribution, bool mirror_x, float2 sample, float* pdf)
+{
+    int height = distribution[1];
+
+    float pdf_v, pdf_u;
+    float v = Distribution1D_Sample(sample.y, distribution + 2, &pdf_v);
+    int row = clamp((int)(v * height), 0, height - 1);
+    float u = Distribution1D_Sample(sample.x, EnvironmentLight_GetConditionalDistribution(distribution, row), &pdf_u);
+
+    float sin_theta;
+    float3 d = EnvironmentLight_MapToDirection(make_float2(u, v), mirror_x, &sin_theta);
+
+    // Jacobian of lat-long mapping is 2 * PI^2 * sin(theta)
+    *pdf = sin_theta > 0.f ? pdf_u * pdf_v / (2.f * PI * PI * sin_theta) : 0.f;
+    return d;
+}
+
+/// PDF of EnvironmentLight_SampleDistribution w.r.t. solid angle
+INLINE float EnvironmentLight_GetDistributionPdf(GLOBAL int const* distribution, bool mirror_x, float3 d)
+{
+    int height = distribution[1];
+
+    float2 uv = EnvironmentLight_MapToUV(d, mirror_x);
+    int row = clamp((int)(uv.y * height), 0, height - 1);
+    float sin_theta = FAST_SIN(PI * uv.y);
+
+    if (sin_theta <= 0.f)
+    {
+        return 0.f;
+    }
+
+    float pdf_v = Distribution1D_GetPdf(uv.y, distribution + 2);
+    float pdf_u = Distribution1D_GetPdf(uv.x, EnvironmentLight_GetConditionalDistribution(distribution, row));
+    return pdf_u * pdf_v / (2.f * PI * PI * sin_theta);
+}
+
+/// Irradiance from the environment at a surface with normal n, irradiance holds 9 SH coefficients
+/// of the environment texture convolved with the cosine lobe, see Utils/sh.h for the basis
+INLINE float3 EnvironmentLight_GetIrradiance(Light const* light, GLOBAL float3 const* irradiance, float3 n)
+{
+    // Coefficients are projected from the texture without mirroring, mirrored map flips x
+    float3 p = make_float3(light->ibl_mirror_x ? -n.x : n.x, n.y, n.z);
+
+    float3 e = 0.2820947917738781f * irradiance[0];
+    e += -0.48860251190292f * p.y * irradiance[1];
+    e += 0.4886025119029199f * p.z * irradiance[2];
+    e += -0.48860251190292f * p.x * irradiance[3];
+    e += 1.092548430592079f * p.x * p.y * irradiance[4];
+    e += -1.092548430592079f * p.y * p.z * irradiance[5];
+    e += (0.9461746957575601f * p.z * p.z - 0.3153915652525201f) * irradiance[6];
+    e += -1.092548430592079f * p.x * p.z * irradiance[7];
+    e += 0.5462742152960395f * (p.x * p.x - p.y * p.y) * irradiance[8];
+
+    // Ringing of the truncated projection can go below zero
+    return light->multiplier * max(e, 0.f);
+}
+
 /// Sample direction to the light
 float3 EnvironmentLight_Sample(// Light
                                Light const* light,
@@ -138,7 +232,11 @@ float3 EnvironmentLight_Sample(// Light
 {
     float3 d;
 
-    if (interaction_type != kLightInteractionVolume)
+    if (EnvironmentLight_HasDistribution(scene->envmap_distribution))
+    {
+        d = EnvironmentLight_SampleDistribution(scene->envmap_distribution, light->ibl_mirror_x, sample, pdf);
+    }
+    else if (interaction_type != kLightInteractionVolume)
     {
         d = Sample_MapToHemisphere(sample, dg->n, 0.f);
         *pdf = 1.f / (2.f * PI);
@@ -154,7 +252,7 @@ float3 EnvironmentLight_Sample(// Light
 
     int tex = EnvironmentLight_GetTexture(light, bxdf_flags);
 
-    if (tex == -1)
+    if (tex == -1 || *pdf <= 0.f)
     {
         *pdf = 0.f;
         return 0.f;
@@ -182,7 +280,11 @@ float EnvironmentLight_GetPdf(
                               TEXTURE_ARG_LIST
                               )
 {
-    if (interaction_type != kLightInteractionVolume)
+    if (EnvironmentLight_HasDistribution(scene->envmap_distribution))
+    {
+        return EnvironmentLight_GetDistributionPdf(scene->envmap_distribution, light->ibl_mirror_x, normalize(wo));
+    }
+    else if (interaction_type != kLightInteractionVolume)
     {
         return 1.f / (2.f * PI);
     }
@@ -193,9 +295,172 @@ float EnvironmentLight_GetPdf(
 }
 
 
+/*
+ Light intensity profiles: lat-long textures around the light direction, see Utils/ies_profile.h.
+ Sampling distributions have the environment light distribution layout.
+ */
+/// Profile frame goes along the light direction, horizontal angles start at b
+INLINE void Light_GetProfileFrame(Light const* light, float3* t, float3* b)
+{
+    *b = GetOrthoVector(light->d);
+    *t = cross(light->d, *b);
+}
+
+/// Relative intensity in direction w from the light, 1 if the light has no profile
+INLINE float Light_GetProfileValue(Light const* light, float3 w, TEXTURE_ARG_LIST)
+{
+    if (light->profile == -1)
+    {
+        return 1.f;
+    }
+
+    float3 t, b;
+    Light_GetProfileFrame(light, &t, &b);
+
+    // Lat-long mapping has theta = 0 along y
+    float3 local = make_float3(dot(w, t), dot(w, light->d), dot(w, b));
+    return Texture_SampleEnvMap(local, TEXTURE_ARGS_IDX(light->profile), false).x;
+}
+
+/// Sample direction from the light proportionally to its profile, pdf is w.r.t. solid angle
+INLINE float3 Light_SampleProfile(Light const* light, Scene const* scene, float2 sample, float* pdf)
+{
+    GLOBAL int const* distribution = scene->light_distribution + light->profile_distribution;
+    float3 local = EnvironmentLight_SampleDistribution(distribution, false, sample, pdf);
+
+    float3 t, b;
+    Light_GetProfileFrame(light, &t, &b);
+    return local.x * t + local.y * light->d + local.z * b;
+}
+
+
 /*
  Area light
  */
+#ifdef BAIKAL_AREA_LIGHT_IMPORTANCE
+// Area lights subtending solid angles in this range are sampled uniformly by solid angle,
+// smaller ones are sampled by area and larger ones are too close to the triangle plane for a stable mapping
+#define AREA_LIGHT_MIN_SOLID_ANGLE 3e-4f
+#define AREA_LIGHT_MAX_SOLID_ANGLE 6.22f
+
+/// Solid angle of triangle v0 v1 v2 seen from point o
+INLINE float SphericalTriangle_GetSolidAngle(float3 o, float3 v0, float3 v1, float3 v2)
+{
+    float3 a = normalize(v0 - o);
+    float3 b = normalize(v1 - o);
+    float3 c = normalize(v2 - o);
+
+    // Van Oosterom and Strackee
+    float num = fabs(dot(a, cross(b, c)));
+    float den = 1.f + dot(a, b) + dot(a, c) + dot(b, c);
+    return 2.f * atan2(num, den);
+}
+
+INLINE bool SphericalTriangle_IsSampled(float solid_angle)
+{
+    return solid_angle > AREA_LIGHT_MIN_SOLID_ANGLE && solid_angle < AREA_LIGHT_MAX_SOLID_ANGLE;
+}
+
+/// Direction uniformly distributed over the solid angle of triangle v0 v1 v2 seen from point o (Arvo 1995)
+INLINE float3 SphericalTriangle_Sample(float3 o, float3 v0, float3 v1, float3 v2, float2 sample)
+{
+    float3 a = normalize(v0 - o);
+    float3 b = normalize(v1 - o);
+    float3 c = normalize(v2 - o);
+
+    // Normals of the great circles through the edges
+    float3 n_ab = normalize(cross(a, b));
+    float3 n_bc = normalize(cross(b, c));
+    float3 n_ca = normalize(cross(c, a));
+
+    // Interior angles and area of the spherical triangle
+    float alpha = acos(clamp(dot(n_ab, -n_ca), -1.f, 1.f));
+    float beta = acos(clamp(dot(n_bc, -n_ab), -1.f, 1.f));
+    float gamma = acos(clamp(dot(n_ca, -n_bc), -1.f, 1.f));
+    float area = alpha + beta + gamma - PI;
+
+    // Split the area by the sample to find the third vertex of the sub-triangle on arc ac
+    float area_sub = sample.x * area;
+    float sin_phi = sin(area_sub + PI - alpha);
+    float cos_phi = cos(area_sub + PI - alpha);
+    float sin_alpha = sin(alpha);
+    float cos_alpha = cos(alpha);
+    float k1 = cos_phi + cos_alpha;
+    float k2 = sin_phi - sin_alpha * dot(a, b);
+    float den = (k2 * sin_phi + k1 * cos_phi) * sin_alpha;
+    float cos_b = den != 0.f ? clamp((k2 + (k2 * cos_phi - k1 * sin_phi) * cos_alpha) / den, -1.f, 1.f) : 1.f;
+    float sin_b = native_sqrt(max(0.f, 1.f - cos_b * cos_b));
+    float3 c_sub = cos_b * a + sin_b * normalize(c - dot(c, a) * a);
+
+    // Sample the arc from b to the new vertex
+    float cos_theta = 1.f - sample.y * (1.f - dot(c_sub, b));
+    float sin_theta = native_sqrt(max(0.f, 1.f - cos_theta * cos_theta));
+    float3 t = c_sub - dot(c_sub, b) * b;
+    float tlen = length(t);
+
+    return tlen > 0.f ? cos_theta * b + sin_theta * (t / tlen) : b;
+}
+#endif
+
+// Index of the area light attached to the primitive of a shape, -1 if there is none.
+// Map layout is written by ClwSceneController: number of shapes, num_shapes + 1 entry offsets,
+// then (primitive, light index) pairs sorted by primitive within each shape.
+INLINE int AreaLightMap_Find(GLOBAL int const* restrict area_light_map, int shapeidx, int primidx)
+{
+    int num_shapes = area_light_map[0];
+
+    if (shapeidx < 0 || shapeidx >= num_shapes)
+    {
+        return -1;
+    }
+
+    GLOBAL int const* entries = area_light_map + 2 + num_shapes;
+    int begin = area_light_map[1 + shapeidx];
+    int end = area_light_map[2 + shapeidx];
+
+    while (begin < end)
+    {
+        int middle = (begin + end) / 2;
+        int entry_prim = entries[2 * middle];
+
+        if (entry_prim == primidx)
+        {
+            return entries[2 * middle + 1];
+        }
+
+        if (entry_prim < primidx)
+        {
+            begin = middle + 1;
+        }
+        else
+        {
+            end = middle;
+        }
+    }
+
+    return -1;
+}
+
+/// Solid angle pdf of AreaLight_Sample returning point p with normal n on the light triangle of the given area,
+/// o is the point being illuminated
+INLINE float AreaLight_GetSamplePdf(Scene const* scene, int shapeidx, int primidx, float3 o, float3 p, float3 n, float area)
+{
+#ifdef BAIKAL_AREA_LIGHT_IMPORTANCE
+    float3 v0, v1, v2;
+    Scene_GetTriangleVertices(scene, shapeidx, primidx, &v0, &v1, &v2);
+
+    float solid_angle = SphericalTriangle_GetSolidAngle(o, v0, v1, v2);
+
+    if (SphericalTriangle_IsSampled(solid_angle))
+    {
+        return 1.f / solid_angle;
+    }
+#endif
+
+    float3 d = p - o;
+    float denom = fabs(dot(-normalize(d), n)) * area;
+    return denom > 0.f ? dot(d, d) / denom : 0.f;
+}
 // Get intensity for a given direction
 float3 AreaLight_GetLe(// Emissive object
                        Light const* light,
@@ -231,7 +496,7 @@ float3 AreaLight_GetLe(// Emissive object
         float3 d = p - dg->p;
         *wo = d;
 
-        int material_offset = scene->shapes[shapeidx].material.offset;
+        int material_offset = Scene_GetShapeMaterial(scene, shapeidx).offset;
 
         const float3 ke = GetUberV2EmissionColor(material_offset, dg, scene->input_map_values, scene->material_attributes, TEXTURE_ARGS).xyz;
         
@@ -262,6 +527,13 @@ float3 AreaLight_Sample(// Emissive object
     int shapeidx = light->shapeidx;
     int primidx = light->primidx;
 
+    // Triangles of paged out lights are degenerate, the mesh is paged in for the next frames
+    if (!Scene_RequestShapeGeometry(scene, shapeidx))
+    {
+        *pdf = 0.f;
+        return 0.f;
+    }
+
     // Generate sample on triangle
     float r0 = sample.x;
     float r1 = sample.y;
@@ -272,6 +544,25 @@ float3 AreaLight_Sample(// Emissive object
     uv.x = 1.f - native_sqrt(r0);
     uv.y = native_sqrt(r0) * r1;
 
+#ifdef BAIKAL_AREA_LIGHT_IMPORTANCE
+    float3 v0, v1, v2;
+    Scene_GetTriangleVertices(scene, shapeidx, primidx, &v0, &v1, &v2);
+
+    if (SphericalTriangle_IsSampled(SphericalTriangle_GetSolidAngle(dg->p, v0, v1, v2)))
+    {
+        // Find the triangle point in the direction sampled by solid angle
+        ray r;
+        r.o.xyz = dg->p;
+        r.d.xyz = SphericalTriangle_Sample(dg->p, v0, v1, v2, sample);
+
+        if (!IntersectTriangle(&r, v0, v1, v2, &uv.x, &uv.y))
+        {
+            *pdf = 0.f;
+            return 0.f;
+        }
+    }
+#endif
+
     float3 n;
     float3 p;
     float2 tx;
@@ -280,7 +571,7 @@ float3 AreaLight_Sample(// Emissive object
 
     *wo = p - dg->p;
 
-    int material_offset = scene->shapes[shapeidx].material.offset;
+    int material_offset = Scene_GetShapeMaterial(scene, shapeidx).offset;
 
     const float3 ke = GetUberV2EmissionColor(material_offset, dg, scene->input_map_values, scene->material_attributes, TEXTURE_ARGS).xyz;
     float3 v = -normalize(*wo);
@@ -289,9 +580,7 @@ float3 AreaLight_Sample(// Emissive object
 
     if (ndotv > 0.f)
     {
-        float dist2 = dot(*wo, *wo);
-        float denom = fabs(ndotv) * area;
-        *pdf = denom > 0.f ? dist2 / denom : 0.f;
+        *pdf = AreaLight_GetSamplePdf(scene, shapeidx, primidx, dg->p, p, n, area);
         return ke;
     }
     else
@@ -334,11 +623,7 @@ float AreaLight_GetPdf(// Emissive object
         float area;
         Scene_InterpolateAttributes(scene, shapeidx, primidx, make_float2(a, b), &p, &n, &tx, &area);
 
-        float3 d = p - dg->p;
-        float dist2 = dot(d, d) ;
-        float denom = (fabs(dot(-normalize(d), n)) * area);
-
-        return denom > 0.f ? dist2 / denom : 0.f;
+        return AreaLight_GetSamplePdf(scene, shapeidx, primidx, dg->p, p, n, area);
     }
     else
     {
@@ -366,6 +651,13 @@ float3 AreaLight_SampleVertex(
     int shapeidx = light->shapeidx;
     int primidx = light->primidx;
 
+    // Triangles of paged out lights are degenerate, the mesh is paged in for the next frames
+    if (!Scene_RequestShapeGeometry(scene, shapeidx))
+    {
+        *pdf = 0.f;
+        return 0.f;
+    }
+
     // Generate sample on triangle
     float r0 = sample0.x;
     float r1 = sample0.y;
@@ -379,10 +671,22 @@ float3 AreaLight_SampleVertex(
     float area;
     Scene_InterpolateAttributes(scene, shapeidx, primidx, uv, p, n, &tx, &area);
 
-    int material_offset = scene->shapes[shapeidx].material.offset;
-
-    /*const float3 ke = GetUberV2EmissionColor(material_offset, dg, scene->input_map_values, scene->material_attributes, TEXTURE_ARGS).xyz;*/
-    const float3 ke = make_float3(0.f, 0.f, 0.f);
+    int material_offset = Scene_GetShapeMaterial(scene, shapeidx).offset;
+
+    // Emission is evaluated at the sampled point on the light
+    DifferentialGeometry dg;
+    dg.p = *p;
+    dg.n = *n;
+    dg.ng = *n;
+    dg.uv = tx;
+    dg.dpdu = GetOrthoVector(*n);
+    dg.dpdv = cross(*n, dg.dpdu);
+    dg.mat = Scene_GetShapeMaterial(scene, shapeidx);
+    dg.area = area;
+    // Finest texture level
+    dg.texture_lod = -64.f;
+
+    const float3 ke = GetUberV2EmissionColor(material_offset, &dg, scene->input_map_values, scene->material_attributes, TEXTURE_ARGS).xyz;
     *wo = Sample_MapToHemisphere(sample1, *n, 1.f);
     *pdf = (1.f / area) * fabs(dot(*n, *wo)) / PI;
 
@@ -482,7 +786,7 @@ float3 PointLight_Sample(// Emissive object
 {
     *wo = light->p - dg->p;
     *pdf = 1.f;
-    return light->intensity / dot(*wo, *wo);
+    return light->intensity * Light_GetProfileValue(light, -normalize(*wo), TEXTURE_ARGS) / dot(*wo, *wo);
 }
 
 /// Get PDF for a given direction
@@ -521,6 +825,14 @@ float3 PointLight_SampleVertex(
 {
     *p = light->p;
     *n = make_float3(0.f, 1.f, 0.f);
+
+    // Profiled lights are importance sampled rather than weighted
+    if (light->profile != -1)
+    {
+        *wo = Light_SampleProfile(light, scene, sample0, pdf);
+        return light->intensity * Light_GetProfileValue(light, *wo, TEXTURE_ARGS);
+    }
+
     *wo = Sample_MapToSphere(sample0);
     *pdf = 1.f / (4.f * PI);
     return light->intensity;
@@ -529,6 +841,17 @@ float3 PointLight_SampleVertex(
 /*
  Spot light
  */
+/// Cone falloff for cosine of the angle between light direction and direction from the light
+INLINE float SpotLight_GetFalloff(Light const* light, float ddotwo)
+{
+    if (ddotwo <= light->oa)
+    {
+        return 0.f;
+    }
+
+    return ddotwo > light->ia ? 1.f : 1.f - (light->ia - ddotwo) / (light->ia - light->oa);
+}
+
 // Get intensity for a given direction
 float3 SpotLight_GetLe(// Emissive object
                         Light const* light,
@@ -562,13 +885,14 @@ float3 SpotLight_Sample(// Emissive object
                          float* pdf)
 {
     *wo = light->p - dg->p;
-    float ddotwo = dot(-normalize(*wo), light->d);
+    float3 w = -normalize(*wo);
+    float falloff = SpotLight_GetFalloff(light, dot(w, light->d));
     
-    if (ddotwo > light->oa)
+    if (falloff > 0.f)
     {
-        float3 intensity = light->intensity / dot(*wo, *wo);
+        float3 intensity = light->intensity * Light_GetProfileValue(light, w, TEXTURE_ARGS) / dot(*wo, *wo);
         *pdf = 1.f;
-        return ddotwo > light->ia ? intensity : intensity * (1.f - (light->ia - ddotwo) / (light->ia - light->oa));
+        return falloff * intensity;
     }
     else
     {
@@ -593,6 +917,42 @@ float SpotLight_GetPdf(// Emissive object
     return 0.f;
 }
 
+/// Sample vertex on the light
+float3 SpotLight_SampleVertex(
+    // Light object
+    Light const* light,
+    // Scene
+    Scene const* scene,
+    // Textures
+    TEXTURE_ARG_LIST,
+    // Sample
+    float2 sample0,
+    float2 sample1,
+    // Direction to light source
+    float3* p,
+    float3* n,
+    float3* wo,
+    // PDF
+    float* pdf)
+{
+    *p = light->p;
+    *n = light->d;
+
+    // Profiled lights are importance sampled, cone falloff is applied on top
+    if (light->profile != -1)
+    {
+        *wo = Light_SampleProfile(light, scene, sample0, pdf);
+    }
+    else
+    {
+        *wo = Sample_MapToCone(sample0, light->d, light->oa);
+        *pdf = 1.f / (2.f * PI * (1.f - light->oa));
+    }
+
+    float falloff = SpotLight_GetFalloff(light, dot(*wo, light->d));
+    return falloff * light->intensity * Light_GetProfileValue(light, *wo, TEXTURE_ARGS);
+}
+
 
 /*
  Dispatch calls
@@ -617,18 +977,25 @@ float3 Light_GetLe(// Light index
 {
     Light light = scene->lights[idx];
 
+    // Light types the scene does not have are compiled out, see ClwScene::Feature
     switch(light.type)
     {
+#ifndef BAIKAL_SCENE_NO_ENVIRONMENT_LIGHT
         case kIbl:
             return EnvironmentLight_GetLe(&light, scene, dg, bxdf_flags, interaction_type, wo, TEXTURE_ARGS);
+#endif
+#ifndef BAIKAL_SCENE_NO_AREA_LIGHTS
         case kArea:
             return AreaLight_GetLe(&light, scene, dg, wo, TEXTURE_ARGS);
+#endif
+#ifndef BAIKAL_SCENE_NO_SINGULAR_LIGHTS
         case kDirectional:
             return DirectionalLight_GetLe(&light, scene, dg, wo, TEXTURE_ARGS);
         case kPoint:
             return PointLight_GetLe(&light, scene, dg, wo, TEXTURE_ARGS);
         case kSpot:
             return SpotLight_GetLe(&light, scene, dg, wo, TEXTURE_ARGS);
+#endif
     }
 
     return make_float3(0.f, 0.f, 0.f);
@@ -658,16 +1025,22 @@ float3 Light_Sample(// Light index
 
     switch(light.type)
     {
+#ifndef BAIKAL_SCENE_NO_ENVIRONMENT_LIGHT
         case kIbl:
             return EnvironmentLight_Sample(&light, scene, dg, TEXTURE_ARGS, sample, bxdf_flags, interaction_type, wo, pdf);
+#endif
+#ifndef BAIKAL_SCENE_NO_AREA_LIGHTS
         case kArea:
             return AreaLight_Sample(&light, scene, dg, TEXTURE_ARGS, sample, wo, pdf);
+#endif
+#ifndef BAIKAL_SCENE_NO_SINGULAR_LIGHTS
         case kDirectional:
             return DirectionalLight_Sample(&light, scene, dg, TEXTURE_ARGS, sample, wo, pdf);
         case kPoint:
             return PointLight_Sample(&light, scene, dg, TEXTURE_ARGS, sample, wo, pdf);
         case kSpot:
             return SpotLight_Sample(&light, scene, dg, TEXTURE_ARGS, sample, wo, pdf);
+#endif
     }
 
     *pdf = 0.f;
@@ -695,16 +1068,22 @@ float Light_GetPdf(// Light index
 
     switch(light.type)
     {
+#ifndef BAIKAL_SCENE_NO_ENVIRONMENT_LIGHT
         case kIbl:
             return EnvironmentLight_GetPdf(&light, scene, dg, bxdf_flags, interaction_type, wo, TEXTURE_ARGS);
+#endif
+#ifndef BAIKAL_SCENE_NO_AREA_LIGHTS
         case kArea:
             return AreaLight_GetPdf(&light, scene, dg, wo, TEXTURE_ARGS);
+#endif
+#ifndef BAIKAL_SCENE_NO_SINGULAR_LIGHTS
         case kDirectional:
             return DirectionalLight_GetPdf(&light, scene, dg, wo, TEXTURE_ARGS);
         case kPoint:
             return PointLight_GetPdf(&light, scene, dg, wo, TEXTURE_ARGS);
         case kSpot:
             return SpotLight_GetPdf(&light, scene, dg, wo, TEXTURE_ARGS);
+#endif
     }
 
     return 0.f;
@@ -738,6 +1117,8 @@ float3 Light_SampleVertex(
             return AreaLight_SampleVertex(&light, scene, TEXTURE_ARGS, sample0, sample1, p, n, wo, pdf);
         case kPoint:
             return PointLight_SampleVertex(&light, scene, TEXTURE_ARGS, sample0, sample1, p, n, wo, pdf);
+        case kSpot:
+            return SpotLight_SampleVertex(&light, scene, TEXTURE_ARGS, sample0, sample1, p, n, wo, pdf);
     }
 
     *pdf = 0.f;
@@ -752,4 +1133,14 @@ bool Light_IsSingular(__global Light const* light)
         light->type == kDirectional;
 }
 
+/// Check if the light illuminates surfaces with the given light link mask
+bool Light_IsLinked(__global Light const* light, int light_mask)
+{
+#ifdef BAIKAL_COMPACT_PATH
+    // Compact path state keeps the lower 16 bits of the mask, upper ones are ignored
+    light_mask |= (int)0xffff0000;
+#endif
+    return (light->link_mask & light_mask) != 0;
+}
+
 #endif // LIGHT_CLnv
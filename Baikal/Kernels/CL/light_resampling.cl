@@ -0,0 +1,93 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef LIGHT_RESAMPLING_CL
+#define LIGHT_RESAMPLING_CL
+
+#include <../Baikal/Kernels/CL/common.cl>
+#include <../Baikal/Kernels/CL/utils.cl>
+#include <../Baikal/Kernels/CL/payload.cl>
+
+// Light resampling picks the light sample of a first hit out of several candidates
+// by resampled importance sampling and reuses the picks of the last frame at the
+// reprojected pixel and around it. Samples are points of the primary sample space of
+// light sampling (light selection and light surface samples), where candidates are
+// uniformly distributed, so a sample is valid at any shading point and resampling
+// weights are the luminances of its light sampling estimates there. Reused reservoirs
+// are combined with 1 / M normalization, which is biased where visibility or the
+// integrand differ between the pixels. Reservoirs are kept per output pixel.
+#define LIGHT_RESAMPLING_CANDIDATES 8
+// Reservoirs of the last frame reused around the reprojected pixel in addition to the one at it
+#define LIGHT_RESAMPLING_SPATIAL_SAMPLES 3
+#define LIGHT_RESAMPLING_SPATIAL_RADIUS 16.f
+// Number of candidates a reused reservoir counts for is clamped to this many frames,
+// so the history follows changes in lighting
+#define LIGHT_RESAMPLING_MAX_HISTORY 20.f
+
+typedef struct
+{
+    // First hit the reservoir has been resampled at
+    float3 p;
+    float3 n;
+    // Selected primary sample space light sample
+    float3 sample;
+    // Number of candidates the sample has been selected from, 0 if the reservoir is empty
+    float num_candidates;
+    // Contribution weight of the sample, 0 if it is occluded
+    float weight;
+    float padding[2];
+} LightReservoir;
+
+INLINE void LightReservoir_Clear(GLOBAL LightReservoir* reservoir)
+{
+    reservoir->num_candidates = 0.f;
+    reservoir->weight = 0.f;
+}
+
+// Pixel of the world space point in the image of a perspective camera, false if the point is off screen.
+// Points are not reprojected into multi-view images, they are seen by several views
+INLINE bool LightResampling_Reproject(GLOBAL Camera const* camera, float3 p, int width, int height, int2* pixel)
+{
+    float3 d = p - camera->p;
+    float z = dot(d, camera->forward);
+
+    if (z <= 0.f || camera->num_views > 1)
+    {
+        return false;
+    }
+
+    // Inverse of camera ray generation, image plane is focal length away
+    float2 c_sample = make_float2(dot(d, camera->right), dot(d, camera->up)) * camera->focal_length / z;
+    float2 img_sample = c_sample / camera->dim + make_float2(0.5f, 0.5f);
+
+    *pixel = convert_int2_rtn(img_sample * make_float2((float)width, (float)height));
+    return pixel->x >= 0 && pixel->x < width && pixel->y >= 0 && pixel->y < height;
+}
+
+// Check if the reservoir has been resampled at a surface close enough to the hit to be reused there
+INLINE bool LightResampling_IsReusable(GLOBAL LightReservoir const* reservoir, float3 p, float3 n, float depth)
+{
+    return reservoir->num_candidates > 0.f &&
+        dot(reservoir->n, n) > 0.9f &&
+        fabs(dot(reservoir->p - p, n)) < 0.05f * depth;
+}
+
+#endif // LIGHT_RESAMPLING_CL
@@ -34,6 +34,31 @@ THE SOFTWARE.
 #include <../Baikal/Kernels/CL/path.cl>
 #include <../Baikal/Kernels/CL/vertex.cl>
 
+// [0..1] image plane sample of the view the pixel belongs to, views split the output into columns.
+// Camera position is moved to the view, views are centered on it
+INLINE float2 Camera_GetViewSample(
+    GLOBAL Camera const* restrict camera,
+    int x,
+    int y,
+    float2 pixel_sample,
+    int output_width,
+    int output_height,
+    float3 camera_right,
+    float3* camera_p
+)
+{
+    int view_width = output_width / camera->num_views;
+    int view = min(x / view_width, camera->num_views - 1);
+    int view_x = x - view * view_width;
+
+    *camera_p += camera_right * (((float)view - 0.5f * (float)(camera->num_views - 1)) * camera->view_separation);
+
+    float2 img_sample;
+    img_sample.x = (float)view_x / view_width + pixel_sample.x / view_width;
+    img_sample.y = (float)y / output_height + pixel_sample.y / output_height;
+    return img_sample;
+}
+
 // Pinhole camera implementation.
 // This kernel is being used if aperture value = 0.
 KERNEL
@@ -51,6 +76,8 @@ void PerspectiveCamera_GeneratePaths(
     uint rng_seed,
     // Current frame
     uint frame,
+    // Number of samples per pixel in the batch
+    int num_samples,
     // Rays to generate
     GLOBAL ray* restrict rays,
     // RNG data
@@ -70,24 +97,32 @@ void PerspectiveCamera_GeneratePaths(
         // Get pointer to ray & path handles
         GLOBAL ray* my_ray = rays + global_id;
 
+        // Samples of a pixel are laid out in consecutive blocks, each block takes its own frame
+        uint sample_frame = frame + global_id / (*num_pixels / num_samples);
+
         // Initialize sampler
         Sampler sampler;
 #if SAMPLER == SOBOL
         uint scramble = random[x + output_width * y] * 0x1fe3434f;
 
-        if (frame & 0xF)
+        // Seed is shared by all samples of a pixel, so it is only updated for single sample batches
+        if (num_samples == 1 && (frame & 0xF))
         {
             random[x + output_width * y] = WangHash(scramble);
         }
 
-        Sampler_Init(&sampler, frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
+        Sampler_Init(&sampler, sample_frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
+#elif SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+        // Per-pixel blue noise value or Owen scrambling seed is used as is
+        uint scramble = random[x + output_width * y];
+        Sampler_Init(&sampler, sample_frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
 #elif SAMPLER == RANDOM
-        uint scramble = x + output_width * y * rng_seed;
+        uint scramble = x + output_width * y * rng_seed + (sample_frame - frame) * 0x9e3779b9;
         Sampler_Init(&sampler, scramble);
 #elif SAMPLER == CMJ
         uint rnd = random[x + output_width * y];
-        uint scramble = rnd * 0x1fe3434f * ((frame + 133 * rnd) / (CMJ_DIM * CMJ_DIM));
-        Sampler_Init(&sampler, frame % (CMJ_DIM * CMJ_DIM), SAMPLE_DIM_CAMERA_OFFSET, scramble);
+        uint scramble = rnd * 0x1fe3434f * ((sample_frame + 133 * rnd) / (CMJ_DIM * CMJ_DIM));
+        Sampler_Init(&sampler, sample_frame % (CMJ_DIM * CMJ_DIM), SAMPLE_DIM_CAMERA_OFFSET, scramble);
 #endif
 
         // Generate sample
@@ -96,11 +131,33 @@ void PerspectiveCamera_GeneratePaths(
 #else
         float2 sample0 = make_float2(0.5f, 0.5f);
 #endif
+#if defined(BAIKAL_PIXEL_FILTER) && !defined(BAIKAL_GENERATE_SAMPLE_AT_PIXEL_CENTER)
+        // Filter footprint is importance sampled, so samples accumulate with equal weights
+        float2 pixel_sample = make_float2(0.5f, 0.5f) + Sample_PixelFilter(sample0);
+#else
+        float2 pixel_sample = sample0;
+#endif
+
+#ifdef BAIKAL_MOTION_BLUR
+        // Time is sampled in a dimension no other camera or surface sample uses
+        sampler.dimension = SAMPLE_DIM_CAMERA_TIME;
+        float time = Sampler_Sample1D(&sampler, SAMPLER_ARGS);
+
+        // Camera frame moves linearly over the shutter interval
+        float3 camera_forward = normalize(mix(camera->forward, camera->motion_forward, time));
+        float3 camera_right = normalize(mix(camera->right, camera->motion_right, time));
+        float3 camera_up = normalize(mix(camera->up, camera->motion_up, time));
+        float3 camera_p = mix(camera->p, camera->motion_p, time);
+#else
+        float time = sample0.x;
+        float3 camera_forward = camera->forward;
+        float3 camera_right = camera->right;
+        float3 camera_up = camera->up;
+        float3 camera_p = camera->p;
+#endif
 
         // Calculate [0..1] image plane sample
-        float2 img_sample;
-        img_sample.x = (float)x / output_width + sample0.x / output_width;
-        img_sample.y = (float)y / output_height + sample0.y / output_height;
+        float2 img_sample = Camera_GetViewSample(camera, x, y, pixel_sample, output_width, output_height, camera_right, &camera_p);
 
         // Transform into [-0.5, 0.5]
         float2 h_sample = img_sample - make_float2(0.5f, 0.5f);
@@ -108,18 +165,22 @@ void PerspectiveCamera_GeneratePaths(
         float2 c_sample = h_sample * camera->dim;
 
         // Calculate direction to image plane
-        my_ray->d.xyz = normalize(camera->focal_length * camera->forward + c_sample.x * camera->right + c_sample.y * camera->up);
+        my_ray->d.xyz = normalize(camera->focal_length * camera_forward + c_sample.x * camera_right + c_sample.y * camera_up);
         // Origin == camera position + nearz * d
-        my_ray->o.xyz = camera->p + camera->zcap.x * my_ray->d.xyz;
+        my_ray->o.xyz = camera_p + camera->zcap.x * my_ray->d.xyz;
         // Max T value = zfar - znear since we moved origin to znear
         my_ray->o.w = camera->zcap.y - camera->zcap.x;
-        // Generate random time from 0 to 1
-        my_ray->d.w = sample0.x;
+        // Time over the shutter interval
+        my_ray->d.w = time;
         // Set ray max
         my_ray->extra.x = 0xFFFFFFFF;
         my_ray->extra.y = 0xFFFFFFFF;
         Ray_SetExtra(my_ray, 1.f);
         Ray_SetMask(my_ray, VISIBILITY_MASK_PRIMARY);
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+        // Pixel footprint cone starts at the camera
+        Ray_SetCone(my_ray, make_float2(0.f, camera->dim.y / (camera->focal_length * output_height)));
+#endif
     }
 }
 
@@ -139,6 +200,8 @@ KERNEL void PerspectiveCameraDof_GeneratePaths(
     uint rng_seed,
     // Current frame
     uint frame,
+    // Number of samples per pixel in the batch
+    int num_samples,
     // Rays to generate
     GLOBAL ray* restrict rays,
     // RNG data
@@ -158,24 +221,32 @@ KERNEL void PerspectiveCameraDof_GeneratePaths(
         // Get pointer to ray & path handles
         GLOBAL ray* my_ray = rays + global_id;
 
+        // Samples of a pixel are laid out in consecutive blocks, each block takes its own frame
+        uint sample_frame = frame + global_id / (*num_pixels / num_samples);
+
         // Initialize sampler
         Sampler sampler;
 #if SAMPLER == SOBOL
         uint scramble = random[x + output_width * y] * 0x1fe3434f;
 
-        if (frame & 0xF)
+        // Seed is shared by all samples of a pixel, so it is only updated for single sample batches
+        if (num_samples == 1 && (frame & 0xF))
         {
             random[x + output_width * y] = WangHash(scramble);
         }
 
-        Sampler_Init(&sampler, frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
+        Sampler_Init(&sampler, sample_frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
+#elif SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+        // Per-pixel blue noise value or Owen scrambling seed is used as is
+        uint scramble = random[x + output_width * y];
+        Sampler_Init(&sampler, sample_frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
 #elif SAMPLER == RANDOM
-        uint scramble = x + output_width * y * rng_seed;
+        uint scramble = x + output_width * y * rng_seed + (sample_frame - frame) * 0x9e3779b9;
         Sampler_Init(&sampler, scramble);
 #elif SAMPLER == CMJ
         uint rnd = random[x + output_width * y];
-        uint scramble = rnd * 0x1fe3434f * ((frame + 133 * rnd) / (CMJ_DIM * CMJ_DIM));
-        Sampler_Init(&sampler, frame % (CMJ_DIM * CMJ_DIM), SAMPLE_DIM_CAMERA_OFFSET, scramble);
+        uint scramble = rnd * 0x1fe3434f * ((sample_frame + 133 * rnd) / (CMJ_DIM * CMJ_DIM));
+        Sampler_Init(&sampler, sample_frame % (CMJ_DIM * CMJ_DIM), SAMPLE_DIM_CAMERA_OFFSET, scramble);
 #endif
 
         // Generate pixel and lens samples
@@ -183,13 +254,35 @@ KERNEL void PerspectiveCameraDof_GeneratePaths(
         float2 sample0 = Sampler_Sample2D(&sampler, SAMPLER_ARGS);
 #else
         float2 sample0 = make_float2(0.5f, 0.5f);
+#endif
+#if defined(BAIKAL_PIXEL_FILTER) && !defined(BAIKAL_GENERATE_SAMPLE_AT_PIXEL_CENTER)
+        // Filter footprint is importance sampled, so samples accumulate with equal weights
+        float2 pixel_sample = make_float2(0.5f, 0.5f) + Sample_PixelFilter(sample0);
+#else
+        float2 pixel_sample = sample0;
 #endif
         float2 sample1 = Sampler_Sample2D(&sampler, SAMPLER_ARGS);
 
+#ifdef BAIKAL_MOTION_BLUR
+        // Time is sampled in a dimension no other camera or surface sample uses
+        sampler.dimension = SAMPLE_DIM_CAMERA_TIME;
+        float time = Sampler_Sample1D(&sampler, SAMPLER_ARGS);
+
+        // Camera frame moves linearly over the shutter interval
+        float3 camera_forward = normalize(mix(camera->forward, camera->motion_forward, time));
+        float3 camera_right = normalize(mix(camera->right, camera->motion_right, time));
+        float3 camera_up = normalize(mix(camera->up, camera->motion_up, time));
+        float3 camera_p = mix(camera->p, camera->motion_p, time);
+#else
+        float time = sample0.x;
+        float3 camera_forward = camera->forward;
+        float3 camera_right = camera->right;
+        float3 camera_up = camera->up;
+        float3 camera_p = camera->p;
+#endif
+
         // Calculate [0..1] image plane sample
-        float2 img_sample;
-        img_sample.x = (float)x / output_width + sample0.x / output_width;
-        img_sample.y = (float)y / output_height + sample0.y / output_height;
+        float2 img_sample = Camera_GetViewSample(camera, x, y, pixel_sample, output_width, output_height, camera_right, &camera_p);
 
         // Transform into [-0.5, 0.5]
         float2 h_sample = img_sample - make_float2(0.5f, 0.5f);
@@ -204,18 +297,22 @@ KERNEL void PerspectiveCameraDof_GeneratePaths(
         float2 camera_dir = focal_plane_sample - lens_sample;
 
         // Calculate direction to image plane
-        my_ray->d.xyz = normalize(camera->forward * camera->focus_distance + camera->right * camera_dir.x + camera->up * camera_dir.y);
+        my_ray->d.xyz = normalize(camera_forward * camera->focus_distance + camera_right * camera_dir.x + camera_up * camera_dir.y);
         // Origin == camera position + nearz * d
-        my_ray->o.xyz = camera->p + lens_sample.x * camera->right + lens_sample.y * camera->up;
+        my_ray->o.xyz = camera_p + lens_sample.x * camera_right + lens_sample.y * camera_up;
         // Max T value = zfar - znear since we moved origin to znear
         my_ray->o.w = camera->zcap.y - camera->zcap.x;
-        // Generate random time from 0 to 1
-        my_ray->d.w = sample0.x;
+        // Time over the shutter interval
+        my_ray->d.w = time;
         // Set ray max
         my_ray->extra.x = 0xFFFFFFFF;
         my_ray->extra.y = 0xFFFFFFFF;
         Ray_SetExtra(my_ray, 1.f);
         Ray_SetMask(my_ray, VISIBILITY_MASK_PRIMARY);
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+        // Pixel footprint cone starts at the camera
+        Ray_SetCone(my_ray, make_float2(0.f, camera->dim.y / (camera->focal_length * output_height)));
+#endif
     }
 }
 
@@ -275,6 +372,10 @@ void PerspectiveCamera_GenerateVertices(
             random[x + output_width * y] = WangHash(scramble);
         }
 
+        Sampler_Init(&sampler, frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
+#elif SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+        // Per-pixel blue noise value or Owen scrambling seed is used as is
+        uint scramble = random[x + output_width * y];
         Sampler_Init(&sampler, frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
 #elif SAMPLER == RANDOM
         uint scramble = x + output_width * y * rng_seed;
@@ -327,10 +428,7 @@ void PerspectiveCamera_GenerateVertices(
         *my_vertex = v;
 
         // Initlize path data
-        my_path->throughput = make_float3(1.f, 1.f, 1.f);
-        my_path->volume = -1;
-        my_path->flags = 0;
-        my_path->active = 0xFF;
+        Path_Init(my_path, make_float3(1.f, 1.f, 1.f), INVALID_IDX);
     }
 }
 
@@ -388,6 +486,10 @@ void PerspectiveCameraDof_GenerateVertices(
             random[x + output_width * y] = WangHash(scramble);
         }
 
+        Sampler_Init(&sampler, frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
+#elif SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+        // Per-pixel blue noise value or Owen scrambling seed is used as is
+        uint scramble = random[x + output_width * y];
         Sampler_Init(&sampler, frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
 #elif SAMPLER == RANDOM
         uint scramble = x + output_width * y * rng_seed;
@@ -448,10 +550,7 @@ void PerspectiveCameraDof_GenerateVertices(
         *my_vertex = v;
 
         // Initlize path data
-        my_path->throughput = make_float3(1.f, 1.f, 1.f);
-        my_path->volume = -1;
-        my_path->flags = 0;
-        my_path->active = 0xFF;
+        Path_Init(my_path, make_float3(1.f, 1.f, 1.f), INVALID_IDX);
     }
 }
 
@@ -477,6 +576,8 @@ KERNEL void GenerateTileDomain(
     int offset_y,
     int width,
     int height,
+    // Number of samples per pixel, tile domain is replicated for each of them
+    int num_samples,
     uint rng_seed,
     uint frame,
     GLOBAL uint* restrict random,
@@ -512,12 +613,15 @@ KERNEL void GenerateTileDomain(
             (group_id.y * tile_size.y + local_id.y) * output_width +
             (group_id.x * tile_size.x + local_id.x);
 
-        indices[global_id.y * width + global_id.x] = idx;
+        for (int i = 0; i < num_samples; ++i)
+        {
+            indices[i * width * height + global_id.y * width + global_id.x] = idx;
+        }
     }
 
     if (global_id.x == 0 && global_id.y == 0)
     {
-        *count = width * height;
+        *count = width * height * num_samples;
     }
 }
 
@@ -533,8 +637,11 @@ KERNEL void GenerateTileDomain_Adaptive(
     GLOBAL uint* restrict random,
     GLOBAL uint const* restrict sobol_mat,
     GLOBAL int const* restrict tile_distribution,
+    // Per-pixel convergence flags
+    GLOBAL int const* restrict convergence_mask,
     GLOBAL int* restrict indices,
-    GLOBAL int* restrict count
+    // Compaction predicate, converged pixels are dropped
+    GLOBAL int* restrict predicate
 )
 {
     int2 global_id;
@@ -566,6 +673,10 @@ KERNEL void GenerateTileDomain_Adaptive(
         random[x + output_width * y] = WangHash(scramble);
     }
 
+    Sampler_Init(&sampler, frame, SAMPLE_DIM_IMG_PLANE_EVALUATE_OFFSET, scramble);
+#elif SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+    // Per-pixel blue noise value or Owen scrambling seed is used as is
+    uint scramble = random[x + output_width * y];
     Sampler_Init(&sampler, frame, SAMPLE_DIM_IMG_PLANE_EVALUATE_OFFSET, scramble);
 #elif SAMPLER == RANDOM
     uint scramble = x + output_width * y * rng_seed;
@@ -596,11 +707,7 @@ KERNEL void GenerateTileDomain_Adaptive(
             (tile_x * tile_size.x + local_id.x);
 
         indices[global_id.y * width + global_id.x] = idx;
-    }
-
-    if (global_id.x == 0 && global_id.y == 0)
-    {
-        *count = width * height;
+        predicate[global_id.y * width + global_id.x] = convergence_mask[idx] ? 0 : 1;
     }
 }
 
@@ -649,21 +756,216 @@ KERNEL void ApplyGammaAndCopyData(
     }
 } 
 
+// Resolve region of accumulated output into tightly packed readback buffer,
+// either as RGBA32F divided by sample count or gamma corrected RGBA8
+KERNEL void ResolveOutputRegion(
+    GLOBAL float4 const* restrict data,
+    int width,
+    int region_x,
+    int region_y,
+    int region_width,
+    int region_height,
+    float gamma,
+    int rgba8,
+    GLOBAL uchar* restrict resolved
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < region_width * region_height)
+    {
+        int x = region_x + global_id % region_width;
+        int y = region_y + global_id / region_width;
+
+        float4 v = data[y * width + x];
+        float4 val = v.w > 0.f ? v / v.w : (float4)(0.f);
+
+        if (rgba8)
+        {
+            val = clamp(native_powr(val, 1.f / gamma), 0.f, 1.f);
+            vstore4(convert_uchar4_sat_rte(val * 255.f), global_id, resolved);
+        }
+        else
+        {
+            vstore4(val, global_id, (GLOBAL float*)resolved);
+        }
+    }
+}
+
 KERNEL void AccumulateSingleSample(
     GLOBAL float4 const* restrict src_sample_data,
     GLOBAL float4* restrict dst_accumulation_data,
+    // Per-pixel sum of squared sample luminance
+    GLOBAL float* restrict dst_moments,
     GLOBAL int* restrict scatter_indices,
-    int num_elements
+    GLOBAL int const* restrict num_elements
 )
 {
     int global_id = get_global_id(0);
 
-    if (global_id < num_elements)
+    if (global_id < *num_elements)
     {
         int idx = scatter_indices[global_id];
         float4 sample = src_sample_data[global_id];
+        float l = luminance(sample.xyz);
         dst_accumulation_data[idx].xyz += sample.xyz;
         dst_accumulation_data[idx].w += 1.f;
+        dst_moments[idx] += l * l;
+    }
+}
+
+// Sum sample slots of the tile pixels into the output. Slot of sample i of pixel p is i * num_pixels + p
+// like in GenerateTileDomain, so every pixel is written by a single work-item and needs no atomics.
+KERNEL void ResolveSampleSlots(
+    GLOBAL float4 const* restrict slots,
+    int num_pixels,
+    int num_samples,
+    // Tile domain, output pixel of every slot
+    GLOBAL int const* restrict indices,
+    GLOBAL float4* restrict output
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_pixels)
+    {
+        float4 sum = 0.f;
+
+        for (int i = 0; i < num_samples; ++i)
+        {
+            sum += slots[i * num_pixels + global_id];
+        }
+
+        output[indices[global_id]] += sum;
+    }
+}
+
+// Sort keys grouping samples of the same pixel, entries past the sample count go last
+KERNEL void BuildSampleSortKeys(
+    GLOBAL int const* restrict scatter_indices,
+    GLOBAL int const* restrict num_elements,
+    int num_entries,
+    GLOBAL int* restrict keys,
+    GLOBAL int* restrict values
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_entries)
+    {
+        keys[global_id] = global_id < *num_elements ? scatter_indices[global_id] : INT_MAX;
+        values[global_id] = global_id;
+    }
+}
+
+// Same as AccumulateSingleSample for samples sorted by pixel. First sample of every pixel
+// sums up the others, so duplicate pixels are accumulated without atomics.
+KERNEL void AccumulateSortedSamples(
+    GLOBAL float4 const* restrict src_sample_data,
+    GLOBAL float4* restrict dst_accumulation_data,
+    // Per-pixel sum of squared sample luminance
+    GLOBAL float* restrict dst_moments,
+    // Sorted pixels and sample indices
+    GLOBAL int const* restrict keys,
+    GLOBAL int const* restrict values,
+    int num_entries
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_entries)
+    {
+        int idx = keys[global_id];
+
+        if (idx == INT_MAX || (global_id > 0 && keys[global_id - 1] == idx))
+        {
+            return;
+        }
+
+        float4 sum = 0.f;
+        float moments = 0.f;
+
+        for (int i = global_id; i < num_entries && keys[i] == idx; ++i)
+        {
+            float4 sample = src_sample_data[values[i]];
+            float l = luminance(sample.xyz);
+            sum.xyz += sample.xyz;
+            sum.w += 1.f;
+            moments += l * l;
+        }
+
+        dst_accumulation_data[idx] += sum;
+        dst_moments[idx] += moments;
+    }
+}
+
+// Mark pixels which relative error of the mean dropped below the threshold.
+// Each work-group covers one variance tile and reports the number of pixels
+// which still need samples.
+KERNEL void UpdateConvergenceMask(
+    GLOBAL float4 const* restrict image_buffer,
+    GLOBAL float const* restrict moments,
+    int width,
+    int height,
+    // Minimum number of samples before a pixel can converge
+    int min_samples,
+    // Relative error threshold
+    float threshold,
+    GLOBAL int* restrict convergence_mask,
+    // Number of unconverged pixels per tile
+    GLOBAL int* restrict tile_unconverged,
+    // Total number of unconverged pixels
+    GLOBAL int* restrict num_unconverged
+)
+{
+    __local int lds[256];
+
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    int gx = get_group_id(0);
+    int gy = get_group_id(1);
+    int wx = get_local_size(0);
+    int num_tiles_x = (width + wx - 1) / wx;
+    int lid = ly * wx + lx;
+
+    int unconverged = 0;
+    if (x < width && y < height)
+    {
+        int idx = y * width + x;
+        float4 v = image_buffer[idx];
+        float n = v.w;
+
+        bool converged = false;
+        if (n >= (float)min_samples && n > 1.f)
+        {
+            float mean = luminance(v.xyz) / n;
+            float variance = max(moments[idx] / n - mean * mean, 0.f) / (n - 1.f);
+            // Black pixels have zero variance and converge right away
+            converged = native_sqrt(variance) <= threshold * max(mean, 1e-4f);
+        }
+
+        convergence_mask[idx] = converged ? 1 : 0;
+        unconverged = converged ? 0 : 1;
+    }
+
+    lds[lid] = unconverged;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int offset = (256 >> 1); offset > 0; offset >>= 1)
+    {
+        if (lid < offset)
+        {
+            lds[lid] += lds[lid + offset];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0 && (gx * wx) < width && (gy * get_local_size(1)) < height)
+    {
+        tile_unconverged[gy * num_tiles_x + gx] = lds[0];
+        atomic_add(num_unconverged, lds[0]);
     }
 }
 
@@ -772,6 +1074,84 @@ KERNEL void EstimateVariance(
     }
 }
 
+// Build tile sampling distribution from per-tile variance.
+// Output layout matches host Distribution1D serialization, see Distribution1D_GetSize.
+// Launched as a single 256-wide work-group: each item reduces a contiguous range
+// of tiles, partial sums are scanned in local memory and then each item writes
+// its range. The first item builds the alias table once all PDF values are written.
+KERNEL void BuildTileDistribution(
+    GLOBAL float const* restrict variance_buffer,
+    // Number of unconverged pixels per tile
+    GLOBAL int const* restrict tile_unconverged,
+    // Drop tiles without unconverged pixels
+    int use_convergence_mask,
+    int num_tiles,
+    GLOBAL int* restrict distribution
+)
+{
+    __local float lds[256];
+
+    int lid = get_local_id(0);
+    int range = (num_tiles + 255) / 256;
+    int begin = min(lid * range, num_tiles);
+    int end = min(begin + range, num_tiles);
+
+    float sum = 0.f;
+    for (int i = begin; i < end; ++i)
+    {
+        bool skip = use_convergence_mask && tile_unconverged[i] == 0;
+        sum += skip ? 0.f : variance_buffer[i];
+    }
+
+    lds[lid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Inclusive scan of partial sums
+    for (int offset = 1; offset < 256; offset <<= 1)
+    {
+        float value = lid >= offset ? lds[lid - offset] : 0.f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        lds[lid] += value;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    float total = lds[255];
+    float prefix = lid > 0 ? lds[lid - 1] : 0.f;
+
+    // Fall back to uniform distribution if there is nothing to sample
+    bool uniform = !(total > 0.f);
+    if (uniform)
+    {
+        total = (float)num_tiles;
+        prefix = (float)begin;
+    }
+
+    GLOBAL float* cdf = (GLOBAL float*)&distribution[1];
+    GLOBAL float* pdf = cdf + num_tiles + 1;
+
+    for (int i = begin; i < end; ++i)
+    {
+        bool skip = use_convergence_mask && tile_unconverged[i] == 0;
+        float value = uniform ? 1.f : (skip ? 0.f : variance_buffer[i]);
+        cdf[i] = prefix / total;
+        pdf[i] = value * num_tiles / total;
+        prefix += value;
+    }
+
+    if (lid == 0)
+    {
+        distribution[0] = num_tiles;
+        cdf[num_tiles] = 1.f;
+    }
+
+    barrier(CLK_GLOBAL_MEM_FENCE);
+
+    if (lid == 0)
+    {
+        Distribution1D_BuildAliasTable(distribution);
+    }
+}
+
 KERNEL
 void  OrthographicCamera_GeneratePaths(
                                      // Camera
@@ -787,6 +1167,8 @@ void  OrthographicCamera_GeneratePaths(
                                      uint rng_seed,
                                      // Current frame
                                      uint frame,
+                                     // Number of samples per pixel in the batch
+                                     int num_samples,
                                      // Rays to generate
                                      GLOBAL ray* restrict rays,
                                      // RNG data
@@ -805,25 +1187,33 @@ void  OrthographicCamera_GeneratePaths(
         
         // Get pointer to ray & path handles
         GLOBAL ray* my_ray = rays + global_id;
+
+        // Samples of a pixel are laid out in consecutive blocks, each block takes its own frame
+        uint sample_frame = frame + global_id / (*num_pixels / num_samples);
         
         // Initialize sampler
         Sampler sampler;
 #if SAMPLER == SOBOL
         uint scramble = random[x + output_width * y] * 0x1fe3434f;
         
-        if (frame & 0xF)
+        // Seed is shared by all samples of a pixel, so it is only updated for single sample batches
+        if (num_samples == 1 && (frame & 0xF))
         {
             random[x + output_width * y] = WangHash(scramble);
         }
         
-        Sampler_Init(&sampler, frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
+        Sampler_Init(&sampler, sample_frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
+#elif SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+        // Per-pixel blue noise value or Owen scrambling seed is used as is
+        uint scramble = random[x + output_width * y];
+        Sampler_Init(&sampler, sample_frame, SAMPLE_DIM_CAMERA_OFFSET, scramble);
 #elif SAMPLER == RANDOM
-        uint scramble = x + output_width * y * rng_seed;
+        uint scramble = x + output_width * y * rng_seed + (sample_frame - frame) * 0x9e3779b9;
         Sampler_Init(&sampler, scramble);
 #elif SAMPLER == CMJ
         uint rnd = random[x + output_width * y];
-        uint scramble = rnd * 0x1fe3434f * ((frame + 133 * rnd) / (CMJ_DIM * CMJ_DIM));
-        Sampler_Init(&sampler, frame % (CMJ_DIM * CMJ_DIM), SAMPLE_DIM_CAMERA_OFFSET, scramble);
+        uint scramble = rnd * 0x1fe3434f * ((sample_frame + 133 * rnd) / (CMJ_DIM * CMJ_DIM));
+        Sampler_Init(&sampler, sample_frame % (CMJ_DIM * CMJ_DIM), SAMPLE_DIM_CAMERA_OFFSET, scramble);
 #endif
         
         // Generate sample
@@ -832,11 +1222,33 @@ void  OrthographicCamera_GeneratePaths(
 #else
         float2 sample0 = make_float2(0.5f, 0.5f);
 #endif
+#if defined(BAIKAL_PIXEL_FILTER) && !defined(BAIKAL_GENERATE_SAMPLE_AT_PIXEL_CENTER)
+        // Filter footprint is importance sampled, so samples accumulate with equal weights
+        float2 pixel_sample = make_float2(0.5f, 0.5f) + Sample_PixelFilter(sample0);
+#else
+        float2 pixel_sample = sample0;
+#endif
         
+#ifdef BAIKAL_MOTION_BLUR
+        // Time is sampled in a dimension no other camera or surface sample uses
+        sampler.dimension = SAMPLE_DIM_CAMERA_TIME;
+        float time = Sampler_Sample1D(&sampler, SAMPLER_ARGS);
+
+        // Camera frame moves linearly over the shutter interval
+        float3 camera_forward = normalize(mix(camera->forward, camera->motion_forward, time));
+        float3 camera_right = normalize(mix(camera->right, camera->motion_right, time));
+        float3 camera_up = normalize(mix(camera->up, camera->motion_up, time));
+        float3 camera_p = mix(camera->p, camera->motion_p, time);
+#else
+        float time = sample0.x;
+        float3 camera_forward = camera->forward;
+        float3 camera_right = camera->right;
+        float3 camera_up = camera->up;
+        float3 camera_p = camera->p;
+#endif
+
         // Calculate [0..1] image plane sample
-        float2 img_sample;
-        img_sample.x = (float)x / output_width + sample0.x / output_width;
-        img_sample.y = (float)y / output_height + sample0.y / output_height;
+        float2 img_sample = Camera_GetViewSample(camera, x, y, pixel_sample, output_width, output_height, camera_right, &camera_p);
         
         // Transform into [-0.5, 0.5]
         float2 h_sample = img_sample - make_float2(0.5f, 0.5f);
@@ -844,18 +1256,22 @@ void  OrthographicCamera_GeneratePaths(
         float2 c_sample = h_sample * camera->dim;
         
         // Calculate direction to image plane
-        my_ray->d.xyz = normalize(camera->forward);
+        my_ray->d.xyz = normalize(camera_forward);
         // Origin == camera position + nearz * d
-        my_ray->o.xyz = camera->p + c_sample.x * camera->right + c_sample.y * camera->up;
+        my_ray->o.xyz = camera_p + c_sample.x * camera_right + c_sample.y * camera_up;
         // Max T value = zfar - znear since we moved origin to znear
         my_ray->o.w = camera->zcap.y - camera->zcap.x;
-        // Generate random time from 0 to 1
-        my_ray->d.w = sample0.x;
+        // Time over the shutter interval
+        my_ray->d.w = time;
         // Set ray max
         my_ray->extra.x = 0xFFFFFFFF;
         my_ray->extra.y = 0xFFFFFFFF;
         Ray_SetExtra(my_ray, 1.f);
         Ray_SetMask(my_ray, VISIBILITY_MASK_PRIMARY);
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+        // Parallel rays keep the pixel footprint
+        Ray_SetCone(my_ray, make_float2(camera->dim.y / output_height, 0.f));
+#endif
     }
 }
 
@@ -869,6 +1285,8 @@ KERNEL void ShadeBackgroundImage(
     GLOBAL int const* restrict pixel_indices,
     // Output indices
     GLOBAL int const*  restrict output_indices,
+    // Image pixels the background is looked up at, differ from output indices if estimates go to sample slots
+    GLOBAL int const* restrict image_indices,
     // Number of rays
     int num_rays,
     int background_idx,
@@ -887,9 +1305,10 @@ KERNEL void ShadeBackgroundImage(
     {
         int pixel_idx = pixel_indices[global_id];
         int output_index = output_indices[pixel_idx];
+        int image_index = image_indices[pixel_idx];
 
-        float x = (float)(output_index % width) / (float)width;
-        float y = (float)(output_index / width) / (float)height;
+        float x = (float)(image_index % width) / (float)width;
+        float y = (float)(image_index / width) / (float)height;
 
         float4 v = make_float4(0.f, 0.f, 0.f, 1.f);
 
@@ -905,4 +1324,29 @@ KERNEL void ShadeBackgroundImage(
 }
 
 
+// Tile the screen with blue noise values, they are used as per-pixel
+// scrambles by BLUE_NOISE_SOBOL sampler
+KERNEL void FillBlueNoiseScrambles(
+    // Blue noise tile
+    GLOBAL uint const* restrict blue_noise,
+    int tile_size,
+    // Image resolution
+    int output_width,
+    int output_height,
+    // Size of RNG data buffer
+    int num_elements,
+    // RNG data
+    GLOBAL uint* restrict random
+)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x < output_width && y < output_height && x + output_width * y < num_elements)
+    {
+        random[x + output_width * y] = blue_noise[(x % tile_size) + tile_size * (y % tile_size)];
+    }
+}
+
+
 #endif // MONTE_CARLO_RENDERER_CL
@@ -26,23 +26,54 @@ THE SOFTWARE.
 #include <../Baikal/Kernels/CL/payload.cl>
 #include <../Baikal/Kernels/CL/bxdf_flags.cl>
 
+#ifndef BAIKAL_COMPACT_PATH
 typedef struct _Path
 {
     float3 throughput;
     int volume;
     int flags;
     int active;
-    int extra1;
+    // Light link mask of the last surface vertex
+    int light_mask;
+} Path;
+#else
+// Compact path state (12 bytes instead of 32): throughput is kept in half
+// precision, flags, BxDF flags and volume index share one 32-bit word.
+// Bits 0-7: path flags, bits 8-15: BxDF flags, bits 16-31: volume index + 1.
+typedef struct _Path
+{
+    ushort throughput[3];
+    // Lower 16 bits of the light link mask of the last surface vertex
+    ushort light_mask;
+    uint state;
 } Path;
 
+#define PATH_FLAGS_MASK 0xffu
+#define PATH_BXDF_FLAGS_MASK 0xff00u
+#define PATH_VOLUME_SHIFT 16
+// Largest finite half value
+#define PATH_MAX_THROUGHPUT 65504.f
+#endif
+
 typedef enum _PathFlags
 {
     kNone = 0x0,
     kKilled = 0x1,
     kScattered = 0x2,
-    kOpaque = 0x4
+    kOpaque = 0x4,
+    kCaustic = 0x8,
+    kIndirect = 0x10,
+    kGlossy = 0x20,
+    // Environment light at the last vertex has been added from its irradiance
+    kEnvIrradiance = 0x40,
+    // Current ray probes the shape for the exit point of diffusion subsurface scattering
+    kSubsurfaceProbe = 0x80
 } PathFlags;
 
+// Roughness floor applied after the first glossy bounce with BAIKAL_REGULARIZE_ROUGHNESS
+#define REGULARIZATION_MIN_ROUGHNESS 0.3f
+
+#ifndef BAIKAL_COMPACT_PATH
 INLINE bool Path_IsScattered(__global Path const* path)
 {
     return path->flags & kScattered;
@@ -73,9 +104,80 @@ INLINE void Path_SetOpacityFlag(__global Path* path)
     path->flags |= kOpaque;
 }
 
+// Caustic flag marks paths which went through a non-singular vertex followed
+// only by singular ones (eye paths) or only through singular vertices (light paths)
+INLINE bool Path_IsCaustic(__global Path const* path)
+{
+    return path->flags & kCaustic;
+}
+
+INLINE void Path_SetCausticFlag(__global Path* path)
+{
+    path->flags |= kCaustic;
+}
+
+INLINE void Path_ClearCausticFlag(__global Path* path)
+{
+    path->flags &= ~kCaustic;
+}
+
+// Indirect flag marks paths which have been extended from at least one surface
+INLINE bool Path_IsIndirect(__global Path const* path)
+{
+    return path->flags & kIndirect;
+}
+
+INLINE void Path_SetIndirectFlag(__global Path* path)
+{
+    path->flags |= kIndirect;
+}
+
+// Glossy flag marks paths which have been extended from a non-singular surface
+INLINE bool Path_IsGlossy(__global Path const* path)
+{
+    return path->flags & kGlossy;
+}
+
+INLINE void Path_SetGlossyFlag(__global Path* path)
+{
+    path->flags |= kGlossy;
+}
+
+// Environment irradiance flag tells miss shading the environment has been already accounted for
+INLINE bool Path_IsEnvIrradiance(__global Path const* path)
+{
+    return path->flags & kEnvIrradiance;
+}
+
+INLINE void Path_SetEnvIrradianceFlag(__global Path* path)
+{
+    path->flags |= kEnvIrradiance;
+}
+
+INLINE void Path_ClearEnvIrradianceFlag(__global Path* path)
+{
+    path->flags &= ~kEnvIrradiance;
+}
+
+// Subsurface probe flag tells the next hit is the exit point of diffusion subsurface scattering
+INLINE bool Path_IsSubsurfaceProbe(__global Path const* path)
+{
+    return path->flags & kSubsurfaceProbe;
+}
+
+INLINE void Path_SetSubsurfaceProbeFlag(__global Path* path)
+{
+    path->flags |= kSubsurfaceProbe;
+}
+
+INLINE void Path_ClearSubsurfaceProbeFlag(__global Path* path)
+{
+    path->flags &= ~kSubsurfaceProbe;
+}
+
 INLINE void Path_ClearBxdfFlags(__global Path* path)
 {
-    path->flags &= (kKilled | kScattered | kOpaque);
+    path->flags &= (kKilled | kScattered | kOpaque | kCaustic | kIndirect | kGlossy | kEnvIrradiance | kSubsurfaceProbe);
 }
 
 INLINE int Path_GetBxdfFlags(__global Path const* path)
@@ -109,6 +211,11 @@ INLINE float3 Path_GetThroughput(__global Path const* path)
     return t;
 }
 
+INLINE void Path_SetThroughput(__global Path* path, float3 throughput)
+{
+    path->throughput = throughput;
+}
+
 INLINE void Path_MulThroughput(__global Path* path, float3 mul)
 {
     path->throughput *= mul;
@@ -119,9 +226,228 @@ INLINE void Path_Kill(__global Path* path)
     path->flags |= kKilled;
 }
 
+INLINE void Path_Init(__global Path* path, float3 throughput, int volume_idx)
+{
+    path->throughput = throughput;
+    path->volume = volume_idx;
+    path->flags = 0;
+    path->active = 0xFF;
+    path->light_mask = -1;
+}
+
+INLINE int Path_GetLightMask(__global Path const* path)
+{
+    return path->light_mask;
+}
+
+INLINE void Path_SetLightMask(__global Path* path, int light_mask)
+{
+    path->light_mask = light_mask;
+}
+
+#else
+INLINE bool Path_IsScattered(__global Path const* path)
+{
+    return path->state & kScattered;
+}
+
+INLINE bool Path_IsAlive(__global Path const* path)
+{
+    return ((path->state & kKilled) == 0);
+}
+
+INLINE bool Path_ContainsOpacity(__global Path const* path)
+{
+    return path->state & kOpaque;
+}
+
+INLINE void Path_ClearScatterFlag(__global Path* path)
+{
+    path->state &= ~kScattered;
+}
+
+INLINE void Path_SetScatterFlag(__global Path* path)
+{
+    path->state |= kScattered;
+}
+
+INLINE void Path_SetOpacityFlag(__global Path* path)
+{
+    path->state |= kOpaque;
+}
+
+INLINE bool Path_IsCaustic(__global Path const* path)
+{
+    return path->state & kCaustic;
+}
+
+INLINE void Path_SetCausticFlag(__global Path* path)
+{
+    path->state |= kCaustic;
+}
+
+INLINE void Path_ClearCausticFlag(__global Path* path)
+{
+    path->state &= ~kCaustic;
+}
+
+INLINE bool Path_IsIndirect(__global Path const* path)
+{
+    return path->state & kIndirect;
+}
+
+INLINE void Path_SetIndirectFlag(__global Path* path)
+{
+    path->state |= kIndirect;
+}
+
+INLINE bool Path_IsGlossy(__global Path const* path)
+{
+    return path->state & kGlossy;
+}
+
+INLINE void Path_SetGlossyFlag(__global Path* path)
+{
+    path->state |= kGlossy;
+}
+
+INLINE bool Path_IsEnvIrradiance(__global Path const* path)
+{
+    return path->state & kEnvIrradiance;
+}
+
+INLINE void Path_SetEnvIrradianceFlag(__global Path* path)
+{
+    path->state |= kEnvIrradiance;
+}
+
+INLINE void Path_ClearEnvIrradianceFlag(__global Path* path)
+{
+    path->state &= ~kEnvIrradiance;
+}
+
+// Subsurface probe flag tells the next hit is the exit point of diffusion subsurface scattering
+INLINE bool Path_IsSubsurfaceProbe(__global Path const* path)
+{
+    return path->state & kSubsurfaceProbe;
+}
+
+INLINE void Path_SetSubsurfaceProbeFlag(__global Path* path)
+{
+    path->state |= kSubsurfaceProbe;
+}
+
+INLINE void Path_ClearSubsurfaceProbeFlag(__global Path* path)
+{
+    path->state &= ~kSubsurfaceProbe;
+}
+
+INLINE void Path_ClearBxdfFlags(__global Path* path)
+{
+    path->state &= ~PATH_BXDF_FLAGS_MASK;
+}
+
+INLINE int Path_GetBxdfFlags(__global Path const* path)
+{
+    return (path->state & PATH_BXDF_FLAGS_MASK) >> 8;
+}
+
+INLINE int Path_SetBxdfFlags(__global Path* path, int flags)
+{
+    path->state |= ((uint)flags << 8) & PATH_BXDF_FLAGS_MASK;
+    return path->state & (PATH_FLAGS_MASK | PATH_BXDF_FLAGS_MASK);
+}
+
+INLINE void Path_Restart(__global Path* path)
+{
+    // Volume index is not a part of the flags
+    path->state &= ~(PATH_FLAGS_MASK | PATH_BXDF_FLAGS_MASK);
+}
+
+INLINE int Path_GetVolumeIdx(__global Path const* path)
+{
+    return (int)(path->state >> PATH_VOLUME_SHIFT) - 1;
+}
+
+INLINE void Path_SetVolumeIdx(__global Path* path, int volume_idx)
+{
+    path->state = (path->state & (PATH_FLAGS_MASK | PATH_BXDF_FLAGS_MASK)) | ((uint)(volume_idx + 1) << PATH_VOLUME_SHIFT);
+}
+
+INLINE float3 Path_GetThroughput(__global Path const* path)
+{
+    return vload_half3(0, (__global half const*)path->throughput);
+}
+
+INLINE void Path_SetThroughput(__global Path* path, float3 throughput)
+{
+    // Out of range values would turn into infinities
+    vstore_half3(min(throughput, PATH_MAX_THROUGHPUT), 0, (__global half*)path->throughput);
+}
+
+INLINE void Path_MulThroughput(__global Path* path, float3 mul)
+{
+    Path_SetThroughput(path, Path_GetThroughput(path) * mul);
+}
+
+INLINE void Path_Kill(__global Path* path)
+{
+    path->state |= kKilled;
+}
+
+INLINE void Path_Init(__global Path* path, float3 throughput, int volume_idx)
+{
+    path->state = 0;
+    path->light_mask = 0xffff;
+    Path_SetVolumeIdx(path, volume_idx);
+    Path_SetThroughput(path, throughput);
+}
+
+// Upper 16 bits of the mask are not stored and read back as set
+INLINE int Path_GetLightMask(__global Path const* path)
+{
+    return (int)path->light_mask | (int)0xffff0000;
+}
+
+INLINE void Path_SetLightMask(__global Path* path, int light_mask)
+{
+    path->light_mask = (ushort)(light_mask & 0xffff);
+}
+#endif
+
+// Decide if the path survives Russian roulette. Survival probability follows
+// throughput luminance and surviving paths are reweighted to keep the estimate unbiased.
+INLINE bool Path_SurviveRussianRoulette(__global Path* path, float sample)
+{
+    float3 t = Path_GetThroughput(path);
+    float q = clamp(0.2126f * t.x + 0.7152f * t.y + 0.0722f * t.z, 0.01f, 0.5f);
+
+    if (sample > q)
+    {
+        return false;
+    }
+
+    Path_MulThroughput(path, 1.f / q);
+    return true;
+}
+
+// Clamp indirect radiance samples to BAIKAL_MAX_RADIANCE. The whole value is
+// scaled so the hue is kept. Camera paths contributions are never clamped.
+INLINE float3 Path_ClampRadiance(__global Path const* path, float3 val)
+{
+#ifdef BAIKAL_MAX_RADIANCE
+    float max_value = max(val.x, max(val.y, val.z));
+    if (Path_IsIndirect(path) && max_value > BAIKAL_MAX_RADIANCE)
+    {
+        val *= BAIKAL_MAX_RADIANCE / max_value;
+    }
+#endif
+    return val;
+}
+
 INLINE void Path_AddContribution(__global Path* path, __global float3* output, int idx, float3 val)
 {
-    output[idx] += Path_GetThroughput(path) * val;
+    output[idx] += Path_ClampRadiance(path, Path_GetThroughput(path) * val);
 }
 
 INLINE bool Path_IsSpecular(__global Path const* path)
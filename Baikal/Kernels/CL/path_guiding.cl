@@ -0,0 +1,148 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef PATH_GUIDING_CL
+#define PATH_GUIDING_CL
+
+#include <../Baikal/Kernels/CL/common.cl>
+#include <../Baikal/Kernels/CL/utils.cl>
+
+// Path guiding caches incident radiance in a uniform grid over the scene,
+// every cell keeps a histogram of directions in cylindrical equal area
+// parametrization (cos theta, phi), so all bins have the same solid angle.
+// Guiding buffer starts with the header (grid origin, inverse cell size
+// and resolution) followed by direction CDFs of all cells. Cells with zero
+// last CDF value have not received any radiance yet and are not guided.
+#define PATH_GUIDING_HEADER_SIZE 12
+#define PATH_GUIDING_RESOLUTION 8
+#define PATH_GUIDING_NUM_BINS (PATH_GUIDING_RESOLUTION * PATH_GUIDING_RESOLUTION)
+// Probability to sample the guiding distribution instead of the BxDF
+#define PATH_GUIDING_FRACTION 0.5f
+// Number of first path vertices radiance is recorded for
+#define PATH_GUIDING_MAX_VERTICES 4
+
+// Guided vertex of a path, filled by surface shading
+typedef struct
+{
+    // Cell * PATH_GUIDING_NUM_BINS + direction bin, -1 if the vertex is not recorded
+    int bin;
+    // Inverse luminance of the throughput times BxDF and cosine of the sampled direction,
+    // scales radiance arriving along the direction to its one sample integral estimate
+    float weight;
+    // Output luminance once the next vertex is reached, negative before that
+    float radiance;
+    int padding;
+} PathGuidingVertex;
+
+INLINE float PathGuiding_GetLuminance(float3 v)
+{
+    return 0.2126f * v.x + 0.7152f * v.y + 0.0722f * v.z;
+}
+
+// Cell containing a point, points outside of the grid map to the closest cell, -1 if there is no grid
+INLINE int PathGuiding_GetCell(GLOBAL int const* guiding, float3 p)
+{
+    int3 resolution = make_int3(guiding[6], guiding[7], guiding[8]);
+
+    if (resolution.x == 0)
+    {
+        return -1;
+    }
+
+    GLOBAL float const* data = (GLOBAL float const*)guiding;
+    float3 pmin = make_float3(data[0], data[1], data[2]);
+    float3 inv_cell_size = make_float3(data[3], data[4], data[5]);
+
+    int3 xyz = clamp(convert_int3_sat_rtn((p - pmin) * inv_cell_size), make_int3(0, 0, 0), resolution - 1);
+    return (xyz.z * resolution.y + xyz.y) * resolution.x + xyz.x;
+}
+
+INLINE GLOBAL float const* PathGuiding_GetCdf(GLOBAL int const* guiding, int cell)
+{
+    return (GLOBAL float const*)(guiding + PATH_GUIDING_HEADER_SIZE) + cell * PATH_GUIDING_NUM_BINS;
+}
+
+INLINE bool PathGuiding_IsTrained(GLOBAL int const* guiding, int cell)
+{
+    return PathGuiding_GetCdf(guiding, cell)[PATH_GUIDING_NUM_BINS - 1] > 0.f;
+}
+
+INLINE int PathGuiding_GetBin(float3 w)
+{
+    float u = 0.5f * (w.z + 1.f);
+    float v = (atan2(w.y, w.x) + PI) / (2.f * PI);
+
+    int iu = clamp((int)(u * PATH_GUIDING_RESOLUTION), 0, PATH_GUIDING_RESOLUTION - 1);
+    int iv = clamp((int)(v * PATH_GUIDING_RESOLUTION), 0, PATH_GUIDING_RESOLUTION - 1);
+    return iu * PATH_GUIDING_RESOLUTION + iv;
+}
+
+// Solid angle pdf of a direction in a trained cell
+INLINE float PathGuiding_GetPdf(GLOBAL int const* guiding, int cell, float3 w)
+{
+    GLOBAL float const* cdf = PathGuiding_GetCdf(guiding, cell);
+    int bin = PathGuiding_GetBin(w);
+
+    float p = cdf[bin] - (bin > 0 ? cdf[bin - 1] : 0.f);
+    return p * PATH_GUIDING_NUM_BINS / (4.f * PI);
+}
+
+// Sample direction in a trained cell, first sample dimension picks the bin and is reused within it
+INLINE float3 PathGuiding_Sample(GLOBAL int const* guiding, int cell, float2 sample, float* pdf)
+{
+    GLOBAL float const* cdf = PathGuiding_GetCdf(guiding, cell);
+
+    int bin = 0;
+    while (bin < PATH_GUIDING_NUM_BINS - 1 && cdf[bin] <= sample.x)
+    {
+        ++bin;
+    }
+
+    float start = bin > 0 ? cdf[bin - 1] : 0.f;
+    float p = cdf[bin] - start;
+    float x = p > 0.f ? clamp((sample.x - start) / p, 0.f, 1.f) : 0.5f;
+
+    float u = ((bin / PATH_GUIDING_RESOLUTION) + x) / PATH_GUIDING_RESOLUTION;
+    float v = ((bin % PATH_GUIDING_RESOLUTION) + sample.y) / PATH_GUIDING_RESOLUTION;
+
+    float z = 2.f * u - 1.f;
+    float r = native_sqrt(max(0.f, 1.f - z * z));
+    float phi = 2.f * PI * v - PI;
+
+    *pdf = p * PATH_GUIDING_NUM_BINS / (4.f * PI);
+    return make_float3(r * native_cos(phi), r * native_sin(phi), z);
+}
+
+// Remember the cell and direction a path has continued in, value is throughput times BxDF and cosine
+INLINE void PathGuiding_RecordVertex(GLOBAL PathGuidingVertex* vertices, int pixel_idx, int bounce, int cell, float3 w, float3 value)
+{
+    float luminance = PathGuiding_GetLuminance(value);
+
+    if (bounce < PATH_GUIDING_MAX_VERTICES && cell >= 0 && luminance > 0.f)
+    {
+        GLOBAL PathGuidingVertex* vertex = vertices + pixel_idx * PATH_GUIDING_MAX_VERTICES + bounce;
+        vertex->bin = cell * PATH_GUIDING_NUM_BINS + PathGuiding_GetBin(w);
+        vertex->weight = 1.f / luminance;
+        vertex->radiance = -1.f;
+    }
+}
+
+#endif // PATH_GUIDING_CL
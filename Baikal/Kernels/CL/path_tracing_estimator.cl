@@ -33,6 +33,9 @@ THE SOFTWARE.
 #include <../Baikal/Kernels/CL/scene.cl>
 #include <../Baikal/Kernels/CL/volumetrics.cl>
 #include <../Baikal/Kernels/CL/path.cl>
+#include <../Baikal/Kernels/CL/path_guiding.cl>
+#include <../Baikal/Kernels/CL/radiance_cache.cl>
+#include <../Baikal/Kernels/CL/light_resampling.cl>
 
 
 KERNEL
@@ -53,10 +56,24 @@ void InitPathData(
         dst_index[global_id] = src_index[global_id];
 
         // Initalize path data
-        my_path->throughput = make_float3(1.f, 1.f, 1.f);
-        my_path->volume = world_volume_idx;
-        my_path->flags = 0;
-        my_path->active = 0xFF;
+        Path_Init(my_path, make_float3(1.f, 1.f, 1.f), world_volume_idx);
+    }
+}
+
+// Empty reservoirs of the estimated pixels, hits which are not resampled leave them empty
+KERNEL void ClearLightReservoirs(
+    // Output indices
+    GLOBAL int const* restrict output_indices,
+    // Number of estimates
+    int num_estimates,
+    GLOBAL LightReservoir* restrict reservoirs
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_estimates)
+    {
+        LightReservoir_Clear(reservoirs + output_indices[global_id]);
     }
 }
 
@@ -96,7 +113,7 @@ KERNEL void ShadeBackgroundEnvMap(
         if (isects[global_id].shapeid < 0 && env_light_idx != -1)
         {
             // Multiply by throughput
-            int volume_idx = paths[pixel_idx].volume;
+            int volume_idx = Path_GetVolumeIdx(paths + pixel_idx);
 
             Light light = lights[env_light_idx];
 
@@ -122,10 +139,20 @@ KERNEL void GatherLightSamples(
     GLOBAL int* restrict num_rays,
     // Shadow rays hits
     GLOBAL int const* restrict shadow_hits,
-    // Light samples
-    GLOBAL float3 const* restrict light_samples,
+    // Light samples, packed RGB
+    GLOBAL float const* restrict light_samples,
+    // Number of light samples per path, stored num_rays entries apart
+    int num_light_samples,
     // throughput
     GLOBAL Path const* restrict paths,
+    // Light reservoirs of the current frame
+    GLOBAL LightReservoir* restrict reservoirs,
+    // Set for first hits of resampled estimates
+    int update_reservoirs,
+    // Set if visibility of the first light sample is gathered as well
+    int gather_visibility,
+    // Visibility buffer, only written if gather_visibility is set
+    GLOBAL float4* restrict visibility,
     // Radiance sample buffer
     GLOBAL float4* restrict output
 )
@@ -138,61 +165,39 @@ KERNEL void GatherLightSamples(
         int pixel_idx = pixel_indices[global_id];
         int output_index = output_indices[pixel_idx];
 
+#ifdef BAIKAL_LIGHT_RESAMPLING
+        // Occluded samples are not reused, the candidates they have been selected from still count
+        if (update_reservoirs && shadow_hits[global_id] != -1)
+        {
+            reservoirs[output_index].weight = 0.f;
+        }
+#endif
+
         // Prepare accumulator variable
         float4 radiance = 0.f;
 
         // Start collecting samples
+        for (int k = 0; k < num_light_samples; ++k)
         {
+            int sample_idx = k * (*num_rays) + global_id;
+
             // If shadow ray didn't hit anything and reached skydome
-            if (shadow_hits[global_id] == -1)
+            if (shadow_hits[sample_idx] == -1)
             {
                 // Add its contribution to radiance accumulator
-                radiance.xyz += light_samples[global_id];
+                radiance.xyz += vload3(sample_idx, light_samples);
             }
         }
 
         // Divide by number of light samples (samples already have built-in throughput)
         ADD_FLOAT4(&output[output_index], radiance);
-    }
-}
 
-///< Handle light samples and visibility info and add contribution to final buffer
-KERNEL void GatherVisibility(
-    // Pixel indices
-    GLOBAL int const* restrict pixel_indices,
-    // Output indices
-    GLOBAL int const*  restrict output_indices,
-    // Number of rays
-    GLOBAL int* restrict num_rays,
-    // Shadow rays hits
-    GLOBAL int const* restrict shadow_hits,
-    // Radiance sample buffer
-    GLOBAL float4* restrict output
-)
-{
-    int global_id = get_global_id(0);
-
-    if (global_id < *num_rays)
-    {
-        // Get pixel id for this sample set
-        int pixel_idx = pixel_indices[global_id];
-        int output_index = output_indices[pixel_idx];
-
-        // Prepare accumulator variable
-        float4 visibility = make_float4(0.f, 0.f, 0.f, 1.f);
-
-        // Start collecting samples
+        // Shadow hits are read once for both outputs
+        if (gather_visibility)
         {
-            // If shadow ray didn't hit anything and reached skydome
-            if (shadow_hits[global_id] == -1)
-            {
-                // Add its contribution to radiance accumulator
-                visibility.xyz += 1.f;
-            }
+            float v = shadow_hits[global_id] == -1 ? 1.f : 0.f;
+            ADD_FLOAT4(&visibility[output_index], make_float4(v, v, v, 1.f));
         }
-
-        // Divide by number of light samples (samples already have built-in throughput)
-        ADD_FLOAT4(&output[output_index], visibility);
     }
 }
 
@@ -295,6 +300,131 @@ KERNEL void FilterPathStream(
     }
 }
 
+// Start a camera path of the next sample in the slot
+INLINE void RegeneratePath(
+    GLOBAL ray const* restrict regeneration_rays,
+    GLOBAL int const* restrict output_indices,
+    int pixel_idx,
+    int pass,
+    int world_volume_idx,
+    GLOBAL int* restrict path_start,
+    GLOBAL Path* restrict paths,
+    GLOBAL ray* restrict camera_ray,
+    GLOBAL float4* restrict output
+)
+{
+    *camera_ray = regeneration_rays[pixel_idx];
+    path_start[pixel_idx] = pass;
+    Path_Init(paths + pixel_idx, make_float3(1.f, 1.f, 1.f), world_volume_idx);
+
+    // Regenerated path is another sample of the pixel
+    ADD_FLOAT4(&output[output_indices[pixel_idx]], make_float4(0.f, 0.f, 0.f, 1.f));
+}
+
+///< Regenerate paths terminated by the last shading in place of their next pass rays
+KERNEL void RegenerateTerminatedPaths(
+    // Camera rays of the next sample
+    GLOBAL ray const* restrict regeneration_rays,
+    // Number of rays of the next pass
+    GLOBAL int const* restrict num_rays,
+    // Pixel indices of the next pass
+    GLOBAL int const* restrict pixel_indices,
+    // Output indices
+    GLOBAL int const* restrict output_indices,
+    // Pass regenerated paths start at
+    int pass,
+    int world_volume_idx,
+    // First pass of the path in every slot
+    GLOBAL int* restrict path_start,
+    GLOBAL Path* restrict paths,
+    // Rays of the next pass
+    GLOBAL ray* restrict rays,
+    // Output values
+    GLOBAL float4* restrict output
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_rays)
+    {
+        int pixel_idx = pixel_indices[global_id];
+
+        // Every slot is regenerated once
+        if (!Path_IsAlive(paths + pixel_idx) && path_start[pixel_idx] == 0)
+        {
+            RegeneratePath(regeneration_rays, output_indices, pixel_idx, pass, world_volume_idx, path_start, paths, rays + global_id, output);
+        }
+    }
+}
+
+///< Regenerate paths terminated before the last shading, they are appended to the rays of the next pass
+KERNEL void RegenerateFreePaths(
+    // Camera rays of the next sample
+    GLOBAL ray const* restrict regeneration_rays,
+    // Number of slots
+    int num_slots,
+    // Output indices
+    GLOBAL int const* restrict output_indices,
+    // Pass regenerated paths start at
+    int pass,
+    int world_volume_idx,
+    // First pass of the path in every slot
+    GLOBAL int* restrict path_start,
+    GLOBAL Path* restrict paths,
+    // Number of rays of the next pass
+    GLOBAL int* restrict num_rays,
+    // Pixel indices of the next pass
+    GLOBAL int* restrict pixel_indices,
+    // Rays of the next pass
+    GLOBAL ray* restrict rays,
+    // Output values
+    GLOBAL float4* restrict output
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_slots)
+    {
+        // Paths of the next pass have been regenerated in place already
+        if (!Path_IsAlive(paths + global_id) && path_start[global_id] == 0)
+        {
+            int ray_idx = atomic_inc(num_rays);
+            pixel_indices[ray_idx] = global_id;
+            RegeneratePath(regeneration_rays, output_indices, global_id, pass, world_volume_idx, path_start, paths, rays + ray_idx, output);
+        }
+    }
+}
+
+///< Terminate paths which have done all their bounces before the next pass
+KERNEL void LimitPathLength(
+    // Number of rays of the next pass
+    GLOBAL int const* restrict num_rays,
+    // Pixel indices of the next pass
+    GLOBAL int const* restrict pixel_indices,
+    // First pass of the path in every slot
+    GLOBAL int const* restrict path_start,
+    // Next pass
+    int pass,
+    int max_bounces,
+    GLOBAL Path* restrict paths,
+    // Rays of the next pass
+    GLOBAL ray* restrict rays
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_rays)
+    {
+        int pixel_idx = pixel_indices[global_id];
+
+        if (pass - path_start[pixel_idx] >= max_bounces)
+        {
+            Path_Kill(paths + pixel_idx);
+            Ray_SetInactive(rays + global_id);
+        }
+    }
+}
+
 ///< Illuminate missing rays
 KERNEL void ShadeMiss(
     // Ray batch
@@ -310,12 +440,20 @@ KERNEL void ShadeMiss(
     GLOBAL Light const* restrict lights,
     // Light distribution
     GLOBAL int const* restrict light_distribution,
+    // Environment light distribution
+    GLOBAL int const* restrict envmap_distribution,
     // Number of emissive objects
     int num_lights,
     int env_light_idx,
+    // Number of light samples per vertex
+    int num_light_samples,
     // Textures
     TEXTURE_ARG_LIST,
     GLOBAL Path const* restrict paths,
+    // First pass of the path in every slot
+    GLOBAL int const* restrict path_start,
+    // Current pass
+    int pass,
     GLOBAL Volume const* restrict volumes,
     // Output values
     GLOBAL float4* restrict output
@@ -333,14 +471,71 @@ KERNEL void ShadeMiss(
         // In case of a miss
         if (isects[global_id].shapeid < 0 && Path_IsAlive(path))
         {
+            // Subsurface probe found no exit point, it doesn't see the environment
+            if (Path_IsSubsurfaceProbe(path))
+            {
+                return;
+            }
+
+#ifdef BAIKAL_SH_IRRADIANCE
+            // Environment has been added from its irradiance at the last vertex
+            if (Path_IsEnvIrradiance(path))
+            {
+                return;
+            }
+#endif
+
+            // The last surface vertex is not linked to the environment light
+            if (Path_GetLightMask(path) != -1 && !Light_IsLinked(&lights[env_light_idx], Path_GetLightMask(path)))
+            {
+                return;
+            }
+
             Light light = lights[env_light_idx];
 
+#ifdef BAIKAL_PATH_REGENERATION
+            // Camera rays of regenerated paths see the background as primary rays do
+            if (pass > 0 && path_start[pixel_idx] == pass)
+            {
+                int background_tex = EnvironmentLight_GetBackgroundTexture(&light);
+
+                if (background_tex != -1)
+                {
+                    float4 background = 0.f;
+                    background.xyz = light.multiplier * Texture_SampleEnvMap(rays[global_id].d.xyz, TEXTURE_ARGS_IDX(background_tex), light.ibl_mirror_x);
+                    ADD_FLOAT4(&output[output_index], background);
+                }
+                return;
+            }
+#endif
+
+            // Only light data is required to evaluate environment light pdf
+            Scene scene =
+            {
+                0,
+                0,
+                0,
+                0,
+                0,
+                0,
+                0,
+                0,
+                0,
+                0,
+                0,
+                lights,
+                env_light_idx,
+                num_lights,
+                light_distribution,
+                envmap_distribution
+            };
+
             // Apply MIS
             int bxdf_flags = Path_GetBxdfFlags(path);
-            float selection_pdf = Distribution1D_GetPdfDiscreet(env_light_idx, light_distribution);
-            float light_pdf = EnvironmentLight_GetPdf(&light, 0, 0, bxdf_flags, kLightInteractionSurface, rays[global_id].d.xyz, TEXTURE_ARGS);
+            float selection_pdf = LightDistribution_GetPdfAtPoint(light_distribution, num_lights, env_light_idx, rays[global_id].o.xyz);
+            float light_pdf = EnvironmentLight_GetPdf(&light, &scene, 0, bxdf_flags, kLightInteractionSurface, rays[global_id].d.xyz, TEXTURE_ARGS);
             float2 extra = Ray_GetExtra(&rays[global_id]);
-            float weight = extra.x > 0.f ? BalanceHeuristic(1, extra.x, 1, light_pdf * selection_pdf) : 1.f;
+            float weight = extra.x > 0.f ? BalanceHeuristic(1, extra.x, num_light_samples, light_pdf * selection_pdf) : 1.f;
 
             float3 t = Path_GetThroughput(path);
             float4 v = 0.f;
@@ -349,7 +544,7 @@ KERNEL void ShadeMiss(
             if (tex != -1)
             {
                 v.xyz = weight * light.multiplier * Texture_SampleEnvMap(rays[global_id].d.xyz, TEXTURE_ARGS_IDX(tex), light.ibl_mirror_x) * t;
-                v.xyz = REASONABLE_RADIANCE(v.xyz);
+                v.xyz = Path_ClampRadiance(path, REASONABLE_RADIANCE(v.xyz));
             }
 
             ADD_FLOAT4(&output[output_index], v);
@@ -357,6 +552,233 @@ KERNEL void ShadeMiss(
     }
 }
 
+///< Multiply ray count, used to size batches holding several rays per path
+KERNEL void ScaleRayCount(
+    // Number of rays
+    GLOBAL int const* restrict num_rays,
+    int scale,
+    // Scaled number of rays
+    GLOBAL int* restrict scaled_num_rays
+)
+{
+    if (get_global_id(0) == 0)
+    {
+        *scaled_num_rays = *num_rays * scale;
+    }
+}
+
+///< Number of rays in a range of the work buffer, used to split it into batches
+KERNEL void SplitRayCount(
+    // Number of rays in the work buffer
+    GLOBAL int const* restrict num_rays,
+    // First entry and size of the range
+    int offset,
+    int size,
+    // Number of rays in the range
+    GLOBAL int* restrict batch_num_rays
+)
+{
+    if (get_global_id(0) == 0)
+    {
+        *batch_num_rays = clamp(*num_rays - offset, 0, size);
+    }
+}
+
+///< Russian roulette on shadow rays of light samples below the threshold luminance, surviving
+///< samples are divided by their survival probability so the estimate stays unbiased
+KERNEL void CullShadowRays(
+    // Number of shadow rays
+    GLOBAL int const* restrict num_rays,
+    // Shadow rays
+    GLOBAL ray* restrict shadow_rays,
+    // Light samples, packed RGB
+    GLOBAL float* restrict light_samples,
+    // Luminance all samples below are subject to roulette
+    float threshold,
+    // RNG seed
+    uint rng_seed
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_rays && Ray_IsActive(shadow_rays + global_id))
+    {
+        float3 sample = vload3(global_id, light_samples);
+        float l = luminance(sample);
+
+        if (l >= threshold)
+        {
+            return;
+        }
+
+        Sampler rng;
+        rng.index = WangHash(HashCombine(rng_seed, global_id));
+
+        float survival = l / threshold;
+
+        if (survival > 0.f && UniformSampler_Sample1D(&rng) < survival)
+        {
+            vstore3(sample / survival, global_id, light_samples);
+        }
+        else
+        {
+            // Same as samples which have not produced a shadow ray at all
+            Ray_SetInactive(shadow_rays + global_id);
+            vstore3(make_float3(0.f, 0.f, 0.f), global_id, light_samples);
+        }
+    }
+}
+
+// Object space ray of the curve shape, false if the ray mask excludes the shape
+INLINE bool Curves_GetShapeRay(GLOBAL Shape const* restrict shapes, int shape_idx, GLOBAL ray const* r, Shape* shape, float3* o, float3* d)
+{
+    *shape = shapes[shape_idx];
+
+    if ((r->extra.x & shape->curve_mask) == 0)
+    {
+        return false;
+    }
+
+#ifdef BAIKAL_MOTION_BLUR
+    Shape_ApplyMotion(shape, Ray_GetTime(r));
+#endif
+
+    matrix4x4 inv = Curves_InverseTransform(shape->transform);
+    *o = matrix_mul_point3(inv, r->o.xyz);
+    *d = matrix_mul_vector3(inv, r->d.xyz);
+    return true;
+}
+
+///< Intersect rays with curve shapes, hits closer than the ones of the intersector replace them
+KERNEL void IntersectCurves(
+    GLOBAL ray const* restrict rays,
+    // Number of rays
+    GLOBAL int const* restrict num_rays,
+    GLOBAL float3 const* restrict vertices,
+    GLOBAL Shape const* restrict shapes,
+    GLOBAL CurveNode const* restrict curve_nodes,
+    GLOBAL int const* restrict curve_segments,
+    // Indices of curve shapes in shapes array
+    GLOBAL int const* restrict curve_shapes,
+    int num_curve_shapes,
+    // Set for paged out curve shapes the rays get into the bounds of
+    GLOBAL int* restrict geometry_requests,
+    // Intersections to update
+    GLOBAL Intersection* restrict isects
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_rays)
+    {
+        GLOBAL ray const* r = rays + global_id;
+
+        if (r->extra.y == 0)
+        {
+            return;
+        }
+
+        Intersection isect = isects[global_id];
+        float tmax = isect.shapeid > 0 ? isect.uvwt.w : r->o.w;
+        int hit_shape = -1;
+        int hit_prim = -1;
+        float2 hit_uv = make_float2(0.f, 0.f);
+
+        for (int i = 0; i < num_curve_shapes; ++i)
+        {
+            int shape_idx = curve_shapes[i];
+            Shape shape;
+            float3 o, d;
+
+            if (!Curves_GetShapeRay(shapes, shape_idx, r, &shape, &o, &d))
+            {
+                continue;
+            }
+
+            if (shape.flags & kShapeNotResident)
+            {
+                if (Curves_IntersectBounds(curve_nodes + shape.curve_root, o, native_recip(d), tmax))
+                {
+                    geometry_requests[shape_idx] = 1;
+                }
+
+                continue;
+            }
+
+            GLOBAL float4 const* points = (GLOBAL float4 const*)(vertices + shape.startvtx);
+            bool bspline = (shape.flags & kShapeBSplineCurves) != 0;
+
+            if (Curves_Intersect(curve_nodes, curve_segments, points, bspline, shape.curve_root, o, d, false, &tmax, &hit_prim, &hit_uv))
+            {
+                hit_shape = shape_idx;
+            }
+        }
+
+        if (hit_shape >= 0)
+        {
+            isect.shapeid = hit_shape + 1;
+            isect.primid = hit_prim;
+            isect.uvwt = make_float4(hit_uv.x, hit_uv.y, 0.f, tmax);
+            isects[global_id] = isect;
+        }
+    }
+}
+
+///< Test shadow rays not occluded by the intersector against curve shapes
+KERNEL void OccludeCurves(
+    GLOBAL ray const* restrict rays,
+    // Number of rays
+    GLOBAL int const* restrict num_rays,
+    GLOBAL float3 const* restrict vertices,
+    GLOBAL Shape const* restrict shapes,
+    GLOBAL CurveNode const* restrict curve_nodes,
+    GLOBAL int const* restrict curve_segments,
+    // Indices of curve shapes in shapes array
+    GLOBAL int const* restrict curve_shapes,
+    int num_curve_shapes,
+    // Occlusion flags to update
+    GLOBAL int* restrict hits
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_rays)
+    {
+        GLOBAL ray const* r = rays + global_id;
+
+        if (r->extra.y == 0 || hits[global_id] > 0)
+        {
+            return;
+        }
+
+        float tmax = r->o.w;
+
+        for (int i = 0; i < num_curve_shapes; ++i)
+        {
+            int shape_idx = curve_shapes[i];
+            Shape shape;
+            float3 o, d;
+
+            // Paged out curves cast no shadows until primary rays bring them in
+            if (!Curves_GetShapeRay(shapes, shape_idx, r, &shape, &o, &d) || (shape.flags & kShapeNotResident))
+            {
+                continue;
+            }
+
+            GLOBAL float4 const* points = (GLOBAL float4 const*)(vertices + shape.startvtx);
+            bool bspline = (shape.flags & kShapeBSplineCurves) != 0;
+            int prim_idx;
+            float2 uv;
+
+            if (Curves_Intersect(curve_nodes, curve_segments, points, bspline, shape.curve_root, o, d, true, &tmax, &prim_idx, &uv))
+            {
+                hits[global_id] = 1;
+                return;
+            }
+        }
+    }
+}
+
 ///< Advance iteration count. Used on missed rays
 KERNEL void AdvanceIterationCount(
     // Pixel indices
@@ -380,5 +802,532 @@ KERNEL void AdvanceIterationCount(
     }
 }
 
+///< Count rays of live paths into cost output: x - rays, y - bounces, w - samples on the first pass
+KERNEL void AccumulateRayCost(
+    // Pixel indices
+    GLOBAL int const* restrict pixel_indices,
+    // Output indices
+    GLOBAL int const* restrict output_indices,
+    // Number of rays
+    GLOBAL int const* restrict num_rays,
+    // Paths
+    GLOBAL Path const* restrict paths,
+    // Set on the first pass of an estimate
+    int first_pass,
+    // Cost output
+    GLOBAL float4* restrict cost
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_rays)
+    {
+        int pixel_idx = pixel_indices[global_id];
+        int output_index = output_indices[pixel_idx];
+
+        float traced = Path_IsAlive(paths + pixel_idx) ? 1.f : 0.f;
+        float4 v = make_float4(traced, traced, 0.f, first_pass ? 1.f : 0.f);
+
+        if (v.x > 0.f || v.w > 0.f)
+        {
+            ADD_FLOAT4(&cost[output_index], v);
+        }
+    }
+}
+
+///< Count active shadow rays of compacted hits into cost output: x - rays, z - shadow rays
+KERNEL void AccumulateShadowRayCost(
+    // Pixel indices
+    GLOBAL int const* restrict pixel_indices,
+    // Output indices
+    GLOBAL int const* restrict output_indices,
+    // Number of hits
+    GLOBAL int const* restrict num_rays,
+    // Shadow rays, stored num_rays entries apart per light sample
+    GLOBAL ray* restrict shadow_rays,
+    // Number of light samples per path
+    int num_light_samples,
+    // Cost output
+    GLOBAL float4* restrict cost
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_rays)
+    {
+        int pixel_idx = pixel_indices[global_id];
+        int output_index = output_indices[pixel_idx];
+
+        float num_shadow_rays = 0.f;
+        for (int k = 0; k < num_light_samples; ++k)
+        {
+            num_shadow_rays += Ray_IsActive(shadow_rays + k * (*num_rays) + global_id) ? 1.f : 0.f;
+        }
+
+        if (num_shadow_rays > 0.f)
+        {
+            ADD_FLOAT4(&cost[output_index], make_float4(num_shadow_rays, 0.f, num_shadow_rays, 0.f));
+        }
+    }
+}
+
+///< Build material sort keys for compacted hits
+KERNEL void BuildMaterialSortKeys(
+    // Intersections
+    GLOBAL Intersection const* restrict isects,
+    // Compacted indices
+    GLOBAL int const* restrict compacted_indices,
+    // Number of compacted indices
+    GLOBAL int const* restrict num_elements,
+    // Shapes
+    GLOBAL Shape const* restrict shapes,
+    // Instances
+    GLOBAL ShapeInstance const* restrict instances,
+    // Instance transforms
+    GLOBAL float4 const* restrict instance_transforms,
+    // Number of base shapes
+    int num_base_shapes,
+    // Total number of entries in the stream
+    int num_entries,
+    // Sort keys
+    GLOBAL int* restrict keys,
+    // Sort values (identity permutation)
+    GLOBAL int* restrict values
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_entries)
+    {
+        // Dead entries go to the end of the stream
+        int key = 0x7fffffff;
+
+        if (global_id < *num_elements)
+        {
+            int shape_idx = isects[compacted_indices[global_id]].shapeid - 1;
+
+            key = 0;
+
+            if (shape_idx >= 0)
+            {
+                // Layer mask selects generated UberV2 code path, so it goes
+                // to the high bits, material offset keeps same materials together
+                // Only shape data is required to look up the material
+                Scene scene =
+                {
+                    0,
+                    0,
+                    0,
+                    0,
+                    0,
+                    shapes,
+                    instances,
+                    instance_transforms,
+                    num_base_shapes
+                };
+
+                Material material = Scene_GetShapeMaterial(&scene, shape_idx);
+                key = ((material.layers & 0xff) << 22) | (material.offset & 0x3fffff);
+            }
+        }
+
+        keys[global_id] = key;
+        values[global_id] = global_id;
+    }
+}
+
+///< Reorder compacted hits according to sorted permutation
+KERNEL void PermuteHits(
+    // Sorted permutation
+    GLOBAL int const* restrict permutation,
+    // Number of compacted indices
+    GLOBAL int const* restrict num_elements,
+    // Source compacted indices
+    GLOBAL int const* restrict src_compacted_indices,
+    // Source pixel indices
+    GLOBAL int const* restrict src_pixel_indices,
+    // Reordered compacted indices
+    GLOBAL int* restrict dst_compacted_indices,
+    // Reordered pixel indices
+    GLOBAL int* restrict dst_pixel_indices
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_elements)
+    {
+        int src_idx = permutation[global_id];
+        dst_compacted_indices[global_id] = src_compacted_indices[src_idx];
+        dst_pixel_indices[global_id] = src_pixel_indices[src_idx];
+    }
+}
+
+///< Count runs of equal keys within each 64-wide wavefront
+KERNEL void CountKeySegments(
+    // Keys
+    GLOBAL int const* restrict keys,
+    // Number of keys
+    GLOBAL int const* restrict num_elements,
+    // Counters
+    GLOBAL int* restrict counters,
+    // Counter to accumulate into
+    int counter_idx
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_elements)
+    {
+        // Each run start means one more distinct code path for the wavefront
+        if ((global_id % 64) == 0 || keys[global_id] != keys[global_id - 1])
+        {
+            atomic_inc(&counters[counter_idx]);
+        }
+    }
+}
+
+uint Part1By1(uint x)
+{
+    x &= 0x0000ffff;                  // x = ---- ---- ---- ---- fedc ba98 7654 3210
+    x = (x ^ (x << 8)) & 0x00ff00ff; // x = ---- ---- fedc ba98 ---- ---- 7654 3210
+    x = (x ^ (x << 4)) & 0x0f0f0f0f; // x = ---- fedc ---- ba98 ---- 7654 ---- 3210
+    x = (x ^ (x << 2)) & 0x33333333; // x = --fe --dc --ba --98 --76 --54 --32 --10
+    x = (x ^ (x << 1)) & 0x55555555; // x = -f-e -d-c -b-a -9-8 -7-6 -5-4 -3-2 -1-0
+    return x;
+}
+
+uint Morton2D(uint x, uint y)
+{
+    return (Part1By1(y) << 1) + Part1By1(x);
+}
+
+uint Part1By2(uint x)
+{
+    x &= 0x000003ff;                  // x = ---- ---- ---- ---- ---- --98 7654 3210
+    x = (x ^ (x << 16)) & 0xff0000ff; // x = ---- --98 ---- ---- ---- ---- 7654 3210
+    x = (x ^ (x << 8)) & 0x0300f00f;  // x = ---- --98 ---- ---- 7654 ---- ---- 3210
+    x = (x ^ (x << 4)) & 0x030c30c3;  // x = ---- --98 ---- 76-- --54 ---- 32-- --10
+    x = (x ^ (x << 2)) & 0x09249249;  // x = ---- 9--8 --7- -6-- 5--4 --3- -2-- 1--0
+    return x;
+}
+
+uint Morton3D(uint x, uint y, uint z)
+{
+    return (Part1By2(z) << 2) + (Part1By2(y) << 1) + Part1By2(x);
+}
+
+// Map unit direction onto [0,1]^2 using octahedral projection
+float2 OctahedralEncode(float3 d)
+{
+    float3 n = d / (fabs(d.x) + fabs(d.y) + fabs(d.z));
+    float2 uv = n.z >= 0.f ? n.xy :
+        (1.f - fabs(n.yx)) * make_float2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+    return clamp(uv * 0.5f + 0.5f, 0.f, 1.f);
+}
+
+///< Build ray sort keys from origin and direction Morton codes
+KERNEL void BuildRaySortKeys(
+    // Rays
+    GLOBAL ray const* restrict rays,
+    // Number of rays
+    GLOBAL int const* restrict num_elements,
+    // Total number of entries in the stream
+    int num_entries,
+    // Scene bounds minimum
+    float4 scene_min,
+    // Scene bounds extent
+    float4 scene_extent,
+    // Sort keys
+    GLOBAL int* restrict keys,
+    // Sort values (identity permutation)
+    GLOBAL int* restrict values
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_entries)
+    {
+        // Dead and inactive rays go to the end of the stream
+        int key = 0x7fffffff;
+
+        if (global_id < *num_elements && rays[global_id].extra.y != 0)
+        {
+            ray r = rays[global_id];
+
+            // 7 bits per origin axis
+            float3 o = clamp((r.o.xyz - scene_min.xyz) / max(scene_extent.xyz, 1e-5f), 0.f, 1.f);
+            uint ox = min((uint)(o.x * 128.f), 127u);
+            uint oy = min((uint)(o.y * 128.f), 127u);
+            uint oz = min((uint)(o.z * 128.f), 127u);
+
+            // 4 bits per direction axis
+            float2 d = OctahedralEncode(r.d.xyz);
+            uint dx = min((uint)(d.x * 16.f), 15u);
+            uint dy = min((uint)(d.y * 16.f), 15u);
+
+            key = (int)((Morton3D(ox, oy, oz) << 8) | (Morton2D(dx, dy) & 0xff));
+        }
+
+        keys[global_id] = key;
+        values[global_id] = global_id;
+    }
+}
+
+///< Reorder rays according to sorted permutation
+KERNEL void PermuteRays(
+    // Sorted permutation
+    GLOBAL int const* restrict permutation,
+    // Number of rays
+    GLOBAL int const* restrict num_elements,
+    // Source rays
+    GLOBAL ray const* restrict src_rays,
+    // Source pixel indices
+    GLOBAL int const* restrict src_pixel_indices,
+    // Reordered rays
+    GLOBAL ray* restrict dst_rays,
+    // Reordered pixel indices
+    GLOBAL int* restrict dst_pixel_indices
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_elements)
+    {
+        int src_idx = permutation[global_id];
+        dst_rays[global_id] = src_rays[src_idx];
+        dst_pixel_indices[global_id] = src_pixel_indices[src_idx];
+    }
+}
+
+///< Gather shadow rays which need another intersection into a dense batch
+KERNEL void GatherShadowRays(
+    // Shadow ray indices
+    GLOBAL int const* restrict indices,
+    // Number of rays
+    GLOBAL int const* restrict num_rays,
+    // Shadow rays
+    GLOBAL ray const* restrict rays,
+    // Gathered rays
+    GLOBAL ray* restrict gathered_rays
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_rays)
+    {
+        gathered_rays[global_id] = rays[indices[global_id]];
+    }
+}
+
+///< Store output luminance of the paths which have reached the next vertex after a guided one
+KERNEL void SnapshotPathGuidingRadiance(
+    // Pixel indices
+    GLOBAL int const* restrict pixel_indices,
+    // Output indices
+    GLOBAL int const* restrict output_indices,
+    // Number of rays
+    GLOBAL int const* restrict num_rays,
+    // Bounce which has generated the rays
+    int bounce,
+    // Radiance sample buffer
+    GLOBAL float4 const* restrict output,
+    // Guided path vertices
+    GLOBAL PathGuidingVertex* restrict vertices
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < *num_rays && bounce < PATH_GUIDING_MAX_VERTICES)
+    {
+        int pixel_idx = pixel_indices[global_id];
+        GLOBAL PathGuidingVertex* vertex = vertices + pixel_idx * PATH_GUIDING_MAX_VERTICES + bounce;
+
+        if (vertex->bin >= 0)
+        {
+            vertex->radiance = PathGuiding_GetLuminance(output[output_indices[pixel_idx]].xyz);
+        }
+    }
+}
+
+///< Splat radiance gathered past each guided vertex into the direction bins and reset the vertices
+KERNEL void UpdatePathGuiding(
+    // Output indices
+    GLOBAL int const* restrict output_indices,
+    // Number of paths
+    int num_paths,
+    // Radiance sample buffer
+    GLOBAL float4 const* restrict output,
+    // Guided path vertices
+    GLOBAL PathGuidingVertex* restrict vertices,
+    // Radiance estimates of direction bins
+    GLOBAL float* restrict radiance
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_paths)
+    {
+        // Output only receives radiance of this path during the estimate,
+        // so the difference to a snapshot is the radiance gathered after it
+        float final_radiance = PathGuiding_GetLuminance(output[output_indices[global_id]].xyz);
+
+        for (int i = 0; i < PATH_GUIDING_MAX_VERTICES; ++i)
+        {
+            GLOBAL PathGuidingVertex* vertex = vertices + global_id * PATH_GUIDING_MAX_VERTICES + i;
+
+            if (vertex->bin >= 0)
+            {
+                float incident = final_radiance - vertex->radiance;
+
+                if (vertex->radiance >= 0.f && incident > 0.f)
+                {
+                    atomic_add_float(radiance + vertex->bin, incident * vertex->weight);
+                }
+
+                vertex->bin = -1;
+            }
+        }
+    }
+}
+
+///< Build direction CDFs of guiding cells from their radiance estimates
+KERNEL void BuildPathGuidingDistribution(
+    // Radiance estimates of direction bins
+    GLOBAL float const* restrict radiance,
+    // Number of cells
+    int num_cells,
+    // Guiding buffer
+    GLOBAL int* restrict guiding
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_cells)
+    {
+        GLOBAL float const* bins = radiance + global_id * PATH_GUIDING_NUM_BINS;
+        GLOBAL float* cdf = (GLOBAL float*)(guiding + PATH_GUIDING_HEADER_SIZE) + global_id * PATH_GUIDING_NUM_BINS;
+
+        float total = 0.f;
+        for (int i = 0; i < PATH_GUIDING_NUM_BINS; ++i)
+        {
+            total += bins[i];
+        }
+
+        if (total <= 0.f)
+        {
+            for (int i = 0; i < PATH_GUIDING_NUM_BINS; ++i)
+            {
+                cdf[i] = 0.f;
+            }
+
+            return;
+        }
+
+        // A tenth of the probability is spread uniformly, so directions
+        // which have not received radiance yet can still be guided into
+        float uniform = 0.1f * total / PATH_GUIDING_NUM_BINS;
+        float inv_total = 1.f / (1.1f * total);
+        float sum = 0.f;
+
+        for (int i = 0; i < PATH_GUIDING_NUM_BINS; ++i)
+        {
+            sum += bins[i] + uniform;
+            cdf[i] = sum * inv_total;
+        }
+
+        cdf[PATH_GUIDING_NUM_BINS - 1] = 1.f;
+    }
+}
+
+///< Splat radiance gathered past the vertices of training paths into the radiance cache and reset the vertices
+KERNEL void UpdateRadianceCache(
+    // Output indices
+    GLOBAL int const* restrict output_indices,
+    // Number of paths
+    int num_paths,
+    // Frame the paths have been traced in
+    int frame,
+    // Radiance sample buffer
+    GLOBAL float4 const* restrict output,
+    // Vertices of training paths
+    GLOBAL RadianceCacheVertex* restrict vertices,
+    // Radiance cache keys
+    GLOBAL uint* restrict keys,
+    // Radiance cache table size minus one
+    int mask,
+    // Radiance accumulated by the entries during the estimate
+    GLOBAL float4* restrict accum
+)
+{
+    int global_id = get_global_id(0);
+    int pixel_idx = global_id * RADIANCE_CACHE_TRAINING_STRIDE + frame % RADIANCE_CACHE_TRAINING_STRIDE;
+
+    if (global_id * RADIANCE_CACHE_TRAINING_STRIDE < num_paths)
+    {
+        // Output only receives radiance of this path during the estimate,
+        // so the difference to a snapshot is the radiance gathered after it
+        float3 final_radiance = pixel_idx < num_paths ? output[output_indices[pixel_idx]].xyz : make_float3(0.f, 0.f, 0.f);
+
+        for (int i = 0; i < RADIANCE_CACHE_MAX_VERTICES; ++i)
+        {
+            GLOBAL RadianceCacheVertex* vertex = vertices + global_id * RADIANCE_CACHE_MAX_VERTICES + i;
+
+            if (vertex->key != 0u)
+            {
+                float3 throughput = vertex->throughput.xyz;
+                float3 incident = max(final_radiance - vertex->radiance.xyz, 0.f);
+
+                if (pixel_idx < num_paths && NON_BLACK(throughput))
+                {
+                    // Outgoing radiance of the vertex towards the previous one
+                    float3 lo = make_float3(
+                        throughput.x > 0.f ? incident.x / throughput.x : 0.f,
+                        throughput.y > 0.f ? incident.y / throughput.y : 0.f,
+                        throughput.z > 0.f ? incident.z / throughput.z : 0.f);
+                    lo = REASONABLE_RADIANCE(lo);
+
+                    int slot = RadianceCache_Insert(keys, mask, vertex->key);
+
+                    if (slot >= 0)
+                    {
+                        atomic_add_float4(accum + slot, make_float4(lo.x, lo.y, lo.z, 1.f));
+                    }
+                }
+
+                vertex->key = 0u;
+            }
+        }
+    }
+}
+
+///< Blend radiance accumulated by the entries during the estimate into resolved radiance
+KERNEL void ResolveRadianceCache(
+    // Radiance cache table size
+    int num_entries,
+    // Radiance accumulated by the entries during the estimate
+    GLOBAL float4* restrict accum,
+    // Resolved radiance of the entries, w is the number of samples
+    GLOBAL float4* restrict radiance
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_entries)
+    {
+        float4 a = accum[global_id];
+
+        if (a.w > 0.f)
+        {
+            float4 r = radiance[global_id];
+            // Older samples fade out once the entry has enough of them
+            float old_samples = clamp(RADIANCE_CACHE_MAX_SAMPLES - a.w, 0.f, r.w);
+            float3 value = (r.xyz * old_samples + a.xyz) / (old_samples + a.w);
+
+            radiance[global_id] = make_float4(value.x, value.y, value.z, min(old_samples + a.w, RADIANCE_CACHE_MAX_SAMPLES));
+            accum[global_id] = 0.f;
+        }
+    }
+}
+
 #endif
 
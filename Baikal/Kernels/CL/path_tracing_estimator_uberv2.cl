@@ -31,9 +31,12 @@ THE SOFTWARE.
 #include <../Baikal/Kernels/CL/sampling.cl>
 #include <../Baikal/Kernels/CL/bxdf.cl>
 #include <../Baikal/Kernels/CL/light.cl>
+#include <../Baikal/Kernels/CL/light_resampling.cl>
 #include <../Baikal/Kernels/CL/scene.cl>
 #include <../Baikal/Kernels/CL/volumetrics.cl>
 #include <../Baikal/Kernels/CL/path.cl>
+#include <../Baikal/Kernels/CL/path_guiding.cl>
+#include <../Baikal/Kernels/CL/radiance_cache.cl>
 
 // This kernel only handles scattered paths.
 // It applies direct illumination and generates
@@ -54,13 +57,21 @@ KERNEL void ShadeVolumeUberV2(
     // Vertices
     GLOBAL float3 const* restrict vertices,
     // Normals
-    GLOBAL float3 const* restrict normals,
+    GLOBAL SceneNormal const* restrict normals,
     // UVs
-    GLOBAL float2 const* restrict uvs,
+    GLOBAL SceneUV const* restrict uvs,
+    // Tangents
+    GLOBAL SceneTangent const* restrict tangents,
     // Indices
     GLOBAL int const* restrict indices,
     // Shapes
     GLOBAL Shape const* restrict shapes,
+    // Instances
+    GLOBAL ShapeInstance const* restrict instances,
+    // Instance transforms
+    GLOBAL float4 const* restrict instance_transforms,
+    // Number of base shapes
+    int num_base_shapes,
     // Material parameters
     GLOBAL int const* restrict material_attributes,
     // Textures
@@ -71,6 +82,8 @@ KERNEL void ShadeVolumeUberV2(
     GLOBAL Light const* restrict lights,
     // Light distribution
     GLOBAL int const* restrict light_distribution,
+    // Environment light distribution
+    GLOBAL int const* restrict envmap_distribution,
     // Number of emissive objects
     int num_lights,
     // RNG seed
@@ -87,8 +100,8 @@ KERNEL void ShadeVolumeUberV2(
     GLOBAL Volume const* restrict volumes,
     // Shadow rays
     GLOBAL ray* restrict shadow_rays,
-    // Light samples
-    GLOBAL float3* restrict light_samples,
+    // Light samples, packed RGB
+    GLOBAL float* restrict light_samples,
     // Path throughput
     GLOBAL Path* restrict paths,
     // Indirect rays (next path segment)
@@ -105,14 +118,19 @@ KERNEL void ShadeVolumeUberV2(
         vertices,
         normals,
         uvs,
+        tangents,
         indices,
         shapes,
+        instances,
+        instance_transforms,
+        num_base_shapes,
         material_attributes,
         input_map_values,
         lights,
         env_light_idx,
         num_lights,
-        light_distribution
+        light_distribution,
+        envmap_distribution
     };
 
     if (global_id < *num_hits)
@@ -130,14 +148,27 @@ KERNEL void ShadeVolumeUberV2(
             return;
         }
 
+#ifdef BAIKAL_CAUSTIC_SPLIT
+        // Light tracing does not handle media, so scattering breaks the caustic chain
+        Path_ClearCausticFlag(path);
+#endif
+
         // Fetch incoming ray
         float3 o = rays[hit_idx].o.xyz;
         float3 wi = -rays[hit_idx].d.xyz;
 
+        // Shapes and new rays are evaluated at the time of the incoming ray
+        float time = Ray_GetTime(&rays[hit_idx]);
+        scene.time = time;
+
         Sampler sampler;
 #if SAMPLER == SOBOL
         uint scramble = random[pixel_idx] * 0x1fe3434f;
         Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET + bounce * SAMPLE_DIMS_PER_BOUNCE + SAMPLE_DIM_VOLUME_EVALUATE_OFFSET, scramble);
+#elif SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+        // Per-pixel blue noise value or Owen scrambling seed is used as is
+        uint scramble = random[pixel_idx];
+        Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET + bounce * SAMPLE_DIMS_PER_BOUNCE + SAMPLE_DIM_VOLUME_EVALUATE_OFFSET, scramble);
 #elif SAMPLER == RANDOM
         uint scramble = pixel_idx * rng_seed;
         Sampler_Init(&sampler, scramble);
@@ -157,20 +188,20 @@ KERNEL void ShadeVolumeUberV2(
         float selection_pdf = 0.f;
         float3 wo;
 
-        int light_idx = Scene_SampleLight(&scene, Sampler_Sample1D(&sampler, SAMPLER_ARGS), &selection_pdf);
-
         // Here we need fake differential geometry for light sampling procedure
         DifferentialGeometry dg;
         // put scattering position in there (it is along the current ray at isect.distance
         // since EvaluateVolume has put it there
         dg.p = o - wi * Intersection_GetDistance(isects + hit_idx);
+
+        int light_idx = Scene_SampleLightAtPoint(&scene, dg.p, Sampler_Sample1D(&sampler, SAMPLER_ARGS), &selection_pdf);
         // Get light sample intencity
         int bxdf_flags = Path_GetBxdfFlags(path); 
         float3 le = Light_Sample(light_idx, &scene, &dg, TEXTURE_ARGS, Sampler_Sample2D(&sampler, SAMPLER_ARGS), bxdf_flags, kLightInteractionVolume, &wo, &pdf);
 
         // Generate shadow ray
         float shadow_ray_length = length(wo); 
-        Ray_Init(shadow_rays + global_id, dg.p, normalize(wo), shadow_ray_length, 0.f, 0xFFFFFFFF);
+        Ray_Init(shadow_rays + global_id, dg.p, normalize(wo), shadow_ray_length, time, 0xFFFFFFFF);
         Ray_SetExtra(shadow_rays + global_id, make_float2(1.f, 0.f));
 
         // Evaluate volume transmittion along the shadow ray (it is incorrect if the light source is outside of the
@@ -193,12 +224,12 @@ KERNEL void ShadeVolumeUberV2(
         if (NON_BLACK(tr) && NON_BLACK(r) && pdf > 0.f) 
         {
             // Put lightsample result
-            light_samples[global_id] = REASONABLE_RADIANCE(r * Path_GetThroughput(path));
+            vstore3(Path_ClampRadiance(path, REASONABLE_RADIANCE(r * Path_GetThroughput(path))), global_id, light_samples);
         }
         else
         { 
             // Nothing to compute
-            light_samples[global_id] = 0.f;
+            vstore3(make_float3(0.f, 0.f, 0.f), global_id, light_samples);
             // Otherwise make it incative to save intersector cycles (hopefully) 
             Ray_SetInactive(shadow_rays + global_id);
         }
@@ -208,11 +239,20 @@ KERNEL void ShadeVolumeUberV2(
         float phase = PhaseFunctionHG_Sample(wi, g, Sampler_Sample2D(&sampler, SAMPLER_ARGS), &wo);
 
         // Generate new path segment
-        Ray_Init(indirect_rays + global_id, dg.p, normalize(wo), CRAZY_HIGH_DISTANCE, 0.f, 0xFFFFFFFF);
-
+        Ray_Init(indirect_rays + global_id, dg.p, normalize(wo), CRAZY_HIGH_DISTANCE, time, 0xFFFFFFFF);
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+        // Footprint is unknown after scattering in the medium, finest texture levels are used
+        Ray_SetCone(indirect_rays + global_id, make_float2(0.f, 0.f));
+#endif
 
         // Update path throughput multiplying by phase function.
         Path_MulThroughput(path, phase);
+        Path_SetIndirectFlag(path);
+        // Media are lit by all lights
+        Path_SetLightMask(path, -1);
+#ifdef BAIKAL_SH_IRRADIANCE
+        Path_ClearEnvIrradianceFlag(path);
+#endif
 #else
         // Single-scattering mode only,
         // kill the path and compact away on next iteration
@@ -223,9 +263,334 @@ KERNEL void ShadeVolumeUberV2(
 }
 
 
-// Handle ray-surface interaction possibly generating path continuation.
-// This is only applied to non-scattered paths.
-KERNEL void ShadeSurfaceUberV2(
+// Check if the light picked for a surface vertex is sampled. Unlinked lights are skipped
+// before sampling, so no shadow ray is spent on them.
+INLINE bool ShadeSurfaceUberV2_IsLightSampled(
+    Scene const* scene,
+    int light_idx,
+    // Environment light is accounted for by its irradiance and is not sampled
+    bool skip_env_light,
+    // Light link mask of the shaded shape
+    int light_mask
+)
+{
+    return light_idx > -1 && !(skip_env_light && light_idx == scene->env_light_idx) &&
+        Light_IsLinked(&scene->lights[light_idx], light_mask);
+}
+
+// MIS weighted estimate of the light reflected from the light sample, throughput is not applied
+INLINE float3 ShadeSurfaceUberV2_EvaluateLightSample(
+    Scene const* scene,
+    DifferentialGeometry const* diffgeo,
+    UberV2ShaderData const* uber_shader_data,
+    // Incoming direction
+    float3 wi,
+    int bxdf_flags,
+    int num_light_samples,
+    // Guiding buffer and cell the BxDF samples are mixed with, -1 if not guided
+    GLOBAL int const* restrict guiding,
+    int guiding_cell,
+    // Light and its selection probability
+    int light_idx,
+    float selection_pdf,
+    // Light surface sample
+    float2 sample,
+    TEXTURE_ARG_LIST,
+    // Vector to the light sample
+    float3* lightwo
+)
+{
+    float light_pdf = 0.f;
+
+    float3 le = Light_Sample(light_idx, scene, diffgeo, TEXTURE_ARGS, sample, bxdf_flags, kLightInteractionSurface, lightwo, &light_pdf);
+    float light_bxdf_pdf = UberV2_GetPdf(diffgeo, wi, normalize(*lightwo), TEXTURE_ARGS, uber_shader_data);
+#ifdef BAIKAL_PATH_GUIDING
+    // BxDF samples are drawn from the mixture with the guiding distribution
+    if (guiding_cell >= 0)
+    {
+        light_bxdf_pdf = mix(light_bxdf_pdf, PathGuiding_GetPdf(guiding, guiding_cell, normalize(*lightwo)), PATH_GUIDING_FRACTION);
+    }
+#endif
+    float light_weight = Light_IsSingular(&scene->lights[light_idx]) ? 1.f : BalanceHeuristic(num_light_samples, light_pdf * selection_pdf, 1, light_bxdf_pdf);
+
+    // Apply MIS to account for both
+    if (NON_BLACK(le) && (light_pdf > 0.0f) && (selection_pdf > 0.0f) && !Bxdf_IsSingular(diffgeo))
+    {
+        float ndotwo = fabs(dot(diffgeo->n, normalize(*lightwo)));
+        return le * ndotwo * UberV2_Evaluate(diffgeo, wi, normalize(*lightwo), TEXTURE_ARGS, uber_shader_data) * light_weight / light_pdf / selection_pdf;
+    }
+
+    return 0.f;
+}
+
+// Set up the shadow ray of a light sample, it is only traced if the sample carries any radiance
+INLINE void ShadeSurfaceUberV2_SetShadowRay(
+    Scene const* scene,
+    DifferentialGeometry const* diffgeo,
+    // Side of the surface to offset rays to
+    float s,
+    int bounce,
+    // Vector to the light sample and its radiance estimate
+    float3 lightwo,
+    float3 radiance,
+    int num_light_samples,
+    GLOBAL Path const* restrict path,
+    GLOBAL ray* restrict shadow_ray,
+    GLOBAL float* restrict light_sample
+)
+{
+    // If we have some light here generate a shadow ray
+    if (NON_BLACK(radiance))
+    {
+        // Generate shadow ray
+        float3 shadow_ray_o = diffgeo->p + CRAZY_LOW_DISTANCE * s * diffgeo->ng;
+        float3 temp = diffgeo->p + lightwo - shadow_ray_o;
+        float3 shadow_ray_dir = normalize(temp);
+        float shadow_ray_length = length(temp);
+        int shadow_ray_mask = VISIBILITY_MASK_BOUNCE_SHADOW(bounce);
+
+        Ray_Init(shadow_ray, shadow_ray_o, shadow_ray_dir, shadow_ray_length, scene->time, shadow_ray_mask);
+        Ray_SetExtra(shadow_ray, make_float2(1.f, 0.f));
+
+        vstore3(Path_ClampRadiance(path, REASONABLE_RADIANCE(radiance)) / num_light_samples, 0, light_sample);
+    }
+    else
+    {
+        // Otherwise save some intersector cycles
+        Ray_SetInactive(shadow_ray);
+        vstore3(make_float3(0.f, 0.f, 0.f), 0, light_sample);
+    }
+}
+
+// Next event estimation for a surface vertex: sample a light with MIS and set up
+// the shadow ray. Each of num_light_samples samples carries 1 / num_light_samples
+// of the estimate.
+INLINE void ShadeSurfaceUberV2_SampleLight(
+    Scene const* scene,
+    DifferentialGeometry const* diffgeo,
+    UberV2ShaderData const* uber_shader_data,
+    // Incoming direction
+    float3 wi,
+    // Side of the surface to offset rays to
+    float s,
+    int bounce,
+    int bxdf_flags,
+    float3 throughput,
+    int num_light_samples,
+    // Environment light is accounted for by its irradiance and is not sampled
+    bool skip_env_light,
+    // Light link mask of the shaded shape
+    int light_mask,
+    // Guiding buffer and cell the BxDF samples are mixed with, -1 if not guided
+    GLOBAL int const* restrict guiding,
+    int guiding_cell,
+    // Light selection sample
+    float light_selection_sample,
+    Sampler* sampler,
+    SAMPLER_ARG_LIST,
+    TEXTURE_ARG_LIST,
+    GLOBAL Path const* restrict path,
+    GLOBAL ray* restrict shadow_ray,
+    GLOBAL float* restrict light_sample
+)
+{
+    float selection_pdf = 0.f;
+    float3 radiance = 0.f;
+    float3 lightwo = 0.f;
+
+    int light_idx = Scene_SampleLightAtPoint(scene, diffgeo->p, light_selection_sample, &selection_pdf);
+
+    // If we have light to sample we can hopefully do mis
+    if (ShadeSurfaceUberV2_IsLightSampled(scene, light_idx, skip_env_light, light_mask))
+    {
+        radiance = throughput * ShadeSurfaceUberV2_EvaluateLightSample(scene, diffgeo, uber_shader_data, wi, bxdf_flags, num_light_samples,
+            guiding, guiding_cell, light_idx, selection_pdf, Sampler_Sample2D(sampler, SAMPLER_ARGS), TEXTURE_ARGS, &lightwo);
+    }
+
+    ShadeSurfaceUberV2_SetShadowRay(scene, diffgeo, s, bounce, lightwo, radiance, num_light_samples, path, shadow_ray, light_sample);
+}
+
+#ifdef BAIKAL_LIGHT_RESAMPLING
+// Estimate of the light sample at primary sample space point x, see light_resampling.cl
+INLINE float3 ShadeSurfaceUberV2_EvaluateResampledLight(
+    Scene const* scene,
+    DifferentialGeometry const* diffgeo,
+    UberV2ShaderData const* uber_shader_data,
+    float3 wi,
+    int bxdf_flags,
+    int num_light_samples,
+    int light_mask,
+    GLOBAL int const* restrict guiding,
+    int guiding_cell,
+    float3 x,
+    TEXTURE_ARG_LIST,
+    float3* lightwo
+)
+{
+    float selection_pdf = 0.f;
+    int light_idx = Scene_SampleLightAtPoint(scene, diffgeo->p, x.x, &selection_pdf);
+
+    if (!ShadeSurfaceUberV2_IsLightSampled(scene, light_idx, false, light_mask))
+    {
+        return 0.f;
+    }
+
+    return ShadeSurfaceUberV2_EvaluateLightSample(scene, diffgeo, uber_shader_data, wi, bxdf_flags, num_light_samples,
+        guiding, guiding_cell, light_idx, selection_pdf, x.yz, TEXTURE_ARGS, lightwo);
+}
+
+// Next event estimation for a first hit by resampling light samples. Candidates of the hit
+// are combined with the reservoirs of the last frame at the reprojected pixel and around it,
+// the selected sample is stored in the reservoir of the pixel. The estimate replaces all
+// num_light_samples light samples of the vertex and carries their MIS weights.
+INLINE void ShadeSurfaceUberV2_ResampleLight(
+    Scene const* scene,
+    DifferentialGeometry const* diffgeo,
+    UberV2ShaderData const* uber_shader_data,
+    // Incoming direction
+    float3 wi,
+    // Side of the surface to offset rays to
+    float s,
+    // Distance to the hit along the camera ray
+    float depth,
+    int bxdf_flags,
+    float3 throughput,
+    int num_light_samples,
+    // Light link mask of the shaded shape
+    int light_mask,
+    // Guiding buffer and cell the BxDF samples are mixed with, -1 if not guided
+    GLOBAL int const* restrict guiding,
+    int guiding_cell,
+    // Seed of resampling random numbers
+    uint seed,
+    TEXTURE_ARG_LIST,
+    // Reservoir of the pixel
+    int reservoir_idx,
+    GLOBAL LightReservoir const* restrict prev_reservoirs,
+    GLOBAL LightReservoir* restrict reservoirs,
+    // Camera of the last frame, reservoirs of the last frame are only used if history is set
+    GLOBAL Camera const* restrict prev_camera,
+    int output_width,
+    int output_height,
+    int history,
+    GLOBAL Path const* restrict path,
+    GLOBAL ray* restrict shadow_ray,
+    GLOBAL float* restrict light_sample
+)
+{
+    // Resampling decisions use their own random numbers, sampler dimensions of the vertex stay the same
+    Sampler rng;
+    rng.index = WangHash(HashCombine(seed, reservoir_idx));
+
+    float3 selected_sample = 0.f;
+    float3 selected_radiance = 0.f;
+    float3 selected_lightwo = 0.f;
+    float selected_target = 0.f;
+    float weight_sum = 0.f;
+    float num_candidates = 0.f;
+
+    // Candidates are uniform in primary sample space, so their resampling weights are the targets
+    for (int i = 0; i < LIGHT_RESAMPLING_CANDIDATES; ++i)
+    {
+        float3 x = make_float3(UniformSampler_Sample1D(&rng), UniformSampler_Sample1D(&rng), UniformSampler_Sample1D(&rng));
+        float3 lightwo = 0.f;
+        float3 radiance = ShadeSurfaceUberV2_EvaluateResampledLight(scene, diffgeo, uber_shader_data, wi, bxdf_flags, num_light_samples,
+            light_mask, guiding, guiding_cell, x, TEXTURE_ARGS, &lightwo);
+        float target = luminance(radiance);
+
+        weight_sum += target;
+        num_candidates += 1.f;
+
+        if (target > 0.f && UniformSampler_Sample1D(&rng) * weight_sum < target)
+        {
+            selected_sample = x;
+            selected_radiance = radiance;
+            selected_lightwo = lightwo;
+            selected_target = target;
+        }
+    }
+
+    int2 pixel;
+    if (history && LightResampling_Reproject(prev_camera, diffgeo->p, output_width, output_height, &pixel))
+    {
+        // Reservoir at the reprojected pixel comes first, the rest are taken around it
+        for (int i = 0; i <= LIGHT_RESAMPLING_SPATIAL_SAMPLES; ++i)
+        {
+            int2 neighbour = pixel;
+
+            if (i > 0)
+            {
+                float2 offset = Sample_MapToDiskConcentric(make_float2(UniformSampler_Sample1D(&rng), UniformSampler_Sample1D(&rng))) * LIGHT_RESAMPLING_SPATIAL_RADIUS;
+                neighbour = clamp(pixel + convert_int2_rtn(offset), make_int2(0, 0), make_int2(output_width - 1, output_height - 1));
+            }
+
+            GLOBAL LightReservoir const* reservoir = prev_reservoirs + neighbour.y * output_width + neighbour.x;
+
+            if (!LightResampling_IsReusable(reservoir, diffgeo->p, diffgeo->n, depth))
+            {
+                continue;
+            }
+
+            float3 x = reservoir->sample;
+            float3 lightwo = 0.f;
+            float3 radiance = ShadeSurfaceUberV2_EvaluateResampledLight(scene, diffgeo, uber_shader_data, wi, bxdf_flags, num_light_samples,
+                light_mask, guiding, guiding_cell, x, TEXTURE_ARGS, &lightwo);
+            float target = luminance(radiance);
+            float reused_candidates = min(reservoir->num_candidates, LIGHT_RESAMPLING_MAX_HISTORY * LIGHT_RESAMPLING_CANDIDATES);
+            float weight = target * reservoir->weight * reused_candidates;
+
+            weight_sum += weight;
+            num_candidates += reused_candidates;
+
+            if (weight > 0.f && UniformSampler_Sample1D(&rng) * weight_sum < weight)
+            {
+                selected_sample = x;
+                selected_radiance = radiance;
+                selected_lightwo = lightwo;
+                selected_target = target;
+            }
+        }
+    }
+
+    // Contribution weight turns the selected sample into an estimate of the light sampling integral
+    float contribution_weight = selected_target > 0.f ? weight_sum / (num_candidates * selected_target) : 0.f;
+
+    GLOBAL LightReservoir* reservoir = reservoirs + reservoir_idx;
+    reservoir->p = diffgeo->p;
+    reservoir->n = diffgeo->n;
+    reservoir->sample = selected_sample;
+    reservoir->num_candidates = num_candidates;
+    reservoir->weight = contribution_weight;
+
+    ShadeSurfaceUberV2_SetShadowRay(scene, diffgeo, s, 0, selected_lightwo, throughput * selected_radiance * contribution_weight, 1,
+        path, shadow_ray, light_sample);
+}
+#endif
+
+#ifdef BAIKAL_UBERV2_VARIANT
+// Check if material layer combination is shaded by this kernel variant,
+// BAIKAL_UBERV2_OWNED_* hold one bit per combination
+INLINE bool UberV2_IsVariantMaterial(int layers)
+{
+    const ulong owned[4] = { BAIKAL_UBERV2_OWNED_0, BAIKAL_UBERV2_OWNED_1, BAIKAL_UBERV2_OWNED_2, BAIKAL_UBERV2_OWNED_3 };
+    return ((owned[(layers >> 6) & 3] >> (layers & 63)) & 1ul) != 0;
+}
+#endif
+
+// Checks if GetMaterialBxDFType is going to select the transparency layer. Sampler is taken
+// by value, so GetMaterialBxDFType draws the same sample afterwards.
+INLINE bool ShadeSurfaceUberV2_IsPassthrough(int layers, float transparency, Sampler sampler, SAMPLER_ARG_LIST)
+{
+    // Same as GetMaterialBxDFType, sample is only taken if there is a layer underneath
+    const bool has_underlying_layer = (layers & (kRefractionLayer | kCoatingLayer | kReflectionLayer | kDiffuseLayer)) != 0;
+    return !has_underlying_layer || Sampler_Sample1D(&sampler, SAMPLER_ARGS) < transparency;
+}
+
+// Surface interaction for a single compacted hit. Shared by the wavefront
+// and persistent-threads versions of the surface shading kernel.
+INLINE void ShadeSurfaceUberV2_Process(
+    // Index into compacted hit list
+    int global_id,
     // Ray batch
     GLOBAL ray const* restrict rays,
     // Intersection data
@@ -241,13 +606,21 @@ KERNEL void ShadeSurfaceUberV2(
     // Vertices
     GLOBAL float3 const* restrict vertices,
     // Normals
-    GLOBAL float3 const* restrict normals,
+    GLOBAL SceneNormal const* restrict normals,
     // UVs
-    GLOBAL float2 const* restrict uvs,
+    GLOBAL SceneUV const* restrict uvs,
+    // Tangents
+    GLOBAL SceneTangent const* restrict tangents,
     // Indices
     GLOBAL int const* restrict indices,
     // Shapes
     GLOBAL Shape const* restrict shapes,
+    // Instances
+    GLOBAL ShapeInstance const* restrict instances,
+    // Instance transforms
+    GLOBAL float4 const* restrict instance_transforms,
+    // Number of base shapes
+    int num_base_shapes,
     // Materials
     GLOBAL int const* restrict material_attributes,
     // Textures
@@ -258,6 +631,12 @@ KERNEL void ShadeSurfaceUberV2(
     GLOBAL Light const* restrict lights,
     // Light distribution
     GLOBAL int const* restrict light_distribution,
+    // Environment light distribution
+    GLOBAL int const* restrict envmap_distribution,
+    // Environment irradiance SH coefficients
+    GLOBAL float3 const* restrict env_irradiance,
+    // Area light of each emissive primitive
+    GLOBAL int const* restrict area_light_map,
     // Number of emissive objects
     int num_lights,
     // RNG seed
@@ -270,252 +649,841 @@ KERNEL void ShadeSurfaceUberV2(
     int bounce,
     // Frame
     int frame,
+    // First bounce to apply Russian roulette at
+    int rr_min_bounce,
+    // Number of light samples per vertex
+    int num_light_samples,
     // Volume data
     GLOBAL Volume const* restrict volumes,
     // Shadow rays
     GLOBAL ray* restrict shadow_rays,
-    // Light samples
-    GLOBAL float3* restrict light_samples,
+    // Light samples, packed RGB
+    GLOBAL float* restrict light_samples,
     // Path throughput
     GLOBAL Path* restrict paths,
+    // First pass of the path in every slot
+    GLOBAL int const* restrict path_start,
     // Indirect rays
     GLOBAL ray* restrict indirect_rays,
     // Radiance
     GLOBAL float3* restrict output,
-    GLOBAL InputMapData const* restrict input_map_values
+    GLOBAL InputMapData const* restrict input_map_values,
+    // Per base shape hit flags for the geometry cache
+    GLOBAL int* restrict geometry_requests,
+    // Path guiding distribution
+    GLOBAL int const* restrict guiding,
+    // Guided path vertices
+    GLOBAL PathGuidingVertex* restrict guiding_vertices,
+    // Radiance cache keys
+    GLOBAL uint const* restrict cache_keys,
+    // Resolved radiance of cache entries
+    GLOBAL float4 const* restrict cache_radiance,
+    // Radiance cache table size minus one
+    int cache_mask,
+    // Radiance cache cell size
+    float cache_cell_size,
+    // Vertices of training paths
+    GLOBAL RadianceCacheVertex* restrict cache_vertices,
+    // Light reservoirs of the last frame and of the current one
+    GLOBAL LightReservoir const* restrict prev_reservoirs,
+    GLOBAL LightReservoir* restrict reservoirs,
+    // Camera of the last frame
+    GLOBAL Camera const* restrict prev_camera,
+    // Output resolution, 0 if first hits are not resampled
+    int output_width,
+    int output_height,
+    // Reservoirs of the last frame are valid
+    int reservoir_history
 )
 {
-    int global_id = get_global_id(0);
-
     Scene scene =
     {
         vertices,
         normals,
         uvs,
+        tangents,
         indices,
         shapes,
+        instances,
+        instance_transforms,
+        num_base_shapes,
         material_attributes,
         input_map_values,
         lights,
         env_light_idx,
         num_lights,
-        light_distribution
+        light_distribution,
+        envmap_distribution
     };
 
-    // Only applied to active rays after compaction
-    if (global_id < *num_hits)
+    // Fetch index
+    int hit_idx = hit_indices[global_id];
+    int pixel_idx = pixel_indices[global_id];
+    Intersection isect = isects[hit_idx];
+
+    GLOBAL Path* path = paths + pixel_idx;
+
+    // Early exit for scattered paths
+    if (Path_IsScattered(path))
     {
-        // Fetch index
-        int hit_idx = hit_indices[global_id];
-        int pixel_idx = pixel_indices[global_id];
-        Intersection isect = isects[hit_idx];
+        return;
+    }
 
-        GLOBAL Path* path = paths + pixel_idx;
+#ifdef BAIKAL_PATH_REGENERATION
+    // Regenerated paths count bounces from the pass they have started at and take the next sample
+    int start_pass = path_start[pixel_idx];
+    bounce -= start_pass;
+    frame += start_pass > 0 ? 1 : 0;
+#endif
+
+#ifdef BAIKAL_UBERV2_VARIANT
+    // Hit is shaded by another variant
+    if (!UberV2_IsVariantMaterial(Scene_GetShapeMaterial(&scene, isect.shapeid - 1).layers))
+    {
+        return;
+    }
+#endif
+
+    // Report the hit and sampled area lights to the geometry cache. Paged out geometry can't be shaded,
+    // the path is dropped and the host pages the mesh in for the next frames.
+    scene.geometry_requests = geometry_requests;
 
-        // Early exit for scattered paths
-        if (Path_IsScattered(path))
+    if (!Scene_RequestShapeGeometry(&scene, isect.shapeid - 1))
+    {
+        Path_Kill(path);
+        Ray_SetInactive(indirect_rays + global_id);
+
+        for (int k = 0; k < num_light_samples; ++k)
         {
-            return;
+            int sample_idx = k * (*num_hits) + global_id;
+            Ray_SetInactive(shadow_rays + sample_idx);
+            vstore3(make_float3(0.f, 0.f, 0.f), sample_idx, light_samples);
         }
+        return;
+    }
 
-        // Fetch incoming ray direction
-        float3 wi = -normalize(rays[hit_idx].d.xyz);
+    // Fetch incoming ray direction
+    float3 wi = -normalize(rays[hit_idx].d.xyz);
 
-        Sampler sampler;
+    // Shapes and new rays are evaluated at the time of the incoming ray
+    float time = Ray_GetTime(&rays[hit_idx]);
+    scene.time = time;
+
+    Sampler sampler;
 #if SAMPLER == SOBOL
-        uint scramble = random[pixel_idx] * 0x1fe3434f;
-        Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET + bounce * SAMPLE_DIMS_PER_BOUNCE, scramble);
+    uint scramble = random[pixel_idx] * 0x1fe3434f;
+    Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET + bounce * SAMPLE_DIMS_PER_BOUNCE, scramble);
+#elif SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+    // Per-pixel blue noise value or Owen scrambling seed is used as is
+    uint scramble = random[pixel_idx];
+    Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET + bounce * SAMPLE_DIMS_PER_BOUNCE, scramble);
 #elif SAMPLER == RANDOM
-        uint scramble = pixel_idx * rng_seed;
-        Sampler_Init(&sampler, scramble);
+    uint scramble = pixel_idx * rng_seed;
+    Sampler_Init(&sampler, scramble);
 #elif SAMPLER == CMJ
-        uint rnd = random[pixel_idx];
-        uint scramble = rnd * 0x1fe3434f * ((frame + 331 * rnd) / (CMJ_DIM * CMJ_DIM));
-        Sampler_Init(&sampler, frame % (CMJ_DIM * CMJ_DIM), SAMPLE_DIM_SURFACE_OFFSET + bounce * SAMPLE_DIMS_PER_BOUNCE, scramble);
+    uint rnd = random[pixel_idx];
+    uint scramble = rnd * 0x1fe3434f * ((frame + 331 * rnd) / (CMJ_DIM * CMJ_DIM));
+    Sampler_Init(&sampler, frame % (CMJ_DIM * CMJ_DIM), SAMPLE_DIM_SURFACE_OFFSET + bounce * SAMPLE_DIMS_PER_BOUNCE, scramble);
 #endif
 
-        // Fill surface data
-        DifferentialGeometry diffgeo;
-        Scene_FillDifferentialGeometry(&scene, &isect, &diffgeo);
+    // Fill surface data
+    DifferentialGeometry diffgeo;
+    Scene_FillDifferentialGeometry(&scene, &isect, &diffgeo);
 
-        // Check if we are hitting from the inside
-        float ngdotwi = dot(diffgeo.ng, wi);
-        bool backfacing = ngdotwi < 0.f;
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+    // Ray cone width grows linearly with the hit distance
+    float2 cone = Ray_GetCone(&rays[hit_idx]);
+    float cone_width = cone.x + cone.y * isect.uvwt.w;
+    DifferentialGeometry_SetTextureLod(&scene, &isect, wi, cone_width, &diffgeo);
+#endif
 
-        // Select BxDF
-        UberV2ShaderData uber_shader_data;
-        UberV2PrepareInputs(&diffgeo, input_map_values, material_attributes, TEXTURE_ARGS, &uber_shader_data);
+    // Check if we are hitting from the inside
+    float ngdotwi = dot(diffgeo.ng, wi);
+    bool backfacing = ngdotwi < 0.f;
 
-        UberV2_ApplyShadingNormal(&diffgeo, &uber_shader_data);
-        DifferentialGeometry_CalculateTangentTransforms(&diffgeo);
+    // Select BxDF
+    UberV2ShaderData uber_shader_data;
+    bool passthrough = false;
 
-        GetMaterialBxDFType(wi, &sampler, SAMPLER_ARGS, &diffgeo, &uber_shader_data);
+    // Passthrough hits (e.g. alpha masked foliage) only fetch the transparency input, the rest of
+    // shader data is not read for them. Emissive ones still need the emission color and exit points
+    // of subsurface probes never pass through.
+    if ((diffgeo.mat.layers & (kTransparencyLayer | kEmissionLayer)) == kTransparencyLayer && !Path_IsSubsurfaceProbe(path))
+    {
+        UberV2PrepareTransparency(&diffgeo, input_map_values, material_attributes, TEXTURE_ARGS, &uber_shader_data);
+        passthrough = ShadeSurfaceUberV2_IsPassthrough(diffgeo.mat.layers, uber_shader_data.transparency, sampler, SAMPLER_ARGS);
+    }
 
-        // Set surface interaction flags
-        Path_SetFlags(&diffgeo, path);
+    if (!passthrough)
+    {
+        UberV2PrepareInputs(&diffgeo, input_map_values, material_attributes, TEXTURE_ARGS, &uber_shader_data);
 
-        // Opacity flag for opacity AOV
-        if (!Bxdf_IsTransparency(&diffgeo))
+#ifdef BAIKAL_REGULARIZE_ROUGHNESS
+        // Blur specular chains seen through glossy surfaces, these are rarely found by BSDF sampling
+        if (Path_IsGlossy(path))
         {
-            Path_SetOpacityFlag(path);
+            uber_shader_data.reflection_roughness = max(uber_shader_data.reflection_roughness, REGULARIZATION_MIN_ROUGHNESS);
+            uber_shader_data.refraction_roughness = max(uber_shader_data.refraction_roughness, REGULARIZATION_MIN_ROUGHNESS);
         }
+#endif
 
-        // Terminate if emissive
-        if (Bxdf_IsEmissive(&diffgeo))
-        {
-            if (!backfacing)
-            {
-                float weight = 1.f;
+        // Passthrough continues along the ray whatever the shading normal is
+        UberV2_ApplyShadingNormal(&diffgeo, &uber_shader_data);
+    }
 
-                if (bounce > 0 && !Path_IsSpecular(path))
-                {
-                    float2 extra = Ray_GetExtra(&rays[hit_idx]);
-                    float ld = isect.uvwt.w;
-                    float denom = fabs(dot(diffgeo.n, wi)) * diffgeo.area;
-                    // TODO: num_lights should be num_emissies instead, presence of analytical lights breaks this code
-                    float bxdf_light_pdf = denom > 0.f ? (ld * ld / denom / num_lights) : 0.f;
-                    weight = extra.x > 0.f ? BalanceHeuristic(1, extra.x, 1, bxdf_light_pdf) : 1.f;
-                }
+    DifferentialGeometry_CalculateTangentTransforms(&diffgeo);
 
-                // In this case we hit after an application of MIS process at previous step.
-                // That means BRDF weight has been already applied.
-                float3 v = REASONABLE_RADIANCE(Path_GetThroughput(path) * Emissive_GetLe(&diffgeo, TEXTURE_ARGS, &uber_shader_data) * weight);
+    GetMaterialBxDFType(wi, &sampler, SAMPLER_ARGS, &diffgeo, &uber_shader_data);
 
-                int output_index = output_indices[pixel_idx];
-                ADD_FLOAT3(&output[output_index], v);
-            }
+#ifdef BAIKAL_UBERV2_DIFFUSION_SSS
+    // Probe of diffusion subsurface scattering has found its exit point, which only
+    // has the exit lobe. Probes are dropped if they hit another shape than they entered.
+    if (Path_IsSubsurfaceProbe(path))
+    {
+        Path_ClearSubsurfaceProbeFlag(path);
 
+        if (isect.shapeid - 1 != as_int(Ray_GetExtra(&rays[hit_idx]).x))
+        {
             Path_Kill(path);
-            Ray_SetInactive(shadow_rays + global_id);
             Ray_SetInactive(indirect_rays + global_id);
 
-            light_samples[global_id] = 0.f;
+            for (int k = 0; k < num_light_samples; ++k)
+            {
+                int sample_idx = k * (*num_hits) + global_id;
+                Ray_SetInactive(shadow_rays + sample_idx);
+                vstore3(make_float3(0.f, 0.f, 0.f), sample_idx, light_samples);
+            }
             return;
         }
 
-        float s = Bxdf_IsBtdf(&diffgeo) ? (-sign(ngdotwi)) : 1.f;
-        if (backfacing && !Bxdf_IsBtdf(&diffgeo))
+        Bxdf_UberV2_SetSampledComponent(&diffgeo, kBxdfUberV2SampleSubsurface);
+        Bxdf_SetFlags(&diffgeo, kBxdfFlagsBrdf);
+    }
+#endif
+
+    // Set surface interaction flags
+    Path_SetFlags(&diffgeo, path);
+
+    // Opacity flag for opacity AOV
+    if (!Bxdf_IsTransparency(&diffgeo))
+    {
+        Path_SetOpacityFlag(path);
+    }
+
+    // Terminate if emissive
+    if (Bxdf_IsEmissive(&diffgeo))
+    {
+#ifdef BAIKAL_CAUSTIC_SPLIT
+        // Camera -> diffuse -> specular chain -> light paths are gathered by light tracing
+        bool gathered_by_light_tracing = (bounce > 1) && Path_IsCaustic(path);
+#else
+        bool gathered_by_light_tracing = false;
+#endif
+
+        if (!backfacing && !gathered_by_light_tracing)
         {
-            //Reverse normal and tangents in this case
-            //but not for BTDFs, since BTDFs rely
-            //on normal direction in order to arrange
-            //indices of refraction
-            diffgeo.n = -diffgeo.n;
-            diffgeo.dpdu = -diffgeo.dpdu;
-            diffgeo.dpdv = -diffgeo.dpdv;
-            s = -s;
+            float weight = 1.f;
+            int hit_light_idx = AreaLightMap_Find(area_light_map, isect.shapeid - 1, isect.primid);
+
+            if (bounce > 0 && !Path_IsSpecular(path))
+            {
+                float2 extra = Ray_GetExtra(&rays[hit_idx]);
+#ifdef BAIKAL_AREA_LIGHT_IMPORTANCE
+                // Light sampling may have picked the point by solid angle
+                float area_light_pdf = AreaLight_GetSamplePdf(&scene, isect.shapeid - 1, isect.primid, rays[hit_idx].o.xyz, diffgeo.p, diffgeo.n, diffgeo.area);
+#else
+                float ld = isect.uvwt.w;
+                float denom = fabs(dot(diffgeo.n, wi)) * diffgeo.area;
+                float area_light_pdf = denom > 0.f ? (ld * ld / denom) : 0.f;
+#endif
+#ifdef BAIKAL_EXACT_LIGHT_PDF
+                // Actual selection probability of the area light we hit
+                float light_selection_pdf = hit_light_idx != -1 ? Scene_GetLightPdfAtPoint(&scene, hit_light_idx, rays[hit_idx].o.xyz) : 0.f;
+                float bxdf_light_pdf = area_light_pdf * light_selection_pdf;
+#else
+                // TODO: num_lights should be num_emissies instead, presence of analytical lights breaks this code
+                float bxdf_light_pdf = area_light_pdf / num_lights;
+#endif
+                weight = extra.x > 0.f ? BalanceHeuristic(1, extra.x, num_light_samples, bxdf_light_pdf) : 1.f;
+            }
+
+            // The last surface vertex is not linked to the light we hit
+            if (bounce > 0 && Path_GetLightMask(path) != -1 && hit_light_idx != -1)
+            {
+                weight = Light_IsLinked(&lights[hit_light_idx], Path_GetLightMask(path)) ? weight : 0.f;
+            }
+
+            // In this case we hit after an application of MIS process at previous step.
+            // That means BRDF weight has been already applied.
+            float3 v = REASONABLE_RADIANCE(Path_GetThroughput(path) * Emissive_GetLe(&diffgeo, TEXTURE_ARGS, &uber_shader_data) * weight);
+            v = Path_ClampRadiance(path, v);
+
+            int output_index = output_indices[pixel_idx];
+            ADD_FLOAT3(&output[output_index], v);
         }
 
-        float ndotwi = fabs(dot(diffgeo.n, wi));
+        Path_Kill(path);
+        Ray_SetInactive(indirect_rays + global_id);
 
-        float light_pdf = 0.f;
-        float bxdf_light_pdf = 0.f;
-        float bxdf_pdf = 0.f;
-        float light_bxdf_pdf = 0.f;
-        float selection_pdf = 0.f;
-        float3 radiance = 0.f;
-        float3 lightwo;
-        float3 bxdfwo;
-        float3 wo;
-        float bxdf_weight = 1.f;
-        float light_weight = 1.f;
+        for (int k = 0; k < num_light_samples; ++k)
+        {
+            int sample_idx = k * (*num_hits) + global_id;
+            Ray_SetInactive(shadow_rays + sample_idx);
+            vstore3(make_float3(0.f, 0.f, 0.f), sample_idx, light_samples);
+        }
+        return;
+    }
 
-        int light_idx = Scene_SampleLight(&scene, Sampler_Sample1D(&sampler, SAMPLER_ARGS), &selection_pdf);
+#ifdef BAIKAL_CAUSTIC_SPLIT
+    // Caustic chain starts at a non-singular first hit and breaks on any other non-singular vertex
+    if (!Bxdf_IsSingular(&diffgeo))
+    {
+        if (bounce == 0)
+        {
+            Path_SetCausticFlag(path);
+        }
+        else
+        {
+            Path_ClearCausticFlag(path);
+        }
+    }
+#endif
 
-        float3 throughput = Path_GetThroughput(path);
+    float s = Bxdf_IsBtdf(&diffgeo) ? (-sign(ngdotwi)) : 1.f;
+    if (backfacing && !Bxdf_IsBtdf(&diffgeo))
+    {
+        //Reverse normal and tangents in this case
+        //but not for BTDFs, since BTDFs rely
+        //on normal direction in order to arrange
+        //indices of refraction
+        diffgeo.n = -diffgeo.n;
+        diffgeo.dpdu = -diffgeo.dpdu;
+        diffgeo.dpdv = -diffgeo.dpdv;
+        s = -s;
+    }
 
-        // Sample bxdf
-        const float2 sample = Sampler_Sample2D(&sampler, SAMPLER_ARGS);
-        float3 bxdf = UberV2_Sample(&diffgeo, wi, TEXTURE_ARGS, sample, &bxdfwo, &bxdf_pdf, &uber_shader_data);
+#ifdef BAIKAL_RADIANCE_CACHE
+    // Past the first non-singular vertex paths terminate into the cache,
+    // training paths go on and record what they gather for the cache instead
+    if (!Bxdf_IsSingular(&diffgeo))
+    {
+        uint cache_key = RadianceCache_GetKey(diffgeo.p, diffgeo.n, cache_cell_size);
+#ifndef BAIKAL_ATOMIC_RESOLVE
+        int training_idx = RadianceCache_GetTrainingIndex(pixel_idx, frame);
+#else
+        // Duplicate output indices mix radiance of different paths, so there is no training
+        int training_idx = -1;
+#endif
+        float3 cached_radiance;
 
-        // If we have light to sample we can hopefully do mis
-        if (light_idx > -1)
+        if (training_idx >= 0)
+        {
+            RadianceCache_RecordVertex(cache_vertices, training_idx, bounce, cache_key, Path_GetThroughput(path), output[output_indices[pixel_idx]]);
+        }
+        else if (Path_IsGlossy(path) && RadianceCache_Lookup(cache_keys, cache_radiance, cache_mask, cache_key, &cached_radiance))
         {
-            // Sample light
-            int bxdf_flags = Path_GetBxdfFlags(path);
-            float3 le = Light_Sample(light_idx, &scene, &diffgeo, TEXTURE_ARGS, Sampler_Sample2D(&sampler, SAMPLER_ARGS), bxdf_flags, kLightInteractionSurface, &lightwo, &light_pdf);
-            light_bxdf_pdf = UberV2_GetPdf(&diffgeo, wi, normalize(lightwo), TEXTURE_ARGS, &uber_shader_data);
-            light_weight = Light_IsSingular(&scene.lights[light_idx]) ? 1.f : BalanceHeuristic(1, light_pdf * selection_pdf, 1, light_bxdf_pdf);
-
-            // Apply MIS to account for both
-            if (NON_BLACK(le) && (light_pdf > 0.0f) && (selection_pdf > 0.0f) && !Bxdf_IsSingular(&diffgeo))
+            float3 v = REASONABLE_RADIANCE(Path_GetThroughput(path) * cached_radiance);
+            v = Path_ClampRadiance(path, v);
+
+            int output_index = output_indices[pixel_idx];
+            ADD_FLOAT3(&output[output_index], v);
+
+            Path_Kill(path);
+            Ray_SetInactive(indirect_rays + global_id);
+
+            for (int k = 0; k < num_light_samples; ++k)
             {
-                wo = lightwo;
-                float ndotwo = fabs(dot(diffgeo.n, normalize(wo)));
-                radiance = le * ndotwo * UberV2_Evaluate(&diffgeo, wi, normalize(wo), TEXTURE_ARGS, &uber_shader_data) * throughput * light_weight / light_pdf / selection_pdf;
+                int sample_idx = k * (*num_hits) + global_id;
+                Ray_SetInactive(shadow_rays + sample_idx);
+                vstore3(make_float3(0.f, 0.f, 0.f), sample_idx, light_samples);
             }
+            return;
         }
+    }
+#endif
 
-        // If we have some light here generate a shadow ray
-        if (NON_BLACK(radiance))
-        {
-            // Generate shadow ray
-            float3 shadow_ray_o = diffgeo.p + CRAZY_LOW_DISTANCE * s * diffgeo.ng;
-            float3 temp = diffgeo.p + wo - shadow_ray_o;
-            float3 shadow_ray_dir = normalize(temp);
-            float shadow_ray_length = length(temp);
-            int shadow_ray_mask = VISIBILITY_MASK_BOUNCE_SHADOW(bounce);
+    float ndotwi = fabs(dot(diffgeo.n, wi));
+
+    float bxdf_pdf = 0.f;
+    float3 bxdfwo;
+
+    int bxdf_flags = Path_GetBxdfFlags(path);
+    float3 throughput = Path_GetThroughput(path);
+    float light_selection_sample = Sampler_Sample1D(&sampler, SAMPLER_ARGS);
+
+    // Sample bxdf
+    float2 sample = Sampler_Sample2D(&sampler, SAMPLER_ARGS);
+    float3 bxdf;
+    int guiding_cell = -1;
 
-            Ray_Init(shadow_rays + global_id, shadow_ray_o, shadow_ray_dir, shadow_ray_length, 0.f, shadow_ray_mask);
-            Ray_SetExtra(shadow_rays + global_id, make_float2(1.f, 0.f));
+#ifdef BAIKAL_UBERV2_DIFFUSION_SSS
+    // Entry point of diffusion subsurface scattering (singular) traces a probe down the normal
+    // for its exit point instead of sampling a direction. The probe starts on the sphere
+    // around the entry point above the sampled point of the tangent plane.
+    bool subsurface_probe = Bxdf_UberV2_GetSampledComponent(&diffgeo) == kBxdfUberV2SampleSubsurface && Bxdf_IsSingular(&diffgeo);
+    float3 probe_o = 0.f;
+    float probe_length = 0.f;
 
-            light_samples[global_id] = REASONABLE_RADIANCE(radiance);
+    if (subsurface_probe)
+    {
+        float radius, phi, max_radius;
+        bxdf = UberV2_DiffusionProfile_Sample(&uber_shader_data, sample, &radius, &phi, &max_radius);
+
+        probe_length = native_sqrt(max(max_radius * max_radius - radius * radius, 0.f));
+        probe_o = diffgeo.p + radius * (native_cos(phi) * diffgeo.dpdu + native_sin(phi) * diffgeo.dpdv) + probe_length * diffgeo.n;
+        bxdfwo = -diffgeo.n;
+        bxdf_pdf = 1.f;
+    }
+    else
+#endif
+#ifdef BAIKAL_PATH_GUIDING
+    // One-sample MIS between the BxDF and the distribution learned for the cell,
+    // the first sample dimension picks the technique and is remapped to [0, 1)
+    int record_cell = Bxdf_IsSingular(&diffgeo) ? -1 : PathGuiding_GetCell(guiding, diffgeo.p);
+    guiding_cell = (record_cell >= 0 && PathGuiding_IsTrained(guiding, record_cell)) ? record_cell : -1;
+
+    if (guiding_cell >= 0)
+    {
+        bool guided = sample.x < PATH_GUIDING_FRACTION;
+        float guiding_pdf = 0.f;
+
+        if (guided)
+        {
+            sample.x = sample.x / PATH_GUIDING_FRACTION;
+            bxdfwo = PathGuiding_Sample(guiding, guiding_cell, sample, &guiding_pdf);
         }
         else
         {
-            // Otherwise save some intersector cycles
-            Ray_SetInactive(shadow_rays + global_id);
-            light_samples[global_id] = 0;
+            sample.x = min((sample.x - PATH_GUIDING_FRACTION) / (1.f - PATH_GUIDING_FRACTION), 0.99999994f);
+            UberV2_Sample(&diffgeo, wi, TEXTURE_ARGS, sample, &bxdfwo, &bxdf_pdf, &uber_shader_data);
+            bxdfwo = normalize(bxdfwo);
+            guiding_pdf = PathGuiding_GetPdf(guiding, guiding_cell, bxdfwo);
         }
 
-        // Apply Russian roulette
-        float q = max(min(0.5f,
-            // Luminance
-            0.2126f * throughput.x + 0.7152f * throughput.y + 0.0722f * throughput.z), 0.01f);
-        // Only if it is 3+ bounce
-        bool rr_apply = bounce > 3;
-        bool rr_stop = Sampler_Sample1D(&sampler, SAMPLER_ARGS) > q && rr_apply;
+        // Both techniques are weighted with the whole material rather than its sampled component
+        bxdf = UberV2_Evaluate(&diffgeo, wi, bxdfwo, TEXTURE_ARGS, &uber_shader_data);
+        bxdf_pdf = mix(UberV2_GetPdf(&diffgeo, wi, bxdfwo, TEXTURE_ARGS, &uber_shader_data), guiding_pdf, PATH_GUIDING_FRACTION);
+    }
+    else
+#endif
+    {
+        bxdf = UberV2_Sample(&diffgeo, wi, TEXTURE_ARGS, sample, &bxdfwo, &bxdf_pdf, &uber_shader_data);
+    }
+
+    // Light link mask is kept for the lights hit by the BxDF sample
+    int light_mask = Scene_GetShapeLightMask(&scene, isect.shapeid - 1);
+    Path_SetLightMask(path, light_mask);
+
+    // Past the first bounce diffuse surfaces take the environment light from its SH irradiance
+    // instead of shadow rays, occlusion of the environment is ignored
+    bool use_env_irradiance = false;
+#ifdef BAIKAL_SH_IRRADIANCE
+    use_env_irradiance = bounce > 0 && env_light_idx > -1 &&
+        (diffgeo.mat.layers & ~kShadingNormalLayer) == kDiffuseLayer && !Bxdf_IsBtdf(&diffgeo) &&
+        Light_IsLinked(&lights[env_light_idx], light_mask);
+
+    if (use_env_irradiance)
+    {
+        Light env_light = lights[env_light_idx];
+        float3 irradiance = EnvironmentLight_GetIrradiance(&env_light, env_irradiance, diffgeo.n);
+        float3 v = irradiance * UberV2_Evaluate(&diffgeo, wi, diffgeo.n, TEXTURE_ARGS, &uber_shader_data) * throughput;
+        v = Path_ClampRadiance(path, REASONABLE_RADIANCE(v));
+
+        int output_index = output_indices[pixel_idx];
+        ADD_FLOAT3(&output[output_index], v);
+
+        Path_SetEnvIrradianceFlag(path);
+    }
+    else
+    {
+        Path_ClearEnvIrradianceFlag(path);
+    }
+#endif
+
+#ifdef BAIKAL_LIGHT_RESAMPLING
+    // First hits take their light sample from the reservoirs, it replaces all the light samples of the vertex
+    bool resample_light = (bounce == 0) && (output_width > 0) && !Bxdf_IsSingular(&diffgeo);
+
+    if (resample_light)
+    {
+        ShadeSurfaceUberV2_ResampleLight(&scene, &diffgeo, &uber_shader_data, wi, s, isect.uvwt.w, bxdf_flags, throughput,
+            num_light_samples, light_mask, guiding, guiding_cell, rng_seed, TEXTURE_ARGS, output_indices[pixel_idx],
+            prev_reservoirs, reservoirs, prev_camera, output_width, output_height, reservoir_history, path, shadow_rays + global_id, light_samples + 3 * global_id);
+    }
+    else
+#endif
+    {
+        ShadeSurfaceUberV2_SampleLight(&scene, &diffgeo, &uber_shader_data, wi, s, bounce, bxdf_flags, throughput,
+            num_light_samples, use_env_irradiance, light_mask, guiding, guiding_cell, light_selection_sample, &sampler, SAMPLER_ARGS, TEXTURE_ARGS, path, shadow_rays + global_id, light_samples + 3 * global_id);
+    }
+
+    // Apply Russian roulette, sample is always drawn to keep sampler dimensions stable
+    float rr_sample = Sampler_Sample1D(&sampler, SAMPLER_ARGS);
+    bool rr_stop = (bounce >= rr_min_bounce) && !Path_SurviveRussianRoulette(path, rr_sample);
 
-        if (rr_apply)
+    // Additional light samples follow the first one with a stride of num_hits,
+    // their dimensions come last to keep the rest of the sequence unchanged
+    for (int k = 1; k < num_light_samples; ++k)
+    {
+        int sample_idx = k * (*num_hits) + global_id;
+#ifdef BAIKAL_LIGHT_RESAMPLING
+        if (resample_light)
         {
-            Path_MulThroughput(path, 1.f / q);
+            Ray_SetInactive(shadow_rays + sample_idx);
+            vstore3(make_float3(0.f, 0.f, 0.f), sample_idx, light_samples);
+            continue;
         }
+#endif
+        ShadeSurfaceUberV2_SampleLight(&scene, &diffgeo, &uber_shader_data, wi, s, bounce, bxdf_flags, throughput,
+            num_light_samples, use_env_irradiance, light_mask, guiding, guiding_cell, Sampler_Sample1D(&sampler, SAMPLER_ARGS), &sampler, SAMPLER_ARGS, TEXTURE_ARGS, path, shadow_rays + sample_idx, light_samples + 3 * sample_idx);
+    }
+
+    bxdfwo = normalize(bxdfwo);
+    float3 t = bxdf * fabs(dot(diffgeo.n, bxdfwo));
+
+    // Only continue if we have non-zero throughput & pdf
+    if (NON_BLACK(t) && bxdf_pdf > 0.f && !rr_stop)
+    {
+#ifdef BAIKAL_PATH_GUIDING
+        // Radiance arriving along the sampled direction trains the cell
+        PathGuiding_RecordVertex(guiding_vertices, pixel_idx, bounce, record_cell, bxdfwo, throughput * t);
+#endif
 
-        bxdfwo = normalize(bxdfwo);
-        float3 t = bxdf * fabs(dot(diffgeo.n, bxdfwo));
+        // Update the throughput
+        Path_MulThroughput(path, t / bxdf_pdf);
 
-        // Only continue if we have non-zero throughput & pdf
-        if (NON_BLACK(t) && bxdf_pdf > 0.f && !rr_stop)
+        // Contributions gathered past this vertex are indirect
+        Path_SetIndirectFlag(path);
+        if (!Bxdf_IsSingular(&diffgeo))
         {
-            // Update the throughput
-            Path_MulThroughput(path, t / bxdf_pdf);
+            Path_SetGlossyFlag(path);
+        }
 
-            // Generate ray
-            float3 indirect_ray_dir = bxdfwo;
-            float3 indirect_ray_o = diffgeo.p + CRAZY_LOW_DISTANCE * s * diffgeo.ng;
-            int indirect_ray_mask = VISIBILITY_MASK_BOUNCE(bounce + 1);
+        // Generate ray
+        float3 indirect_ray_dir = bxdfwo;
+        float3 indirect_ray_o = diffgeo.p + CRAZY_LOW_DISTANCE * s * diffgeo.ng;
+        int indirect_ray_mask = VISIBILITY_MASK_BOUNCE(bounce + 1);
 
-            Ray_Init(indirect_rays + global_id, indirect_ray_o, indirect_ray_dir, CRAZY_HIGH_DISTANCE, 0.f, indirect_ray_mask);
+#ifdef BAIKAL_UBERV2_DIFFUSION_SSS
+        if (subsurface_probe)
+        {
+            // Shape the probe has entered is kept instead of BxDF pdf
+            Path_SetSubsurfaceProbeFlag(path);
+            Ray_Init(indirect_rays + global_id, probe_o, indirect_ray_dir, 2.f * probe_length, time, indirect_ray_mask);
+            Ray_SetExtra(indirect_rays + global_id, make_float2(as_float(isect.shapeid - 1), 0.f));
+        }
+        else
+#endif
+        {
+            Ray_Init(indirect_rays + global_id, indirect_ray_o, indirect_ray_dir, CRAZY_HIGH_DISTANCE, time, indirect_ray_mask);
             Ray_SetExtra(indirect_rays + global_id, make_float2(Bxdf_IsSingular(&diffgeo) ? 0.f : bxdf_pdf, 0.f));
+        }
 
-            if (Bxdf_IsBtdf(&diffgeo))
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+        // Singular lobes keep the spread, others widen it by the angle of a cone subtending 1 / pdf steradians.
+        // Width is clamped to the largest half value.
+        float spread = Bxdf_IsSingular(&diffgeo) ? cone.y : cone.y + native_rsqrt(PI * bxdf_pdf);
+        Ray_SetCone(indirect_rays + global_id, make_float2(min(cone_width, 65504.f), min(spread, PI)));
+#endif
+
+        if (Bxdf_IsBtdf(&diffgeo))
+        {
+            if (backfacing)
             {
-                if (backfacing)
-                {
-                    Path_SetVolumeIdx(path, INVALID_IDX);
-                }
-                else
-                {
-                    Path_SetVolumeIdx(path, Scene_GetVolumeIndex(&scene, isect.shapeid - 1));
-                }
+                Path_SetVolumeIdx(path, INVALID_IDX);
+            }
+            else
+            {
+                Path_SetVolumeIdx(path, Scene_GetVolumeIndex(&scene, isect.shapeid - 1));
             }
         }
-        else
+    }
+    else
+    {
+        // Otherwise kill the path
+        Path_Kill(path);
+        Ray_SetInactive(indirect_rays + global_id);
+    }
+}
+
+// Handle ray-surface interaction possibly generating path continuation.
+// This is only applied to non-scattered paths.
+KERNEL void ShadeSurfaceUberV2(
+    // Ray batch
+    GLOBAL ray const* restrict rays,
+    // Intersection data
+    GLOBAL Intersection const* restrict isects,
+    // Hit indices
+    GLOBAL int const* restrict hit_indices,
+    // Pixel indices
+    GLOBAL int const* restrict pixel_indices,
+    // Output indices
+    GLOBAL int const*  restrict output_indices,
+    // Number of rays
+    GLOBAL int const* restrict num_hits,
+    // Vertices
+    GLOBAL float3 const* restrict vertices,
+    // Normals
+    GLOBAL SceneNormal const* restrict normals,
+    // UVs
+    GLOBAL SceneUV const* restrict uvs,
+    // Tangents
+    GLOBAL SceneTangent const* restrict tangents,
+    // Indices
+    GLOBAL int const* restrict indices,
+    // Shapes
+    GLOBAL Shape const* restrict shapes,
+    // Instances
+    GLOBAL ShapeInstance const* restrict instances,
+    // Instance transforms
+    GLOBAL float4 const* restrict instance_transforms,
+    // Number of base shapes
+    int num_base_shapes,
+    // Materials
+    GLOBAL int const* restrict material_attributes,
+    // Textures
+    TEXTURE_ARG_LIST,
+    // Environment texture index
+    int env_light_idx,
+    // Emissives
+    GLOBAL Light const* restrict lights,
+    // Light distribution
+    GLOBAL int const* restrict light_distribution,
+    // Environment light distribution
+    GLOBAL int const* restrict envmap_distribution,
+    // Environment irradiance SH coefficients
+    GLOBAL float3 const* restrict env_irradiance,
+    // Area light of each emissive primitive
+    GLOBAL int const* restrict area_light_map,
+    // Number of emissive objects
+    int num_lights,
+    // RNG seed
+    uint rng_seed,
+    // Sampler states
+    GLOBAL uint* restrict random,
+    // Sobol matrices
+    GLOBAL uint const* restrict sobol_mat,
+    // Current bounce
+    int bounce,
+    // Frame
+    int frame,
+    // First bounce to apply Russian roulette at
+    int rr_min_bounce,
+    // Number of light samples per vertex
+    int num_light_samples,
+    // Volume data
+    GLOBAL Volume const* restrict volumes,
+    // Shadow rays
+    GLOBAL ray* restrict shadow_rays,
+    // Light samples, packed RGB
+    GLOBAL float* restrict light_samples,
+    // Path throughput
+    GLOBAL Path* restrict paths,
+    // First pass of the path in every slot
+    GLOBAL int const* restrict path_start,
+    // Indirect rays
+    GLOBAL ray* restrict indirect_rays,
+    // Radiance
+    GLOBAL float3* restrict output,
+    GLOBAL InputMapData const* restrict input_map_values,
+    // Per base shape hit flags for the geometry cache
+    GLOBAL int* restrict geometry_requests,
+    // Path guiding distribution
+    GLOBAL int const* restrict guiding,
+    // Guided path vertices
+    GLOBAL PathGuidingVertex* restrict guiding_vertices,
+    // Radiance cache keys
+    GLOBAL uint const* restrict cache_keys,
+    // Resolved radiance of cache entries
+    GLOBAL float4 const* restrict cache_radiance,
+    // Radiance cache table size minus one
+    int cache_mask,
+    // Radiance cache cell size
+    float cache_cell_size,
+    // Vertices of training paths
+    GLOBAL RadianceCacheVertex* restrict cache_vertices,
+    // Light reservoirs of the last frame and of the current one
+    GLOBAL LightReservoir const* restrict prev_reservoirs,
+    GLOBAL LightReservoir* restrict reservoirs,
+    // Camera of the last frame
+    GLOBAL Camera const* restrict prev_camera,
+    // Output resolution, 0 if first hits are not resampled
+    int output_width,
+    int output_height,
+    // Reservoirs of the last frame are valid
+    int reservoir_history
+)
+{
+    int global_id = get_global_id(0);
+
+    // Only applied to active rays after compaction
+    if (global_id < *num_hits)
+    {
+        ShadeSurfaceUberV2_Process(global_id,
+            rays, isects, hit_indices, pixel_indices, output_indices, num_hits,
+            vertices, normals, uvs, tangents, indices, shapes, instances, instance_transforms, num_base_shapes, material_attributes, TEXTURE_ARGS,
+            env_light_idx, lights, light_distribution, envmap_distribution, env_irradiance, area_light_map, num_lights, rng_seed, random, sobol_mat,
+            bounce, frame, rr_min_bounce, num_light_samples, volumes, shadow_rays, light_samples, paths, path_start, indirect_rays, output,
+            input_map_values, geometry_requests, guiding, guiding_vertices,
+            cache_keys, cache_radiance, cache_mask, cache_cell_size, cache_vertices,
+            prev_reservoirs, reservoirs, prev_camera, output_width, output_height, reservoir_history);
+    }
+}
+
+// Persistent-threads version of ShadeSurfaceUberV2. Instead of launching one
+// thread per work buffer entry the host launches a fixed number of groups
+// (enough to fill the device) and each group keeps grabbing batches of hits
+// from a global work counter until the compacted hit list is exhausted.
+// This keeps the dispatch size independent of the number of live paths.
+// The work counter should be reset to zero prior to the launch.
+KERNEL void ShadeSurfaceUberV2Persistent(
+    // Ray batch
+    GLOBAL ray const* restrict rays,
+    // Intersection data
+    GLOBAL Intersection const* restrict isects,
+    // Hit indices
+    GLOBAL int const* restrict hit_indices,
+    // Pixel indices
+    GLOBAL int const* restrict pixel_indices,
+    // Output indices
+    GLOBAL int const*  restrict output_indices,
+    // Number of rays
+    GLOBAL int const* restrict num_hits,
+    // Vertices
+    GLOBAL float3 const* restrict vertices,
+    // Normals
+    GLOBAL SceneNormal const* restrict normals,
+    // UVs
+    GLOBAL SceneUV const* restrict uvs,
+    // Tangents
+    GLOBAL SceneTangent const* restrict tangents,
+    // Indices
+    GLOBAL int const* restrict indices,
+    // Shapes
+    GLOBAL Shape const* restrict shapes,
+    // Instances
+    GLOBAL ShapeInstance const* restrict instances,
+    // Instance transforms
+    GLOBAL float4 const* restrict instance_transforms,
+    // Number of base shapes
+    int num_base_shapes,
+    // Materials
+    GLOBAL int const* restrict material_attributes,
+    // Textures
+    TEXTURE_ARG_LIST,
+    // Environment texture index
+    int env_light_idx,
+    // Emissives
+    GLOBAL Light const* restrict lights,
+    // Light distribution
+    GLOBAL int const* restrict light_distribution,
+    // Environment light distribution
+    GLOBAL int const* restrict envmap_distribution,
+    // Environment irradiance SH coefficients
+    GLOBAL float3 const* restrict env_irradiance,
+    // Area light of each emissive primitive
+    GLOBAL int const* restrict area_light_map,
+    // Number of emissive objects
+    int num_lights,
+    // RNG seed
+    uint rng_seed,
+    // Sampler states
+    GLOBAL uint* restrict random,
+    // Sobol matrices
+    GLOBAL uint const* restrict sobol_mat,
+    // Current bounce
+    int bounce,
+    // Frame
+    int frame,
+    // First bounce to apply Russian roulette at
+    int rr_min_bounce,
+    // Number of light samples per vertex
+    int num_light_samples,
+    // Volume data
+    GLOBAL Volume const* restrict volumes,
+    // Shadow rays
+    GLOBAL ray* restrict shadow_rays,
+    // Light samples, packed RGB
+    GLOBAL float* restrict light_samples,
+    // Path throughput
+    GLOBAL Path* restrict paths,
+    // First pass of the path in every slot
+    GLOBAL int const* restrict path_start,
+    // Indirect rays
+    GLOBAL ray* restrict indirect_rays,
+    // Radiance
+    GLOBAL float3* restrict output,
+    GLOBAL InputMapData const* restrict input_map_values,
+    // Per base shape hit flags for the geometry cache
+    GLOBAL int* restrict geometry_requests,
+    // Path guiding distribution
+    GLOBAL int const* restrict guiding,
+    // Guided path vertices
+    GLOBAL PathGuidingVertex* restrict guiding_vertices,
+    // Radiance cache keys
+    GLOBAL uint const* restrict cache_keys,
+    // Resolved radiance of cache entries
+    GLOBAL float4 const* restrict cache_radiance,
+    // Radiance cache table size minus one
+    int cache_mask,
+    // Radiance cache cell size
+    float cache_cell_size,
+    // Vertices of training paths
+    GLOBAL RadianceCacheVertex* restrict cache_vertices,
+    // Light reservoirs of the last frame and of the current one
+    GLOBAL LightReservoir const* restrict prev_reservoirs,
+    GLOBAL LightReservoir* restrict reservoirs,
+    // Camera of the last frame
+    GLOBAL Camera const* restrict prev_camera,
+    // Output resolution, 0 if first hits are not resampled
+    int output_width,
+    int output_height,
+    // Reservoirs of the last frame are valid
+    int reservoir_history,
+    // Global work queue head
+    GLOBAL int* restrict work_counter
+)
+{
+    __local int batch_start;
+
+    int local_id = get_local_id(0);
+    int local_size = get_local_size(0);
+    int num_items = *num_hits;
+
+    for (;;)
+    {
+        // Grab the next batch for the whole group
+        if (local_id == 0)
         {
-            // Otherwise kill the path
-            Path_Kill(path);
-            Ray_SetInactive(indirect_rays + global_id);
+            batch_start = atomic_add(work_counter, local_size);
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        int current_batch = batch_start;
+
+        // The queue is drained, batch_start is uniform across the group
+        if (current_batch >= num_items)
+        {
+            break;
+        }
+
+        int item = current_batch + local_id;
+
+        if (item < num_items)
+        {
+            ShadeSurfaceUberV2_Process(item,
+                rays, isects, hit_indices, pixel_indices, output_indices, num_hits,
+                vertices, normals, uvs, tangents, indices, shapes, instances, instance_transforms, num_base_shapes, material_attributes, TEXTURE_ARGS,
+                env_light_idx, lights, light_distribution, envmap_distribution, env_irradiance, area_light_map, num_lights, rng_seed, random, sobol_mat,
+                bounce, frame, rr_min_bounce, num_light_samples, volumes, shadow_rays, light_samples, paths, path_start, indirect_rays, output,
+                input_map_values, geometry_requests, guiding, guiding_vertices,
+                cache_keys, cache_radiance, cache_mask, cache_cell_size, cache_vertices,
+                prev_reservoirs, reservoirs, prev_camera, output_width, output_height, reservoir_history);
         }
+
+        // Make sure everyone has read batch_start before it is overwritten
+        barrier(CLK_LOCAL_MEM_FENCE);
     }
 }
 
@@ -529,6 +1497,8 @@ KERNEL void ApplyVolumeTransmissionUberV2(
     GLOBAL ray* restrict shadow_rays,
     // Number of rays
     GLOBAL int* restrict num_rays,
+    // Shadow ray index of every intersection
+    GLOBAL int const* restrict shadow_ray_indices,
     // Shadow rays hits
     GLOBAL Intersection const* restrict isects,
     // throughput
@@ -536,21 +1506,35 @@ KERNEL void ApplyVolumeTransmissionUberV2(
     // Vertices
     GLOBAL float3 const* restrict vertices,
     // Normals
-    GLOBAL float3 const* restrict normals,
+    GLOBAL SceneNormal const* restrict normals,
     // UVs
-    GLOBAL float2 const* restrict uvs,
+    GLOBAL SceneUV const* restrict uvs,
+    // Tangents
+    GLOBAL SceneTangent const* restrict tangents,
     // Indices
     GLOBAL int const* restrict indices,
     // Shapes
     GLOBAL Shape const* restrict shapes,
+    // Instances
+    GLOBAL ShapeInstance const* restrict instances,
+    // Instance transforms
+    GLOBAL float4 const* restrict instance_transforms,
+    // Number of base shapes
+    int num_base_shapes,
     // Materials
     GLOBAL int const* restrict material_attributes,
     // Volumes
     GLOBAL Volume const* restrict volumes,
-    // Light samples
-    GLOBAL float3* restrict light_samples,
+    // Density grids of heterogeneous volumes
+    GLOBAL int const* restrict volume_grids,
+    // RNG seed
+    uint rng_seed,
+    // Light samples, packed RGB
+    GLOBAL float* restrict light_samples,
     // Shadow predicates
     GLOBAL int* restrict shadow_hits,
+    // Set for the rays which have moved past a volume boundary and need another intersection
+    GLOBAL int* restrict shadow_pending,
     // Radiance sample buffer
     GLOBAL float4* restrict output,
     GLOBAL InputMapData const* restrict input_map_values
@@ -560,19 +1544,24 @@ KERNEL void ApplyVolumeTransmissionUberV2(
 
     if (global_id < *num_rays)
     {
-        int pixel_idx = pixel_indices[global_id];
+        int ray_idx = shadow_ray_indices[global_id];
+        int pixel_idx = pixel_indices[ray_idx];
 
         // Ray might be inactive, in this case we just 
         // fail an intersection test, nothing has been added for this ray.
-        if (Ray_IsActive(&shadow_rays[global_id]))
+        if (Ray_IsActive(&shadow_rays[ray_idx]))
         {
             Scene scene =
             {
                 vertices,
                 normals,
                 uvs,
+                tangents,
                 indices,
                 shapes,
+                instances,
+                instance_transforms,
+                num_base_shapes,
                 material_attributes,
                 input_map_values,
                 0,
@@ -581,8 +1570,11 @@ KERNEL void ApplyVolumeTransmissionUberV2(
                 0
             };
 
+            // Boundary normals are fetched at the time of the shadow ray
+            scene.time = Ray_GetTime(&shadow_rays[ray_idx]);
+
             // Get pixel id for this sample set
-            int pixel_idx = pixel_indices[global_id];
+            int pixel_idx = pixel_indices[ray_idx];
             GLOBAL Path* path = &paths[pixel_idx];
             int path_volume_idx = Path_GetVolumeIdx(path);
 
@@ -594,8 +1586,8 @@ KERNEL void ApplyVolumeTransmissionUberV2(
             // we can't fail the test for them like condition above does.
             if (isects[global_id].shapeid < 0)
             {
-                Ray_SetInactive(&shadow_rays[global_id]);
-                shadow_hits[global_id] = -1;
+                Ray_SetInactive(&shadow_rays[ray_idx]);
+                shadow_hits[ray_idx] = -1;
                 return;
             }
 
@@ -608,14 +1600,14 @@ KERNEL void ApplyVolumeTransmissionUberV2(
 
             int volume_idx = Scene_GetVolumeIndex(&scene, shape_idx);
             /// @FIXME need to get material params from material_attributes
-            int layers = scene.shapes[shape_idx].material.layers;
+            int layers = Scene_GetShapeMaterial(&scene, shape_idx).layers;
 
             // If shape does not have volume, it is a surface intersection
             // and we fail a shadow test and bail out.
             if ((volume_idx == -1) || (!UberV2IsTransmissive(layers) && volume_idx != path_volume_idx))
             {
-                shadow_hits[global_id] = 1;
-                Ray_SetInactive(&shadow_rays[global_id]);
+                shadow_hits[ray_idx] = 1;
+                Ray_SetInactive(&shadow_rays[ray_idx]);
                 return;
             }
 
@@ -624,8 +1616,8 @@ KERNEL void ApplyVolumeTransmissionUberV2(
             float3 n;
             Scene_InterpolateNormalsFromIntersection(&scene, &isect, &n);
 
-            ray shadow_ray = shadow_rays[global_id];
-            float shadow_ray_throughput = Ray_GetExtra(&shadow_rays[global_id]).x;
+            ray shadow_ray = shadow_rays[ray_idx];
+            float shadow_ray_throughput = Ray_GetExtra(&shadow_rays[ray_idx]).x;
             // Now we determine if we are exiting or entering. On exit 
             // we need to apply transmittance and emission, on enter we simply update the ray origin.
             if (dot(shadow_ray.d.xyz, n) > 0.f)
@@ -635,13 +1627,27 @@ KERNEL void ApplyVolumeTransmissionUberV2(
                 // This is new ray origin after media boundary intersection
                 float3 p = shadow_ray.o.xyz + (t + CRAZY_LOW_DISTANCE) * shadow_ray.d.xyz;
 
-                // Calculate volume transmittance up to this point
-                float3 tr = Volume_Transmittance(&volumes[volume_idx], &shadow_rays[global_id], t);
-                // Calculat volume emission up to this point
-                float3 emission = Volume_Emission(&volumes[volume_idx], &shadow_rays[global_id], t);
+                float3 tr;
+                float3 emission;
+
+                if (volumes[volume_idx].type == kHeterogeneous)
+                {
+                    // Ratio tracking, emission of heterogeneous volumes is only gathered along path segments
+                    float3 segment_emission = 0.f;
+                    tr = 1.f;
+                    emission = 0.f;
+                    Volume_Track(&volumes[volume_idx], volume_grids, shadow_ray.o.xyz, shadow_ray.d.xyz, t, false, WangHash(ray_idx ^ rng_seed), &tr, &segment_emission);
+                }
+                else
+                {
+                    // Calculate volume transmittance up to this point
+                    tr = Volume_Transmittance(&volumes[volume_idx], &shadow_rays[ray_idx], t);
+                    // Calculat volume emission up to this point
+                    emission = Volume_Emission(&volumes[volume_idx], &shadow_rays[ray_idx], t);
+                }
 
                 // Multiply light sample by the transmittance of this segment
-                light_samples[global_id] *= tr;
+                vstore3(vload3(ray_idx, light_samples) * tr, ray_idx, light_samples);
 
                 // TODO: this goes directly to output, not affected by a shadow ray, fix me
                 if (length(emission) > 0.f)
@@ -651,19 +1657,21 @@ KERNEL void ApplyVolumeTransmissionUberV2(
                     ADD_FLOAT3(&output[output_index], v);
                 }
 
-                shadow_rays[global_id].o.xyz = p;
-                shadow_rays[global_id].o.w = length(old_target - p);
+                shadow_rays[ray_idx].o.xyz = p;
+                shadow_rays[ray_idx].o.w = length(old_target - p);
+                shadow_pending[global_id] = 1;
                 // TODO: we keep average throughput here since we do not have float3 available
                 float tr_avg = (tr.x + tr.y + tr.z) / 3.f;
-                Ray_SetExtra(&shadow_rays[global_id], make_float2(shadow_ray_throughput * tr_avg, 0.f));
+                Ray_SetExtra(&shadow_rays[ray_idx], make_float2(shadow_ray_throughput * tr_avg, 0.f));
             }
             else
             {
                 float3 old_target = shadow_ray.o.xyz + (shadow_ray.o.w) * shadow_ray.d.xyz;
                 float3 p = shadow_ray.o.xyz + (t + CRAZY_LOW_DISTANCE) * shadow_ray.d.xyz;
 
-                shadow_rays[global_id].o.xyz = p;
-                shadow_rays[global_id].o.w = length(old_target - p);
+                shadow_rays[ray_idx].o.xyz = p;
+                shadow_rays[ray_idx].o.w = length(old_target - p);
+                shadow_pending[global_id] = 1;
             }
         }
     }
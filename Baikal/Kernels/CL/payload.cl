@@ -55,6 +55,17 @@ typedef struct
     float aspect_ratio;
     float focus_distance;
     float aperture;
+
+    // Coordinate frame and position at shutter close, same as shutter open ones for static cameras
+    float3 motion_forward;
+    float3 motion_right;
+    float3 motion_up;
+    float3 motion_p;
+
+    // Views laid out side by side in the output, spread along the right vector
+    int num_views;
+    float view_separation;
+    int padding[2];
 } Camera;
 
 enum UberMaterialLayers
@@ -77,6 +88,19 @@ typedef struct
     int padding;
 } Material;
 
+// Geometry format of the shape
+enum ShapeFlags
+{
+    // Indices are 16 bit, startidx is given in 16 bit units
+    kShapeShortIndices = 0x1,
+    // Geometry is paged out of the device geometry cache, startidx and startvtx are not valid
+    kShapeNotResident = 0x2,
+    // Shape is a set of curve segments intersected by the renderer, startidx points to first control points of segments
+    kShapeCurves = 0x4,
+    // Curve segments are cubic B-splines of 4 control points instead of linear ones
+    kShapeBSplineCurves = 0x8
+};
+
 // Shape description
 typedef struct
 {
@@ -95,14 +119,55 @@ typedef struct
     // Transform in row major format
     matrix4x4 transform;
     Material material;
+    // ShapeFlags
+    int flags;
+    // Light link mask, lights sharing no bits with it don't illuminate the shape
+    int light_mask;
+    // Root of the curve BVH in curve nodes array for kShapeCurves shapes, -1 otherwise
+    int curve_root;
+    // Visibility mask of curves, the intersector checks it for other shapes
+    int curve_mask;
 } Shape;
 
+// Node of a curve BVH in object space of its shape. Leaves have negative child with
+// -(child + 1) being the first of count entries in curve segments array, internal
+// nodes have count set to 0 and their children next to each other starting from child.
+typedef struct
+{
+    float pmin[3];
+    int child;
+    float pmax[3];
+    int count;
+} CurveNode;
+
 typedef struct
 {
     int group_id;
     int padding[3];
 } ShapeAdditionalData;
 
+// Instance of a shape: geometry and material flags come from the base shape
+typedef struct
+{
+    // Index of the base shape in shapes array
+    int base_idx;
+    // Index of the transform in instance transforms array,
+    // each transform is 3 float4 rows of the affine matrix in row major format
+    int transform_idx;
+    // unique shape id
+    int id;
+    int volume_idx;
+    int group_id;
+    // Material override
+    int material_offset;
+    int material_layers;
+    // Light link mask
+    int light_mask;
+    // Instance motion over the shutter interval, same layout as in Shape
+    float3 linearvelocity;
+    float4 angularvelocity;
+} ShapeInstance;
+
 typedef enum
 {
     kFloat3 = 0,
@@ -125,9 +190,72 @@ typedef struct _InputMapData
             int placeholder[2];
             int type; //We can use it since float3 is actually float4
         } int_values;
+        // Row of kMatMul matrix, uses all four components
+        struct
+        {
+            float4 value;
+        } float4_value;
+        // Input map interpreter instruction, see InputMapOp
+        struct
+        {
+            int op;
+            int arg0;
+            int arg1;
+            int arg2;
+        } instruction;
     };
 } InputMapData;
 
+// Instructions of the input map interpreter used by the generic UberV2 kernels.
+// Input map data starts with a header entry: arg0 is the offset of the root table
+// and arg1 is the number of roots. Root entries are sorted by input map id (arg0)
+// and point to the first instruction (arg1). Instructions evaluate the graph in postfix order.
+enum InputMapOp
+{
+    kInputMapOpReturn = 0,
+    // Push leaf value, arg0 is the leaf entry
+    kInputMapOpConstant,
+    kInputMapOpSampler,
+    kInputMapOpSamplerBumpmap,
+    // Push folded constant, arg0 is the entry holding all four components
+    kInputMapOpConstant4,
+    // Pop b, a, push op(a, b)
+    kInputMapOpAdd,
+    kInputMapOpSub,
+    kInputMapOpMul,
+    kInputMapOpDiv,
+    kInputMapOpMin,
+    kInputMapOpMax,
+    kInputMapOpDot3,
+    kInputMapOpDot4,
+    kInputMapOpCross3,
+    kInputMapOpCross4,
+    kInputMapOpPow,
+    kInputMapOpMod,
+    // Replace top with op(top)
+    kInputMapOpSin,
+    kInputMapOpCos,
+    kInputMapOpTan,
+    kInputMapOpAsin,
+    kInputMapOpAcos,
+    kInputMapOpAtan,
+    kInputMapOpLength3,
+    kInputMapOpNormalize3,
+    kInputMapOpFloor,
+    kInputMapOpAbs,
+    // Pop control, b, a, push mix(a, b, control)
+    kInputMapOpLerp,
+    // arg0 is the component
+    kInputMapOpSelect,
+    // arg0 is the mask packed by 3 bits per component
+    kInputMapOpShuffle,
+    kInputMapOpShuffle2,
+    // arg0 is the entry of the first matrix row
+    kInputMapOpMatMul,
+    // Pop data, destination range, source range
+    kInputMapOpRemap
+};
+
 enum Bxdf
 {
     kZero,
@@ -182,6 +310,13 @@ typedef struct
     float multiplier;
     int tex_background;
     bool ibl_mirror_x;
+    // Light link mask, matched against the light mask of the shaded shape
+    int link_mask;
+    // Point and spot light intensity profile texture, -1 if there is none, and offset
+    // of its sampling distribution in the light distribution buffer
+    int profile;
+    int profile_distribution;
+    int padding2;
 } Light;
 
 typedef enum
@@ -199,6 +334,7 @@ typedef struct _Volume
 
     // Id of volume data if present
     int data;
+    // 1 if the grid of a heterogeneous volume is sparse
     int extra;
 
     // Absorbtion
@@ -215,7 +351,25 @@ enum TextureFormat
     UNKNOWN,
     RGBA8,
     RGBA16,
-    RGBA32
+    RGBA32,
+    // 4x4 blocks in row major order, see Utils/texture_compression.h
+    BC1,
+    BC5,
+    // Single and two channel formats, 16 bit ones are half floats
+    R8,
+    R16,
+    RG8,
+    RG16,
+    // UDIM set, w x h tile texture indices (-1 for missing tiles) in row major order
+    // start at textures + dataoffset, see UdimTexture
+    UDIM
+};
+
+enum TextureFlags
+{
+    // Full resolution texels are paged out of the device texture cache,
+    // the header describes the low resolution copy sampled instead
+    kTextureNotResident = 0x1
 };
 
 /// Texture description
@@ -230,7 +384,13 @@ struct _Texture
     int dataoffset;
     // Format
     int fmt;
-    int extra;
+    // Number of mip levels, level i follows level i - 1 in texture data
+    // and is max(1, w >> i) x max(1, h >> i) texels large, every level is 16 bytes aligned
+    int levels;
+    // Layer of texture images array holding a copy of the texels, -1 if the texture is only in texture data
+    int layer;
+    // TextureFlags
+    int flags;
 } Texture;
 
 // Hit data
@@ -255,7 +415,9 @@ typedef struct _DifferentialGeometry
     Material mat;
     float  area;
     int transfer_mode;
-    int padding[2];
+    // Log2 of the ray footprint in UV units, textures add log2 of their resolution to get the mip level
+    float texture_lod;
+    int padding;
 } DifferentialGeometry;
 
 
@@ -0,0 +1,467 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef PHOTON_MAP_CL
+#define PHOTON_MAP_CL
+
+#include <../Baikal/Kernels/CL/integrator_bdpt.cl>
+
+// Caustic photons are light subpaths (see GenerateLightVertices) deposited
+// at their first non-singular vertex after a chain of singular ones. Photons
+// are hashed into a uniform grid with cells of twice the gather radius, so
+// each gather visits 2x2x2 cells. Camera -> non-singular -> singular+ -> light
+// paths are skipped by the path tracer (BAIKAL_CAUSTIC_SPLIT) and taken from
+// the photon map at the first hit instead.
+
+typedef struct
+{
+    float4 p;
+    // Direction to the previous vertex
+    float4 wi;
+    float4 power;
+    // Normal on the side photon arrives from
+    float4 n;
+} Photon;
+
+INLINE int PhotonMap_GetCellHash(int3 cell, int table_mask)
+{
+    return ((cell.x * 73856093) ^ (cell.y * 19349663) ^ (cell.z * 83492791)) & table_mask;
+}
+
+INLINE int3 PhotonMap_GetCell(float3 p, float cell_size)
+{
+    return convert_int3_sat_rtn(p / cell_size);
+}
+
+///< Advance photon paths through singular vertices and store photons
+///< at the first non-singular vertex
+KERNEL void TracePhotons(
+    // Number of photon paths
+    int num_paths,
+    // Photon path rays, updated in place
+    GLOBAL ray* restrict rays,
+    // Intersection data
+    GLOBAL Intersection const* restrict isects,
+    // Vertices
+    GLOBAL float3 const* restrict vertices,
+    // Normals
+    GLOBAL SceneNormal const* restrict normals,
+    // UVs
+    GLOBAL SceneUV const* restrict uvs,
+    // Tangents
+    GLOBAL SceneTangent const* restrict tangents,
+    // Indices
+    GLOBAL int const* restrict indices,
+    // Shapes
+    GLOBAL Shape const* restrict shapes,
+    // Instances
+    GLOBAL ShapeInstance const* restrict instances,
+    // Instance transforms
+    GLOBAL float4 const* restrict instance_transforms,
+    // Number of base shapes
+    int num_base_shapes,
+    // Materials
+    GLOBAL int const* restrict material_attributes,
+    // Textures
+    TEXTURE_ARG_LIST,
+    // Environment texture index
+    int env_light_idx,
+    // Emissives
+    GLOBAL Light const* restrict lights,
+    // Light distribution
+    GLOBAL int const* restrict light_distribution,
+    // Environment light distribution
+    GLOBAL int const* restrict envmap_distribution,
+    // Number of emissive objects
+    int num_lights,
+    // RNG seed
+    uint rng_seed,
+    // Sampler states
+    GLOBAL uint const* restrict random,
+    // Sobol matrices
+    GLOBAL uint const* restrict sobol_mat,
+    // Current bounce
+    int bounce,
+    // Frame
+    int frame,
+    // Path buffer
+    GLOBAL Path* restrict paths,
+    // Photons
+    GLOBAL Photon* restrict photons,
+    // Number of stored photons
+    GLOBAL int* restrict num_photons,
+    GLOBAL InputMapData const* restrict input_map_values
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id >= num_paths)
+    {
+        return;
+    }
+
+    Scene scene =
+    {
+        vertices,
+        normals,
+        uvs,
+        tangents,
+        indices,
+        shapes,
+        instances,
+        instance_transforms,
+        num_base_shapes,
+        material_attributes,
+        input_map_values,
+        lights,
+        env_light_idx,
+        num_lights,
+        light_distribution,
+        envmap_distribution
+    };
+
+    GLOBAL Path* path = paths + global_id;
+
+    if (!Path_IsAlive(path))
+    {
+        return;
+    }
+
+    Intersection isect = isects[global_id];
+
+    // Photon escaped
+    if (isect.shapeid < 0)
+    {
+        Path_Kill(path);
+        Ray_SetInactive(rays + global_id);
+        return;
+    }
+
+    float3 wi = -normalize(rays[global_id].d.xyz);
+
+    Sampler sampler;
+#if SAMPLER == SOBOL || SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+    uint scramble = random[global_id] * 0x2c1b3c6d;
+    Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET + bounce * SAMPLE_DIMS_PER_BOUNCE, scramble);
+#elif SAMPLER == RANDOM
+    uint scramble = global_id * rng_seed;
+    Sampler_Init(&sampler, scramble);
+#elif SAMPLER == CMJ
+    uint rnd = random[global_id];
+    uint scramble = rnd * 0x2c1b3c6d * ((frame + 173 * rnd) / (CMJ_DIM * CMJ_DIM));
+    Sampler_Init(&sampler, frame % (CMJ_DIM * CMJ_DIM), SAMPLE_DIM_SURFACE_OFFSET + bounce * SAMPLE_DIMS_PER_BOUNCE, scramble);
+#endif
+
+    // Fill surface data
+    DifferentialGeometry diffgeo;
+    Scene_FillDifferentialGeometry(&scene, &isect, &diffgeo);
+
+    float ngdotwi = dot(diffgeo.ng, wi);
+    bool backfacing = ngdotwi < 0.f;
+
+    UberV2ShaderData uber_shader_data;
+    UberV2PrepareInputs(&diffgeo, input_map_values, material_attributes, TEXTURE_ARGS, &uber_shader_data);
+
+    UberV2_ApplyShadingNormal(&diffgeo, &uber_shader_data);
+    DifferentialGeometry_CalculateTangentTransforms(&diffgeo);
+
+    GetMaterialBxDFType(wi, &sampler, SAMPLER_ARGS, &diffgeo, &uber_shader_data);
+
+    // Photons hitting emitters are handled by the path tracer
+    if (Bxdf_IsEmissive(&diffgeo))
+    {
+        Path_Kill(path);
+        Ray_SetInactive(rays + global_id);
+        return;
+    }
+
+    float s = Bxdf_IsBtdf(&diffgeo) ? (-sign(ngdotwi)) : 1.f;
+    if (backfacing && !Bxdf_IsBtdf(&diffgeo))
+    {
+        diffgeo.n = -diffgeo.n;
+        diffgeo.dpdu = -diffgeo.dpdu;
+        diffgeo.dpdv = -diffgeo.dpdv;
+        s = -s;
+    }
+
+    if (!Bxdf_IsSingular(&diffgeo))
+    {
+        // Only light -> singular+ -> non-singular photons are stored,
+        // everything else is sampled well enough by the path tracer
+        if (Path_IsCaustic(path))
+        {
+            int idx = atomic_inc(num_photons);
+
+            if (idx < num_paths)
+            {
+                Photon photon;
+                photon.p = make_float4(diffgeo.p.x, diffgeo.p.y, diffgeo.p.z, 0.f);
+                photon.wi = make_float4(wi.x, wi.y, wi.z, 0.f);
+                photon.power.xyz = REASONABLE_RADIANCE(Path_GetThroughput(path));
+                photon.power.w = 0.f;
+                photon.n.xyz = backfacing ? -diffgeo.ng : diffgeo.ng;
+                photon.n.w = 0.f;
+                photons[idx] = photon;
+            }
+        }
+
+        Path_Kill(path);
+        Ray_SetInactive(rays + global_id);
+        return;
+    }
+
+    // Singular vertex, continue photon path
+    float3 bxdfwo;
+    float bxdf_pdf = 0.f;
+    float3 bxdf = UberV2_Sample(&diffgeo, wi, TEXTURE_ARGS, Sampler_Sample2D(&sampler, SAMPLER_ARGS), &bxdfwo, &bxdf_pdf, &uber_shader_data);
+
+    bxdfwo = normalize(bxdfwo);
+    float3 t = bxdf * fabs(dot(diffgeo.n, bxdfwo));
+
+    if (NON_BLACK(t) && bxdf_pdf > 0.f)
+    {
+        Path_MulThroughput(path, t / bxdf_pdf);
+        Path_SetCausticFlag(path);
+
+        float3 indirect_ray_o = diffgeo.p + CRAZY_LOW_DISTANCE * s * diffgeo.ng;
+        Ray_Init(rays + global_id, indirect_ray_o, bxdfwo, CRAZY_HIGH_DISTANCE, 0.f, VISIBILITY_MASK_ALL);
+    }
+    else
+    {
+        Path_Kill(path);
+        Ray_SetInactive(rays + global_id);
+    }
+}
+
+///< Compute grid cell hashes of stored photons for sorting
+KERNEL void HashPhotons(
+    // Photons
+    GLOBAL Photon const* restrict photons,
+    // Number of stored photons
+    int num_photons,
+    // Grid cell size
+    float cell_size,
+    // Hash table size - 1, table size is a power of two
+    int table_mask,
+    // Cell hashes
+    GLOBAL int* restrict keys,
+    // Photon indices
+    GLOBAL int* restrict values
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_photons)
+    {
+        keys[global_id] = PhotonMap_GetCellHash(PhotonMap_GetCell(photons[global_id].p.xyz, cell_size), table_mask);
+        values[global_id] = global_id;
+    }
+}
+
+///< Find ranges of sorted photons sharing a hash, cell_starts has to be filled with -1
+KERNEL void FindPhotonCells(
+    // Sorted cell hashes
+    GLOBAL int const* restrict keys,
+    // Number of stored photons
+    int num_photons,
+    // First photon of each hash
+    GLOBAL int* restrict cell_starts,
+    // One past the last photon of each hash
+    GLOBAL int* restrict cell_ends
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_photons)
+    {
+        int key = keys[global_id];
+
+        if (global_id == 0 || keys[global_id - 1] != key)
+        {
+            cell_starts[key] = global_id;
+        }
+
+        if (global_id == num_photons - 1 || keys[global_id + 1] != key)
+        {
+            cell_ends[key] = global_id + 1;
+        }
+    }
+}
+
+///< Add caustic radiance gathered from photons at the first non-singular hits
+KERNEL void GatherPhotons(
+    // Ray batch
+    GLOBAL ray const* restrict rays,
+    // Intersection data
+    GLOBAL Intersection const* restrict isects,
+    // Hit indices
+    GLOBAL int const* restrict hit_indices,
+    // Pixel indices
+    GLOBAL int const* restrict pixel_indices,
+    // Output indices
+    GLOBAL int const* restrict output_indices,
+    // Number of hits
+    GLOBAL int const* restrict num_hits,
+    // Path buffer
+    GLOBAL Path const* restrict paths,
+    // Vertices
+    GLOBAL float3 const* restrict vertices,
+    // Normals
+    GLOBAL SceneNormal const* restrict normals,
+    // UVs
+    GLOBAL SceneUV const* restrict uvs,
+    // Tangents
+    GLOBAL SceneTangent const* restrict tangents,
+    // Indices
+    GLOBAL int const* restrict indices,
+    // Shapes
+    GLOBAL Shape const* restrict shapes,
+    // Instances
+    GLOBAL ShapeInstance const* restrict instances,
+    // Instance transforms
+    GLOBAL float4 const* restrict instance_transforms,
+    // Number of base shapes
+    int num_base_shapes,
+    // Materials
+    GLOBAL int const* restrict material_attributes,
+    // Textures
+    TEXTURE_ARG_LIST,
+    // Photons
+    GLOBAL Photon const* restrict photons,
+    // Photon indices sorted by cell hash
+    GLOBAL int const* restrict photon_indices,
+    // Photon ranges of each hash
+    GLOBAL int const* restrict cell_starts,
+    GLOBAL int const* restrict cell_ends,
+    // Hash table size - 1
+    int table_mask,
+    // Gather radius
+    float radius,
+    // Photon power scale, inverse of the number of photon paths
+    float power_scale,
+    // Radiance sample buffer
+    GLOBAL float3* restrict output,
+    GLOBAL InputMapData const* restrict input_map_values
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id >= *num_hits)
+    {
+        return;
+    }
+
+    int hit_idx = hit_indices[global_id];
+    int pixel_idx = pixel_indices[global_id];
+
+    // Caustic flag is set by surface shading at non-singular first hits
+    if (!Path_IsCaustic(paths + pixel_idx))
+    {
+        return;
+    }
+
+    Scene scene =
+    {
+        vertices,
+        normals,
+        uvs,
+        tangents,
+        indices,
+        shapes,
+        instances,
+        instance_transforms,
+        num_base_shapes,
+        material_attributes,
+        input_map_values,
+        0,
+        -1,
+        0,
+        0,
+        0
+    };
+
+    Intersection isect = isects[hit_idx];
+    float3 wi = -normalize(rays[hit_idx].d.xyz);
+
+    DifferentialGeometry diffgeo;
+    Scene_FillDifferentialGeometry(&scene, &isect, &diffgeo);
+
+    UberV2ShaderData uber_shader_data;
+    UberV2PrepareInputs(&diffgeo, input_map_values, material_attributes, TEXTURE_ARGS, &uber_shader_data);
+
+    UberV2_ApplyShadingNormal(&diffgeo, &uber_shader_data);
+    DifferentialGeometry_CalculateTangentTransforms(&diffgeo);
+
+    // Photons on the other side of the surface don't contribute
+    float3 ng = dot(diffgeo.ng, wi) < 0.f ? -diffgeo.ng : diffgeo.ng;
+
+    float cell_size = 2.f * radius;
+    float radius2 = radius * radius;
+    int3 base = PhotonMap_GetCell(diffgeo.p - radius, cell_size);
+    float3 radiance = 0.f;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        int3 cell = base + make_int3(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+        int hash = PhotonMap_GetCellHash(cell, table_mask);
+        int start = cell_starts[hash];
+
+        if (start < 0)
+        {
+            continue;
+        }
+
+        // Different cells might share a hash, so the same range is visited more than once
+        bool visited = false;
+        for (int j = 0; j < i; ++j)
+        {
+            int3 other = base + make_int3(j & 1, (j >> 1) & 1, (j >> 2) & 1);
+            visited = visited || PhotonMap_GetCellHash(other, table_mask) == hash;
+        }
+
+        if (visited)
+        {
+            continue;
+        }
+
+        for (int k = start; k < cell_ends[hash]; ++k)
+        {
+            Photon photon = photons[photon_indices[k]];
+            float3 d = photon.p.xyz - diffgeo.p;
+
+            if (dot(d, d) < radius2 && dot(photon.n.xyz, ng) > 0.9f)
+            {
+                radiance += photon.power.xyz * UberV2_Evaluate(&diffgeo, wi, photon.wi.xyz, TEXTURE_ARGS, &uber_shader_data);
+            }
+        }
+    }
+
+    // Eye paths have unit throughput at their first hit
+    radiance *= power_scale / (PI * radius2);
+
+    if (NON_BLACK(radiance))
+    {
+        int output_index = output_indices[pixel_idx];
+        ADD_FLOAT3(&output[output_index], REASONABLE_RADIANCE(radiance));
+    }
+}
+
+#endif
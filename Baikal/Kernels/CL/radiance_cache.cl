@@ -0,0 +1,134 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef RADIANCE_CACHE_CL
+#define RADIANCE_CACHE_CL
+
+#include <../Baikal/Kernels/CL/common.cl>
+#include <../Baikal/Kernels/CL/utils.cl>
+#include <../Baikal/Kernels/CL/sampling.cl>
+
+// Radiance cache keeps outgoing radiance of surface points in a hash table
+// addressed by the world space cell of the point and the dominant axis of its
+// normal. Table keys are 32 bit hashes of the cell, 0 marks an empty slot and
+// collisions are resolved by linear probing. Paths past their first non-singular
+// vertex take the radiance from the cache instead of tracing further, except for
+// training paths, which are traced in full and splat the radiance gathered past
+// each vertex into the cache at the end of the estimate.
+#define RADIANCE_CACHE_MAX_PROBES 8
+// Every RADIANCE_CACHE_TRAINING_STRIDE-th path trains the cache, the set shifts every frame
+#define RADIANCE_CACHE_TRAINING_STRIDE 16
+// Number of first path vertices a training path records
+#define RADIANCE_CACHE_MAX_VERTICES 4
+// Resolved radiance is a running average over this number of last samples at most,
+// so the cache follows changes in lighting which do not alter the scene revision
+#define RADIANCE_CACHE_MAX_SAMPLES 64.f
+
+// Vertex of a training path
+typedef struct
+{
+    // Cache key of the vertex, 0 if the vertex is not recorded
+    uint key;
+    int padding[3];
+    // Path throughput on arrival to the vertex
+    float4 throughput;
+    // Output value on arrival to the vertex
+    float4 radiance;
+} RadianceCacheVertex;
+
+INLINE uint RadianceCache_GetKey(float3 p, float3 n, float cell_size)
+{
+    int3 cell = convert_int3_sat_rtn(p / cell_size);
+
+    // Opposite sides of thin geometry fall into different entries
+    float3 a = fabs(n);
+    int axis = (a.x > a.y && a.x > a.z) ? 0 : (a.y > a.z ? 1 : 2);
+    float c = axis == 0 ? n.x : (axis == 1 ? n.y : n.z);
+    uint side = 2 * axis + (c < 0.f ? 1 : 0);
+
+    uint key = WangHash(side);
+    key = WangHash(key ^ (uint)cell.x);
+    key = WangHash(key ^ (uint)cell.y);
+    key = WangHash(key ^ (uint)cell.z);
+    return max(key, 1u);
+}
+
+// Index of the training path record, -1 if the path does not train the cache in this frame
+INLINE int RadianceCache_GetTrainingIndex(int pixel_idx, int frame)
+{
+    return (pixel_idx % RADIANCE_CACHE_TRAINING_STRIDE == frame % RADIANCE_CACHE_TRAINING_STRIDE) ?
+        pixel_idx / RADIANCE_CACHE_TRAINING_STRIDE : -1;
+}
+
+// Fetch resolved radiance of the entry, false if there is none or it has no samples yet
+INLINE bool RadianceCache_Lookup(GLOBAL uint const* keys, GLOBAL float4 const* radiance, int mask, uint key, float3* value)
+{
+    for (int i = 0; i < RADIANCE_CACHE_MAX_PROBES; ++i)
+    {
+        int slot = (int)((key + i) & (uint)mask);
+        uint slot_key = keys[slot];
+
+        if (slot_key == key)
+        {
+            float4 r = radiance[slot];
+            *value = r.xyz;
+            return r.w > 0.f;
+        }
+
+        if (slot_key == 0u)
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+// Find or allocate the entry, -1 if the probe sequence is full
+INLINE int RadianceCache_Insert(GLOBAL uint* keys, int mask, uint key)
+{
+    for (int i = 0; i < RADIANCE_CACHE_MAX_PROBES; ++i)
+    {
+        int slot = (int)((key + i) & (uint)mask);
+        uint slot_key = atomic_cmpxchg((volatile GLOBAL uint*)(keys + slot), 0u, key);
+
+        if (slot_key == 0u || slot_key == key)
+        {
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+// Remember the entry a training path has reached along with its throughput and the output so far
+INLINE void RadianceCache_RecordVertex(GLOBAL RadianceCacheVertex* vertices, int training_idx, int bounce, uint key, float3 throughput, float3 radiance)
+{
+    if (bounce < RADIANCE_CACHE_MAX_VERTICES)
+    {
+        GLOBAL RadianceCacheVertex* vertex = vertices + training_idx * RADIANCE_CACHE_MAX_VERTICES + bounce;
+        vertex->key = key;
+        vertex->throughput = make_float4(throughput.x, throughput.y, throughput.z, 0.f);
+        vertex->radiance = make_float4(radiance.x, radiance.y, radiance.z, 0.f);
+    }
+}
+
+#endif // RADIANCE_CACHE_CL
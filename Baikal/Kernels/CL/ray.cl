@@ -71,7 +71,30 @@ INLINE float2 Ray_GetExtra(GLOBAL ray const* r)
     return r->padding;
 }
 
+// Set ray cone used for texture filtering: x - cone width at the ray origin, y - spread angle.
+// Cone is stored in half precision in the second component of extra data, so it has to be set after Ray_SetExtra.
+INLINE void Ray_SetCone(GLOBAL ray* r, float2 cone)
+{
+    vstore_half2(cone, 1, (GLOBAL half*)&r->padding);
+}
+
+// Get ray cone
+INLINE float2 Ray_GetCone(GLOBAL ray const* r)
+{
+    return vload_half2(1, (GLOBAL half const*)&r->padding);
+}
+
 // Initialize ray structure
+// Get ray time over the shutter interval, rays are only spread over it with motion blur
+INLINE float Ray_GetTime(GLOBAL ray const* r)
+{
+#ifdef BAIKAL_MOTION_BLUR
+    return r->d.w;
+#else
+    return 0.f;
+#endif
+}
+
 INLINE void Ray_Init(GLOBAL ray* r, float3 o, float3 d, float maxt, float time, int mask)
 {
     r->o.xyz = o;
@@ -22,6 +22,7 @@ THE SOFTWARE.
 #ifndef SAMPLING_CL
 #define SAMPLING_CL
 
+#include <../Baikal/Kernels/CL/common.cl>
 #include <../Baikal/Kernels/CL/utils.cl>
 
 #define SAMPLE_DIMS_PER_BOUNCE 300
@@ -30,6 +31,8 @@ THE SOFTWARE.
 #define SAMPLE_DIM_VOLUME_APPLY_OFFSET 101
 #define SAMPLE_DIM_VOLUME_EVALUATE_OFFSET 201
 #define SAMPLE_DIM_IMG_PLANE_EVALUATE_OFFSET 401
+// Camera samples are only taken at the first bounce, so the second bounce camera dimensions are free
+#define SAMPLE_DIM_CAMERA_TIME (SAMPLE_DIMS_PER_BOUNCE + SAMPLE_DIM_CAMERA_OFFSET)
 
 typedef struct
 {
@@ -47,7 +50,7 @@ typedef struct _Sampler
     uint padding;
 } Sampler;
 
-#if SAMPLER == SOBOL
+#if SAMPLER == SOBOL || SAMPLER == BLUE_NOISE_SOBOL
 #define SAMPLER_ARG_LIST __global uint const* sobol_mat
 #define SAMPLER_ARGS sobol_mat
 #elif SAMPLER == RANDOM
@@ -56,6 +59,9 @@ typedef struct _Sampler
 #elif SAMPLER == CMJ
 #define SAMPLER_ARG_LIST int unused
 #define SAMPLER_ARGS 0
+#elif SAMPLER == OWEN_SOBOL
+#define SAMPLER_ARG_LIST int unused
+#define SAMPLER_ARGS 0
 #endif
 
 /**
@@ -78,6 +84,28 @@ float SobolSampler_Sample1D(Sampler* sampler, __global uint const* mat)
     return result * (1.f / (1UL << 32));
 }
 
+/**
+    Blue noise dithered Sobol sampler
+**/
+
+// Sobol points are toroidally shifted by per-pixel blue noise value (passed as scramble),
+// so the error of the first samples is distributed as blue noise in screen space.
+// Shifts of different dimensions are decorrelated with golden ratio offsets.
+float BlueNoiseSobolSampler_Sample1D(Sampler* sampler, __global uint const* mat)
+{
+    uint result = 0;
+    uint index = sampler->index;
+    for (uint i = sampler->dimension * MATSIZE; index;  index >>= 1, ++i)
+    {
+        if (index & 1)
+            result ^= mat[i];
+    }
+
+    result += sampler->scramble + sampler->dimension * 0x9e3779b9;
+
+    return result * (1.f / (1UL << 32));
+}
+
 /**
     Random sampler
 **/
@@ -107,6 +135,89 @@ float UniformSampler_Sample1D(Sampler* sampler)
 }
 
 
+/**
+    Owen scrambled Sobol sampler
+**/
+
+// Hash based Owen scrambling, see B. Burley: "Practical Hash-based Owen Scrambling", JCGT 2020.
+// Direction numbers are only kept for 4 dimensions, higher dimensions are padded
+// with scrambled 4D sets, so no matrices are read from global memory.
+#define OWEN_SOBOL_DIMS 4
+
+__constant uint g_owen_sobol_directions[OWEN_SOBOL_DIMS * 32] =
+{
+    // Dimension 0
+    0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000,
+    0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000,
+    0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100,
+    0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001,
+    // Dimension 1
+    0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+    0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+    0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+    0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff,
+    // Dimension 2
+    0x80000000, 0xc0000000, 0x60000000, 0x90000000, 0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000,
+    0x68800000, 0x9cc00000, 0xee600000, 0x55900000, 0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000,
+    0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000, 0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500,
+    0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590, 0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555,
+    // Dimension 3
+    0x80000000, 0xc0000000, 0x20000000, 0x50000000, 0xf8000000, 0x74000000, 0xa2000000, 0x93000000,
+    0xd8800000, 0x25400000, 0x59e00000, 0xe6d00000, 0x78080000, 0xb40c0000, 0x82020000, 0xc3050000,
+    0x208f8000, 0x51474000, 0xfbea2000, 0x75d93000, 0xa0858800, 0x914e5400, 0xdbe79e00, 0x25db6d00,
+    0x58800080, 0xe54000c0, 0x79e00020, 0xb6d00050, 0x800800f8, 0xc00c0074, 0x200200a2, 0x50050093
+};
+
+uint ReverseBits(uint x)
+{
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+    x = ((x >> 8) & 0x00ff00ff) | ((x & 0x00ff00ff) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+uint HashCombine(uint seed, uint v)
+{
+    return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+/// Owen scramble bits of x, i.e. flip each bit depending on the hash of all higher bits
+uint NestedUniformScramble(uint x, uint seed)
+{
+    x = ReverseBits(x);
+
+    // Laine-Karras style permutation with Burley's constants
+    x ^= x * 0x3d20adea;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56;
+    x ^= x * 0x53a22864;
+
+    return ReverseBits(x);
+}
+
+float OwenSobolSampler_Sample1D(Sampler* sampler)
+{
+    uint dimension = sampler->dimension;
+
+    // Each group of 4 dimensions gets its own shuffled sample order
+    uint index = NestedUniformScramble(sampler->index, HashCombine(sampler->scramble, dimension / OWEN_SOBOL_DIMS));
+
+    __constant uint const* directions = g_owen_sobol_directions + (dimension % OWEN_SOBOL_DIMS) * 32;
+
+    uint result = 0;
+    for (uint i = 0; index; index >>= 1, ++i)
+    {
+        if (index & 1)
+            result ^= directions[i];
+    }
+
+    result = NestedUniformScramble(result, HashCombine(sampler->scramble, WangHash(dimension + 1)));
+
+    return result * (1.f / (1UL << 32));
+}
+
 /**
     Correllated multi-jittered 
 **/
@@ -176,7 +287,7 @@ float2 CmjSampler_Sample2D(Sampler* sampler)
     return cmj(idx, CMJ_DIM, sampler->dimension * sampler->scramble);
 }
 
-#if SAMPLER == SOBOL
+#if SAMPLER == SOBOL || SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
 void Sampler_Init(Sampler* sampler, uint index, uint start_dimension, uint scramble)
 {
     sampler->index = index;
@@ -209,6 +320,13 @@ float2 Sampler_Sample2D(Sampler* sampler, SAMPLER_ARG_LIST)
     sample.y = SobolSampler_Sample1D(sampler, SAMPLER_ARGS);
     ++(sampler->dimension);
     return sample;
+#elif SAMPLER == BLUE_NOISE_SOBOL
+    float2 sample;
+    sample.x = BlueNoiseSobolSampler_Sample1D(sampler, SAMPLER_ARGS);
+    ++(sampler->dimension);
+    sample.y = BlueNoiseSobolSampler_Sample1D(sampler, SAMPLER_ARGS);
+    ++(sampler->dimension);
+    return sample;
 #elif SAMPLER == RANDOM
     float2 sample;
     sample.x = UniformSampler_Sample1D(sampler);
@@ -219,6 +337,13 @@ float2 Sampler_Sample2D(Sampler* sampler, SAMPLER_ARG_LIST)
     sample = CmjSampler_Sample2D(sampler);
     ++(sampler->dimension);
     return sample;
+#elif SAMPLER == OWEN_SOBOL
+    float2 sample;
+    sample.x = OwenSobolSampler_Sample1D(sampler);
+    ++(sampler->dimension);
+    sample.y = OwenSobolSampler_Sample1D(sampler);
+    ++(sampler->dimension);
+    return sample;
 #endif
 }
 
@@ -228,6 +353,10 @@ float Sampler_Sample1D(Sampler* sampler, SAMPLER_ARG_LIST)
     float sample = SobolSampler_Sample1D(sampler, SAMPLER_ARGS);
     ++(sampler->dimension);
     return sample;
+#elif SAMPLER == BLUE_NOISE_SOBOL
+    float sample = BlueNoiseSobolSampler_Sample1D(sampler, SAMPLER_ARGS);
+    ++(sampler->dimension);
+    return sample;
 #elif SAMPLER == RANDOM
     return UniformSampler_Sample1D(sampler);
 #elif SAMPLER == CMJ
@@ -235,6 +364,10 @@ float Sampler_Sample1D(Sampler* sampler, SAMPLER_ARG_LIST)
     sample = CmjSampler_Sample2D(sampler);
     ++(sampler->dimension);
     return sample.x;
+#elif SAMPLER == OWEN_SOBOL
+    float sample = OwenSobolSampler_Sample1D(sampler);
+    ++(sampler->dimension);
+    return sample;
 #endif
 }
 
@@ -258,15 +391,35 @@ float3 Sample_MapToHemisphere(
     float r2 = sample.y;
     
     // Transform to spherical coordinates
-    float sinpsi = sin(2*PI*r1);
-    float cospsi = cos(2*PI*r1);
-    float costheta = pow(1.f - r2, 1.f/(e + 1.f));
-    float sintheta = sqrt(1.f - costheta * costheta);
+    float sinpsi = FAST_SIN(2*PI*r1);
+    float cospsi = FAST_COS(2*PI*r1);
+    float costheta = FAST_POWR(1.f - r2, 1.f/(e + 1.f));
+    float sintheta = FAST_SQRT(1.f - costheta * costheta);
     
     // Return the result
     return normalize(u * sintheta * cospsi + v * sintheta * sinpsi + n * costheta);
 }
 
+/// Sample directions uniformly within cos_max of n
+float3 Sample_MapToCone(
+                        // Sample
+                        float2 sample,
+                        // Cone axis
+                        float3 n,
+                        // Cosine of cone half angle
+                        float cos_max
+                        )
+{
+    float3 u = GetOrthoVector(n);
+    float3 v = cross(u, n);
+
+    float costheta = 1.f - sample.x * (1.f - cos_max);
+    float sintheta = FAST_SQRT(max(0.f, 1.f - costheta * costheta));
+    float psi = 2.f * PI * sample.y;
+
+    return normalize(u * sintheta * FAST_COS(psi) + v * sintheta * FAST_SIN(psi) + n * costheta);
+}
+
 float2 Sample_MapToDisk(
     // Sample
     float2 sample
@@ -311,8 +464,8 @@ float3 Sample_MapToSphere(
     float z = 1.f - 2.f * sample.x;
     float r = native_sqrt(max(0.f, 1.f - z*z));
     float phi = 2.f * PI * sample.y;
-    float x = cos(phi);
-    float y = sin(phi);
+    float x = FAST_COS(phi);
+    float y = FAST_SIN(phi);
     
     // Return the result
     return make_float3(x,y,z);
@@ -330,6 +483,57 @@ float2 Sample_MapToPolygon(int n, float2 sample, float sample1)
     return u*v1 + v*v2;;
 }
 
+#ifdef BAIKAL_PIXEL_FILTER
+#define PIXEL_FILTER_GAUSSIAN 1
+#define PIXEL_FILTER_BLACKMAN_HARRIS 2
+
+/// Invert normalized Blackman-Harris window CDF over [0, 1]
+float Sample_BlackmanHarris(float sample)
+{
+    float const a0 = 0.35875f;
+    float const a1 = 0.48829f;
+    float const a2 = 0.14128f;
+    float const a3 = 0.01168f;
+
+    // Newton iterations safeguarded by bisection, CDF is monotonic
+    float lo = 0.f;
+    float hi = 1.f;
+    float t = sample;
+
+    for (int i = 0; i < 10; ++i)
+    {
+        float phi = 2.f * PI * t;
+        float cdf = (a0 * t - a1 * sin(phi) / (2.f * PI) + a2 * sin(2.f * phi) / (4.f * PI) - a3 * sin(3.f * phi) / (6.f * PI)) / a0;
+        float pdf = (a0 - a1 * cos(phi) + a2 * cos(2.f * phi) - a3 * cos(3.f * phi)) / a0;
+
+        if (cdf < sample) lo = t; else hi = t;
+
+        float next = pdf > 0.f ? t - (cdf - sample) / pdf : -1.f;
+        t = (next >= lo && next <= hi) ? next : 0.5f * (lo + hi);
+    }
+
+    return t;
+}
+
+/// Map sample to pixel filter footprint, returns offset from pixel center in pixels
+float2 Sample_PixelFilter(float2 sample)
+{
+    float const radius = BAIKAL_PIXEL_FILTER_RADIUS;
+#if BAIKAL_PIXEL_FILTER == PIXEL_FILTER_GAUSSIAN
+    // Radially symmetric Gaussian truncated at 3 sigma
+    float const sigma = radius / 3.f;
+    float r = sigma * FAST_SQRT(-2.f * FAST_LOG(1.f - sample.x * (1.f - exp(-4.5f))));
+    float phi = 2.f * PI * sample.y;
+    return make_float2(r * FAST_COS(phi), r * FAST_SIN(phi));
+#elif BAIKAL_PIXEL_FILTER == PIXEL_FILTER_BLACKMAN_HARRIS
+    // Separable window spanning the filter diameter
+    return radius * make_float2(2.f * Sample_BlackmanHarris(sample.x) - 1.f, 2.f * Sample_BlackmanHarris(sample.y) - 1.f);
+#else
+    return sample - make_float2(0.5f, 0.5f);
+#endif
+}
+#endif
+
 /// Power heuristic for multiple importance sampling
 float PowerHeuristic(int nf, float fpdf, int ng, float gpdf)
 {
@@ -371,6 +575,43 @@ int lower_bound(GLOBAL float const* values, int n, float value)
 
     return b;
 }
+
+/*
+ Distribution1D layout: number of segments N, N + 1 CDF values, N PDF values,
+ N alias probabilities and N alias segment indices.
+ */
+int Distribution1D_GetSize(int num_segments)
+{
+    return 1 + (num_segments + 1) + 3 * num_segments;
+}
+
+/// Pick segment of 1D distribution in constant time using its alias table,
+/// du is the uniformly distributed position within the picked segment
+int Distribution1D_SampleSegment(float s, GLOBAL int const* data, float* du)
+{
+    int num_segments = data[0];
+
+    GLOBAL float const* alias_probabilities = (GLOBAL float const*)&data[1] + 2 * num_segments + 1;
+    GLOBAL int const* aliases = (GLOBAL int const*)(alias_probabilities + num_segments);
+
+    // Clamp as 1 may be passed
+    float x = s * num_segments;
+    int segment_idx = clamp((int)x, 0, num_segments - 1);
+    float remainder = min(x - segment_idx, 0.99999994f);
+
+    float alias_probability = alias_probabilities[segment_idx];
+
+    // Remap the remainder to the position within the picked segment
+    if (remainder < alias_probability)
+    {
+        *du = min(remainder / alias_probability, 0.99999994f);
+        return segment_idx;
+    }
+
+    *du = min((remainder - alias_probability) / (1.f - alias_probability), 0.99999994f);
+    return aliases[segment_idx];
+}
+
 /// Sample 1D distribution
 float Distribution1D_Sample(float s, GLOBAL int const* data, float* pdf)
 {
@@ -379,15 +620,13 @@ float Distribution1D_Sample(float s, GLOBAL int const* data, float* pdf)
     GLOBAL float const* cdf_data = (GLOBAL float const*)&data[1];
     GLOBAL float const* pdf_data = cdf_data + num_segments + 1;
 
-    int segment_idx = max(lower_bound(cdf_data, num_segments + 1, s), 1);
-
-    // Find lerp coefficient
-    float du = (s - cdf_data[segment_idx - 1]) / (cdf_data[segment_idx] - cdf_data[segment_idx - 1]);
+    float du;
+    int segment_idx = Distribution1D_SampleSegment(s, data, &du);
 
     // Calc pdf
-    *pdf = pdf_data[segment_idx - 1];
+    *pdf = pdf_data[segment_idx];
 
-    return (segment_idx - 1 + du) / num_segments;;
+    return (segment_idx + du) / num_segments;
 }
 
 /// Sample 1D distribution
@@ -398,15 +637,13 @@ int Distribution1D_SampleDiscrete(float s, GLOBAL int const* data, float* pdf)
     GLOBAL float const* cdf_data = (GLOBAL float const*)&data[1];
     GLOBAL float const* pdf_data = cdf_data + num_segments + 1;
 
-    int segment_idx = max(lower_bound(cdf_data, num_segments + 1, s), 1);
-
-    // Find lerp coefficient
-    float du = (s - cdf_data[segment_idx - 1]) / (cdf_data[segment_idx] - cdf_data[segment_idx - 1]);
+    float du;
+    int segment_idx = Distribution1D_SampleSegment(s, data, &du);
 
     // Calc pdf
-    *pdf = pdf_data[segment_idx - 1] / num_segments;
+    *pdf = pdf_data[segment_idx] / num_segments;
 
-    return segment_idx - 1;
+    return segment_idx;
 }
 
 /// PDF of  1D distribution
@@ -416,10 +653,10 @@ float Distribution1D_GetPdf(float s, GLOBAL int const* data)
     GLOBAL float const* cdf_data = (GLOBAL float const*)&data[1];
     GLOBAL float const* pdf_data = cdf_data + num_segments + 1;
 
-    int segment_idx = max(lower_bound(cdf_data, num_segments + 1, s), 1);
+    int segment_idx = clamp((int)(s * num_segments), 0, num_segments - 1);
 
     // Calc pdf
-    return pdf_data[segment_idx - 1];
+    return pdf_data[segment_idx];
 }
 
 /// PDF of  1D distribution
@@ -433,6 +670,56 @@ float Distribution1D_GetPdfDiscreet(int d, GLOBAL int const* data)
     return pdf_data[d] / num_segments;
 }
 
+/// Build alias table of 1D distribution from its PDF values, run by a single work-item.
+/// Small and large segments are swept in index order, as in host Distribution1D::BuildAliasTable
+void Distribution1D_BuildAliasTable(GLOBAL int* data)
+{
+    int num_segments = data[0];
+
+    GLOBAL float const* pdf_data = (GLOBAL float const*)&data[1] + num_segments + 1;
+    GLOBAL float* alias_probabilities = (GLOBAL float*)&data[1] + 2 * num_segments + 1;
+    GLOBAL int* aliases = (GLOBAL int*)(alias_probabilities + num_segments);
+
+    for (int i = 0; i < num_segments; ++i)
+    {
+        alias_probabilities[i] = pdf_data[i];
+        aliases[i] = i;
+    }
+
+    int small = 0;
+    while (small < num_segments && alias_probabilities[small] >= 1.f) ++small;
+    int large = 0;
+    while (large < num_segments && alias_probabilities[large] < 1.f) ++large;
+    int current = small;
+
+    while (current < num_segments && large < num_segments)
+    {
+        // Fill the rest of the current segment from the large one
+        aliases[current] = large;
+        alias_probabilities[large] -= 1.f - alias_probabilities[current];
+
+        bool demoted = alias_probabilities[large] < 1.f;
+
+        if (demoted && large < small)
+        {
+            // Sweep has already passed the segment, so it is filled right away
+            current = large;
+        }
+        else
+        {
+            ++small;
+            while (small < num_segments && alias_probabilities[small] >= 1.f) ++small;
+            current = small;
+        }
+
+        if (demoted)
+        {
+            ++large;
+            while (large < num_segments && alias_probabilities[large] < 1.f) ++large;
+        }
+    }
+}
+
 
 
 #endif // SAMPLING_CL
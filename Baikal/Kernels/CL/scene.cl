@@ -25,19 +25,40 @@ THE SOFTWARE.
 #include <../Baikal/Kernels/CL/common.cl>
 #include <../Baikal/Kernels/CL/utils.cl>
 #include <../Baikal/Kernels/CL/payload.cl>
+#include <../Baikal/Kernels/CL/curves.cl>
+
+#ifdef BAIKAL_COMPRESSED_GEOMETRY
+// Octahedral encoded normal, x and y are 16 bit snorm values in low and high halves
+typedef uint SceneNormal;
+// Half precision UV pair
+typedef uint SceneUV;
+#else
+typedef float3 SceneNormal;
+typedef float2 SceneUV;
+#endif
+// Octahedral encoded tangent, the lowest bit holds bitangent sign (set if negative)
+typedef uint SceneTangent;
 
 typedef struct
 {
     // Vertices
     GLOBAL float3 const* restrict vertices;
     // Normals
-    GLOBAL float3 const* restrict normals;
+    GLOBAL SceneNormal const* restrict normals;
     // UVs
-    GLOBAL float2 const* restrict uvs;
+    GLOBAL SceneUV const* restrict uvs;
+    // Tangents
+    GLOBAL SceneTangent const* restrict tangents;
     // Indices
     GLOBAL int const* restrict indices;
     // Shapes
     GLOBAL Shape const* restrict shapes;
+    // Instances of base shapes
+    GLOBAL ShapeInstance const* restrict instances;
+    // Instance transforms, 3 rows per instance
+    GLOBAL float4 const* restrict instance_transforms;
+    // Number of shapes in shapes array, indices past it refer to instances
+    int num_base_shapes;
     // Material attributes
     GLOBAL int const* restrict material_attributes;
     // Input map values
@@ -50,18 +71,208 @@ typedef struct
     int num_lights;
     // Light distribution 
     GLOBAL int const* restrict light_distribution;
+    // Environment light distribution
+    GLOBAL int const* restrict envmap_distribution;
+    // Ray time over the shutter interval, initializers leave it at shutter open
+    float time;
+    // Per base shape use flags for the geometry cache, null unless the kernel reports geometry use
+    GLOBAL int* restrict geometry_requests;
 } Scene;
 
+#ifdef BAIKAL_MOTION_BLUR
+// Move shape transform to the given time of the shutter interval, rotation is
+// interpolated along the shortest arc around the shape origin
+INLINE void Shape_ApplyMotion(Shape* shape, float time)
+{
+    float4 q = shape->angularvelocity;
+    q = q.w < 0.f ? -q : q;
+
+    float s = length(q.xyz);
+    if (s > 0.f)
+    {
+        float half_angle = time * atan2(s, q.w);
+        float4 qt = (float4)(q.xyz * (sin(half_angle) / s), cos(half_angle));
+
+        float3 c0 = quaternion_rotate(qt, make_float3(shape->transform.m0.x, shape->transform.m1.x, shape->transform.m2.x));
+        float3 c1 = quaternion_rotate(qt, make_float3(shape->transform.m0.y, shape->transform.m1.y, shape->transform.m2.y));
+        float3 c2 = quaternion_rotate(qt, make_float3(shape->transform.m0.z, shape->transform.m1.z, shape->transform.m2.z));
+
+        shape->transform.m0.xyz = make_float3(c0.x, c1.x, c2.x);
+        shape->transform.m1.xyz = make_float3(c0.y, c1.y, c2.y);
+        shape->transform.m2.xyz = make_float3(c0.z, c1.z, c2.z);
+    }
+
+    shape->transform.m0.w += time * shape->linearvelocity.x;
+    shape->transform.m1.w += time * shape->linearvelocity.y;
+    shape->transform.m2.w += time * shape->linearvelocity.z;
+}
+#endif
+
+// Get shape given scene and shape index, instances are expanded from their base shape
+INLINE Shape Scene_GetShape(Scene const* scene, int shape_idx)
+{
+    if (shape_idx < scene->num_base_shapes)
+    {
+#ifdef BAIKAL_MOTION_BLUR
+        Shape shape = scene->shapes[shape_idx];
+        Shape_ApplyMotion(&shape, scene->time);
+        return shape;
+#else
+        return scene->shapes[shape_idx];
+#endif
+    }
+
+    ShapeInstance instance = scene->instances[shape_idx - scene->num_base_shapes];
+    Shape shape = scene->shapes[instance.base_idx];
+
+    shape.id = instance.id;
+    shape.volume_idx = instance.volume_idx;
+    shape.material.offset = instance.material_offset;
+    shape.material.layers = instance.material_layers;
+
+    shape.transform.m0 = scene->instance_transforms[3 * instance.transform_idx];
+    shape.transform.m1 = scene->instance_transforms[3 * instance.transform_idx + 1];
+    shape.transform.m2 = scene->instance_transforms[3 * instance.transform_idx + 2];
+    shape.transform.m3 = make_float4(0.f, 0.f, 0.f, 1.f);
+
+#ifdef BAIKAL_MOTION_BLUR
+    shape.linearvelocity = instance.linearvelocity;
+    shape.angularvelocity = instance.angularvelocity;
+    Shape_ApplyMotion(&shape, scene->time);
+#endif
+
+    return shape;
+}
+
+// Get shape material without fetching the rest of shape data
+INLINE Material Scene_GetShapeMaterial(Scene const* scene, int shape_idx)
+{
+    if (shape_idx < scene->num_base_shapes)
+    {
+        return scene->shapes[shape_idx].material;
+    }
+
+    ShapeInstance instance = scene->instances[shape_idx - scene->num_base_shapes];
+    Material material = scene->shapes[instance.base_idx].material;
+    material.offset = instance.material_offset;
+    material.layers = instance.material_layers;
+    return material;
+}
+
+// Get light link mask of the shape, instances have their own one
+INLINE int Scene_GetShapeLightMask(Scene const* scene, int shape_idx)
+{
+    return shape_idx < scene->num_base_shapes ?
+        scene->shapes[shape_idx].light_mask :
+        scene->instances[shape_idx - scene->num_base_shapes].light_mask;
+}
+
+// Get unique id of the shape
+INLINE int Scene_GetShapeId(Scene const* scene, int shape_idx)
+{
+    return shape_idx < scene->num_base_shapes ?
+        scene->shapes[shape_idx].id :
+        scene->instances[shape_idx - scene->num_base_shapes].id;
+}
+
+// Get index of the base shape owning shape geometry, instances share it with their base shape
+INLINE int Scene_GetBaseShapeIndex(Scene const* scene, int shape_idx)
+{
+    return shape_idx < scene->num_base_shapes ?
+        shape_idx :
+        scene->instances[shape_idx - scene->num_base_shapes].base_idx;
+}
+
+// False if shape geometry is not in the device geometry cache
+INLINE bool Scene_IsShapeResident(Scene const* scene, int shape_idx)
+{
+    return (scene->shapes[Scene_GetBaseShapeIndex(scene, shape_idx)].flags & kShapeNotResident) == 0;
+}
+
+// Report use of the shape geometry to the geometry cache, returns false if the geometry is paged out
+INLINE bool Scene_RequestShapeGeometry(Scene const* scene, int shape_idx)
+{
+    int base_shape_idx = Scene_GetBaseShapeIndex(scene, shape_idx);
+
+    if (scene->geometry_requests && scene->geometry_requests[base_shape_idx] == 0)
+    {
+        scene->geometry_requests[base_shape_idx] = 1;
+    }
+
+    return (scene->shapes[base_shape_idx].flags & kShapeNotResident) == 0;
+}
+
+// Fetch triangle indices of the shape
+INLINE void Scene_GetTriangleIndices(Scene const* scene, Shape const* shape, int prim_idx, int* i0, int* i1, int* i2)
+{
+    // Paged out shapes and curves are degenerate, so kernels which do not check residency stay in bounds
+    if (shape->flags & (kShapeNotResident | kShapeCurves))
+    {
+        *i0 = *i1 = *i2 = 0;
+        return;
+    }
+
+#ifdef BAIKAL_COMPRESSED_GEOMETRY
+    if (shape->flags & kShapeShortIndices)
+    {
+        GLOBAL ushort const* indices = (GLOBAL ushort const*)scene->indices;
+        *i0 = indices[shape->startidx + 3 * prim_idx];
+        *i1 = indices[shape->startidx + 3 * prim_idx + 1];
+        *i2 = indices[shape->startidx + 3 * prim_idx + 2];
+        return;
+    }
+#endif
+
+    *i0 = scene->indices[shape->startidx + 3 * prim_idx];
+    *i1 = scene->indices[shape->startidx + 3 * prim_idx + 1];
+    *i2 = scene->indices[shape->startidx + 3 * prim_idx + 2];
+}
+
+// Decode octahedral encoded unit vector, x and y are 16 bit snorm values in low and high halves
+INLINE float3 Scene_DecodeOctahedral(uint packed)
+{
+    float2 e = max(make_float2(as_short((ushort)(packed & 0xffffu)), as_short((ushort)(packed >> 16))) / 32767.f, -1.f);
+    float3 n = make_float3(e.x, e.y, 1.f - fabs(e.x) - fabs(e.y));
+
+    // Lower hemisphere is folded over the diagonals
+    if (n.z < 0.f)
+    {
+        n.x = (1.f - fabs(e.y)) * (e.x >= 0.f ? 1.f : -1.f);
+        n.y = (1.f - fabs(e.x)) * (e.y >= 0.f ? 1.f : -1.f);
+    }
+
+    return normalize(n);
+}
+
+// Fetch object space normal of the vertex
+INLINE float3 Scene_GetNormal(Scene const* scene, int vertex_idx)
+{
+#ifdef BAIKAL_COMPRESSED_GEOMETRY
+    return Scene_DecodeOctahedral(scene->normals[vertex_idx]);
+#else
+    return scene->normals[vertex_idx];
+#endif
+}
+
+// Fetch UV of the vertex
+INLINE float2 Scene_GetUV(Scene const* scene, int vertex_idx)
+{
+#ifdef BAIKAL_COMPRESSED_GEOMETRY
+    return vload_half2(vertex_idx, (GLOBAL half const*)scene->uvs);
+#else
+    return scene->uvs[vertex_idx];
+#endif
+}
+
 // Get triangle vertices given scene, shape index and prim index
 INLINE void Scene_GetTriangleVertices(Scene const* scene, int shape_idx, int prim_idx, float3* v0, float3* v1, float3* v2)
 {
     // Extract shape data
-    Shape shape = scene->shapes[shape_idx];
+    Shape shape = Scene_GetShape(scene, shape_idx);
 
     // Fetch indices starting from startidx and offset by prim_idx
-    int i0 = scene->indices[shape.startidx + 3 * prim_idx];
-    int i1 = scene->indices[shape.startidx + 3 * prim_idx + 1];
-    int i2 = scene->indices[shape.startidx + 3 * prim_idx + 2];
+    int i0, i1, i2;
+    Scene_GetTriangleIndices(scene, &shape, prim_idx, &i0, &i1, &i2);
 
     // Fetch positions and transform to world space
     *v0 = matrix_mul_point3(shape.transform, scene->vertices[shape.startvtx + i0]);
@@ -73,17 +284,16 @@ INLINE void Scene_GetTriangleVertices(Scene const* scene, int shape_idx, int pri
 INLINE void Scene_GetTriangleUVs(Scene const* scene, int shape_idx, int prim_idx, float2* uv0, float2* uv1, float2* uv2)
 {
     // Extract shape data
-    Shape shape = scene->shapes[shape_idx];
+    Shape shape = Scene_GetShape(scene, shape_idx);
 
     // Fetch indices starting from startidx and offset by prim_idx
-    int i0 = scene->indices[shape.startidx + 3 * prim_idx];
-    int i1 = scene->indices[shape.startidx + 3 * prim_idx + 1];
-    int i2 = scene->indices[shape.startidx + 3 * prim_idx + 2];
+    int i0, i1, i2;
+    Scene_GetTriangleIndices(scene, &shape, prim_idx, &i0, &i1, &i2);
 
     // Fetch positions and transform to world space
-    *uv0 = scene->uvs[shape.startvtx + i0];
-    *uv1 = scene->uvs[shape.startvtx + i1];
-    *uv2 = scene->uvs[shape.startvtx + i2];
+    *uv0 = Scene_GetUV(scene, shape.startvtx + i0);
+    *uv1 = Scene_GetUV(scene, shape.startvtx + i1);
+    *uv2 = Scene_GetUV(scene, shape.startvtx + i2);
 }
 
 
@@ -91,17 +301,16 @@ INLINE void Scene_GetTriangleUVs(Scene const* scene, int shape_idx, int prim_idx
 INLINE void Scene_InterpolateAttributes(Scene const* scene, int shape_idx, int prim_idx, float2 barycentrics, float3* p, float3* n, float2* uv, float* area)
 {
     // Extract shape data
-    Shape shape = scene->shapes[shape_idx];
+    Shape shape = Scene_GetShape(scene, shape_idx);
 
     // Fetch indices starting from startidx and offset by prim_idx
-    int i0 = scene->indices[shape.startidx + 3 * prim_idx];
-    int i1 = scene->indices[shape.startidx + 3 * prim_idx + 1];
-    int i2 = scene->indices[shape.startidx + 3 * prim_idx + 2];
+    int i0, i1, i2;
+    Scene_GetTriangleIndices(scene, &shape, prim_idx, &i0, &i1, &i2);
 
     // Fetch normals
-    float3 n0 = scene->normals[shape.startvtx + i0];
-    float3 n1 = scene->normals[shape.startvtx + i1];
-    float3 n2 = scene->normals[shape.startvtx + i2];
+    float3 n0 = Scene_GetNormal(scene, shape.startvtx + i0);
+    float3 n1 = Scene_GetNormal(scene, shape.startvtx + i1);
+    float3 n2 = Scene_GetNormal(scene, shape.startvtx + i2);
 
     // Fetch positions and transform to world space
     float3 v0 = matrix_mul_point3(shape.transform, scene->vertices[shape.startvtx + i0]);
@@ -109,9 +318,9 @@ INLINE void Scene_InterpolateAttributes(Scene const* scene, int shape_idx, int p
     float3 v2 = matrix_mul_point3(shape.transform, scene->vertices[shape.startvtx + i2]);
 
     // Fetch UVs
-    float2 uv0 = scene->uvs[shape.startvtx + i0];
-    float2 uv1 = scene->uvs[shape.startvtx + i1];
-    float2 uv2 = scene->uvs[shape.startvtx + i2];
+    float2 uv0 = Scene_GetUV(scene, shape.startvtx + i0);
+    float2 uv1 = Scene_GetUV(scene, shape.startvtx + i1);
+    float2 uv2 = Scene_GetUV(scene, shape.startvtx + i2);
 
     // Calculate barycentric position and normal
     *p = (1.f - barycentrics.x - barycentrics.y) * v0 + barycentrics.x * v1 + barycentrics.y * v2;
@@ -124,12 +333,11 @@ INLINE void Scene_InterpolateAttributes(Scene const* scene, int shape_idx, int p
 INLINE void Scene_InterpolateVertices(Scene const* scene, int shape_idx, int prim_idx, float2 barycentrics, float3* p)
 {
     // Extract shape data
-    Shape shape = scene->shapes[shape_idx];
+    Shape shape = Scene_GetShape(scene, shape_idx);
 
     // Fetch indices starting from startidx and offset by prim_idx
-    int i0 = scene->indices[shape.startidx + 3 * prim_idx];
-    int i1 = scene->indices[shape.startidx + 3 * prim_idx + 1];
-    int i2 = scene->indices[shape.startidx + 3 * prim_idx + 2];
+    int i0, i1, i2;
+    Scene_GetTriangleIndices(scene, &shape, prim_idx, &i0, &i1, &i2);
 
     // Fetch positions and transform to world space
     float3 v0 = matrix_mul_point3(shape.transform, scene->vertices[shape.startvtx + i0]);
@@ -148,12 +356,11 @@ INLINE void Scene_InterpolateVerticesFromIntersection(Scene const* scene, Inters
     int prim_idx = isect->primid;
     float2 barycentrics = isect->uvwt.xy;
 
-    Shape shape = scene->shapes[shape_idx];
+    Shape shape = Scene_GetShape(scene, shape_idx);
 
     // Fetch indices starting from startidx and offset by prim_idx
-    int i0 = scene->indices[shape.startidx + 3 * prim_idx];
-    int i1 = scene->indices[shape.startidx + 3 * prim_idx + 1];
-    int i2 = scene->indices[shape.startidx + 3 * prim_idx + 2];
+    int i0, i1, i2;
+    Scene_GetTriangleIndices(scene, &shape, prim_idx, &i0, &i1, &i2);
 
     // Fetch positions and transform to world space
     float3 v0 = matrix_mul_point3(shape.transform, scene->vertices[shape.startvtx + i0]);
@@ -172,26 +379,97 @@ INLINE void Scene_InterpolateNormalsFromIntersection(Scene const* scene, Interse
     int prim_idx = isect->primid;
     float2 barycentrics = isect->uvwt.xy;
 
-    Shape shape = scene->shapes[shape_idx];
+    Shape shape = Scene_GetShape(scene, shape_idx);
 
     // Fetch indices starting from startidx and offset by prim_idx
-    int i0 = scene->indices[shape.startidx + 3 * prim_idx];
-    int i1 = scene->indices[shape.startidx + 3 * prim_idx + 1];
-    int i2 = scene->indices[shape.startidx + 3 * prim_idx + 2];
+    int i0, i1, i2;
+    Scene_GetTriangleIndices(scene, &shape, prim_idx, &i0, &i1, &i2);
 
     // Fetch normals
-    float3 n0 = scene->normals[shape.startvtx + i0];
-    float3 n1 = scene->normals[shape.startvtx + i1];
-    float3 n2 = scene->normals[shape.startvtx + i2];
+    float3 n0 = Scene_GetNormal(scene, shape.startvtx + i0);
+    float3 n1 = Scene_GetNormal(scene, shape.startvtx + i1);
+    float3 n2 = Scene_GetNormal(scene, shape.startvtx + i2);
 
     // Calculate barycentric position and normal
     *n = normalize(matrix_mul_vector3(shape.transform, (1.f - barycentrics.x - barycentrics.y) * n0 + barycentrics.x * n1 + barycentrics.y * n2));
 }
 
+#ifdef BAIKAL_VERTEX_TANGENTS
+// Fetch object space tangent of the vertex, w is bitangent sign
+INLINE float4 Scene_GetTangent(Scene const* scene, int vertex_idx)
+{
+    uint packed = scene->tangents[vertex_idx];
+    float3 t = Scene_DecodeOctahedral(packed);
+    return make_float4(t.x, t.y, t.z, (packed & 1u) ? -1.f : 1.f);
+}
+
+// Interpolate tangent frame computed by the host, bitangent sign is taken from the closest vertex
+INLINE void Scene_InterpolateTangents(Scene const* scene, int shape_idx, int prim_idx, float2 barycentrics, float3 n, float3* dpdu, float3* dpdv)
+{
+    // Extract shape data
+    Shape shape = Scene_GetShape(scene, shape_idx);
+
+    // Fetch indices starting from startidx and offset by prim_idx
+    int i0, i1, i2;
+    Scene_GetTriangleIndices(scene, &shape, prim_idx, &i0, &i1, &i2);
+
+    // Fetch tangents
+    float4 t0 = Scene_GetTangent(scene, shape.startvtx + i0);
+    float4 t1 = Scene_GetTangent(scene, shape.startvtx + i1);
+    float4 t2 = Scene_GetTangent(scene, shape.startvtx + i2);
+
+    float b0 = 1.f - barycentrics.x - barycentrics.y;
+    float3 t = matrix_mul_vector3(shape.transform, b0 * t0.xyz + barycentrics.x * t1.xyz + barycentrics.y * t2.xyz);
+    float handedness = b0 >= max(barycentrics.x, barycentrics.y) ? t0.w : (barycentrics.x >= barycentrics.y ? t1.w : t2.w);
+
+    // Orthogonalize against the world space normal
+    t -= dot(n, t) * n;
+
+    if (dot(t, t) > 0.f)
+    {
+        *dpdu = normalize(t);
+        *dpdv = handedness * normalize(cross(n, *dpdu));
+    }
+    else
+    {
+        *dpdu = normalize(GetOrthoVector(n));
+        *dpdv = normalize(cross(n, *dpdu));
+    }
+}
+#endif
+
 INLINE int Scene_GetVolumeIndex(Scene const* scene, int shape_idx)
 {
-    Shape shape = scene->shapes[shape_idx];
+#ifdef BAIKAL_SCENE_NO_VOLUMES
+    // Volume code of the callers folds away
+    return -1;
+#else
+    Shape shape = Scene_GetShape(scene, shape_idx);
     return shape.volume_idx;
+#endif
+}
+
+// Fill differential geometry of a curve hit, uv is the position along the segment and the angle around
+// its axis. Tangent frame follows the fiber, so anisotropic materials get highlights across it.
+INLINE void Scene_FillCurveDifferentialGeometry(Scene const* scene, Shape const* shape, int prim_idx, float2 uv, DifferentialGeometry* diffgeo)
+{
+    GLOBAL float4 const* points = (GLOBAL float4 const*)(scene->vertices + shape->startvtx);
+
+    float3 tangent;
+    float4 c = Curves_Evaluate(points, prim_idx, (shape->flags & kShapeBSplineCurves) != 0, uv.x, &tangent);
+    float3 n = Curves_GetNormal(tangent, uv.y);
+
+    diffgeo->p = matrix_mul_point3(shape->transform, c.xyz + c.w * n);
+    diffgeo->n = normalize(matrix_mul_vector3(shape->transform, n));
+    diffgeo->ng = diffgeo->n;
+    diffgeo->uv = uv;
+    diffgeo->area = 0.f;
+    diffgeo->mat = shape->material;
+    diffgeo->texture_lod = -64.f;
+
+    float3 t = matrix_mul_vector3(shape->transform, tangent);
+    diffgeo->dpdu = normalize(t - dot(diffgeo->n, t) * diffgeo->n);
+    diffgeo->dpdv = normalize(cross(diffgeo->n, diffgeo->dpdu));
 }
 
 /// Fill DifferentialGeometry structure based on intersection info from RadeonRays
@@ -211,7 +489,13 @@ void Scene_FillDifferentialGeometry(// Scene
     float2 barycentrics = isect->uvwt.xy;
 
     // Extract shape data
-    Shape shape = scene->shapes[shape_idx];
+    Shape shape = Scene_GetShape(scene, shape_idx);
+
+    if (shape.flags & kShapeCurves)
+    {
+        Scene_FillCurveDifferentialGeometry(scene, &shape, prim_idx, barycentrics, diffgeo);
+        return;
+    }
 
     // Interpolate attributes
     float3 p;
@@ -237,9 +521,8 @@ void Scene_FillDifferentialGeometry(// Scene
     // Get material at shading point
     diffgeo->mat = shape.material;
 
-    // Get UVs
-    float2 uv0, uv1, uv2;
-    Scene_GetTriangleUVs(scene, shape_idx, prim_idx, &uv0, &uv1, &uv2);
+    // Footprint far below a texel selects the finest texture level unless the caller knows the ray cone
+    diffgeo->texture_lod = -64.f;
 
     // Reverse geometric normal if shading normal points to different side
     if (dot(diffgeo->ng, diffgeo->n) < 0.f)
@@ -247,6 +530,14 @@ void Scene_FillDifferentialGeometry(// Scene
         diffgeo->ng = -diffgeo->ng;
     }
 
+#ifdef BAIKAL_VERTEX_TANGENTS
+    // Tangents have been computed from UV derivatives by the host
+    Scene_InterpolateTangents(scene, shape_idx, prim_idx, barycentrics, diffgeo->n, &diffgeo->dpdu, &diffgeo->dpdv);
+#else
+    // Get UVs
+    float2 uv0, uv1, uv2;
+    Scene_GetTriangleUVs(scene, shape_idx, prim_idx, &uv0, &uv1, &uv2);
+
     /// Calculate tangent basis
     /// From PBRT book
     float du1 = uv0.x - uv2.x;
@@ -274,9 +565,37 @@ void Scene_FillDifferentialGeometry(// Scene
         diffgeo->dpdu = normalize(GetOrthoVector(diffgeo->n));
         diffgeo->dpdv = normalize(cross(diffgeo->n, diffgeo->dpdu));
     }
+#endif
 }
 
 
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+// Set texture level of detail for the ray cone of the given width arriving from wi
+INLINE void DifferentialGeometry_SetTextureLod(Scene const* scene, Intersection const* isect, float3 wi, float cone_width, DifferentialGeometry* diffgeo)
+{
+    int shape_idx = isect->shapeid - 1;
+    int prim_idx = isect->primid;
+
+    float3 v0, v1, v2;
+    Scene_GetTriangleVertices(scene, shape_idx, prim_idx, &v0, &v1, &v2);
+
+    float2 uv0, uv1, uv2;
+    Scene_GetTriangleUVs(scene, shape_idx, prim_idx, &uv0, &uv1, &uv2);
+
+    // Ratio of UV to world space area of the triangle
+    float world_area = length(cross(v1 - v0, v2 - v0));
+    float2 duv1 = uv1 - uv0;
+    float2 duv2 = uv2 - uv0;
+    float uv_area = fabs(duv1.x * duv2.y - duv1.y * duv2.x);
+
+    // Footprint is stretched along the surface at grazing angles
+    float footprint = cone_width / max(fabs(dot(diffgeo->n, wi)), 1e-3f);
+
+    diffgeo->texture_lod = (world_area > 0.f && uv_area > 0.f && footprint > 0.f) ?
+        log2(footprint) + 0.5f * log2(uv_area / world_area) : -64.f;
+}
+#endif
+
 // Calculate tangent transform matrices inside differential geometry
 INLINE void DifferentialGeometry_CalculateTangentTransforms(DifferentialGeometry* diffgeo)
 {
@@ -311,4 +630,276 @@ INLINE int Scene_SampleLight(Scene const* scene, float sample, float* pdf)
 #endif
 }
 
+#ifndef BAIKAL_LIGHT_GRID
+// Light BVH section follows power distribution in light distribution buffer:
+// number of nodes (0 if there is no BVH), infinite light probability,
+// infinite light distribution, nodes (8 x 32-bit each), parent indices and
+// light to leaf node mapping.
+#define LIGHT_BVH_NODE_SIZE 8
+
+INLINE GLOBAL int const* LightBvh_Get(GLOBAL int const* light_distribution)
+{
+    return light_distribution + Distribution1D_GetSize(light_distribution[0]);
+}
+
+// Estimated contribution of the lights below a node at a shading point
+INLINE float LightBvh_GetImportance(GLOBAL int const* node, float3 p)
+{
+    GLOBAL float const* data = (GLOBAL float const*)node;
+    float3 pmin = make_float3(data[0], data[1], data[2]);
+    float3 pmax = make_float3(data[4], data[5], data[6]);
+    float power = data[3];
+
+    float3 center = 0.5f * (pmin + pmax);
+    float3 extent = pmax - pmin;
+
+    // Do not let the importance blow up when the point is within the bounds
+    float dist2 = dot(p - center, p - center);
+    float radius2 = 0.25f * dot(extent, extent);
+    return power / max(max(dist2, radius2), 1e-8f);
+}
+
+// Probability to select the first of two siblings
+INLINE float LightBvh_GetLeftProbability(GLOBAL int const* left, float3 p)
+{
+    float wl = LightBvh_GetImportance(left, p);
+    float wr = LightBvh_GetImportance(left + LIGHT_BVH_NODE_SIZE, p);
+    return (wl + wr) > 0.f ? wl / (wl + wr) : 0.5f;
+}
+
+// Sample light index taking into account proximity of the lights to a shading point
+INLINE int Scene_SampleLightAtPoint(Scene const* scene, float3 p, float sample, float* pdf)
+{
+    GLOBAL int const* bvh = LightBvh_Get(scene->light_distribution);
+    int num_nodes = bvh[0];
+
+    if (num_nodes == 0)
+    {
+        return Scene_SampleLight(scene, sample, pdf);
+    }
+
+    float infinite_probability = as_float(bvh[1]);
+    GLOBAL int const* infinite_distribution = bvh + 2;
+
+    if (sample < infinite_probability)
+    {
+        int light_idx = Distribution1D_SampleDiscrete(sample / infinite_probability, infinite_distribution, pdf);
+        *pdf *= infinite_probability;
+        return light_idx;
+    }
+
+    GLOBAL int const* nodes = infinite_distribution + Distribution1D_GetSize(scene->num_lights);
+
+    sample = (sample - infinite_probability) / (1.f - infinite_probability);
+    float selection_pdf = 1.f - infinite_probability;
+    int node = 0;
+
+    // Descend choosing children proportionally to their importance and reuse the sample
+    while (nodes[node * LIGHT_BVH_NODE_SIZE + 7] >= 0)
+    {
+        int left = nodes[node * LIGHT_BVH_NODE_SIZE + 7];
+        float pl = LightBvh_GetLeftProbability(nodes + left * LIGHT_BVH_NODE_SIZE, p);
+
+        if (sample < pl)
+        {
+            sample = sample / pl;
+            selection_pdf *= pl;
+            node = left;
+        }
+        else
+        {
+            sample = (sample - pl) / (1.f - pl);
+            selection_pdf *= (1.f - pl);
+            node = left + 1;
+        }
+
+        sample = min(sample, 0.99999994f);
+    }
+
+    *pdf = selection_pdf;
+    return -nodes[node * LIGHT_BVH_NODE_SIZE + 7] - 1;
+}
+
+// Probability of a light to be selected by Scene_SampleLightAtPoint
+INLINE float LightDistribution_GetPdfAtPoint(GLOBAL int const* light_distribution, int num_lights, int light_idx, float3 p)
+{
+    GLOBAL int const* bvh = LightBvh_Get(light_distribution);
+    int num_nodes = bvh[0];
+
+    if (num_nodes == 0)
+    {
+        return Distribution1D_GetPdfDiscreet(light_idx, light_distribution);
+    }
+
+    float infinite_probability = as_float(bvh[1]);
+    GLOBAL int const* infinite_distribution = bvh + 2;
+    GLOBAL int const* nodes = infinite_distribution + Distribution1D_GetSize(num_lights);
+    GLOBAL int const* parents = nodes + num_nodes * LIGHT_BVH_NODE_SIZE;
+    GLOBAL int const* light_nodes = parents + num_nodes;
+
+    int node = light_nodes[light_idx];
+
+    if (node < 0)
+    {
+        return infinite_probability * Distribution1D_GetPdfDiscreet(light_idx, infinite_distribution);
+    }
+
+    // Walk up to the root multiplying selection probabilities
+    float pdf = 1.f - infinite_probability;
+    while (node > 0)
+    {
+        int parent = parents[node];
+        int left = nodes[parent * LIGHT_BVH_NODE_SIZE + 7];
+        float pl = LightBvh_GetLeftProbability(nodes + left * LIGHT_BVH_NODE_SIZE, p);
+        pdf *= (node == left) ? pl : (1.f - pl);
+        node = parent;
+    }
+
+    return pdf;
+}
+
+#else
+// Light grid section follows power distribution in light distribution buffer:
+// number of cells (0 if there is no grid), infinite light probability,
+// infinite and local light distributions, grid header (origin, cell size and
+// resolution), cell list offsets, cell list probabilities, light indices and
+// CDF values of cell lists.
+#define LIGHT_GRID_HEADER_SIZE 9
+
+// Light list of the grid cell containing a shading point
+typedef struct
+{
+    float infinite_probability;
+    GLOBAL int const* infinite_distribution;
+    GLOBAL int const* local_distribution;
+    // Probability to pick a light from the list rather than from local distribution
+    float list_probability;
+    GLOBAL int const* light_indices;
+    GLOBAL float const* cdf;
+    int num_lights;
+} LightGridCell;
+
+INLINE GLOBAL int const* LightGrid_Get(GLOBAL int const* light_distribution)
+{
+    return light_distribution + Distribution1D_GetSize(light_distribution[0]);
+}
+
+INLINE void LightGrid_GetCell(GLOBAL int const* grid, int num_lights, float3 p, LightGridCell* cell)
+{
+    int num_cells = grid[0];
+
+    cell->infinite_probability = as_float(grid[1]);
+    cell->infinite_distribution = grid + 2;
+    cell->local_distribution = cell->infinite_distribution + Distribution1D_GetSize(num_lights);
+
+    GLOBAL int const* header = cell->local_distribution + Distribution1D_GetSize(num_lights);
+    GLOBAL float const* data = (GLOBAL float const*)header;
+    float3 pmin = make_float3(data[0], data[1], data[2]);
+    float3 cell_size = make_float3(data[3], data[4], data[5]);
+    int3 resolution = make_int3(header[6], header[7], header[8]);
+
+    // Points outside of the grid use the closest cell
+    int3 xyz = clamp(convert_int3_sat_rtn((p - pmin) / cell_size), make_int3(0, 0, 0), resolution - 1);
+    int idx = (xyz.z * resolution.y + xyz.y) * resolution.x + xyz.x;
+
+    GLOBAL int const* offsets = header + LIGHT_GRID_HEADER_SIZE;
+    GLOBAL float const* list_probabilities = (GLOBAL float const*)(offsets + num_cells + 1);
+    GLOBAL int const* light_indices = (GLOBAL int const*)(list_probabilities + num_cells);
+    GLOBAL float const* cdf = (GLOBAL float const*)(light_indices + offsets[num_cells]);
+
+    cell->list_probability = list_probabilities[idx];
+    cell->light_indices = light_indices + offsets[idx];
+    cell->cdf = cdf + offsets[idx];
+    cell->num_lights = offsets[idx + 1] - offsets[idx];
+}
+
+// Probability of a local light to be picked in the cell, either from the list or by power
+INLINE float LightGridCell_GetLocalPdf(LightGridCell const* cell, int light_idx)
+{
+    float pdf = (1.f - cell->list_probability) * Distribution1D_GetPdfDiscreet(light_idx, cell->local_distribution);
+
+    for (int i = 0; i < cell->num_lights; ++i)
+    {
+        if (cell->light_indices[i] == light_idx)
+        {
+            pdf += cell->list_probability * (cell->cdf[i] - (i > 0 ? cell->cdf[i - 1] : 0.f));
+            break;
+        }
+    }
+
+    return pdf;
+}
+
+// Sample light index from the lights listed in the grid cell of a shading point
+INLINE int Scene_SampleLightAtPoint(Scene const* scene, float3 p, float sample, float* pdf)
+{
+    GLOBAL int const* grid = LightGrid_Get(scene->light_distribution);
+
+    if (grid[0] == 0)
+    {
+        return Scene_SampleLight(scene, sample, pdf);
+    }
+
+    LightGridCell cell;
+    LightGrid_GetCell(grid, scene->num_lights, p, &cell);
+
+    if (sample < cell.infinite_probability)
+    {
+        int light_idx = Distribution1D_SampleDiscrete(sample / cell.infinite_probability, cell.infinite_distribution, pdf);
+        *pdf *= cell.infinite_probability;
+        return light_idx;
+    }
+
+    sample = (sample - cell.infinite_probability) / (1.f - cell.infinite_probability);
+
+    int light_idx = 0;
+    if (sample < cell.list_probability)
+    {
+        // Lists are short, so they are scanned linearly
+        sample = sample / cell.list_probability;
+
+        int i = 0;
+        while (i < cell.num_lights - 1 && cell.cdf[i] <= sample)
+        {
+            ++i;
+        }
+
+        light_idx = cell.light_indices[i];
+    }
+    else
+    {
+        float local_pdf = 0.f;
+        sample = min((sample - cell.list_probability) / (1.f - cell.list_probability), 0.99999994f);
+        light_idx = Distribution1D_SampleDiscrete(sample, cell.local_distribution, &local_pdf);
+    }
+
+    // Light may be reached by both strategies
+    *pdf = (1.f - cell.infinite_probability) * LightGridCell_GetLocalPdf(&cell, light_idx);
+    return light_idx;
+}
+
+// Probability of a light to be selected by Scene_SampleLightAtPoint
+INLINE float LightDistribution_GetPdfAtPoint(GLOBAL int const* light_distribution, int num_lights, int light_idx, float3 p)
+{
+    GLOBAL int const* grid = LightGrid_Get(light_distribution);
+
+    if (grid[0] == 0)
+    {
+        return Distribution1D_GetPdfDiscreet(light_idx, light_distribution);
+    }
+
+    LightGridCell cell;
+    LightGrid_GetCell(grid, num_lights, p, &cell);
+
+    // Infinite and local lights are picked with separate distributions
+    return cell.infinite_probability * Distribution1D_GetPdfDiscreet(light_idx, cell.infinite_distribution) +
+        (1.f - cell.infinite_probability) * LightGridCell_GetLocalPdf(&cell, light_idx);
+}
+#endif
+
+INLINE float Scene_GetLightPdfAtPoint(Scene const* scene, int light_idx, float3 p)
+{
+    return LightDistribution_GetPdfAtPoint(scene->light_distribution, scene->num_lights, light_idx, p);
+}
+
 #endif
@@ -0,0 +1,188 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef TEMPORAL_ACCUMULATION_CL
+#define TEMPORAL_ACCUMULATION_CL
+
+#include <../Baikal/Kernels/CL/common.cl>
+
+// Mesh ids are resolved colors, blended ids on silhouettes never match
+#define TEMPORAL_ID_EPSILON 1e-3f
+
+// Camera frame is passed as position, basis vectors and (dim.x, dim.y, focal_length, znear)
+INLINE float3 Temporal_CameraDirection(
+    float2 img_sample,
+    float3 camera_forward,
+    float3 camera_right,
+    float3 camera_up,
+    float4 camera_params
+)
+{
+    // Same construction as primary ray generation
+    float2 c_sample = (img_sample - make_float2(0.5f, 0.5f)) * camera_params.xy;
+    return normalize(camera_params.z * camera_forward + c_sample.x * camera_right + c_sample.y * camera_up);
+}
+
+// Reproject history of the previous camera onto current pixels
+KERNEL void TemporalReproject_main(
+    // Current depth AOV
+    GLOBAL float4 const* restrict depths,
+    // Current mesh id AOV
+    GLOBAL float4 const* restrict mesh_ids,
+    // Accumulated history, xyz - mean color, w - number of samples
+    GLOBAL float4 const* restrict prev_history,
+    // Geometry of the history, x - distance from camera, yzw - mesh id
+    GLOBAL float4 const* restrict prev_geometry,
+    // Image resolution
+    int width,
+    int height,
+    // Current camera
+    float4 camera_p,
+    float4 camera_forward,
+    float4 camera_right,
+    float4 camera_up,
+    float4 camera_params,
+    // Previous camera
+    float4 prev_camera_p,
+    float4 prev_camera_forward,
+    float4 prev_camera_right,
+    float4 prev_camera_up,
+    float4 prev_camera_params,
+    // Maximum number of history samples carried over
+    float max_history,
+    // Relative distance tolerance
+    float depth_tolerance,
+    // Reprojected history
+    GLOBAL float4* restrict base
+)
+{
+    int idx = get_global_id(0);
+
+    if (idx < width * height)
+    {
+        float4 result = (float4)(0.f);
+
+        float4 depth = depths[idx];
+        float4 mesh_id = mesh_ids[idx];
+
+        if (depth.w > 0.f && mesh_id.w > 0.f)
+        {
+            int x = idx % width;
+            int y = idx / width;
+
+            float2 img_sample = make_float2((x + 0.5f) / width, (y + 0.5f) / height);
+            float3 d = Temporal_CameraDirection(img_sample, camera_forward.xyz, camera_right.xyz, camera_up.xyz, camera_params);
+
+            // Depth AOV is measured from the near plane along the ray
+            float3 p = camera_p.xyz + (camera_params.w + depth.x / depth.w) * d;
+            float3 id = mesh_id.xyz / mesh_id.w;
+
+            // Project into the previous camera image plane
+            float3 v = p - prev_camera_p.xyz;
+            float local_z = dot(v, prev_camera_forward.xyz);
+
+            if (local_z > 0.f)
+            {
+                float2 c_sample = make_float2(dot(v, prev_camera_right.xyz), dot(v, prev_camera_up.xyz)) * prev_camera_params.z / local_z;
+                float2 prev_img_sample = c_sample / prev_camera_params.xy + make_float2(0.5f, 0.5f);
+
+                int prev_x = (int)floor(prev_img_sample.x * width);
+                int prev_y = (int)floor(prev_img_sample.y * height);
+
+                if (prev_x >= 0 && prev_x < width && prev_y >= 0 && prev_y < height)
+                {
+                    int prev_idx = prev_y * width + prev_x;
+                    float4 geometry = prev_geometry[prev_idx];
+                    float distance = length(v);
+
+                    // Reject disocclusions: different surface or depth discontinuity
+                    bool same_surface = fabs(geometry.x - distance) <= depth_tolerance * distance &&
+                        fabs(geometry.y - id.x) < TEMPORAL_ID_EPSILON &&
+                        fabs(geometry.z - id.y) < TEMPORAL_ID_EPSILON &&
+                        fabs(geometry.w - id.z) < TEMPORAL_ID_EPSILON;
+
+                    if (same_surface)
+                    {
+                        float4 history = prev_history[prev_idx];
+                        result = make_float4(history.x, history.y, history.z, min(history.w, max_history));
+                    }
+                }
+            }
+        }
+
+        base[idx] = result;
+    }
+}
+
+// Blend reprojected history with the current estimate and store new history
+KERNEL void TemporalResolve_main(
+    // Accumulated color of the current camera
+    GLOBAL float4 const* restrict colors,
+    // Current depth AOV
+    GLOBAL float4 const* restrict depths,
+    // Current mesh id AOV
+    GLOBAL float4 const* restrict mesh_ids,
+    // Reprojected history
+    GLOBAL float4 const* restrict base,
+    // Number of pixels
+    int num_pixels,
+    // Camera near plane
+    float znear,
+    // New history
+    GLOBAL float4* restrict history,
+    // New history geometry
+    GLOBAL float4* restrict geometry,
+    // Output color
+    GLOBAL float4* restrict out_colors
+)
+{
+    int idx = get_global_id(0);
+
+    if (idx < num_pixels)
+    {
+        float4 color = colors[idx];
+        float4 prev = base[idx];
+
+        // History acts as prev.w extra samples of the mean
+        float num_samples = prev.w + color.w;
+        float3 mean = num_samples > 0.f ?
+            (prev.xyz * prev.w + color.xyz) / num_samples : make_float3(0.f, 0.f, 0.f);
+
+        history[idx] = make_float4(mean.x, mean.y, mean.z, num_samples);
+        out_colors[idx] = make_float4(mean.x, mean.y, mean.z, 1.f);
+
+        float4 depth = depths[idx];
+        float4 mesh_id = mesh_ids[idx];
+
+        if (depth.w > 0.f && mesh_id.w > 0.f)
+        {
+            float3 id = mesh_id.xyz / mesh_id.w;
+            geometry[idx] = make_float4(znear + depth.x / depth.w, id.x, id.y, id.z);
+        }
+        else
+        {
+            // Misses never match a surface
+            geometry[idx] = make_float4(-1.f, -1.f, -1.f, -1.f);
+        }
+    }
+}
+
+#endif // TEMPORAL_ACCUMULATION_CL
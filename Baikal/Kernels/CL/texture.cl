@@ -28,22 +28,161 @@ THE SOFTWARE.
 
 
 /// To simplify a bit
-#define TEXTURE_ARG_LIST __global Texture const* textures, __global char const* texturedata
-#define TEXTURE_ARG_LIST_IDX(x) int x, __global Texture const* textures, __global char const* texturedata
-#define TEXTURE_ARGS textures, texturedata
-#define TEXTURE_ARGS_IDX(x) x, textures, texturedata
+/// Sampling a paged out texture requests its full resolution texels in texturerequests, see kTextureNotResident
+#ifdef BAIKAL_TEXTURE_IMAGES
+// RGBA8 textures are also copied into layers of an image array, see Texture::layer
+#define TEXTURE_ARG_LIST __global Texture const* textures, __global char const* texturedata, __global int* texturerequests, __read_only image2d_array_t textureimages
+#define TEXTURE_ARG_LIST_IDX(x) int x, __global Texture const* textures, __global char const* texturedata, __global int* texturerequests, __read_only image2d_array_t textureimages
+#define TEXTURE_ARGS textures, texturedata, texturerequests, textureimages
+#define TEXTURE_ARGS_IDX(x) x, textures, texturedata, texturerequests, textureimages
+#else
+#define TEXTURE_ARG_LIST __global Texture const* textures, __global char const* texturedata, __global int* texturerequests
+#define TEXTURE_ARG_LIST_IDX(x) int x, __global Texture const* textures, __global char const* texturedata, __global int* texturerequests
+#define TEXTURE_ARGS textures, texturedata, texturerequests
+#define TEXTURE_ARGS_IDX(x) x, textures, texturedata, texturerequests
+#endif
+
+/// Index of a texel of an uncompressed format. With BAIKAL_TILED_TEXTURES texels are stored in 8x8 tiles
+/// in row major order, rows of a tile are adjacent, so both rows of a bilinear footprint are usually close in memory.
+/// Width and height of tiled data are padded to multiples of 8.
+inline
+int TextureData_GetTexelIndex(int x, int y, int width)
+{
+#ifdef BAIKAL_TILED_TEXTURES
+    return ((((y >> 3) * ((width + 7) >> 3)) + (x >> 3)) << 6) + ((y & 7) << 3) + (x & 7);
+#else
+    return width * y + x;
+#endif
+}
 
-/// Sample 2D texture
+/// Number of texels stored for a width x height level of an uncompressed format
 inline
-float4 Texture_Sample2D(float2 uv, TEXTURE_ARG_LIST_IDX(texidx))
+int TextureData_GetStoredTexelCount(int width, int height)
 {
-    // Get width and height
-    int width = textures[texidx].w;
-    int height = textures[texidx].h;
+#ifdef BAIKAL_TILED_TEXTURES
+    return ((width + 7) & ~7) * ((height + 7) & ~7);
+#else
+    return width * height;
+#endif
+}
 
-    // Find the origin of the data in the pool
-    __global char const* mydata = texturedata + textures[texidx].dataoffset;
+/// Decode RGB565 color
+inline
+float4 TextureData_DecodeRGB565(uint c)
+{
+    return make_float4((float)((c >> 11) & 0x1F) / 31.f, (float)((c >> 5) & 0x3F) / 63.f, (float)(c & 0x1F) / 31.f, 1.f);
+}
+
+/// Decode texel of a BC1 block: RGB565 endpoints followed by 2 bit indices,
+/// endpoints which are not in decreasing order select the palette with transparent black
+inline
+float4 TextureData_FetchBC1(__global uint const* block, int texel)
+{
+    uint c0 = block[0] & 0xFFFF;
+    uint c1 = block[0] >> 16;
+    uint idx = (block[1] >> (2 * texel)) & 0x3;
+
+    float4 color0 = TextureData_DecodeRGB565(c0);
+    float4 color1 = TextureData_DecodeRGB565(c1);
+
+    if (idx < 2)
+    {
+        return idx == 0 ? color0 : color1;
+    }
+
+    if (c0 > c1)
+    {
+        return idx == 2 ? (2.f * color0 + color1) / 3.f : (color0 + 2.f * color1) / 3.f;
+    }
+
+    return idx == 2 ? 0.5f * (color0 + color1) : make_float4(0.f, 0.f, 0.f, 0.f);
+}
+
+/// Decode texel of a BC4 block: 8 bit endpoints followed by 3 bit indices,
+/// endpoints which are not in decreasing order select the palette with explicit 0 and 1
+inline
+float TextureData_FetchBC4(__global uint const* block, int texel)
+{
+    uint r0 = block[0] & 0xFF;
+    uint r1 = (block[0] >> 8) & 0xFF;
+    ulong bits = (((ulong)block[1] << 32) | block[0]) >> 16;
+    uint idx = (uint)(bits >> (3 * texel)) & 0x7;
+
+    float value0 = (float)r0 / 255.f;
+    float value1 = (float)r1 / 255.f;
 
+    if (idx < 2)
+    {
+        return idx == 0 ? value0 : value1;
+    }
+
+    if (r0 > r1)
+    {
+        return ((float)(8 - idx) * value0 + (float)(idx - 1) * value1) / 7.f;
+    }
+
+    if (idx >= 6)
+    {
+        return idx == 6 ? 0.f : 1.f;
+    }
+
+    return ((float)(6 - idx) * value0 + (float)(idx - 1) * value1) / 5.f;
+}
+
+/// Decode texel of block compressed data, BC5 holds normal map x and y and z is reconstructed
+inline
+float4 TextureData_FetchBlockTexel(__global char const* mydata, int width, int x, int y, int fmt)
+{
+    int block_size = fmt == BC1 ? 8 : 16;
+    __global uint const* block = (__global uint const*)(mydata + block_size * ((y >> 2) * ((width + 3) >> 2) + (x >> 2)));
+    int texel = ((y & 3) << 2) + (x & 3);
+
+    if (fmt == BC1)
+    {
+        return TextureData_FetchBC1(block, texel);
+    }
+
+    float2 n = 2.f * make_float2(TextureData_FetchBC4(block, texel), TextureData_FetchBC4(block + 2, texel)) - 1.f;
+    float nz = native_sqrt(max(1.f - dot(n, n), 0.f));
+    return make_float4(0.5f * n.x + 0.5f, 0.5f * n.y + 0.5f, 0.5f * nz + 0.5f, 1.f);
+}
+
+/// Load texel of a single or two channel format, one channel is replicated to all components
+inline
+float4 TextureData_LoadChannels(__global char const* mydata, int idx, int fmt)
+{
+    switch (fmt)
+    {
+        case R8:
+        {
+            float r = (float)((__global uchar const*)mydata)[idx] / 255.f;
+            return make_float4(r, r, r, r);
+        }
+
+        case R16:
+        {
+            float r = vload_half(idx, (__global half const*)mydata);
+            return make_float4(r, r, r, r);
+        }
+
+        case RG8:
+        {
+            uchar2 rg = ((__global uchar2 const*)mydata)[idx];
+            return make_float4((float)rg.x / 255.f, (float)rg.y / 255.f, 0.f, 0.f);
+        }
+
+        default:
+        {
+            float2 rg = vload_half2(idx, (__global half const*)mydata);
+            return make_float4(rg.x, rg.y, 0.f, 0.f);
+        }
+    }
+}
+
+/// Bilinear fetch from width x height texels in the given format
+inline
+float4 TextureData_Sample2D(float2 uv, __global char const* mydata, int width, int height, int fmt)
+{
     // Handle UV wrap
     // TODO: need UV mode support
     uv -= floor(uv);
@@ -65,17 +204,17 @@ float4 Texture_Sample2D(float2 uv, TEXTURE_ARG_LIST_IDX(texidx))
     float wx = uv.x * width - floor(uv.x * width);
     float wy = uv.y * height - floor(uv.y * height);
 
-    switch (textures[texidx].fmt)
+    switch (fmt)
     {
         case RGBA32:
         {
             __global float4 const* mydataf = (__global float4 const*)mydata;
 
             // Get 4 values for linear filtering
-            float4 val00 = *(mydataf + width * y0 + x0);
-            float4 val01 = *(mydataf + width * y0 + x1);
-            float4 val10 = *(mydataf + width * y1 + x0);
-            float4 val11 = *(mydataf + width * y1 + x1);
+            float4 val00 = *(mydataf + TextureData_GetTexelIndex(x0, y0, width));
+            float4 val01 = *(mydataf + TextureData_GetTexelIndex(x1, y0, width));
+            float4 val10 = *(mydataf + TextureData_GetTexelIndex(x0, y1, width));
+            float4 val11 = *(mydataf + TextureData_GetTexelIndex(x1, y1, width));
 
             // Filter and return the result
             return lerp(lerp(val00, val01, wx), lerp(val10, val11, wx), wy);
@@ -86,10 +225,10 @@ float4 Texture_Sample2D(float2 uv, TEXTURE_ARG_LIST_IDX(texidx))
             __global half const* mydatah = (__global half const*)mydata;
 
             // Get 4 values
-            float4 val00 = vload_half4(width * y0 + x0, mydatah);
-            float4 val01 = vload_half4(width * y0 + x1, mydatah);
-            float4 val10 = vload_half4(width * y1 + x0, mydatah);
-            float4 val11 = vload_half4(width * y1 + x1, mydatah);
+            float4 val00 = vload_half4(TextureData_GetTexelIndex(x0, y0, width), mydatah);
+            float4 val01 = vload_half4(TextureData_GetTexelIndex(x1, y0, width), mydatah);
+            float4 val10 = vload_half4(TextureData_GetTexelIndex(x0, y1, width), mydatah);
+            float4 val11 = vload_half4(TextureData_GetTexelIndex(x1, y1, width), mydatah);
 
             // Filter and return the result
             return lerp(lerp(val00, val01, wx), lerp(val10, val11, wx), wy);
@@ -100,10 +239,10 @@ float4 Texture_Sample2D(float2 uv, TEXTURE_ARG_LIST_IDX(texidx))
             __global uchar4 const* mydatac = (__global uchar4 const*)mydata;
 
             // Get 4 values and convert to float
-            uchar4 valu00 = *(mydatac + width * y0 + x0);
-            uchar4 valu01 = *(mydatac + width * y0 + x1);
-            uchar4 valu10 = *(mydatac + width * y1 + x0);
-            uchar4 valu11 = *(mydatac + width * y1 + x1);
+            uchar4 valu00 = *(mydatac + TextureData_GetTexelIndex(x0, y0, width));
+            uchar4 valu01 = *(mydatac + TextureData_GetTexelIndex(x1, y0, width));
+            uchar4 valu10 = *(mydatac + TextureData_GetTexelIndex(x0, y1, width));
+            uchar4 valu11 = *(mydatac + TextureData_GetTexelIndex(x1, y1, width));
 
             float4 val00 = make_float4((float)valu00.x / 255.f, (float)valu00.y / 255.f, (float)valu00.z / 255.f, (float)valu00.w / 255.f);
             float4 val01 = make_float4((float)valu01.x / 255.f, (float)valu01.y / 255.f, (float)valu01.z / 255.f, (float)valu01.w / 255.f);
@@ -114,6 +253,33 @@ float4 Texture_Sample2D(float2 uv, TEXTURE_ARG_LIST_IDX(texidx))
             return lerp(lerp(val00, val01, wx), lerp(val10, val11, wx), wy);
         }
 
+        case R8:
+        case R16:
+        case RG8:
+        case RG16:
+        {
+            // Get 4 values
+            float4 val00 = TextureData_LoadChannels(mydata, TextureData_GetTexelIndex(x0, y0, width), fmt);
+            float4 val01 = TextureData_LoadChannels(mydata, TextureData_GetTexelIndex(x1, y0, width), fmt);
+            float4 val10 = TextureData_LoadChannels(mydata, TextureData_GetTexelIndex(x0, y1, width), fmt);
+            float4 val11 = TextureData_LoadChannels(mydata, TextureData_GetTexelIndex(x1, y1, width), fmt);
+
+            // Filter and return the result
+            return lerp(lerp(val00, val01, wx), lerp(val10, val11, wx), wy);
+        }
+
+        case BC1:
+        case BC5:
+        {
+            float4 val00 = TextureData_FetchBlockTexel(mydata, width, x0, y0, fmt);
+            float4 val01 = TextureData_FetchBlockTexel(mydata, width, x1, y0, fmt);
+            float4 val10 = TextureData_FetchBlockTexel(mydata, width, x0, y1, fmt);
+            float4 val11 = TextureData_FetchBlockTexel(mydata, width, x1, y1, fmt);
+
+            // Filter and return the result
+            return lerp(lerp(val00, val01, wx), lerp(val10, val11, wx), wy);
+        }
+
         default:
         {
             return make_float4(0.f, 0.f, 0.f, 0.f);
@@ -121,6 +287,166 @@ float4 Texture_Sample2D(float2 uv, TEXTURE_ARG_LIST_IDX(texidx))
     }
 }
 
+/// Size of a texel in bytes
+inline
+int Texture_GetTexelSize(int fmt)
+{
+    switch (fmt)
+    {
+        case RGBA32: return 16;
+        case RGBA16: return 8;
+        case R8: return 1;
+        case R16: return 2;
+        case RG8: return 2;
+        case RG16: return 4;
+        default: return 4;
+    }
+}
+
+/// Size of a mip level in bytes, levels are 16 bytes aligned in texture data
+inline
+int Texture_GetLevelSize(int width, int height, int fmt)
+{
+    return (TextureData_GetStoredTexelCount(width, height) * Texture_GetTexelSize(fmt) + 0xF) & ~0xF;
+}
+
+#ifdef BAIKAL_TEXTURE_IMAGES
+/// Bilinear fetch from the width x height corner of an image array layer, matches TextureData_Sample2D
+inline
+float4 TextureImage_Sample2D(float2 uv, __read_only image2d_array_t textureimages, int layer, int width, int height)
+{
+    const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
+
+    // Handle UV wrap and reverse Y
+    uv -= floor(uv);
+    uv.y = 1.f - uv.y;
+
+    // Texel centers are at half integer coordinates, clamping to the last center
+    // keeps the filter footprint inside of the texture like the clamped fetches of the buffer path
+    float2 size = make_float2((float)width, (float)height);
+    float2 xy = min(uv * size, size - 1.f) + 0.5f;
+
+    return read_imagef(textureimages, sampler, (float4)(xy.x, xy.y, (float)layer, 0.f));
+}
+#endif
+
+/// Ask the host to page in full resolution texels of the texture if it is sampled from its low resolution copy
+inline
+void Texture_RequestResidency(TEXTURE_ARG_LIST_IDX(texidx))
+{
+    if ((textures[texidx].flags & kTextureNotResident) && texturerequests[texidx] == 0)
+    {
+        texturerequests[texidx] = 1;
+    }
+}
+
+/// Index of the tile texture of UDIM set containing uv, -1 outside of the tiles.
+/// Tiles wrap UVs, so they are sampled at the fractional part of uv. Other textures are returned as is.
+inline
+int Texture_GetUdimTile(float2 uv, TEXTURE_ARG_LIST_IDX(texidx))
+{
+    if (textures[texidx].fmt != UDIM)
+    {
+        return texidx;
+    }
+
+    int u = (int)floor(uv.x);
+    int v = (int)floor(uv.y);
+
+    if (u < 0 || u >= textures[texidx].w || v < 0 || v >= textures[texidx].h)
+    {
+        return -1;
+    }
+
+    __global int const* tiles = (__global int const*)(textures + textures[texidx].dataoffset);
+    return tiles[v * textures[texidx].w + u];
+}
+
+/// Sample 2D texture
+inline
+float4 Texture_Sample2D(float2 uv, TEXTURE_ARG_LIST_IDX(texidx))
+{
+    texidx = Texture_GetUdimTile(uv, TEXTURE_ARGS_IDX(texidx));
+
+    if (texidx < 0)
+    {
+        return make_float4(0.f, 0.f, 0.f, 0.f);
+    }
+
+    Texture_RequestResidency(TEXTURE_ARGS_IDX(texidx));
+
+    // Get width and height
+    int width = textures[texidx].w;
+    int height = textures[texidx].h;
+
+#ifdef BAIKAL_TEXTURE_IMAGES
+    int layer = textures[texidx].layer;
+
+    if (layer >= 0)
+    {
+        return TextureImage_Sample2D(uv, textureimages, layer, width, height);
+    }
+#endif
+
+    // Find the origin of the data in the pool
+    __global char const* mydata = texturedata + textures[texidx].dataoffset;
+
+    return TextureData_Sample2D(uv, mydata, width, height, textures[texidx].fmt);
+}
+
+/// Sample 2D texture blending the two mip levels closest to the footprint, see DifferentialGeometry::texture_lod
+inline
+float4 Texture_Sample2DLod(float2 uv, float lod, TEXTURE_ARG_LIST_IDX(texidx))
+{
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+    texidx = Texture_GetUdimTile(uv, TEXTURE_ARGS_IDX(texidx));
+
+    if (texidx < 0)
+    {
+        return make_float4(0.f, 0.f, 0.f, 0.f);
+    }
+
+    int levels = textures[texidx].levels;
+
+    if (levels > 1)
+    {
+        Texture_RequestResidency(TEXTURE_ARGS_IDX(texidx));
+
+        int width = textures[texidx].w;
+        int height = textures[texidx].h;
+        int fmt = textures[texidx].fmt;
+
+        // Footprint in texels of the first level
+        lod = clamp(lod + 0.5f * log2((float)(width * height)), 0.f, (float)(levels - 1));
+
+        int level = (int)lod;
+        float t = lod - (float)level;
+
+        // Skip finer levels
+        __global char const* mydata = texturedata + textures[texidx].dataoffset;
+
+        for (int i = 0; i < level; ++i)
+        {
+            mydata += Texture_GetLevelSize(width, height, fmt);
+            width = max(width >> 1, 1);
+            height = max(height >> 1, 1);
+        }
+
+        float4 value = TextureData_Sample2D(uv, mydata, width, height, fmt);
+
+        if (t > 0.f)
+        {
+            mydata += Texture_GetLevelSize(width, height, fmt);
+            value = lerp(value, TextureData_Sample2D(uv, mydata, max(width >> 1, 1), max(height >> 1, 1), fmt), t);
+        }
+
+        return value;
+    }
+#endif
+
+    return Texture_Sample2D(uv, TEXTURE_ARGS_IDX(texidx));
+}
+
 /// Sample lattitue-longitude environment map using 3d vector
 inline
 float3 Texture_SampleEnvMap(float3 d, TEXTURE_ARG_LIST_IDX(texidx), bool mirror_x)
@@ -204,174 +530,17 @@ float Texture_GetValue1f(
     return v;
 }
 
-inline float3 TextureData_SampleNormalFromBump_uchar4(__global uchar4 const* mydatac, int width, int height, int t0, int s0)
-{
-	int t0minus = clamp(t0 - 1, 0, height - 1);
-	int t0plus = clamp(t0 + 1, 0, height - 1);
-	int s0minus = clamp(s0 - 1, 0, width - 1);
-	int s0plus = clamp(s0 + 1, 0, width - 1);
-
-	const uchar utex00 = (*(mydatac + width * t0minus + s0minus)).x;
-	const uchar utex10 = (*(mydatac + width * t0minus + (s0))).x;
-	const uchar utex20 = (*(mydatac + width * t0minus + s0plus)).x;
-
-	const uchar utex01 = (*(mydatac + width * (t0)+s0minus)).x;
-	const uchar utex21 = (*(mydatac + width * (t0)+(s0 + 1))).x;
-
-	const uchar utex02 = (*(mydatac + width * t0plus + s0minus)).x;
-	const uchar utex12 = (*(mydatac + width * t0plus + (s0))).x;
-	const uchar utex22 = (*(mydatac + width * t0plus + s0plus)).x;
-
-	const float tex00 = (float)utex00 / 255.f;
-	const float tex10 = (float)utex10 / 255.f;
-	const float tex20 = (float)utex20 / 255.f;
-
-	const float tex01 = (float)utex01 / 255.f;
-	const float tex21 = (float)utex21 / 255.f;
-
-	const float tex02 = (float)utex02 / 255.f;
-	const float tex12 = (float)utex12 / 255.f;
-	const float tex22 = (float)utex22 / 255.f;
-
-	const float Gx = tex00 - tex20 + 2.0f * tex01 - 2.0f * tex21 + tex02 - tex22;
-	const float Gy = tex00 + 2.0f * tex10 + tex20 - tex02 - 2.0f * tex12 - tex22;
-	const float3 n = make_float3(Gx, Gy, 1.f);
-
-	return n;
-}
-
-inline float3 TextureData_SampleNormalFromBump_half4(__global half const* mydatah, int width, int height, int t0, int s0)
-{
-	int t0minus = clamp(t0 - 1, 0, height - 1);
-	int t0plus = clamp(t0 + 1, 0, height - 1);
-	int s0minus = clamp(s0 - 1, 0, width - 1);
-	int s0plus = clamp(s0 + 1, 0, width - 1);
-
-	const float tex00 = vload_half4(width * t0minus + s0minus, mydatah).x;
-	const float tex10 = vload_half4(width * t0minus + (s0), mydatah).x;
-	const float tex20 = vload_half4(width * t0minus + s0plus, mydatah).x;
-
-	const float tex01 = vload_half4(width * (t0)+s0minus, mydatah).x;
-	const float tex21 = vload_half4(width * (t0)+s0plus, mydatah).x;
-
-	const float tex02 = vload_half4(width * t0plus + s0minus, mydatah).x;
-	const float tex12 = vload_half4(width * t0plus + (s0), mydatah).x;
-	const float tex22 = vload_half4(width * t0plus + s0plus, mydatah).x;
-
-	const float Gx = tex00 - tex20 + 2.0f * tex01 - 2.0f * tex21 + tex02 - tex22;
-	const float Gy = tex00 + 2.0f * tex10 + tex20 - tex02 - 2.0f * tex12 - tex22;
-	const float3 n = make_float3(Gx, Gy, 1.f);
-
-	return n;
-}
-
-inline float3 TextureData_SampleNormalFromBump_float4(__global float4 const* mydataf, int width, int height, int t0, int s0)
-{
-	int t0minus = clamp(t0 - 1, 0, height - 1);
-	int t0plus = clamp(t0 + 1, 0, height - 1);
-	int s0minus = clamp(s0 - 1, 0, width - 1);
-	int s0plus = clamp(s0 + 1, 0, width - 1);
-
-	const float tex00 = (*(mydataf + width * t0minus + s0minus)).x;
-	const float tex10 = (*(mydataf + width * t0minus + (s0))).x;
-	const float tex20 = (*(mydataf + width * t0minus + s0plus)).x;
-
-	const float tex01 = (*(mydataf + width * (t0)+s0minus)).x;
-	const float tex21 = (*(mydataf + width * (t0)+s0plus)).x;
-
-	const float tex02 = (*(mydataf + width * t0plus + s0minus)).x;
-	const float tex12 = (*(mydataf + width * t0plus + (s0))).x;
-	const float tex22 = (*(mydataf + width * t0plus + s0plus)).x;
-
-	const float Gx = tex00 - tex20 + 2.0f * tex01 - 2.0f * tex21 + tex02 - tex22;
-	const float Gy = tex00 + 2.0f * tex10 + tex20 - tex02 - 2.0f * tex12 - tex22;
-	const float3 n = make_float3(Gx, Gy, 1.f);
-
-	return n;
-}
-
-/// Sample 2D texture
+/// Sample normal of a bump map from its derivative map, see Texture::CreateDerivativeMap.
+/// Gradients are filtered by a single fetch of the two channel map.
 inline
 float3 Texture_SampleBump(float2 uv, TEXTURE_ARG_LIST_IDX(texidx))
 {
-    // Get width and height
-    int width = textures[texidx].w;
-    int height = textures[texidx].h;
-
-    // Find the origin of the data in the pool
-    __global char const* mydata = texturedata + textures[texidx].dataoffset;
-
-    // Handle UV wrap
-    // TODO: need UV mode support
-    uv -= floor(uv);
-
-    // Reverse Y:
-    // it is needed as textures are loaded with Y axis going top to down
-    // and our axis goes from down to top
-    uv.y = 1.f - uv.y;
-
-    // Calculate integer coordinates
-    int s0 = clamp((int)floor(uv.x * width), 0, width - 1);
-    int t0 = clamp((int)floor(uv.y * height), 0, height - 1);
-
-	int s1 = clamp(s0 + 1, 0, width - 1);
-	int t1 = clamp(t0 + 1, 0, height - 1);
-
-	// Calculate weights for linear filtering
-	float wx = uv.x * width - floor(uv.x * width);
-	float wy = uv.y * height - floor(uv.y * height);
-
-    switch (textures[texidx].fmt)
-    {
-    case RGBA32:
-    {
-        __global float3 const* mydataf = (__global float3 const*)mydata;
-
-		float3 n00 = TextureData_SampleNormalFromBump_float4(mydataf, width, height, t0, s0);
-		float3 n01 = TextureData_SampleNormalFromBump_float4(mydataf, width, height, t0, s1);
-		float3 n10 = TextureData_SampleNormalFromBump_float4(mydataf, width, height, t1, s0);
-		float3 n11 = TextureData_SampleNormalFromBump_float4(mydataf, width, height, t1, s1);
-
-		float3 n = lerp3(lerp3(n00, n01, wx), lerp3(n10, n11, wx), wy);
-
-		return 0.5f * normalize(n) + make_float3(0.5f, 0.5f, 0.5f);
-    }
-
-    case RGBA16:
-    {
-        __global half const* mydatah = (__global half const*)mydata;
+    // Missing UDIM tiles give zero gradients, so they are flat
+    float2 gradient = Texture_Sample2D(uv, TEXTURE_ARGS_IDX(texidx)).xy;
+    float3 n = make_float3(gradient.x, gradient.y, 1.f);
 
-		float3 n00 = TextureData_SampleNormalFromBump_half4(mydatah, width, height, t0, s0);
-		float3 n01 = TextureData_SampleNormalFromBump_half4(mydatah, width, height, t0, s1);
-		float3 n10 = TextureData_SampleNormalFromBump_half4(mydatah, width, height, t1, s0);
-		float3 n11 = TextureData_SampleNormalFromBump_half4(mydatah, width, height, t1, s1);
-
-		float3 n = lerp3(lerp3(n00, n01, wx), lerp3(n10, n11, wx), wy);
-
-		return 0.5f * normalize(n) + make_float3(0.5f, 0.5f, 0.5f);
-    }
-
-    case RGBA8:
-    {
-        __global uchar4 const* mydatac = (__global uchar4 const*)mydata;
-
-		float3 n00 = TextureData_SampleNormalFromBump_uchar4(mydatac, width, height, t0, s0);
-		float3 n01 = TextureData_SampleNormalFromBump_uchar4(mydatac, width, height, t0, s1);
-		float3 n10 = TextureData_SampleNormalFromBump_uchar4(mydatac, width, height, t1, s0);
-		float3 n11 = TextureData_SampleNormalFromBump_uchar4(mydatac, width, height, t1, s1);
-
-		float3 n = lerp3(lerp3(n00, n01, wx), lerp3(n10, n11, wx), wy);
-
-		return 0.5f * normalize(n) + make_float3(0.5f, 0.5f, 0.5f);
-    }
-
-    default:
-    {
-        return make_float3(0.f, 0.f, 0.f);
-    }
-    }
+    return 0.5f * normalize(n) + make_float3(0.5f, 0.5f, 0.5f);
 }
 
 
-
 #endif // TEXTURE_CL
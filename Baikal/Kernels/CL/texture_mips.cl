@@ -0,0 +1,171 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef TEXTURE_MIPS_CL
+#define TEXTURE_MIPS_CL
+
+#include <../Baikal/Kernels/CL/common.cl>
+#include <../Baikal/Kernels/CL/texture.cl>
+
+// Read texel as float4
+INLINE float4 TextureMips_Load(GLOBAL char const* data, int idx, int fmt)
+{
+    switch (fmt)
+    {
+        case RGBA32:
+            return ((GLOBAL float4 const*)data)[idx];
+        case RGBA16:
+            return vload_half4(idx, (GLOBAL half const*)data);
+        case R8:
+            return (float4)((float)((GLOBAL uchar const*)data)[idx] / 255.f);
+        case R16:
+            return (float4)(vload_half(idx, (GLOBAL half const*)data));
+        case RG8:
+            return (float4)(convert_float2(((GLOBAL uchar2 const*)data)[idx]) / 255.f, 0.f, 0.f);
+        case RG16:
+            return (float4)(vload_half2(idx, (GLOBAL half const*)data), 0.f, 0.f);
+        default:
+            return convert_float4(((GLOBAL uchar4 const*)data)[idx]) / 255.f;
+    }
+}
+
+// Write texel from float4
+INLINE void TextureMips_Store(GLOBAL char* data, int idx, int fmt, float4 value)
+{
+    switch (fmt)
+    {
+        case RGBA32:
+            ((GLOBAL float4*)data)[idx] = value;
+            break;
+        case RGBA16:
+            vstore_half4(value, idx, (GLOBAL half*)data);
+            break;
+        case R8:
+            ((GLOBAL uchar*)data)[idx] = convert_uchar_sat_rte(value.x * 255.f);
+            break;
+        case R16:
+            vstore_half(value.x, idx, (GLOBAL half*)data);
+            break;
+        case RG8:
+            ((GLOBAL uchar2*)data)[idx] = convert_uchar2_sat_rte(value.xy * 255.f);
+            break;
+        case RG16:
+            vstore_half2(value.xy, idx, (GLOBAL half*)data);
+            break;
+        default:
+            ((GLOBAL uchar4*)data)[idx] = convert_uchar4_sat_rte(value * 255.f);
+            break;
+    }
+}
+
+// Build mip level from the previous one with a 2x2 box filter,
+// the last row and column of odd sized levels are folded into the neighbouring texels
+KERNEL
+void GenerateMipLevel(
+    // Texture format
+    int fmt,
+    // Offset and size of the previous level
+    int src_offset,
+    int src_width,
+    int src_height,
+    // Offset and size of the level to build
+    int dst_offset,
+    int dst_width,
+    int dst_height,
+    // Texture data
+    GLOBAL char* restrict texturedata
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < dst_width * dst_height)
+    {
+        int x = global_id % dst_width;
+        int y = global_id / dst_width;
+
+        // Texels covered by the destination texel
+        int x0 = min(2 * x, src_width - 1);
+        int y0 = min(2 * y, src_height - 1);
+        int x1 = (x == dst_width - 1) ? (src_width - 1) : min(2 * x + 1, src_width - 1);
+        int y1 = (y == dst_height - 1) ? (src_height - 1) : min(2 * y + 1, src_height - 1);
+
+        GLOBAL char const* src = texturedata + src_offset;
+        float4 sum = make_float4(0.f, 0.f, 0.f, 0.f);
+
+        for (int j = y0; j <= y1; ++j)
+        {
+            for (int i = x0; i <= x1; ++i)
+            {
+                sum += TextureMips_Load(src, TextureData_GetTexelIndex(i, j, src_width), fmt);
+            }
+        }
+
+        float count = (float)((x1 - x0 + 1) * (y1 - y0 + 1));
+        TextureMips_Store(texturedata + dst_offset, TextureData_GetTexelIndex(x, y, dst_width), fmt, sum / count);
+    }
+}
+
+// Expand three channel texels as stored in image files to the RGBA layout of texture data,
+// alpha is zero the same way the host expansion leaves it
+KERNEL
+void ExpandTextureChannels(
+    // Device texture format
+    int fmt,
+    // Texture size
+    int width,
+    int height,
+    int depth,
+    // Packed three channel texels
+    GLOBAL char const* restrict src,
+    // Offset of the texture in texture data
+    int dst_offset,
+    // Texture data
+    GLOBAL char* restrict texturedata
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < width * height * depth)
+    {
+        int x = global_id % width;
+        int y = (global_id / width) % height;
+        int z = global_id / (width * height);
+
+        GLOBAL char* dst = texturedata + dst_offset;
+        int idx = z * TextureData_GetStoredTexelCount(width, height) + TextureData_GetTexelIndex(x, y, width);
+
+        switch (fmt)
+        {
+            case RGBA32:
+                ((GLOBAL float4*)dst)[idx] = (float4)(vload3(global_id, (GLOBAL float const*)src), 0.f);
+                break;
+            case RGBA16:
+                // Half bits are copied as they are
+                ((GLOBAL ushort4*)dst)[idx] = (ushort4)(vload3(global_id, (GLOBAL ushort const*)src), 0);
+                break;
+            default:
+                ((GLOBAL uchar4*)dst)[idx] = (uchar4)(vload3(global_id, (GLOBAL uchar const*)src), 0);
+                break;
+        }
+    }
+}
+
+#endif // TEXTURE_MIPS_CL
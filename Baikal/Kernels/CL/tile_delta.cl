@@ -0,0 +1,107 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef TILE_DELTA_CL
+#define TILE_DELTA_CL
+
+#include <../Baikal/Kernels/CL/common.cl>
+
+// Matches TileDeltaEncoder::kTileSize, one work group per tile
+#define TILE_DELTA_SIZE 16
+
+// Largest difference of the color channels in quantization steps
+INLINE int TileDelta_Difference(uint a, uint b)
+{
+    uint4 d = abs_diff(convert_int4(as_uchar4(a)), convert_int4(as_uchar4(b)));
+    return (int)max(max(d.x, d.y), d.z);
+}
+
+// Find tiles of an RGBA8 image which moved away from the last sent ones and pack them.
+// Changed tiles get consecutive slots in arbitrary order, edge tiles repeat the last row and column.
+KERNEL
+void TileDelta_Detect(
+    // Tightly packed RGBA8 image
+    GLOBAL uint const* restrict image,
+    // Image as of the last time each tile was sent, updated for the changed tiles
+    GLOBAL uint* restrict reference,
+    int width,
+    int height,
+    // Tiles differing by more than threshold in any pixel are sent
+    int threshold,
+    // Non-zero sends all the tiles
+    int send_all,
+    // Number of changed tiles, cleared by the host
+    GLOBAL int* restrict num_changed,
+    // Tile index of each slot
+    GLOBAL int* restrict changed_tiles,
+    // TILE_DELTA_SIZE^2 pixels of each slot
+    GLOBAL uint* restrict packed
+)
+{
+    __local int lds[TILE_DELTA_SIZE * TILE_DELTA_SIZE];
+    __local int slot;
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    int lid = ly * TILE_DELTA_SIZE + lx;
+    int num_tiles_x = (width + TILE_DELTA_SIZE - 1) / TILE_DELTA_SIZE;
+    int tile = get_group_id(1) * num_tiles_x + get_group_id(0);
+
+    int gx = get_global_id(0);
+    int gy = get_global_id(1);
+    bool inside = gx < width && gy < height;
+    int idx = min(gy, height - 1) * width + min(gx, width - 1);
+
+    uint value = image[idx];
+    lds[lid] = inside ? TileDelta_Difference(value, reference[idx]) : 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int offset = (TILE_DELTA_SIZE * TILE_DELTA_SIZE) >> 1; offset > 0; offset >>= 1)
+    {
+        if (lid < offset)
+        {
+            lds[lid] = max(lds[lid], lds[lid + offset]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // Same for the whole group, so is the barrier below
+    if (!send_all && lds[0] <= threshold)
+    {
+        return;
+    }
+
+    if (lid == 0)
+    {
+        slot = atomic_inc(num_changed);
+        changed_tiles[slot] = tile;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    packed[slot * TILE_DELTA_SIZE * TILE_DELTA_SIZE + lid] = value;
+
+    if (inside)
+    {
+        reference[idx] = value;
+    }
+}
+
+#endif // TILE_DELTA_CL
@@ -0,0 +1,177 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef TONEMAP_CL
+#define TONEMAP_CL
+
+#include <../Baikal/Kernels/CL/common.cl>
+
+#define TONEMAP_LINEAR 0
+#define TONEMAP_REINHARD 1
+#define TONEMAP_FILMIC 2
+#define TONEMAP_ACES 3
+
+#define TONEMAP_OUTPUT_RGBA32F 0
+#define TONEMAP_OUTPUT_RGBA8 1
+#define TONEMAP_OUTPUT_RGBA16F 2
+
+// Uncharted 2 filmic curve by John Hable
+INLINE float3 Tonemap_FilmicCurve(float3 x)
+{
+    float const a = 0.15f;
+    float const b = 0.50f;
+    float const c = 0.10f;
+    float const d = 0.20f;
+    float const e = 0.02f;
+    float const f = 0.30f;
+    return ((x * (a * x + c * b) + d * e) / (x * (a * x + b) + d * f)) - e / f;
+}
+
+INLINE float3 Tonemap_Apply(float3 x, int tonemap_operator)
+{
+    switch (tonemap_operator)
+    {
+    case TONEMAP_REINHARD:
+        return x / (1.f + x);
+    case TONEMAP_FILMIC:
+    {
+        float const white = 11.2f;
+        return Tonemap_FilmicCurve(2.f * x) / Tonemap_FilmicCurve(make_float3(white, white, white));
+    }
+    case TONEMAP_ACES:
+    {
+        // Fit of ACES reference rendering transform by Krzysztof Narkowicz
+        return (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+    }
+    default:
+        return x;
+    }
+}
+
+// Gamma of zero selects sRGB transfer function
+INLINE float3 Tonemap_Encode(float3 x, float gamma)
+{
+    x = clamp(x, 0.f, 1.f);
+
+    if (gamma > 0.f)
+    {
+        return native_powr(x, 1.f / gamma);
+    }
+
+    float3 lo = x * 12.92f;
+    float3 hi = 1.055f * native_powr(x, 1.f / 2.4f) - 0.055f;
+    return select(hi, lo, isless(x, (float3)(0.0031308f)));
+}
+
+// Color ramp from blue over green to red for t in [0, 1]
+INLINE float3 Tonemap_Heatmap(float t)
+{
+    t = clamp(t, 0.f, 1.f);
+    float3 color = make_float3(
+        clamp(2.f * t - 0.5f, 0.f, 1.f),
+        clamp(2.f - fabs(4.f * t - 2.f), 0.f, 1.f),
+        clamp(1.5f - 2.f * t, 0.f, 1.f));
+    return color;
+}
+
+// Triangular distributed noise in [-1, 1] from pixel index
+INLINE float Tonemap_Dither(uint idx)
+{
+    uint h = idx * 0x9e3779b9u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+
+    float u0 = (float)(h & 0xffffu) / 65535.f;
+    float u1 = (float)(h >> 16) / 65535.f;
+    return u0 + u1 - 1.f;
+}
+
+// Tonemap and quantize accumulated color, writes RGBA8, RGBA16F or RGBA32F with w set to 1
+KERNEL
+void Tonemap_main(
+    // Color data, divided by sample count in w
+    GLOBAL float4 const* restrict colors,
+    // Number of pixels
+    int num_pixels,
+    // Exposure multiplier
+    float exposure,
+    int tonemap_operator,
+    float gamma,
+    // Dithering amplitude in quantization steps
+    float dither,
+    // Non-zero keeps linear values without clamping and encoding
+    int hdr,
+    // Channel shown as a heatmap, 0 - off, 1..3 - x..z
+    int heatmap_channel,
+    // Per sample value at the top of the heatmap ramp
+    float heatmap_max,
+    // One of TONEMAP_OUTPUT_* formats
+    int output_format,
+    // Resulting color
+    GLOBAL uchar* restrict out_colors
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < num_pixels)
+    {
+        float4 v = colors[global_id];
+        float3 color = v.w > 0.f ? v.xyz / v.w : make_float3(0.f, 0.f, 0.f);
+
+        if (heatmap_channel > 0)
+        {
+            // Ramp colors are display values already
+            float value = heatmap_channel == 1 ? color.x : (heatmap_channel == 2 ? color.y : color.z);
+            color = Tonemap_Heatmap(value / heatmap_max);
+        }
+        else
+        {
+            color = Tonemap_Apply(color * exposure, tonemap_operator);
+
+            if (!hdr)
+            {
+                color = Tonemap_Encode(color, gamma);
+            }
+        }
+
+        switch (output_format)
+        {
+        case TONEMAP_OUTPUT_RGBA8:
+        {
+            color = color * 255.f + dither * Tonemap_Dither((uint)global_id);
+            uchar4 value = convert_uchar4_sat_rte(make_float4(color.x, color.y, color.z, 255.f));
+            vstore4(value, global_id, out_colors);
+            break;
+        }
+        case TONEMAP_OUTPUT_RGBA16F:
+            vstore_half4(make_float4(color.x, color.y, color.z, 1.f), global_id, (GLOBAL half*)out_colors);
+            break;
+        default:
+            vstore4(make_float4(color.x, color.y, color.z, 1.f), global_id, (GLOBAL float*)out_colors);
+            break;
+        }
+    }
+}
+
+#endif // TONEMAP_CL
@@ -0,0 +1,409 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef UBERV2_GENERIC_CL
+#define UBERV2_GENERIC_CL
+
+// Generic replacement of generated uberv2_generated.cl. Checks material layers at runtime
+// instead of specializing per layer combination, so it does not depend on the scene.
+// Has to match CLUberV2Generator output for every layer combination.
+
+void UberV2PrepareInputs(
+    DifferentialGeometry const* dg, GLOBAL InputMapData const* restrict input_map_values,
+    GLOBAL int const* restrict material_attributes, TEXTURE_ARG_LIST, UberV2ShaderData *data)
+{
+    const int layers = dg->mat.layers;
+    int offset = dg->mat.offset + 1;
+
+    // Should have same order as in ClwSceneController::WriteMaterial
+    if ((layers & kEmissionLayer) == kEmissionLayer)
+    {
+        data->emission_color = GetInputMapFloat4(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+    }
+    if ((layers & kCoatingLayer) == kCoatingLayer)
+    {
+        data->coating_color = GetInputMapFloat4(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->coating_ior = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+    }
+    if ((layers & kReflectionLayer) == kReflectionLayer)
+    {
+        data->reflection_color = GetInputMapFloat4(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->reflection_roughness = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->reflection_anisotropy = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->reflection_anisotropy_rotation = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->reflection_ior = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->reflection_metalness = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+    }
+    if ((layers & kDiffuseLayer) == kDiffuseLayer)
+    {
+        data->diffuse_color = GetInputMapFloat4(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+    }
+    if ((layers & kRefractionLayer) == kRefractionLayer)
+    {
+        data->refraction_color = GetInputMapFloat4(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->refraction_roughness = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->refraction_ior = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+    }
+    if ((layers & kTransparencyLayer) == kTransparencyLayer)
+    {
+        data->transparency = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+    }
+    if ((layers & kShadingNormalLayer) == kShadingNormalLayer)
+    {
+        data->shading_normal = GetInputMapFloat4(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+    }
+    if ((layers & kSSSLayer) == kSSSLayer)
+    {
+        data->sss_absorption_color = GetInputMapFloat4(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->sss_scatter_color = GetInputMapFloat4(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->sss_subsurface_color = GetInputMapFloat4(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->sss_absorption_distance = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->sss_scatter_distance = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->sss_scatter_direction = GetInputMapFloat(material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS);
+        data->sss_diffusion = (material_attributes[dg->mat.offset] >> 4) & 1;
+    }
+}
+
+// Only fills transparency, skipping inputs of the layers it is stored after
+void UberV2PrepareTransparency(
+    DifferentialGeometry const* dg, GLOBAL InputMapData const* restrict input_map_values,
+    GLOBAL int const* restrict material_attributes, TEXTURE_ARG_LIST, UberV2ShaderData *data)
+{
+    const int layers = dg->mat.layers;
+    int offset = dg->mat.offset + 1;
+
+    if ((layers & kTransparencyLayer) != kTransparencyLayer)
+    {
+        return;
+    }
+
+    offset += ((layers & kEmissionLayer) == kEmissionLayer) ? 1 : 0;
+    offset += ((layers & kCoatingLayer) == kCoatingLayer) ? 2 : 0;
+    offset += ((layers & kReflectionLayer) == kReflectionLayer) ? 6 : 0;
+    offset += ((layers & kDiffuseLayer) == kDiffuseLayer) ? 1 : 0;
+    offset += ((layers & kRefractionLayer) == kRefractionLayer) ? 3 : 0;
+
+    data->transparency = GetInputMapFloat(material_attributes[offset], dg, input_map_values, TEXTURE_ARGS);
+}
+
+// Same as CLUberV2Generator::HasDiffusionSSS with diffusion mode of the material
+bool UberV2_IsDiffusionSSSGeneric(int layers, UberV2ShaderData const* shader_data)
+{
+    return ((layers & (kSSSLayer | kDiffuseLayer)) == (kSSSLayer | kDiffuseLayer)) && UberV2_IsDiffusionSSS(shader_data);
+}
+
+void GetMaterialBxDFType(
+    float3 wi, Sampler* sampler, SAMPLER_ARG_LIST, DifferentialGeometry* dg, UberV2ShaderData const* shader_data)
+{
+    const int layers = dg->mat.layers;
+    const float ndotwi = dot(dg->n, wi);
+    int bxdf_flags = 0;
+
+    if ((layers & kEmissionLayer) == kEmissionLayer)
+    {
+        bxdf_flags |= kBxdfFlagsEmissive;
+    }
+
+    // Samples are only taken if there is a layer underneath, same as in generated code
+    if ((layers & kTransparencyLayer) == kTransparencyLayer)
+    {
+        const bool has_underlying_layer = (layers & (kRefractionLayer | kCoatingLayer | kReflectionLayer | kDiffuseLayer)) != 0;
+
+        if (!has_underlying_layer || Sampler_Sample1D(sampler, SAMPLER_ARGS) < shader_data->transparency)
+        {
+            bxdf_flags |= (kBxdfFlagsTransparency | kBxdfFlagsSingular);
+            Bxdf_SetFlags(dg, bxdf_flags);
+            Bxdf_UberV2_SetSampledComponent(dg, kBxdfUberV2SampleTransparency);
+            return;
+        }
+    }
+
+    if ((layers & kRefractionLayer) == kRefractionLayer)
+    {
+        const bool has_underlying_layer = (layers & (kCoatingLayer | kReflectionLayer | kDiffuseLayer)) != 0;
+
+        if (!has_underlying_layer ||
+            Sampler_Sample1D(sampler, SAMPLER_ARGS) >= CalculateFresnel(1.0f, shader_data->refraction_ior, ndotwi))
+        {
+            Bxdf_UberV2_SetSampledComponent(dg, kBxdfUberV2SampleRefraction);
+            if (shader_data->refraction_roughness < ROUGHNESS_EPS)
+            {
+                bxdf_flags |= kBxdfFlagsSingular;
+            }
+            Bxdf_SetFlags(dg, bxdf_flags);
+            return;
+        }
+    }
+
+    float top_ior = 1.0f;
+
+    if ((layers & (kReflectionLayer | kRefractionLayer | kCoatingLayer)) != 0)
+    {
+        bxdf_flags |= kBxdfFlagsBrdf;
+    }
+
+    if ((layers & kCoatingLayer) == kCoatingLayer)
+    {
+        const bool has_underlying_layer = (layers & (kReflectionLayer | kDiffuseLayer)) != 0;
+
+        if (!has_underlying_layer ||
+            Sampler_Sample1D(sampler, SAMPLER_ARGS) < CalculateFresnel(top_ior, shader_data->coating_ior, ndotwi))
+        {
+            bxdf_flags |= kBxdfFlagsSingular;
+            Bxdf_SetFlags(dg, bxdf_flags);
+            Bxdf_UberV2_SetSampledComponent(dg, kBxdfUberV2SampleCoating);
+            return;
+        }
+
+        top_ior = shader_data->coating_ior;
+    }
+
+    if ((layers & kReflectionLayer) == kReflectionLayer)
+    {
+        const bool has_underlying_layer = (layers & kDiffuseLayer) != 0;
+
+        if (!has_underlying_layer ||
+            Sampler_Sample1D(sampler, SAMPLER_ARGS) <
+            UberV2_GetReflectionWeight(top_ior, shader_data->reflection_ior, shader_data->reflection_roughness, ndotwi))
+        {
+            if (shader_data->reflection_roughness < ROUGHNESS_EPS)
+            {
+                bxdf_flags |= kBxdfFlagsSingular;
+            }
+            Bxdf_UberV2_SetSampledComponent(dg, kBxdfUberV2SampleReflection);
+            Bxdf_SetFlags(dg, bxdf_flags);
+            return;
+        }
+    }
+
+    if ((layers & kDiffuseLayer) == kDiffuseLayer)
+    {
+        if (UberV2_IsDiffusionSSSGeneric(layers, shader_data))
+        {
+            Bxdf_UberV2_SetSampledComponent(dg, kBxdfUberV2SampleSubsurface);
+            Bxdf_SetFlags(dg, bxdf_flags | kBxdfFlagsBrdf | kBxdfFlagsSingular);
+            return;
+        }
+
+        Bxdf_UberV2_SetSampledComponent(dg, kBxdfUberV2SampleDiffuse);
+        bxdf_flags |= kBxdfFlagsBrdf;
+    }
+
+    Bxdf_SetFlags(dg, bxdf_flags);
+}
+
+// Blends layer values the same way as CLUberV2Generator::GenerateBlend.
+// Layers without roughness are blended by reflection_blend as singular reflection, i.e. by Fresnel only
+#define UBERV2_GENERIC_BLEND(type, fresnel_blend, reflection_blend, coating_value, reflection_value, diffuse_value, refraction_value) \
+    type values[3]; \
+    float iors[3]; \
+    float roughness[3]; \
+    int num_values = 0; \
+    int num_iors = 1; \
+    iors[0] = 1.0f; \
+    if ((layers & kCoatingLayer) == kCoatingLayer) \
+    { \
+        iors[num_iors++] = shader_data->coating_ior; \
+        roughness[num_values] = 0.0f; \
+        values[num_values++] = coating_value; \
+    } \
+    if ((layers & kReflectionLayer) == kReflectionLayer) \
+    { \
+        iors[num_iors++] = shader_data->reflection_ior; \
+        roughness[num_values] = shader_data->reflection_roughness; \
+        values[num_values++] = reflection_value; \
+    } \
+    if ((layers & kDiffuseLayer) == kDiffuseLayer) \
+    { \
+        roughness[num_values] = 0.0f; \
+        values[num_values++] = diffuse_value; \
+    } \
+    type result = 0.0f; \
+    if (num_values > 0) \
+    { \
+        result = values[num_values - 1]; \
+        for (int a = num_iors - 1; a > 0; --a) \
+        { \
+            result = reflection_blend(iors[a - 1], iors[a], roughness[a - 1], values[a - 1], result, wi); \
+        } \
+    } \
+    if ((layers & kRefractionLayer) == kRefractionLayer) \
+    { \
+        result = num_values > 0 ? \
+            fresnel_blend(1.0f, shader_data->refraction_ior, result, refraction_value, wi) : \
+            refraction_value; \
+    } \
+    if ((layers & kTransparencyLayer) == kTransparencyLayer) \
+    { \
+        result = mix(result, (type)(0.0f), shader_data->transparency); \
+    } \
+    return result;
+
+float3 UberV2_EvaluateGeneric(
+    int layers, float3 wi, float3 wo, TEXTURE_ARG_LIST, UberV2ShaderData const* shader_data)
+{
+    UBERV2_GENERIC_BLEND(float3, Fresnel_Blend, Reflection_Blend,
+        UberV2_IdealReflect_Evaluate(shader_data, wi, wo, TEXTURE_ARGS),
+        UberV2_Reflection_Evaluate(shader_data, wi, wo, TEXTURE_ARGS),
+        UberV2_IsDiffusionSSSGeneric(layers, shader_data) ? (float3)(0.0f) : UberV2_Lambert_Evaluate(shader_data, wi, wo, TEXTURE_ARGS),
+        UberV2_Refraction_Evaluate(shader_data, wi, wo, TEXTURE_ARGS))
+}
+
+float UberV2_GetPdfGeneric(
+    int layers, float3 wi, float3 wo, TEXTURE_ARG_LIST, UberV2ShaderData const* shader_data)
+{
+    UBERV2_GENERIC_BLEND(float, Fresnel_Blend_F, Reflection_Blend_F,
+        UberV2_IdealReflect_GetPdf(shader_data, wi, wo, TEXTURE_ARGS),
+        UberV2_Reflection_GetPdf(shader_data, wi, wo, TEXTURE_ARGS),
+        UberV2_IsDiffusionSSSGeneric(layers, shader_data) ? 0.0f : UberV2_Lambert_GetPdf(shader_data, wi, wo, TEXTURE_ARGS),
+        UberV2_Refraction_GetPdf(shader_data, wi, wo, TEXTURE_ARGS))
+}
+
+#undef UBERV2_GENERIC_BLEND
+
+#ifdef BAIKAL_UBERV2_STOCHASTIC_LAYERS
+// Evaluates only the layer selected by GetMaterialBxDFType, same as CLUberV2Generator::GenerateSampledLayer
+float3 UberV2_EvaluateSampledLayerGeneric(
+    int layers, int component, float3 wi, float3 wo, TEXTURE_ARG_LIST, UberV2ShaderData const* shader_data)
+{
+    switch (component)
+    {
+        case kBxdfUberV2SampleCoating:
+            if ((layers & kCoatingLayer) == kCoatingLayer)
+                return UberV2_IdealReflect_Evaluate(shader_data, wi, wo, TEXTURE_ARGS);
+            break;
+        case kBxdfUberV2SampleReflection:
+            if ((layers & kReflectionLayer) == kReflectionLayer)
+                return UberV2_Reflection_Evaluate(shader_data, wi, wo, TEXTURE_ARGS);
+            break;
+        case kBxdfUberV2SampleRefraction:
+            if ((layers & kRefractionLayer) == kRefractionLayer)
+                return UberV2_Refraction_Evaluate(shader_data, wi, wo, TEXTURE_ARGS);
+            break;
+        case kBxdfUberV2SampleDiffuse:
+            if ((layers & kDiffuseLayer) == kDiffuseLayer)
+                return UberV2_Lambert_Evaluate(shader_data, wi, wo, TEXTURE_ARGS);
+            break;
+    }
+
+    return (float3)(0.0f);
+}
+
+float UberV2_GetSampledLayerPdfGeneric(
+    int layers, int component, float3 wi, float3 wo, TEXTURE_ARG_LIST, UberV2ShaderData const* shader_data)
+{
+    switch (component)
+    {
+        case kBxdfUberV2SampleCoating:
+            if ((layers & kCoatingLayer) == kCoatingLayer)
+                return UberV2_IdealReflect_GetPdf(shader_data, wi, wo, TEXTURE_ARGS);
+            break;
+        case kBxdfUberV2SampleReflection:
+            if ((layers & kReflectionLayer) == kReflectionLayer)
+                return UberV2_Reflection_GetPdf(shader_data, wi, wo, TEXTURE_ARGS);
+            break;
+        case kBxdfUberV2SampleRefraction:
+            if ((layers & kRefractionLayer) == kRefractionLayer)
+                return UberV2_Refraction_GetPdf(shader_data, wi, wo, TEXTURE_ARGS);
+            break;
+        case kBxdfUberV2SampleDiffuse:
+            if ((layers & kDiffuseLayer) == kDiffuseLayer)
+                return UberV2_Lambert_GetPdf(shader_data, wi, wo, TEXTURE_ARGS);
+            break;
+    }
+
+    return 0.0f;
+}
+#endif
+
+float3 UberV2_Evaluate(
+    DifferentialGeometry const* dg, float3 wi, float3 wo, TEXTURE_ARG_LIST, UberV2ShaderData const* shader_data)
+{
+    float3 wi_t = matrix_mul_vector3(dg->world_to_tangent, wi);
+    float3 wo_t = matrix_mul_vector3(dg->world_to_tangent, wo);
+    if (Bxdf_UberV2_GetSampledComponent(dg) == kBxdfUberV2SampleSubsurface)
+    {
+        return UberV2_Subsurface_Evaluate(shader_data, wi_t, wo_t, TEXTURE_ARGS);
+    }
+#ifdef BAIKAL_UBERV2_STOCHASTIC_LAYERS
+    return UberV2_EvaluateSampledLayerGeneric(dg->mat.layers, Bxdf_UberV2_GetSampledComponent(dg), wi_t, wo_t, TEXTURE_ARGS, shader_data);
+#else
+    return UberV2_EvaluateGeneric(dg->mat.layers, wi_t, wo_t, TEXTURE_ARGS, shader_data);
+#endif
+}
+
+float UberV2_GetPdf(
+    DifferentialGeometry const* dg, float3 wi, float3 wo, TEXTURE_ARG_LIST, UberV2ShaderData const* shader_data)
+{
+    float3 wi_t = matrix_mul_vector3(dg->world_to_tangent, wi);
+    float3 wo_t = matrix_mul_vector3(dg->world_to_tangent, wo);
+    if (Bxdf_UberV2_GetSampledComponent(dg) == kBxdfUberV2SampleSubsurface)
+    {
+        return UberV2_Subsurface_GetPdf(shader_data, wi_t, wo_t, TEXTURE_ARGS);
+    }
+#ifdef BAIKAL_UBERV2_STOCHASTIC_LAYERS
+    return UberV2_GetSampledLayerPdfGeneric(dg->mat.layers, Bxdf_UberV2_GetSampledComponent(dg), wi_t, wo_t, TEXTURE_ARGS, shader_data);
+#else
+    return UberV2_GetPdfGeneric(dg->mat.layers, wi_t, wo_t, TEXTURE_ARGS, shader_data);
+#endif
+}
+
+float3 UberV2_Sample(
+    DifferentialGeometry const* dg, float3 wi, TEXTURE_ARG_LIST, float2 sample,
+    float3 *wo, float *pdf, UberV2ShaderData const* shader_data)
+{
+    const int layers = dg->mat.layers;
+    float3 wi_t = matrix_mul_vector3(dg->world_to_tangent, wi);
+    float3 wo_t;
+    float3 res = 0.f;
+
+    switch (Bxdf_UberV2_GetSampledComponent(dg))
+    {
+        case kBxdfUberV2SampleTransparency:
+            if ((layers & kTransparencyLayer) == kTransparencyLayer)
+                res = UberV2_Passthrough_Sample(shader_data, wi_t, TEXTURE_ARGS, sample, &wo_t, pdf);
+            break;
+        case kBxdfUberV2SampleCoating:
+            if ((layers & kCoatingLayer) == kCoatingLayer)
+                res = UberV2_Coating_Sample(shader_data, wi_t, TEXTURE_ARGS, &wo_t, pdf);
+            break;
+        case kBxdfUberV2SampleReflection:
+            if ((layers & kReflectionLayer) == kReflectionLayer)
+                res = UberV2_Reflection_Sample(shader_data, wi_t, TEXTURE_ARGS, sample, &wo_t, pdf);
+            break;
+        case kBxdfUberV2SampleRefraction:
+            if ((layers & kRefractionLayer) == kRefractionLayer)
+                res = UberV2_Refraction_Sample(shader_data, wi_t, TEXTURE_ARGS, sample, &wo_t, pdf);
+            break;
+        case kBxdfUberV2SampleDiffuse:
+            if ((layers & kDiffuseLayer) == kDiffuseLayer)
+                res = UberV2_Lambert_Sample(shader_data, wi_t, TEXTURE_ARGS, sample, &wo_t, pdf);
+            break;
+        case kBxdfUberV2SampleSubsurface:
+            res = UberV2_Subsurface_Sample(shader_data, wi_t, TEXTURE_ARGS, sample, &wo_t, pdf);
+            break;
+    }
+
+    *wo = matrix_mul_vector3(dg->tangent_to_world, wo_t);
+    return res;
+}
+
+#endif // UBERV2_GENERIC_CL
@@ -0,0 +1,135 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#ifndef TEMPORAL_ACCUMULATION_CL
+#ifndef UPSAMPLE_CL
+#define UPSAMPLE_CL
+
+#include <../Baikal/Kernels/CL/common.cl>
+
+#define UPSAMPLE_EPSILON 1e-4f
+
+// Upsample low resolution color, neighbours are weighted by the similarity of their depth
+// and normal to the low resolution pixel covering the output pixel, so colors of different
+// surfaces are not blended across edges
+KERNEL void Upsample_main(
+    // Accumulated low resolution color, w - number of samples
+    GLOBAL float4 const* restrict colors,
+    // Low resolution depth AOV
+    GLOBAL float4 const* restrict depths,
+    // Low resolution shading normal AOV
+    GLOBAL float4 const* restrict normals,
+    // Low resolution
+    int width,
+    int height,
+    // Output resolution
+    int out_width,
+    int out_height,
+    // Relative depth difference which halves the weight
+    float depth_sigma,
+    // Exponent of the normals cosine
+    float normal_power,
+    // Resulting color, w set to 1
+    GLOBAL float4* restrict out_colors
+)
+{
+    int global_id = get_global_id(0);
+
+    if (global_id < out_width * out_height)
+    {
+        int x = global_id % out_width;
+        int y = global_id / out_width;
+
+        // Output pixel center in low resolution pixels
+        float2 p = make_float2((x + 0.5f) * width / out_width, (y + 0.5f) * height / out_height);
+
+        int ref_x = clamp((int)p.x, 0, width - 1);
+        int ref_y = clamp((int)p.y, 0, height - 1);
+        int ref_idx = ref_y * width + ref_x;
+
+        float4 ref_depth = depths[ref_idx];
+        float4 ref_normal = normals[ref_idx];
+        bool ref_hit = ref_depth.w > 0.f;
+        float ref_d = ref_hit ? ref_depth.x / ref_depth.w : 0.f;
+        float3 ref_n = ref_normal.w > 0.f ? normalize(ref_normal.xyz) : make_float3(0.f, 0.f, 0.f);
+
+        // Bilinear footprint between low resolution pixel centers
+        p -= make_float2(0.5f, 0.5f);
+        int x0 = (int)floor(p.x);
+        int y0 = (int)floor(p.y);
+        float2 f = p - make_float2((float)x0, (float)y0);
+
+        float3 sum = make_float3(0.f, 0.f, 0.f);
+        float weight_sum = 0.f;
+
+        for (int j = 0; j < 2; ++j)
+        {
+            for (int i = 0; i < 2; ++i)
+            {
+                int sx = clamp(x0 + i, 0, width - 1);
+                int sy = clamp(y0 + j, 0, height - 1);
+                int idx = sy * width + sx;
+
+                float4 color = colors[idx];
+
+                if (color.w <= 0.f)
+                {
+                    continue;
+                }
+
+                float4 depth = depths[idx];
+                float4 normal = normals[idx];
+                bool hit = depth.w > 0.f;
+
+                float weight = (i ? f.x : 1.f - f.x) * (j ? f.y : 1.f - f.y);
+
+                if (hit != ref_hit)
+                {
+                    // Silhouette against the background
+                    weight = 0.f;
+                }
+                else if (hit)
+                {
+                    float d = depth.x / depth.w;
+                    float relative = fabs(d - ref_d) / max(ref_d, UPSAMPLE_EPSILON);
+                    weight *= native_exp2(-relative / depth_sigma);
+
+                    float3 n = normal.w > 0.f ? normalize(normal.xyz) : make_float3(0.f, 0.f, 0.f);
+                    weight *= pow(max(dot(n, ref_n), 0.f), normal_power);
+                }
+
+                // Covering pixel always contributes
+                if (sx == ref_x && sy == ref_y)
+                {
+                    weight = max(weight, UPSAMPLE_EPSILON);
+                }
+
+                sum += weight * color.xyz / color.w;
+                weight_sum += weight;
+            }
+        }
+
+        float3 result = weight_sum > 0.f ? sum / weight_sum : make_float3(0.f, 0.f, 0.f);
+        out_colors[global_id] = make_float4(result.x, result.y, result.z, 1.f);
+    }
+}
+
+#endif // UPSAMPLE_CL
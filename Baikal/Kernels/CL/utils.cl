@@ -62,6 +62,15 @@ int2 make_int2(int x, int y)
     res.y = y;
     return res;
 }
+
+int3 make_int3(int x, int y, int z)
+{
+    int3 res;
+    res.x = x;
+    res.y = y;
+    res.z = z;
+    return res;
+}
 #endif
 
 matrix4x4 matrix_from_cols(float4 c0, float4 c1, float4 c2, float4 c3)
@@ -109,6 +118,13 @@ matrix4x4 matrix_transpose(matrix4x4 m)
     return matrix_from_cols(m.m0, m.m1, m.m2, m.m3);
 }
 
+// Rotate vector by unit quaternion given as (x, y, z, w)
+float3 quaternion_rotate(float4 q, float3 v)
+{
+    float3 t = 2.f * cross(q.xyz, v);
+    return v + q.w * t + cross(q.xyz, t);
+}
+
 float4 matrix_mul_vector4(matrix4x4 m, float4 v)
 {
     float4 res;
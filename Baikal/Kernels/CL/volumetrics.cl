@@ -25,6 +25,7 @@ THE SOFTWARE.
 #include <../Baikal/Kernels/CL/common.cl>
 #include <../Baikal/Kernels/CL/payload.cl>
 #include <../Baikal/Kernels/CL/path.cl>
+#include <../Baikal/Kernels/CL/sampling.cl>
 
 #define FAKE_SHAPE_SENTINEL 0xFFFFFF
 
@@ -58,6 +59,316 @@ float PhaseFunctionHG_Sample(float3 wi, float g, float2 sample, float3* wo)
     return PhaseFunctionHG(wi, *wo, g);
 }
 
+// Heterogeneous volumes scale their coefficients by the density stored in a voxel grid.
+// Grid starts with the header (origin, inverse extent, voxel resolution, majorant
+// resolution and the number of voxels per majorant cell) followed by the densities
+// and the majorants, maximum densities of voxel blocks, both stored x first.
+// Collisions are sampled against the majorant of the cell the ray goes through.
+#define VOLUME_GRID_HEADER_SIZE 16
+// Tentative collisions per tracked segment are capped to bound the cost of dense media
+#define VOLUME_GRID_MAX_COLLISIONS 256
+// Sparse grids (Volume::extra is VOLUME_GRID_SPARSE) follow the header with a tree instead: root table of node
+// offsets over the grid, nodes of SPARSE_GRID_NODE_SIZE^3 brick offsets followed by brick
+// majorants and leaves of SPARSE_GRID_BRICK_SIZE^3 densities, see Utils/sparse_volume_grid.h.
+// Offsets are relative to the end of the header, empty nodes and bricks are -1.
+#define VOLUME_GRID_SPARSE 1
+#define SPARSE_GRID_BRICK_SIZE 8
+#define SPARSE_GRID_NODE_SIZE 8
+// Cells stepped through by tracking in a sparse grid are capped the same way
+#define SPARSE_GRID_MAX_STEPS 4096
+
+INLINE float VolumeGrid_GetVoxel(GLOBAL float const* density, int3 resolution, int3 voxel)
+{
+    return density[(voxel.z * resolution.y + voxel.y) * resolution.x + voxel.x];
+}
+
+// Density at a point in [0, 1]^3 grid space, interpolated between voxel centers
+INLINE float VolumeGrid_GetDensity(GLOBAL int const* grid, float3 u)
+{
+    int3 resolution = make_int3(grid[6], grid[7], grid[8]);
+    GLOBAL float const* density = (GLOBAL float const*)(grid + VOLUME_GRID_HEADER_SIZE);
+
+    float3 g = u * convert_float3(resolution) - 0.5f;
+    float3 f = floor(g);
+    float3 t = g - f;
+    int3 v0 = clamp(convert_int3(f), make_int3(0, 0, 0), resolution - 1);
+    int3 v1 = clamp(convert_int3(f) + 1, make_int3(0, 0, 0), resolution - 1);
+
+    float d00 = mix(VolumeGrid_GetVoxel(density, resolution, make_int3(v0.x, v0.y, v0.z)), VolumeGrid_GetVoxel(density, resolution, make_int3(v1.x, v0.y, v0.z)), t.x);
+    float d10 = mix(VolumeGrid_GetVoxel(density, resolution, make_int3(v0.x, v1.y, v0.z)), VolumeGrid_GetVoxel(density, resolution, make_int3(v1.x, v1.y, v0.z)), t.x);
+    float d01 = mix(VolumeGrid_GetVoxel(density, resolution, make_int3(v0.x, v0.y, v1.z)), VolumeGrid_GetVoxel(density, resolution, make_int3(v1.x, v0.y, v1.z)), t.x);
+    float d11 = mix(VolumeGrid_GetVoxel(density, resolution, make_int3(v0.x, v1.y, v1.z)), VolumeGrid_GetVoxel(density, resolution, make_int3(v1.x, v1.y, v1.z)), t.x);
+
+    return mix(mix(d00, d10, t.y), mix(d01, d11, t.y), t.z);
+}
+
+// Node offset of the voxel, -1 if the node is empty
+INLINE int SparseGrid_GetNode(GLOBAL int const* grid, int3 voxel)
+{
+    int3 resolution = make_int3(grid[9], grid[10], grid[11]);
+    int3 node = voxel / (SPARSE_GRID_BRICK_SIZE * SPARSE_GRID_NODE_SIZE);
+    return grid[VOLUME_GRID_HEADER_SIZE + (node.z * resolution.y + node.y) * resolution.x + node.x];
+}
+
+INLINE int SparseGrid_GetBrickSlot(int3 voxel)
+{
+    int3 brick = (voxel / SPARSE_GRID_BRICK_SIZE) % SPARSE_GRID_NODE_SIZE;
+    return (brick.z * SPARSE_GRID_NODE_SIZE + brick.y) * SPARSE_GRID_NODE_SIZE + brick.x;
+}
+
+INLINE float SparseGrid_GetVoxel(GLOBAL int const* grid, int3 voxel)
+{
+    GLOBAL int const* tree = grid + VOLUME_GRID_HEADER_SIZE;
+    int node = SparseGrid_GetNode(grid, voxel);
+
+    if (node < 0)
+    {
+        return 0.f;
+    }
+
+    int leaf = tree[node + SparseGrid_GetBrickSlot(voxel)];
+
+    if (leaf < 0)
+    {
+        return 0.f;
+    }
+
+    int3 v = voxel % SPARSE_GRID_BRICK_SIZE;
+    return as_float(tree[leaf + (v.z * SPARSE_GRID_BRICK_SIZE + v.y) * SPARSE_GRID_BRICK_SIZE + v.x]);
+}
+
+// Majorant of the brick holding the voxel, cell_size gets the number of voxels along
+// each axis sharing the majorant, bricks in empty nodes are skipped a whole node at a time
+INLINE float SparseGrid_GetMajorant(GLOBAL int const* grid, int3 voxel, int* cell_size)
+{
+    GLOBAL int const* tree = grid + VOLUME_GRID_HEADER_SIZE;
+    int node = SparseGrid_GetNode(grid, voxel);
+
+    if (node < 0)
+    {
+        *cell_size = SPARSE_GRID_BRICK_SIZE * SPARSE_GRID_NODE_SIZE;
+        return 0.f;
+    }
+
+    *cell_size = SPARSE_GRID_BRICK_SIZE;
+    return as_float(tree[node + SPARSE_GRID_NODE_SIZE * SPARSE_GRID_NODE_SIZE * SPARSE_GRID_NODE_SIZE + SparseGrid_GetBrickSlot(voxel)]);
+}
+
+// Density at a point in [0, 1]^3 grid space, interpolated between voxel centers
+INLINE float SparseGrid_GetDensity(GLOBAL int const* grid, float3 u)
+{
+    int3 resolution = make_int3(grid[6], grid[7], grid[8]);
+
+    float3 g = u * convert_float3(resolution) - 0.5f;
+    float3 f = floor(g);
+    float3 t = g - f;
+    int3 v0 = clamp(convert_int3(f), make_int3(0, 0, 0), resolution - 1);
+    int3 v1 = clamp(convert_int3(f) + 1, make_int3(0, 0, 0), resolution - 1);
+
+    float d00 = mix(SparseGrid_GetVoxel(grid, make_int3(v0.x, v0.y, v0.z)), SparseGrid_GetVoxel(grid, make_int3(v1.x, v0.y, v0.z)), t.x);
+    float d10 = mix(SparseGrid_GetVoxel(grid, make_int3(v0.x, v1.y, v0.z)), SparseGrid_GetVoxel(grid, make_int3(v1.x, v1.y, v0.z)), t.x);
+    float d01 = mix(SparseGrid_GetVoxel(grid, make_int3(v0.x, v0.y, v1.z)), SparseGrid_GetVoxel(grid, make_int3(v1.x, v0.y, v1.z)), t.x);
+    float d11 = mix(SparseGrid_GetVoxel(grid, make_int3(v0.x, v1.y, v1.z)), SparseGrid_GetVoxel(grid, make_int3(v1.x, v1.y, v1.z)), t.x);
+
+    return mix(mix(d00, d10, t.y), mix(d01, d11, t.y), t.z);
+}
+
+INLINE float VolumeGrid_Random(uint* state)
+{
+    *state = WangHash(1664525U * (*state) + 1013904223U);
+    return (*state >> 8) * (1.f / 16777216.f);
+}
+
+// Sample collisions against the majorant from t up to t_cell, exponential steps are memoryless,
+// so sampling restarts at every cell boundary. Returns true if tracking ends within the cell,
+// t is then the scattering distance or -1.
+INLINE bool Volume_SampleCollisions(GLOBAL int const* grid, bool sparse, float3 uo, float3 ud, float t_cell, float majorant,
+    float3 sigma_t, float3 sigma_s, float3 sigma_e, bool scatter, uint* state, int* num_collisions, float* t, float3* weight, float3* emission)
+{
+    while (majorant > 0.f && *num_collisions < VOLUME_GRID_MAX_COLLISIONS)
+    {
+        *t -= native_log(1.f - VolumeGrid_Random(state)) / majorant;
+
+        if (*t >= t_cell)
+        {
+            return false;
+        }
+
+        ++(*num_collisions);
+
+        float density = sparse ? SparseGrid_GetDensity(grid, uo + (*t) * ud) : VolumeGrid_GetDensity(grid, uo + (*t) * ud);
+        float3 sigma_n = max(majorant - density * sigma_t, 0.f);
+
+        *emission += (*weight) * density * sigma_e / majorant;
+
+        if (scatter)
+        {
+            float3 ss = density * sigma_s;
+            float ps = max(max(ss.x, ss.y), ss.z);
+            float pn = max(max(sigma_n.x, sigma_n.y), sigma_n.z);
+
+            if (ps + pn <= 0.f)
+            {
+                *weight = 0.f;
+                *t = -1.f;
+                return true;
+            }
+
+            float p = ps / (ps + pn);
+
+            if (VolumeGrid_Random(state) < p)
+            {
+                *weight *= ss / (majorant * p);
+                return true;
+            }
+
+            *weight *= sigma_n / (majorant * (1.f - p));
+        }
+        else
+        {
+            *weight *= sigma_n / majorant;
+
+            if (!NON_BLACK(*weight))
+            {
+                *t = -1.f;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Track the ray through a heterogeneous volume over [0, maxdist] segment.
+// Delta tracking (scatter = true) stops at a scattering event and returns its distance,
+// ratio tracking runs to the end of the segment and returns -1. Null collisions are
+// picked with probabilities proportional to the largest channel of the coefficients,
+// weight gets multiplied by the resulting throughput and emission gets the collision
+// estimate of the emission along the tracked part of the segment.
+float Volume_Track(GLOBAL Volume const* volume, GLOBAL int const* volume_grids, float3 o, float3 d, float maxdist, bool scatter, uint seed, float3* weight, float3* emission)
+{
+    GLOBAL int const* grid = volume_grids + volume->data;
+    GLOBAL float const* header = (GLOBAL float const*)grid;
+
+    float3 sigma_a = TEXTURED_INPUT_GET_COLOR(volume->sigma_a);
+    float3 sigma_s = TEXTURED_INPUT_GET_COLOR(volume->sigma_s);
+    float3 sigma_e = TEXTURED_INPUT_GET_COLOR(volume->sigma_e);
+    float3 sigma_t = sigma_a + sigma_s;
+    float max_sigma_t = max(max(sigma_t.x, sigma_t.y), sigma_t.z);
+
+    // Ray in grid space, parametrization is kept
+    float3 uo = (o - make_float3(header[0], header[1], header[2])) * make_float3(header[3], header[4], header[5]);
+    float3 ud = d * make_float3(header[3], header[4], header[5]);
+
+    float3 inv_ud = native_recip(ud);
+    float3 ta = -uo * inv_ud;
+    float3 tb = (1.f - uo) * inv_ud;
+    // Axes parallel to the ray give NaNs on slab planes, fmin and fmax skip them
+    float3 tmin = fmin(ta, tb);
+    float3 tmax = fmax(ta, tb);
+    float t = fmax(fmax(fmax(tmin.x, tmin.y), tmin.z), 0.f);
+    float t_end = fmin(fmin(fmin(tmax.x, tmax.y), tmax.z), maxdist);
+
+    if (max_sigma_t <= 0.f || t >= t_end)
+    {
+        return -1.f;
+    }
+
+    int3 resolution = make_int3(grid[6], grid[7], grid[8]);
+    uint state = seed;
+    int num_collisions = 0;
+
+    if (volume->extra == VOLUME_GRID_SPARSE)
+    {
+        // Sparse grid traversal, the cell of the majorant is looked up past the current
+        // distance to step over cell boundaries
+        float3 voxels = convert_float3(resolution);
+        float3 vd = fabs(ud * voxels);
+        float t_eps = 1e-3f / max(max(vd.x, vd.y), vd.z);
+
+        for (int step = 0; t < t_end && step < SPARSE_GRID_MAX_STEPS && num_collisions < VOLUME_GRID_MAX_COLLISIONS; ++step)
+        {
+            int3 voxel = clamp(convert_int3_sat_rtn((uo + (t + t_eps) * ud) * voxels), make_int3(0, 0, 0), resolution - 1);
+
+            int cell_size;
+            float majorant = SparseGrid_GetMajorant(grid, voxel, &cell_size) * max_sigma_t;
+
+            int3 cell = (voxel / cell_size) * cell_size;
+            float3 boundary = convert_float3(cell + select((int3)(0), (int3)(cell_size), ud > 0.f)) / voxels;
+            float3 t_exit = make_float3(
+                ud.x != 0.f ? (boundary.x - uo.x) * inv_ud.x : CRAZY_HIGH_DISTANCE,
+                ud.y != 0.f ? (boundary.y - uo.y) * inv_ud.y : CRAZY_HIGH_DISTANCE,
+                ud.z != 0.f ? (boundary.z - uo.z) * inv_ud.z : CRAZY_HIGH_DISTANCE);
+            // Cell exit is moved past the lookup point if rounding puts it before
+            float t_cell = max(min(min(min(t_exit.x, t_exit.y), t_exit.z), t_end), t + t_eps);
+
+            if (Volume_SampleCollisions(grid, true, uo, ud, t_cell, majorant, sigma_t, sigma_s, sigma_e, scatter, &state, &num_collisions, &t, weight, emission))
+            {
+                return t;
+            }
+
+            t = t_cell;
+        }
+
+        return -1.f;
+    }
+
+    // Majorant grid traversal
+    int3 majorant_resolution = make_int3(grid[9], grid[10], grid[11]);
+    GLOBAL float const* majorants = (GLOBAL float const*)(grid + VOLUME_GRID_HEADER_SIZE) + resolution.x * resolution.y * resolution.z;
+    float3 scale = convert_float3(resolution) / (float)grid[12];
+
+    float3 q = (uo + t * ud) * scale;
+    int3 cell = clamp(convert_int3_sat_rtn(q), make_int3(0, 0, 0), majorant_resolution - 1);
+    int3 cell_step = make_int3(ud.x > 0.f ? 1 : -1, ud.y > 0.f ? 1 : -1, ud.z > 0.f ? 1 : -1);
+    float3 boundary = convert_float3(cell + max(cell_step, 0)) / scale;
+    float3 t_next = make_float3(
+        ud.x != 0.f ? (boundary.x - uo.x) * inv_ud.x : CRAZY_HIGH_DISTANCE,
+        ud.y != 0.f ? (boundary.y - uo.y) * inv_ud.y : CRAZY_HIGH_DISTANCE,
+        ud.z != 0.f ? (boundary.z - uo.z) * inv_ud.z : CRAZY_HIGH_DISTANCE);
+    float3 t_delta = make_float3(
+        ud.x != 0.f ? fabs(inv_ud.x / scale.x) : CRAZY_HIGH_DISTANCE,
+        ud.y != 0.f ? fabs(inv_ud.y / scale.y) : CRAZY_HIGH_DISTANCE,
+        ud.z != 0.f ? fabs(inv_ud.z / scale.z) : CRAZY_HIGH_DISTANCE);
+
+    while (t < t_end && num_collisions < VOLUME_GRID_MAX_COLLISIONS)
+    {
+        float t_cell = min(min(min(t_next.x, t_next.y), t_next.z), t_end);
+        float majorant = majorants[(cell.z * majorant_resolution.y + cell.y) * majorant_resolution.x + cell.x] * max_sigma_t;
+
+        if (Volume_SampleCollisions(grid, false, uo, ud, t_cell, majorant, sigma_t, sigma_s, sigma_e, scatter, &state, &num_collisions, &t, weight, emission))
+        {
+            return t;
+        }
+
+        // Step into the next majorant cell
+        t = t_cell;
+
+        if (t_next.x <= t_next.y && t_next.x <= t_next.z)
+        {
+            cell.x += cell_step.x;
+            t_next.x += t_delta.x;
+        }
+        else if (t_next.y <= t_next.z)
+        {
+            cell.y += cell_step.y;
+            t_next.y += t_delta.y;
+        }
+        else
+        {
+            cell.z += cell_step.z;
+            t_next.z += t_delta.z;
+        }
+
+        if (any(cell < 0) || any(cell >= majorant_resolution))
+        {
+            break;
+        }
+    }
+
+    return -1.f;
+}
+
 // Evaluate volume transmittance along the ray [0, dist] segment
 float3 Volume_Transmittance(GLOBAL Volume const* volume, GLOBAL ray const* ray, float dist)
 {
@@ -149,6 +460,8 @@ KERNEL void SampleVolume(
     GLOBAL int const* numrays,
     // Volumes
     GLOBAL Volume const* volumes,
+    // Density grids of heterogeneous volumes
+    GLOBAL int const* volume_grids,
     // Textures
     TEXTURE_ARG_LIST,
     // RNG seed
@@ -185,13 +498,17 @@ KERNEL void SampleVolume(
 
         int volidx = Path_GetVolumeIdx(path);
 
-        // Check if we are inside some volume
-        if (volidx != -1)
+        // Check if we are inside some volume, subsurface probes are not real rays and don't scatter
+        if (volidx != -1 && !Path_IsSubsurfaceProbe(path))
         {
             Sampler sampler;
 #if SAMPLER == SOBOL
             uint scramble = random[pixelidx] * 0x1fe3434f;
             Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET + bounce * SAMPLE_DIMS_PER_BOUNCE + SAMPLE_DIM_VOLUME_APPLY_OFFSET, scramble);
+#elif SAMPLER == BLUE_NOISE_SOBOL || SAMPLER == OWEN_SOBOL
+            // Per-pixel blue noise value or Owen scrambling seed is used as is
+            uint scramble = random[pixelidx];
+            Sampler_Init(&sampler, frame, SAMPLE_DIM_SURFACE_OFFSET + bounce * SAMPLE_DIMS_PER_BOUNCE + SAMPLE_DIM_VOLUME_APPLY_OFFSET, scramble);
 #elif SAMPLER == RANDOM
             uint scramble = pixelidx * rngseed;
             Sampler_Init(&sampler, scramble);
@@ -206,6 +523,33 @@ KERNEL void SampleVolume(
             float maxdist = Intersection_GetDistance(isects + globalid);
             float2 sample = Sampler_Sample2D(&sampler, SAMPLER_ARGS);
             float2 sample1 = Sampler_Sample2D(&sampler, SAMPLER_ARGS);
+
+            if (volumes[volidx].type == kHeterogeneous)
+            {
+                // Delta tracking needs an unbounded number of samples, they come from a hash of the sample
+                uint seed = WangHash(as_uint(sample.x) ^ WangHash(pixelidx ^ rngseed));
+                float3 weight = 1.f;
+                float3 emission = 0.f;
+                float d = Volume_Track(&volumes[volidx], volume_grids, rays[globalid].o.xyz, rays[globalid].d.xyz, maxdist, true, seed, &weight, &emission);
+
+                // Emission estimate already carries the throughput of the tracked segment
+                Path_AddContribution(path, output, output_indices[pixelidx], emission);
+                Path_MulThroughput(path, weight);
+
+                if (d < 0.f)
+                {
+                    Path_ClearScatterFlag(path);
+                }
+                else
+                {
+                    Path_SetScatterFlag(path);
+                    isects[globalid].shapeid = FAKE_SHAPE_SENTINEL;
+                    isects[globalid].uvwt.w = d;
+                }
+
+                return;
+            }
+
             float d = Volume_SampleDistance(&volumes[volidx], &rays[globalid], maxdist, make_float2(sample.x, sample1.y), &pdf);
             
             // Check if we shall skip the event (it is either outside of a volume or not happened at all)
@@ -25,44 +25,19 @@ THE SOFTWARE.
 #include <../Baikal/Kernels/CL/common.cl>
 #include <../Baikal/Kernels/CL/utils.cl>
 
-#define WAVELET_KERNEL_SIZE 25
-#define GAUSS_KERNEL_SIZE 9
+#define WAVELET_GROUP_SIZE 8
+// Steps up to this value are filtered from a local memory tile
+#ifdef BAIKAL_CPU_DEVICE
+// Local memory is emulated on CPUs, cached global reads are faster than the tile and its barriers
+#define WAVELET_MAX_TILED_STEP 0
+#else
+#define WAVELET_MAX_TILED_STEP 2
+#endif
+#define WAVELET_TILE_SIZE (WAVELET_GROUP_SIZE + 4 * WAVELET_MAX_TILED_STEP)
 #define DENOM_EPS 1e-8f
 #define FRAME_BLEND_ALPHA 0.2f
 #define MLAA_MAX_SEARCH_STEPS 15
 
-// Gauss filter 3x3 for variance prefiltering on first wavelet pass
-float4 GaussFilter3x3(
-    GLOBAL float4 const* restrict buffer, 
-    int2 buffer_size,
-    int2 uv)
-{
-    const int2 kernel_offsets[GAUSS_KERNEL_SIZE] = {
-        make_int2(-1, -1),  make_int2(0, -1),   make_int2(1, -1),
-        make_int2(-1, 0),   make_int2(0, 0),    make_int2(1, 0),
-        make_int2(-1, 1),   make_int2(0, 1),    make_int2(1, 1),
-    };
-
-    const float kernel_weights[GAUSS_KERNEL_SIZE] = {
-        1.0 / 16.0, 1.0 / 8.0, 1.0 / 16.0,
-        1.0 / 8.0, 1.0 / 4.0, 1.0 / 8.0,
-        1.0 / 16.0, 1.0 / 8.0, 1.0 / 16.0
-    };
-
-    float4 sample_out = make_float4(0.f, 0.f, 0.f, 0.f);
-    
-    for (int i = 0; i < GAUSS_KERNEL_SIZE; i++)
-    {
-        const int cx = clamp(uv.x + kernel_offsets[i].x, 0, buffer_size.x - 1);
-        const int cy = clamp(uv.y + kernel_offsets[i].y, 0, buffer_size.y - 1);
-        const int ci = cy * buffer_size.x + cx;
-
-        sample_out += kernel_weights[i] * buffer[ci];
-    }
-    
-    return sample_out;
-}
-
 // Convertor to linear address with out of bounds clamp
 int ConvertToLinearAddress(int address_x, int address_y, int2 buffer_size)
 {
@@ -111,17 +86,32 @@ float4 dFdy(GLOBAL float4 const* restrict buffer, float2 uv, int2 buffer_size)
     return Sampler2DBilinear(buffer, buffer_size, uv_y) - Sampler2DBilinear(buffer, buffer_size, uv);
 }
 
+// Color and variance of the wavelet pass input, first pass reads temporal accumulation results
+INLINE float4 Wavelet_LoadColorVariance(
+    GLOBAL float4 const* colors,
+    GLOBAL float4 const* restrict variances,
+    GLOBAL half const* restrict packed_colors,
+    int first_pass,
+    int idx)
+{
+    return first_pass ?
+        make_float4(colors[idx].x, colors[idx].y, colors[idx].z, variances[idx].z) :
+        vload_half4(idx, packed_colors);
+}
 
+// Wavelet pass with edge-stopping function, variance is filtered along with color
 KERNEL
 void WaveletFilter_main(
-    // Color data
-    GLOBAL float4 const* restrict colors,
+    // Color data of the first pass
+    GLOBAL float4 const* colors,
+    // Moments and variance of the first pass
+    GLOBAL float4 const* restrict variances,
+    // Color and variance of further passes
+    GLOBAL half const* restrict packed_colors,
     // Normal data
     GLOBAL float4 const* restrict normals,
     // Positional data
     GLOBAL float4 const* restrict positions,
-    // Variance
-    GLOBAL float4 const* restrict variances,
     // Albedo
     GLOBAL float4 const* restrict albedo,
     // Image resolution
@@ -132,45 +122,94 @@ void WaveletFilter_main(
     // Filter kernel parameters
     float sigma_color,
     float sigma_position,
-    // Resulting color
-    GLOBAL float4* restrict out_colors
+    // Pass flags
+    int first_pass,
+    int last_pass,
+    int write_history,
+    // Color and variance for the next pass
+    GLOBAL half* restrict out_packed_colors,
+    // Resulting color of the last pass
+    GLOBAL float4* restrict out_colors,
+    // Input of the pass is stored as color history
+    GLOBAL float4* history
 )
 {
+    __local float4 tile_colors[WAVELET_TILE_SIZE * WAVELET_TILE_SIZE];
+    __local float4 tile_normals[WAVELET_TILE_SIZE * WAVELET_TILE_SIZE];
+    __local float4 tile_positions[WAVELET_TILE_SIZE * WAVELET_TILE_SIZE];
+    __local float4 tile_albedos[WAVELET_TILE_SIZE * WAVELET_TILE_SIZE];
+
+    // B3 spline, the 5x5 kernel is its outer product
+    const float kernel_weights[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
     int2 global_id;
     global_id.x = get_global_id(0);
     global_id.y = get_global_id(1);
 
-    const float kernel_weights[WAVELET_KERNEL_SIZE] = {
-        1.0 / 256.0, 1.0 / 64.0, 3.0 / 128.0, 1.0 / 64.0, 1.0 / 256.0,
-        1.0 / 64.0, 1.0 / 16.0, 3.0 / 32.0, 1.0 / 16.0, 1.0 / 64.0,
-        3.0 / 128.0, 3.0 / 32.0, 9.0 / 64.0, 3.0 / 32.0, 3.0 / 128.0,
-        1.0 / 64.0, 1.0 / 16.0, 3.0 / 32.0, 1.0 / 16.0, 1.0 / 64.0,
-        1.0 / 256.0, 1.0 / 64.0, 3.0 / 128.0, 1.0 / 64.0, 1.0 / 256.0 };
-
-    const int2 kernel_offsets[WAVELET_KERNEL_SIZE] = {
-        make_int2(-2, -2), make_int2(-1, -2), make_int2(0, -2),  make_int2(1, -2),  make_int2(2, -2),
-        make_int2(-2, -1), make_int2(-1, -1), make_int2(0, -2),  make_int2(1, -1),  make_int2(2, -1),
-        make_int2(-2, 0),  make_int2(-1, 0),  make_int2(0, 0),   make_int2(1, 0),   make_int2(2, 0),
-        make_int2(-2, 1),  make_int2(-1, 1),  make_int2(0, 1),   make_int2(1, 1),   make_int2(2, 1),
-        make_int2(-2, 2),  make_int2(-1, 2),  make_int2(0, 2),   make_int2(1, 2),   make_int2(2, 2) };
-    
-    const int2 buffer_size  = make_int2(width, height);
-    const float2 uv = make_float2(global_id.x + 0.5f, global_id.y + 0.5f) / make_float2(width, height);
- 
+    int2 local_id;
+    local_id.x = get_local_id(0);
+    local_id.y = get_local_id(1);
+
+    // Step is uniform across the launch, so is the barrier below
+    const bool tiled = step_width <= WAVELET_MAX_TILED_STEP;
+    const int halo = 2 * step_width;
+    const int tile_size = WAVELET_GROUP_SIZE + 2 * halo;
+
+    if (tiled)
+    {
+        const int tile_x = get_group_id(0) * WAVELET_GROUP_SIZE - halo;
+        const int tile_y = get_group_id(1) * WAVELET_GROUP_SIZE - halo;
+
+        // Load tile with apron, borders are clamped as in the untiled path
+        for (int i = local_id.y * WAVELET_GROUP_SIZE + local_id.x; i < tile_size * tile_size; i += WAVELET_GROUP_SIZE * WAVELET_GROUP_SIZE)
+        {
+            const int cx = clamp(tile_x + i % tile_size, 0, width - 1);
+            const int cy = clamp(tile_y + i / tile_size, 0, height - 1);
+            const int ci = cy * width + cx;
+
+            tile_colors[i] = Wavelet_LoadColorVariance(colors, variances, packed_colors, first_pass, ci);
+            tile_normals[i] = normals[ci];
+            tile_positions[i] = positions[ci];
+            tile_albedos[i].xyz = albedo[ci].xyz / max(albedo[ci].w, 1.f);
+        }
+
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
     // Check borders
     if (global_id.x < width && global_id.y < height)
     {
         const int idx = global_id.y * width + global_id.x;
+        const int tile_idx = (local_id.y + halo) * tile_size + local_id.x + halo;
 
-        const float3 color = colors[idx].xyz;
+        const float4 color_variance = tiled ? tile_colors[tile_idx] : Wavelet_LoadColorVariance(colors, variances, packed_colors, first_pass, idx);
+        const float3 color = color_variance.xyz;
         const float3 position = positions[idx].xyz;
         const float3 normal = normals[idx].xyz;
         const float3 calbedo = albedo[idx].xyz / max(albedo[idx].w, 1.f);
 
-        const float variance = step_width == 1 ? sqrt(GaussFilter3x3(variances, buffer_size, global_id).z) : sqrt(variances[idx].z);
-        const float step_width_2 = (float)(step_width * step_width);
-        
+        // Gauss 3x3 prefiltered variance on the first pass, first pass is always tiled
+        float variance = color_variance.w;
+
+        if (first_pass)
+        {
+            const float gauss_weights[3] = { 1.f / 4.f, 1.f / 2.f, 1.f / 4.f };
+
+            variance = 0.f;
+
+            for (int j = -1; j <= 1; ++j)
+            {
+                for (int i = -1; i <= 1; ++i)
+                {
+                    variance += gauss_weights[i + 1] * gauss_weights[j + 1] * tile_colors[tile_idx + j * tile_size + i].w;
+                }
+            }
+        }
+
+        const float std_deviation = sqrt(max(variance, 0.f));
+
         float3 color_sum = make_float3(0.0f, 0.0f, 0.0f);
+        float variance_sum = 0.f;
         float weight_sum = 0.f;
 
         const float3 luminance = make_float3(0.2126f, 0.7152f, 0.0722f);
@@ -181,48 +220,81 @@ void WaveletFilter_main(
         const float sigma_adaptation_samples = 100.0f;
         const float sigma_variance = max(max_sigma_variance * exp(-albedo[idx].w / sigma_adaptation_samples), min_sigma_variance);
 
+        float4 result = make_float4(color.x, color.y, color.z, color_variance.w);
+
         if (length(position) > 0.f && !any(isnan(color)))
         {
-            for (int i = 0; i < WAVELET_KERNEL_SIZE; i++)
+            for (int j = -2; j <= 2; ++j)
             {
-                const int cx = clamp(global_id.x + step_width * kernel_offsets[i].x, 0, width - 1);
-                const int cy = clamp(global_id.y + step_width * kernel_offsets[i].y, 0, height - 1);
-                const int ci = cy * width + cx;
-
-                const float3 sample_color       = colors[ci].xyz;
-                const float3 sample_normal      = normals[ci].xyz;
-                const float3 sample_position    = positions[ci].xyz;
-                const float3 sample_albedo      = albedo[ci].xyz / max(albedo[ci].w, 1.f);
-
-                const float3 delta_position     = position - sample_position;
-                const float3 delta_color        = calbedo - sample_albedo;
-
-                const float position_dist2      = dot(delta_position, delta_position);
-                const float color_dist2         = dot(delta_color, delta_color);
-
-                const float position_value     = exp(-position_dist2 / (sigma_position * 20.f));
-                const float color_value        = exp(-color_dist2 / sigma_color);
-
-                const float position_weight     = isnan(position_value) ? 1.f : position_value;
-                const float color_weight        = isnan(color_value) ? 1.f : color_value;
-                const float normal_weight       = pow(max(0.f, dot(sample_normal, normal)), 128.f);
-
-                const float lum_value           = exp(-fabs((lum_color - dot(luminance, sample_color))) / (sigma_variance * variance + DENOM_EPS));
-                const float luminance_weight    = isnan(lum_value) ? 1.f : lum_value;
-
-                const float final_weight = color_weight * luminance_weight * normal_weight * position_weight * kernel_weights[i];
-
-                color_sum   += final_weight * sample_color;
-                weight_sum  += final_weight;
+                for (int i = -2; i <= 2; ++i)
+                {
+                    float4 sample_color_variance;
+                    float3 sample_normal;
+                    float3 sample_position;
+                    float3 sample_albedo;
+
+                    if (tiled)
+                    {
+                        const int ti = tile_idx + j * step_width * tile_size + i * step_width;
+                        sample_color_variance = tile_colors[ti];
+                        sample_normal = tile_normals[ti].xyz;
+                        sample_position = tile_positions[ti].xyz;
+                        sample_albedo = tile_albedos[ti].xyz;
+                    }
+                    else
+                    {
+                        const int cx = clamp(global_id.x + step_width * i, 0, width - 1);
+                        const int cy = clamp(global_id.y + step_width * j, 0, height - 1);
+                        const int ci = cy * width + cx;
+                        sample_color_variance = Wavelet_LoadColorVariance(colors, variances, packed_colors, first_pass, ci);
+                        sample_normal = normals[ci].xyz;
+                        sample_position = positions[ci].xyz;
+                        sample_albedo = albedo[ci].xyz / max(albedo[ci].w, 1.f);
+                    }
+
+                    const float3 sample_color       = sample_color_variance.xyz;
+
+                    const float3 delta_position     = position - sample_position;
+                    const float3 delta_color        = calbedo - sample_albedo;
+
+                    const float position_dist2      = dot(delta_position, delta_position);
+                    const float color_dist2         = dot(delta_color, delta_color);
+
+                    const float position_value     = exp(-position_dist2 / (sigma_position * 20.f));
+                    const float color_value        = exp(-color_dist2 / sigma_color);
+
+                    const float position_weight     = isnan(position_value) ? 1.f : position_value;
+                    const float color_weight        = isnan(color_value) ? 1.f : color_value;
+                    const float normal_weight       = pow(max(0.f, dot(sample_normal, normal)), 128.f);
+
+                    const float lum_value           = exp(-fabs((lum_color - dot(luminance, sample_color))) / (sigma_variance * std_deviation + DENOM_EPS));
+                    const float luminance_weight    = isnan(lum_value) ? 1.f : lum_value;
+
+                    const float final_weight = color_weight * luminance_weight * normal_weight * position_weight *
+                        kernel_weights[i + 2] * kernel_weights[j + 2];
+
+                    color_sum       += final_weight * sample_color;
+                    variance_sum    += final_weight * final_weight * sample_color_variance.w;
+                    weight_sum      += final_weight;
+                }
             }
 
-            out_colors[idx].xyz = color_sum / max(weight_sum, DENOM_EPS);
-            out_colors[idx].w = 1.f;
+            result.xyz = color_sum / max(weight_sum, DENOM_EPS);
+            result.w = variance_sum / max(weight_sum * weight_sum, DENOM_EPS);
+        }
+
+        if (last_pass)
+        {
+            out_colors[idx] = make_float4(result.x, result.y, result.z, 1.f);
         }
         else
         {
-            out_colors[idx].xyz = color;
-            out_colors[idx].w = 1.f;
+            vstore_half4(result, idx, out_packed_colors);
+        }
+
+        if (write_history)
+        {
+            history[idx] = make_float4(color.x, color.y, color.z, 1.f);
         }
     }
 }
@@ -306,27 +378,6 @@ void CopyBuffers_main(
     }
 }
 
-KERNEL
-void CopyBuffer_main(
-    GLOBAL float4 const* restrict in_buffer,
-    GLOBAL float4* restrict out_buffer,
-    // Image resolution
-    int width,
-    int height
-)
-{
-    int2 global_id;
-    global_id.x = get_global_id(0);
-    global_id.y = get_global_id(1);
-
-    // Check borders
-    if (global_id.x < width && global_id.y < height)
-    {
-        const int idx = global_id.y * width + global_id.x;
-        out_buffer[idx] = in_buffer[idx];
-    }
-}
-
 // Geometry consistency term - normal alignment test
 bool IsNormalConsistent(float3 nq, float3 np)
 {
@@ -616,33 +667,6 @@ void TemporalAccumulation_main(
     }
 }
 
-KERNEL
-void UpdateVariance_main(
-    // Color data
-    GLOBAL float4 const* restrict colors,
-    GLOBAL float4 const* restrict positions,
-    GLOBAL float4 const* restrict normals,
-    // Image resolution
-    int width,
-    int height,
-    GLOBAL float4* restrict out_variance
-)
-{
-    int2 global_id;
-    global_id.x = get_global_id(0);
-    global_id.y = get_global_id(1);
-
-    const int bilateral_filter_kernel_size = 3;
-    const int2 buffer_size  = make_int2(width, height);
-
-    // Check borders
-    if (global_id.x < width && global_id.y < height)
-    {
-        const int idx = global_id.y * width + global_id.x;
-        out_variance[idx] = BilateralVariance(colors, positions, normals, global_id, buffer_size, bilateral_filter_kernel_size);
-    } 
-}
-
 // Jimenez MLAA. Implementation was adapted to OpenCL
 
 /**
@@ -919,4 +943,179 @@ void NeighborhoodBlendingMLAA(  GLOBAL float4 const* restrict colorTex,
     out_buffer[idx] = color / sum;
 }
 
+// Reduce 2x2 blocks to one pixel for denoising at half resolution. The block takes the mesh ID
+// covering most of its pixels and averages the pixels of that mesh only, so surfaces are not
+// mixed across silhouettes. Outputs are divided by the number of samples like in CopyBuffers_main,
+// albedo keeps the number of samples of the block as the filter adapts to it.
+KERNEL
+void WaveletDownsample_main(
+    // Full resolution inputs
+    GLOBAL float4 const* restrict colors,
+    GLOBAL float4 const* restrict positions,
+    GLOBAL float4 const* restrict normals,
+    GLOBAL float4 const* restrict albedos,
+    GLOBAL float4 const* restrict mesh_ids,
+    int width,
+    int height,
+    // Half resolution
+    int low_width,
+    int low_height,
+    GLOBAL float4* restrict out_colors,
+    GLOBAL float4* restrict out_positions,
+    GLOBAL float4* restrict out_normals,
+    GLOBAL float4* restrict out_albedos,
+    GLOBAL float4* restrict out_mesh_ids
+)
+{
+    int2 global_id;
+    global_id.x = get_global_id(0);
+    global_id.y = get_global_id(1);
+
+    if (global_id.x < low_width && global_id.y < low_height)
+    {
+        int idx[4];
+        float id[4];
+
+        for (int i = 0; i < 4; ++i)
+        {
+            int x = min(2 * global_id.x + (i & 1), width - 1);
+            int y = min(2 * global_id.y + (i >> 1), height - 1);
+            idx[i] = y * width + x;
+            id[i] = mesh_ids[idx[i]].x;
+        }
+
+        // Mesh ID held by most pixels of the block, the first one on ties
+        int best = 0;
+        int best_count = 0;
+
+        for (int i = 0; i < 4; ++i)
+        {
+            int count = 0;
+
+            for (int j = 0; j < 4; ++j)
+            {
+                count += id[j] == id[i] ? 1 : 0;
+            }
+
+            if (count > best_count)
+            {
+                best = i;
+                best_count = count;
+            }
+        }
+
+        float3 color = make_float3(0.f, 0.f, 0.f);
+        float3 position = make_float3(0.f, 0.f, 0.f);
+        float3 normal = make_float3(0.f, 0.f, 0.f);
+        float3 albedo = make_float3(0.f, 0.f, 0.f);
+        float samples = 0.f;
+
+        for (int i = 0; i < 4; ++i)
+        {
+            if (id[i] != id[best])
+            {
+                continue;
+            }
+
+            color += colors[idx[i]].xyz / max(colors[idx[i]].w, 1.f);
+            position += positions[idx[i]].xyz / max(positions[idx[i]].w, 1.f);
+            normal += normals[idx[i]].xyz / max(normals[idx[i]].w, 1.f);
+            albedo += albedos[idx[i]].xyz / max(albedos[idx[i]].w, 1.f);
+            samples += albedos[idx[i]].w;
+        }
+
+        const float inv_count = 1.f / best_count;
+        color *= inv_count;
+        position *= inv_count;
+        normal = dot(normal, normal) > 0.f ? normalize(normal) : normal;
+        albedo *= inv_count;
+        samples = max(samples * inv_count, 1.f);
+
+        const int low_idx = global_id.y * low_width + global_id.x;
+
+        out_colors[low_idx] = make_float4(color.x, color.y, color.z, 1.f);
+        out_positions[low_idx] = make_float4(position.x, position.y, position.z, 1.f);
+        out_normals[low_idx] = make_float4(normal.x, normal.y, normal.z, 1.f);
+        out_albedos[low_idx] = make_float4(albedo.x * samples, albedo.y * samples, albedo.z * samples, samples);
+        out_mesh_ids[low_idx] = mesh_ids[idx[best]];
+    }
+}
+
+// Upsample color denoised at half resolution with a joint bilateral filter. Low resolution
+// neighbours are weighted by distance and by how well their position, normal and mesh ID
+// match the full resolution pixel, so edges follow the full resolution geometry. Pixels
+// without a matching neighbour, e.g. of thin objects lost in the downsample, take the
+// covering low resolution pixel.
+KERNEL
+void WaveletUpsample_main(
+    // Half resolution denoised color, position, normal and mesh ID as written by WaveletDownsample_main
+    GLOBAL float4 const* restrict low_colors,
+    GLOBAL float4 const* restrict low_positions,
+    GLOBAL float4 const* restrict low_normals,
+    GLOBAL float4 const* restrict low_mesh_ids,
+    int low_width,
+    int low_height,
+    // Full resolution guides
+    GLOBAL float4 const* restrict positions,
+    GLOBAL float4 const* restrict normals,
+    GLOBAL float4 const* restrict mesh_ids,
+    int width,
+    int height,
+    // Same meaning as in the wavelet filter
+    float sigma_position,
+    GLOBAL float4* restrict out_colors
+)
+{
+    int2 global_id;
+    global_id.x = get_global_id(0);
+    global_id.y = get_global_id(1);
+
+    if (global_id.x < width && global_id.y < height)
+    {
+        const int idx = global_id.y * width + global_id.x;
+
+        const float3 position = positions[idx].xyz / max(positions[idx].w, 1.f);
+        const float3 normal = normals[idx].xyz / max(normals[idx].w, 1.f);
+        const float mesh_id = mesh_ids[idx].x;
+
+        // Pixel center in low resolution pixels
+        const float2 p = make_float2((global_id.x + 0.5f) * 0.5f, (global_id.y + 0.5f) * 0.5f);
+        const int cx = min(global_id.x / 2, low_width - 1);
+        const int cy = min(global_id.y / 2, low_height - 1);
+
+        float3 sum = make_float3(0.f, 0.f, 0.f);
+        float weight_sum = 0.f;
+
+        for (int j = -1; j <= 1; ++j)
+        {
+            for (int i = -1; i <= 1; ++i)
+            {
+                const int sx = clamp(cx + i, 0, low_width - 1);
+                const int sy = clamp(cy + j, 0, low_height - 1);
+                const int low_idx = sy * low_width + sx;
+
+                if (low_mesh_ids[low_idx].x != mesh_id)
+                {
+                    continue;
+                }
+
+                const float2 d = p - make_float2(sx + 0.5f, sy + 0.5f);
+                const float3 delta_position = position - low_positions[low_idx].xyz;
+
+                const float spatial_weight = exp(-dot(d, d));
+                const float position_weight = exp(-dot(delta_position, delta_position) / (sigma_position * 20.f));
+                const float normal_weight = pow(max(0.f, dot(low_normals[low_idx].xyz, normal)), 32.f);
+
+                float weight = spatial_weight * (isnan(position_weight) ? 1.f : position_weight) * normal_weight;
+
+                sum += weight * low_colors[low_idx].xyz;
+                weight_sum += weight;
+            }
+        }
+
+        const float3 color = weight_sum > DENOM_EPS ? sum / weight_sum : low_colors[cy * low_width + cx].xyz;
+        out_colors[idx] = make_float4(color.x, color.y, color.z, 1.f);
+    }
+}
+
 #endif
\ No newline at end of file
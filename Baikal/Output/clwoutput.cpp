@@ -0,0 +1,130 @@
+#include "clwoutput.h"
+#include "Utils/geometry_compression.h"
+#include "Utils/half_conversion.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace Baikal
+{
+    std::size_t ClwOutput::GetPixelSize(Format format)
+    {
+        switch (format)
+        {
+        case Format::kRGBA32F:
+            return sizeof(RadeonRays::float3);
+        case Format::kRGBA16F:
+            return 4 * sizeof(std::uint16_t);
+        case Format::kRG16F:
+        case Format::kR32F:
+        case Format::kR32UI:
+        case Format::kRG16Oct:
+        case Format::kRGBA8:
+            return sizeof(std::uint32_t);
+        default:
+            throw std::runtime_error("ClwOutput: unsupported format");
+        }
+    }
+
+    std::size_t ClwOutput::GetStorageSize(std::size_t num_pixels, Format format)
+    {
+        auto num_bytes = num_pixels * GetPixelSize(format);
+        return (num_bytes + sizeof(RadeonRays::float3) - 1) / sizeof(RadeonRays::float3);
+    }
+
+    void ClwOutput::GetPackedData(RadeonRays::float3* data, size_t offset, size_t elems_count) const
+    {
+        if (elems_count == 0)
+        {
+            return;
+        }
+
+        auto pixel_size = GetPixelSize(format());
+        auto element_size = sizeof(RadeonRays::float3);
+
+        // Raw storage is addressed in float3 elements, read the ones covering requested pixels
+        auto first_byte = offset * pixel_size;
+        auto first_element = first_byte / element_size;
+        auto num_elements = (first_byte + elems_count * pixel_size + element_size - 1) / element_size - first_element;
+
+        std::vector<RadeonRays::float3> raw(num_elements);
+        m_context.ReadBuffer(0, m_data, raw.data(), first_element, num_elements).Wait();
+
+        auto bytes = reinterpret_cast<char const*>(raw.data()) + (first_byte - first_element * element_size);
+
+        // Half pixels are converted all at once, pixel offset keeps them 2 byte aligned
+        if (format() == Format::kRGBA16F)
+        {
+            std::vector<float> values(4 * elems_count);
+            HalfConversion::HalfToFloat(reinterpret_cast<std::uint16_t const*>(bytes), values.data(), values.size());
+
+            for (std::size_t i = 0; i < elems_count; ++i)
+            {
+                data[i] = RadeonRays::float3(values[4 * i], values[4 * i + 1], values[4 * i + 2], 1.f);
+            }
+
+            return;
+        }
+
+        for (std::size_t i = 0; i < elems_count; ++i)
+        {
+            auto pixel = bytes + i * pixel_size;
+
+            switch (format())
+            {
+            case Format::kRG16F:
+            {
+                std::uint32_t value;
+                std::memcpy(&value, pixel, sizeof(value));
+                auto uv = GeometryCompression::DecodeUV(value);
+                data[i] = RadeonRays::float3(uv.x, uv.y, 0.f, 1.f);
+                break;
+            }
+            case Format::kR32F:
+            {
+                float value;
+                std::memcpy(&value, pixel, sizeof(value));
+                data[i] = RadeonRays::float3(value, value, value, 1.f);
+                break;
+            }
+            case Format::kR32UI:
+            {
+                std::int32_t value;
+                std::memcpy(&value, pixel, sizeof(value));
+                auto id = static_cast<float>(value);
+                data[i] = RadeonRays::float3(id, id, id, 1.f);
+                break;
+            }
+            case Format::kRG16Oct:
+            {
+                std::uint32_t value;
+                std::memcpy(&value, pixel, sizeof(value));
+                // Pixels nothing was written to decode as +Z
+                data[i] = GeometryCompression::DecodeNormal(value);
+                data[i].w = 1.f;
+                break;
+            }
+            case Format::kRGBA8:
+            {
+                auto value = reinterpret_cast<unsigned char const*>(pixel);
+                data[i] = RadeonRays::float3(value[0] / 255.f, value[1] / 255.f, value[2] / 255.f, 1.f);
+                break;
+            }
+            default:
+                throw std::runtime_error("ClwOutput: unsupported format");
+            }
+        }
+    }
+
+    void ClwOutput::GetRawData(void* data) const
+    {
+        auto size = width() * height() * GetPixelSize(format());
+        auto status = clEnqueueReadBuffer(m_context.GetCommandQueue(0), m_data, CL_TRUE, 0, size, data, 0, nullptr, nullptr);
+
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error("ClwOutput: cannot read data");
+        }
+    }
+}
@@ -8,20 +8,26 @@ namespace Baikal
     class ClwOutput : public Output
     {
     public:
-        ClwOutput(CLWContext context, std::uint32_t w, std::uint32_t h)
-        : Output(w, h)
+        ClwOutput(CLWContext context, std::uint32_t w, std::uint32_t h, Format format = Format::kRGBA32F)
+        : Output(w, h, format)
         , m_context(context)
-        , m_data(context.CreateBuffer<RadeonRays::float3>(w*h, CL_MEM_READ_WRITE))
+        , m_data(context.CreateBuffer<RadeonRays::float3>(GetStorageSize(w*h, format), CL_MEM_READ_WRITE))
         {
         }
 
         void GetData(RadeonRays::float3* data) const override
         {
-            m_context.ReadBuffer(0, m_data, data, m_data.GetElementCount()).Wait();
+            GetData(data, 0, width() * height());
         }
 
         void GetData(RadeonRays::float3* data, /* offset in elems */ size_t offset, /* read elems */size_t elems_count) const override
         {
+            if (format() != Format::kRGBA32F)
+            {
+                GetPackedData(data, offset, elems_count);
+                return;
+            }
+
             m_context.ReadBuffer(
                 0,
                 m_data,
@@ -30,14 +36,29 @@ namespace Baikal
                 elems_count).Wait();
         }
 
+        // Packed formats keep running mean, they are cleared to zero whatever the value is
         void Clear(RadeonRays::float3 const& val) override
         {
-            m_context.FillBuffer(0, m_data, val, m_data.GetElementCount()).Wait();
+            auto fill_value = format() == Format::kRGBA32F ? val : RadeonRays::float3(0.f, 0.f, 0.f, 0.f);
+            m_context.FillBuffer(0, m_data, fill_value, m_data.GetElementCount()).Wait();
+            Touch();
         }
 
+        // Raw storage, packed formats are tightly packed and reinterpreted by the kernels
         CLWBuffer<RadeonRays::float3> data() const { return m_data; }
 
+        // Read width * height pixels of raw storage without decoding
+        void GetRawData(void* data) const;
+
+        // Size of a single pixel in bytes
+        static std::size_t GetPixelSize(Format format);
+        // Number of float3 elements holding num_pixels of given format
+        static std::size_t GetStorageSize(std::size_t num_pixels, Format format);
+
     private:
+        // Read covering range of raw storage and decode it, w is set to 1
+        void GetPackedData(RadeonRays::float3* data, size_t offset, size_t elems_count) const;
+
         CLWContext m_context;
         CLWBuffer<RadeonRays::float3> m_data;
     };
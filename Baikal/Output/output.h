@@ -44,15 +44,38 @@ namespace Baikal
     class Output
     {
     public:
+        /**
+         \brief Storage format of the output surface.
+
+         kRGBA32F accumulates samples with sample count in w. Packed formats keep
+         running mean instead and are only supported by single-pass outputs.
+         */
+        enum class Format
+        {
+            kRGBA32F,
+            kRGBA16F,
+            kRG16F,
+            kR32F,
+            // 32-bit integer IDs, negative values survive the round trip
+            kR32UI,
+            // Octahedral encoded unit vector, two 16-bit snorm values
+            kRG16Oct,
+            // Display ready 8-bit color written by post effects
+            kRGBA8
+        };
+
         /**
          \brief Create output of a given size
          
          \param w Output surface width
          \param h Output surface height
+         \param format Storage format
          */
-        Output(std::uint32_t w, std::uint32_t h)
+        Output(std::uint32_t w, std::uint32_t h, Format format = Format::kRGBA32F)
         : m_width(w)
         , m_height(h)
+        , m_format(format)
+        , m_version(0)
         {
         }
 
@@ -72,14 +95,27 @@ namespace Baikal
         std::uint32_t width() const;
         // Get surface height
         std::uint32_t height() const;
+        // Get storage format
+        Format format() const;
+        // Content version, changes whenever renderers or post effects update the content
+        std::uint64_t version() const;
+        // Mark content as updated
+        void Touch();
 
     private:
         // Surface width
         std::uint32_t m_width;
         // Surface height
         std::uint32_t m_height;
+        // Storage format
+        Format m_format;
+        // Content version
+        std::uint64_t m_version;
     };
     
     inline std::uint32_t Output::width() const { return m_width; }
     inline std::uint32_t Output::height() const { return m_height; }
+    inline Output::Format Output::format() const { return m_format; }
+    inline std::uint64_t Output::version() const { return m_version; }
+    inline void Output::Touch() { ++m_version; }
 }
@@ -0,0 +1,100 @@
+#include "tile_delta_encoder.h"
+#include "clwoutput.h"
+
+#include <stdexcept>
+
+#ifdef BAIKAL_EMBED_KERNELS
+#include "embed_kernels.h"
+#endif
+
+namespace Baikal
+{
+    TileDeltaEncoder::TileDeltaEncoder(CLWContext context, const CLProgramManager *program_manager)
+#ifdef BAIKAL_EMBED_KERNELS
+        : ClwClass(context, program_manager, "tile_delta", g_tile_delta_opencl, g_tile_delta_opencl_headers)
+#else
+        : ClwClass(context, program_manager, "../Baikal/Kernels/CL/tile_delta.cl")
+#endif
+    {
+    }
+
+    void TileDeltaEncoder::Reset()
+    {
+        m_send_all = true;
+    }
+
+    void TileDeltaEncoder::Resize(std::uint32_t width, std::uint32_t height)
+    {
+        auto context = GetContext();
+        auto num_tiles_x = (width + kTileSize - 1) / kTileSize;
+        auto num_tiles_y = (height + kTileSize - 1) / kTileSize;
+        auto num_tiles = num_tiles_x * num_tiles_y;
+
+        m_reference = context.CreateBuffer<std::uint32_t>(width * height, CL_MEM_READ_WRITE);
+        m_num_changed = context.CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+        m_changed_tiles = context.CreateBuffer<int>(num_tiles, CL_MEM_READ_WRITE);
+        m_packed = context.CreateBuffer<std::uint32_t>(num_tiles * kTileSize * kTileSize, CL_MEM_READ_WRITE);
+
+        m_width = width;
+        m_height = height;
+        m_send_all = true;
+    }
+
+    TileDelta TileDeltaEncoder::Encode(Output const& output)
+    {
+        if (output.format() != Output::Format::kRGBA8)
+        {
+            throw std::runtime_error("TileDeltaEncoder: RGBA8 output is required");
+        }
+
+        if (output.width() != m_width || output.height() != m_height)
+        {
+            Resize(output.width(), output.height());
+        }
+
+        auto context = GetContext();
+        context.FillBuffer(0, m_num_changed, 0, 1);
+
+        auto kernel = GetKernel("TileDelta_Detect");
+
+        // Set kernel parameters
+        int argc = 0;
+        kernel.SetArg(argc++, static_cast<ClwOutput const&>(output).data());
+        kernel.SetArg(argc++, m_reference);
+        kernel.SetArg(argc++, static_cast<int>(m_width));
+        kernel.SetArg(argc++, static_cast<int>(m_height));
+        kernel.SetArg(argc++, static_cast<int>(m_threshold));
+        kernel.SetArg(argc++, m_send_all ? 1 : 0);
+        kernel.SetArg(argc++, m_num_changed);
+        kernel.SetArg(argc++, m_changed_tiles);
+        kernel.SetArg(argc++, m_packed);
+
+        auto num_tiles_x = (m_width + kTileSize - 1) / kTileSize;
+        auto num_tiles_y = (m_height + kTileSize - 1) / kTileSize;
+        size_t gs[] = { num_tiles_x * kTileSize, num_tiles_y * kTileSize };
+        size_t ls[] = { kTileSize, kTileSize };
+        context.Launch2D(0, gs, ls, kernel);
+
+        m_send_all = false;
+
+        TileDelta delta;
+        delta.width = m_width;
+        delta.height = m_height;
+
+        // Only the tiles found are read back
+        int num_changed = 0;
+        context.ReadBuffer(0, m_num_changed, &num_changed, 1).Wait();
+
+        if (num_changed > 0)
+        {
+            std::vector<int> tiles(num_changed);
+            delta.pixels.resize(num_changed * kTileSize * kTileSize);
+            context.ReadBuffer(0, m_changed_tiles, tiles.data(), num_changed);
+            context.ReadBuffer(0, m_packed, delta.pixels.data(), delta.pixels.size()).Wait();
+
+            delta.tiles.assign(tiles.cbegin(), tiles.cend());
+        }
+
+        return delta;
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "output.h"
+#include "Utils/clw_class.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace Baikal
+{
+    // Tiles of an image changed since the previous encode
+    struct TileDelta
+    {
+        std::uint32_t width = 0u;
+        std::uint32_t height = 0u;
+        // Row major index of each tile, tiles_x = (width + kTileSize - 1) / kTileSize
+        std::vector<std::uint32_t> tiles;
+        // kTileSize^2 RGBA8 pixels of each tile in row order of the output,
+        // edge tiles repeat the last row and column of the image
+        std::vector<std::uint32_t> pixels;
+    };
+
+    /**
+    \brief Finds the tiles of a tonemapped output worth sending to a remote viewer.
+
+    \details Encoder keeps a device copy of the image as of the last time each tile was sent.
+    Tiles are compared on the device and only the changed ones are packed and read back, so a
+    converging frame costs a few tiles of traffic instead of the whole image. Comparison is done
+    on quantized values, which is what the viewer sees.
+    */
+    class TileDeltaEncoder : protected ClwClass
+    {
+    public:
+        static std::uint32_t constexpr kTileSize = 16u;
+
+        TileDeltaEncoder(CLWContext context, const CLProgramManager *program_manager);
+
+        // Next Encode returns all the tiles, call after a camera or scene change
+        void Reset();
+        // Largest channel difference in quantization steps a tile may drift by before it is sent again
+        void SetThreshold(std::uint32_t threshold) { m_threshold = threshold; }
+
+        // Collect tiles of RGBA8 output changed since the previous call
+        TileDelta Encode(Output const& output);
+
+    private:
+        void Resize(std::uint32_t width, std::uint32_t height);
+
+        std::uint32_t m_width = 0u;
+        std::uint32_t m_height = 0u;
+        std::uint32_t m_threshold = 1u;
+        bool m_send_all = true;
+
+        CLWBuffer<std::uint32_t> m_reference;
+        CLWBuffer<int> m_num_changed;
+        CLWBuffer<int> m_changed_tiles;
+        CLWBuffer<std::uint32_t> m_packed;
+    };
+}
@@ -22,6 +22,9 @@ THE SOFTWARE.
 #pragma once
 #include "clw_post_effect.h"
 
+#include <memory>
+#include <stdexcept>
+
 #ifdef BAIKAL_EMBED_KERNELS
 #include "embed_kernels.h"
 #endif
@@ -34,8 +37,12 @@ namespace Baikal
     \details BilateralDenoiser does selective gaussian blur of pixels based
     on distance metric taking color, normal and world position into account. 
     Filter is not smoothing out normal maps and rapid normal changes. 
+    With iterations set the wide kernel is replaced by an a-trous wavelet filter:
+    each iteration applies a 5x5 kernel with taps spaced 2^i pixels apart, so the
+    cost grows with the number of iterations instead of radius squared.
     Parameters:
         * radius - Filter radius in pixels
+        * iterations - Number of a-trous iterations, 0 selects the brute-force kernel
         * color_sensitivity - Higher the sensitivity the more it smoothes out depending on color difference.
         * normal_sensitivity - Higher the sensitivity the more it smoothes out depending on normal difference.
         * position_sensitivity - Higher the sensitivity the more it smoothes out depending on position difference.
@@ -55,8 +62,13 @@ namespace Baikal
     private: 
         // Find required output
         ClwOutput* FindOutput(InputSet const& input_set, Renderer::OutputType type);
+        // Run a-trous iterations
+        void ApplyAtrous(ClwOutput* color, ClwOutput* normal, ClwOutput* position, ClwOutput* albedo,
+            ClwOutput* out_color, std::uint32_t iterations);
 
         CLWProgram m_program;
+        // Ping-pong buffers for a-trous iterations
+        std::unique_ptr<ClwOutput> m_tmp_buffers[2];
     };
 
     inline BilateralDenoiser::BilateralDenoiser(CLWContext context, const CLProgramManager *program_manager)
@@ -72,6 +84,7 @@ namespace Baikal
         RegisterParameter("position_sensitivity", RadeonRays::float4(5.f, 0.f, 0.f, 0.f));
         RegisterParameter("normal_sensitivity", RadeonRays::float4(0.1f, 0.f, 0.f, 0.f));
         RegisterParameter("albedo_sensitivity", RadeonRays::float4(0.1f, 0.f, 0.f, 0.f));
+        RegisterParameter("iterations", RadeonRays::float4(0.f, 0.f, 0.f, 0.f));
     }
 
     inline ClwOutput* BilateralDenoiser::FindOutput(InputSet const& input_set, Renderer::OutputType type)
@@ -83,6 +96,11 @@ namespace Baikal
             return nullptr;
         }
 
+        if (iter->second->format() != Output::Format::kRGBA32F)
+        {
+            throw std::runtime_error("Denoiser inputs require RGBA32F format");
+        }
+
         return static_cast<ClwOutput*>(iter->second);
     }
 
@@ -100,6 +118,14 @@ namespace Baikal
         auto albedo = FindOutput(input_set, Renderer::OutputType::kAlbedo);
         auto out_color = static_cast<ClwOutput*>(&output);
 
+        auto iterations = static_cast<std::uint32_t>(GetParameter("iterations").x);
+
+        if (iterations > 0)
+        {
+            ApplyAtrous(color, normal, position, albedo, out_color, iterations);
+            return;
+        }
+
         auto denoise_kernel = GetKernel("BilateralDenoise_main");
 
         // Set kernel parameters
@@ -126,4 +152,54 @@ namespace Baikal
         }
     }
 
+    inline void BilateralDenoiser::ApplyAtrous(ClwOutput* color, ClwOutput* normal, ClwOutput* position, ClwOutput* albedo,
+        ClwOutput* out_color, std::uint32_t iterations)
+    {
+        auto sigma_color = GetParameter("color_sensitivity").x;
+        auto sigma_position = GetParameter("position_sensitivity").x;
+        auto sigma_normal = GetParameter("normal_sensitivity").x;
+        auto sigma_albedo = GetParameter("albedo_sensitivity").x;
+
+        auto width = color->width();
+        auto height = color->height();
+
+        if (iterations > 1 && (!m_tmp_buffers[0] || m_tmp_buffers[0]->width() != width || m_tmp_buffers[0]->height() != height))
+        {
+            m_tmp_buffers[0].reset(new ClwOutput(GetContext(), width, height));
+            m_tmp_buffers[1].reset(new ClwOutput(GetContext(), width, height));
+        }
+
+        auto denoise_kernel = GetKernel("AtrousDenoise_main");
+
+        for (auto i = 0u; i < iterations; ++i)
+        {
+            auto input = i == 0 ? color : m_tmp_buffers[(i - 1) % 2].get();
+            auto output = i == iterations - 1 ? out_color : m_tmp_buffers[i % 2].get();
+
+            // Noise is reduced on every iteration, so color sensitivity is tightened accordingly
+            auto step = 1 << i;
+            auto iteration_sigma_color = sigma_color / static_cast<float>(step);
+
+            // Set kernel parameters
+            int argc = 0;
+            denoise_kernel.SetArg(argc++, input->data());
+            denoise_kernel.SetArg(argc++, normal->data());
+            denoise_kernel.SetArg(argc++, position->data());
+            denoise_kernel.SetArg(argc++, albedo->data());
+            denoise_kernel.SetArg(argc++, width);
+            denoise_kernel.SetArg(argc++, height);
+            denoise_kernel.SetArg(argc++, step);
+            denoise_kernel.SetArg(argc++, iteration_sigma_color);
+            denoise_kernel.SetArg(argc++, sigma_normal);
+            denoise_kernel.SetArg(argc++, sigma_position);
+            denoise_kernel.SetArg(argc++, sigma_albedo);
+            denoise_kernel.SetArg(argc++, output->data());
+
+            // Kernel tiles through local memory, so the group size is fixed
+            size_t gs[] = { static_cast<size_t>((width + 7) / 8 * 8), static_cast<size_t>((height + 7) / 8 * 8) };
+            size_t ls[] = { 8, 8 };
+
+            GetContext().Launch2D(0, gs, ls, denoise_kernel);
+        }
+    }
 }
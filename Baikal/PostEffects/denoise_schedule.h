@@ -0,0 +1,137 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+
+namespace Baikal
+{
+    /**
+    \brief Decides which progressive iterations get denoised.
+
+    \details Early iterations are denoised every frame. Past that a frame is denoised
+    once the noise estimate has dropped by a given ratio since the last denoised frame,
+    or the number of samples has doubled if the estimate does not move, so the frequency
+    decreases as the image converges. Once noise falls below the threshold the last
+    result is final and no more frames are denoised. In between callers keep showing
+    the previously denoised output. Sample count going backwards (output cleared)
+    restarts the schedule.
+
+    Noise is a relative measure in [0..1], e.g. AdaptiveRenderer::GetUnconvergedFraction,
+    negative values mean no estimate is available and only the sample count is used.
+    */
+    class DenoiseSchedule
+    {
+    public:
+        DenoiseSchedule(std::uint32_t every_frame_samples = 16,
+                        float noise_threshold = 0.01f,
+                        float noise_ratio = 0.75f);
+
+        // Check if the frame should be denoised, updates the schedule if so
+        bool ShouldDenoise(std::uint32_t num_samples, float noise = -1.f);
+        // Check if denoising has stopped
+        bool IsFinished() const { return m_finished; }
+        // Start over, e.g. when the output is cleared
+        void Reset();
+
+    private:
+        void Record(std::uint32_t num_samples, float noise);
+
+        std::uint32_t m_every_frame_samples;
+        float m_noise_threshold;
+        float m_noise_ratio;
+
+        // Last denoised frame
+        std::uint32_t m_last_samples;
+        float m_last_noise;
+        bool m_finished;
+    };
+
+    inline DenoiseSchedule::DenoiseSchedule(std::uint32_t every_frame_samples, float noise_threshold, float noise_ratio)
+        : m_every_frame_samples(every_frame_samples)
+        , m_noise_threshold(noise_threshold)
+        , m_noise_ratio(noise_ratio)
+    {
+        if (noise_ratio <= 0.f || noise_ratio >= 1.f)
+        {
+            throw std::runtime_error("DenoiseSchedule: noise ratio should be in (0..1)");
+        }
+
+        Reset();
+    }
+
+    inline void DenoiseSchedule::Reset()
+    {
+        m_last_samples = 0;
+        m_last_noise = 1.f;
+        m_finished = false;
+    }
+
+    inline void DenoiseSchedule::Record(std::uint32_t num_samples, float noise)
+    {
+        m_last_samples = num_samples;
+
+        if (noise >= 0.f)
+        {
+            m_last_noise = noise;
+        }
+    }
+
+    inline bool DenoiseSchedule::ShouldDenoise(std::uint32_t num_samples, float noise)
+    {
+        if (num_samples < m_last_samples)
+        {
+            Reset();
+        }
+
+        if (m_finished)
+        {
+            return false;
+        }
+
+        if (num_samples <= m_every_frame_samples)
+        {
+            Record(num_samples, noise);
+            return true;
+        }
+
+        // Converged enough, denoise one last time
+        if (noise >= 0.f && noise <= m_noise_threshold)
+        {
+            Record(num_samples, noise);
+            m_finished = true;
+            return true;
+        }
+
+        bool noise_dropped = noise >= 0.f && noise <= m_last_noise * m_noise_ratio;
+        bool samples_doubled = num_samples >= 2 * m_last_samples;
+
+        if (noise_dropped || samples_doubled)
+        {
+            Record(num_samples, noise);
+            return true;
+        }
+
+        return false;
+    }
+}
@@ -0,0 +1,267 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+#pragma once
+#include "clw_post_effect.h"
+#include "Utils/clw_readback.h"
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#ifdef BAIKAL_EMBED_KERNELS
+#include "embed_kernels.h"
+#endif
+
+namespace Baikal
+{
+    /**
+    \brief Interface of denoisers running outside of Baikal, e.g. OIDN or ML denoisers.
+
+    \details All images are width * height RGBA32F pixels with 16 bytes pixel stride and
+    tightly packed rows. Inputs are resolved (divided by sample count) and live in pinned
+    host memory shared with the render device, so a backend may read them directly or
+    import them into its own device. Output alpha is preset to 1, backends write color only.
+    Denoise is called from a worker thread, one call at a time.
+    */
+    class DenoiserBackend
+    {
+    public:
+        virtual ~DenoiserBackend() = default;
+
+        virtual void Denoise(float const* color,
+                             float const* albedo,
+                             float const* normal,
+                             std::uint32_t width,
+                             std::uint32_t height,
+                             float* output) = 0;
+    };
+
+    /**
+    \brief Adapter handing renderer outputs to an external denoiser.
+
+    \details ExternalDenoiser resolves color, albedo and normal into one staging buffer and
+    copies it to pinned host memory on a separate queue, then runs the backend on a worker
+    thread. With latency set Apply returns the result of the previous frame, so denoising
+    frame N overlaps rendering of frame N + 1; the very first frame is waited for.
+    Parameters:
+        * latency - 1 to pipeline denoising with rendering, 0 to wait for the current frame
+    Required AOVs in input set:
+        * kColor
+        * kAlbedo
+        * kWorldShadingNormal
+    */
+    class ExternalDenoiser : public ClwPostEffect
+    {
+    public:
+        // Constructor
+        ExternalDenoiser(CLWContext context, const CLProgramManager *program_manager);
+        // Waits for jobs in flight
+        ~ExternalDenoiser();
+        // Apply external denoiser
+        void Apply(InputSet const& input_set, Output& output) override;
+        // Set denoiser implementation
+        void SetBackend(std::shared_ptr<DenoiserBackend> backend);
+
+    private:
+        struct Frame
+        {
+            std::unique_ptr<ClwReadback> readback;
+            std::vector<float> result;
+            std::future<void> job;
+            std::uint32_t width = 0;
+            std::uint32_t height = 0;
+        };
+
+        // Find required output
+        ClwOutput* FindOutput(InputSet const& input_set, Renderer::OutputType type);
+        // Upload denoised frame
+        void WriteResult(Frame const& frame, Output& output);
+
+        std::shared_ptr<DenoiserBackend> m_backend;
+        std::mutex m_backend_mutex;
+        Frame m_frames[2];
+        std::uint32_t m_current_frame;
+    };
+
+    inline ExternalDenoiser::ExternalDenoiser(CLWContext context, const CLProgramManager *program_manager)
+#ifdef BAIKAL_EMBED_KERNELS
+        : ClwPostEffect(context, program_manager, "external_denoise", g_external_denoise_opencl, g_external_denoise_opencl_headers)
+#else
+        : ClwPostEffect(context, program_manager, "../Baikal/Kernels/CL/external_denoise.cl")
+#endif
+        , m_current_frame(0)
+    {
+        RegisterParameter("latency", RadeonRays::float4(1.f, 0.f, 0.f, 0.f));
+
+        for (auto& frame : m_frames)
+        {
+            frame.readback.reset(new ClwReadback(context));
+        }
+    }
+
+    inline ExternalDenoiser::~ExternalDenoiser()
+    {
+        for (auto& frame : m_frames)
+        {
+            if (frame.job.valid())
+            {
+                frame.job.wait();
+            }
+        }
+    }
+
+    inline void ExternalDenoiser::SetBackend(std::shared_ptr<DenoiserBackend> backend)
+    {
+        for (auto& frame : m_frames)
+        {
+            if (frame.job.valid())
+            {
+                frame.job.wait();
+            }
+        }
+
+        m_backend = backend;
+    }
+
+    inline ClwOutput* ExternalDenoiser::FindOutput(InputSet const& input_set, Renderer::OutputType type)
+    {
+        auto iter = input_set.find(type);
+
+        if (iter == input_set.cend())
+        {
+            throw std::runtime_error("ExternalDenoiser: color, albedo and normal inputs are required");
+        }
+
+        if (iter->second->format() != Output::Format::kRGBA32F)
+        {
+            throw std::runtime_error("Denoiser inputs require RGBA32F format");
+        }
+
+        return static_cast<ClwOutput*>(iter->second);
+    }
+
+    inline void ExternalDenoiser::WriteResult(Frame const& frame, Output& output)
+    {
+        auto out = static_cast<ClwOutput&>(output).data();
+        GetContext().WriteBuffer(0, out, reinterpret_cast<RadeonRays::float3 const*>(frame.result.data()),
+            frame.width * frame.height).Wait();
+    }
+
+    inline void ExternalDenoiser::Apply(InputSet const& input_set, Output& output)
+    {
+        if (!m_backend)
+        {
+            throw std::runtime_error("ExternalDenoiser: backend is not set");
+        }
+
+        auto color = FindOutput(input_set, Renderer::OutputType::kColor);
+        auto albedo = FindOutput(input_set, Renderer::OutputType::kAlbedo);
+        auto normal = FindOutput(input_set, Renderer::OutputType::kWorldShadingNormal);
+
+        auto width = color->width();
+        auto height = color->height();
+
+        if (output.format() != Output::Format::kRGBA32F ||
+            albedo->width() != width || albedo->height() != height ||
+            normal->width() != width || normal->height() != height ||
+            output.width() != width || output.height() != height)
+        {
+            throw std::runtime_error("ExternalDenoiser: inputs and output must be RGBA32F of the same size");
+        }
+
+        auto& frame = m_frames[m_current_frame];
+        auto& prev_frame = m_frames[1 - m_current_frame];
+
+        // Slot is reused two frames later, surface errors of a result which was never shown
+        if (frame.job.valid())
+        {
+            frame.job.get();
+        }
+
+        auto num_pixels = static_cast<int>(width * height);
+
+        if (frame.width != width || frame.height != height)
+        {
+            // Alpha stays 1, backends only write color
+            frame.result.assign(4 * num_pixels, 1.f);
+            frame.width = width;
+            frame.height = height;
+        }
+
+        // Resolve inputs and copy them to pinned memory on the readback queue
+        {
+            auto size = 3 * num_pixels * sizeof(RadeonRays::float4);
+            auto resolve_kernel = GetKernel("ExternalDenoiserResolve_main");
+
+            // Set kernel parameters
+            int argc = 0;
+            resolve_kernel.SetArg(argc++, color->data());
+            resolve_kernel.SetArg(argc++, albedo->data());
+            resolve_kernel.SetArg(argc++, normal->data());
+            resolve_kernel.SetArg(argc++, num_pixels);
+            resolve_kernel.SetArg(argc++, frame.readback->GetStagingBuffer(size));
+
+            auto event = GetContext().Launch1D(0, ((num_pixels + 63) / 64) * 64, 64, resolve_kernel);
+            frame.readback->Enqueue(size, event);
+        }
+
+        auto backend = m_backend;
+        auto* job_frame = &frame;
+
+        frame.job = std::async(std::launch::async, [this, backend, job_frame, num_pixels]()
+        {
+            job_frame->readback->Wait();
+
+            auto data = static_cast<float const*>(job_frame->readback->GetData());
+
+            std::lock_guard<std::mutex> lock(m_backend_mutex);
+            backend->Denoise(data, data + 4 * num_pixels, data + 8 * num_pixels,
+                job_frame->width, job_frame->height, job_frame->result.data());
+        });
+
+        auto latency = GetParameter("latency").x > 0.f;
+
+        if (latency && prev_frame.job.valid() && prev_frame.width == width && prev_frame.height == height)
+        {
+            // Previous frame has been denoised while the current one was rendered
+            prev_frame.job.get();
+            WriteResult(prev_frame, output);
+        }
+        else if (latency)
+        {
+            // Nothing to show yet, keep the job pending so the next frame shows it
+            frame.job.wait();
+            WriteResult(frame, output);
+        }
+        else
+        {
+            frame.job.get();
+            WriteResult(frame, output);
+        }
+
+        m_current_frame = 1 - m_current_frame;
+    }
+}
@@ -24,6 +24,7 @@ THE SOFTWARE.
 #include "Renderers/renderer.h"
 #include "Output/output.h"
 
+#include <cstdint>
 #include <map>
 #include <string>
 #include <stdexcept>
@@ -61,6 +62,9 @@ namespace Baikal
         // Get scalar parameter
         RadeonRays::float4 GetParameter(std::string const& name) const;
 
+        // Changes on every parameter update
+        std::uint32_t GetParametersVersion() const;
+
     protected:
         // Adds scalar parameter into the parameter map
         void RegisterParameter(std::string const& name, RadeonRays::float4 const& initial_value);
@@ -68,6 +72,8 @@ namespace Baikal
     private:
         // Parameter map
         std::map<std::string, RadeonRays::float4> m_parameters;
+        // Number of parameter updates
+        std::uint32_t m_parameters_version = 0;
     };
 
     inline void PostEffect::SetParameter(std::string const& name, RadeonRays::float4 const& value)
@@ -80,6 +86,7 @@ namespace Baikal
         }
 
         iter->second = value;
+        ++m_parameters_version;
     }
 
     inline RadeonRays::float4 PostEffect::GetParameter(std::string const& name) const
@@ -94,6 +101,11 @@ namespace Baikal
         return iter->second;
     }
 
+    inline std::uint32_t PostEffect::GetParametersVersion() const
+    {
+        return m_parameters_version;
+    }
+
     inline void PostEffect::RegisterParameter(std::string const& name, RadeonRays::float4 const& initial_value)
     {
         assert(m_parameters.find(name) == m_parameters.cend());
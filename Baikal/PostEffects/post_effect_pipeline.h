@@ -0,0 +1,474 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+#pragma once
+
+#include "post_effect.h"
+#include "Utils/trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace Baikal
+{
+    /**
+    \brief Graph of post effects with pooled intermediate outputs.
+
+    \details Stages are added in execution order and read either pipeline inputs
+    (renderer outputs) or results of earlier stages, forming a DAG. Results which are
+    not bound to external outputs live in pooled buffers: stages whose lifetimes do not
+    overlap share a buffer of the same size and format. Execute only runs stages whose
+    parameters or inputs changed since the last run, tracked by output content versions.
+    Skipped stages keep their results, unless the pooled buffer has been reused by another
+    stage since then and a consumer needs it again, in which case the stage is rerun.
+    All stages are enqueued in order, so effects sharing a device queue need no extra
+    synchronization.
+    */
+    class PostEffectPipeline
+    {
+    public:
+        // Creates intermediate outputs, e.g. RenderFactory::CreateOutput
+        using OutputCreator = std::function<std::unique_ptr<Output>(std::uint32_t width,
+                                                                    std::uint32_t height,
+                                                                    Output::Format format)>;
+
+        // Where a stage input comes from
+        struct Source
+        {
+            // Index of the producing stage, -1 for pipeline inputs
+            int stage;
+            // Pipeline input to read if stage is -1
+            Renderer::OutputType type;
+
+            static Source Input(Renderer::OutputType type) { return Source{ -1, type }; }
+            static Source Stage(int stage) { return Source{ stage, Renderer::OutputType::kColor }; }
+        };
+
+        // Stage inputs keyed by the type the effect expects them as
+        using Inputs = std::map<Renderer::OutputType, Source>;
+
+        explicit PostEffectPipeline(OutputCreator creator);
+
+        // Add a stage reading from pipeline inputs or earlier stages, returns stage index
+        int AddStage(PostEffect& effect, Inputs const& inputs, Output::Format format = Output::Format::kRGBA32F);
+        // Write stage result into an external output instead of a pooled one, nullptr restores pooling
+        void SetOutput(int stage, Output* output);
+        // Run stage on every Execute, e.g. for effects accumulating history
+        void SetAlwaysRun(int stage, bool always_run);
+
+        // Run stages which are out of date
+        void Execute(PostEffect::InputSet const& inputs);
+
+        // Stage result, results of stages without consumers stay valid until the next Execute
+        Output* GetResult(int stage) const;
+        // Number of stages run by the last Execute
+        std::uint32_t GetNumExecutedStages() const { return m_num_executed_stages; }
+        // Number of pooled intermediate outputs
+        std::size_t GetNumPooledOutputs() const { return m_pool.size(); }
+
+    private:
+        struct Stage
+        {
+            PostEffect* effect;
+            Inputs inputs;
+            Output::Format format;
+            Output* external_output;
+            bool always_run;
+
+            // Planned resources
+            std::uint32_t width;
+            std::uint32_t height;
+            int last_use;
+            int pool_index;
+
+            // State of the last run
+            bool executed;
+            std::uint32_t parameters_version;
+            std::vector<std::uint64_t> input_versions;
+            std::uint64_t result_version;
+        };
+
+        struct PooledOutput
+        {
+            std::unique_ptr<Output> output;
+            // Index of the last stage using the buffer in the current plan
+            int free_after;
+            // Stage which result is currently stored
+            int owner;
+        };
+
+        // Assign pooled outputs to stages
+        void Plan(std::vector<std::uint32_t> const& sizes);
+        // Check stage index
+        void ValidateStage(int stage) const;
+
+        Output* GetSourceOutput(Source const& source, PostEffect::InputSet const& inputs) const;
+        std::uint64_t GetSourceVersion(Source const& source, PostEffect::InputSet const& inputs) const;
+
+        OutputCreator m_creator;
+        std::vector<Stage> m_stages;
+        std::vector<PooledOutput> m_pool;
+        bool m_planned;
+        std::uint32_t m_num_executed_stages;
+    };
+
+    inline PostEffectPipeline::PostEffectPipeline(OutputCreator creator)
+        : m_creator(creator)
+        , m_planned(false)
+        , m_num_executed_stages(0)
+    {
+    }
+
+    inline void PostEffectPipeline::ValidateStage(int stage) const
+    {
+        if (stage < 0 || stage >= static_cast<int>(m_stages.size()))
+        {
+            throw std::runtime_error("PostEffectPipeline: invalid stage index");
+        }
+    }
+
+    inline int PostEffectPipeline::AddStage(PostEffect& effect, Inputs const& inputs, Output::Format format)
+    {
+        if (inputs.empty())
+        {
+            throw std::runtime_error("PostEffectPipeline: stage requires inputs");
+        }
+
+        // Sources of earlier stages only, so stage order is a topological one
+        for (auto const& input : inputs)
+        {
+            if (input.second.stage != -1)
+            {
+                ValidateStage(input.second.stage);
+            }
+        }
+
+        Stage stage;
+        stage.effect = &effect;
+        stage.inputs = inputs;
+        stage.format = format;
+        stage.external_output = nullptr;
+        stage.always_run = false;
+        stage.width = 0;
+        stage.height = 0;
+        stage.last_use = -1;
+        stage.pool_index = -1;
+        stage.executed = false;
+        stage.parameters_version = 0;
+        stage.result_version = 0;
+
+        m_stages.push_back(stage);
+        m_planned = false;
+
+        return static_cast<int>(m_stages.size()) - 1;
+    }
+
+    inline void PostEffectPipeline::SetOutput(int stage, Output* output)
+    {
+        ValidateStage(stage);
+
+        m_stages[stage].external_output = output;
+        m_stages[stage].executed = false;
+        m_planned = false;
+    }
+
+    inline void PostEffectPipeline::SetAlwaysRun(int stage, bool always_run)
+    {
+        ValidateStage(stage);
+
+        m_stages[stage].always_run = always_run;
+    }
+
+    inline Output* PostEffectPipeline::GetResult(int stage) const
+    {
+        ValidateStage(stage);
+
+        auto const& s = m_stages[stage];
+
+        if (s.external_output)
+        {
+            return s.external_output;
+        }
+
+        return s.pool_index >= 0 ? m_pool[s.pool_index].output.get() : nullptr;
+    }
+
+    inline Output* PostEffectPipeline::GetSourceOutput(Source const& source, PostEffect::InputSet const& inputs) const
+    {
+        if (source.stage >= 0)
+        {
+            return GetResult(source.stage);
+        }
+
+        auto iter = inputs.find(source.type);
+
+        if (iter == inputs.cend() || !iter->second)
+        {
+            throw std::runtime_error("PostEffectPipeline: pipeline input is missing");
+        }
+
+        return iter->second;
+    }
+
+    inline std::uint64_t PostEffectPipeline::GetSourceVersion(Source const& source, PostEffect::InputSet const& inputs) const
+    {
+        return source.stage >= 0 ? m_stages[source.stage].result_version : GetSourceOutput(source, inputs)->version();
+    }
+
+    inline void PostEffectPipeline::Plan(std::vector<std::uint32_t> const& sizes)
+    {
+        auto num_stages = static_cast<int>(m_stages.size());
+
+        // Results without consumers are kept until the end, so they can be queried
+        for (auto s = 0; s < num_stages; ++s)
+        {
+            m_stages[s].last_use = num_stages;
+        }
+
+        for (auto s = 0; s < num_stages; ++s)
+        {
+            for (auto const& input : m_stages[s].inputs)
+            {
+                if (input.second.stage >= 0)
+                {
+                    auto& producer = m_stages[input.second.stage];
+                    producer.last_use = producer.last_use == num_stages ? s : std::max(producer.last_use, s);
+                }
+            }
+        }
+
+        for (auto& pooled : m_pool)
+        {
+            pooled.free_after = -1;
+            pooled.owner = -1;
+        }
+
+        // Greedy interval assignment in stage order
+        for (auto s = 0; s < num_stages; ++s)
+        {
+            auto& stage = m_stages[s];
+
+            stage.width = sizes[2 * s];
+            stage.height = sizes[2 * s + 1];
+            stage.pool_index = -1;
+            stage.executed = false;
+
+            if (stage.external_output)
+            {
+                continue;
+            }
+
+            for (auto i = 0u; i < m_pool.size(); ++i)
+            {
+                auto const& output = *m_pool[i].output;
+
+                if (m_pool[i].free_after < s &&
+                    output.width() == stage.width && output.height() == stage.height &&
+                    output.format() == stage.format)
+                {
+                    stage.pool_index = static_cast<int>(i);
+                    break;
+                }
+            }
+
+            if (stage.pool_index < 0)
+            {
+                PooledOutput pooled;
+                pooled.output = m_creator(stage.width, stage.height, stage.format);
+                pooled.free_after = -1;
+                pooled.owner = -1;
+                m_pool.push_back(std::move(pooled));
+                stage.pool_index = static_cast<int>(m_pool.size()) - 1;
+            }
+
+            m_pool[stage.pool_index].free_after = stage.last_use;
+        }
+
+        // Release buffers the plan does not need anymore
+        std::vector<int> remap(m_pool.size(), -1);
+        std::vector<PooledOutput> pool;
+
+        for (auto i = 0u; i < m_pool.size(); ++i)
+        {
+            if (m_pool[i].free_after >= 0)
+            {
+                remap[i] = static_cast<int>(pool.size());
+                pool.push_back(std::move(m_pool[i]));
+            }
+        }
+
+        for (auto& stage : m_stages)
+        {
+            if (stage.pool_index >= 0)
+            {
+                stage.pool_index = remap[stage.pool_index];
+            }
+        }
+
+        m_pool = std::move(pool);
+        m_planned = true;
+    }
+
+    inline void PostEffectPipeline::Execute(PostEffect::InputSet const& inputs)
+    {
+        auto num_stages = static_cast<int>(m_stages.size());
+
+        // Stage size follows its first input
+        std::vector<std::uint32_t> sizes(2 * num_stages);
+
+        for (auto s = 0; s < num_stages; ++s)
+        {
+            auto const& source = m_stages[s].inputs.cbegin()->second;
+
+            if (source.stage >= 0)
+            {
+                sizes[2 * s] = sizes[2 * source.stage];
+                sizes[2 * s + 1] = sizes[2 * source.stage + 1];
+            }
+            else
+            {
+                auto output = GetSourceOutput(source, inputs);
+                sizes[2 * s] = output->width();
+                sizes[2 * s + 1] = output->height();
+            }
+
+            if (sizes[2 * s] != m_stages[s].width || sizes[2 * s + 1] != m_stages[s].height)
+            {
+                m_planned = false;
+            }
+        }
+
+        if (!m_planned)
+        {
+            Plan(sizes);
+        }
+
+        // Stages with changed parameters or inputs, reruns propagate to consumers
+        std::vector<bool> dirty(num_stages, false);
+
+        for (auto s = 0; s < num_stages; ++s)
+        {
+            auto const& stage = m_stages[s];
+
+            dirty[s] = stage.always_run || !stage.executed ||
+                stage.parameters_version != stage.effect->GetParametersVersion();
+
+            auto i = 0u;
+            for (auto const& input : stage.inputs)
+            {
+                auto source_stage = input.second.stage;
+
+                dirty[s] = dirty[s] || (source_stage >= 0 && dirty[source_stage]) ||
+                    i >= stage.input_versions.size() ||
+                    stage.input_versions[i] != GetSourceVersion(input.second, inputs);
+                ++i;
+            }
+        }
+
+        // Consumers of results whose pooled buffer has been reused need their producers rerun
+        std::vector<bool> run = dirty;
+        bool changed = true;
+
+        while (changed)
+        {
+            changed = false;
+
+            std::vector<int> owners(m_pool.size());
+            std::transform(m_pool.cbegin(), m_pool.cend(), owners.begin(),
+                [](PooledOutput const& pooled) { return pooled.owner; });
+
+            for (auto s = 0; s < num_stages && !changed; ++s)
+            {
+                if (!run[s])
+                {
+                    continue;
+                }
+
+                for (auto const& input : m_stages[s].inputs)
+                {
+                    auto producer = input.second.stage;
+
+                    if (producer >= 0 && m_stages[producer].pool_index >= 0 &&
+                        owners[m_stages[producer].pool_index] != producer)
+                    {
+                        // Restart, the producer overwrites buffers of earlier stages
+                        run[producer] = true;
+                        changed = true;
+                    }
+                }
+
+                if (m_stages[s].pool_index >= 0)
+                {
+                    owners[m_stages[s].pool_index] = s;
+                }
+            }
+        }
+
+        m_num_executed_stages = 0;
+
+        for (auto s = 0; s < num_stages; ++s)
+        {
+            if (!run[s])
+            {
+                continue;
+            }
+
+            auto& stage = m_stages[s];
+
+            PostEffect::InputSet input_set;
+            stage.input_versions.clear();
+
+            for (auto const& input : stage.inputs)
+            {
+                input_set[input.first] = GetSourceOutput(input.second, inputs);
+                stage.input_versions.push_back(GetSourceVersion(input.second, inputs));
+            }
+
+            auto output = GetResult(s);
+            {
+                BAIKAL_TRACE_SCOPE("posteffect", "PostEffectStage");
+                stage.effect->Apply(input_set, *output);
+            }
+            output->Touch();
+
+            if (stage.pool_index >= 0)
+            {
+                m_pool[stage.pool_index].owner = s;
+            }
+
+            // Restoring a reused buffer reproduces the same content
+            if (dirty[s])
+            {
+                ++stage.result_version;
+            }
+
+            stage.parameters_version = stage.effect->GetParametersVersion();
+            stage.executed = true;
+            ++m_num_executed_stages;
+        }
+    }
+}
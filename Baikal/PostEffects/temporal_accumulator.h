@@ -0,0 +1,250 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+#pragma once
+#include "clw_post_effect.h"
+
+#include <SceneGraph/camera.h>
+
+#include <memory>
+#include <stdexcept>
+
+#ifdef BAIKAL_EMBED_KERNELS
+#include "embed_kernels.h"
+#endif
+
+namespace Baikal
+{
+    /**
+    \brief Temporal accumulation for interactive camera moves.
+
+    \details TemporalAccumulator keeps the accumulated image of previous frames and reprojects it
+    onto the current camera once the camera moves. History is reprojected using depth so it stays
+    in place on the surfaces, disoccluded pixels are detected by mesh id and distance mismatch
+    and restart from the current estimate. Renderer output is blended with the history, so the
+    image converges from the history instead of restarting after each renderer Clear.
+    Update should be called with the scene camera before Apply on every frame.
+    Parameters:
+        * max_history - Maximum number of history samples carried over a camera move
+        * depth_tolerance - Relative distance difference which is treated as disocclusion
+    Required AOVs in input set:
+        * kColor
+        * kDepth
+        * kMeshID
+    */
+    class TemporalAccumulator : public ClwPostEffect
+    {
+    public:
+        // Constructor
+        TemporalAccumulator(CLWContext context, const CLProgramManager *program_manager);
+        // Apply temporal accumulation
+        void Apply(InputSet const& input_set, Output& output) override;
+        // Update camera of the current frame
+        void Update(PerspectiveCamera* camera);
+        // Drop accumulated history, e.g. after scene edits
+        void Reset();
+
+    private:
+        struct CameraFrame
+        {
+            RadeonRays::float3 p;
+            RadeonRays::float3 forward;
+            RadeonRays::float3 right;
+            RadeonRays::float3 up;
+            // dim.x, dim.y, focal_length, znear
+            RadeonRays::float4 params;
+        };
+
+        ClwOutput* FindOutput(InputSet const& input_set, Renderer::OutputType type);
+
+        CameraFrame m_camera;
+        CameraFrame m_prev_camera;
+        bool m_camera_moved;
+        bool m_has_history;
+
+        std::uint32_t m_current_buffer_index;
+        std::unique_ptr<ClwOutput> m_history[2];
+        std::unique_ptr<ClwOutput> m_geometry[2];
+        std::unique_ptr<ClwOutput> m_base;
+    };
+
+    inline TemporalAccumulator::TemporalAccumulator(CLWContext context, const CLProgramManager *program_manager)
+#ifdef BAIKAL_EMBED_KERNELS
+        : ClwPostEffect(context, program_manager, "temporal_accumulation", g_temporal_accumulation_opencl, g_temporal_accumulation_opencl_headers)
+#else
+        : ClwPostEffect(context, program_manager, "../Baikal/Kernels/CL/temporal_accumulation.cl")
+#endif
+        , m_camera()
+        , m_prev_camera()
+        , m_camera_moved(false)
+        , m_has_history(false)
+        , m_current_buffer_index(0)
+    {
+        RegisterParameter("max_history", RadeonRays::float4(32.f, 0.f, 0.f, 0.f));
+        RegisterParameter("depth_tolerance", RadeonRays::float4(0.02f, 0.f, 0.f, 0.f));
+    }
+
+    inline ClwOutput* TemporalAccumulator::FindOutput(InputSet const& input_set, Renderer::OutputType type)
+    {
+        auto iter = input_set.find(type);
+
+        if (iter == input_set.cend())
+        {
+            throw std::runtime_error("TemporalAccumulator: color, depth and mesh id inputs are required");
+        }
+
+        if (iter->second->format() != Output::Format::kRGBA32F)
+        {
+            throw std::runtime_error("TemporalAccumulator: inputs require RGBA32F format");
+        }
+
+        return static_cast<ClwOutput*>(iter->second);
+    }
+
+    inline void TemporalAccumulator::Update(PerspectiveCamera* camera)
+    {
+        m_prev_camera = m_camera;
+
+        auto dim = camera->GetSensorSize();
+        m_camera.p = camera->GetPosition();
+        m_camera.forward = camera->GetForwardVector();
+        m_camera.right = camera->GetRightVector();
+        m_camera.up = camera->GetUpVector();
+        m_camera.params = RadeonRays::float4(dim.x, dim.y, camera->GetFocalLength(), camera->GetDepthRange().x);
+
+        auto differs = [](RadeonRays::float3 const& a, RadeonRays::float3 const& b)
+        {
+            return a.x != b.x || a.y != b.y || a.z != b.z || a.w != b.w;
+        };
+
+        // Moves are sticky until the next Apply consumes them
+        m_camera_moved = m_camera_moved ||
+            differs(m_camera.p, m_prev_camera.p) ||
+            differs(m_camera.forward, m_prev_camera.forward) ||
+            differs(m_camera.right, m_prev_camera.right) ||
+            differs(m_camera.up, m_prev_camera.up) ||
+            differs(m_camera.params, m_prev_camera.params);
+    }
+
+    inline void TemporalAccumulator::Reset()
+    {
+        m_has_history = false;
+    }
+
+    inline void TemporalAccumulator::Apply(InputSet const& input_set, Output& output)
+    {
+        auto color = FindOutput(input_set, Renderer::OutputType::kColor);
+        auto depth = FindOutput(input_set, Renderer::OutputType::kDepth);
+        auto mesh_id = FindOutput(input_set, Renderer::OutputType::kMeshID);
+
+        if (output.format() != Output::Format::kRGBA32F)
+        {
+            throw std::runtime_error("TemporalAccumulator: output requires RGBA32F format");
+        }
+
+        auto width = color->width();
+        auto height = color->height();
+
+        if (depth->width() != width || depth->height() != height ||
+            mesh_id->width() != width || mesh_id->height() != height ||
+            output.width() != width || output.height() != height)
+        {
+            throw std::runtime_error("TemporalAccumulator: input and output sizes differ");
+        }
+
+        // (Re)create history buffers on resize
+        if (!m_base || m_base->width() != width || m_base->height() != height)
+        {
+            for (auto i = 0u; i < 2u; ++i)
+            {
+                m_history[i].reset(new ClwOutput(GetContext(), width, height));
+                m_geometry[i].reset(new ClwOutput(GetContext(), width, height));
+            }
+
+            m_base.reset(new ClwOutput(GetContext(), width, height));
+            m_has_history = false;
+        }
+
+        int num_pixels = static_cast<int>(width * height);
+        auto prev_index = m_current_buffer_index;
+        auto next_index = 1 - m_current_buffer_index;
+
+        if (!m_has_history)
+        {
+            m_base->Clear(0.f);
+        }
+        else if (m_camera_moved)
+        {
+            auto reproject_kernel = GetKernel("TemporalReproject_main");
+
+            auto to_cl = [](RadeonRays::float3 const& v)
+            {
+                return cl_float4{ { v.x, v.y, v.z, v.w } };
+            };
+
+            // Set kernel parameters
+            int argc = 0;
+            reproject_kernel.SetArg(argc++, depth->data());
+            reproject_kernel.SetArg(argc++, mesh_id->data());
+            reproject_kernel.SetArg(argc++, m_history[prev_index]->data());
+            reproject_kernel.SetArg(argc++, m_geometry[prev_index]->data());
+            reproject_kernel.SetArg(argc++, static_cast<int>(width));
+            reproject_kernel.SetArg(argc++, static_cast<int>(height));
+            reproject_kernel.SetArg(argc++, to_cl(m_camera.p));
+            reproject_kernel.SetArg(argc++, to_cl(m_camera.forward));
+            reproject_kernel.SetArg(argc++, to_cl(m_camera.right));
+            reproject_kernel.SetArg(argc++, to_cl(m_camera.up));
+            reproject_kernel.SetArg(argc++, to_cl(m_camera.params));
+            reproject_kernel.SetArg(argc++, to_cl(m_prev_camera.p));
+            reproject_kernel.SetArg(argc++, to_cl(m_prev_camera.forward));
+            reproject_kernel.SetArg(argc++, to_cl(m_prev_camera.right));
+            reproject_kernel.SetArg(argc++, to_cl(m_prev_camera.up));
+            reproject_kernel.SetArg(argc++, to_cl(m_prev_camera.params));
+            reproject_kernel.SetArg(argc++, GetParameter("max_history").x);
+            reproject_kernel.SetArg(argc++, GetParameter("depth_tolerance").x);
+            reproject_kernel.SetArg(argc++, m_base->data());
+
+            GetContext().Launch1D(0, ((num_pixels + 63) / 64) * 64, 64, reproject_kernel);
+        }
+        // Static camera keeps the last reprojection, renderer samples take over as they accumulate
+
+        auto resolve_kernel = GetKernel("TemporalResolve_main");
+
+        // Set kernel parameters
+        int argc = 0;
+        resolve_kernel.SetArg(argc++, color->data());
+        resolve_kernel.SetArg(argc++, depth->data());
+        resolve_kernel.SetArg(argc++, mesh_id->data());
+        resolve_kernel.SetArg(argc++, m_base->data());
+        resolve_kernel.SetArg(argc++, num_pixels);
+        resolve_kernel.SetArg(argc++, m_camera.params.w);
+        resolve_kernel.SetArg(argc++, m_history[next_index]->data());
+        resolve_kernel.SetArg(argc++, m_geometry[next_index]->data());
+        resolve_kernel.SetArg(argc++, static_cast<ClwOutput&>(output).data());
+
+        GetContext().Launch1D(0, ((num_pixels + 63) / 64) * 64, 64, resolve_kernel);
+
+        m_current_buffer_index = next_index;
+        m_has_history = true;
+        m_camera_moved = false;
+    }
+}
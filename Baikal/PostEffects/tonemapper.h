@@ -0,0 +1,147 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+#include "clw_post_effect.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#ifdef BAIKAL_EMBED_KERNELS
+#include "embed_kernels.h"
+#endif
+
+namespace Baikal
+{
+    /**
+    \brief Tonemapping and quantization for LDR previews.
+
+    \details Tonemapper resolves accumulated color, applies exposure and a tonemapping
+    curve, encodes the result and quantizes it with dithering. RGBA8 outputs receive
+    tightly packed 8-bit values which can be read back or uploaded into a texture as is,
+    RGBA16F and RGBA32F outputs receive encoded values with w set to 1.
+    Parameters:
+        * exposure - Exposure in stops
+        * operator - Tonemapping curve: 0 - linear, 1 - Reinhard, 2 - filmic, 3 - ACES
+        * gamma - Encoding gamma, 0 selects sRGB transfer function
+        * dither - Dithering amplitude in quantization steps, RGBA8 output only
+        * hdr - Non-zero skips encoding and keeps values unclamped, e.g. to resolve HDR outputs
+        * heatmap - x selects a channel of the input shown on a color ramp instead, 0 - off,
+          1 - x, 2 - y, 3 - z, e.g. of kCost output; y is the per sample value at the top of the ramp
+    Required AOVs in input set:
+        * kColor
+    */
+    class Tonemapper : public ClwPostEffect
+    {
+    public:
+        // Constructor
+        Tonemapper(CLWContext context, const CLProgramManager *program_manager);
+        // Apply tonemapping
+        void Apply(InputSet const& input_set, Output& output) override;
+    };
+
+    inline Tonemapper::Tonemapper(CLWContext context, const CLProgramManager *program_manager)
+#ifdef BAIKAL_EMBED_KERNELS
+        : ClwPostEffect(context, program_manager, "tonemap", g_tonemap_opencl, g_tonemap_opencl_headers)
+#else
+        : ClwPostEffect(context, program_manager, "../Baikal/Kernels/CL/tonemap.cl")
+#endif
+    {
+        RegisterParameter("exposure", RadeonRays::float4(0.f, 0.f, 0.f, 0.f));
+        RegisterParameter("operator", RadeonRays::float4(0.f, 0.f, 0.f, 0.f));
+        RegisterParameter("gamma", RadeonRays::float4(0.f, 0.f, 0.f, 0.f));
+        RegisterParameter("dither", RadeonRays::float4(1.f, 0.f, 0.f, 0.f));
+        RegisterParameter("hdr", RadeonRays::float4(0.f, 0.f, 0.f, 0.f));
+        RegisterParameter("heatmap", RadeonRays::float4(0.f, 1.f, 0.f, 0.f));
+    }
+
+    inline void Tonemapper::Apply(InputSet const& input_set, Output& output)
+    {
+        auto iter = input_set.find(Renderer::OutputType::kColor);
+
+        if (iter == input_set.cend())
+        {
+            throw std::runtime_error("Tonemapper: color input is required");
+        }
+
+        auto color = iter->second;
+
+        int output_format = 0;
+        switch (output.format())
+        {
+        case Output::Format::kRGBA32F:
+            output_format = 0;
+            break;
+        case Output::Format::kRGBA8:
+            output_format = 1;
+            break;
+        case Output::Format::kRGBA16F:
+            output_format = 2;
+            break;
+        default:
+            throw std::runtime_error("Tonemapper: unsupported output format");
+        }
+
+        if (color->format() != Output::Format::kRGBA32F)
+        {
+            throw std::runtime_error("Tonemapper: unsupported input format");
+        }
+
+        if (color->width() != output.width() || color->height() != output.height())
+        {
+            throw std::runtime_error("Tonemapper: input and output sizes differ");
+        }
+
+        auto exposure = std::pow(2.f, GetParameter("exposure").x);
+        auto tonemap_operator = static_cast<int>(GetParameter("operator").x);
+        auto gamma = GetParameter("gamma").x;
+        auto dither = GetParameter("dither").x;
+        auto hdr = GetParameter("hdr").x != 0.f ? 1 : 0;
+        auto heatmap = GetParameter("heatmap");
+        auto heatmap_channel = static_cast<int>(heatmap.x);
+        auto heatmap_max = heatmap.y;
+        int num_pixels = static_cast<int>(output.width() * output.height());
+
+        if (heatmap_channel < 0 || heatmap_channel > 3 || (heatmap_channel > 0 && heatmap_max <= 0.f))
+        {
+            throw std::runtime_error("Tonemapper: invalid heatmap parameter");
+        }
+
+        auto tonemap_kernel = GetKernel("Tonemap_main");
+
+        // Set kernel parameters
+        int argc = 0;
+        tonemap_kernel.SetArg(argc++, static_cast<ClwOutput*>(color)->data());
+        tonemap_kernel.SetArg(argc++, num_pixels);
+        tonemap_kernel.SetArg(argc++, exposure);
+        tonemap_kernel.SetArg(argc++, tonemap_operator);
+        tonemap_kernel.SetArg(argc++, gamma);
+        tonemap_kernel.SetArg(argc++, dither);
+        tonemap_kernel.SetArg(argc++, hdr);
+        tonemap_kernel.SetArg(argc++, heatmap_channel);
+        tonemap_kernel.SetArg(argc++, heatmap_max);
+        tonemap_kernel.SetArg(argc++, output_format);
+        tonemap_kernel.SetArg(argc++, static_cast<ClwOutput&>(output).data());
+
+        GetContext().Launch1D(0, ((num_pixels + 63) / 64) * 64, 64, tonemap_kernel);
+    }
+
+}
@@ -0,0 +1,136 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+#include "clw_post_effect.h"
+
+#include <stdexcept>
+
+#ifdef BAIKAL_EMBED_KERNELS
+#include "embed_kernels.h"
+#endif
+
+namespace Baikal
+{
+    /**
+    \brief Edge-aware upsampling of reduced resolution renders.
+
+    \details Upsampler resolves accumulated color of a low resolution render and resizes it
+    to the output resolution. Each output pixel blends the nearest low resolution pixels with
+    bilinear weights scaled by the similarity of their depth and shading normal to the pixel
+    covering it, so the image stays sharp on silhouettes and creases. Used to preview camera
+    moves at a fraction of the resolution. Output w is set to 1.
+    Parameters:
+        * depth_sigma - Relative depth difference which halves the weight of a neighbour
+        * normal_power - Exponent of the normals cosine in the weight of a neighbour
+    Required AOVs in input set:
+        * kColor
+        * kDepth
+        * kWorldShadingNormal
+    */
+    class Upsampler : public ClwPostEffect
+    {
+    public:
+        // Constructor
+        Upsampler(CLWContext context, const CLProgramManager *program_manager);
+        // Apply upsampling
+        void Apply(InputSet const& input_set, Output& output) override;
+
+    private:
+        ClwOutput* FindOutput(InputSet const& input_set, Renderer::OutputType type);
+    };
+
+    inline Upsampler::Upsampler(CLWContext context, const CLProgramManager *program_manager)
+#ifdef BAIKAL_EMBED_KERNELS
+        : ClwPostEffect(context, program_manager, "upsample", g_upsample_opencl, g_upsample_opencl_headers)
+#else
+        : ClwPostEffect(context, program_manager, "../Baikal/Kernels/CL/upsample.cl")
+#endif
+    {
+        RegisterParameter("depth_sigma", RadeonRays::float4(0.05f, 0.f, 0.f, 0.f));
+        RegisterParameter("normal_power", RadeonRays::float4(8.f, 0.f, 0.f, 0.f));
+    }
+
+    inline ClwOutput* Upsampler::FindOutput(InputSet const& input_set, Renderer::OutputType type)
+    {
+        auto iter = input_set.find(type);
+
+        if (iter == input_set.cend())
+        {
+            throw std::runtime_error("Upsampler: color, depth and normal inputs are required");
+        }
+
+        if (iter->second->format() != Output::Format::kRGBA32F)
+        {
+            throw std::runtime_error("Upsampler: inputs require RGBA32F format");
+        }
+
+        return static_cast<ClwOutput*>(iter->second);
+    }
+
+    inline void Upsampler::Apply(InputSet const& input_set, Output& output)
+    {
+        auto color = FindOutput(input_set, Renderer::OutputType::kColor);
+        auto depth = FindOutput(input_set, Renderer::OutputType::kDepth);
+        auto normal = FindOutput(input_set, Renderer::OutputType::kWorldShadingNormal);
+
+        if (output.format() != Output::Format::kRGBA32F)
+        {
+            throw std::runtime_error("Upsampler: output requires RGBA32F format");
+        }
+
+        auto width = color->width();
+        auto height = color->height();
+
+        if (depth->width() != width || depth->height() != height ||
+            normal->width() != width || normal->height() != height)
+        {
+            throw std::runtime_error("Upsampler: input sizes differ");
+        }
+
+        if (output.width() < width || output.height() < height)
+        {
+            throw std::runtime_error("Upsampler: output is smaller than inputs");
+        }
+
+        auto depth_sigma = GetParameter("depth_sigma").x;
+        auto normal_power = GetParameter("normal_power").x;
+        int num_pixels = static_cast<int>(output.width() * output.height());
+
+        auto upsample_kernel = GetKernel("Upsample_main");
+
+        // Set kernel parameters
+        int argc = 0;
+        upsample_kernel.SetArg(argc++, color->data());
+        upsample_kernel.SetArg(argc++, depth->data());
+        upsample_kernel.SetArg(argc++, normal->data());
+        upsample_kernel.SetArg(argc++, static_cast<int>(width));
+        upsample_kernel.SetArg(argc++, static_cast<int>(height));
+        upsample_kernel.SetArg(argc++, static_cast<int>(output.width()));
+        upsample_kernel.SetArg(argc++, static_cast<int>(output.height()));
+        upsample_kernel.SetArg(argc++, depth_sigma);
+        upsample_kernel.SetArg(argc++, normal_power);
+        upsample_kernel.SetArg(argc++, static_cast<ClwOutput&>(output).data());
+
+        GetContext().Launch1D(0, ((num_pixels + 63) / 64) * 64, 64, upsample_kernel);
+    }
+
+}
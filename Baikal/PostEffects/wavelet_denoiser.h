@@ -23,11 +23,13 @@ THE SOFTWARE.
 #include "clw_post_effect.h"
 
 #include <SceneGraph/camera.h>
+#include "Utils/clw_profiler.h"
 #include <math/matrix.h>
 #include <math/mathutils.h>
 #include "AreaMap33.h"
 
 #include <limits>
+#include <memory>
 
 #ifdef BAIKAL_EMBED_KERNELS
 #include "embed_kernels.h"
@@ -45,6 +47,9 @@ namespace Baikal
     Parameters:
     * color_sensitivity - Higher the sensitivity the more it smoothes out depending on color difference.
     * position_sensitivity - Higher the sensitivity the more it smoothes out depending on position difference.
+    * half_resolution - Non-zero denoises a half resolution downsample of the inputs for about a quarter
+      of the cost and upsamples it with a joint bilateral filter guided by full resolution positions,
+      normals and mesh IDs. Meant for previews, history is restarted when the mode changes.
     Required AOVs in input set:
     * kColor
     * kAlbedo
@@ -61,10 +66,19 @@ namespace Baikal
         // Apply filter
         void Apply(InputSet const& input_set, Output& output) override;
         void Update(PerspectiveCamera* camera);
+        // Profile device time of every kernel of Apply, wavelet passes are told apart by their pass index.
+        // Caller resolves the profiler, nullptr turns profiling off
+        void SetProfiler(ClwProfiler* profiler) { m_profiler = profiler; }
 
     private:
         // Find required output
         ClwOutput* FindOutput(InputSet const& input_set, Renderer::OutputType type);
+        // Filter inputs of the same resolution into output
+        void Denoise(ClwOutput* color, ClwOutput* position, ClwOutput* normal, ClwOutput* albedo, ClwOutput* mesh_id, Output& output);
+
+        void ProfileMark(char const* name, std::uint32_t pass = ClwProfiler::kNoPass) {
+            if (m_profiler) m_profiler->Mark(name, pass);
+        }
 
         CLWProgram  m_program;
 
@@ -79,8 +93,9 @@ namespace Baikal
         ClwOutput*          m_positions[m_num_tmp_buffers];
         ClwOutput*          m_normals[m_num_tmp_buffers];
         ClwOutput*          m_mesh_ids[m_num_tmp_buffers];
+        // Half precision color and variance between wavelet passes
         ClwOutput*          m_tmp_buffers[m_num_tmp_buffers];
-        ClwOutput*          m_updated_variance;
+        ClwOutput*          m_filtered_color;
         ClwOutput*          m_moments[m_num_tmp_buffers];
 
         // MLAA buffers
@@ -101,6 +116,16 @@ namespace Baikal
         uint32_t            m_buffers_height;
 
         bool                m_buffers_initialized;
+
+        // Half resolution inputs and denoised color
+        std::unique_ptr<ClwOutput> m_low_color;
+        std::unique_ptr<ClwOutput> m_low_position;
+        std::unique_ptr<ClwOutput> m_low_normal;
+        std::unique_ptr<ClwOutput> m_low_albedo;
+        std::unique_ptr<ClwOutput> m_low_mesh_id;
+        std::unique_ptr<ClwOutput> m_low_denoised;
+
+        ClwProfiler*        m_profiler = nullptr;
     };
 
     inline WaveletDenoiser::WaveletDenoiser(CLWContext context, const CLProgramManager *program_manager)
@@ -119,6 +144,7 @@ namespace Baikal
         RegisterParameter("color_sensitivity", RadeonRays::float4(0.07f, 0.f, 0.f, 0.f));
         RegisterParameter("position_sensitivity", RadeonRays::float4(0.03f, 0.f, 0.f, 0.f));
         RegisterParameter("normal_sensitivity", RadeonRays::float4(0.01f, 0.f, 0.f, 0.f));
+        RegisterParameter("half_resolution", RadeonRays::float4(0.f, 0.f, 0.f, 0.f));
 
         for (uint32_t buffer_index = 0; buffer_index < m_num_tmp_buffers; buffer_index++)
         {
@@ -178,7 +204,7 @@ namespace Baikal
             delete m_moments[i];
         }
 
-        delete m_updated_variance;
+        delete m_filtered_color;
         delete m_motion_buffer;
 
         delete m_edge_detection;
@@ -194,23 +220,110 @@ namespace Baikal
             return nullptr;
         }
 
+        if (iter->second->format() != Output::Format::kRGBA32F)
+        {
+            throw std::runtime_error("Denoiser inputs require RGBA32F format");
+        }
+
         return static_cast<ClwOutput*>(iter->second);
     }
 
     inline void WaveletDenoiser::Apply(InputSet const& input_set, Output& output)
     {
-        uint32_t prev_buffer_index = m_current_buffer_index;
-        m_current_buffer_index = (m_current_buffer_index + 1) % m_num_tmp_buffers;
-
-        auto sigma_color = GetParameter("color_sensitivity").x;
-        auto sigma_position = GetParameter("position_sensitivity").x;
-
         auto color = FindOutput(input_set, Renderer::OutputType::kColor);
         auto normal = FindOutput(input_set, Renderer::OutputType::kWorldShadingNormal);
         auto position = FindOutput(input_set, Renderer::OutputType::kWorldPosition);
         auto albedo = FindOutput(input_set, Renderer::OutputType::kAlbedo);
         auto mesh_id = FindOutput(input_set, Renderer::OutputType::kMeshID);
 
+        if (m_profiler)
+        {
+            m_profiler->Begin();
+        }
+
+        if (GetParameter("half_resolution").x <= 0.f)
+        {
+            Denoise(color, position, normal, albedo, mesh_id, output);
+            return;
+        }
+
+        auto width = color->width();
+        auto height = color->height();
+        auto low_width = (width + 1) / 2;
+        auto low_height = (height + 1) / 2;
+
+        if (!m_low_color || m_low_color->width() != low_width || m_low_color->height() != low_height)
+        {
+            m_low_color.reset(new ClwOutput(GetContext(), low_width, low_height));
+            m_low_position.reset(new ClwOutput(GetContext(), low_width, low_height));
+            m_low_normal.reset(new ClwOutput(GetContext(), low_width, low_height));
+            m_low_albedo.reset(new ClwOutput(GetContext(), low_width, low_height));
+            m_low_mesh_id.reset(new ClwOutput(GetContext(), low_width, low_height));
+            m_low_denoised.reset(new ClwOutput(GetContext(), low_width, low_height));
+        }
+
+        {
+            auto downsample_kernel = GetKernel("WaveletDownsample_main");
+
+            int argc = 0;
+            downsample_kernel.SetArg(argc++, color->data());
+            downsample_kernel.SetArg(argc++, position->data());
+            downsample_kernel.SetArg(argc++, normal->data());
+            downsample_kernel.SetArg(argc++, albedo->data());
+            downsample_kernel.SetArg(argc++, mesh_id->data());
+            downsample_kernel.SetArg(argc++, width);
+            downsample_kernel.SetArg(argc++, height);
+            downsample_kernel.SetArg(argc++, low_width);
+            downsample_kernel.SetArg(argc++, low_height);
+            downsample_kernel.SetArg(argc++, m_low_color->data());
+            downsample_kernel.SetArg(argc++, m_low_position->data());
+            downsample_kernel.SetArg(argc++, m_low_normal->data());
+            downsample_kernel.SetArg(argc++, m_low_albedo->data());
+            downsample_kernel.SetArg(argc++, m_low_mesh_id->data());
+
+            size_t gs[] = { static_cast<size_t>((low_width + 7) / 8 * 8), static_cast<size_t>((low_height + 7) / 8 * 8) };
+            size_t ls[] = { 8, 8 };
+
+            GetContext().Launch2D(0, gs, ls, downsample_kernel);
+            ProfileMark("downsample");
+        }
+
+        Denoise(m_low_color.get(), m_low_position.get(), m_low_normal.get(), m_low_albedo.get(), m_low_mesh_id.get(), *m_low_denoised);
+
+        {
+            auto upsample_kernel = GetKernel("WaveletUpsample_main");
+
+            int argc = 0;
+            upsample_kernel.SetArg(argc++, m_low_denoised->data());
+            upsample_kernel.SetArg(argc++, m_low_position->data());
+            upsample_kernel.SetArg(argc++, m_low_normal->data());
+            upsample_kernel.SetArg(argc++, m_low_mesh_id->data());
+            upsample_kernel.SetArg(argc++, low_width);
+            upsample_kernel.SetArg(argc++, low_height);
+            upsample_kernel.SetArg(argc++, position->data());
+            upsample_kernel.SetArg(argc++, normal->data());
+            upsample_kernel.SetArg(argc++, mesh_id->data());
+            upsample_kernel.SetArg(argc++, width);
+            upsample_kernel.SetArg(argc++, height);
+            upsample_kernel.SetArg(argc++, GetParameter("position_sensitivity").x);
+            upsample_kernel.SetArg(argc++, static_cast<ClwOutput&>(output).data());
+
+            size_t gs[] = { static_cast<size_t>((width + 7) / 8 * 8), static_cast<size_t>((height + 7) / 8 * 8) };
+            size_t ls[] = { 8, 8 };
+
+            GetContext().Launch2D(0, gs, ls, upsample_kernel);
+            ProfileMark("upsample");
+        }
+    }
+
+    inline void WaveletDenoiser::Denoise(ClwOutput* color, ClwOutput* position, ClwOutput* normal, ClwOutput* albedo, ClwOutput* mesh_id, Output& output)
+    {
+        uint32_t prev_buffer_index = m_current_buffer_index;
+        m_current_buffer_index = (m_current_buffer_index + 1) % m_num_tmp_buffers;
+
+        auto sigma_color = GetParameter("color_sensitivity").x;
+        auto sigma_position = GetParameter("position_sensitivity").x;
+
         auto out_color = static_cast<ClwOutput*>(&output);
 
         auto color_width = color->width();
@@ -221,7 +334,7 @@ namespace Baikal
         {
             for (uint32_t buffer_index = 0; buffer_index < m_num_tmp_buffers; buffer_index++)
             {
-                m_tmp_buffers[buffer_index] = new ClwOutput(GetContext(), color_width, color_height);
+                m_tmp_buffers[buffer_index] = new ClwOutput(GetContext(), color_width, color_height, Output::Format::kRGBA16F);
 
                 m_colors[buffer_index] = new ClwOutput(GetContext(), color_width, color_height);
                 m_positions[buffer_index] = new ClwOutput(GetContext(), color_width, color_height);
@@ -238,12 +351,12 @@ namespace Baikal
             }
 
             m_motion_buffer = new ClwOutput(GetContext(), color_width, color_height);
-            m_updated_variance = new ClwOutput(GetContext(), color_width, color_height);
+            m_filtered_color = new ClwOutput(GetContext(), color_width, color_height);
             m_edge_detection = new ClwOutput(GetContext(), color_width, color_height);
             m_blending_weight_calculation = new ClwOutput(GetContext(), color_width, color_height);
 
             m_motion_buffer->Clear(0.f);
-            m_updated_variance->Clear(0.f);
+            m_filtered_color->Clear(0.f);
             m_edge_detection->Clear(0.f);
             m_blending_weight_calculation->Clear(0.f);
 
@@ -258,7 +371,7 @@ namespace Baikal
             for (uint32_t buffer_index = 0; buffer_index < m_num_tmp_buffers; buffer_index++)
             {
                 delete m_tmp_buffers[buffer_index];
-                m_tmp_buffers[buffer_index] = new ClwOutput(GetContext(), color_width, color_height);
+                m_tmp_buffers[buffer_index] = new ClwOutput(GetContext(), color_width, color_height, Output::Format::kRGBA16F);
                 m_tmp_buffers[buffer_index]->Clear(0.f);
 
                 delete m_colors[buffer_index];
@@ -283,18 +396,18 @@ namespace Baikal
             }
 
             delete m_motion_buffer;
-            delete m_updated_variance;
+            delete m_filtered_color;
             delete m_edge_detection;
             delete m_blending_weight_calculation;
 
 
             m_motion_buffer = new ClwOutput(GetContext(), color_width, color_height);
-            m_updated_variance = new ClwOutput(GetContext(), color_width, color_height);
+            m_filtered_color = new ClwOutput(GetContext(), color_width, color_height);
             m_edge_detection = new ClwOutput(GetContext(), color_width, color_height);
             m_blending_weight_calculation = new ClwOutput(GetContext(), color_width, color_height);
 
             m_motion_buffer->Clear(0.f);
-            m_updated_variance->Clear(0.f);
+            m_filtered_color->Clear(0.f);
             m_edge_detection->Clear(0.f);
             m_blending_weight_calculation->Clear(0.f);
 
@@ -326,6 +439,7 @@ namespace Baikal
                 size_t ls[] = { 8, 8 };
 
                 GetContext().Launch2D(0, gs, ls, copy_buffers_kernel);
+                ProfileMark("copy_buffers");
             }
         }
 
@@ -349,6 +463,7 @@ namespace Baikal
                 size_t ls[] = { 8, 8 };
 
                 GetContext().Launch2D(0, gs, ls, generate_motion_kernel);
+                ProfileMark("generate_motion");
             }
         }
 
@@ -379,63 +494,34 @@ namespace Baikal
                 size_t ls[] = { 8, 8 };
 
                 GetContext().Launch2D(0, gs, ls, accumulation_kernel);
-            }
-        }
-
-        {
-            auto copy_buffer_kernel = GetKernel("CopyBuffer_main");
-
-            int argc = 0;
-
-            // Set kernel parameters
-            copy_buffer_kernel.SetArg(argc++, m_colors[m_current_buffer_index]->data());
-            copy_buffer_kernel.SetArg(argc++, m_tmp_buffers[0]->data());
-            copy_buffer_kernel.SetArg(argc++, m_buffers_width);
-            copy_buffer_kernel.SetArg(argc++, m_buffers_height);
-
-            // Run shading kernel
-            {
-                size_t gs[] = { static_cast<size_t>((output.width() + 7) / 8 * 8), static_cast<size_t>((output.height() + 7) / 8 * 8) };
-                size_t ls[] = { 8, 8 };
-
-                GetContext().Launch2D(0, gs, ls, copy_buffer_kernel);
+                ProfileMark("temporal_accumulation");
             }
         }
 
         {
             auto filter_kernel = GetKernel("WaveletFilter_main");
-            auto update_variance_kernel = GetKernel("UpdateVariance_main");
-
-            Baikal::ClwOutput* current_input = nullptr;
-            Baikal::ClwOutput* current_output = nullptr;
-            Baikal::ClwOutput* current_variance = nullptr;
 
             for (uint32_t pass_index = 0; pass_index < m_max_wavelet_passes; pass_index++)
             {
-                if (pass_index == 0)
-                {
-                    // Result of first wavelet pass goes to color buffer for next frame
-                    current_input = m_tmp_buffers[pass_index % m_num_tmp_buffers];
-                    current_output = m_max_wavelet_passes == 1 ? out_color : m_colors[m_current_buffer_index];
-                    current_variance = m_moments[m_current_buffer_index];
-                }
-                else
-                {
-                    // Last pass goes to output buffer
-                    current_input = pass_index == 1 ? m_colors[m_current_buffer_index] : m_tmp_buffers[pass_index % m_num_tmp_buffers];
-                    current_output = m_tmp_buffers[(pass_index + 1) % m_num_tmp_buffers];
-                    current_variance = m_updated_variance;
-                }
+                const int first_pass = pass_index == 0 ? 1 : 0;
+                const int last_pass = pass_index == m_max_wavelet_passes - 1 ? 1 : 0;
+                // Result of first wavelet pass goes to color buffer for next frame
+                const int write_history = pass_index == 1 ? 1 : 0;
+
+                // First pass reads temporal accumulation results, further passes ping-pong half precision buffers
+                auto packed_input = m_tmp_buffers[(pass_index + 1) % m_num_tmp_buffers];
+                auto packed_output = m_tmp_buffers[pass_index % m_num_tmp_buffers];
 
                 const int step_width = 1 << pass_index;
 
                 int argc = 0;
 
                 // Set kernel parameters
-                filter_kernel.SetArg(argc++, current_input->data());
+                filter_kernel.SetArg(argc++, m_colors[m_current_buffer_index]->data());
+                filter_kernel.SetArg(argc++, m_moments[m_current_buffer_index]->data());
+                filter_kernel.SetArg(argc++, packed_input->data());
                 filter_kernel.SetArg(argc++, m_normals[m_current_buffer_index]->data());
                 filter_kernel.SetArg(argc++, m_positions[m_current_buffer_index]->data());
-                filter_kernel.SetArg(argc++, current_variance->data());
                 filter_kernel.SetArg(argc++, albedo->data());
 
                 filter_kernel.SetArg(argc++, color->width());
@@ -443,31 +529,20 @@ namespace Baikal
                 filter_kernel.SetArg(argc++, step_width);
                 filter_kernel.SetArg(argc++, sigma_color);
                 filter_kernel.SetArg(argc++, sigma_position);
-                filter_kernel.SetArg(argc++, current_output->data());
-
-                // Run wavelet filter kernel
+                filter_kernel.SetArg(argc++, first_pass);
+                filter_kernel.SetArg(argc++, last_pass);
+                filter_kernel.SetArg(argc++, write_history);
+                filter_kernel.SetArg(argc++, packed_output->data());
+                filter_kernel.SetArg(argc++, m_filtered_color->data());
+                filter_kernel.SetArg(argc++, m_colors[m_current_buffer_index]->data());
+
+                // Run wavelet filter kernel, group size matches local memory tile
                 {
                     size_t gs[] = { static_cast<size_t>((output.width() + 7) / 8 * 8), static_cast<size_t>((output.height() + 7) / 8 * 8) };
                     size_t ls[] = { 8, 8 };
 
                     GetContext().Launch2D(0, gs, ls, filter_kernel);
-                }
-
-                argc = 0;
-
-                update_variance_kernel.SetArg(argc++, current_output->data());
-                update_variance_kernel.SetArg(argc++, m_positions[m_current_buffer_index]->data());
-                update_variance_kernel.SetArg(argc++, m_normals[m_current_buffer_index]->data());
-                update_variance_kernel.SetArg(argc++, color->width());
-                update_variance_kernel.SetArg(argc++, color->height());
-                update_variance_kernel.SetArg(argc++, m_updated_variance->data());
-
-                // Run update variance kernel
-                {
-                    size_t gs[] = { static_cast<size_t>((output.width() + 7) / 8 * 8), static_cast<size_t>((output.height() + 7) / 8 * 8) };
-                    size_t ls[] = { 8, 8 };
-
-                    GetContext().Launch2D(0, gs, ls, update_variance_kernel);
+                    ProfileMark("wavelet_filter", pass_index);
                 }
             }
 
@@ -486,6 +561,7 @@ namespace Baikal
                 size_t ls[] = { 8, 8 };
 
                 GetContext().Launch2D(0, gs, ls, edge_detection_kernel);
+                ProfileMark("mlaa_edge_detection");
             }
 
             argc = 0;
@@ -503,12 +579,13 @@ namespace Baikal
                 size_t ls[] = { 8, 8 };
 
                 GetContext().Launch2D(0, gs, ls, blending_weight_calclulation_kernel);
+                ProfileMark("mlaa_blending_weights");
             }
 
             argc = 0;
 
             auto neighborhood_blending_kernel = GetKernel("NeighborhoodBlendingMLAA");
-            neighborhood_blending_kernel.SetArg(argc++, current_output->data());
+            neighborhood_blending_kernel.SetArg(argc++, m_filtered_color->data());
             neighborhood_blending_kernel.SetArg(argc++, m_blending_weight_calculation->data());
             neighborhood_blending_kernel.SetArg(argc++, color->width());
             neighborhood_blending_kernel.SetArg(argc++, color->height());
@@ -520,6 +597,7 @@ namespace Baikal
                 size_t ls[] = { 8, 8 };
 
                 GetContext().Launch2D(0, gs, ls, neighborhood_blending_kernel);
+                ProfileMark("mlaa_neighborhood_blending");
             }
         }
     }
@@ -1,10 +1,18 @@
 #include "clw_render_factory.h"
 
 #include "Output/clwoutput.h"
+#include "Output/tile_delta_encoder.h"
 #include "Renderers/monte_carlo_renderer.h"
 #include "Renderers/adaptive_renderer.h"
+#include "Estimators/ao_estimator.h"
 #include "Estimators/path_tracing_estimator.h"
+#include "Estimators/bdpt_estimator.h"
+#include "Estimators/photon_map_estimator.h"
 
+#include "PostEffects/external_denoiser.h"
+#include "PostEffects/temporal_accumulator.h"
+#include "PostEffects/tonemapper.h"
+#include "PostEffects/upsampler.h"
 #ifdef ENABLE_DENOISER
 #include "PostEffects/bilateral_denoiser.h"
 #include "PostEffects/wavelet_denoiser.h"
@@ -26,7 +34,14 @@ namespace Baikal
         )
         , RadeonRays::IntersectionApi::Delete
     )
-    
+    , m_background_intersector(
+        CreateFromOpenClContext(
+            context,
+            context.GetDevice(0).GetID(),
+            context.GetCommandQueue(0)
+        )
+        , RadeonRays::IntersectionApi::Delete
+    )
     {
     }
 
@@ -43,21 +58,88 @@ namespace Baikal
                         &m_program_manager,
                         std::make_unique<PathTracingEstimator>(m_context, m_intersector, &m_program_manager)
                         ));
+            case RendererType::kUnidirectionalPathTracerPersistentThreads:
+            {
+                auto estimator = std::make_unique<PathTracingEstimator>(m_context, m_intersector, &m_program_manager);
+                estimator->SetShadingMode(PathTracingEstimator::ShadingMode::kPersistentThreads);
+
+                return std::unique_ptr<Renderer>(
+                    new MonteCarloRenderer(
+                        m_context,
+                        &m_program_manager,
+                        std::move(estimator)
+                        ));
+            }
+            case RendererType::kBidirectionalPathTracer:
+                return std::unique_ptr<Renderer>(
+                    new MonteCarloRenderer(
+                        m_context,
+                        &m_program_manager,
+                        std::make_unique<BdptEstimator>(m_context, m_intersector, &m_program_manager)
+                        ));
+            case RendererType::kPhotonMappedPathTracer:
+                return std::unique_ptr<Renderer>(
+                    new MonteCarloRenderer(
+                        m_context,
+                        &m_program_manager,
+                        std::make_unique<PhotonMapEstimator>(m_context, m_intersector, &m_program_manager)
+                        ));
+            case RendererType::kAmbientOcclusion:
+                return std::unique_ptr<Renderer>(
+                    new MonteCarloRenderer(
+                        m_context,
+                        &m_program_manager,
+                        std::make_unique<AoEstimator>(m_context, m_intersector, &m_program_manager)
+                        ));
+            case RendererType::kAdaptivePathTracer:
+                return std::unique_ptr<Renderer>(
+                    new AdaptiveRenderer(
+                        m_context,
+                        &m_program_manager,
+                        std::make_unique<PathTracingEstimator>(m_context, m_intersector, &m_program_manager)
+                        ));
             default:
                 throw std::runtime_error("Renderer not supported");
         }
     }
 
     std::unique_ptr<Output> ClwRenderFactory::CreateOutput(std::uint32_t w,
-                                                           std::uint32_t h)
+                                                           std::uint32_t h,
+                                                           Output::Format format)
                                                            const
     {
-        return std::unique_ptr<Output>(new ClwOutput(m_context, w, h));
+        return std::unique_ptr<Output>(new ClwOutput(m_context, w, h, format));
     }
 
     std::unique_ptr<PostEffect> ClwRenderFactory::CreatePostEffect(
                                                     PostEffectType type) const
     {
+        // Tonemapping does not depend on denoiser kernels
+        if (type == PostEffectType::kTonemapper)
+        {
+            return std::unique_ptr<PostEffect>(
+                                        new Tonemapper(m_context, &m_program_manager));
+        }
+
+        if (type == PostEffectType::kTemporalAccumulator)
+        {
+            return std::unique_ptr<PostEffect>(
+                                        new TemporalAccumulator(m_context, &m_program_manager));
+        }
+
+        if (type == PostEffectType::kUpsampler)
+        {
+            return std::unique_ptr<PostEffect>(
+                                        new Upsampler(m_context, &m_program_manager));
+        }
+
+        // Adapter for denoisers running outside of Baikal, backend is set by the caller
+        if (type == PostEffectType::kExternalDenoiser)
+        {
+            return std::unique_ptr<PostEffect>(
+                                        new ExternalDenoiser(m_context, &m_program_manager));
+        }
+
 #ifdef ENABLE_DENOISER
         switch (type)
         {
@@ -75,8 +157,31 @@ namespace Baikal
 #endif
     }
 
+    std::unique_ptr<TileDeltaEncoder> ClwRenderFactory::CreateTileDeltaEncoder() const
+    {
+        return std::unique_ptr<TileDeltaEncoder>(new TileDeltaEncoder(m_context, &m_program_manager));
+    }
+
     std::unique_ptr<SceneController<ClwScene>> ClwRenderFactory::CreateSceneController() const
     {
-        return std::make_unique<ClwSceneController>(m_context, m_intersector.get(), &m_program_manager);
+        auto controller = std::make_unique<ClwSceneController>(m_context, m_intersector.get(), &m_program_manager, m_background_intersector.get());
+        // Derived scene data is cached next to program binaries
+        controller->SetCompileCachePath(m_cache_path);
+        return controller;
+    }
+
+    void ClwRenderFactory::SetSharedProgramCachePath(std::string const& path)
+    {
+        m_program_manager.SetSharedCachePath(path);
+    }
+
+    void ClwRenderFactory::SetBuildProfile(CLProgramManager::BuildProfile profile)
+    {
+        m_program_manager.SetBuildProfile(profile);
+    }
+
+    void ClwRenderFactory::SetWorkGroupTuning(bool enable)
+    {
+        m_program_manager.GetWorkGroupTuner(m_context).SetEnabled(enable);
     }
 }
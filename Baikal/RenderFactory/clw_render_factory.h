@@ -35,6 +35,8 @@
 
 namespace Baikal
 {
+    class TileDeltaEncoder;
+
     /**
      \brief RenderFactory class is in charge of render entities creation.
      
@@ -50,9 +52,10 @@ namespace Baikal
         // Create a renderer of specified type
         std::unique_ptr<Renderer> 
             CreateRenderer(RendererType type) const override;
-        // Create an output of specified type
+        // Create an output of specified size and storage format
         std::unique_ptr<Output> 
-            CreateOutput(std::uint32_t w, std::uint32_t h) const override;
+            CreateOutput(std::uint32_t w, std::uint32_t h,
+                Output::Format format = Output::Format::kRGBA32F) const override;
         // Create post effect of specified type
         std::unique_ptr<PostEffect> 
             CreatePostEffect(PostEffectType type) const override;
@@ -60,6 +63,17 @@ namespace Baikal
         std::unique_ptr<SceneController<ClwScene>>
             CreateSceneController() const override;
 
+        // Create encoder of tile updates for remote viewers, works on outputs of this factory
+        std::unique_ptr<TileDeltaEncoder>
+            CreateTileDeltaEncoder() const;
+
+        // Look program binaries up in a read-only folder shared between machines after the cache folder
+        void SetSharedProgramCachePath(std::string const& path);
+        // Set math options of the programs, applies to programs built afterwards
+        void SetBuildProfile(CLProgramManager::BuildProfile profile);
+        // Time local sizes of the first kernel launches, on by default. Stored sizes are used either way
+        void SetWorkGroupTuning(bool enable);
+
     private:
         CLWContext m_context;
         std::string m_cache_path;
@@ -68,5 +82,7 @@ namespace Baikal
         using RadeonRaysInstanceDelete = decltype(RadeonRays::IntersectionApi::Delete);
 
         std::shared_ptr<RadeonRays::IntersectionApi> m_intersector;
+        // Background scene compiles build acceleration structures here while rendering uses the other one
+        std::shared_ptr<RadeonRays::IntersectionApi> m_background_intersector;
     };
 }
@@ -25,11 +25,11 @@
 
 #include "CLW.h"
 #include "Controllers/scene_controller.h"
+#include "Output/output.h"
 
 namespace Baikal
 {
     class Renderer;
-    class Output;
     class PostEffect;
     
     /**
@@ -45,13 +45,27 @@ namespace Baikal
     public:
         enum class RendererType
         {
-            kUnidirectionalPathTracer
+            kUnidirectionalPathTracer,
+            // Same as above, but surface shading uses persistent threads
+            kUnidirectionalPathTracerPersistentThreads,
+            // Path tracing with caustics gathered by light tracing
+            kBidirectionalPathTracer,
+            // Path tracing with caustics gathered from a photon map
+            kPhotonMappedPathTracer,
+            // Ambient occlusion of first hits without materials and lights, for layout previews
+            kAmbientOcclusion,
+            // Path tracing with samples spread by image variance, converged pixels get no more rays
+            kAdaptivePathTracer
         };
         
         enum class PostEffectType
         {
             kBilateralDenoiser,
-            kWaveletDenoiser
+            kWaveletDenoiser,
+            kTonemapper,
+            kTemporalAccumulator,
+            kExternalDenoiser,
+            kUpsampler
         };
 
         RenderFactory() = default;
@@ -61,7 +75,8 @@ namespace Baikal
         std::unique_ptr<Renderer> CreateRenderer(RendererType type) const = 0;
 
         virtual 
-        std::unique_ptr<Output> CreateOutput(std::uint32_t w, std::uint32_t h) const = 0;
+        std::unique_ptr<Output> CreateOutput(std::uint32_t w, std::uint32_t h,
+            Output::Format format = Output::Format::kRGBA32F) const = 0;
 
         virtual 
         std::unique_ptr<PostEffect> CreatePostEffect(PostEffectType type) const = 0;
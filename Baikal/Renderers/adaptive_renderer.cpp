@@ -1,5 +1,8 @@
 #include "adaptive_renderer.h"
 #include "Output/clwoutput.h"
+#include "Renderers/render_checkpoint.h"
+
+#include <stdexcept>
 
 namespace Baikal
 {
@@ -9,9 +12,19 @@ namespace Baikal
         const CLProgramManager *program_manager,
         std::unique_ptr<Estimator> estimator
     ) : MonteCarloRenderer(context, program_manager, std::move(estimator))
+    , m_pp(context, GetFullBuildOpts().c_str())
+    , m_convergence_threshold(0.f)
+    , m_min_samples_per_pixel(64u)
+    , m_converged(false)
+    , m_unconverged_fraction(1.f)
     {
         auto samples_buffer_size = GetEstimator().GetWorkBufferSize();
         m_sample_buffer = GetContext().CreateBuffer<float3>(samples_buffer_size, CL_MEM_READ_WRITE);
+        m_domain_indices = GetContext().CreateBuffer<int>(samples_buffer_size, CL_MEM_READ_WRITE);
+        m_domain_predicate = GetContext().CreateBuffer<int>(samples_buffer_size, CL_MEM_READ_WRITE);
+        m_sorted_keys = GetContext().CreateBuffer<int>(samples_buffer_size, CL_MEM_READ_WRITE);
+        m_sorted_values = GetContext().CreateBuffer<int>(samples_buffer_size, CL_MEM_READ_WRITE);
+        m_unconverged_count = GetContext().CreateBuffer<int>(1, CL_MEM_READ_WRITE);
     }
 
     void AdaptiveRenderer::Clear(RadeonRays::float3 const& val,
@@ -20,6 +33,10 @@ namespace Baikal
         MonteCarloRenderer::Clear(val, output);
 
         GetContext().FillBuffer(0u, m_variance_buffer, 0.f, m_variance_buffer.GetElementCount()).Wait();
+        GetContext().FillBuffer(0u, m_moments_buffer, 0.f, m_moments_buffer.GetElementCount()).Wait();
+        GetContext().FillBuffer(0u, m_convergence_mask, 0, m_convergence_mask.GetElementCount()).Wait();
+        m_converged = false;
+        m_unconverged_fraction = 1.f;
     }
 
     // Render single tile
@@ -32,6 +49,28 @@ namespace Baikal
         auto width = output->width();
         auto height = output->height();
 
+        // Samples are distributed by variance, so batching them per pixel makes no sense
+        if (GetSamplesPerDispatch() != 1)
+        {
+            throw std::runtime_error("AdaptiveRenderer: multiple samples per dispatch are not supported");
+        }
+
+        // Work buffer might have been resized along with the tile size
+        auto samples_buffer_size = GetEstimator().GetWorkBufferSize();
+        if (m_sample_buffer.GetElementCount() < samples_buffer_size)
+        {
+            m_sample_buffer = GetContext().CreateBuffer<float3>(samples_buffer_size, CL_MEM_READ_WRITE);
+            m_domain_indices = GetContext().CreateBuffer<int>(samples_buffer_size, CL_MEM_READ_WRITE);
+            m_domain_predicate = GetContext().CreateBuffer<int>(samples_buffer_size, CL_MEM_READ_WRITE);
+            m_sorted_keys = GetContext().CreateBuffer<int>(samples_buffer_size, CL_MEM_READ_WRITE);
+            m_sorted_values = GetContext().CreateBuffer<int>(samples_buffer_size, CL_MEM_READ_WRITE);
+        }
+
+        if (output && m_converged)
+        {
+            return;
+        }
+
         GetContext().FillBuffer(0u, m_sample_buffer, float3(), m_sample_buffer.GetElementCount()).Wait();
 
         if (output)
@@ -39,46 +78,52 @@ namespace Baikal
             auto num_rays = tile_size.x * tile_size.y;
             auto output_size = int2(width, height);
 
-            if (m_sample_counter < 32)
+            // Tiles sampled after the variance can hand out the same pixel to several rays
+            bool adaptive_domain = m_sample_counter >= 32;
+
+            if (!adaptive_domain)
             {
-                MonteCarloRenderer::GenerateTileDomain(output_size, tile_origin, tile_size);
+                MonteCarloRenderer::GenerateTileDomain(output_size, tile_origin, tile_size, 1);
             }
             else
             {
-                GenerateTileDomain(output_size, tile_origin, tile_size);
+                GenerateTileDomain(output_size, tile_origin, tile_size, 1);
             }
 
             GeneratePrimaryRays(scene, *output, tile_size);
 
+            m_estimator->SetSampleIndex(m_sample_counter);
+
             m_estimator->Estimate(
                 scene,
                 num_rays,
-                Estimator::QualityLevel::kStandard,
+                GetQualityLevel(),
                 m_sample_buffer,
                 false,
                 true
             );
 
-            AccumulateSamples(m_sample_buffer, output->data(), num_rays);
+            AccumulateSamples(m_sample_buffer, output->data(), num_rays, adaptive_domain);
 
             if (m_sample_counter > 0 && m_sample_counter % 32 == 0)
             {
-                auto variance_buffer_size = m_variance_buffer.GetElementCount();
                 EstimateVariance(output->data(), output->width(), output->height());
 
-                std::vector<float> probabilities(variance_buffer_size);
-                GetContext().ReadBuffer(0u, m_variance_buffer, &probabilities[0], variance_buffer_size).Wait();
-
-                m_tile_distribution.Set(&probabilities[0],
-                                        (std::uint32_t)variance_buffer_size);
+                bool use_convergence_mask = m_convergence_threshold > 0.f;
+                if (use_convergence_mask)
+                {
+                    auto num_unconverged = UpdateConvergenceMask(output->data(), width, height);
+                    m_converged = (num_unconverged == 0);
+                    m_unconverged_fraction = static_cast<float>(num_unconverged) / (width * height);
+                }
 
-                UpdateTileDistribution();
+                UpdateTileDistribution(use_convergence_mask);
             }
 
         }
 
         // Check if we have other outputs, than color
-        bool aov_pass_needed = (FindFirstNonZeroOutput(false) != nullptr);
+        bool aov_pass_needed = HasEnabledAOVs();
         if (aov_pass_needed)
         {
             FillAOVs(scene, tile_origin, tile_size);
@@ -89,16 +134,54 @@ namespace Baikal
     void AdaptiveRenderer::AccumulateSamples(
         CLWBuffer<float3> sample_buffer,
         CLWBuffer<float3> accumulation_buffer,
-        std::uint32_t num_elements
+        std::uint32_t num_elements,
+        bool duplicate_indices
     )
     {
+        if (duplicate_indices)
+        {
+            auto key_kernel = GetKernel("BuildSampleSortKeys");
+
+            int argc = 0;
+            key_kernel.SetArg(argc++, m_estimator->GetOutputIndexBuffer());
+            key_kernel.SetArg(argc++, m_estimator->GetRayCountBuffer());
+            key_kernel.SetArg(argc++, (cl_int)num_elements);
+            key_kernel.SetArg(argc++, m_domain_predicate);
+            key_kernel.SetArg(argc++, m_domain_indices);
+
+            GetContext().Launch1D(0, ((num_elements + 63) / 64) * 64, 64, key_kernel);
+
+            m_pp.SortRadix(
+                0,
+                m_domain_predicate,
+                m_sorted_keys,
+                m_domain_indices,
+                m_sorted_values,
+                (int)num_elements
+            );
+
+            auto accumulate_kernel = GetKernel("AccumulateSortedSamples");
+
+            argc = 0;
+            accumulate_kernel.SetArg(argc++, sample_buffer);
+            accumulate_kernel.SetArg(argc++, accumulation_buffer);
+            accumulate_kernel.SetArg(argc++, m_moments_buffer);
+            accumulate_kernel.SetArg(argc++, m_sorted_keys);
+            accumulate_kernel.SetArg(argc++, m_sorted_values);
+            accumulate_kernel.SetArg(argc++, (cl_int)num_elements);
+
+            GetContext().Launch1D(0, ((num_elements + 63) / 64) * 64, 64, accumulate_kernel);
+            return;
+        }
+
         auto accumulate_kernel = GetKernel("AccumulateSingleSample");
 
         int argc = 0;
         accumulate_kernel.SetArg(argc++, sample_buffer);
         accumulate_kernel.SetArg(argc++, accumulation_buffer);
+        accumulate_kernel.SetArg(argc++, m_moments_buffer);
         accumulate_kernel.SetArg(argc++, m_estimator->GetOutputIndexBuffer());
-        accumulate_kernel.SetArg(argc++, num_elements);
+        accumulate_kernel.SetArg(argc++, m_estimator->GetRayCountBuffer());
 
         {
             GetContext().Launch1D(0, ((num_elements + 63) / 64) * 64, 64, accumulate_kernel);
@@ -121,13 +204,83 @@ namespace Baikal
 
         // Run shading kernel
         {
-            size_t gs[] = { static_cast<size_t>((width + 15) / 16 * 16), static_cast<size_t>((width + 15) / 16 * 16) };
+            size_t gs[] = { static_cast<size_t>((width + 15) / 16 * 16), static_cast<size_t>((height + 15) / 16 * 16) };
             size_t ls[] = { 16, 16 };
 
             GetContext().Launch2D(0, gs, ls, estimate_kernel);
         }
     }
 
+    std::uint32_t AdaptiveRenderer::UpdateConvergenceMask(
+        CLWBuffer<float3> accumulation_buffer,
+        std::uint32_t width,
+        std::uint32_t height
+    )
+    {
+        GetContext().FillBuffer(0u, m_unconverged_count, 0, 1);
+
+        auto mask_kernel = GetKernel("UpdateConvergenceMask");
+
+        int argc = 0;
+        mask_kernel.SetArg(argc++, accumulation_buffer);
+        mask_kernel.SetArg(argc++, m_moments_buffer);
+        mask_kernel.SetArg(argc++, width);
+        mask_kernel.SetArg(argc++, height);
+        mask_kernel.SetArg(argc++, m_min_samples_per_pixel);
+        mask_kernel.SetArg(argc++, m_convergence_threshold);
+        mask_kernel.SetArg(argc++, m_convergence_mask);
+        mask_kernel.SetArg(argc++, m_tile_unconverged_buffer);
+        mask_kernel.SetArg(argc++, m_unconverged_count);
+
+        {
+            size_t gs[] = { static_cast<size_t>((width + 15) / 16 * 16), static_cast<size_t>((height + 15) / 16 * 16) };
+            size_t ls[] = { 16, 16 };
+
+            GetContext().Launch2D(0, gs, ls, mask_kernel);
+        }
+
+        int num_unconverged = 0;
+        GetContext().ReadBuffer(0u, m_unconverged_count, &num_unconverged, 1).Wait();
+        return static_cast<std::uint32_t>(num_unconverged);
+    }
+
+    void AdaptiveRenderer::SetConvergenceThreshold(float threshold)
+    {
+        if (threshold < 0.f)
+        {
+            throw std::runtime_error("AdaptiveRenderer: convergence threshold should be non-negative");
+        }
+
+        m_convergence_threshold = threshold;
+        m_converged = false;
+        m_unconverged_fraction = 1.f;
+    }
+
+    float AdaptiveRenderer::GetConvergenceThreshold() const
+    {
+        return m_convergence_threshold;
+    }
+
+    void AdaptiveRenderer::SetMinSamplesPerPixel(std::uint32_t num_samples)
+    {
+        m_min_samples_per_pixel = num_samples;
+    }
+
+    std::uint32_t AdaptiveRenderer::GetMinSamplesPerPixel() const
+    {
+        return m_min_samples_per_pixel;
+    }
+
+    bool AdaptiveRenderer::IsConverged() const
+    {
+        return m_converged;
+    }
+
+    float AdaptiveRenderer::GetUnconvergedFraction() const
+    {
+        return m_convergence_threshold > 0.f ? m_unconverged_fraction : -1.f;
+    }
+
     void AdaptiveRenderer::SetOutput(OutputType type, Output* output)
     {
         // Intermediate variance buffer
@@ -140,55 +293,79 @@ namespace Baikal
 
             auto variance_buffer_size = ((width + 15) / 16) * ((height + 15) / 16);
             m_variance_buffer = GetContext().CreateBuffer<float>(variance_buffer_size, CL_MEM_READ_WRITE);
+            m_tile_unconverged_buffer = GetContext().CreateBuffer<int>(variance_buffer_size, CL_MEM_READ_WRITE);
+            m_moments_buffer = GetContext().CreateBuffer<float>(width * height, CL_MEM_READ_WRITE);
+            m_convergence_mask = GetContext().CreateBuffer<int>(width * height, CL_MEM_READ_WRITE);
+            GetContext().FillBuffer(0u, m_moments_buffer, 0.f, width * height);
+            GetContext().FillBuffer(0u, m_convergence_mask, 0, width * height);
+            m_converged = false;
+            m_unconverged_fraction = 1.f;
+
+            // Zero variance everywhere results in uniform distribution
+            GetContext().FillBuffer(0u, m_variance_buffer, 0.f, variance_buffer_size);
+            UpdateTileDistribution(false);
+        }
+    }
 
-            std::vector<float> probabilities(variance_buffer_size, 1.f);
-            m_tile_distribution.Set(&probabilities[0], variance_buffer_size);
+    void AdaptiveRenderer::SaveCheckpoint(RenderCheckpoint& checkpoint) const
+    {
+        MonteCarloRenderer::SaveCheckpoint(checkpoint);
+
+        checkpoint.SaveBuffer(GetContext(), "adaptive.variance", m_variance_buffer);
+        checkpoint.SaveBuffer(GetContext(), "adaptive.moments", m_moments_buffer);
+        checkpoint.SaveBuffer(GetContext(), "adaptive.convergence_mask", m_convergence_mask);
+        checkpoint.SaveBuffer(GetContext(), "adaptive.tile_unconverged", m_tile_unconverged_buffer);
+        checkpoint.SaveBuffer(GetContext(), "adaptive.tile_distribution", m_tile_distribution_buffer);
+        checkpoint.SetValue("adaptive.converged", m_converged ? 1u : 0u);
+        checkpoint.SetValue("adaptive.unconverged_fraction", m_unconverged_fraction);
+    }
 
-            UpdateTileDistribution();
-        }
+    void AdaptiveRenderer::LoadCheckpoint(RenderCheckpoint const& checkpoint)
+    {
+        MonteCarloRenderer::LoadCheckpoint(checkpoint);
+
+        checkpoint.LoadBuffer(GetContext(), "adaptive.variance", m_variance_buffer);
+        checkpoint.LoadBuffer(GetContext(), "adaptive.moments", m_moments_buffer);
+        checkpoint.LoadBuffer(GetContext(), "adaptive.convergence_mask", m_convergence_mask);
+        checkpoint.LoadBuffer(GetContext(), "adaptive.tile_unconverged", m_tile_unconverged_buffer);
+        checkpoint.LoadBuffer(GetContext(), "adaptive.tile_distribution", m_tile_distribution_buffer);
+        m_converged = checkpoint.GetValue<std::uint32_t>("adaptive.converged") != 0u;
+        m_unconverged_fraction = checkpoint.GetValue<float>("adaptive.unconverged_fraction");
     }
 
-    void AdaptiveRenderer::UpdateTileDistribution()
+    void AdaptiveRenderer::UpdateTileDistribution(bool use_convergence_mask)
     {
-        // Write distribution data
-        int* distribution_ptr = nullptr;
         auto num_tiles = m_variance_buffer.GetElementCount();
-        auto required_size = (1 + 1 + num_tiles + num_tiles);
+        // Segment count, CDF, PDF, alias probabilities and aliases
+        auto required_size = 1 + (num_tiles + 1) + 3 * num_tiles;
         if (m_tile_distribution_buffer.GetElementCount() < required_size)
         {
-            m_tile_distribution_buffer = GetContext().CreateBuffer<int>(required_size, CL_MEM_READ_ONLY);
+            m_tile_distribution_buffer = GetContext().CreateBuffer<int>(required_size, CL_MEM_READ_WRITE);
         }
 
-        GetContext().MapBuffer(0, m_tile_distribution_buffer, CL_MAP_WRITE, &distribution_ptr).Wait();
-        auto current = distribution_ptr;
-
-        // Write the number of segments first
-        *current++ = (int)m_tile_distribution.m_num_segments;
+        auto build_kernel = GetKernel("BuildTileDistribution");
 
-        // Then write num_segments  + 1 CDF values
-        auto values = reinterpret_cast<float*>(current);
-        for (auto i = 0u; i < m_tile_distribution.m_num_segments + 1; ++i)
-        {
-            values[i] = m_tile_distribution.m_cdf[i];
-        }
-
-        // Then write num_segments PDF values
-        values += m_tile_distribution.m_num_segments + 1;
+        int argc = 0;
+        build_kernel.SetArg(argc++, m_variance_buffer);
+        build_kernel.SetArg(argc++, m_tile_unconverged_buffer);
+        build_kernel.SetArg(argc++, use_convergence_mask ? 1 : 0);
+        build_kernel.SetArg(argc++, (int)num_tiles);
+        build_kernel.SetArg(argc++, m_tile_distribution_buffer);
 
-        for (auto i = 0u; i < m_tile_distribution.m_num_segments; ++i)
+        // Single work-group scans the whole tile range
         {
-            values[i] = m_tile_distribution.m_func_values[i] / m_tile_distribution.m_func_sum;
+            GetContext().Launch1D(0, 256, 256, build_kernel);
         }
-
-        GetContext().UnmapBuffer(0, m_tile_distribution_buffer, distribution_ptr);
     }
 
     void AdaptiveRenderer::GenerateTileDomain(
         int2 const& output_size,
         int2 const& tile_origin,
-        int2 const& tile_size
+        int2 const& tile_size,
+        std::uint32_t num_samples
     )
     {
+        // RenderTile always requests a single sample per pixel
         // Fetch kernel
         CLWKernel generate_kernel = GetKernel("GenerateTileDomain_Adaptive");
 
@@ -200,13 +377,14 @@ namespace Baikal
         generate_kernel.SetArg(argc++, tile_origin.y);
         generate_kernel.SetArg(argc++, tile_size.x);
         generate_kernel.SetArg(argc++, tile_size.y);
-        generate_kernel.SetArg(argc++, rand_uint());
+        generate_kernel.SetArg(argc++, GetLaunchSeed(LaunchSeed::kGenerateTileDomain));
         generate_kernel.SetArg(argc++, m_sample_counter);
         generate_kernel.SetArg(argc++, m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kRandomSeed));
         generate_kernel.SetArg(argc++, m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kSobolLUT));
         generate_kernel.SetArg(argc++, m_tile_distribution_buffer);
-        generate_kernel.SetArg(argc++, m_estimator->GetOutputIndexBuffer());
-        generate_kernel.SetArg(argc++, m_estimator->GetRayCountBuffer());
+        generate_kernel.SetArg(argc++, m_convergence_mask);
+        generate_kernel.SetArg(argc++, m_domain_indices);
+        generate_kernel.SetArg(argc++, m_domain_predicate);
 
         // Run shading kernel
         {
@@ -215,6 +393,16 @@ namespace Baikal
 
             GetContext().Launch2D(0, gs, ls, generate_kernel);
         }
+
+        // Drop converged pixels, compaction is stable so ray order is deterministic
+        m_pp.Compact(
+            0,
+            m_domain_predicate,
+            m_domain_indices,
+            m_estimator->GetOutputIndexBuffer(),
+            (std::uint32_t)(tile_size.x * tile_size.y),
+            m_estimator->GetRayCountBuffer()
+        );
     }
     
 }
@@ -24,7 +24,6 @@ THE SOFTWARE.
 #include "math/int2.h"
 #include "monte_carlo_renderer.h"
 #include "CLW.h"
-#include "Utils/distribution1d.h"
 
 #include <memory>
 
@@ -59,13 +58,66 @@ namespace Baikal
         // Set output
         void SetOutput(OutputType type, Output* output) override;
 
+        // Variance, moments and convergence state go along with the outputs
+        void SaveCheckpoint(RenderCheckpoint& checkpoint) const override;
+        void LoadCheckpoint(RenderCheckpoint const& checkpoint) override;
+
+        /**
+        \brief Set relative error threshold pixels are considered converged at.
+
+        Pixel is converged once the standard deviation of its mean luminance
+        falls below threshold * mean. Converged pixels no longer receive rays and
+        converged tiles are excluded from the tile distribution. 0 disables
+        convergence tracking.
+
+        \param threshold Relative error threshold
+        */
+        void SetConvergenceThreshold(float threshold);
+
+        /**
+        \brief Get relative error threshold.
+        */
+        float GetConvergenceThreshold() const;
+
+        /**
+        \brief Set number of samples a pixel needs before it can converge.
+
+        \param num_samples Minimum number of samples per pixel
+        */
+        void SetMinSamplesPerPixel(std::uint32_t num_samples);
+
+        /**
+        \brief Get number of samples a pixel needs before it can converge.
+        */
+        std::uint32_t GetMinSamplesPerPixel() const;
+
+        /**
+        \brief Check if all the pixels of the output have converged.
+
+        Updated every time tile distribution is refreshed. Once converged
+        RenderTile does not generate any more work until the output is cleared.
+        */
+        bool IsConverged() const;
+
+        /**
+        \brief Fraction of the output pixels which have not converged yet.
+
+        Updated along with the convergence mask, returns -1 if convergence
+        threshold is not set and no estimate is available.
+        */
+        float GetUnconvergedFraction() const;
+
         // DEBUG STUFF
         CLWBuffer<float> GetVarianceBuffer() const { return m_variance_buffer; }
+        CLWBuffer<int> GetConvergenceMask() const { return m_convergence_mask; }
+        CLWBuffer<int> GetTileDistributionBuffer() const { return m_tile_distribution_buffer; }
     protected:
+        // Samples are sorted by pixel first if output indices might contain duplicates
         void AccumulateSamples(
             CLWBuffer<float3> sample_buffer,
             CLWBuffer<float3> accumulation_buffer,
-            std::uint32_t num_elements
+            std::uint32_t num_elements,
+            bool duplicate_indices
         );
 
         void EstimateVariance(
@@ -77,16 +129,42 @@ namespace Baikal
         void GenerateTileDomain(
             int2 const& output_size,
             int2 const& tile_origin,
-            int2 const& tile_size
+            int2 const& tile_size,
+            std::uint32_t num_samples
         ) override;
 
-        void UpdateTileDistribution();
+        // Rebuild tile sampling distribution from variance estimates on the GPU
+        void UpdateTileDistribution(bool use_convergence_mask);
+
+        // Refresh convergence mask, returns number of unconverged pixels
+        std::uint32_t UpdateConvergenceMask(
+            CLWBuffer<float3> accumulation_buffer,
+            std::uint32_t width,
+            std::uint32_t height
+        );
 
     private:
         mutable CLWBuffer<float> m_variance_buffer;
         mutable CLWBuffer<float3> m_sample_buffer;
         CLWBuffer<int> m_tile_distribution_buffer;
-        Distribution1D m_tile_distribution;
+        // Per-pixel sum of squared luminance
+        mutable CLWBuffer<float> m_moments_buffer;
+        // Per-pixel convergence flags
+        mutable CLWBuffer<int> m_convergence_mask;
+        // Number of unconverged pixels per variance tile
+        CLWBuffer<int> m_tile_unconverged_buffer;
+        CLWBuffer<int> m_unconverged_count;
+        // Domain generation temporaries, compacted into output indices.
+        // Reused as unsorted keys and values by AccumulateSamples
+        CLWBuffer<int> m_domain_indices;
+        CLWBuffer<int> m_domain_predicate;
+        CLWBuffer<int> m_sorted_keys;
+        CLWBuffer<int> m_sorted_values;
+        CLWParallelPrimitives m_pp;
+        float m_convergence_threshold;
+        std::uint32_t m_min_samples_per_pixel;
+        mutable bool m_converged;
+        mutable float m_unconverged_fraction;
     };
     
 }
@@ -22,14 +22,20 @@
 #include "monte_carlo_renderer.h"
 #include "Output/clwoutput.h"
 #include "Estimators/estimator.h"
+#include "Renderers/render_checkpoint.h"
 
 #include <numeric>
 #include <chrono>
 #include <cstddef>
 #include <cstdlib>
 #include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <locale>
 #include <random>
+#include <sstream>
 #include <algorithm>
+#include <string>
 
 #include "math/int2.h"
 
@@ -37,7 +43,9 @@
 #include "embed_kernels.h"
 #endif
 
+#include "Utils/blue_noise.h"
 #include "Utils/cl_program_manager.h"
+#include "Utils/trace.h"
 
 namespace Baikal
 {
@@ -46,6 +54,26 @@ namespace Baikal
     int constexpr kTileSizeX = 1920;
     int constexpr kTileSizeY = 1080;
 
+    // Rough device memory footprint of a single work buffer entry (estimator and intersector buffers)
+    std::size_t constexpr kWorkBufferEntrySize = 448;
+    // Fraction of device memory auto-tuned work buffer is allowed to take
+    std::size_t constexpr kWorkBufferMemoryFraction = 4;
+    // Minimum number of entries per compute unit to keep the device busy
+    std::size_t constexpr kMinWorkBufferEntriesPerComputeUnit = 64 * 256;
+    // Upper bound for auto-tuned work buffer size
+    std::size_t constexpr kMaxWorkBufferSize = 4096 * 4096;
+    // Work buffer entries per core on CPU devices, larger buffers only thrash the caches
+    std::size_t constexpr kCpuWorkBufferEntriesPerComputeUnit = 16 * 1024;
+
+    // Float literal for build options, independent of the global locale
+    static std::string ToFloatLiteral(float value)
+    {
+        std::ostringstream stream;
+        stream.imbue(std::locale::classic());
+        stream << std::showpoint << std::setprecision(std::numeric_limits<float>::max_digits10) << value << 'f';
+        return stream.str();
+    }
+
     // Constructor
     MonteCarloRenderer::MonteCarloRenderer(
         CLWContext context,
@@ -64,8 +92,37 @@ namespace Baikal
 #else
         , m_uberv2_kernels(context, program_manager, "../Baikal/Kernels/CL/fill_aovs_uberv2.cl", "")
 #endif
+        , m_samples_per_dispatch(1u)
+        , m_regenerate_paths(false)
+        , m_tile_size(kTileSizeX, kTileSizeY)
+        , m_auto_tile_size(false)
+        , m_work_buffer_size(0u)
+        , m_region_origin(0, 0)
+        , m_region_size(0, 0)
+        , m_render_statistics()
+        , m_iteration_time_ms(0.f)
+        , m_quality(Estimator::QualityLevel::kStandard)
+        , m_pixel_filter(PixelFilter::kBox)
+        , m_pixel_filter_radius(1.5f)
+        , m_fused_aovs(false)
+        , m_sample_slots(false)
+        , m_disabled_aovs(0u)
+        , m_primary_hit_patterns(0u)
+        , m_random_seed(0u)
+        , m_profiler(context)
     {
-        m_estimator->SetWorkBufferSize(kTileSizeX * kTileSizeY);
+        m_estimator->SetProfiler(&m_profiler);
+
+        if (IsCpuDevice(context))
+        {
+            // Full HD tile is sized for GPUs, CPUs run it from system memory one core at a time
+            AutoTuneTileSize();
+        }
+        else
+        {
+            m_work_buffer_size = kTileSizeX * kTileSizeY;
+            m_estimator->SetWorkBufferSize(m_work_buffer_size);
+        }
     }
 
     void MonteCarloRenderer::Clear(RadeonRays::float3 const& val, Output& output) const
@@ -76,6 +133,8 @@ namespace Baikal
 
     void MonteCarloRenderer::Render(ClwScene const& scene)
     {
+        BAIKAL_TRACE_SCOPE("renderer", "Render");
+
         auto output = FindFirstNonZeroOutput(true, true);
         if (!output)
         {
@@ -84,63 +143,340 @@ namespace Baikal
 
         auto output_size = int2(output->width(), output->height());
 
-        if (output_size.x > kTileSizeX || output_size.y > kTileSizeY)
+        // Tiles cover the render region only
+        auto region_origin = int2();
+        auto region_size = output_size;
+
+        if (m_region_size.x > 0 && m_region_size.y > 0)
         {
-            auto num_tiles_x = (output_size.x + kTileSizeX - 1) / kTileSizeX;
-            auto num_tiles_y = (output_size.y + kTileSizeY - 1) / kTileSizeY;
+            if (m_region_origin.x + m_region_size.x > output_size.x || m_region_origin.y + m_region_size.y > output_size.y)
+            {
+                throw std::runtime_error("MonteCarloRenderer: render region is out of the output");
+            }
+
+            region_origin = m_region_origin;
+            region_size = m_region_size;
+        }
+
+        auto tile_size_x = m_tile_size.x;
+        auto tile_size_y = m_tile_size.y;
+
+        if (m_auto_tile_size)
+        {
+            // Auto-tuned work buffer is shaped after the region to cover as many rows as possible
+            auto work_buffer_size = (int)m_work_buffer_size;
+            tile_size_x = std::min(region_size.x, work_buffer_size);
+            tile_size_y = work_buffer_size / tile_size_x;
+        }
+
+        // All samples of a tile share the work buffer, so tiles get shorter
+        tile_size_y /= (int)m_samples_per_dispatch;
+
+        if (tile_size_y == 0)
+        {
+            throw std::runtime_error("MonteCarloRenderer: tile size is too small for the number of samples per dispatch");
+        }
+
+        auto num_tiles_x = (region_size.x + tile_size_x - 1) / tile_size_x;
+        auto num_tiles_y = (region_size.y + tile_size_y - 1) / tile_size_y;
+
+        m_render_statistics.tile_size = int2(std::min(tile_size_x, region_size.x), std::min(tile_size_y, region_size.y));
+        m_render_statistics.num_tiles = num_tiles_x * num_tiles_y;
+
+        // Resized work buffer gets new random numbers, so it has to be done before the frame setup
+        FitWorkBufferToRegion(m_render_statistics.tile_size);
+        m_render_statistics.work_buffer_size = m_estimator->GetWorkBufferSize();
 
+        PrepareFrame(output_size);
+
+        if (region_size.x > tile_size_x || region_size.y > tile_size_y)
+        {
             for (auto x = 0; x < num_tiles_x; ++x)
                 for (auto y = 0; y < num_tiles_y; ++y)
                 {
-                    auto tile_offset = int2(x * kTileSizeX, y * kTileSizeY);
-                    auto tile_size = int2(std::min(kTileSizeX, output_size.x - tile_offset.x),
-                        std::min(kTileSizeY, output_size.y - tile_offset.y));
+                    auto tile_offset = int2(x * tile_size_x, y * tile_size_y);
+                    auto tile_size = int2(std::min(tile_size_x, region_size.x - tile_offset.x),
+                        std::min(tile_size_y, region_size.y - tile_offset.y));
 
-                    RenderTile(scene, tile_offset, tile_size);
+                    RenderTile(scene, int2(region_origin.x + tile_offset.x, region_origin.y + tile_offset.y), tile_size);
                 }
         }
         else
         {
-            RenderTile(scene, int2(), output_size);
+            RenderTile(scene, region_origin, region_size);
+        }
+
+        FinishFrame();
+    }
+
+    void MonteCarloRenderer::RenderTiles(ClwScene const& scene, TileSource const& next_tile)
+    {
+        BAIKAL_TRACE_SCOPE("renderer", "RenderTiles");
+
+        auto output = FindFirstNonZeroOutput(true, true);
+        if (!output)
+        {
+            throw std::runtime_error("No outputs set");
+        }
+
+        auto output_size = int2(output->width(), output->height());
+
+        PrepareFrame(output_size);
+
+        int2 tile_origin;
+        int2 tile_size;
+        auto num_tiles = 0u;
+
+        while (next_tile(tile_origin, tile_size))
+        {
+            if (tile_origin.x < 0 || tile_origin.y < 0 ||
+                tile_origin.x + tile_size.x > output_size.x || tile_origin.y + tile_size.y > output_size.y ||
+                static_cast<std::size_t>(tile_size.x * tile_size.y) * m_samples_per_dispatch > m_estimator->GetWorkBufferSize())
+            {
+                throw std::runtime_error("MonteCarloRenderer: invalid tile");
+            }
+
+            RenderTile(scene, tile_origin, tile_size);
+            ++num_tiles;
+        }
+
+        m_render_statistics.tile_size = tile_size;
+        m_render_statistics.num_tiles = num_tiles;
+        m_render_statistics.work_buffer_size = m_estimator->GetWorkBufferSize();
+
+        FinishFrame();
+    }
+
+    void MonteCarloRenderer::SetRenderRegion(int2 const& origin, int2 const& size)
+    {
+        if (origin.x < 0 || origin.y < 0 || size.x < 0 || size.y < 0)
+        {
+            throw std::runtime_error("MonteCarloRenderer: invalid render region");
+        }
+
+        m_region_origin = origin;
+        m_region_size = size;
+    }
+
+    void MonteCarloRenderer::GetRenderRegion(int2& origin, int2& size) const
+    {
+        origin = m_region_origin;
+        size = m_region_size;
+    }
+
+    void MonteCarloRenderer::FitWorkBufferToRegion(int2 const& tile_size)
+    {
+        auto size = m_work_buffer_size;
+
+        if (m_region_size.x > 0 && m_region_size.y > 0)
+        {
+            size = std::min(size, static_cast<std::size_t>(tile_size.x * tile_size.y) * m_samples_per_dispatch);
+        }
+
+        if (size != m_estimator->GetWorkBufferSize())
+        {
+            m_estimator->SetWorkBufferSize(size);
+        }
+    }
+
+    void MonteCarloRenderer::PrepareFrame(int2 const& output_size)
+    {
+        m_profiler.Begin();
+        m_regenerate_paths = false;
+
+        // Camera and AOV kernels have to sample the same way the estimator does
+        auto sampler_opts = m_estimator->GetSamplerBuildOptions();
+        SetDefaultBuildOptions(sampler_opts);
+        m_uberv2_kernels.SetDefaultBuildOptions(sampler_opts);
+
+        if (m_estimator->GetSamplerType() == Estimator::SamplerType::kBlueNoiseSobol &&
+            m_estimator->HasRandomBuffer(Estimator::RandomBufferType::kBlueNoise))
+        {
+            FillBlueNoiseScrambles(output_size);
+            m_profiler.Mark("blue_noise");
+        }
+    }
+
+    void MonteCarloRenderer::FinishFrame()
+    {
+        // Let consumers such as post effect pipelines know the content has changed
+        for (auto i = 0; i < static_cast<int>(OutputType::kMax); ++i)
+        {
+            if (auto output = GetOutput(static_cast<OutputType>(i)))
+            {
+                output->Touch();
+            }
         }
 
-        ++m_sample_counter;
+        // Regenerated paths have taken the samples following the ones of the frame
+        m_sample_counter += m_samples_per_dispatch * (m_regenerate_paths ? 2u : 1u);
+
+        m_estimator->FinishFrame();
+
+        // Collect spans completed so far, the rest are resolved after later frames
+        m_profiler.Resolve();
+    }
+
+    std::uint32_t MonteCarloRenderer::RenderWithTimeBudget(ClwScene const& scene, float time_budget_ms)
+    {
+        using clock = std::chrono::high_resolution_clock;
+
+        auto start = clock::now();
+        auto elapsed_ms = [&start]()
+        {
+            return std::chrono::duration<float, std::milli>(clock::now() - start).count();
+        };
+
+        std::uint32_t num_samples = 0;
+
+        do
+        {
+            // Submit half of the iterations expected to fit into the remaining time
+            // and synchronize to correct the estimate, so we converge without overshooting
+            auto remaining_ms = time_budget_ms - elapsed_ms();
+            auto num_iterations = 1u;
+
+            if (m_iteration_time_ms > 0.f)
+            {
+                num_iterations = std::max(1u, (std::uint32_t)(remaining_ms / m_iteration_time_ms / 2.f));
+            }
+
+            auto batch_start = clock::now();
+
+            for (auto i = 0u; i < num_iterations; ++i)
+            {
+                Render(scene);
+            }
+
+            GetContext().Finish(0);
+
+            auto batch_ms = std::chrono::duration<float, std::milli>(clock::now() - batch_start).count();
+            m_iteration_time_ms = batch_ms / num_iterations;
+
+            num_samples += num_iterations * m_samples_per_dispatch;
+        }
+        while (elapsed_ms() + m_iteration_time_ms <= time_budget_ms);
+
+        return num_samples;
     }
 
     // Render the scene into the output
     void MonteCarloRenderer::RenderTile(ClwScene const& scene, int2 const& tile_origin, int2 const& tile_size)
     {
+        BAIKAL_TRACE_SCOPE("renderer", "RenderTile");
+
         // Number of rays to generate
         auto color_output = static_cast<ClwOutput*>(GetOutput(OutputType::kColor));
 
+        // Check if we have outputs that we can render in single pass
+        bool aov_pass_needed = HasEnabledAOVs();
+
         if (color_output)
         {
-            auto num_rays = tile_size.x * tile_size.y;
+            auto num_rays = tile_size.x * tile_size.y * m_samples_per_dispatch;
             auto output_size = int2(color_output->width(), color_output->height());
 
-            GenerateTileDomain(output_size, tile_origin, tile_size);
-            GeneratePrimaryRays(scene, *color_output, tile_size);
+            // Several rays write into the same pixel if we take more than one sample,
+            // unless each of them is estimated into a slot of its own
+            bool multiple_samples = m_samples_per_dispatch > 1;
+            bool sample_slots = UseSampleSlots();
 
-            if (scene.background_idx > -1)
+            GenerateTileDomain(output_size, tile_origin, tile_size, m_samples_per_dispatch);
+
+            // Cached pattern replaces ray generation, the estimator takes its hits instead of intersecting the rays
+            auto pattern = GetPrimaryHitPattern(scene, tile_origin, tile_size, output_size, num_rays);
+            bool cached_hits = pattern >= 0 && m_primary_hit_cache.valid[pattern];
+
+            if (cached_hits)
             {
-                m_estimator->Estimate(
-                    scene,
-                    num_rays,
-                    Estimator::QualityLevel::kStandard,
-                    color_output->data(),
-                    true,
-                    false,
-                    std::bind(&MonteCarloRenderer::HandleMissedRays, this, std::ref(scene), output_size.x, output_size.y,
-                        std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4,
-                        std::placeholders::_5, std::placeholders::_6));
+                GetContext().CopyBuffer(0u, m_primary_hit_cache.rays[pattern], m_estimator->GetRayBuffer(), 0, 0, num_rays);
             }
             else
-                m_estimator->Estimate(
-                    scene,
-                    num_rays,
-                    Estimator::QualityLevel::kStandard,
-                    color_output->data());
+            {
+                GeneratePrimaryRays(scene, *color_output, tile_size, false, m_samples_per_dispatch);
+            }
+
+            if (pattern >= 0)
+            {
+                if (!cached_hits)
+                {
+                    // Estimator reuses its ray buffer for later bounces
+                    GetContext().CopyBuffer(0u, m_estimator->GetRayBuffer(), m_primary_hit_cache.rays[pattern], 0, 0, num_rays);
+                }
+
+                if (!m_estimator->SetPrimaryHitBuffer(m_primary_hit_cache.hits[pattern], cached_hits))
+                {
+                    pattern = -1;
+                }
+            }
+
+            // Slots of terminated paths are refilled with the next samples of the same pixels
+            auto regeneration_rays = m_estimator->GetRegenerationRayBuffer();
+            if (regeneration_rays.GetElementCount() > 0)
+            {
+                GeneratePrimaryRays(scene, *color_output, tile_size, false, m_samples_per_dispatch,
+                    m_sample_counter + m_samples_per_dispatch, regeneration_rays);
+                m_regenerate_paths = true;
+            }
+            m_profiler.Mark("primary_rays");
+            m_estimator->SetOutputSize(color_output->width(), color_output->height());
+
+            Estimator::MissedPrimaryRaysHandler missed_rays_handler = nullptr;
+            if (scene.background_idx > -1)
+            {
+                missed_rays_handler = std::bind(&MonteCarloRenderer::HandleMissedRays, this, std::ref(scene),
+                    output_size.x, output_size.y,
+                    std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4,
+                    std::placeholders::_5, std::placeholders::_6);
+            }
+
+            // AOV kernel accumulates without atomics, so only a single sample per pixel can be fused
+            Estimator::PrimaryHitsHandler primary_hits_handler = nullptr;
+            if (aov_pass_needed && m_fused_aovs && !multiple_samples)
+            {
+                primary_hits_handler = std::bind(&MonteCarloRenderer::FillAOVsFromHits, this, std::ref(scene),
+                    std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4);
+                aov_pass_needed = false;
+            }
+
+            // Estimator follows the dispatch index, so all tiles of a sample use the same random numbers
+            m_estimator->SetSampleIndex(m_sample_counter / m_samples_per_dispatch);
+
+            auto estimate_output = color_output->data();
+
+            if (sample_slots)
+            {
+                auto work_buffer_size = m_estimator->GetWorkBufferSize();
+                if (m_sample_slot_buffer.GetElementCount() < work_buffer_size)
+                {
+                    m_sample_slot_buffer = GetContext().CreateBuffer<RadeonRays::float3>(work_buffer_size, CL_MEM_READ_WRITE);
+                }
+
+                GetContext().FillBuffer(0u, m_sample_slot_buffer, RadeonRays::float3(), num_rays);
+                estimate_output = m_sample_slot_buffer;
+            }
+
+            // Rays are estimated into the slot with their index if sample slots are used
+            m_estimator->Estimate(
+                scene,
+                num_rays,
+                m_quality,
+                estimate_output,
+                !sample_slots,
+                multiple_samples && !sample_slots,
+                missed_rays_handler,
+                primary_hits_handler);
+
+            if (pattern >= 0)
+            {
+                m_primary_hit_cache.valid[pattern] = true;
+            }
 
+            if (sample_slots)
+            {
+                ResolveSampleSlots(tile_size, color_output->data());
+                m_profiler.Mark("resolve_sample_slots");
+            }
         }
         else
         {
@@ -154,11 +490,10 @@ namespace Baikal
             }
         }
 
-        // Check if we have outputs that we can render in single pass
-        bool aov_pass_needed = (FindFirstNonZeroOutput(false) != nullptr);
         if (aov_pass_needed)
         {
             FillAOVs(scene, tile_origin, tile_size);
+            m_profiler.Mark("fill_aovs");
             GetContext().Flush(0);
         }
     }
@@ -166,7 +501,8 @@ namespace Baikal
     void MonteCarloRenderer::GenerateTileDomain(
         int2 const& output_size, 
         int2 const& tile_origin,
-        int2 const& tile_size
+        int2 const& tile_size,
+        std::uint32_t num_samples
     )
     {
         // Fetch kernel
@@ -180,7 +516,8 @@ namespace Baikal
         generate_kernel.SetArg(argc++, tile_origin.y);
         generate_kernel.SetArg(argc++, tile_size.x);
         generate_kernel.SetArg(argc++, tile_size.y);
-        generate_kernel.SetArg(argc++, rand_uint());
+        generate_kernel.SetArg(argc++, (cl_int)num_samples);
+        generate_kernel.SetArg(argc++, GetLaunchSeed(LaunchSeed::kGenerateTileDomain));
         generate_kernel.SetArg(argc++, m_sample_counter);
         generate_kernel.SetArg(argc++, m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kRandomSeed));
         generate_kernel.SetArg(argc++, m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kSobolLUT));
@@ -196,6 +533,30 @@ namespace Baikal
         }
     }
 
+    void MonteCarloRenderer::FillBlueNoiseScrambles(int2 const& output_size)
+    {
+        auto random = m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kRandomSeed);
+
+        // Fetch kernel
+        CLWKernel fill_kernel = GetKernel("FillBlueNoiseScrambles");
+
+        // Set kernel parameters
+        int argc = 0;
+        fill_kernel.SetArg(argc++, m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kBlueNoise));
+        fill_kernel.SetArg(argc++, (cl_int)kBlueNoiseTileSize);
+        fill_kernel.SetArg(argc++, output_size.x);
+        fill_kernel.SetArg(argc++, output_size.y);
+        fill_kernel.SetArg(argc++, (cl_int)random.GetElementCount());
+        fill_kernel.SetArg(argc++, random);
+
+        {
+            size_t gs[] = { static_cast<size_t>((output_size.x + 15) / 16 * 16), static_cast<size_t>((output_size.y + 15) / 16 * 16) };
+            size_t ls[] = { 16, 16 };
+
+            GetContext().Launch2D(0, gs, ls, fill_kernel);
+        }
+    }
+
     Output* MonteCarloRenderer::FindFirstNonZeroOutput(bool include_multipass, bool include_singlepass) const
     {
         // If we don't use anything, why are we calling this function?
@@ -219,13 +580,39 @@ namespace Baikal
         return current_output;
     }
 
+    bool MonteCarloRenderer::HasEnabledAOVs() const
+    {
+        for (auto i = static_cast<std::uint32_t>(Renderer::OutputType::kMaxMultiPassOutput) + 1;
+            i < static_cast<std::uint32_t>(Renderer::OutputType::kMax); ++i)
+        {
+            auto type = static_cast<Renderer::OutputType>(i);
+            if (GetOutput(type) && IsAOVEnabled(type))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
     void MonteCarloRenderer::SetOutput(OutputType type, Output* output)
     {
         static const std::map<OutputType, Estimator::IntermediateValue> kOutputTypeToIntermediateValue = 
         {
             { OutputType::kOpacity, Estimator::IntermediateValue::kOpacity },
             { OutputType::kVisibility, Estimator::IntermediateValue::kVisibility },
+            { OutputType::kCost, Estimator::IntermediateValue::kCost },
         };
+
+        // Estimator kernels accumulate samples atomically and need full precision
+        if (output && type < OutputType::kMaxMultiPassOutput && output->format() != Output::Format::kRGBA32F)
+        {
+            throw std::runtime_error("MonteCarloRenderer: multi-pass outputs require RGBA32F format");
+        }
+
+        if (output && output->format() == Output::Format::kRGBA8)
+        {
+            throw std::runtime_error("MonteCarloRenderer: RGBA8 outputs are written by post effects only");
+        }
         
         auto it = kOutputTypeToIntermediateValue.find(type);
         if (it != kOutputTypeToIntermediateValue.end())
@@ -253,12 +640,14 @@ namespace Baikal
 
     void MonteCarloRenderer::FillAOVs(ClwScene const& scene, int2 const& tile_origin, int2 const& tile_size)
     {
+        BAIKAL_TRACE_SCOPE("renderer", "FillAOVs");
+
         // Find first non-zero AOV to get buffer dimensions
         auto output = FindFirstNonZeroOutput(false);
         auto output_size = int2(output->width(), output->height());
 
         // Generate tile domain
-        GenerateTileDomain(output_size, tile_origin, tile_size);
+        GenerateTileDomain(output_size, tile_origin, tile_size, 1);
 
         // Generate primary
         GeneratePrimaryRays(scene, *output, tile_size, true);
@@ -268,38 +657,70 @@ namespace Baikal
         // Intersect ray batch
         m_estimator->TraceFirstHit(scene, num_rays);
 
+        FillAOVsFromHits(
+            scene,
+            m_estimator->GetRayBuffer(),
+            m_estimator->GetFirstHitBuffer(),
+            m_estimator->GetOutputIndexBuffer(),
+            num_rays);
+    }
+
+    void MonteCarloRenderer::FillAOVsFromHits(
+        ClwScene const& scene,
+        CLWBuffer<ray> rays,
+        CLWBuffer<Intersection> intersections,
+        CLWBuffer<int> output_indices,
+        std::size_t size)
+    {
+        auto output = FindFirstNonZeroOutput(false);
+        auto output_size = int2(output->width(), output->height());
+
         CLWKernel fill_kernel = m_uberv2_kernels.GetKernel("FillAOVsUberV2");
 
+        // Ray count buffer holds the number of rays generated for the tile
         auto argc = 0U;
-        fill_kernel.SetArg(argc++, m_estimator->GetRayBuffer());
-        fill_kernel.SetArg(argc++, m_estimator->GetFirstHitBuffer());
-        fill_kernel.SetArg(argc++, m_estimator->GetOutputIndexBuffer());
+        fill_kernel.SetArg(argc++, rays);
+        fill_kernel.SetArg(argc++, intersections);
+        fill_kernel.SetArg(argc++, output_indices);
         fill_kernel.SetArg(argc++, m_estimator->GetRayCountBuffer());
         fill_kernel.SetArg(argc++, scene.vertices);
         fill_kernel.SetArg(argc++, scene.normals);
         fill_kernel.SetArg(argc++, scene.uvs);
+        fill_kernel.SetArg(argc++, scene.tangents);
         fill_kernel.SetArg(argc++, scene.indices);
         fill_kernel.SetArg(argc++, scene.shapes);
+        fill_kernel.SetArg(argc++, scene.instances);
+        fill_kernel.SetArg(argc++, scene.instance_transforms);
+        fill_kernel.SetArg(argc++, scene.num_base_shapes);
         fill_kernel.SetArg(argc++, scene.shapes_additional);
         fill_kernel.SetArg(argc++, scene.material_attributes);
         fill_kernel.SetArg(argc++, scene.textures);
         fill_kernel.SetArg(argc++, scene.texturedata);
+        fill_kernel.SetArg(argc++, scene.texture_requests);
+        if (scene.texture_images)
+        {
+            fill_kernel.SetArg(argc++, scene.texture_images.get());
+        }
         fill_kernel.SetArg(argc++, scene.envmapidx);
         fill_kernel.SetArg(argc++, scene.background_idx);
         fill_kernel.SetArg(argc++, output_size.x);
         fill_kernel.SetArg(argc++, output_size.y);
         fill_kernel.SetArg(argc++, scene.lights);
         fill_kernel.SetArg(argc++, scene.num_lights);
-        fill_kernel.SetArg(argc++, rand_uint());
+        fill_kernel.SetArg(argc++, GetLaunchSeed(LaunchSeed::kFillAovs));
         fill_kernel.SetArg(argc++, m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kRandomSeed));
         fill_kernel.SetArg(argc++, m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kSobolLUT));
         fill_kernel.SetArg(argc++, m_sample_counter);
+        // A single AOV sample is taken per dispatch, packed outputs keep running mean over them
+        fill_kernel.SetArg(argc++, static_cast<int>(m_sample_counter / m_samples_per_dispatch));
         for (auto i = static_cast<std::uint32_t>(Renderer::OutputType::kMaxMultiPassOutput) + 1;
             i < static_cast<std::uint32_t>(Renderer::OutputType::kMax); ++i)
         {
-            if (auto aov = static_cast<ClwOutput*>(GetOutput(static_cast<Renderer::OutputType>(i))))
+            auto aov = static_cast<ClwOutput*>(GetOutput(static_cast<Renderer::OutputType>(i)));
+            if (aov && IsAOVEnabled(static_cast<Renderer::OutputType>(i)))
             {
-                fill_kernel.SetArg(argc++, 1);
+                // Flag carries the storage format, see AOV_FORMAT_* in the kernel
+                fill_kernel.SetArg(argc++, static_cast<int>(aov->format()) + 1);
                 fill_kernel.SetArg(argc++, aov->data());
             }
             else
@@ -313,7 +734,7 @@ namespace Baikal
 
         // Run AOV kernel
         {
-            int globalsize = tile_size.x * tile_size.y;
+            int globalsize = static_cast<int>(size);
             GetContext().Launch1D(0, ((globalsize + 63) / 64) * 64, 64, fill_kernel);
         }
     }
@@ -333,16 +754,61 @@ namespace Baikal
         }
     }
 
+    std::string MonteCarloRenderer::GetPixelFilterBuildOptions() const
+    {
+        if (m_pixel_filter == PixelFilter::kBox)
+        {
+            return "";
+        }
+
+        return "-D BAIKAL_PIXEL_FILTER=" + std::to_string(static_cast<int>(m_pixel_filter)) +
+            " -D BAIKAL_PIXEL_FILTER_RADIUS=" + ToFloatLiteral(m_pixel_filter_radius) + " ";
+    }
+
+    void MonteCarloRenderer::CompileProgramsAsync(ClwScene const& scene)
+    {
+        auto sampler_opts = m_estimator->GetSamplerBuildOptions();
+        SetDefaultBuildOptions(sampler_opts);
+        m_uberv2_kernels.SetDefaultBuildOptions(sampler_opts);
+
+        // Color pass generates rays with the pixel filter, AOV pass at pixel centers
+        CompileProgramAsync(sampler_opts + GetPixelFilterBuildOptions());
+        CompileProgramAsync(sampler_opts + GetPixelFilterBuildOptions() + "-D BAIKAL_GENERATE_SAMPLE_AT_PIXEL_CENTER ");
+        m_uberv2_kernels.CompileProgramAsync(sampler_opts);
+
+        m_estimator->CompileProgramsAsync(scene, m_quality, m_samples_per_dispatch > 1 && !UseSampleSlots());
+    }
+
     void MonteCarloRenderer::GeneratePrimaryRays(
         ClwScene const& scene, 
         Output const& output, 
         int2 const& tile_size,
-        bool generate_at_pixel_center
+        bool generate_at_pixel_center,
+        std::uint32_t num_samples
+    )
+    {
+        GeneratePrimaryRays(scene, output, tile_size, generate_at_pixel_center, num_samples, m_sample_counter, m_estimator->GetRayBuffer());
+    }
+
+    void MonteCarloRenderer::GeneratePrimaryRays(
+        ClwScene const& scene,
+        Output const& output,
+        int2 const& tile_size,
+        bool generate_at_pixel_center,
+        std::uint32_t num_samples,
+        std::uint32_t frame,
+        CLWBuffer<ray> rays
     )
     {
+        if (output.width() % scene.camera_num_views != 0)
+        {
+            throw std::runtime_error("MonteCarloRenderer: output width is not a multiple of the number of camera views");
+        }
+
         // Fetch kernel
         auto kernel_name = GetCameraKernelName(scene.camera_type);
-        auto genkernel = GetKernel(kernel_name, generate_at_pixel_center ? "-D BAIKAL_GENERATE_SAMPLE_AT_PIXEL_CENTER " : "");
+        auto genkernel = GetKernel(kernel_name, m_estimator->GetSamplerBuildOptions() + GetPixelFilterBuildOptions() +
+            (generate_at_pixel_center ? "-D BAIKAL_GENERATE_SAMPLE_AT_PIXEL_CENTER " : ""));
 
         // Set kernel parameters
         int argc = 0;
@@ -351,14 +817,16 @@ namespace Baikal
         genkernel.SetArg(argc++, output.height());
         genkernel.SetArg(argc++, m_estimator->GetOutputIndexBuffer());
         genkernel.SetArg(argc++, m_estimator->GetRayCountBuffer());
-        genkernel.SetArg(argc++, (int)rand_uint());
-        genkernel.SetArg(argc++, m_sample_counter);
-        genkernel.SetArg(argc++, m_estimator->GetRayBuffer());
+        // Seed follows the frame, so rays generated ahead for the next samples differ
+        genkernel.SetArg(argc++, (int)Baikal::GetLaunchSeed(m_random_seed, frame, LaunchSeed::kGeneratePrimaryRays));
+        genkernel.SetArg(argc++, frame);
+        genkernel.SetArg(argc++, (cl_int)num_samples);
+        genkernel.SetArg(argc++, rays);
         genkernel.SetArg(argc++, m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kRandomSeed));
         genkernel.SetArg(argc++, m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kSobolLUT));
 
         {
-            int globalsize = tile_size.x * tile_size.y;
+            int globalsize = tile_size.x * tile_size.y * num_samples;
             GetContext().Launch1D(0, ((globalsize + 63) / 64) * 64, 64, genkernel);
         }
     }
@@ -373,11 +841,124 @@ namespace Baikal
         return GetKernel("AccumulateData");
     }
 
+    void MonteCarloRenderer::ReadOutputAsync(
+        Output const& output,
+        int2 const& region_origin,
+        int2 const& region_size,
+        ReadbackFormat format,
+        ClwReadback& readback,
+        float gamma)
+    {
+        BAIKAL_TRACE_SCOPE("renderer", "ReadOutputAsync");
+
+        if (output.format() != Output::Format::kRGBA32F)
+        {
+            throw std::runtime_error("MonteCarloRenderer: readback requires RGBA32F output");
+        }
+
+        if (region_origin.x < 0 || region_origin.y < 0 || region_size.x <= 0 || region_size.y <= 0 ||
+            region_origin.x + region_size.x > static_cast<int>(output.width()) ||
+            region_origin.y + region_size.y > static_cast<int>(output.height()))
+        {
+            throw std::runtime_error("MonteCarloRenderer: invalid readback region");
+        }
+
+        auto num_pixels = region_size.x * region_size.y;
+        auto pixel_size = format == ReadbackFormat::kRGBA8 ? 4u : 4u * sizeof(float);
+        auto size = num_pixels * pixel_size;
+
+        auto resolve_kernel = GetKernel("ResolveOutputRegion");
+
+        int argc = 0;
+        resolve_kernel.SetArg(argc++, static_cast<ClwOutput const&>(output).data());
+        resolve_kernel.SetArg(argc++, static_cast<int>(output.width()));
+        resolve_kernel.SetArg(argc++, region_origin.x);
+        resolve_kernel.SetArg(argc++, region_origin.y);
+        resolve_kernel.SetArg(argc++, region_size.x);
+        resolve_kernel.SetArg(argc++, region_size.y);
+        resolve_kernel.SetArg(argc++, gamma);
+        resolve_kernel.SetArg(argc++, format == ReadbackFormat::kRGBA8 ? 1 : 0);
+        resolve_kernel.SetArg(argc++, readback.GetStagingBuffer(size));
+
+        auto event = GetContext().Launch1D(0, ((num_pixels + 63) / 64) * 64, 64, resolve_kernel);
+        readback.Enqueue(size, event);
+    }
+
     void MonteCarloRenderer::SetRandomSeed(std::uint32_t seed)
     {
+        m_random_seed = seed;
         m_estimator->SetRandomSeed(seed);
     }
 
+    void MonteCarloRenderer::SetSampleIndex(std::uint32_t index)
+    {
+        m_sample_counter = index;
+    }
+
+    void MonteCarloRenderer::SaveCheckpoint(RenderCheckpoint& checkpoint) const
+    {
+        checkpoint.SetValue("sample_index", m_sample_counter);
+        checkpoint.SetValue("random_seed", m_random_seed);
+        checkpoint.SetValue("samples_per_dispatch", m_samples_per_dispatch);
+
+        for (auto i = 0; i < static_cast<int>(OutputType::kMax); ++i)
+        {
+            auto output = static_cast<ClwOutput*>(GetOutput(static_cast<OutputType>(i)));
+
+            if (output)
+            {
+                checkpoint.SaveBuffer(GetContext(), "output." + std::to_string(i), output->data());
+            }
+        }
+
+        // Sobol scrambles are rehashed as samples go
+        if (m_estimator->HasRandomBuffer(Estimator::RandomBufferType::kRandomSeed))
+        {
+            checkpoint.SaveBuffer(GetContext(), "estimator.random",
+                m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kRandomSeed));
+        }
+    }
+
+    void MonteCarloRenderer::LoadCheckpoint(RenderCheckpoint const& checkpoint)
+    {
+        // Samples of a dispatch share their frame, other batching would render different samples
+        if (checkpoint.GetValue<std::uint32_t>("samples_per_dispatch") != m_samples_per_dispatch)
+        {
+            throw std::runtime_error("MonteCarloRenderer: checkpoint has a different number of samples per dispatch");
+        }
+
+        auto random_seed = checkpoint.GetValue<std::uint32_t>("random_seed");
+        if (random_seed != m_random_seed)
+        {
+            SetRandomSeed(random_seed);
+        }
+
+        // Outputs stored in the checkpoint but not set are skipped
+        for (auto i = 0; i < static_cast<int>(OutputType::kMax); ++i)
+        {
+            auto output = static_cast<ClwOutput*>(GetOutput(static_cast<OutputType>(i)));
+
+            if (output)
+            {
+                checkpoint.LoadBuffer(GetContext(), "output." + std::to_string(i), output->data());
+                output->Touch();
+            }
+        }
+
+        if (m_estimator->HasRandomBuffer(Estimator::RandomBufferType::kRandomSeed) && checkpoint.HasEntry("estimator.random"))
+        {
+            checkpoint.LoadBuffer(GetContext(), "estimator.random",
+                m_estimator->GetRandomBuffer(Estimator::RandomBufferType::kRandomSeed));
+        }
+
+        m_sample_counter = checkpoint.GetValue<std::uint32_t>("sample_index");
+    }
+
+    std::uint32_t MonteCarloRenderer::GetLaunchSeed(LaunchSeed launch) const
+    {
+        return Baikal::GetLaunchSeed(m_random_seed, m_sample_counter, launch);
+    }
+
     void MonteCarloRenderer::Benchmark(ClwScene const& scene, Estimator::RayTracingStats& stats)
     {
         auto output = static_cast<ClwOutput*>(GetOutput(OutputType::kColor));
@@ -385,23 +966,364 @@ namespace Baikal
         int num_rays = output->width() * output->height();
         int2 tile_size = int2(output->width(), output->height());
 
-        GenerateTileDomain(tile_size, int2(), tile_size);
+        GenerateTileDomain(tile_size, int2(), tile_size, 1);
         GeneratePrimaryRays(scene, *output, tile_size);
 
         m_estimator->Benchmark(scene, num_rays, stats);
     }
 
+    MonteCarloRenderer::PickResult MonteCarloRenderer::Pick(ClwScene const& scene, int2 const& pixel)
+    {
+        auto output = FindFirstNonZeroOutput(true, true);
+        if (!output)
+        {
+            throw std::runtime_error("No outputs set");
+        }
+
+        auto output_size = int2(output->width(), output->height());
+
+        if (pixel.x < 0 || pixel.y < 0 || pixel.x >= output_size.x || pixel.y >= output_size.y)
+        {
+            throw std::runtime_error("MonteCarloRenderer: pick pixel is outside of the output");
+        }
+
+        // Single pass AOV ray of the pixel, frame zero leaves the per pixel sampler state unchanged
+        GenerateTileDomain(output_size, pixel, int2(1, 1), 1);
+        GeneratePrimaryRays(scene, *output, int2(1, 1), true, 1, 0, m_estimator->GetRayBuffer());
+        m_estimator->TraceFirstHit(scene, 1);
+
+        ray pick_ray;
+        Intersection hit;
+        GetContext().ReadBuffer(0, m_estimator->GetRayBuffer(), &pick_ray, 1);
+        GetContext().ReadBuffer(0, m_estimator->GetFirstHitBuffer(), &hit, 1).Wait();
+
+        PickResult result = {};
+        result.shape_id = -1;
+        result.prim_id = -1;
+
+        if (hit.shapeid > -1)
+        {
+            // Same mapping as Scene_GetShapeId
+            auto shape_idx = hit.shapeid - 1;
+            if (shape_idx < scene.num_base_shapes)
+            {
+                ClwScene::Shape shape;
+                GetContext().ReadBuffer(0, scene.shapes, &shape, shape_idx, 1).Wait();
+                result.shape_id = shape.id;
+            }
+            else
+            {
+                ClwScene::ShapeInstance instance;
+                GetContext().ReadBuffer(0, scene.instances, &instance, shape_idx - scene.num_base_shapes, 1).Wait();
+                result.shape_id = instance.id;
+            }
+
+            auto t = hit.uvwt.w;
+            result.prim_id = hit.primid;
+            result.uv = RadeonRays::float2(hit.uvwt.x, hit.uvwt.y);
+            result.distance = t;
+            result.position = RadeonRays::float3(
+                pick_ray.o.x + pick_ray.d.x * t,
+                pick_ray.o.y + pick_ray.d.y * t,
+                pick_ray.o.z + pick_ray.d.z * t);
+        }
+
+        return result;
+    }
+
     void MonteCarloRenderer::SetMaxBounces(std::uint32_t max_bounces)
     {
         m_estimator->SetMaxBounces(max_bounces);
     }
 
+    void MonteCarloRenderer::SetSamplesPerDispatch(std::uint32_t num_samples)
+    {
+        if (num_samples == 0)
+        {
+            throw std::runtime_error("MonteCarloRenderer: invalid number of samples per dispatch");
+        }
+
+        m_samples_per_dispatch = num_samples;
+    }
+
+    std::uint32_t MonteCarloRenderer::GetSamplesPerDispatch() const
+    {
+        return m_samples_per_dispatch;
+    }
+
+    void MonteCarloRenderer::SetSampleSlots(bool enable)
+    {
+        m_sample_slots = enable;
+
+        if (!enable)
+        {
+            m_sample_slot_buffer = CLWBuffer<RadeonRays::float3>();
+        }
+    }
+
+    bool MonteCarloRenderer::GetSampleSlots() const
+    {
+        return m_sample_slots;
+    }
+
+    bool MonteCarloRenderer::UseSampleSlots() const
+    {
+        if (!m_sample_slots || m_samples_per_dispatch == 1)
+        {
+            return false;
+        }
+
+        // Intermediate values are written at output indices
+        for (std::size_t i = 0; i < static_cast<std::size_t>(Estimator::IntermediateValue::kMax); ++i)
+        {
+            if (m_estimator->HasIntermediateValueBuffer(static_cast<Estimator::IntermediateValue>(i)))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void MonteCarloRenderer::ResolveSampleSlots(int2 const& tile_size, CLWBuffer<RadeonRays::float3> output)
+    {
+        auto resolve_kernel = GetKernel("ResolveSampleSlots");
+
+        int num_pixels = tile_size.x * tile_size.y;
+
+        int argc = 0;
+        resolve_kernel.SetArg(argc++, m_sample_slot_buffer);
+        resolve_kernel.SetArg(argc++, num_pixels);
+        resolve_kernel.SetArg(argc++, (cl_int)m_samples_per_dispatch);
+        resolve_kernel.SetArg(argc++, m_estimator->GetOutputIndexBuffer());
+        resolve_kernel.SetArg(argc++, output);
+
+        {
+            GetContext().Launch1D(0, ((num_pixels + 63) / 64) * 64, 64, resolve_kernel);
+        }
+    }
+
+    void MonteCarloRenderer::SetPixelFilter(PixelFilter filter, float radius)
+    {
+        if (radius <= 0.f)
+        {
+            throw std::runtime_error("MonteCarloRenderer: invalid pixel filter radius");
+        }
+
+        m_pixel_filter = filter;
+        m_pixel_filter_radius = radius;
+    }
+
+    MonteCarloRenderer::PixelFilter MonteCarloRenderer::GetPixelFilter() const
+    {
+        return m_pixel_filter;
+    }
+
+    float MonteCarloRenderer::GetPixelFilterRadius() const
+    {
+        return m_pixel_filter_radius;
+    }
+
+    void MonteCarloRenderer::SetFusedAOVs(bool enable)
+    {
+        m_fused_aovs = enable;
+    }
+
+    bool MonteCarloRenderer::GetFusedAOVs() const
+    {
+        return m_fused_aovs;
+    }
+
+    void MonteCarloRenderer::SetPrimaryHitCache(std::uint32_t num_patterns)
+    {
+        m_primary_hit_patterns = num_patterns;
+        m_primary_hit_cache = PrimaryHitCache();
+    }
+
+    std::uint32_t MonteCarloRenderer::GetPrimaryHitCache() const
+    {
+        return m_primary_hit_patterns;
+    }
+
+    int MonteCarloRenderer::GetPrimaryHitPattern(ClwScene const& scene, int2 const& tile_origin, int2 const& tile_size,
+                                                 int2 const& output_size, std::size_t num_rays)
+    {
+        // Tiles of a frame would need patterns of their own
+        if (m_primary_hit_patterns == 0 || tile_origin.x != 0 || tile_origin.y != 0 ||
+            tile_size.x != output_size.x || tile_size.y != output_size.y)
+        {
+            return -1;
+        }
+
+        auto& cache = m_primary_hit_cache;
+
+        if (cache.scene != &scene || cache.revision != scene.revision ||
+            cache.camera_revision != scene.camera_revision || cache.num_rays != num_rays)
+        {
+            // Buffers are kept if only their content is stale
+            if (cache.num_rays != num_rays)
+            {
+                cache.rays.clear();
+                cache.hits.clear();
+            }
+
+            cache.rays.resize(m_primary_hit_patterns);
+            cache.hits.resize(m_primary_hit_patterns);
+            cache.valid.assign(m_primary_hit_patterns, false);
+            cache.scene = &scene;
+            cache.revision = scene.revision;
+            cache.camera_revision = scene.camera_revision;
+            cache.num_rays = num_rays;
+        }
+
+        // Sample counter skips the samples of regenerated paths, so patterns take turns by frame
+        auto pattern = static_cast<int>(cache.next_pattern++ % m_primary_hit_patterns);
+
+        if (cache.rays[pattern].GetElementCount() == 0)
+        {
+            cache.rays[pattern] = GetContext().CreateBuffer<ray>(num_rays, CL_MEM_READ_WRITE);
+            cache.hits[pattern] = GetContext().CreateBuffer<Intersection>(num_rays, CL_MEM_READ_WRITE);
+        }
+
+        return pattern;
+    }
+
+    void MonteCarloRenderer::SetAOVEnabled(OutputType type, bool enabled)
+    {
+        if (type <= OutputType::kMaxMultiPassOutput || type >= OutputType::kMax)
+        {
+            throw std::runtime_error("MonteCarloRenderer: only single pass outputs can be disabled");
+        }
+
+        auto bit = 1u << static_cast<std::uint32_t>(type);
+        m_disabled_aovs = enabled ? (m_disabled_aovs & ~bit) : (m_disabled_aovs | bit);
+    }
+
+    bool MonteCarloRenderer::IsAOVEnabled(OutputType type) const
+    {
+        return (m_disabled_aovs & (1u << static_cast<std::uint32_t>(type))) == 0;
+    }
+
+    void MonteCarloRenderer::SetQualityLevel(Estimator::QualityLevel quality)
+    {
+        m_quality = quality;
+    }
+
+    Estimator::QualityLevel MonteCarloRenderer::GetQualityLevel() const
+    {
+        return m_quality;
+    }
+
+    void MonteCarloRenderer::SetTileSize(int2 const& tile_size)
+    {
+        if (tile_size.x <= 0 || tile_size.y <= 0)
+        {
+            throw std::runtime_error("MonteCarloRenderer: invalid tile size");
+        }
+
+        m_tile_size = tile_size;
+        m_auto_tile_size = false;
+
+        m_work_buffer_size = tile_size.x * tile_size.y;
+        m_estimator->SetWorkBufferSize(m_work_buffer_size);
+    }
+
+    void MonteCarloRenderer::AutoTuneTileSize()
+    {
+        auto device = GetContext().GetDevice(0).GetID();
+
+        cl_ulong global_mem_size = 0;
+        cl_ulong max_alloc_size = 0;
+        cl_uint num_compute_units = 0;
+        clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem_size), &global_mem_size, nullptr);
+        clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc_size), &max_alloc_size, nullptr);
+        clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(num_compute_units), &num_compute_units, nullptr);
+
+        // Leave most of the memory to the scene, ray buffer is the largest single allocation
+        auto memory_limit = (std::size_t)(global_mem_size / kWorkBufferMemoryFraction / kWorkBufferEntrySize);
+        auto allocation_limit = (std::size_t)(max_alloc_size / sizeof(ray));
+        auto occupancy_limit = std::max<std::size_t>(num_compute_units, 1u) * kMinWorkBufferEntriesPerComputeUnit;
+
+        auto size = std::min(std::min(memory_limit, allocation_limit), kMaxWorkBufferSize);
+        size = std::max(size, std::min(occupancy_limit, allocation_limit));
+
+        if (IsCpuDevice(GetContext()))
+        {
+            // Memory limits are far away on CPUs, keep a few tiles worth of work per core instead
+            size = std::min(size, std::max<std::size_t>(num_compute_units, 1u) * kCpuWorkBufferEntriesPerComputeUnit);
+        }
+
+        m_auto_tile_size = true;
+
+        m_work_buffer_size = size;
+        m_estimator->SetWorkBufferSize(size);
+    }
+
+    int2 MonteCarloRenderer::GetTileSize() const
+    {
+        return m_tile_size;
+    }
+
+    std::size_t MonteCarloRenderer::GetWorkBufferMemorySize() const
+    {
+        return m_estimator->GetAllocatedWorkBufferSize() * kWorkBufferEntrySize;
+    }
+
+    bool MonteCarloRenderer::LimitWorkBufferMemory(std::size_t max_bytes)
+    {
+        auto size = m_work_buffer_size;
+        auto limit = max_bytes / kWorkBufferEntrySize;
+
+        // Batches of pipelined estimates allocate entries of their own
+        auto allocated = m_estimator->GetAllocatedWorkBufferSize();
+        auto estimator_size = m_estimator->GetWorkBufferSize();
+        if (allocated > estimator_size && estimator_size > 0)
+        {
+            limit = limit * estimator_size / allocated;
+        }
+
+        if (size <= limit)
+        {
+            return true;
+        }
+
+        cl_uint num_compute_units = 0;
+        clGetDeviceInfo(GetContext().GetDevice(0).GetID(), CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(num_compute_units), &num_compute_units, nullptr);
+
+        auto occupancy_limit = std::max<std::size_t>(num_compute_units, 1u) * kMinWorkBufferEntriesPerComputeUnit;
+        size = std::min(size, std::max(limit, occupancy_limit));
+
+        m_auto_tile_size = true;
+
+        m_work_buffer_size = size;
+        m_estimator->SetWorkBufferSize(size);
+
+        return size <= limit;
+    }
+
+    MonteCarloRenderer::RenderStatistics MonteCarloRenderer::GetRenderStatistics() const
+    {
+        return m_render_statistics;
+    }
+
+    void MonteCarloRenderer::SetProfiling(bool enable)
+    {
+        m_profiler.SetEnabled(enable);
+    }
+
+    bool MonteCarloRenderer::GetProfiling() const
+    {
+        return m_profiler.IsEnabled();
+    }
+
     void MonteCarloRenderer::HandleMissedRays(const ClwScene &scene , uint32_t w, uint32_t h,
         CLWBuffer<ray> rays, CLWBuffer<Intersection> intersections, CLWBuffer<int> pixel_indices,
         CLWBuffer<int> output_indices, std::size_t size, CLWBuffer<RadeonRays::float3> output)
     {
+        auto sample_slots = UseSampleSlots();
+
         // Fetch kernel
-        auto misskernel = GetKernel("ShadeBackgroundImage") ;
+        auto misskernel = GetKernel("ShadeBackgroundImage", m_samples_per_dispatch > 1 && !sample_slots ? " -D BAIKAL_ATOMIC_RESOLVE " : "");
 
         // Set kernel parameters
         int argc = 0;
@@ -409,12 +1331,19 @@ namespace Baikal
         misskernel.SetArg(argc++, intersections);
         misskernel.SetArg(argc++, pixel_indices);
         misskernel.SetArg(argc++, output_indices);
+        // Output indices of sample slots are slot indices, tile domain tells the pixel
+        misskernel.SetArg(argc++, sample_slots ? m_estimator->GetOutputIndexBuffer() : output_indices);
         misskernel.SetArg(argc++, (cl_int)size);
         misskernel.SetArg(argc++, scene.background_idx);
         misskernel.SetArg(argc++, w);
         misskernel.SetArg(argc++, h);
         misskernel.SetArg(argc++, scene.textures);
         misskernel.SetArg(argc++, scene.texturedata);
+        misskernel.SetArg(argc++, scene.texture_requests);
+        if (scene.texture_images)
+        {
+            misskernel.SetArg(argc++, scene.texture_images.get());
+        }
         misskernel.SetArg(argc++, output);
 
         {
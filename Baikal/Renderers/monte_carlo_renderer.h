@@ -27,11 +27,14 @@ THE SOFTWARE.
 #include "SceneGraph/clwscene.h"
 #include "Controllers/clw_scene_controller.h"
 #include "Utils/clw_class.h"
+#include "Utils/clw_profiler.h"
+#include "Utils/clw_readback.h"
 #include "Estimators/estimator.h"
 
 #include "CLW.h"
 
 #include <memory>
+#include <functional>
 
 
 namespace Baikal
@@ -44,6 +47,45 @@ namespace Baikal
     class MonteCarloRenderer : public Renderer, protected ClwClass
     {
     public:
+        // Tiling information of the last Render() call
+        struct RenderStatistics
+        {
+            int2 tile_size;
+            std::uint32_t num_tiles;
+            std::size_t work_buffer_size;
+        };
+
+        // Pixel format of asynchronous output readback
+        enum class ReadbackFormat
+        {
+            // Accumulated value divided by sample count
+            kRGBA32F,
+            // Gamma corrected and clamped like the interop copy kernel
+            kRGBA8
+        };
+
+        // First hit of a picking ray, see Pick
+        struct PickResult
+        {
+            // Id of the shape as in kShapeId output, -1 if the ray has missed
+            int shape_id;
+            // Triangle of the shape
+            int prim_id;
+            // Barycentric coordinates on the triangle
+            RadeonRays::float2 uv;
+            // Ray parameter of the hit
+            float distance;
+            // World space position of the hit
+            RadeonRays::float3 position;
+        };
+
+        // Reconstruction filter importance sampled by primary rays
+        enum class PixelFilter
+        {
+            kBox,
+            kGaussian,
+            kBlackmanHarris
+        };
 
         MonteCarloRenderer(
             CLWContext context,
@@ -60,6 +102,20 @@ namespace Baikal
         // Render the scene into the output
         void Render(ClwScene const& scene) override;
 
+        // Tile source of split frame rendering, fills the next tile or returns false once the frame is done
+        using TileSource = std::function<bool(int2& tile_origin, int2& tile_size)>;
+        // Render a single iteration over the tiles handed out by next_tile, the rest of the output
+        // is left unchanged. Lets several devices share a frame, see TileScheduler
+        void RenderTiles(ClwScene const& scene, TileSource const& next_tile);
+
+        // Restrict Render to a region of the outputs, single pass AOVs included, pixels outside of it are left unchanged.
+        // Work buffer shrinks to the tiles of the region while it is set, zero size renders whole outputs again
+        void SetRenderRegion(int2 const& origin, int2 const& size);
+        void GetRenderRegion(int2& origin, int2& size) const;
+
+        // Render as many iterations as fit into a time budget
+        std::uint32_t RenderWithTimeBudget(ClwScene const& scene, float time_budget_ms) override;
+
         // Render single tile
         void RenderTile(ClwScene const& scene,
                         RadeonRays::int2 const& tile_origin,
@@ -70,22 +126,121 @@ namespace Baikal
 
         void SetRandomSeed(std::uint32_t seed) override;
 
+        void SetSampleIndex(std::uint32_t index) override;
+
+        // Outputs are saved by their type, the estimator random state and samples per dispatch along with them
+        void SaveCheckpoint(RenderCheckpoint& checkpoint) const override;
+        void LoadCheckpoint(RenderCheckpoint const& checkpoint) override;
+
         // Interop function
         CLWKernel GetCopyKernel();
         // Add function
         CLWKernel GetAccumulateKernel();
+        // Resolve output region on the device and copy it to readback host memory
+        // without waiting, poll readback.IsReady() or call readback.Wait() before reading.
+        // Resolve is enqueued after rendering submitted so far, the copy runs on the readback queue
+        void ReadOutputAsync(
+            Output const& output,
+            int2 const& region_origin,
+            int2 const& region_size,
+            ReadbackFormat format,
+            ClwReadback& readback,
+            float gamma = 2.2f
+        );
+        // Start compiling the programs rendering the scene with current settings needs on worker threads,
+        // e.g. right after the scene is loaded. Render picks them up instead of compiling them one at a time
+        void CompileProgramsAsync(ClwScene const& scene);
         // Run render benchmark
         void Benchmark(ClwScene const& scene, Estimator::RayTracingStats& stats);
+        // Trace the primary ray through the center of an output pixel and return its first hit, picks the same
+        // shape as the kShapeId output would without rendering it. Uses the estimator ray buffers, so it should
+        // not be called in the middle of a frame. Waits for the device
+        PickResult Pick(ClwScene const& scene, int2 const& pixel);
 
         // Set max number of light bounces
         void SetMaxBounces(std::uint32_t max_bounces);
+
+        // Get underlying estimator
+        Estimator& GetEstimator() { return *m_estimator;  }
+
+        // Set number of samples per pixel taken in a single Render() call,
+        // samples are traced in one batch and accumulated atomically
+        void SetSamplesPerDispatch(std::uint32_t num_samples);
+        std::uint32_t GetSamplesPerDispatch() const;
+
+        // Estimate samples of a dispatch into slots of their own and sum them per pixel in a follow-up kernel
+        // instead of accumulating them atomically. Float atomics are compare and swap loops on most devices,
+        // so this pays off with many samples per dispatch. Slots take a float4 per work buffer entry.
+        // Visibility and opacity outputs are still accumulated atomically, so slots are not used while they are set
+        void SetSampleSlots(bool enable);
+        bool GetSampleSlots() const;
+
+        // Set pixel filter and its radius in pixels, box filter jitters within the pixel.
+        // Other filters distribute primary rays after the filter, so accumulation stays a plain average
+        void SetPixelFilter(PixelFilter filter, float radius = 1.5f);
+        PixelFilter GetPixelFilter() const;
+        float GetPixelFilterRadius() const;
+
+        // Fill single pass AOVs from the primary hits of the color estimate instead of a separate
+        // pixel center pass. AOVs then average jittered primary samples, needs one sample per dispatch
+        void SetFusedAOVs(bool enable);
+        bool GetFusedAOVs() const;
+
+        // Keep primary rays and hits of num_patterns samples and cycle through them while the camera and the scene
+        // stay the same, so later iterations skip primary ray generation and traversal. Lens and time samples repeat
+        // along with the pixel jitter. Only used while a tile covers the whole output, every pattern takes a ray and
+        // a hit per work buffer entry of device memory. 0 disables the cache and releases it
+        void SetPrimaryHitCache(std::uint32_t num_patterns);
+        std::uint32_t GetPrimaryHitCache() const;
+
+        // Keep a single pass output attached but skip filling it, accumulated outputs then simply take fewer samples.
+        // Packed outputs average over all dispatches and should stay enabled while they accumulate
+        void SetAOVEnabled(OutputType type, bool enabled);
+        bool IsAOVEnabled(OutputType type) const;
+
+        // Set quality level the estimator is run at
+        void SetQualityLevel(Estimator::QualityLevel quality);
+        Estimator::QualityLevel GetQualityLevel() const;
+
+        // Set tile size, estimator work buffer is resized to hold a single tile
+        void SetTileSize(int2 const& tile_size);
+        // Size work buffer after device memory and compute units, tiles follow output width
+        void AutoTuneTileSize();
+        // Get tile size set via SetTileSize
+        int2 GetTileSize() const;
+        // Rough device memory of the estimator and intersector buffers sized after the work buffer
+        std::size_t GetWorkBufferMemorySize() const;
+        // Shrink work buffer to max_bytes of device memory, tiles then follow output width as after AutoTuneTileSize.
+        // Work buffer is not made smaller than it takes to keep the device busy, returns false if max_bytes is below that
+        bool LimitWorkBufferMemory(std::size_t max_bytes);
+
+        // Get tiling information of the last Render() call
+        RenderStatistics GetRenderStatistics() const;
+
+        // Measure device time of the render steps, adds marker commands to the queue while enabled
+        void SetProfiling(bool enable);
+        bool GetProfiling() const;
+        // Profiler is resolved at the end of every Render() call without waiting for the device
+        ClwProfiler& GetProfiler() { return m_profiler; }
         
     protected:
         void GeneratePrimaryRays(
             ClwScene const& scene,
             Output const& output,
             int2 const& tile_size,
-            bool generate_at_pixel_center = false
+            bool generate_at_pixel_center = false,
+            std::uint32_t num_samples = 1
+        );
+
+        // Generate rays of the samples starting at frame into the given ray buffer
+        void GeneratePrimaryRays(
+            ClwScene const& scene,
+            Output const& output,
+            int2 const& tile_size,
+            bool generate_at_pixel_center,
+            std::uint32_t num_samples,
+            std::uint32_t frame,
+            CLWBuffer<ray> rays
         );
 
         void FillAOVs(
@@ -94,16 +249,52 @@ namespace Baikal
             int2 const& tile_size
         );
 
+        // Run AOV kernel over already intersected rays
+        void FillAOVsFromHits(
+            ClwScene const& scene,
+            CLWBuffer<ray> rays,
+            CLWBuffer<Intersection> intersections,
+            CLWBuffer<int> output_indices,
+            std::size_t size
+        );
+
         virtual void GenerateTileDomain(
             int2 const& output_size,
             int2 const& tile_origin,
-            int2 const& tile_size
+            int2 const& tile_size,
+            std::uint32_t num_samples
         );
 
-        Estimator& GetEstimator() { return *m_estimator;  }
+        // Tile blue noise over the screen into estimator random buffer (used by kBlueNoiseSobol sampler)
+        void FillBlueNoiseScrambles(int2 const& output_size);
+
+        // Resize estimator work buffer to hold tiles of the render region, or to the full size if there is none
+        void FitWorkBufferToRegion(int2 const& tile_size);
+
+        // Per iteration setup shared by Render and RenderTiles
+        void PrepareFrame(int2 const& output_size);
+        // Build options of the camera kernels for the current pixel filter
+        std::string GetPixelFilterBuildOptions() const;
+        // Mark outputs updated and advance the sample counter
+        void FinishFrame();
+
+        // Seed of a launch of the current sample, see Baikal::GetLaunchSeed
+        std::uint32_t GetLaunchSeed(LaunchSeed launch) const;
 
         // Find non-zero AOV
         Output* FindFirstNonZeroOutput(bool include_multipass = true, bool include_singlepass = true) const;
+        // Check if any single pass output is set and enabled
+        bool HasEnabledAOVs() const;
+
+        // Samples of the current settings go to sample slots, see SetSampleSlots
+        bool UseSampleSlots() const;
+        // Sum sample slots of the tile into the output
+        void ResolveSampleSlots(int2 const& tile_size, CLWBuffer<RadeonRays::float3> output);
+
+        // Pattern of the primary hit cache the current sample uses, -1 if the cache is not used for the tile.
+        // Drops all patterns once the scene, its camera or the ray count changes
+        int GetPrimaryHitPattern(ClwScene const& scene, int2 const& tile_origin, int2 const& tile_size,
+                                 int2 const& output_size, std::size_t num_rays);
 
         // Handler for missed rays used when scene have background override with plain image
         void HandleMissedRays(const ClwScene &scene, uint32_t w, uint32_t h,
@@ -116,6 +307,45 @@ namespace Baikal
 
     private:
         ClwClass m_uberv2_kernels;
+        std::uint32_t m_samples_per_dispatch;
+        // Estimator has regenerated paths with the samples following the ones of the frame
+        bool m_regenerate_paths;
+        int2 m_tile_size;
+        bool m_auto_tile_size;
+        // Work buffer size picked after the tile size, the estimator holds less while a render region is set
+        std::size_t m_work_buffer_size;
+        int2 m_region_origin;
+        int2 m_region_size;
+        RenderStatistics m_render_statistics;
+        // Measured duration of a single Render() call
+        float m_iteration_time_ms;
+        Estimator::QualityLevel m_quality;
+        PixelFilter m_pixel_filter;
+        float m_pixel_filter_radius;
+        bool m_fused_aovs;
+        bool m_sample_slots;
+        // Created on first use
+        CLWBuffer<RadeonRays::float3> m_sample_slot_buffer;
+        // Bit per output type skipped by the AOV kernel
+        std::uint32_t m_disabled_aovs;
+
+        // Primary rays and hits of every pattern, buffers are created on first use of the pattern
+        struct PrimaryHitCache
+        {
+            std::vector<CLWBuffer<ray>> rays;
+            std::vector<CLWBuffer<Intersection>> hits;
+            std::vector<bool> valid;
+            std::uint32_t next_pattern = 0;
+            // Scene, revisions and ray count the patterns have been traced for
+            ClwScene const* scene = nullptr;
+            std::uint32_t revision = 0;
+            std::uint32_t camera_revision = 0;
+            std::size_t num_rays = 0;
+        };
+        std::uint32_t m_primary_hit_patterns;
+        PrimaryHitCache m_primary_hit_cache;
+        std::uint32_t m_random_seed;
+        ClwProfiler m_profiler;
     };
 
 }
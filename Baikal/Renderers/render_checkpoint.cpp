@@ -0,0 +1,161 @@
+/**********************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#include "render_checkpoint.h"
+
+#include <cstdio>
+#include <fstream>
+
+namespace Baikal
+{
+    namespace
+    {
+        char const kMagic[4] = { 'B', 'K', 'C', 'P' };
+        std::uint32_t constexpr kVersion = 1u;
+
+        template <typename T>
+        void WritePod(std::ostream& stream, T const& value)
+        {
+            stream.write(reinterpret_cast<char const*>(&value), sizeof(T));
+        }
+
+        template <typename T>
+        T ReadPod(std::istream& stream)
+        {
+            T value;
+            if (!stream.read(reinterpret_cast<char*>(&value), sizeof(T)))
+            {
+                throw std::runtime_error("RenderCheckpoint: unexpected end of data");
+            }
+            return value;
+        }
+    }
+
+    std::vector<char> const& RenderCheckpoint::GetEntry(std::string const& name) const
+    {
+        auto iter = m_entries.find(name);
+        if (iter == m_entries.cend())
+        {
+            throw std::runtime_error("RenderCheckpoint: no " + name + " in the checkpoint");
+        }
+
+        return iter->second;
+    }
+
+    void RenderCheckpoint::Write(std::ostream& stream) const
+    {
+        stream.write(kMagic, sizeof(kMagic));
+        WritePod(stream, kVersion);
+        WritePod(stream, static_cast<std::uint32_t>(m_entries.size()));
+
+        for (auto const& entry : m_entries)
+        {
+            WritePod(stream, static_cast<std::uint32_t>(entry.first.size()));
+            stream.write(entry.first.data(), entry.first.size());
+            WritePod(stream, static_cast<std::uint64_t>(entry.second.size()));
+            stream.write(entry.second.data(), entry.second.size());
+        }
+
+        if (!stream)
+        {
+            throw std::runtime_error("RenderCheckpoint: cannot write data");
+        }
+    }
+
+    void RenderCheckpoint::Read(std::istream& stream)
+    {
+        char magic[sizeof(kMagic)];
+        if (!stream.read(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0)
+        {
+            throw std::runtime_error("RenderCheckpoint: data is not a checkpoint");
+        }
+
+        if (ReadPod<std::uint32_t>(stream) != kVersion)
+        {
+            throw std::runtime_error("RenderCheckpoint: unsupported version");
+        }
+
+        std::map<std::string, std::vector<char>> entries;
+        auto num_entries = ReadPod<std::uint32_t>(stream);
+
+        for (auto i = 0u; i < num_entries; ++i)
+        {
+            std::string name(ReadPod<std::uint32_t>(stream), '\0');
+            if (!name.empty() && !stream.read(&name[0], name.size()))
+            {
+                throw std::runtime_error("RenderCheckpoint: unexpected end of data");
+            }
+
+            auto& block = entries[name];
+            block.resize(static_cast<std::size_t>(ReadPod<std::uint64_t>(stream)));
+            if (!block.empty() && !stream.read(block.data(), block.size()))
+            {
+                throw std::runtime_error("RenderCheckpoint: unexpected end of data");
+            }
+        }
+
+        // Nothing is replaced by a partial read
+        m_entries = std::move(entries);
+    }
+
+    void RenderCheckpoint::WriteFile(std::string const& file_name) const
+    {
+        auto temp_name = file_name + ".tmp";
+
+        {
+            std::ofstream out(temp_name, std::ios::binary | std::ios::trunc);
+            if (!out)
+            {
+                throw std::runtime_error("RenderCheckpoint: cannot open " + temp_name);
+            }
+
+            Write(out);
+            out.close();
+
+            if (!out)
+            {
+                throw std::runtime_error("RenderCheckpoint: cannot write " + temp_name);
+            }
+        }
+
+        // Windows does not replace existing files on rename
+        if (std::rename(temp_name.c_str(), file_name.c_str()) != 0)
+        {
+            std::remove(file_name.c_str());
+
+            if (std::rename(temp_name.c_str(), file_name.c_str()) != 0)
+            {
+                throw std::runtime_error("RenderCheckpoint: cannot replace " + file_name);
+            }
+        }
+    }
+
+    void RenderCheckpoint::ReadFile(std::string const& file_name)
+    {
+        std::ifstream in(file_name, std::ios::binary);
+        if (!in)
+        {
+            throw std::runtime_error("RenderCheckpoint: cannot open " + file_name);
+        }
+
+        Read(in);
+    }
+}
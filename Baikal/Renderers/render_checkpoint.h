@@ -0,0 +1,147 @@
+/**********************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include "CLW.h"
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace Baikal
+{
+    /**
+    \brief State of a progressive render, so it can be resumed after the process is gone.
+
+    \details Renderers store their accumulation buffers, sample index and any other state
+    later samples depend on as named blocks of bytes, see Renderer::SaveCheckpoint.
+    Blocks are read back into buffers of the same size only, so a checkpoint can be restored
+    into a renderer set up the same way as the one it was saved from.
+    */
+    class RenderCheckpoint
+    {
+    public:
+        // Trivially copyable value
+        template <typename T>
+        void SetValue(std::string const& name, T const& value);
+        // Throws std::runtime_error if there is no such value or its size differs
+        template <typename T>
+        T GetValue(std::string const& name) const;
+
+        // Read the whole buffer from the device, waits for the copy
+        template <typename T>
+        void SaveBuffer(CLWContext context, std::string const& name, CLWBuffer<T> buffer);
+        // Write the block into the buffer, throws std::runtime_error if there is none or the sizes differ
+        template <typename T>
+        void LoadBuffer(CLWContext context, std::string const& name, CLWBuffer<T> buffer) const;
+
+        bool HasEntry(std::string const& name) const { return m_entries.find(name) != m_entries.cend(); }
+        std::size_t GetNumEntries() const { return m_entries.size(); }
+
+        // Throws std::runtime_error on stream errors and if the data is not a checkpoint
+        void Write(std::ostream& stream) const;
+        void Read(std::istream& stream);
+
+        // Written next to the file and moved over it once complete, a process killed
+        // while writing leaves the previous checkpoint in place
+        void WriteFile(std::string const& file_name) const;
+        void ReadFile(std::string const& file_name);
+
+    private:
+        std::vector<char> const& GetEntry(std::string const& name) const;
+
+        std::map<std::string, std::vector<char>> m_entries;
+    };
+
+    template <typename T>
+    inline void RenderCheckpoint::SetValue(std::string const& name, T const& value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "RenderCheckpoint: values have to be trivially copyable");
+
+        auto& entry = m_entries[name];
+        entry.resize(sizeof(T));
+        std::memcpy(entry.data(), &value, sizeof(T));
+    }
+
+    template <typename T>
+    inline T RenderCheckpoint::GetValue(std::string const& name) const
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "RenderCheckpoint: values have to be trivially copyable");
+
+        auto& entry = GetEntry(name);
+        if (entry.size() != sizeof(T))
+        {
+            throw std::runtime_error("RenderCheckpoint: size of " + name + " does not match");
+        }
+
+        T value;
+        std::memcpy(&value, entry.data(), sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    inline void RenderCheckpoint::SaveBuffer(CLWContext context, std::string const& name, CLWBuffer<T> buffer)
+    {
+        auto num_elements = buffer.GetElementCount();
+
+        std::vector<T> data(num_elements);
+        if (num_elements != 0)
+        {
+            context.ReadBuffer(0, buffer, data.data(), num_elements).Wait();
+        }
+
+        auto& entry = m_entries[name];
+        entry.resize(num_elements * sizeof(T));
+
+        if (num_elements != 0)
+        {
+            std::memcpy(entry.data(), data.data(), entry.size());
+        }
+    }
+
+    template <typename T>
+    inline void RenderCheckpoint::LoadBuffer(CLWContext context, std::string const& name, CLWBuffer<T> buffer) const
+    {
+        auto& entry = GetEntry(name);
+        auto num_elements = buffer.GetElementCount();
+
+        if (entry.size() != num_elements * sizeof(T))
+        {
+            throw std::runtime_error("RenderCheckpoint: size of " + name + " does not match");
+        }
+
+        if (num_elements == 0)
+        {
+            return;
+        }
+
+        std::vector<T> data(num_elements);
+        std::memcpy(data.data(), entry.data(), entry.size());
+        context.WriteBuffer(0, buffer, data.data(), num_elements).Wait();
+    }
+}
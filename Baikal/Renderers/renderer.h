@@ -38,6 +38,7 @@ THE SOFTWARE.
 namespace Baikal
 {
     class Output;
+    class RenderCheckpoint;
     struct ClwScene;
 
     /**
@@ -56,6 +57,8 @@ namespace Baikal
             kColor = 0,
             kOpacity,
             kVisibility,
+            // Work per pixel: rays traced, bounces, shadow rays and number of samples
+            kCost,
             kMaxMultiPassOutput,
             // Single-pass outputs that will
             // be rendered in AOV kernel
@@ -96,6 +99,19 @@ namespace Baikal
         virtual
         void Render(ClwScene const& scene) = 0;
 
+        /**
+         \brief Render as many iterations as fit into a time budget.
+
+         At least one iteration is always rendered. The call returns once
+         all the work is finished on the device.
+
+         \param scene Scene to render
+         \param time_budget_ms Time budget in milliseconds
+         \return Number of samples per pixel rendered
+         */
+        virtual
+        std::uint32_t RenderWithTimeBudget(ClwScene const& scene, float time_budget_ms) = 0;
+
         /**
         \brief Render single iteration.
 
@@ -128,6 +144,42 @@ namespace Baikal
         */
         virtual void SetRandomSeed(std::uint32_t seed) = 0;
 
+        /**
+        \brief Set index of the first sample the next Render call adds.
+
+        Samples only depend on the random seed and their index, so a range of samples
+        [a, b) can be rendered on its own by setting the index to a and rendering b - a
+        samples. A range renders bit for bit the same no matter what was rendered before, and
+        outputs of disjoint ranges add up to a render of their union up to the order of floating
+        point additions, as long as renderers share the work buffer size and samples per dispatch.
+
+        \param index Sample index
+        */
+        virtual void SetSampleIndex(std::uint32_t index) = 0;
+
+        /**
+        \brief Store the state of the progressive render into a checkpoint.
+
+        Contents of all the outputs set, the sample index, the random seed and whatever
+        else the next samples depend on are read back from the device.
+
+        \param checkpoint Checkpoint to fill
+        */
+        virtual void SaveCheckpoint(RenderCheckpoint& checkpoint) const = 0;
+
+        /**
+        \brief Resume the progressive render stored in a checkpoint.
+
+        The renderer has to be set up like the one the checkpoint comes from, with outputs
+        of the same sizes and formats. Outputs are overwritten, so they should not be cleared
+        afterwards. Next Render call adds the sample the interrupted render would have added,
+        so the result matches the uninterrupted render.
+        Throws std::runtime_error if the checkpoint does not fit the renderer.
+
+        \param checkpoint Checkpoint to restore
+        */
+        virtual void LoadCheckpoint(RenderCheckpoint const& checkpoint) = 0;
+
         /**
             Disallow copies and moves.
          */
@@ -1,154 +1,232 @@
 #include "collector.h"
 #include "SceneGraph/clwscene.h"
 #include "SceneGraph/iterator.h"
+#include <algorithm>
 #include <vector>
 #include <cassert>
+#include <stdexcept>
 #include <unordered_map>
 
 namespace Baikal
 {
-    struct IdCompare
-    {
-        bool operator() (const SceneObject::Ptr& lhs, const SceneObject::Ptr& rhs) const
-        {
-            return lhs->GetId() < rhs->GetId();
-        }
-    };
-    using ItemMap = std::unordered_map<uint32_t, int>;
-    using ItemSet = std::set<SceneObject::Ptr, IdCompare>;
-    
+    // Object id -> item index
+    using ItemMap = std::unordered_map<std::uint32_t, std::uint32_t>;
+    using ItemList = std::vector<SceneObject::Ptr>;
+
     class BundleImpl : public Bundle
     {
     public:
-        BundleImpl(ItemMap const& map, ItemSet const& set)
-        : m_map(map)
-        , m_set(set)
+        BundleImpl(Collector const* collector, std::uint32_t generation)
+        : m_collector(collector)
+        , m_generation(generation)
         {
         }
-        
-        ItemMap m_map;
-        ItemSet m_set;
+
+        // Collector and its state the bundle has been created from
+        Collector const* m_collector;
+        std::uint32_t m_generation;
     };
-    
+
     struct Collector::CollectorImpl
     {
+        // Committed items in index order
+        ItemList m_items;
         ItemMap m_map;
-        ItemSet m_set;
+        // Items collected during current pass
+        std::unordered_map<std::uint32_t, SceneObject::Ptr> m_pending;
+        // Changes made by the last commit
+        ItemList m_added;
+        ItemList m_removed;
+        // Incremented by every commit which changes the item list
+        std::uint32_t m_generation = 0;
+        // Last generation which removed items, indices of other items might have been moved
+        std::uint32_t m_remove_generation = 0;
     };
-    
+
     Collector::Collector()
     : m_impl (new CollectorImpl)
     {
     }
-    
+
     Collector::~Collector() = default;
-    
+
     void Collector::Clear()
     {
+        m_impl->m_items.clear();
         m_impl->m_map.clear();
-        m_impl->m_set.clear();
+        m_impl->m_pending.clear();
+        m_impl->m_added.clear();
+        m_impl->m_removed.clear();
+
+        // Everything serialized before is invalid now
+        m_impl->m_remove_generation = ++m_impl->m_generation;
     }
-    
+
+    void Collector::BeginCollect()
+    {
+        m_impl->m_pending.clear();
+    }
+
     std::unique_ptr<Iterator> Collector::CreateIterator() const
     {
         return std::unique_ptr<Iterator>(
-            new IteratorImpl<ItemSet::const_iterator>(m_impl->m_set.cbegin(),
-                                                      m_impl->m_set.cend()));
+            new IteratorImpl<ItemList::const_iterator>(m_impl->m_items.cbegin(),
+                                                       m_impl->m_items.cend()));
     }
-    
+
     void Collector::Collect(Iterator& iter, ExpandFunc expand_func)
     {
         for(;iter.IsValid(); iter.Next())
         {
             // Expand current item
             auto cur_items = expand_func(iter.Item());
-            
+
             // Insert items
-            m_impl->m_set.insert(cur_items.cbegin(), cur_items.cend());
+            for (auto& item : cur_items)
+            {
+                m_impl->m_pending.emplace(item->GetId(), item);
+            }
         }
     }
 
     void Collector::Collect(std::shared_ptr < Baikal::SceneObject > object)
     {
-        m_impl->m_set.insert(object);
+        m_impl->m_pending.emplace(object->GetId(), object);
     }
 
     void Collector::Commit()
     {
-        m_impl->m_map.clear();
-        
-        int idx = 0;
-        for (auto& i : m_impl->m_set)
+        auto& items = m_impl->m_items;
+        auto& map = m_impl->m_map;
+        auto& pending = m_impl->m_pending;
+
+        m_impl->m_added.clear();
+        m_impl->m_removed.clear();
+
+        // Remove items which have not been collected in this pass,
+        // the hole is filled with the last item to keep indices dense
+        for (std::uint32_t idx = 0; idx < items.size();)
+        {
+            if (pending.find(items[idx]->GetId()) != pending.cend())
+            {
+                ++idx;
+                continue;
+            }
+
+            m_impl->m_removed.push_back(items[idx]);
+            map.erase(items[idx]->GetId());
+
+            if (idx + 1 != items.size())
+            {
+                items[idx] = std::move(items.back());
+                map[items[idx]->GetId()] = idx;
+            }
+
+            items.pop_back();
+        }
+
+        // Append new items, id order keeps the layout deterministic
+        for (auto& item : pending)
+        {
+            if (map.find(item.first) == map.cend())
+            {
+                m_impl->m_added.push_back(item.second);
+            }
+        }
+
+        std::sort(m_impl->m_added.begin(), m_impl->m_added.end(),
+            [](SceneObject::Ptr const& lhs, SceneObject::Ptr const& rhs)
+            {
+                return lhs->GetId() < rhs->GetId();
+            });
+
+        for (auto& item : m_impl->m_added)
+        {
+            map[item->GetId()] = static_cast<std::uint32_t>(items.size());
+            items.push_back(item);
+        }
+
+        pending.clear();
+
+        if (!m_impl->m_added.empty() || !m_impl->m_removed.empty())
+        {
+            ++m_impl->m_generation;
+        }
+
+        if (!m_impl->m_removed.empty())
         {
-            m_impl->m_map[i->GetId()] = idx++;
+            m_impl->m_remove_generation = m_impl->m_generation;
         }
     }
-    
+
+    std::vector<SceneObject::Ptr> const& Collector::GetAddedItems() const
+    {
+        return m_impl->m_added;
+    }
+
+    std::vector<SceneObject::Ptr> const& Collector::GetRemovedItems() const
+    {
+        return m_impl->m_removed;
+    }
+
     void Collector::Finalize(FinalizeFunc finalize_func)
     {
-        for (auto& i : m_impl->m_set)
+        for (auto& i : m_impl->m_items)
         {
             finalize_func(i);
         }
     }
-    
+
     bool Collector::NeedsUpdate(Bundle const* bundle, ChangedFunc changed_func) const
     {
         auto bundle_impl = static_cast<BundleImpl const*>(bundle);
-        
+
         // Check if:
-        // 0) bundle and our map sizes match.
-        // 1) All the objects collector has are in the bundle.
-        // 2) They have not changed.
-        if (bundle_impl->m_set.size() != m_impl->m_set.size())
+        // 0) bundle has been created from the current item list.
+        // 1) Collected objects have not changed.
+        if (bundle_impl->m_collector != this || bundle_impl->m_generation != m_impl->m_generation)
         {
             return true;
         }
-        
-        for (auto& i : m_impl->m_set)
+
+        for (auto& i : m_impl->m_items)
         {
             if (changed_func(i))
             {
-                // Case 2: we have the object which is changed.
                 return true;
             }
-            
-            auto iter = bundle_impl->m_set.find(i);
-            
-            if (iter == bundle_impl->m_set.cend())
-            {
-                // Case 1: we have an object which is not serialized as a part of bundle.
-                return true;
-            }
-
-            // Here we know that bundle_impl->m_map[i] == m_impl->m_map[i]
-            // since it is defined by set traversal order.
         }
-        
+
         return false;
     }
-    
+
+    bool Collector::IndicesChanged(Bundle const* bundle) const
+    {
+        auto bundle_impl = static_cast<BundleImpl const*>(bundle);
+
+        // Additions do not move existing items, removals might
+        return bundle_impl->m_collector != this || bundle_impl->m_generation < m_impl->m_remove_generation;
+    }
+
     std::size_t Collector::GetNumItems() const
     {
-        return m_impl->m_set.size();
+        return m_impl->m_items.size();
     }
-    
+
     Bundle* Collector::CreateBundle() const
     {
-        return new BundleImpl { m_impl->m_map, m_impl->m_set };
+        return new BundleImpl { this, m_impl->m_generation };
     }
-    
+
     std::uint32_t Collector::GetItemIndex(SceneObject::Ptr item) const
     {
         auto iter = m_impl->m_map.find(item->GetId());
-        
+
         if (iter == m_impl->m_map.cend())
         {
             throw std::runtime_error("No such item in the collector");
         }
-        
+
         return iter->second;
     }
-    
-    
 }
@@ -30,6 +30,7 @@
 #include <memory>
 #include <map>
 #include <set>
+#include <vector>
 #include <functional>
 
 #include "../scene_object.h"
@@ -56,6 +57,10 @@ namespace Baikal
 
      Collector iterates over collection of objects collecting objects and their dependecies into random access bundle.
      The engine uses collectors in order to resolve material-texture or shape-material dependecies for GPU serialization.
+
+     Collection is incremental: each pass started with BeginCollect is compared to the previously committed
+     one on Commit. Items keep their indices across passes, a removed item has its index taken by the last
+     item, so indices stay dense and iteration goes in index order.
      */
     class Collector
     {
@@ -71,18 +76,26 @@ namespace Baikal
 
         // Clear collector state (CreateIterator returns invalid iterator if the collector is empty)
         void Clear();
+        // Start new collection pass, committed items keep their indices until the next Commit
+        void BeginCollect();
         // Create an iterator of objects
         std::unique_ptr<Iterator> CreateIterator() const;
         // Collect objects and their dependencies
         void Collect(Iterator& iter, ExpandFunc expand_func);
         // Adds single object to collection
         void Collect(std::shared_ptr<Baikal::SceneObject> object);
-        // Commit collected objects
+        // Commit collected objects: items not collected in this pass are removed, new ones are appended
         void Commit();
+        // Items added and removed by the last Commit
+        std::vector<SceneObject::Ptr> const& GetAddedItems() const;
+        std::vector<SceneObject::Ptr> const& GetRemovedItems() const;
         // Commit collected objects with order based on object id.
         //void CommitOrderedById();
         // Given a budnle check if all collected objects are in the bundle and do not require update
         bool NeedsUpdate(Bundle const* bundle, ChangedFunc cahnged_func) const;
+        // Check if indices of the items serialized into the bundle might have changed since,
+        // data referencing them by index has to be rewritten in this case
+        bool IndicesChanged(Bundle const* bundle) const;
         // Get number of objects in the collection
         std::size_t GetNumItems() const;
         // Create serialised bundle (randomly accessible dump of objects)
@@ -23,6 +23,7 @@
 
 #include <cmath>
 #include <cassert>
+#include <stdexcept>
 
 #include "math/quaternion.h"
 #include "math/matrix.h"
@@ -47,6 +48,18 @@ namespace Baikal
     {
     }
 
+    void Camera::SetViews(std::uint32_t num_views, float separation)
+    {
+        if (num_views == 0)
+        {
+            throw std::runtime_error("Camera: number of views should be positive");
+        }
+
+        m_num_views = num_views;
+        m_view_separation = separation;
+        SetDirty(true);
+    }
+
     void Camera::LookAt(RadeonRays::float3 const& eye,
                         RadeonRays::float3 const& at,
                         RadeonRays::float3 const& up)
@@ -175,6 +188,49 @@ namespace Baikal
         return m_p;
     }
     
+    void Camera::SetMotionLookAt(RadeonRays::float3 const& eye,
+                                 RadeonRays::float3 const& at,
+                                 RadeonRays::float3 const& up)
+    {
+        m_motion_p = eye;
+        m_motion_forward = normalize(at - eye);
+        m_motion_right = normalize(cross(m_motion_forward, up));
+        m_motion_up = cross(m_motion_right, m_motion_forward);
+        m_has_motion = true;
+        SetDirty(true);
+    }
+
+    void Camera::ClearMotion()
+    {
+        m_has_motion = false;
+        SetDirty(true);
+    }
+
+    bool Camera::HasMotion() const
+    {
+        return m_has_motion;
+    }
+
+    RadeonRays::float3 Camera::GetMotionForwardVector() const
+    {
+        return m_has_motion ? m_motion_forward : m_forward;
+    }
+
+    RadeonRays::float3 Camera::GetMotionUpVector() const
+    {
+        return m_has_motion ? m_motion_up : m_up;
+    }
+
+    RadeonRays::float3 Camera::GetMotionRightVector() const
+    {
+        return m_has_motion ? m_motion_right : m_right;
+    }
+
+    RadeonRays::float3 Camera::GetMotionPosition() const
+    {
+        return m_has_motion ? m_motion_p : m_p;
+    }
+    
     float Camera::GetAspectRatio() const
     {
         return m_dim.x / m_dim.y;
@@ -28,6 +28,8 @@
  */
 #pragma once
 
+#include <cstdint>
+
 #include "math/float3.h"
 #include "math/float2.h"
 
@@ -66,6 +68,20 @@ namespace Baikal
         RadeonRays::float3 GetUpVector() const;
         RadeonRays::float3 GetRightVector() const;
         RadeonRays::float3 GetPosition() const;
+
+        // Set camera frame at shutter close, the camera moves from the frame
+        // set by LookAt() and moves at shutter open
+        void SetMotionLookAt(RadeonRays::float3 const& eye,
+                             RadeonRays::float3 const& at,
+                             RadeonRays::float3 const& up);
+        void ClearMotion();
+        bool HasMotion() const;
+
+        // Shutter close frame, static cameras return the shutter open one
+        RadeonRays::float3 GetMotionForwardVector() const;
+        RadeonRays::float3 GetMotionUpVector() const;
+        RadeonRays::float3 GetMotionRightVector() const;
+        RadeonRays::float3 GetMotionPosition() const;
         
         // Set camera depth range.
         // Does not really make sence for physical camera
@@ -83,6 +99,14 @@ namespace Baikal
         void SetVolume(VolumeMaterial::Ptr shape);
         VolumeMaterial::Ptr GetVolume() const;
 
+        // Render num_views views side by side in a single pass, each of them takes output width / num_views
+        // columns of the outputs and the sensor size applies to a single view. Views are spread along
+        // the right vector separation apart and centered on the camera position, two of them make a
+        // left and right eye pair. Output width has to be a multiple of the number of views
+        void SetViews(std::uint32_t num_views, float separation);
+        std::uint32_t GetNumViews() const;
+        float GetViewSeparation() const;
+
     protected:
         // Rotate camera around world Z axis
         void Rotate(RadeonRays::float3, float angle);
@@ -105,8 +129,18 @@ namespace Baikal
         // Near and far Z
         RadeonRays::float2 m_zcap;
 
+        // Camera coordinate frame at shutter close
+        RadeonRays::float3 m_motion_forward;
+        RadeonRays::float3 m_motion_right;
+        RadeonRays::float3 m_motion_up;
+        RadeonRays::float3 m_motion_p;
+        bool m_has_motion = false;
+
         // Volume index
         VolumeMaterial::Ptr m_volume;
+
+        std::uint32_t m_num_views = 1;
+        float m_view_separation = 0.f;
     };
     
     class OrthographicCamera : public Camera
@@ -242,4 +276,14 @@ namespace Baikal
         return m_volume;
     }
 
+    inline std::uint32_t Camera::GetNumViews() const
+    {
+        return m_num_views;
+    }
+
+    inline float Camera::GetViewSeparation() const
+    {
+        return m_view_separation;
+    }
+
 }
@@ -1,16 +1,28 @@
 #pragma once
 
 #include "CLW.h"
+#include "Controllers/acceleration_structure.h"
+#include "Controllers/scene_compile_stats.h"
 //#include "math/float3.h"
 #include "SceneGraph/scene1.h"
 #include "radeon_rays.h"
 #include "SceneGraph/Collector/collector.h"
 
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
 
 namespace Baikal
 {
     using namespace RadeonRays;
 
+    class Texture;
+    class Mesh;
+
     enum class CameraType
     {
         kPerspective,
@@ -24,22 +36,64 @@ namespace Baikal
     {
         #include "Kernels/CL/payload.cl"
 
+#ifdef BAIKAL_COMPRESSED_GEOMETRY
+        // Octahedral encoded normals and half precision UVs, see Utils/geometry_compression.h
+        using NormalData = std::uint32_t;
+        using UVData = std::uint32_t;
+#else
+        using NormalData = RadeonRays::float3;
+        using UVData = RadeonRays::float2;
+#endif
+
         CLWBuffer<RadeonRays::float3> vertices;
-        CLWBuffer<RadeonRays::float3> normals;
-        CLWBuffer<RadeonRays::float2> uvs;
+        CLWBuffer<NormalData> normals;
+        CLWBuffer<UVData> uvs;
+        // Encoded tangents with bitangent sign, see GeometryCompression::EncodeTangent,
+        // single placeholder element unless BAIKAL_VERTEX_TANGENTS is defined
+        CLWBuffer<std::uint32_t> tangents;
+        // Meshes with kShapeShortIndices flag pack two 16 bit indices per element
         CLWBuffer<int> indices;
 
         CLWBuffer<Shape> shapes;
         CLWBuffer<ShapeAdditionalData> shapes_additional;
+        // Instances reference their base shape instead of duplicating its descriptor
+        CLWBuffer<ShapeInstance> instances;
+        CLWBuffer<RadeonRays::float4> instance_transforms;
+        // Set to non-zero by shading kernels for every base shape which has been hit
+        CLWBuffer<int> geometry_requests;
+        // BVH nodes of all curve shapes, see Shape::curve_root, and first control points of segments their leaves refer to
+        CLWBuffer<CurveNode> curve_nodes;
+        CLWBuffer<int> curve_segments;
+        // Indices of curve shapes in shapes buffer, the intersector does not know about them
+        CLWBuffer<int> curve_shapes;
+        int num_curve_shapes = 0;
 
         CLWBuffer<std::int32_t> material_attributes;
         CLWBuffer<Light> lights;
         CLWBuffer<Volume> volumes;
+        // Density and majorant grids of heterogeneous volumes at Volume::data offsets, see volumetrics.cl
+        CLWBuffer<int> volume_grids;
         CLWBuffer<Texture> textures;
         CLWBuffer<char> texturedata;
+        // Set to non-zero by kernels for every texture sampled from its low resolution copy, see kTextureNotResident
+        CLWBuffer<int> texture_requests;
+        // Image array of RGBA8 textures sampled with hardware filtering, see Texture::layer.
+        // Only set if ClwClass::UsesTextureImages, kernels take it right after texture_requests then.
+        std::shared_ptr<std::remove_pointer<cl_mem>::type> texture_images;
+        // Textures and revisions in texture_images layer order
+        std::vector<std::pair<std::shared_ptr<Baikal::Texture>, std::uint32_t>> texture_image_layers;
 
+        // Slot of camera_ring written by the last camera update, kernels read the camera from it
         CLWBuffer<Camera> camera;
+        std::vector<CLWBuffer<Camera>> camera_ring;
+        std::size_t camera_slot = 0;
         CLWBuffer<int> light_distributions;
+        // Area light of each emissive primitive, see WriteAreaLightMap in clw_scene_controller.cpp
+        CLWBuffer<int> area_light_map;
+        // Marginal and conditional distributions of environment light luminance
+        CLWBuffer<int> envmap_distribution;
+        // 9 SH coefficients of environment irradiance, zero unless built with BAIKAL_SH_IRRADIANCE
+        CLWBuffer<RadeonRays::float3> env_irradiance;
         CLWBuffer<InputMapData> input_map_data;
 
         std::unique_ptr<Bundle> material_bundle;
@@ -48,14 +102,147 @@ namespace Baikal
         std::unique_ptr<Bundle> input_map_leafs_bundle;
         std::unique_ptr<Bundle> input_map_bundle;
 
+        // Scene features kernels branch on, estimators build kernels without the code of absent ones
+        enum Feature : std::uint32_t
+        {
+            kFeatureVolumes = 1u << 0,
+            kFeatureEnvironmentLight = 1u << 1,
+            kFeatureAreaLights = 1u << 2,
+            kFeatureSingularLights = 1u << 3,
+
+            kFeatureAll = kFeatureVolumes | kFeatureEnvironmentLight | kFeatureAreaLights | kFeatureSingularLights
+        };
+
+        // Features present in the scene, set by the scene controller
+        std::uint32_t features = kFeatureAll;
+
+        // Number of entries in shapes buffer, instances follow them in shape index space
+        int num_base_shapes = 0;
         int num_lights;
         int num_volumes;
         int envmapidx;
         int background_idx;
         int camera_volume_index;
         CameraType camera_type;
+        // Views side by side in the outputs, see Camera::SetViews
+        int camera_num_views = 1;
+
+        // Texture and its data revision envmap_distribution has been built for
+        Baikal::Texture const* envmap_distribution_texture = nullptr;
+        std::uint32_t envmap_distribution_revision = 0;
+        // Texture and its data revision env_irradiance has been projected from
+        Baikal::Texture const* env_irradiance_texture = nullptr;
+        std::uint32_t env_irradiance_revision = 0;
+
+        // World space bounds of all the shapes
+        RadeonRays::bbox world_aabb;
 
         std::vector<RadeonRays::Shape*> isect_shapes;
         std::vector<RadeonRays::Shape*> visible_shapes;
+        // Position of every serialized shape in isect_shapes. Shape descriptors and then instance
+        // records follow the same order, so moved shapes are updated without sorting the scene again
+        std::unordered_map<Baikal::Shape const*, std::uint32_t> shape_slots;
+        // Base meshes of instances which are not in the scene themselves
+        std::vector<Baikal::Shape const*> excluded_meshes;
+
+        // Intersector shape of every mesh and instance. Shapes are kept between compiles, so only
+        // added ones and meshes with new geometry need their bottom level BVHs built.
+        struct IntersectorShape
+        {
+            RadeonRays::Shape* shape;
+            // Mesh geometry revision the shape has been created from
+            std::uint32_t revision;
+            // Intersector shape of the base mesh for instances, nullptr for meshes
+            RadeonRays::Shape* base;
+        };
+        std::map<std::shared_ptr<Baikal::Shape>, IntersectorShape> intersector_shapes;
+        // Intersector the shapes have been created in, background compiles use the one
+        // not being rendered with, so their acceleration structure is built on the worker
+        RadeonRays::IntersectionApi* intersector = nullptr;
+        // Shapes are attached to the intersector and committed, cleared once another scene takes it
+        bool intersector_attached = false;
+        // Triangles of meshes the intersector builds BVHs for and if instances need a two level structure
+        std::size_t intersector_triangles = 0;
+        bool intersector_two_level = false;
+        // Set once shapes or their transforms change after the first compile
+        bool shapes_edited = false;
+        // Structure chosen by the last intersector commit
+        AccelerationStructure acceleration_structure = AccelerationStructure::kBalanced;
+
+        // Location of mesh geometry in vertices/normals/uvs and indices buffers
+        struct GeometryRange
+        {
+            std::size_t vertex_offset;
+            std::size_t vertex_count;
+            // Index range is given in indices buffer elements
+            std::size_t index_offset;
+            std::size_t index_count;
+            bool short_indices;
+            // Mesh geometry revision the range content corresponds to
+            std::uint32_t revision;
+        };
+
+        // Geometry buffers are shared pools sub-allocated per mesh (see ClwResourceRegistry),
+        // every range here holds a reference to the pool entry of its revision
+        std::map<std::shared_ptr<Baikal::Mesh>, GeometryRange> geometry_ranges;
+
+        // Meshes in shapes buffer order
+        std::vector<std::shared_ptr<Baikal::Mesh>> base_meshes;
+        // With limited geometry cache only some of the meshes have geometry ranges.
+        // Every mesh known to the cache is here with the last residency update it has been hit in.
+        std::map<std::shared_ptr<Baikal::Mesh>, std::uint32_t> geometry_last_used;
+        std::uint32_t geometry_frame = 0;
+
+        // Timings, memory and counts of the last compile
+        SceneCompileStats compile_stats;
+
+        // Unique value assigned by every compile which has changed anything but the camera,
+        // estimators keeping data derived from the scene compare it between frames
+        std::uint32_t revision = 0;
+        // Unique value assigned by every camera update
+        std::uint32_t camera_revision = 0;
+
+        // Number of geometry bytes written to the device by the last shapes update
+        std::size_t geometry_bytes_uploaded = 0;
+
+        // Host copy of shapes buffer, allows to update descriptors without reading them back
+        std::vector<Shape> shape_descriptors;
+        // Host copies of instances and instance_transforms buffers
+        std::vector<ShapeInstance> instance_descriptors;
+        std::vector<RadeonRays::float4> instance_transform_data;
+
+        // Location of texture data in texturedata buffer
+        struct TextureSlot
+        {
+            // Offset and size in bytes, both are 16 bytes aligned
+            std::size_t offset;
+            std::size_t size;
+            // Texture data revision the slot content corresponds to
+            std::uint32_t revision;
+        };
+
+        // Texture data buffer is a shared pool sub-allocated per texture,
+        // every slot here holds a reference to the pool entry of its revision
+        std::map<std::shared_ptr<Baikal::Texture>, TextureSlot> texture_slots;
+
+        // Textures in textures buffer order
+        std::vector<std::shared_ptr<Baikal::Texture>> collected_textures;
+
+        // Low resolution copy of a texture, made again once texture data revision changes
+        struct TextureFallback
+        {
+            std::shared_ptr<Baikal::Texture> texture;
+            std::uint32_t revision;
+        };
+
+        // With limited texture cache only some of the large textures have slots, the rest is sampled
+        // from low resolution copies, which always have slots. Every texture known to the cache
+        // is here with the last residency update it has been sampled in.
+        std::map<std::shared_ptr<Baikal::Texture>, TextureFallback> texture_fallbacks;
+        std::map<std::shared_ptr<Baikal::Texture>, std::uint32_t> texture_last_used;
+        std::uint32_t texture_frame = 0;
+
+        // Number of texel bytes written to the device by the last textures update
+        std::size_t texture_bytes_uploaded = 0;
     };
 }
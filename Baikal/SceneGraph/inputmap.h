@@ -23,7 +23,9 @@ THE SOFTWARE.
 #pragma once
 
 #include <set>
+#include <vector>
 #include "SceneGraph/texture.h"
+#include "Utils/object_pool.h"
 #include "scene_object.h"
 
 namespace Baikal
@@ -76,10 +78,16 @@ namespace Baikal
         InputMapType m_type;
 
         InputMap(InputMapType t) : SceneObject(), m_type(t) {}
+
+        // Nodes are created with new by their Create functions, materials have lots of them
+        static void* operator new(std::size_t size) { return ObjectPool::Allocate(size); }
+        static void operator delete(void* ptr, std::size_t size) { ObjectPool::Deallocate(ptr, size); }
         // Collects set of textures from this object and all its inputs
         virtual void CollectTextures(std::set<Texture::Ptr> &textures) = 0;
         // Collects set of leafs from this object and all its inputs
         virtual void GetLeafs(std::set<Ptr> &leafs) {};
+        // Appends direct inputs of this object
+        virtual void GetInputs(std::vector<Ptr> &inputs) const {};
         // Checks if object is leaf or not
         virtual bool IsLeaf() const { return false;}
     };
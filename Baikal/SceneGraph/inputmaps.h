@@ -26,6 +26,8 @@ THE SOFTWARE.
 
 #include <assert.h>
 #include <array>
+#include <iterator>
+#include <map>
 
 #include "math/float3.h"
 #include "math/matrix.h"
@@ -173,6 +175,56 @@ namespace Baikal
             return Ptr(new InputMap_SamplerBumpMap(texture));
         }
 
+        // Derivative maps are uploaded instead of the height texture
+        void CollectTextures(std::set<Texture::Ptr> &textures) override
+        {
+            textures.insert(GetDerivativeTexture());
+            return;
+        }
+
+        // Derivative map of the height texture, see Texture::CreateDerivativeMap.
+        // UDIM sets get a set of tile derivative maps. Maps are rebuilt when height texels change.
+        Texture::Ptr GetDerivativeTexture() const
+        {
+            auto udim = std::dynamic_pointer_cast<UdimTexture>(m_texture);
+
+            if (!udim)
+            {
+                m_derivative_udim.reset();
+                auto derivatives = GetDerivativeMap(m_texture);
+                PruneDerivativeMaps();
+                return derivatives;
+            }
+
+            auto const& tiles = udim->GetTiles();
+            bool changed = !m_derivative_udim || m_derivative_udim->GetTiles().size() != tiles.size();
+
+            for (auto const& tile : tiles)
+            {
+                changed = GetDerivativeMap(tile.second) != (m_derivative_udim ? m_derivative_udim->GetTile(tile.first) : nullptr) || changed;
+            }
+
+            if (changed)
+            {
+                m_derivative_udim = UdimTexture::Create();
+
+                for (auto const& tile : tiles)
+                {
+                    m_derivative_udim->SetTile(tile.first, GetDerivativeMap(tile.second));
+                }
+            }
+
+            PruneDerivativeMaps();
+            return m_derivative_udim;
+        }
+
+        void SetTexture(Texture::Ptr texture) override
+        {
+            InputMap_Sampler::SetTexture(texture);
+            m_derivative_maps.clear();
+            m_derivative_udim.reset();
+        }
+
     protected:
         explicit InputMap_SamplerBumpMap(Texture::Ptr texture) :
             InputMap_Sampler(texture)
@@ -181,6 +233,44 @@ namespace Baikal
             m_type = InputMapType::kSamplerBumpmap;
         }
 
+    private:
+        struct DerivativeMap
+        {
+            std::uint32_t revision;
+            Texture::Ptr texture;
+            bool used;
+        };
+
+        Texture::Ptr GetDerivativeMap(Texture::Ptr const& height) const
+        {
+            auto& map = m_derivative_maps[height];
+
+            if (!map.texture || map.revision != height->GetDataRevision())
+            {
+                map.revision = height->GetDataRevision();
+                map.texture = height->CreateDerivativeMap();
+            }
+
+            map.used = true;
+            return map.texture;
+        }
+
+        // Drops maps of tiles no longer in the set
+        void PruneDerivativeMaps() const
+        {
+            for (auto iter = m_derivative_maps.begin(); iter != m_derivative_maps.end();)
+            {
+                iter = iter->second.used ? std::next(iter) : m_derivative_maps.erase(iter);
+            }
+
+            for (auto& map : m_derivative_maps)
+            {
+                map.second.used = false;
+            }
+        }
+
+        mutable std::map<Texture::Ptr, DerivativeMap> m_derivative_maps;
+        mutable UdimTexture::Ptr m_derivative_udim;
     };
     
     template<InputMap::InputMapType type>
@@ -245,6 +335,12 @@ namespace Baikal
             else m_b->GetLeafs(leafs);
         }
 
+        void GetInputs(std::vector<InputMap::Ptr> & inputs) const override
+        {
+            inputs.push_back(m_a);
+            inputs.push_back(m_b);
+        }
+
 
     protected:
         InputMap::Ptr m_a;
@@ -312,6 +408,11 @@ namespace Baikal
             else m_arg->GetLeafs(leafs);
         }
 
+        void GetInputs(std::vector<InputMap::Ptr> & inputs) const override
+        {
+            inputs.push_back(m_arg);
+        }
+
         void SetDirty(bool dirty) const override
         {
             SceneObject::SetDirty(dirty);
@@ -381,6 +482,12 @@ namespace Baikal
             else m_control->GetLeafs(leafs);
         }
 
+        void GetInputs(std::vector<InputMap::Ptr> & inputs) const override
+        {
+            InputMap_TwoArg::GetInputs(inputs);
+            inputs.push_back(m_control);
+        }
+
         void SetDirty(bool dirty) const override
         {
             InputMap_TwoArg::SetDirty(dirty);
@@ -612,6 +719,13 @@ namespace Baikal
             else m_data->GetLeafs(leafs);
         }
 
+        void GetInputs(std::vector<InputMap::Ptr> & inputs) const override
+        {
+            inputs.push_back(m_source_range);
+            inputs.push_back(m_destination_range);
+            inputs.push_back(m_data);
+        }
+
 
     private:
         InputMap::Ptr m_source_range;
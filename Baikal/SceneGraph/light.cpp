@@ -1,6 +1,7 @@
 #include "light.h"
 #include "SceneGraph/scene1.h"
 #include "SceneGraph/texture.h"
+#include "Utils/object_pool.h"
 
 namespace Baikal
 {
@@ -34,6 +35,11 @@ namespace Baikal
 
     std::unique_ptr<Iterator> Light::CreateTextureIterator() const
     {
+        if (m_profile)
+        {
+            return std::make_unique<ContainerIterator<std::set<Texture::Ptr>>>(std::set<Texture::Ptr>{ m_profile });
+        }
+
         return std::make_unique<EmptyIterator>();
     }
 
@@ -48,6 +54,28 @@ namespace Baikal
         SetDirty(true);
     }
 
+    std::uint32_t Light::GetLinkMask() const
+    {
+        return m_link_mask;
+    }
+
+    void Light::SetLinkMask(std::uint32_t mask)
+    {
+        m_link_mask = mask;
+        SetDirty(true);
+    }
+
+    Texture::Ptr Light::GetProfile() const
+    {
+        return m_profile;
+    }
+
+    void Light::SetProfile(Texture::Ptr profile)
+    {
+        m_profile = profile;
+        SetDirty(true);
+    }
+
     void SpotLight::SetConeShape(RadeonRays::float2 angles)
     {
         m_angles = angles;
@@ -180,15 +208,49 @@ namespace Baikal
     }
 
 
+    // Average profile value over directions within cos_outer of the light direction
+    static float GetProfileAverage(Texture const& profile, float cos_outer)
+    {
+        auto size = profile.GetSize();
+        auto sum = 0.f;
+        auto weight = 0.f;
+
+        for (auto y = 0; y < size.y; ++y)
+        {
+            auto theta = PI * (y + 0.5f) / size.y;
+
+            if (std::cos(theta) < cos_outer)
+            {
+                break;
+            }
+
+            // Solid angle of lat-long texel row
+            auto sin_theta = std::sin(theta);
+
+            for (auto x = 0; x < size.x; ++x)
+            {
+                sum += profile.GetTexel(x, y).x * sin_theta;
+            }
+
+            weight += size.x * sin_theta;
+        }
+
+        return weight > 0.f ? sum / weight : 0.f;
+    }
+
     RadeonRays::float3 PointLight::GetPower(Scene1 const& scene) const
     {
-        return 4.f * PI * GetEmittedRadiance();
+        auto profile = GetProfile();
+        auto scale = profile ? GetProfileAverage(*profile, -1.f) : 1.f;
+        return 4.f * PI * GetEmittedRadiance() * scale;
     }
 
     RadeonRays::float3 SpotLight::GetPower(Scene1 const& scene) const
     {
         auto cone = GetConeShape();
-        return 2.f * PI * GetEmittedRadiance() * (1.f - 0.5f * (cone.x + cone.y));
+        auto profile = GetProfile();
+        auto scale = profile ? GetProfileAverage(*profile, cone.y) : 1.f;
+        return 2.f * PI * GetEmittedRadiance() * (1.f - 0.5f * (cone.x + cone.y)) * scale;
     }
 
     RadeonRays::float3 DirectionalLight::GetPower(Scene1 const& scene) const
@@ -275,22 +337,22 @@ namespace Baikal
     }
     
     PointLight::Ptr PointLight::Create() {
-        return std::make_shared<PointLightConcrete>();
+        return MakePooled<PointLightConcrete>();
     }
     
     DirectionalLight::Ptr DirectionalLight::Create() {
-        return std::make_shared<DirectionalLightConcrete>();
+        return MakePooled<DirectionalLightConcrete>();
     }
     
     SpotLight::Ptr SpotLight::Create() {
-        return std::make_shared<SpotLightConcrete>();
+        return MakePooled<SpotLightConcrete>();
     }
     
     ImageBasedLight::Ptr ImageBasedLight::Create() {
-        return std::make_shared<ImageBasedLightConcrete>();
+        return MakePooled<ImageBasedLightConcrete>();
     }
     
     AreaLight::Ptr AreaLight::Create(Shape::Ptr shape, std::size_t idx) {
-        return std::make_shared<AreaLightConcrete>(shape, idx);
+        return MakePooled<AreaLightConcrete>(shape, idx);
     }
 }
@@ -73,6 +73,15 @@ namespace Baikal
         RadeonRays::float3 GetEmittedRadiance() const;
         void SetEmittedRadiance(RadeonRays::float3 const& e);
 
+        // Set and get link mask, the light illuminates only shapes sharing a bit with it
+        std::uint32_t GetLinkMask() const;
+        void SetLinkMask(std::uint32_t mask);
+
+        // Set and get lat-long intensity profile around the light direction, see Utils/ies_profile.h.
+        // Point and spot lights scale emitted radiance by it, the other lights ignore it.
+        Texture::Ptr GetProfile() const;
+        void SetProfile(Texture::Ptr profile);
+
         // Iterator for all the textures used by the light
         virtual std::unique_ptr<Iterator> CreateTextureIterator() const;
 
@@ -89,11 +98,16 @@ namespace Baikal
         RadeonRays::float3 m_d;
         // Emmited radiance
         RadeonRays::float3 m_e;
+        // Link mask
+        std::uint32_t m_link_mask;
+        // Intensity profile
+        Texture::Ptr m_profile;
     };
     
     inline Light::Light()
     : m_d(0.f, -1.f, 0.f)
     , m_e(1.f, 1.f, 1.f)
+    , m_link_mask(0xffffffffu)
     {
     }
     
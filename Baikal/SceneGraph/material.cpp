@@ -1,8 +1,10 @@
 #include "material.h"
 #include "iterator.h"
+#include "Utils/object_pool.h"
 
 #include <cassert>
 #include <memory>
+#include <stdexcept>
 
 namespace Baikal
 {
@@ -253,12 +255,73 @@ namespace Baikal
         return (GetInputValue("emission").float_value.sqnorm() != 0);
     }
 
+    void VolumeMaterial::SetDensityGrid(DensityGrid grid)
+    {
+        auto num_voxels = static_cast<std::size_t>(grid.resolution[0]) * grid.resolution[1] * grid.resolution[2];
+
+        if (num_voxels == 0 || grid.density.size() != num_voxels)
+        {
+            throw std::runtime_error("VolumeMaterial: density grid size does not match its resolution");
+        }
+
+        m_density_grid.reset(new DensityGrid(std::move(grid)));
+        m_sparse_density_grid.reset();
+        SetDirty(true);
+    }
+
+    std::uint32_t constexpr VolumeMaterial::SparseDensityGrid::kBrickSize;
+
+    void VolumeMaterial::SetSparseDensityGrid(SparseDensityGrid grid)
+    {
+        auto brick_voxels = SparseDensityGrid::kBrickSize * SparseDensityGrid::kBrickSize * SparseDensityGrid::kBrickSize;
+        auto num_bricks = grid.bricks.size() / 3;
+
+        if (grid.resolution[0] == 0 || grid.resolution[1] == 0 || grid.resolution[2] == 0)
+        {
+            throw std::runtime_error("VolumeMaterial: sparse density grid resolution should be positive");
+        }
+
+        if (grid.bricks.size() % 3 != 0 || grid.density.size() != num_bricks * brick_voxels)
+        {
+            throw std::runtime_error("VolumeMaterial: sparse density grid size does not match its number of bricks");
+        }
+
+        for (std::size_t i = 0; i < grid.bricks.size(); ++i)
+        {
+            if (grid.bricks[i] * SparseDensityGrid::kBrickSize >= grid.resolution[i % 3])
+            {
+                throw std::runtime_error("VolumeMaterial: sparse density grid brick is outside of its resolution");
+            }
+        }
+
+        m_sparse_density_grid.reset(new SparseDensityGrid(std::move(grid)));
+        m_density_grid.reset();
+        SetDirty(true);
+    }
+
+    void VolumeMaterial::ClearDensityGrid()
+    {
+        m_density_grid.reset();
+        m_sparse_density_grid.reset();
+        SetDirty(true);
+    }
+
+    VolumeMaterial::DensityGrid const* VolumeMaterial::GetDensityGrid() const
+    {
+        return m_density_grid.get();
+    }
+
+    VolumeMaterial::SparseDensityGrid const* VolumeMaterial::GetSparseDensityGrid() const
+    {
+        return m_sparse_density_grid.get();
+    }
+
     namespace {
         struct VolumeMaterialConcrete : public VolumeMaterial {
         };
     }
 
     VolumeMaterial::Ptr VolumeMaterial::Create() {
-        return std::make_shared<VolumeMaterialConcrete>();
+        return MakePooled<VolumeMaterialConcrete>();
     }
 }
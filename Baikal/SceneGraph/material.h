@@ -28,11 +28,14 @@
  */
 #pragma once
 
+#include <cstdint>
 #include <set>
 #include <unordered_map>
 #include <string>
 #include <memory>
+#include <vector>
 
+#include "math/bbox.h"
 #include "math/float3.h"
 
 #include "scene_object.h"
@@ -185,10 +188,56 @@ namespace Baikal
         using Ptr = std::shared_ptr<VolumeMaterial>;
         static Ptr Create();
 
+        // Voxel density of a heterogeneous volume
+        struct DensityGrid
+        {
+            // World space bounds, density is zero outside of them
+            RadeonRays::bbox bounds;
+            // Number of voxels along each axis
+            std::uint32_t resolution[3];
+            // Densities stored x first
+            std::vector<float> density;
+        };
+
+        // Density of a heterogeneous volume stored in bricks of kBrickSize^3 voxels,
+        // voxels outside of the bricks are empty
+        struct SparseDensityGrid
+        {
+            static std::uint32_t constexpr kBrickSize = 8u;
+
+            // World space bounds of the voxel index space, density is zero outside of them
+            RadeonRays::bbox bounds;
+            // Number of voxels along each axis
+            std::uint32_t resolution[3];
+            // Coordinates of the bricks in brick units (voxel coordinates divided by kBrickSize), three per brick
+            std::vector<std::uint32_t> bricks;
+            // kBrickSize^3 densities per brick stored x first, voxels past the resolution are ignored
+            std::vector<float> density;
+        };
+
         // Check if material has emissive components
         bool HasEmission() const override;
 
+        // Make volume heterogeneous, absorption, scattering and emission are scaled by the density
+        // trilinearly interpolated between voxel centers.
+        // Throws std::runtime_error if the number of densities does not match the resolution.
+        void SetDensityGrid(DensityGrid grid);
+        // Make volume heterogeneous with densities of a sparse grid, replaces the dense grid if any.
+        // Throws std::runtime_error if the resolution is empty, the number of densities does not match
+        // the number of bricks or a brick lies outside of the resolution.
+        void SetSparseDensityGrid(SparseDensityGrid grid);
+        // Make volume homogeneous again
+        void ClearDensityGrid();
+        // Density grid, nullptr for homogeneous volumes and sparse grids
+        DensityGrid const* GetDensityGrid() const;
+        // Sparse density grid, nullptr unless set by SetSparseDensityGrid
+        SparseDensityGrid const* GetSparseDensityGrid() const;
+
     protected:
         VolumeMaterial();
+
+    private:
+        std::unique_ptr<DensityGrid> m_density_grid;
+        std::unique_ptr<SparseDensityGrid> m_sparse_density_grid;
     };
 }
@@ -3,10 +3,13 @@
 #include "camera.h"
 #include "iterator.h"
 
+#include <algorithm>
+#include <iterator>
 #include <vector>
 #include <list>
 #include <cassert>
 #include <set>
+#include <unordered_set>
 
 namespace Baikal
 {
@@ -19,6 +22,9 @@ namespace Baikal
     {
         ShapeList m_shapes;
         LightList m_lights;
+        // Members of the lists, scenes with millions of instances can't afford a search per attach
+        std::unordered_set<Shape const*> m_shape_set;
+        std::unordered_set<Light const*> m_light_set;
         Camera::Ptr m_camera;
         Baikal::Texture::Ptr m_background_texture;
         EnvironmentOverride m_environment_override;
@@ -65,13 +71,8 @@ namespace Baikal
     {
         assert(light);
 
-        // Check if the light is already in the scene
-        LightList::const_iterator citer =  std::find(m_impl->m_lights.cbegin(),
-                                                     m_impl->m_lights.cend(),
-                                                     light);
-        
-        // And insert only if not
-        if (citer == m_impl->m_lights.cend())
+        // Insert only if the light is not in the scene yet
+        if (m_impl->m_light_set.insert(light.get()).second)
         {
             m_impl->m_lights.push_back(light);
 
@@ -81,15 +82,12 @@ namespace Baikal
 
     void Scene1::DetachLight(Light::Ptr light)
     {
-        // Check if the light is in the scene
-        LightList::const_iterator citer =  std::find(m_impl->m_lights.cbegin(),
-                                                     m_impl->m_lights.cend(),
-                                                     light);
-        
-        // And remove it if yes
-        if (citer != m_impl->m_lights.cend())
+        // Remove the light if it is in the scene, the list keeps attach order
+        if (m_impl->m_light_set.erase(light.get()))
         {
-            m_impl->m_lights.erase(citer);
+            // Lights are often detached in reverse order, e.g. by scene clears
+            auto riter = std::find(m_impl->m_lights.rbegin(), m_impl->m_lights.rend(), light);
+            m_impl->m_lights.erase(std::next(riter).base());
             
             SetDirtyFlag(kLights);
         }
@@ -105,18 +103,19 @@ namespace Baikal
         return std::make_unique<IteratorImpl<ShapeList::const_iterator>>
             (m_impl->m_shapes.begin(), m_impl->m_shapes.end());
     }
+
+    Scene1::Span<Shape::Ptr> Scene1::GetShapes() const
+    {
+        auto data = m_impl->m_shapes.data();
+        return Span<Shape::Ptr>(data, data + m_impl->m_shapes.size());
+    }
     
     void Scene1::AttachShape(Shape::Ptr shape)
     {
         assert(shape);
         
-        // Check if the shape is already in the scene
-        ShapeList::const_iterator citer =  std::find(m_impl->m_shapes.cbegin(),
-                                                     m_impl->m_shapes.cend(),
-                                                     shape);
-        
-        // And attach it if not
-        if (citer == m_impl->m_shapes.cend())
+        // Attach only if the shape is not in the scene yet
+        if (m_impl->m_shape_set.insert(shape.get()).second)
         {
             m_impl->m_shapes.push_back(shape);
             
@@ -128,15 +127,12 @@ namespace Baikal
     {
         assert(shape);
         
-        // Check if the shape is in the scene
-        ShapeList::const_iterator citer =  std::find(m_impl->m_shapes.cbegin(),
-                                                     m_impl->m_shapes.cend(),
-                                                     shape);
-        
-        // And detach if yes
-        if (citer != m_impl->m_shapes.cend())
+        // Detach the shape if it is in the scene, the list keeps attach order
+        if (m_impl->m_shape_set.erase(shape.get()))
         {
-            m_impl->m_shapes.erase(citer);
+            // Shapes are often detached in reverse order, e.g. by scene clears
+            auto riter = std::find(m_impl->m_shapes.rbegin(), m_impl->m_shapes.rend(), shape);
+            m_impl->m_shapes.erase(std::next(riter).base());
             
             SetDirtyFlag(kShapes);
         }
@@ -152,6 +148,12 @@ namespace Baikal
         return std::make_unique<IteratorImpl<LightList::const_iterator>>
             (m_impl->m_lights.begin(), m_impl->m_lights.end());
     }
+
+    Scene1::Span<Light::Ptr> Scene1::GetLights() const
+    {
+        auto data = m_impl->m_lights.data();
+        return Span<Light::Ptr>(data, data + m_impl->m_lights.size());
+    }
     
     bool Scene1::IsValid() const
     {
@@ -162,13 +164,10 @@ namespace Baikal
 
     RadeonRays::bbox Scene1::GetWorldAABB() const
     {
-        auto iter = CreateShapeIterator();
-
         RadeonRays::bbox result;
-        for (; iter->IsValid(); iter->Next())
+        for (auto const& shape : GetShapes())
         {
-            auto aabb = iter->ItemAs<Shape>()->GetWorldAABB();
-            result.grow(aabb);
+            result.grow(shape->GetWorldAABB());
         }
 
         return result;
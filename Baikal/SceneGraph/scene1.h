@@ -59,12 +59,32 @@ namespace Baikal
         using DirtyFlags = std::uint32_t;
         enum
         {
-            kNone,
-            kLights,
-            kShapes,
-            kShapeTransforms,
-            kCamera,
-            kBackground
+            kNone = 0,
+            kLights = (1 << 0),
+            kShapes = (1 << 1),
+            kShapeTransforms = (1 << 2),
+            kCamera = (1 << 3),
+            kBackground = (1 << 4)
+        };
+
+        // Contiguous view of attached objects in attach order, replaces iterators in loops over
+        // large scenes: no allocation, virtual calls or reference count changes per object.
+        // The view is invalidated by attaching or detaching objects of the same kind.
+        template <typename T>
+        class Span
+        {
+        public:
+            Span(T const* begin, T const* end) : m_begin(begin), m_end(end) {}
+
+            T const* begin() const { return m_begin; }
+            T const* end() const { return m_end; }
+            std::size_t size() const { return static_cast<std::size_t>(m_end - m_begin); }
+            bool empty() const { return m_begin == m_end; }
+            T const& operator [] (std::size_t idx) const { return m_begin[idx]; }
+
+        private:
+            T const* m_begin;
+            T const* m_end;
         };
 
         struct EnvironmentOverride
@@ -86,6 +106,8 @@ namespace Baikal
         std::size_t GetNumLights() const;
         // Get light iterator
         std::unique_ptr<Iterator> CreateLightIterator() const;
+        // Get attached lights
+        Span<Light::Ptr> GetLights() const;
         
         // Add or remove shapes
         void AttachShape(Shape::Ptr shape);
@@ -95,6 +117,8 @@ namespace Baikal
         std::size_t GetNumShapes() const;
         // Get shape iterator
         std::unique_ptr<Iterator> CreateShapeIterator() const;
+        // Get attached shapes
+        Span<Shape::Ptr> GetShapes() const;
 
         // Set and get camera
         void SetCamera(Camera::Ptr camera);
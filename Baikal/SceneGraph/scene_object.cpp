@@ -1,8 +1,13 @@
 #include "scene_object.h"
 
+#include <atomic>
+
 namespace Baikal
 {
-    std::uint32_t g_next_id = 0;
+    // Objects can be created from several threads at once
+    std::atomic<std::uint32_t> g_next_id(0);
+    // Edited from loader threads as well
+    std::atomic<std::uint64_t> g_change_count(0);
 
     SceneObject::SceneObject()
         : m_dirty(false), m_id(g_next_id++)
@@ -13,4 +18,14 @@ namespace Baikal
     {
         g_next_id = 0;
     }
+
+    std::uint64_t SceneObject::GetChangeCount()
+    {
+        return g_change_count.load(std::memory_order_acquire);
+    }
+
+    void SceneObject::RecordChange()
+    {
+        g_change_count.fetch_add(1, std::memory_order_release);
+    }
 }
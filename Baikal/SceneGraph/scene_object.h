@@ -28,6 +28,7 @@
  */
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <memory>
 #include <vector>
@@ -59,9 +60,17 @@ namespace Baikal
 
         static void ResetId();
 
+        // Position of the change journal shared by all scene objects. Objects append to the journal
+        // whenever they become dirty, so a position which has not moved since a scene compile means
+        // none of the objects has changed, whichever scene they belong to
+        static std::uint64_t GetChangeCount();
+
     protected:
         // Constructor
         SceneObject();
+
+        // Append a change tracked by a flag of its own, e.g. transforms or vertices, to the journal
+        static void RecordChange();
         
     private:
         mutable bool m_dirty;
@@ -83,6 +92,11 @@ namespace Baikal
     inline void SceneObject::SetDirty(bool dirty) const
     {
         m_dirty = dirty;
+
+        if (dirty)
+        {
+            RecordChange();
+        }
     }
     
     inline std::string SceneObject::GetName() const
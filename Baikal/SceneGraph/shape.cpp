@@ -1,20 +1,57 @@
 #include "shape.h"
+#include "Utils/object_pool.h"
 #include <cassert>
+#include <stdexcept>
 
 namespace Baikal
 {
+    namespace
+    {
+        template <typename T>
+        void ReleaseArray(std::vector<T>& array, std::size_t& num_released)
+        {
+            num_released = array.size();
+            std::vector<T>().swap(array);
+        }
+
+        template <typename T>
+        void RestoreArray(std::vector<T>& array, std::size_t& num_released, std::vector<T>&& data)
+        {
+            if (num_released > 0 && data.size() == num_released)
+            {
+                array = std::move(data);
+                num_released = 0;
+            }
+        }
+
+        template <typename T>
+        T const* GetArrayData(std::vector<T> const& array)
+        {
+            return array.empty() ? nullptr : array.data();
+        }
+    }
+
     Mesh::Mesh() :
-    m_aabb_cached(false)
+    m_num_released_vertices(0),
+    m_num_released_normals(0),
+    m_num_released_uvs(0),
+    m_num_released_indices(0),
+    m_aabb_cached(false),
+    m_geometry_revision(0),
+    m_vertices_dirty(false),
+    m_normals_dirty(false)
     {
     }
     
     void Mesh::SetIndices(std::uint32_t const* indices, std::size_t num_indices)
     {
+        ++m_geometry_revision;
         assert(indices);
         assert(num_indices != 0);
         
         // Resize internal array and copy data
         m_indices.resize(num_indices);
+        m_num_released_indices = 0;
         
         std::copy(indices, indices + num_indices, &m_indices[0]);
         
@@ -23,26 +60,32 @@ namespace Baikal
 
     void Mesh::SetIndices(std::vector<std::uint32_t>&& indices)
     {
+        ++m_geometry_revision;
         m_indices = std::move(indices);
+        m_num_released_indices = 0;
+
+        SetDirty(true);
     }
 
     std::size_t Mesh::GetNumIndices() const
     {
-        return m_indices.size();
+        return m_indices.empty() ? m_num_released_indices : m_indices.size();
         
     }
     std::uint32_t const* Mesh::GetIndices() const
     {
-        return &m_indices[0];
+        return GetArrayData(m_indices);
     }
     
     void Mesh::SetVertices(RadeonRays::float3 const* vertices, std::size_t num_vertices)
     {
+        ++m_geometry_revision;
         assert(vertices);
         assert(num_vertices != 0);
         
         // Resize internal array and copy data
         m_vertices.resize(num_vertices);
+        m_num_released_vertices = 0;
 
         std::copy(vertices, vertices + num_vertices, &m_vertices[0]);
 
@@ -51,11 +94,13 @@ namespace Baikal
     
     void Mesh::SetVertices(float const* vertices, std::size_t num_vertices)
     {
+        ++m_geometry_revision;
         assert(vertices);
         assert(num_vertices != 0);
         
         // Resize internal array and copy data
         m_vertices.resize(num_vertices);
+        m_num_released_vertices = 0;
         
         for (std::size_t i = 0; i < num_vertices; ++i)
         {
@@ -70,27 +115,33 @@ namespace Baikal
 
     void Mesh::SetVertices(std::vector<RadeonRays::float3>&& vertices)
     {
+        ++m_geometry_revision;
         m_vertices = std::move(vertices);
+        m_num_released_vertices = 0;
+
+        SetDirty(true);
     }
 
     
     std::size_t Mesh::GetNumVertices() const
     {
-        return m_vertices.size();
+        return m_vertices.empty() ? m_num_released_vertices : m_vertices.size();
     }
     
     RadeonRays::float3 const* Mesh::GetVertices() const
     {
-        return &m_vertices[0];
+        return GetArrayData(m_vertices);
     }
     
     void Mesh::SetNormals(RadeonRays::float3 const* normals, std::size_t num_normals)
     {
+        ++m_geometry_revision;
         assert(normals);
         assert(num_normals != 0);
         
         // Resize internal array and copy data
         m_normals.resize(num_normals);
+        m_num_released_normals = 0;
 
         std::copy(normals, normals + num_normals, &m_normals[0]);
 
@@ -99,11 +150,13 @@ namespace Baikal
     
     void Mesh::SetNormals(float const* normals, std::size_t num_normals)
     {
+        ++m_geometry_revision;
         assert(normals);
         assert(num_normals != 0);
         
         // Resize internal array and copy data
         m_normals.resize(num_normals);
+        m_num_released_normals = 0;
         
         for (std::size_t i = 0; i < num_normals; ++i)
         {
@@ -118,27 +171,33 @@ namespace Baikal
 
     void Mesh::SetNormals(std::vector<RadeonRays::float3>&& normals)
     {
+        ++m_geometry_revision;
         m_normals = std::move(normals);
+        m_num_released_normals = 0;
+
+        SetDirty(true);
     }
 
     
     std::size_t Mesh::GetNumNormals() const
     {
-        return m_normals.size();
+        return m_normals.empty() ? m_num_released_normals : m_normals.size();
     }
 
     RadeonRays::float3 const* Mesh::GetNormals() const
     {
-        return &m_normals[0];
+        return GetArrayData(m_normals);
     }
 
     void Mesh::SetUVs(RadeonRays::float2 const* uvs, std::size_t num_uvs)
     {
+        ++m_geometry_revision;
         assert(uvs);
         assert(num_uvs != 0);
         
         // Resize internal array and copy data
         m_uvs.resize(num_uvs);
+        m_num_released_uvs = 0;
 
         std::copy(uvs, uvs + num_uvs, &m_uvs[0]);
 
@@ -147,11 +206,13 @@ namespace Baikal
     
     void Mesh::SetUVs(float const* uvs, std::size_t num_uvs)
     {
+        ++m_geometry_revision;
         assert(uvs);
         assert(num_uvs != 0);
         
         // Resize internal array and copy data
         m_uvs.resize(num_uvs);
+        m_num_released_uvs = 0;
         
         for (std::size_t i = 0; i < num_uvs; ++i)
         {
@@ -164,17 +225,21 @@ namespace Baikal
 
     void Mesh::SetUVs(std::vector<RadeonRays::float2>&& uvs)
     {
+        ++m_geometry_revision;
         m_uvs = std::move(uvs);
+        m_num_released_uvs = 0;
+
+        SetDirty(true);
     }
 
     std::size_t Mesh::GetNumUVs() const
     {
-        return m_uvs.size();
+        return m_uvs.empty() ? m_num_released_uvs : m_uvs.size();
     }
     
     RadeonRays::float2 const* Mesh::GetUVs() const
     {
-        return &m_uvs[0];
+        return GetArrayData(m_uvs);
     }
 
     RadeonRays::bbox Shape::GetWorldAABB() const
@@ -206,6 +271,7 @@ namespace Baikal
 
     RadeonRays::bbox Mesh::GetLocalAABB() const
     {
+        // Box is kept while vertices are released
         if (!m_aabb_cached)
         {
             m_aabb = RadeonRays::bbox();
@@ -213,22 +279,222 @@ namespace Baikal
             {
                 m_aabb.grow(m_vertices[m_indices[i]]);
             }
+
+            // Without indices all the vertices are bounded
+            if (m_num_released_indices > 0)
+            {
+                for (auto const& vertex : m_vertices)
+                {
+                    m_aabb.grow(vertex);
+                }
+            }
+
             m_aabb_cached = true;
         }
 
         return m_aabb;
     }
 
+    void Mesh::UpdateVertices(RadeonRays::float3 const* vertices, std::size_t num_vertices,
+                              RadeonRays::float3 const* normals)
+    {
+        assert(vertices);
+
+        if (num_vertices != GetNumVertices() || (normals && num_vertices != GetNumNormals()))
+        {
+            throw std::runtime_error("Mesh::UpdateVertices(...): vertex count differs from the mesh one, use SetVertices");
+        }
+
+        // Released arrays are replaced, the uploaded ones stay in place on the device
+        if (m_vertices.empty())
+        {
+            m_vertices.resize(num_vertices);
+            m_num_released_vertices = 0;
+        }
+
+        if (normals && m_normals.empty())
+        {
+            m_normals.resize(num_vertices);
+            m_num_released_normals = 0;
+        }
+
+        std::copy(vertices, vertices + num_vertices, m_vertices.begin());
+
+        if (normals)
+        {
+            std::copy(normals, normals + num_vertices, m_normals.begin());
+            m_normals_dirty = true;
+        }
+
+        m_vertices_dirty = true;
+        m_aabb_cached = false;
+        RecordChange();
+    }
+
+    bool Mesh::IsVerticesDirty() const
+    {
+        return m_vertices_dirty;
+    }
+
+    void Mesh::SetVerticesDirty(bool dirty) const
+    {
+        m_vertices_dirty = dirty;
+        m_normals_dirty = m_normals_dirty && dirty;
+
+        if (dirty)
+        {
+            RecordChange();
+        }
+    }
+
+    bool Mesh::IsNormalsDirty() const
+    {
+        return m_normals_dirty;
+    }
+
+    std::uint32_t Mesh::GetGeometryRevision() const
+    {
+        return m_geometry_revision;
+    }
+
     void Mesh::SetDirty(bool dirty) const
     {
         Shape::SetDirty(dirty);
-        m_aabb_cached = false;
+
+        if (m_num_released_vertices == 0)
+        {
+            m_aabb_cached = false;
+        }
+    }
+
+    void Mesh::ReleaseData()
+    {
+        // Box can't be computed without vertices
+        GetLocalAABB();
+
+        ReleaseArray(m_vertices, m_num_released_vertices);
+        ReleaseArray(m_normals, m_num_released_normals);
+        ReleaseArray(m_uvs, m_num_released_uvs);
+        ReleaseArray(m_indices, m_num_released_indices);
+    }
+
+    bool Mesh::IsDataReleased() const
+    {
+        return m_num_released_vertices > 0 || m_num_released_normals > 0 ||
+            m_num_released_uvs > 0 || m_num_released_indices > 0;
+    }
+
+    void Mesh::RestoreData(std::vector<RadeonRays::float3>&& vertices, std::vector<RadeonRays::float3>&& normals,
+                           std::vector<RadeonRays::float2>&& uvs, std::vector<std::uint32_t>&& indices)
+    {
+        RestoreArray(m_vertices, m_num_released_vertices, std::move(vertices));
+        RestoreArray(m_normals, m_num_released_normals, std::move(normals));
+        RestoreArray(m_uvs, m_num_released_uvs, std::move(uvs));
+        RestoreArray(m_indices, m_num_released_indices, std::move(indices));
+    }
+
+    Curves::Curves() :
+    m_basis(Basis::kLinear)
+    {
+    }
+
+    void Curves::SetCurves(RadeonRays::float3 const* points, float const* widths, std::size_t num_points,
+                           std::uint32_t const* segments, std::size_t num_segments, Basis basis)
+    {
+        assert(points);
+        assert(widths);
+        assert(segments);
+
+        auto points_per_segment = GetPointsPerSegment(basis);
+
+        for (std::size_t i = 0; i < num_segments; ++i)
+        {
+            if (segments[i] + points_per_segment > num_points)
+            {
+                throw std::runtime_error("Curves::SetCurves(...): segment runs past the last control point");
+            }
+        }
+
+        // Radius goes to w, so it is uploaded along with the position
+        std::vector<RadeonRays::float3> vertices(points, points + num_points);
+        for (std::size_t i = 0; i < num_points; ++i)
+        {
+            vertices[i].w = 0.5f * widths[i];
+        }
+
+        m_basis = basis;
+        SetVertices(std::move(vertices));
+        SetIndices(std::vector<std::uint32_t>(segments, segments + num_segments));
+        SetDirty(true);
+    }
+
+    Curves::Basis Curves::GetBasis() const
+    {
+        return m_basis;
+    }
+
+    std::size_t Curves::GetNumSegments() const
+    {
+        return GetNumIndices();
+    }
+
+    std::size_t Curves::GetPointsPerSegment(Basis basis)
+    {
+        return basis == Basis::kBSpline ? 4u : 2u;
+    }
+
+    RadeonRays::bbox Curves::GetLocalAABB() const
+    {
+        RadeonRays::bbox result;
+        auto vertices = GetVertices();
+
+        for (std::size_t i = 0; i < GetNumVertices(); ++i)
+        {
+            // B-spline curve stays in the convex hull of its control points
+            auto r = RadeonRays::float3(vertices[i].w, vertices[i].w, vertices[i].w);
+            result.grow(vertices[i] - r);
+            result.grow(vertices[i] + r);
+        }
+
+        return result;
     }
 
     RadeonRays::bbox Instance::GetLocalAABB() const
     {
         return m_base_shape->GetLocalAABB();
     }
+
+    void Instance::SetLodLevels(std::vector<LodLevel> levels)
+    {
+        for (std::size_t i = 0; i < levels.size(); ++i)
+        {
+            if (!levels[i].mesh)
+            {
+                throw std::runtime_error("Instance::SetLodLevels(...): level has no mesh");
+            }
+
+            if (i > 0 && levels[i].min_screen_size > levels[i - 1].min_screen_size)
+            {
+                throw std::runtime_error("Instance::SetLodLevels(...): level thresholds have to decrease");
+            }
+        }
+
+        m_lod_levels = std::move(levels);
+        m_current_lod = 0;
+
+        if (!m_lod_levels.empty())
+        {
+            SetBaseShape(m_lod_levels[0].mesh);
+        }
+    }
+
+    void Instance::SetCurrentLod(std::size_t level)
+    {
+        assert(level < m_lod_levels.size());
+
+        m_current_lod = level;
+        SetBaseShape(m_lod_levels[level].mesh);
+    }
     
     namespace {
         struct InstanceConcrete : public Instance {
@@ -238,13 +504,20 @@ namespace Baikal
         
         struct MeshConcrete : public Mesh {
         };
+
+        struct CurvesConcrete : public Curves {
+        };
     }
     
     Mesh::Ptr Mesh::Create() {
-        return std::make_shared<MeshConcrete>();
+        return MakePooled<MeshConcrete>();
     }
     
+    Curves::Ptr Curves::Create() {
+        return MakePooled<CurvesConcrete>();
+    }
+
     Instance::Ptr Instance::Create(Shape::Ptr base_shape) {
-        return std::make_shared<InstanceConcrete>(base_shape);
+        return MakePooled<InstanceConcrete>(base_shape);
     }
 }
@@ -88,6 +88,19 @@ namespace Baikal
         void SetTransform(RadeonRays::matrix const& t);
         RadeonRays::matrix GetTransform() const;
 
+        // Set transform at shutter close, the shape moves from GetTransform() at shutter open.
+        // Motion is rigid: translation and rotation are interpolated, scale stays the shutter open one
+        void SetMotionTransform(RadeonRays::matrix const& t);
+        void ClearMotionTransform();
+        // Shapes without motion return their transform
+        RadeonRays::matrix GetMotionTransform() const;
+        bool HasMotion() const;
+
+        // Transform changes are tracked separately from other changes,
+        // so moving shapes does not require shape data to be rewritten
+        bool IsTransformDirty() const;
+        void SetTransformDirty(bool dirty) const;
+
         // Set whether a shape casts shadow or not
         void SetShadow(bool shadow);
         bool GetShadow() const;
@@ -96,6 +109,10 @@ namespace Baikal
         void SetVisibilityMask(std::uint32_t mask);
         std::uint32_t GetVisibilityMask() const;
 
+        // Set light link mask, the shape is lit only by lights sharing a bit with it
+        void SetLightLinkMask(std::uint32_t mask);
+        std::uint32_t GetLightLinkMask() const;
+
         // Local AABB
         virtual RadeonRays::bbox GetLocalAABB() const = 0;
         RadeonRays::bbox GetWorldAABB() const;
@@ -115,8 +132,15 @@ namespace Baikal
         VolumeMaterial::Ptr m_volume;
         // Transform
         RadeonRays::matrix m_transform;
+        // Transform at shutter close
+        RadeonRays::matrix m_motion_transform;
+        bool m_has_motion;
+        // Transform has been changed since last drop
+        mutable bool m_transform_dirty;
         // Visibility mask
         std::uint32_t m_visibility_mask;
+        // Light link mask
+        std::uint32_t m_light_link_mask;
         // Group id
         std::uint32_t m_group_id;
     };
@@ -146,6 +170,18 @@ namespace Baikal
         std::size_t GetNumVertices() const;
         RadeonRays::float3 const* GetVertices() const;
 
+        // Replace positions (and normals if given) of a deforming mesh keeping its topology.
+        // Vertex count has to match the current one, geometry revision is kept, so only
+        // positions are uploaded and the mesh BVH is rebuilt on next scene compile
+        void UpdateVertices(RadeonRays::float3 const* vertices, std::size_t num_vertices,
+                            RadeonRays::float3 const* normals = nullptr);
+
+        // Positions have been changed by UpdateVertices since last drop
+        bool IsVerticesDirty() const;
+        void SetVerticesDirty(bool dirty) const;
+        // Normals have been passed to UpdateVertices since last drop
+        bool IsNormalsDirty() const;
+
         // Set and get normal array
         void SetNormals(RadeonRays::float3 const* normals, std::size_t num_normals);
         void SetNormals(float const* normals, std::size_t num_normals);
@@ -164,6 +200,20 @@ namespace Baikal
         // Local space AABB
         RadeonRays::bbox GetLocalAABB() const override;
 
+        // Incremented by every index, vertex, normal or UV array change,
+        // allows to tell geometry edits from transform or material ones
+        std::uint32_t GetGeometryRevision() const;
+
+        // Free arrays keeping their sizes and the local AABB, e.g. once they are uploaded to the device.
+        // Released arrays read as null until they are restored or set again.
+        void ReleaseData();
+        // Check if any of the arrays is released
+        bool IsDataReleased() const;
+        // Put back released arrays, arrays of other sizes than the released ones are ignored.
+        // Geometry revision is kept, so the mesh is not reuploaded.
+        void RestoreData(std::vector<RadeonRays::float3>&& vertices, std::vector<RadeonRays::float3>&& normals,
+                         std::vector<RadeonRays::float2>&& uvs, std::vector<std::uint32_t>&& indices);
+
         // We need to override it since mesh changes trigger
         // m_aabb_cached flag reset
         void SetDirty(bool dirty) const override;
@@ -181,10 +231,65 @@ namespace Baikal
         std::vector<RadeonRays::float2> m_uvs;
         std::vector<std::uint32_t> m_indices;
 
+        // Sizes of arrays freed by ReleaseData, zero for arrays in memory
+        std::size_t m_num_released_vertices;
+        std::size_t m_num_released_normals;
+        std::size_t m_num_released_uvs;
+        std::size_t m_num_released_indices;
+
         mutable RadeonRays::bbox m_aabb;
         mutable bool m_aabb_cached;
+
+        std::uint32_t m_geometry_revision;
+
+        mutable bool m_vertices_dirty;
+        mutable bool m_normals_dirty;
     };
-    
+
+    /**
+     \brief Curves class.
+
+     Collection of curve segments with varying width, meant for hair and fur. Control points are
+     kept as mesh vertices with radius in w and every index is the first control point of a
+     segment, so curves share geometry storage and updates with meshes. Curves are intersected
+     by the renderer itself instead of being triangulated into ribbons, they have no normals and UVs.
+     */
+    class Curves : public Mesh
+    {
+    public:
+        using Ptr = std::shared_ptr<Curves>;
+        static Ptr Create();
+
+        enum class Basis
+        {
+            // Segments of 2 points
+            kLinear,
+            // Uniform cubic B-spline segments of 4 points, consecutive segments of a strand share 3 of them
+            kBSpline
+        };
+
+        // Set control points with their widths and first control point of every segment
+        void SetCurves(RadeonRays::float3 const* points, float const* widths, std::size_t num_points,
+                       std::uint32_t const* segments, std::size_t num_segments, Basis basis);
+
+        Basis GetBasis() const;
+        std::size_t GetNumSegments() const;
+        static std::size_t GetPointsPerSegment(Basis basis);
+
+        // Local space AABB, control points are grown by their radius
+        RadeonRays::bbox GetLocalAABB() const override;
+
+        // Forbidden stuff
+        Curves(Curves const&) = delete;
+        Curves& operator = (Curves const&) = delete;
+
+    protected:
+        Curves();
+
+    private:
+        Basis m_basis;
+    };
+
     inline Shape::~Shape()
     {
     }
@@ -192,7 +297,10 @@ namespace Baikal
     inline Shape::Shape() 
         : m_material(nullptr)
         , m_volume(nullptr)
+        , m_has_motion(false)
+        , m_transform_dirty(false)
         , m_visibility_mask(0xffffffffu)
+        , m_light_link_mask(0xffffffffu)
         , m_group_id(-1)
     {
     }
@@ -233,7 +341,7 @@ namespace Baikal
     inline void Shape::SetTransform(RadeonRays::matrix const& t)
     {
         m_transform = t;
-        SetDirty(true);
+        SetTransformDirty(true);
     }
 
     inline RadeonRays::matrix Shape::GetTransform() const
@@ -241,6 +349,44 @@ namespace Baikal
         return m_transform;
     }
 
+    inline void Shape::SetMotionTransform(RadeonRays::matrix const& t)
+    {
+        m_motion_transform = t;
+        m_has_motion = true;
+        SetTransformDirty(true);
+    }
+
+    inline void Shape::ClearMotionTransform()
+    {
+        m_has_motion = false;
+        SetTransformDirty(true);
+    }
+
+    inline RadeonRays::matrix Shape::GetMotionTransform() const
+    {
+        return m_has_motion ? m_motion_transform : m_transform;
+    }
+
+    inline bool Shape::HasMotion() const
+    {
+        return m_has_motion;
+    }
+
+    inline bool Shape::IsTransformDirty() const
+    {
+        return m_transform_dirty;
+    }
+
+    inline void Shape::SetTransformDirty(bool dirty) const
+    {
+        m_transform_dirty = dirty;
+
+        if (dirty)
+        {
+            RecordChange();
+        }
+    }
+
     inline void Shape::SetVisibilityMask(std::uint32_t mask)
     {
         m_visibility_mask = mask;
@@ -252,10 +398,23 @@ namespace Baikal
         return m_visibility_mask;
     }
 
+    inline void Shape::SetLightLinkMask(std::uint32_t mask)
+    {
+        m_light_link_mask = mask;
+        SetDirty(true);
+    }
+
+    inline std::uint32_t Shape::GetLightLinkMask() const
+    {
+        return m_light_link_mask;
+    }
+
     /**
     \brief Instance class.
 
     Instance references some mesh, but might have different transform and material.
+    Instances with levels of detail are bound to one of the level meshes by the scene
+    controller on every compile, depending on their projected size from the scene camera.
     */
     class Instance : public Shape
     {
@@ -267,6 +426,22 @@ namespace Baikal
         void SetBaseShape(Shape::Ptr base_shape);
         Shape::Ptr GetBaseShape() const;
 
+        // Level of detail, used while the projected size of the instance is at least min_screen_size
+        struct LodLevel
+        {
+            Mesh::Ptr mesh;
+            // Diameter of the instance bounding sphere in image height fractions
+            float min_screen_size;
+        };
+
+        // Set levels going from the finest one, thresholds have to decrease. Instance is bound to the
+        // first level until the next compile selects one, empty set turns selection off.
+        void SetLodLevels(std::vector<LodLevel> levels);
+        std::vector<LodLevel> const& GetLodLevels() const;
+        // Bind the instance to the level mesh
+        void SetCurrentLod(std::size_t level);
+        std::size_t GetCurrentLod() const;
+
         // Local space AABB
         RadeonRays::bbox GetLocalAABB() const override;
 
@@ -279,10 +454,13 @@ namespace Baikal
         
     private:
         Shape::Ptr m_base_shape;
+        std::vector<LodLevel> m_lod_levels;
+        std::size_t m_current_lod;
     };
 
     inline Instance::Instance(Shape::Ptr base_shape)
         : m_base_shape(base_shape)
+        , m_current_lod(0)
     {
     }
 
@@ -296,5 +474,15 @@ namespace Baikal
     {
         return m_base_shape;
     }
+
+    inline std::vector<Instance::LodLevel> const& Instance::GetLodLevels() const
+    {
+        return m_lod_levels;
+    }
+
+    inline std::size_t Instance::GetCurrentLod() const
+    {
+        return m_current_lod;
+    }
 }
 
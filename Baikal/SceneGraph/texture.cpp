@@ -1,9 +1,73 @@
 #include "texture.h"
 
 #include "Utils/half.h"
+#include "Utils/half_conversion.h"
+#include "Utils/texture_compression.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
 
 namespace Baikal
 {
+    // Normalized value of a texel of a single, two or three channel format
+    static RadeonRays::float3 GetChannelsTexel(char const* data, Texture::Format format, std::size_t idx)
+    {
+        switch (format) {
+        case Texture::Format::kR8:
+        {
+            float r = reinterpret_cast<std::uint8_t const*>(data)[idx] / 255.f;
+            return RadeonRays::float3(r, r, r);
+        }
+        case Texture::Format::kR16:
+        {
+            half hr;
+            hr.setBits(reinterpret_cast<std::uint16_t const*>(data)[idx]);
+            return RadeonRays::float3(hr, hr, hr);
+        }
+        case Texture::Format::kRg8:
+        {
+            auto texel = reinterpret_cast<std::uint8_t const*>(data) + 2 * idx;
+            return RadeonRays::float3(texel[0] / 255.f, texel[1] / 255.f, 0.f);
+        }
+        case Texture::Format::kRg16:
+        {
+            auto texel = reinterpret_cast<std::uint16_t const*>(data) + 2 * idx;
+
+            half hr, hg;
+            hr.setBits(texel[0]);
+            hg.setBits(texel[1]);
+
+            return RadeonRays::float3(hr, hg, 0.f);
+        }
+        case Texture::Format::kRgb8:
+        {
+            auto texel = reinterpret_cast<std::uint8_t const*>(data) + 3 * idx;
+            return RadeonRays::float3(texel[0] / 255.f, texel[1] / 255.f, texel[2] / 255.f);
+        }
+        case Texture::Format::kRgb16:
+        {
+            auto texel = reinterpret_cast<std::uint16_t const*>(data) + 3 * idx;
+
+            half hr, hg, hb;
+            hr.setBits(texel[0]);
+            hg.setBits(texel[1]);
+            hb.setBits(texel[2]);
+
+            return RadeonRays::float3(hr, hg, hb);
+        }
+        case Texture::Format::kRgb32:
+        {
+            auto texel = reinterpret_cast<float const*>(data) + 3 * idx;
+            return RadeonRays::float3(texel[0], texel[1], texel[2]);
+        }
+        default:
+            break;
+        }
+
+        return RadeonRays::float3();
+    }
+
     RadeonRays::float3 Texture::ComputeAverageValue() const
     {
         auto avg = RadeonRays::float3();
@@ -31,18 +95,19 @@ namespace Baikal
             auto data = reinterpret_cast<std::uint16_t*>(m_data.get());
             auto num_elements = m_size.x * m_size.y * m_size.z;
 
-            for (auto i = 0; i < num_elements; ++i)
-            {
-                auto r = data[4 * i];
-                auto g = data[4 * i + 1];
-                auto b = data[4 * i + 2];
+            // Convert in chunks to keep the temporary storage small
+            std::size_t constexpr kChunkSize = 4096;
+            std::vector<float> values(4 * kChunkSize);
 
-                half hr, hg, hb;
-                hr.setBits(r);
-                hg.setBits(g);
-                hb.setBits(b);
+            for (auto i = 0; i < num_elements; i += static_cast<int>(kChunkSize))
+            {
+                auto count = std::min(static_cast<std::size_t>(num_elements - i), kChunkSize);
+                HalfConversion::HalfToFloat(data + 4 * static_cast<std::size_t>(i), values.data(), 4 * count);
 
-                avg += RadeonRays::float3(hr, hg, hb);
+                for (std::size_t j = 0; j < count; ++j)
+                {
+                    avg += RadeonRays::float3(values[4 * j], values[4 * j + 1], values[4 * j + 2]);
+                }
             }
 
             avg *= (1.f / num_elements);
@@ -65,6 +130,44 @@ namespace Baikal
             avg *= (1.f / num_elements);
             break;
         }
+        case Format::kR8:
+        case Format::kR16:
+        case Format::kRg8:
+        case Format::kRg16:
+        case Format::kRgb8:
+        case Format::kRgb16:
+        case Format::kRgb32:
+        {
+            auto num_elements = m_size.x * m_size.y * m_size.z;
+
+            for (auto i = 0; i < num_elements; ++i)
+            {
+                avg += GetChannelsTexel(m_data.get(), m_format, i);
+            }
+
+            avg *= (1.f / num_elements);
+            break;
+        }
+        case Format::kBc1:
+        case Format::kBc5:
+        {
+            auto num_elements = m_size.x * m_size.y * m_size.z;
+            auto slice_size = GetSizeInBytes() / m_size.z;
+
+            for (auto z = 0; z < m_size.z; ++z)
+            {
+                for (auto y = 0; y < m_size.y; ++y)
+                {
+                    for (auto x = 0; x < m_size.x; ++x)
+                    {
+                        avg += TextureCompression::DecodeTexel(m_data.get() + slice_size * z, m_format, m_size.x, x, y);
+                    }
+                }
+            }
+
+            avg *= (1.f / num_elements);
+            break;
+        }
         default:
             break;
         }
@@ -72,12 +175,142 @@ namespace Baikal
         return avg;
     }
 
+    RadeonRays::float3 Texture::GetTexel(std::uint32_t x, std::uint32_t y) const
+    {
+        auto idx = y * m_size.x + x;
+
+        switch (m_format) {
+        case Format::kRgba8:
+        {
+            auto data = reinterpret_cast<std::uint8_t*>(m_data.get());
+            return RadeonRays::float3(data[4 * idx] / 255.f, data[4 * idx + 1] / 255.f, data[4 * idx + 2] / 255.f);
+        }
+        case Format::kRgba16:
+        {
+            auto data = reinterpret_cast<std::uint16_t*>(m_data.get());
+
+            half hr, hg, hb;
+            hr.setBits(data[4 * idx]);
+            hg.setBits(data[4 * idx + 1]);
+            hb.setBits(data[4 * idx + 2]);
+
+            return RadeonRays::float3(hr, hg, hb);
+        }
+        case Format::kRgba32:
+        {
+            auto data = reinterpret_cast<float*>(m_data.get());
+            return RadeonRays::float3(data[4 * idx], data[4 * idx + 1], data[4 * idx + 2]);
+        }
+        case Format::kR8:
+        case Format::kR16:
+        case Format::kRg8:
+        case Format::kRg16:
+        case Format::kRgb8:
+        case Format::kRgb16:
+        case Format::kRgb32:
+        {
+            return GetChannelsTexel(m_data.get(), m_format, idx);
+        }
+        case Format::kBc1:
+        case Format::kBc5:
+        {
+            return TextureCompression::DecodeTexel(m_data.get(), m_format, m_size.x, x, y);
+        }
+        default:
+            break;
+        }
+
+        return RadeonRays::float3();
+    }
+
+    Texture::Ptr Texture::CreateDerivativeMap() const
+    {
+        auto width = m_size.x;
+        auto height = m_size.y;
+
+        std::vector<float> heights(static_cast<std::size_t>(width) * height);
+
+        for (auto y = 0; y < height; ++y)
+        {
+            for (auto x = 0; x < width; ++x)
+            {
+                heights[y * width + x] = GetTexel(x, y).x;
+            }
+        }
+
+        std::vector<float> gradients(2 * heights.size());
+
+        for (auto y = 0; y < height; ++y)
+        {
+            auto y0 = std::max(y - 1, 0);
+            auto y1 = std::min(y + 1, height - 1);
+
+            for (auto x = 0; x < width; ++x)
+            {
+                auto x0 = std::max(x - 1, 0);
+                auto x1 = std::min(x + 1, width - 1);
+
+                auto h = [&](int i, int j) { return heights[j * width + i]; };
+
+                // Same kernel the bump sampler used to evaluate at every hit
+                auto gx = h(x0, y0) - h(x1, y0) + 2.f * h(x0, y) - 2.f * h(x1, y) + h(x0, y1) - h(x1, y1);
+                auto gy = h(x0, y0) + 2.f * h(x, y0) + h(x1, y0) - h(x0, y1) - 2.f * h(x, y1) - h(x1, y1);
+
+                gradients[2 * (y * width + x)] = gx;
+                gradients[2 * (y * width + x) + 1] = gy;
+            }
+        }
+
+        auto data = new char[sizeof(std::uint16_t) * gradients.size()];
+        HalfConversion::FloatToHalf(gradients.data(), reinterpret_cast<std::uint16_t*>(data), gradients.size());
+
+        return Create(data, RadeonRays::int3(width, height, 1), Format::kRg16);
+    }
+
+    void UdimTexture::SetTile(int tile, Texture::Ptr texture)
+    {
+        if (tile < kFirstTile || tile >= kFirstTile + kNumColumns * kMaxRows)
+        {
+            throw std::runtime_error("UdimTexture: tile number is out of range");
+        }
+
+        if (std::dynamic_pointer_cast<UdimTexture>(texture))
+        {
+            throw std::runtime_error("UdimTexture: tiles can't be UDIM sets");
+        }
+
+        if (texture)
+        {
+            m_tiles[tile] = texture;
+        }
+        else
+        {
+            m_tiles.erase(tile);
+        }
+
+        SetDirty(true);
+    }
+
+    Texture::Ptr UdimTexture::GetTile(int tile) const
+    {
+        auto iter = m_tiles.find(tile);
+        return iter != m_tiles.cend() ? iter->second : nullptr;
+    }
+
+    int UdimTexture::GetNumRows() const
+    {
+        return m_tiles.empty() ? 0 : (m_tiles.crbegin()->first - kFirstTile) / kNumColumns + 1;
+    }
+
     namespace {
         struct TextureConcrete : public Texture {
             TextureConcrete() = default;
             TextureConcrete(char* data, RadeonRays::int3 size, Format format) :
                 Texture(data, size, format) {}
         };
+
+        struct UdimTextureConcrete : public UdimTexture {
+        };
     }
 
     Texture::Ptr Texture::Create() {
@@ -87,4 +320,8 @@ namespace Baikal
     Texture::Ptr Texture::Create(char* data, RadeonRays::int3 size, Format format) {
         return std::make_shared<TextureConcrete>(data, size, format);
     }
+
+    UdimTexture::Ptr UdimTexture::Create() {
+        return std::make_shared<UdimTextureConcrete>();
+    }
 }
@@ -31,6 +31,8 @@
 #include "math/float3.h"
 #include "math/float2.h"
 #include "math/int3.h"
+#include <cstdint>
+#include <map>
 #include <memory>
 #include <string>
 
@@ -52,7 +54,21 @@ namespace Baikal
         {
             kRgba8,
             kRgba16,
-            kRgba32
+            kRgba32,
+            // Single and two channel formats for scalar inputs: one channel is replicated to RGBA on sampling,
+            // two channels give (r, g, 0, 0). 16 bit formats are half floats.
+            kR8,
+            kR16,
+            kRg8,
+            kRg16,
+            // Three channel formats as stored in image files, expanded to RGBA with zero alpha on upload
+            kRgb8,
+            kRgb16,
+            kRgb32,
+            // Block compressed formats, see Utils/texture_compression.h.
+            // BC1 keeps RGB in 4 bits per texel, BC5 keeps two channel normal maps in 8 bits per texel.
+            kBc1,
+            kBc5
         };
 
         using Ptr = std::shared_ptr<Texture>;
@@ -64,6 +80,8 @@ namespace Baikal
 
         // Set data
         void SetData(char* data, RadeonRays::int3 size, Format format);
+        // Move data of the other texture into this one, e.g. to fill a placeholder, the other texture is left empty
+        void TakeData(Texture& other);
 
         // Get texture dimensions
         RadeonRays::int3 GetSize() const;
@@ -73,9 +91,26 @@ namespace Baikal
         Format GetFormat() const;
         // Get data size in bytes
         std::size_t GetSizeInBytes() const;
+        // Check if texels are stored in 4x4 blocks
+        bool IsCompressed() const;
+        // Incremented by every SetData call, allows to tell which textures need to be reuploaded
+        std::uint32_t GetDataRevision() const;
+
+        // Free texel data keeping size and format, e.g. once it is uploaded to the device.
+        // Data reads as null until it is restored or set again.
+        void ReleaseData();
+        bool IsDataReleased() const;
+        // Put back GetSizeInBytes() bytes of released texel data, texture takes ownership of the array.
+        // Data revision is kept, so the texture is not reuploaded.
+        void RestoreData(char* data);
 
         // Average normalized value
         RadeonRays::float3 ComputeAverageValue() const;
+        // Normalized value of a texel in the first slice
+        RadeonRays::float3 GetTexel(std::uint32_t x, std::uint32_t y) const;
+        // Two half channel map of Sobel gradients of the first channel of the first slice, edges are clamped.
+        // Bump maps are sampled from it by a single filtered fetch, see Texture_SampleBump.
+        Ptr CreateDerivativeMap() const;
 
         // Disallow copying
         Texture(Texture const&) = delete;
@@ -94,12 +129,51 @@ namespace Baikal
         RadeonRays::int3 m_size;
         // Format
         Format m_format;
+        // Data revision
+        std::uint32_t m_data_revision;
+        // Data has been freed by ReleaseData
+        bool m_data_released;
+    };
+
+    /**
+     \brief UDIM texture set.
+
+     Tiles are regular textures addressed by UDIM numbers 1001 + u + 10 * v. Sampling picks the tile
+     containing the UV coordinates and samples it at their fractional part, so materials reference
+     the whole set through a single texture. Texel data of the set itself is unused and missing tiles are black.
+     */
+    class UdimTexture : public Texture
+    {
+    public:
+        using Ptr = std::shared_ptr<UdimTexture>;
+        static Ptr Create();
+
+        // Number of the tile at the UV origin, tiles are in rows of kNumColumns
+        static int const kFirstTile = 1001;
+        static int const kNumColumns = 10;
+        static int const kMaxRows = 100;
+
+        // Set tile texture, nullptr removes the tile
+        void SetTile(int tile, Texture::Ptr texture);
+        Texture::Ptr GetTile(int tile) const;
+        // Tiles by tile number
+        std::map<int, Texture::Ptr> const& GetTiles() const { return m_tiles; }
+        // Number of tile rows up to the last tile
+        int GetNumRows() const;
+
+    protected:
+        UdimTexture() = default;
+
+    private:
+        std::map<int, Texture::Ptr> m_tiles;
     };
 
     inline Texture::Texture()
         : m_data(new char[16])
         , m_size(2, 2, 1)
         , m_format(Format::kRgba8)
+        , m_data_revision(0)
+        , m_data_released(false)
     {
         // Create checkerboard by default
         m_data[0] = m_data[1] = m_data[2] = m_data[3] = (char)0xFF;
@@ -112,6 +186,8 @@ namespace Baikal
         : m_data(data)
         , m_size(size)
         , m_format(format)
+        , m_data_revision(0)
+        , m_data_released(false)
     {
         if (size.z == 0)
         {
@@ -130,9 +206,18 @@ namespace Baikal
         }
 
         m_format = format;
+        m_data_released = false;
+        ++m_data_revision;
         SetDirty(true);
     }
 
+    inline void Texture::TakeData(Texture& other)
+    {
+        auto size = other.m_size;
+        SetData(other.m_data.release(), size, other.m_format);
+        other.m_size = RadeonRays::int3(0, 0, 1);
+    }
+
     inline RadeonRays::int3 Texture::GetSize() const
     {
         return m_size;
@@ -143,14 +228,48 @@ namespace Baikal
         return m_data.get();
     }
 
+    inline std::uint32_t Texture::GetDataRevision() const
+    {
+        return m_data_revision;
+    }
+
+    inline void Texture::ReleaseData()
+    {
+        m_data.reset();
+        m_data_released = true;
+    }
+
+    inline bool Texture::IsDataReleased() const
+    {
+        return m_data_released;
+    }
+
+    inline void Texture::RestoreData(char* data)
+    {
+        m_data.reset(data);
+        m_data_released = false;
+    }
+
     inline Texture::Format Texture::GetFormat() const
     {
         return m_format;
     }
 
+    inline bool Texture::IsCompressed() const
+    {
+        return m_format == Format::kBc1 || m_format == Format::kBc5;
+    }
+
     inline std::size_t Texture::GetSizeInBytes() const
     {
+        if (IsCompressed())
+        {
+            std::size_t block_size = m_format == Format::kBc1 ? 8 : 16;
+            return block_size * ((m_size.x + 3) / 4) * ((m_size.y + 3) / 4) * m_size.z;
+        }
+
         std::uint32_t component_size = 1;
+        std::uint32_t num_components = 4;
 
         switch (m_format) {
         case Format::kRgba8:
@@ -162,10 +281,35 @@ namespace Baikal
         case Format::kRgba32:
             component_size = 4;
             break;
+        case Format::kR8:
+            num_components = 1;
+            break;
+        case Format::kR16:
+            component_size = 2;
+            num_components = 1;
+            break;
+        case Format::kRg8:
+            num_components = 2;
+            break;
+        case Format::kRg16:
+            component_size = 2;
+            num_components = 2;
+            break;
+        case Format::kRgb8:
+            num_components = 3;
+            break;
+        case Format::kRgb16:
+            component_size = 2;
+            num_components = 3;
+            break;
+        case Format::kRgb32:
+            component_size = 4;
+            num_components = 3;
+            break;
         default:
             break;
         }
 
-        return 4 * component_size * m_size.x * m_size.y * m_size.z;
+        return num_components * component_size * m_size.x * m_size.y * m_size.z;
     }
 }
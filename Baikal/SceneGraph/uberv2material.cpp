@@ -22,6 +22,7 @@ THE SOFTWARE.
 
 #include "uberv2material.h"
 #include "inputmaps.h"
+#include "Utils/object_pool.h"
 
 using namespace Baikal;
 using namespace RadeonRays;
@@ -33,10 +34,11 @@ namespace
 }
 
 UberV2Material::Ptr UberV2Material::Create() {
-    return std::make_shared<UberV2MaterialConcrete>();
+    return MakePooled<UberV2MaterialConcrete>();
 }
 
 UberV2Material::UberV2Material()
+    : sss_mode_(kSSSRandomWalk)
 {
     using namespace RadeonRays;
 
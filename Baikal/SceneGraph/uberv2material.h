@@ -44,6 +44,11 @@ namespace Baikal
             kEmissionSinglesided = 1U,
             kEmissionDoublesided = 2U
         };
+        enum SSSMode
+        {
+            kSSSRandomWalk = 1U,
+            kSSSDiffusion = 2U
+        };
 
         enum Layers
         {
@@ -96,6 +101,18 @@ namespace Baikal
             return is_multiscatter_;
         }
 
+        // Sets how SSS layer scatters light under the surface. Diffusion mode replaces the diffuse
+        // layer by a diffusion profile, probe rays against the same shape find the exit points.
+        void SetSSSMode(SSSMode sss_mode)
+        {
+            sss_mode_ = sss_mode;
+        }
+        // Returns SSS mode
+        SSSMode GetSSSMode() const
+        {
+            return sss_mode_;
+        }
+
         // Sets layers that should be enabled in material
         void SetLayers(std::uint32_t layers);
 
@@ -112,6 +129,7 @@ namespace Baikal
         bool is_link_to_reflection_;
         bool is_double_sided_;
         bool is_multiscatter_;
+        SSSMode sss_mode_;
         std::uint32_t layers_;
         std::set<std::string> m_active_inputs;
 
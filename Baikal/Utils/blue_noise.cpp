@@ -0,0 +1,174 @@
+#include "blue_noise.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace Baikal
+{
+    namespace
+    {
+        // Void-and-cluster blue noise generator (R. Ulichney, 1993)
+        class VoidAndCluster
+        {
+        public:
+            explicit VoidAndCluster(std::uint32_t size)
+                : m_size(size)
+                , m_pattern(size * size, false)
+                , m_energy(size * size, 0.f)
+                , m_filter(size * size)
+            {
+                // Toroidal gaussian energy filter
+                float const sigma = 1.5f;
+                for (auto y = 0u; y < size; ++y)
+                {
+                    for (auto x = 0u; x < size; ++x)
+                    {
+                        auto dx = (float)std::min(x, size - x);
+                        auto dy = (float)std::min(y, size - y);
+                        m_filter[x + size * y] = std::exp(-(dx * dx + dy * dy) / (2.f * sigma * sigma));
+                    }
+                }
+            }
+
+            void Toggle(std::uint32_t idx)
+            {
+                m_pattern[idx] = !m_pattern[idx];
+                auto sign = m_pattern[idx] ? 1.f : -1.f;
+
+                auto px = idx % m_size;
+                auto py = idx / m_size;
+
+                for (auto y = 0u; y < m_size; ++y)
+                {
+                    auto dy = (y + m_size - py) % m_size;
+                    for (auto x = 0u; x < m_size; ++x)
+                    {
+                        auto dx = (x + m_size - px) % m_size;
+                        m_energy[x + m_size * y] += sign * m_filter[dx + m_size * dy];
+                    }
+                }
+            }
+
+            // Set pixel with the highest energy
+            std::uint32_t FindTightestCluster() const
+            {
+                return FindExtremum(true);
+            }
+
+            // Empty pixel with the lowest energy
+            std::uint32_t FindLargestVoid() const
+            {
+                return FindExtremum(false);
+            }
+
+            bool IsSet(std::uint32_t idx) const
+            {
+                return m_pattern[idx];
+            }
+
+        private:
+            std::uint32_t FindExtremum(bool set) const
+            {
+                auto best_idx = 0u;
+                auto best_energy = set ? -std::numeric_limits<float>::max() : std::numeric_limits<float>::max();
+
+                for (auto i = 0u; i < m_size * m_size; ++i)
+                {
+                    if (m_pattern[i] != set)
+                        continue;
+
+                    if (set ? (m_energy[i] > best_energy) : (m_energy[i] < best_energy))
+                    {
+                        best_energy = m_energy[i];
+                        best_idx = i;
+                    }
+                }
+
+                return best_idx;
+            }
+
+            std::uint32_t m_size;
+            std::vector<bool> m_pattern;
+            std::vector<float> m_energy;
+            std::vector<float> m_filter;
+        };
+
+        std::vector<std::uint32_t> GenerateBlueNoiseTile(std::uint32_t size)
+        {
+            auto num_pixels = size * size;
+            auto num_initial = num_pixels / 10;
+
+            // Fixed seed keeps renders reproducible
+            std::mt19937 rng(0x2545f491u);
+
+            // Initial binary pattern: random points relaxed by moving the tightest cluster into the largest void
+            VoidAndCluster prototype(size);
+            for (auto i = 0u; i < num_initial;)
+            {
+                auto idx = rng() % num_pixels;
+                if (!prototype.IsSet(idx))
+                {
+                    prototype.Toggle(idx);
+                    ++i;
+                }
+            }
+
+            for (;;)
+            {
+                auto cluster = prototype.FindTightestCluster();
+                prototype.Toggle(cluster);
+                auto void_idx = prototype.FindLargestVoid();
+
+                if (void_idx == cluster)
+                {
+                    prototype.Toggle(cluster);
+                    break;
+                }
+
+                prototype.Toggle(void_idx);
+            }
+
+            std::vector<std::uint32_t> ranks(num_pixels);
+
+            // Rank initial points by removing tightest clusters
+            {
+                auto pattern = prototype;
+                for (auto rank = num_initial; rank > 0; --rank)
+                {
+                    auto cluster = pattern.FindTightestCluster();
+                    pattern.Toggle(cluster);
+                    ranks[cluster] = rank - 1;
+                }
+            }
+
+            // Rank remaining pixels by filling largest voids
+            {
+                auto pattern = prototype;
+                for (auto rank = num_initial; rank < num_pixels; ++rank)
+                {
+                    auto void_idx = pattern.FindLargestVoid();
+                    pattern.Toggle(void_idx);
+                    ranks[void_idx] = rank;
+                }
+            }
+
+            // Map ranks to 32-bit range, low bits are jittered within the rank interval
+            std::vector<std::uint32_t> tile(num_pixels);
+            auto step = (std::uint32_t)((1ull << 32) / num_pixels);
+            for (auto i = 0u; i < num_pixels; ++i)
+            {
+                tile[i] = ranks[i] * step + (std::uint32_t)(rng() % step);
+            }
+
+            return tile;
+        }
+    }
+
+    std::vector<std::uint32_t> const& GetBlueNoiseTile()
+    {
+        static std::vector<std::uint32_t> const tile = GenerateBlueNoiseTile(kBlueNoiseTileSize);
+        return tile;
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Baikal
+{
+    ///< Size of the blue noise tile (in pixels along each axis)
+    static std::uint32_t const kBlueNoiseTileSize = 64u;
+
+    ///< Returns kBlueNoiseTileSize x kBlueNoiseTileSize tile of blue noise values
+    ///< uniformly covering 32-bit unsigned range. The tile is generated once
+    ///< with void-and-cluster method and is seamlessly tileable.
+    ///<
+    std::vector<std::uint32_t> const& GetBlueNoiseTile();
+}
@@ -23,6 +23,7 @@ THE SOFTWARE.
 #include <assert.h>
 
 #include <array>
+#include <cmath>
 
 #include "cl_inputmap_generator.h"
 #include "SceneGraph/uberv2material.h"
@@ -52,6 +53,11 @@ void CLInputMapGenerator::Generate(const Collector& input_map_collector, const C
     m_float_selector = float_selector_header;
 
     m_generated_inputs.clear();
+    m_canonical_keys.clear();
+    m_canonical.clear();
+
+    // Matrix rows and folded constants follow the leafs in input map data
+    GetDataOffsets(input_map_collector, input_map_leaf_collector, m_matrix_offsets, m_constant_offsets);
 
     // We need to guarantee order. So sort it by id using map
     std::map <uint32_t, InputMap::Ptr> inputs;
@@ -74,6 +80,470 @@ void CLInputMapGenerator::Generate(const Collector& input_map_collector, const C
     m_source_code += footer;
 }
 
+std::vector<InputMap::Ptr> CLInputMapGenerator::CollectMatrices(const Collector& input_map_collector)
+{
+    // Sorted by id, so the layout does not depend on collection order
+    std::map<uint32_t, InputMap::Ptr> matrices;
+    std::vector<InputMap::Ptr> stack;
+
+    auto input_iter = input_map_collector.CreateIterator();
+    for (; input_iter->IsValid(); input_iter->Next())
+    {
+        stack.push_back(input_iter->ItemAs<InputMap>());
+    }
+
+    while (!stack.empty())
+    {
+        auto input = stack.back();
+        stack.pop_back();
+
+        if (input->m_type == InputMap::InputMapType::kMatMul)
+        {
+            matrices.emplace(input->GetId(), input);
+        }
+
+        input->GetInputs(stack);
+    }
+
+    std::vector<InputMap::Ptr> result;
+    result.reserve(matrices.size());
+
+    for (auto& matrix : matrices)
+    {
+        result.push_back(matrix.second);
+    }
+
+    return result;
+}
+
+// Checks if input map doesn't depend on samplers, results are cached in constants
+static bool IsConstant(InputMap::Ptr const& input, std::map<InputMap const*, bool>& constants)
+{
+    auto iter = constants.find(input.get());
+    if (iter != constants.end())
+    {
+        return iter->second;
+    }
+
+    bool constant = true;
+
+    if (input->m_type == InputMap::InputMapType::kSampler || input->m_type == InputMap::InputMapType::kSamplerBumpmap)
+    {
+        constant = false;
+    }
+    else
+    {
+        std::vector<InputMap::Ptr> inputs;
+        input->GetInputs(inputs);
+
+        for (auto& arg : inputs)
+        {
+            constant = IsConstant(arg, constants) && constant;
+        }
+    }
+
+    constants.emplace(input.get(), constant);
+    return constant;
+}
+
+std::vector<InputMap::Ptr> CLInputMapGenerator::CollectConstantSubtrees(const Collector& input_map_collector)
+{
+    // Sorted by id, so the layout does not depend on collection order
+    std::map<uint32_t, InputMap::Ptr> subtrees;
+    std::map<InputMap const*, bool> constants;
+    std::set<InputMap const*> visited;
+    std::vector<InputMap::Ptr> stack;
+
+    auto input_iter = input_map_collector.CreateIterator();
+    for (; input_iter->IsValid(); input_iter->Next())
+    {
+        stack.push_back(input_iter->ItemAs<InputMap>());
+    }
+
+    while (!stack.empty())
+    {
+        auto input = stack.back();
+        stack.pop_back();
+
+        if (!visited.insert(input.get()).second)
+        {
+            continue;
+        }
+
+        if (!IsConstant(input, constants))
+        {
+            input->GetInputs(stack);
+        }
+        // Leafs are read directly, larger subtrees are folded
+        else if (!input->IsLeaf())
+        {
+            subtrees.emplace(input->GetId(), input);
+        }
+    }
+
+    std::vector<InputMap::Ptr> result;
+    result.reserve(subtrees.size());
+
+    for (auto& subtree : subtrees)
+    {
+        result.push_back(subtree.second);
+    }
+
+    return result;
+}
+
+namespace
+{
+    using Value = std::array<float, 4>;
+
+    template <typename F>
+    Value Map(Value const& a, F f)
+    {
+        return { f(a[0]), f(a[1]), f(a[2]), f(a[3]) };
+    }
+
+    template <typename F>
+    Value Map(Value const& a, Value const& b, F f)
+    {
+        return { f(a[0], b[0]), f(a[1], b[1]), f(a[2], b[2]), f(a[3], b[3]) };
+    }
+
+    Value Splat(float value)
+    {
+        return { value, value, value, value };
+    }
+
+    float Dot(Value const& a, Value const& b, int num_components)
+    {
+        float result = 0.f;
+
+        for (auto i = 0; i < num_components; ++i)
+        {
+            result += a[i] * b[i];
+        }
+
+        return result;
+    }
+
+    Value Cross(Value const& a, Value const& b)
+    {
+        return { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0], 0.f };
+    }
+
+    Value Evaluate(InputMap::Ptr const& input)
+    {
+        switch (input->m_type)
+        {
+            case InputMap::InputMapType::kConstantFloat:
+            {
+                auto value = static_cast<InputMap_ConstantFloat*>(input.get())->GetValue();
+                return { value, value, value, 0.f };
+            }
+            case InputMap::InputMapType::kConstantFloat3:
+            {
+                auto value = static_cast<InputMap_ConstantFloat3*>(input.get())->GetValue();
+                return { value.x, value.y, value.z, 0.f };
+            }
+            case InputMap::InputMapType::kAdd:
+            case InputMap::InputMapType::kSub:
+            case InputMap::InputMapType::kMul:
+            case InputMap::InputMapType::kDiv:
+            case InputMap::InputMapType::kMin:
+            case InputMap::InputMapType::kMax:
+            case InputMap::InputMapType::kDot3:
+            case InputMap::InputMapType::kDot4:
+            case InputMap::InputMapType::kCross3:
+            case InputMap::InputMapType::kCross4:
+            case InputMap::InputMapType::kPow:
+            case InputMap::InputMapType::kMod:
+            case InputMap::InputMapType::kShuffle2:
+            {
+                std::vector<InputMap::Ptr> inputs;
+                input->GetInputs(inputs);
+                auto a = Evaluate(inputs[0]);
+                auto b = Evaluate(inputs[1]);
+
+                switch (input->m_type)
+                {
+                    case InputMap::InputMapType::kAdd: return Map(a, b, [](float x, float y) { return x + y; });
+                    case InputMap::InputMapType::kSub: return Map(a, b, [](float x, float y) { return x - y; });
+                    case InputMap::InputMapType::kMul: return Map(a, b, [](float x, float y) { return x * y; });
+                    case InputMap::InputMapType::kDiv: return Map(a, b, [](float x, float y) { return x / y; });
+                    case InputMap::InputMapType::kMin: return Map(a, b, [](float x, float y) { return std::fmin(x, y); });
+                    case InputMap::InputMapType::kMax: return Map(a, b, [](float x, float y) { return std::fmax(x, y); });
+                    case InputMap::InputMapType::kDot3: return { Dot(a, b, 3), 0.f, 0.f, 0.f };
+                    case InputMap::InputMapType::kDot4: return { Dot(a, b, 4), 0.f, 0.f, 0.f };
+                    case InputMap::InputMapType::kCross3:
+                    case InputMap::InputMapType::kCross4: return Cross(a, b);
+                    case InputMap::InputMapType::kPow: return Map(a, [&b](float x) { return std::pow(x, b[0]); });
+                    case InputMap::InputMapType::kMod: return Map(a, b, [](float x, float y) { return std::fmod(x, y); });
+                    default:
+                    {
+                        auto mask = static_cast<InputMap_Shuffle2*>(input.get())->GetMask();
+                        Value result;
+
+                        for (auto i = 0u; i < 4; ++i)
+                        {
+                            auto component = mask[i] & 7;
+                            result[i] = component < 4 ? a[component] : b[component - 4];
+                        }
+
+                        return result;
+                    }
+                }
+            }
+            case InputMap::InputMapType::kLerp:
+            {
+                auto i = static_cast<InputMap_Lerp*>(input.get());
+                auto a = Evaluate(i->GetA());
+                auto b = Evaluate(i->GetB());
+                auto control = Evaluate(i->GetControl());
+
+                Value result;
+                for (auto c = 0u; c < 4; ++c)
+                {
+                    result[c] = a[c] + (b[c] - a[c]) * control[c];
+                }
+
+                return result;
+            }
+            case InputMap::InputMapType::kSelect:
+            {
+                auto i = static_cast<InputMap_Select*>(input.get());
+                return Splat(Evaluate(i->GetArg())[static_cast<uint32_t>(i->GetSelection())]);
+            }
+            case InputMap::InputMapType::kShuffle:
+            {
+                auto i = static_cast<InputMap_Shuffle*>(input.get());
+                auto arg = Evaluate(i->GetArg());
+                auto mask = i->GetMask();
+                return { arg[mask[0] & 3], arg[mask[1] & 3], arg[mask[2] & 3], arg[mask[3] & 3] };
+            }
+            case InputMap::InputMapType::kMatMul:
+            {
+                auto i = static_cast<InputMap_MatMul*>(input.get());
+                auto arg = Evaluate(i->GetArg());
+                auto m = i->GetMatrix();
+                return {
+                    Dot({ m.m00, m.m01, m.m02, m.m03 }, arg, 4),
+                    Dot({ m.m10, m.m11, m.m12, m.m13 }, arg, 4),
+                    Dot({ m.m20, m.m21, m.m22, m.m23 }, arg, 4),
+                    Dot({ m.m30, m.m31, m.m32, m.m33 }, arg, 4) };
+            }
+            case InputMap::InputMapType::kRemap:
+            {
+                auto i = static_cast<InputMap_Remap*>(input.get());
+                auto src = Evaluate(i->GetSourceRange());
+                auto dest = Evaluate(i->GetDestinationRange());
+                auto data = Evaluate(i->GetData());
+                return Map(data, [&src, &dest](float x) { return dest[0] + (dest[1] - dest[0]) * ((x - src[0]) / (src[1] - src[0])); });
+            }
+            case InputMap::InputMapType::kLength3:
+            {
+                auto arg = Evaluate(static_cast<InputMap_Length3*>(input.get())->GetArg());
+                return { std::sqrt(Dot(arg, arg, 3)), 0.f, 0.f, 0.f };
+            }
+            case InputMap::InputMapType::kNormalize3:
+            {
+                auto arg = Evaluate(static_cast<InputMap_Normalize3*>(input.get())->GetArg());
+                auto length = std::sqrt(Dot(arg, arg, 3));
+
+                // Zero vector is returned as is
+                if (length == 0.f)
+                {
+                    return Splat(0.f);
+                }
+
+                return { arg[0] / length, arg[1] / length, arg[2] / length, 0.f };
+            }
+            default:
+            {
+                std::vector<InputMap::Ptr> inputs;
+                input->GetInputs(inputs);
+
+                // Samplers are never folded
+                if (inputs.size() != 1)
+                {
+                    assert(false);
+                    return Splat(0.f);
+                }
+
+                auto arg = Evaluate(inputs[0]);
+
+                switch (input->m_type)
+                {
+                    case InputMap::InputMapType::kSin: return Map(arg, [](float x) { return std::sin(x); });
+                    case InputMap::InputMapType::kCos: return Map(arg, [](float x) { return std::cos(x); });
+                    case InputMap::InputMapType::kTan: return Map(arg, [](float x) { return std::tan(x); });
+                    case InputMap::InputMapType::kAsin: return Map(arg, [](float x) { return std::asin(x); });
+                    case InputMap::InputMapType::kAcos: return Map(arg, [](float x) { return std::acos(x); });
+                    case InputMap::InputMapType::kAtan: return Map(arg, [](float x) { return std::atan(x); });
+                    case InputMap::InputMapType::kFloor: return Map(arg, [](float x) { return std::floor(x); });
+                    case InputMap::InputMapType::kAbs: return Map(arg, [](float x) { return std::fabs(x); });
+                    default:
+                        assert(false);
+                        return Splat(0.f);
+                }
+            }
+        }
+    }
+
+    // Shuffle2 mask components below 4 read a, the others read b
+    enum Shuffle2Inputs
+    {
+        kShuffle2A = 0x1,
+        kShuffle2B = 0x2
+    };
+
+    int GetShuffle2Inputs(std::array<uint32_t, 4> const& mask)
+    {
+        int inputs = 0;
+
+        for (auto component : mask)
+        {
+            inputs |= (component & 7) < 4 ? kShuffle2A : kShuffle2B;
+        }
+
+        return inputs;
+    }
+}
+
+RadeonRays::float4 CLInputMapGenerator::EvaluateConstant(std::shared_ptr<Baikal::InputMap> input)
+{
+    auto value = Evaluate(input);
+    return RadeonRays::float4(value[0], value[1], value[2], value[3]);
+}
+
+void CLInputMapGenerator::GetDataOffsets(const Collector& input_map_collector, const Collector& input_map_leaf_collector,
+                                         Offsets& matrix_offsets, Offsets& constant_offsets)
+{
+    auto matrices = CollectMatrices(input_map_collector);
+    auto constants = CollectConstantSubtrees(input_map_collector);
+
+    matrix_offsets.clear();
+    constant_offsets.clear();
+
+    std::size_t offset = kLeafsOffset + input_map_leaf_collector.GetNumItems();
+
+    for (auto& matrix : matrices)
+    {
+        matrix_offsets[matrix->GetId()] = offset;
+        offset += 4;
+    }
+
+    for (auto& constant : constants)
+    {
+        constant_offsets[constant->GetId()] = offset++;
+    }
+}
+
+void CLInputMapGenerator::GetUsedInputs(std::shared_ptr<Baikal::InputMap> input, std::vector<std::shared_ptr<Baikal::InputMap>>& inputs)
+{
+    switch (input->m_type)
+    {
+        case InputMap::InputMapType::kShuffle2:
+        {
+            InputMap_Shuffle2 *i = static_cast<InputMap_Shuffle2*>(input.get());
+            auto used = GetShuffle2Inputs(i->GetMask());
+
+            if (used & kShuffle2A) inputs.push_back(i->GetA());
+            if (used & kShuffle2B) inputs.push_back(i->GetB());
+            break;
+        }
+        case InputMap::InputMapType::kRemap:
+        {
+            InputMap_Remap *i = static_cast<InputMap_Remap*>(input.get());
+            inputs.insert(inputs.end(), 2, i->GetDestinationRange());
+            inputs.push_back(i->GetData());
+            inputs.insert(inputs.end(), 3, i->GetSourceRange());
+            break;
+        }
+        default:
+            input->GetInputs(inputs);
+            break;
+    }
+}
+
+InputMap::Ptr CLInputMapGenerator::GetCanonical(InputMap::Ptr input)
+{
+    auto iter = m_canonical.find(input.get());
+    if (iter != m_canonical.end())
+    {
+        return iter->second;
+    }
+
+    std::string key;
+
+    // Leafs, matrices and folded constants are values, so only the same object is equal
+    if (input->IsLeaf() || input->m_type == InputMap::InputMapType::kMatMul ||
+        m_constant_offsets.find(input->GetId()) != m_constant_offsets.end())
+    {
+        key = "#" + std::to_string(input->GetId());
+    }
+    else
+    {
+        key = std::to_string(static_cast<int>(input->m_type));
+
+        switch (input->m_type)
+        {
+            case InputMap::InputMapType::kSelect:
+                key += ":" + std::to_string(static_cast<int>(static_cast<InputMap_Select*>(input.get())->GetSelection()));
+                break;
+            case InputMap::InputMapType::kShuffle:
+            case InputMap::InputMapType::kShuffle2:
+            {
+                auto mask = (input->m_type == InputMap::InputMapType::kShuffle) ?
+                    static_cast<InputMap_Shuffle*>(input.get())->GetMask() :
+                    static_cast<InputMap_Shuffle2*>(input.get())->GetMask();
+
+                for (auto component : mask)
+                {
+                    key += ":" + std::to_string(component);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        std::vector<InputMap::Ptr> inputs;
+        input->GetInputs(inputs);
+
+        for (auto& arg : inputs)
+        {
+            key += "," + std::to_string(GetCanonical(arg)->GetId());
+        }
+    }
+
+    auto canonical = m_canonical_keys.emplace(key, input).first->second;
+    m_canonical.emplace(input.get(), canonical);
+    return canonical;
+}
+
+void CLInputMapGenerator::CountReads(InputMap::Ptr input, std::map<InputMap const*, int>& reads, std::vector<InputMap::Ptr>& order)
+{
+    input = GetCanonical(input);
+
+    if (reads[input.get()]++ > 0)
+    {
+        return;
+    }
+
+    // Leafs and folded constants are single reads
+    if (!input->IsLeaf() && m_constant_offsets.find(input->GetId()) == m_constant_offsets.end())
+    {
+        std::vector<InputMap::Ptr> inputs;
+        GetUsedInputs(input, inputs);
+
+        for (auto& arg : inputs)
+        {
+            CountReads(arg, reads, order);
+        }
+    }
+
+    order.push_back(input);
+}
+
 void CLInputMapGenerator::GenerateSingleInput(std::shared_ptr<Baikal::InputMap> input, const Collector& input_map_leaf_collector)
 {
     if (m_generated_inputs.find(input->GetId()) != m_generated_inputs.end()) return;
@@ -84,8 +554,35 @@ void CLInputMapGenerator::GenerateSingleInput(std::shared_ptr<Baikal::InputMap>
     m_float4_selector += "\t\tcase " + input_id + ": return ReadInputMap" + input_id + "(dg, input_map_values, TEXTURE_ARGS);\n";
     m_float_selector += "\t\tcase " + input_id + ": return ReadInputMap" + input_id + "(dg, input_map_values, TEXTURE_ARGS).x;\n";
 
-    m_read_functions += "float4 ReadInputMap" + input_id + "(DifferentialGeometry const* dg, GLOBAL InputMapData const* restrict input_map_values, TEXTURE_ARG_LIST)\n{\n"
-        "\treturn (float4)(\n\t";
+    m_read_functions += "float4 ReadInputMap" + input_id + "(DifferentialGeometry const* dg, GLOBAL InputMapData const* restrict input_map_values, TEXTURE_ARG_LIST)\n{\n";
+
+    // Input maps read more than once are evaluated into locals first, so samplers are fetched once
+    std::map<InputMap const*, int> reads;
+    std::vector<InputMap::Ptr> order;
+    CountReads(input, reads, order);
+
+    m_locals.clear();
+
+    for (auto& node : order)
+    {
+        // Constants are single loads anyway
+        bool is_constant = node->m_type == InputMap::InputMapType::kConstantFloat ||
+            node->m_type == InputMap::InputMapType::kConstantFloat3 ||
+            m_constant_offsets.find(node->GetId()) != m_constant_offsets.end();
+
+        if (reads[node.get()] < 2 || is_constant)
+        {
+            continue;
+        }
+
+        m_read_functions += "\tfloat4 value" + std::to_string(node->GetId()) + " = (float4)(\n\t";
+        GenerateInputSource(node, input_map_leaf_collector);
+        m_read_functions += "\t);\n";
+
+        m_locals.insert(node.get());
+    }
+
+    m_read_functions += "\treturn (float4)(\n\t";
 
     GenerateInputSource(input, input_map_leaf_collector);
 
@@ -96,33 +593,48 @@ void CLInputMapGenerator::GenerateSingleInput(std::shared_ptr<Baikal::InputMap>
 
 void CLInputMapGenerator::GenerateInputSource(std::shared_ptr<Baikal::InputMap> input, const Collector& input_map_leaf_collector)
 {
+    input = GetCanonical(input);
+
+    if (m_locals.find(input.get()) != m_locals.end())
+    {
+        m_read_functions += "value" + std::to_string(input->GetId()) + "\n";
+        return;
+    }
+
+    auto constant = m_constant_offsets.find(input->GetId());
+    if (constant != m_constant_offsets.end())
+    {
+        m_read_functions += "input_map_values[" + std::to_string(constant->second) + "].float4_value.value\n";
+        return;
+    }
+
     switch (input->m_type)
     {
 
         case InputMap::InputMapType::kConstantFloat:
         {
-            int32_t index = input_map_leaf_collector.GetItemIndex(input);
+            int32_t index = kLeafsOffset + input_map_leaf_collector.GetItemIndex(input);
 
             m_read_functions += "((float4)(input_map_values[" + std::to_string(index) + "].float_value.value, 0.0f))\n";
             break;
         }
         case InputMap::InputMapType::kConstantFloat3:
         {
-            int32_t index = input_map_leaf_collector.GetItemIndex(input);
+            int32_t index = kLeafsOffset + input_map_leaf_collector.GetItemIndex(input);
 
             m_read_functions += "((float4)(input_map_values[" + std::to_string(index) + "].float_value.value, 0.0f))\n";
             break;
         }
         case InputMap::InputMapType::kSampler:
         {
-            int32_t index = input_map_leaf_collector.GetItemIndex(input);
+            int32_t index = kLeafsOffset + input_map_leaf_collector.GetItemIndex(input);
 
-            m_read_functions += "Texture_Sample2D(dg->uv, TEXTURE_ARGS_IDX(input_map_values[" + std::to_string(index) + "].int_values.idx))\n";
+            m_read_functions += "Texture_Sample2DLod(dg->uv, dg->texture_lod, TEXTURE_ARGS_IDX(input_map_values[" + std::to_string(index) + "].int_values.idx))\n";
             break;
         }
         case InputMap::InputMapType::kSamplerBumpmap:
         {
-            int32_t index = input_map_leaf_collector.GetItemIndex(input);
+            int32_t index = kLeafsOffset + input_map_leaf_collector.GetItemIndex(input);
 
             m_read_functions += "(float4)(Texture_SampleBump(dg->uv, TEXTURE_ARGS_IDX(input_map_values[" + std::to_string(index) + "].int_values.idx)), 1.0f)\n";
             break;
@@ -393,6 +905,18 @@ void CLInputMapGenerator::GenerateInputSource(std::shared_ptr<Baikal::InputMap>
         {
             InputMap_Shuffle2 *i = static_cast<InputMap_Shuffle2*>(input.get());
             auto mask = i->GetMask();
+            auto used = GetShuffle2Inputs(mask);
+
+            // Skip the input none of the components come from
+            if (used != (kShuffle2A | kShuffle2B))
+            {
+                m_read_functions += "shuffle(\n\t\t";
+                GenerateInputSource(used == kShuffle2A ? i->GetA() : i->GetB(), input_map_leaf_collector);
+                m_read_functions += "\t, \n\t\t";
+                m_read_functions += "(uint4)(" + std::to_string(mask[0] & 3) + ", " + std::to_string(mask[1] & 3) + ", " + std::to_string(mask[2] & 3) + ", " + std::to_string(mask[3] & 3) + ")\n";
+                m_read_functions += "\t)\n";
+                break;
+            }
 
             m_read_functions += "shuffle2(\n\t\t";
             GenerateInputSource(i->GetA(), input_map_leaf_collector);
@@ -407,31 +931,15 @@ void CLInputMapGenerator::GenerateInputSource(std::shared_ptr<Baikal::InputMap>
         {
             InputMap_MatMul *i = static_cast<InputMap_MatMul*>(input.get());
 
-            auto mat4 = i->GetMatrix();
+            // Rows are read from input map data, so matrix edits keep the source unchanged
+            auto offset = m_matrix_offsets.at(i->GetId());
 
             m_read_functions += "matrix_mul_vector4(\n\t\t";
-            //Generate matrix
             m_read_functions += "matrix_from_rows(\n\t\t\t";
-            m_read_functions += "make_float4(" +
-                std::to_string(mat4.m00) + ", " +
-                std::to_string(mat4.m01) + ", " +
-                std::to_string(mat4.m02) + ", " +
-                std::to_string(mat4.m03) + "), \n\t\t\t";
-            m_read_functions += "make_float4(" +
-                std::to_string(mat4.m10) + ", " +
-                std::to_string(mat4.m11) + ", " +
-                std::to_string(mat4.m12) + ", " +
-                std::to_string(mat4.m13) + "), \n\t\t\t";
-            m_read_functions += "make_float4(" +
-                std::to_string(mat4.m20) + ", " +
-                std::to_string(mat4.m21) + ", " +
-                std::to_string(mat4.m22) + ", " +
-                std::to_string(mat4.m23) + "), \n\t\t\t";
-            m_read_functions += "make_float4(" +
-                std::to_string(mat4.m30) + ", " +
-                std::to_string(mat4.m31) + ", " +
-                std::to_string(mat4.m32) + ", " +
-                std::to_string(mat4.m33) + ")),\n\t\t(";
+            m_read_functions += "input_map_values[" + std::to_string(offset) + "].float4_value.value, \n\t\t\t";
+            m_read_functions += "input_map_values[" + std::to_string(offset + 1) + "].float4_value.value, \n\t\t\t";
+            m_read_functions += "input_map_values[" + std::to_string(offset + 2) + "].float4_value.value, \n\t\t\t";
+            m_read_functions += "input_map_values[" + std::to_string(offset + 3) + "].float4_value.value),\n\t\t(";
             GenerateInputSource(i->GetArg(), input_map_leaf_collector);
             m_read_functions +=  "\t)\n\t)";
             break;
@@ -459,3 +967,180 @@ void CLInputMapGenerator::GenerateInputSource(std::shared_ptr<Baikal::InputMap>
 
     }
 }
+
+static ClwScene::InputMapData MakeInstruction(int op, int arg)
+{
+    ClwScene::InputMapData instruction;
+    instruction.instruction.op = op;
+    instruction.instruction.arg0 = arg;
+    instruction.instruction.arg1 = 0;
+    instruction.instruction.arg2 = 0;
+    return instruction;
+}
+
+void CLInputMapGenerator::GenerateInterpreterCode(const Collector& input_map_collector, const Collector& input_map_leaf_collector,
+                                                  std::vector<ClwScene::InputMapData>& input_map_data)
+{
+    Offsets matrix_offsets;
+    Offsets constant_offsets;
+    GetDataOffsets(input_map_collector, input_map_leaf_collector, matrix_offsets, constant_offsets);
+
+    // Roots are sorted by id for binary search
+    std::map<uint32_t, InputMap::Ptr> inputs;
+
+    auto input_iter = input_map_collector.CreateIterator();
+    for (; input_iter->IsValid(); input_iter->Next())
+    {
+        auto input = input_iter->ItemAs<InputMap>();
+        inputs.insert(std::make_pair(input->GetId(), input));
+    }
+
+    auto root_offset = input_map_data.size();
+    auto code_offset = root_offset + inputs.size();
+
+    std::vector<ClwScene::InputMapData> code;
+
+    input_map_data.resize(code_offset);
+
+    auto root = input_map_data.data() + root_offset;
+    for (auto &input : inputs)
+    {
+        root->instruction.arg0 = static_cast<int>(input.first);
+        root->instruction.arg1 = static_cast<int>(code_offset + code.size());
+        ++root;
+
+        GenerateInstructions(input.second, input_map_leaf_collector, matrix_offsets, constant_offsets, code);
+
+        code.push_back(MakeInstruction(ClwScene::kInputMapOpReturn, 0));
+    }
+
+    input_map_data.insert(input_map_data.end(), code.begin(), code.end());
+
+    input_map_data[0].instruction.arg0 = static_cast<int>(root_offset);
+    input_map_data[0].instruction.arg1 = static_cast<int>(inputs.size());
+}
+
+void CLInputMapGenerator::GenerateInstructions(std::shared_ptr<Baikal::InputMap> input, const Collector& input_map_leaf_collector,
+                                               const Offsets& matrix_offsets, const Offsets& constant_offsets,
+                                               std::vector<ClwScene::InputMapData>& code)
+{
+    auto Emit = [&code](int op, int arg)
+    {
+        code.push_back(MakeInstruction(op, arg));
+    };
+
+    auto PackMask = [](std::array<uint32_t, 4> const& mask)
+    {
+        return static_cast<int>(mask[0] | (mask[1] << 3) | (mask[2] << 6) | (mask[3] << 9));
+    };
+
+    // Map type to instruction, operands are pushed before it
+    static const std::map<InputMap::InputMapType, int> ops =
+    {
+        { InputMap::InputMapType::kAdd, ClwScene::kInputMapOpAdd },
+        { InputMap::InputMapType::kSub, ClwScene::kInputMapOpSub },
+        { InputMap::InputMapType::kMul, ClwScene::kInputMapOpMul },
+        { InputMap::InputMapType::kDiv, ClwScene::kInputMapOpDiv },
+        { InputMap::InputMapType::kMin, ClwScene::kInputMapOpMin },
+        { InputMap::InputMapType::kMax, ClwScene::kInputMapOpMax },
+        { InputMap::InputMapType::kDot3, ClwScene::kInputMapOpDot3 },
+        { InputMap::InputMapType::kDot4, ClwScene::kInputMapOpDot4 },
+        { InputMap::InputMapType::kCross3, ClwScene::kInputMapOpCross3 },
+        { InputMap::InputMapType::kCross4, ClwScene::kInputMapOpCross4 },
+        { InputMap::InputMapType::kPow, ClwScene::kInputMapOpPow },
+        { InputMap::InputMapType::kMod, ClwScene::kInputMapOpMod },
+        { InputMap::InputMapType::kSin, ClwScene::kInputMapOpSin },
+        { InputMap::InputMapType::kCos, ClwScene::kInputMapOpCos },
+        { InputMap::InputMapType::kTan, ClwScene::kInputMapOpTan },
+        { InputMap::InputMapType::kAsin, ClwScene::kInputMapOpAsin },
+        { InputMap::InputMapType::kAcos, ClwScene::kInputMapOpAcos },
+        { InputMap::InputMapType::kAtan, ClwScene::kInputMapOpAtan },
+        { InputMap::InputMapType::kLength3, ClwScene::kInputMapOpLength3 },
+        { InputMap::InputMapType::kNormalize3, ClwScene::kInputMapOpNormalize3 },
+        { InputMap::InputMapType::kFloor, ClwScene::kInputMapOpFloor },
+        { InputMap::InputMapType::kAbs, ClwScene::kInputMapOpAbs },
+        { InputMap::InputMapType::kLerp, ClwScene::kInputMapOpLerp },
+        { InputMap::InputMapType::kRemap, ClwScene::kInputMapOpRemap }
+    };
+
+    auto constant = constant_offsets.find(input->GetId());
+    if (constant != constant_offsets.end())
+    {
+        Emit(ClwScene::kInputMapOpConstant4, static_cast<int>(constant->second));
+        return;
+    }
+
+    switch (input->m_type)
+    {
+        case InputMap::InputMapType::kConstantFloat:
+        case InputMap::InputMapType::kConstantFloat3:
+        {
+            Emit(ClwScene::kInputMapOpConstant, kLeafsOffset + input_map_leaf_collector.GetItemIndex(input));
+            break;
+        }
+        case InputMap::InputMapType::kSampler:
+        {
+            Emit(ClwScene::kInputMapOpSampler, kLeafsOffset + input_map_leaf_collector.GetItemIndex(input));
+            break;
+        }
+        case InputMap::InputMapType::kSamplerBumpmap:
+        {
+            Emit(ClwScene::kInputMapOpSamplerBumpmap, kLeafsOffset + input_map_leaf_collector.GetItemIndex(input));
+            break;
+        }
+        case InputMap::InputMapType::kSelect:
+        {
+            InputMap_Select *i = static_cast<InputMap_Select*>(input.get());
+            GenerateInstructions(i->GetArg(), input_map_leaf_collector, matrix_offsets, constant_offsets, code);
+            Emit(ClwScene::kInputMapOpSelect, static_cast<int>(i->GetSelection()));
+            break;
+        }
+        case InputMap::InputMapType::kShuffle:
+        {
+            InputMap_Shuffle *i = static_cast<InputMap_Shuffle*>(input.get());
+            GenerateInstructions(i->GetArg(), input_map_leaf_collector, matrix_offsets, constant_offsets, code);
+            Emit(ClwScene::kInputMapOpShuffle, PackMask(i->GetMask()));
+            break;
+        }
+        case InputMap::InputMapType::kShuffle2:
+        {
+            InputMap_Shuffle2 *i = static_cast<InputMap_Shuffle2*>(input.get());
+            auto mask = i->GetMask();
+            auto used = GetShuffle2Inputs(mask);
+
+            // Skip the input none of the components come from
+            if (used != (kShuffle2A | kShuffle2B))
+            {
+                GenerateInstructions(used == kShuffle2A ? i->GetA() : i->GetB(), input_map_leaf_collector, matrix_offsets, constant_offsets, code);
+                Emit(ClwScene::kInputMapOpShuffle, PackMask({ mask[0] & 3, mask[1] & 3, mask[2] & 3, mask[3] & 3 }));
+                break;
+            }
+
+            GenerateInstructions(i->GetA(), input_map_leaf_collector, matrix_offsets, constant_offsets, code);
+            GenerateInstructions(i->GetB(), input_map_leaf_collector, matrix_offsets, constant_offsets, code);
+            Emit(ClwScene::kInputMapOpShuffle2, PackMask(mask));
+            break;
+        }
+        case InputMap::InputMapType::kMatMul:
+        {
+            InputMap_MatMul *i = static_cast<InputMap_MatMul*>(input.get());
+            GenerateInstructions(i->GetArg(), input_map_leaf_collector, matrix_offsets, constant_offsets, code);
+            Emit(ClwScene::kInputMapOpMatMul, static_cast<int>(matrix_offsets.at(i->GetId())));
+            break;
+        }
+        default:
+        {
+            // Inputs are appended in argument order, remap is (source range, destination range, data)
+            std::vector<InputMap::Ptr> inputs;
+            input->GetInputs(inputs);
+
+            for (auto& arg : inputs)
+            {
+                GenerateInstructions(arg, input_map_leaf_collector, matrix_offsets, constant_offsets, code);
+            }
+
+            Emit(ops.at(input->m_type), 0);
+            break;
+        }
+    }
+}
@@ -23,7 +23,11 @@ THE SOFTWARE.
 
 #pragma once
 
+#include <map>
+#include <memory>
 #include <set>
+#include <string>
+#include <vector>
 
 #include "SceneGraph/scene1.h"
 #include "SceneGraph/Collector/collector.h"
@@ -35,6 +39,9 @@ namespace Baikal
     class CLInputMapGenerator
     {
     public:
+        // Input map data starts with the interpreter header entry, leafs follow it
+        static constexpr std::uint32_t kLeafsOffset = 1;
+
         /**
         * @brief Generates source code for input maps. 
         *
@@ -53,7 +60,70 @@ namespace Baikal
             return m_source_code;
         }
 
+        /**
+        * @brief Collects kMatMul input maps reachable from the collected ones, ordered by id.
+        *
+        * Matrices are values rather than graph structure, so they are not baked into the source.
+        * Rows of the i-th matrix are stored in input map data at kLeafsOffset + GetNumItems() of leaf collector + 4 * i.
+        *
+        * @param input_map_collector set of input maps for generation
+        */
+        static std::vector<std::shared_ptr<Baikal::InputMap>> CollectMatrices(const Collector& input_map_collector);
+
+        /**
+        * @brief Collects constant subtrees reachable from the collected input maps, ordered by id.
+        *
+        * Subtrees without samplers are folded: they are evaluated on host by EvaluateConstant
+        * and kernels read the result instead of the whole subtree. Which subtrees are constant
+        * only depends on graph structure, so value edits keep the generated source.
+        * Result of the i-th subtree is stored in input map data right after the matrix rows,
+        * at kLeafsOffset + GetNumItems() of leaf collector + 4 * number of matrices + i.
+        *
+        * @param input_map_collector set of input maps for generation
+        */
+        static std::vector<std::shared_ptr<Baikal::InputMap>> CollectConstantSubtrees(const Collector& input_map_collector);
+
+        /**
+        * @brief Evaluates input map without samplers the same way as generated code does.
+        *
+        * @param input constant input map
+        * @return value of input map
+        */
+        static RadeonRays::float4 EvaluateConstant(std::shared_ptr<Baikal::InputMap> input);
+
+        /**
+        * @brief Generates code for the input map interpreter of the generic UberV2 kernels.
+        *
+        * Appends root table and instructions to input map data which already holds the header,
+        * leafs, matrix rows and folded constants, and fills the header. See InputMapOp in payload.cl.
+        * Like the generated source, the code only depends on graph structure.
+        *
+        * @param input_map_collector set of input maps for generation
+        * @param input_map_leaf_collector list of leaf nodes that holds values
+        * @param input_map_data input map data to append code to
+        */
+        static void GenerateInterpreterCode(const Collector& input_map_collector, const Collector& input_map_leaf_collector,
+                                            std::vector<ClwScene::InputMapData>& input_map_data);
+
     private:
+        // Input map id -> entry in input map data
+        using Offsets = std::map<uint32_t, std::size_t>;
+
+        // Fills offsets of matrix rows and folded constants in input map data
+        static void GetDataOffsets(const Collector& input_map_collector, const Collector& input_map_leaf_collector,
+                                   Offsets& matrix_offsets, Offsets& constant_offsets);
+        // Appends inputs in the order and multiplicity generated code reads them, inputs which don't
+        // contribute to the result are skipped
+        static void GetUsedInputs(std::shared_ptr<Baikal::InputMap> input, std::vector<std::shared_ptr<Baikal::InputMap>>& inputs);
+        // Appends instructions evaluating single input map in postfix order. Called recursively.
+        static void GenerateInstructions(std::shared_ptr<Baikal::InputMap> input, const Collector& input_map_leaf_collector,
+                                         const Offsets& matrix_offsets, const Offsets& constant_offsets,
+                                         std::vector<ClwScene::InputMapData>& code);
+        // Returns first collected input map with the same structure, so equal subexpressions are generated once
+        std::shared_ptr<Baikal::InputMap> GetCanonical(std::shared_ptr<Baikal::InputMap> input);
+        // Counts reads of input map and its inputs, appends newly visited ones in postfix order
+        void CountReads(std::shared_ptr<Baikal::InputMap> input, std::map<InputMap const*, int>& reads,
+                        std::vector<std::shared_ptr<Baikal::InputMap>>& order);
         // Proceed single input, writes function header and function call
         void GenerateSingleInput(std::shared_ptr<Baikal::InputMap> input, const Collector& input_map_leaf_collector);
         // Writes source code for single input map. Called recursively.
@@ -63,5 +133,14 @@ namespace Baikal
         std::string m_float4_selector;
         std::string m_float_selector;
         std::set<uint32_t> m_generated_inputs;
+        // Input map id -> first matrix row in input map data
+        Offsets m_matrix_offsets;
+        // Input map id -> folded value in input map data
+        Offsets m_constant_offsets;
+        // Structure key -> canonical input map, input map -> canonical input map
+        std::map<std::string, std::shared_ptr<Baikal::InputMap>> m_canonical_keys;
+        std::map<InputMap const*, std::shared_ptr<Baikal::InputMap>> m_canonical;
+        // Input maps stored in locals of the function being generated
+        std::set<InputMap const*> m_locals;
     };
 }
@@ -28,46 +28,35 @@ THE SOFTWARE.
 #include <algorithm>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <regex>
+#include <cstdio>
+#include <thread>
 
 #include "cl_program_manager.h"
+#include "Utils/compile_cache.h"
 #include "version.h"
 #include "Utils/mkpath.h"
+#include "Utils/task_scheduler.h"
 
 //#define DUMP_PROGRAM_SOURCE 1
 
 using namespace Baikal;
 
-inline std::uint32_t jenkins_one_at_a_time_hash(char const *key, size_t len)
+// In-memory programs kept per CLProgram, disk cache is not limited
+static const std::size_t kMaxInMemoryPrograms = 16;
+
+static std::string GetDriverVersion(CLWDevice const& device)
 {
-    std::uint32_t hash, i;
-    for (hash = i = 0; i < len; ++i)
+    std::size_t size = 0;
+    if (clGetDeviceInfo(device.GetID(), CL_DRIVER_VERSION, 0, nullptr, &size) != CL_SUCCESS || size == 0)
     {
-        hash += key[i];
-        hash += (hash << 10);
-        hash ^= (hash >> 6);
+        return "";
     }
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
-    return hash;
-}
 
-// Computting check sum algo
-// Copy from here: https://codereview.stackexchange.com/questions/104948/32-bit-checksum-of-a-file
-inline std::uint32_t CheckSum(const std::string &source)
-{
-    std::uint32_t check_sum = 0;
-    unsigned shift = 0;
-    for (uint32_t ch : source)
-    {
-        check_sum += (ch << shift);
-        shift += 8;
-        if (shift == 32) {
-            shift = 0;
-        }
-    }
-    return check_sum;
+    std::string version(size, '\0');
+    clGetDeviceInfo(device.GetID(), CL_DRIVER_VERSION, size, &version[0], nullptr);
+    return version;
 }
 
 inline bool LoadBinaries(std::string const& name, std::vector<std::uint8_t>& data)
@@ -90,15 +79,31 @@ inline bool LoadBinaries(std::string const& name, std::vector<std::uint8_t>& dat
     }
 }
 
+// Binary is written next to its final name and moved there, so readers never see a partial file
 inline void SaveBinaries(std::string const& name, std::vector<std::uint8_t>& data)
 {
+    if (data.empty())
+    {
+        return;
+    }
+
     mkfilepath(name);
 
-    std::ofstream out(name, std::ios::out | std::ios::binary);
+    std::ostringstream temp_name_stream;
+    temp_name_stream << name << "." << std::this_thread::get_id() << ".tmp";
+    auto temp_name = temp_name_stream.str();
+    {
+        std::ofstream out(temp_name, std::ios::out | std::ios::binary);
+        if (!out || !out.write((char*)&data[0], data.size()))
+        {
+            return;
+        }
+    }
 
-    if (out)
+    std::remove(name.c_str());
+    if (std::rename(temp_name.c_str(), name.c_str()) != 0)
     {
-        out.write((char*)&data[0], data.size());
+        std::remove(temp_name.c_str());
     }
 }
 
@@ -122,23 +127,26 @@ void CLProgram::SetSource(const std::string &source)
 
 void CLProgram::ParseSource(const std::string &source)
 {
-    std::string::size_type offset = 0;
-    std::string::size_type position = 0;
-    std::string find_str("#include");
-    while ((position = source.find(find_str, offset)) != std::string::npos)
+    for (auto const& include : CLProgramManager::ParseIncludes(source))
     {
-        std::string::size_type end_position = source.find(">", position);
-        assert(end_position != std::string::npos);
-        std::string fname = source.substr(position, end_position - position);
-        position = fname.find("<");
-        assert(position != std::string::npos);
-        fname = fname.substr(position + 1, fname.length() - position);
-        offset = end_position;
+        AddRequiredHeader(ResolveHeader(include));
+    }
+}
+
+void CLProgram::AddRequiredHeader(const std::string &header)
+{
+    // Every header is visited once, nested includes come from the include lists the manager keeps
+    if (!m_required_headers.insert(header).second)
+    {
+        return;
+    }
 
-        m_program_manager->LoadHeader(fname);
-        m_required_headers.insert(fname);
-        std::string arr = m_program_manager->ReadHeader(fname);
-        ParseSource(arr);
+    m_program_manager->LoadHeader(header);
+
+    auto includes = m_program_manager->GetHeaderIncludes(header);
+    for (auto const& include : includes)
+    {
+        AddRequiredHeader(ResolveHeader(include));
     }
 }
 
@@ -161,6 +169,7 @@ void CLProgram::BuildSource(const std::string &source)
         assert(position != std::string::npos);
         fname = fname.substr(position + 1, fname.length() - position);
         offset = end_position + 1;
+        fname = ResolveHeader(fname);
 
         if (m_included_headers.find(fname) == m_included_headers.end())
         {
@@ -175,6 +184,14 @@ void CLProgram::BuildSource(const std::string &source)
 }
 
 CLWProgram CLProgram::Compile(const std::string &opts)
+{
+    auto compiled_program = CompileSource(m_program_name, m_compiled_source, opts, m_context);
+    m_is_dirty = false;
+    return compiled_program;
+}
+
+CLWProgram CLProgram::CompileSource(const std::string &program_name, const std::string &source,
+                                    const std::string &opts, CLWContext context)
 {
     std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
     start = std::chrono::high_resolution_clock::now();
@@ -182,24 +199,24 @@ CLWProgram CLProgram::Compile(const std::string &opts)
     CLWProgram compiled_program;
     try
     {
-        compiled_program = CLWProgram::CreateFromSource(m_compiled_source.c_str(), m_compiled_source.size(), opts.c_str(), m_context);
+        compiled_program = CLWProgram::CreateFromSource(source.c_str(), source.size(), opts.c_str(), context);
         /*
          * Code below usable for cache debugging
          */
 #ifdef DUMP_PROGRAM_SOURCE
         auto e = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
-        std::ofstream file(m_program_name + std::to_string(e) + ".cl");
-        file << m_compiled_source;
+        std::ofstream file(program_name + std::to_string(e) + ".cl");
+        file << source;
         file.close();
 #endif
     }
     catch (CLWException& )
     {
         std::cerr << "Compilation failed!" << std::endl;
-        std::cerr << "Dumping source to file:" << m_program_name << ".cl.failed" << std::endl;
-        std::string fname = m_program_name + ".cl.failed";
+        std::cerr << "Dumping source to file:" << program_name << ".cl.failed" << std::endl;
+        std::string fname = program_name + ".cl.failed";
         std::ofstream file(fname);
-        file << m_compiled_source;
+        file << source;
         file.close();
         throw;
     }
@@ -208,7 +225,6 @@ CLWProgram CLProgram::Compile(const std::string &opts)
     int elapsed_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     std::cerr << "Program compilation time: " << elapsed_ms << " ms" << std::endl;
 
-    m_is_dirty = false;
     return compiled_program;
 }
 
@@ -217,89 +233,269 @@ bool CLProgram::IsHeaderNeeded(const std::string &header_name) const
     return (m_required_headers.find(header_name) != m_required_headers.end());
 }
 
-CLWProgram CLProgram::GetCLWProgram(const std::string &opts)
+void CLProgram::UpdateSource()
 {
     // global dirty flag
     if (m_is_dirty)
     {
-        m_programs.clear();
         m_compiled_source.clear();
         m_included_headers.clear();
+        m_filenames.clear();
         BuildSource(m_program_source);
+
+        ContentHash hash;
+        hash.Add(m_compiled_source.size());
+        hash.Add(m_compiled_source.data(), m_compiled_source.size());
+        m_source_hash = hash.Get();
+
+        m_is_dirty = false;
     }
+}
 
-    auto it = m_programs.find(opts);
-    if (it != m_programs.end())
+void CLProgram::AddProgram(const std::string &filename, CLWProgram program)
+{
+    if (m_programs.find(filename) == m_programs.end())
     {
-        return it->second;
+        // Drop the oldest program
+        if (m_program_order.size() >= kMaxInMemoryPrograms)
+        {
+            m_programs.erase(m_program_order.front());
+            m_program_order.pop_front();
+        }
+
+        m_program_order.push_back(filename);
     }
 
-    CLWProgram result;
-    //check if we can get it from cache
-    if (!m_cache_path.empty())
-    {
-        std::string filename = GetFilenameHash(opts);
+    m_programs[filename] = program;
+}
+
+const std::string& CLProgram::ResolveHeader(const std::string &header_name) const
+{
+    auto it = m_header_overrides.find(header_name);
+    return it != m_header_overrides.end() ? it->second : header_name;
+}
 
-        auto cached_program_path = m_cache_path;
-        cached_program_path.append("/");
-        cached_program_path.append(filename);
-        cached_program_path.append(".bin");
+std::string CLProgram::GetCachedProgramPath(const std::string &cache_path, const std::string &filename)
+{
+    auto cached_program_path = cache_path;
+    cached_program_path.append("/");
+    cached_program_path.append(filename);
+    cached_program_path.append(".bin");
+    return cached_program_path;
+}
+
+std::vector<std::string> CLProgram::GetCachePaths() const
+{
+    std::vector<std::string> paths;
+    for (auto const& path : { m_cache_path, m_program_manager->GetSharedCachePath() })
+    {
+        if (!path.empty())
+        {
+            paths.push_back(path);
+        }
+    }
+    return paths;
+}
 
+bool CLProgram::LoadCachedProgram(const std::string &filename, CLWProgram &program) const
+{
+    for (auto const& path : GetCachePaths())
+    {
         std::vector<std::uint8_t> binary;
-        if (LoadBinaries(cached_program_path, binary))
+        if (!LoadBinaries(GetCachedProgramPath(path, filename), binary) || binary.empty())
+        {
+            continue;
+        }
+
+        // Truncated or foreign binaries are skipped and the program is rebuilt
+        try
         {
-            // Create from binary
             std::size_t size = binary.size();
             auto binaries = &binary[0];
-            result = CLWProgram::CreateFromBinary(&binaries, &size, m_context);
-            m_programs[opts] = result;
+            program = CLWProgram::CreateFromBinary(&binaries, &size, m_context);
+            return true;
         }
-        else
+        catch (std::exception&)
         {
-            result = Compile(opts);
-            m_programs[opts] = result;
+        }
+    }
+
+    return false;
+}
+
+bool CLProgram::TakePendingProgram(const std::string &opts, const std::string &filename)
+{
+    auto it = m_pending.find(opts);
+    if (it == m_pending.end() ||
+        it->second.program.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        return false;
+    }
 
-            // Save binaries
-            result.GetBinaries(0, binary);
-            SaveBinaries(cached_program_path, binary);
+    auto pending = it->second;
+    m_pending.erase(it);
+
+    // Source has changed while compiling
+    if (pending.filename != filename)
+    {
+        return false;
+    }
+
+    // Rethrows compilation errors
+    auto result = pending.program.get();
+    AddProgram(filename, result);
+
+    if (!m_cache_path.empty())
+    {
+        std::vector<std::uint8_t> binary;
+        result.GetBinaries(0, binary);
+        SaveBinaries(GetCachedProgramPath(m_cache_path, filename), binary);
+    }
+
+    return true;
+}
+
+bool CLProgram::IsReady(const std::string &opts)
+{
+    UpdateSource();
+
+    auto filename = GetFilenameHash(opts);
+
+    if (m_programs.find(filename) != m_programs.end())
+    {
+        return true;
+    }
+
+    if (TakePendingProgram(opts, filename))
+    {
+        return true;
+    }
+
+    // Binaries are loaded without compilation
+    auto paths = GetCachePaths();
+    return std::any_of(paths.begin(), paths.end(), [&filename](std::string const& path)
+    {
+        return std::ifstream(GetCachedProgramPath(path, filename)).good();
+    });
+}
+
+void CLProgram::CompileAsync(const std::string &opts)
+{
+    if (IsReady(opts))
+    {
+        return;
+    }
+
+    auto filename = GetFilenameHash(opts);
+
+    auto it = m_pending.find(opts);
+    if (it != m_pending.end())
+    {
+        // Already compiling current source
+        if (it->second.filename == filename)
+        {
+            return;
         }
+
+        // Outdated compile finishes on its worker, dropping the future does not wait for it
+        m_pending.erase(it);
     }
 
-    m_is_dirty = false;
-    return result;
+    // Worker only touches copies, so headers can change meanwhile
+    auto program_name = m_program_name;
+    auto source = m_compiled_source;
+    auto context = m_context;
+
+    m_pending[opts] = { filename, TaskScheduler::Get().Submit([program_name, source, opts, context]()
+    {
+        return CompileSource(program_name, source, opts, context);
+    }).share() };
 }
 
-std::string CLProgram::GetFilenameHash(std::string const& opts) const
+CLWProgram CLProgram::GetCLWProgram(const std::string &opts)
 {
-    auto name = m_program_name;
-    auto device_name = m_context.GetDevice(0).GetName();
+    UpdateSource();
 
-    std::regex forbidden("(\\\\)|[\\./:<>\\\"\\|\\?\\*]");
+    auto filename = GetFilenameHash(opts);
 
-    device_name = std::regex_replace(device_name, forbidden, "_");
-    device_name.erase(
-        std::remove_if(device_name.begin(), device_name.end(), isspace),
-                      device_name.end());
+    // Programs of previous sources are kept, so switching back to them is free
+    auto it = m_programs.find(filename);
+    if (it != m_programs.end())
+    {
+        return it->second;
+    }
 
-    name.append("_");
-    name.append(device_name);
+    // Wait for background compile of current source rather than starting another one
+    auto pending = m_pending.find(opts);
+    if (pending != m_pending.end() && pending->second.filename == filename)
+    {
+        pending->second.program.wait();
+    }
 
-    auto extra = m_context.GetDevice(0).GetVersion();
-    extra.append(opts);
+    if (TakePendingProgram(opts, filename))
+    {
+        return m_programs[filename];
+    }
 
-    std::ostringstream oss;
-    oss << jenkins_one_at_a_time_hash(extra.c_str(), extra.size());
+    CLWProgram result;
+    //check if we can get it from cache
+    if (LoadCachedProgram(filename, result))
+    {
+        AddProgram(filename, result);
+        return result;
+    }
+
+    result = Compile(opts);
+    AddProgram(filename, result);
+
+    // Save binaries, shared cache folder is never written
+    if (!m_cache_path.empty())
+    {
+        std::vector<std::uint8_t> binary;
+        result.GetBinaries(0, binary);
+        SaveBinaries(GetCachedProgramPath(m_cache_path, filename), binary);
+    }
 
-    name.append("_");
-    name.append(oss.str());
+    return result;
+}
 
+std::string CLProgram::GetFilenameHash(std::string const& opts) const
+{
+    auto it = m_filenames.find(opts);
+    if (it != m_filenames.end())
+    {
+        return it->second;
+    }
 
-    std::uint32_t file_hash = CheckSum(m_compiled_source);
+    auto device = m_context.GetDevice(0);
 
-    name.append("_");
-    name.append(std::to_string(file_hash));
+    if (m_device_key.empty())
+    {
+        auto device_name = device.GetName();
 
-    name.append(BAIKAL_VERSION);
+        std::regex forbidden("(\\\\)|[\\./:<>\\\"\\|\\?\\*]");
+
+        device_name = std::regex_replace(device_name, forbidden, "_");
+        device_name.erase(
+            std::remove_if(device_name.begin(), device_name.end(), isspace),
+                          device_name.end());
+
+        m_device_key = device_name;
+    }
+
+    // Full source, options, device and driver, so binaries are never reused across them
+    ContentHash hash;
+    hash.Add(m_source_hash);
+
+    for (auto const& value : { opts, device.GetName(), device.GetVendor(), device.GetVersion(), GetDriverVersion(device), std::string(BAIKAL_VERSION) })
+    {
+        hash.Add(value.size());
+        hash.Add(value.data(), value.size());
+    }
+
+    std::ostringstream oss;
+    oss << m_program_name << "_" << m_device_key << "_" << std::hex << std::setw(16) << std::setfill('0') << hash.Get();
 
-    return name;
+    m_filenames[opts] = oss.str();
+    return oss.str();
 }
@@ -22,6 +22,10 @@ THE SOFTWARE.
 
 #pragma once
 
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <map>
 #include <string>
 #include <vector>
 #include <set>
@@ -45,6 +49,8 @@ namespace Baikal
         void SetDirty() { m_is_dirty = true; }
         // Returns program id
         uint32_t GetId() const { return m_id; }
+        // Includes of header overrides.first are replaced with overrides.second, should be set before SetSource
+        void SetHeaderOverrides(const std::map<std::string, std::string> &overrides) { m_header_overrides = overrides; }
         /**
          * @brief Sets program source
          *
@@ -69,16 +75,54 @@ namespace Baikal
         // Compiles program. In case of error dumps source into current folder
         CLWProgram Compile(const std::string &opts);
 
+        // Checks if GetCLWProgram returns without compiling
+        bool IsReady(const std::string &opts);
+
+        /**
+         * @brief Starts compiling program on a worker thread
+         *
+         * Compiles a snapshot of current source, the result is picked up
+         * by IsReady or GetCLWProgram if the source has not changed since.
+         */
+        void CompileAsync(const std::string &opts);
+
     private:
+        // Program being compiled on a worker thread
+        struct PendingProgram
+        {
+            std::string filename;
+            std::shared_future<CLWProgram> program;
+        };
+
+        // Rebuilds full source if the program is dirty
+        void UpdateSource();
+        // Adds program to in-memory cache, evicts the oldest one if it is full
+        void AddProgram(const std::string &filename, CLWProgram program);
+        // Moves finished background compile of current source into in-memory cache
+        bool TakePendingProgram(const std::string &opts, const std::string &filename);
+        // Returns header name with overrides applied
+        const std::string& ResolveHeader(const std::string &header_name) const;
+        // Returns path of cached binary in cache folder
+        static std::string GetCachedProgramPath(const std::string &cache_path, const std::string &filename);
+        // Returns cache folders to look binaries up in, writable one first
+        std::vector<std::string> GetCachePaths() const;
+        // Creates program from binary of cache or shared cache folder, false if there is no usable one
+        bool LoadCachedProgram(const std::string &filename, CLWProgram &program) const;
+        // Compiles source, in case of error dumps it into current folder
+        static CLWProgram CompileSource(const std::string &program_name, const std::string &source,
+                                        const std::string &opts, CLWContext context);
+
         // Parses source
         void ParseSource(const std::string &source);
+        // Adds header and the headers it includes to required ones
+        void AddRequiredHeader(const std::string &header);
         /**
          * This function builds full program source by replacing 
          * include directives with source code.
          * Duplicate includes removed.
          */
         void BuildSource(const std::string &source);
-        // Returns hash for file name
+        // Returns cache file name, a hash of full source, options and device
         std::string GetFilenameHash(std::string const& opts) const;
 
         const CLProgramManager *m_program_manager;
@@ -88,12 +132,18 @@ namespace Baikal
         std::string m_program_source;  ///< Program source code without modifications
         std::unordered_set<std::string> m_required_headers; ///< Set of required headers
 
-        std::unordered_map<std::string, CLWProgram> m_programs; ///< In-memory cache for compiled programs
+        std::unordered_map<std::string, CLWProgram> m_programs; ///< In-memory cache for compiled programs by file name
+        std::deque<std::string> m_program_order; ///< File names of in-memory programs, oldest first
+        std::uint64_t m_source_hash = 0; ///< Hash of m_compiled_source
+        mutable std::unordered_map<std::string, std::string> m_filenames; ///< File names of current source by options
+        mutable std::string m_device_key; ///< Device name usable in file names
 
         bool m_is_dirty = true;
         uint32_t m_id;
         CLWContext m_context;
         std::set<std::string> m_included_headers; ///< Set of included headers
+        std::map<std::string, std::string> m_header_overrides; ///< Header name -> name of its replacement
 
+        std::unordered_map<std::string, PendingProgram> m_pending; ///< Background compiles by options
     };
 }
@@ -22,6 +22,7 @@ THE SOFTWARE.
 
 #include "cl_program_manager.h"
 
+#include <cassert>
 #include <fstream>
 #include <regex>
 
@@ -52,7 +53,8 @@ CLProgramManager::CLProgramManager(const std::string &cache_path) :
 
 }
 
-uint32_t CLProgramManager::CreateProgramFromFile(CLWContext context, const std::string &fname) const
+uint32_t CLProgramManager::CreateProgramFromFile(CLWContext context, const std::string &fname,
+                                                 const std::map<std::string, std::string> &header_overrides) const
 {
     std::regex delimiter("\\\\");
     auto fullpath = std::regex_replace(fname, delimiter, "/");
@@ -71,12 +73,14 @@ uint32_t CLProgramManager::CreateProgramFromFile(CLWContext context, const std::
 
     auto name = fullpath.substr(filename_start, filename_end - filename_start);
 
-    return CLProgramManager::CreateProgramFromSource(context, name, ReadFile(fname));
+    return CLProgramManager::CreateProgramFromSource(context, name, ReadFile(fname), header_overrides);
 }
 
-uint32_t CLProgramManager::CreateProgramFromSource(CLWContext context, const std::string &name, const std::string &source) const
+uint32_t CLProgramManager::CreateProgramFromSource(CLWContext context, const std::string &name, const std::string &source,
+                                                   const std::map<std::string, std::string> &header_overrides) const
 {
     CLProgram prg(this, m_next_program_id++, context, name, m_cache_path);
+    prg.SetHeaderOverrides(header_overrides);
     prg.SetSource(source);
     m_programs.insert(std::make_pair(prg.GetId(), prg));
     return prg.GetId();
@@ -88,6 +92,7 @@ void CLProgramManager::AddHeader(const std::string &header, const std::string &s
     if (currect_header_code != source)
     {
         m_headers[header] = source;
+        m_header_includes.erase(header);
 
         for (auto &program : m_programs)
         {
@@ -101,6 +106,12 @@ void CLProgramManager::AddHeader(const std::string &header, const std::string &s
 
 void CLProgramManager::LoadHeader(const std::string &header) const
 {
+    // Programs share most of their headers, edits of loaded ones come through AddHeader
+    if (m_headers.find(header) != m_headers.end())
+    {
+        return;
+    }
+
     std::string header_source = ReadFile(header);
     AddHeader(header, header_source);
 }
@@ -110,6 +121,37 @@ const std::string& CLProgramManager::ReadHeader(const std::string &header) const
     return m_headers[header];
 }
 
+const std::vector<std::string>& CLProgramManager::GetHeaderIncludes(const std::string &header) const
+{
+    auto it = m_header_includes.find(header);
+    if (it == m_header_includes.end())
+    {
+        it = m_header_includes.emplace(header, ParseIncludes(ReadHeader(header))).first;
+    }
+    return it->second;
+}
+
+std::vector<std::string> CLProgramManager::ParseIncludes(const std::string &source)
+{
+    std::vector<std::string> includes;
+
+    std::string::size_type offset = 0;
+    std::string::size_type position = 0;
+    std::string find_str("#include");
+    while ((position = source.find(find_str, offset)) != std::string::npos)
+    {
+        std::string::size_type end_position = source.find(">", position);
+        assert(end_position != std::string::npos);
+        std::string fname = source.substr(position, end_position - position);
+        position = fname.find("<");
+        assert(position != std::string::npos);
+        includes.push_back(fname.substr(position + 1, fname.length() - position));
+        offset = end_position;
+    }
+
+    return includes;
+}
+
 CLWProgram CLProgramManager::GetProgram(uint32_t id, const std::string &opts) const
 {
     CLProgram &program = m_programs[id];
@@ -121,3 +163,45 @@ void CLProgramManager::CompileProgram(uint32_t id, const std::string &opts) cons
     CLProgram &program = m_programs[id];
     program.Compile(opts);
 }
+
+void CLProgramManager::CompileProgramAsync(uint32_t id, const std::string &opts) const
+{
+    CLProgram &program = m_programs[id];
+    program.CompileAsync(opts);
+}
+
+bool CLProgramManager::IsProgramReady(uint32_t id, const std::string &opts) const
+{
+    CLProgram &program = m_programs[id];
+    return program.IsReady(opts);
+}
+
+void CLProgramManager::SetSharedCachePath(const std::string &path) const
+{
+    m_shared_cache_path = path;
+}
+
+const std::string& CLProgramManager::GetSharedCachePath() const
+{
+    return m_shared_cache_path;
+}
+
+void CLProgramManager::SetBuildProfile(BuildProfile profile) const
+{
+    m_build_profile = profile;
+}
+
+CLProgramManager::BuildProfile CLProgramManager::GetBuildProfile() const
+{
+    return m_build_profile;
+}
+
+WorkGroupTuner& CLProgramManager::GetWorkGroupTuner(CLWContext context) const
+{
+    auto& tuner = m_work_group_tuners[context.GetDevice(0).GetID()];
+    if (!tuner)
+    {
+        tuner.reset(new WorkGroupTuner(context, m_cache_path));
+    }
+    return *tuner;
+}
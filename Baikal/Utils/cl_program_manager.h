@@ -30,6 +30,9 @@ THE SOFTWARE.
 #include "CLWProgram.h"
 #include "CLWContext.h"
 #include "cl_program.h"
+#include "work_group_tuner.h"
+
+#include <memory>
 
 
 namespace Baikal
@@ -37,27 +40,61 @@ namespace Baikal
     class CLProgramManager
     {
     public:
+        // Math options programs are built with, every profile has its own binaries
+        enum class BuildProfile
+        {
+            // Relaxed math
+            kDefault,
+            // Relaxed math, sampling code uses native functions
+            kFast,
+            // IEEE conformant math, for comparisons against reference images
+            kReference
+        };
+
         // Constructor
         explicit CLProgramManager(const std::string &cache_path);
-        // Creates program from file and returns its id
-        uint32_t CreateProgramFromFile(CLWContext context, const std::string &fname) const;
+        // Creates program from file and returns its id, header_overrides maps included header to its replacement
+        uint32_t CreateProgramFromFile(CLWContext context, const std::string &fname,
+                                       const std::map<std::string, std::string> &header_overrides = {}) const;
         // Creates program from source and returns its id
-        uint32_t CreateProgramFromSource(CLWContext context, const std::string &name, const std::string &source) const;
-        // Loads header from file into map of headers
+        uint32_t CreateProgramFromSource(CLWContext context, const std::string &name, const std::string &source,
+                                         const std::map<std::string, std::string> &header_overrides = {}) const;
+        // Loads header from file into map of headers, headers already known are not read again
         void LoadHeader(const std::string &header) const;
         // Adds header to map from source
         void AddHeader(const std::string &header, const std::string &source) const;
         // Reads header from disk and returns its source
         const std::string& ReadHeader(const std::string &header) const;
+        // Returns names included by the header, parsed once per header source
+        const std::vector<std::string>& GetHeaderIncludes(const std::string &header) const;
+        // Returns names of #include <name> directives in the order they appear
+        static std::vector<std::string> ParseIncludes(const std::string &source);
         // Returns compiled program
         CLWProgram GetProgram(uint32_t id, const std::string &opts) const;
         // Compiles program
         void CompileProgram(uint32_t id, const std::string &opts) const;
+        // Compiles program on a worker thread, GetProgram picks up the result once it is ready
+        void CompileProgramAsync(uint32_t id, const std::string &opts) const;
+        // Checks if GetProgram returns without compiling
+        bool IsProgramReady(uint32_t id, const std::string &opts) const;
+        // Sets read-only folder binaries are looked up in when the cache folder misses them,
+        // e.g. a network share warmed up once for a whole farm
+        void SetSharedCachePath(const std::string &path) const;
+        const std::string& GetSharedCachePath() const;
+        // Sets profile of programs requested afterwards
+        void SetBuildProfile(BuildProfile profile) const;
+        BuildProfile GetBuildProfile() const;
+        // Returns local size tuner of the context device, results are stored in cache folder
+        WorkGroupTuner& GetWorkGroupTuner(CLWContext context) const;
 
     private:
         mutable std::string m_cache_path; ///< Path to cache folder
+        mutable std::string m_shared_cache_path; ///< Path to read-only cache folder
+        mutable BuildProfile m_build_profile = BuildProfile::kDefault; ///< Math options of programs
+        mutable std::map<cl_device_id, std::unique_ptr<WorkGroupTuner>> m_work_group_tuners; ///< Tuners by device
         mutable std::map<uint32_t, CLProgram> m_programs; ///< Cache of programs by id
         mutable std::map<std::string, std::string> m_headers; ///< Headers map
+        mutable std::map<std::string, std::vector<std::string>> m_header_includes; ///< Includes of headers by name
         static uint32_t m_next_program_id;
     };
 }
@@ -22,6 +22,9 @@ THE SOFTWARE.
 
 #include "cl_uberv2_generator.h"
 
+#include <sstream>
+#include <stdexcept>
+
 using namespace Baikal;
 
 inline int popcount(std::uint32_t value)
@@ -63,7 +66,7 @@ void CLUberV2Generator::AddMaterial(UberV2Material::Ptr material)
 
 void CLUberV2Generator::MaterialGeneratePrepareInputs(UberV2Material::Ptr material, UberV2Sources *sources)
 {
-    static const std::string reader_function_arguments("material_attributes[offset++], dg, input_map_values, TEXTURE_ARGS");
+    static const std::string reader_function_arguments(", dg, input_map_values, TEXTURE_ARGS");
     struct LayerReader
     {
         std::string variable;
@@ -147,6 +150,10 @@ void CLUberV2Generator::MaterialGeneratePrepareInputs(UberV2Material::Ptr materi
         "{\n"
         "\tint offset = dg->mat.offset + 1;\n";
 
+    // Already read float4 inputs: index in material attributes and variable
+    std::vector<std::pair<std::string, std::string>> colors;
+    auto index = 0u;
+
     // Write code for each layer
     for (auto &reader: readers)
     {
@@ -155,17 +162,54 @@ void CLUberV2Generator::MaterialGeneratePrepareInputs(UberV2Material::Ptr materi
         {
             for (auto &r : reader.second)
             {
-                sources->m_prepare_inputs += std::string("\t") + r.variable + " = " + r.reader + "(" + reader_function_arguments + ");\n";
+                // Transparency input is read at its position in material attributes
+                if (reader.first == UberV2Material::Layers::kTransparencyLayer)
+                {
+                    sources->m_prepare_transparency =
+                        "void UberV2PrepareTransparency" + std::to_string(layers) + "("
+                        "DifferentialGeometry const* dg, GLOBAL InputMapData const* restrict input_map_values,"
+                        "GLOBAL int const* restrict material_attributes, TEXTURE_ARG_LIST, UberV2ShaderData *data)\n"
+                        "{\n"
+                        "\t" + r.variable + " = " + r.reader + "(material_attributes[dg->mat.offset + " + std::to_string(index + 1) + "]" +
+                        reader_function_arguments + ");\n"
+                        "}\n";
+                }
+
+                auto input = "input_map" + std::to_string(index++);
+                bool is_float = (r.reader == "GetInputMapFloat");
+
+                sources->m_prepare_inputs += "\tint " + input + " = material_attributes[offset++];\n";
+                sources->m_prepare_inputs += std::string("\t") + r.variable + " = ";
+
+                // Same input map is often bound to several inputs, reuse its value instead of sampling textures again
+                for (auto &color : colors)
+                {
+                    sources->m_prepare_inputs += "(" + input + " == " + color.first + ") ? " + color.second + (is_float ? ".x" : "") + " :\n\t\t";
+                }
+
+                sources->m_prepare_inputs += r.reader + "(" + input + reader_function_arguments + ");\n";
+
+                if (!is_float)
+                {
+                    colors.emplace_back(input, r.variable);
+                }
             }
         }
     }
 
+    // Diffusion mode is packed with material parameters, see ClwSceneController::WriteMaterial
+    if ((layers & UberV2Material::Layers::kSSSLayer) == UberV2Material::Layers::kSSSLayer)
+    {
+        sources->m_prepare_inputs += "\tdata->sss_diffusion = (material_attributes[dg->mat.offset] >> 4) & 1;\n";
+    }
+
     sources->m_prepare_inputs += "\n}";
 }
 
 std::string CLUberV2Generator::GenerateBlend(const BlendData &blend_data, bool is_float)
 {
     std::string fresnel_function = is_float ? "Fresnel_Blend_F" : "Fresnel_Blend";
+    std::string reflection_function = is_float ? "Reflection_Blend_F" : "Reflection_Blend";
 
     std::string result = is_float ? "0.0f" : "(float3)(0.0f)";
     result.reserve(1024); //1k should be enought
@@ -181,14 +225,27 @@ std::string CLUberV2Generator::GenerateBlend(const BlendData &blend_data, bool i
         return value;
     };
 
+    // Rough reflection takes its lobe albedo into account, see UberV2_GetReflectionWeight
+    auto GenerateReflectionBlend = [&](const std::string &top_ior, const std::string &bottom_ior, const std::string &roughness,
+                                       const std::string &top_value, const std::string &bottom_value) -> std::string
+    {
+        std::string value = reflection_function;
+        value += "(" + top_ior + ", " + bottom_ior + ", " + roughness + ", " + top_value + ", " + bottom_value + ", wi)";
+        return value;
+    };
+
     // Generate BRDF first
     if (!blend_data.m_brdf_values.empty())
     {
         brdf = "(" + blend_data.m_brdf_values[blend_data.m_brdf_values.size() - 1] + ")";
         for (size_t a = blend_data.m_brdf_iors.size() - 1; a > 0 ; --a)
         {
-            brdf = "(" + GenerateFresnelBlend(blend_data.m_brdf_iors[a - 1], blend_data.m_brdf_iors[a],
-                                              blend_data.m_brdf_values[a -1], brdf) + ")";
+            auto const& roughness = blend_data.m_brdf_roughness[a - 1];
+            brdf = "(" + (roughness.empty() ?
+                GenerateFresnelBlend(blend_data.m_brdf_iors[a - 1], blend_data.m_brdf_iors[a],
+                                     blend_data.m_brdf_values[a -1], brdf) :
+                GenerateReflectionBlend(blend_data.m_brdf_iors[a - 1], blend_data.m_brdf_iors[a], roughness,
+                                        blend_data.m_brdf_values[a -1], brdf)) + ")";
         }
     }
 
@@ -246,15 +303,21 @@ void CLUberV2Generator::MaterialGenerateGetPdf(UberV2Material::Ptr material, Ube
         {
             blend.m_brdf_iors.push_back("shader_data->coating_ior");
             blend.m_brdf_values.push_back("UberV2_IdealReflect_GetPdf(shader_data, wi, wo, TEXTURE_ARGS)");
+            blend.m_brdf_roughness.push_back("");
         }
         if ((layers & UberV2Material::Layers::kReflectionLayer) == UberV2Material::Layers::kReflectionLayer)
         {
             blend.m_brdf_iors.push_back("shader_data->reflection_ior");
             blend.m_brdf_values.push_back("UberV2_Reflection_GetPdf(shader_data, wi, wo, TEXTURE_ARGS)");
+            blend.m_brdf_roughness.push_back("shader_data->reflection_roughness");
         }
         if ((layers & UberV2Material::Layers::kDiffuseLayer) == UberV2Material::Layers::kDiffuseLayer)
         {
-            blend.m_brdf_values.push_back("UberV2_Lambert_GetPdf(shader_data, wi, wo, TEXTURE_ARGS)");
+            // Diffusion profile takes over the diffuse layer of SSS materials
+            blend.m_brdf_values.push_back(HasDiffusionSSS(layers) ?
+                "(UberV2_IsDiffusionSSS(shader_data) ? 0.0f : UberV2_Lambert_GetPdf(shader_data, wi, wo, TEXTURE_ARGS))" :
+                "UberV2_Lambert_GetPdf(shader_data, wi, wo, TEXTURE_ARGS)");
+            blend.m_brdf_roughness.push_back("");
         }
 
         // BTDF
@@ -270,7 +333,21 @@ void CLUberV2Generator::MaterialGenerateGetPdf(UberV2Material::Ptr material, Ube
             blend.m_transparency_value = "shader_data->transparency";
         }
 
-        sources->m_get_pdf += "\treturn " + GenerateBlend(blend, true) + ";\n}\n";
+        // Exit point of diffusion subsurface scattering only has its exit lobe
+        if (HasDiffusionSSS(layers))
+        {
+            sources->m_get_pdf +=
+                "\tif (Bxdf_UberV2_GetSampledComponent(dg) == kBxdfUberV2SampleSubsurface)\n"
+                "\t\treturn UberV2_Subsurface_GetPdf(shader_data, wi, wo, TEXTURE_ARGS);\n";
+        }
+
+        sources->m_get_pdf +=
+            "#ifdef BAIKAL_UBERV2_STOCHASTIC_LAYERS\n" +
+            GenerateSampledLayer(layers, "GetPdf", true) +
+            "#else\n"
+            "\treturn " + GenerateBlend(blend, true) + ";\n"
+            "#endif\n"
+            "}\n";
 }
 
 void CLUberV2Generator::MaterialGenerateSample(UberV2Material::Ptr material, UberV2Sources *sources)
@@ -298,6 +375,9 @@ void CLUberV2Generator::MaterialGenerateSample(UberV2Material::Ptr material, Ube
             "\t\tcase kBxdfUberV2SampleRefraction: result = UberV2_Refraction_Sample(shader_data, wi, TEXTURE_ARGS, sample, wo, pdf);\n\t\t\tbreak;\n"},
         {UberV2Material::Layers::kDiffuseLayer,
             "\t\tcase kBxdfUberV2SampleDiffuse: result = UberV2_Lambert_Sample(shader_data, wi, TEXTURE_ARGS, sample, wo, pdf);\n\t\t\tbreak;\n"
+            },
+        {UberV2Material::Layers::kSSSLayer | UberV2Material::Layers::kDiffuseLayer,
+            "\t\tcase kBxdfUberV2SampleSubsurface: result = UberV2_Subsurface_Sample(shader_data, wi, TEXTURE_ARGS, sample, wo, pdf);\n\t\t\tbreak;\n"
             }
     };
 
@@ -427,7 +507,7 @@ void CLUberV2Generator::MaterialGenerateGetBxDFType(UberV2Material::Ptr material
     {
         sources->m_get_bxdf_type +=
             (reflection_has_underlying_layer ?
-                "\tconst float fresnel2 = CalculateFresnel(top_ior, shader_data->reflection_ior, ndotwi);\n"
+                "\tconst float fresnel2 = UberV2_GetReflectionWeight(top_ior, shader_data->reflection_ior, shader_data->reflection_roughness, ndotwi);\n"
                 "\tconst float sample4 = Sampler_Sample1D(sampler, SAMPLER_ARGS);\n"
                 "\tif (sample4 < fresnel2)\n"
                 "\t{\n" : "") +
@@ -445,6 +525,19 @@ void CLUberV2Generator::MaterialGenerateGetBxDFType(UberV2Material::Ptr material
 
     if ((layers & UberV2Material::Layers::kDiffuseLayer) == UberV2Material::Layers::kDiffuseLayer)
     {
+        // Entry point of diffusion subsurface scattering is singular, the estimator traces a probe ray
+        // for the exit point instead of sampling a direction
+        if (HasDiffusionSSS(layers))
+        {
+            sources->m_get_bxdf_type +=
+                "\tif (UberV2_IsDiffusionSSS(shader_data))\n"
+                "\t{\n"
+                "\t\tBxdf_UberV2_SetSampledComponent(dg, kBxdfUberV2SampleSubsurface);\n"
+                "\t\tBxdf_SetFlags(dg, bxdf_flags | kBxdfFlagsBrdf | kBxdfFlagsSingular);\n"
+                "\t\treturn;\n"
+                "\t}\n";
+        }
+
         sources->m_get_bxdf_type +=
             "\tBxdf_UberV2_SetSampledComponent(dg, kBxdfUberV2SampleDiffuse);\n"
             "\tbxdf_flags |= kBxdfFlagsBrdf;\n";
@@ -471,15 +564,21 @@ void CLUberV2Generator::MaterialGenerateEvaluate(UberV2Material::Ptr material, U
         {
             blend.m_brdf_iors.push_back("shader_data->coating_ior");
             blend.m_brdf_values.push_back("UberV2_IdealReflect_Evaluate(shader_data, wi, wo, TEXTURE_ARGS)");
+            blend.m_brdf_roughness.push_back("");
         }
         if ((layers & UberV2Material::Layers::kReflectionLayer) == UberV2Material::Layers::kReflectionLayer)
         {
             blend.m_brdf_iors.push_back("shader_data->reflection_ior");
             blend.m_brdf_values.push_back("UberV2_Reflection_Evaluate(shader_data, wi, wo, TEXTURE_ARGS)");
+            blend.m_brdf_roughness.push_back("shader_data->reflection_roughness");
         }
         if ((layers & UberV2Material::Layers::kDiffuseLayer) == UberV2Material::Layers::kDiffuseLayer)
         {
-            blend.m_brdf_values.push_back("UberV2_Lambert_Evaluate(shader_data, wi, wo, TEXTURE_ARGS)");
+            // Diffusion profile takes over the diffuse layer of SSS materials
+            blend.m_brdf_values.push_back(HasDiffusionSSS(layers) ?
+                "(UberV2_IsDiffusionSSS(shader_data) ? (float3)(0.0f) : UberV2_Lambert_Evaluate(shader_data, wi, wo, TEXTURE_ARGS))" :
+                "UberV2_Lambert_Evaluate(shader_data, wi, wo, TEXTURE_ARGS)");
+            blend.m_brdf_roughness.push_back("");
         }
 
         // BTDF
@@ -495,7 +594,92 @@ void CLUberV2Generator::MaterialGenerateEvaluate(UberV2Material::Ptr material, U
             blend.m_transparency_value = "shader_data->transparency";
         }
 
-        sources->m_evaluate += "\treturn " + GenerateBlend(blend, false) + ";\n}\n";
+        // Exit point of diffusion subsurface scattering only has its exit lobe
+        if (HasDiffusionSSS(layers))
+        {
+            sources->m_evaluate +=
+                "\tif (Bxdf_UberV2_GetSampledComponent(dg) == kBxdfUberV2SampleSubsurface)\n"
+                "\t\treturn UberV2_Subsurface_Evaluate(shader_data, wi, wo, TEXTURE_ARGS);\n";
+        }
+
+        sources->m_evaluate +=
+            "#ifdef BAIKAL_UBERV2_STOCHASTIC_LAYERS\n" +
+            GenerateSampledLayer(layers, "Evaluate", false) +
+            "#else\n"
+            "\treturn " + GenerateBlend(blend, false) + ";\n"
+            "#endif\n"
+            "}\n";
+}
+
+std::string CLUberV2Generator::GenerateSampledLayer(std::uint32_t layers, const std::string &function, bool is_float)
+{
+    // Layer, its sampled component and prefix of its brick functions
+    std::vector<std::pair<std::uint32_t, std::pair<std::string, std::string>>> components =
+    {
+        {UberV2Material::Layers::kCoatingLayer, {"kBxdfUberV2SampleCoating", "UberV2_IdealReflect_"}},
+        {UberV2Material::Layers::kReflectionLayer, {"kBxdfUberV2SampleReflection", "UberV2_Reflection_"}},
+        {UberV2Material::Layers::kRefractionLayer, {"kBxdfUberV2SampleRefraction", "UberV2_Refraction_"}},
+        {UberV2Material::Layers::kDiffuseLayer, {"kBxdfUberV2SampleDiffuse", "UberV2_Lambert_"}}
+    };
+
+    std::string result =
+        "\tswitch (Bxdf_UberV2_GetSampledComponent(dg))\n"
+        "\t{\n";
+
+    for (auto &component : components)
+    {
+        if ((layers & component.first) == component.first)
+        {
+            result += "\t\tcase " + component.second.first + ": return " + component.second.second + function +
+                "(shader_data, wi, wo, TEXTURE_ARGS);\n";
+        }
+    }
+
+    // Transparency passes light through and doesn't contribute
+    result += "\t}\n"
+        "\treturn " + std::string(is_float ? "0.0f" : "(float3)(0.0f)") + ";\n";
+
+    return result;
+}
+
+bool CLUberV2Generator::HasDiffusionSSS(std::uint32_t layers)
+{
+    // Diffusion profile scatters the light of the diffuse layer
+    std::uint32_t const sss_layers = UberV2Material::Layers::kSSSLayer | UberV2Material::Layers::kDiffuseLayer;
+    return (layers & sss_layers) == sss_layers;
+}
+
+std::string CLUberV2Generator::GetVariantGuard(std::uint32_t layers)
+{
+    // Kernel variants only compile the layer combinations they own, see GetVariantBuildOptions
+    return "#if !defined(BAIKAL_UBERV2_VARIANT) || ((BAIKAL_UBERV2_OWNED_" + std::to_string(layers / 64) +
+        " >> " + std::to_string(layers % 64) + ") & 1)\n";
+}
+
+std::string CLUberV2Generator::GetVariantBuildOptions(std::set<std::uint32_t> const& owned_layers)
+{
+    std::uint64_t owned[4] = {};
+
+    for (auto layers : owned_layers)
+    {
+        if (layers >= 256)
+        {
+            throw std::runtime_error("CLUberV2Generator: layer combination doesn't fit into variant mask");
+        }
+
+        owned[layers / 64] |= (1ull << (layers % 64));
+    }
+
+    std::ostringstream oss;
+    oss << " -D BAIKAL_UBERV2_VARIANT";
+
+    for (auto i = 0u; i < 4; ++i)
+    {
+        oss << " -D BAIKAL_UBERV2_OWNED_" << i << "=0x" << std::hex << owned[i] << std::dec << "ul";
+    }
+
+    oss << " ";
+    return oss.str();
 }
 
 std::string Baikal::CLUberV2Generator::BuildSource()
@@ -506,13 +690,17 @@ std::string Baikal::CLUberV2Generator::BuildSource()
     // Merge all per-material sources
     for(auto material : m_materials)
     {
+        source += GetVariantGuard(material.first);
         source += material.second.m_get_bxdf_type + "\n";
         source += material.second.m_evaluate + "\n";
         source += material.second.m_get_pdf + "\n";
         source += material.second.m_prepare_inputs + "\n";
+        source += material.second.m_prepare_transparency + "\n";
         source += material.second.m_sample + "\n";
+        source += "#endif\n";
     }
     source += GeneratePrepareInputsDispatcher();
+    source += GeneratePrepareTransparencyDispatcher();
     source += GenerateGetBxDFTypeDispatcher();
     source += GenerateGetPdfDispatcher();
     source += GenerateEvaluateDispatcher();
@@ -536,8 +724,10 @@ std::string Baikal::CLUberV2Generator::GenerateEvaluateDispatcher()
 
     for(auto material : m_materials)
     {
+        source += GetVariantGuard(material.first);
         source += "\t\tcase " + std::to_string(material.first) + ":\n" +
             "\t\t\treturn UberV2_Evaluate" + std::to_string(material.first) + "(dg, wi_t, wo_t, TEXTURE_ARGS, shader_data);\n";
+        source += "#endif\n";
     }
 
     source += "\t}\n\treturn (float3)(0.0f);\n}\n";
@@ -560,8 +750,10 @@ std::string Baikal::CLUberV2Generator::GenerateGetPdfDispatcher()
 
     for(auto material : m_materials)
     {
+        source += GetVariantGuard(material.first);
         source += "\t\tcase " + std::to_string(material.first) + ":\n" +
             "\t\t\treturn UberV2_GetPdf" + std::to_string(material.first) + "(dg, wi_t, wo_t, TEXTURE_ARGS, shader_data);\n";
+        source += "#endif\n";
     }
 
     source += "\t}\n\treturn 0.0f;\n}\n";
@@ -586,9 +778,11 @@ std::string Baikal::CLUberV2Generator::GenerateSampleDispatcher()
 
     for(auto material : m_materials)
     {
+        source += GetVariantGuard(material.first);
         source += "\t\tcase " + std::to_string(material.first) + ":\n" +
             "\t\t\tres = UberV2_Sample" + std::to_string(material.first) + "(dg, wi_t, TEXTURE_ARGS, sample, &wo_t, pdf, shader_data);\n"
             "\t\t\tbreak;\n";
+        source += "#endif\n";
     }
 
     source += "\t}\n"
@@ -611,8 +805,10 @@ std::string Baikal::CLUberV2Generator::GeneratePrepareInputsDispatcher()
 
     for(auto material : m_materials)
     {
+        source += GetVariantGuard(material.first);
         source += "\t\tcase " + std::to_string(material.first) + ":\n" +
             "\t\t\treturn UberV2PrepareInputs" + std::to_string(material.first) + "(dg, input_map_values, material_attributes, TEXTURE_ARGS, shader_data);\n";
+        source += "#endif\n";
     }
 
     source += "\t}\n"
@@ -622,6 +818,35 @@ std::string Baikal::CLUberV2Generator::GeneratePrepareInputsDispatcher()
 
 }
 
+std::string Baikal::CLUberV2Generator::GeneratePrepareTransparencyDispatcher()
+{
+    std::string source =
+        "void UberV2PrepareTransparency("
+        "DifferentialGeometry const* dg, GLOBAL InputMapData const* restrict input_map_values,"
+        "GLOBAL int const* restrict material_attributes, TEXTURE_ARG_LIST, UberV2ShaderData *shader_data)\n"
+        "{\n"
+        "\tswitch(dg->mat.layers)\n"
+        "\t{\n";
+
+    for(auto material : m_materials)
+    {
+        if (material.second.m_prepare_transparency.empty())
+        {
+            continue;
+        }
+
+        source += GetVariantGuard(material.first);
+        source += "\t\tcase " + std::to_string(material.first) + ":\n" +
+            "\t\t\treturn UberV2PrepareTransparency" + std::to_string(material.first) + "(dg, input_map_values, material_attributes, TEXTURE_ARGS, shader_data);\n";
+        source += "#endif\n";
+    }
+
+    source += "\t}\n"
+        "}\n";
+
+    return source;
+}
+
 std::string Baikal::CLUberV2Generator::GenerateGetBxDFTypeDispatcher()
 {
     std::string source =
@@ -633,9 +858,11 @@ std::string Baikal::CLUberV2Generator::GenerateGetBxDFTypeDispatcher()
 
     for(auto material : m_materials)
     {
+        source += GetVariantGuard(material.first);
         source += "\t\tcase " + std::to_string(material.first) + ":\n" +
             "\t\t\treturn GetMaterialBxDFType" + std::to_string(material.first) + "(wi, sampler, SAMPLER_ARGS, dg, shader_data);\n"
             "\t\t\tbreak;\n";
+        source += "#endif\n";
     }
 
     source += "\t}\n"
@@ -22,7 +22,10 @@ THE SOFTWARE.
 
 #pragma once
 
+#include <cstdint>
 #include <map>
+#include <set>
+#include <string>
 
 #include "SceneGraph/uberv2material.h"
 
@@ -52,10 +55,27 @@ namespace Baikal
          */
         std::string BuildSource();
 
+        /**
+         * @brief Returns build options of a kernel variant shading only given layer combinations
+         *
+         * Per-material functions of other combinations are left out of the variant,
+         * so its register use follows the materials it owns. Variant kernels skip
+         * hits with other materials, so every combination should be owned by exactly one variant.
+         *
+         * @param owned_layers layer combinations shaded by the variant
+         * @return build options
+         */
+        static std::string GetVariantBuildOptions(std::set<std::uint32_t> const& owned_layers);
+
     private:
+        // Returns preprocessor condition enabling code of the layer combination
+        static std::string GetVariantGuard(std::uint32_t layers);
+
         struct UberV2Sources
         {
             std::string m_prepare_inputs;
+            // Empty if material has no transparency layer
+            std::string m_prepare_transparency;
             std::string m_get_pdf;
             std::string m_sample;
             std::string m_get_bxdf_type;
@@ -66,6 +86,8 @@ namespace Baikal
         {
             std::vector<std::string> m_brdf_iors;
             std::vector<std::string> m_brdf_values;
+            // Roughness of each BRDF value if it is blended as rough reflection, empty otherwise
+            std::vector<std::string> m_brdf_roughness;
             std::string m_btdf_ior;
             std::string m_btdf_value;
             std::string m_transparency_value;
@@ -79,13 +101,37 @@ namespace Baikal
          *    BxDF = F(1.0, refraction_ior) * BRDF + (1.0f - F(1.0, refraction_ior)) * refraction
          *    BRDF = F(1.0, coating_ior) * coating + (1.0f - F(1.0f, coating_ior) *
          *    (F(coating_ior, reflection_ior) * reflection + (1.0f - F(coating_ior, reflection_ior)) * diffuse)
+         * Rough reflection is blended by UberV2_GetReflectionWeight instead of F
          *
          * @param is_float should be set to true if generating blend for float value and false if generating for float4
          */
         std::string GenerateBlend(const BlendData &blend_data, bool is_float);
 
+        /**
+         * @brief Generates evaluation of the layer selected by GetMaterialBxDFType only
+         *
+         * Used if BAIKAL_UBERV2_STOCHASTIC_LAYERS is defined. Layers are selected with
+         * probabilities equal to their blend weights, so the value of the selected layer
+         * is an unbiased estimate of the blend and needs no further weighting.
+         *
+         * @param function brick function to call, Evaluate or GetPdf
+         * @param is_float should be set to true if generating for float value and false if generating for float3
+         */
+        static std::string GenerateSampledLayer(std::uint32_t layers, const std::string &function, bool is_float);
+
+        /**
+         * @brief Checks if layer combination can be shaded by diffusion profile
+         *
+         * Materials with SSS and diffuse layers in kSSSDiffusion mode scatter the light
+         * of the diffuse layer by the profile, see UberV2_IsDiffusionSSS.
+         */
+        static bool HasDiffusionSSS(std::uint32_t layers);
+
         /**
          * @brief Generates function that will fill ShaderData structure with values
+         *
+         * For materials with transparency layer also generates function that only fills transparency,
+         * it is enough to shade hits where the transparency layer is going to be selected
          */
         void MaterialGeneratePrepareInputs(UberV2Material::Ptr material, UberV2Sources *sources);
 
@@ -131,6 +177,7 @@ namespace Baikal
         std::string GenerateSampleDispatcher();
         std::string GenerateGetBxDFTypeDispatcher();
         std::string GeneratePrepareInputsDispatcher();
+        std::string GeneratePrepareTransparencyDispatcher();
 
         std::map<std::uint32_t, UberV2Sources> m_materials;
     };
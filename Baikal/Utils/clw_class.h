@@ -4,6 +4,7 @@
 #include <numeric>
 #include <vector>
 #include <fstream>
+#include <map>
 #include <regex>
 #include <sstream>
 #include <unordered_map>
@@ -24,22 +25,39 @@ namespace Baikal
             std::string const& name,
             std::string const& source,
             std::unordered_map<char const*, char const*> const& headers,
-            std::string const& opts = "");
+            std::string const& opts = "",
+            std::map<std::string, std::string> const& header_overrides = {});
 #else
         //create from file
         ClwClass(CLWContext context,
             const CLProgramManager *program_manager,
             std::string const& cl_file,
-            std::string const& opts = "");
+            std::string const& opts = "",
+            std::map<std::string, std::string> const& header_overrides = {});
 #endif
 
         virtual ~ClwClass() = default;
 
         CLWContext GetContext() const { return m_context; }
+        // Queue the commands of the class to another context of the same OpenCL context and device,
+        // e.g. one wrapping a command queue of its own. Programs are shared, so kernels stay valid.
+        void SetContext(CLWContext context) { m_context = context; }
         CLWKernel GetKernel(std::string const& name, std::string const& opts = "");
+        // Checks if GetKernel returns without compiling the program
+        bool IsProgramReady(std::string const& opts = "") const;
+        // Compiles the program in background, GetKernel picks up the result
+        void CompileProgramAsync(std::string const& opts = "") const;
         void SetDefaultBuildOptions(std::string const& opts);
         std::string GetDefaultBuildOpts() const { return m_default_opts; }
         std::string GetFullBuildOpts() const;
+        // Launches 1D kernel over size work items with the local size tuned for the device, see WorkGroupTuner
+        void LaunchTuned(CLWKernel kernel, char const* name, std::size_t size) const;
+
+        // Checks if kernels take texture images after texture data, see BAIKAL_TEXTURE_IMAGES.
+        // Devices without image support fall back to sampling texture data buffer only.
+        static bool UsesTextureImages(CLWContext const& context);
+        // Checks if the context runs on a CPU OpenCL runtime, see BAIKAL_CPU_DEVICE.
+        static bool IsCpuDevice(CLWContext const& context);
 
     private:
         void AddCommonOptions(std::string& opts) const;
@@ -52,6 +70,10 @@ namespace Baikal
         uint32_t m_program_id;
         // Default build options
         std::string m_default_opts;
+        // Device samples texture images, see UsesTextureImages
+        bool m_uses_texture_images;
+        // Device is a CPU, see IsCpuDevice
+        bool m_is_cpu_device;
     };
 
 #ifdef BAIKAL_EMBED_KERNELS
@@ -61,14 +83,17 @@ namespace Baikal
         std::string const& name,
         std::string const& source,
         std::unordered_map<char const*, char const*> const& headers,
-        std::string const& opts)
+        std::string const& opts,
+        std::map<std::string, std::string> const& header_overrides)
         : m_context(context)
         , m_program_manager(program_manager)
+        , m_uses_texture_images(UsesTextureImages(context))
+        , m_is_cpu_device(IsCpuDevice(context))
     {
         auto options = opts;
         AddCommonOptions(options);
 
-        m_program_id = m_program_manager->CreateProgramFromSource(context, name, source);
+        m_program_id = m_program_manager->CreateProgramFromSource(context, name, source, header_overrides);
         for (auto const& header : headers)
         {
             m_program_manager->AddHeader(header.first, header.second);
@@ -79,14 +104,17 @@ namespace Baikal
         CLWContext context,
         const CLProgramManager *program_manager,
         std::string const& cl_file,
-        std::string const& opts)
+        std::string const& opts,
+        std::map<std::string, std::string> const& header_overrides)
         : m_context(context)
         , m_program_manager(program_manager)
+        , m_uses_texture_images(UsesTextureImages(context))
+        , m_is_cpu_device(IsCpuDevice(context))
     {
         auto options = opts;
         AddCommonOptions(options);
 
-        m_program_id = m_program_manager->CreateProgramFromFile(context, cl_file);
+        m_program_id = m_program_manager->CreateProgramFromFile(context, cl_file, header_overrides);
     }
 #endif
 
@@ -97,11 +125,36 @@ namespace Baikal
         return m_program_manager->GetProgram(m_program_id, options).GetKernel(name);
     }
 
+    inline bool ClwClass::IsProgramReady(std::string const& opts) const
+    {
+        std::string options = opts.empty() ? m_default_opts : opts;
+        AddCommonOptions(options);
+        return m_program_manager->IsProgramReady(m_program_id, options);
+    }
+
+    inline void ClwClass::CompileProgramAsync(std::string const& opts) const
+    {
+        std::string options = opts.empty() ? m_default_opts : opts;
+        AddCommonOptions(options);
+        m_program_manager->CompileProgramAsync(m_program_id, options);
+    }
+
 
     inline void ClwClass::AddCommonOptions(std::string& opts) const
     {
-        opts.append(" -cl-mad-enable -cl-fast-relaxed-math "
-            "-cl-std=CL1.2 -I . ");
+        switch (m_program_manager->GetBuildProfile())
+        {
+        case CLProgramManager::BuildProfile::kFast:
+            opts.append(" -cl-mad-enable -cl-fast-relaxed-math -D BAIKAL_FAST_MATH ");
+            break;
+        case CLProgramManager::BuildProfile::kReference:
+            break;
+        default:
+            opts.append(" -cl-mad-enable -cl-fast-relaxed-math ");
+            break;
+        }
+
+        opts.append(" -cl-std=CL1.2 -I . ");
 
         opts.append(
 #if defined(__APPLE__)
@@ -114,6 +167,82 @@ namespace Baikal
             ""
 #endif
         );
+
+#ifdef BAIKAL_COMPACT_PATH
+        // Path state layout has to match the host one
+        opts.append(" -D BAIKAL_COMPACT_PATH ");
+#endif
+
+#ifdef BAIKAL_COMPRESSED_GEOMETRY
+        // Vertex attribute formats have to match the host ones
+        opts.append(" -D BAIKAL_COMPRESSED_GEOMETRY ");
+#endif
+
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+        // Texture data layout has to match the host one
+        opts.append(" -D BAIKAL_TEXTURE_MIPMAPS ");
+#endif
+
+#ifdef BAIKAL_TILED_TEXTURES
+        // Texel addressing has to match the host upload
+        opts.append(" -D BAIKAL_TILED_TEXTURES ");
+#endif
+
+#ifdef BAIKAL_SH_IRRADIANCE
+        // Environment irradiance coefficients are only built by the host with the option
+        opts.append(" -D BAIKAL_SH_IRRADIANCE ");
+#endif
+
+#ifdef BAIKAL_AREA_LIGHT_IMPORTANCE
+        // Light sampling and MIS have to agree on area light pdfs
+        opts.append(" -D BAIKAL_AREA_LIGHT_IMPORTANCE ");
+#endif
+
+#ifdef BAIKAL_LIGHT_GRID
+        // Light distribution buffer holds light grid instead of light BVH
+        opts.append(" -D BAIKAL_LIGHT_GRID ");
+#endif
+
+#ifdef BAIKAL_MOTION_BLUR
+        // Shape velocities are only written by the host with the option
+        opts.append(" -D BAIKAL_MOTION_BLUR ");
+#endif
+
+#ifdef BAIKAL_VERTEX_TANGENTS
+        // Tangent buffer is only filled by the host with the option
+        opts.append(" -D BAIKAL_VERTEX_TANGENTS ");
+#endif
+
+        if (m_uses_texture_images)
+        {
+            // Kernel arguments have to match the ones set by the host
+            opts.append(" -D BAIKAL_TEXTURE_IMAGES ");
+        }
+
+        if (m_is_cpu_device)
+        {
+            // CPU runtimes emulate local memory, kernels pick plain global memory paths
+            opts.append(" -D BAIKAL_CPU_DEVICE ");
+        }
+    }
+
+    inline bool ClwClass::UsesTextureImages(CLWContext const& context)
+    {
+#ifdef BAIKAL_TEXTURE_IMAGES
+        cl_bool image_support = CL_FALSE;
+        clGetDeviceInfo(context.GetDevice(0).GetID(), CL_DEVICE_IMAGE_SUPPORT, sizeof(image_support), &image_support, nullptr);
+        return image_support == CL_TRUE;
+#else
+        (void)context;
+        return false;
+#endif
+    }
+
+    inline bool ClwClass::IsCpuDevice(CLWContext const& context)
+    {
+        cl_device_type type = 0;
+        clGetDeviceInfo(context.GetDevice(0).GetID(), CL_DEVICE_TYPE, sizeof(type), &type, nullptr);
+        return (type & CL_DEVICE_TYPE_CPU) != 0;
     }
 
     inline std::string ClwClass::GetFullBuildOpts() const
@@ -123,6 +252,11 @@ namespace Baikal
         return options;
     }
 
+    inline void ClwClass::LaunchTuned(CLWKernel kernel, char const* name, std::size_t size) const
+    {
+        m_program_manager->GetWorkGroupTuner(m_context).Launch1D(m_context, kernel, name, size);
+    }
+
     inline void ClwClass::SetDefaultBuildOptions(std::string const& opts)
     {
         m_default_opts = opts;
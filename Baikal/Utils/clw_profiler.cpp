@@ -0,0 +1,251 @@
+#include "clw_profiler.h"
+#include "trace.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace Baikal
+{
+    ClwProfiler::ClwProfiler(CLWContext context)
+        : m_context(context)
+        , m_enabled(false)
+        , m_timing_supported(false)
+        , m_last_end(0)
+        , m_has_last_end(false)
+        , m_host_offset(0)
+        , m_has_host_offset(false)
+        , m_track(context.GetDevice(0).GetName())
+    {
+        cl_command_queue_properties properties = 0;
+        auto status = clGetCommandQueueInfo(m_context.GetCommandQueue(0), CL_QUEUE_PROPERTIES,
+            sizeof(properties), &properties, nullptr);
+
+        m_timing_supported = (status == CL_SUCCESS) && (properties & CL_QUEUE_PROFILING_ENABLE);
+    }
+
+    ClwProfiler::~ClwProfiler()
+    {
+        ReleaseMarkers();
+    }
+
+    void ClwProfiler::SetEnabled(bool enabled)
+    {
+        if (!enabled)
+        {
+            ReleaseMarkers();
+        }
+
+        m_enabled = enabled;
+    }
+
+    void ClwProfiler::Begin()
+    {
+        if (!m_enabled || !m_timing_supported)
+        {
+            return;
+        }
+
+        auto host_time = Tracer::Now();
+
+        cl_event event = nullptr;
+        if (clEnqueueMarkerWithWaitList(m_context.GetCommandQueue(0), 0, nullptr, &event) != CL_SUCCESS)
+        {
+            throw std::runtime_error("ClwProfiler: cannot enqueue marker");
+        }
+
+        m_markers.push_back({ -1, event, host_time });
+    }
+
+    void ClwProfiler::Mark(char const* name, std::uint32_t pass)
+    {
+        if (!m_enabled)
+        {
+            return;
+        }
+
+        int index = 0;
+        FindEntry(name, pass, &index);
+
+        if (!m_timing_supported)
+        {
+            return;
+        }
+
+        cl_event event = nullptr;
+        if (clEnqueueMarkerWithWaitList(m_context.GetCommandQueue(0), 0, nullptr, &event) != CL_SUCCESS)
+        {
+            throw std::runtime_error("ClwProfiler: cannot enqueue marker");
+        }
+
+        m_markers.push_back({ index, event, 0u });
+    }
+
+    void ClwProfiler::Count(char const* name, std::uint32_t pass, std::uint64_t value)
+    {
+        if (!m_enabled)
+        {
+            return;
+        }
+
+        auto& entry = FindEntry(name, pass);
+        entry.count += value;
+        ++entry.num_counts;
+    }
+
+    void ClwProfiler::Resolve(bool wait)
+    {
+        if (m_markers.empty())
+        {
+            return;
+        }
+
+        if (wait)
+        {
+            m_context.Flush(0);
+        }
+
+        // Markers complete in submission order, stop at the first pending one
+        std::size_t num_resolved = 0;
+        for (auto const& marker : m_markers)
+        {
+            if (wait)
+            {
+                clWaitForEvents(1, &marker.event);
+            }
+            else
+            {
+                cl_int execution_status = CL_QUEUED;
+                clGetEventInfo(marker.event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(execution_status), &execution_status, nullptr);
+
+                if (execution_status != CL_COMPLETE)
+                {
+                    break;
+                }
+            }
+
+            cl_ulong end = 0;
+            clGetEventProfilingInfo(marker.event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+
+#ifdef BAIKAL_TRACE
+            // Device clock is only related to the host one through the enqueue time of chain starts
+            if (marker.entry < 0)
+            {
+                cl_ulong queued = 0;
+                clGetEventProfilingInfo(marker.event, CL_PROFILING_COMMAND_QUEUED, sizeof(queued), &queued, nullptr);
+                m_host_offset = static_cast<std::int64_t>(marker.host_time) - static_cast<std::int64_t>(queued);
+                m_has_host_offset = true;
+            }
+#endif
+
+            if (marker.entry >= 0 && m_has_last_end && end >= m_last_end)
+            {
+                auto& entry = m_entries[marker.entry];
+                entry.milliseconds += (end - m_last_end) * 1e-6;
+                ++entry.num_spans;
+
+#ifdef BAIKAL_TRACE
+                if (m_has_host_offset && Tracer::Get().IsEnabled())
+                {
+                    auto name = entry.pass == kNoPass ? entry.name : entry.name + " " + std::to_string(entry.pass);
+                    Tracer::Get().AddDeviceEvent(m_track, name, m_last_end + m_host_offset, end + m_host_offset);
+                }
+#endif
+            }
+
+            m_last_end = end;
+            m_has_last_end = true;
+
+            clReleaseEvent(marker.event);
+            ++num_resolved;
+        }
+
+        m_markers.erase(m_markers.begin(), m_markers.begin() + num_resolved);
+    }
+
+    void ClwProfiler::Reset()
+    {
+        ReleaseMarkers();
+        m_entries.clear();
+    }
+
+    void ClwProfiler::WriteJson(std::ostream& stream) const
+    {
+        stream << "[\n";
+
+        for (std::size_t i = 0; i < m_entries.size(); ++i)
+        {
+            auto const& entry = m_entries[i];
+
+            stream << "  { \"name\": \"";
+            for (auto c : entry.name)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    stream << '\\';
+                }
+                stream << c;
+            }
+            stream << "\"";
+
+            if (entry.pass != kNoPass)
+            {
+                stream << ", \"pass\": " << entry.pass;
+            }
+
+            if (entry.num_spans > 0)
+            {
+                stream << ", \"milliseconds\": " << entry.milliseconds / entry.num_spans
+                       << ", \"total_milliseconds\": " << entry.milliseconds
+                       << ", \"spans\": " << entry.num_spans;
+            }
+
+            if (entry.num_counts > 0)
+            {
+                stream << ", \"count\": " << static_cast<double>(entry.count) / entry.num_counts
+                       << ", \"total_count\": " << entry.count
+                       << ", \"counts\": " << entry.num_counts;
+            }
+
+            stream << " }" << (i + 1 < m_entries.size() ? ",\n" : "\n");
+        }
+
+        stream << "]\n";
+    }
+
+    ClwProfiler::Entry& ClwProfiler::FindEntry(char const* name, std::uint32_t pass, int* index)
+    {
+        // Few dozens of entries at most, linear search is fine
+        for (std::size_t i = 0; i < m_entries.size(); ++i)
+        {
+            if (m_entries[i].pass == pass && m_entries[i].name == name)
+            {
+                if (index)
+                {
+                    *index = static_cast<int>(i);
+                }
+
+                return m_entries[i];
+            }
+        }
+
+        if (index)
+        {
+            *index = static_cast<int>(m_entries.size());
+        }
+
+        m_entries.push_back({ name, pass, 0.0, 0u, 0u, 0u });
+        return m_entries.back();
+    }
+
+    void ClwProfiler::ReleaseMarkers()
+    {
+        for (auto const& marker : m_markers)
+        {
+            clReleaseEvent(marker.event);
+        }
+
+        m_markers.clear();
+        m_has_last_end = false;
+        m_has_host_offset = false;
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "CLW.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Baikal
+{
+    ///< The class measures device time of render steps with marker commands enqueued between them,
+    ///< so kernels are launched as usual and nothing waits for the device while rendering.
+    ///< A step spans from the end of the previous marker to the end of its own one.
+    ///< Markers are resolved once their events are complete, Resolve does not block by default.
+    ///< Device times are only available if the context queue is created with profiling enabled,
+    ///< otherwise the profiler only records counts. Resolved spans are also added to the Tracer
+    ///< timeline while it is started, in host time estimated from the queue times of chain starts.
+    ///<
+    class ClwProfiler
+    {
+    public:
+        // Pass of the steps running once per sample rather than per bounce
+        static std::uint32_t constexpr kNoPass = 0xffffffffu;
+
+        struct Entry
+        {
+            std::string name;
+            std::uint32_t pass;
+            // Device time summed over all resolved spans
+            double milliseconds;
+            std::uint32_t num_spans;
+            // Values summed over all Count calls
+            std::uint64_t count;
+            std::uint32_t num_counts;
+        };
+
+        explicit ClwProfiler(CLWContext context);
+        ~ClwProfiler();
+
+        // Profiler does nothing until enabled
+        void SetEnabled(bool enabled);
+        bool IsEnabled() const { return m_enabled; }
+
+        // Check if the context queue records device times
+        bool IsTimingSupported() const { return m_timing_supported; }
+
+        // Start a new chain of spans, work enqueued before is not accounted
+        void Begin();
+        // End the span of a step in the current chain
+        void Mark(char const* name, std::uint32_t pass = kNoPass);
+        // Add a host known value to a step, e.g. number of rays
+        void Count(char const* name, std::uint32_t pass, std::uint64_t value);
+
+        // Accumulate device times of complete markers, if wait is set blocks until all of them are done
+        void Resolve(bool wait = false);
+        // Drop accumulated data and pending markers
+        void Reset();
+
+        // Entries in the order steps have been seen first
+        std::vector<Entry> const& GetEntries() const { return m_entries; }
+
+        // Write entries as a JSON array of objects with per span and per count averages
+        void WriteJson(std::ostream& stream) const;
+
+        ClwProfiler(ClwProfiler const&) = delete;
+        ClwProfiler& operator = (ClwProfiler const&) = delete;
+
+    private:
+        struct Marker
+        {
+            // Index of the entry the span ends, -1 for the chain start
+            int entry;
+            cl_event event;
+            // Host time of enqueueing a chain start
+            std::uint64_t host_time;
+        };
+
+        Entry& FindEntry(char const* name, std::uint32_t pass, int* index = nullptr);
+        void ReleaseMarkers();
+
+        CLWContext m_context;
+        bool m_enabled;
+        bool m_timing_supported;
+        std::vector<Entry> m_entries;
+        // Markers in submission order, the first one is resolved or a chain start
+        std::vector<Marker> m_markers;
+        // End time of the last resolved marker in nanoseconds
+        cl_ulong m_last_end;
+        bool m_has_last_end;
+        // Host minus device time of the last resolved chain start
+        std::int64_t m_host_offset;
+        bool m_has_host_offset;
+        // Tracer track of the device
+        std::string m_track;
+    };
+}
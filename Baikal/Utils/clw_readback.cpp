@@ -0,0 +1,156 @@
+#include "clw_readback.h"
+
+#include <stdexcept>
+
+namespace Baikal
+{
+    ClwReadback::ClwReadback(CLWContext context)
+        : m_context(context)
+        , m_queue(nullptr)
+        , m_mapped(nullptr)
+        , m_data(nullptr)
+        , m_capacity(0)
+        , m_size(0)
+        , m_event(nullptr)
+    {
+        cl_int status = CL_SUCCESS;
+        m_queue = clCreateCommandQueue(m_context, m_context.GetDevice(0), 0, &status);
+
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error("ClwReadback: cannot create command queue");
+        }
+    }
+
+    ClwReadback::~ClwReadback()
+    {
+        Wait();
+        ReleaseEvent();
+
+        if (m_mapped)
+        {
+            m_context.UnmapBuffer(0, m_pinned, m_mapped).Wait();
+        }
+
+        clReleaseCommandQueue(m_queue);
+    }
+
+    CLWBuffer<char> ClwReadback::GetStagingBuffer(std::size_t size)
+    {
+        // Previous copy might still read from the staging buffer
+        Wait();
+
+        if (m_capacity < size)
+        {
+            m_staging = m_context.CreateBuffer<char>(size, CL_MEM_READ_WRITE);
+
+            if (m_mapped)
+            {
+                m_context.UnmapBuffer(0, m_pinned, m_mapped).Wait();
+            }
+
+            // Host accessible allocation stays mapped, reads into it avoid an extra pinning copy by the driver
+            m_pinned = m_context.CreateBuffer<char>(size, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR);
+            m_context.MapBuffer(0, m_pinned, CL_MAP_READ, &m_mapped).Wait();
+            m_capacity = size;
+        }
+
+        return m_staging;
+    }
+
+    void ClwReadback::Enqueue(std::size_t size, CLWEvent event)
+    {
+        if (size > m_capacity)
+        {
+            throw std::runtime_error("ClwReadback: staging buffer is too small");
+        }
+
+        Wait();
+        ReleaseEvent();
+
+        // Make sure the conversion work is submitted before the copy waits for it
+        m_context.Flush(0);
+
+        cl_event wait_event = event;
+        auto status = clEnqueueReadBuffer(m_queue, m_staging, CL_FALSE, 0, size, m_mapped,
+            1, &wait_event, &m_event);
+
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error("ClwReadback: cannot enqueue read");
+        }
+
+        clFlush(m_queue);
+        m_size = size;
+        m_data = m_mapped;
+    }
+
+    void ClwReadback::EnqueueBuffer(cl_mem buffer, std::size_t size)
+    {
+        // Make sure pinned memory is large enough
+        GetStagingBuffer(size);
+        EnqueueRead(buffer, size, m_mapped);
+    }
+
+    void ClwReadback::EnqueueBuffer(cl_mem buffer, std::size_t size, void* destination, std::size_t offset)
+    {
+        Wait();
+        EnqueueRead(buffer, size, destination, offset);
+    }
+
+    void ClwReadback::EnqueueRead(cl_mem buffer, std::size_t size, void* destination, std::size_t offset)
+    {
+        ReleaseEvent();
+
+        cl_event marker = nullptr;
+        auto status = clEnqueueMarkerWithWaitList(m_context.GetCommandQueue(0), 0, nullptr, &marker);
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error("ClwReadback: cannot enqueue marker");
+        }
+
+        m_context.Flush(0);
+
+        status = clEnqueueReadBuffer(m_queue, buffer, CL_FALSE, offset, size, destination,
+            1, &marker, &m_event);
+        clReleaseEvent(marker);
+
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error("ClwReadback: cannot enqueue read");
+        }
+
+        clFlush(m_queue);
+        m_size = size;
+        m_data = destination;
+    }
+
+    bool ClwReadback::IsReady() const
+    {
+        if (!m_event)
+        {
+            return true;
+        }
+
+        cl_int execution_status = CL_QUEUED;
+        clGetEventInfo(m_event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(execution_status), &execution_status, nullptr);
+        return execution_status == CL_COMPLETE;
+    }
+
+    void ClwReadback::Wait() const
+    {
+        if (m_event)
+        {
+            clWaitForEvents(1, &m_event);
+        }
+    }
+
+    void ClwReadback::ReleaseEvent()
+    {
+        if (m_event)
+        {
+            clReleaseEvent(m_event);
+            m_event = nullptr;
+        }
+    }
+}
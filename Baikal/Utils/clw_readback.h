@@ -0,0 +1,66 @@
+#pragma once
+
+#include "CLW.h"
+
+#include <cstddef>
+
+namespace Baikal
+{
+    ///< The class copies device data into a persistent pinned host buffer on its own
+    ///< command queue, so reads do not block the queue rendering is enqueued to.
+    ///< Copy waits for an event from the render queue, which allows to snapshot a buffer
+    ///< with a conversion kernel first and transfer only the converted data.
+    ///< Host data stays valid until the staging buffer is requested again.
+    ///<
+    class ClwReadback
+    {
+    public:
+        explicit ClwReadback(CLWContext context);
+        ~ClwReadback();
+
+        // Device buffer of at least size bytes for conversion kernels to write into
+        CLWBuffer<char> GetStagingBuffer(std::size_t size);
+
+        // Copy size bytes of the staging buffer to the host once event is complete,
+        // waits for the previous copy first
+        void Enqueue(std::size_t size, CLWEvent event);
+
+        // Copy size bytes of a device buffer already in its final layout to the host, skipping
+        // the staging buffer. Copy starts once work submitted to the context queue so far is complete,
+        // the buffer should not be written until then
+        void EnqueueBuffer(cl_mem buffer, std::size_t size);
+        // Same as above but copies size bytes starting at offset into caller owned memory, e.g. a mapped
+        // pixel buffer of the display, which has to stay valid until the copy has completed
+        void EnqueueBuffer(cl_mem buffer, std::size_t size, void* destination, std::size_t offset = 0);
+
+        // Check if the last copy has completed
+        bool IsReady() const;
+        // Block until the last copy has completed
+        void Wait() const;
+
+        // Host data of the last copy, call Wait or check IsReady first
+        void const* GetData() const { return m_data; }
+        std::size_t GetSize() const { return m_size; }
+
+        ClwReadback(ClwReadback const&) = delete;
+        ClwReadback& operator = (ClwReadback const&) = delete;
+
+    private:
+        void ReleaseEvent();
+        // Copy after the work queued on the context so far
+        void EnqueueRead(cl_mem buffer, std::size_t size, void* destination, std::size_t offset = 0);
+
+        CLWContext m_context;
+        cl_command_queue m_queue;
+        CLWBuffer<char> m_staging;
+        CLWBuffer<char> m_pinned;
+        char* m_mapped;
+        // Destination of the last copy
+        void* m_data;
+        // Size of the staging and pinned buffers in bytes
+        std::size_t m_capacity;
+        // Size of the last copy in bytes
+        std::size_t m_size;
+        cl_event m_event;
+    };
+}
@@ -0,0 +1,124 @@
+#include "clw_uploader.h"
+
+#include <cassert>
+#include <chrono>
+
+namespace Baikal
+{
+    // Staging allocations are aligned for any payload type
+    static std::size_t constexpr kStagingAlignment = 64u;
+
+    std::size_t constexpr ClwUploader::kDefaultChunkSize;
+
+    ClwUploader::ClwUploader(CLWContext context, std::size_t chunk_size)
+        : m_context(context)
+        , m_chunk_size(chunk_size)
+        , m_current_chunk(0)
+    {
+        for (auto& chunk : m_chunks)
+        {
+            // Host accessible allocation stays mapped for the uploader lifetime,
+            // writes from it do not need an extra pinning copy by the driver
+            chunk.buffer = m_context.CreateBuffer<char>(m_chunk_size, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
+            m_context.MapBuffer(0, chunk.buffer, CL_MAP_WRITE, &chunk.mapped).Wait();
+        }
+    }
+
+    ClwUploader::~ClwUploader()
+    {
+        Finish();
+
+        for (auto& chunk : m_chunks)
+        {
+            m_context.UnmapBuffer(0, chunk.buffer, chunk.mapped).Wait();
+        }
+    }
+
+    char* ClwUploader::Reserve(std::size_t size)
+    {
+        assert(size <= m_chunk_size);
+
+        auto chunk = &m_chunks[m_current_chunk];
+        auto offset = (chunk->used + kStagingAlignment - 1) & ~(kStagingAlignment - 1);
+
+        if (offset + size > m_chunk_size)
+        {
+            // Switch to the other chunk, its previous writes have to be done before reuse
+            m_current_chunk = (m_current_chunk + 1) % m_chunks.size();
+            chunk = &m_chunks[m_current_chunk];
+
+            for (auto& event : chunk->events)
+            {
+                event.Wait();
+            }
+
+            chunk->events.clear();
+            chunk->used = 0;
+            offset = 0;
+        }
+
+        chunk->used = offset + size;
+        return chunk->mapped + offset;
+    }
+
+    void ClwUploader::Track(CLWEvent event)
+    {
+        // Make sure the write starts while we fill the rest of the chunk
+        m_context.Flush(0);
+        m_chunks[m_current_chunk].events.push_back(event);
+    }
+
+    void ClwUploader::Finish()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto& chunk : m_chunks)
+        {
+            for (auto& event : chunk.events)
+            {
+                event.Wait();
+            }
+
+            chunk.events.clear();
+            chunk.used = 0;
+        }
+    }
+
+    void ClwUploader::ResetStats()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.fill(Stats());
+    }
+
+    char const* ClwUploader::GetCategoryName(Category category)
+    {
+        static char const* const kNames[] =
+        {
+            "camera",
+            "geometry",
+            "shapes",
+            "materials",
+            "textures",
+            "lights",
+            "volumes",
+            "input_maps"
+        };
+
+        static_assert(sizeof(kNames) / sizeof(kNames[0]) == static_cast<std::size_t>(Category::kCount), "Category names do not match categories");
+
+        return kNames[static_cast<std::size_t>(category)];
+    }
+
+    void ClwUploader::AddStats(Category category, std::size_t bytes, double milliseconds)
+    {
+        auto& stats = m_stats[static_cast<std::size_t>(category)];
+        stats.bytes += bytes;
+        stats.milliseconds += milliseconds;
+        ++stats.writes;
+    }
+
+    double ClwUploader::Now()
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "CLW.h"
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace Baikal
+{
+    ///< The class batches host to device copies through reusable pinned staging
+    ///< buffers. Data is copied into a staging chunk and an asynchronous write is
+    ///< enqueued from it, so source memory can be released right after Write returns
+    ///< and writes overlap with filling the next chunk. Chunks are reused once their
+    ///< writes have completed.
+    ///< Bytes and host time spent are accumulated per category. Writes from
+    ///< several threads are serialized.
+    ///<
+    class ClwUploader
+    {
+    public:
+        enum class Category
+        {
+            kCamera,
+            kGeometry,
+            kShapes,
+            kMaterials,
+            kTextures,
+            kLights,
+            kVolumes,
+            kInputMaps,
+
+            kCount
+        };
+
+        struct Stats
+        {
+            std::size_t bytes = 0;
+            std::size_t writes = 0;
+            // Host time spent in Write calls (copies, enqueues and waits for free chunks)
+            double milliseconds = 0.0;
+        };
+
+        // Size of a single staging chunk in bytes
+        static std::size_t constexpr kDefaultChunkSize = 8u * 1024u * 1024u;
+
+        explicit ClwUploader(CLWContext context, std::size_t chunk_size = kDefaultChunkSize);
+        ~ClwUploader();
+
+        // Write count elements starting at element offset of the buffer
+        template <typename T>
+        void Write(Category category, CLWBuffer<T> buffer, T const* data, std::size_t count, std::size_t offset = 0);
+
+        // Block until all enqueued writes have completed
+        void Finish();
+
+        Stats const& GetStats(Category category) const { return m_stats[static_cast<std::size_t>(category)]; }
+        void ResetStats();
+
+        static char const* GetCategoryName(Category category);
+
+        ClwUploader(ClwUploader const&) = delete;
+        ClwUploader& operator = (ClwUploader const&) = delete;
+
+    private:
+        struct Chunk
+        {
+            CLWBuffer<char> buffer;
+            char* mapped = nullptr;
+            std::size_t used = 0;
+            std::vector<CLWEvent> events;
+        };
+
+        // Get staging space for size bytes (size <= chunk size), switches chunks when needed
+        char* Reserve(std::size_t size);
+        void Track(CLWEvent event);
+        void AddStats(Category category, std::size_t bytes, double milliseconds);
+
+        static double Now();
+
+        CLWContext m_context;
+        std::size_t m_chunk_size;
+        std::array<Chunk, 2> m_chunks;
+        std::size_t m_current_chunk;
+        std::array<Stats, static_cast<std::size_t>(Category::kCount)> m_stats;
+        std::mutex m_mutex;
+    };
+
+    template <typename T>
+    inline void ClwUploader::Write(Category category, CLWBuffer<T> buffer, T const* data, std::size_t count, std::size_t offset)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto start = Now();
+
+        // Split into pieces fitting into a chunk, each piece holds whole elements
+        auto max_elements = m_chunk_size / sizeof(T);
+        auto remaining = count;
+
+        while (remaining > 0)
+        {
+            auto num_elements = remaining < max_elements ? remaining : max_elements;
+            auto staging = Reserve(num_elements * sizeof(T));
+
+            std::memcpy(staging, data, num_elements * sizeof(T));
+            Track(m_context.WriteBuffer(0, buffer, reinterpret_cast<T const*>(staging), offset, num_elements));
+
+            data += num_elements;
+            offset += num_elements;
+            remaining -= num_elements;
+        }
+
+        AddStats(category, count * sizeof(T), Now() - start);
+    }
+}
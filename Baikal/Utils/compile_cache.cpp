@@ -0,0 +1,122 @@
+#include "compile_cache.h"
+#include "mkpath.h"
+#include "version.h"
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace Baikal
+{
+    namespace
+    {
+        std::uint64_t constexpr kFnvPrime = 1099511628211ull;
+
+        // Entry file header, the key is repeated to catch file name collisions
+        struct EntryHeader
+        {
+            char magic[4];
+            std::uint32_t version;
+            std::uint64_t key;
+            std::uint64_t count;
+        };
+
+        char const kMagic[4] = { 'B', 'K', 'C', 'C' };
+        // Bumped whenever serialized data layout changes (2: Distribution1D alias tables)
+        std::uint32_t constexpr kEntryVersion = 2u;
+    }
+
+    void ContentHash::Add(void const* data, std::size_t size)
+    {
+        auto bytes = static_cast<unsigned char const*>(data);
+        auto hash = m_hash;
+
+        for (; size >= sizeof(std::uint64_t); size -= sizeof(std::uint64_t), bytes += sizeof(std::uint64_t))
+        {
+            std::uint64_t word;
+            std::memcpy(&word, bytes, sizeof(word));
+            hash = (hash ^ word) * kFnvPrime;
+        }
+
+        for (; size > 0; --size, ++bytes)
+        {
+            hash = (hash ^ *bytes) * kFnvPrime;
+        }
+
+        m_hash = hash;
+    }
+
+    CompileCache::CompileCache(std::string const& path)
+        : m_path(path)
+    {
+    }
+
+    std::string CompileCache::GetFileName(std::string const& kind, std::uint64_t key) const
+    {
+        std::ostringstream oss;
+        oss << m_path << "/" << kind << "_" << std::hex << std::setw(16) << std::setfill('0') << key << "_" << BAIKAL_VERSION << ".bin";
+        return oss.str();
+    }
+
+    bool CompileCache::Load(std::string const& kind, std::uint64_t key, std::vector<int>& data) const
+    {
+        if (!IsEnabled())
+        {
+            return false;
+        }
+
+        std::ifstream in(GetFileName(kind, key), std::ios::in | std::ios::binary);
+
+        if (!in)
+        {
+            return false;
+        }
+
+        EntryHeader header;
+
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+            header.version != kEntryVersion ||
+            header.key != key)
+        {
+            return false;
+        }
+
+        // Truncated entries are treated as missing
+        std::vector<int> entry(static_cast<std::size_t>(header.count));
+
+        if (!in.read(reinterpret_cast<char*>(entry.data()), entry.size() * sizeof(int)))
+        {
+            return false;
+        }
+
+        data = std::move(entry);
+        return true;
+    }
+
+    void CompileCache::Save(std::string const& kind, std::uint64_t key, std::vector<int> const& data) const
+    {
+        if (!IsEnabled())
+        {
+            return;
+        }
+
+        auto name = GetFileName(kind, key);
+        mkfilepath(name);
+
+        std::ofstream out(name, std::ios::out | std::ios::binary);
+
+        if (out)
+        {
+            EntryHeader header;
+            std::memcpy(header.magic, kMagic, sizeof(kMagic));
+            header.version = kEntryVersion;
+            header.key = key;
+            header.count = data.size();
+
+            out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+            out.write(reinterpret_cast<char const*>(data.data()), data.size() * sizeof(int));
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace Baikal
+{
+    ///< 64-bit FNV-1a hash of the data compile results are derived from.
+    ///< Data is consumed in 8 byte words, so the value depends on how Add calls split it.
+    ///<
+    class ContentHash
+    {
+    public:
+        void Add(void const* data, std::size_t size);
+
+        template <typename T>
+        void Add(T const& value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "ContentHash: only trivially copyable types can be hashed");
+            Add(&value, sizeof(T));
+        }
+
+        template <typename T>
+        void Add(std::vector<T> const& values)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "ContentHash: only trivially copyable types can be hashed");
+            Add(values.size());
+            Add(values.data(), values.size() * sizeof(T));
+        }
+
+        std::uint64_t Get() const { return m_hash; }
+
+    private:
+        std::uint64_t m_hash = 14695981039346656037ull;
+    };
+
+    ///< On-disk cache of expensive scene compile results, e.g. light BVH and distributions,
+    ///< keyed by the content hash of their inputs. Entries are int arrays
+    ///< in the layout of the device buffers they fill, so reopening an unchanged scene
+    ///< only reads them back. Empty path disables the cache.
+    ///<
+    class CompileCache
+    {
+    public:
+        explicit CompileCache(std::string const& path = "");
+
+        bool IsEnabled() const { return !m_path.empty(); }
+        void SetPath(std::string const& path) { m_path = path; }
+
+        // Returns false if there is no valid entry for the key
+        bool Load(std::string const& kind, std::uint64_t key, std::vector<int>& data) const;
+        void Save(std::string const& kind, std::uint64_t key, std::vector<int> const& data) const;
+
+    private:
+        std::string GetFileName(std::string const& kind, std::uint64_t key) const;
+
+        std::string m_path;
+    };
+}
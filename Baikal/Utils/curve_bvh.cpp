@@ -0,0 +1,107 @@
+#include "curve_bvh.h"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+namespace Baikal
+{
+    namespace
+    {
+        struct BuildContext
+        {
+            RadeonRays::float3 const* pmin;
+            RadeonRays::float3 const* pmax;
+            std::int32_t const* segment_data;
+            std::vector<std::uint32_t> order;
+        };
+
+        void WriteBounds(CurveBvh::Node& node, RadeonRays::float3 const& pmin, RadeonRays::float3 const& pmax)
+        {
+            node.pmin[0] = pmin.x; node.pmin[1] = pmin.y; node.pmin[2] = pmin.z;
+            node.pmax[0] = pmax.x; node.pmax[1] = pmax.y; node.pmax[2] = pmax.z;
+        }
+
+        void BuildNode(CurveBvh& bvh, BuildContext& context, std::uint32_t node_idx, std::uint32_t begin, std::uint32_t end)
+        {
+            assert(end > begin);
+
+            auto pmin = context.pmin[context.order[begin]];
+            auto pmax = context.pmax[context.order[begin]];
+            auto cmin = 0.5f * (pmin + pmax);
+            auto cmax = cmin;
+
+            for (auto i = begin; i < end; ++i)
+            {
+                auto idx = context.order[i];
+                auto c = 0.5f * (context.pmin[idx] + context.pmax[idx]);
+
+                pmin = RadeonRays::vmin(pmin, context.pmin[idx]);
+                pmax = RadeonRays::vmax(pmax, context.pmax[idx]);
+                cmin = RadeonRays::vmin(cmin, c);
+                cmax = RadeonRays::vmax(cmax, c);
+            }
+
+            WriteBounds(bvh.m_nodes[node_idx], pmin, pmax);
+
+            if (end - begin <= CurveBvh::kMaxLeafSize)
+            {
+                bvh.m_nodes[node_idx].child = -static_cast<std::int32_t>(bvh.m_segments.size()) - 1;
+                bvh.m_nodes[node_idx].count = static_cast<std::int32_t>(end - begin);
+
+                for (auto i = begin; i < end; ++i)
+                {
+                    bvh.m_segments.push_back(context.segment_data[context.order[i]]);
+                }
+
+                return;
+            }
+
+            // Median split along the largest extent of centroids
+            auto extent = cmax - cmin;
+            auto axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+            auto mid = begin + (end - begin) / 2;
+
+            std::nth_element(context.order.begin() + begin, context.order.begin() + mid, context.order.begin() + end,
+                [&context, axis](std::uint32_t lhs, std::uint32_t rhs)
+                {
+                    return (context.pmin[lhs][axis] + context.pmax[lhs][axis]) < (context.pmin[rhs][axis] + context.pmax[rhs][axis]);
+                });
+
+            auto left = static_cast<std::uint32_t>(bvh.m_nodes.size());
+            bvh.m_nodes.resize(left + 2);
+            bvh.m_nodes[node_idx].child = static_cast<std::int32_t>(left);
+            bvh.m_nodes[node_idx].count = 0;
+
+            BuildNode(bvh, context, left, begin, mid);
+            BuildNode(bvh, context, left + 1, mid, end);
+        }
+    }
+
+    CurveBvh::CurveBvh()
+    {
+    }
+
+    void CurveBvh::Build(RadeonRays::float3 const* pmin,
+                         RadeonRays::float3 const* pmax,
+                         std::int32_t const* segment_data,
+                         std::uint32_t num_segments)
+    {
+        m_nodes.clear();
+        m_segments.clear();
+
+        if (num_segments == 0)
+        {
+            return;
+        }
+
+        BuildContext context = { pmin, pmax, segment_data, std::vector<std::uint32_t>(num_segments) };
+        std::iota(context.order.begin(), context.order.end(), 0u);
+
+        m_nodes.reserve(2 * num_segments - 1);
+        m_segments.reserve(num_segments);
+        m_nodes.resize(1);
+
+        BuildNode(*this, context, 0u, 0u, num_segments);
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "math/float3.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace Baikal
+{
+    ///< The class represents bounding volume hierarchy over curve segments of a single shape.
+    ///< Hierarchy is built in object space of the shape, so it is kept while the shape moves.
+    ///< Leaves refer to a few consecutive entries of the segments array, children of
+    ///< internal nodes are stored next to each other.
+    ///<
+    struct CurveBvh
+    {
+    public:
+        // Maximum number of segments in a leaf
+        static std::uint32_t constexpr kMaxLeafSize = 4;
+
+        ///< Node layout matches CurveNode used by the kernels (8 x 32-bit)
+        struct Node
+        {
+            float pmin[3];
+            // Leaf: -(first entry in segments + 1), internal node: index of the left child
+            std::int32_t child;
+            float pmax[3];
+            // Number of segments in a leaf, 0 for internal nodes
+            std::int32_t count;
+        };
+
+        CurveBvh();
+
+        // Build hierarchy over num_segments segment bounds, segment_data values are written to m_segments in leaf order
+        void Build(RadeonRays::float3 const* pmin,
+                   RadeonRays::float3 const* pmax,
+                   std::int32_t const* segment_data,
+                   std::uint32_t num_segments);
+
+        // Nodes, root goes first
+        std::vector<Node> m_nodes;
+        // Segment data referred to by leaves
+        std::vector<std::int32_t> m_segments;
+    };
+}
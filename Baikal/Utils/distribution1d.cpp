@@ -41,30 +41,92 @@ namespace Baikal
         {
             m_cdf[i] /= m_func_sum;
         }
+
+        BuildAliasTable();
     }
 
-    float Distribution1D::Sample1D(float u, float& pdf) const
+    void Distribution1D::BuildAliasTable()
     {
-        assert(m_num_segments > 0);
+        auto num_segments = m_num_segments;
+        m_alias_probabilities.resize(num_segments);
+        m_aliases.resize(num_segments);
 
-        // Find the segment here u lies
-        // this one is in [0, N-1] and we need to handle corner case:
-        // for 0 it returns 0 index
-        auto iter = std::lower_bound(m_cdf.cbegin(), m_cdf.cend(), u); 
+        // Segment probabilities scaled by the number of segments, so the average is 1
+        for (auto i = 0u; i < num_segments; ++i)
+        {
+            m_alias_probabilities[i] = m_func_values[i] / m_func_sum;
+            m_aliases[i] = i;
+        }
 
-        // Find segment index : clamp it as last may be returned for 1
-        auto segment_idx = std::max((std::uint32_t)std::distance(m_cdf.cbegin(), iter), 1u);
+        auto next_small = [this](std::uint32_t i)
+        {
+            while (i < m_num_segments && m_alias_probabilities[i] >= 1.f) ++i;
+            return i;
+        };
+
+        auto next_large = [this](std::uint32_t i)
+        {
+            while (i < m_num_segments && m_alias_probabilities[i] < 1.f) ++i;
+            return i;
+        };
+
+        // Sweep small and large segments in index order, so no work lists are needed
+        // (BuildTileDistribution kernel builds tables on the device the same way)
+        auto small = next_small(0u);
+        auto large = next_large(0u);
+        auto current = small;
 
-        assert(u >= m_cdf[segment_idx - 1] && u <= m_cdf[segment_idx]);
+        while (current < num_segments && large < num_segments)
+        {
+            // Fill the rest of the current segment from the large one
+            m_aliases[current] = large;
+            m_alias_probabilities[large] -= 1.f - m_alias_probabilities[current];
+
+            if (m_alias_probabilities[large] < 1.f && large < small)
+            {
+                // Sweep has already passed the segment, so it is filled right away
+                current = large;
+                large = next_large(large + 1);
+            }
+            else
+            {
+                if (m_alias_probabilities[large] < 1.f)
+                {
+                    large = next_large(large + 1);
+                }
+
+                small = next_small(small + 1);
+                current = small;
+            }
+        }
+    }
+
+    float Distribution1D::Sample1D(float u, float& pdf) const
+    {
+        assert(m_num_segments > 0);
+
+        // Pick the segment from the alias table, clamp as 1 may be passed
+        float x = u * m_num_segments;
+        auto segment_idx = std::min((std::uint32_t)x, m_num_segments - 1);
+        float du = std::min(x - segment_idx, 0.99999994f);
 
-        // Find lerp coefficient
-        float du = (u - m_cdf[segment_idx - 1]) / (m_cdf[segment_idx] - m_cdf[segment_idx - 1]);
+        // Remap the remainder to the lerp coefficient within the picked segment
+        auto alias_probability = m_alias_probabilities[segment_idx];
+        if (du < alias_probability)
+        {
+            du = std::min(du / alias_probability, 0.99999994f);
+        }
+        else
+        {
+            du = std::min((du - alias_probability) / (1.f - alias_probability), 0.99999994f);
+            segment_idx = m_aliases[segment_idx];
+        }
 
         // Calc pdf
-        pdf = m_func_values[segment_idx - 1] / m_func_sum;
+        pdf = m_func_values[segment_idx] / m_func_sum;
 
         // Return corresponding value
-        return (segment_idx - 1 + du) / m_num_segments;
+        return (segment_idx + du) / m_num_segments;
     }
 
     float Distribution1D::pdf(float u) const
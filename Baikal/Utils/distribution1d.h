@@ -39,17 +39,23 @@ namespace Baikal
 
         void Set(float const* values, std::uint32_t num_segments);
 
-        // Sample one value using this distribution
+        // Sample one value using this distribution in constant time (alias method)
         // u is uniformely distributed random var
         float Sample1D(float u, float& pdf) const;
 
         // PDF
         float pdf(float u) const;
 
+        // Build alias table from function values
+        void BuildAliasTable();
+
         // Function values
         std::vector<float> m_func_values;
         // Cumulative distribution function
         std::vector<float> m_cdf;
+        // Alias table: probability to keep each segment, alias segment otherwise
+        std::vector<float> m_alias_probabilities;
+        std::vector<std::uint32_t> m_aliases;
         // Number of segments
         std::uint32_t m_num_segments;
         // Integral of the function over the whole range (normalizer)
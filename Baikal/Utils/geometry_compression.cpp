@@ -0,0 +1,97 @@
+#include "geometry_compression.h"
+#include "half.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Baikal
+{
+    namespace GeometryCompression
+    {
+        static float SignNotZero(float v)
+        {
+            return v >= 0.f ? 1.f : -1.f;
+        }
+
+        static std::uint32_t ToSnorm16(float v)
+        {
+            auto clamped = std::min(std::max(v, -1.f), 1.f);
+            auto value = static_cast<std::int16_t>(std::lround(clamped * 32767.f));
+            return static_cast<std::uint16_t>(value);
+        }
+
+        static float FromSnorm16(std::uint32_t v)
+        {
+            auto value = static_cast<std::int16_t>(static_cast<std::uint16_t>(v & 0xffffu));
+            return std::max(value / 32767.f, -1.f);
+        }
+
+        std::uint32_t EncodeNormal(RadeonRays::float3 const& n)
+        {
+            auto l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+
+            if (l1 == 0.f)
+            {
+                return 0u;
+            }
+
+            // Project onto the octahedron, lower hemisphere is folded over the diagonals
+            auto x = n.x / l1;
+            auto y = n.y / l1;
+
+            if (n.z < 0.f)
+            {
+                auto folded_x = (1.f - std::fabs(y)) * SignNotZero(x);
+                auto folded_y = (1.f - std::fabs(x)) * SignNotZero(y);
+                x = folded_x;
+                y = folded_y;
+            }
+
+            return ToSnorm16(x) | (ToSnorm16(y) << 16);
+        }
+
+        RadeonRays::float3 DecodeNormal(std::uint32_t packed)
+        {
+            auto x = FromSnorm16(packed);
+            auto y = FromSnorm16(packed >> 16);
+            auto z = 1.f - std::fabs(x) - std::fabs(y);
+
+            if (z < 0.f)
+            {
+                auto unfolded_x = (1.f - std::fabs(y)) * SignNotZero(x);
+                auto unfolded_y = (1.f - std::fabs(x)) * SignNotZero(y);
+                x = unfolded_x;
+                y = unfolded_y;
+            }
+
+            auto length = std::sqrt(x * x + y * y + z * z);
+            return RadeonRays::float3(x / length, y / length, z / length);
+        }
+
+        std::uint32_t EncodeTangent(RadeonRays::float3 const& t, float sign)
+        {
+            // Lowest bit of x only moves the direction by a snorm step
+            return (EncodeNormal(t) & ~1u) | (sign < 0.f ? 1u : 0u);
+        }
+
+        RadeonRays::float3 DecodeTangent(std::uint32_t packed, float& sign)
+        {
+            sign = (packed & 1u) ? -1.f : 1.f;
+            return DecodeNormal(packed);
+        }
+
+        std::uint32_t EncodeUV(RadeonRays::float2 const& uv)
+        {
+            return static_cast<std::uint32_t>(half(uv.x).bits()) |
+                (static_cast<std::uint32_t>(half(uv.y).bits()) << 16);
+        }
+
+        RadeonRays::float2 DecodeUV(std::uint32_t packed)
+        {
+            half x, y;
+            x.setBits(static_cast<unsigned short>(packed & 0xffffu));
+            y.setBits(static_cast<unsigned short>(packed >> 16));
+            return RadeonRays::float2(x, y);
+        }
+    }
+}
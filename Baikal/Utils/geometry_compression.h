@@ -0,0 +1,44 @@
+#pragma once
+
+#include "math/float2.h"
+#include "math/float3.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Baikal
+{
+    ///< Vertex attribute encodings used by BAIKAL_COMPRESSED_GEOMETRY scene buffers.
+    ///< Decoding counterparts live in Kernels/CL/scene.cl, the host versions are kept for validation.
+    ///<
+    namespace GeometryCompression
+    {
+        // Largest vertex count of a mesh which can use 16-bit indices
+        static std::size_t constexpr kMaxShortIndexVertices = 65536u;
+
+        // Octahedral encoding of a unit vector, x and y are 16-bit snorm values
+        // in the low and high halves. Zero vector is encoded as +Z.
+        std::uint32_t EncodeNormal(RadeonRays::float3 const& n);
+        RadeonRays::float3 DecodeNormal(std::uint32_t packed);
+
+        // Octahedral encoded tangent with the bitangent sign in the lowest bit (set if negative),
+        // used by BAIKAL_VERTEX_TANGENTS regardless of BAIKAL_COMPRESSED_GEOMETRY
+        std::uint32_t EncodeTangent(RadeonRays::float3 const& t, float sign);
+        RadeonRays::float3 DecodeTangent(std::uint32_t packed, float& sign);
+
+        // Half precision pair, x in the low half
+        std::uint32_t EncodeUV(RadeonRays::float2 const& uv);
+        RadeonRays::float2 DecodeUV(std::uint32_t packed);
+
+        inline bool CanUseShortIndices(std::size_t num_vertices)
+        {
+            return num_vertices <= kMaxShortIndexVertices;
+        }
+
+        // Number of 32-bit elements occupied by num_indices indices
+        inline std::size_t GetIndexStorageSize(std::size_t num_indices, bool short_indices)
+        {
+            return short_indices ? (num_indices + 1) / 2 : num_indices;
+        }
+    }
+}
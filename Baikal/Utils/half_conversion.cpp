@@ -0,0 +1,168 @@
+#include "half_conversion.h"
+#include "half.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define BAIKAL_HALF_F16C
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define BAIKAL_HALF_NEON
+#include <arm_neon.h>
+#endif
+
+namespace Baikal
+{
+    namespace HalfConversion
+    {
+        namespace
+        {
+            void HalfToFloatScalar(std::uint16_t const* src, float* dst, std::size_t count)
+            {
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    half value;
+                    value.setBits(src[i]);
+                    dst[i] = value;
+                }
+            }
+
+            void FloatToHalfScalar(float const* src, std::uint16_t* dst, std::size_t count)
+            {
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    dst[i] = half(src[i]).bits();
+                }
+            }
+
+#if defined(BAIKAL_HALF_F16C)
+            // F16C instructions are VEX encoded, so both F16C and OS support of AVX state are required
+            bool HasF16C()
+            {
+#ifdef _MSC_VER
+                int info[4];
+                __cpuid(info, 1);
+
+                bool osxsave = (info[2] & (1 << 27)) != 0;
+                bool avx = (info[2] & (1 << 28)) != 0;
+                bool f16c = (info[2] & (1 << 29)) != 0;
+
+                return osxsave && avx && f16c && (_xgetbv(0) & 0x6) == 0x6;
+#else
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+#endif
+            }
+
+            // MSVC allows intrinsics of any instruction set, GCC and Clang need them enabled per function
+#ifdef _MSC_VER
+#define BAIKAL_F16C_TARGET
+#else
+#define BAIKAL_F16C_TARGET __attribute__((target("avx,f16c")))
+#endif
+
+            BAIKAL_F16C_TARGET void HalfToFloatVector(std::uint16_t const* src, float* dst, std::size_t count)
+            {
+                std::size_t i = 0;
+
+                for (; i + 8 <= count; i += 8)
+                {
+                    auto values = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i));
+                    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(values));
+                }
+
+                HalfToFloatScalar(src + i, dst + i, count - i);
+            }
+
+            BAIKAL_F16C_TARGET void FloatToHalfVector(float const* src, std::uint16_t* dst, std::size_t count)
+            {
+                std::size_t i = 0;
+
+                for (; i + 8 <= count; i += 8)
+                {
+                    auto values = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), values);
+                }
+
+                FloatToHalfScalar(src + i, dst + i, count - i);
+            }
+
+#undef BAIKAL_F16C_TARGET
+
+            bool const g_accelerated = HasF16C();
+#elif defined(BAIKAL_HALF_NEON)
+            // Conversion instructions are part of the base AArch64 instruction set
+            void HalfToFloatVector(std::uint16_t const* src, float* dst, std::size_t count)
+            {
+                std::size_t i = 0;
+
+                for (; i + 4 <= count; i += 4)
+                {
+                    auto values = vreinterpret_f16_u16(vld1_u16(src + i));
+                    vst1q_f32(dst + i, vcvt_f32_f16(values));
+                }
+
+                HalfToFloatScalar(src + i, dst + i, count - i);
+            }
+
+            // Rounds to nearest even in the default FPCR mode
+            void FloatToHalfVector(float const* src, std::uint16_t* dst, std::size_t count)
+            {
+                std::size_t i = 0;
+
+                for (; i + 4 <= count; i += 4)
+                {
+                    auto values = vcvt_f16_f32(vld1q_f32(src + i));
+                    vst1_u16(dst + i, vreinterpret_u16_f16(values));
+                }
+
+                FloatToHalfScalar(src + i, dst + i, count - i);
+            }
+
+            bool const g_accelerated = true;
+#else
+            void HalfToFloatVector(std::uint16_t const* src, float* dst, std::size_t count)
+            {
+                HalfToFloatScalar(src, dst, count);
+            }
+
+            void FloatToHalfVector(float const* src, std::uint16_t* dst, std::size_t count)
+            {
+                FloatToHalfScalar(src, dst, count);
+            }
+
+            bool const g_accelerated = false;
+#endif
+        }
+
+        void HalfToFloat(std::uint16_t const* src, float* dst, std::size_t count)
+        {
+            if (g_accelerated)
+            {
+                HalfToFloatVector(src, dst, count);
+            }
+            else
+            {
+                HalfToFloatScalar(src, dst, count);
+            }
+        }
+
+        void FloatToHalf(float const* src, std::uint16_t* dst, std::size_t count)
+        {
+            if (g_accelerated)
+            {
+                FloatToHalfVector(src, dst, count);
+            }
+            else
+            {
+                FloatToHalfScalar(src, dst, count);
+            }
+        }
+
+        bool IsAccelerated()
+        {
+            return g_accelerated;
+        }
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Baikal
+{
+    ///< Bulk conversion between half and single precision arrays. Uses F16C
+    ///< on x86 CPUs supporting it and NEON on AArch64, the half class otherwise.
+    ///< Results match the half class, float to half conversion rounds to nearest even.
+    ///<
+    namespace HalfConversion
+    {
+        void HalfToFloat(std::uint16_t const* src, float* dst, std::size_t count);
+        void FloatToHalf(float const* src, std::uint16_t* dst, std::size_t count);
+
+        // True if the conversions run on the vector path
+        bool IsAccelerated();
+    }
+}
@@ -0,0 +1,229 @@
+#include "ies_profile.h"
+#include "math/mathutils.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+namespace Baikal
+{
+    namespace
+    {
+        // Segment of sorted angles containing x and the position within it, x is clamped to the range
+        void FindSegment(std::vector<float> const& angles, float x, std::size_t& idx, float& t)
+        {
+            if (angles.size() == 1u || x <= angles.front())
+            {
+                idx = 0u;
+                t = 0.f;
+                return;
+            }
+
+            if (x >= angles.back())
+            {
+                idx = angles.size() - 2u;
+                t = 1.f;
+                return;
+            }
+
+            idx = static_cast<std::size_t>(std::upper_bound(angles.begin(), angles.end(), x) - angles.begin()) - 1u;
+            auto range = angles[idx + 1] - angles[idx];
+            t = range > 0.f ? (x - angles[idx]) / range : 0.f;
+        }
+    }
+
+    IesProfile::IesProfile()
+    {
+    }
+
+    IesProfile IesProfile::Parse(std::string const& data)
+    {
+        std::istringstream stream(data);
+        std::string line;
+        std::string tilt;
+
+        // Keywords go before the TILT line
+        while (std::getline(stream, line))
+        {
+            if (line.compare(0, 5, "TILT=") == 0)
+            {
+                tilt = line.substr(5);
+                tilt.erase(std::remove_if(tilt.begin(), tilt.end(), [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; }), tilt.end());
+                break;
+            }
+        }
+
+        if (tilt.empty())
+        {
+            throw std::runtime_error("IesProfile: TILT line is missing");
+        }
+
+        // Values are separated by blanks or commas and may span lines
+        std::string rest(std::istreambuf_iterator<char>(stream), {});
+        std::replace(rest.begin(), rest.end(), ',', ' ');
+        std::istringstream values(rest);
+
+        auto read = [&values]()
+        {
+            float value;
+            if (!(values >> value))
+            {
+                throw std::runtime_error("IesProfile: unexpected end of data");
+            }
+            return value;
+        };
+
+        // Lamp tilt does not change the web, skip it
+        if (tilt == "INCLUDE")
+        {
+            read();
+            auto num_pairs = static_cast<int>(read());
+            for (auto i = 0; i < 2 * num_pairs; ++i)
+            {
+                read();
+            }
+        }
+
+        read();
+        read();
+        auto multiplier = read();
+        auto num_vertical = static_cast<int>(read());
+        auto num_horizontal = static_cast<int>(read());
+        auto photometric_type = static_cast<int>(read());
+
+        if (num_vertical < 1 || num_horizontal < 1)
+        {
+            throw std::runtime_error("IesProfile: invalid number of angles");
+        }
+
+        if (photometric_type != 1)
+        {
+            throw std::runtime_error("IesProfile: only type C photometry is supported");
+        }
+
+        // Units, luminous opening, ballast factors and input watts
+        for (auto i = 0; i < 7; ++i)
+        {
+            read();
+        }
+
+        IesProfile profile;
+        profile.m_vertical_angles.resize(num_vertical);
+        profile.m_horizontal_angles.resize(num_horizontal);
+        profile.m_candela.resize(static_cast<std::size_t>(num_vertical) * num_horizontal);
+
+        std::generate(profile.m_vertical_angles.begin(), profile.m_vertical_angles.end(), read);
+        std::generate(profile.m_horizontal_angles.begin(), profile.m_horizontal_angles.end(), read);
+        std::generate(profile.m_candela.begin(), profile.m_candela.end(), [&]() { return std::max(read() * multiplier, 0.f); });
+
+        if (!std::is_sorted(profile.m_vertical_angles.begin(), profile.m_vertical_angles.end()) ||
+            !std::is_sorted(profile.m_horizontal_angles.begin(), profile.m_horizontal_angles.end()))
+        {
+            throw std::runtime_error("IesProfile: angles should be ascending");
+        }
+
+        return profile;
+    }
+
+    IesProfile IesProfile::Load(std::string const& filename)
+    {
+        std::ifstream in(filename);
+
+        if (!in)
+        {
+            throw std::runtime_error("IesProfile: cannot open " + filename);
+        }
+
+        return Parse(std::string(std::istreambuf_iterator<char>(in), {}));
+    }
+
+    float IesProfile::GetIntensity(float theta, float phi) const
+    {
+        if (m_candela.empty())
+        {
+            return 0.f;
+        }
+
+        auto theta_deg = theta * 180.f / PI;
+
+        // Web does not cover the rest of the sphere
+        if (theta_deg < m_vertical_angles.front() || theta_deg > m_vertical_angles.back())
+        {
+            return 0.f;
+        }
+
+        auto phi_deg = std::fmod(phi * 180.f / PI, 360.f);
+        phi_deg = phi_deg < 0.f ? phi_deg + 360.f : phi_deg;
+
+        // Partial webs are mirrored around their planes of symmetry
+        auto h_first = m_horizontal_angles.front();
+        auto h_last = m_horizontal_angles.back();
+
+        if (h_first == 0.f && h_last == 90.f)
+        {
+            phi_deg = std::fmod(phi_deg, 180.f);
+            phi_deg = phi_deg > 90.f ? 180.f - phi_deg : phi_deg;
+        }
+        else if (h_first == 0.f && h_last == 180.f)
+        {
+            phi_deg = phi_deg > 180.f ? 360.f - phi_deg : phi_deg;
+        }
+        else if (h_first == 90.f && h_last == 270.f)
+        {
+            phi_deg = phi_deg < 90.f ? 180.f - phi_deg : (phi_deg > 270.f ? 540.f - phi_deg : phi_deg);
+        }
+
+        std::size_t v, h;
+        float tv, th;
+        FindSegment(m_vertical_angles, theta_deg, v, tv);
+        FindSegment(m_horizontal_angles, phi_deg, h, th);
+
+        auto num_vertical = m_vertical_angles.size();
+        auto v1 = std::min(v + 1, num_vertical - 1);
+        auto h1 = std::min(h + 1, m_horizontal_angles.size() - 1);
+
+        auto value = [&](std::size_t i, std::size_t j) { return m_candela[j * num_vertical + i]; };
+        auto i0 = value(v, h) * (1.f - tv) + value(v1, h) * tv;
+        auto i1 = value(v, h1) * (1.f - tv) + value(v1, h1) * tv;
+        return i0 * (1.f - th) + i1 * th;
+    }
+
+    float IesProfile::GetMaxIntensity() const
+    {
+        return m_candela.empty() ? 0.f : *std::max_element(m_candela.begin(), m_candela.end());
+    }
+
+    Texture::Ptr IesProfile::CreateTexture(std::uint32_t width, std::uint32_t height) const
+    {
+        auto max_intensity = GetMaxIntensity();
+
+        if (width == 0u || height == 0u || max_intensity <= 0.f)
+        {
+            throw std::runtime_error("IesProfile: cannot create texture of empty profile");
+        }
+
+        auto data = new char[4 * sizeof(float) * width * height];
+        auto texels = reinterpret_cast<float*>(data);
+
+        for (auto y = 0u; y < height; ++y)
+        {
+            auto theta = PI * (y + 0.5f) / height;
+
+            for (auto x = 0u; x < width; ++x)
+            {
+                auto phi = 2.f * PI * (x + 0.5f) / width;
+                auto value = GetIntensity(theta, phi) / max_intensity;
+
+                auto texel = texels + 4 * (y * width + x);
+                texel[0] = texel[1] = texel[2] = value;
+                texel[3] = 1.f;
+            }
+        }
+
+        return Texture::Create(data, RadeonRays::int3(width, height, 1), Texture::Format::kRgba32);
+    }
+}
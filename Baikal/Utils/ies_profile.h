@@ -0,0 +1,41 @@
+#pragma once
+
+#include "SceneGraph/texture.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Baikal
+{
+    ///< The class represents photometric web of a luminaire read from IES LM-63 data.
+    ///< Candela values are given over vertical angles from the nadir (light direction)
+    ///< and horizontal angles around it, type C photometry only. Profile textures are
+    ///< lat-long maps of the relative intensity with theta = 0 along the light direction
+    ///< in the first row, lights scale their emission by it and importance sample it.
+    ///<
+    struct IesProfile
+    {
+    public:
+        IesProfile();
+
+        // Parse LM-63 file contents, throws std::runtime_error on malformed data
+        static IesProfile Parse(std::string const& data);
+        // Read and parse LM-63 file
+        static IesProfile Load(std::string const& filename);
+
+        // Intensity in candela, angles are in radians: theta from the nadir, phi around it
+        float GetIntensity(float theta, float phi) const;
+        // Largest candela value of the web
+        float GetMaxIntensity() const;
+
+        // RGBA32 lat-long map of width x height texels of intensity relative to the maximum
+        Texture::Ptr CreateTexture(std::uint32_t width, std::uint32_t height) const;
+
+        // Vertical and horizontal angles in degrees
+        std::vector<float> m_vertical_angles;
+        std::vector<float> m_horizontal_angles;
+        // Candela values with the multiplier applied, vertical angles first
+        std::vector<float> m_candela;
+    };
+}
@@ -0,0 +1,106 @@
+#include "light_bvh.h"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+namespace Baikal
+{
+    namespace
+    {
+        struct BuildContext
+        {
+            RadeonRays::float3 const* pmin;
+            RadeonRays::float3 const* pmax;
+            float const* power;
+            std::uint32_t const* light_indices;
+            std::vector<std::uint32_t> order;
+        };
+
+        void WriteBounds(LightBvh::Node& node, RadeonRays::float3 const& pmin, RadeonRays::float3 const& pmax)
+        {
+            node.pmin[0] = pmin.x; node.pmin[1] = pmin.y; node.pmin[2] = pmin.z;
+            node.pmax[0] = pmax.x; node.pmax[1] = pmax.y; node.pmax[2] = pmax.z;
+        }
+
+        void BuildNode(LightBvh& bvh, BuildContext& context, std::uint32_t node_idx, std::uint32_t begin, std::uint32_t end)
+        {
+            assert(end > begin);
+
+            auto pmin = context.pmin[context.order[begin]];
+            auto pmax = context.pmax[context.order[begin]];
+            auto cmin = 0.5f * (pmin + pmax);
+            auto cmax = cmin;
+            auto power = 0.f;
+
+            for (auto i = begin; i < end; ++i)
+            {
+                auto idx = context.order[i];
+                auto c = 0.5f * (context.pmin[idx] + context.pmax[idx]);
+
+                pmin = RadeonRays::vmin(pmin, context.pmin[idx]);
+                pmax = RadeonRays::vmax(pmax, context.pmax[idx]);
+                cmin = RadeonRays::vmin(cmin, c);
+                cmax = RadeonRays::vmax(cmax, c);
+                power += context.power[idx];
+            }
+
+            WriteBounds(bvh.m_nodes[node_idx], pmin, pmax);
+            bvh.m_nodes[node_idx].power = power;
+
+            if (end - begin == 1)
+            {
+                bvh.m_nodes[node_idx].child = -static_cast<std::int32_t>(context.light_indices[context.order[begin]]) - 1;
+                return;
+            }
+
+            // Median split along the largest extent of centroids
+            auto extent = cmax - cmin;
+            auto axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+            auto mid = begin + (end - begin) / 2;
+
+            std::nth_element(context.order.begin() + begin, context.order.begin() + mid, context.order.begin() + end,
+                [&context, axis](std::uint32_t lhs, std::uint32_t rhs)
+                {
+                    return (context.pmin[lhs][axis] + context.pmax[lhs][axis]) < (context.pmin[rhs][axis] + context.pmax[rhs][axis]);
+                });
+
+            auto left = static_cast<std::uint32_t>(bvh.m_nodes.size());
+            bvh.m_nodes.resize(left + 2);
+            bvh.m_parents.resize(left + 2, static_cast<std::int32_t>(node_idx));
+            bvh.m_nodes[node_idx].child = static_cast<std::int32_t>(left);
+
+            BuildNode(bvh, context, left, begin, mid);
+            BuildNode(bvh, context, left + 1, mid, end);
+        }
+    }
+
+    LightBvh::LightBvh()
+    {
+    }
+
+    void LightBvh::Build(RadeonRays::float3 const* pmin,
+                         RadeonRays::float3 const* pmax,
+                         float const* power,
+                         std::uint32_t const* light_indices,
+                         std::uint32_t num_lights)
+    {
+        m_nodes.clear();
+        m_parents.clear();
+
+        if (num_lights == 0)
+        {
+            return;
+        }
+
+        BuildContext context = { pmin, pmax, power, light_indices, std::vector<std::uint32_t>(num_lights) };
+        std::iota(context.order.begin(), context.order.end(), 0u);
+
+        m_nodes.reserve(2 * num_lights - 1);
+        m_parents.reserve(2 * num_lights - 1);
+        m_nodes.resize(1);
+        m_parents.resize(1, -1);
+
+        BuildNode(*this, context, 0u, 0u, num_lights);
+    }
+}
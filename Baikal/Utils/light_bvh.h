@@ -0,0 +1,43 @@
+#pragma once
+
+#include "math/float3.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace Baikal
+{
+    ///< The class represents bounding volume hierarchy over light sources.
+    ///< Each node keeps bounds and total power of the lights below it, which
+    ///< allows to pick lights proportionally to their estimated contribution
+    ///< at a given shading point by a single top-down traversal.
+    ///< Children of internal nodes are stored next to each other.
+    ///<
+    struct LightBvh
+    {
+    public:
+        ///< Node layout matches the one used by the kernels (8 x 32-bit)
+        struct Node
+        {
+            float pmin[3];
+            float power;
+            float pmax[3];
+            // Leaf: -(light index + 1), internal node: index of the left child
+            std::int32_t child;
+        };
+
+        LightBvh();
+
+        // Build hierarchy over num_lights lights, light_indices are written to leaves
+        void Build(RadeonRays::float3 const* pmin,
+                   RadeonRays::float3 const* pmax,
+                   float const* power,
+                   std::uint32_t const* light_indices,
+                   std::uint32_t num_lights);
+
+        // Nodes, root goes first
+        std::vector<Node> m_nodes;
+        // Parent index for each node, -1 for the root
+        std::vector<std::int32_t> m_parents;
+    };
+}
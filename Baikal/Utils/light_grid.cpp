@@ -0,0 +1,173 @@
+#include "light_grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace Baikal
+{
+    namespace
+    {
+        // Number of cells along the largest extent of the lights
+        std::uint32_t const kMaxResolution = 8u;
+        // Maximum number of lights in a cell list
+        std::uint32_t const kMaxCellLights = 32u;
+        // Power distribution keeps some probability to reach lights left out of the list
+        float const kMaxListProbability = 0.9f;
+
+        // Estimated contribution of a light to the points within a cell,
+        // same estimate as light BVH uses for its nodes
+        float GetImportance(RadeonRays::float3 const& cell_center, RadeonRays::float3 const& cell_extent,
+                            RadeonRays::float3 const& pmin, RadeonRays::float3 const& pmax, float power)
+        {
+            auto center = 0.5f * (pmin + pmax);
+            auto extent = pmax - pmin;
+            auto d = center - cell_center;
+
+            // Do not let the importance blow up for the lights within the cell
+            float dist2 = d.x * d.x + d.y * d.y + d.z * d.z;
+            float radius2 = 0.25f * (extent.sqnorm() + cell_extent.sqnorm());
+            return power / std::max(std::max(dist2, radius2), 1e-8f);
+        }
+    }
+
+    LightGrid::LightGrid()
+        : m_pmin(0.f, 0.f, 0.f)
+        , m_cell_size(1.f, 1.f, 1.f)
+        , m_resolution{ 0u, 0u, 0u }
+    {
+    }
+
+    std::uint32_t LightGrid::GetNumCells() const
+    {
+        return m_resolution[0] * m_resolution[1] * m_resolution[2];
+    }
+
+    std::uint32_t LightGrid::GetCellIndex(RadeonRays::float3 const& p) const
+    {
+        float const pos[3] = { (p.x - m_pmin.x) / m_cell_size.x, (p.y - m_pmin.y) / m_cell_size.y, (p.z - m_pmin.z) / m_cell_size.z };
+        std::uint32_t cell[3];
+
+        for (auto axis = 0u; axis < 3; ++axis)
+        {
+            auto max_cell = static_cast<float>(m_resolution[axis] - 1);
+            cell[axis] = static_cast<std::uint32_t>(std::min(std::max(std::floor(pos[axis]), 0.f), max_cell));
+        }
+
+        return (cell[2] * m_resolution[1] + cell[1]) * m_resolution[0] + cell[0];
+    }
+
+    void LightGrid::Build(RadeonRays::float3 const* pmin,
+                          RadeonRays::float3 const* pmax,
+                          float const* power,
+                          std::uint32_t const* light_indices,
+                          std::uint32_t num_lights)
+    {
+        m_resolution[0] = m_resolution[1] = m_resolution[2] = 0u;
+        m_cell_offsets.clear();
+        m_list_probabilities.clear();
+        m_light_indices.clear();
+        m_cdf.clear();
+
+        if (num_lights == 0)
+        {
+            return;
+        }
+
+        auto bounds_min = pmin[0];
+        auto bounds_max = pmax[0];
+
+        for (auto i = 1u; i < num_lights; ++i)
+        {
+            bounds_min = RadeonRays::vmin(bounds_min, pmin[i]);
+            bounds_max = RadeonRays::vmax(bounds_max, pmax[i]);
+        }
+
+        // Cells are close to cubes, flat axes get a single cell
+        auto extent = bounds_max - bounds_min;
+        float const extents[3] = { extent.x, extent.y, extent.z };
+        auto max_extent = std::max(std::max(extent.x, extent.y), extent.z);
+        float cell_size[3];
+
+        for (auto axis = 0u; axis < 3; ++axis)
+        {
+            auto resolution = max_extent > 0.f ? std::ceil(kMaxResolution * extents[axis] / max_extent) : 1.f;
+            m_resolution[axis] = std::min(std::max(static_cast<std::uint32_t>(resolution), 1u), kMaxResolution);
+            cell_size[axis] = extents[axis] > 0.f ? extents[axis] / m_resolution[axis] : 1.f;
+        }
+
+        m_pmin = bounds_min;
+        m_cell_size = RadeonRays::float3(cell_size[0], cell_size[1], cell_size[2]);
+
+        auto num_cells = GetNumCells();
+        auto cell_extent = RadeonRays::float3(extents[0] > 0.f ? cell_size[0] : 0.f,
+            extents[1] > 0.f ? cell_size[1] : 0.f, extents[2] > 0.f ? cell_size[2] : 0.f);
+
+        m_cell_offsets.reserve(num_cells + 1);
+        m_list_probabilities.reserve(num_cells);
+        m_cell_offsets.push_back(0u);
+
+        std::vector<float> importance(num_lights);
+        std::vector<std::uint32_t> order(num_lights);
+
+        for (auto z = 0u; z < m_resolution[2]; ++z)
+        {
+            for (auto y = 0u; y < m_resolution[1]; ++y)
+            {
+                for (auto x = 0u; x < m_resolution[0]; ++x)
+                {
+                    auto cell_center = m_pmin + RadeonRays::float3(
+                        (x + 0.5f) * cell_size[0], (y + 0.5f) * cell_size[1], (z + 0.5f) * cell_size[2]);
+
+                    // Lights with no contribution are not listed
+                    order.clear();
+                    auto total_importance = 0.f;
+                    for (auto i = 0u; i < num_lights; ++i)
+                    {
+                        importance[i] = GetImportance(cell_center, cell_extent, pmin[i], pmax[i], power[i]);
+                        total_importance += importance[i];
+
+                        if (importance[i] > 0.f)
+                        {
+                            order.push_back(i);
+                        }
+                    }
+
+                    auto num_listed = std::min(static_cast<std::uint32_t>(order.size()), kMaxCellLights);
+                    bool complete = num_listed == order.size();
+
+                    std::partial_sort(order.begin(), order.begin() + num_listed, order.end(),
+                        [&importance](std::uint32_t lhs, std::uint32_t rhs)
+                        {
+                            return importance[lhs] > importance[rhs];
+                        });
+
+                    auto listed_importance = 0.f;
+                    for (auto i = 0u; i < num_listed; ++i)
+                    {
+                        listed_importance += importance[order[i]];
+                    }
+
+                    // Complete lists are used alone, otherwise the power distribution
+                    // takes at least the share of lights left out of the list
+                    auto list_probability = 0.f;
+                    if (listed_importance > 0.f)
+                    {
+                        list_probability = complete ? 1.f : std::min(listed_importance / total_importance, kMaxListProbability);
+                    }
+
+                    auto cdf = 0.f;
+                    for (auto i = 0u; i < num_listed; ++i)
+                    {
+                        cdf += importance[order[i]] / listed_importance;
+                        m_light_indices.push_back(light_indices[order[i]]);
+                        m_cdf.push_back(i + 1 == num_listed ? 1.f : cdf);
+                    }
+
+                    m_list_probabilities.push_back(list_probability);
+                    m_cell_offsets.push_back(static_cast<std::uint32_t>(m_light_indices.size()));
+                }
+            }
+        }
+    }
+}
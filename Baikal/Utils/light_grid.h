@@ -0,0 +1,46 @@
+#pragma once
+
+#include "math/float3.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace Baikal
+{
+    ///< The class represents uniform world space grid over light sources.
+    ///< Each cell keeps a short list of the lights with the largest estimated
+    ///< contribution to the cell along with their CDF, so lights are picked
+    ///< from a handful of nearby ones instead of the whole scene. The rest of
+    ///< the lights are reached by falling back to the global power distribution
+    ///< with the probability the list does not cover.
+    ///<
+    struct LightGrid
+    {
+    public:
+        LightGrid();
+
+        // Build grid over bounds of num_lights lights, light_indices are written to cell lists
+        void Build(RadeonRays::float3 const* pmin,
+                   RadeonRays::float3 const* pmax,
+                   float const* power,
+                   std::uint32_t const* light_indices,
+                   std::uint32_t num_lights);
+
+        // Cell containing a point, points outside of the grid map to the closest cell
+        std::uint32_t GetCellIndex(RadeonRays::float3 const& p) const;
+
+        std::uint32_t GetNumCells() const;
+
+        // Grid origin, cell size and number of cells along each axis
+        RadeonRays::float3 m_pmin;
+        RadeonRays::float3 m_cell_size;
+        std::uint32_t m_resolution[3];
+        // Cell lists are stored one after another, num_cells + 1 offsets
+        std::vector<std::uint32_t> m_cell_offsets;
+        // Probability to pick the light from the cell list rather than the power distribution
+        std::vector<float> m_list_probabilities;
+        // Light indices and CDF values of cell lists
+        std::vector<std::uint32_t> m_light_indices;
+        std::vector<float> m_cdf;
+    };
+}
@@ -0,0 +1,72 @@
+#include "majorant_grid.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace Baikal
+{
+    MajorantGrid::MajorantGrid()
+        : m_resolution{ 0u, 0u, 0u }
+        , m_block(1u)
+    {
+    }
+
+    std::uint32_t MajorantGrid::GetNumCells() const
+    {
+        return m_resolution[0] * m_resolution[1] * m_resolution[2];
+    }
+
+    void MajorantGrid::Build(float const* density, std::uint32_t const resolution[3], std::uint32_t block)
+    {
+        if (block == 0u)
+        {
+            throw std::runtime_error("MajorantGrid: block size should be positive");
+        }
+
+        m_block = block;
+
+        for (auto axis = 0u; axis < 3; ++axis)
+        {
+            m_resolution[axis] = (resolution[axis] + block - 1) / block;
+        }
+
+        m_majorants.assign(GetNumCells(), 0.f);
+
+        // Interpolation reaches one voxel past the block on each side
+        auto get_range = [&](std::uint32_t cell, std::uint32_t axis, std::uint32_t& begin, std::uint32_t& end)
+        {
+            begin = cell * block > 0u ? cell * block - 1u : 0u;
+            end = std::min((cell + 1u) * block + 1u, resolution[axis]);
+        };
+
+        for (auto z = 0u; z < m_resolution[2]; ++z)
+        {
+            std::uint32_t z0, z1;
+            get_range(z, 2u, z0, z1);
+
+            for (auto y = 0u; y < m_resolution[1]; ++y)
+            {
+                std::uint32_t y0, y1;
+                get_range(y, 1u, y0, y1);
+
+                for (auto x = 0u; x < m_resolution[0]; ++x)
+                {
+                    std::uint32_t x0, x1;
+                    get_range(x, 0u, x0, x1);
+
+                    auto majorant = 0.f;
+                    for (auto vz = z0; vz < z1; ++vz)
+                    {
+                        for (auto vy = y0; vy < y1; ++vy)
+                        {
+                            auto row = density + (vz * resolution[1] + vy) * resolution[0];
+                            majorant = std::max(majorant, *std::max_element(row + x0, row + x1));
+                        }
+                    }
+
+                    m_majorants[(z * m_resolution[1] + y) * m_resolution[0] + x] = majorant;
+                }
+            }
+        }
+    }
+}
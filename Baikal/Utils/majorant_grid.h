@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Baikal
+{
+    ///< The class represents coarse grid of density upper bounds over a voxel
+    ///< density grid. Every cell bounds the trilinearly interpolated density
+    ///< within a block of voxels, so delta and ratio tracking take long steps
+    ///< through thin regions and skip empty ones without sampling the density.
+    ///<
+    struct MajorantGrid
+    {
+    public:
+        MajorantGrid();
+
+        // Build majorants of resolution[0] x resolution[1] x resolution[2] densities stored x first,
+        // every cell covers block voxels along each axis
+        void Build(float const* density, std::uint32_t const resolution[3], std::uint32_t block);
+
+        std::uint32_t GetNumCells() const;
+
+        // Number of cells along each axis
+        std::uint32_t m_resolution[3];
+        // Number of voxels covered by a cell along each axis
+        std::uint32_t m_block;
+        // Maximum density within each cell, x first
+        std::vector<float> m_majorants;
+    };
+}
@@ -0,0 +1,106 @@
+#include "mesh_tangents.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace Baikal
+{
+    namespace MeshTangents
+    {
+        static RadeonRays::float3 SafeNormalize(RadeonRays::float3 const& v)
+        {
+            auto sqlength = v.sqnorm();
+            return sqlength > 0.f ? v * (1.f / std::sqrt(sqlength)) : RadeonRays::float3(0.f, 0.f, 0.f);
+        }
+
+        // Same choice as GetOrthoVector in Kernels/CL/utils.cl
+        static RadeonRays::float3 GetOrthoVector(RadeonRays::float3 const& n)
+        {
+            auto p = std::fabs(n.z) > 0.f ?
+                RadeonRays::float3(0.f, -n.z, n.y) :
+                RadeonRays::float3(-n.y, n.x, 0.f);
+            return SafeNormalize(p);
+        }
+
+        // Angle between the edges leaving a triangle corner
+        static float GetCornerAngle(RadeonRays::float3 const& e1, RadeonRays::float3 const& e2)
+        {
+            auto cos_angle = RadeonRays::dot(SafeNormalize(e1), SafeNormalize(e2));
+            return std::acos(std::min(std::max(cos_angle, -1.f), 1.f));
+        }
+
+        void Compute(RadeonRays::float3 const* vertices, RadeonRays::float3 const* normals,
+                     RadeonRays::float2 const* uvs, std::size_t num_vertices,
+                     std::uint32_t const* indices, std::size_t num_indices,
+                     RadeonRays::float4* tangents)
+        {
+            std::vector<RadeonRays::float3> accumulated_tangents(num_vertices);
+            std::vector<RadeonRays::float3> accumulated_bitangents(num_vertices);
+            std::vector<RadeonRays::float3> face_normals(normals ? 0 : num_vertices);
+
+            for (std::size_t i = 0; i + 2 < num_indices; i += 3)
+            {
+                std::uint32_t corners[3] = { indices[i], indices[i + 1], indices[i + 2] };
+
+                if (corners[0] >= num_vertices || corners[1] >= num_vertices || corners[2] >= num_vertices)
+                {
+                    continue;
+                }
+
+                auto dp1 = vertices[corners[1]] - vertices[corners[0]];
+                auto dp2 = vertices[corners[2]] - vertices[corners[0]];
+
+                RadeonRays::float3 t(0.f, 0.f, 0.f);
+                RadeonRays::float3 b(0.f, 0.f, 0.f);
+
+                if (uvs)
+                {
+                    auto duv1 = uvs[corners[1]] - uvs[corners[0]];
+                    auto duv2 = uvs[corners[2]] - uvs[corners[0]];
+                    auto det = duv1.x * duv2.y - duv2.x * duv1.y;
+
+                    // Sign of the determinant is kept, so mirrored triangles flip the bitangent
+                    if (det != 0.f)
+                    {
+                        t = SafeNormalize((duv2.y * dp1 - duv1.y * dp2) * (1.f / det));
+                        b = SafeNormalize((duv1.x * dp2 - duv2.x * dp1) * (1.f / det));
+                    }
+                }
+
+                auto ng = SafeNormalize(RadeonRays::cross(dp1, dp2));
+
+                for (auto corner = 0u; corner < 3u; ++corner)
+                {
+                    auto p = vertices[corners[corner]];
+                    auto angle = GetCornerAngle(vertices[corners[(corner + 1) % 3]] - p, vertices[corners[(corner + 2) % 3]] - p);
+
+                    accumulated_tangents[corners[corner]] += angle * t;
+                    accumulated_bitangents[corners[corner]] += angle * b;
+
+                    if (!normals)
+                    {
+                        face_normals[corners[corner]] += angle * ng;
+                    }
+                }
+            }
+
+            for (std::size_t i = 0; i < num_vertices; ++i)
+            {
+                auto n = SafeNormalize(normals ? normals[i] : face_normals[i]);
+                auto t = accumulated_tangents[i];
+
+                // Gram-Schmidt against the normal
+                t = SafeNormalize(t - RadeonRays::dot(n, t) * n);
+
+                if (t.sqnorm() == 0.f)
+                {
+                    t = GetOrthoVector(n);
+                }
+
+                auto sign = RadeonRays::dot(RadeonRays::cross(n, t), accumulated_bitangents[i]) < 0.f ? -1.f : 1.f;
+                tangents[i] = RadeonRays::float4(t.x, t.y, t.z, sign);
+            }
+        }
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "math/float2.h"
+#include "math/float3.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Baikal
+{
+    ///< Per-vertex tangent frames used by BAIKAL_VERTEX_TANGENTS scene buffers.
+    ///< Follows MikkTSpace conventions: triangle UV derivatives are accumulated with corner
+    ///< angle weights and orthogonalized against the vertex normal, w holds the bitangent
+    ///< sign, so bitangent = w * cross(n, t). Vertices are not split at UV seams.
+    ///<
+    namespace MeshTangents
+    {
+        // Normals may be null, then accumulated face normals are used, vertices without
+        // UV derivatives get an arbitrary tangent orthogonal to the normal
+        void Compute(RadeonRays::float3 const* vertices, RadeonRays::float3 const* normals,
+                     RadeonRays::float2 const* uvs, std::size_t num_vertices,
+                     std::uint32_t const* indices, std::size_t num_indices,
+                     RadeonRays::float4* tangents);
+    }
+}
@@ -0,0 +1,135 @@
+#include "object_pool.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+
+namespace Baikal
+{
+    std::size_t constexpr ObjectPool::kAlignment;
+    std::size_t constexpr ObjectPool::kMaxBlockSize;
+
+    namespace
+    {
+        // Chunks hold at least this many bytes
+        std::size_t constexpr kChunkSize = 64 * 1024;
+
+        std::size_t GetSizeClass(std::size_t size)
+        {
+            return (std::max<std::size_t>(size, 1) + ObjectPool::kAlignment - 1) / ObjectPool::kAlignment;
+        }
+    }
+
+    ObjectPool::ObjectPool(std::size_t block_size)
+        : m_block_size(block_size)
+        , m_blocks_per_chunk(std::max<std::size_t>(kChunkSize / block_size, 1))
+        , m_free_list(nullptr)
+        , m_num_allocated(0)
+    {
+    }
+
+    ObjectPool& ObjectPool::Get(std::size_t size)
+    {
+        using PoolTable = std::array<std::atomic<ObjectPool*>, kMaxBlockSize / kAlignment + 1>;
+        // Pools and the table are intentionally leaked, see declaration
+        static auto& pools = *new PoolTable();
+
+        auto size_class = GetSizeClass(size);
+        assert(size_class < pools.size());
+
+        auto pool = pools[size_class].load(std::memory_order_acquire);
+
+        if (!pool)
+        {
+            auto created = new ObjectPool(size_class * kAlignment);
+
+            if (pools[size_class].compare_exchange_strong(pool, created, std::memory_order_acq_rel))
+            {
+                pool = created;
+            }
+            else
+            {
+                delete created;
+            }
+        }
+
+        return *pool;
+    }
+
+    void* ObjectPool::Allocate(std::size_t size)
+    {
+        if (size > kMaxBlockSize)
+        {
+            return ::operator new(size);
+        }
+
+        return Get(size).AllocateBlock();
+    }
+
+    void ObjectPool::Deallocate(void* ptr, std::size_t size)
+    {
+        if (!ptr)
+        {
+            return;
+        }
+
+        if (size > kMaxBlockSize)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        Get(size).DeallocateBlock(ptr);
+    }
+
+    std::size_t ObjectPool::GetNumAllocated(std::size_t size)
+    {
+        if (size > kMaxBlockSize)
+        {
+            return 0;
+        }
+
+        auto& pool = Get(size);
+        std::lock_guard<std::mutex> lock(pool.m_mutex);
+        return pool.m_num_allocated;
+    }
+
+    void* ObjectPool::AllocateBlock()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_free_list)
+        {
+            // Operator new aligns chunks for any fundamental type, block sizes keep the alignment
+            std::unique_ptr<char[]> chunk(new char[m_block_size * m_blocks_per_chunk]);
+
+            for (auto i = m_blocks_per_chunk; i > 0; --i)
+            {
+                auto block = reinterpret_cast<FreeBlock*>(chunk.get() + (i - 1) * m_block_size);
+                block->next = m_free_list;
+                m_free_list = block;
+            }
+
+            m_chunks.push_back(std::move(chunk));
+        }
+
+        auto block = m_free_list;
+        m_free_list = block->next;
+        ++m_num_allocated;
+
+        return block;
+    }
+
+    void ObjectPool::DeallocateBlock(void* block)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto free_block = static_cast<FreeBlock*>(block);
+        free_block->next = m_free_list;
+        m_free_list = free_block;
+
+        assert(m_num_allocated > 0);
+        --m_num_allocated;
+    }
+}
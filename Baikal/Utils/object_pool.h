@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Baikal
+{
+    ///< The class hands out fixed size blocks carved from large chunks, e.g. for
+    ///< scene graph objects which are created by millions. Freed blocks go to a
+    ///< free list and are reused by later allocations of the same size class, chunks
+    ///< are never returned to the system. Requests are rounded up to kAlignment,
+    ///< larger ones than kMaxBlockSize go to the global operator new.
+    ///<
+    class ObjectPool
+    {
+    public:
+        static std::size_t constexpr kAlignment = 16;
+        static std::size_t constexpr kMaxBlockSize = 1024;
+
+        // Allocate size bytes from the pool of its size class, thread safe
+        static void* Allocate(std::size_t size);
+        // Return memory of size bytes previously returned by Allocate
+        static void Deallocate(void* ptr, std::size_t size);
+        // Number of blocks in use in the pool of the size class
+        static std::size_t GetNumAllocated(std::size_t size);
+
+    private:
+        explicit ObjectPool(std::size_t block_size);
+
+        // Pool of the size class, pools are created on first use and live until the process exits,
+        // so objects destroyed during static destruction can still return their blocks
+        static ObjectPool& Get(std::size_t size);
+
+        void* AllocateBlock();
+        void DeallocateBlock(void* block);
+
+        struct FreeBlock
+        {
+            FreeBlock* next;
+        };
+
+        std::mutex m_mutex;
+        std::size_t m_block_size;
+        std::size_t m_blocks_per_chunk;
+        FreeBlock* m_free_list;
+        std::vector<std::unique_ptr<char[]>> m_chunks;
+        std::size_t m_num_allocated;
+    };
+
+    ///< Standard allocator drawing from ObjectPool, used with std::allocate_shared
+    ///< the object and its reference counts share a single pooled block.
+    ///<
+    template <typename T>
+    class PoolAllocator
+    {
+    public:
+        using value_type = T;
+
+        PoolAllocator() = default;
+        template <typename U>
+        PoolAllocator(PoolAllocator<U> const&) {}
+
+        T* allocate(std::size_t n)
+        {
+            static_assert(alignof(T) <= ObjectPool::kAlignment, "PoolAllocator: type is over-aligned");
+            return static_cast<T*>(ObjectPool::Allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T* ptr, std::size_t n)
+        {
+            ObjectPool::Deallocate(ptr, n * sizeof(T));
+        }
+
+        template <typename U>
+        bool operator == (PoolAllocator<U> const&) const { return true; }
+        template <typename U>
+        bool operator != (PoolAllocator<U> const&) const { return false; }
+    };
+
+    // Create shared object in a pooled block
+    template <typename T, typename... Args>
+    inline std::shared_ptr<T> MakePooled(Args&&... args)
+    {
+        return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+    }
+}
@@ -0,0 +1,125 @@
+#include "range_allocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+namespace Baikal
+{
+    std::size_t constexpr RangeAllocator::kInvalidOffset;
+
+    RangeAllocator::RangeAllocator()
+        : m_capacity(0)
+    {
+    }
+
+    std::size_t RangeAllocator::Allocate(std::size_t size)
+    {
+        if (size == 0)
+        {
+            return 0;
+        }
+
+        for (auto iter = m_free_blocks.begin(); iter != m_free_blocks.end(); ++iter)
+        {
+            if (iter->second >= size)
+            {
+                auto offset = iter->first;
+                auto remainder = iter->second - size;
+
+                m_free_blocks.erase(iter);
+
+                if (remainder > 0)
+                {
+                    m_free_blocks.emplace(offset + size, remainder);
+                }
+
+                return offset;
+            }
+        }
+
+        return kInvalidOffset;
+    }
+
+    void RangeAllocator::Free(std::size_t offset, std::size_t size)
+    {
+        if (size == 0)
+        {
+            return;
+        }
+
+        assert(offset + size <= m_capacity);
+
+        auto next = m_free_blocks.lower_bound(offset);
+
+        // Merge with the previous block
+        if (next != m_free_blocks.begin())
+        {
+            auto prev = std::prev(next);
+
+            assert(prev->first + prev->second <= offset);
+
+            if (prev->first + prev->second == offset)
+            {
+                offset = prev->first;
+                size += prev->second;
+                m_free_blocks.erase(prev);
+            }
+        }
+
+        // Merge with the next block
+        if (next != m_free_blocks.end() && offset + size == next->first)
+        {
+            size += next->second;
+            m_free_blocks.erase(next);
+        }
+
+        m_free_blocks.emplace(offset, size);
+    }
+
+    void RangeAllocator::Grow(std::size_t capacity)
+    {
+        if (capacity <= m_capacity)
+        {
+            return;
+        }
+
+        auto old_capacity = m_capacity;
+        m_capacity = capacity;
+        Free(old_capacity, capacity - old_capacity);
+    }
+
+    void RangeAllocator::Reset(std::size_t capacity)
+    {
+        m_free_blocks.clear();
+        m_capacity = capacity;
+
+        if (capacity > 0)
+        {
+            m_free_blocks.emplace(0u, capacity);
+        }
+    }
+
+    std::size_t RangeAllocator::GetLargestFreeBlock() const
+    {
+        std::size_t largest = 0;
+
+        for (auto const& block : m_free_blocks)
+        {
+            largest = std::max(largest, block.second);
+        }
+
+        return largest;
+    }
+
+    std::size_t RangeAllocator::GetFreeTail() const
+    {
+        if (m_free_blocks.empty())
+        {
+            return 0;
+        }
+
+        auto last = std::prev(m_free_blocks.end());
+        return last->first + last->second == m_capacity ? last->second : 0;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+
+namespace Baikal
+{
+    ///< The class manages sub-allocations inside a linear range [0, capacity),
+    ///< e.g. a GPU buffer shared by several meshes. Free blocks are kept ordered
+    ///< by offset and merged with their neighbours on release, allocation is first-fit.
+    ///<
+    class RangeAllocator
+    {
+    public:
+        static std::size_t constexpr kInvalidOffset = ~std::size_t(0);
+
+        RangeAllocator();
+
+        // Allocate size elements, returns kInvalidOffset if there is no large enough block
+        std::size_t Allocate(std::size_t size);
+        // Return block previously returned by Allocate
+        void Free(std::size_t offset, std::size_t size);
+        // Extend the range, new space is appended as a free block
+        void Grow(std::size_t capacity);
+        // Forget all allocations and set new capacity
+        void Reset(std::size_t capacity);
+
+        std::size_t GetCapacity() const { return m_capacity; }
+        // Size of the largest block which can be allocated without growing
+        std::size_t GetLargestFreeBlock() const;
+        // Number of elements in free blocks at the end of the range
+        std::size_t GetFreeTail() const;
+
+    private:
+        // Offset -> size
+        std::map<std::size_t, std::size_t> m_free_blocks;
+        std::size_t m_capacity;
+    };
+}
@@ -0,0 +1,440 @@
+#include "render_protocol.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace Baikal
+{
+    namespace
+    {
+        char const kMagic[4] = { 'B', 'K', 'R', 'N' };
+        std::uint32_t constexpr kProtocolVersion = 2u;
+        // Longest scene path or model name and error text
+        std::size_t constexpr kMaxStringLength = 4096u;
+        std::size_t constexpr kMaxErrorLength = 65536u;
+
+        struct SampleChunkHeader
+        {
+            std::uint32_t job_id;
+            std::uint32_t width;
+            std::uint32_t height;
+            std::uint32_t reserved;
+        };
+
+        struct FrameHeader
+        {
+            std::uint32_t request_id;
+            std::uint32_t width;
+            std::uint32_t height;
+            FrameFormat format;
+        };
+
+        struct FrameTilesHeader
+        {
+            std::uint32_t request_id;
+            std::uint32_t width;
+            std::uint32_t height;
+            std::uint32_t tile_size;
+            std::uint32_t num_samples;
+            FrameFormat format;
+            std::uint32_t num_tiles;
+            std::uint32_t reserved;
+        };
+
+        // Throws if the tiles do not fit the frame
+        void CheckFrameTiles(std::uint32_t width, std::uint32_t height, std::uint32_t tile_size,
+                             std::vector<std::uint32_t> const& tiles)
+        {
+            if (tile_size == 0u)
+            {
+                throw std::runtime_error("Render protocol: invalid tile size");
+            }
+
+            auto num_tiles = static_cast<std::size_t>((width + tile_size - 1u) / tile_size) * ((height + tile_size - 1u) / tile_size);
+            if (std::any_of(tiles.cbegin(), tiles.cend(), [num_tiles](std::uint32_t tile) { return tile >= num_tiles; }))
+            {
+                throw std::runtime_error("Render protocol: tile is out of the frame");
+            }
+        }
+
+        static_assert(std::is_trivially_copyable<RenderJob>::value, "RenderJob is sent as is");
+        static_assert(std::is_trivially_copyable<ViewRequest>::value, "ViewRequest is sent as is");
+
+        void AppendString(std::vector<char>& payload, std::string const& str)
+        {
+            auto length = static_cast<std::uint32_t>(str.size());
+            auto offset = payload.size();
+            payload.resize(offset + sizeof(length) + str.size());
+            std::memcpy(payload.data() + offset, &length, sizeof(length));
+            std::memcpy(payload.data() + offset + sizeof(length), str.data(), str.size());
+        }
+
+        std::string ReadString(std::vector<char> const& payload, std::size_t& offset)
+        {
+            std::uint32_t length = 0;
+            if (payload.size() - offset < sizeof(length))
+            {
+                throw std::runtime_error("Render protocol: invalid scene request");
+            }
+
+            std::memcpy(&length, payload.data() + offset, sizeof(length));
+            offset += sizeof(length);
+
+            if (payload.size() - offset < length)
+            {
+                throw std::runtime_error("Render protocol: invalid scene request");
+            }
+
+            std::string str(payload.data() + offset, length);
+            offset += length;
+            return str;
+        }
+
+        void CheckPayloadSize(RenderMessageType type, std::uint64_t payload_size)
+        {
+            auto max_size = GetMaxPayloadSize(type);
+
+            if (payload_size > max_size)
+            {
+                throw std::runtime_error("Render protocol: payload of " + std::to_string(payload_size) +
+                                         " bytes exceeds the limit of " + std::to_string(max_size) + " bytes");
+            }
+        }
+
+        // 32-bit integer finalizer, flips about half of the output bits for every input bit
+        std::uint32_t Mix(std::uint32_t value)
+        {
+            value ^= value >> 16;
+            value *= 0x7feb352du;
+            value ^= value >> 15;
+            value *= 0x846ca68bu;
+            value ^= value >> 16;
+            return value;
+        }
+    }
+
+    std::uint32_t GetWorkerSeed(std::uint32_t job_seed, std::uint32_t slot)
+    {
+        return Mix(Mix(job_seed) ^ (slot * 0x9e3779b9u));
+    }
+
+    std::size_t GetMaxPayloadSize(RenderMessageType type)
+    {
+        auto max_pixels = static_cast<std::size_t>(kMaxRenderFrameSize) * kMaxRenderFrameSize;
+
+        switch (type)
+        {
+            case RenderMessageType::kJob:
+                return sizeof(RenderJob);
+            case RenderMessageType::kSamples:
+                return sizeof(SampleChunkHeader) + max_pixels * sizeof(RadeonRays::float3);
+            case RenderMessageType::kLoadScene:
+                return 2u * (sizeof(std::uint32_t) + kMaxStringLength);
+            case RenderMessageType::kView:
+                return sizeof(ViewRequest);
+            case RenderMessageType::kFrame:
+                return sizeof(FrameHeader) + GetFrameDataSize(FrameFormat::kRgba8, kMaxRenderFrameSize, kMaxRenderFrameSize);
+            case RenderMessageType::kError:
+                return kMaxErrorLength;
+            case RenderMessageType::kFrameTiles:
+                // Single pixel tiles take an index and a whole BC1 block each, larger edge tiles may cover
+                // up to four times the frame
+                return sizeof(FrameTilesHeader) + 4u * max_pixels * (sizeof(std::uint32_t) + 8u);
+        }
+
+        throw std::runtime_error("Render protocol: unknown message type");
+    }
+
+    RenderMessageHeader MakeRenderMessageHeader(RenderMessageType type, std::size_t payload_size)
+    {
+        CheckPayloadSize(type, payload_size);
+
+        RenderMessageHeader header = {};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kProtocolVersion;
+        header.type = type;
+        header.payload_size = payload_size;
+        return header;
+    }
+
+    void CheckRenderMessageHeader(RenderMessageHeader const& header)
+    {
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+        {
+            throw std::runtime_error("Render protocol: invalid message");
+        }
+
+        if (header.version != kProtocolVersion)
+        {
+            throw std::runtime_error("Render protocol: version mismatch, expected " + std::to_string(kProtocolVersion) +
+                                     " got " + std::to_string(header.version));
+        }
+
+        CheckPayloadSize(header.type, header.payload_size);
+    }
+
+    std::vector<char> EncodeRenderJob(RenderJob const& job)
+    {
+        std::vector<char> payload(sizeof(RenderJob));
+        std::memcpy(payload.data(), &job, sizeof(RenderJob));
+        return payload;
+    }
+
+    RenderJob DecodeRenderJob(std::vector<char> const& payload)
+    {
+        if (payload.size() != sizeof(RenderJob))
+        {
+            throw std::runtime_error("Render protocol: invalid job size");
+        }
+
+        RenderJob job;
+        std::memcpy(&job, payload.data(), sizeof(RenderJob));
+        return job;
+    }
+
+    std::vector<char> EncodeSampleChunk(SampleChunk const& chunk)
+    {
+        if (chunk.data.size() != static_cast<std::size_t>(chunk.width) * chunk.height)
+        {
+            throw std::runtime_error("Render protocol: chunk data does not match its size");
+        }
+
+        SampleChunkHeader header = { chunk.job_id, chunk.width, chunk.height, 0u };
+        auto data_size = chunk.data.size() * sizeof(RadeonRays::float3);
+
+        std::vector<char> payload(sizeof(header) + data_size);
+        std::memcpy(payload.data(), &header, sizeof(header));
+        std::memcpy(payload.data() + sizeof(header), chunk.data.data(), data_size);
+        return payload;
+    }
+
+    SampleChunk DecodeSampleChunk(std::vector<char> const& payload)
+    {
+        if (payload.size() < sizeof(SampleChunkHeader))
+        {
+            throw std::runtime_error("Render protocol: invalid chunk size");
+        }
+
+        SampleChunkHeader header;
+        std::memcpy(&header, payload.data(), sizeof(header));
+
+        auto num_pixels = static_cast<std::size_t>(header.width) * header.height;
+
+        if (payload.size() != sizeof(header) + num_pixels * sizeof(RadeonRays::float3))
+        {
+            throw std::runtime_error("Render protocol: chunk data does not match its size");
+        }
+
+        SampleChunk chunk;
+        chunk.job_id = header.job_id;
+        chunk.width = header.width;
+        chunk.height = header.height;
+        chunk.data.resize(num_pixels);
+        std::memcpy(chunk.data.data(), payload.data() + sizeof(header), num_pixels * sizeof(RadeonRays::float3));
+        return chunk;
+    }
+
+    std::size_t GetFrameDataSize(FrameFormat format, std::uint32_t width, std::uint32_t height)
+    {
+        switch (format)
+        {
+            case FrameFormat::kRgba8:
+                return static_cast<std::size_t>(width) * height * 4u;
+            case FrameFormat::kBc1:
+                // 8 bytes per 4x4 block, partial edge blocks are whole
+                return static_cast<std::size_t>((width + 3u) / 4u) * ((height + 3u) / 4u) * 8u;
+        }
+
+        throw std::runtime_error("Render protocol: unknown frame format");
+    }
+
+    std::vector<char> EncodeSceneRequest(SceneRequest const& request)
+    {
+        std::vector<char> payload;
+        AppendString(payload, request.path);
+        AppendString(payload, request.model_name);
+        return payload;
+    }
+
+    SceneRequest DecodeSceneRequest(std::vector<char> const& payload)
+    {
+        std::size_t offset = 0;
+
+        SceneRequest request;
+        request.path = ReadString(payload, offset);
+        request.model_name = ReadString(payload, offset);
+
+        if (offset != payload.size())
+        {
+            throw std::runtime_error("Render protocol: invalid scene request");
+        }
+
+        return request;
+    }
+
+    std::vector<char> EncodeViewRequest(ViewRequest const& request)
+    {
+        std::vector<char> payload(sizeof(ViewRequest));
+        std::memcpy(payload.data(), &request, sizeof(ViewRequest));
+        return payload;
+    }
+
+    ViewRequest DecodeViewRequest(std::vector<char> const& payload)
+    {
+        if (payload.size() != sizeof(ViewRequest))
+        {
+            throw std::runtime_error("Render protocol: invalid view request size");
+        }
+
+        ViewRequest request;
+        std::memcpy(&request, payload.data(), sizeof(ViewRequest));
+
+        // Frame size depends on it, so it is checked right away
+        GetFrameDataSize(request.format, 0u, 0u);
+        return request;
+    }
+
+    std::vector<char> EncodeFrame(EncodedFrame const& frame)
+    {
+        if (frame.data.size() != GetFrameDataSize(frame.format, frame.width, frame.height))
+        {
+            throw std::runtime_error("Render protocol: frame data does not match its size");
+        }
+
+        FrameHeader header = { frame.request_id, frame.width, frame.height, frame.format };
+
+        std::vector<char> payload(sizeof(header) + frame.data.size());
+        std::memcpy(payload.data(), &header, sizeof(header));
+        std::memcpy(payload.data() + sizeof(header), frame.data.data(), frame.data.size());
+        return payload;
+    }
+
+    EncodedFrame DecodeFrame(std::vector<char> const& payload)
+    {
+        if (payload.size() < sizeof(FrameHeader))
+        {
+            throw std::runtime_error("Render protocol: invalid frame size");
+        }
+
+        FrameHeader header;
+        std::memcpy(&header, payload.data(), sizeof(header));
+
+        if (payload.size() != sizeof(header) + GetFrameDataSize(header.format, header.width, header.height))
+        {
+            throw std::runtime_error("Render protocol: frame data does not match its size");
+        }
+
+        EncodedFrame frame;
+        frame.request_id = header.request_id;
+        frame.width = header.width;
+        frame.height = header.height;
+        frame.format = header.format;
+        frame.data.assign(payload.cbegin() + sizeof(header), payload.cend());
+        return frame;
+    }
+
+    std::vector<char> EncodeFrameTiles(FrameTiles const& frame)
+    {
+        CheckFrameTiles(frame.width, frame.height, frame.tile_size, frame.tiles);
+
+        if (frame.data.size() != frame.tiles.size() * GetFrameDataSize(frame.format, frame.tile_size, frame.tile_size))
+        {
+            throw std::runtime_error("Render protocol: tile data does not match the tile count");
+        }
+
+        FrameTilesHeader header = { frame.request_id, frame.width, frame.height, frame.tile_size, frame.num_samples,
+                                    frame.format, static_cast<std::uint32_t>(frame.tiles.size()), 0u };
+
+        auto tiles_size = frame.tiles.size() * sizeof(std::uint32_t);
+        std::vector<char> payload(sizeof(header) + tiles_size + frame.data.size());
+        std::memcpy(payload.data(), &header, sizeof(header));
+        std::memcpy(payload.data() + sizeof(header), frame.tiles.data(), tiles_size);
+        std::memcpy(payload.data() + sizeof(header) + tiles_size, frame.data.data(), frame.data.size());
+        return payload;
+    }
+
+    FrameTiles DecodeFrameTiles(std::vector<char> const& payload)
+    {
+        if (payload.size() < sizeof(FrameTilesHeader))
+        {
+            throw std::runtime_error("Render protocol: invalid frame tiles size");
+        }
+
+        FrameTilesHeader header;
+        std::memcpy(&header, payload.data(), sizeof(header));
+
+        auto tile_data_size = header.tile_size > 0u ? GetFrameDataSize(header.format, header.tile_size, header.tile_size) : 0u;
+        auto tiles_size = static_cast<std::size_t>(header.num_tiles) * sizeof(std::uint32_t);
+        if (payload.size() != sizeof(header) + tiles_size + header.num_tiles * tile_data_size)
+        {
+            throw std::runtime_error("Render protocol: tile data does not match the tile count");
+        }
+
+        FrameTiles frame;
+        frame.request_id = header.request_id;
+        frame.width = header.width;
+        frame.height = header.height;
+        frame.tile_size = header.tile_size;
+        frame.num_samples = header.num_samples;
+        frame.format = header.format;
+        frame.tiles.resize(header.num_tiles);
+        std::memcpy(frame.tiles.data(), payload.data() + sizeof(header), tiles_size);
+        frame.data.assign(payload.cbegin() + sizeof(header) + tiles_size, payload.cend());
+
+        CheckFrameTiles(frame.width, frame.height, frame.tile_size, frame.tiles);
+        return frame;
+    }
+
+    void SampleMerger::Reset(std::uint32_t job_id, std::uint32_t width, std::uint32_t height)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job_id = job_id;
+        m_width = width;
+        m_height = height;
+        m_data.assign(static_cast<std::size_t>(width) * height, RadeonRays::float3(0.f, 0.f, 0.f, 0.f));
+        m_has_samples = false;
+    }
+
+    bool SampleMerger::Merge(SampleChunk const& chunk)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (chunk.job_id != m_job_id || chunk.width != m_width || chunk.height != m_height)
+        {
+            return false;
+        }
+
+        for (std::size_t i = 0; i < m_data.size(); ++i)
+        {
+            m_data[i] += chunk.data[i];
+        }
+
+        m_has_samples = true;
+        return true;
+    }
+
+    bool SampleMerger::Take(std::vector<RadeonRays::float3>& data)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_has_samples)
+        {
+            return false;
+        }
+
+        data.resize(m_data.size());
+        std::copy(m_data.cbegin(), m_data.cend(), data.begin());
+        std::fill(m_data.begin(), m_data.end(), RadeonRays::float3(0.f, 0.f, 0.f, 0.f));
+        m_has_samples = false;
+        return true;
+    }
+
+    std::uint32_t SampleMerger::GetJobId() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_job_id;
+    }
+}
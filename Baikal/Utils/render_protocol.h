@@ -0,0 +1,190 @@
+#pragma once
+
+#include "math/float3.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Baikal
+{
+    ///< Messages exchanged between a render coordinator and its workers.
+    ///< A message is a fixed header followed by the payload, both written in host byte order,
+    ///< so all nodes of a render are expected to share the architecture.
+    ///<
+    ///< For every camera or scene change the coordinator sends a new job. Workers load the scene
+    ///< themselves and check it against the content hash of the job, then keep rendering with
+    ///< the seed of their slot and send back what they have accumulated since the last chunk.
+    ///<
+    ///< A render server answers view requests of its client with tonemapped frames. Scene stays
+    ///< compiled between requests until the client asks for another one. Progressive views are
+    ///< streamed as tiles changed since the previous update, the first update has all of them.
+    ///<
+    enum class RenderMessageType : std::uint32_t
+    {
+        kJob = 1,
+        kSamples = 2,
+        // Render server messages
+        kLoadScene = 3,
+        kView = 4,
+        kFrame = 5,
+        // Text of a failed render server request
+        kError = 6,
+        kFrameTiles = 7
+    };
+
+    struct RenderMessageHeader
+    {
+        char magic[4];
+        std::uint32_t version;
+        RenderMessageType type;
+        std::uint32_t reserved;
+        std::uint64_t payload_size;
+    };
+
+    struct RenderJob
+    {
+        // Chunks of older jobs are dropped by the coordinator
+        std::uint32_t job_id;
+        // Seed of the job and the slot of the receiving worker, see GetWorkerSeed
+        std::uint32_t seed;
+        std::uint32_t slot;
+        std::uint32_t reserved;
+        // Content hash of the scene file the job has been set up for
+        std::uint64_t scene_hash;
+        std::uint32_t width;
+        std::uint32_t height;
+        RadeonRays::float3 camera_position;
+        RadeonRays::float3 camera_at;
+        RadeonRays::float3 camera_up;
+    };
+
+    struct SampleChunk
+    {
+        std::uint32_t job_id;
+        std::uint32_t width;
+        std::uint32_t height;
+        // Accumulated radiance in the output layout, w holds the sample count of each pixel
+        std::vector<RadeonRays::float3> data;
+    };
+
+    // Scene file of a render server, relative to the path
+    struct SceneRequest
+    {
+        std::string path;
+        std::string model_name;
+    };
+
+    enum class FrameFormat : std::uint32_t
+    {
+        // Tonemapped RGBA8 rows, bottom-up as in the output
+        kRgba8 = 0,
+        // Same frame as BC1 blocks, can be uploaded as a compressed texture as is
+        kBc1 = 1
+    };
+
+    struct ViewRequest
+    {
+        // Echoed in the frame
+        std::uint32_t request_id;
+        // Samples accumulated before the frame is sent, at least one
+        std::uint32_t num_samples;
+        // Zero keeps the current bounce count
+        std::uint32_t num_bounces;
+        FrameFormat format;
+        // Non-zero streams frame tiles every update_samples samples instead of a single frame
+        std::uint32_t update_samples;
+        std::uint32_t reserved[3];
+        RadeonRays::float3 camera_position;
+        RadeonRays::float3 camera_at;
+        RadeonRays::float3 camera_up;
+    };
+
+    struct EncodedFrame
+    {
+        std::uint32_t request_id;
+        std::uint32_t width;
+        std::uint32_t height;
+        FrameFormat format;
+        std::vector<char> data;
+    };
+
+    // Tiles of a progressive view which changed since its previous update
+    struct FrameTiles
+    {
+        std::uint32_t request_id;
+        std::uint32_t width;
+        std::uint32_t height;
+        // Tiles are square, edge tiles are whole and cropped by the client
+        std::uint32_t tile_size;
+        // Samples accumulated so far, the view is complete once it reaches the requested count
+        std::uint32_t num_samples;
+        FrameFormat format;
+        // Row major index of each tile
+        std::vector<std::uint32_t> tiles;
+        // Frame data of the tiles one after another
+        std::vector<char> data;
+    };
+
+    // Bytes of a frame of the format
+    std::size_t GetFrameDataSize(FrameFormat format, std::uint32_t width, std::uint32_t height);
+
+    // Largest frame width and height messages are sized for
+    std::uint32_t constexpr kMaxRenderFrameSize = 8192u;
+    // Largest valid payload of the message type, throws for unknown types
+    std::size_t GetMaxPayloadSize(RenderMessageType type);
+
+    // Seed of a render slot, slot 0 is the coordinator. Samples of different slots are decorrelated
+    // even for consecutive job seeds
+    std::uint32_t GetWorkerSeed(std::uint32_t job_seed, std::uint32_t slot);
+
+    // Message header for the payload, throws if the payload is too large for the type
+    RenderMessageHeader MakeRenderMessageHeader(RenderMessageType type, std::size_t payload_size);
+    // Throws if the header does not come from a compatible node or its payload is too large for the type,
+    // so payload memory can be allocated from a checked header
+    void CheckRenderMessageHeader(RenderMessageHeader const& header);
+
+    std::vector<char> EncodeRenderJob(RenderJob const& job);
+    RenderJob DecodeRenderJob(std::vector<char> const& payload);
+
+    std::vector<char> EncodeSampleChunk(SampleChunk const& chunk);
+    SampleChunk DecodeSampleChunk(std::vector<char> const& payload);
+
+    std::vector<char> EncodeSceneRequest(SceneRequest const& request);
+    SceneRequest DecodeSceneRequest(std::vector<char> const& payload);
+
+    std::vector<char> EncodeViewRequest(ViewRequest const& request);
+    ViewRequest DecodeViewRequest(std::vector<char> const& payload);
+
+    std::vector<char> EncodeFrame(EncodedFrame const& frame);
+    EncodedFrame DecodeFrame(std::vector<char> const& payload);
+
+    std::vector<char> EncodeFrameTiles(FrameTiles const& frame);
+    FrameTiles DecodeFrameTiles(std::vector<char> const& payload);
+
+    ///< Sums sample chunks of all workers for the current job.
+    ///< Chunks are merged from network threads while the render thread takes the sum.
+    ///<
+    class SampleMerger
+    {
+    public:
+        // Drop merged samples and accept chunks of the job only
+        void Reset(std::uint32_t job_id, std::uint32_t width, std::uint32_t height);
+        // Returns false if the chunk belongs to another job or size
+        bool Merge(SampleChunk const& chunk);
+        // Move samples merged since the last call into data, returns false if there are none
+        bool Take(std::vector<RadeonRays::float3>& data);
+
+        std::uint32_t GetJobId() const;
+
+    private:
+        mutable std::mutex m_mutex;
+        std::vector<RadeonRays::float3> m_data;
+        std::uint32_t m_job_id = 0u;
+        std::uint32_t m_width = 0u;
+        std::uint32_t m_height = 0u;
+        bool m_has_samples = false;
+    };
+}
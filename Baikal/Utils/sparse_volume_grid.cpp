@@ -0,0 +1,266 @@
+#include "sparse_volume_grid.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace Baikal
+{
+    std::uint32_t constexpr SparseVolumeGrid::kBrickSize;
+    std::uint32_t constexpr SparseVolumeGrid::kNodeSize;
+
+    namespace
+    {
+        std::uint32_t constexpr kBrickVoxels = SparseVolumeGrid::kBrickSize * SparseVolumeGrid::kBrickSize * SparseVolumeGrid::kBrickSize;
+        std::uint32_t constexpr kNodeBricks = SparseVolumeGrid::kNodeSize * SparseVolumeGrid::kNodeSize * SparseVolumeGrid::kNodeSize;
+
+        float AsFloat(std::int32_t value)
+        {
+            float result;
+            std::memcpy(&result, &value, sizeof(result));
+            return result;
+        }
+
+        std::int32_t AsInt(float value)
+        {
+            std::int32_t result;
+            std::memcpy(&result, &value, sizeof(result));
+            return result;
+        }
+
+        std::uint32_t GetBrickSlot(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+        {
+            auto n = SparseVolumeGrid::kNodeSize;
+            return ((z % n) * n + y % n) * n + x % n;
+        }
+
+        std::uint32_t GetVoxelSlot(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+        {
+            auto n = SparseVolumeGrid::kBrickSize;
+            return ((z % n) * n + y % n) * n + x % n;
+        }
+    }
+
+    SparseVolumeGrid::SparseVolumeGrid()
+        : m_resolution{ 0u, 0u, 0u }
+        , m_num_nodes(0u)
+        , m_num_leaves(0u)
+    {
+    }
+
+    void SparseVolumeGrid::Build(std::uint32_t const* bricks, float const* density, std::size_t num_bricks, std::uint32_t const resolution[3])
+    {
+        std::uint32_t brick_resolution[3];
+
+        for (auto axis = 0u; axis < 3; ++axis)
+        {
+            brick_resolution[axis] = (resolution[axis] + kBrickSize - 1) / kBrickSize;
+            m_resolution[axis] = (brick_resolution[axis] + kNodeSize - 1) / kNodeSize;
+        }
+
+        auto get_key = [&](std::uint32_t x, std::uint32_t y, std::uint32_t z)
+        {
+            return (static_cast<std::uint64_t>(z) * brick_resolution[1] + y) * brick_resolution[0] + x;
+        };
+
+        // Voxel range of a brick along an axis, voxels past the resolution are left out
+        auto get_voxels = [&](std::uint32_t brick, std::uint32_t axis, std::uint32_t& begin, std::uint32_t& end)
+        {
+            begin = brick * kBrickSize;
+            end = std::min(begin + kBrickSize, resolution[axis]);
+        };
+
+        // Bricks holding any density and their maximum densities
+        std::unordered_map<std::uint64_t, std::size_t> brick_map;
+        std::vector<float> brick_max(num_bricks, 0.f);
+
+        for (std::size_t i = 0; i < num_bricks; ++i)
+        {
+            auto coords = bricks + 3 * i;
+
+            if (coords[0] >= brick_resolution[0] || coords[1] >= brick_resolution[1] || coords[2] >= brick_resolution[2])
+            {
+                throw std::runtime_error("SparseVolumeGrid: brick is outside of the grid");
+            }
+
+            std::uint32_t begin[3], end[3];
+            for (auto axis = 0u; axis < 3; ++axis)
+            {
+                get_voxels(coords[axis], axis, begin[axis], end[axis]);
+            }
+
+            auto values = density + i * kBrickVoxels;
+            for (auto z = begin[2]; z < end[2]; ++z)
+                for (auto y = begin[1]; y < end[1]; ++y)
+                    for (auto x = begin[0]; x < end[0]; ++x)
+                        brick_max[i] = std::max(brick_max[i], values[GetVoxelSlot(x, y, z)]);
+
+            if (brick_max[i] <= 0.f)
+            {
+                continue;
+            }
+
+            if (!brick_map.emplace(get_key(coords[0], coords[1], coords[2]), i).second)
+            {
+                throw std::runtime_error("SparseVolumeGrid: duplicate brick");
+            }
+        }
+
+        // Interpolation reaches one voxel into the neighbours, so bricks next to stored ones get majorants too
+        std::vector<std::uint64_t> slots;
+
+        for (auto const& brick : brick_map)
+        {
+            auto coords = bricks + 3 * brick.second;
+
+            for (auto dz = -1; dz <= 1; ++dz)
+                for (auto dy = -1; dy <= 1; ++dy)
+                    for (auto dx = -1; dx <= 1; ++dx)
+                    {
+                        std::int64_t x = coords[0] + dx, y = coords[1] + dy, z = coords[2] + dz;
+
+                        if (x >= 0 && y >= 0 && z >= 0 && x < brick_resolution[0] && y < brick_resolution[1] && z < brick_resolution[2])
+                        {
+                            slots.push_back(get_key(static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y), static_cast<std::uint32_t>(z)));
+                        }
+                    }
+        }
+
+        std::sort(slots.begin(), slots.end());
+        slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+
+        m_data.assign(static_cast<std::size_t>(m_resolution[0]) * m_resolution[1] * m_resolution[2], -1);
+        m_num_nodes = 0u;
+        m_num_leaves = 0u;
+
+        for (auto key : slots)
+        {
+            std::uint32_t coords[3] =
+            {
+                static_cast<std::uint32_t>(key % brick_resolution[0]),
+                static_cast<std::uint32_t>((key / brick_resolution[0]) % brick_resolution[1]),
+                static_cast<std::uint32_t>(key / brick_resolution[0] / brick_resolution[1])
+            };
+
+            auto root = (coords[2] / kNodeSize * m_resolution[1] + coords[1] / kNodeSize) * m_resolution[0] + coords[0] / kNodeSize;
+
+            if (m_data[root] < 0)
+            {
+                m_data[root] = static_cast<std::int32_t>(m_data.size());
+                m_data.resize(m_data.size() + kNodeBricks, -1);
+                m_data.resize(m_data.size() + kNodeBricks, AsInt(0.f));
+                ++m_num_nodes;
+            }
+
+            std::uint32_t begin[3], end[3];
+            for (auto axis = 0u; axis < 3; ++axis)
+            {
+                get_voxels(coords[axis], axis, begin[axis], end[axis]);
+                begin[axis] = begin[axis] > 0u ? begin[axis] - 1u : 0u;
+                end[axis] = std::min(end[axis] + 1u, resolution[axis]);
+            }
+
+            // Maximum over the voxels interpolated within the brick, neighbours contribute their borders only
+            auto majorant = 0.f;
+
+            for (auto dz = -1; dz <= 1; ++dz)
+                for (auto dy = -1; dy <= 1; ++dy)
+                    for (auto dx = -1; dx <= 1; ++dx)
+                    {
+                        std::int64_t nx = coords[0] + dx, ny = coords[1] + dy, nz = coords[2] + dz;
+
+                        if (nx < 0 || ny < 0 || nz < 0 || nx >= brick_resolution[0] || ny >= brick_resolution[1] || nz >= brick_resolution[2])
+                        {
+                            continue;
+                        }
+
+                        auto iter = brick_map.find(get_key(static_cast<std::uint32_t>(nx), static_cast<std::uint32_t>(ny), static_cast<std::uint32_t>(nz)));
+
+                        if (iter == brick_map.end())
+                        {
+                            continue;
+                        }
+
+                        if (dx == 0 && dy == 0 && dz == 0)
+                        {
+                            majorant = std::max(majorant, brick_max[iter->second]);
+                            continue;
+                        }
+
+                        std::uint32_t const neighbour[3] = { static_cast<std::uint32_t>(nx), static_cast<std::uint32_t>(ny), static_cast<std::uint32_t>(nz) };
+                        std::uint32_t box_begin[3], box_end[3];
+
+                        for (auto axis = 0u; axis < 3; ++axis)
+                        {
+                            get_voxels(neighbour[axis], axis, box_begin[axis], box_end[axis]);
+                            box_begin[axis] = std::max(box_begin[axis], begin[axis]);
+                            box_end[axis] = std::min(box_end[axis], end[axis]);
+                        }
+
+                        auto values = density + iter->second * kBrickVoxels;
+                        for (auto z = box_begin[2]; z < box_end[2]; ++z)
+                            for (auto y = box_begin[1]; y < box_end[1]; ++y)
+                                for (auto x = box_begin[0]; x < box_end[0]; ++x)
+                                    majorant = std::max(majorant, values[GetVoxelSlot(x, y, z)]);
+                    }
+
+            m_data[m_data[root] + kNodeBricks + GetBrickSlot(coords[0], coords[1], coords[2])] = AsInt(majorant);
+        }
+
+        // Leaves follow the nodes in the same order
+        for (auto key : slots)
+        {
+            auto iter = brick_map.find(key);
+
+            if (iter == brick_map.end())
+            {
+                continue;
+            }
+
+            auto coords = bricks + 3 * iter->second;
+            auto root = (coords[2] / kNodeSize * m_resolution[1] + coords[1] / kNodeSize) * m_resolution[0] + coords[0] / kNodeSize;
+
+            m_data[m_data[root] + GetBrickSlot(coords[0], coords[1], coords[2])] = static_cast<std::int32_t>(m_data.size());
+
+            auto values = density + iter->second * kBrickVoxels;
+            for (auto i = 0u; i < kBrickVoxels; ++i)
+            {
+                m_data.push_back(AsInt(values[i]));
+            }
+
+            ++m_num_leaves;
+        }
+    }
+
+    float SparseVolumeGrid::GetVoxel(std::uint32_t x, std::uint32_t y, std::uint32_t z) const
+    {
+        auto bx = x / kBrickSize, by = y / kBrickSize, bz = z / kBrickSize;
+
+        if (bx / kNodeSize >= m_resolution[0] || by / kNodeSize >= m_resolution[1] || bz / kNodeSize >= m_resolution[2])
+        {
+            return 0.f;
+        }
+
+        auto node = m_data[(bz / kNodeSize * m_resolution[1] + by / kNodeSize) * m_resolution[0] + bx / kNodeSize];
+
+        if (node < 0)
+        {
+            return 0.f;
+        }
+
+        auto leaf = m_data[node + GetBrickSlot(bx, by, bz)];
+        return leaf < 0 ? 0.f : AsFloat(m_data[leaf + GetVoxelSlot(x, y, z)]);
+    }
+
+    float SparseVolumeGrid::GetMajorant(std::uint32_t x, std::uint32_t y, std::uint32_t z) const
+    {
+        if (x / kNodeSize >= m_resolution[0] || y / kNodeSize >= m_resolution[1] || z / kNodeSize >= m_resolution[2])
+        {
+            return 0.f;
+        }
+
+        auto node = m_data[(z / kNodeSize * m_resolution[1] + y / kNodeSize) * m_resolution[0] + x / kNodeSize];
+        return node < 0 ? 0.f : AsFloat(m_data[node + kNodeBricks + GetBrickSlot(x, y, z)]);
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Baikal
+{
+    ///< The class lays out a sparse voxel density grid as a two level tree for
+    ///< the device. Leaves are bricks of kBrickSize^3 densities, nodes hold the
+    ///< leaves of kNodeSize^3 bricks together with majorants of every brick and
+    ///< a dense root table over the grid points to the nodes. Empty bricks and
+    ///< nodes are not stored, so tracking skips them without sampling the density.
+    ///<
+    struct SparseVolumeGrid
+    {
+    public:
+        // Voxels along a brick axis
+        static std::uint32_t constexpr kBrickSize = 8u;
+        // Bricks along a node axis
+        static std::uint32_t constexpr kNodeSize = 8u;
+
+        SparseVolumeGrid();
+
+        // Build the tree of resolution[0] x resolution[1] x resolution[2] voxels from num_bricks bricks
+        // at brick coordinates (three per brick) with kBrickSize^3 densities each, stored x first
+        void Build(std::uint32_t const* bricks, float const* density, std::size_t num_bricks, std::uint32_t const resolution[3]);
+
+        // Density of a voxel, zero for voxels outside of the bricks
+        float GetVoxel(std::uint32_t x, std::uint32_t y, std::uint32_t z) const;
+        // Majorant of a brick, zero for bricks in empty nodes
+        float GetMajorant(std::uint32_t x, std::uint32_t y, std::uint32_t z) const;
+
+        // Number of nodes along each axis
+        std::uint32_t m_resolution[3];
+        // Root table of node offsets followed by the nodes and the leaves, offsets are
+        // relative to the start and -1 for empty entries. Node is kNodeSize^3 leaf offsets
+        // followed by as many brick majorants, leaf is kBrickSize^3 densities.
+        std::vector<std::int32_t> m_data;
+        // Number of stored nodes and leaves
+        std::uint32_t m_num_nodes;
+        std::uint32_t m_num_leaves;
+    };
+}
@@ -0,0 +1,398 @@
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <exception>
+#include <string>
+
+#ifdef __linux__
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#endif
+
+namespace Baikal
+{
+    namespace
+    {
+        // Worker the calling thread belongs to, tasks it submits go to its own queue
+        thread_local TaskScheduler const* t_scheduler = nullptr;
+        thread_local std::size_t t_worker_index = 0;
+
+        struct SharedConfig
+        {
+            std::mutex mutex;
+            std::size_t num_workers = TaskScheduler::DefaultNumWorkers();
+            bool created = false;
+        };
+
+        SharedConfig& GetSharedConfig()
+        {
+            static SharedConfig config;
+            return config;
+        }
+
+        struct ParallelJob
+        {
+            TaskScheduler::RangeFunc func;
+            std::size_t count = 0;
+            std::size_t batch_size = 1;
+            std::size_t next = 0;
+            std::size_t active = 0;
+            std::exception_ptr exception;
+            std::mutex mutex;
+            std::condition_variable done_cv;
+        };
+
+        // Take batches of the job until there are none left, helpers starting after the job is done return right away
+        void RunBatches(ParallelJob& job)
+        {
+            std::unique_lock<std::mutex> lock(job.mutex);
+
+            while (job.next < job.count)
+            {
+                auto begin = job.next;
+                auto end = std::min(begin + job.batch_size, job.count);
+                job.next = end;
+                ++job.active;
+
+                lock.unlock();
+
+                try
+                {
+                    job.func(begin, end);
+                }
+                catch (...)
+                {
+                    lock.lock();
+
+                    // Skip the rest of the work
+                    if (!job.exception)
+                    {
+                        job.exception = std::current_exception();
+                    }
+
+                    job.next = job.count;
+                    lock.unlock();
+                }
+
+                lock.lock();
+                --job.active;
+            }
+
+            if (job.active == 0)
+            {
+                job.done_cv.notify_all();
+            }
+        }
+
+        // CPUs of every NUMA node, a single empty entry if the topology is unknown
+        std::vector<std::vector<int>> GetNodeCpus()
+        {
+            std::vector<std::vector<int>> nodes;
+
+#ifdef __linux__
+            // Lists look like "0-15,32-47"
+            auto parse = [](std::string const& list)
+            {
+                std::vector<int> values;
+                std::istringstream stream(list);
+                std::string range;
+
+                while (std::getline(stream, range, ','))
+                {
+                    if (range.empty() || range == "\n")
+                    {
+                        continue;
+                    }
+
+                    auto dash = range.find('-');
+                    auto first = std::stoi(range.substr(0, dash));
+                    auto last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+
+                    for (auto i = first; i <= last; ++i)
+                    {
+                        values.push_back(i);
+                    }
+                }
+
+                return values;
+            };
+
+            try
+            {
+                std::ifstream online("/sys/devices/system/node/online");
+                std::string list;
+
+                if (std::getline(online, list))
+                {
+                    for (auto node : parse(list))
+                    {
+                        std::ifstream cpus("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                        std::string cpu_list;
+
+                        if (std::getline(cpus, cpu_list))
+                        {
+                            auto node_cpus = parse(cpu_list);
+
+                            // Memory only nodes have no CPUs
+                            if (!node_cpus.empty())
+                            {
+                                nodes.push_back(std::move(node_cpus));
+                            }
+                        }
+                    }
+                }
+            }
+            catch (std::exception&)
+            {
+                nodes.clear();
+            }
+#endif
+
+            if (nodes.empty())
+            {
+                nodes.resize(1);
+            }
+
+            return nodes;
+        }
+
+        void PinToCpus(std::thread& thread, std::vector<int> const& cpus)
+        {
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+
+            for (auto cpu : cpus)
+            {
+                if (cpu < CPU_SETSIZE)
+                {
+                    CPU_SET(cpu, &set);
+                }
+            }
+
+            // Affinity is a hint, a restricted process keeps the default placement
+            pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+            (void)thread;
+            (void)cpus;
+#endif
+        }
+    }
+
+    TaskScheduler& TaskScheduler::Get()
+    {
+        static TaskScheduler scheduler([]()
+        {
+            auto& config = GetSharedConfig();
+            std::lock_guard<std::mutex> lock(config.mutex);
+            config.created = true;
+            return config.num_workers;
+        }());
+
+        return scheduler;
+    }
+
+    bool TaskScheduler::Configure(std::size_t num_workers)
+    {
+        auto& config = GetSharedConfig();
+        std::lock_guard<std::mutex> lock(config.mutex);
+
+        if (config.created)
+        {
+            return false;
+        }
+
+        config.num_workers = num_workers;
+        return true;
+    }
+
+    TaskScheduler::TaskScheduler(std::size_t num_workers)
+    {
+        auto nodes = GetNodeCpus();
+        m_num_nodes = nodes.size();
+
+        m_workers.reserve(num_workers);
+
+        for (std::size_t i = 0; i < num_workers; ++i)
+        {
+            m_workers.emplace_back(new Worker);
+            // Spread workers evenly over the nodes
+            m_workers.back()->node = i % m_num_nodes;
+        }
+
+        m_victims.resize(num_workers);
+
+        for (std::size_t i = 0; i < num_workers; ++i)
+        {
+            for (std::size_t j = 1; j < num_workers; ++j)
+            {
+                m_victims[i].push_back((i + j) % num_workers);
+            }
+
+            std::stable_partition(m_victims[i].begin(), m_victims[i].end(), [this, i](std::size_t victim)
+            {
+                return m_workers[victim]->node == m_workers[i]->node;
+            });
+        }
+
+        // Queues are in place before any worker looks at them
+        for (std::size_t i = 0; i < num_workers; ++i)
+        {
+            auto& worker = *m_workers[i];
+            worker.thread = std::thread(&TaskScheduler::WorkerLoop, this, i);
+
+            if (m_num_nodes > 1)
+            {
+                PinToCpus(worker.thread, nodes[worker.node]);
+            }
+        }
+    }
+
+    TaskScheduler::~TaskScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+
+        m_task_cv.notify_all();
+
+        // Workers drain the queues before they exit, so no future is left without a value
+        for (auto& worker : m_workers)
+        {
+            worker->thread.join();
+        }
+    }
+
+    std::size_t TaskScheduler::DefaultNumWorkers()
+    {
+        auto num_threads = std::thread::hardware_concurrency();
+        return num_threads > 1 ? num_threads - 1 : 0;
+    }
+
+    void TaskScheduler::Push(Task task)
+    {
+        auto index = t_scheduler == this ? t_worker_index : m_next_queue++ % m_workers.size();
+
+        {
+            auto& worker = *m_workers[index];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.tasks.push_back(std::move(task));
+        }
+
+        // Counted under the lock the workers wait on, so the wake up is not lost
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_num_queued;
+        }
+
+        m_task_cv.notify_one();
+    }
+
+    bool TaskScheduler::RunOne(std::size_t index)
+    {
+        Task task;
+
+        {
+            auto& worker = *m_workers[index];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+
+            // Latest task has the warmest data
+            if (!worker.tasks.empty())
+            {
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+            }
+        }
+
+        for (auto iter = m_victims[index].begin(); !task && iter != m_victims[index].end(); ++iter)
+        {
+            auto& victim = *m_workers[*iter];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+            }
+        }
+
+        if (!task)
+        {
+            return false;
+        }
+
+        --m_num_queued;
+        task();
+        return true;
+    }
+
+    void TaskScheduler::WorkerLoop(std::size_t index)
+    {
+        t_scheduler = this;
+        t_worker_index = index;
+
+        for (;;)
+        {
+            if (RunOne(index))
+            {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_task_cv.wait(lock, [this]() { return m_stop || m_num_queued > 0; });
+
+            if (m_stop && m_num_queued == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    void TaskScheduler::ParallelFor(std::size_t count, std::size_t batch_size, RangeFunc func)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        batch_size = std::max<std::size_t>(batch_size, 1u);
+
+        // Nothing to share
+        if (m_workers.empty() || count <= batch_size)
+        {
+            func(0, count);
+            return;
+        }
+
+        // Helpers may start after the job is done, they keep the state alive
+        auto job = std::make_shared<ParallelJob>();
+        job->func = std::move(func);
+        job->count = count;
+        job->batch_size = batch_size;
+
+        auto num_batches = (count + batch_size - 1) / batch_size;
+        auto num_helpers = std::min(num_batches - 1, m_workers.size());
+
+        for (std::size_t i = 0; i < num_helpers; ++i)
+        {
+            Push([job]() { RunBatches(*job); });
+        }
+
+        RunBatches(*job);
+
+        // Remaining batches are running on the workers which took them
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->done_cv.wait(lock, [&job]() { return job->next >= job->count && job->active == 0; });
+
+        // References of the caller may be captured
+        job->func = nullptr;
+
+        if (job->exception)
+        {
+            std::rethrow_exception(job->exception);
+        }
+    }
+}
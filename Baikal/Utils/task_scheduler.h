@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Baikal
+{
+    ///< Process wide set of workers shared by texture decoding, parsing, serialization,
+    ///< kernel compilation and image writing, so these don't each spawn a thread per core.
+    ///< Every worker has its own queue, tasks submitted from a worker go to its queue and
+    ///< idle workers steal from the others, workers of the same NUMA node first.
+    ///< On machines with several nodes workers are spread over the nodes and kept on them.
+    ///<
+    class TaskScheduler
+    {
+    public:
+        using Task = std::function<void()>;
+        // Invoked with [begin, end) range of indices
+        using RangeFunc = std::function<void(std::size_t, std::size_t)>;
+
+        // Shared scheduler, created on first use
+        static TaskScheduler& Get();
+        // Number of workers of the shared scheduler, returns false once it has been created
+        static bool Configure(std::size_t num_workers);
+
+        // Default number of workers leaves one hardware thread for the caller
+        explicit TaskScheduler(std::size_t num_workers = DefaultNumWorkers());
+        ~TaskScheduler();
+
+        // Run func on a worker, its result or exception is passed through the future.
+        // Tasks should not block on futures of other tasks, nested work goes through ParallelFor.
+        template <typename Func>
+        std::future<typename std::result_of<Func()>::type> Submit(Func&& func);
+
+        // Run func over [0, count) split into batches of batch_size indices, returns when all batches are done.
+        // The calling thread takes part in the work, so it can be called from tasks.
+        // The first exception thrown by func is rethrown in the calling thread.
+        void ParallelFor(std::size_t count, std::size_t batch_size, RangeFunc func);
+
+        std::size_t GetNumWorkers() const { return m_workers.size(); }
+        std::size_t GetNumNodes() const { return m_num_nodes; }
+
+        static std::size_t DefaultNumWorkers();
+
+        TaskScheduler(TaskScheduler const&) = delete;
+        TaskScheduler& operator = (TaskScheduler const&) = delete;
+
+    private:
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+            std::size_t node = 0;
+            std::thread thread;
+        };
+
+        void Push(Task task);
+        // Own queue from the back, then the others from the front, returns false if there is nothing to run
+        bool RunOne(std::size_t index);
+        void WorkerLoop(std::size_t index);
+
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        // Steal order of every worker, same node first
+        std::vector<std::vector<std::size_t>> m_victims;
+        std::size_t m_num_nodes = 1;
+
+        std::mutex m_mutex;
+        std::condition_variable m_task_cv;
+        std::atomic<std::size_t> m_num_queued{ 0 };
+        std::atomic<std::size_t> m_next_queue{ 0 };
+        bool m_stop = false;
+    };
+
+    template <typename Func>
+    std::future<typename std::result_of<Func()>::type> TaskScheduler::Submit(Func&& func)
+    {
+        using Result = typename std::result_of<Func()>::type;
+
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+        auto future = task->get_future();
+
+        if (m_workers.empty())
+        {
+            (*task)();
+        }
+        else
+        {
+            Push([task]() { (*task)(); });
+        }
+
+        return future;
+    }
+}
@@ -0,0 +1,333 @@
+#include "texture_compression.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+namespace Baikal
+{
+    namespace TextureCompression
+    {
+        using Color = std::array<float, 3>;
+
+        // 4x4 texels of 8 bit RGBA data
+        using Block = std::array<std::array<std::uint8_t, 4>, 16>;
+
+        static std::uint32_t ReadUint32(std::uint8_t const* data)
+        {
+            return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<std::uint32_t>(data[3]) << 24);
+        }
+
+        static void WriteUint32(std::uint32_t value, std::uint8_t* data)
+        {
+            for (auto i = 0; i < 4; ++i)
+            {
+                data[i] = static_cast<std::uint8_t>(value >> (8 * i));
+            }
+        }
+
+        static std::uint32_t EncodeRGB565(Color const& c)
+        {
+            auto r = static_cast<std::uint32_t>(std::lround(std::min(std::max(c[0], 0.f), 1.f) * 31.f));
+            auto g = static_cast<std::uint32_t>(std::lround(std::min(std::max(c[1], 0.f), 1.f) * 63.f));
+            auto b = static_cast<std::uint32_t>(std::lround(std::min(std::max(c[2], 0.f), 1.f) * 31.f));
+            return (r << 11) | (g << 5) | b;
+        }
+
+        static Color DecodeRGB565(std::uint32_t c)
+        {
+            return {{ ((c >> 11) & 0x1F) / 31.f, ((c >> 5) & 0x3F) / 63.f, (c & 0x1F) / 31.f }};
+        }
+
+        static float GetDistance(Color const& a, Color const& b)
+        {
+            return (a[0] - b[0]) * (a[0] - b[0]) + (a[1] - b[1]) * (a[1] - b[1]) + (a[2] - b[2]) * (a[2] - b[2]);
+        }
+
+        // BC1 palette, the second mode with transparent black is used if c0 <= c1
+        static std::array<Color, 4> GetBC1Palette(std::uint32_t c0, std::uint32_t c1)
+        {
+            auto color0 = DecodeRGB565(c0);
+            auto color1 = DecodeRGB565(c1);
+            std::array<Color, 4> palette = {{ color0, color1 }};
+
+            for (auto i = 0; i < 3; ++i)
+            {
+                if (c0 > c1)
+                {
+                    palette[2][i] = (2.f * color0[i] + color1[i]) / 3.f;
+                    palette[3][i] = (color0[i] + 2.f * color1[i]) / 3.f;
+                }
+                else
+                {
+                    palette[2][i] = 0.5f * (color0[i] + color1[i]);
+                    palette[3][i] = 0.f;
+                }
+            }
+
+            return palette;
+        }
+
+        // BC4 palette of a single channel, the second mode has explicit 0 and 1 if r0 <= r1
+        static std::array<float, 8> GetBC4Palette(std::uint32_t r0, std::uint32_t r1)
+        {
+            std::array<float, 8> palette = {{ r0 / 255.f, r1 / 255.f }};
+
+            for (auto i = 2u; i < 8u; ++i)
+            {
+                if (r0 > r1)
+                {
+                    palette[i] = ((8 - i) * palette[0] + (i - 1) * palette[1]) / 7.f;
+                }
+                else if (i < 6u)
+                {
+                    palette[i] = ((6 - i) * palette[0] + (i - 1) * palette[1]) / 5.f;
+                }
+                else
+                {
+                    palette[i] = i == 6u ? 0.f : 1.f;
+                }
+            }
+
+            return palette;
+        }
+
+        static void EncodeBC1(Block const& block, std::uint8_t* data)
+        {
+            std::array<Color, 16> colors;
+            Color mean = {{ 0.f, 0.f, 0.f }};
+
+            for (auto i = 0u; i < 16u; ++i)
+            {
+                for (auto c = 0; c < 3; ++c)
+                {
+                    colors[i][c] = block[i][c] / 255.f;
+                    mean[c] += colors[i][c] / 16.f;
+                }
+            }
+
+            // Principal axis of the colors by power iteration
+            float covariance[3][3] = {};
+
+            for (auto const& color : colors)
+            {
+                for (auto j = 0; j < 3; ++j)
+                {
+                    for (auto k = 0; k < 3; ++k)
+                    {
+                        covariance[j][k] += (color[j] - mean[j]) * (color[k] - mean[k]);
+                    }
+                }
+            }
+
+            Color axis = {{ 1.f, 1.f, 1.f }};
+
+            for (auto iteration = 0; iteration < 8; ++iteration)
+            {
+                Color next = {{ 0.f, 0.f, 0.f }};
+
+                for (auto j = 0; j < 3; ++j)
+                {
+                    for (auto k = 0; k < 3; ++k)
+                    {
+                        next[j] += covariance[j][k] * axis[k];
+                    }
+                }
+
+                auto length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+
+                // Flat block, any axis works
+                if (length < 1e-8f)
+                {
+                    break;
+                }
+
+                axis = {{ next[0] / length, next[1] / length, next[2] / length }};
+            }
+
+            // Endpoints are the extreme colors along the axis
+            auto min_idx = 0u;
+            auto max_idx = 0u;
+            auto min_t = 0.f;
+            auto max_t = 0.f;
+
+            for (auto i = 0u; i < 16u; ++i)
+            {
+                auto t = colors[i][0] * axis[0] + colors[i][1] * axis[1] + colors[i][2] * axis[2];
+
+                if (i == 0u || t < min_t)
+                {
+                    min_t = t;
+                    min_idx = i;
+                }
+
+                if (i == 0u || t > max_t)
+                {
+                    max_t = t;
+                    max_idx = i;
+                }
+            }
+
+            auto c0 = EncodeRGB565(colors[max_idx]);
+            auto c1 = EncodeRGB565(colors[min_idx]);
+
+            // Four color mode requires c0 > c1, equal endpoints only use the first palette entry
+            if (c0 < c1)
+            {
+                std::swap(c0, c1);
+            }
+
+            std::uint32_t indices = 0;
+
+            if (c0 != c1)
+            {
+                auto palette = GetBC1Palette(c0, c1);
+
+                for (auto i = 0u; i < 16u; ++i)
+                {
+                    auto best = 0u;
+
+                    for (auto j = 1u; j < 4u; ++j)
+                    {
+                        if (GetDistance(colors[i], palette[j]) < GetDistance(colors[i], palette[best]))
+                        {
+                            best = j;
+                        }
+                    }
+
+                    indices |= best << (2 * i);
+                }
+            }
+
+            WriteUint32(c0 | (c1 << 16), data);
+            WriteUint32(indices, data + 4);
+        }
+
+        static void EncodeBC4(Block const& block, int channel, std::uint8_t* data)
+        {
+            std::uint32_t r0 = 0;
+            std::uint32_t r1 = 255;
+
+            for (auto const& texel : block)
+            {
+                r0 = std::max<std::uint32_t>(r0, texel[channel]);
+                r1 = std::min<std::uint32_t>(r1, texel[channel]);
+            }
+
+            std::uint64_t bits = r0 | (r1 << 8);
+
+            // Eight value mode requires r0 > r1, equal endpoints only use the first palette entry
+            if (r0 != r1)
+            {
+                auto palette = GetBC4Palette(r0, r1);
+
+                for (auto i = 0u; i < 16u; ++i)
+                {
+                    auto value = block[i][channel] / 255.f;
+                    auto best = 0u;
+
+                    for (auto j = 1u; j < 8u; ++j)
+                    {
+                        if (std::fabs(value - palette[j]) < std::fabs(value - palette[best]))
+                        {
+                            best = j;
+                        }
+                    }
+
+                    bits |= static_cast<std::uint64_t>(best) << (16 + 3 * i);
+                }
+            }
+
+            WriteUint32(static_cast<std::uint32_t>(bits), data);
+            WriteUint32(static_cast<std::uint32_t>(bits >> 32), data + 4);
+        }
+
+        static float DecodeBC4(std::uint8_t const* data, int texel)
+        {
+            auto bits = ReadUint32(data) | (static_cast<std::uint64_t>(ReadUint32(data + 4)) << 32);
+            auto palette = GetBC4Palette(data[0], data[1]);
+            return palette[(bits >> (16 + 3 * texel)) & 0x7];
+        }
+
+        Texture::Ptr Compress(Texture const& texture, Texture::Format format)
+        {
+            if (texture.GetFormat() != Texture::Format::kRgba8)
+            {
+                throw std::runtime_error("TextureCompression: only 8 bit textures can be compressed");
+            }
+
+            if (format != Texture::Format::kBc1 && format != Texture::Format::kBc5)
+            {
+                throw std::runtime_error("TextureCompression: unsupported block format");
+            }
+
+            auto size = texture.GetSize();
+            auto blocks_x = (size.x + 3) / 4;
+            auto blocks_y = (size.y + 3) / 4;
+            auto block_size = GetBlockSize(format);
+
+            auto texels = reinterpret_cast<std::uint8_t const*>(texture.GetData());
+            auto data = new char[block_size * blocks_x * blocks_y * size.z];
+            auto current = reinterpret_cast<std::uint8_t*>(data);
+
+            for (auto z = 0; z < size.z; ++z)
+            {
+                auto slice = texels + 4 * size.x * size.y * z;
+
+                for (auto by = 0; by < blocks_y; ++by)
+                {
+                    for (auto bx = 0; bx < blocks_x; ++bx)
+                    {
+                        Block block;
+
+                        for (auto i = 0; i < 16; ++i)
+                        {
+                            auto x = std::min(4 * bx + i % 4, size.x - 1);
+                            auto y = std::min(4 * by + i / 4, size.y - 1);
+                            std::copy(slice + 4 * (y * size.x + x), slice + 4 * (y * size.x + x) + 4, block[i].begin());
+                        }
+
+                        if (format == Texture::Format::kBc1)
+                        {
+                            EncodeBC1(block, current);
+                        }
+                        else
+                        {
+                            EncodeBC4(block, 0, current);
+                            EncodeBC4(block, 1, current + 8);
+                        }
+
+                        current += block_size;
+                    }
+                }
+            }
+
+            return Texture::Create(data, size, format);
+        }
+
+        RadeonRays::float3 DecodeTexel(char const* data, Texture::Format format, int width, int x, int y)
+        {
+            auto block = reinterpret_cast<std::uint8_t const*>(data) +
+                GetBlockSize(format) * ((y / 4) * ((width + 3) / 4) + x / 4);
+            auto texel = (y % 4) * 4 + x % 4;
+
+            if (format == Texture::Format::kBc1)
+            {
+                auto endpoints = ReadUint32(block);
+                auto palette = GetBC1Palette(endpoints & 0xFFFF, endpoints >> 16);
+                auto const& color = palette[(ReadUint32(block + 4) >> (2 * texel)) & 0x3];
+                return RadeonRays::float3(color[0], color[1], color[2]);
+            }
+
+            // Normal z is reconstructed from x and y
+            auto r = DecodeBC4(block, texel);
+            auto g = DecodeBC4(block + 8, texel);
+            auto nx = 2.f * r - 1.f;
+            auto ny = 2.f * g - 1.f;
+            auto nz = std::sqrt(std::max(1.f - nx * nx - ny * ny, 0.f));
+            return RadeonRays::float3(r, g, 0.5f * nz + 0.5f);
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "SceneGraph/texture.h"
+#include "math/float3.h"
+
+#include <cstddef>
+
+namespace Baikal
+{
+    ///< Block compressed texture formats. Texels are stored in 4x4 blocks in row major order,
+    ///< edge blocks of sizes which are not multiples of 4 repeat the last row and column.
+    ///< Decoding counterparts live in Kernels/CL/texture.cl, the host versions back Texture::GetTexel.
+    ///<
+    namespace TextureCompression
+    {
+        // Bytes per 4x4 block of a compressed format
+        inline std::size_t GetBlockSize(Texture::Format format)
+        {
+            return format == Texture::Format::kBc1 ? 8u : 16u;
+        }
+
+        // Encode 8 bit texture with kBc1 or kBc5 format.
+        // BC1 drops alpha, BC5 keeps red and green only and the blue channel of a normal map is reconstructed on decode.
+        Texture::Ptr Compress(Texture const& texture, Texture::Format format);
+
+        // Normalized value of a texel of the first slice of compressed data
+        RadeonRays::float3 DecodeTexel(char const* data, Texture::Format format, int width, int x, int y);
+    }
+}
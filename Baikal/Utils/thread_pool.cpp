@@ -0,0 +1,143 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace Baikal
+{
+    ThreadPool::ThreadPool(std::size_t num_workers)
+    {
+        m_workers.reserve(num_workers);
+
+        for (auto i = 0u; i < num_workers; ++i)
+        {
+            m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+
+        m_job_cv.notify_all();
+
+        for (auto& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    std::size_t ThreadPool::DefaultNumWorkers()
+    {
+        auto num_threads = std::thread::hardware_concurrency();
+        return num_threads > 1 ? num_threads - 1 : 0;
+    }
+
+    void ThreadPool::ParallelFor(std::size_t count, std::size_t batch_size, RangeFunc func)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        batch_size = std::max<std::size_t>(batch_size, 1u);
+
+        // Nothing to share
+        if (m_workers.empty() || count <= batch_size)
+        {
+            func(0, count);
+            return;
+        }
+
+        std::lock_guard<std::mutex> dispatch_lock(m_dispatch_mutex);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_func = std::move(func);
+            m_count = count;
+            m_batch_size = batch_size;
+            m_next = 0;
+            m_exception = nullptr;
+            ++m_job_id;
+        }
+
+        m_job_cv.notify_all();
+
+        RunBatches();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done_cv.wait(lock, [this]() { return m_next >= m_count && m_active == 0; });
+
+        m_func = nullptr;
+
+        if (m_exception)
+        {
+            std::rethrow_exception(m_exception);
+        }
+    }
+
+    void ThreadPool::RunBatches()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (m_next < m_count)
+        {
+            auto begin = m_next;
+            auto end = std::min(begin + m_batch_size, m_count);
+            m_next = end;
+            ++m_active;
+
+            lock.unlock();
+
+            try
+            {
+                m_func(begin, end);
+            }
+            catch (...)
+            {
+                lock.lock();
+
+                // Skip the rest of the work
+                if (!m_exception)
+                {
+                    m_exception = std::current_exception();
+                }
+
+                m_next = m_count;
+                lock.unlock();
+            }
+
+            lock.lock();
+            --m_active;
+        }
+
+        if (m_active == 0)
+        {
+            m_done_cv.notify_all();
+        }
+    }
+
+    void ThreadPool::WorkerLoop()
+    {
+        std::size_t last_job_id = 0;
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_job_cv.wait(lock, [this, last_job_id]() { return m_stop || (m_job_id != last_job_id && m_next < m_count); });
+
+                if (m_stop)
+                {
+                    return;
+                }
+
+                last_job_id = m_job_id;
+            }
+
+            RunBatches();
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Baikal
+{
+    ///< Fixed set of worker threads running index ranges of a loop body.
+    ///< The calling thread takes part in the work, so pool with zero workers
+    ///< runs everything serially. ParallelFor calls from different threads are serialized.
+    ///<
+    class ThreadPool
+    {
+    public:
+        // Invoked with [begin, end) range of indices
+        using RangeFunc = std::function<void(std::size_t, std::size_t)>;
+
+        // Default number of workers leaves one hardware thread for the caller
+        explicit ThreadPool(std::size_t num_workers = DefaultNumWorkers());
+        ~ThreadPool();
+
+        // Run func over [0, count) split into batches of batch_size indices, returns when all batches are done.
+        // The first exception thrown by func is rethrown in the calling thread.
+        void ParallelFor(std::size_t count, std::size_t batch_size, RangeFunc func);
+
+        std::size_t GetNumWorkers() const { return m_workers.size(); }
+
+        static std::size_t DefaultNumWorkers();
+
+        ThreadPool(ThreadPool const&) = delete;
+        ThreadPool& operator = (ThreadPool const&) = delete;
+
+    private:
+        void WorkerLoop();
+        // Take batches of the current job until there are none left
+        void RunBatches();
+
+        std::vector<std::thread> m_workers;
+
+        std::mutex m_dispatch_mutex;
+        std::mutex m_mutex;
+        std::condition_variable m_job_cv;
+        std::condition_variable m_done_cv;
+
+        // Current job state, guarded by m_mutex
+        RangeFunc m_func;
+        std::size_t m_count = 0;
+        std::size_t m_batch_size = 1;
+        std::size_t m_next = 0;
+        std::size_t m_active = 0;
+        std::size_t m_job_id = 0;
+        std::exception_ptr m_exception;
+        bool m_stop = false;
+    };
+}
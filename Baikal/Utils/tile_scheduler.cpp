@@ -0,0 +1,256 @@
+#include "tile_scheduler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace Baikal
+{
+    // Weight of the last tile in the throughput estimate
+    float constexpr kThroughputSmoothing = 0.25f;
+
+    TileScheduler::TileScheduler(std::size_t num_devices)
+        : m_devices(num_devices)
+    {
+        if (num_devices == 0)
+        {
+            throw std::runtime_error("TileScheduler: at least one device is required");
+        }
+    }
+
+    float TileScheduler::GetEstimatedThroughput(Device const& device) const
+    {
+        if (device.throughput > 0.f)
+        {
+            return device.throughput;
+        }
+
+        auto sum = 0.f;
+        auto num_measured = 0u;
+
+        for (auto const& d : m_devices)
+        {
+            if (d.throughput > 0.f)
+            {
+                sum += d.throughput;
+                ++num_measured;
+            }
+        }
+
+        return num_measured ? sum / num_measured : 1.f;
+    }
+
+    float TileScheduler::GetRemainingTime(Device const& device) const
+    {
+        auto throughput = GetEstimatedThroughput(device);
+        auto remaining_time = device.queued_pixels / throughput;
+
+        if (device.busy)
+        {
+            auto elapsed_ms = std::chrono::duration<float, std::milli>(clock::now() - device.start).count();
+            auto tile_time = device.current.size.x * device.current.size.y / throughput;
+            remaining_time += std::max(tile_time - elapsed_ms, 0.f);
+        }
+
+        return remaining_time;
+    }
+
+    void TileScheduler::BeginFrame(int2 const& region_origin, int2 const& region_size, int2 const& tile_size)
+    {
+        if (region_size.x <= 0 || region_size.y <= 0 || tile_size.x <= 0 || tile_size.y <= 0)
+        {
+            throw std::runtime_error("TileScheduler: invalid frame size");
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done_cv.wait(lock, [this] { return m_num_busy == 0; });
+
+        auto total_throughput = 0.f;
+        for (auto const& device : m_devices)
+        {
+            total_throughput += GetEstimatedThroughput(device);
+        }
+
+        // Contiguous runs keep neighbouring tiles on the same device,
+        // a tile goes to the device whose share covers most of it
+        auto total_pixels = static_cast<float>(region_size.x) * region_size.y;
+        auto assigned_pixels = 0.f;
+        auto device_idx = 0u;
+
+        for (auto& device : m_devices)
+        {
+            device.queue.clear();
+            device.queued_pixels = 0;
+            device.num_tiles = 0;
+        }
+
+        auto share_end = total_pixels * GetEstimatedThroughput(m_devices[0]) / total_throughput;
+
+        for (auto y = 0; y < region_size.y; y += tile_size.y)
+            for (auto x = 0; x < region_size.x; x += tile_size.x)
+            {
+                Tile tile;
+                tile.origin = int2(region_origin.x + x, region_origin.y + y);
+                tile.size = int2(std::min(tile_size.x, region_size.x - x), std::min(tile_size.y, region_size.y - y));
+
+                auto num_pixels = static_cast<std::size_t>(tile.size.x * tile.size.y);
+
+                while (device_idx + 1 < m_devices.size() && assigned_pixels + 0.5f * num_pixels > share_end)
+                {
+                    ++device_idx;
+                    share_end += total_pixels * GetEstimatedThroughput(m_devices[device_idx]) / total_throughput;
+                }
+
+                m_devices[device_idx].queue.push_back(tile);
+                m_devices[device_idx].queued_pixels += num_pixels;
+                assigned_pixels += num_pixels;
+            }
+
+        m_num_stolen = 0;
+        ++m_frame;
+        lock.unlock();
+
+        m_frame_cv.notify_all();
+    }
+
+    void TileScheduler::EndFrame()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done_cv.wait(lock, [this]
+        {
+            return m_num_busy == 0 && std::all_of(m_devices.cbegin(), m_devices.cend(),
+                [](Device const& device) { return device.queue.empty(); });
+        });
+    }
+
+    std::uint64_t TileScheduler::WaitForFrame(std::uint64_t last_frame)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_frame_cv.wait(lock, [this, last_frame] { return m_stop || m_frame > last_frame; });
+        return m_stop ? 0u : m_frame;
+    }
+
+    void TileScheduler::Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+
+        m_frame_cv.notify_all();
+    }
+
+    void TileScheduler::CompleteTile(Device& device)
+    {
+        if (!device.busy)
+        {
+            return;
+        }
+
+        auto elapsed_ms = std::chrono::duration<float, std::milli>(clock::now() - device.start).count();
+        auto num_pixels = static_cast<float>(device.current.size.x * device.current.size.y);
+
+        if (elapsed_ms > 0.f)
+        {
+            auto throughput = num_pixels / elapsed_ms;
+            device.throughput = device.throughput > 0.f ?
+                (1.f - kThroughputSmoothing) * device.throughput + kThroughputSmoothing * throughput :
+                throughput;
+        }
+
+        device.busy = false;
+        --m_num_busy;
+    }
+
+    bool TileScheduler::NextTile(std::size_t device_idx, Tile& tile)
+    {
+        if (device_idx >= m_devices.size())
+        {
+            throw std::runtime_error("TileScheduler: invalid device index");
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        auto& device = m_devices[device_idx];
+        CompleteTile(device);
+
+        auto found = false;
+
+        if (!device.queue.empty())
+        {
+            tile = device.queue.front();
+            device.queue.pop_front();
+            device.queued_pixels -= static_cast<std::size_t>(tile.size.x * tile.size.y);
+            found = true;
+        }
+        else
+        {
+            // Steal from the device expected to finish last
+            Device* victim = nullptr;
+            auto victim_time = 0.f;
+
+            for (auto& d : m_devices)
+            {
+                if (d.queue.empty())
+                {
+                    continue;
+                }
+
+                auto remaining_time = GetRemainingTime(d);
+                if (!victim || remaining_time > victim_time)
+                {
+                    victim = &d;
+                    victim_time = remaining_time;
+                }
+            }
+
+            if (victim)
+            {
+                auto const& candidate = victim->queue.back();
+                auto num_pixels = static_cast<float>(candidate.size.x * candidate.size.y);
+
+                // Only take the tile if we get it done before the victim would have,
+                // devices which have not started the frame yet are not waited for
+                if (!victim->busy || num_pixels / GetEstimatedThroughput(device) <= victim_time)
+                {
+                    tile = candidate;
+                    victim->queue.pop_back();
+                    victim->queued_pixels -= static_cast<std::size_t>(num_pixels);
+                    ++m_num_stolen;
+                    found = true;
+                }
+            }
+        }
+
+        if (found)
+        {
+            device.busy = true;
+            device.current = tile;
+            device.start = clock::now();
+            ++device.num_tiles;
+            ++m_num_busy;
+        }
+
+        lock.unlock();
+        m_done_cv.notify_all();
+
+        return found;
+    }
+
+    float TileScheduler::GetThroughput(std::size_t device) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_devices.at(device).throughput;
+    }
+
+    std::size_t TileScheduler::GetNumTiles(std::size_t device) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_devices.at(device).num_tiles;
+    }
+
+    std::size_t TileScheduler::GetNumStolenTiles() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_num_stolen;
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "math/int2.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace Baikal
+{
+    ///< Splits frames into tiles shared by several devices rendering into their own outputs.
+    ///< Every frame tiles are distributed in contiguous runs proportional to the measured
+    ///< throughput of each device. A device which runs out of tiles steals from the back of the
+    ///< queue with the most remaining time, unless the victim would finish the tile sooner itself,
+    ///< so slow devices never hold up the end of a frame.
+    ///<
+    ///< Devices report a tile as done by asking for the next one, they are expected to synchronize
+    ///< with their queue before that to keep throughput measurements meaningful.
+    ///<
+    class TileScheduler
+    {
+    public:
+        using int2 = RadeonRays::int2;
+
+        struct Tile
+        {
+            int2 origin;
+            int2 size;
+        };
+
+        explicit TileScheduler(std::size_t num_devices);
+
+        // Start a new frame covering the region, blocks until all tiles of the previous one are done
+        void BeginFrame(int2 const& region_origin, int2 const& region_size, int2 const& tile_size);
+        // Block until all tiles of the current frame are done
+        void EndFrame();
+        // Block until a frame newer than last_frame starts or Stop is called, returns the frame index or 0 once stopped
+        std::uint64_t WaitForFrame(std::uint64_t last_frame);
+        // Wake up devices waiting for a frame
+        void Stop();
+
+        // Mark previous tile of the device as done and get the next one, returns false once there are none left for the device
+        bool NextTile(std::size_t device, Tile& tile);
+
+        // Device throughput estimate in pixels per millisecond
+        float GetThroughput(std::size_t device) const;
+        // Number of tiles rendered by the device in the last frame
+        std::size_t GetNumTiles(std::size_t device) const;
+        // Number of tiles taken from other queues in the last frame
+        std::size_t GetNumStolenTiles() const;
+
+        TileScheduler(TileScheduler const&) = delete;
+        TileScheduler& operator = (TileScheduler const&) = delete;
+
+    private:
+        using clock = std::chrono::high_resolution_clock;
+
+        struct Device
+        {
+            std::deque<Tile> queue;
+            // Pixels left in the queue
+            std::size_t queued_pixels = 0;
+            // Tile being rendered
+            bool busy = false;
+            Tile current;
+            clock::time_point start;
+            // Pixels per millisecond, 0 until measured
+            float throughput = 0.f;
+            std::size_t num_tiles = 0;
+        };
+
+        // Finish the tile of the device, guarded by m_mutex
+        void CompleteTile(Device& device);
+        // Throughput used for estimates, unmeasured devices are assumed to match the average
+        float GetEstimatedThroughput(Device const& device) const;
+        // Time in milliseconds the device needs for its queue and the rest of its tile
+        float GetRemainingTime(Device const& device) const;
+
+        std::vector<Device> m_devices;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_frame_cv;
+        std::condition_variable m_done_cv;
+
+        std::uint64_t m_frame = 0;
+        std::size_t m_num_busy = 0;
+        std::size_t m_num_stolen = 0;
+        bool m_stop = false;
+    };
+}
@@ -0,0 +1,162 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+namespace Baikal
+{
+    namespace
+    {
+        // Process ids of the tracks, Perfetto groups tracks by process
+        std::uint32_t constexpr kHostPid = 1u;
+        std::uint32_t constexpr kDevicePid = 2u;
+
+        void WriteEscaped(std::ostream& stream, std::string const& value)
+        {
+            for (auto c : value)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    stream << '\\';
+                }
+                stream << c;
+            }
+        }
+
+        void WriteTrackName(std::ostream& stream, std::uint32_t pid, std::uint32_t tid, std::string const& name)
+        {
+            stream << "  { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid << ", \"tid\": " << tid
+                   << ", \"args\": { \"name\": \"";
+            WriteEscaped(stream, name);
+            stream << "\" } }";
+        }
+    }
+
+    Tracer& Tracer::Get()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    void Tracer::Start()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_events.clear();
+        m_threads.clear();
+        m_device_tracks.clear();
+        m_enabled = true;
+    }
+
+    void Tracer::Stop()
+    {
+        m_enabled = false;
+    }
+
+    std::uint64_t Tracer::Now()
+    {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+    }
+
+    void Tracer::AddHostEvent(char const* category, char const* name, std::uint64_t start, std::uint64_t end)
+    {
+        if (!IsEnabled())
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto thread = m_threads.emplace(std::this_thread::get_id(), static_cast<std::uint32_t>(m_threads.size()));
+        m_events.push_back({ name, category, start, end, thread.first->second, false });
+    }
+
+    void Tracer::AddDeviceEvent(std::string const& track, std::string const& name, std::uint64_t start, std::uint64_t end)
+    {
+        if (!IsEnabled())
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto iter = std::find(m_device_tracks.begin(), m_device_tracks.end(), track);
+        if (iter == m_device_tracks.end())
+        {
+            iter = m_device_tracks.insert(m_device_tracks.end(), track);
+        }
+
+        auto index = static_cast<std::uint32_t>(iter - m_device_tracks.begin());
+        m_events.push_back({ name, "device", start, end, index, true });
+    }
+
+    std::size_t Tracer::GetNumEvents() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_events.size();
+    }
+
+    void Tracer::WriteJson(std::ostream& stream) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Timestamps start at the first event, microseconds with nanosecond fraction
+        std::uint64_t origin = 0;
+        if (!m_events.empty())
+        {
+            origin = std::min_element(m_events.begin(), m_events.end(),
+                [](Event const& a, Event const& b) { return a.start < b.start; })->start;
+        }
+
+        stream << "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        stream << "  { \"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << kHostPid << ", \"args\": { \"name\": \"Host\" } },\n";
+        stream << "  { \"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << kDevicePid << ", \"args\": { \"name\": \"Device\" } }";
+
+        for (auto const& thread : m_threads)
+        {
+            stream << ",\n";
+            WriteTrackName(stream, kHostPid, thread.second, "Thread " + std::to_string(thread.second));
+        }
+
+        for (std::size_t i = 0; i < m_device_tracks.size(); ++i)
+        {
+            stream << ",\n";
+            WriteTrackName(stream, kDevicePid, static_cast<std::uint32_t>(i), m_device_tracks[i]);
+        }
+
+        auto flags = stream.flags();
+        stream << std::fixed << std::setprecision(3);
+
+        for (auto const& event : m_events)
+        {
+            auto start = event.start > origin ? event.start - origin : 0u;
+            auto duration = event.end > event.start ? event.end - event.start : 0u;
+
+            stream << ",\n  { \"name\": \"";
+            WriteEscaped(stream, event.name);
+            stream << "\", \"cat\": \"" << event.category << "\", \"ph\": \"X\""
+                   << ", \"pid\": " << (event.device ? kDevicePid : kHostPid)
+                   << ", \"tid\": " << event.track
+                   << ", \"ts\": " << start * 1e-3
+                   << ", \"dur\": " << duration * 1e-3 << " }";
+        }
+
+        stream.flags(flags);
+        stream << "\n] }\n";
+    }
+
+    void Tracer::WriteFile(std::string const& file_name) const
+    {
+        std::ofstream out(file_name);
+
+        if (!out)
+        {
+            throw std::runtime_error("Tracer: cannot open " + file_name);
+        }
+
+        WriteJson(out);
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Baikal
+{
+    ///< The class collects a timeline of host scopes and device spans while started and writes
+    ///< it as Chrome trace event JSON, which Perfetto and chrome://tracing open as is.
+    ///< Host events land on the tracks of their threads, device spans resolved by ClwProfiler
+    ///< on a track per command queue, both in host time so they line up.
+    ///< Scopes are placed with BAIKAL_TRACE_SCOPE, which compiles to nothing unless the library
+    ///< is built with BAIKAL_ENABLE_TRACE and only checks a flag while tracing is stopped.
+    ///<
+    class Tracer
+    {
+    public:
+        static Tracer& Get();
+
+        // Events are only recorded between Start and Stop, Start drops the previous ones
+        void Start();
+        void Stop();
+        bool IsEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+        // Host clock of all events in nanoseconds
+        static std::uint64_t Now();
+
+        // Scope of the calling thread
+        void AddHostEvent(char const* category, char const* name, std::uint64_t start, std::uint64_t end);
+        // Device work already converted into host time, track names the device queue
+        void AddDeviceEvent(std::string const& track, std::string const& name, std::uint64_t start, std::uint64_t end);
+
+        std::size_t GetNumEvents() const;
+
+        // Write {"traceEvents": [...]} with complete events in microseconds
+        void WriteJson(std::ostream& stream) const;
+        // Throws std::runtime_error if the file cannot be written
+        void WriteFile(std::string const& file_name) const;
+
+        Tracer(Tracer const&) = delete;
+        Tracer& operator = (Tracer const&) = delete;
+
+    private:
+        Tracer() = default;
+
+        struct Event
+        {
+            std::string name;
+            char const* category;
+            std::uint64_t start;
+            std::uint64_t end;
+            // Host threads first, then device tracks
+            std::uint32_t track;
+            bool device;
+        };
+
+        std::atomic<bool> m_enabled{ false };
+        mutable std::mutex m_mutex;
+        std::vector<Event> m_events;
+        std::map<std::thread::id, std::uint32_t> m_threads;
+        std::vector<std::string> m_device_tracks;
+    };
+
+    ///< Host event spanning the lifetime of the object, names have to outlive the tracer
+    ///<
+    class TraceScope
+    {
+    public:
+        TraceScope(char const* category, char const* name)
+            : m_category(category)
+            , m_name(Tracer::Get().IsEnabled() ? name : nullptr)
+            , m_start(m_name ? Tracer::Now() : 0)
+        {
+        }
+
+        ~TraceScope()
+        {
+            if (m_name)
+            {
+                Tracer::Get().AddHostEvent(m_category, m_name, m_start, Tracer::Now());
+            }
+        }
+
+        TraceScope(TraceScope const&) = delete;
+        TraceScope& operator = (TraceScope const&) = delete;
+
+    private:
+        char const* m_category;
+        char const* m_name;
+        std::uint64_t m_start;
+    };
+}
+
+#ifdef BAIKAL_TRACE
+#define BAIKAL_TRACE_CONCAT_IMPL(a, b) a##b
+#define BAIKAL_TRACE_CONCAT(a, b) BAIKAL_TRACE_CONCAT_IMPL(a, b)
+#define BAIKAL_TRACE_SCOPE(category, name) Baikal::TraceScope BAIKAL_TRACE_CONCAT(trace_scope_, __LINE__)(category, name)
+#else
+#define BAIKAL_TRACE_SCOPE(category, name)
+#endif
@@ -0,0 +1,193 @@
+#include "work_group_tuner.h"
+
+#include "Utils/mkpath.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace Baikal
+{
+    // Sizes tried for every kernel, the ones above kernel and device limits are skipped
+    static std::size_t const kCandidateLocalSizes[] = { 32, 64, 128, 256 };
+    // Launches timed per candidate, the fastest one counts
+    static std::uint32_t constexpr kMeasurementsPerCandidate = 3;
+    // Smaller launches are too short to time and use the current local size
+    static std::size_t constexpr kMinTunedWorkSize = 16384;
+
+    static std::string GetDeviceInfoString(CLWDevice const& device, cl_device_info info)
+    {
+        std::size_t size = 0;
+        if (clGetDeviceInfo(device.GetID(), info, 0, nullptr, &size) != CL_SUCCESS || size == 0)
+        {
+            return "";
+        }
+
+        std::string value(size, '\0');
+        clGetDeviceInfo(device.GetID(), info, size, &value[0], nullptr);
+        value.resize(value.find_last_not_of('\0') + 1);
+        return value;
+    }
+
+    WorkGroupTuner::WorkGroupTuner(CLWContext context, std::string const& cache_path)
+        : m_context(context)
+        , m_enabled(true)
+    {
+        auto device = m_context.GetDevice(0);
+        m_device_id = device.GetName() + "|" + GetDeviceInfoString(device, CL_DRIVER_VERSION);
+
+        if (!cache_path.empty())
+        {
+            // Same file name for all drivers, results of another driver are dropped on load
+            auto device_key = device.GetName();
+            std::replace_if(device_key.begin(), device_key.end(), [](char c)
+            {
+                return !std::isalnum(static_cast<unsigned char>(c));
+            }, '_');
+
+            m_file_name = cache_path + "/workgroups_" + device_key + ".txt";
+            Load();
+        }
+    }
+
+    void WorkGroupTuner::SetEnabled(bool enabled)
+    {
+        m_enabled = enabled;
+    }
+
+    bool WorkGroupTuner::IsEnabled() const
+    {
+        return m_enabled;
+    }
+
+    std::size_t WorkGroupTuner::GetLocalSize(char const* name) const
+    {
+        auto it = m_entries.find(name);
+        return (it != m_entries.end() && it->second.local_size) ? it->second.local_size : kDefaultLocalSize;
+    }
+
+    WorkGroupTuner::Entry& WorkGroupTuner::FindEntry(CLWKernel kernel, char const* name)
+    {
+        auto it = m_entries.find(name);
+        if (it != m_entries.end())
+        {
+            return it->second;
+        }
+
+        auto& entry = m_entries[name];
+
+        std::size_t kernel_max = 0;
+        clGetKernelWorkGroupInfo(kernel, m_context.GetDevice(0).GetID(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_max), &kernel_max, nullptr);
+
+        for (auto size : kCandidateLocalSizes)
+        {
+            if (size <= kernel_max)
+            {
+                entry.candidates.push_back(size);
+            }
+        }
+
+        // Stored sizes are only taken while they fit the kernel as built now
+        auto stored = m_stored_sizes.find(name);
+        if (stored != m_stored_sizes.end() && stored->second <= kernel_max)
+        {
+            entry.local_size = stored->second;
+        }
+        // Nothing to choose from
+        else if (entry.candidates.size() < 2)
+        {
+            entry.local_size = entry.candidates.empty() ? std::max<std::size_t>(kernel_max, 1) : entry.candidates.front();
+        }
+
+        entry.nanoseconds_per_item.assign(entry.candidates.size(), std::numeric_limits<double>::max());
+        return entry;
+    }
+
+    void WorkGroupTuner::Launch1D(CLWKernel kernel, char const* name, std::size_t size)
+    {
+        Launch1D(m_context, kernel, name, size);
+    }
+
+    void WorkGroupTuner::Launch1D(CLWContext context, CLWKernel kernel, char const* name, std::size_t size)
+    {
+        auto& entry = FindEntry(kernel, name);
+
+        if (entry.local_size || !m_enabled || size < kMinTunedWorkSize)
+        {
+            auto local_size = entry.local_size ? entry.local_size : kDefaultLocalSize;
+            context.Launch1D(0, ((size + local_size - 1) / local_size) * local_size, local_size, kernel);
+            return;
+        }
+
+        auto candidate = entry.num_measurements % entry.candidates.size();
+        auto local_size = entry.candidates[candidate];
+
+        // Preceding work is not accounted
+        context.Finish(0);
+        auto start = std::chrono::high_resolution_clock::now();
+        context.Launch1D(0, ((size + local_size - 1) / local_size) * local_size, local_size, kernel);
+        context.Finish(0);
+        auto nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+
+        entry.nanoseconds_per_item[candidate] = std::min(entry.nanoseconds_per_item[candidate], nanoseconds / size);
+
+        if (++entry.num_measurements == entry.candidates.size() * kMeasurementsPerCandidate)
+        {
+            auto best = std::min_element(entry.nanoseconds_per_item.begin(), entry.nanoseconds_per_item.end());
+            entry.local_size = entry.candidates[best - entry.nanoseconds_per_item.begin()];
+            Save();
+        }
+    }
+
+    void WorkGroupTuner::Load()
+    {
+        std::ifstream in(m_file_name);
+        std::string device_id;
+        if (!in || !std::getline(in, device_id) || device_id != m_device_id)
+        {
+            return;
+        }
+
+        std::string name;
+        std::size_t local_size = 0;
+        while (in >> name >> local_size)
+        {
+            if (local_size > 0)
+            {
+                m_stored_sizes[name] = local_size;
+            }
+        }
+    }
+
+    void WorkGroupTuner::Save() const
+    {
+        if (m_file_name.empty())
+        {
+            return;
+        }
+
+        // Kernels not launched in this run keep their stored sizes
+        auto sizes = m_stored_sizes;
+        for (auto const& entry : m_entries)
+        {
+            if (entry.second.local_size)
+            {
+                sizes[entry.first] = entry.second.local_size;
+            }
+        }
+
+        std::ostringstream data;
+        data << m_device_id << "\n";
+        for (auto const& size : sizes)
+        {
+            data << size.first << " " << size.second << "\n";
+        }
+
+        mkfilepath(m_file_name);
+        std::ofstream out(m_file_name);
+        out << data.str();
+    }
+}
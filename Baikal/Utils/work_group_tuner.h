@@ -0,0 +1,67 @@
+#pragma once
+
+#include "CLW.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Baikal
+{
+    ///< The class picks local work sizes of 1D kernels per device. The first launches of a kernel
+    ///< cycle through the candidate sizes and are timed on the host, which waits for the device
+    ///< before and after them. Once every candidate is measured the fastest one per work item is kept
+    ///< and stored in a file next to the program cache, so later runs on the same device and driver
+    ///< start with tuned sizes. Kernels launched this way must not depend on their local size.
+    ///<
+    class WorkGroupTuner
+    {
+    public:
+        // Local size used until a kernel is tuned and if tuning is disabled
+        static std::size_t constexpr kDefaultLocalSize = 64;
+
+        // Empty cache path keeps results in memory only
+        WorkGroupTuner(CLWContext context, std::string const& cache_path);
+
+        // Launch kernel on the context queue over size work items
+        void Launch1D(CLWKernel kernel, char const* name, std::size_t size);
+        // Same as above but on queue 0 of another context sharing the device, e.g. one with a queue of its own
+        void Launch1D(CLWContext context, CLWKernel kernel, char const* name, std::size_t size);
+
+        // Tuned local size of the kernel, kDefaultLocalSize while it is tuned
+        std::size_t GetLocalSize(char const* name) const;
+
+        // Tuning is enabled by default, stored results are used either way
+        void SetEnabled(bool enabled);
+        bool IsEnabled() const;
+
+        WorkGroupTuner(WorkGroupTuner const&) = delete;
+        WorkGroupTuner& operator = (WorkGroupTuner const&) = delete;
+
+    private:
+        struct Entry
+        {
+            // Zero while tuning
+            std::size_t local_size = 0;
+            // Candidates fitting the kernel and their best device time per work item
+            std::vector<std::size_t> candidates;
+            std::vector<double> nanoseconds_per_item;
+            std::uint32_t num_measurements = 0;
+        };
+
+        Entry& FindEntry(CLWKernel kernel, char const* name);
+        void Load();
+        void Save() const;
+
+        CLWContext m_context;
+        std::string m_file_name;
+        // Device and driver the stored results belong to
+        std::string m_device_id;
+        bool m_enabled;
+        std::map<std::string, Entry> m_entries;
+        // Sizes read from the file
+        std::map<std::string, std::size_t> m_stored_sizes;
+    };
+}
@@ -1,8 +1,12 @@
 #include "image_io.h"
 #include "SceneGraph/texture.h"
+#include "Utils/half_conversion.h"
+#include "Utils/texture_compression.h"
 
 #include "OpenImageIO/imageio.h"
 
+#include <fstream>
+
 namespace Baikal
 {
     class Oiio : public ImageIo
@@ -16,10 +20,38 @@ namespace Baikal
     {
         OIIO_NAMESPACE_USING
 
+        // Images with one or two channels keep them as is instead of padding to RGBA
         if (spec.format.basetype == TypeDesc::UINT8)
-            return Texture::Format::kRgba8;
+        {
+            if (spec.nchannels == 1)
+                return Texture::Format::kR8;
+            else if (spec.nchannels == 2)
+                return Texture::Format::kRg8;
+#ifdef BAIKAL_TEXTURE_CONVERSION
+            else if (spec.nchannels == 3)
+                return Texture::Format::kRgb8;
+#endif
+            else
+                return Texture::Format::kRgba8;
+        }
         else if (spec.format.basetype == TypeDesc::HALF)
-            return Texture::Format::kRgba16;
+        {
+            if (spec.nchannels == 1)
+                return Texture::Format::kR16;
+            else if (spec.nchannels == 2)
+                return Texture::Format::kRg16;
+#ifdef BAIKAL_TEXTURE_CONVERSION
+            else if (spec.nchannels == 3)
+                return Texture::Format::kRgb16;
+#endif
+            else
+                return Texture::Format::kRgba16;
+        }
+#ifdef BAIKAL_TEXTURE_CONVERSION
+        // Three channel images are expanded to RGBA when uploaded to the device
+        else if (spec.nchannels == 3)
+            return Texture::Format::kRgb32;
+#endif
         else
             return Texture::Format::kRgba32;
     }
@@ -28,14 +60,35 @@ namespace Baikal
     {
         OIIO_NAMESPACE_USING
 
-        if (fmt == Texture::Format::kRgba8)
+        if (fmt == Texture::Format::kRgba8 || fmt == Texture::Format::kR8 || fmt == Texture::Format::kRg8 ||
+            fmt == Texture::Format::kRgb8)
             return  TypeDesc::UINT8;
-        else if (fmt == Texture::Format::kRgba16)
+        else if (fmt == Texture::Format::kRgba16 || fmt == Texture::Format::kR16 || fmt == Texture::Format::kRg16 ||
+            fmt == Texture::Format::kRgb16)
             return TypeDesc::HALF;
         else
             return TypeDesc::FLOAT;
     }
 
+    static int GetChannelCount(Texture::Format fmt)
+    {
+        switch (fmt)
+        {
+        case Texture::Format::kR8:
+        case Texture::Format::kR16:
+            return 1;
+        case Texture::Format::kRg8:
+        case Texture::Format::kRg16:
+            return 2;
+        case Texture::Format::kRgb8:
+        case Texture::Format::kRgb16:
+        case Texture::Format::kRgb32:
+            return 3;
+        default:
+            return 4;
+        }
+    }
+
     Texture::Ptr Oiio::LoadImage(const std::string &filename) const
     {
         OIIO_NAMESPACE_USING
@@ -52,7 +105,28 @@ namespace Baikal
         auto fmt = GetTextureFormat(spec);
         char* texturedata = nullptr;
 
-        if (fmt == Texture::Format::kRgba8)
+        // Block compression starts from RGBA texels
+        if (fmt == Texture::Format::kRgb8 && m_compression_format != Texture::Format::kRgba8)
+        {
+            fmt = Texture::Format::kRgba8;
+        }
+
+        if (fmt == Texture::Format::kR8 || fmt == Texture::Format::kRg8 ||
+            fmt == Texture::Format::kR16 || fmt == Texture::Format::kRg16 ||
+            fmt == Texture::Format::kRgb8 || fmt == Texture::Format::kRgb16 || fmt == Texture::Format::kRgb32)
+        {
+            auto texel_size = GetChannelCount(fmt) * GetTextureFormat(fmt).size();
+            auto size = spec.width * spec.height * spec.depth * texel_size;
+
+            texturedata = new char[size];
+
+            // Read data to storage
+            input->read_image(GetTextureFormat(fmt), texturedata, texel_size);
+
+            // Close handle
+            input->close();
+        }
+        else if (fmt == Texture::Format::kRgba8)
         {
             auto size = spec.width * spec.height * spec.depth * 4;
 
@@ -62,18 +136,6 @@ namespace Baikal
             // Read data to storage
             input->read_image(TypeDesc::UINT8, texturedata, sizeof(char) * 4);
 
-            if (spec.nchannels == 1)
-            {
-                // set B, G and A components to 
-                for (auto i = 0; i < size; i += 4)
-                {
-                    texturedata[i + 1] = texturedata[i];
-                    texturedata[i + 2] = texturedata[i];
-                    texturedata[i + 3] = texturedata[i];
-                }
-
-            }
-
             // Close handle
             input->close();
         }
@@ -106,8 +168,27 @@ namespace Baikal
             input->close();
         }
 
-        //
-        return Texture::Create(texturedata, RadeonRays::int3(spec.width, spec.height, spec.depth), fmt);;
+        // Float texels are read as is and converted in bulk, it is much faster than letting OIIO convert them
+        if (m_half_precision && (fmt == Texture::Format::kRgba32 || fmt == Texture::Format::kRgb32))
+        {
+            auto count = static_cast<std::size_t>(spec.width) * spec.height * spec.depth * GetChannelCount(fmt);
+            auto halfdata = new char[count * sizeof(std::uint16_t)];
+
+            HalfConversion::FloatToHalf(reinterpret_cast<float const*>(texturedata), reinterpret_cast<std::uint16_t*>(halfdata), count);
+
+            delete[] texturedata;
+            texturedata = halfdata;
+            fmt = fmt == Texture::Format::kRgba32 ? Texture::Format::kRgba16 : Texture::Format::kRgb16;
+        }
+
+        auto texture = Texture::Create(texturedata, RadeonRays::int3(spec.width, spec.height, spec.depth), fmt);
+
+        if (fmt == Texture::Format::kRgba8 && m_compression_format != Texture::Format::kRgba8)
+        {
+            return TextureCompression::Compress(*texture, m_compression_format);
+        }
+
+        return texture;
     }
 
     void Oiio::SaveImage(std::string const& filename, Texture::Ptr texture) const
@@ -121,10 +202,15 @@ namespace Baikal
             throw std::runtime_error("Can't create image file on disk");
         }
 
+        if (texture->IsCompressed())
+        {
+            throw std::runtime_error("Can't save block compressed image " + filename);
+        }
+
         auto dim = texture->GetSize();
         auto fmt = GetTextureFormat(texture->GetFormat());
 
-        ImageSpec spec(dim.x, dim.y, 4, fmt);
+        ImageSpec spec(dim.x, dim.y, GetChannelCount(texture->GetFormat()), fmt);
 
         out->open(filename, spec);
 
@@ -133,6 +219,39 @@ namespace Baikal
         out->close();
     }
 
+    UdimTexture::Ptr ImageIo::LoadUdimImage(std::string const& filename) const
+    {
+        static std::string const kTileToken = "<UDIM>";
+
+        auto token = filename.find(kTileToken);
+
+        if (token == std::string::npos)
+        {
+            throw std::runtime_error("Can't load " + filename + " UDIM set: file name has no " + kTileToken + " token");
+        }
+
+        auto udim = UdimTexture::Create();
+        auto last_tile = UdimTexture::kFirstTile + UdimTexture::kNumColumns * UdimTexture::kMaxRows;
+
+        for (auto tile = UdimTexture::kFirstTile; tile < last_tile; ++tile)
+        {
+            auto tile_filename = filename;
+            tile_filename.replace(token, kTileToken.size(), std::to_string(tile));
+
+            if (std::ifstream(tile_filename).good())
+            {
+                udim->SetTile(tile, LoadImage(tile_filename));
+            }
+        }
+
+        if (udim->GetTiles().empty())
+        {
+            throw std::runtime_error("Can't load " + filename + " UDIM set: no tiles found");
+        }
+
+        return udim;
+    }
+
     std::unique_ptr<ImageIo> ImageIo::CreateImageIo()
     {
         return std::make_unique<Oiio>();
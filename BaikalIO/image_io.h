@@ -66,10 +66,23 @@ namespace Baikal
         // Load texture from file
         virtual Texture::Ptr LoadImage(std::string const& filename) const = 0;
         virtual void SaveImage(std::string const& filename, Texture::Ptr texture) const = 0;
+        // Load UDIM set from the files named as filename with <UDIM> replaced by tile numbers, missing tiles are skipped
+        UdimTexture::Ptr LoadUdimImage(std::string const& filename) const;
+
+        // Block compress 8 bit images on load with kBc1 or kBc5 format, kRgba8 keeps them uncompressed
+        void SetCompressionFormat(Texture::Format format) { m_compression_format = format; }
+        Texture::Format GetCompressionFormat() const { return m_compression_format; }
+        // Store 32-bit float images as half precision kRgba16 or kRgb16 textures, halving their memory
+        void SetHalfPrecision(bool enable) { m_half_precision = enable; }
+        bool IsHalfPrecision() const { return m_half_precision; }
         
         // Disallow copying
         ImageIo(ImageIo const&) = delete;
         ImageIo& operator = (ImageIo const&) = delete;
+
+    protected:
+        Texture::Format m_compression_format = Texture::Format::kRgba8;
+        bool m_half_precision = false;
     };
     
 
@@ -0,0 +1,447 @@
+#include "json.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace Baikal
+{
+    namespace
+    {
+        // Nesting limit keeping the recursive parser off the stack end
+        std::size_t constexpr kMaxDepth = 256;
+
+        JsonValue const& GetNull()
+        {
+            static JsonValue const null_value;
+            return null_value;
+        }
+
+        std::string const& GetEmptyString()
+        {
+            static std::string const empty;
+            return empty;
+        }
+
+        void AppendUtf8(std::string& str, std::uint32_t code_point)
+        {
+            if (code_point < 0x80)
+            {
+                str += static_cast<char>(code_point);
+            }
+            else if (code_point < 0x800)
+            {
+                str += static_cast<char>(0xc0 | (code_point >> 6));
+                str += static_cast<char>(0x80 | (code_point & 0x3f));
+            }
+            else if (code_point < 0x10000)
+            {
+                str += static_cast<char>(0xe0 | (code_point >> 12));
+                str += static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+                str += static_cast<char>(0x80 | (code_point & 0x3f));
+            }
+            else
+            {
+                str += static_cast<char>(0xf0 | (code_point >> 18));
+                str += static_cast<char>(0x80 | ((code_point >> 12) & 0x3f));
+                str += static_cast<char>(0x80 | ((code_point >> 6) & 0x3f));
+                str += static_cast<char>(0x80 | (code_point & 0x3f));
+            }
+        }
+    }
+
+    class JsonParser
+    {
+    public:
+        JsonParser(char const* data, std::size_t size)
+            : m_begin(data)
+            , m_p(data)
+            , m_end(data + size)
+        {
+        }
+
+        JsonValue ParseDocument()
+        {
+            JsonValue value;
+            ParseValue(value, 0);
+
+            SkipSpaces();
+            if (m_p != m_end)
+            {
+                Fail("unexpected data after the document");
+            }
+
+            return value;
+        }
+
+    private:
+        [[noreturn]] void Fail(char const* message) const
+        {
+            throw std::runtime_error(std::string("JSON: ") + message + " at offset " + std::to_string(m_p - m_begin));
+        }
+
+        void SkipSpaces()
+        {
+            while (m_p < m_end && (*m_p == ' ' || *m_p == '\t' || *m_p == '\n' || *m_p == '\r'))
+            {
+                ++m_p;
+            }
+        }
+
+        void Expect(char const* literal)
+        {
+            auto length = std::strlen(literal);
+            if (static_cast<std::size_t>(m_end - m_p) < length || std::memcmp(m_p, literal, length) != 0)
+            {
+                Fail("invalid literal");
+            }
+            m_p += length;
+        }
+
+        void ParseValue(JsonValue& value, std::size_t depth)
+        {
+            if (depth > kMaxDepth)
+            {
+                Fail("nesting is too deep");
+            }
+
+            SkipSpaces();
+            if (m_p == m_end)
+            {
+                Fail("unexpected end of data");
+            }
+
+            switch (*m_p)
+            {
+                case '{':
+                    ParseObject(value, depth);
+                    break;
+                case '[':
+                    ParseArray(value, depth);
+                    break;
+                case '"':
+                    value.m_type = JsonValue::Type::kString;
+                    ParseString(value.m_string);
+                    break;
+                case 't':
+                    Expect("true");
+                    value.m_type = JsonValue::Type::kBool;
+                    value.m_bool = true;
+                    break;
+                case 'f':
+                    Expect("false");
+                    value.m_type = JsonValue::Type::kBool;
+                    value.m_bool = false;
+                    break;
+                case 'n':
+                    Expect("null");
+                    value.m_type = JsonValue::Type::kNull;
+                    break;
+                default:
+                    value.m_type = JsonValue::Type::kNumber;
+                    value.m_number = ParseNumber();
+                    break;
+            }
+        }
+
+        void ParseObject(JsonValue& value, std::size_t depth)
+        {
+            value.m_type = JsonValue::Type::kObject;
+            ++m_p;
+
+            SkipSpaces();
+            if (m_p < m_end && *m_p == '}')
+            {
+                ++m_p;
+                return;
+            }
+
+            for (;;)
+            {
+                SkipSpaces();
+                if (m_p == m_end || *m_p != '"')
+                {
+                    Fail("expected member name");
+                }
+
+                value.m_members.emplace_back();
+                auto& member = value.m_members.back();
+                ParseString(member.first);
+
+                SkipSpaces();
+                if (m_p == m_end || *m_p != ':')
+                {
+                    Fail("expected ':'");
+                }
+                ++m_p;
+
+                ParseValue(member.second, depth + 1);
+
+                SkipSpaces();
+                if (m_p < m_end && *m_p == ',')
+                {
+                    ++m_p;
+                    continue;
+                }
+                if (m_p < m_end && *m_p == '}')
+                {
+                    ++m_p;
+                    return;
+                }
+                Fail("expected ',' or '}'");
+            }
+        }
+
+        void ParseArray(JsonValue& value, std::size_t depth)
+        {
+            value.m_type = JsonValue::Type::kArray;
+            ++m_p;
+
+            SkipSpaces();
+            if (m_p < m_end && *m_p == ']')
+            {
+                ++m_p;
+                return;
+            }
+
+            for (;;)
+            {
+                value.m_elements.emplace_back();
+                ParseValue(value.m_elements.back(), depth + 1);
+
+                SkipSpaces();
+                if (m_p < m_end && *m_p == ',')
+                {
+                    ++m_p;
+                    continue;
+                }
+                if (m_p < m_end && *m_p == ']')
+                {
+                    ++m_p;
+                    return;
+                }
+                Fail("expected ',' or ']'");
+            }
+        }
+
+        std::uint32_t ParseHex4()
+        {
+            if (m_end - m_p < 4)
+            {
+                Fail("invalid unicode escape");
+            }
+
+            std::uint32_t value = 0;
+            for (auto i = 0; i < 4; ++i, ++m_p)
+            {
+                auto c = *m_p;
+                value <<= 4;
+                if (c >= '0' && c <= '9') value |= c - '0';
+                else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+                else Fail("invalid unicode escape");
+            }
+
+            return value;
+        }
+
+        void ParseString(std::string& str)
+        {
+            ++m_p;
+
+            for (;;)
+            {
+                // Copy the run up to the next quote or escape at once
+                auto run = m_p;
+                while (m_p < m_end && *m_p != '"' && *m_p != '\\')
+                {
+                    ++m_p;
+                }
+                str.append(run, m_p);
+
+                if (m_p == m_end)
+                {
+                    Fail("unterminated string");
+                }
+
+                if (*m_p++ == '"')
+                {
+                    return;
+                }
+
+                if (m_p == m_end)
+                {
+                    Fail("unterminated string");
+                }
+
+                switch (*m_p++)
+                {
+                    case '"': str += '"'; break;
+                    case '\\': str += '\\'; break;
+                    case '/': str += '/'; break;
+                    case 'b': str += '\b'; break;
+                    case 'f': str += '\f'; break;
+                    case 'n': str += '\n'; break;
+                    case 'r': str += '\r'; break;
+                    case 't': str += '\t'; break;
+                    case 'u':
+                    {
+                        auto code_point = ParseHex4();
+
+                        // Characters outside of the basic plane come as surrogate pairs
+                        if (code_point >= 0xd800 && code_point < 0xdc00 &&
+                            m_end - m_p >= 2 && m_p[0] == '\\' && m_p[1] == 'u')
+                        {
+                            m_p += 2;
+                            auto low = ParseHex4();
+                            if (low < 0xdc00 || low >= 0xe000)
+                            {
+                                Fail("invalid surrogate pair");
+                            }
+                            code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+                        }
+
+                        AppendUtf8(str, code_point);
+                        break;
+                    }
+                    default:
+                        Fail("invalid escape");
+                }
+            }
+        }
+
+        // Parsed by hand, strtod depends on the locale
+        double ParseNumber()
+        {
+            auto negative = false;
+            if (m_p < m_end && *m_p == '-')
+            {
+                negative = true;
+                ++m_p;
+            }
+
+            if (m_p == m_end || *m_p < '0' || *m_p > '9')
+            {
+                Fail("invalid value");
+            }
+
+            double mantissa = 0.0;
+            int exponent = 0;
+            while (m_p < m_end && *m_p >= '0' && *m_p <= '9')
+            {
+                mantissa = mantissa * 10.0 + (*m_p++ - '0');
+            }
+
+            if (m_p < m_end && *m_p == '.')
+            {
+                ++m_p;
+                if (m_p == m_end || *m_p < '0' || *m_p > '9')
+                {
+                    Fail("invalid number");
+                }
+
+                while (m_p < m_end && *m_p >= '0' && *m_p <= '9')
+                {
+                    mantissa = mantissa * 10.0 + (*m_p++ - '0');
+                    --exponent;
+                }
+            }
+
+            if (m_p < m_end && (*m_p == 'e' || *m_p == 'E'))
+            {
+                ++m_p;
+                auto negative_exponent = false;
+                if (m_p < m_end && (*m_p == '-' || *m_p == '+'))
+                {
+                    negative_exponent = *m_p++ == '-';
+                }
+
+                if (m_p == m_end || *m_p < '0' || *m_p > '9')
+                {
+                    Fail("invalid number");
+                }
+
+                int value = 0;
+                while (m_p < m_end && *m_p >= '0' && *m_p <= '9')
+                {
+                    value = std::min(value * 10 + (*m_p++ - '0'), 10000);
+                }
+
+                exponent += negative_exponent ? -value : value;
+            }
+
+            auto value = exponent != 0 ? mantissa * std::pow(10.0, exponent) : mantissa;
+            return negative ? -value : value;
+        }
+
+        char const* m_begin;
+        char const* m_p;
+        char const* m_end;
+    };
+
+    JsonValue JsonValue::Parse(char const* data, std::size_t size)
+    {
+        return JsonParser(data, size).ParseDocument();
+    }
+
+    bool JsonValue::AsBool(bool fallback) const
+    {
+        return m_type == Type::kBool ? m_bool : fallback;
+    }
+
+    double JsonValue::AsNumber(double fallback) const
+    {
+        return m_type == Type::kNumber ? m_number : fallback;
+    }
+
+    std::string const& JsonValue::AsString() const
+    {
+        return m_type == Type::kString ? m_string : GetEmptyString();
+    }
+
+    std::size_t JsonValue::GetSize() const
+    {
+        switch (m_type)
+        {
+            case Type::kArray:
+                return m_elements.size();
+            case Type::kObject:
+                return m_members.size();
+            default:
+                return 0;
+        }
+    }
+
+    JsonValue const& JsonValue::At(std::size_t index) const
+    {
+        return m_type == Type::kArray && index < m_elements.size() ? m_elements[index] : GetNull();
+    }
+
+    JsonValue const& JsonValue::operator [] (char const* name) const
+    {
+        for (auto const& member : m_members)
+        {
+            if (member.first == name)
+            {
+                return member.second;
+            }
+        }
+
+        return GetNull();
+    }
+
+    bool JsonValue::HasMember(char const* name) const
+    {
+        for (auto const& member : m_members)
+        {
+            if (member.first == name)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
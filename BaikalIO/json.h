@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef WIN32
+#ifdef BAIKAL_EXPORT_API
+#define BAIKAL_API_ENTRY __declspec(dllexport)
+#else
+#define BAIKAL_API_ENTRY __declspec(dllimport)
+#endif
+#else
+#define BAIKAL_API_ENTRY __attribute__((visibility ("default")))
+#endif
+
+namespace Baikal
+{
+    ///< Read only JSON document tree for the scene loaders.
+    ///< Lookups of missing members or out of range elements return a null value,
+    ///< so optional properties can be queried without checks.
+    ///<
+    class BAIKAL_API_ENTRY JsonValue
+    {
+    public:
+        enum class Type
+        {
+            kNull,
+            kBool,
+            kNumber,
+            kString,
+            kArray,
+            kObject
+        };
+
+        using Member = std::pair<std::string, JsonValue>;
+
+        JsonValue() = default;
+
+        // Parse UTF-8 text, throws std::runtime_error with the offset of the first error
+        static JsonValue Parse(char const* data, std::size_t size);
+
+        Type GetType() const { return m_type; }
+        bool IsNull() const { return m_type == Type::kNull; }
+        bool IsNumber() const { return m_type == Type::kNumber; }
+        bool IsString() const { return m_type == Type::kString; }
+        bool IsArray() const { return m_type == Type::kArray; }
+        bool IsObject() const { return m_type == Type::kObject; }
+
+        // Values of other types give the fallback
+        bool AsBool(bool fallback = false) const;
+        double AsNumber(double fallback = 0.0) const;
+        std::string const& AsString() const;
+
+        // Element count of arrays, member count of objects, zero otherwise
+        std::size_t GetSize() const;
+        JsonValue const& At(std::size_t index) const;
+        // Members are searched linearly, the objects of scene formats are small
+        JsonValue const& operator [] (char const* name) const;
+        bool HasMember(char const* name) const;
+        std::vector<Member> const& GetMembers() const { return m_members; }
+
+    private:
+        friend class JsonParser;
+
+        Type m_type = Type::kNull;
+        bool m_bool = false;
+        double m_number = 0.0;
+        std::string m_string;
+        std::vector<JsonValue> m_elements;
+        std::vector<Member> m_members;
+    };
+}
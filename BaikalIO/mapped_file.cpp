@@ -0,0 +1,110 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+
+#ifdef WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Baikal
+{
+#ifdef WIN32
+    MappedFile::MappedFile(std::string const& filename)
+    {
+        auto file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("Cannot open file for reading: " + filename);
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size))
+        {
+            CloseHandle(file);
+            throw std::runtime_error("Cannot get file size: " + filename);
+        }
+
+        m_file = file;
+        m_size = static_cast<std::size_t>(size.QuadPart);
+
+        if (m_size == 0)
+        {
+            return;
+        }
+
+        m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        m_data = m_mapping ? static_cast<char const*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+
+        if (!m_data)
+        {
+            if (m_mapping)
+            {
+                CloseHandle(m_mapping);
+            }
+            CloseHandle(file);
+            throw std::runtime_error("Cannot map file: " + filename);
+        }
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (m_data)
+        {
+            UnmapViewOfFile(m_data);
+            CloseHandle(m_mapping);
+        }
+
+        CloseHandle(m_file);
+    }
+#else
+    MappedFile::MappedFile(std::string const& filename)
+    {
+        auto file = open(filename.c_str(), O_RDONLY);
+
+        if (file < 0)
+        {
+            throw std::runtime_error("Cannot open file for reading: " + filename);
+        }
+
+        struct stat info;
+        if (fstat(file, &info) != 0)
+        {
+            close(file);
+            throw std::runtime_error("Cannot get file size: " + filename);
+        }
+
+        m_size = static_cast<std::size_t>(info.st_size);
+
+        if (m_size > 0)
+        {
+            auto data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+            if (data == MAP_FAILED)
+            {
+                close(file);
+                throw std::runtime_error("Cannot map file: " + filename);
+            }
+
+            m_data = static_cast<char const*>(data);
+        }
+
+        // Mapping stays valid after the descriptor is closed
+        close(file);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (m_data)
+        {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+#endif
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace Baikal
+{
+    ///< Read only memory mapping of a whole file, pages are loaded on first access.
+    ///< Empty files are not mapped and give nullptr data.
+    ///<
+    class MappedFile
+    {
+    public:
+        // Throws if the file cannot be opened or mapped
+        explicit MappedFile(std::string const& filename);
+        ~MappedFile();
+
+        char const* GetData() const { return m_data; }
+        std::size_t GetSize() const { return m_size; }
+
+        MappedFile(MappedFile const&) = delete;
+        MappedFile& operator = (MappedFile const&) = delete;
+
+    private:
+        char const* m_data = nullptr;
+        std::size_t m_size = 0u;
+        // Windows file and mapping handles, posix mappings outlive their descriptor
+        void* m_file = nullptr;
+        void* m_mapping = nullptr;
+    };
+}
@@ -9,19 +9,132 @@
 #include "SceneGraph/inputmaps.h"
 
 #include "image_io.h"
+#include "mapped_file.h"
 
+#include "Utils/log.h"
+#include "Utils/task_scheduler.h"
 #include "XML/tinyxml2.h"
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <sstream>
 #include <map>
 #include <stack>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <assert.h>
 
 namespace Baikal
 {
     using namespace tinyxml2;
 
+    namespace
+    {
+        // Library textures are created holding the default checkerboard while the library is read,
+        // files are decoded in parallel once all the materials are there
+        class DeferredTextures
+        {
+        public:
+            explicit DeferredTextures(std::string const& base_path)
+                : m_base_path(base_path)
+            {
+            }
+
+            // Textures are shared by file name
+            Texture::Ptr Get(std::string const& name)
+            {
+                auto iter = m_textures.find(name);
+                if (iter != m_textures.cend())
+                {
+                    return iter->second;
+                }
+
+                auto texture = Texture::Create();
+                texture->SetName(name);
+                m_textures.emplace(name, texture);
+                m_pending.emplace_back(m_base_path + name, texture);
+                return texture;
+            }
+
+            // Failed files keep the checkerboard
+            void Load(ImageIo const& io)
+            {
+                if (m_pending.empty())
+                {
+                    return;
+                }
+
+                std::vector<char> failed(m_pending.size(), 0);
+
+                TaskScheduler::Get().ParallelFor(m_pending.size(), 1, [&](std::size_t begin, std::size_t end)
+                {
+                    for (auto i = begin; i < end; ++i)
+                    {
+                        try
+                        {
+                            auto decoded = io.LoadImage(m_pending[i].first);
+                            m_pending[i].second->TakeData(*decoded);
+                        }
+                        catch (std::runtime_error&)
+                        {
+                            failed[i] = 1;
+                        }
+                    }
+                });
+
+                for (std::size_t i = 0; i < m_pending.size(); ++i)
+                {
+                    if (failed[i])
+                    {
+                        LogInfo("Can't load texture: ", m_pending[i].first, "\n");
+                    }
+                }
+
+                m_pending.clear();
+            }
+
+        private:
+            std::string m_base_path;
+            std::unordered_map<std::string, Texture::Ptr> m_textures;
+            std::vector<std::pair<std::string, Texture::Ptr>> m_pending;
+        };
+    }
+
+    static std::string GetBasePath(std::string const& filename)
+    {
+        auto slash = filename.find_last_of('/');
+        if (slash == std::string::npos) slash = filename.find_last_of('\\');
+        return slash != std::string::npos ? filename.substr(0, slash + 1) : std::string();
+    }
+
+    // Name a texture is saved under, unnamed textures are written next to the library
+    static std::string GetTextureName(ImageIo& io, Texture::Ptr texture, std::string const& base_path,
+        std::map<Texture::Ptr, std::string>& texture_names)
+    {
+        auto iter = texture_names.find(texture);
+        if (iter != texture_names.cend())
+        {
+            return iter->second;
+        }
+
+        std::string texture_name = texture->GetName();
+        if (texture_name.empty())
+        {
+            std::ostringstream oss;
+            oss << (std::uint64_t)texture.get() << ".jpg";
+            texture_name = oss.str();
+            io.SaveImage(base_path + texture_name, texture);
+        }
+
+        texture_names[texture] = texture_name;
+        return texture_name;
+    }
+
     // XML based material IO implememtation
     class MaterialIoXML : public MaterialIo
     {
@@ -38,18 +151,20 @@ namespace Baikal
         // Write single InputMap
         void WriteInputMap(ImageIo& io, XMLPrinter& printer, InputMap::Ptr inputMap);
 
+        using ElementMap = std::unordered_map<uint32_t, XMLElement*>;
+        using InputMapCache = std::unordered_map<uint32_t, InputMap::Ptr>;
+
         // Load inputs
-        InputMap::Ptr LoadInputMap(ImageIo& io, XMLElement* element, 
-            const std::map<uint32_t, XMLElement*> &input_map_cache,
-            std::map<uint32_t, InputMap::Ptr> &loaded_inputs);
+        InputMap::Ptr LoadInputMap(DeferredTextures& textures, XMLElement* element,
+            const ElementMap &input_map_cache,
+            InputMapCache &loaded_inputs);
         // Load single material
-        Material::Ptr LoadMaterial(ImageIo& io, XMLElement& element, const std::map<uint32_t, InputMap::Ptr> &loaded_inputs);
+        Material::Ptr LoadMaterial(XMLElement& element, const InputMapCache &loaded_inputs);
 
         // Texture to name map
         std::map<Texture::Ptr, std::string> m_tex2name;
 
-        std::map<std::string, Texture::Ptr> m_name2tex;
-        std::map<std::uint64_t, Material::Ptr> m_id2mat;
+        std::unordered_map<std::uint64_t, Material::Ptr> m_id2mat;
         std::set<InputMap::Ptr> m_saved_inputs;
 
         struct ResolveRequest
@@ -68,36 +183,53 @@ namespace Baikal
         std::string m_base_path;
 
         template<class T>
-        InputMap::Ptr LoadTwoArgInput(ImageIo& io, XMLElement* element,
-            const std::map<uint32_t, XMLElement*> &input_map_cache,
-            std::map<uint32_t, InputMap::Ptr> &loaded_inputs)
+        InputMap::Ptr LoadTwoArgInput(DeferredTextures& textures, XMLElement* element,
+            const ElementMap &input_map_cache,
+            InputMapCache &loaded_inputs)
         {
             uint32_t arg1_id = element->UnsignedAttribute("input0");
             uint32_t arg2_id = element->UnsignedAttribute("input1");
-            InputMap::Ptr arg1 = LoadInputMap(io, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
-            InputMap::Ptr arg2 = LoadInputMap(io, input_map_cache.at(arg2_id), input_map_cache, loaded_inputs);
+            InputMap::Ptr arg1 = LoadInputMap(textures, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
+            InputMap::Ptr arg2 = LoadInputMap(textures, input_map_cache.at(arg2_id), input_map_cache, loaded_inputs);
 
             return T::Create(arg1, arg2);
         }
 
         template<class T>
-        InputMap::Ptr LoadOneArgInput(ImageIo& io, XMLElement* element,
-            const std::map<uint32_t, XMLElement*> &input_map_cache,
-            std::map<uint32_t, InputMap::Ptr> &loaded_inputs)
+        InputMap::Ptr LoadOneArgInput(DeferredTextures& textures, XMLElement* element,
+            const ElementMap &input_map_cache,
+            InputMapCache &loaded_inputs)
         {
             uint32_t arg1_id = element->UnsignedAttribute("input0");
-            InputMap::Ptr arg1 = LoadInputMap(io, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
+            InputMap::Ptr arg1 = LoadInputMap(textures, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
 
             return T::Create(arg1);
         }
 
     };
 
+    // Binary material library, inputs are stored after their own inputs and referenced by index,
+    // so loading is a single pass over the records without any lookups
+    class MaterialIoBinary : public MaterialIo
+    {
+    public:
+        // Save materials to disk
+        void SaveMaterials(std::string const& filename, Iterator& iterator) override;
+
+        // Load materials from disk
+        std::unique_ptr<Iterator> LoadMaterials(std::string const& file_name) override;
+    };
+
     std::unique_ptr<MaterialIo> MaterialIo::CreateMaterialIoXML()
     {
         return std::make_unique<MaterialIoXML>();
     }
 
+    std::unique_ptr<MaterialIo> MaterialIo::CreateMaterialIoBinary()
+    {
+        return std::make_unique<MaterialIoBinary>();
+    }
+
     static std::string Float4ToString(RadeonRays::float3 const& v)
     {
         std::ostringstream oss;
@@ -144,6 +276,7 @@ namespace Baikal
             printer.PushAttribute("refraction_link_ior", uberv2_material->IsLinkRefractionIOR());
             printer.PushAttribute("emission_doublesided", uberv2_material->isDoubleSided());
             printer.PushAttribute("sss_multyscatter", uberv2_material->IsMultiscatter());
+            printer.PushAttribute("sss_diffusion", uberv2_material->GetSSSMode() == UberV2Material::kSSSDiffusion);
             printer.PushAttribute("layers", uberv2_material->GetLayers());
 
             auto num_inputs = uberv2_material->GetNumInputs();
@@ -167,17 +300,12 @@ namespace Baikal
 
     void MaterialIoXML::SaveMaterials(std::string const& filename, Iterator& mat_iter)
     {
-        auto slash = filename.find_last_of('/');
-        if (slash == std::string::npos) slash = filename.find_last_of('\\');
-        if (slash != std::string::npos)
-            m_base_path.assign(filename.cbegin(), filename.cbegin() + slash + 1);
-        else
-            m_base_path.clear();
+        m_base_path = GetBasePath(filename);
 
-        XMLDocument doc;
         XMLPrinter printer;
 
         m_tex2name.clear();
+        m_saved_inputs.clear();
 
         auto image_io = ImageIo::CreateImageIo();
 
@@ -216,12 +344,17 @@ namespace Baikal
         }
         printer.CloseElement();
 
-        doc.Parse(printer.CStr());
+        // Printed text is the file as is, no need to parse it back into a document
+        std::ofstream out(filename, std::ios::binary);
+        if (!out)
+        {
+            throw std::runtime_error("Cannot open file for writing: " + filename);
+        }
 
-        doc.SaveFile(filename.c_str());
+        out.write(printer.CStr(), printer.CStrSize() - 1);
     }
 
-    Material::Ptr MaterialIoXML::LoadMaterial(ImageIo& io, XMLElement& element, const std::map<uint32_t, InputMap::Ptr> &loaded_inputs)
+    Material::Ptr MaterialIoXML::LoadMaterial(XMLElement& element, const InputMapCache &loaded_inputs)
     {
         std::string name(element.Attribute("name"));
 
@@ -235,6 +368,10 @@ namespace Baikal
         material->SetDoubleSided(strcmp(element.Attribute("emission_doublesided"), "true") == 0);
         material->LinkRefractionIOR(strcmp(element.Attribute("refraction_link_ior"), "true") == 0);
         material->SetMultiscatter(strcmp(element.Attribute("sss_multyscatter"), "true") == 0);
+        // Older files have no SSS mode
+        auto attribute_sss_diffusion = element.Attribute("sss_diffusion");
+        material->SetSSSMode((attribute_sss_diffusion && strcmp(attribute_sss_diffusion, "true") == 0) ?
+            UberV2Material::kSSSDiffusion : UberV2Material::kSSSRandomWalk);
         material->SetName(name);
 
         auto num_inputs = material->GetNumInputs();
@@ -257,40 +394,45 @@ namespace Baikal
     std::unique_ptr<Iterator> MaterialIoXML::LoadMaterials(std::string const& file_name)
     {
         m_id2mat.clear();
-        m_name2tex.clear();
         m_resolve_requests.clear();
 
-        auto slash = file_name.find_last_of('/');
-        if (slash == std::string::npos) slash = file_name.find_last_of('\\');
-        if (slash != std::string::npos)
-            m_base_path.assign(file_name.cbegin(), file_name.cbegin() + slash + 1);
-        else
-            m_base_path.clear();
+        m_base_path = GetBasePath(file_name);
 
         XMLDocument doc;
-        doc.LoadFile(file_name.c_str());
+        if (doc.LoadFile(file_name.c_str()) != XML_SUCCESS)
+        {
+            throw std::runtime_error("Cannot load material file: " + file_name);
+        }
+
+        auto inputs = doc.FirstChildElement("Inputs");
+        auto materials_node = doc.FirstChildElement("Materials");
+        if (!inputs || !materials_node)
+        {
+            throw std::runtime_error("Invalid material file: " + file_name);
+        }
 
         auto image_io = ImageIo::CreateImageIo();
+        DeferredTextures textures(m_base_path);
 
-        std::map<uint32_t, XMLElement*> input_map_cache;
-        auto inputs = doc.FirstChildElement("Inputs");
+        // Inputs reference each other by id in any order, so all of them are indexed first
+        ElementMap input_map_cache;
         for (auto element = inputs->FirstChildElement(); element; element = element->NextSiblingElement())
         {
             uint32_t id = element->UnsignedAttribute("id");
             input_map_cache.insert(std::make_pair(id, element));
         }
 
-        std::map<uint32_t, InputMap::Ptr> loaded_elements;
+        InputMapCache loaded_elements;
+        loaded_elements.reserve(input_map_cache.size());
         for (auto element = inputs->FirstChildElement(); element; element = element->NextSiblingElement())
         {
-            LoadInputMap(*image_io, element, input_map_cache, loaded_elements);
+            LoadInputMap(textures, element, input_map_cache, loaded_elements);
         }
 
         std::set<Material::Ptr> materials;
-        auto materials_node = doc.FirstChildElement("Materials");
         for (auto element = materials_node->FirstChildElement(); element; element = element->NextSiblingElement())
         {
-            auto material = LoadMaterial(*image_io, *element, loaded_elements);
+            auto material = LoadMaterial(*element, loaded_elements);
             materials.insert(material);
         }
 
@@ -300,6 +442,11 @@ namespace Baikal
             i.material->SetInputValue(i.input, m_id2mat[i.id]);
         }
 
+        if (m_load_textures)
+        {
+            textures.Load(*image_io);
+        }
+
         return std::make_unique<ContainerIterator<std::set<Material::Ptr>>>(std::move(materials));
     }
 
@@ -477,28 +624,8 @@ namespace Baikal
             {
                 InputMap_Sampler *i = static_cast<InputMap_Sampler*>(inputMap.get());
 
-                auto texture = i->GetTexture();
-                auto iter = m_tex2name.find(texture);
-
-                if (iter != m_tex2name.cend())
-                {
-                    printer.PushAttribute("value", iter->second.c_str());
-                }
-                else
-                {
-                    std::string texture_name = texture->GetName();
-                    if (texture_name.empty())
-                    {
-                        std::ostringstream oss;
-                        oss << (std::uint64_t)texture.get() << ".jpg";
-                        texture_name = oss.str();
-                        io.SaveImage(m_base_path + texture_name, texture);
-                    }
-
-                    m_tex2name[texture] = texture_name;
-
-                    printer.PushAttribute("value", texture_name.c_str());
-                }
+                auto texture_name = GetTextureName(io, i->GetTexture(), m_base_path, m_tex2name);
+                printer.PushAttribute("value", texture_name.c_str());
                 printer.CloseElement();
                 break;
             }
@@ -543,6 +670,7 @@ namespace Baikal
                 printer.PushAttribute("input0", i->GetArg()->GetId());
                 printer.CloseElement();
                 WriteInputMap(io, printer, i->GetArg());
+                break;
             }
             // Specials
             case InputMap::InputMapType::kLerp:
@@ -613,9 +741,9 @@ namespace Baikal
         }
     }
 
-    InputMap::Ptr MaterialIoXML::LoadInputMap(ImageIo& io, XMLElement* element,
-        const std::map<uint32_t, XMLElement*> &input_map_cache,
-        std::map<uint32_t, InputMap::Ptr> &loaded_inputs)
+    InputMap::Ptr MaterialIoXML::LoadInputMap(DeferredTextures& textures, XMLElement* element,
+        const ElementMap &input_map_cache,
+        InputMapCache &loaded_inputs)
     {
         InputMap::InputMapType type = static_cast<InputMap::InputMapType>(element->UnsignedAttribute("type"));
         std::string name = element->Attribute("name");
@@ -649,113 +777,82 @@ namespace Baikal
             }
             case InputMap::InputMapType::kSampler:
             {
-                std::string filename(element->Attribute("value"));
-
-                auto iter = m_name2tex.find(filename);
-                Texture::Ptr texture;
-
-                if (iter != m_name2tex.cend())
-                {
-                    texture = iter->second;
-                }
-                else
-                {
-                    texture = io.LoadImage(m_base_path + filename);
-                    m_name2tex[name] = texture;
-                }
-
-                result = InputMap_Sampler::Create(texture);
-
+                result = InputMap_Sampler::Create(textures.Get(element->Attribute("value")));
                 break;
             }
             case InputMap::InputMapType::kSamplerBumpmap:
             {
-                std::string filename(element->Attribute("value"));
-
-                auto iter = m_name2tex.find(filename);
-                Texture::Ptr texture;
-
-                if (iter != m_name2tex.cend())
-                {
-                    texture = iter->second;
-                }
-                else
-                {
-                    texture = io.LoadImage(m_base_path + filename);
-                    m_name2tex[name] = texture;
-                }
-
-                result = InputMap_SamplerBumpMap::Create(texture);
+                result = InputMap_SamplerBumpMap::Create(textures.Get(element->Attribute("value")));
                 break;
             }
 
             // Two inputs
             case InputMap::InputMapType::kAdd:
-                result = LoadTwoArgInput<InputMap_Add>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Add>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kSub:
-                result = LoadTwoArgInput<InputMap_Sub>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Sub>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kMul:
-                result = LoadTwoArgInput<InputMap_Mul>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Mul>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kDiv:
-                result = LoadTwoArgInput<InputMap_Div>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Div>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kMin:
-                result = LoadTwoArgInput<InputMap_Min>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Min>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kMax:
-                result = LoadTwoArgInput<InputMap_Max>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Max>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kDot3:
-                result = LoadTwoArgInput<InputMap_Dot3>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Dot3>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kDot4:
-                result = LoadTwoArgInput<InputMap_Dot4>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Dot4>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kCross3:
-                result = LoadTwoArgInput<InputMap_Cross3>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Cross3>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kCross4:
-                result = LoadTwoArgInput<InputMap_Cross4>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Cross4>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kPow:
-                result = LoadTwoArgInput<InputMap_Pow>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Pow>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kMod:
-                result = LoadTwoArgInput<InputMap_Mod>(io, element, input_map_cache, loaded_inputs);
+                result = LoadTwoArgInput<InputMap_Mod>(textures, element, input_map_cache, loaded_inputs);
                 break;
             //Single input
             case InputMap::InputMapType::kSin:
-                result = LoadOneArgInput<InputMap_Sin>(io, element, input_map_cache, loaded_inputs);
+                result = LoadOneArgInput<InputMap_Sin>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kCos:
-                result = LoadOneArgInput<InputMap_Cos>(io, element, input_map_cache, loaded_inputs);
+                result = LoadOneArgInput<InputMap_Cos>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kTan:
-                result = LoadOneArgInput<InputMap_Tan>(io, element, input_map_cache, loaded_inputs);
+                result = LoadOneArgInput<InputMap_Tan>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kAsin:
-                result = LoadOneArgInput<InputMap_Asin>(io, element, input_map_cache, loaded_inputs);
+                result = LoadOneArgInput<InputMap_Asin>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kAcos:
-                result = LoadOneArgInput<InputMap_Acos>(io, element, input_map_cache, loaded_inputs);
+                result = LoadOneArgInput<InputMap_Acos>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kAtan:
-                result = LoadOneArgInput<InputMap_Atan>(io, element, input_map_cache, loaded_inputs);
+                result = LoadOneArgInput<InputMap_Atan>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kLength3:
-                result = LoadOneArgInput<InputMap_Length3>(io, element, input_map_cache, loaded_inputs);
+                result = LoadOneArgInput<InputMap_Length3>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kNormalize3:
-                result = LoadOneArgInput<InputMap_Normalize3>(io, element, input_map_cache, loaded_inputs);
+                result = LoadOneArgInput<InputMap_Normalize3>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kFloor:
-                result = LoadOneArgInput<InputMap_Floor>(io, element, input_map_cache, loaded_inputs);
+                result = LoadOneArgInput<InputMap_Floor>(textures, element, input_map_cache, loaded_inputs);
                 break;
             case InputMap::InputMapType::kAbs:
-                result = LoadOneArgInput<InputMap_Abs>(io, element, input_map_cache, loaded_inputs);
+                result = LoadOneArgInput<InputMap_Abs>(textures, element, input_map_cache, loaded_inputs);
                 break;
             // Specials
             case InputMap::InputMapType::kLerp:
@@ -763,9 +860,9 @@ namespace Baikal
                 uint32_t arg1_id = element->UnsignedAttribute("input0");
                 uint32_t arg2_id = element->UnsignedAttribute("input1");
                 uint32_t control_id = element->UnsignedAttribute("control");
-                InputMap::Ptr arg1 = LoadInputMap(io, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
-                InputMap::Ptr arg2 = LoadInputMap(io, input_map_cache.at(arg2_id), input_map_cache, loaded_inputs);
-                InputMap::Ptr control = LoadInputMap(io, input_map_cache.at(control_id), input_map_cache, loaded_inputs);
+                InputMap::Ptr arg1 = LoadInputMap(textures, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
+                InputMap::Ptr arg2 = LoadInputMap(textures, input_map_cache.at(arg2_id), input_map_cache, loaded_inputs);
+                InputMap::Ptr control = LoadInputMap(textures, input_map_cache.at(control_id), input_map_cache, loaded_inputs);
 
                 result = InputMap_Lerp::Create(arg1, arg2, control);
                 break;
@@ -773,7 +870,7 @@ namespace Baikal
             case InputMap::InputMapType::kSelect:
             {
                 uint32_t arg1_id = element->UnsignedAttribute("input0");
-                InputMap::Ptr arg1 = LoadInputMap(io, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
+                InputMap::Ptr arg1 = LoadInputMap(textures, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
                 InputMap_Select::Selection selection = 
                     static_cast<InputMap_Select::Selection>(element->UnsignedAttribute("selection"));
 
@@ -783,7 +880,7 @@ namespace Baikal
             case InputMap::InputMapType::kShuffle:
             {
                 uint32_t arg1_id = element->UnsignedAttribute("input0");
-                InputMap::Ptr arg1 = LoadInputMap(io, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
+                InputMap::Ptr arg1 = LoadInputMap(textures, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
                 std::array<uint32_t, 4> mask;
                 std::istringstream iss(element->Attribute("mask"));
                 iss >> mask[0] >> mask[1] >> mask[2] >> mask[3];
@@ -794,9 +891,9 @@ namespace Baikal
             case InputMap::InputMapType::kShuffle2:
             {
                 uint32_t arg1_id = element->UnsignedAttribute("input0");
-                InputMap::Ptr arg1 = LoadInputMap(io, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
+                InputMap::Ptr arg1 = LoadInputMap(textures, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
                 uint32_t arg2_id = element->UnsignedAttribute("input1");
-                InputMap::Ptr arg2 = LoadInputMap(io, input_map_cache.at(arg2_id), input_map_cache, loaded_inputs);
+                InputMap::Ptr arg2 = LoadInputMap(textures, input_map_cache.at(arg2_id), input_map_cache, loaded_inputs);
 
                 std::array<uint32_t, 4> mask;
                 std::istringstream iss(element->Attribute("mask"));
@@ -808,7 +905,7 @@ namespace Baikal
             case InputMap::InputMapType::kMatMul:
             {
                 uint32_t arg1_id = element->UnsignedAttribute("input0");
-                InputMap::Ptr arg1 = LoadInputMap(io, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
+                InputMap::Ptr arg1 = LoadInputMap(textures, input_map_cache.at(arg1_id), input_map_cache, loaded_inputs);
 
                 RadeonRays::matrix mat;
                 std::istringstream iss(element->Attribute("matrix"));
@@ -826,11 +923,11 @@ namespace Baikal
             case InputMap::InputMapType::kRemap:
             {
                 uint32_t src_id = element->UnsignedAttribute("src");
-                InputMap::Ptr src = LoadInputMap(io, input_map_cache.at(src_id), input_map_cache, loaded_inputs);
+                InputMap::Ptr src = LoadInputMap(textures, input_map_cache.at(src_id), input_map_cache, loaded_inputs);
                 uint32_t dst_id = element->UnsignedAttribute("dst");
-                InputMap::Ptr dst = LoadInputMap(io, input_map_cache.at(dst_id), input_map_cache, loaded_inputs);
+                InputMap::Ptr dst = LoadInputMap(textures, input_map_cache.at(dst_id), input_map_cache, loaded_inputs);
                 uint32_t data_id = element->UnsignedAttribute("data");
-                InputMap::Ptr data = LoadInputMap(io, input_map_cache.at(data_id), input_map_cache, loaded_inputs);
+                InputMap::Ptr data = LoadInputMap(textures, input_map_cache.at(data_id), input_map_cache, loaded_inputs);
 
                 result = InputMap_Remap::Create(src, dst, data);
                 break;
@@ -841,4 +938,445 @@ namespace Baikal
         loaded_inputs.insert(std::make_pair(id, result));
         return result;
     }
+
+    namespace
+    {
+        char const kMaterialLibraryMagic[8] = { 'B', 'K', 'M', 'A', 'T', 'L', 'I', 'B' };
+        std::uint32_t constexpr kMaterialLibraryVersion = 1;
+        std::uint32_t constexpr kNone = ~0u;
+
+        enum MaterialLibraryFlags : std::uint32_t
+        {
+            kMaterialThin = 1u << 0,
+            kMaterialDoubleSided = 1u << 1,
+            kMaterialLinkRefractionIor = 1u << 2,
+            kMaterialMultiscatter = 1u << 3,
+            kMaterialSSSDiffusion = 1u << 4
+        };
+
+        // Records are followed by the string table, strings are referenced by offset and length
+        struct MaterialLibraryHeader
+        {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t num_inputs;
+            std::uint32_t num_material_inputs;
+            std::uint32_t num_materials;
+            std::uint32_t strings_size;
+            std::uint32_t padding;
+        };
+
+        struct LibraryString
+        {
+            std::uint32_t offset;
+            std::uint32_t length;
+        };
+
+        struct LibraryInputRecord
+        {
+            std::uint32_t type;
+            LibraryString name;
+            std::uint32_t inputs[3];
+            // Texture file name relative to the library
+            LibraryString texture;
+            std::uint32_t params[4];
+            float values[16];
+        };
+
+        struct LibraryMaterialInputRecord
+        {
+            LibraryString name;
+            std::uint32_t input;
+        };
+
+        struct LibraryMaterialRecord
+        {
+            LibraryString name;
+            std::uint32_t layers;
+            std::uint32_t flags;
+            std::uint32_t first_input;
+            std::uint32_t num_inputs;
+        };
+
+        static_assert(sizeof(MaterialLibraryHeader) == 32, "Material library header layout changed");
+        static_assert(sizeof(LibraryInputRecord) == 112, "Material library input layout changed");
+        static_assert(sizeof(LibraryMaterialInputRecord) == 12, "Material library input layout changed");
+        static_assert(sizeof(LibraryMaterialRecord) == 24, "Material library material layout changed");
+
+        class LibraryWriter
+        {
+        public:
+            LibraryWriter(ImageIo& io, std::string const& base_path)
+                : m_io(io)
+                , m_base_path(base_path)
+            {
+            }
+
+            LibraryString AddString(std::string const& str)
+            {
+                LibraryString ref = { static_cast<std::uint32_t>(m_strings.size()), static_cast<std::uint32_t>(str.size()) };
+                m_strings.insert(m_strings.end(), str.cbegin(), str.cend());
+                return ref;
+            }
+
+            std::uint32_t AddInputMap(InputMap::Ptr input_map)
+            {
+                auto iter = m_input_indices.find(input_map.get());
+                if (iter != m_input_indices.cend())
+                {
+                    return iter->second;
+                }
+
+                LibraryInputRecord record = {};
+                record.type = static_cast<std::uint32_t>(input_map->m_type);
+                record.inputs[0] = record.inputs[1] = record.inputs[2] = kNone;
+
+                // Inputs go first so loading is a single forward pass
+                std::vector<InputMap::Ptr> inputs;
+                input_map->GetInputs(inputs);
+
+                if (inputs.size() > 3)
+                {
+                    throw std::runtime_error("Material library: unsupported input map");
+                }
+
+                for (std::size_t i = 0; i < inputs.size(); ++i)
+                {
+                    record.inputs[i] = AddInputMap(inputs[i]);
+                }
+
+                switch (input_map->m_type)
+                {
+                    case InputMap::InputMapType::kConstantFloat3:
+                    {
+                        auto value = std::static_pointer_cast<InputMap_ConstantFloat3>(input_map)->GetValue();
+                        record.values[0] = value.x;
+                        record.values[1] = value.y;
+                        record.values[2] = value.z;
+                        record.values[3] = value.w;
+                        break;
+                    }
+                    case InputMap::InputMapType::kConstantFloat:
+                        record.values[0] = std::static_pointer_cast<InputMap_ConstantFloat>(input_map)->GetValue();
+                        break;
+                    case InputMap::InputMapType::kSampler:
+                    case InputMap::InputMapType::kSamplerBumpmap:
+                    {
+                        auto texture = std::static_pointer_cast<InputMap_Sampler>(input_map)->GetTexture();
+                        record.texture = AddString(GetTextureName(m_io, texture, m_base_path, m_texture_names));
+                        break;
+                    }
+                    case InputMap::InputMapType::kSelect:
+                        record.params[0] = static_cast<std::uint32_t>(std::static_pointer_cast<InputMap_Select>(input_map)->GetSelection());
+                        break;
+                    case InputMap::InputMapType::kShuffle:
+                    {
+                        auto mask = std::static_pointer_cast<InputMap_Shuffle>(input_map)->GetMask();
+                        std::copy(mask.cbegin(), mask.cend(), record.params);
+                        break;
+                    }
+                    case InputMap::InputMapType::kShuffle2:
+                    {
+                        auto mask = std::static_pointer_cast<InputMap_Shuffle2>(input_map)->GetMask();
+                        std::copy(mask.cbegin(), mask.cend(), record.params);
+                        break;
+                    }
+                    case InputMap::InputMapType::kMatMul:
+                    {
+                        auto const& matrix = std::static_pointer_cast<InputMap_MatMul>(input_map)->GetMatrix();
+                        for (int i = 0; i < 16; ++i)
+                        {
+                            record.values[i] = matrix.m[i / 4][i % 4];
+                        }
+                        break;
+                    }
+                    default:
+                        break;
+                }
+
+                record.name = AddString(input_map->GetName());
+
+                auto index = static_cast<std::uint32_t>(m_inputs.size());
+                m_inputs.push_back(record);
+                m_input_indices[input_map.get()] = index;
+                return index;
+            }
+
+            void AddMaterial(Material::Ptr material)
+            {
+                auto uberv2_material = std::dynamic_pointer_cast<UberV2Material>(material);
+                if (!uberv2_material)
+                {
+                    LogInfo("Material library: only UberV2 materials are supported, ", material->GetName(), " is skipped\n");
+                    return;
+                }
+
+                LibraryMaterialRecord record = {};
+                record.name = AddString(material->GetName());
+                record.layers = uberv2_material->GetLayers();
+                record.flags = (material->IsThin() ? kMaterialThin : 0u) |
+                    (uberv2_material->isDoubleSided() ? kMaterialDoubleSided : 0u) |
+                    (uberv2_material->IsLinkRefractionIOR() ? kMaterialLinkRefractionIor : 0u) |
+                    (uberv2_material->IsMultiscatter() ? kMaterialMultiscatter : 0u) |
+                    (uberv2_material->GetSSSMode() == UberV2Material::kSSSDiffusion ? kMaterialSSSDiffusion : 0u);
+                record.first_input = static_cast<std::uint32_t>(m_material_inputs.size());
+
+                for (std::size_t i = 0; i < material->GetNumInputs(); ++i)
+                {
+                    auto input = material->GetInput(i);
+
+                    if (!material->IsActive(input) ||
+                        input.value.type != Material::InputType::kInputMap ||
+                        !input.value.input_map_value)
+                    {
+                        continue;
+                    }
+
+                    LibraryMaterialInputRecord input_record = {};
+                    input_record.input = AddInputMap(input.value.input_map_value);
+                    input_record.name = AddString(input.info.name);
+                    m_material_inputs.push_back(input_record);
+                }
+
+                record.num_inputs = static_cast<std::uint32_t>(m_material_inputs.size()) - record.first_input;
+                m_materials.push_back(record);
+            }
+
+            void Write(std::ostream& out) const
+            {
+                MaterialLibraryHeader header = {};
+                std::memcpy(header.magic, kMaterialLibraryMagic, sizeof(header.magic));
+                header.version = kMaterialLibraryVersion;
+                header.num_inputs = static_cast<std::uint32_t>(m_inputs.size());
+                header.num_material_inputs = static_cast<std::uint32_t>(m_material_inputs.size());
+                header.num_materials = static_cast<std::uint32_t>(m_materials.size());
+                header.strings_size = static_cast<std::uint32_t>(m_strings.size());
+
+                out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+                out.write(reinterpret_cast<char const*>(m_inputs.data()), m_inputs.size() * sizeof(LibraryInputRecord));
+                out.write(reinterpret_cast<char const*>(m_material_inputs.data()), m_material_inputs.size() * sizeof(LibraryMaterialInputRecord));
+                out.write(reinterpret_cast<char const*>(m_materials.data()), m_materials.size() * sizeof(LibraryMaterialRecord));
+                out.write(m_strings.data(), m_strings.size());
+            }
+
+        private:
+            ImageIo& m_io;
+            std::string m_base_path;
+            std::map<Texture::Ptr, std::string> m_texture_names;
+
+            std::vector<char> m_strings;
+            std::vector<LibraryInputRecord> m_inputs;
+            std::unordered_map<InputMap const*, std::uint32_t> m_input_indices;
+            std::vector<LibraryMaterialInputRecord> m_material_inputs;
+            std::vector<LibraryMaterialRecord> m_materials;
+        };
+
+        // Typed view of a record array inside the mapped file
+        template <typename T>
+        T const* GetRecords(MappedFile const& file, std::size_t& offset, std::size_t count)
+        {
+            if (count > (file.GetSize() - offset) / sizeof(T))
+            {
+                throw std::runtime_error("Material library: file is truncated");
+            }
+
+            auto records = reinterpret_cast<T const*>(file.GetData() + offset);
+            offset += count * sizeof(T);
+            return records;
+        }
+
+        InputMap::Ptr CreateLibraryInput(LibraryInputRecord const& record, std::vector<InputMap::Ptr> const& inputs,
+            DeferredTextures& textures, std::function<std::string(LibraryString const&)> const& get_string)
+        {
+            // Inputs are stored first, so an input can only reference the ones before it
+            auto arg = [&](std::size_t i)
+            {
+                if (record.inputs[i] >= inputs.size())
+                {
+                    throw std::runtime_error("Material library: input index out of range");
+                }
+                return inputs[record.inputs[i]];
+            };
+            auto mask = [&]() { return std::array<std::uint32_t, 4>{ { record.params[0], record.params[1], record.params[2], record.params[3] } }; };
+
+            switch (static_cast<InputMap::InputMapType>(record.type))
+            {
+                // Leafs
+                case InputMap::InputMapType::kConstantFloat3:
+                    return InputMap_ConstantFloat3::Create(RadeonRays::float3(record.values[0], record.values[1], record.values[2], record.values[3]));
+                case InputMap::InputMapType::kConstantFloat:
+                    return InputMap_ConstantFloat::Create(record.values[0]);
+                case InputMap::InputMapType::kSampler:
+                    return InputMap_Sampler::Create(textures.Get(get_string(record.texture)));
+                case InputMap::InputMapType::kSamplerBumpmap:
+                    return InputMap_SamplerBumpMap::Create(textures.Get(get_string(record.texture)));
+
+                // Two inputs
+                case InputMap::InputMapType::kAdd: return InputMap_Add::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kSub: return InputMap_Sub::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kMul: return InputMap_Mul::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kDiv: return InputMap_Div::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kMin: return InputMap_Min::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kMax: return InputMap_Max::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kDot3: return InputMap_Dot3::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kDot4: return InputMap_Dot4::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kCross3: return InputMap_Cross3::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kCross4: return InputMap_Cross4::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kPow: return InputMap_Pow::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kMod: return InputMap_Mod::Create(arg(0), arg(1));
+
+                // Single input
+                case InputMap::InputMapType::kSin: return InputMap_Sin::Create(arg(0));
+                case InputMap::InputMapType::kCos: return InputMap_Cos::Create(arg(0));
+                case InputMap::InputMapType::kTan: return InputMap_Tan::Create(arg(0));
+                case InputMap::InputMapType::kAsin: return InputMap_Asin::Create(arg(0));
+                case InputMap::InputMapType::kAcos: return InputMap_Acos::Create(arg(0));
+                case InputMap::InputMapType::kAtan: return InputMap_Atan::Create(arg(0));
+                case InputMap::InputMapType::kLength3: return InputMap_Length3::Create(arg(0));
+                case InputMap::InputMapType::kNormalize3: return InputMap_Normalize3::Create(arg(0));
+                case InputMap::InputMapType::kFloor: return InputMap_Floor::Create(arg(0));
+                case InputMap::InputMapType::kAbs: return InputMap_Abs::Create(arg(0));
+
+                // Specials
+                case InputMap::InputMapType::kLerp:
+                    return InputMap_Lerp::Create(arg(0), arg(1), arg(2));
+                case InputMap::InputMapType::kSelect:
+                    return InputMap_Select::Create(arg(0), static_cast<InputMap_Select::Selection>(record.params[0]));
+                case InputMap::InputMapType::kShuffle:
+                    return InputMap_Shuffle::Create(arg(0), mask());
+                case InputMap::InputMapType::kShuffle2:
+                    return InputMap_Shuffle2::Create(arg(0), arg(1), mask());
+                case InputMap::InputMapType::kMatMul:
+                {
+                    RadeonRays::matrix matrix;
+                    for (int i = 0; i < 16; ++i)
+                    {
+                        matrix.m[i / 4][i % 4] = record.values[i];
+                    }
+                    return InputMap_MatMul::Create(arg(0), matrix);
+                }
+                case InputMap::InputMapType::kRemap:
+                    return InputMap_Remap::Create(arg(0), arg(1), arg(2));
+            }
+
+            throw std::runtime_error("Material library: unknown input map type");
+        }
+    }
+
+    void MaterialIoBinary::SaveMaterials(std::string const& filename, Iterator& mat_iter)
+    {
+        auto image_io = ImageIo::CreateImageIo();
+        LibraryWriter writer(*image_io, GetBasePath(filename));
+
+        for (mat_iter.Reset(); mat_iter.IsValid(); mat_iter.Next())
+        {
+            auto material = mat_iter.ItemAs<Material>();
+            if (material)
+            {
+                writer.AddMaterial(material);
+            }
+        }
+
+        std::ofstream out(filename, std::ios::binary);
+        if (!out)
+        {
+            throw std::runtime_error("Cannot open file for writing: " + filename);
+        }
+
+        writer.Write(out);
+    }
+
+    std::unique_ptr<Iterator> MaterialIoBinary::LoadMaterials(std::string const& file_name)
+    {
+        MappedFile file(file_name);
+
+        if (file.GetSize() < sizeof(MaterialLibraryHeader))
+        {
+            throw std::runtime_error("Material library: file is truncated: " + file_name);
+        }
+
+        MaterialLibraryHeader header;
+        std::memcpy(&header, file.GetData(), sizeof(header));
+
+        if (std::memcmp(header.magic, kMaterialLibraryMagic, sizeof(header.magic)) != 0)
+        {
+            throw std::runtime_error("Material library: not a material library: " + file_name);
+        }
+
+        if (header.version != kMaterialLibraryVersion)
+        {
+            throw std::runtime_error("Material library: unsupported version: " + file_name);
+        }
+
+        std::size_t offset = sizeof(header);
+        auto input_records = GetRecords<LibraryInputRecord>(file, offset, header.num_inputs);
+        auto material_input_records = GetRecords<LibraryMaterialInputRecord>(file, offset, header.num_material_inputs);
+        auto material_records = GetRecords<LibraryMaterialRecord>(file, offset, header.num_materials);
+        auto strings = GetRecords<char>(file, offset, header.strings_size);
+
+        std::function<std::string(LibraryString const&)> get_string = [&](LibraryString const& ref)
+        {
+            if (ref.offset > header.strings_size || ref.length > header.strings_size - ref.offset)
+            {
+                throw std::runtime_error("Material library: string out of range");
+            }
+            return std::string(strings + ref.offset, ref.length);
+        };
+
+        auto image_io = ImageIo::CreateImageIo();
+        DeferredTextures textures(GetBasePath(file_name));
+
+        std::vector<InputMap::Ptr> inputs;
+        inputs.reserve(header.num_inputs);
+        for (std::uint32_t i = 0; i < header.num_inputs; ++i)
+        {
+            auto input = CreateLibraryInput(input_records[i], inputs, textures, get_string);
+            input->SetName(get_string(input_records[i].name));
+            inputs.push_back(input);
+        }
+
+        std::set<Material::Ptr> materials;
+        for (std::uint32_t i = 0; i < header.num_materials; ++i)
+        {
+            auto const& record = material_records[i];
+
+            if (record.first_input > header.num_material_inputs ||
+                record.num_inputs > header.num_material_inputs - record.first_input)
+            {
+                throw std::runtime_error("Material library: material inputs out of range");
+            }
+
+            // Layers go first since they define active inputs
+            auto material = UberV2Material::Create();
+            material->SetLayers(record.layers);
+            material->SetThin((record.flags & kMaterialThin) != 0);
+            material->SetDoubleSided((record.flags & kMaterialDoubleSided) != 0);
+            material->LinkRefractionIOR((record.flags & kMaterialLinkRefractionIor) != 0);
+            material->SetMultiscatter((record.flags & kMaterialMultiscatter) != 0);
+            material->SetSSSMode((record.flags & kMaterialSSSDiffusion) != 0 ?
+                UberV2Material::kSSSDiffusion : UberV2Material::kSSSRandomWalk);
+            material->SetName(get_string(record.name));
+
+            for (std::uint32_t j = 0; j < record.num_inputs; ++j)
+            {
+                auto const& input = material_input_records[record.first_input + j];
+
+                if (input.input >= inputs.size())
+                {
+                    throw std::runtime_error("Material library: input index out of range");
+                }
+
+                material->SetInputValue(get_string(input.name), inputs[input.input]);
+            }
+
+            materials.insert(material);
+        }
+
+        if (m_load_textures)
+        {
+            textures.Load(*image_io);
+        }
+
+        return std::make_unique<ContainerIterator<std::set<Material::Ptr>>>(std::move(materials));
+    }
 }
@@ -57,6 +57,9 @@ namespace Baikal
     public:
         // Create XML based material IO
         static std::unique_ptr<MaterialIo> CreateMaterialIoXML();
+        // Create binary material library IO, faster to load than XML,
+        // textures are referenced by file name like in XML
+        static std::unique_ptr<MaterialIo> CreateMaterialIoBinary();
 
         using MaterialMap = std::map<std::string, std::string>;
 
@@ -83,9 +86,17 @@ namespace Baikal
         // Load material mapping from disk
         MaterialMap LoadMaterialMapping(std::string const& filename);
 
+        // Skip decoding of texture files on load, textures keep their file names and the default checkerboard.
+        // Useful for tools which rewrite libraries without looking at texels.
+        void SetTextureLoading(bool enable) { m_load_textures = enable; }
+        bool IsTextureLoading() const { return m_load_textures; }
+
         // Disallow copying
         MaterialIo(MaterialIo const&) = delete;
         MaterialIo& operator = (MaterialIo const&) = delete;
+
+    protected:
+        bool m_load_textures = true;
     };
 
     inline MaterialIo::~MaterialIo()
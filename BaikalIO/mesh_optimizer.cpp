@@ -0,0 +1,265 @@
+#include "mesh_optimizer.h"
+
+#include "SceneGraph/iterator.h"
+#include "SceneGraph/light.h"
+#include "SceneGraph/scene1.h"
+#include "SceneGraph/shape.h"
+#include "Utils/log.h"
+#include "Utils/task_scheduler.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <set>
+#include <vector>
+
+namespace Baikal
+{
+    namespace
+    {
+        using Triangle = std::array<std::uint32_t, 3>;
+
+        // Spreads the low 10 bits so there are two zero bits between each of them
+        std::uint32_t ExpandBits(std::uint32_t v)
+        {
+            v = (v * 0x00010001u) & 0xff0000ffu;
+            v = (v * 0x00000101u) & 0x0f00f00fu;
+            v = (v * 0x00000011u) & 0xc30c30c3u;
+            v = (v * 0x00000005u) & 0x49249249u;
+            return v;
+        }
+
+        // 30 bit code of a point in the unit cube
+        std::uint32_t Morton3D(float x, float y, float z)
+        {
+            auto quantize = [](float v)
+            {
+                return static_cast<std::uint32_t>(std::min(std::max(v * 1024.f, 0.f), 1023.f));
+            };
+
+            return (ExpandBits(quantize(x)) << 2) | (ExpandBits(quantize(y)) << 1) | ExpandBits(quantize(z));
+        }
+
+        // Same triangle with the smallest index first, winding is kept
+        Triangle Canonical(Triangle const& t)
+        {
+            if (t[1] < t[0] && t[1] < t[2]) return Triangle{ { t[1], t[2], t[0] } };
+            if (t[2] < t[0] && t[2] < t[1]) return Triangle{ { t[2], t[0], t[1] } };
+            return t;
+        }
+
+        template <typename T>
+        std::vector<T> Gather(T const* data, std::vector<std::uint32_t> const& order)
+        {
+            std::vector<T> result(order.size());
+            for (std::size_t i = 0; i < order.size(); ++i)
+            {
+                result[i] = data[order[i]];
+            }
+            return result;
+        }
+    }
+
+    MeshOptimizationStats OptimizeMesh(Mesh& mesh)
+    {
+        MeshOptimizationStats stats;
+
+        auto num_vertices = mesh.GetNumVertices();
+        auto num_normals = mesh.GetNumNormals();
+        auto num_uvs = mesh.GetNumUVs();
+        auto num_indices = mesh.GetNumIndices();
+
+        if (num_indices == 0 || num_indices % 3 != 0 ||
+            (num_normals != 0 && num_normals != num_vertices) ||
+            (num_uvs != 0 && num_uvs != num_vertices) ||
+            num_vertices > std::numeric_limits<std::uint32_t>::max())
+        {
+            return stats;
+        }
+
+        auto vertices = mesh.GetVertices();
+        auto indices = mesh.GetIndices();
+        auto num_triangles = num_indices / 3;
+
+        if (std::any_of(indices, indices + num_indices, [num_vertices](std::uint32_t i) { return i >= num_vertices; }))
+        {
+            return stats;
+        }
+
+        // Degenerate triangles don't add any surface
+        std::vector<Triangle> triangles;
+        triangles.reserve(num_triangles);
+        for (std::size_t i = 0; i < num_triangles; ++i)
+        {
+            Triangle t = { { indices[3 * i], indices[3 * i + 1], indices[3 * i + 2] } };
+
+            auto e1 = vertices[t[1]] - vertices[t[0]];
+            auto e2 = vertices[t[2]] - vertices[t[0]];
+            auto n = RadeonRays::cross(e1, e2);
+
+            if (t[0] == t[1] || t[1] == t[2] || t[0] == t[2] || n.x * n.x + n.y * n.y + n.z * n.z == 0.f)
+            {
+                ++stats.num_degenerate_triangles;
+                continue;
+            }
+
+            triangles.push_back(Canonical(t));
+        }
+
+        // Sorting the canonical forms puts duplicates next to each other, the first occurrence is kept
+        std::vector<std::uint32_t> order(triangles.size());
+        for (std::size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = static_cast<std::uint32_t>(i);
+        }
+
+        std::sort(order.begin(), order.end(), [&triangles](std::uint32_t a, std::uint32_t b)
+        {
+            return triangles[a] != triangles[b] ? triangles[a] < triangles[b] : a < b;
+        });
+
+        std::vector<char> keep(triangles.size(), 1);
+        for (std::size_t i = 1; i < order.size(); ++i)
+        {
+            if (triangles[order[i]] == triangles[order[i - 1]])
+            {
+                keep[order[i]] = 0;
+                ++stats.num_duplicate_triangles;
+            }
+        }
+
+        // Centroid codes relative to the bounds of the remaining triangles
+        RadeonRays::float3 bmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+        RadeonRays::float3 bmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+        for (std::size_t i = 0; i < triangles.size(); ++i)
+        {
+            if (!keep[i])
+            {
+                continue;
+            }
+
+            for (auto index : triangles[i])
+            {
+                auto const& v = vertices[index];
+                bmin = RadeonRays::float3(std::min(bmin.x, v.x), std::min(bmin.y, v.y), std::min(bmin.z, v.z));
+                bmax = RadeonRays::float3(std::max(bmax.x, v.x), std::max(bmax.y, v.y), std::max(bmax.z, v.z));
+            }
+        }
+
+        auto extent = bmax - bmin;
+        auto inv = [](float v) { return v > 0.f ? 1.f / v : 0.f; };
+        RadeonRays::float3 scale(inv(extent.x), inv(extent.y), inv(extent.z));
+
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> codes;
+        codes.reserve(triangles.size() - stats.num_duplicate_triangles);
+        for (std::size_t i = 0; i < triangles.size(); ++i)
+        {
+            if (!keep[i])
+            {
+                continue;
+            }
+
+            auto const& t = triangles[i];
+            auto c = (vertices[t[0]] + vertices[t[1]] + vertices[t[2]]) * (1.f / 3.f) - bmin;
+            codes.emplace_back(Morton3D(c.x * scale.x, c.y * scale.y, c.z * scale.z), static_cast<std::uint32_t>(i));
+        }
+
+        // Ties keep the file order, which is often already coherent
+        std::sort(codes.begin(), codes.end());
+
+        // Vertices are renumbered by first use in the new triangle order
+        auto constexpr kUnused = std::numeric_limits<std::uint32_t>::max();
+        std::vector<std::uint32_t> remap(num_vertices, kUnused);
+        std::vector<std::uint32_t> vertex_order;
+        vertex_order.reserve(num_vertices);
+
+        std::vector<std::uint32_t> new_indices;
+        new_indices.reserve(codes.size() * 3);
+        for (auto const& code : codes)
+        {
+            for (auto index : triangles[code.second])
+            {
+                if (remap[index] == kUnused)
+                {
+                    remap[index] = static_cast<std::uint32_t>(vertex_order.size());
+                    vertex_order.push_back(index);
+                }
+
+                new_indices.push_back(remap[index]);
+            }
+        }
+
+        stats.num_unused_vertices = num_vertices - vertex_order.size();
+
+        mesh.SetVertices(Gather(vertices, vertex_order));
+        if (num_normals)
+        {
+            mesh.SetNormals(Gather(mesh.GetNormals(), vertex_order));
+        }
+        if (num_uvs)
+        {
+            mesh.SetUVs(Gather(mesh.GetUVs(), vertex_order));
+        }
+        mesh.SetIndices(std::move(new_indices));
+
+        return stats;
+    }
+
+    MeshOptimizationStats OptimizeSceneMeshes(Scene1& scene)
+    {
+        std::set<Shape const*> emissive;
+        auto light_iter = scene.CreateLightIterator();
+        for (; light_iter->IsValid(); light_iter->Next())
+        {
+            auto area_light = std::dynamic_pointer_cast<AreaLight>(light_iter->ItemAs<Light>());
+            if (!area_light)
+            {
+                continue;
+            }
+
+            auto shape = area_light->GetShape();
+            auto instance = std::dynamic_pointer_cast<Instance>(shape);
+            emissive.insert(instance ? instance->GetBaseShape().get() : shape.get());
+        }
+
+        // Instances share their base mesh, so it is only optimized once
+        std::vector<Mesh::Ptr> meshes;
+        std::set<Mesh const*> visited;
+        auto shape_iter = scene.CreateShapeIterator();
+        for (; shape_iter->IsValid(); shape_iter->Next())
+        {
+            auto shape = shape_iter->ItemAs<Shape>();
+            auto instance = std::dynamic_pointer_cast<Instance>(shape);
+            auto mesh = std::dynamic_pointer_cast<Mesh>(instance ? instance->GetBaseShape() : shape);
+
+            if (mesh && !emissive.count(mesh.get()) && visited.insert(mesh.get()).second)
+            {
+                meshes.push_back(mesh);
+            }
+        }
+
+        std::vector<MeshOptimizationStats> mesh_stats(meshes.size());
+
+        TaskScheduler::Get().ParallelFor(meshes.size(), 1, [&](std::size_t begin, std::size_t end)
+        {
+            for (auto i = begin; i < end; ++i)
+            {
+                mesh_stats[i] = OptimizeMesh(*meshes[i]);
+            }
+        });
+
+        MeshOptimizationStats stats;
+        for (auto const& s : mesh_stats)
+        {
+            stats.num_degenerate_triangles += s.num_degenerate_triangles;
+            stats.num_duplicate_triangles += s.num_duplicate_triangles;
+            stats.num_unused_vertices += s.num_unused_vertices;
+        }
+
+        LogInfo("Mesh optimization: ", meshes.size(), " meshes, removed ", stats.num_degenerate_triangles, " degenerate and ",
+            stats.num_duplicate_triangles, " duplicate triangles, ", stats.num_unused_vertices, " unused vertices\n");
+
+        return stats;
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+
+#ifdef WIN32
+#ifdef BAIKAL_EXPORT_API
+#define BAIKAL_API_ENTRY __declspec(dllexport)
+#else
+#define BAIKAL_API_ENTRY __declspec(dllimport)
+#endif
+#else
+#define BAIKAL_API_ENTRY __attribute__((visibility ("default")))
+#endif
+
+namespace Baikal
+{
+    class Mesh;
+    class Scene1;
+
+    // What an optimization pass removed
+    struct MeshOptimizationStats
+    {
+        std::size_t num_degenerate_triangles = 0;
+        std::size_t num_duplicate_triangles = 0;
+        std::size_t num_unused_vertices = 0;
+    };
+
+    // Drops degenerate and duplicate triangles and unused vertices, then orders triangles
+    // along the Morton curve of their centroids and vertices by first use. Neighbouring
+    // triangles end up close in memory, which helps attribute fetches and BVH builds.
+    // Meshes with attribute arrays not matching the vertex count are left as is.
+    BAIKAL_API_ENTRY MeshOptimizationStats OptimizeMesh(Mesh& mesh);
+
+    // Optimizes all the meshes of the scene in parallel. Meshes with area lights are skipped,
+    // the lights reference their triangles by index.
+    BAIKAL_API_ENTRY MeshOptimizationStats OptimizeSceneMeshes(Scene1& scene);
+}
@@ -0,0 +1,619 @@
+#include "obj_parser.h"
+#include "Utils/task_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace Baikal
+{
+    namespace
+    {
+        // Large enough to amortize chunk bookkeeping, small enough to balance the workers
+        std::size_t constexpr kChunkSize = 4u << 20;
+
+        enum class LineType
+        {
+            kOther,
+            kPosition,
+            kNormal,
+            kTexcoord,
+            kFace,
+            kShape,
+            kUseMaterial,
+            kMaterialLibrary
+        };
+
+        // Statement changing the state of the faces following it
+        struct Statement
+        {
+            LineType type;
+            // Triangles of the chunk preceding the statement
+            std::size_t triangle;
+            std::string name;
+        };
+
+        struct Counts
+        {
+            std::size_t positions;
+            std::size_t normals;
+            std::size_t texcoords;
+        };
+
+        struct Chunk
+        {
+            char const* begin;
+            char const* end;
+
+            // Filled by the counting pass
+            std::size_t num_lines;
+            Counts num_attributes;
+            std::size_t num_triangles;
+            std::vector<Statement> statements;
+
+            // Totals of the preceding chunks
+            std::size_t first_line;
+            Counts first_attributes;
+            std::size_t first_triangle;
+        };
+
+        bool IsSpace(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        bool IsDigit(char c)
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        char const* SkipSpaces(char const* p, char const* end)
+        {
+            while (p < end && IsSpace(*p))
+            {
+                ++p;
+            }
+            return p;
+        }
+
+        char const* SkipToken(char const* p, char const* end)
+        {
+            while (p < end && !IsSpace(*p))
+            {
+                ++p;
+            }
+            return p;
+        }
+
+        // Invoke func for every line of [begin, end) with trailing comments cut off
+        template <typename Func>
+        void ForEachLine(char const* begin, char const* end, Func func)
+        {
+            while (begin < end)
+            {
+                auto line_end = static_cast<char const*>(std::memchr(begin, '\n', end - begin));
+                if (!line_end)
+                {
+                    line_end = end;
+                }
+
+                auto comment = static_cast<char const*>(std::memchr(begin, '#', line_end - begin));
+                func(begin, comment ? comment : line_end);
+
+                begin = line_end < end ? line_end + 1 : end;
+            }
+        }
+
+        // Classify the line and skip its keyword
+        LineType GetLineType(char const*& p, char const* end)
+        {
+            auto keyword = SkipSpaces(p, end);
+            p = SkipToken(keyword, end);
+
+            auto length = static_cast<std::size_t>(p - keyword);
+            auto is = [keyword, length](char const* name)
+            {
+                return std::strlen(name) == length && std::memcmp(keyword, name, length) == 0;
+            };
+
+            if (length == 0) return LineType::kOther;
+            if (is("v")) return LineType::kPosition;
+            if (is("vn")) return LineType::kNormal;
+            if (is("vt")) return LineType::kTexcoord;
+            if (is("f")) return LineType::kFace;
+            if (is("o") || is("g")) return LineType::kShape;
+            if (is("usemtl")) return LineType::kUseMaterial;
+            if (is("mtllib")) return LineType::kMaterialLibrary;
+            return LineType::kOther;
+        }
+
+        // First token of the rest of the line
+        std::string ParseName(char const* p, char const* end)
+        {
+            p = SkipSpaces(p, end);
+            return std::string(p, SkipToken(p, end));
+        }
+
+        // Decimal with optional fraction and exponent, missing values read as zero as tinyobj does
+        float ParseFloat(char const*& p, char const* end)
+        {
+            p = SkipSpaces(p, end);
+
+            auto negative = false;
+            if (p < end && (*p == '-' || *p == '+'))
+            {
+                negative = *p++ == '-';
+            }
+
+            double mantissa = 0.0;
+            int exponent = 0;
+            while (p < end && IsDigit(*p))
+            {
+                mantissa = mantissa * 10.0 + (*p++ - '0');
+            }
+
+            if (p < end && *p == '.')
+            {
+                ++p;
+                while (p < end && IsDigit(*p))
+                {
+                    mantissa = mantissa * 10.0 + (*p++ - '0');
+                    --exponent;
+                }
+            }
+
+            if (p < end && (*p == 'e' || *p == 'E'))
+            {
+                ++p;
+                auto negative_exponent = false;
+                if (p < end && (*p == '-' || *p == '+'))
+                {
+                    negative_exponent = *p++ == '-';
+                }
+
+                // Clamped, anything beyond is out of float range anyway
+                int value = 0;
+                while (p < end && IsDigit(*p))
+                {
+                    value = std::min(value * 10 + (*p++ - '0'), 1000);
+                }
+
+                exponent += negative_exponent ? -value : value;
+            }
+
+            p = SkipToken(p, end);
+
+            auto value = exponent != 0 ? mantissa * std::pow(10.0, exponent) : mantissa;
+            return static_cast<float>(negative ? -value : value);
+        }
+
+        bool ParseInt(char const*& p, char const* end, std::int64_t& value)
+        {
+            auto negative = false;
+            if (p < end && (*p == '-' || *p == '+'))
+            {
+                negative = *p++ == '-';
+            }
+
+            if (p == end || !IsDigit(*p))
+            {
+                return false;
+            }
+
+            value = 0;
+            while (p < end && IsDigit(*p))
+            {
+                value = std::min<std::int64_t>(value * 10 + (*p++ - '0'), std::numeric_limits<std::int32_t>::max());
+            }
+
+            value = negative ? -value : value;
+            return true;
+        }
+
+        // Indices are one based, negative ones count back from the last attribute before the face
+        std::int32_t ResolveIndex(std::int64_t index, std::size_t count, std::size_t total, std::size_t line)
+        {
+            auto resolved = index > 0 ? index - 1 : static_cast<std::int64_t>(count) + index;
+
+            if (index == 0 || resolved < 0 || resolved >= static_cast<std::int64_t>(total))
+            {
+                throw std::runtime_error("OBJ: invalid face index at line " + std::to_string(line));
+            }
+
+            return static_cast<std::int32_t>(resolved);
+        }
+
+        // v, v/vt, v//vn or v/vt/vn
+        ObjCorner ParseCorner(char const*& p, char const* end, Counts const& counts, Counts const& totals, std::size_t line)
+        {
+            ObjCorner corner = { -1, -1, -1 };
+            std::int64_t index = 0;
+
+            if (!ParseInt(p, end, index))
+            {
+                throw std::runtime_error("OBJ: invalid face index at line " + std::to_string(line));
+            }
+
+            corner.position = ResolveIndex(index, counts.positions, totals.positions, line);
+
+            if (p < end && *p == '/')
+            {
+                ++p;
+                if (ParseInt(p, end, index))
+                {
+                    corner.texcoord = ResolveIndex(index, counts.texcoords, totals.texcoords, line);
+                }
+
+                if (p < end && *p == '/')
+                {
+                    ++p;
+                    if (ParseInt(p, end, index))
+                    {
+                        corner.normal = ResolveIndex(index, counts.normals, totals.normals, line);
+                    }
+                }
+            }
+
+            p = SkipToken(p, end);
+            return corner;
+        }
+
+        // First pass: sizes of the chunk and its statements
+        void CountChunk(Chunk& chunk)
+        {
+            ForEachLine(chunk.begin, chunk.end, [&chunk](char const* p, char const* end)
+            {
+                ++chunk.num_lines;
+
+                auto type = GetLineType(p, end);
+                switch (type)
+                {
+                    case LineType::kPosition:
+                        ++chunk.num_attributes.positions;
+                        break;
+                    case LineType::kNormal:
+                        ++chunk.num_attributes.normals;
+                        break;
+                    case LineType::kTexcoord:
+                        ++chunk.num_attributes.texcoords;
+                        break;
+                    case LineType::kFace:
+                    {
+                        std::size_t num_corners = 0;
+                        for (p = SkipSpaces(p, end); p < end; p = SkipSpaces(SkipToken(p, end), end))
+                        {
+                            ++num_corners;
+                        }
+
+                        chunk.num_triangles += num_corners > 2 ? num_corners - 2 : 0;
+                        break;
+                    }
+                    case LineType::kShape:
+                    case LineType::kUseMaterial:
+                    case LineType::kMaterialLibrary:
+                        chunk.statements.push_back({ type, chunk.num_triangles, ParseName(p, end) });
+                        break;
+                    default:
+                        break;
+                }
+            });
+        }
+
+        // Second pass: write attributes and fan triangulated faces at the chunk offsets
+        void ParseChunk(Chunk const& chunk, Counts const& totals, ObjData& data)
+        {
+            auto counts = chunk.first_attributes;
+            auto corners = data.corners.data() + 3 * chunk.first_triangle;
+            auto line = chunk.first_line;
+
+            ForEachLine(chunk.begin, chunk.end, [&](char const* p, char const* end)
+            {
+                ++line;
+
+                switch (GetLineType(p, end))
+                {
+                    case LineType::kPosition:
+                    {
+                        auto x = ParseFloat(p, end);
+                        auto y = ParseFloat(p, end);
+                        auto z = ParseFloat(p, end);
+                        data.positions[counts.positions++] = RadeonRays::float3(x, y, z, 1.f);
+                        break;
+                    }
+                    case LineType::kNormal:
+                    {
+                        auto x = ParseFloat(p, end);
+                        auto y = ParseFloat(p, end);
+                        auto z = ParseFloat(p, end);
+                        data.normals[counts.normals++] = RadeonRays::float3(x, y, z, 0.f);
+                        break;
+                    }
+                    case LineType::kTexcoord:
+                    {
+                        auto u = ParseFloat(p, end);
+                        auto v = ParseFloat(p, end);
+                        data.texcoords[counts.texcoords++] = RadeonRays::float2(u, v);
+                        break;
+                    }
+                    case LineType::kFace:
+                    {
+                        ObjCorner first = { -1, -1, -1 };
+                        ObjCorner previous = first;
+                        std::size_t num_corners = 0;
+
+                        for (p = SkipSpaces(p, end); p < end; p = SkipSpaces(p, end))
+                        {
+                            auto corner = ParseCorner(p, end, counts, totals, line);
+
+                            if (num_corners == 0)
+                            {
+                                first = corner;
+                            }
+                            else if (num_corners >= 2)
+                            {
+                                *corners++ = first;
+                                *corners++ = previous;
+                                *corners++ = corner;
+                            }
+
+                            previous = corner;
+                            ++num_corners;
+                        }
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            });
+        }
+
+        struct CornerHash
+        {
+            std::size_t operator()(ObjCorner const& corner) const
+            {
+                auto hash = static_cast<std::uint64_t>(static_cast<std::uint32_t>(corner.position)) * 0x9e3779b97f4a7c15ull;
+                hash ^= static_cast<std::uint64_t>(static_cast<std::uint32_t>(corner.normal)) * 0xc2b2ae3d27d4eb4full;
+                hash ^= static_cast<std::uint64_t>(static_cast<std::uint32_t>(corner.texcoord)) * 0x165667b19e3779f9ull;
+                return static_cast<std::size_t>(hash ^ (hash >> 32));
+            }
+        };
+
+        struct CornerEqual
+        {
+            bool operator()(ObjCorner const& lhs, ObjCorner const& rhs) const
+            {
+                return lhs.position == rhs.position && lhs.normal == rhs.normal && lhs.texcoord == rhs.texcoord;
+            }
+        };
+    }
+
+    ObjData ParseObj(char const* data, std::size_t size, TaskScheduler& scheduler)
+    {
+        // Chunks end right after a line break, so no line is split
+        std::vector<Chunk> chunks;
+        auto data_end = data + size;
+        for (auto begin = data; begin < data_end;)
+        {
+            auto end = begin + std::min(kChunkSize, static_cast<std::size_t>(data_end - begin));
+
+            if (end < data_end)
+            {
+                auto line_end = static_cast<char const*>(std::memchr(end, '\n', data_end - end));
+                end = line_end ? line_end + 1 : data_end;
+            }
+
+            Chunk chunk = {};
+            chunk.begin = begin;
+            chunk.end = end;
+            chunks.push_back(std::move(chunk));
+
+            begin = end;
+        }
+
+        scheduler.ParallelFor(chunks.size(), 1, [&chunks](std::size_t begin, std::size_t end)
+        {
+            for (auto i = begin; i < end; ++i)
+            {
+                CountChunk(chunks[i]);
+            }
+        });
+
+        Counts totals = { 0u, 0u, 0u };
+        std::size_t num_lines = 0;
+        std::size_t num_triangles = 0;
+        for (auto& chunk : chunks)
+        {
+            chunk.first_line = num_lines;
+            chunk.first_attributes = totals;
+            chunk.first_triangle = num_triangles;
+
+            num_lines += chunk.num_lines;
+            totals.positions += chunk.num_attributes.positions;
+            totals.normals += chunk.num_attributes.normals;
+            totals.texcoords += chunk.num_attributes.texcoords;
+            num_triangles += chunk.num_triangles;
+        }
+
+        auto max_index = static_cast<std::size_t>(std::numeric_limits<std::int32_t>::max());
+        if (totals.positions > max_index || totals.normals > max_index || totals.texcoords > max_index)
+        {
+            throw std::runtime_error("OBJ: too many vertex attributes");
+        }
+
+        ObjData obj;
+        obj.positions.resize(totals.positions);
+        obj.normals.resize(totals.normals);
+        obj.texcoords.resize(totals.texcoords);
+        obj.corners.resize(3 * num_triangles);
+
+        scheduler.ParallelFor(chunks.size(), 1, [&](std::size_t begin, std::size_t end)
+        {
+            for (auto i = begin; i < end; ++i)
+            {
+                ParseChunk(chunks[i], totals, obj);
+            }
+        });
+
+        // Split the triangles into groups, statements are applied in file order
+        std::map<std::string, std::int32_t> material_indices;
+        std::map<std::int32_t, std::size_t> shape_groups;
+        std::uint32_t shape = 0;
+        std::int32_t material = -1;
+        std::size_t segment_begin = 0;
+
+        obj.shape_names.emplace_back();
+
+        auto flush = [&](std::size_t segment_end)
+        {
+            if (segment_end == segment_begin)
+            {
+                return;
+            }
+
+            auto iter = shape_groups.find(material);
+            if (iter == shape_groups.cend())
+            {
+                iter = shape_groups.emplace(material, obj.groups.size()).first;
+                obj.groups.push_back({ shape, material, {} });
+            }
+
+            auto& triangles = obj.groups[iter->second].triangles;
+            if (!triangles.empty() && triangles.back().second == segment_begin)
+            {
+                triangles.back().second = segment_end;
+            }
+            else
+            {
+                triangles.emplace_back(segment_begin, segment_end);
+            }
+
+            segment_begin = segment_end;
+        };
+
+        for (auto const& chunk : chunks)
+        {
+            for (auto const& statement : chunk.statements)
+            {
+                flush(chunk.first_triangle + statement.triangle);
+
+                switch (statement.type)
+                {
+                    case LineType::kShape:
+                        shape = static_cast<std::uint32_t>(obj.shape_names.size());
+                        obj.shape_names.push_back(statement.name);
+                        shape_groups.clear();
+                        break;
+                    case LineType::kUseMaterial:
+                    {
+                        auto result = material_indices.emplace(statement.name, static_cast<std::int32_t>(obj.material_names.size()));
+                        if (result.second)
+                        {
+                            obj.material_names.push_back(statement.name);
+                        }
+                        material = result.first->second;
+                        break;
+                    }
+                    case LineType::kMaterialLibrary:
+                        obj.material_libraries.push_back(statement.name);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        flush(num_triangles);
+
+        return obj;
+    }
+
+    ObjMeshData BuildObjMesh(ObjData const& data, ObjData::Group const& group)
+    {
+        std::size_t num_triangles = 0;
+        for (auto const& range : group.triangles)
+        {
+            num_triangles += range.second - range.first;
+        }
+
+        ObjMeshData mesh;
+        mesh.indices.resize(3 * num_triangles);
+
+        // Unique corners in order of the first use
+        std::vector<ObjCorner> vertex_corners;
+        std::unordered_map<ObjCorner, std::uint32_t, CornerHash, CornerEqual> vertex_indices;
+        vertex_indices.reserve(num_triangles);
+
+        auto index = mesh.indices.begin();
+        for (auto const& range : group.triangles)
+        {
+            for (auto c = 3 * range.first; c < 3 * range.second; ++c)
+            {
+                auto result = vertex_indices.emplace(data.corners[c], static_cast<std::uint32_t>(vertex_corners.size()));
+                if (result.second)
+                {
+                    vertex_corners.push_back(data.corners[c]);
+                }
+
+                *index++ = result.first->second;
+            }
+        }
+
+        auto num_vertices = vertex_corners.size();
+        mesh.vertices.resize(num_vertices);
+        mesh.normals.resize(num_vertices);
+        mesh.uvs.resize(num_vertices);
+
+        auto missing_normals = false;
+        for (std::size_t i = 0; i < num_vertices; ++i)
+        {
+            auto const& corner = vertex_corners[i];
+            mesh.vertices[i] = data.positions[corner.position];
+            mesh.normals[i] = corner.normal >= 0 ? data.normals[corner.normal] : RadeonRays::float3(0.f, 0.f, 0.f, 0.f);
+            mesh.uvs[i] = corner.texcoord >= 0 ? data.texcoords[corner.texcoord] : RadeonRays::float2(0.f, 0.f);
+            missing_normals = missing_normals || corner.normal < 0;
+        }
+
+        if (missing_normals)
+        {
+            // Cross product length is twice the triangle area, so the sums are area weighted
+            for (std::size_t t = 0; t < num_triangles; ++t)
+            {
+                auto i0 = mesh.indices[3 * t];
+                auto i1 = mesh.indices[3 * t + 1];
+                auto i2 = mesh.indices[3 * t + 2];
+
+                auto e1 = mesh.vertices[i1] - mesh.vertices[i0];
+                auto e2 = mesh.vertices[i2] - mesh.vertices[i0];
+                auto normal = RadeonRays::float3(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x, 0.f);
+
+                for (auto i : { i0, i1, i2 })
+                {
+                    if (vertex_corners[i].normal < 0)
+                    {
+                        mesh.normals[i] += normal;
+                    }
+                }
+            }
+
+            for (std::size_t i = 0; i < num_vertices; ++i)
+            {
+                if (vertex_corners[i].normal >= 0)
+                {
+                    continue;
+                }
+
+                auto const& normal = mesh.normals[i];
+                auto length = std::sqrt(normal.sqnorm());
+                mesh.normals[i] = length > 0.f ?
+                    RadeonRays::float3(normal.x / length, normal.y / length, normal.z / length, 0.f) :
+                    RadeonRays::float3(0.f, 1.f, 0.f, 0.f);
+            }
+        }
+
+        return mesh;
+    }
+}
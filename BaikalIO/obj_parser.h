@@ -0,0 +1,83 @@
+#pragma once
+
+#include "math/float2.h"
+#include "math/float3.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef WIN32
+#ifdef BAIKAL_EXPORT_API
+#define BAIKAL_API_ENTRY __declspec(dllexport)
+#else
+#define BAIKAL_API_ENTRY __declspec(dllimport)
+#endif
+#else
+#define BAIKAL_API_ENTRY __attribute__((visibility ("default")))
+#endif
+
+namespace Baikal
+{
+    class TaskScheduler;
+
+    // Attribute indices of a face corner, -1 if the corner has no such attribute
+    struct ObjCorner
+    {
+        std::int32_t position;
+        std::int32_t texcoord;
+        std::int32_t normal;
+    };
+
+    ///< Geometry of an OBJ file with faces triangulated as fans.
+    ///< Attributes are kept in file order, corners reference them by index.
+    ///<
+    struct ObjData
+    {
+        // Triangles of a shape using the same material, in file order
+        struct Group
+        {
+            // Index of the shape started by the last 'o' or 'g', 0 before the first one
+            std::uint32_t shape;
+            // Index of the usemtl name, -1 before the first usemtl
+            std::int32_t material;
+            // [begin, end) ranges of triangles
+            std::vector<std::pair<std::size_t, std::size_t>> triangles;
+        };
+
+        // Positions have w = 1, normals w = 0
+        std::vector<RadeonRays::float3> positions;
+        std::vector<RadeonRays::float3> normals;
+        std::vector<RadeonRays::float2> texcoords;
+        // Three corners per triangle
+        std::vector<ObjCorner> corners;
+
+        std::vector<std::string> shape_names;
+        // Names referenced by usemtl
+        std::vector<std::string> material_names;
+        // Files referenced by mtllib
+        std::vector<std::string> material_libraries;
+        // Groups of a shape follow in order of the first material use
+        std::vector<Group> groups;
+    };
+
+    // Mesh buffers of a group, ready to be moved into Mesh
+    struct ObjMeshData
+    {
+        std::vector<RadeonRays::float3> vertices;
+        std::vector<RadeonRays::float3> normals;
+        std::vector<RadeonRays::float2> uvs;
+        std::vector<std::uint32_t> indices;
+    };
+
+    // Parse OBJ text in chunks of lines. The first pass counts attributes and triangles of every chunk,
+    // so the second one writes them into the final arrays in parallel. Throws on invalid face indices.
+    BAIKAL_API_ENTRY ObjData ParseObj(char const* data, std::size_t size, TaskScheduler& scheduler);
+
+    // Build the mesh of a group, corners with the same attribute indices share a vertex.
+    // Corners without a normal get the area weighted normal of adjacent faces, missing texcoords are zero.
+    // Groups are independent, so they can be built in parallel.
+    BAIKAL_API_ENTRY ObjMeshData BuildObjMesh(ObjData const& data, ObjData::Group const& group);
+}
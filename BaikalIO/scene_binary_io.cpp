@@ -1,243 +1,1180 @@
 #include "scene_binary_io.h"
+#include "mapped_file.h"
 #include "SceneGraph/scene1.h"
 #include "SceneGraph/iterator.h"
 #include "SceneGraph/shape.h"
 #include "SceneGraph/material.h"
 #include "SceneGraph/light.h"
 #include "SceneGraph/texture.h"
+#include "SceneGraph/inputmaps.h"
 #include "SceneGraph/uberv2material.h"
-#include "image_io.h"
-#include "math/mathutils.h"
 #include "Utils/log.h"
 
+#include <array>
+#include <cstring>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
 
 namespace Baikal
 {
     // Create static object to register loader. This object will be used as loader
     static SceneBinaryIo scene_binary_io_loader;
 
-    Scene1::Ptr SceneBinaryIo::LoadScene(std::string const& filename, std::string const& basepath) const
+    namespace
     {
-        auto scene = Scene1::Create();
-        auto image_io(ImageIo::CreateImageIo());
+        char const kMagic[8] = { 'B', 'K', 'S', 'C', 'E', 'N', 'E', '\0' };
+        std::uint32_t constexpr kFormatVersion = 1u;
+        std::size_t constexpr kAlignment = 64u;
+        // Index of a missing record
+        std::uint32_t constexpr kNone = 0xffffffffu;
 
-        std::map<std::string, Material*> mats;
+        enum class SectionType : std::uint32_t
+        {
+            kStrings = 1,
+            kVertices,
+            kNormals,
+            kUVs,
+            kIndices,
+            kMeshes,
+            kInstances,
+            kTextures,
+            kTextureData,
+            kInputMaps,
+            kMaterialInputs,
+            kMaterials,
+            kLights
+        };
 
-        struct less
+        struct FileHeader
         {
-            bool operator ()(RadeonRays::float3 const& v1, RadeonRays::float3 const& v2) const {
-                return v1.x < v2.x;
-            }
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t num_sections;
+            std::uint64_t sections_offset;
+            std::uint64_t file_size;
+            std::uint64_t reserved[4];
         };
 
-        std::map<RadeonRays::float3, Material::Ptr, less> c2mats;
+        struct Section
+        {
+            SectionType type;
+            // Record size, catches layout changes made without a version bump
+            std::uint32_t element_size;
+            std::uint64_t offset;
+            std::uint64_t count;
+            std::uint64_t reserved;
+        };
 
-        std::string full_path = filename;
+        struct StringRef
+        {
+            std::uint32_t offset;
+            std::uint32_t length;
+        };
 
-        std::ifstream in(full_path, std::ios::binary | std::ios::in);
+        enum ShapeFlags : std::uint32_t
+        {
+            kShapeMotion = 0x1,
+            // Base mesh of instances which is not attached to the scene itself
+            kShapeDetached = 0x2
+        };
 
-        if (!in)
+        struct ShapeRecord
         {
-            throw std::runtime_error("Cannot open file for reading");
+            float transform[4][4];
+            float motion_transform[4][4];
+            StringRef name;
+            std::uint32_t material;
+            std::uint32_t flags;
+            std::uint32_t visibility_mask;
+            std::uint32_t light_link_mask;
+            std::uint32_t group_id;
+            std::uint32_t reserved;
+        };
+
+        // Ranges of the vertex, normal, uv and index sections
+        struct MeshRecord
+        {
+            ShapeRecord shape;
+            std::uint64_t first_vertex;
+            std::uint64_t num_vertices;
+            std::uint64_t first_normal;
+            std::uint64_t num_normals;
+            std::uint64_t first_uv;
+            std::uint64_t num_uvs;
+            std::uint64_t first_index;
+            std::uint64_t num_indices;
+        };
+
+        // Shapes are indexed as meshes followed by instances
+        struct InstanceRecord
+        {
+            ShapeRecord shape;
+            std::uint32_t base_shape;
+            std::uint32_t reserved;
+        };
+
+        // Data range is relative to the texture data section and 64 byte aligned
+        struct TextureRecord
+        {
+            StringRef name;
+            std::uint32_t format;
+            std::int32_t size[3];
+            std::uint64_t data_offset;
+            std::uint64_t data_size;
+        };
+
+        // Inputs always reference preceding input maps
+        struct InputMapRecord
+        {
+            StringRef name;
+            std::uint32_t type;
+            std::uint32_t inputs[3];
+            std::uint32_t texture;
+            // Selection or shuffle mask
+            std::uint32_t params[4];
+            // Constant value or matrix
+            float values[16];
+        };
+
+        struct MaterialInputRecord
+        {
+            StringRef name;
+            std::uint32_t input_map;
+            std::uint32_t reserved;
+        };
+
+        enum MaterialFlags : std::uint32_t
+        {
+            kMaterialThin = 0x1,
+            kMaterialDoubleSided = 0x2,
+            kMaterialLinkRefractionIor = 0x4,
+            kMaterialMultiscatter = 0x8,
+            kMaterialSSSDiffusion = 0x10
+        };
+
+        // Inputs are a range of the material input section
+        struct MaterialRecord
+        {
+            StringRef name;
+            std::uint32_t flags;
+            std::uint32_t layers;
+            std::uint32_t first_input;
+            std::uint32_t num_inputs;
+        };
+
+        enum class LightType : std::uint32_t
+        {
+            kPoint = 0,
+            kDirectional,
+            kSpot,
+            kImageBased,
+            kArea
+        };
+
+        enum class LightTexture : std::uint32_t
+        {
+            kIllumination = 0,
+            kReflection,
+            kRefraction,
+            kTransparency,
+            kBackground,
+            kCount
+        };
+
+        struct LightRecord
+        {
+            LightType type;
+            std::uint32_t link_mask;
+            StringRef name;
+            float position[4];
+            float direction[4];
+            float radiance[4];
+            float cone_shape[2];
+            float multiplier;
+            std::uint32_t mirror_x;
+            std::uint32_t textures[static_cast<std::size_t>(LightTexture::kCount)];
+            // Parent shape and primitive of area lights
+            std::uint32_t shape;
+            std::uint64_t primitive;
+        };
+
+        static_assert(sizeof(FileHeader) == kAlignment, "File header takes exactly one alignment unit");
+        static_assert(kAlignment % sizeof(Section) == 0, "Section table should not break the alignment");
+        static_assert(std::is_trivially_copyable<MeshRecord>::value &&
+                      std::is_trivially_copyable<InstanceRecord>::value &&
+                      std::is_trivially_copyable<TextureRecord>::value &&
+                      std::is_trivially_copyable<InputMapRecord>::value &&
+                      std::is_trivially_copyable<MaterialRecord>::value &&
+                      std::is_trivially_copyable<LightRecord>::value, "Records are stored as is");
+
+        std::uint64_t Align(std::uint64_t value)
+        {
+            return (value + kAlignment - 1) & ~static_cast<std::uint64_t>(kAlignment - 1);
+        }
+
+        // Matrices are stored as 16 floats, vectors as 4 floats
+        void FromMatrix(RadeonRays::matrix const& m, float* values)
+        {
+            std::memcpy(values, &m.m[0][0], 16 * sizeof(float));
         }
 
-        std::uint32_t num_meshes = 0;
-        in.read((char*)&num_meshes, sizeof(std::uint32_t));
+        RadeonRays::matrix ToMatrix(float const* values)
+        {
+            RadeonRays::matrix m;
+            std::memcpy(&m.m[0][0], values, 16 * sizeof(float));
+            return m;
+        }
 
-        LogInfo("Number of objects: ", num_meshes, "\n");
+        void FromFloat3(RadeonRays::float3 const& v, float* values)
+        {
+            values[0] = v.x; values[1] = v.y; values[2] = v.z; values[3] = v.w;
+        }
+
+        RadeonRays::float3 ToFloat3(float const* values)
+        {
+            return RadeonRays::float3(values[0], values[1], values[2], values[3]);
+        }
 
-        for (auto i = 0U; i < num_meshes; ++i)
+        template <typename T>
+        struct SectionView
         {
-            auto mesh = Mesh::Create();
+            T const* data = nullptr;
+            std::size_t count = 0u;
+
+            T const& At(std::uint64_t index) const
+            {
+                if (index >= count)
+                {
+                    throw std::runtime_error("Binary scene: record index out of range");
+                }
+
+                return data[index];
+            }
+
+            // Check the range before copying it
+            T const* Range(std::uint64_t first, std::uint64_t num) const
+            {
+                if (first > count || num > count - first)
+                {
+                    throw std::runtime_error("Binary scene: data range out of section");
+                }
+
+                return data + first;
+            }
+        };
 
-            std::uint32_t num_indices = 0;
-            in.read((char*)&num_indices, sizeof(std::uint32_t));
+        ///< Validated header and section table of a mapped file
+        class SectionTable
+        {
+        public:
+            explicit SectionTable(MappedFile const& file)
+                : m_data(file.GetData())
+                , m_size(file.GetSize())
+            {
+                if (m_size < sizeof(FileHeader))
+                {
+                    throw std::runtime_error("Binary scene: file is too small");
+                }
 
-            std::uint32_t num_vertices = 0;
-            in.read((char*)&num_vertices, sizeof(std::uint32_t));
+                FileHeader header;
+                std::memcpy(&header, m_data, sizeof(header));
 
+                if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+                {
+                    throw std::runtime_error("Binary scene: not a Baikal binary scene");
+                }
 
-            std::uint32_t num_normals = 0;
-            in.read((char*)&num_normals, sizeof(std::uint32_t));
+                if (header.version != kFormatVersion)
+                {
+                    throw std::runtime_error("Binary scene: version mismatch, expected " + std::to_string(kFormatVersion) +
+                                             " got " + std::to_string(header.version));
+                }
 
+                if (header.file_size != m_size ||
+                    header.sections_offset > m_size ||
+                    header.num_sections > (m_size - header.sections_offset) / sizeof(Section))
+                {
+                    throw std::runtime_error("Binary scene: file is truncated");
+                }
 
-            std::uint32_t num_uvs = 0;
-            in.read((char*)&num_uvs, sizeof(std::uint32_t));
+                m_sections.resize(header.num_sections);
+                std::memcpy(m_sections.data(), m_data + header.sections_offset, header.num_sections * sizeof(Section));
+            }
 
+            // Missing sections are empty
+            template <typename T>
+            SectionView<T> Get(SectionType type) const
             {
-                std::vector<std::uint32_t> indices(num_indices);
-                in.read((char*)&indices[0], num_indices * sizeof(std::uint32_t));
+                SectionView<T> view;
+
+                for (auto const& section : m_sections)
+                {
+                    if (section.type != type)
+                    {
+                        continue;
+                    }
+
+                    if (section.element_size != sizeof(T))
+                    {
+                        throw std::runtime_error("Binary scene: unexpected record size");
+                    }
+
+                    if (section.offset % kAlignment != 0 ||
+                        section.offset > m_size ||
+                        section.count > (m_size - section.offset) / sizeof(T))
+                    {
+                        throw std::runtime_error("Binary scene: invalid section");
+                    }
+
+                    view.data = reinterpret_cast<T const*>(m_data + section.offset);
+                    view.count = static_cast<std::size_t>(section.count);
+                    break;
+                }
+
+                return view;
+            }
+
+        private:
+            char const* m_data;
+            std::size_t m_size;
+            std::vector<Section> m_sections;
+        };
 
-                mesh->SetIndices(&indices[0], num_indices);
+        ///< Collects section contents as chunks referencing scene data, so nothing is copied before writing
+        class SectionWriter
+        {
+        public:
+            // Start a new section, following chunks are appended to it
+            void Begin(SectionType type, std::uint32_t element_size)
+            {
+                m_sections.push_back({ type, element_size, 0u, 0u, 0u });
+                m_chunks.emplace_back();
             }
 
+            // Append count elements of the current section
+            void Append(void const* data, std::uint64_t count)
             {
-                std::vector<RadeonRays::float3> vertices(num_vertices);
-                in.read((char*)&vertices[0], num_vertices * sizeof(RadeonRays::float3));
+                auto& section = m_sections.back();
+
+                if (count > 0)
+                {
+                    m_chunks.back().emplace_back(static_cast<char const*>(data), count * section.element_size);
+                }
 
-                mesh->SetVertices(&vertices[0], num_vertices);
+                section.count += count;
             }
 
+            template <typename T>
+            void Add(SectionType type, std::vector<T> const& records)
             {
-                std::vector<RadeonRays::float3> normals(num_normals);
-                in.read((char*)&normals[0], num_normals * sizeof(RadeonRays::float3));
+                Begin(type, sizeof(T));
+                Append(records.data(), records.size());
+            }
+
+            void Write(std::ostream& out) const
+            {
+                FileHeader header = {};
+                std::memcpy(header.magic, kMagic, sizeof(kMagic));
+                header.version = kFormatVersion;
+                header.num_sections = static_cast<std::uint32_t>(m_sections.size());
+                header.sections_offset = sizeof(FileHeader);
+
+                auto sections = m_sections;
+                auto offset = Align(header.sections_offset + sections.size() * sizeof(Section));
+
+                for (auto& section : sections)
+                {
+                    section.offset = offset;
+                    offset = Align(offset + section.count * section.element_size);
+                }
+
+                header.file_size = offset;
+
+                out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+                out.write(reinterpret_cast<char const*>(sections.data()), sections.size() * sizeof(Section));
+
+                std::uint64_t position = sizeof(header) + sections.size() * sizeof(Section);
+                for (std::size_t i = 0; i < sections.size(); ++i)
+                {
+                    Pad(out, sections[i].offset - position);
+                    position = sections[i].offset;
 
-                mesh->SetNormals(&normals[0], num_normals);
+                    for (auto const& chunk : m_chunks[i])
+                    {
+                        out.write(chunk.first, chunk.second);
+                        position += chunk.second;
+                    }
+                }
+
+                Pad(out, header.file_size - position);
             }
 
+        private:
+            static void Pad(std::ostream& out, std::uint64_t size)
             {
-                std::vector<RadeonRays::float2> uvs(num_uvs);
-                in.read((char*)&uvs[0], num_uvs * sizeof(RadeonRays::float2));
+                char const zeros[kAlignment] = {};
+                out.write(zeros, size);
+            }
 
-                mesh->SetUVs(&uvs[0], num_uvs);
+            std::vector<Section> m_sections;
+            std::vector<std::vector<std::pair<char const*, std::size_t>>> m_chunks;
+        };
+
+        ///< Flattens scene objects into records, shared objects are stored once
+        class SceneFlattener
+        {
+        public:
+            StringRef AddString(std::string const& str)
+            {
+                StringRef ref = { static_cast<std::uint32_t>(m_strings.size()), static_cast<std::uint32_t>(str.size()) };
+                m_strings.insert(m_strings.end(), str.cbegin(), str.cend());
+                return ref;
             }
 
+            std::uint32_t AddTexture(Texture::Ptr texture)
+            {
+                if (!texture)
+                {
+                    return kNone;
+                }
+
+                auto iter = m_texture_indices.find(texture.get());
+                if (iter != m_texture_indices.cend())
+                {
+                    return iter->second;
+                }
 
+                auto index = kNone;
+                if (std::dynamic_pointer_cast<UdimTexture>(texture))
+                {
+                    LogInfo("Binary scene: UDIM textures are not supported, ", texture->GetName(), " is skipped\n");
+                }
+                else if (texture->GetData())
+                {
+                    auto size = texture->GetSize();
+                    TextureRecord record = {};
+                    record.name = AddString(texture->GetName());
+                    record.format = static_cast<std::uint32_t>(texture->GetFormat());
+                    record.size[0] = size.x;
+                    record.size[1] = size.y;
+                    record.size[2] = size.z;
+                    record.data_offset = m_texture_data_size;
+                    record.data_size = texture->GetSizeInBytes();
+
+                    m_texture_data_size = Align(m_texture_data_size + record.data_size);
+                    index = static_cast<std::uint32_t>(m_textures.size());
+                    m_textures.push_back(record);
+                    m_texture_data.push_back(texture);
+                }
+
+                m_texture_indices[texture.get()] = index;
+                return index;
+            }
+
+            std::uint32_t AddInputMap(InputMap::Ptr input_map)
             {
-                std::uint32_t flag = 0;
-                in.read(reinterpret_cast<char*>(&flag), sizeof(flag));
+                if (!input_map)
+                {
+                    return kNone;
+                }
 
-                if (!flag)
+                auto iter = m_input_map_indices.find(input_map.get());
+                if (iter != m_input_map_indices.cend())
                 {
-                    RadeonRays::float3 albedo;
-                    in.read(reinterpret_cast<char*>(&albedo.x), sizeof(RadeonRays::float3));
+                    return iter->second;
+                }
+
+                InputMapRecord record = {};
+                record.type = static_cast<std::uint32_t>(input_map->m_type);
+                record.inputs[0] = record.inputs[1] = record.inputs[2] = kNone;
+                record.texture = kNone;
+
+                // Inputs go first so loading is a single forward pass
+                std::vector<InputMap::Ptr> inputs;
+                input_map->GetInputs(inputs);
 
-                    /*auto iter = c2mats.find(albedo);
+                if (inputs.size() > 3)
+                {
+                    throw std::runtime_error("Binary scene: unsupported input map");
+                }
+
+                for (std::size_t i = 0; i < inputs.size(); ++i)
+                {
+                    record.inputs[i] = AddInputMap(inputs[i]);
+                }
 
-                    if (iter != c2mats.cend())
+                switch (input_map->m_type)
+                {
+                    case InputMap::InputMapType::kConstantFloat3:
+                        FromFloat3(std::static_pointer_cast<InputMap_ConstantFloat3>(input_map)->GetValue(), record.values);
+                        break;
+                    case InputMap::InputMapType::kConstantFloat:
+                        record.values[0] = std::static_pointer_cast<InputMap_ConstantFloat>(input_map)->GetValue();
+                        break;
+                    case InputMap::InputMapType::kSampler:
+                    case InputMap::InputMapType::kSamplerBumpmap:
+                        record.texture = AddTexture(std::static_pointer_cast<InputMap_Sampler>(input_map)->GetTexture());
+                        break;
+                    case InputMap::InputMapType::kSelect:
+                        record.params[0] = static_cast<std::uint32_t>(std::static_pointer_cast<InputMap_Select>(input_map)->GetSelection());
+                        break;
+                    case InputMap::InputMapType::kShuffle:
                     {
-                        material = iter->second;
+                        auto mask = std::static_pointer_cast<InputMap_Shuffle>(input_map)->GetMask();
+                        std::copy(mask.cbegin(), mask.cend(), record.params);
+                        break;
                     }
-                    else
+                    case InputMap::InputMapType::kShuffle2:
                     {
-                        material = new SingleBxdf(SingleBxdf::BxdfType::kLambert);
-                        material->SetInputValue("albedo", albedo);
-                        c2mats[albedo] = material;
-                        scene->AttachAutoreleaseObject(material);
-                    }*/
+                        auto mask = std::static_pointer_cast<InputMap_Shuffle2>(input_map)->GetMask();
+                        std::copy(mask.cbegin(), mask.cend(), record.params);
+                        break;
+                    }
+                    case InputMap::InputMapType::kMatMul:
+                        FromMatrix(std::static_pointer_cast<InputMap_MatMul>(input_map)->GetMatrix(), record.values);
+                        break;
+                    default:
+                        break;
+                }
+
+                // Name is added after the inputs to keep string order stable, it doesn't matter for loading
+                record.name = AddString(input_map->GetName());
+
+                auto index = static_cast<std::uint32_t>(m_input_maps.size());
+                m_input_maps.push_back(record);
+                m_input_map_indices[input_map.get()] = index;
+                return index;
+            }
+
+            std::uint32_t AddMaterial(Material::Ptr material)
+            {
+                if (!material)
+                {
+                    return kNone;
+                }
+
+                auto iter = m_material_indices.find(material.get());
+                if (iter != m_material_indices.cend())
+                {
+                    return iter->second;
+                }
+
+                auto index = kNone;
+                auto uberv2_material = std::dynamic_pointer_cast<UberV2Material>(material);
+
+                if (!uberv2_material)
+                {
+                    LogInfo("Binary scene: only UberV2 materials are supported, ", material->GetName(), " is skipped\n");
                 }
                 else
                 {
-                    std::uint32_t size = 0;
-                    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+                    MaterialRecord record = {};
+                    record.name = AddString(material->GetName());
+                    record.flags = (material->IsThin() ? kMaterialThin : 0u) |
+                        (uberv2_material->isDoubleSided() ? kMaterialDoubleSided : 0u) |
+                        (uberv2_material->IsLinkRefractionIOR() ? kMaterialLinkRefractionIor : 0u) |
+                        (uberv2_material->IsMultiscatter() ? kMaterialMultiscatter : 0u) |
+                        (uberv2_material->GetSSSMode() == UberV2Material::kSSSDiffusion ? kMaterialSSSDiffusion : 0u);
+                    record.layers = uberv2_material->GetLayers();
+                    record.first_input = static_cast<std::uint32_t>(m_material_inputs.size());
+
+                    for (std::size_t i = 0; i < material->GetNumInputs(); ++i)
+                    {
+                        auto input = material->GetInput(i);
+
+                        if (!material->IsActive(input) ||
+                            input.value.type != Material::InputType::kInputMap ||
+                            !input.value.input_map_value)
+                        {
+                            continue;
+                        }
+
+                        MaterialInputRecord input_record = {};
+                        input_record.input_map = AddInputMap(input.value.input_map_value);
+                        input_record.name = AddString(input.info.name);
+                        m_material_inputs.push_back(input_record);
+                    }
+
+                    record.num_inputs = static_cast<std::uint32_t>(m_material_inputs.size()) - record.first_input;
+                    index = static_cast<std::uint32_t>(m_materials.size());
+                    m_materials.push_back(record);
+                }
 
-                    std::vector<char> buff(size);
-                    in.read(&buff[0], sizeof(char) * size);
+                m_material_indices[material.get()] = index;
+                return index;
+            }
 
-                    //std::string name(buff.cbegin(), buff.cend());
+            ShapeRecord MakeShapeRecord(Shape const& shape, bool detached)
+            {
+                ShapeRecord record = {};
+                FromMatrix(shape.GetTransform(), &record.transform[0][0]);
+                FromMatrix(shape.GetMotionTransform(), &record.motion_transform[0][0]);
+                record.name = AddString(shape.GetName());
+                record.material = AddMaterial(shape.GetMaterial());
+                record.flags = (shape.HasMotion() ? kShapeMotion : 0u) |
+                    (detached ? kShapeDetached : 0u);
+                record.visibility_mask = shape.GetVisibilityMask();
+                record.light_link_mask = shape.GetLightLinkMask();
+                record.group_id = shape.GetGroupId();
+                return record;
+            }
 
-                    //auto iter = mats.find(name);
+            bool HasShape(Shape const* shape) const
+            {
+                return m_shape_indices.find(shape) != m_shape_indices.cend();
+            }
 
-                    //if (iter != mats.cend())
-                    //{
-                    //    material = iter->second;
-                    //}
-                    //else
-                    //{
-                    //    LogInfo("Loading texture ", name, "\n");
-                    //    auto texture = image_io->LoadImage(basepath + name);
-                    //    //material = new SingleBxdf(SingleBxdf::BxdfType::kLambert);
-                    //    //material->SetInputValue("albedo", texture);
-                    //    //mats[name] = material;
-                    //    //scene->AttachAutoreleaseObject(texture);
-                    //    //scene->AttachAutoreleaseObject(material);
-                    //}
+            void AddMesh(Mesh::Ptr mesh, bool detached)
+            {
+                m_shape_indices[mesh.get()] = static_cast<std::uint32_t>(m_meshes.size());
+
+                MeshRecord record = {};
+                record.shape = MakeShapeRecord(*mesh, detached);
+                record.first_vertex = m_num_vertices;
+                record.num_vertices = mesh->GetNumVertices();
+                record.first_normal = m_num_normals;
+                record.num_normals = mesh->GetNumNormals();
+                record.first_uv = m_num_uvs;
+                record.num_uvs = mesh->GetNumUVs();
+                record.first_index = m_num_indices;
+                record.num_indices = mesh->GetNumIndices();
+
+                m_num_vertices += record.num_vertices;
+                m_num_normals += record.num_normals;
+                m_num_uvs += record.num_uvs;
+                m_num_indices += record.num_indices;
+
+                m_meshes.push_back(record);
+                m_mesh_data.push_back(mesh);
+            }
 
+            // All meshes have to be added before the first instance
+            void AddInstance(Instance::Ptr instance)
+            {
+                auto base = m_shape_indices.find(instance->GetBaseShape().get());
+                if (base == m_shape_indices.cend() || base->second >= m_meshes.size())
+                {
+                    LogInfo("Binary scene: only instances of meshes are supported, ", instance->GetName(), " is skipped\n");
+                    return;
+                }
+
+                m_shape_indices[instance.get()] = static_cast<std::uint32_t>(m_meshes.size() + m_instances.size());
+
+                InstanceRecord record = {};
+                record.shape = MakeShapeRecord(*instance, false);
+                record.base_shape = base->second;
+                m_instances.push_back(record);
+            }
+
+            void AddLight(Light::Ptr light)
+            {
+                LightRecord record = {};
+                record.link_mask = light->GetLinkMask();
+                record.name = AddString(light->GetName());
+                FromFloat3(light->GetPosition(), record.position);
+                FromFloat3(light->GetDirection(), record.direction);
+                FromFloat3(light->GetEmittedRadiance(), record.radiance);
+                std::fill(std::begin(record.textures), std::end(record.textures), kNone);
+                record.shape = kNone;
+
+                if (std::dynamic_pointer_cast<PointLight>(light))
+                {
+                    record.type = LightType::kPoint;
+                }
+                else if (std::dynamic_pointer_cast<DirectionalLight>(light))
+                {
+                    record.type = LightType::kDirectional;
                 }
+                else if (auto spot = std::dynamic_pointer_cast<SpotLight>(light))
+                {
+                    record.type = LightType::kSpot;
+                    auto cone_shape = spot->GetConeShape();
+                    record.cone_shape[0] = cone_shape.x;
+                    record.cone_shape[1] = cone_shape.y;
+                }
+                else if (auto ibl = std::dynamic_pointer_cast<ImageBasedLight>(light))
+                {
+                    record.type = LightType::kImageBased;
+                    record.multiplier = ibl->GetMultiplier();
+                    record.mirror_x = ibl->GetMirrorX() ? 1u : 0u;
+                    record.textures[static_cast<std::size_t>(LightTexture::kIllumination)] = AddTexture(ibl->GetTexture());
+                    record.textures[static_cast<std::size_t>(LightTexture::kReflection)] = AddTexture(ibl->GetReflectionTexture());
+                    record.textures[static_cast<std::size_t>(LightTexture::kRefraction)] = AddTexture(ibl->GetRefractionTexture());
+                    record.textures[static_cast<std::size_t>(LightTexture::kTransparency)] = AddTexture(ibl->GetTransparencyTexture());
+                    record.textures[static_cast<std::size_t>(LightTexture::kBackground)] = AddTexture(ibl->GetBackgroundTexture());
+                }
+                else if (auto area = std::dynamic_pointer_cast<AreaLight>(light))
+                {
+                    auto shape = m_shape_indices.find(area->GetShape().get());
+                    if (shape == m_shape_indices.cend())
+                    {
+                        LogInfo("Binary scene: area light of a shape out of the scene is skipped\n");
+                        return;
+                    }
+
+                    record.type = LightType::kArea;
+                    record.shape = shape->second;
+                    record.primitive = area->GetPrimitiveIdx();
+                }
+                else
+                {
+                    LogInfo("Binary scene: unsupported light type, ", light->GetName(), " is skipped\n");
+                    return;
+                }
+
+                m_lights.push_back(record);
+            }
+
+            void Write(std::ostream& out) const
+            {
+                SectionWriter writer;
+                writer.Add(SectionType::kStrings, m_strings);
+
+                writer.Begin(SectionType::kVertices, sizeof(RadeonRays::float3));
+                for (auto const& mesh : m_mesh_data)
+                {
+                    writer.Append(mesh->GetVertices(), mesh->GetNumVertices());
+                }
+
+                writer.Begin(SectionType::kNormals, sizeof(RadeonRays::float3));
+                for (auto const& mesh : m_mesh_data)
+                {
+                    writer.Append(mesh->GetNormals(), mesh->GetNumNormals());
+                }
+
+                writer.Begin(SectionType::kUVs, sizeof(RadeonRays::float2));
+                for (auto const& mesh : m_mesh_data)
+                {
+                    writer.Append(mesh->GetUVs(), mesh->GetNumUVs());
+                }
+
+                writer.Begin(SectionType::kIndices, sizeof(std::uint32_t));
+                for (auto const& mesh : m_mesh_data)
+                {
+                    writer.Append(mesh->GetIndices(), mesh->GetNumIndices());
+                }
+
+                writer.Add(SectionType::kMeshes, m_meshes);
+                writer.Add(SectionType::kInstances, m_instances);
+                writer.Add(SectionType::kTextures, m_textures);
+
+                // Every texture starts at an aligned offset, padding is taken from a zero block
+                static char const zeros[kAlignment] = {};
+                writer.Begin(SectionType::kTextureData, 1u);
+                for (std::size_t i = 0; i < m_textures.size(); ++i)
+                {
+                    auto const& record = m_textures[i];
+                    writer.Append(m_texture_data[i]->GetData(), record.data_size);
+                    writer.Append(zeros, Align(record.data_size) - record.data_size);
+                }
+
+                writer.Add(SectionType::kInputMaps, m_input_maps);
+                writer.Add(SectionType::kMaterialInputs, m_material_inputs);
+                writer.Add(SectionType::kMaterials, m_materials);
+                writer.Add(SectionType::kLights, m_lights);
 
-                mesh->SetMaterial(nullptr);
+                writer.Write(out);
             }
 
-            scene->AttachShape(mesh);
+        private:
+            std::vector<char> m_strings;
+
+            std::vector<MeshRecord> m_meshes;
+            std::vector<Mesh::Ptr> m_mesh_data;
+            std::vector<InstanceRecord> m_instances;
+            std::map<Shape const*, std::uint32_t> m_shape_indices;
+            std::uint64_t m_num_vertices = 0u;
+            std::uint64_t m_num_normals = 0u;
+            std::uint64_t m_num_uvs = 0u;
+            std::uint64_t m_num_indices = 0u;
+
+            std::vector<TextureRecord> m_textures;
+            std::vector<Texture::Ptr> m_texture_data;
+            std::map<Texture const*, std::uint32_t> m_texture_indices;
+            std::uint64_t m_texture_data_size = 0u;
+
+            std::vector<InputMapRecord> m_input_maps;
+            std::map<InputMap const*, std::uint32_t> m_input_map_indices;
+
+            std::vector<MaterialInputRecord> m_material_inputs;
+            std::vector<MaterialRecord> m_materials;
+            std::map<Material const*, std::uint32_t> m_material_indices;
+
+            std::vector<LightRecord> m_lights;
+        };
+
+        template <typename T>
+        T const& GetIndexed(std::vector<T> const& items, std::uint32_t index)
+        {
+            if (index >= items.size())
+            {
+                throw std::runtime_error("Binary scene: record index out of range");
+            }
+
+            return items[index];
         }
 
-        auto  ibl_texture = image_io->LoadImage("../Resources/Textures/Canopus_Ground_4k.exr");
+        template <typename T>
+        T GetOptional(std::vector<T> const& items, std::uint32_t index)
+        {
+            return index == kNone ? nullptr : GetIndexed(items, index);
+        }
 
-        auto ibl = ImageBasedLight::Create();
-        ibl->SetTexture(ibl_texture);
-        ibl->SetMultiplier(1.f);
+        InputMap::Ptr CreateInputMap(InputMapRecord const& record, std::vector<InputMap::Ptr> const& input_maps,
+            std::vector<Texture::Ptr> const& textures)
+        {
+            // Inputs are stored first, so input_maps holds all of them
+            auto arg = [&](std::size_t i) { return GetIndexed(input_maps, record.inputs[i]); };
+            auto mask = [&]() { return std::array<std::uint32_t, 4>{ { record.params[0], record.params[1], record.params[2], record.params[3] } }; };
 
-        // TODO: temporary code to add directional light
-        auto light = DirectionalLight::Create();
-        light->SetDirection(RadeonRays::normalize(RadeonRays::float3(-1.1f, -0.6f, -0.4f)));
-        light->SetEmittedRadiance(7.f * RadeonRays::float3(1.f, 0.95f, 0.92f));
+            switch (static_cast<InputMap::InputMapType>(record.type))
+            {
+                // Leafs
+                case InputMap::InputMapType::kConstantFloat3:
+                    return InputMap_ConstantFloat3::Create(ToFloat3(record.values));
+                case InputMap::InputMapType::kConstantFloat:
+                    return InputMap_ConstantFloat::Create(record.values[0]);
+                case InputMap::InputMapType::kSampler:
+                    return InputMap_Sampler::Create(GetOptional(textures, record.texture));
+                case InputMap::InputMapType::kSamplerBumpmap:
+                    return InputMap_SamplerBumpMap::Create(GetOptional(textures, record.texture));
 
-        auto light1 = DirectionalLight::Create();
-        light1->SetDirection(RadeonRays::float3(0.3f, -1.f, -0.5f));
-        light1->SetEmittedRadiance(RadeonRays::float3(1.f, 0.8f, 0.65f));
+                // Two inputs
+                case InputMap::InputMapType::kAdd: return InputMap_Add::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kSub: return InputMap_Sub::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kMul: return InputMap_Mul::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kDiv: return InputMap_Div::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kMin: return InputMap_Min::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kMax: return InputMap_Max::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kDot3: return InputMap_Dot3::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kDot4: return InputMap_Dot4::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kCross3: return InputMap_Cross3::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kCross4: return InputMap_Cross4::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kPow: return InputMap_Pow::Create(arg(0), arg(1));
+                case InputMap::InputMapType::kMod: return InputMap_Mod::Create(arg(0), arg(1));
 
-        scene->AttachLight(light);
-        //scene->AttachLight(light1);
-        scene->AttachLight(ibl);
+                // Single input
+                case InputMap::InputMapType::kSin: return InputMap_Sin::Create(arg(0));
+                case InputMap::InputMapType::kCos: return InputMap_Cos::Create(arg(0));
+                case InputMap::InputMapType::kTan: return InputMap_Tan::Create(arg(0));
+                case InputMap::InputMapType::kAsin: return InputMap_Asin::Create(arg(0));
+                case InputMap::InputMapType::kAcos: return InputMap_Acos::Create(arg(0));
+                case InputMap::InputMapType::kAtan: return InputMap_Atan::Create(arg(0));
+                case InputMap::InputMapType::kLength3: return InputMap_Length3::Create(arg(0));
+                case InputMap::InputMapType::kNormalize3: return InputMap_Normalize3::Create(arg(0));
+                case InputMap::InputMapType::kFloor: return InputMap_Floor::Create(arg(0));
+                case InputMap::InputMapType::kAbs: return InputMap_Abs::Create(arg(0));
 
-        return scene;
+                // Specials
+                case InputMap::InputMapType::kLerp:
+                    return InputMap_Lerp::Create(arg(0), arg(1), arg(2));
+                case InputMap::InputMapType::kSelect:
+                    return InputMap_Select::Create(arg(0), static_cast<InputMap_Select::Selection>(record.params[0]));
+                case InputMap::InputMapType::kShuffle:
+                    return InputMap_Shuffle::Create(arg(0), mask());
+                case InputMap::InputMapType::kShuffle2:
+                    return InputMap_Shuffle2::Create(arg(0), arg(1), mask());
+                case InputMap::InputMapType::kMatMul:
+                    return InputMap_MatMul::Create(arg(0), ToMatrix(record.values));
+                case InputMap::InputMapType::kRemap:
+                    return InputMap_Remap::Create(arg(0), arg(1), arg(2));
+            }
+
+            throw std::runtime_error("Binary scene: unknown input map type");
+        }
     }
 
-    void SceneBinaryIo::SaveScene(Scene1 const& scene, std::string const& filename, std::string const& basepath) const
+    Scene1::Ptr SceneBinaryIo::LoadScene(std::string const& filename, std::string const& basepath) const
     {
-        std::string full_path = filename;
+        MappedFile file(filename);
+        SectionTable sections(file);
 
-        std::ofstream out(full_path, std::ios::binary | std::ios::out);
+        auto strings = sections.Get<char>(SectionType::kStrings);
+        auto get_string = [&](StringRef const& ref)
+        {
+            return ref.length > 0 ? std::string(strings.Range(ref.offset, ref.length), ref.length) : std::string();
+        };
 
-        if (!out)
+        auto scene = Scene1::Create();
+
+        std::vector<Texture::Ptr> textures;
         {
-            throw std::runtime_error("Cannot open file for writing");
+            auto records = sections.Get<TextureRecord>(SectionType::kTextures);
+            auto data = sections.Get<char>(SectionType::kTextureData);
+
+            for (std::size_t i = 0; i < records.count; ++i)
+            {
+                auto const& record = records.data[i];
+
+                if (record.format > static_cast<std::uint32_t>(Texture::Format::kBc5))
+                {
+                    throw std::runtime_error("Binary scene: unknown texture format");
+                }
+
+                // Range is checked before allocating, so a corrupt size can't request a huge buffer
+                auto src = data.Range(record.data_offset, record.data_size);
+
+                // Texture owns its data, so this is the only copy
+                std::unique_ptr<char[]> texels(new char[record.data_size]);
+                std::memcpy(texels.get(), src, record.data_size);
+
+                auto texture = Texture::Create(texels.get(), RadeonRays::int3(record.size[0], record.size[1], record.size[2]),
+                    static_cast<Texture::Format>(record.format));
+                texels.release();
+
+                if (texture->GetSizeInBytes() != record.data_size)
+                {
+                    throw std::runtime_error("Binary scene: texture data does not match its size");
+                }
+
+                texture->SetName(get_string(record.name));
+                textures.push_back(texture);
+            }
         }
 
-        auto default_material = UberV2Material::Create();
+        std::vector<InputMap::Ptr> input_maps;
+        {
+            auto records = sections.Get<InputMapRecord>(SectionType::kInputMaps);
 
-        auto num_shapes = (std::uint32_t)scene.GetNumShapes();
-        out.write((char*)&num_shapes, sizeof(std::uint32_t));
+            for (std::size_t i = 0; i < records.count; ++i)
+            {
+                auto input_map = CreateInputMap(records.data[i], input_maps, textures);
+                input_map->SetName(get_string(records.data[i].name));
+                input_maps.push_back(input_map);
+            }
+        }
 
-        auto shape_iter = scene.CreateShapeIterator();
+        std::vector<Material::Ptr> materials;
+        {
+            auto records = sections.Get<MaterialRecord>(SectionType::kMaterials);
+            auto inputs = sections.Get<MaterialInputRecord>(SectionType::kMaterialInputs);
 
-        for (; shape_iter->IsValid(); shape_iter->Next())
+            for (std::size_t i = 0; i < records.count; ++i)
+            {
+                auto const& record = records.data[i];
+
+                // Layers go first since they define active inputs
+                auto material = UberV2Material::Create();
+                material->SetLayers(record.layers);
+                material->SetThin((record.flags & kMaterialThin) != 0);
+                material->SetDoubleSided((record.flags & kMaterialDoubleSided) != 0);
+                material->LinkRefractionIOR((record.flags & kMaterialLinkRefractionIor) != 0);
+                material->SetMultiscatter((record.flags & kMaterialMultiscatter) != 0);
+                material->SetSSSMode((record.flags & kMaterialSSSDiffusion) != 0 ?
+                    UberV2Material::kSSSDiffusion : UberV2Material::kSSSRandomWalk);
+                material->SetName(get_string(record.name));
+
+                auto material_inputs = inputs.Range(record.first_input, record.num_inputs);
+                for (std::uint32_t j = 0; j < record.num_inputs; ++j)
+                {
+                    material->SetInputValue(get_string(material_inputs[j].name), GetIndexed(input_maps, material_inputs[j].input_map));
+                }
+
+                materials.push_back(material);
+            }
+        }
+
+        auto apply_shape_record = [&](ShapeRecord const& record, Shape::Ptr shape)
+        {
+            shape->SetName(get_string(record.name));
+            shape->SetMaterial(GetOptional(materials, record.material));
+            shape->SetTransform(ToMatrix(&record.transform[0][0]));
+
+            if (record.flags & kShapeMotion)
+            {
+                shape->SetMotionTransform(ToMatrix(&record.motion_transform[0][0]));
+            }
+
+            shape->SetVisibilityMask(record.visibility_mask);
+            shape->SetLightLinkMask(record.light_link_mask);
+            shape->SetGroupId(record.group_id);
+
+            if (!(record.flags & kShapeDetached))
+            {
+                scene->AttachShape(shape);
+            }
+        };
+
+        std::vector<Shape::Ptr> shapes;
         {
-            auto mesh = shape_iter->ItemAs<Mesh>();
-            auto num_indices = (std::uint32_t)mesh->GetNumIndices();
-            out.write((char*)&num_indices, sizeof(std::uint32_t));
+            auto records = sections.Get<MeshRecord>(SectionType::kMeshes);
+            auto vertices = sections.Get<RadeonRays::float3>(SectionType::kVertices);
+            auto normals = sections.Get<RadeonRays::float3>(SectionType::kNormals);
+            auto uvs = sections.Get<RadeonRays::float2>(SectionType::kUVs);
+            auto indices = sections.Get<std::uint32_t>(SectionType::kIndices);
+
+            LogInfo("Number of objects: ", records.count, "\n");
+
+            for (std::size_t i = 0; i < records.count; ++i)
+            {
+                auto const& record = records.data[i];
+                auto mesh = Mesh::Create();
+
+                auto mesh_vertices = vertices.Range(record.first_vertex, record.num_vertices);
+                mesh->SetVertices(std::vector<RadeonRays::float3>(mesh_vertices, mesh_vertices + record.num_vertices));
+
+                auto mesh_normals = normals.Range(record.first_normal, record.num_normals);
+                mesh->SetNormals(std::vector<RadeonRays::float3>(mesh_normals, mesh_normals + record.num_normals));
+
+                auto mesh_uvs = uvs.Range(record.first_uv, record.num_uvs);
+                mesh->SetUVs(std::vector<RadeonRays::float2>(mesh_uvs, mesh_uvs + record.num_uvs));
+
+                auto mesh_indices = indices.Range(record.first_index, record.num_indices);
+                mesh->SetIndices(std::vector<std::uint32_t>(mesh_indices, mesh_indices + record.num_indices));
+
+                apply_shape_record(record.shape, mesh);
+                shapes.push_back(mesh);
+            }
+        }
 
-            auto num_vertices = (std::uint32_t)mesh->GetNumVertices();
-            out.write((char*)&num_vertices, sizeof(std::uint32_t));
+        {
+            auto records = sections.Get<InstanceRecord>(SectionType::kInstances);
+            auto num_meshes = shapes.size();
 
-            auto num_normals = (std::uint32_t)mesh->GetNumNormals();
-            out.write((char*)&num_normals, sizeof(std::uint32_t));
+            for (std::size_t i = 0; i < records.count; ++i)
+            {
+                auto const& record = records.data[i];
 
-            auto num_uvs = (std::uint32_t)mesh->GetNumUVs();
-            out.write((char*)&num_uvs, sizeof(std::uint32_t));
+                if (record.base_shape >= num_meshes)
+                {
+                    throw std::runtime_error("Binary scene: instance base shape is not a mesh");
+                }
 
-            out.write((char const*)mesh->GetIndices(), mesh->GetNumIndices() * sizeof(std::uint32_t));
-            out.write((char const*)mesh->GetVertices(), mesh->GetNumVertices() * sizeof(RadeonRays::float3));
-            out.write((char const*)mesh->GetNormals(), mesh->GetNumNormals() * sizeof(RadeonRays::float3));
-            out.write((char const*)mesh->GetUVs(), mesh->GetNumUVs() * sizeof(RadeonRays::float2));
+                auto instance = Instance::Create(shapes[record.base_shape]);
+                apply_shape_record(record.shape, instance);
+                shapes.push_back(instance);
+            }
+        }
 
-            auto material = mesh->GetMaterial();
+        {
+            auto records = sections.Get<LightRecord>(SectionType::kLights);
 
-            /*if (!material)
+            for (std::size_t i = 0; i < records.count; ++i)
             {
-                material = default_material;
+                auto const& record = records.data[i];
+                Light::Ptr light;
+
+                switch (record.type)
+                {
+                    case LightType::kPoint:
+                        light = PointLight::Create();
+                        break;
+                    case LightType::kDirectional:
+                        light = DirectionalLight::Create();
+                        break;
+                    case LightType::kSpot:
+                    {
+                        auto spot = SpotLight::Create();
+                        spot->SetConeShape(RadeonRays::float2(record.cone_shape[0], record.cone_shape[1]));
+                        light = spot;
+                        break;
+                    }
+                    case LightType::kImageBased:
+                    {
+                        auto texture = [&](LightTexture type) { return GetOptional(textures, record.textures[static_cast<std::size_t>(type)]); };
+
+                        auto ibl = ImageBasedLight::Create();
+                        ibl->SetTexture(texture(LightTexture::kIllumination));
+                        ibl->SetReflectionTexture(texture(LightTexture::kReflection));
+                        ibl->SetRefractionTexture(texture(LightTexture::kRefraction));
+                        ibl->SetTransparencyTexture(texture(LightTexture::kTransparency));
+                        ibl->SetBackgroundTexture(texture(LightTexture::kBackground));
+                        ibl->SetMultiplier(record.multiplier);
+                        ibl->SetMirrorX(record.mirror_x != 0);
+                        light = ibl;
+                        break;
+                    }
+                    case LightType::kArea:
+                    {
+                        auto shape = GetIndexed(shapes, record.shape);
+                        auto instance = std::dynamic_pointer_cast<Instance>(shape);
+                        auto mesh = std::dynamic_pointer_cast<Mesh>(instance ? instance->GetBaseShape() : shape);
+
+                        if (!mesh || record.primitive >= mesh->GetNumIndices() / 3)
+                        {
+                            throw std::runtime_error("Binary scene: area light primitive out of range");
+                        }
+
+                        light = AreaLight::Create(shape, static_cast<std::size_t>(record.primitive));
+                        break;
+                    }
+                    default:
+                        throw std::runtime_error("Binary scene: unknown light type");
+                }
+
+                light->SetName(get_string(record.name));
+                light->SetPosition(ToFloat3(record.position));
+                light->SetDirection(ToFloat3(record.direction));
+                light->SetEmittedRadiance(ToFloat3(record.radiance));
+                light->SetLinkMask(record.link_mask);
+                scene->AttachLight(light);
             }
+        }
+
+        return scene;
+    }
+
+    void SceneBinaryIo::SaveScene(Scene1 const& scene, std::string const& filename, std::string const& basepath) const
+    {
+        std::string full_path = filename;
+
+        std::ofstream out(full_path, std::ios::binary | std::ios::out);
+
+        if (!out)
+        {
+            throw std::runtime_error("Cannot open file for writing");
+        }
 
-            auto diffuse = std::dynamic_pointer_cast<SingleBxdf>(material);
+        SceneFlattener flattener;
 
-            if (!diffuse)
+        // Meshes first since instances and area lights reference them by index
+        std::vector<Instance::Ptr> instances;
+
+        auto shape_iter = scene.CreateShapeIterator();
+        for (; shape_iter->IsValid(); shape_iter->Next())
+        {
+            auto shape = shape_iter->ItemAs<Shape>();
+
+            if (auto mesh = std::dynamic_pointer_cast<Mesh>(shape))
             {
-                diffuse = std::dynamic_pointer_cast<SingleBxdf>(material->GetInputValue("base_material").mat_value);
+                flattener.AddMesh(mesh, false);
             }
+            else if (auto instance = std::dynamic_pointer_cast<Instance>(shape))
+            {
+                instances.push_back(instance);
+            }
+        }
 
-            if (!diffuse)
+        // Base meshes of instances are not necessarily attached to the scene
+        for (auto const& instance : instances)
+        {
+            auto base = std::dynamic_pointer_cast<Mesh>(instance->GetBaseShape());
+
+            if (base && !flattener.HasShape(base.get()))
             {
-                throw std::runtime_error("Material not supported");
+                flattener.AddMesh(base, true);
             }
-            diffuse->GetInputValue("albedo");
-            */
+        }
 
-            auto albedo = RadeonRays::float3(1.0f, 1.0f, 1.0f);
+        for (auto const& instance : instances)
+        {
+            flattener.AddInstance(instance);
+        }
 
-            std::uint32_t flag = 0;
-            out.write(reinterpret_cast<char const*>(&flag), sizeof(flag));
-            out.write(reinterpret_cast<char const*>(&albedo.x), sizeof(RadeonRays::float3));
+        auto light_iter = scene.CreateLightIterator();
+        for (; light_iter->IsValid(); light_iter->Next())
+        {
+            flattener.AddLight(light_iter->ItemAs<Light>());
+        }
+
+        flattener.Write(out);
+
+        if (!out)
+        {
+            throw std::runtime_error("Binary scene: cannot write file");
         }
     }
 }
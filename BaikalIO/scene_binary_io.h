@@ -28,13 +28,24 @@ THE SOFTWARE.
 
 namespace Baikal
 {
-    // Create fake test IO
+    ///< Binary scene cache, meant to store scenes converted from slower formats like OBJ or FBX.
+    ///< The file starts with a 64 byte header holding the magic, the format version and
+    ///< the offset of the section table. Every section is an array of fixed size records or raw data
+    ///< starting at 64 byte aligned offset, so the file is memory mapped and sections are copied
+    ///< to scene objects as is, nothing is parsed. Records reference each other by indices into
+    ///< their sections, names are ranges of the string section.
+    ///<
+    ///< Sections: vertices, normals, uvs and indices of all meshes, meshes and instances with their
+    ///< transforms and flags, textures and their texel data, input maps, UberV2 materials and lights.
+    ///< Input maps are stored after their inputs, so shared subgraphs survive a round trip.
+    ///< Files of another version are rejected.
+    ///<
     class SceneBinaryIo : public SceneIo::Loader
     {
     public:
         SceneBinaryIo() : SceneIo::Loader("bin", this)
         {}
-        // Load scene (this class uses filename to determine what scene to generate)
+        // Load scene, basepath is not used since textures are stored in the file
         Scene1::Ptr LoadScene(std::string const& filename, std::string const& basepath) const override;
         void SaveScene(Scene1 const& scene, std::string const& filename, std::string const& basepath) const override;
     };
@@ -5,6 +5,8 @@
 #include "SceneGraph/material.h"
 #include "SceneGraph/light.h"
 #include "SceneGraph/texture.h"
+#include "SceneGraph/uberv2material.h"
+#include "SceneGraph/inputmaps.h"
 #include "image_io.h"
 #include "math/mathutils.h"
 
@@ -32,7 +34,8 @@ namespace Baikal
         Scene1::Ptr LoadScene(const std::string &filename, const std::string &basepath) const override;
 
     private:
-        void LoadMesh(FbxNode* node, std::string const& basepath, Scene1& scene, ImageIo& io) const;
+        // Nodes sharing an FbxMesh become instances of the mesh loaded for the first of them
+        void LoadMesh(FbxNode* node, std::string const& basepath, Scene1& scene, ImageIo& io, std::map<FbxMesh*, Mesh::Ptr>& meshes) const;
         void LoadLight(FbxNode* node, std::string const& basepath, Scene1& scene, ImageIo& io) const;
         Material::Ptr TranslateMaterial(FbxSurfaceMaterial* material, std::string const& basepath, Scene1& scene, ImageIo& io) const;
         Texture::Ptr GetTexture(FbxSurfaceMaterial* material, const char* textureType, std::string const& basepath, Scene1& scene, ImageIo& io) const;
@@ -99,89 +102,82 @@ namespace Baikal
     {
         auto iter = m_material_cache.find(material);
 
-        if (iter == m_material_cache.cend())
+        if (iter != m_material_cache.cend())
         {
-            auto base = SingleBxdf::Create(SingleBxdf::BxdfType::kLambert);
+            return iter->second;
+        }
 
-            Material::Ptr res = base;
-            base->SetName(material->GetName());
+        auto res = UberV2Material::Create();
+        res->SetName(material->GetName());
 
-            auto albedo = material->FindProperty(FbxSurfaceMaterial::sDiffuse).Get<FbxDouble3>();
-            auto mul = material->FindProperty(FbxSurfaceMaterial::sDiffuseFactor).Get<FbxDouble>();
-            auto texture = GetTexture(material, FbxSurfaceMaterial::sDiffuse, basepath, scene, io);
-            auto normal = GetTexture(material, FbxSurfaceMaterial::sNormalMap, basepath, scene, io);
-            auto bump = GetTexture(material, FbxSurfaceMaterial::sBump, basepath, scene, io);
+        std::uint32_t material_layers = UberV2Material::Layers::kDiffuseLayer;
 
-            if (texture)
-            { 
-                base->SetInputValue("albedo", texture);
-            }
-            else
-            {
-                base->SetInputValue("albedo", mul * RadeonRays::float3(albedo[0], albedo[1], albedo[2]));
-            }
+        auto albedo = material->FindProperty(FbxSurfaceMaterial::sDiffuse).Get<FbxDouble3>();
+        auto mul = material->FindProperty(FbxSurfaceMaterial::sDiffuseFactor).Get<FbxDouble>();
+        auto texture = GetTexture(material, FbxSurfaceMaterial::sDiffuse, basepath, scene, io);
+        auto normal = GetTexture(material, FbxSurfaceMaterial::sNormalMap, basepath, scene, io);
+        auto bump = GetTexture(material, FbxSurfaceMaterial::sBump, basepath, scene, io);
 
-            if (normal)
-            {
-                base->SetInputValue("normal", normal);
-            }
-            else if (bump)
-            {
-                base->SetInputValue("bump", normal);
-            }
-
-            auto specular_albedo = material->FindProperty(FbxSurfaceMaterial::sSpecular).Get<FbxDouble3>();
-            auto specular_mul = material->FindProperty(FbxSurfaceMaterial::sSpecularFactor).Get<FbxDouble>();
-            auto shininess = material->FindProperty(FbxSurfaceMaterial::sShininess).Get<FbxDouble>();
-            auto specular_texture = GetTexture(material, FbxSurfaceMaterial::sSpecular, basepath, scene, io);
+        if (texture)
+        {
+            res->SetInputValue("uberv2.diffuse.color", InputMap_Sampler::Create(texture));
+        }
+        else
+        {
+            res->SetInputValue("uberv2.diffuse.color", InputMap_ConstantFloat3::Create(
+                static_cast<float>(mul) * RadeonRays::float3(albedo[0], albedo[1], albedo[2])));
+        }
 
-            if (specular_mul > 0.f && (specular_albedo[0] > 0.f ||
-                specular_albedo[1] > 0.f || specular_albedo[2] > 0.f))
-            {
-                auto top = SingleBxdf::Create(shininess > 0.99f ?
-                    SingleBxdf::BxdfType::kMicrofacetGGX :
-                    SingleBxdf::BxdfType::kIdealReflect);
+        // Normal maps take precedence over bump maps
+        if (normal || bump)
+        {
+            material_layers |= UberV2Material::Layers::kShadingNormalLayer;
 
-                if (specular_texture)
-                {
-                    top->SetInputValue("albedo", specular_texture);
-                }
-                else
-                {
-                    top->SetInputValue("albedo", specular_mul * RadeonRays::float3(
-                        specular_albedo[0],
-                        specular_albedo[1],
-                        specular_albedo[2]));
-                }
+            InputMap::Ptr sampler = normal ?
+                std::static_pointer_cast<InputMap>(InputMap_Sampler::Create(normal)) :
+                std::static_pointer_cast<InputMap>(InputMap_SamplerBumpMap::Create(bump));
 
-                auto r = RadeonRays::clamp(1.f - shininess / 10.f, 0.001f, 999.f);
-                top->SetInputValue("roughness", RadeonRays::float3(r,r,r));
+            res->SetInputValue("uberv2.shading_normal", InputMap_Remap::Create(
+                InputMap_ConstantFloat3::Create(RadeonRays::float3(0.f, 1.f, 0.f)),
+                InputMap_ConstantFloat3::Create(RadeonRays::float3(-1.f, 1.f, 0.f)),
+                sampler));
+        }
 
-                auto layered = MultiBxdf::Create(MultiBxdf::Type::kFresnelBlend);
-                layered->SetInputValue("base_material", base);
-                layered->SetInputValue("top_material", top);
-                layered->SetInputValue("ior", RadeonRays::float3(1.5f, 1.5f, 1.5f, 1.5f));
-                res = layered;
+        auto specular_albedo = material->FindProperty(FbxSurfaceMaterial::sSpecular).Get<FbxDouble3>();
+        auto specular_mul = material->FindProperty(FbxSurfaceMaterial::sSpecularFactor).Get<FbxDouble>();
+        auto shininess = material->FindProperty(FbxSurfaceMaterial::sShininess).Get<FbxDouble>();
+        auto specular_texture = GetTexture(material, FbxSurfaceMaterial::sSpecular, basepath, scene, io);
 
-                if (normal)
-                {
-                    top->SetInputValue("normal", normal);
-                }
-                else if (bump)
-                {
-                    top->SetInputValue("bump", normal);
-                }
+        // Dielectric coating over the diffuse base, low shininess is a mirror
+        if (specular_mul > 0.f && (specular_albedo[0] > 0.f ||
+            specular_albedo[1] > 0.f || specular_albedo[2] > 0.f))
+        {
+            material_layers |= UberV2Material::Layers::kReflectionLayer;
 
+            if (specular_texture)
+            {
+                res->SetInputValue("uberv2.reflection.color", InputMap_Sampler::Create(specular_texture));
+            }
+            else
+            {
+                res->SetInputValue("uberv2.reflection.color", InputMap_ConstantFloat3::Create(
+                    static_cast<float>(specular_mul) * RadeonRays::float3(
+                    specular_albedo[0],
+                    specular_albedo[1],
+                    specular_albedo[2])));
             }
 
-            m_material_cache[material] = res;
-
-            return res;
-        }
-        else
-        {
-            return iter->second;
+            auto r = shininess > 0.99f ? RadeonRays::clamp(1.f - static_cast<float>(shininess) / 10.f, 0.001f, 999.f) : 0.001f;
+            res->SetInputValue("uberv2.reflection.roughness", InputMap_ConstantFloat::Create(r));
+            res->SetInputValue("uberv2.reflection.ior", InputMap_ConstantFloat::Create(1.5f));
+            res->SetInputValue("uberv2.reflection.metalness", InputMap_ConstantFloat::Create(0.f));
         }
+
+        res->SetLayers(material_layers);
+
+        m_material_cache[material] = res;
+
+        return res;
     }
 
     void SceneFbxIo::LoadLight(FbxNode* node, std::string const& basepath, Scene1& scene, ImageIo& io) const
@@ -241,17 +237,47 @@ namespace Baikal
         }
     }
 
-    void SceneFbxIo::LoadMesh(FbxNode* node, std::string const& basepath, Scene1& scene, ImageIo& io) const
+    void SceneFbxIo::LoadMesh(FbxNode* node, std::string const& basepath, Scene1& scene, ImageIo& io, std::map<FbxMesh*, Mesh::Ptr>& meshes) const
     {
-        auto mesh = Mesh::Create();
         auto fbx_mesh = node->GetMesh();
 
-        auto transform = FbxMatrix(node->EvaluateGlobalTransform());
-        auto invtransp = node->EvaluateGlobalTransform().Inverse().Transpose();
+        // Geometric transform applies to the node attribute only, so it is part of the instance transform
+        FbxAMatrix geometric_transform(
+            node->GetGeometricTranslation(FbxNode::eSourcePivot),
+            node->GetGeometricRotation(FbxNode::eSourcePivot),
+            node->GetGeometricScaling(FbxNode::eSourcePivot));
+        auto transform = FbxToBaikalTransform(node->EvaluateGlobalTransform() * geometric_transform);
+
+        // Materials belong to the node, instances of the same mesh can use different ones
+        Material::Ptr material;
+        FbxLayerElementArrayTemplate<int>* material_indices = nullptr;
+        fbx_mesh->GetMaterialIndices(&material_indices);
+
+        if (material_indices && material_indices->GetCount() > 0)
+        {
+            auto fbx_material = node->GetMaterial(material_indices->GetAt(0));
+
+            if (fbx_material)
+            {
+                material = TranslateMaterial(fbx_material, basepath, scene, io);
+            }
+        }
 
+        auto iter = meshes.find(fbx_mesh);
+        if (iter != meshes.cend())
+        {
+            auto instance = Instance::Create(iter->second);
+            instance->SetName(node->GetName());
+            instance->SetTransform(transform);
+            instance->SetMaterial(material);
+            scene.AttachShape(instance);
+            return;
+        }
+
+        auto mesh = Mesh::Create();
         mesh->SetName(node->GetName());
 
-        // Vertices
+        // Vertices are kept in object space and written straight into the buffers moved into the mesh
         {
             auto num_triangles = fbx_mesh->GetPolygonCount();
             auto num_vertices = fbx_mesh->GetControlPointsCount();
@@ -267,66 +293,45 @@ namespace Baikal
 
             for (auto i = 0; i < num_vertices; ++i)
             {
-                auto vertex = vertex_ptr[i];
-                vertex = transform.MultNormalize(vertex);
-                vertices[i] = RadeonRays::float3(vertex[0], vertex[1], vertex[2]);
+                auto const& vertex = vertex_ptr[i];
+                vertices[i] = RadeonRays::float3(vertex[0], vertex[1], vertex[2], 1.f);
             }
 
             for (auto i = 0; i < num_triangles; ++i)
             {
                 assert(fbx_mesh->GetPolygonSize(i) == 3);
 
-                auto i0 = fbx_mesh->GetPolygonVertex(i, 0);
-                auto i1 = fbx_mesh->GetPolygonVertex(i, 1);
-                auto i2 = fbx_mesh->GetPolygonVertex(i, 2);
-
-                FbxVector4 n0, n1, n2;
-                fbx_mesh->GetPolygonVertexNormal(i, 0, n0);
-                fbx_mesh->GetPolygonVertexNormal(i, 1, n1);
-                fbx_mesh->GetPolygonVertexNormal(i, 2, n2);
-
-                n0 = invtransp.MultT(n0);
-                n1 = invtransp.MultT(n1);
-                n2 = invtransp.MultT(n2);
+                for (auto v = 0; v < 3; ++v)
+                {
+                    auto index = fbx_mesh->GetPolygonVertex(i, v);
 
-                normals[i0] = normalize(RadeonRays::float3(n0[0], n0[1], n0[2], 0));
-                normals[i1] = normalize(RadeonRays::float3(n1[0], n1[1], n1[2], 0));
-                normals[i2] = normalize(RadeonRays::float3(n2[0], n2[1], n2[2], 0));
+                    FbxVector4 n;
+                    fbx_mesh->GetPolygonVertexNormal(i, v, n);
+                    normals[index] = normalize(RadeonRays::float3(n[0], n[1], n[2], 0));
 
-                indices[3 * i] = i0;
-                indices[3 * i + 1] = i1;
-                indices[3 * i + 2] = i2;
+                    if (uv_list.GetCount() > 0)
+                    {
+                        FbxVector2 uv;
+                        bool unmapped = false;
+                        fbx_mesh->GetPolygonVertexUV(i, v, uv_list.GetStringAt(0), uv, unmapped);
+                        uvs[index] = unmapped ? RadeonRays::float2() : RadeonRays::float2(uv[0], uv[1]);
+                    }
 
-                if (uv_list.GetCount() > 0)
-                {
-                    FbxVector2 uv0, uv1, uv2;
-                    bool unmapped0, unmapped1, unmapped2;
-                    fbx_mesh->GetPolygonVertexUV(i, 0, uv_list.GetStringAt(0), uv0, unmapped0);
-                    fbx_mesh->GetPolygonVertexUV(i, 1, uv_list.GetStringAt(0), uv1, unmapped1);
-                    fbx_mesh->GetPolygonVertexUV(i, 2, uv_list.GetStringAt(0), uv2, unmapped2);
-
-                    uvs[i0] = unmapped0 ? RadeonRays::float2() : RadeonRays::float2(uv0[0], uv0[1]);
-                    uvs[i1] = unmapped1 ? RadeonRays::float2() : RadeonRays::float2(uv1[0], uv1[1]);
-                    uvs[i2] = unmapped2 ? RadeonRays::float2() : RadeonRays::float2(uv2[0], uv2[1]);;
+                    indices[3 * i + v] = index;
                 }
             }
 
-            FbxLayerElementArrayTemplate<int>* material_indices = nullptr;
-            fbx_mesh->GetMaterialIndices(&material_indices);
-
-            if (material_indices)
-            {
-                auto fbx_material = node->GetMaterial(material_indices->GetAt(0));
-                mesh->SetMaterial(TranslateMaterial(fbx_material, basepath, scene, io));
-            }
-
             mesh->SetVertices(std::move(vertices));
             mesh->SetNormals(std::move(normals));
             mesh->SetUVs(std::move(uvs));
             mesh->SetIndices(std::move(indices));
-
-            scene.AttachShape(mesh);
         }
+
+        mesh->SetTransform(transform);
+        mesh->SetMaterial(material);
+
+        scene.AttachShape(mesh);
+        meshes.emplace(fbx_mesh, mesh);
     }
 
     Scene1::Ptr SceneFbxIo::LoadScene(std::string const& filename, std::string const& basepath) const
@@ -355,6 +360,7 @@ namespace Baikal
         FbxGeometryConverter converter(fbx_manager);
         converter.Triangulate(fbx_scene, true);
 
+        std::map<FbxMesh*, Mesh::Ptr> meshes;
         std::stack<FbxNode*> node_stack;
 
         node_stack.push(fbx_root_node);
@@ -378,7 +384,7 @@ namespace Baikal
             switch (attribs->GetAttributeType())
             {
             case FbxNodeAttribute::eMesh:
-                LoadMesh(node, basepath, *scene, *image_io);
+                LoadMesh(node, basepath, *scene, *image_io, meshes);
                 break;
             case FbxNodeAttribute::eLight:
                 LoadLight(node, basepath, *scene, *image_io);
@@ -390,6 +396,7 @@ namespace Baikal
         fbx_importer->Destroy();
         fbx_manager->Destroy();
 
+        LoadPendingTextures(*image_io);
 
         Texture::Ptr ibl_texture = image_io->LoadImage("../Resources/Textures/Canopus_Ground_4k.exr");
 
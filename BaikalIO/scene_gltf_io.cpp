@@ -0,0 +1,1012 @@
+#include "scene_io.h"
+#include "image_io.h"
+#include "json.h"
+#include "mapped_file.h"
+#include "SceneGraph/scene1.h"
+#include "SceneGraph/shape.h"
+#include "SceneGraph/light.h"
+#include "SceneGraph/texture.h"
+#include "SceneGraph/uberv2material.h"
+#include "SceneGraph/inputmaps.h"
+#include "math/mathutils.h"
+
+#include "Utils/log.h"
+#include "Utils/task_scheduler.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <stack>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Baikal
+{
+    namespace
+    {
+        std::uint32_t constexpr kGlbMagic = 0x46546c67;     // "glTF"
+        std::uint32_t constexpr kGlbVersion = 2;
+        std::uint32_t constexpr kGlbJsonChunk = 0x4e4f534a; // "JSON"
+        std::uint32_t constexpr kGlbBinChunk = 0x004e4942;  // "BIN\0"
+
+        // Accessor component types
+        int constexpr kByte = 5120;
+        int constexpr kUnsignedByte = 5121;
+        int constexpr kShort = 5122;
+        int constexpr kUnsignedShort = 5123;
+        int constexpr kUnsignedInt = 5125;
+        int constexpr kFloat = 5126;
+
+        // Primitive mode of triangle lists, the default one
+        int constexpr kTriangles = 4;
+
+        struct Buffer
+        {
+            char const* data;
+            std::size_t size;
+        };
+
+        // Document with its buffers, which point into mapped files or decoded data URIs
+        struct Document
+        {
+            JsonValue json;
+            std::vector<std::unique_ptr<MappedFile>> files;
+            std::vector<std::unique_ptr<std::vector<char>>> decoded;
+            std::vector<Buffer> buffers;
+        };
+
+        // Elements of an accessor inside its buffer
+        struct Accessor
+        {
+            char const* data;
+            std::size_t count;
+            std::size_t stride;
+            int component_type;
+            std::size_t num_components;
+            bool normalized;
+        };
+
+        // Mesh buffers of a primitive, built in parallel and moved into Mesh
+        struct PrimitiveData
+        {
+            std::vector<RadeonRays::float3> vertices;
+            std::vector<RadeonRays::float3> normals;
+            std::vector<RadeonRays::float2> uvs;
+            std::vector<std::uint32_t> indices;
+        };
+
+        // Files and hosts are little endian
+        std::uint32_t ReadUint32(char const* p)
+        {
+            std::uint32_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        // Non negative integer property
+        std::size_t GetSize(JsonValue const& value, std::size_t fallback, char const* name)
+        {
+            if (value.IsNull())
+            {
+                return fallback;
+            }
+
+            auto number = value.AsNumber(-1.0);
+            if (number < 0.0 || number != std::floor(number) || number > 9007199254740992.0)
+            {
+                throw std::runtime_error(std::string("glTF: invalid ") + name);
+            }
+
+            return static_cast<std::size_t>(number);
+        }
+
+        // Index into an array of count elements
+        std::size_t GetIndex(JsonValue const& value, std::size_t count, char const* name)
+        {
+            auto index = GetSize(value, count, name);
+            if (index >= count)
+            {
+                throw std::runtime_error(std::string("glTF: invalid ") + name);
+            }
+
+            return index;
+        }
+
+        void GetFloats(JsonValue const& value, float* out, std::size_t count)
+        {
+            if (value.GetSize() != count)
+            {
+                return;
+            }
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                out[i] = static_cast<float>(value.At(i).AsNumber(out[i]));
+            }
+        }
+
+        // Percent encoded URI of an external file
+        std::string DecodeUri(std::string const& uri)
+        {
+            auto hex = [](char c)
+            {
+                return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            };
+
+            std::string res;
+            for (std::size_t i = 0; i < uri.size(); ++i)
+            {
+                if (uri[i] == '%' && i + 2 < uri.size() && hex(uri[i + 1]) >= 0 && hex(uri[i + 2]) >= 0)
+                {
+                    res += static_cast<char>(hex(uri[i + 1]) * 16 + hex(uri[i + 2]));
+                    i += 2;
+                }
+                else
+                {
+                    res += uri[i];
+                }
+            }
+
+            return res;
+        }
+
+        bool IsDataUri(std::string const& uri)
+        {
+            return uri.compare(0, 5, "data:") == 0;
+        }
+
+        std::vector<char> DecodeBase64(char const* data, std::size_t size)
+        {
+            auto value = [](char c)
+            {
+                return c >= 'A' && c <= 'Z' ? c - 'A' : c >= 'a' && c <= 'z' ? c - 'a' + 26 :
+                    c >= '0' && c <= '9' ? c - '0' + 52 : c == '+' ? 62 : c == '/' ? 63 : -1;
+            };
+
+            std::vector<char> res;
+            res.reserve(size / 4 * 3);
+
+            std::uint32_t bits = 0;
+            int num_bits = 0;
+            for (std::size_t i = 0; i < size && data[i] != '='; ++i)
+            {
+                auto v = value(data[i]);
+                if (v < 0)
+                {
+                    throw std::runtime_error("glTF: invalid base64 data");
+                }
+
+                bits = (bits << 6) | static_cast<std::uint32_t>(v);
+                num_bits += 6;
+                if (num_bits >= 8)
+                {
+                    num_bits -= 8;
+                    res.push_back(static_cast<char>((bits >> num_bits) & 0xff));
+                }
+            }
+
+            return res;
+        }
+
+        Document LoadDocument(std::string const& filename, std::string const& basepath)
+        {
+            Document document;
+
+            document.files.emplace_back(new MappedFile(filename));
+            auto data = document.files.back()->GetData();
+            auto size = document.files.back()->GetSize();
+
+            // GLB holds the document in the first chunk, optionally followed by the binary buffer
+            Buffer glb_buffer = { nullptr, 0 };
+            if (size >= 12 && ReadUint32(data) == kGlbMagic)
+            {
+                if (ReadUint32(data + 4) != kGlbVersion)
+                {
+                    throw std::runtime_error("glTF: unsupported GLB version in " + filename);
+                }
+
+                std::size_t length = ReadUint32(data + 8);
+                if (length > size)
+                {
+                    throw std::runtime_error("glTF: truncated GLB file " + filename);
+                }
+
+                Buffer json = { nullptr, 0 };
+                for (std::size_t offset = 12; offset + 8 <= length;)
+                {
+                    std::size_t chunk_size = ReadUint32(data + offset);
+                    auto chunk_type = ReadUint32(data + offset + 4);
+                    offset += 8;
+
+                    if (chunk_size > length - offset)
+                    {
+                        throw std::runtime_error("glTF: truncated GLB file " + filename);
+                    }
+
+                    if (chunk_type == kGlbJsonChunk && !json.data)
+                    {
+                        json = { data + offset, chunk_size };
+                    }
+                    else if (chunk_type == kGlbBinChunk && !glb_buffer.data)
+                    {
+                        glb_buffer = { data + offset, chunk_size };
+                    }
+
+                    // Chunks are 4 byte aligned
+                    offset += (chunk_size + 3) & ~std::size_t(3);
+                }
+
+                if (!json.data)
+                {
+                    throw std::runtime_error("glTF: no JSON chunk in " + filename);
+                }
+
+                document.json = JsonValue::Parse(json.data, json.size);
+            }
+            else
+            {
+                document.json = JsonValue::Parse(data, size);
+            }
+
+            if (document.json["asset"]["version"].AsString().compare(0, 2, "2.") != 0)
+            {
+                throw std::runtime_error("glTF: only version 2.0 is supported, " + filename);
+            }
+
+            auto const& buffers = document.json["buffers"];
+            for (std::size_t i = 0; i < buffers.GetSize(); ++i)
+            {
+                auto const& uri = buffers.At(i)["uri"].AsString();
+                auto length = GetSize(buffers.At(i)["byteLength"], 0, "buffer length");
+
+                Buffer buffer = { nullptr, 0 };
+                if (uri.empty())
+                {
+                    buffer = glb_buffer;
+                }
+                else if (IsDataUri(uri))
+                {
+                    auto comma = uri.find(',');
+                    if (comma == std::string::npos || comma < 7 || uri.compare(comma - 7, 7, ";base64") != 0)
+                    {
+                        throw std::runtime_error("glTF: unsupported data URI of buffer " + std::to_string(i));
+                    }
+
+                    document.decoded.emplace_back(new std::vector<char>(DecodeBase64(uri.data() + comma + 1, uri.size() - comma - 1)));
+                    buffer = { document.decoded.back()->data(), document.decoded.back()->size() };
+                }
+                else
+                {
+                    document.files.emplace_back(new MappedFile(basepath + DecodeUri(uri)));
+                    buffer = { document.files.back()->GetData(), document.files.back()->GetSize() };
+                }
+
+                if (buffer.size < length)
+                {
+                    throw std::runtime_error("glTF: buffer " + std::to_string(i) + " is shorter than its length");
+                }
+
+                document.buffers.push_back(buffer);
+            }
+
+            return document;
+        }
+
+        std::size_t GetComponentSize(int component_type)
+        {
+            switch (component_type)
+            {
+                case kByte:
+                case kUnsignedByte:
+                    return 1;
+                case kShort:
+                case kUnsignedShort:
+                    return 2;
+                case kUnsignedInt:
+                case kFloat:
+                    return 4;
+                default:
+                    throw std::runtime_error("glTF: unsupported component type " + std::to_string(component_type));
+            }
+        }
+
+        std::size_t GetNumComponents(std::string const& type)
+        {
+            if (type == "SCALAR") return 1;
+            if (type == "VEC2") return 2;
+            if (type == "VEC3") return 3;
+            if (type == "VEC4") return 4;
+            throw std::runtime_error("glTF: unsupported accessor type " + type);
+        }
+
+        Accessor GetAccessor(Document const& document, JsonValue const& index)
+        {
+            auto const& accessors = document.json["accessors"];
+            auto const& accessor = accessors.At(GetIndex(index, accessors.GetSize(), "accessor index"));
+
+            if (accessor.HasMember("sparse") || !accessor.HasMember("bufferView"))
+            {
+                throw std::runtime_error("glTF: sparse accessors are not supported");
+            }
+
+            auto const& views = document.json["bufferViews"];
+            auto const& view = views.At(GetIndex(accessor["bufferView"], views.GetSize(), "buffer view index"));
+            auto const& buffer = document.buffers.at(GetIndex(view["buffer"], document.buffers.size(), "buffer index"));
+
+            auto view_offset = GetSize(view["byteOffset"], 0, "buffer view offset");
+            auto view_length = GetSize(view["byteLength"], 0, "buffer view length");
+            if (view_offset > buffer.size || view_length > buffer.size - view_offset)
+            {
+                throw std::runtime_error("glTF: buffer view is out of buffer bounds");
+            }
+
+            Accessor res;
+            res.component_type = static_cast<int>(accessor["componentType"].AsNumber());
+            res.num_components = GetNumComponents(accessor["type"].AsString());
+            res.normalized = accessor["normalized"].AsBool();
+            res.count = GetSize(accessor["count"], 0, "accessor count");
+
+            auto element_size = GetComponentSize(res.component_type) * res.num_components;
+            res.stride = GetSize(view["byteStride"], element_size, "buffer view stride");
+
+            auto offset = GetSize(accessor["byteOffset"], 0, "accessor offset");
+            if (res.count > 0 && (res.stride < element_size || offset > view_length || element_size > view_length - offset ||
+                res.count - 1 > (view_length - offset - element_size) / res.stride))
+            {
+                throw std::runtime_error("glTF: accessor is out of buffer view bounds");
+            }
+
+            res.data = buffer.data + view_offset + offset;
+            return res;
+        }
+
+        // First num_components float components of element i, integer ones are normalized
+        void ReadFloats(Accessor const& accessor, std::size_t i, float* out, std::size_t num_components)
+        {
+            auto p = accessor.data + i * accessor.stride;
+
+            if (accessor.component_type == kFloat)
+            {
+                std::memcpy(out, p, num_components * sizeof(float));
+                return;
+            }
+
+            for (std::size_t c = 0; c < num_components; ++c)
+            {
+                switch (accessor.component_type)
+                {
+                    case kUnsignedByte:
+                        out[c] = static_cast<std::uint8_t>(p[c]) / 255.f;
+                        break;
+                    case kByte:
+                        out[c] = std::max(static_cast<std::int8_t>(p[c]) / 127.f, -1.f);
+                        break;
+                    case kUnsignedShort:
+                    {
+                        std::uint16_t value;
+                        std::memcpy(&value, p + 2 * c, sizeof(value));
+                        out[c] = value / 65535.f;
+                        break;
+                    }
+                    case kShort:
+                    {
+                        std::int16_t value;
+                        std::memcpy(&value, p + 2 * c, sizeof(value));
+                        out[c] = std::max(value / 32767.f, -1.f);
+                        break;
+                    }
+                    default:
+                        throw std::runtime_error("glTF: unsupported attribute component type");
+                }
+            }
+        }
+
+        void CheckAccessor(Accessor const& accessor, std::size_t num_components, std::size_t count, char const* name)
+        {
+            if (accessor.num_components != num_components || accessor.count != count ||
+                (accessor.component_type != kFloat && !accessor.normalized))
+            {
+                throw std::runtime_error(std::string("glTF: invalid ") + name + " accessor");
+            }
+        }
+
+        PrimitiveData LoadPrimitive(Document const& document, JsonValue const& primitive)
+        {
+            PrimitiveData data;
+
+            auto const& attributes = primitive["attributes"];
+            auto positions = GetAccessor(document, attributes["POSITION"]);
+            if (positions.num_components != 3 || positions.component_type != kFloat)
+            {
+                throw std::runtime_error("glTF: invalid POSITION accessor");
+            }
+
+            auto num_vertices = positions.count;
+            data.vertices.resize(num_vertices);
+            data.normals.resize(num_vertices);
+            data.uvs.resize(num_vertices);
+
+            // Attributes are read straight from the mapped buffers into the mesh layout
+            float value[3];
+            for (std::size_t i = 0; i < num_vertices; ++i)
+            {
+                ReadFloats(positions, i, value, 3);
+                data.vertices[i] = RadeonRays::float3(value[0], value[1], value[2], 1.f);
+            }
+
+            if (attributes.HasMember("TEXCOORD_0"))
+            {
+                auto uvs = GetAccessor(document, attributes["TEXCOORD_0"]);
+                CheckAccessor(uvs, 2, num_vertices, "TEXCOORD_0");
+
+                // glTF texture space starts at the top left corner
+                for (std::size_t i = 0; i < num_vertices; ++i)
+                {
+                    ReadFloats(uvs, i, value, 2);
+                    data.uvs[i] = RadeonRays::float2(value[0], 1.f - value[1]);
+                }
+            }
+
+            if (primitive.HasMember("indices"))
+            {
+                auto indices = GetAccessor(document, primitive["indices"]);
+                if (indices.num_components != 1)
+                {
+                    throw std::runtime_error("glTF: invalid index accessor");
+                }
+
+                data.indices.resize(indices.count);
+                if (indices.component_type == kUnsignedInt && indices.stride == sizeof(std::uint32_t))
+                {
+                    std::memcpy(data.indices.data(), indices.data, indices.count * sizeof(std::uint32_t));
+                }
+                else
+                {
+                    for (std::size_t i = 0; i < indices.count; ++i)
+                    {
+                        auto p = indices.data + i * indices.stride;
+                        switch (indices.component_type)
+                        {
+                            case kUnsignedByte:
+                                data.indices[i] = static_cast<std::uint8_t>(*p);
+                                break;
+                            case kUnsignedShort:
+                            {
+                                std::uint16_t index;
+                                std::memcpy(&index, p, sizeof(index));
+                                data.indices[i] = index;
+                                break;
+                            }
+                            case kUnsignedInt:
+                                std::memcpy(&data.indices[i], p, sizeof(std::uint32_t));
+                                break;
+                            default:
+                                throw std::runtime_error("glTF: invalid index component type");
+                        }
+                    }
+                }
+
+                for (auto index : data.indices)
+                {
+                    if (index >= num_vertices)
+                    {
+                        throw std::runtime_error("glTF: vertex index is out of range");
+                    }
+                }
+            }
+            else
+            {
+                data.indices.resize(num_vertices);
+                std::iota(data.indices.begin(), data.indices.end(), 0u);
+            }
+
+            if (data.indices.size() % 3 != 0)
+            {
+                throw std::runtime_error("glTF: triangle list index count is not a multiple of 3");
+            }
+
+            if (attributes.HasMember("NORMAL"))
+            {
+                auto normals = GetAccessor(document, attributes["NORMAL"]);
+                CheckAccessor(normals, 3, num_vertices, "NORMAL");
+
+                for (std::size_t i = 0; i < num_vertices; ++i)
+                {
+                    ReadFloats(normals, i, value, 3);
+                    data.normals[i] = RadeonRays::float3(value[0], value[1], value[2], 0.f);
+                }
+            }
+            else
+            {
+                // Cross product length is twice the triangle area, so the sums are area weighted
+                for (std::size_t t = 0; t < data.indices.size(); t += 3)
+                {
+                    auto i0 = data.indices[t];
+                    auto i1 = data.indices[t + 1];
+                    auto i2 = data.indices[t + 2];
+
+                    auto e1 = data.vertices[i1] - data.vertices[i0];
+                    auto e2 = data.vertices[i2] - data.vertices[i0];
+                    auto normal = RadeonRays::float3(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x, 0.f);
+
+                    data.normals[i0] += normal;
+                    data.normals[i1] += normal;
+                    data.normals[i2] += normal;
+                }
+
+                for (auto& normal : data.normals)
+                {
+                    auto length = std::sqrt(normal.sqnorm());
+                    normal = length > 0.f ?
+                        RadeonRays::float3(normal.x / length, normal.y / length, normal.z / length, 0.f) :
+                        RadeonRays::float3(0.f, 1.f, 0.f, 0.f);
+                }
+            }
+
+            return data;
+        }
+
+        RadeonRays::matrix MakeMatrix(float const (&m)[4][4])
+        {
+            RadeonRays::matrix res;
+
+            for (int i = 0; i < 4; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    res.m[i][j] = m[i][j];
+                }
+            }
+
+            return res;
+        }
+
+        // Local transform given as a column major matrix or as translation, rotation and scale
+        RadeonRays::matrix GetNodeTransform(JsonValue const& node)
+        {
+            float m[4][4] = { { 1.f, 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f, 0.f }, { 0.f, 0.f, 1.f, 0.f }, { 0.f, 0.f, 0.f, 1.f } };
+
+            auto const& matrix = node["matrix"];
+            if (matrix.GetSize() == 16)
+            {
+                for (std::size_t k = 0; k < 16; ++k)
+                {
+                    m[k % 4][k / 4] = static_cast<float>(matrix.At(k).AsNumber());
+                }
+
+                return MakeMatrix(m);
+            }
+
+            float t[3] = { 0.f, 0.f, 0.f };
+            float q[4] = { 0.f, 0.f, 0.f, 1.f };
+            float s[3] = { 1.f, 1.f, 1.f };
+            GetFloats(node["translation"], t, 3);
+            GetFloats(node["rotation"], q, 4);
+            GetFloats(node["scale"], s, 3);
+
+            auto length = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+            auto x = length > 0.f ? q[0] / length : 0.f;
+            auto y = length > 0.f ? q[1] / length : 0.f;
+            auto z = length > 0.f ? q[2] / length : 0.f;
+            auto w = length > 0.f ? q[3] / length : 1.f;
+
+            float r[3][3] =
+            {
+                { 1.f - 2.f * (y * y + z * z), 2.f * (x * y - z * w), 2.f * (x * z + y * w) },
+                { 2.f * (x * y + z * w), 1.f - 2.f * (x * x + z * z), 2.f * (y * z - x * w) },
+                { 2.f * (x * z - y * w), 2.f * (y * z + x * w), 1.f - 2.f * (x * x + y * y) }
+            };
+
+            for (int i = 0; i < 3; ++i)
+            {
+                for (int j = 0; j < 3; ++j)
+                {
+                    m[i][j] = r[i][j] * s[j];
+                }
+
+                m[i][3] = t[i];
+            }
+
+            return MakeMatrix(m);
+        }
+
+        // Node referencing a mesh, with the world transform of the node
+        struct MeshNode
+        {
+            std::size_t mesh;
+            RadeonRays::matrix transform;
+            std::string name;
+        };
+    }
+
+    // glTF 2.0 loader for .gltf and .glb files
+    class SceneIoGltf : public SceneIo::Loader
+    {
+    public:
+        SceneIoGltf() : SceneIo::Loader("gltf", this)
+        {
+            SceneIo::RegisterLoader("glb", this);
+        }
+
+        ~SceneIoGltf()
+        {
+            SceneIo::UnregisterLoader("glb");
+        }
+
+        // Load scene from file
+        Scene1::Ptr LoadScene(std::string const& filename, std::string const& basepath) const override;
+
+    private:
+        Material::Ptr TranslateMaterial(ImageIo const& image_io, Document const& document, JsonValue const& material, std::string const& basepath, Scene1& scene) const;
+        Texture::Ptr GetTexture(ImageIo const& image_io, Document const& document, JsonValue const& texture_info, std::string const& basepath, Scene1& scene) const;
+        void LoadLight(JsonValue const& light, RadeonRays::matrix const& transform, Scene1& scene) const;
+    };
+
+    // Create static object to register loader. This object will be used as loader
+    static SceneIoGltf gltf_loader;
+
+    Texture::Ptr SceneIoGltf::GetTexture(ImageIo const& image_io, Document const& document, JsonValue const& texture_info, std::string const& basepath, Scene1& scene) const
+    {
+        if (!texture_info.IsObject())
+        {
+            return nullptr;
+        }
+
+        auto const& textures = document.json["textures"];
+        auto const& texture = textures.At(GetIndex(texture_info["index"], textures.GetSize(), "texture index"));
+
+        auto const& images = document.json["images"];
+        if (!texture.HasMember("source"))
+        {
+            return nullptr;
+        }
+
+        auto image_index = GetIndex(texture["source"], images.GetSize(), "image index");
+        auto const& uri = images.At(image_index)["uri"].AsString();
+
+        // ImageIo decodes files only
+        if (uri.empty() || IsDataUri(uri))
+        {
+            LogInfo("glTF: embedded image ", image_index, " is not supported\n");
+            return nullptr;
+        }
+
+        return LoadTexture(image_io, scene, basepath, DecodeUri(uri));
+    }
+
+    Material::Ptr SceneIoGltf::TranslateMaterial(ImageIo const& image_io, Document const& document, JsonValue const& material, std::string const& basepath, Scene1& scene) const
+    {
+        auto res = UberV2Material::Create();
+        res->SetName(material["name"].AsString());
+
+        std::uint32_t material_layers = UberV2Material::Layers::kDiffuseLayer | UberV2Material::Layers::kReflectionLayer;
+
+        auto gamma = InputMap_ConstantFloat::Create(2.2f);
+        auto const& pbr = material["pbrMetallicRoughness"];
+
+        // Base color is shared by the diffuse and the metallic reflection
+        float base_color_factor[4] = { 1.f, 1.f, 1.f, 1.f };
+        GetFloats(pbr["baseColorFactor"], base_color_factor, 4);
+
+        InputMap::Ptr base_color = InputMap_ConstantFloat3::Create(
+            RadeonRays::float3(base_color_factor[0], base_color_factor[1], base_color_factor[2]));
+
+        if (auto texture = GetTexture(image_io, document, pbr["baseColorTexture"], basepath, scene))
+        {
+            base_color = InputMap_Mul::Create(InputMap_Pow::Create(InputMap_Sampler::Create(texture), gamma), base_color);
+        }
+
+        res->SetInputValue("uberv2.diffuse.color", base_color);
+        res->SetInputValue("uberv2.reflection.color", base_color);
+
+        // Metalness is in the blue channel and roughness in the green one
+        InputMap::Ptr metalness = InputMap_ConstantFloat::Create(static_cast<float>(pbr["metallicFactor"].AsNumber(1.0)));
+        InputMap::Ptr roughness = InputMap_ConstantFloat::Create(static_cast<float>(pbr["roughnessFactor"].AsNumber(1.0)));
+
+        if (auto texture = GetTexture(image_io, document, pbr["metallicRoughnessTexture"], basepath, scene))
+        {
+            auto sampler = InputMap_Sampler::Create(texture);
+            metalness = InputMap_Mul::Create(InputMap_Select::Create(sampler, InputMap_Select::Selection::kZ), metalness);
+            roughness = InputMap_Mul::Create(InputMap_Select::Create(sampler, InputMap_Select::Selection::kY), roughness);
+        }
+
+        res->SetInputValue("uberv2.reflection.metalness", metalness);
+        res->SetInputValue("uberv2.reflection.roughness", roughness);
+        res->SetInputValue("uberv2.reflection.ior", InputMap_ConstantFloat::Create(1.5f));
+
+        if (auto texture = GetTexture(image_io, document, material["normalTexture"], basepath, scene))
+        {
+            material_layers |= UberV2Material::Layers::kShadingNormalLayer;
+
+            res->SetInputValue("uberv2.shading_normal", InputMap_Remap::Create(
+                InputMap_ConstantFloat3::Create(RadeonRays::float3(0.f, 1.f, 0.f)),
+                InputMap_ConstantFloat3::Create(RadeonRays::float3(-1.f, 1.f, 0.f)),
+                InputMap_Sampler::Create(texture)));
+        }
+
+        float emissive_factor[3] = { 0.f, 0.f, 0.f };
+        GetFloats(material["emissiveFactor"], emissive_factor, 3);
+
+        RadeonRays::float3 emission(emissive_factor[0], emissive_factor[1], emissive_factor[2]);
+        if (emission.sqnorm() > 0.f)
+        {
+            material_layers |= UberV2Material::Layers::kEmissionLayer;
+
+            InputMap::Ptr emission_color = InputMap_ConstantFloat3::Create(emission);
+            if (auto texture = GetTexture(image_io, document, material["emissiveTexture"], basepath, scene))
+            {
+                emission_color = InputMap_Mul::Create(InputMap_Pow::Create(InputMap_Sampler::Create(texture), gamma), emission_color);
+            }
+
+            res->SetInputValue("uberv2.emission.color", emission_color);
+        }
+
+        res->SetLayers(material_layers);
+
+        return res;
+    }
+
+    void SceneIoGltf::LoadLight(JsonValue const& light, RadeonRays::matrix const& transform, Scene1& scene) const
+    {
+        float color[3] = { 1.f, 1.f, 1.f };
+        GetFloats(light["color"], color, 3);
+
+        auto intensity = static_cast<float>(light["intensity"].AsNumber(1.0));
+        auto radiance = intensity * RadeonRays::float3(color[0], color[1], color[2]);
+
+        // Lights shine along -z of their node
+        auto position = RadeonRays::float3(transform.m[0][3], transform.m[1][3], transform.m[2][3]);
+        auto direction = RadeonRays::normalize(RadeonRays::float3(-transform.m[0][2], -transform.m[1][2], -transform.m[2][2]));
+
+        auto const& type = light["type"].AsString();
+        if (type == "point")
+        {
+            auto res = PointLight::Create();
+            res->SetName(light["name"].AsString());
+            res->SetEmittedRadiance(radiance);
+            res->SetPosition(position);
+            scene.AttachLight(res);
+        }
+        else if (type == "directional")
+        {
+            auto res = DirectionalLight::Create();
+            res->SetName(light["name"].AsString());
+            res->SetEmittedRadiance(radiance);
+            res->SetDirection(direction);
+            scene.AttachLight(res);
+        }
+        else if (type == "spot")
+        {
+            auto const& spot = light["spot"];
+            auto inner_angle = static_cast<float>(spot["innerConeAngle"].AsNumber(0.0));
+            auto outer_angle = static_cast<float>(spot["outerConeAngle"].AsNumber(PI / 4.0));
+
+            auto res = SpotLight::Create();
+            res->SetName(light["name"].AsString());
+            res->SetEmittedRadiance(radiance);
+            res->SetPosition(position);
+            res->SetDirection(direction);
+            res->SetConeShape(RadeonRays::float2(std::cos(inner_angle), std::cos(outer_angle)));
+            scene.AttachLight(res);
+        }
+        else
+        {
+            LogInfo("glTF: unsupported light type ", type, "\n");
+        }
+    }
+
+    Scene1::Ptr SceneIoGltf::LoadScene(std::string const& filename, std::string const& basepath) const
+    {
+        auto image_io(ImageIo::CreateImageIo());
+        auto& scheduler = GetScheduler();
+
+        LogInfo("Loading a scene from glTF: ", filename, " ... ");
+        auto document = LoadDocument(filename, basepath);
+        LogInfo("Success\n");
+
+        auto const& json = document.json;
+        auto const& nodes = json["nodes"];
+        auto const& meshes = json["meshes"];
+        auto const& lights = json["extensions"]["KHR_lights_punctual"]["lights"];
+
+        auto scene = Scene1::Create();
+
+        // Textures are decoded in parallel after all the materials are translated
+        auto const& gltf_materials = json["materials"];
+        std::vector<Material::Ptr> materials(gltf_materials.GetSize());
+        for (std::size_t i = 0; i < materials.size(); ++i)
+        {
+            materials[i] = TranslateMaterial(*image_io, document, gltf_materials.At(i), basepath, *scene);
+        }
+
+        LoadPendingTextures(*image_io);
+
+        // Root nodes of the default scene, or the nodes nobody has as a child
+        std::vector<std::size_t> roots;
+        auto const& scenes = json["scenes"];
+        if (scenes.GetSize() > 0)
+        {
+            auto scene_index = json.HasMember("scene") ? GetIndex(json["scene"], scenes.GetSize(), "scene index") : 0;
+            auto const& scene_nodes = scenes.At(scene_index)["nodes"];
+
+            for (std::size_t i = 0; i < scene_nodes.GetSize(); ++i)
+            {
+                roots.push_back(GetIndex(scene_nodes.At(i), nodes.GetSize(), "node index"));
+            }
+        }
+        else
+        {
+            std::vector<char> is_child(nodes.GetSize(), 0);
+            for (std::size_t i = 0; i < nodes.GetSize(); ++i)
+            {
+                auto const& children = nodes.At(i)["children"];
+                for (std::size_t c = 0; c < children.GetSize(); ++c)
+                {
+                    is_child[GetIndex(children.At(c), nodes.GetSize(), "node index")] = 1;
+                }
+            }
+
+            for (std::size_t i = 0; i < nodes.GetSize(); ++i)
+            {
+                if (!is_child[i])
+                {
+                    roots.push_back(i);
+                }
+            }
+        }
+
+        // Walk the hierarchy, lights are created right away and mesh nodes are collected
+        std::vector<MeshNode> mesh_nodes;
+        std::vector<char> visited(nodes.GetSize(), 0);
+        std::stack<std::pair<std::size_t, RadeonRays::matrix>> node_stack;
+
+        for (auto root = roots.crbegin(); root != roots.crend(); ++root)
+        {
+            node_stack.emplace(*root, RadeonRays::matrix());
+        }
+
+        while (!node_stack.empty())
+        {
+            auto index = node_stack.top().first;
+            auto transform = node_stack.top().second;
+            node_stack.pop();
+
+            if (visited[index])
+            {
+                throw std::runtime_error("glTF: node " + std::to_string(index) + " has several parents");
+            }
+            visited[index] = 1;
+
+            auto const& node = nodes.At(index);
+            transform = transform * GetNodeTransform(node);
+
+            if (node.HasMember("mesh"))
+            {
+                mesh_nodes.push_back({ GetIndex(node["mesh"], meshes.GetSize(), "mesh index"), transform, node["name"].AsString() });
+            }
+
+            auto const& light = node["extensions"]["KHR_lights_punctual"]["light"];
+            if (!light.IsNull())
+            {
+                LoadLight(lights.At(GetIndex(light, lights.GetSize(), "light index")), transform, *scene);
+            }
+
+            auto const& children = node["children"];
+            for (auto c = children.GetSize(); c > 0; --c)
+            {
+                node_stack.emplace(GetIndex(children.At(c - 1), nodes.GetSize(), "node index"), transform);
+            }
+        }
+
+        // Triangle primitives of the referenced meshes in order of the first reference
+        std::vector<std::size_t> mesh_first_primitive(meshes.GetSize(), 0);
+        std::vector<char> mesh_used(meshes.GetSize(), 0);
+        std::vector<std::pair<std::size_t, std::size_t>> primitives;
+        for (auto const& mesh_node : mesh_nodes)
+        {
+            if (mesh_used[mesh_node.mesh])
+            {
+                continue;
+            }
+
+            mesh_used[mesh_node.mesh] = 1;
+            mesh_first_primitive[mesh_node.mesh] = primitives.size();
+
+            auto const& mesh_primitives = meshes.At(mesh_node.mesh)["primitives"];
+            for (std::size_t p = 0; p < mesh_primitives.GetSize(); ++p)
+            {
+                primitives.emplace_back(mesh_node.mesh, p);
+            }
+        }
+
+        // Buffers are built in parallel, scene objects are created serially afterwards
+        std::vector<PrimitiveData> primitive_data(primitives.size());
+        scheduler.ParallelFor(primitives.size(), 1, [&](std::size_t begin, std::size_t end)
+        {
+            for (auto i = begin; i < end; ++i)
+            {
+                auto const& primitive = meshes.At(primitives[i].first)["primitives"].At(primitives[i].second);
+
+                if (GetSize(primitive["mode"], kTriangles, "primitive mode") == kTriangles)
+                {
+                    primitive_data[i] = LoadPrimitive(document, primitive);
+                }
+            }
+        });
+
+        std::vector<Mesh::Ptr> primitive_meshes(primitives.size());
+        for (std::size_t i = 0; i < primitives.size(); ++i)
+        {
+            auto& data = primitive_data[i];
+            if (data.indices.empty())
+            {
+                continue;
+            }
+
+            auto const& primitive = meshes.At(primitives[i].first)["primitives"].At(primitives[i].second);
+
+            auto mesh = Mesh::Create();
+            mesh->SetVertices(std::move(data.vertices));
+            mesh->SetNormals(std::move(data.normals));
+            mesh->SetUVs(std::move(data.uvs));
+            mesh->SetIndices(std::move(data.indices));
+
+            if (primitive.HasMember("material"))
+            {
+                mesh->SetMaterial(materials[GetIndex(primitive["material"], materials.size(), "material index")]);
+            }
+
+            primitive_meshes[i] = mesh;
+        }
+
+        // The first node referencing a mesh gets its primitives, the others instance them
+        std::fill(mesh_used.begin(), mesh_used.end(), 0);
+        for (auto const& mesh_node : mesh_nodes)
+        {
+            auto first = mesh_first_primitive[mesh_node.mesh];
+            auto num_primitives = meshes.At(mesh_node.mesh)["primitives"].GetSize();
+            auto is_instance = mesh_used[mesh_node.mesh] != 0;
+            mesh_used[mesh_node.mesh] = 1;
+
+            for (auto i = first; i < first + num_primitives; ++i)
+            {
+                auto const& mesh = primitive_meshes[i];
+                if (!mesh)
+                {
+                    continue;
+                }
+
+                if (!is_instance)
+                {
+                    mesh->SetName(mesh_node.name);
+                    mesh->SetTransform(mesh_node.transform);
+                    scene->AttachShape(mesh);
+
+                    // Area lights are sampled from the mesh itself, so instances do not emit
+                    auto material = mesh->GetMaterial();
+                    if (material && material->HasEmission())
+                    {
+                        for (std::size_t l = 0; l < mesh->GetNumIndices() / 3; ++l)
+                        {
+                            scene->AttachLight(AreaLight::Create(mesh, l));
+                        }
+                    }
+                }
+                else
+                {
+                    auto instance = Instance::Create(mesh);
+                    instance->SetName(mesh_node.name);
+                    instance->SetTransform(mesh_node.transform);
+                    instance->SetMaterial(mesh->GetMaterial());
+                    scene->AttachShape(instance);
+                }
+            }
+        }
+
+        return scene;
+    }
+}
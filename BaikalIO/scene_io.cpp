@@ -7,12 +7,15 @@
 #include "SceneGraph/texture.h"
 #include "math/mathutils.h"
 
+#include <algorithm>
 #include <string>
+#include <fstream>
 #include <map>
 #include <set>
 #include <cassert>
 
 #include "Utils/log.h"
+#include "Utils/task_scheduler.h"
 
 namespace Baikal
 {
@@ -71,22 +74,62 @@ namespace Baikal
         {
             return iter->second;
         }
-        else
+
+        if (!std::ifstream(fname).good())
+        {
+            LogInfo("Missing texture: ", name, "\n");
+            return nullptr;
+        }
+
+        auto texture = Texture::Create();
+        texture->SetName(name);
+        m_texture_cache[name] = texture;
+        m_pending_textures.emplace_back(fname, texture);
+        return texture;
+    }
+
+    void SceneIo::Loader::LoadPendingTextures(ImageIo const& io) const
+    {
+        if (m_pending_textures.empty())
+        {
+            return;
+        }
+
+        LogInfo("Loading ", m_pending_textures.size(), " textures\n");
+
+        // Failed decodes keep the checkerboard, they are logged after the workers are done
+        std::vector<char> failed(m_pending_textures.size(), 0);
+
+        GetScheduler().ParallelFor(m_pending_textures.size(), 1, [&](std::size_t begin, std::size_t end)
         {
-            try
+            for (auto i = begin; i < end; ++i)
             {
-                LogInfo("Loading ", name, "\n");
-                auto texture = io.LoadImage(fname);
-                texture->SetName(name);
-                m_texture_cache[name] = texture;
-                return texture;
+                try
+                {
+                    auto decoded = io.LoadImage(m_pending_textures[i].first);
+                    m_pending_textures[i].second->TakeData(*decoded);
+                }
+                catch (std::runtime_error&)
+                {
+                    failed[i] = 1;
+                }
             }
-            catch (std::runtime_error)
+        });
+
+        for (auto i = 0u; i < m_pending_textures.size(); ++i)
+        {
+            if (failed[i])
             {
-                LogInfo("Missing texture: ", name, "\n");
-                return nullptr;
+                LogInfo("Can't load texture: ", m_pending_textures[i].second->GetName(), "\n");
             }
         }
+
+        m_pending_textures.clear();
+    }
+
+    TaskScheduler& SceneIo::Loader::GetScheduler()
+    {
+        return TaskScheduler::Get();
     }
 
     SceneIo::Loader::Loader(const std::string& ext, SceneIo::Loader *loader) :
@@ -31,6 +31,8 @@
 #include <string>
 #include <memory>
 #include <map>
+#include <utility>
+#include <vector>
 #include "SceneGraph/texture.h"
 #include "SceneGraph/scene1.h"
 
@@ -50,6 +52,7 @@ namespace Baikal
     class Scene1;
     class Texture;
     class ImageIo;
+    class TaskScheduler;
     
     /**
      \brief Interface for scene loading
@@ -76,7 +79,13 @@ namespace Baikal
             virtual ~Loader();
 
         protected:
+            // Texture is returned right away holding the default checkerboard and is decoded by LoadPendingTextures,
+            // missing files give nullptr. Textures are shared by name.
             Texture::Ptr LoadTexture(ImageIo const& io, Scene1& scene, std::string const& basepath, std::string const& name) const;
+            // Decode all the textures returned by LoadTexture since the last call in parallel
+            void LoadPendingTextures(ImageIo const& io) const;
+            // Shared scheduler running parsing and texture decoding of all the loaders
+            static TaskScheduler& GetScheduler();
 
         private:
             Loader(const Loader &) = delete;
@@ -84,6 +93,8 @@ namespace Baikal
 
             std::string m_ext;
             mutable std::map<std::string, Texture::Ptr> m_texture_cache;
+            // Placeholder textures and their files waiting for LoadPendingTextures
+            mutable std::vector<std::pair<std::string, Texture::Ptr>> m_pending_textures;
         };
 
         // Registers extension handler
@@ -22,6 +22,8 @@ THE SOFTWARE.
 
 #include "scene_io.h"
 #include "image_io.h"
+#include "mapped_file.h"
+#include "obj_parser.h"
 #include "SceneGraph/scene1.h"
 #include "SceneGraph/shape.h"
 #include "SceneGraph/material.h"
@@ -32,13 +34,14 @@ THE SOFTWARE.
 #include "SceneGraph/uberv2material.h"
 #include "SceneGraph/inputmaps.h"
 
+#include <algorithm>
 #include <string>
 #include <map>
 #include <set>
-#include <cassert>
 
 #include "Utils/tiny_obj_loader.h"
 #include "Utils/log.h"
+#include "Utils/task_scheduler.h"
 
 namespace Baikal
 {
@@ -69,24 +72,28 @@ namespace Baikal
 
     Scene1::Ptr SceneIoObj::LoadScene(std::string const& filename, std::string const& basepath) const
     {
-        using namespace tinyobj;
-
         auto image_io(ImageIo::CreateImageIo());
-
-        // Loader data
-        std::vector<shape_t> objshapes;
-        std::vector<material_t> objmaterials;
+        auto& scheduler = GetScheduler();
 
         // Try loading file
         LogInfo("Loading a scene from OBJ: ", filename, " ... ");
-        std::string err;
-        auto res = LoadObj(objshapes, objmaterials, err, filename.c_str(), basepath.c_str(), triangulation|calculate_normals);
-        if (!res)
+        ObjData obj;
         {
-            throw std::runtime_error(err);
+            MappedFile file(filename);
+            obj = ParseObj(file.GetData(), file.GetSize(), scheduler);
         }
         LogInfo("Success\n");
 
+        // Load all material libraries before resolving usemtl names
+        std::vector<tinyobj::material_t> objmaterials;
+        std::map<std::string, int> material_map;
+        tinyobj::MaterialFileReader material_reader(basepath);
+        for (auto const& library : obj.material_libraries)
+        {
+            std::string err;
+            material_reader(library, objmaterials, material_map, err);
+        }
+
         // Allocate scene
         auto scene = Scene1::Create();
 
@@ -106,103 +113,94 @@ namespace Baikal
             }
         }
 
-        // Enumerate all shapes in the scene
-        for (int s = 0; s < (int)objshapes.size(); ++s)
-        {
-            const auto& shape = objshapes[s];
+        LoadPendingTextures(*image_io);
 
-            // Find all materials used by this shape.
-            std::set<int> used_materials(std::begin(shape.mesh.material_ids), std::end(shape.mesh.material_ids));
-
-            // Split the mesh into multiple meshes, each with only one material.
-            for (int used_material : used_materials)
+        // Unknown names use no material
+        std::vector<int> material_ids(obj.material_names.size(), -1);
+        for (std::size_t i = 0; i < obj.material_names.size(); ++i)
+        {
+            auto iter = material_map.find(obj.material_names[i]);
+            if (iter != material_map.cend())
             {
-                // Map from old index to new index.
-                std::map<unsigned int, unsigned int> used_indices;
-
-                // Remapped indices.
-                std::vector<unsigned int> indices;
-
-                // Collected vertex/normal/texcoord data.
-                std::vector<float> vertices, normals, texcoords;
-
-                // Go through each face in the mesh.
-                for (size_t i = 0; i < shape.mesh.material_ids.size(); ++i)
-                {
-                    // Skip faces which don't use the current material.
-                    if (shape.mesh.material_ids[i] != used_material) continue;
-
-                    const int num_face_vertices = shape.mesh.num_vertices[i];
-                    assert(num_face_vertices == 3 && "expected triangles");
-                    // For each vertex index of this face.
-                    for (int j = 0; j < num_face_vertices; ++j)
-                    {
-                        const unsigned int old_index = shape.mesh.indices[num_face_vertices * i + j];
-                        // Collect vertex/normal/texcoord data. Avoid inserting the same data twice.
-                        auto result = used_indices.emplace(old_index, (unsigned int)(vertices.size() / 3));
-                        if (result.second) // Did insert?
-                        {
-                            // Push the new data.
-                            for (int k = 0; k < 3; ++k)
-                                vertices.push_back(shape.mesh.positions[3 * old_index + k]);
-                            for (int k = 0; k < 3; ++k)
-                                normals.push_back(shape.mesh.normals[3 * old_index + k]);
-                            if (!shape.mesh.texcoords.empty())
-                                for (int k = 0; k < 2; ++k)
-                                    texcoords.push_back(shape.mesh.texcoords[2 * old_index + k]);
-                        }
-                        const unsigned int new_index = result.first->second;
-                        indices.push_back(new_index);
-                    }
-                }
-
-                // Create empty mesh
-                auto mesh = Mesh::Create();
+                material_ids[i] = iter->second;
+            }
+        }
 
-                // Set vertex and index data
-                auto num_vertices = vertices.size() / 3;
-                mesh->SetVertices(&vertices[0], num_vertices);
+        auto get_material_id = [&material_ids](ObjData::Group const& group)
+        {
+            return group.material < 0 ? -1 : material_ids[group.material];
+        };
 
-                auto num_normals = normals.size() / 3;
-                mesh->SetNormals(&normals[0], num_normals);
+        // Meshes of a shape go in ascending material order, groups resolving to the same material are merged
+        std::vector<ObjData::Group const*> sorted_groups;
+        for (auto const& group : obj.groups)
+        {
+            sorted_groups.push_back(&group);
+        }
 
-                auto num_uvs = texcoords.size() / 2;
+        std::stable_sort(sorted_groups.begin(), sorted_groups.end(), [&](ObjData::Group const* lhs, ObjData::Group const* rhs)
+        {
+            return lhs->shape != rhs->shape ? lhs->shape < rhs->shape : get_material_id(*lhs) < get_material_id(*rhs);
+        });
 
-                // If we do not have UVs, generate zeroes
-                if (num_uvs)
-                {
-                    mesh->SetUVs(&texcoords[0], num_uvs);
-                }
-                else
-                {
-                    std::vector<RadeonRays::float2> zero(num_vertices);
-                    std::fill(zero.begin(), zero.end(), RadeonRays::float2(0, 0));
-                    mesh->SetUVs(&zero[0], num_vertices);
-                }
+        std::vector<ObjData::Group> groups;
+        std::vector<int> group_materials;
+        for (auto group : sorted_groups)
+        {
+            auto material_id = get_material_id(*group);
 
-                // Set indices
-                auto num_indices = indices.size();
-                mesh->SetIndices(reinterpret_cast<std::uint32_t const*>(&indices[0]), num_indices);
+            if (!groups.empty() && groups.back().shape == group->shape && group_materials.back() == material_id)
+            {
+                auto& triangles = groups.back().triangles;
+                triangles.insert(triangles.end(), group->triangles.cbegin(), group->triangles.cend());
+            }
+            else
+            {
+                groups.push_back(*group);
+                group_materials.push_back(material_id);
+            }
+        }
 
-                // Set material
+        // Build vertex and index data of all meshes in parallel
+        std::vector<ObjMeshData> mesh_data(groups.size());
+        scheduler.ParallelFor(groups.size(), 1, [&](std::size_t begin, std::size_t end)
+        {
+            for (auto i = begin; i < end; ++i)
+            {
+                mesh_data[i] = BuildObjMesh(obj, groups[i]);
+            }
+        });
 
-                if (used_material >= 0)
-                {
-                    mesh->SetMaterial(materials[used_material]);
-                }
+        for (std::size_t i = 0; i < groups.size(); ++i)
+        {
+            // Create empty mesh
+            auto mesh = Mesh::Create();
+
+            // Set vertex and index data
+            mesh->SetVertices(std::move(mesh_data[i].vertices));
+            mesh->SetNormals(std::move(mesh_data[i].normals));
+            mesh->SetUVs(std::move(mesh_data[i].uvs));
+            mesh->SetIndices(std::move(mesh_data[i].indices));
+            mesh->SetName(obj.shape_names[groups[i].shape]);
+
+            // Set material
+            auto used_material = group_materials[i];
+            if (used_material >= 0)
+            {
+                mesh->SetMaterial(materials[used_material]);
+            }
 
-                // Attach to the scene
-                scene->AttachShape(mesh);
+            // Attach to the scene
+            scene->AttachShape(mesh);
 
-                // If the mesh has emissive material we need to add area light for it
-                if (used_material >= 0 && emissives.find(materials[used_material]) != emissives.cend())
+            // If the mesh has emissive material we need to add area light for it
+            if (used_material >= 0 && emissives.find(materials[used_material]) != emissives.cend())
+            {
+                // Add area light for each polygon of emissive mesh
+                for (std::size_t l = 0; l < mesh->GetNumIndices() / 3; ++l)
                 {
-                    // Add area light for each polygon of emissive mesh
-                    for (std::size_t l = 0; l < mesh->GetNumIndices() / 3; ++l)
-                    {
-                        auto light = AreaLight::Create(mesh, l);
-                        scene->AttachLight(light);
-                    }
+                    auto light = AreaLight::Create(mesh, l);
+                    scene->AttachLight(light);
                 }
             }
         }
@@ -91,10 +91,10 @@ namespace Baikal
         }
 
         auto mesh = Mesh::Create();
-        mesh->SetVertices(&vertices[0], vertices.size());
-        mesh->SetNormals(&normals[0], normals.size());
-        mesh->SetUVs(&uvs[0], uvs.size());
-        mesh->SetIndices(&indices[0], indices.size());
+        mesh->SetVertices(std::move(vertices));
+        mesh->SetNormals(std::move(normals));
+        mesh->SetUVs(std::move(uvs));
+        mesh->SetIndices(std::move(indices));
         mesh->SetName("sphere");
 
         return mesh;
@@ -663,6 +663,214 @@ namespace Baikal
             ibl->SetMultiplier(1.f);
             scene->AttachLight(ibl);
         }
+        // Scenes of the BaikalBench suite
+        else if (fname == "bench_interior")
+        {
+            // Closed room lit by the environment through a single window, so most paths take several bounces
+            auto wall_mtl = UberV2Material::Create();
+            wall_mtl->SetInputValue("uberv2.diffuse.color", InputMap_ConstantFloat3::Create(float3(0.7f, 0.7f, 0.65f)));
+            wall_mtl->SetLayers(UberV2Material::Layers::kDiffuseLayer);
+
+            auto floor_mtl = UberV2Material::Create();
+            floor_mtl->SetInputValue("uberv2.diffuse.color", InputMap_ConstantFloat3::Create(float3(0.4f, 0.25f, 0.15f)));
+            floor_mtl->SetInputValue("uberv2.reflection.color", InputMap_ConstantFloat3::Create(float3(1.f, 1.f, 1.f)));
+            floor_mtl->SetInputValue("uberv2.reflection.roughness", InputMap_ConstantFloat::Create(0.2f));
+            floor_mtl->SetInputValue("uberv2.reflection.ior", InputMap_ConstantFloat::Create(1.5f));
+            floor_mtl->SetLayers(UberV2Material::Layers::kDiffuseLayer | UberV2Material::Layers::kReflectionLayer);
+
+            auto add_quad = [&scene](std::vector<RadeonRays::float3> const& vertices, bool flip, Material::Ptr material)
+            {
+                auto quad = CreateQuad(vertices, flip);
+                quad->SetMaterial(material);
+                scene->AttachShape(quad);
+            };
+
+            // Wall pieces in the x = const plane
+            auto add_wall_x = [&add_quad](float x, float z0, float z1, float y0, float y1, bool flip, Material::Ptr material)
+            {
+                add_quad({ float3(x, y0, z0), float3(x, y0, z1), float3(x, y1, z1), float3(x, y1, z0) }, flip, material);
+            };
+
+            add_quad({ float3(-4, 0, -4), float3(4, 0, -4), float3(4, 0, 4), float3(-4, 0, 4) }, false, floor_mtl);
+            add_quad({ float3(-4, 3, -4), float3(4, 3, -4), float3(4, 3, 4), float3(-4, 3, 4) }, true, wall_mtl);
+            add_quad({ float3(-4, 0, -4), float3(4, 0, -4), float3(4, 3, -4), float3(-4, 3, -4) }, true, wall_mtl);
+            add_quad({ float3(-4, 0, 4), float3(4, 0, 4), float3(4, 3, 4), float3(-4, 3, 4) }, false, wall_mtl);
+            add_wall_x(-4.f, -4.f, 4.f, 0.f, 3.f, false, wall_mtl);
+
+            // Window wall
+            add_wall_x(4.f, -4.f, 4.f, 0.f, 1.f, true, wall_mtl);
+            add_wall_x(4.f, -4.f, 4.f, 2.5f, 3.f, true, wall_mtl);
+            add_wall_x(4.f, -4.f, -1.5f, 1.f, 2.5f, true, wall_mtl);
+            add_wall_x(4.f, 1.5f, 4.f, 1.f, 2.5f, true, wall_mtl);
+
+            float3 const colors[] = { float3(0.8f, 0.2f, 0.2f), float3(0.2f, 0.8f, 0.2f), float3(0.9f, 0.9f, 0.9f) };
+            for (int i = 0; i < 3; ++i)
+            {
+                auto mat = UberV2Material::Create();
+                mat->SetInputValue("uberv2.diffuse.color", InputMap_ConstantFloat3::Create(colors[i]));
+                mat->SetInputValue("uberv2.reflection.color", InputMap_ConstantFloat3::Create(float3(1.f, 1.f, 1.f)));
+                mat->SetInputValue("uberv2.reflection.roughness", InputMap_ConstantFloat::Create(0.05f + 0.3f * i));
+                mat->SetInputValue("uberv2.reflection.ior", InputMap_ConstantFloat::Create(1.5f));
+                mat->SetLayers(UberV2Material::Layers::kDiffuseLayer | UberV2Material::Layers::kReflectionLayer);
+
+                auto sphere = CreateSphere(64, 32, 0.5f, float3(-1.5f + 1.5f * i, 0.5f, -1.f + i));
+                sphere->SetMaterial(mat);
+                scene->AttachShape(sphere);
+            }
+
+            auto ibl_texture = image_io->LoadImage("../Resources/Textures/sky.hdr");
+            auto ibl = ImageBasedLight::Create();
+            ibl->SetTexture(ibl_texture);
+            ibl->SetMultiplier(4.f);
+            scene->AttachLight(ibl);
+        }
+        else if (fname == "bench_exterior_ibl")
+        {
+            // Open scene, most secondary rays escape to the environment
+            auto ground_mtl = UberV2Material::Create();
+            ground_mtl->SetInputValue("uberv2.diffuse.color", InputMap_ConstantFloat3::Create(float3(0.5f, 0.5f, 0.5f)));
+            ground_mtl->SetLayers(UberV2Material::Layers::kDiffuseLayer);
+
+            auto ground = CreateQuad(
+            {
+                RadeonRays::float3(-50, 0, -50),
+                RadeonRays::float3(50, 0, -50),
+                RadeonRays::float3(50, 0, 50),
+                RadeonRays::float3(-50, 0, 50),
+            }
+            , false);
+            ground->SetMaterial(ground_mtl);
+            scene->AttachShape(ground);
+
+            for (int i = 0; i < 5; ++i)
+            {
+                for (int j = 0; j < 5; ++j)
+                {
+                    auto mat = UberV2Material::Create();
+                    mat->SetInputValue("uberv2.diffuse.color", InputMap_ConstantFloat3::Create(float3(0.2f + 0.15f * i, 0.5f, 0.8f - 0.15f * j)));
+                    mat->SetInputValue("uberv2.reflection.color", InputMap_ConstantFloat3::Create(float3(1.f, 1.f, 1.f)));
+                    mat->SetInputValue("uberv2.reflection.roughness", InputMap_ConstantFloat::Create(0.02f + 0.1f * j));
+                    mat->SetInputValue("uberv2.reflection.ior", InputMap_ConstantFloat::Create(1.5f));
+                    mat->SetLayers(UberV2Material::Layers::kDiffuseLayer | UberV2Material::Layers::kReflectionLayer);
+
+                    auto sphere = CreateSphere(64, 32, 0.8f, float3(i * 2.f - 4.f, 0.8f, j * 2.f - 4.f));
+                    sphere->SetMaterial(mat);
+                    scene->AttachShape(sphere);
+                }
+            }
+
+            auto ibl_texture = image_io->LoadImage("../Resources/Textures/sky.hdr");
+            auto ibl = ImageBasedLight::Create();
+            ibl->SetTexture(ibl_texture);
+            ibl->SetMultiplier(1.f);
+            scene->AttachLight(ibl);
+        }
+        else if (fname == "bench_instancing")
+        {
+            // 64x64 instances of a single sphere mesh over a ground plane
+            auto mesh = CreateSphere(32, 16, 0.2f, float3());
+            auto ground_mtl = UberV2Material::Create();
+            ground_mtl->SetInputValue("uberv2.diffuse.color", InputMap_ConstantFloat3::Create(float3(0.5f, 0.5f, 0.5f)));
+            ground_mtl->SetLayers(UberV2Material::Layers::kDiffuseLayer);
+            mesh->SetMaterial(ground_mtl);
+
+            auto ground = CreateQuad(
+            {
+                RadeonRays::float3(-20, 0, -20),
+                RadeonRays::float3(20, 0, -20),
+                RadeonRays::float3(20, 0, 20),
+                RadeonRays::float3(-20, 0, 20),
+            }
+            , false);
+            ground->SetMaterial(ground_mtl);
+            scene->AttachShape(ground);
+
+            std::vector<Material::Ptr> materials;
+            for (int i = 0; i < 4; ++i)
+            {
+                auto mat = UberV2Material::Create();
+                mat->SetInputValue("uberv2.diffuse.color", InputMap_ConstantFloat3::Create(float3(0.2f * i + 0.2f, 0.8f - 0.2f * i, 0.5f)));
+                mat->SetLayers(UberV2Material::Layers::kDiffuseLayer);
+                materials.push_back(mat);
+            }
+
+            int const kGridSize = 64;
+            for (int i = 0; i < kGridSize; ++i)
+            {
+                for (int j = 0; j < kGridSize; ++j)
+                {
+                    // Sizes vary in a fixed pattern so results are comparable between runs
+                    auto s = 0.5f + 0.5f * ((i * 7 + j * 13) % 11) / 10.f;
+                    auto instance = Instance::Create(mesh);
+                    instance->SetTransform(RadeonRays::translation(float3(i * 0.5f - 16.f, 0.2f * s, j * 0.5f - 16.f)) *
+                        RadeonRays::scale(float3(s, s, s)));
+                    instance->SetMaterial(materials[(i + j) % materials.size()]);
+                    scene->AttachShape(instance);
+                }
+            }
+
+            auto ibl_texture = image_io->LoadImage("../Resources/Textures/studio015.hdr");
+            auto ibl = ImageBasedLight::Create();
+            ibl->SetTexture(ibl_texture);
+            ibl->SetMultiplier(1.f);
+            scene->AttachLight(ibl);
+        }
+        else if (fname == "bench_textures")
+        {
+            // 48 quads with their own 1024x1024 RGBA8 texture each, 192MB of texels in total
+            int const kTextureSize = 1024;
+            int const kColumns = 8;
+            int const kRows = 6;
+
+            for (int i = 0; i < kRows; ++i)
+            {
+                for (int j = 0; j < kColumns; ++j)
+                {
+                    auto index = i * kColumns + j;
+                    auto data = new char[kTextureSize * kTextureSize * 4];
+
+                    // Checker with a different cell size and tint per texture
+                    auto cell = 8 << (index % 5);
+                    for (int y = 0; y < kTextureSize; ++y)
+                    {
+                        for (int x = 0; x < kTextureSize; ++x)
+                        {
+                            auto texel = reinterpret_cast<unsigned char*>(data) + (y * kTextureSize + x) * 4;
+                            auto on = ((x / cell) + (y / cell)) % 2 != 0;
+                            texel[0] = static_cast<unsigned char>(on ? 64 + (index * 37) % 192 : 32);
+                            texel[1] = static_cast<unsigned char>(on ? 64 + (index * 71) % 192 : 32);
+                            texel[2] = static_cast<unsigned char>(on ? 64 + (index * 13) % 192 : 32);
+                            texel[3] = static_cast<unsigned char>(255);
+                        }
+                    }
+
+                    auto texture = Texture::Create(data, RadeonRays::int3(kTextureSize, kTextureSize, 1), Texture::Format::kRgba8);
+
+                    auto mat = UberV2Material::Create();
+                    mat->SetInputValue("uberv2.diffuse.color", InputMap_Sampler::Create(texture));
+                    mat->SetLayers(UberV2Material::Layers::kDiffuseLayer);
+
+                    auto x = j * 1.1f - 4.4f;
+                    auto y = i * 1.1f;
+                    auto quad = CreateQuad(
+                    {
+                        RadeonRays::float3(x, y, 0),
+                        RadeonRays::float3(x + 1.f, y, 0),
+                        RadeonRays::float3(x + 1.f, y + 1.f, 0),
+                        RadeonRays::float3(x, y + 1.f, 0),
+                    }
+                    , true);
+                    quad->SetMaterial(mat);
+                    scene->AttachShape(quad);
+                }
+            }
+
+            auto ibl_texture = image_io->LoadImage("../Resources/Textures/studio015.hdr");
+            auto ibl = ImageBasedLight::Create();
+            ibl->SetTexture(ibl_texture);
+            ibl->SetMultiplier(1.f);
+            scene->AttachLight(ibl);
+        }
 
 
         return scene;
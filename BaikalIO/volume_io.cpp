@@ -0,0 +1,145 @@
+#include "volume_io.h"
+
+#include <stdexcept>
+
+#ifdef BAIKAL_ENABLE_OPENVDB
+#include <openvdb/openvdb.h>
+
+#include <algorithm>
+#endif
+
+namespace Baikal
+{
+#ifdef BAIKAL_ENABLE_OPENVDB
+    class Vdb : public VolumeIo
+    {
+    public:
+        VolumeMaterial::SparseDensityGrid LoadVolume(std::string const& filename, std::string const& grid_name) const override;
+    };
+
+    VolumeMaterial::SparseDensityGrid Vdb::LoadVolume(std::string const& filename, std::string const& grid_name) const
+    {
+        auto const brick_size = static_cast<int>(VolumeMaterial::SparseDensityGrid::kBrickSize);
+
+        openvdb::initialize();
+
+        openvdb::FloatGrid::Ptr grid;
+
+        try
+        {
+            openvdb::io::File file(filename);
+            file.open();
+
+            if (grid_name.empty())
+            {
+                for (auto iter = file.beginName(); iter != file.endName() && !grid; ++iter)
+                {
+                    grid = openvdb::gridPtrCast<openvdb::FloatGrid>(file.readGrid(iter.gridName()));
+                }
+            }
+            else if (file.hasGrid(grid_name))
+            {
+                grid = openvdb::gridPtrCast<openvdb::FloatGrid>(file.readGrid(grid_name));
+            }
+
+            file.close();
+        }
+        catch (openvdb::Exception const& e)
+        {
+            throw std::runtime_error("Can't load " + filename + " volume: " + e.what());
+        }
+
+        if (!grid)
+        {
+            throw std::runtime_error("Can't load " + filename + " volume: no float grid " + grid_name);
+        }
+
+        if (!grid->transform().isLinear())
+        {
+            throw std::runtime_error("Can't load " + filename + " volume: grid transform is not linear");
+        }
+
+        auto active = grid->evalActiveVoxelBoundingBox();
+
+        if (active.empty())
+        {
+            throw std::runtime_error("Can't load " + filename + " volume: grid has no active voxels");
+        }
+
+        // Index space starts at a leaf boundary, so bricks are the leaves of the grid
+        openvdb::Coord origin;
+        for (auto axis = 0; axis < 3; ++axis)
+        {
+            origin[axis] = active.min()[axis] & ~(brick_size - 1);
+        }
+
+        VolumeMaterial::SparseDensityGrid result;
+
+        for (auto axis = 0; axis < 3; ++axis)
+        {
+            result.resolution[axis] = static_cast<std::uint32_t>(active.max()[axis] - origin[axis] + 1);
+        }
+
+        // Voxel values are at their centers in VDB index space, rotations are approximated by the bounds
+        auto pmin = grid->indexToWorld(origin.asVec3d() - openvdb::Vec3d(0.5));
+        auto pmax = grid->indexToWorld(active.max().asVec3d() + openvdb::Vec3d(0.5));
+
+        result.bounds = RadeonRays::bbox(
+            RadeonRays::float3(static_cast<float>(std::min(pmin.x(), pmax.x())), static_cast<float>(std::min(pmin.y(), pmax.y())), static_cast<float>(std::min(pmin.z(), pmax.z()))),
+            RadeonRays::float3(static_cast<float>(std::max(pmin.x(), pmax.x())), static_cast<float>(std::max(pmin.y(), pmax.y())), static_cast<float>(std::max(pmin.z(), pmax.z()))));
+
+        auto add_brick = [&](openvdb::Coord const& brick_origin, auto const& get_value)
+        {
+            for (auto axis = 0; axis < 3; ++axis)
+            {
+                result.bricks.push_back(static_cast<std::uint32_t>((brick_origin[axis] - origin[axis]) / brick_size));
+            }
+
+            for (auto z = 0; z < brick_size; ++z)
+                for (auto y = 0; y < brick_size; ++y)
+                    for (auto x = 0; x < brick_size; ++x)
+                    {
+                        result.density.push_back(std::max(get_value(brick_origin.offsetBy(x, y, z)), 0.f));
+                    }
+        };
+
+        for (auto leaf = grid->tree().cbeginLeaf(); leaf; ++leaf)
+        {
+            add_brick(leaf->origin(), [&](openvdb::Coord const& voxel)
+            {
+                return leaf->isValueOn(voxel) ? leaf->getValue(voxel) : 0.f;
+            });
+        }
+
+        // Active tiles of the internal nodes are split into constant bricks
+        for (auto iter = grid->cbeginValueOn(); iter; ++iter)
+        {
+            if (!iter.isTileValue())
+            {
+                continue;
+            }
+
+            auto value = *iter;
+            auto box = iter.getBoundingBox();
+
+            for (auto z = box.min().z(); z <= box.max().z(); z += brick_size)
+                for (auto y = box.min().y(); y <= box.max().y(); y += brick_size)
+                    for (auto x = box.min().x(); x <= box.max().x(); x += brick_size)
+                    {
+                        add_brick(openvdb::Coord(x, y, z), [value](openvdb::Coord const&) { return value; });
+                    }
+        }
+
+        return result;
+    }
+#endif
+
+    std::unique_ptr<VolumeIo> VolumeIo::CreateVolumeIo()
+    {
+#ifdef BAIKAL_ENABLE_OPENVDB
+        return std::make_unique<Vdb>();
+#else
+        throw std::runtime_error("VolumeIo: BaikalIO is built without OpenVDB support");
+#endif
+    }
+}
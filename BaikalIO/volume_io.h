@@ -0,0 +1,70 @@
+/**********************************************************************
+ Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+
+/**
+ \file volume_io.h
+ \brief Contains an interface for volume loading
+ */
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "SceneGraph/material.h"
+
+#ifdef WIN32
+#ifdef BAIKAL_EXPORT_API
+#define BAIKAL_API_ENTRY __declspec(dllexport)
+#else
+#define BAIKAL_API_ENTRY __declspec(dllimport)
+#endif
+#else
+#define BAIKAL_API_ENTRY __attribute__((visibility ("default")))
+#endif
+
+namespace Baikal
+{
+    /**
+     \brief Interface for volume loading
+
+     VolumeIo reads voxel grids from disk into sparse density grids of volume materials.
+     */
+    class BAIKAL_API_ENTRY VolumeIo
+    {
+    public:
+        // Create default volume IO, throws std::runtime_error if BaikalIO is built without OpenVDB
+        static std::unique_ptr<VolumeIo> CreateVolumeIo();
+
+        // Constructor
+        VolumeIo() = default;
+        // Destructor
+        virtual ~VolumeIo() = default;
+
+        // Load float grid of the given name from a VDB file, the first float grid is loaded if the name is empty.
+        // Bricks follow the leaves and the active tiles of the grid, negative values are clamped to zero.
+        virtual VolumeMaterial::SparseDensityGrid LoadVolume(std::string const& filename, std::string const& grid_name) const = 0;
+
+        // Disallow copying
+        VolumeIo(VolumeIo const&) = delete;
+        VolumeIo& operator = (VolumeIo const&) = delete;
+    };
+}
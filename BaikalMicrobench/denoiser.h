@@ -0,0 +1,97 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include "microbench.h"
+
+#ifdef ENABLE_DENOISER
+#include "PostEffects/wavelet_denoiser.h"
+#include "scene_io.h"
+
+// Each kernel of the wavelet denoiser on AOVs of a rendered scene, every wavelet pass is reported on its own
+TEST_F(MicrobenchTest, Denoiser_Wavelet)
+{
+    using OutputType = Baikal::Renderer::OutputType;
+
+    auto scene = Baikal::SceneIo::LoadScene("sphere+plane+ibl.test", "");
+    SetupCamera(*scene);
+
+    std::vector<std::unique_ptr<Baikal::Output>> aovs;
+    Baikal::PostEffect::InputSet input_set;
+    input_set[OutputType::kColor] = m_output.get();
+
+    for (auto type : { OutputType::kWorldShadingNormal, OutputType::kWorldPosition, OutputType::kAlbedo, OutputType::kMeshID })
+    {
+        aovs.push_back(m_factory->CreateOutput(kOutputWidth, kOutputHeight));
+        m_renderer->SetOutput(type, aovs.back().get());
+        input_set[type] = aovs.back().get();
+    }
+
+    auto& clw_scene = m_controller->CompileScene(scene);
+    m_renderer->Clear(RadeonRays::float3(), *m_output);
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        m_renderer->Render(clw_scene);
+    }
+
+    auto denoiser = m_factory->CreatePostEffect(Baikal::RenderFactory<Baikal::ClwScene>::PostEffectType::kWaveletDenoiser);
+    auto wavelet_denoiser = dynamic_cast<Baikal::WaveletDenoiser*>(denoiser.get());
+    ASSERT_NE(wavelet_denoiser, nullptr);
+
+    auto denoised = m_factory->CreateOutput(kOutputWidth, kOutputHeight);
+    wavelet_denoiser->Update(m_camera.get());
+
+    // First application allocates the buffers
+    wavelet_denoiser->Apply(input_set, *denoised);
+    m_context.Finish(0);
+
+    Baikal::ClwProfiler profiler(m_context);
+    profiler.SetEnabled(true);
+    wavelet_denoiser->SetProfiler(&profiler);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        wavelet_denoiser->Apply(input_set, *denoised);
+    }
+
+    profiler.Resolve(true);
+    wavelet_denoiser->SetProfiler(nullptr);
+    m_timing_supported = profiler.IsTimingSupported();
+
+    for (auto const& entry : profiler.GetEntries())
+    {
+        if (entry.num_spans == 0)
+        {
+            continue;
+        }
+
+        std::ostringstream name;
+        name << "WaveletDenoiser_" << entry.name;
+        if (entry.pass != Baikal::ClwProfiler::kNoPass)
+        {
+            name << "_pass_" << entry.pass;
+        }
+
+        Report(name.str(), entry.milliseconds / entry.num_spans, kOutputWidth * kOutputHeight, 0u);
+    }
+}
+#endif
@@ -0,0 +1,280 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include "gtest/gtest.h"
+
+#include "CLW.h"
+#include "Renderers/monte_carlo_renderer.h"
+#include "RenderFactory/clw_render_factory.h"
+#include "Controllers/clw_scene_controller.h"
+#include "Output/output.h"
+#include "SceneGraph/camera.h"
+#include "SceneGraph/scene1.h"
+#include "SceneGraph/shape.h"
+#include "Utils/clw_profiler.h"
+#include "math/mathutils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern int g_argc;
+extern char** g_argv;
+
+// Benchmarks report device times of kernels and primitives on synthetic inputs. Every result is printed
+// and recorded as a test property, so --gtest_output=xml:file keeps them for comparisons between runs.
+class MicrobenchTest : public ::testing::Test
+{
+public:
+    static std::uint32_t constexpr kOutputWidth = 512;
+    static std::uint32_t constexpr kOutputHeight = 512;
+    // Samples or launches measured per benchmark after a warm up one
+    static std::uint32_t constexpr kNumIterations = 16;
+
+    virtual void SetUp()
+    {
+        std::vector<CLWPlatform> platforms;
+
+        ASSERT_NO_THROW(CLWPlatform::CreateAllPlatforms(platforms));
+        ASSERT_GT(platforms.size(), 0u);
+
+        char* device_index_option = GetCmdOption(g_argv, g_argv + g_argc, "-device");
+        char* platform_index_option = GetCmdOption(g_argv, g_argv + g_argc, "-platform");
+
+        auto platform_index = platform_index_option ? (int)atoi(platform_index_option) : -1;
+        auto device_index = device_index_option ? (int)atoi(device_index_option) : -1;
+
+        Baikal::SceneObject::ResetId();
+
+        // Prefer GPU devices if nothing has been specified
+        if (platform_index == -1)
+        {
+            platform_index = 0;
+
+            for (auto j = 0u; j < platforms.size(); ++j)
+            {
+                for (auto i = 0u; i < platforms[j].GetDeviceCount(); ++i)
+                {
+                    if (platforms[j].GetDevice(i).GetType() == CL_DEVICE_TYPE_GPU)
+                    {
+                        platform_index = j;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (device_index == -1)
+        {
+            device_index = 0;
+
+            for (auto i = 0u; i < platforms[platform_index].GetDeviceCount(); ++i)
+            {
+                if (platforms[platform_index].GetDevice(i).GetType() == CL_DEVICE_TYPE_GPU)
+                {
+                    device_index = i;
+                    break;
+                }
+            }
+        }
+
+        ASSERT_LT((std::size_t)platform_index, platforms.size());
+        ASSERT_LT((std::uint32_t)device_index, platforms[platform_index].GetDeviceCount());
+
+        auto device = platforms[platform_index].GetDevice(device_index);
+        m_context = CLWContext::Create(device);
+
+        ASSERT_NO_THROW(m_factory = std::make_unique<Baikal::ClwRenderFactory>(m_context, "cache"));
+        ASSERT_NO_THROW(m_renderer = m_factory->CreateRenderer(Baikal::ClwRenderFactory::RendererType::kUnidirectionalPathTracer));
+        ASSERT_NO_THROW(m_controller = m_factory->CreateSceneController());
+        ASSERT_NO_THROW(m_output = m_factory->CreateOutput(kOutputWidth, kOutputHeight));
+        ASSERT_NO_THROW(m_renderer->SetOutput(Baikal::Renderer::OutputType::kColor, m_output.get()));
+        ASSERT_NO_THROW(m_renderer->SetRandomSeed(0));
+    }
+
+    virtual void TearDown()
+    {
+    }
+
+    // Camera at -6 on z axis looking at the origin, a 7x7 quad at z = 0 covers the whole output
+    void SetupCamera(Baikal::Scene1& scene)
+    {
+        m_camera = Baikal::PerspectiveCamera::Create(
+            RadeonRays::float3(0.f, 0.f, -6.f),
+            RadeonRays::float3(0.f, 0.f, 0.f),
+            RadeonRays::float3(0.f, 1.f, 0.f));
+
+        m_camera->SetSensorSize(RadeonRays::float2(0.036f, 0.036f));
+        m_camera->SetDepthRange(RadeonRays::float2(0.0f, 100000.f));
+        m_camera->SetFocalLength(0.035f);
+        m_camera->SetFocusDistance(1.f);
+        m_camera->SetAperture(0.f);
+
+        scene.SetCamera(m_camera);
+    }
+
+    // Quad in the z = 0 plane facing the camera
+    static Baikal::Mesh::Ptr CreateQuad(RadeonRays::float2 const& min, RadeonRays::float2 const& max)
+    {
+        RadeonRays::float3 vertices[] =
+        {
+            RadeonRays::float3(min.x, min.y, 0.f),
+            RadeonRays::float3(max.x, min.y, 0.f),
+            RadeonRays::float3(max.x, max.y, 0.f),
+            RadeonRays::float3(min.x, max.y, 0.f)
+        };
+
+        RadeonRays::float3 n(0.f, 0.f, -1.f);
+        RadeonRays::float3 normals[] = { n, n, n, n };
+
+        RadeonRays::float2 uvs[] =
+        {
+            RadeonRays::float2(0, 0),
+            RadeonRays::float2(1, 0),
+            RadeonRays::float2(1, 1),
+            RadeonRays::float2(0, 1)
+        };
+
+        std::uint32_t indices[] = { 0, 2, 1, 0, 3, 2 };
+
+        auto mesh = Baikal::Mesh::Create();
+        mesh->SetVertices(vertices, 4);
+        mesh->SetNormals(normals, 4);
+        mesh->SetUVs(uvs, 4);
+        mesh->SetIndices(indices, 6);
+        return mesh;
+    }
+
+    // Render kNumIterations samples of the scene with profiling after a warm up sample, which builds the programs
+    std::vector<Baikal::ClwProfiler::Entry> ProfileRender(Baikal::Scene1::Ptr scene)
+    {
+        auto renderer = static_cast<Baikal::MonteCarloRenderer*>(m_renderer.get());
+        auto& clw_scene = m_controller->CompileScene(scene);
+
+        renderer->Clear(RadeonRays::float3(), *m_output);
+        renderer->Render(clw_scene);
+        m_context.Finish(0);
+
+        renderer->SetProfiling(true);
+        auto& profiler = renderer->GetProfiler();
+        profiler.Reset();
+
+        for (auto i = 0u; i < kNumIterations; ++i)
+        {
+            renderer->Render(clw_scene);
+        }
+
+        profiler.Resolve(true);
+        renderer->SetProfiling(false);
+
+        m_timing_supported = profiler.IsTimingSupported();
+        return profiler.GetEntries();
+    }
+
+    // Report average device time of a profiled step over the rays of its pass
+    void ReportStep(std::vector<Baikal::ClwProfiler::Entry> const& entries, std::string const& name,
+                    char const* step, std::uint32_t pass)
+    {
+        auto find = [&entries, pass](char const* step_name)
+        {
+            return std::find_if(entries.cbegin(), entries.cend(), [step_name, pass](Baikal::ClwProfiler::Entry const& e)
+            {
+                return e.name == step_name && e.pass == pass;
+            });
+        };
+
+        auto entry = find(step);
+        auto rays = find("rays");
+
+        if (entry == entries.cend() || entry->num_spans == 0 || rays == entries.cend() || rays->num_counts == 0)
+        {
+            std::cout << "[  BENCH   ] " << name << ": not measured\n";
+            return;
+        }
+
+        Report(name, entry->milliseconds / entry->num_spans, rays->count / rays->num_counts, 0u);
+    }
+
+    // Time a launch sequence on the host, the device queue is drained around each launch
+    template <typename Launch>
+    double MeasureMilliseconds(Launch&& launch)
+    {
+        launch();
+        m_context.Finish(0);
+
+        auto best = std::numeric_limits<double>::max();
+        for (auto i = 0u; i < kNumIterations; ++i)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            launch();
+            m_context.Finish(0);
+            best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+        }
+
+        return best;
+    }
+
+    // Print and record time per launch, items per second and, if bytes are known, memory throughput
+    void Report(std::string const& name, double milliseconds, std::uint64_t items, std::uint64_t bytes)
+    {
+        auto mitems_per_second = milliseconds > 0.0 ? items / (milliseconds * 1e3) : 0.0;
+
+        std::cout << "[  BENCH   ] " << name << ": " << milliseconds << " ms, " << mitems_per_second << " Mitems/s";
+        RecordProperty(name + "_ms", std::to_string(milliseconds));
+        RecordProperty(name + "_mitems_per_second", std::to_string(mitems_per_second));
+
+        if (bytes > 0)
+        {
+            auto gb_per_second = milliseconds > 0.0 ? bytes / (milliseconds * 1e6) : 0.0;
+            std::cout << ", " << gb_per_second << " GB/s";
+            RecordProperty(name + "_gb_per_second", std::to_string(gb_per_second));
+        }
+
+        std::cout << (m_timing_supported ? "" : " (host timed)") << "\n";
+    }
+
+    static char* GetCmdOption(char ** begin, char ** end, const std::string & option)
+    {
+        char ** itr = std::find(begin, end, option);
+        if (itr != end && ++itr != end)
+        {
+            return *itr;
+        }
+        return 0;
+    }
+
+    CLWContext m_context;
+    std::unique_ptr<Baikal::Renderer> m_renderer;
+    std::unique_ptr<Baikal::SceneController<Baikal::ClwScene>> m_controller;
+    std::unique_ptr<Baikal::RenderFactory<Baikal::ClwScene>> m_factory;
+    std::unique_ptr<Baikal::Output> m_output;
+    Baikal::PerspectiveCamera::Ptr m_camera;
+    // Device timing of the last profiled run, host times are reported otherwise
+    bool m_timing_supported = true;
+};
@@ -0,0 +1,68 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include "microbench.h"
+#include "CLWParallelPrimitives.h"
+
+#include <numeric>
+#include <random>
+
+// Stream compaction of the hit predicates as done after every intersection of a pass
+TEST_F(MicrobenchTest, Primitives_Compact)
+{
+    CLWParallelPrimitives pp(m_context, "");
+
+    for (auto num_items : { 1u << 20, 1u << 22 })
+    {
+        // Half of the paths alive in random order, the worst case for compaction
+        std::vector<int> predicates(num_items);
+        std::mt19937 rng(0);
+        std::bernoulli_distribution alive(0.5);
+        std::generate(predicates.begin(), predicates.end(), [&rng, &alive]() { return alive(rng) ? 1 : 0; });
+
+        std::vector<int> indices(num_items);
+        std::iota(indices.begin(), indices.end(), 0);
+
+        auto predicate_buffer = m_context.CreateBuffer<int>(num_items, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &predicates[0]);
+        auto input_buffer = m_context.CreateBuffer<int>(num_items, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &indices[0]);
+        auto output_buffer = m_context.CreateBuffer<int>(num_items, CL_MEM_READ_WRITE);
+        auto count_buffer = m_context.CreateBuffer<int>(1, CL_MEM_READ_WRITE);
+
+        auto milliseconds = MeasureMilliseconds([&]()
+        {
+            pp.Compact(0, predicate_buffer, input_buffer, output_buffer, num_items, count_buffer);
+        });
+
+        int count = 0;
+        m_context.ReadBuffer(0, count_buffer, &count, 1).Wait();
+        ASSERT_EQ(count, std::count(predicates.cbegin(), predicates.cend(), 1));
+
+        // Predicates and inputs are read, scan is written and read back, alive indices are written
+        auto bytes = static_cast<std::uint64_t>(num_items) * sizeof(int) * 4 + count * sizeof(int);
+
+        std::ostringstream name;
+        name << "Compact_" << num_items;
+        m_timing_supported = false;
+        Report(name.str(), milliseconds, num_items, bytes);
+    }
+}
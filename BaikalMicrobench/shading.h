@@ -0,0 +1,212 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include "microbench.h"
+#include "SceneGraph/light.h"
+#include "SceneGraph/material.h"
+#include "SceneGraph/uberv2material.h"
+#include "SceneGraph/inputmaps.h"
+#include "SceneGraph/texture.h"
+#include "Utils/half.h"
+#include "Utils/texture_compression.h"
+
+using namespace Baikal;
+using namespace RadeonRays;
+
+namespace
+{
+    // Layer sets cycled through by the material benchmark, all taking different branches of the uber material
+    std::uint32_t const kLayerCombinations[] =
+    {
+        UberV2Material::Layers::kDiffuseLayer,
+        UberV2Material::Layers::kDiffuseLayer | UberV2Material::Layers::kReflectionLayer,
+        UberV2Material::Layers::kReflectionLayer,
+        UberV2Material::Layers::kDiffuseLayer | UberV2Material::Layers::kCoatingLayer,
+        UberV2Material::Layers::kRefractionLayer,
+        UberV2Material::Layers::kDiffuseLayer | UberV2Material::Layers::kTransparencyLayer,
+        UberV2Material::Layers::kDiffuseLayer | UberV2Material::Layers::kReflectionLayer | UberV2Material::Layers::kCoatingLayer,
+        UberV2Material::Layers::kDiffuseLayer | UberV2Material::Layers::kEmissionLayer
+    };
+
+    std::uint32_t constexpr kTextureSize = 1024;
+
+    // Checker of 32 texel squares with a gradient, so neighbouring texels differ
+    float GetTexelValue(std::uint32_t x, std::uint32_t y, std::uint32_t channel)
+    {
+        auto checker = ((x / 32 + y / 32) & 1) ? 0.8f : 0.2f;
+        return checker * (0.5f + 0.5f * static_cast<float>((x + y * (channel + 1)) % kTextureSize) / kTextureSize);
+    }
+
+    template <typename T, typename Convert>
+    Texture::Ptr CreateTexture(std::uint32_t num_channels, Texture::Format format, Convert convert)
+    {
+        auto data = new char[kTextureSize * kTextureSize * num_channels * sizeof(T)];
+        auto texels = reinterpret_cast<T*>(data);
+
+        for (auto y = 0u; y < kTextureSize; ++y)
+        {
+            for (auto x = 0u; x < kTextureSize; ++x)
+            {
+                for (auto c = 0u; c < num_channels; ++c)
+                {
+                    texels[(y * kTextureSize + x) * num_channels + c] = convert(GetTexelValue(x, y, c));
+                }
+            }
+        }
+
+        return Texture::Create(data, int3(kTextureSize, kTextureSize, 1), format);
+    }
+
+    std::uint8_t ToUnorm8(float value)
+    {
+        return static_cast<std::uint8_t>(value * 255.f + 0.5f);
+    }
+}
+
+// Surface shading of an 8x8 grid of quads covering the output, shared by 1, 8 and 64 uber materials
+TEST_F(MicrobenchTest, Shading_UberV2Materials)
+{
+    std::uint32_t constexpr kGridSize = 8;
+
+    for (auto num_materials : { 1u, 8u, 64u })
+    {
+        auto scene = Scene1::Create();
+        SetupCamera(*scene);
+
+        std::vector<UberV2Material::Ptr> materials;
+        for (auto i = 0u; i < num_materials; ++i)
+        {
+            auto material = UberV2Material::Create();
+            material->SetLayers(kLayerCombinations[i % (sizeof(kLayerCombinations) / sizeof(kLayerCombinations[0]))]);
+            material->SetInputValue("uberv2.diffuse.color",
+                InputMap_ConstantFloat3::Create(float3(0.2f + 0.6f * i / num_materials, 0.5f, 0.8f)));
+            materials.push_back(material);
+        }
+
+        auto quad_size = 7.f / kGridSize;
+        for (auto y = 0u; y < kGridSize; ++y)
+        {
+            for (auto x = 0u; x < kGridSize; ++x)
+            {
+                auto min = float2(-3.5f + x * quad_size, -3.5f + y * quad_size);
+                auto quad = CreateQuad(min, float2(min.x + quad_size, min.y + quad_size));
+                quad->SetMaterial(materials[(y * kGridSize + x) % num_materials]);
+                scene->AttachShape(quad);
+            }
+        }
+
+        auto light = PointLight::Create();
+        light->SetPosition(float3(0.f, 0.f, -3.f));
+        light->SetEmittedRadiance(float3(20.f, 20.f, 20.f));
+        scene->AttachLight(light);
+
+        auto entries = ProfileRender(scene);
+
+        for (auto pass = 0u; pass < 2; ++pass)
+        {
+            std::ostringstream name;
+            name << "ShadeSurfaceUberV2_" << num_materials << "_materials_pass_" << pass;
+            ReportStep(entries, name.str(), "shade_surface", pass);
+        }
+    }
+}
+
+// Surface shading of a full screen quad with a diffuse texture of every format, camera rays sample the
+// texture once per pixel, so differences of primary pass shading times come from the texture fetches
+TEST_F(MicrobenchTest, Shading_TextureFormats)
+{
+    auto rgba8 = CreateTexture<std::uint8_t>(4, Texture::Format::kRgba8, ToUnorm8);
+
+    std::vector<std::pair<char const*, Texture::Ptr>> textures =
+    {
+        { "Rgba8", rgba8 },
+        { "Rgba16", CreateTexture<half>(4, Texture::Format::kRgba16, [](float v) { return half(v); }) },
+        { "Rgba32", CreateTexture<float>(4, Texture::Format::kRgba32, [](float v) { return v; }) },
+        { "R8", CreateTexture<std::uint8_t>(1, Texture::Format::kR8, ToUnorm8) },
+        { "Rg8", CreateTexture<std::uint8_t>(2, Texture::Format::kRg8, ToUnorm8) },
+        { "Bc1", TextureCompression::Compress(*rgba8, Texture::Format::kBc1) }
+    };
+
+    for (auto const& texture : textures)
+    {
+        auto scene = Scene1::Create();
+        SetupCamera(*scene);
+
+        auto material = UberV2Material::Create();
+        material->SetLayers(UberV2Material::Layers::kDiffuseLayer);
+        material->SetInputValue("uberv2.diffuse.color", InputMap_Sampler::Create(texture.second));
+
+        auto quad = CreateQuad(float2(-4.f, -4.f), float2(4.f, 4.f));
+        quad->SetMaterial(material);
+        scene->AttachShape(quad);
+
+        auto light = PointLight::Create();
+        light->SetPosition(float3(0.f, 0.f, -3.f));
+        light->SetEmittedRadiance(float3(20.f, 20.f, 20.f));
+        scene->AttachLight(light);
+
+        auto entries = ProfileRender(scene);
+
+        std::ostringstream name;
+        name << "TextureSample2D_" << texture.first;
+        ReportStep(entries, name.str(), "shade_surface", 0);
+    }
+}
+
+// Light sampling of a diffuse floor lit by a grid of 1, 16 and 256 point lights
+TEST_F(MicrobenchTest, Shading_GatherLightSamples)
+{
+    for (auto grid_size : { 1u, 4u, 16u })
+    {
+        auto scene = Scene1::Create();
+        SetupCamera(*scene);
+
+        auto material = UberV2Material::Create();
+        material->SetLayers(UberV2Material::Layers::kDiffuseLayer);
+        material->SetInputValue("uberv2.diffuse.color", InputMap_ConstantFloat3::Create(float3(0.8f, 0.8f, 0.8f)));
+
+        auto floor = CreateQuad(float2(-4.f, -4.f), float2(4.f, 4.f));
+        floor->SetMaterial(material);
+        scene->AttachShape(floor);
+
+        auto num_lights = grid_size * grid_size;
+        auto spacing = 7.f / grid_size;
+        for (auto y = 0u; y < grid_size; ++y)
+        {
+            for (auto x = 0u; x < grid_size; ++x)
+            {
+                auto light = PointLight::Create();
+                light->SetPosition(float3(-3.5f + (x + 0.5f) * spacing, -3.5f + (y + 0.5f) * spacing, -1.f));
+                light->SetEmittedRadiance(float3(20.f, 20.f, 20.f) * (1.f / num_lights));
+                scene->AttachLight(light);
+            }
+        }
+
+        auto entries = ProfileRender(scene);
+
+        std::ostringstream name;
+        name << "GatherLightSamples_" << num_lights << "_lights";
+        ReportStep(entries, name.str(), "gather_lights", 0);
+        ReportStep(entries, name.str() + "_shade_surface", "shade_surface", 0);
+    }
+}
@@ -20,13 +20,14 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 ********************************************************************/
 #include "Application/app_utils.h"
+#include "Utils/task_scheduler.h"
 
 #include <iostream>
 
 namespace
 {
     char const* kHelpMessage =
-        "Baikal [-p path_to_models][-f model_name][-b][-r][-ns number_of_shadow_rays][-ao ao_radius][-w window_width][-h window_height][-nb number_of_indirect_bounces]";
+        "Baikal [-p path_to_models][-f model_name][-b][-r][-ns number_of_shadow_rays][-ao ao_radius][-aorays number_of_ao_rays][-w window_width][-h window_height][-nb number_of_indirect_bounces][-gcache geometry_cache_megabytes][-tcache texture_cache_megabytes][-devresident 0|1][-membudget device_memory_percent][-split 0|1][-motionscale 1|2|4][-views number_of_views][-viewsep view_separation][-worker port][-coordinator host:port,host:port][-stats stats_file.json][-trace trace_file.json][-port server_port][-optmesh 0|1][-camset cameras.txt][-camsetmin first][-camsetmax last][-camout output_folder][-dataset camera.xml][-datasetlights light.xml][-datasetspp max_input_samples][-thumbnails output_folder][-thumbsize pixels][-checkpoint checkpoint_file][-checkpointinterval seconds][-sharedcache program_cache_folder][-warmup][-kprofile default|fast|reference][-accel auto|fast|balanced|quality][-benchout results.json][-benchscenes name,name][-threads number_of_host_workers]";
 }
 
 namespace Baikal
@@ -54,8 +55,11 @@ namespace Baikal
         char* height = GetCmdOption(argv, argv + argc, "-h");
         s.height = width ? atoi(height) : s.height;
 
-        char* aorays = GetCmdOption(argv, argv + argc, "-ao");
-        s.ao_radius = aorays ? (float)atof(aorays) : s.ao_radius;
+        char* aoradius = GetCmdOption(argv, argv + argc, "-ao");
+        s.ao_radius = aoradius ? (float)atof(aoradius) : s.ao_radius;
+
+        char* aorays = GetCmdOption(argv, argv + argc, "-aorays");
+        s.num_ao_rays = aorays ? atoi(aorays) : s.num_ao_rays;
 
         char* bounces = GetCmdOption(argv, argv + argc, "-nb");
         s.num_bounces = bounces ? atoi(bounces) : s.num_bounces;
@@ -120,6 +124,119 @@ namespace Baikal
         char* cspeed = GetCmdOption(argv, argv + argc, "-cs");
         s.cspeed = cspeed ? (float)atof(cspeed) : s.cspeed;
 
+        char* geometry_cache = GetCmdOption(argv, argv + argc, "-gcache");
+        s.geometry_cache_mb = geometry_cache ? atoi(geometry_cache) : s.geometry_cache_mb;
+
+        char* texture_cache = GetCmdOption(argv, argv + argc, "-tcache");
+        s.texture_cache_mb = texture_cache ? atoi(texture_cache) : s.texture_cache_mb;
+
+        char* device_resident = GetCmdOption(argv, argv + argc, "-devresident");
+        s.device_resident = device_resident ? (atoi(device_resident) > 0) : s.device_resident;
+
+        char* memory_budget = GetCmdOption(argv, argv + argc, "-membudget");
+        s.memory_budget_percent = memory_budget ? atoi(memory_budget) : s.memory_budget_percent;
+
+        char* split_frame = GetCmdOption(argv, argv + argc, "-split");
+        s.split_frame = split_frame ? (atoi(split_frame) > 0) : s.split_frame;
+
+        char* num_views = GetCmdOption(argv, argv + argc, "-views");
+        s.camera_num_views = num_views ? atoi(num_views) : s.camera_num_views;
+
+        if (s.camera_num_views < 1)
+            throw std::runtime_error("Number of views should be positive");
+
+        char* view_separation = GetCmdOption(argv, argv + argc, "-viewsep");
+        s.camera_view_separation = view_separation ? (float)atof(view_separation) : s.camera_view_separation;
+
+        char* motion_scale = GetCmdOption(argv, argv + argc, "-motionscale");
+        s.motion_scale = motion_scale ? atoi(motion_scale) : s.motion_scale;
+
+        char* worker_port = GetCmdOption(argv, argv + argc, "-worker");
+        s.worker_port = worker_port ? atoi(worker_port) : s.worker_port;
+
+        char* coordinator = GetCmdOption(argv, argv + argc, "-coordinator");
+        s.coordinator = coordinator ? coordinator : s.coordinator;
+
+        char* server_port = GetCmdOption(argv, argv + argc, "-port");
+        s.server_port = server_port ? atoi(server_port) : s.server_port;
+
+        char* stats_file_name = GetCmdOption(argv, argv + argc, "-stats");
+        s.stats_file_name = stats_file_name ? stats_file_name : s.stats_file_name;
+
+        char* trace_file_name = GetCmdOption(argv, argv + argc, "-trace");
+        s.trace_file_name = trace_file_name ? trace_file_name : s.trace_file_name;
+
+        char* optimize_meshes = GetCmdOption(argv, argv + argc, "-optmesh");
+        s.optimize_meshes = optimize_meshes ? (atoi(optimize_meshes) > 0) : s.optimize_meshes;
+
+        char* camera_set = GetCmdOption(argv, argv + argc, "-camset");
+        s.camera_set = camera_set ? camera_set : s.camera_set;
+
+        char* camera_set_min = GetCmdOption(argv, argv + argc, "-camsetmin");
+        s.camera_set_min = camera_set_min ? atoi(camera_set_min) : s.camera_set_min;
+
+        char* camera_set_max = GetCmdOption(argv, argv + argc, "-camsetmax");
+        s.camera_set_max = camera_set_max ? atoi(camera_set_max) : s.camera_set_max;
+
+        char* camera_out_folder = GetCmdOption(argv, argv + argc, "-camout");
+        s.camera_out_folder = camera_out_folder ? camera_out_folder : s.camera_out_folder;
+
+        char* dataset_cameras = GetCmdOption(argv, argv + argc, "-dataset");
+        s.dataset_cameras = dataset_cameras ? dataset_cameras : s.dataset_cameras;
+
+        char* dataset_lights = GetCmdOption(argv, argv + argc, "-datasetlights");
+        s.dataset_lights = dataset_lights ? dataset_lights : s.dataset_lights;
+
+        char* dataset_input_samples = GetCmdOption(argv, argv + argc, "-datasetspp");
+        s.dataset_input_samples = dataset_input_samples ? atoi(dataset_input_samples) : s.dataset_input_samples;
+
+        char* thumbnail_folder = GetCmdOption(argv, argv + argc, "-thumbnails");
+        s.thumbnail_folder = thumbnail_folder ? thumbnail_folder : s.thumbnail_folder;
+
+        char* thumbnail_size = GetCmdOption(argv, argv + argc, "-thumbsize");
+        s.thumbnail_size = thumbnail_size ? atoi(thumbnail_size) : s.thumbnail_size;
+
+        char* checkpoint_file = GetCmdOption(argv, argv + argc, "-checkpoint");
+        s.checkpoint_file = checkpoint_file ? checkpoint_file : s.checkpoint_file;
+
+        char* checkpoint_interval = GetCmdOption(argv, argv + argc, "-checkpointinterval");
+        s.checkpoint_interval = checkpoint_interval ? (float)atof(checkpoint_interval) : s.checkpoint_interval;
+
+        char* build_profile = GetCmdOption(argv, argv + argc, "-kprofile");
+        if (build_profile)
+        {
+            std::string profile(build_profile);
+            s.build_profile = profile == "fast" ? Baikal::CLProgramManager::BuildProfile::kFast :
+                profile == "reference" ? Baikal::CLProgramManager::BuildProfile::kReference : Baikal::CLProgramManager::BuildProfile::kDefault;
+        }
+
+        char* acceleration_structure = GetCmdOption(argv, argv + argc, "-accel");
+        if (acceleration_structure)
+        {
+            std::string type(acceleration_structure);
+            s.acceleration_structure = type == "fast" ? Baikal::AccelerationStructure::kFastBuild :
+                type == "balanced" ? Baikal::AccelerationStructure::kBalanced :
+                type == "quality" ? Baikal::AccelerationStructure::kHighQuality : Baikal::AccelerationStructure::kAuto;
+        }
+
+        char* shared_program_cache = GetCmdOption(argv, argv + argc, "-sharedcache");
+        s.shared_program_cache = shared_program_cache ? shared_program_cache : s.shared_program_cache;
+
+        char* bench_output = GetCmdOption(argv, argv + argc, "-benchout");
+        s.bench_output = bench_output ? bench_output : s.bench_output;
+
+        char* bench_scenes = GetCmdOption(argv, argv + argc, "-benchscenes");
+        s.bench_scenes = bench_scenes ? bench_scenes : s.bench_scenes;
+
+        char* num_host_threads = GetCmdOption(argv, argv + argc, "-threads");
+        s.num_host_threads = num_host_threads ? atoi(num_host_threads) : s.num_host_threads;
+
+        // Shared scheduler is sized once, before loading or compiling submits any work
+        if (s.num_host_threads >= 0)
+        {
+            Baikal::TaskScheduler::Configure(static_cast<std::size_t>(s.num_host_threads));
+        }
+
 
         char* cfg = GetCmdOption(argv, argv + argc, "-config");
 
@@ -150,9 +267,8 @@ namespace Baikal
                 "Can not set device index, because platform index was not specified" << std::endl;
         }
 
-        if (aorays)
+        if (aoradius)
         {
-            s.num_ao_rays = atoi(aorays);
             s.ao_enabled = true;
         }
 
@@ -161,7 +277,12 @@ namespace Baikal
             s.progressive = true;
         }
 
-        if (CmdOptionExists(argv, argv + argc, "-nowindow"))
+        if (CmdOptionExists(argv, argv + argc, "-warmup"))
+        {
+            s.warm_up_cache = true;
+        }
+
+        if (CmdOptionExists(argv, argv + argc, "-nowindow") || s.worker_port > 0 || !s.camera_set.empty() || !s.dataset_cameras.empty() || !s.thumbnail_folder.empty() || !s.checkpoint_file.empty() || s.warm_up_cache)
         {
             s.cmd_line_mode = true;
         }
@@ -202,6 +323,18 @@ namespace Baikal
         , interop(true)
         , cspeed(10.25f)
         , mode(ConfigManager::Mode::kUseSingleGpu)
+        , geometry_cache_mb(0)
+        , texture_cache_mb(0)
+        , device_resident(false)
+        , memory_budget_percent(0)
+        , split_frame(false)
+        , motion_scale(1)
+        , worker_port(0)
+        , coordinator()
+        , server_port(8030)
+        , stats_file_name()
+        , trace_file_name()
+        , optimize_meshes(false)
         //ao
         , ao_radius(1.f)
         , num_ao_rays(1)
@@ -217,6 +350,26 @@ namespace Baikal
         , camera_focus_distance(1.f)
         , camera_focal_length(0.035f) // 35mm lens
         , camera_type (CameraType::kPerspective)
+        , camera_num_views(1)
+        , camera_view_separation(0.065f) // average interpupillary distance
+        , camera_set()
+        , camera_set_min(0)
+        , camera_set_max(-1)
+        , camera_out_folder("../Output/")
+        , dataset_cameras()
+        , dataset_lights()
+        , dataset_input_samples(16)
+        , thumbnail_folder()
+        , thumbnail_size(128)
+        , checkpoint_file()
+        , checkpoint_interval(300.f)
+        , shared_program_cache()
+        , warm_up_cache(false)
+        , build_profile(Baikal::CLProgramManager::BuildProfile::kDefault)
+        , acceleration_structure(Baikal::AccelerationStructure::kAuto)
+        , bench_output("../Output/bench.json")
+        , bench_scenes()
+        , num_host_threads(-1)
 
         //app
         , progressive(false)
@@ -28,6 +28,7 @@
 #include "Utils/config_manager.h"
 #include "Baikal/Renderers/renderer.h"
 #include "Baikal/Estimators/estimator.h"
+#include "Baikal/Controllers/acceleration_structure.h"
 
 namespace Baikal
 {
@@ -48,6 +49,30 @@ namespace Baikal
         bool interop;
         float cspeed;
         ConfigManager::Mode mode;
+        // Device geometry cache size in megabytes, zero keeps all geometry resident
+        int geometry_cache_mb;
+        // Device texture cache size in megabytes, zero keeps all textures resident
+        int texture_cache_mb;
+        // Free host copies of uploaded geometry and textures, single device only
+        bool device_resident;
+        // Percentage of device memory the scene and renderer are fitted into, zero disables fitting
+        int memory_budget_percent;
+        // Devices share each frame through a tile queue instead of rendering full frames
+        bool split_frame;
+        // Camera moves are rendered at 1/motion_scale of the resolution and upsampled, one disables it
+        int motion_scale;
+        // Port to serve a render coordinator on, zero renders locally
+        int worker_port;
+        // Comma separated host:port list of workers to merge samples from
+        std::string coordinator;
+        // Port BaikalServer listens for its client on
+        int server_port;
+        // JSON file the render step timings and upload bytes are written to on exit, enables profiling
+        std::string stats_file_name;
+        // Chrome trace event JSON of host scopes and device steps written on exit, enables profiling
+        std::string trace_file_name;
+        // Reorder mesh triangles and vertices after loading and drop degenerate and duplicate triangles
+        bool optimize_meshes;
 
         //ao
         float ao_radius;
@@ -64,16 +89,50 @@ namespace Baikal
         float camera_focus_distance;
         float camera_focal_length;
         CameraType camera_type;
+        //views side by side in the window, spread along the camera right vector
+        int camera_num_views;
+        float camera_view_separation;
 
-        //file with camera positions
+        //file with camera positions, one "eye at up" line of nine floats per camera
         std::string camera_set;
-        //range of camera set
+        //range of camera set, negative max renders up to the last camera
         int camera_set_min;
         int camera_set_max;
 
         //folder to store camera position output
         std::string camera_out_folder;
 
+        //dataset generation: cameras and light sets as logged with C and L keys, light sets are optional
+        std::string dataset_cameras;
+        std::string dataset_lights;
+        //largest sample count of noisy inputs, snapshots are taken at each power of two below it
+        int dataset_input_samples;
+
+        //folder to write thumbnails of all the scene materials to, rendered in one atlas
+        std::string thumbnail_folder;
+        int thumbnail_size;
+
+        //progressive render saving its state every checkpoint_interval seconds, resumes from the file if it exists
+        std::string checkpoint_file;
+        float checkpoint_interval;
+
+        //read-only folder of program binaries, e.g. a share warmed up by one node of a farm
+        std::string shared_program_cache;
+        //build the program cache for the scene and exit
+        bool warm_up_cache;
+        //math options of the kernels, fast trades accuracy for speed
+        Baikal::CLProgramManager::BuildProfile build_profile;
+        //intersector build time against traversal speed trade off
+        Baikal::AccelerationStructure acceleration_structure;
+
+        //BaikalBench JSON results file
+        std::string bench_output;
+        //comma separated BaikalBench scene names, empty runs all of them
+        std::string bench_scenes;
+
+        //workers of the shared host task scheduler, negative leaves one hardware thread for the render loop
+        int num_host_threads;
+
         //app
         bool progressive;
         bool cmd_line_mode;
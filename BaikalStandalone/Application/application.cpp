@@ -91,6 +91,10 @@ namespace Baikal
     static bool     g_is_middle_pressed = false; // middle mouse button
     static bool     g_is_c_pressed = false;
     static bool     g_is_l_pressed = false;
+    static bool     g_is_region_drawn = false; // shift+LMB drag
+    static bool     g_is_region_pending = false;
+    static float2   g_region_start = float2(0, 0);
+    static float2   g_region_end = float2(0, 0);
     static float2   g_mouse_pos = float2(0, 0);
     static float2   g_mouse_delta = float2(0, 0);
     static float2   g_scroll_delta = float2(0, 0);
@@ -141,6 +145,16 @@ namespace Baikal
         doc.SaveFile(xml);
     }
 
+    // Each light_list is one light set of the dataset generation, lights are appended to the last one
+    void AppendLightList(const char* xml)
+    {
+        tinyxml2::XMLDocument doc;
+
+        doc.LoadFile(xml);
+        doc.InsertEndChild(doc.NewElement("light_list"));
+        doc.SaveFile(xml);
+    }
+
     void AppendLight(Baikal::Light::Ptr l, const char* xml)
     {
         //get light type
@@ -153,7 +167,7 @@ namespace Baikal
         tinyxml2::XMLDocument doc;
 
         doc.LoadFile(xml);
-        auto root = doc.FirstChildElement("light_list");
+        auto root = doc.LastChildElement("light_list");
         if (!root)
         {
             root = doc.NewElement("light_list");
@@ -295,7 +309,22 @@ namespace Baikal
 
         if (button == GLFW_MOUSE_BUTTON_LEFT)
         {
-            if (action == GLFW_PRESS)
+            if (action == GLFW_PRESS && (mods & GLFW_MOD_SHIFT))
+            {
+                double x, y;
+                glfwGetCursorPos(window, &x, &y);
+                g_region_start = float2((float)x, (float)y);
+                g_is_region_drawn = true;
+            }
+            else if (action == GLFW_RELEASE && g_is_region_drawn)
+            {
+                double x, y;
+                glfwGetCursorPos(window, &x, &y);
+                g_region_end = float2((float)x, (float)y);
+                g_is_region_drawn = false;
+                g_is_region_pending = true;
+            }
+            else if (action == GLFW_PRESS)
             {
                 double x, y;
                 glfwGetCursorPos(window, &x, &y);
@@ -480,6 +509,7 @@ namespace Baikal
             if (g_is_l_pressed)
             {
                 auto scene = m_cl->GetScene();
+                AppendLightList(kLightLogFile.c_str());
                 auto it = scene->CreateLightIterator();
                 for (; it->IsValid(); it->Next())
                 {
@@ -503,6 +533,34 @@ namespace Baikal
             }
         }
 
+        // Click without a drag renders whole frames again
+        if (g_is_region_pending)
+        {
+            auto x0 = (std::uint32_t)std::max(g_region_start.x, 0.f);
+            auto y0 = (std::uint32_t)std::max(g_region_start.y, 0.f);
+            auto x1 = (std::uint32_t)std::max(g_region_end.x, 0.f);
+            auto y1 = (std::uint32_t)std::max(g_region_end.y, 0.f);
+
+            if (x0 == x1 || y0 == y1)
+            {
+                m_cl->ClearRenderRegion();
+            }
+            else
+            {
+                m_cl->SetRenderRegion(x0, y0, x1, y1);
+            }
+
+            // Pixels of the region keep their samples, the count follows the region from now on
+            m_settings.samplecount = 0;
+            g_is_region_pending = false;
+        }
+
+        // Full resolution accumulation restarts once the camera stops
+        if (m_cl->SetNavigating(update))
+        {
+            m_settings.samplecount = 0;
+        }
+
         if (update)
         {
             //if (g_num_samples > -1)
@@ -714,6 +772,10 @@ namespace Baikal
 
                 m_cl->StopRenderThreads();
 
+                if (!m_settings.stats_file_name.empty())
+                {
+                    m_cl->SaveRenderStatistics(m_settings.stats_file_name);
+                }
             }
             catch (std::runtime_error&)
             {
@@ -722,6 +784,32 @@ namespace Baikal
             }
 
         }
+        else if (!m_settings.camera_set.empty())
+        {
+            m_cl->RenderCameraSet(m_settings);
+        }
+        else if (!m_settings.dataset_cameras.empty())
+        {
+            m_cl->GenerateDataset(m_settings);
+        }
+        else if (!m_settings.thumbnail_folder.empty())
+        {
+            m_cl->RenderMaterialThumbnails(m_settings);
+        }
+        else if (!m_settings.checkpoint_file.empty())
+        {
+            m_cl->RenderResumable(m_settings);
+        }
+        else if (m_settings.warm_up_cache)
+        {
+            m_cl->WarmUpProgramCache();
+        }
+        else if (m_settings.worker_port > 0)
+        {
+            // Headless node of a distributed render, camera comes with the jobs
+            m_cl->UpdateScene();
+            m_cl->RunWorker(m_settings);
+        }
         else
         {
             m_cl.reset(new AppClRender(m_settings, -1));
@@ -753,6 +841,16 @@ namespace Baikal
             std::cout << "\tPrimary: " << m_settings.stats.primary_throughput * 1e-6f << " Mrays/s\n";
             std::cout << "\tSecondary: " << m_settings.stats.secondary_throughput * 1e-6f << " Mrays/s\n";
             std::cout << "\tShadow: " << m_settings.stats.shadow_throughput * 1e-6f << " Mrays/s\n";
+
+            if (!m_settings.stats_file_name.empty())
+            {
+                m_cl->SaveRenderStatistics(m_settings.stats_file_name);
+            }
+        }
+
+        if (!m_settings.trace_file_name.empty())
+        {
+            m_cl->SaveTrace(m_settings.trace_file_name);
         }
     }
 
@@ -770,6 +868,7 @@ namespace Baikal
             { Renderer::OutputType::kColor, "Color" },
             { Renderer::OutputType::kOpacity, "Opacity" },
             { Renderer::OutputType::kVisibility, "Visibility" },
+            { Renderer::OutputType::kCost, "Cost" },
             { Renderer::OutputType::kWorldPosition, "World Position" },
             { Renderer::OutputType::kWorldShadingNormal, "Shading Normal" },
             { Renderer::OutputType::kWorldGeometricNormal, "Geometric Normal" },
@@ -786,6 +885,8 @@ namespace Baikal
         };
 
         static int output = 0;
+        static int cost_channel = 0;
+        static float cost_max = 16.f;
         bool update = false;
         if (m_settings.gui_visible)
         {
@@ -794,6 +895,7 @@ namespace Baikal
             ImGui::Text("Use wsad keys to move");
             ImGui::Text("Q/E to climb/descent");
             ImGui::Text("Mouse+RMB to look around");
+            ImGui::Text("Shift+LMB drag to render a region, click to reset");
             ImGui::Text("F1 to hide/show GUI");
             ImGui::Separator();
             ImGui::Text("Device vendor: %s", m_cl->GetDevice(0).GetVendor().c_str());
@@ -804,6 +906,94 @@ namespace Baikal
             ImGui::Text("Scene: %s", m_settings.modelname.c_str());
             ImGui::Text("Unique triangles: %d", m_num_triangles);
             ImGui::Text("Number of instances: %d", m_num_instances);
+
+            auto const& compile_stats = m_cl->GetCompileStats();
+            ImGui::Text("Scene memory: %.2f MB", compile_stats.total_bytes / (1024.f * 1024.f));
+            ImGui::Text("Last compile: %.3f ms (%s)", compile_stats.total_milliseconds, compile_stats.full_recompile ? "full" : "incremental");
+
+            if (ImGui::CollapsingHeader("Scene compile details"))
+            {
+                for (auto i = 0; i < Baikal::SceneCompileStats::kStepCount; ++i)
+                {
+                    auto step = static_cast<Baikal::SceneCompileStats::Step>(i);
+                    ImGui::Text("%s: %.3f ms", Baikal::SceneCompileStats::GetStepName(step), compile_stats.step_milliseconds[i]);
+                }
+
+                ImGui::Separator();
+
+                for (auto const& buffer : compile_stats.buffers)
+                {
+                    ImGui::Text("%s: %.2f MB", buffer.name, buffer.bytes / (1024.f * 1024.f));
+                }
+            }
+
+            if (ImGui::CollapsingHeader("Render profiling"))
+            {
+                bool profiling = m_cl->GetProfiling();
+                if (ImGui::Checkbox("Profile render steps", &profiling))
+                {
+                    m_cl->SetProfiling(profiling);
+                }
+
+                auto& profiler = m_cl->GetProfiler();
+
+                if (!profiler.IsTimingSupported())
+                {
+                    ImGui::Text("Device queue has no profiling enabled, only counts are recorded");
+                }
+
+                if (ImGui::Button("Reset profile"))
+                {
+                    profiler.Reset();
+                }
+
+                auto const& entries = profiler.GetEntries();
+
+                // Compaction is shown as the share of the rays of a pass still alive after it
+                auto find_average_count = [&entries](char const* name, std::uint32_t pass)
+                {
+                    for (auto const& entry : entries)
+                    {
+                        if (entry.pass == pass && entry.name == name && entry.num_counts > 0)
+                        {
+                            return static_cast<double>(entry.count) / entry.num_counts;
+                        }
+                    }
+
+                    return 0.0;
+                };
+
+                for (auto const& entry : entries)
+                {
+                    auto pass = static_cast<int>(entry.pass);
+                    auto has_pass = entry.pass != ClwProfiler::kNoPass;
+
+                    if (entry.num_spans > 0)
+                    {
+                        ImGui::Text(has_pass ? "%s %d: %.3f ms" : "%s: %.3f ms", entry.name.c_str(), has_pass ? pass : 0,
+                            entry.milliseconds / entry.num_spans);
+                    }
+                    else if (entry.num_counts > 0 && (entry.name == "alive"))
+                    {
+                        auto num_rays = find_average_count("rays", entry.pass);
+                        ImGui::Text("compaction %d: %.1f%%", pass, num_rays > 0.0 ? 100.0 * entry.count / entry.num_counts / num_rays : 0.0);
+                    }
+                    else if (entry.num_counts > 0)
+                    {
+                        ImGui::Text("%s %d: %.0f", entry.name.c_str(), pass, static_cast<double>(entry.count) / entry.num_counts);
+                    }
+                }
+
+                ImGui::Separator();
+
+                auto const& uploader = m_cl->GetUploader();
+                for (auto i = 0; i < static_cast<int>(ClwUploader::Category::kCount); ++i)
+                {
+                    auto category = static_cast<ClwUploader::Category>(i);
+                    ImGui::Text("%s uploads: %.2f MB", ClwUploader::GetCategoryName(category), uploader.GetStats(category).bytes / (1024.f * 1024.f));
+                }
+            }
+
             ImGui::Separator();
             ImGui::SliderInt("GI bounces", &num_bounces, 1, 10);
 
@@ -872,7 +1062,30 @@ namespace Baikal
                 },
                 nullptr, (int)kBaikalOutputs.size()
             );
+
+            if (gui_out_type == Renderer::OutputType::kCost)
+            {
+                bool heatmap_changed = ImGui::Combo("Heatmap", &cost_channel, "Rays\0Bounces\0Shadow rays\0");
+                heatmap_changed |= ImGui::SliderFloat("Heatmap max", &cost_max, 1.f, 64.f);
+
+                if (heatmap_changed)
+                {
+                    m_cl->SetCostHeatmap(cost_channel + 1, cost_max);
+                }
+            }
             ImGui::Text(" ");
+
+            RadeonRays::int2 region_origin, region_size;
+            if (m_cl->GetRenderRegion(region_origin, region_size))
+            {
+                ImGui::Text("Render region: %dx%d at %d, %d", region_size.x, region_size.y, region_origin.x, region_origin.y);
+                if (ImGui::Button("Reset render region"))
+                {
+                    g_region_end = g_region_start;
+                    g_is_region_pending = true;
+                }
+            }
+
             ImGui::Text("Number of samples: %d", m_settings.samplecount);
             ImGui::Text("Frame time %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
             ImGui::Text("Renderer performance %.3f Msamples/s", (ImGui::GetIO().Framerate *m_settings.width * m_settings.height) / 1000000.f);
@@ -945,27 +1158,33 @@ namespace Baikal
             static float sigmaPosition = m_cl->GetDenoiserFloatParam("position_sensitivity").x;
             static float sigmaNormal = m_cl->GetDenoiserFloatParam("normal_sensitivity").x;
             static float sigmaColor = m_cl->GetDenoiserFloatParam("color_sensitivity").x;
+            static bool halfResolution = m_cl->GetDenoiserFloatParam("half_resolution").x > 0.f;
 
             ImGui::Text("Denoiser settings");
             ImGui::SliderFloat("Position sigma", &sigmaPosition, 0.f, 0.3f);
             ImGui::SliderFloat("Normal sigma", &sigmaNormal, 0.f, 5.f);
             ImGui::SliderFloat("Color sigma", &sigmaColor, 0.f, 5.f);       
+            ImGui::Checkbox("Half resolution", &halfResolution);
 
             if (m_cl->GetDenoiserFloatParam("position_sensitivity").x != sigmaPosition ||
                 m_cl->GetDenoiserFloatParam("normal_sensitivity").x != sigmaNormal ||
-                m_cl->GetDenoiserFloatParam("color_sensitivity").x != sigmaColor)
+                m_cl->GetDenoiserFloatParam("color_sensitivity").x != sigmaColor ||
+                (m_cl->GetDenoiserFloatParam("half_resolution").x > 0.f) != halfResolution)
             {
                 m_cl->SetDenoiserFloatParam("position_sensitivity", sigmaPosition);
                 m_cl->SetDenoiserFloatParam("normal_sensitivity", sigmaNormal);
                 m_cl->SetDenoiserFloatParam("color_sensitivity", sigmaColor);
+                m_cl->SetDenoiserFloatParam("half_resolution", float4(halfResolution ? 1.f : 0.f, 0.f, 0.f, 0.f));
             }
 #endif
             ImGui::End();
 
-            // Get shape/material info from renderer
-            if (m_shape_id_future.valid())
+            // Get shape/material info of the double clicked pixel from renderer
+            if (g_is_double_click)
             {
-                m_current_shape_id = m_shape_id_future.get();
+                m_current_shape_id = m_cl->GetShapeId((std::uint32_t)g_mouse_pos.x, (std::uint32_t)g_mouse_pos.y);
+                g_is_double_click = false;
+
                 auto shape = m_cl->GetShapeById(m_current_shape_id);
 
                 if (shape)
@@ -989,13 +1208,6 @@ namespace Baikal
                 }
             }
 
-            // Process double click event if it occured
-            if (g_is_double_click)
-            {
-                m_shape_id_future = m_cl->GetShapeId((std::uint32_t)g_mouse_pos.x, (std::uint32_t)g_mouse_pos.y);
-                g_is_double_click = false;
-            }
-
 
             // draw material
             if (m_material_explorer)
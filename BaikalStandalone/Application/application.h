@@ -28,7 +28,6 @@
 #include "Application/material_explorer.h"
 #include "image_io.h"
 
-#include <future>
 #include <memory>
 #include <chrono>
 
@@ -70,7 +69,6 @@ namespace Baikal
 
         int m_current_shape_id;
         std::string m_object_name;
-        std::future<int> m_shape_id_future;
 
         class InputSettings
         {
@@ -0,0 +1,380 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#include "Application/bench_suite.h"
+
+#include "Application/cl_render.h"
+#include "Utils/clw_profiler.h"
+#include "Utils/mkpath.h"
+#include "Utils/version.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+namespace Baikal
+{
+    namespace
+    {
+        struct BenchScene
+        {
+            char const* name;
+            char const* path;
+            char const* model_name;
+            RadeonRays::float3 camera_pos;
+            RadeonRays::float3 camera_at;
+        };
+
+        // Generated scenes come from the test scene loader, they only need textures of Resources
+        BenchScene const kBenchScenes[] =
+        {
+            { "cornell_box", "../Resources/CornellBox", "orig.objm", RadeonRays::float3(0.f, 1.f, 3.f), RadeonRays::float3(0.f, 1.f, 0.f) },
+            { "interior", "../Resources", "bench_interior.test", RadeonRays::float3(-3.5f, 1.5f, 3.5f), RadeonRays::float3(2.f, 1.f, -2.f) },
+            { "exterior_ibl", "../Resources", "bench_exterior_ibl.test", RadeonRays::float3(0.f, 4.f, 12.f), RadeonRays::float3(0.f, 0.5f, 0.f) },
+            { "instancing", "../Resources", "bench_instancing.test", RadeonRays::float3(0.f, 10.f, 20.f), RadeonRays::float3(0.f, 0.f, 0.f) },
+            { "textures", "../Resources", "bench_textures.test", RadeonRays::float3(0.f, 3.3f, 9.f), RadeonRays::float3(0.f, 3.3f, 0.f) }
+        };
+
+        // Samples rendered when settings do not ask for a number
+        std::uint32_t constexpr kDefaultNumSamples = 256;
+        // Samples rendered with profiling on, after the timed ones
+        std::uint32_t constexpr kNumProfiledSamples = 16;
+
+        std::string GetDriverVersion(CLWDevice const& device)
+        {
+            std::size_t size = 0;
+            if (clGetDeviceInfo(device.GetID(), CL_DRIVER_VERSION, 0, nullptr, &size) != CL_SUCCESS || size == 0)
+            {
+                return "";
+            }
+
+            std::string version(size, '\0');
+            clGetDeviceInfo(device.GetID(), CL_DRIVER_VERSION, size, &version[0], nullptr);
+            version.resize(version.find_last_not_of('\0') + 1);
+            return version;
+        }
+
+        std::string ToJsonString(std::string const& value)
+        {
+            std::string result = "\"";
+            for (auto c : value)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    result += '\\';
+                }
+                else if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    continue;
+                }
+                result += c;
+            }
+            return result + "\"";
+        }
+
+        double GetMillisecondsSince(std::chrono::high_resolution_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+    }
+
+    std::vector<std::string> BenchSuite::GetSceneNames()
+    {
+        std::vector<std::string> names;
+        for (auto const& scene : kBenchScenes)
+        {
+            names.push_back(scene.name);
+        }
+        return names;
+    }
+
+    BenchSuite::BenchSuite(AppSettings const& settings)
+        : m_settings(settings)
+    {
+        // Nothing is displayed
+        m_settings.interop = false;
+        m_settings.cmd_line_mode = true;
+
+        if (m_settings.num_samples <= 0)
+        {
+            m_settings.num_samples = static_cast<int>(kDefaultNumSamples);
+        }
+    }
+
+    void BenchSuite::Run()
+    {
+        auto names = GetSceneNames();
+        std::vector<std::size_t> selected;
+
+        if (m_settings.bench_scenes.empty())
+        {
+            for (std::size_t i = 0; i < names.size(); ++i)
+            {
+                selected.push_back(i);
+            }
+        }
+        else
+        {
+            std::istringstream scenes(m_settings.bench_scenes);
+            for (std::string name; std::getline(scenes, name, ',');)
+            {
+                auto it = std::find(names.cbegin(), names.cend(), name);
+                if (it == names.cend())
+                {
+                    throw std::runtime_error("Unknown benchmark scene: " + name);
+                }
+                selected.push_back(static_cast<std::size_t>(it - names.cbegin()));
+            }
+        }
+
+        std::vector<Result> results;
+        for (auto index : selected)
+        {
+            std::cout << "Benchmarking " << names[index] << "...\n";
+            results.push_back(RunScene(index));
+
+            auto const& result = results.back();
+            if (!result.error.empty())
+            {
+                std::cout << "    Failed: " << result.error << "\n";
+            }
+            else
+            {
+                std::cout << "    " << result.num_samples << " samples in " << result.render_milliseconds / 1000.0 << " s\n";
+            }
+        }
+
+        mkfilepath(m_settings.bench_output);
+        std::ofstream file(m_settings.bench_output);
+        if (!file)
+        {
+            throw std::runtime_error("Cannot write benchmark results to " + m_settings.bench_output);
+        }
+
+        WriteJson(results, file);
+        std::cout << "Benchmark results saved to " << m_settings.bench_output << "\n";
+    }
+
+    BenchSuite::Result BenchSuite::RunScene(std::size_t index)
+    {
+        auto const& scene = kBenchScenes[index];
+
+        Result result;
+        result.name = scene.name;
+
+        // A failing scene is reported in the results, the others are still measured
+        try
+        {
+            auto settings = m_settings;
+            settings.path = scene.path;
+            settings.modelname = scene.model_name;
+            settings.camera_pos = scene.camera_pos;
+            settings.camera_at = scene.camera_at;
+            settings.camera_up = RadeonRays::float3(0.f, 1.f, 0.f);
+
+            std::unique_ptr<AppClRender> render(new AppClRender(settings, static_cast<GLuint>(-1)));
+            result.load_milliseconds = render->GetLoadMilliseconds();
+
+            if (m_device_name.empty())
+            {
+                auto device = render->GetDevice(0);
+                m_device_name = device.GetName();
+                m_device_version = device.GetVersion();
+                m_driver_version = GetDriverVersion(device);
+
+                cl_ulong global_mem_size = 0;
+                clGetDeviceInfo(device.GetID(), CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem_size), &global_mem_size, nullptr);
+                m_device_memory = global_mem_size;
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            render->UpdateScene();
+            render->Finish();
+            result.compile_milliseconds = GetMillisecondsSince(start);
+
+            // Stats of the full compile, the update before the timed samples only clears the output
+            auto const& compile_stats = render->GetCompileStats();
+            result.scene_bytes = compile_stats.total_bytes;
+            result.num_shapes = compile_stats.num_shapes;
+            result.num_instances = compile_stats.num_instances;
+            result.num_triangles = compile_stats.num_triangles;
+            result.num_textures = compile_stats.num_textures;
+            result.num_lights = compile_stats.num_lights;
+
+            // Programs are built or read from the cache on the first sample
+            start = std::chrono::high_resolution_clock::now();
+            render->Render(0);
+            render->Finish();
+            result.first_frame_milliseconds = GetMillisecondsSince(start);
+            result.work_buffer_bytes = render->GetWorkBufferMemorySize();
+
+            // Time to N samples starts from a cleared output with everything built
+            render->UpdateScene();
+            render->Finish();
+
+            result.num_samples = static_cast<std::uint32_t>(m_settings.num_samples);
+            start = std::chrono::high_resolution_clock::now();
+            for (std::uint32_t i = 0; i < result.num_samples; ++i)
+            {
+                render->Render(static_cast<int>(i));
+            }
+            render->Finish();
+            result.render_milliseconds = GetMillisecondsSince(start);
+
+            // Profiled separately, markers between the steps cost a bit of time
+            render->SetProfiling(true);
+            auto& profiler = render->GetProfiler();
+            profiler.Reset();
+
+            for (std::uint32_t i = 0; i < kNumProfiledSamples; ++i)
+            {
+                render->Render(static_cast<int>(result.num_samples + i));
+            }
+
+            profiler.Resolve(true);
+            render->SetProfiling(false);
+
+            result.timing_supported = profiler.IsTimingSupported();
+            result.num_profiled_samples = kNumProfiledSamples;
+
+            for (auto const& entry : profiler.GetEntries())
+            {
+                if (entry.pass == ClwProfiler::kNoPass)
+                {
+                    continue;
+                }
+
+                auto it = std::find_if(result.bounces.begin(), result.bounces.end(), [&entry](Bounce const& b) { return b.pass == entry.pass; });
+                if (it == result.bounces.end())
+                {
+                    Bounce bounce;
+                    bounce.pass = entry.pass;
+                    it = result.bounces.insert(result.bounces.end(), bounce);
+                }
+
+                if (entry.name == "rays")
+                {
+                    it->num_paths += entry.count;
+                }
+                else if (entry.name == "intersect")
+                {
+                    it->intersect_milliseconds += entry.milliseconds;
+                }
+
+                it->milliseconds += entry.milliseconds;
+            }
+
+            std::sort(result.bounces.begin(), result.bounces.end(), [](Bounce const& a, Bounce const& b) { return a.pass < b.pass; });
+
+        }
+        catch (CLWException& e)
+        {
+            result.error = std::string(e.what()) + " (OpenCL error code: " + std::to_string(e.errcode_) + ")";
+        }
+        catch (std::exception& e)
+        {
+            result.error = e.what();
+        }
+
+        return result;
+    }
+
+    void BenchSuite::WriteJson(std::vector<Result> const& results, std::ostream& stream) const
+    {
+        auto build_profile = m_settings.build_profile == CLProgramManager::BuildProfile::kFast ? "fast" :
+            m_settings.build_profile == CLProgramManager::BuildProfile::kReference ? "reference" : "default";
+
+        stream << "{\n";
+        stream << "\"version\": " << ToJsonString(BAIKAL_VERSION) << ",\n";
+        stream << "\"device\": " << ToJsonString(m_device_name) << ",\n";
+        stream << "\"device_version\": " << ToJsonString(m_device_version) << ",\n";
+        stream << "\"driver_version\": " << ToJsonString(m_driver_version) << ",\n";
+        stream << "\"device_memory_bytes\": " << m_device_memory << ",\n";
+        stream << "\"build_profile\": \"" << build_profile << "\",\n";
+        stream << "\"width\": " << m_settings.width << ",\n";
+        stream << "\"height\": " << m_settings.height << ",\n";
+        stream << "\"max_bounces\": " << m_settings.num_bounces << ",\n";
+        stream << "\"scenes\": [";
+
+        auto num_pixels = static_cast<double>(m_settings.width) * m_settings.height;
+
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            auto const& result = results[i];
+
+            stream << (i > 0 ? ",\n" : "\n") << "  {\n";
+            stream << "    \"name\": " << ToJsonString(result.name);
+
+            if (!result.error.empty())
+            {
+                stream << ",\n    \"error\": " << ToJsonString(result.error) << "\n  }";
+                continue;
+            }
+
+            auto seconds = result.render_milliseconds / 1000.0;
+
+            stream << ",\n    \"load_milliseconds\": " << result.load_milliseconds;
+            stream << ",\n    \"compile_milliseconds\": " << result.compile_milliseconds;
+            stream << ",\n    \"first_frame_milliseconds\": " << result.first_frame_milliseconds;
+            stream << ",\n    \"samples\": " << result.num_samples;
+            stream << ",\n    \"render_milliseconds\": " << result.render_milliseconds;
+            stream << ",\n    \"samples_per_second\": " << (seconds > 0.0 ? result.num_samples / seconds : 0.0);
+            stream << ",\n    \"primary_mrays_per_second\": " << (seconds > 0.0 ? num_pixels * result.num_samples / seconds * 1e-6 : 0.0);
+            stream << ",\n    \"memory\": { \"scene_bytes\": " << result.scene_bytes << ", \"work_buffer_bytes\": " << result.work_buffer_bytes
+                   << ", \"total_bytes\": " << result.scene_bytes + result.work_buffer_bytes << " }";
+            stream << ",\n    \"counts\": { \"shapes\": " << result.num_shapes << ", \"instances\": " << result.num_instances
+                   << ", \"triangles\": " << result.num_triangles << ", \"textures\": " << result.num_textures
+                   << ", \"lights\": " << result.num_lights << " }";
+            stream << ",\n    \"profiled_samples\": " << result.num_profiled_samples;
+            stream << ",\n    \"timing_supported\": " << (result.timing_supported ? "true" : "false");
+            stream << ",\n    \"bounces\": [";
+
+            for (std::size_t j = 0; j < result.bounces.size(); ++j)
+            {
+                auto const& bounce = result.bounces[j];
+
+                stream << (j > 0 ? ",\n" : "\n") << "      { \"pass\": " << bounce.pass << ", \"paths\": " << bounce.num_paths;
+
+                // Path rate of the whole pass and of the intersection alone, shadow rays are not counted
+                if (result.timing_supported && bounce.milliseconds > 0.0)
+                {
+                    stream << ", \"milliseconds\": " << bounce.milliseconds / result.num_profiled_samples
+                           << ", \"mrays_per_second\": " << bounce.num_paths / (bounce.milliseconds * 1e3);
+                }
+
+                if (result.timing_supported && bounce.intersect_milliseconds > 0.0)
+                {
+                    stream << ", \"intersect_mrays_per_second\": " << bounce.num_paths / (bounce.intersect_milliseconds * 1e3);
+                }
+
+                stream << " }";
+            }
+
+            stream << (result.bounces.empty() ? "]" : "\n    ]") << "\n  }";
+        }
+
+        stream << "\n]\n}\n";
+    }
+}
@@ -0,0 +1,105 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Application/app_utils.h"
+
+namespace Baikal
+{
+    /**
+    \brief Renders a fixed set of scenes on the primary device and writes the timings as JSON.
+
+    \details Suite covers the CornellBox of Resources and generated interior, exterior lit by an
+    environment, heavy instancing and texture heavy scenes, so results of different drivers and
+    code versions can be compared. Every scene is loaded into its own renderer and measured for
+    load, scene compile and first frame time, which includes building or loading the programs,
+    then for the time to render settings.num_samples and the per bounce path throughput of
+    a profiled run.
+    */
+    class BenchSuite
+    {
+    public:
+        // Returns names of all the scenes of the suite
+        static std::vector<std::string> GetSceneNames();
+
+        explicit BenchSuite(AppSettings const& settings);
+
+        // Run the scenes of settings.bench_scenes, all if it is empty, and write settings.bench_output
+        void Run();
+
+    private:
+        struct Bounce
+        {
+            std::uint32_t pass = 0;
+            // Paths traced in the pass over all the profiled samples
+            std::uint64_t num_paths = 0;
+            // Device time of all the pass steps and of the intersection only
+            double milliseconds = 0.0;
+            double intersect_milliseconds = 0.0;
+        };
+
+        struct Result
+        {
+            std::string name;
+            // Set if the scene has failed, other values are not valid then
+            std::string error;
+
+            double load_milliseconds = 0.0;
+            double compile_milliseconds = 0.0;
+            double first_frame_milliseconds = 0.0;
+            double render_milliseconds = 0.0;
+            std::uint32_t num_samples = 0;
+
+            bool timing_supported = false;
+            std::uint32_t num_profiled_samples = 0;
+            std::vector<Bounce> bounces;
+
+            // Device memory of the compiled scene and the renderer work buffers
+            std::size_t scene_bytes = 0;
+            std::size_t work_buffer_bytes = 0;
+
+            std::size_t num_shapes = 0;
+            std::size_t num_instances = 0;
+            std::size_t num_triangles = 0;
+            std::size_t num_textures = 0;
+            std::size_t num_lights = 0;
+        };
+
+        // Index is one of the GetSceneNames ones
+        Result RunScene(std::size_t index);
+        void WriteJson(std::vector<Result> const& results, std::ostream& stream) const;
+
+        AppSettings m_settings;
+
+        // Taken from the first renderer created
+        std::string m_device_name;
+        std::string m_device_version;
+        std::string m_driver_version;
+        std::uint64_t m_device_memory = 0;
+    };
+}
@@ -19,37 +19,241 @@ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 ********************************************************************/
-#include "OpenImageIO/imageio.h"
-
 #include "Application/cl_render.h"
 #include "Application/gl_render.h"
 
 #include "SceneGraph/scene1.h"
 #include "SceneGraph/camera.h"
 #include "SceneGraph/material.h"
+#include "SceneGraph/light.h"
 #include "scene_io.h"
+#include "image_io.h"
 #include "material_io.h"
+#include "mesh_optimizer.h"
 #include "SceneGraph/material.h"
 
 #include "Renderers/monte_carlo_renderer.h"
 #include "Renderers/adaptive_renderer.h"
-
+#include "Controllers/clw_scene_controller.h"
+#include "Controllers/memory_budget.h"
+#include "Estimators/ao_estimator.h"
+#include "Application/material_preview.h"
+#include "Renderers/render_checkpoint.h"
+#include "Utils/task_scheduler.h"
+#include "Utils/trace.h"
+
+#include <algorithm>
+#include <cstdio>
 #include <fstream>
+#include <future>
+#include <map>
+#include <set>
 #include <sstream>
 #include <thread>
 #include <chrono>
+#include <limits>
 
 #ifdef ENABLE_DENOISER
 #include "PostEffects/wavelet_denoiser.h"
 #endif
 #include "Utils/clw_class.h"
+#include "XML/tinyxml2.h"
 
 namespace Baikal
 {
+    // Split frame tiles are small enough to balance and fit into any work buffer
+    int constexpr kSplitTileSize = 128;
+    // Samples per camera of a camera set render without -ns
+    int constexpr kDefaultCameraSetSamples = 64;
+    // Samples of a dataset reference without -ns
+    int constexpr kDefaultDatasetReferenceSamples = 1024;
+    // Samples per material thumbnail without -ns
+    int constexpr kDefaultThumbnailSamples = 256;
+    // Samples of a resumable render without -ns
+    int constexpr kDefaultResumableSamples = 1024;
+
+    namespace
+    {
+        struct CameraSetEntry
+        {
+            RadeonRays::float3 eye;
+            RadeonRays::float3 at;
+            RadeonRays::float3 up;
+        };
+
+        // One camera per line as eye, at and up, '#' starts a comment
+        std::vector<CameraSetEntry> LoadCameraSet(std::string const& filename)
+        {
+            std::ifstream in(filename);
+            if (!in)
+            {
+                throw std::runtime_error("Cannot open camera set: " + filename);
+            }
+
+            std::vector<CameraSetEntry> cameras;
+            std::string line;
+            for (auto line_number = 1; std::getline(in, line); ++line_number)
+            {
+                line = line.substr(0, line.find('#'));
+                if (line.find_first_not_of(" \t\r") == std::string::npos)
+                {
+                    continue;
+                }
+
+                CameraSetEntry camera;
+                std::istringstream iss(line);
+                if (!(iss >> camera.eye.x >> camera.eye.y >> camera.eye.z >>
+                    camera.at.x >> camera.at.y >> camera.at.z >>
+                    camera.up.x >> camera.up.y >> camera.up.z))
+                {
+                    throw std::runtime_error("Invalid camera at line " + std::to_string(line_number) + " of " + filename);
+                }
+
+                cameras.push_back(camera);
+            }
+
+            return cameras;
+        }
+
+        struct DatasetCamera
+        {
+            RadeonRays::float3 eye;
+            RadeonRays::float3 at;
+            float aperture;
+            float focus_distance;
+            float focal_length;
+        };
+
+        // cam_list of camera.xml as logged with the C key
+        std::vector<DatasetCamera> LoadDatasetCameras(std::string const& filename)
+        {
+            tinyxml2::XMLDocument doc;
+            if (doc.LoadFile(filename.c_str()) != tinyxml2::XML_SUCCESS)
+            {
+                throw std::runtime_error("Cannot open dataset cameras: " + filename);
+            }
+
+            std::vector<DatasetCamera> cameras;
+            for (auto list = doc.FirstChildElement("cam_list"); list; list = list->NextSiblingElement("cam_list"))
+            {
+                for (auto element = list->FirstChildElement("camera"); element; element = element->NextSiblingElement("camera"))
+                {
+                    DatasetCamera camera;
+                    camera.eye = RadeonRays::float3(element->FloatAttribute("cpx"), element->FloatAttribute("cpy"), element->FloatAttribute("cpz"));
+                    camera.at = RadeonRays::float3(element->FloatAttribute("tpx"), element->FloatAttribute("tpy"), element->FloatAttribute("tpz"));
+                    camera.aperture = element->FloatAttribute("aperture");
+                    camera.focus_distance = element->FloatAttribute("focus_dist");
+                    camera.focal_length = element->FloatAttribute("focal_length");
+                    cameras.push_back(camera);
+                }
+            }
+
+            return cameras;
+        }
+
+        // Every light_list of light.xml as logged with the L key is a light set, environment
+        // textures of the scene are shared by name, others are loaded from the file name
+        std::vector<std::vector<Light::Ptr>> LoadDatasetLights(std::string const& filename, Scene1 const& scene)
+        {
+            tinyxml2::XMLDocument doc;
+            if (doc.LoadFile(filename.c_str()) != tinyxml2::XML_SUCCESS)
+            {
+                throw std::runtime_error("Cannot open dataset lights: " + filename);
+            }
+
+            std::map<std::string, Texture::Ptr> textures;
+            for (auto iter = scene.CreateLightIterator(); iter->IsValid(); iter->Next())
+            {
+                if (auto ibl = std::dynamic_pointer_cast<ImageBasedLight>(iter->ItemAs<Light>()))
+                {
+                    if (ibl->GetTexture())
+                    {
+                        textures[ibl->GetTexture()->GetName()] = ibl->GetTexture();
+                    }
+                }
+            }
+
+            auto image_io = ImageIo::CreateImageIo();
+
+            std::vector<std::vector<Light::Ptr>> light_sets;
+            for (auto list = doc.FirstChildElement("light_list"); list; list = list->NextSiblingElement("light_list"))
+            {
+                std::vector<Light::Ptr> lights;
+                for (auto element = list->FirstChildElement("light"); element; element = element->NextSiblingElement("light"))
+                {
+                    std::string type = element->Attribute("type") ? element->Attribute("type") : "";
+                    Light::Ptr light;
+
+                    if (type == "ibl")
+                    {
+                        auto ibl = ImageBasedLight::Create();
+                        std::string name = element->Attribute("tex") ? element->Attribute("tex") : "";
+                        auto& texture = textures[name];
+                        if (!texture)
+                        {
+                            texture = image_io->LoadImage(name);
+                        }
+                        ibl->SetTexture(texture);
+                        ibl->SetMultiplier(element->FloatAttribute("mul"));
+                        light = ibl;
+                    }
+                    else if (type == "spot")
+                    {
+                        auto spot = SpotLight::Create();
+                        spot->SetConeShape(RadeonRays::float2(element->FloatAttribute("csx"), element->FloatAttribute("csy")));
+                        light = spot;
+                    }
+                    else if (type == "point")
+                    {
+                        light = PointLight::Create();
+                    }
+                    else if (type == "direct")
+                    {
+                        light = DirectionalLight::Create();
+                    }
+                    else
+                    {
+                        throw std::runtime_error("Unknown light type \"" + type + "\" in " + filename);
+                    }
+
+                    light->SetPosition(RadeonRays::float3(element->FloatAttribute("posx"), element->FloatAttribute("posy"), element->FloatAttribute("posz")));
+                    light->SetDirection(RadeonRays::float3(element->FloatAttribute("dirx"), element->FloatAttribute("diry"), element->FloatAttribute("dirz")));
+                    light->SetEmittedRadiance(RadeonRays::float3(element->FloatAttribute("radx"), element->FloatAttribute("rady"), element->FloatAttribute("radz")));
+                    lights.push_back(light);
+                }
+
+                light_sets.push_back(std::move(lights));
+            }
+
+            return light_sets;
+        }
+    }
+
     AppClRender::AppClRender(AppSettings& settings, GLuint tex) : m_tex(tex), m_output_type(Renderer::OutputType::kColor)
     {
         InitCl(settings, m_tex);
+
+        auto load_start = std::chrono::high_resolution_clock::now();
         LoadScene(settings);
+        m_load_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - load_start).count();
+
+        if (settings.memory_budget_percent > 0)
+        {
+            FitMemoryBudget(settings);
+        }
+
+        if (!settings.coordinator.empty())
+        {
+            std::vector<std::string> workers;
+            std::istringstream addresses(settings.coordinator);
+            for (std::string address; std::getline(addresses, address, ',');)
+            {
+                workers.push_back(address);
+            }
+
+            m_coordinator.reset(new RenderCoordinator(workers));
+            m_remote_buffer = m_cfgs[m_primary].context.CreateBuffer<RadeonRays::float3>(m_width * m_height, CL_MEM_READ_ONLY);
+        }
     }
 
     void AppClRender::InitCl(AppSettings& settings, GLuint tex)
@@ -72,6 +276,28 @@ namespace Baikal
             ConfigManager::CreateConfigs(settings.mode, false, m_cfgs, settings.num_bounces, settings.platform_index, settings.device_index);
         }
 
+        for (auto& cfg : m_cfgs)
+        {
+            auto factory = static_cast<Baikal::ClwRenderFactory*>(cfg.factory.get());
+            factory->SetBuildProfile(settings.build_profile);
+
+            if (!settings.shared_program_cache.empty())
+            {
+                factory->SetSharedProgramCachePath(settings.shared_program_cache);
+            }
+
+            // Clay preview of the layout, materials are never compiled
+            if (settings.ao_enabled)
+            {
+                cfg.renderer = factory->CreateRenderer(Baikal::ClwRenderFactory::RendererType::kAmbientOcclusion);
+
+                auto& estimator = static_cast<Baikal::AoEstimator&>(
+                    static_cast<Baikal::MonteCarloRenderer*>(cfg.renderer.get())->GetEstimator());
+                estimator.SetNumAoRays(static_cast<std::uint32_t>(std::max(settings.num_ao_rays, 1)));
+                estimator.SetAoRadius(settings.ao_radius);
+            }
+        }
+
         m_width = (std::uint32_t)settings.width;
         m_height = (std::uint32_t)settings.height;
 
@@ -102,7 +328,6 @@ namespace Baikal
 
             m_ctrl[i].clear.store(1);
             m_ctrl[i].stop.store(0);
-            m_ctrl[i].newdata.store(0);
             m_ctrl[i].idx = static_cast<int>(i);
         }
 
@@ -122,6 +347,43 @@ namespace Baikal
             }
         }
 
+        for (auto& cfg : m_cfgs)
+        {
+            static_cast<ClwSceneController*>(cfg.controller.get())->SetAccelerationStructure(settings.acceleration_structure);
+        }
+
+        if (settings.geometry_cache_mb > 0)
+        {
+            // Budget is split assuming two triangles per vertex, as in closed meshes
+            auto cache_bytes = static_cast<std::size_t>(settings.geometry_cache_mb) << 20;
+            auto vertex_bytes = sizeof(float3) + sizeof(ClwScene::NormalData) + sizeof(ClwScene::UVData);
+            auto max_vertices = cache_bytes / (vertex_bytes + 6 * sizeof(int));
+
+            for (auto& cfg : m_cfgs)
+            {
+                static_cast<ClwSceneController*>(cfg.controller.get())->SetGeometryCacheSize(max_vertices, 6 * max_vertices);
+            }
+
+            std::cout << "Geometry cache: " << settings.geometry_cache_mb << "MB\n";
+        }
+
+        if (settings.texture_cache_mb > 0)
+        {
+            for (auto& cfg : m_cfgs)
+            {
+                static_cast<ClwSceneController*>(cfg.controller.get())->SetTextureCacheSize(static_cast<std::size_t>(settings.texture_cache_mb) << 20);
+            }
+
+            std::cout << "Texture cache: " << settings.texture_cache_mb << "MB\n";
+        }
+
+        // Every device compiles the scene with its own controller, which needs the host copies
+        if (settings.device_resident && m_cfgs.size() == 1)
+        {
+            static_cast<ClwSceneController*>(m_cfgs[0].controller.get())->SetDeviceResident(true);
+            std::cout << "Device resident scene data\n";
+        }
+
         //create renderer
         for (std::size_t i = 0; i < m_cfgs.size(); ++i)
         {
@@ -140,15 +402,66 @@ namespace Baikal
 
             if (m_cfgs[i].type == ConfigManager::kPrimary)
             {
-                m_outputs[i].copybuffer = m_cfgs[i].context.CreateBuffer<RadeonRays::float3>(m_width * m_height, CL_MEM_READ_WRITE);
+                m_outputs[i].output_ldr = m_cfgs[i].factory->CreateOutput(m_width, m_height, Baikal::Output::Format::kRGBA8);
+                m_outputs[i].tonemapper = m_cfgs[i].factory->CreatePostEffect(Baikal::RenderFactory<Baikal::ClwScene>::PostEffectType::kTonemapper);
+                // Keep the look of the former host conversion
+                m_outputs[i].tonemapper->SetParameter("gamma", 2.2f);
             }
         }
 
-        m_shape_id_data.output = m_cfgs[m_primary].factory->CreateOutput(m_width, m_height);
+        m_compositor.reset(new MultiDeviceCompositor(m_cfgs, m_primary, m_width * m_height));
+
+        for (auto i = 0u; i < m_preview_frames.GetNumFrames(); ++i)
+        {
+            m_preview_frames.GetFrames()[i].readback.reset(new ClwReadback(m_cfgs[m_primary].context));
+        }
+
+        if (settings.split_frame && m_cfgs.size() > 1)
+        {
+            // Tiles have to fit into the smallest work buffer
+            auto work_buffer_size = std::numeric_limits<std::size_t>::max();
+            for (auto& cfg : m_cfgs)
+            {
+                auto renderer = static_cast<Baikal::MonteCarloRenderer*>(cfg.renderer.get());
+                work_buffer_size = std::min(work_buffer_size, renderer->GetEstimator().GetWorkBufferSize());
+            }
+
+            m_split_tile_size.x = std::min(static_cast<int>(m_width), kSplitTileSize);
+            m_split_tile_size.y = std::min(kSplitTileSize, static_cast<int>(work_buffer_size / m_split_tile_size.x));
+            m_scheduler.reset(new TileScheduler(m_cfgs.size()));
+
+            std::cout << "Split frame rendering, " << m_split_tile_size.x << "x" << m_split_tile_size.y << " tiles\n";
+        }
         m_dummy_output_data.output = m_cfgs[m_primary].factory->CreateOutput(m_width, m_height);
         m_cfgs[m_primary].renderer->Clear(RadeonRays::float3(0, 0, 0), *m_outputs[m_primary].output);
-        m_cfgs[m_primary].renderer->Clear(RadeonRays::float3(0, 0, 0), *m_shape_id_data.output);
         m_cfgs[m_primary].renderer->Clear(RadeonRays::float3(0, 0, 0), *m_dummy_output_data.output);
+
+        // Other devices accumulate full resolution samples, so it is limited to a single one
+        if (settings.motion_scale > 1 && m_cfgs.size() == 1)
+        {
+            auto scale = static_cast<std::uint32_t>(settings.motion_scale);
+            auto width = std::max(m_width / scale, 1u);
+            auto height = std::max(m_height / scale, 1u);
+
+            m_motion.color = m_cfgs[m_primary].factory->CreateOutput(width, height);
+            m_motion.depth = m_cfgs[m_primary].factory->CreateOutput(width, height);
+            m_motion.normal = m_cfgs[m_primary].factory->CreateOutput(width, height);
+            m_motion.upsampler = m_cfgs[m_primary].factory->CreatePostEffect(Baikal::RenderFactory<Baikal::ClwScene>::PostEffectType::kUpsampler);
+
+            std::cout << "Camera moves rendered at " << width << "x" << height << "\n";
+        }
+
+        if (!settings.stats_file_name.empty())
+        {
+            SetProfiling(true);
+        }
+
+        // Device steps come from the profiler spans
+        if (!settings.trace_file_name.empty())
+        {
+            SetProfiling(true);
+            Baikal::Tracer::Get().Start();
+        }
     }
 
 
@@ -161,8 +474,19 @@ namespace Baikal
         basepath += "/";
         std::string filename = basepath + settings.modelname;
 
+        // Workers check they are given jobs for the same scene
+        if (settings.worker_port > 0 || !settings.coordinator.empty())
+        {
+            m_scene_hash = HashSceneFile(filename);
+        }
+
         {
             m_scene = Baikal::SceneIo::LoadScene(filename, basepath);
+
+            if (settings.optimize_meshes)
+            {
+                Baikal::OptimizeSceneMeshes(*m_scene);
+            }
             // Enable this to generate new materal mapping for a model
 #if 0
             auto material_io{Baikal::MaterialIo::CreateMaterialIoXML()};
@@ -170,17 +494,20 @@ namespace Baikal
             material_io->SaveIdentityMapping(basepath + "mapping.xml", *m_scene);
 #endif
 
-            // Check it we have material remapping
+            // Check it we have material remapping, binary library is preferred as it loads faster
+            std::ifstream in_binary_materials(basepath + "materials.bin");
             std::ifstream in_materials(basepath + "materials.xml");
             std::ifstream in_mapping(basepath + "mapping.xml");
 
-            if (in_materials && in_mapping)
+            if ((in_binary_materials || in_materials) && in_mapping)
             {
+                auto binary = static_cast<bool>(in_binary_materials);
+                in_binary_materials.close();
                 in_materials.close();
                 in_mapping.close();
 
-                auto material_io = Baikal::MaterialIo::CreateMaterialIoXML();
-                auto mats = material_io->LoadMaterials(basepath + "materials.xml");
+                auto material_io = binary ? Baikal::MaterialIo::CreateMaterialIoBinary() : Baikal::MaterialIo::CreateMaterialIoXML();
+                auto mats = material_io->LoadMaterials(basepath + (binary ? "materials.bin" : "materials.xml"));
                 auto mapping = material_io->LoadMaterialMapping(basepath + "mapping.xml");
 
                 material_io->ReplaceSceneMaterials(*m_scene, *mats, mapping);
@@ -208,12 +535,13 @@ namespace Baikal
 
         m_scene->SetCamera(m_camera);
 
-        // Adjust sensor size based on current aspect ratio
-        float aspect = (float)settings.width / settings.height;
+        // Adjust sensor size based on current aspect ratio of a single view
+        float aspect = (float)settings.width / settings.camera_num_views / settings.height;
         settings.camera_sensor_size.y = settings.camera_sensor_size.x / aspect;
 
         m_camera->SetSensorSize(settings.camera_sensor_size);
         m_camera->SetDepthRange(settings.camera_zcap);
+        m_camera->SetViews(settings.camera_num_views, settings.camera_view_separation);
 
         auto perspective_camera = std::dynamic_pointer_cast<Baikal::PerspectiveCamera>(m_camera);
 
@@ -232,6 +560,39 @@ namespace Baikal
         std::cout << "Sensor size: " << settings.camera_sensor_size.x * 1000.f << "x" << settings.camera_sensor_size.y * 1000.f << "mm\n";
     }
 
+    void AppClRender::FitMemoryBudget(AppSettings& settings)
+    {
+        // Textures are shared, so devices after the first one start from what has been degraded for it
+        for (std::size_t i = 0; i < m_cfgs.size(); ++i)
+        {
+            MemoryBudget budget(m_cfgs[i].context, settings.memory_budget_percent / 100.f);
+            auto controller = static_cast<ClwSceneController*>(m_cfgs[i].controller.get());
+            auto renderer = static_cast<MonteCarloRenderer*>(m_cfgs[i].renderer.get());
+
+            auto report = budget.Fit(*m_scene, *controller, *renderer);
+
+            std::cout << "Device " << i << " memory budget: " << (report.budget_bytes >> 20) << "MB, scene and work buffer: " <<
+                (report.requested_bytes >> 20) << "MB";
+
+            if (report.fitted_bytes != report.requested_bytes)
+            {
+                std::cout << " -> " << (report.fitted_bytes >> 20) << "MB";
+            }
+
+            std::cout << "\n";
+
+            for (auto const& action : report.actions)
+            {
+                std::cout << "    " << action << "\n";
+            }
+
+            if (!report.fits)
+            {
+                std::cout << "    Warning: scene does not fit into the budget\n";
+            }
+        }
+    }
+
     void AppClRender::UpdateScene()
     {
 
@@ -239,186 +600,964 @@ namespace Baikal
         {
             if (i == static_cast<std::size_t>(m_primary))
             {
-                m_cfgs[i].controller->CompileScene(m_scene);
-                m_cfgs[i].renderer->Clear(float3(0, 0, 0), *m_outputs[i].output);
-
-#ifdef ENABLE_DENOISER
-                ClearDenoiserOutputs(i);
-#endif
-
+                m_compile_stats = m_cfgs[i].controller->CompileScene(m_scene).compile_stats;
+                ClearRenderOutputs();
             }
             else
                 m_ctrl[i].clear.store(true);
         }
+
+        if (m_coordinator)
+        {
+            StartRemoteJob();
+        }
     }
 
-    void AppClRender::Update(AppSettings& settings)
+    void AppClRender::StartRemoteJob()
     {
-        //if (std::chrono::duration_cast<std::chrono::seconds>(time - updatetime).count() > 1)
-        //{
-        for (std::size_t i = 0; i < m_cfgs.size(); ++i)
+        RenderJob job = {};
+        job.job_id = ++m_job_id;
+        job.seed = m_job_id;
+        job.scene_hash = m_scene_hash;
+        job.width = m_width;
+        job.height = m_height;
+        job.camera_position = m_camera->GetPosition();
+        job.camera_at = m_camera->GetPosition() + m_camera->GetForwardVector();
+        job.camera_up = m_camera->GetUpVector();
+
+        m_coordinator->StartJob(job);
+    }
+
+    void AppClRender::MergeRemoteSamples()
+    {
+        if (!m_coordinator->TakeSamples(m_remote_samples))
         {
-            if (m_cfgs[i].type == ConfigManager::kPrimary)
-                continue;
+            return;
+        }
+
+        auto& context = m_cfgs[m_primary].context;
+        context.WriteBuffer(0, m_remote_buffer, m_remote_samples.data(), m_remote_samples.size()).Wait();
+
+        auto acckernel = static_cast<MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->GetAccumulateKernel();
+
+        int argc = 0;
+        acckernel.SetArg(argc++, m_remote_buffer);
+        acckernel.SetArg(argc++, static_cast<int>(m_remote_samples.size()));
+        acckernel.SetArg(argc++, static_cast<Baikal::ClwOutput*>(m_outputs[m_primary].output.get())->data());
+
+        auto globalsize = static_cast<int>(m_remote_samples.size());
+        context.Launch1D(0, ((globalsize + 63) / 64) * 64, 64, acckernel);
+    }
+
+    void AppClRender::RunWorker(AppSettings& settings)
+    {
+        RenderWorker worker(static_cast<std::uint16_t>(settings.worker_port));
+
+        auto renderer = m_cfgs[m_primary].renderer.get();
+        auto output = static_cast<Baikal::ClwOutput*>(m_outputs[m_primary].output.get());
+        auto& fdata = m_outputs[m_primary].fdata;
+
+        RenderJob job;
+        bool has_job = false;
+        auto updatetime = std::chrono::high_resolution_clock::now();
 
-            int desired = 1;
-            if (std::atomic_compare_exchange_strong(&m_ctrl[i].newdata, &desired, 0))
+        while (worker.IsConnected())
+        {
+            if (worker.PollJob(job))
             {
+                has_job = job.scene_hash == m_scene_hash && job.width == m_width && job.height == m_height;
+
+                if (!has_job)
                 {
-                    m_cfgs[m_primary].context.WriteBuffer(0, m_outputs[m_primary].copybuffer, &m_outputs[i].fdata[0], settings.width * settings.height);
+                    std::cerr << "Render job " << job.job_id << " does not match the scene or resolution of the worker\n";
+                    continue;
                 }
 
-                auto acckernel = static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->GetAccumulateKernel();
-
-                int argc = 0;
-                acckernel.SetArg(argc++, m_outputs[m_primary].copybuffer);
-                acckernel.SetArg(argc++, settings.width * settings.width);
-                acckernel.SetArg(argc++, static_cast<Baikal::ClwOutput*>(m_outputs[m_primary].output.get())->data());
+                m_camera->LookAt(job.camera_position, job.camera_at, job.camera_up);
+                renderer->SetRandomSeed(GetWorkerSeed(job.seed, job.slot));
+                UpdateScene();
+                updatetime = std::chrono::high_resolution_clock::now();
+            }
 
-                int globalsize = settings.width * settings.height;
-                m_cfgs[m_primary].context.Launch1D(0, ((globalsize + 63) / 64) * 64, 64, acckernel);
+            if (!has_job)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
             }
-        }
 
-        //updatetime = time;
-        //}
+            renderer->Render(m_cfgs[m_primary].controller->GetCachedScene(m_scene));
 
-        if (!settings.interop)
-        {
-#ifdef ENABLE_DENOISER
-            m_outputs[m_primary].output_denoised->GetData(&m_outputs[m_primary].fdata[0]);
-#else
-            m_outputs[m_primary].output->GetData(&m_outputs[m_primary].fdata[0]);
-#endif
+            auto now = std::chrono::high_resolution_clock::now();
 
-            float gamma = 2.2f;
-            for (int i = 0; i < (int)m_outputs[m_primary].fdata.size(); ++i)
+            // Same cadence as secondary devices, chunks are large
+            if (std::chrono::duration_cast<std::chrono::seconds>(now - updatetime).count() > 1)
             {
-                m_outputs[m_primary].udata[4 * i] = (unsigned char)clamp(clamp(pow(m_outputs[m_primary].fdata[i].x / m_outputs[m_primary].fdata[i].w, 1.f / gamma), 0.f, 1.f) * 255, 0, 255);
-                m_outputs[m_primary].udata[4 * i + 1] = (unsigned char)clamp(clamp(pow(m_outputs[m_primary].fdata[i].y / m_outputs[m_primary].fdata[i].w, 1.f / gamma), 0.f, 1.f) * 255, 0, 255);
-                m_outputs[m_primary].udata[4 * i + 2] = (unsigned char)clamp(clamp(pow(m_outputs[m_primary].fdata[i].z / m_outputs[m_primary].fdata[i].w, 1.f / gamma), 0.f, 1.f) * 255, 0, 255);
-                m_outputs[m_primary].udata[4 * i + 3] = 1;
-            }
+                SampleChunk chunk;
+                chunk.job_id = job.job_id;
+                chunk.width = m_width;
+                chunk.height = m_height;
+
+                output->GetData(&fdata[0]);
+                chunk.data = fdata;
+                worker.SendSamples(chunk);
 
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, m_tex);
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_outputs[m_primary].output->width(), m_outputs[m_primary].output->height(), GL_RGBA, GL_UNSIGNED_BYTE, &m_outputs[m_primary].udata[0]);
-            glBindTexture(GL_TEXTURE_2D, 0);
+                // Unlike Renderer::Clear this keeps the sample counter, so the next chunk continues the sequence
+                output->Clear(float3(0, 0, 0));
+                updatetime = now;
+            }
         }
-        else
-        {
-            std::vector<cl_mem> objects;
-            objects.push_back(m_cl_interop_image);
-            m_cfgs[m_primary].context.AcquireGLObjects(0, objects);
 
-            auto copykernel = static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->GetCopyKernel();
+        std::cout << "Render coordinator disconnected\n";
+    }
 
-#ifdef ENABLE_DENOISER
-            auto output = m_outputs[m_primary].output_denoised.get();
-#else
-            auto output = m_outputs[m_primary].output.get();
-#endif
+    void AppClRender::RenderCameraSet(AppSettings& settings)
+    {
+        auto cameras = LoadCameraSet(settings.camera_set);
+
+        auto first = static_cast<std::size_t>(std::max(settings.camera_set_min, 0));
+        auto last = settings.camera_set_max < 0 ? cameras.size() :
+            std::min(cameras.size(), static_cast<std::size_t>(settings.camera_set_max) + 1);
+        auto num_samples = settings.num_samples > 0 ? settings.num_samples : kDefaultCameraSetSamples;
+
+        auto& context = m_cfgs[m_primary].context;
+        auto controller = m_cfgs[m_primary].controller.get();
+        auto renderer = m_cfgs[m_primary].renderer.get();
+        auto output = static_cast<Baikal::ClwOutput*>(m_outputs[m_primary].output.get());
+
+        // Frame is copied on the device so the next camera can clear the output right away,
+        // the copy reaches the host while the next camera renders
+        auto num_pixels = static_cast<std::size_t>(m_width) * m_height;
+        auto snapshot = context.CreateBuffer<RadeonRays::float3>(num_pixels, CL_MEM_READ_WRITE);
+        ClwReadback readback(context);
+        std::string pending_name;
+
+        auto save_pending = [&]()
+        {
+            if (pending_name.empty())
+            {
+                return;
+            }
 
-            int argc = 0;
+            readback.Wait();
+            auto data = static_cast<RadeonRays::float3 const*>(readback.GetData());
+            m_image_writer.Write(pending_name, m_width, m_height, std::vector<RadeonRays::float3>(data, data + num_pixels));
+            pending_name.clear();
+        };
 
-            copykernel.SetArg(argc++, static_cast<Baikal::ClwOutput*>(output)->data());
-            copykernel.SetArg(argc++, output->width());
-            copykernel.SetArg(argc++, output->height());
-            copykernel.SetArg(argc++, 2.2f);
-            copykernel.SetArg(argc++, m_cl_interop_image);
+        // Full compile once, cameras only touch the camera afterwards
+        static_cast<MonteCarloRenderer*>(renderer)->CompileProgramsAsync(controller->CompileScene(m_scene));
 
-            int globalsize = output->width() * output->height();
-            m_cfgs[m_primary].context.Launch1D(0, ((globalsize + 63) / 64) * 64, 64, copykernel);
+        std::cout << "Rendering cameras " << first << " to " << last << " of " << cameras.size() << "\n";
+        auto start_time = std::chrono::high_resolution_clock::now();
 
-            m_cfgs[m_primary].context.ReleaseGLObjects(0, objects);
-            m_cfgs[m_primary].context.Finish(0);
-        }
+        for (auto i = first; i < last; ++i)
+        {
+            m_camera->LookAt(cameras[i].eye, cameras[i].at, cameras[i].up);
+            controller->CompileScene(m_scene);
+            renderer->Clear(float3(0, 0, 0), *output);
 
+            auto& scene = controller->GetCachedScene(m_scene);
+            for (auto s = 0; s < num_samples; ++s)
+            {
+                renderer->Render(scene);
+            }
 
-        if (settings.benchmark)
-        {
-            auto& scene = m_cfgs[m_primary].controller->CompileScene(m_scene);
-            static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->Benchmark(scene, settings.stats);
+            // Previous camera should have landed by now
+            save_pending();
 
-            settings.benchmark = false;
-            settings.rt_benchmarked = true;
+            context.CopyBuffer(0u, output->data(), snapshot, 0, 0, num_pixels);
+            readback.EnqueueBuffer(snapshot, num_pixels * sizeof(RadeonRays::float3));
+
+            std::ostringstream oss;
+            oss << settings.camera_out_folder << settings.modelname << "_camera" << i << ".exr";
+            pending_name = oss.str();
         }
 
-        //ClwClass::Update();
+        save_pending();
+        m_image_writer.Wait();
+
+        auto delta = std::chrono::duration_cast<std::chrono::milliseconds>
+            (std::chrono::high_resolution_clock::now() - start_time).count();
+        std::cout << "Camera set rendered in " << delta / 1000.f << "s\n";
     }
 
-    void AppClRender::Render(int sample_cnt)
+    void AppClRender::GenerateDataset(AppSettings& settings)
     {
-#ifdef ENABLE_DENOISER
-        WaveletDenoiser* wavelet_denoiser = dynamic_cast<WaveletDenoiser*>(m_outputs[m_primary].denoiser.get());
-
-        if (wavelet_denoiser != nullptr)
+        auto cameras = LoadDatasetCameras(settings.dataset_cameras);
+        auto light_sets = settings.dataset_lights.empty() ?
+            std::vector<std::vector<Light::Ptr>>() : LoadDatasetLights(settings.dataset_lights, *m_scene);
+
+        auto input_samples = std::max(settings.dataset_input_samples, 1);
+        auto reference_samples = std::max(settings.num_samples > 0 ? settings.num_samples : kDefaultDatasetReferenceSamples, input_samples);
+
+        auto& context = m_cfgs[m_primary].context;
+        auto controller = m_cfgs[m_primary].controller.get();
+        auto renderer = m_cfgs[m_primary].renderer.get();
+        auto output = static_cast<Baikal::ClwOutput*>(m_outputs[m_primary].output.get());
+
+        // Noisy inputs are snapshots of the reference accumulation at 1, 2, 4 ... samples
+        std::vector<int> snapshot_samples;
+        std::vector<std::string> layer_names;
+        for (auto s = 1; s <= input_samples; s *= 2)
         {
-            wavelet_denoiser->Update(static_cast<PerspectiveCamera*>(m_camera.get()));
+            snapshot_samples.push_back(s);
+            layer_names.push_back("color_" + std::to_string(s) + "spp");
         }
-#endif
-        auto& scene = m_cfgs[m_primary].controller->GetCachedScene(m_scene);
-        m_cfgs[m_primary].renderer->Render(scene);
 
-        if (m_shape_id_requested)
+        // AOVs accumulate over all the reference samples
+        struct Aov
+        {
+            Renderer::OutputType type;
+            char const* name;
+            std::unique_ptr<Output> output;
+            Output* previous;
+        };
+
+        Aov aovs[] =
+        {
+            { Renderer::OutputType::kWorldPosition, "position", nullptr, nullptr },
+            { Renderer::OutputType::kWorldShadingNormal, "normal", nullptr, nullptr },
+            { Renderer::OutputType::kAlbedo, "albedo", nullptr, nullptr },
+            { Renderer::OutputType::kDepth, "depth", nullptr, nullptr },
+            { Renderer::OutputType::kMeshID, "mesh_id", nullptr, nullptr }
+        };
+
+        for (auto& aov : aovs)
         {
-            // offset in OpenCl memory till necessary item
-            auto offset = (std::uint32_t)(m_width * (m_height - m_shape_id_pos.y) + m_shape_id_pos.x);
-            // copy shape id elem from OpenCl
-            float4 shape_id;
-            m_shape_id_data.output->GetData((float3*)&shape_id, offset, 1);
-            m_promise.set_value(static_cast<int>(shape_id.x));
-            // clear output to stop tracking shape id map in openCl
-            m_cfgs[m_primary].renderer->SetOutput(Renderer::OutputType::kShapeId, nullptr);
-            m_shape_id_requested = false;
+            aov.output = m_cfgs[m_primary].factory->CreateOutput(m_width, m_height);
+            aov.previous = renderer->GetOutput(aov.type);
+            renderer->SetOutput(aov.type, aov.output.get());
+            layer_names.push_back(aov.name);
         }
 
-#ifdef ENABLE_DENOISER
-        Baikal::PostEffect::InputSet input_set;
-        input_set[Baikal::Renderer::OutputType::kColor] = m_outputs[m_primary].output.get();
-        input_set[Baikal::Renderer::OutputType::kWorldShadingNormal] = m_outputs[m_primary].output_normal.get();
-        input_set[Baikal::Renderer::OutputType::kWorldPosition] = m_outputs[m_primary].output_position.get();
-        input_set[Baikal::Renderer::OutputType::kAlbedo] = m_outputs[m_primary].output_albedo.get();
-        input_set[Baikal::Renderer::OutputType::kMeshID] = m_outputs[m_primary].output_mesh_id.get();
+        layer_names.push_back("reference");
 
-        auto radius = 10U - RadeonRays::clamp((sample_cnt / 16), 1U, 9U);
-        auto position_sensitivity = 5.f + 10.f * (radius / 10.f);
+        // All the layers of a view are copied into one buffer and read back at once, there are two of them
+        // so the next view renders while the previous one reaches the host
+        auto num_pixels = static_cast<std::size_t>(m_width) * m_height;
+        auto num_layers = layer_names.size();
+        CLWBuffer<RadeonRays::float3> snapshots[] =
+        {
+            context.CreateBuffer<RadeonRays::float3>(num_layers * num_pixels, CL_MEM_READ_WRITE),
+            context.CreateBuffer<RadeonRays::float3>(num_layers * num_pixels, CL_MEM_READ_WRITE)
+        };
 
-        const bool is_bilateral_denoiser = dynamic_cast<BilateralDenoiser*>(m_outputs[m_primary].denoiser.get()) != nullptr;
+        ClwReadback readback(context);
+        std::vector<RadeonRays::float3> pending_data(num_layers * num_pixels);
+        std::string pending_name;
 
-        if (is_bilateral_denoiser)
+        auto save_pending = [&]()
         {
+            if (pending_name.empty())
+            {
+                return;
+            }
 
-            auto normal_sensitivity = 0.1f + (radius / 10.f) * 0.15f;
-            auto color_sensitivity = (radius / 10.f) * 2.f;
-            auto albedo_sensitivity = 0.5f + (radius / 10.f) * 0.5f;
-            m_outputs[m_primary].denoiser->SetParameter("radius", static_cast<float>(radius));
-            m_outputs[m_primary].denoiser->SetParameter("color_sensitivity", color_sensitivity);
-            m_outputs[m_primary].denoiser->SetParameter("normal_sensitivity", normal_sensitivity);
-            m_outputs[m_primary].denoiser->SetParameter("position_sensitivity", position_sensitivity);
-            m_outputs[m_primary].denoiser->SetParameter("albedo_sensitivity", albedo_sensitivity);
-        }
+            readback.Wait();
 
-        m_outputs[m_primary].denoiser->Apply(input_set, *m_outputs[m_primary].output_denoised);
+            std::vector<AsyncImageWriter::Layer> layers(num_layers);
+            for (std::size_t i = 0; i < num_layers; ++i)
+            {
+                layers[i].name = layer_names[i];
+                layers[i].data.assign(pending_data.begin() + i * num_pixels, pending_data.begin() + (i + 1) * num_pixels);
+            }
+
+            m_image_writer.WriteLayers(pending_name, m_width, m_height, std::move(layers));
+            pending_name.clear();
+        };
+
+        // Full compile once, views only touch the camera and lights afterwards
+        static_cast<MonteCarloRenderer*>(renderer)->CompileProgramsAsync(controller->CompileScene(m_scene));
+
+        auto num_light_sets = std::max<std::size_t>(light_sets.size(), 1u);
+        std::cout << "Generating dataset of " << cameras.size() << " cameras and " << num_light_sets << " light sets\n";
+        auto start_time = std::chrono::high_resolution_clock::now();
+
+        auto perspective_camera = std::dynamic_pointer_cast<PerspectiveCamera>(m_camera);
+        std::size_t view = 0;
+
+        for (std::size_t l = 0; l < num_light_sets; ++l)
+        {
+            // Without light sets the scene lights are used, area lights come with emissive materials and always stay
+            if (!light_sets.empty())
+            {
+                std::vector<Light::Ptr> detached;
+                for (auto iter = m_scene->CreateLightIterator(); iter->IsValid(); iter->Next())
+                {
+                    auto light = iter->ItemAs<Light>();
+                    if (!std::dynamic_pointer_cast<AreaLight>(light))
+                    {
+                        detached.push_back(light);
+                    }
+                }
+
+                for (auto const& light : detached)
+                {
+                    m_scene->DetachLight(light);
+                }
+
+                for (auto const& light : light_sets[l])
+                {
+                    m_scene->AttachLight(light);
+                }
+            }
+
+            for (std::size_t c = 0; c < cameras.size(); ++c, ++view)
+            {
+                auto const& camera = cameras[c];
+                m_camera->LookAt(camera.eye, camera.at, settings.camera_up);
+
+                if (perspective_camera)
+                {
+                    perspective_camera->SetAperture(camera.aperture);
+                    perspective_camera->SetFocusDistance(camera.focus_distance);
+                    perspective_camera->SetFocalLength(camera.focal_length);
+                }
+
+                controller->CompileScene(m_scene);
+                renderer->Clear(float3(0, 0, 0), *output);
+                for (auto& aov : aovs)
+                {
+                    renderer->Clear(float3(0, 0, 0), *aov.output);
+                }
+
+                auto& scene = controller->GetCachedScene(m_scene);
+                auto& snapshot = snapshots[view % 2];
+                std::size_t next_snapshot = 0;
+
+                for (auto s = 1; s <= reference_samples; ++s)
+                {
+                    renderer->Render(scene);
+
+                    if (next_snapshot < snapshot_samples.size() && s == snapshot_samples[next_snapshot])
+                    {
+                        context.CopyBuffer(0u, output->data(), snapshot, 0, next_snapshot * num_pixels, num_pixels);
+                        ++next_snapshot;
+                    }
+                }
+
+                auto layer = snapshot_samples.size();
+                for (auto& aov : aovs)
+                {
+                    context.CopyBuffer(0u, static_cast<Baikal::ClwOutput*>(aov.output.get())->data(), snapshot, 0, layer++ * num_pixels, num_pixels);
+                }
+
+                context.CopyBuffer(0u, output->data(), snapshot, 0, layer * num_pixels, num_pixels);
+
+                // Previous view should have landed by now
+                save_pending();
+                readback.EnqueueBuffer(snapshot, num_layers * num_pixels * sizeof(RadeonRays::float3), pending_data.data());
+
+                std::ostringstream oss;
+                oss << settings.camera_out_folder << settings.modelname << "_camera" << c << "_lights" << l << ".exr";
+                pending_name = oss.str();
+            }
+        }
+
+        save_pending();
+        m_image_writer.Wait();
+
+        for (auto& aov : aovs)
+        {
+            renderer->SetOutput(aov.type, aov.previous);
+        }
+
+        auto delta = std::chrono::duration_cast<std::chrono::milliseconds>
+            (std::chrono::high_resolution_clock::now() - start_time).count();
+        std::cout << "Dataset of " << view << " views generated in " << delta / 1000.f << "s\n";
+    }
+
+    void AppClRender::RenderMaterialThumbnails(AppSettings& settings)
+    {
+        // Every material once, in the order the shapes reference them
+        std::vector<Material::Ptr> materials;
+        std::set<Material::Ptr> visited;
+
+        for (auto iter = m_scene->CreateShapeIterator(); iter->IsValid(); iter->Next())
+        {
+            auto material = iter->ItemAs<Shape>()->GetMaterial();
+
+            if (material && visited.insert(material).second)
+            {
+                materials.push_back(material);
+            }
+        }
+
+        if (materials.empty())
+        {
+            std::cout << "No materials to render thumbnails of\n";
+            return;
+        }
+
+        auto num_samples = settings.num_samples > 0 ? settings.num_samples : kDefaultThumbnailSamples;
+        auto tile_size = static_cast<std::uint32_t>(std::max(settings.thumbnail_size, 1));
+
+        MaterialPreviewRenderer preview(*m_cfgs[m_primary].factory, tile_size);
+
+        // Balls are lit by the environment of the scene if it has one
+        for (auto iter = m_scene->CreateLightIterator(); iter->IsValid(); iter->Next())
+        {
+            if (auto ibl = std::dynamic_pointer_cast<ImageBasedLight>(iter->ItemAs<Light>()))
+            {
+                preview.SetEnvironment(ibl->GetTexture(), ibl->GetMultiplier());
+                break;
+            }
+        }
+
+        std::cout << "Rendering thumbnails of " << materials.size() << " materials\n";
+        auto start_time = std::chrono::high_resolution_clock::now();
+
+        preview.Render(materials, num_samples);
+        auto thumbnails = preview.GetThumbnails();
+
+        auto delta = std::chrono::duration_cast<std::chrono::milliseconds>
+            (std::chrono::high_resolution_clock::now() - start_time).count();
+        std::cout << "Thumbnails rendered in " << delta / 1000.f << "s\n";
+
+        m_image_writer.Write(settings.thumbnail_folder + settings.modelname + "_materials.exr",
+            preview.GetAtlasWidth(), preview.GetAtlasHeight(), preview.GetAtlasData());
+
+        for (std::size_t i = 0; i < thumbnails.size(); ++i)
+        {
+            std::ostringstream oss;
+            oss << settings.thumbnail_folder << settings.modelname << "_material" << i << ".exr";
+            std::cout << oss.str() << ": " << materials[i]->GetName() << "\n";
+
+            m_image_writer.Write(oss.str(), tile_size, tile_size, std::move(thumbnails[i]));
+        }
+
+        m_image_writer.Wait();
+    }
+
+    void AppClRender::RenderResumable(AppSettings& settings)
+    {
+        auto num_samples = settings.num_samples > 0 ? settings.num_samples : kDefaultResumableSamples;
+
+        auto controller = m_cfgs[m_primary].controller.get();
+        auto renderer = m_cfgs[m_primary].renderer.get();
+        auto output = m_outputs[m_primary].output.get();
+
+        static_cast<MonteCarloRenderer*>(renderer)->CompileProgramsAsync(controller->CompileScene(m_scene));
+        auto& scene = controller->GetCachedScene(m_scene);
+
+        renderer->Clear(float3(0, 0, 0), *output);
+
+        // Sample index of the renderer may run ahead of the samples per pixel, so the loop keeps its own count
+        auto first_sample = 0;
+
+        if (std::ifstream(settings.checkpoint_file, std::ios::binary))
+        {
+            RenderCheckpoint checkpoint;
+            checkpoint.ReadFile(settings.checkpoint_file);
+            renderer->LoadCheckpoint(checkpoint);
+            first_sample = checkpoint.GetValue<int>("app.num_samples");
+
+            std::cout << "Resuming from " << settings.checkpoint_file << " at " << first_sample << " samples\n";
+        }
+
+        std::future<void> pending_write;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        auto last_checkpoint = start_time;
+
+        for (auto s = first_sample; s < num_samples; ++s)
+        {
+            renderer->Render(scene);
+
+            auto now = std::chrono::high_resolution_clock::now();
+            if (std::chrono::duration<float>(now - last_checkpoint).count() < settings.checkpoint_interval || s + 1 == num_samples)
+            {
+                continue;
+            }
+
+            // Slow disks skip checkpoints rather than stalling the render
+            if (pending_write.valid())
+            {
+                if (pending_write.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                {
+                    continue;
+                }
+
+                try
+                {
+                    pending_write.get();
+                }
+                catch (std::exception& e)
+                {
+                    std::cout << "Checkpoint failed: " << e.what() << "\n";
+                }
+            }
+
+            // State is read back here, encoding and writing it runs on a worker
+            auto checkpoint = std::make_shared<RenderCheckpoint>();
+            renderer->SaveCheckpoint(*checkpoint);
+            checkpoint->SetValue("app.num_samples", s + 1);
+
+            auto file_name = settings.checkpoint_file;
+            pending_write = TaskScheduler::Get().Submit([checkpoint, file_name]()
+            {
+                checkpoint->WriteFile(file_name);
+            });
+
+            last_checkpoint = now;
+        }
+
+        if (pending_write.valid())
+        {
+            try
+            {
+                pending_write.get();
+            }
+            catch (std::exception& e)
+            {
+                std::cout << "Checkpoint failed: " << e.what() << "\n";
+            }
+        }
+
+        auto delta = std::chrono::duration_cast<std::chrono::milliseconds>
+            (std::chrono::high_resolution_clock::now() - start_time).count();
+        std::cout << num_samples - first_sample << " samples rendered in " << delta / 1000.f << "s\n";
+
+        SaveFrameBuffer(settings);
+        m_image_writer.Wait();
+
+        // Finished job starts from scratch next time
+        std::remove(settings.checkpoint_file.c_str());
+    }
+
+    AppClRender::~AppClRender()
+    {
+        // Copies may still write into mapped pixel buffers
+        for (auto i = 0u; i < m_preview_frames.GetNumFrames(); ++i)
+        {
+            auto& frame = m_preview_frames.GetFrames()[i];
+
+            if (frame.readback)
+            {
+                frame.readback->Wait();
+            }
+
+            if (frame.pbo)
+            {
+                if (frame.mapped)
+                {
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, frame.pbo);
+                    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                }
+
+                glDeleteBuffers(1, &frame.pbo);
+            }
+        }
+    }
+
+    void AppClRender::Update(AppSettings& settings)
+    {
+        BAIKAL_TRACE_SCOPE("app", "Update");
+
+        //if (std::chrono::duration_cast<std::chrono::seconds>(time - updatetime).count() > 1)
+        //{
+        m_compositor->Composite(static_cast<Baikal::ClwOutput*>(m_outputs[m_primary].output.get())->data());
+
+        if (m_coordinator)
+        {
+            MergeRemoteSamples();
+        }
+
+        //updatetime = time;
+        //}
+
+        if (!settings.interop)
+        {
+            UpdatePreviewAsync(GetDisplayOutput());
+        }
+        else
+        {
+            std::vector<cl_mem> objects;
+            objects.push_back(m_cl_interop_image);
+            m_cfgs[m_primary].context.AcquireGLObjects(0, objects);
+
+            auto copykernel = static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->GetCopyKernel();
+            auto output = GetDisplayOutput();
+
+            int argc = 0;
+
+            copykernel.SetArg(argc++, static_cast<Baikal::ClwOutput*>(output)->data());
+            copykernel.SetArg(argc++, output->width());
+            copykernel.SetArg(argc++, output->height());
+            copykernel.SetArg(argc++, 2.2f);
+            copykernel.SetArg(argc++, m_cl_interop_image);
+
+            int globalsize = output->width() * output->height();
+            m_cfgs[m_primary].context.Launch1D(0, ((globalsize + 63) / 64) * 64, 64, copykernel);
+
+            m_cfgs[m_primary].context.ReleaseGLObjects(0, objects);
+            m_cfgs[m_primary].context.Finish(0);
+        }
+
+
+        if (settings.benchmark)
+        {
+            auto& scene = m_cfgs[m_primary].controller->CompileScene(m_scene);
+            static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->Benchmark(scene, settings.stats);
+
+            settings.benchmark = false;
+            settings.rt_benchmarked = true;
+        }
+
+        //ClwClass::Update();
+    }
+
+    void AppClRender::Render(int sample_cnt)
+    {
+        BAIKAL_TRACE_SCOPE("app", "Render");
+
+#ifdef ENABLE_DENOISER
+        WaveletDenoiser* wavelet_denoiser = dynamic_cast<WaveletDenoiser*>(m_outputs[m_primary].denoiser.get());
+
+        if (wavelet_denoiser != nullptr)
+        {
+            wavelet_denoiser->Update(static_cast<PerspectiveCamera*>(m_camera.get()));
+        }
+#endif
+        auto& scene = m_cfgs[m_primary].controller->GetCachedScene(m_scene);
+
+        if (m_scheduler)
+        {
+            RadeonRays::int2 origin, size;
+            if (!GetRenderRegion(origin, size))
+            {
+                size = RadeonRays::int2(m_width, m_height);
+            }
+
+            // Secondary devices pick up their share as soon as the frame starts
+            m_scheduler->BeginFrame(origin, size, m_split_tile_size);
+            RenderSplitFrameTiles(m_primary, scene);
+            m_scheduler->EndFrame();
+        }
+        else
+        {
+            m_cfgs[m_primary].renderer->Render(scene);
+        }
+
+        // Samples which have hit paged out geometry are incomplete, paged out textures are sampled at low resolution
+        auto clw_controller = static_cast<ClwSceneController*>(m_cfgs[m_primary].controller.get());
+        auto geometry_changed = clw_controller->UpdateGeometryResidency(m_scene);
+        auto textures_changed = clw_controller->UpdateTextureResidency(m_scene);
+
+        if (geometry_changed || textures_changed)
+        {
+            ClearRenderOutputs();
+#ifdef ENABLE_DENOISER
+            m_outputs[m_primary].denoise_schedule.Reset();
+#endif
+        }
+
+        if (m_navigating)
+        {
+            Baikal::PostEffect::InputSet input_set;
+            input_set[Baikal::Renderer::OutputType::kColor] = m_motion.color.get();
+            input_set[Baikal::Renderer::OutputType::kDepth] = m_motion.depth.get();
+            input_set[Baikal::Renderer::OutputType::kWorldShadingNormal] = m_motion.normal.get();
+
+            // Displayed output is overwritten, it is cleared once full resolution rendering resumes
+            BAIKAL_TRACE_SCOPE("posteffect", "Upsample");
+#ifdef ENABLE_DENOISER
+            m_motion.upsampler->Apply(input_set, *m_outputs[m_primary].output_denoised);
+#else
+            m_motion.upsampler->Apply(input_set, *m_outputs[m_primary].output);
+#endif
+            return;
+        }
+
+#ifdef ENABLE_DENOISER
+        // Denoising whole frames would cost more than rendering a small region
+        RadeonRays::int2 origin, size;
+        if (GetRenderRegion(origin, size))
+        {
+            return;
+        }
+
+        // Adaptive renderer tells how much of the image is still noisy
+        auto adaptive_renderer = dynamic_cast<AdaptiveRenderer*>(m_cfgs[m_primary].renderer.get());
+        auto noise = adaptive_renderer ? adaptive_renderer->GetUnconvergedFraction() : -1.f;
+
+        if (!m_outputs[m_primary].denoise_schedule.ShouldDenoise(static_cast<std::uint32_t>(sample_cnt + 1), noise))
+        {
+            return;
+        }
+
+        Baikal::PostEffect::InputSet input_set;
+        input_set[Baikal::Renderer::OutputType::kColor] = m_outputs[m_primary].output.get();
+        input_set[Baikal::Renderer::OutputType::kWorldShadingNormal] = m_outputs[m_primary].output_normal.get();
+        input_set[Baikal::Renderer::OutputType::kWorldPosition] = m_outputs[m_primary].output_position.get();
+        input_set[Baikal::Renderer::OutputType::kAlbedo] = m_outputs[m_primary].output_albedo.get();
+        input_set[Baikal::Renderer::OutputType::kMeshID] = m_outputs[m_primary].output_mesh_id.get();
+
+        auto radius = 10U - RadeonRays::clamp((sample_cnt / 16), 1U, 9U);
+        auto position_sensitivity = 5.f + 10.f * (radius / 10.f);
+
+        const bool is_bilateral_denoiser = dynamic_cast<BilateralDenoiser*>(m_outputs[m_primary].denoiser.get()) != nullptr;
+
+        if (is_bilateral_denoiser)
+        {
+
+            auto normal_sensitivity = 0.1f + (radius / 10.f) * 0.15f;
+            auto color_sensitivity = (radius / 10.f) * 2.f;
+            auto albedo_sensitivity = 0.5f + (radius / 10.f) * 0.5f;
+            m_outputs[m_primary].denoiser->SetParameter("radius", static_cast<float>(radius));
+            m_outputs[m_primary].denoiser->SetParameter("color_sensitivity", color_sensitivity);
+            m_outputs[m_primary].denoiser->SetParameter("normal_sensitivity", normal_sensitivity);
+            m_outputs[m_primary].denoiser->SetParameter("position_sensitivity", position_sensitivity);
+            m_outputs[m_primary].denoiser->SetParameter("albedo_sensitivity", albedo_sensitivity);
+        }
+
+        BAIKAL_TRACE_SCOPE("posteffect", "Denoise");
+        m_outputs[m_primary].denoiser->Apply(input_set, *m_outputs[m_primary].output_denoised);
 #endif
     }
 
-    void AppClRender::SaveFrameBuffer(AppSettings& settings)
+    bool AppClRender::SetNavigating(bool navigating)
     {
-        std::vector<RadeonRays::float3> data;
+        // Other AOVs are displayed at full resolution, workers send full resolution samples
+        navigating = navigating && m_motion.upsampler && !m_coordinator &&
+            m_output_type == Renderer::OutputType::kColor && m_region_size.x == 0;
+
+        if (navigating == m_navigating)
+        {
+            return false;
+        }
+
+        auto renderer = m_cfgs[m_primary].renderer.get();
+
+        if (navigating)
+        {
+#ifdef ENABLE_DENOISER
+            // Denoiser is skipped while upsampling, and all the outputs have to be of the same size
+            renderer->SetOutput(Renderer::OutputType::kWorldPosition, nullptr);
+            renderer->SetOutput(Renderer::OutputType::kAlbedo, nullptr);
+            renderer->SetOutput(Renderer::OutputType::kMeshID, nullptr);
+#endif
+            renderer->SetOutput(Renderer::OutputType::kColor, m_motion.color.get());
+            renderer->SetOutput(Renderer::OutputType::kDepth, m_motion.depth.get());
+            renderer->SetOutput(Renderer::OutputType::kWorldShadingNormal, m_motion.normal.get());
+        }
+        else
+        {
+            renderer->SetOutput(Renderer::OutputType::kColor, m_outputs[m_primary].output.get());
+            renderer->SetOutput(Renderer::OutputType::kDepth, nullptr);
+#ifdef ENABLE_DENOISER
+            SetDenoiserOutputs(m_primary);
+            m_outputs[m_primary].denoise_schedule.Reset();
+#else
+            renderer->SetOutput(Renderer::OutputType::kWorldShadingNormal, nullptr);
+#endif
+        }
+
+        m_navigating = navigating;
+        ClearRenderOutputs();
+        return true;
+    }
+
+    void AppClRender::SetRenderRegion(std::uint32_t x0, std::uint32_t y0, std::uint32_t x1, std::uint32_t y1)
+    {
+        // Workers send whole frames
+        if (m_coordinator)
+        {
+            return;
+        }
+
+        auto xmin = std::min(std::min(x0, x1), m_width - 1);
+        auto xmax = std::min(std::max(x0, x1), m_width - 1);
+        auto ymin = std::min(std::min(y0, y1), m_height - 1);
+        auto ymax = std::min(std::max(y0, y1), m_height - 1);
+
+        // Region is given in full resolution pixels
+        SetNavigating(false);
+
+        // Window rows go from the top
+        m_region_origin = RadeonRays::int2(static_cast<int>(xmin), static_cast<int>(m_height - 1 - ymax));
+        m_region_size = RadeonRays::int2(static_cast<int>(xmax - xmin + 1), static_cast<int>(ymax - ymin + 1));
+
+        static_cast<MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->SetRenderRegion(m_region_origin, m_region_size);
+    }
+
+    void AppClRender::ClearRenderRegion()
+    {
+        m_region_origin = RadeonRays::int2();
+        m_region_size = RadeonRays::int2();
+
+        static_cast<MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->SetRenderRegion(m_region_origin, m_region_size);
+
+#ifdef ENABLE_DENOISER
+        // Denoised output is stale
+        m_outputs[m_primary].denoise_schedule.Reset();
+#endif
+    }
+
+    bool AppClRender::GetRenderRegion(RadeonRays::int2& origin, RadeonRays::int2& size) const
+    {
+        origin = m_region_origin;
+        size = m_region_size;
+        return m_region_size.x > 0 && m_region_size.y > 0;
+    }
+
+    Output* AppClRender::GetDisplayOutput() const
+    {
+#ifdef ENABLE_DENOISER
+        RadeonRays::int2 origin, size;
+        if (!GetRenderRegion(origin, size))
+        {
+            return m_outputs[m_primary].output_denoised.get();
+        }
+#endif
+        return m_outputs[m_primary].output.get();
+    }
+
+    void AppClRender::ClearRenderOutputs()
+    {
+        auto renderer = m_cfgs[m_primary].renderer.get();
+
+        if (m_navigating)
+        {
+            renderer->Clear(float3(0, 0, 0), *m_motion.color);
+            renderer->Clear(float3(0, 0, 0), *m_motion.depth);
+            renderer->Clear(float3(0, 0, 0), *m_motion.normal);
+            return;
+        }
+
+        renderer->Clear(float3(0, 0, 0), *m_outputs[m_primary].output);
+#ifdef ENABLE_DENOISER
+        ClearDenoiserOutputs(m_primary);
+#endif
+    }
+
+    void AppClRender::UpdatePreview(Output* output)
+    {
+        BAIKAL_TRACE_SCOPE("app", "UpdatePreview");
+
+        PostEffect::InputSet input_set;
+        input_set[Renderer::OutputType::kColor] = output;
+
+        auto& output_data = m_outputs[m_primary];
+        output_data.tonemapper->Apply(input_set, *output_data.output_ldr);
+        static_cast<Baikal::ClwOutput*>(output_data.output_ldr.get())->GetRawData(&output_data.udata[0]);
+    }
+
+    std::vector<unsigned char> const& AppClRender::ReadPreview()
+    {
+        UpdatePreview(m_outputs[m_primary].output.get());
+        return m_outputs[m_primary].udata;
+    }
+
+    TileDelta AppClRender::ReadPreviewTiles(bool reset)
+    {
+        auto& output_data = m_outputs[m_primary];
+
+        if (!m_tile_encoder)
+        {
+            m_tile_encoder = static_cast<ClwRenderFactory*>(m_cfgs[m_primary].factory.get())->CreateTileDeltaEncoder();
+        }
+
+        if (reset)
+        {
+            m_tile_encoder->Reset();
+        }
 
-        //read cl output in case of iterop
-        std::vector<RadeonRays::float3> output_data;
-        if (settings.interop)
+        PostEffect::InputSet input_set;
+        input_set[Renderer::OutputType::kColor] = output_data.output.get();
+        output_data.tonemapper->Apply(input_set, *output_data.output_ldr);
+
+        return m_tile_encoder->Encode(*output_data.output_ldr);
+    }
+
+    bool AppClRender::UpdatePreviewAsync(Output* output)
+    {
+        BAIKAL_TRACE_SCOPE("app", "UpdatePreviewAsync");
+
+        auto& output_data = m_outputs[m_primary];
+        auto ldr = static_cast<Baikal::ClwOutput*>(output_data.output_ldr.get());
+        auto size = ldr->width() * ldr->height() * ClwOutput::GetPixelSize(ldr->format());
+        auto row_size = ldr->width() * ClwOutput::GetPixelSize(ldr->format());
+
+        // Publish the back frame once its copy has landed
+        if (m_preview_pending && m_preview_frames.GetBackFrame().readback->IsReady())
+        {
+            m_preview_frames.Publish();
+            m_preview_pending = false;
+        }
+
+        if (!m_preview_pending)
+        {
+            PostEffect::InputSet input_set;
+            input_set[Renderer::OutputType::kColor] = output;
+            output_data.tonemapper->Apply(input_set, *output_data.output_ldr);
+
+            auto& frame = m_preview_frames.GetBackFrame();
+            if (!frame.pbo)
+            {
+                glGenBuffers(1, &frame.pbo);
+            }
+
+            // Device copies straight into the pixel buffer, so the texture upload from it is asynchronous and
+            // nothing goes through client memory. Orphaning hands out fresh storage instead of waiting for
+            // the previous upload, a frame which has never been uploaded is dropped the same way.
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, frame.pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            frame.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            if (!frame.mapped)
+            {
+                throw std::runtime_error("AppClRender: cannot map preview pixel buffer");
+            }
+
+            // Rows out of the render region do not change
+            RadeonRays::int2 origin, region_size;
+            if (GetRenderRegion(origin, region_size))
+            {
+                frame.first_row = static_cast<std::uint32_t>(origin.y);
+                frame.num_rows = static_cast<std::uint32_t>(region_size.y);
+            }
+            else
+            {
+                frame.first_row = 0;
+                frame.num_rows = ldr->height();
+            }
+
+            BAIKAL_TRACE_SCOPE("app", "EnqueueReadback");
+            auto offset = frame.first_row * row_size;
+            frame.readback->EnqueueBuffer(ldr->data(), frame.num_rows * row_size, static_cast<char*>(frame.mapped) + offset, offset);
+            m_preview_pending = true;
+        }
+
+        if (!m_preview_frames.Acquire())
         {
-            auto output = m_outputs[m_primary].output.get();
-            auto buffer = static_cast<Baikal::ClwOutput*>(output)->data();
-            output_data.resize(buffer.GetElementCount());
-            m_cfgs[m_primary].context.ReadBuffer(0, static_cast<Baikal::ClwOutput*>(output)->data(), &output_data[0], output_data.size()).Wait();
+            // Texture keeps the last frame until a newer one has been read back
+            return false;
         }
 
-        //use already copied to CPU cl data in case of no interop
-        auto& fdata = settings.interop ? output_data : m_outputs[m_primary].fdata;
+        auto& frame = m_preview_frames.GetFrontFrame();
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, frame.pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        frame.mapped = nullptr;
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_tex);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, frame.first_row, ldr->width(), frame.num_rows, GL_RGBA, GL_UNSIGNED_BYTE,
+            reinterpret_cast<void*>(static_cast<std::size_t>(frame.first_row * row_size)));
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        return true;
+    }
+
+    void AppClRender::SaveFrameBuffer(AppSettings& settings)
+    {
+        std::vector<RadeonRays::float3> data;
+
+        // Preview is tonemapped on the device, read full precision data here
+        auto& fdata = m_outputs[m_primary].fdata;
+        m_outputs[m_primary].output->GetData(&fdata[0]);
 
         data.resize(fdata.size());
         std::transform(fdata.cbegin(), fdata.cend(), data.begin(),
@@ -435,40 +1574,17 @@ namespace Baikal
             "_d" << camera_direction.x << camera_direction.y << camera_direction.z <<
             "_s" << settings.num_samples << ".exr";
 
-        SaveImage(oss.str(), settings.width, settings.height, data.data());
+        m_image_writer.Write(oss.str(), settings.width, settings.height, std::move(data));
     }
 
     void AppClRender::SaveImage(const std::string& name, int width, int height, const RadeonRays::float3* data)
     {
-        OIIO_NAMESPACE_USING;
-
-        std::vector<float3> tempbuf(width * height);
-        tempbuf.assign(data, data + width * height);
-
-        for (auto y = 0; y < height; ++y)
-            for (auto x = 0; x < width; ++x)
-            {
-
-                float3 val = data[(height - 1 - y) * width + x];
-                tempbuf[y * width + x] = (1.f / val.w) * val;
-
-                tempbuf[y * width + x].x = std::pow(tempbuf[y * width + x].x, 1.f / 2.2f);
-                tempbuf[y * width + x].y = std::pow(tempbuf[y * width + x].y, 1.f / 2.2f);
-                tempbuf[y * width + x].z = std::pow(tempbuf[y * width + x].z, 1.f / 2.2f);
-            }
-
-        ImageOutput* out = ImageOutput::create(name);
-
-        if (!out)
-        {
-            throw std::runtime_error("Can't create image file on disk");
-        }
-
-        ImageSpec spec(width, height, 3, TypeDesc::FLOAT);
+        m_image_writer.Write(name, width, height, std::vector<RadeonRays::float3>(data, data + width * height));
+    }
 
-        out->open(name, spec);
-        out->write_image(TypeDesc::FLOAT, &tempbuf[0], sizeof(float3));
-        out->close();
+    void AppClRender::WaitForSavedImages()
+    {
+        m_image_writer.Wait();
     }
 
     void AppClRender::RenderThread(ControlData& cd)
@@ -478,9 +1594,20 @@ namespace Baikal
         auto output = m_outputs[cd.idx].output.get();
 
         auto updatetime = std::chrono::high_resolution_clock::now();
+        std::uint64_t frame = 0;
 
         while (!cd.stop.load())
         {
+            if (m_scheduler)
+            {
+                frame = m_scheduler->WaitForFrame(frame);
+
+                if (frame == 0)
+                {
+                    break;
+                }
+            }
+
             int result = 1;
             bool update = false;
 
@@ -492,17 +1619,34 @@ namespace Baikal
             }
 
             auto& scene = controller->GetCachedScene(m_scene);
-            renderer->Render(scene);
+
+            if (m_scheduler)
+            {
+                RenderSplitFrameTiles(cd.idx, scene);
+            }
+            else
+            {
+                renderer->Render(scene);
+            }
+
+            auto clw_controller = static_cast<ClwSceneController*>(controller);
+            auto geometry_changed = clw_controller->UpdateGeometryResidency(m_scene);
+            auto textures_changed = clw_controller->UpdateTextureResidency(m_scene);
+
+            if (geometry_changed || textures_changed)
+            {
+                renderer->Clear(float3(0, 0, 0), *output);
+            }
 
             auto now = std::chrono::high_resolution_clock::now();
 
-            update = update || (std::chrono::duration_cast<std::chrono::seconds>(now - updatetime).count() > 1);
+            // Split frame tiles are handed over every frame, the primary does not render them
+            update = update || m_scheduler || (std::chrono::duration_cast<std::chrono::seconds>(now - updatetime).count() > 1);
 
-            if (update)
+            // Retry on the next iteration if the previous snapshot is still in flight
+            if (update && m_compositor->Submit(cd.idx, static_cast<ClwOutput*>(output)->data(), m_scheduler != nullptr))
             {
-                m_outputs[cd.idx].output->GetData(&m_outputs[cd.idx].fdata[0]);
                 updatetime = now;
-                cd.newdata.store(1);
             }
 
             m_cfgs[cd.idx].context.Finish(0);
@@ -532,6 +1676,65 @@ namespace Baikal
 
             m_ctrl[i].stop.store(true);
         }
+
+        if (m_scheduler)
+        {
+            m_scheduler->Stop();
+        }
+    }
+
+    void AppClRender::RenderSplitFrameTiles(std::size_t cfg_index, ClwScene const& scene)
+    {
+        auto renderer = static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[cfg_index].renderer.get());
+        auto& context = m_cfgs[cfg_index].context;
+        auto first_tile = true;
+
+        renderer->RenderTiles(scene, [&](RadeonRays::int2& tile_origin, RadeonRays::int2& tile_size)
+        {
+            // Scheduler measures device throughput from tile completion
+            if (!first_tile)
+            {
+                context.Finish(0);
+            }
+
+            first_tile = false;
+
+            TileScheduler::Tile tile;
+            if (!m_scheduler->NextTile(cfg_index, tile))
+            {
+                return false;
+            }
+
+            tile_origin = tile.origin;
+            tile_size = tile.size;
+            return true;
+        });
+    }
+
+    void AppClRender::WarmUpProgramCache()
+    {
+        auto start_time = std::chrono::high_resolution_clock::now();
+
+        // All devices compile side by side
+        for (auto& cfg : m_cfgs)
+        {
+            auto& scene = cfg.controller->CompileScene(m_scene);
+            static_cast<MonteCarloRenderer*>(cfg.renderer.get())->CompileProgramsAsync(scene);
+        }
+
+        // A single sample picks the programs up, which stores their binaries
+        for (std::size_t i = 0; i < m_cfgs.size(); ++i)
+        {
+            auto& scene = m_cfgs[i].controller->GetCachedScene(m_scene);
+            m_cfgs[i].renderer->Clear(float3(0, 0, 0), *m_outputs[i].output);
+            m_cfgs[i].renderer->Render(scene);
+            m_cfgs[i].context.Finish(0);
+        }
+
+        auto delta = std::chrono::duration_cast<std::chrono::milliseconds>
+            (std::chrono::high_resolution_clock::now() - start_time).count();
+
+        std::cout << "Program cache warmed up for " << m_cfgs.size() << " devices in " << delta / 1000.f << " s\n";
     }
 
     void AppClRender::RunBenchmark(AppSettings& settings)
@@ -551,15 +1754,8 @@ namespace Baikal
 
         settings.time_benchmark_time = delta / 1000.f;
 
+        UpdatePreview(m_outputs[m_primary].output.get());
         m_outputs[m_primary].output->GetData(&m_outputs[m_primary].fdata[0]);
-        float gamma = 2.2f;
-        for (int i = 0; i < (int)m_outputs[m_primary].fdata.size(); ++i)
-        {
-            m_outputs[m_primary].udata[4 * i] = (unsigned char)clamp(clamp(pow(m_outputs[m_primary].fdata[i].x / m_outputs[m_primary].fdata[i].w, 1.f / gamma), 0.f, 1.f) * 255, 0, 255);
-            m_outputs[m_primary].udata[4 * i + 1] = (unsigned char)clamp(clamp(pow(m_outputs[m_primary].fdata[i].y / m_outputs[m_primary].fdata[i].w, 1.f / gamma), 0.f, 1.f) * 255, 0, 255);
-            m_outputs[m_primary].udata[4 * i + 2] = (unsigned char)clamp(clamp(pow(m_outputs[m_primary].fdata[i].z / m_outputs[m_primary].fdata[i].w, 1.f / gamma), 0.f, 1.f) * 255, 0, 255);
-            m_outputs[m_primary].udata[4 * i + 3] = 1;
-        }
 
         auto& fdata = m_outputs[m_primary].fdata;
         std::vector<RadeonRays::float3> data(fdata.size());
@@ -573,7 +1769,8 @@ namespace Baikal
         std::stringstream oss;
         oss << "../Output/" << settings.modelname << ".exr";
 
-        SaveImage(oss.str(), settings.width, settings.height, &data[0]);
+        // Encoded while the RT benchmark runs
+        m_image_writer.Write(oss.str(), settings.width, settings.height, std::move(data));
 
         std::cout << "Running RT benchmark...\n";
 
@@ -581,6 +1778,89 @@ namespace Baikal
         static_cast<MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->Benchmark(scene, settings.stats);
     }
 
+    void AppClRender::SetProfiling(bool enable)
+    {
+        static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->SetProfiling(enable);
+    }
+
+    bool AppClRender::GetProfiling() const
+    {
+        return static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->GetProfiling();
+    }
+
+    Baikal::ClwProfiler& AppClRender::GetProfiler()
+    {
+        return static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->GetProfiler();
+    }
+
+    Baikal::ClwUploader const& AppClRender::GetUploader() const
+    {
+        return static_cast<ClwSceneController*>(m_cfgs[m_primary].controller.get())->GetUploader();
+    }
+
+    void AppClRender::SaveRenderStatistics(std::string const& file_name)
+    {
+        std::ofstream file(file_name);
+
+        if (!file)
+        {
+            std::cout << "Cannot write render statistics to " << file_name << "\n";
+            return;
+        }
+
+        // Profiled spans of the submitted frames are resolved before writing
+        auto& profiler = GetProfiler();
+        profiler.Resolve(true);
+
+        file << "{\n\"device\": \"" << m_cfgs[m_primary].context.GetDevice(0).GetName() << "\",\n";
+        file << "\"timing_supported\": " << (profiler.IsTimingSupported() ? "true" : "false") << ",\n";
+        file << "\"steps\": ";
+        profiler.WriteJson(file);
+        file << ",\n\"uploads\": {";
+
+        auto const& uploader = GetUploader();
+        for (auto i = 0; i < static_cast<int>(ClwUploader::Category::kCount); ++i)
+        {
+            auto category = static_cast<ClwUploader::Category>(i);
+            auto const& stats = uploader.GetStats(category);
+            file << (i > 0 ? ",\n" : "\n") << "  \"" << ClwUploader::GetCategoryName(category) << "\": { \"bytes\": " << stats.bytes
+                 << ", \"writes\": " << stats.writes << ", \"milliseconds\": " << stats.milliseconds << " }";
+        }
+
+        file << "\n}\n}\n";
+
+        std::cout << "Render statistics saved to " << file_name << "\n";
+    }
+
+    void AppClRender::SaveTrace(std::string const& file_name)
+    {
+        auto& tracer = Baikal::Tracer::Get();
+
+        // Spans of the submitted frames are added to the timeline while it is still recording
+        GetProfiler().Resolve(true);
+        tracer.Stop();
+
+        try
+        {
+            tracer.WriteFile(file_name);
+            std::cout << "Trace of " << tracer.GetNumEvents() << " events saved to " << file_name << "\n";
+        }
+        catch (std::runtime_error& e)
+        {
+            std::cout << e.what() << "\n";
+        }
+    }
+
+    void AppClRender::Finish()
+    {
+        m_cfgs[m_primary].context.Finish(0);
+    }
+
+    std::size_t AppClRender::GetWorkBufferMemorySize() const
+    {
+        return static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get())->GetWorkBufferMemorySize();
+    }
+
     void AppClRender::SetNumBounces(int num_bounces)
     {
         for (std::size_t i = 0; i < m_cfgs.size(); ++i)
@@ -591,6 +1871,9 @@ namespace Baikal
 
     void AppClRender::SetOutputType(Renderer::OutputType type)
     {
+        // Other AOVs are displayed at full resolution only
+        SetNavigating(false);
+
         for (std::size_t i = 0; i < m_cfgs.size(); ++i)
         {
 #ifdef ENABLE_DENOISER
@@ -598,7 +1881,8 @@ namespace Baikal
 #else
             m_cfgs[i].renderer->SetOutput(m_output_type, nullptr);
 #endif
-            if (type == Renderer::OutputType::kOpacity || type == Renderer::OutputType::kVisibility)
+            if (type == Renderer::OutputType::kOpacity || type == Renderer::OutputType::kVisibility ||
+                type == Renderer::OutputType::kCost)
             {
                 m_cfgs[i].renderer->SetOutput(Renderer::OutputType::kColor, m_dummy_output_data.output.get());
             }
@@ -609,12 +1893,24 @@ namespace Baikal
             m_cfgs[i].renderer->SetOutput(type, m_outputs[i].output.get());
         }
         m_output_type = type;
+
+        m_outputs[m_primary].tonemapper->SetParameter("heatmap",
+            type == Renderer::OutputType::kCost ? m_cost_heatmap : RadeonRays::float4(0.f, 1.f, 0.f, 0.f));
+    }
+
+    void AppClRender::SetCostHeatmap(int channel, float max_value)
+    {
+        m_cost_heatmap = RadeonRays::float4(static_cast<float>(channel), max_value, 0.f, 0.f);
+
+        if (m_output_type == Renderer::OutputType::kCost)
+        {
+            m_outputs[m_primary].tonemapper->SetParameter("heatmap", m_cost_heatmap);
+        }
     }
 
 
-    std::future<int> AppClRender::GetShapeId(std::uint32_t x, std::uint32_t y)
+    int AppClRender::GetShapeId(std::uint32_t x, std::uint32_t y)
     {
-        m_promise = std::promise<int>();
         if (x >= m_width || y >= m_height)
             throw std::logic_error(
                 "AppClRender::GetShapeId(...): x or y cords beyond the size of image");
@@ -622,13 +1918,15 @@ namespace Baikal
         if (m_cfgs.empty())
             throw std::runtime_error("AppClRender::GetShapeId(...): config vector is empty");
 
-        // enable aov shape id output from OpenCl
-        m_cfgs[m_primary].renderer->SetOutput(
-            Renderer::OutputType::kShapeId, m_shape_id_data.output.get());
-        m_shape_id_pos = RadeonRays::float2((float)x, (float)y);
-        // request shape id from render
-        m_shape_id_requested = true;
-        return m_promise.get_future();
+        // Camera moves are rendered into smaller outputs, rows go from the bottom
+        auto output = m_navigating ? m_motion.color.get() : m_outputs[m_primary].output.get();
+        auto pixel = RadeonRays::int2(
+            static_cast<int>(x * output->width() / m_width),
+            static_cast<int>((m_height - 1 - y) * output->height() / m_height));
+
+        auto& scene = m_cfgs[m_primary].controller->GetCachedScene(m_scene);
+        auto renderer = static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[m_primary].renderer.get());
+        return renderer->Pick(scene, pixel).shape_id;
     }
 
     Baikal::Shape::Ptr AppClRender::GetShapeById(int shape_id)
@@ -25,18 +25,25 @@
 #include <thread>
 #include <atomic>
 #include <mutex>
-#include <future>
 
 #include "RenderFactory/render_factory.h"
 #include "Renderers/monte_carlo_renderer.h"
 #include "Output/clwoutput.h"
+#include "Output/tile_delta_encoder.h"
+#include "PostEffects/post_effect.h"
 #include "Application/app_utils.h"
 #include "Utils/config_manager.h"
+#include "Application/multi_device_compositor.h"
+#include "Application/frame_ring.h"
+#include "Application/image_writer.h"
+#include "Application/render_node.h"
+#include "Utils/tile_scheduler.h"
 #include "Application/gl_render.h"
 #include "SceneGraph/camera.h"
 
 #ifdef ENABLE_DENOISER
 #include "PostEffects/bilateral_denoiser.h"
+#include "PostEffects/denoise_schedule.h"
 #endif
 
 
@@ -55,24 +62,28 @@ namespace Baikal
             std::unique_ptr<Baikal::Output> output_mesh_id;
             std::unique_ptr<Baikal::Output> output_denoised;
             std::unique_ptr<Baikal::PostEffect> denoiser;
+            // Skips denoising of converging frames, output_denoised is kept in between
+            Baikal::DenoiseSchedule denoise_schedule;
 #endif
 
+            // Tonemapped RGBA8 preview
+            std::unique_ptr<Baikal::Output> output_ldr;
+            std::unique_ptr<Baikal::PostEffect> tonemapper;
+
             std::vector<float3> fdata;
             std::vector<unsigned char> udata;
-            CLWBuffer<float3> copybuffer;
         };
 
         struct ControlData
         {
             std::atomic<int> clear;
             std::atomic<int> stop;
-            std::atomic<int> newdata;
-            std::mutex datamutex;
             int idx;
         };
 
     public:
         AppClRender(AppSettings& settings, GLuint tex);
+        ~AppClRender();
         //copy data from to GL
         void Update(AppSettings& settings);
 
@@ -80,23 +91,91 @@ namespace Baikal
         void UpdateScene();
         //render
         void Render(int sample_cnt);
+        // Switch the primary device to reduced resolution while the camera moves and back to full resolution
+        // once it stops. Returns true if the resolution has changed, accumulation restarts then
+        bool SetNavigating(bool navigating);
+        // Render only the pixels within the window rectangle spanned by the corners, the rest of the frame keeps
+        // its samples. Skips the denoiser and reads back only the rows of the region for the preview.
+        // Secondary devices keep rendering whole frames unless they share split frames, workers always do
+        void SetRenderRegion(std::uint32_t x0, std::uint32_t y0, std::uint32_t x1, std::uint32_t y1);
+        void ClearRenderRegion();
+        // Region in output pixels, rows go from the bottom
+        bool GetRenderRegion(RadeonRays::int2& origin, RadeonRays::int2& size) const;
         void StartRenderThreads();
         void StopRenderThreads();
         void RunBenchmark(AppSettings& settings);
+        // Serve jobs of a render coordinator on the primary device until it disconnects
+        void RunWorker(AppSettings& settings);
+        // Render settings.num_samples for each camera of the set on the primary device. Scene is compiled once,
+        // cameras go through the camera only update and frames are read back and saved while the next one renders
+        void RenderCameraSet(AppSettings& settings);
+        // Write a multi-part EXR for each camera and light set of the dataset files: noisy colour at 1, 2, 4 ...
+        // up to settings.dataset_input_samples, AOVs and the settings.num_samples reference. Noisy inputs are
+        // snapshots of the reference accumulation, so every view renders only once into the compiled scene
+        void GenerateDataset(AppSettings& settings);
+        // Write a thumbnail of every material of the scene into settings.thumbnail_folder, all of them are
+        // rendered in one atlas on the primary device, settings.num_samples each, see MaterialPreviewRenderer
+        void RenderMaterialThumbnails(AppSettings& settings);
+        // Render settings.num_samples on the primary device and save the frame, with the render state written to
+        // settings.checkpoint_file in the background every settings.checkpoint_interval seconds. An existing
+        // checkpoint is resumed, so a killed job started again with the same settings loses only the samples since
+        // the last one. The checkpoint is removed once the frame is saved
+        void RenderResumable(AppSettings& settings);
+        // Build all programs the scene needs on every device into the program cache folder, which can then be
+        // handed to other machines with the same devices and drivers, e.g. as their shared cache
+        void WarmUpProgramCache();
+
+        // Tonemap output into the RGBA8 preview and read it into udata
+        void UpdatePreview(Output* output);
+        // Tonemap output and start copying it into the pixel buffer of the next preview frame,
+        // uploads the latest frame which has landed into the preview texture.
+        // Returns false if there is no new one
+        bool UpdatePreviewAsync(Output* output);
+        // Tonemap the primary output and read it back as RGBA8 rows, bottom-up
+        std::vector<unsigned char> const& ReadPreview();
+        // Tonemap the primary output and read back the tiles changed since the previous call,
+        // reset returns all of them
+        TileDelta ReadPreviewTiles(bool reset);
+        inline std::uint32_t GetWidth() const { return m_width; };
+        inline std::uint32_t GetHeight() const { return m_height; };
 
-        //save cl frame buffer to file
+        //save cl frame buffer to file, encoding runs in the background
         void SaveFrameBuffer(AppSettings& settings);
         void SaveImage(const std::string& name, int width, int height, const RadeonRays::float3* data);
+        // Block until all the saved frames are on disk
+        void WaitForSavedImages();
 
         inline Baikal::Camera::Ptr GetCamera() { return m_camera; };
         inline Baikal::Scene1::Ptr GetScene() { return m_scene; };
         inline CLWDevice GetDevice(int i) { return m_cfgs[m_primary].context.GetDevice(i); };
         inline Renderer::OutputType GetOutputType() { return m_output_type; };
+        // Stats of the last primary device scene compile
+        inline Baikal::SceneCompileStats const& GetCompileStats() const { return m_compile_stats; };
+        // Wall time of loading the scene file and its materials
+        inline double GetLoadMilliseconds() const { return m_load_milliseconds; };
+        // Device memory of the primary renderer work buffers
+        std::size_t GetWorkBufferMemorySize() const;
+        // Wait until the primary device is done with the submitted work
+        void Finish();
+
+        // Measure device time of the primary device render steps
+        void SetProfiling(bool enable);
+        bool GetProfiling() const;
+        Baikal::ClwProfiler& GetProfiler();
+        Baikal::ClwUploader const& GetUploader() const;
+        // Write profiled steps and upload bytes of the primary device as JSON
+        void SaveRenderStatistics(std::string const& file_name);
+        // Stop tracing and write the timeline started by -trace
+        void SaveTrace(std::string const& file_name);
 
         void SetNumBounces(int num_bounces);
         void SetOutputType(Renderer::OutputType type);
+        // Channel of the cost output shown as a heatmap, 1 - rays, 2 - bounces, 3 - shadow rays,
+        // and the number of them per sample at the top of the ramp
+        void SetCostHeatmap(int channel, float max_value);
 
-        std::future<int> GetShapeId(std::uint32_t x, std::uint32_t y);
+        // Id of the shape seen through a window pixel, traces a single ray of the compiled scene
+        int GetShapeId(std::uint32_t x, std::uint32_t y);
         Baikal::Shape::Ptr GetShapeById(int shape_id);
 
 #ifdef ENABLE_DENOISER
@@ -111,20 +190,72 @@ namespace Baikal
     private:
         void InitCl(AppSettings& settings, GLuint tex);
         void LoadScene(AppSettings& settings);
+        // Degrade textures, work buffers and caches of every device until the scene fits into its memory budget
+        void FitMemoryBudget(AppSettings& settings);
         void RenderThread(ControlData& cd);
+        // Render tiles of the current split frame handed to the device
+        void RenderSplitFrameTiles(std::size_t cfg_index, ClwScene const& scene);
+        // Send the current camera to workers, their samples of the previous one are dropped
+        void StartRemoteJob();
+        // Accumulate samples received from workers into the primary output
+        void MergeRemoteSamples();
+        // Clear outputs the primary device currently accumulates into
+        void ClearRenderOutputs();
+        // Output shown in the window, accumulated one while rendering a region as the denoiser is skipped then
+        Output* GetDisplayOutput() const;
 
         Baikal::Scene1::Ptr m_scene;
         Baikal::Camera::Ptr m_camera;
 
-        std::promise<int> m_promise;
-        bool m_shape_id_requested = false;
-        OutputData m_shape_id_data;
         OutputData m_dummy_output_data;
-        RadeonRays::float2 m_shape_id_pos;
         std::vector<ConfigManager::Config> m_cfgs;
         std::vector<OutputData> m_outputs;
         std::unique_ptr<ControlData[]> m_ctrl;
         std::vector<std::thread> m_renderthreads;
+        // Gathers secondary device outputs into the primary one
+        std::unique_ptr<MultiDeviceCompositor> m_compositor;
+        struct PreviewFrame
+        {
+            std::unique_ptr<ClwReadback> readback;
+            // Pixel buffer the frame is copied into, created on the first preview update
+            GLuint pbo = 0;
+            // Pixel buffer stays mapped until the frame is uploaded
+            void* mapped = nullptr;
+            // Rows of the frame read back, the texture keeps the others
+            std::uint32_t first_row = 0;
+            std::uint32_t num_rows = 0;
+        };
+
+        // Preview frames copied to the host without blocking the display
+        FrameRing<PreviewFrame> m_preview_frames;
+        // Back preview frame copy is in flight
+        bool m_preview_pending = false;
+        // Created on the first tile readback
+        std::unique_ptr<TileDeltaEncoder> m_tile_encoder;
+        // Hands out tiles of each frame to all devices in split frame mode
+        std::unique_ptr<TileScheduler> m_scheduler;
+        RadeonRays::int2 m_split_tile_size;
+        // Workers of a distributed render
+        std::unique_ptr<RenderCoordinator> m_coordinator;
+        std::uint32_t m_job_id = 0u;
+        std::uint64_t m_scene_hash = 0u;
+        std::vector<RadeonRays::float3> m_remote_samples;
+        CLWBuffer<RadeonRays::float3> m_remote_buffer;
+        struct MotionOutputs
+        {
+            std::unique_ptr<Baikal::Output> color;
+            std::unique_ptr<Baikal::Output> depth;
+            std::unique_ptr<Baikal::Output> normal;
+            // Edge-aware upsampling guided by depth and normal
+            std::unique_ptr<Baikal::PostEffect> upsampler;
+        };
+
+        // Reduced resolution outputs of camera moves, empty if motion scale is one
+        MotionOutputs m_motion;
+        bool m_navigating = false;
+        // Render region in output pixels, empty if whole frames are rendered
+        RadeonRays::int2 m_region_origin;
+        RadeonRays::int2 m_region_size;
         int m_primary = -1;
         std::uint32_t m_width, m_height;
 
@@ -133,5 +264,10 @@ namespace Baikal
         //save GL tex for no interop case
         GLuint m_tex;
         Renderer::OutputType m_output_type;
+        RadeonRays::float4 m_cost_heatmap = RadeonRays::float4(1.f, 16.f, 0.f, 0.f);
+        Baikal::SceneCompileStats m_compile_stats;
+        double m_load_milliseconds = 0.0;
+        // Encodes saved frames while the next ones render
+        AsyncImageWriter m_image_writer;
     };
 }
@@ -0,0 +1,83 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include <atomic>
+
+namespace Baikal
+{
+    /**
+    \brief Lock-free triple buffer handing frames from a single producer to a single consumer.
+
+    \details Producer fills the back frame and publishes it, consumer acquires the latest
+    published frame. Neither side ever waits for the other: a frame published before the
+    consumer got to the previous one replaces it.
+    */
+    template <typename T>
+    class FrameRing
+    {
+    public:
+        FrameRing()
+            : m_back(0)
+            , m_ready(1)
+            , m_front(2)
+        {
+        }
+
+        // Producer side
+        T& GetBackFrame() { return m_frames[m_back]; }
+        // Make the back frame the latest one and take over the frame it replaces
+        void Publish()
+        {
+            m_back = m_ready.exchange(m_back | kNewFrameBit) & kIndexMask;
+        }
+
+        // Consumer side, take the latest frame if there is a new one
+        bool Acquire()
+        {
+            if ((m_ready.load() & kNewFrameBit) == 0)
+            {
+                return false;
+            }
+
+            m_front = m_ready.exchange(m_front) & kIndexMask;
+            return true;
+        }
+        T& GetFrontFrame() { return m_frames[m_front]; }
+
+        // All frames, e.g. for initialization before the ring is shared
+        T* GetFrames() { return m_frames; }
+        static constexpr unsigned GetNumFrames() { return 3; }
+
+        FrameRing(FrameRing const&) = delete;
+        FrameRing& operator = (FrameRing const&) = delete;
+
+    private:
+        static constexpr unsigned kNewFrameBit = 4;
+        static constexpr unsigned kIndexMask = 3;
+
+        T m_frames[3];
+        unsigned m_back;
+        std::atomic<unsigned> m_ready;
+        unsigned m_front;
+    };
+}
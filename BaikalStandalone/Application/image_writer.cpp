@@ -0,0 +1,215 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#include "Application/image_writer.h"
+#include "Utils/task_scheduler.h"
+
+#include "OpenImageIO/imageio.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+namespace Baikal
+{
+    AsyncImageWriter::AsyncImageWriter(std::size_t num_threads, std::size_t max_pending)
+        : m_max_tasks(std::max<std::size_t>(num_threads, 1u))
+        , m_max_pending(std::max<std::size_t>(max_pending, 1u))
+    {
+    }
+
+    AsyncImageWriter::~AsyncImageWriter()
+    {
+        // Tasks refer to the writer until they are done
+        Wait();
+    }
+
+    void AsyncImageWriter::Write(std::string const& file_name, int width, int height, std::vector<RadeonRays::float3>&& data)
+    {
+        Push(Job{ file_name, width, height, std::move(data), {} });
+    }
+
+    void AsyncImageWriter::WriteLayers(std::string const& file_name, int width, int height, std::vector<Layer>&& layers)
+    {
+        Push(Job{ file_name, width, height, {}, std::move(layers) });
+    }
+
+    void AsyncImageWriter::Push(Job&& job)
+    {
+        bool submit = false;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_job_done.wait(lock, [this]() { return m_jobs.size() < m_max_pending; });
+            m_jobs.push_back(std::move(job));
+
+            if (m_num_tasks < m_max_tasks)
+            {
+                ++m_num_tasks;
+                submit = true;
+            }
+        }
+
+        // Runs the frame right away if the scheduler has no workers, so not under the lock
+        if (submit)
+        {
+            TaskScheduler::Get().Submit([this]() { DrainTask(); });
+        }
+    }
+
+    void AsyncImageWriter::Wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_job_done.wait(lock, [this]() { return m_jobs.empty() && m_num_tasks == 0; });
+    }
+
+    void AsyncImageWriter::DrainTask()
+    {
+        for (;;)
+        {
+            Job job;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                if (m_jobs.empty())
+                {
+                    // Notified under the lock, the writer may be destroyed as soon as it is released
+                    --m_num_tasks;
+                    m_job_done.notify_all();
+                    return;
+                }
+
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+
+            // Queue has room again
+            m_job_done.notify_all();
+
+            // Nobody to throw to on this thread, a failed frame is reported and skipped
+            try
+            {
+                if (job.layers.empty())
+                {
+                    Encode(job);
+                }
+                else
+                {
+                    EncodeLayers(job);
+                }
+            }
+            catch (std::exception& e)
+            {
+                std::cerr << "Failed to save " << job.file_name << ": " << e.what() << "\n";
+            }
+        }
+    }
+
+    void AsyncImageWriter::Encode(Job const& job)
+    {
+        OIIO_NAMESPACE_USING;
+
+        auto width = job.width;
+        auto height = job.height;
+        auto const& data = job.data;
+
+        std::vector<RadeonRays::float3> tempbuf(width * height);
+
+        for (auto y = 0; y < height; ++y)
+            for (auto x = 0; x < width; ++x)
+            {
+                RadeonRays::float3 val = data[(height - 1 - y) * width + x];
+                auto& out = tempbuf[y * width + x];
+                out = (1.f / val.w) * val;
+
+                out.x = std::pow(out.x, 1.f / 2.2f);
+                out.y = std::pow(out.y, 1.f / 2.2f);
+                out.z = std::pow(out.z, 1.f / 2.2f);
+            }
+
+        std::unique_ptr<ImageOutput> out(ImageOutput::create(job.file_name));
+
+        if (!out)
+        {
+            throw std::runtime_error("Can't create image file on disk");
+        }
+
+        ImageSpec spec(width, height, 3, TypeDesc::FLOAT);
+
+        out->open(job.file_name, spec);
+        out->write_image(TypeDesc::FLOAT, &tempbuf[0], sizeof(RadeonRays::float3));
+        out->close();
+    }
+
+    void AsyncImageWriter::EncodeLayers(Job const& job)
+    {
+        OIIO_NAMESPACE_USING;
+
+        auto width = job.width;
+        auto height = job.height;
+
+        std::unique_ptr<ImageOutput> out(ImageOutput::create(job.file_name));
+
+        if (!out || !out->supports("multiimage"))
+        {
+            throw std::runtime_error("Can't create multi-part image file on disk");
+        }
+
+        std::vector<ImageSpec> specs;
+        for (auto const& layer : job.layers)
+        {
+            ImageSpec spec(width, height, 3, TypeDesc::FLOAT);
+            spec.attribute("oiio:subimagename", layer.name);
+            specs.push_back(spec);
+        }
+
+        if (!out->open(job.file_name, static_cast<int>(specs.size()), specs.data()))
+        {
+            throw std::runtime_error(out->geterror());
+        }
+
+        std::vector<RadeonRays::float3> tempbuf(width * height);
+
+        for (std::size_t i = 0; i < job.layers.size(); ++i)
+        {
+            auto const& data = job.layers[i].data;
+
+            for (auto y = 0; y < height; ++y)
+                for (auto x = 0; x < width; ++x)
+                {
+                    RadeonRays::float3 val = data[(height - 1 - y) * width + x];
+                    tempbuf[y * width + x] = val.w > 0.f ? (1.f / val.w) * val : RadeonRays::float3();
+                }
+
+            if (i > 0 && !out->open(job.file_name, specs[i], ImageOutput::AppendSubimage))
+            {
+                throw std::runtime_error(out->geterror());
+            }
+
+            out->write_image(TypeDesc::FLOAT, &tempbuf[0], sizeof(RadeonRays::float3));
+        }
+
+        out->close();
+    }
+}
@@ -0,0 +1,92 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "math/float3.h"
+
+namespace Baikal
+{
+    /**
+    \brief Encodes and writes frames to disk on workers of the shared task scheduler.
+
+    \details Render loop hands over a copy of the frame and goes on with the next one
+    while OIIO encodes the previous ones. Write blocks once the queue is full, so a slow
+    disk can't pile up frames in memory. Pending frames are written on destruction.
+    */
+    class AsyncImageWriter
+    {
+    public:
+        // Named part of a multi-part image
+        struct Layer
+        {
+            std::string name;
+            std::vector<RadeonRays::float3> data;
+        };
+
+        // At most num_threads frames are encoded at the same time
+        AsyncImageWriter(std::size_t num_threads = 2, std::size_t max_pending = 4);
+        ~AsyncImageWriter();
+
+        // Queue the frame, data is bottom-up with radiance divided by w, gamma is applied on write
+        void Write(std::string const& file_name, int width, int height, std::vector<RadeonRays::float3>&& data);
+        // Queue layers of the same size as parts of one EXR file, kept linear, data of every layer is bottom-up and divided by w
+        void WriteLayers(std::string const& file_name, int width, int height, std::vector<Layer>&& layers);
+        // Block until all the queued frames are on disk
+        void Wait();
+
+        AsyncImageWriter(AsyncImageWriter const&) = delete;
+        AsyncImageWriter& operator = (AsyncImageWriter const&) = delete;
+
+    private:
+        struct Job
+        {
+            std::string file_name;
+            int width;
+            int height;
+            std::vector<RadeonRays::float3> data;
+            // Multi-part image if not empty, data is unused then
+            std::vector<Layer> layers;
+        };
+
+        void Push(Job&& job);
+        // Write queued frames until the queue is empty
+        void DrainTask();
+        static void Encode(Job const& job);
+        static void EncodeLayers(Job const& job);
+
+        std::size_t m_max_tasks;
+        std::size_t m_max_pending;
+        std::deque<Job> m_jobs;
+        // Drain tasks submitted to the scheduler and not finished yet
+        std::size_t m_num_tasks = 0;
+
+        std::mutex m_mutex;
+        std::condition_variable m_job_done;
+    };
+}
@@ -0,0 +1,242 @@
+/**********************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#include "Application/material_preview.h"
+#include "math/mathutils.h"
+#include "Output/output.h"
+#include "Renderers/renderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace Baikal
+{
+    namespace
+    {
+        // Tiles are two world units wide, the rest of the tile shows the environment
+        float constexpr kBallRadius = 0.8f;
+        std::uint32_t constexpr kSphereLatitudes = 48u;
+        std::uint32_t constexpr kSphereLongitudes = 64u;
+
+        // UV sphere around the origin, instances move it into the tiles
+        Mesh::Ptr CreateSphere(std::uint32_t lat, std::uint32_t lon, float r)
+        {
+            std::vector<RadeonRays::float3> vertices;
+            std::vector<RadeonRays::float3> normals;
+            std::vector<RadeonRays::float2> uvs;
+            std::vector<std::uint32_t> indices;
+
+            // Poles are split along the seam, so every vertex keeps its own UV
+            for (auto j = 0u; j <= lat; ++j)
+            {
+                auto theta = float(j) / lat * PI;
+
+                for (auto i = 0u; i <= lon; ++i)
+                {
+                    auto phi = float(i) / lon * PI * 2.f;
+                    RadeonRays::float3 n(sinf(theta) * cosf(phi), cosf(theta), -sinf(theta) * sinf(phi));
+
+                    vertices.push_back(n * r);
+                    normals.push_back(n);
+                    uvs.push_back(RadeonRays::float2(float(i) / lon, 1.f - float(j) / lat));
+                }
+            }
+
+            for (auto j = 0u; j < lat; ++j)
+            {
+                for (auto i = 0u; i < lon; ++i)
+                {
+                    auto v0 = j * (lon + 1) + i;
+                    auto v1 = v0 + lon + 1;
+
+                    if (j != 0)
+                    {
+                        indices.push_back(v0);
+                        indices.push_back(v1);
+                        indices.push_back(v0 + 1);
+                    }
+
+                    if (j != lat - 1)
+                    {
+                        indices.push_back(v0 + 1);
+                        indices.push_back(v1);
+                        indices.push_back(v1 + 1);
+                    }
+                }
+            }
+
+            auto mesh = Mesh::Create();
+            mesh->SetVertices(std::move(vertices));
+            mesh->SetNormals(std::move(normals));
+            mesh->SetUVs(std::move(uvs));
+            mesh->SetIndices(std::move(indices));
+            mesh->SetName("material_preview_sphere");
+
+            return mesh;
+        }
+
+        Texture::Ptr CreateUniformEnvironment()
+        {
+            auto data = new char[4 * sizeof(float)];
+            auto texel = reinterpret_cast<float*>(data);
+            texel[0] = texel[1] = texel[2] = texel[3] = 1.f;
+
+            auto texture = Texture::Create(data, RadeonRays::int3(1, 1, 1), Texture::Format::kRgba32);
+            texture->SetName("material_preview_environment");
+            return texture;
+        }
+    }
+
+    MaterialPreviewRenderer::MaterialPreviewRenderer(RenderFactory<ClwScene> const& factory, std::uint32_t tile_size)
+        : m_factory(factory)
+        , m_renderer(factory.CreateRenderer(RenderFactory<ClwScene>::RendererType::kUnidirectionalPathTracer))
+        , m_controller(factory.CreateSceneController())
+        , m_sphere(CreateSphere(kSphereLatitudes, kSphereLongitudes, kBallRadius))
+        , m_light(ImageBasedLight::Create())
+        , m_camera(OrthographicCamera::Create(RadeonRays::float3(0.f, 0.f, 10.f), RadeonRays::float3(0.f, 0.f, 0.f), RadeonRays::float3(0.f, 1.f, 0.f)))
+        , m_tile_size(tile_size)
+    {
+        if (tile_size == 0)
+        {
+            throw std::runtime_error("MaterialPreviewRenderer: tile size is zero");
+        }
+
+        m_light->SetTexture(CreateUniformEnvironment());
+        m_light->SetMultiplier(1.f);
+        m_camera->SetDepthRange(RadeonRays::float2(0.01f, 100.f));
+    }
+
+    MaterialPreviewRenderer::~MaterialPreviewRenderer() = default;
+
+    void MaterialPreviewRenderer::SetEnvironment(Texture::Ptr texture, float multiplier)
+    {
+        m_light->SetTexture(texture ? texture : CreateUniformEnvironment());
+        m_light->SetMultiplier(multiplier);
+    }
+
+    void MaterialPreviewRenderer::CreateAtlas(std::size_t num_materials)
+    {
+        // Close to square, so the atlas stays within the image size limits the longest
+        auto num_columns = static_cast<std::uint32_t>(std::ceil(std::sqrt(static_cast<float>(num_materials))));
+        auto num_rows = static_cast<std::uint32_t>((num_materials + num_columns - 1) / num_columns);
+
+        if (!m_atlas || num_columns != m_num_columns || num_rows != m_num_rows)
+        {
+            m_num_columns = num_columns;
+            m_num_rows = num_rows;
+            m_atlas = m_factory.CreateOutput(GetAtlasWidth(), GetAtlasHeight());
+            m_renderer->SetOutput(Renderer::OutputType::kColor, m_atlas.get());
+        }
+
+        // Camera spans two world units per tile, so pixels stay square
+        m_camera->SetSensorSize(RadeonRays::float2(2.f * m_num_columns, 2.f * m_num_rows));
+    }
+
+    void MaterialPreviewRenderer::BuildScene(std::vector<Material::Ptr> const& materials)
+    {
+        // Previous library is dropped, instances of the new one are all compiled into the same program
+        if (m_scene)
+        {
+            m_controller->EvictScene(m_scene);
+        }
+
+        m_scene = Scene1::Create();
+        m_scene->SetCamera(m_camera);
+        m_scene->AttachLight(m_light);
+
+        for (std::size_t i = 0; i < materials.size(); ++i)
+        {
+            auto column = static_cast<float>(i % m_num_columns);
+            auto row = static_cast<float>(i / m_num_columns);
+
+            auto instance = Instance::Create(m_sphere);
+            instance->SetTransform(RadeonRays::translation(RadeonRays::float3(
+                2.f * column + 1.f - m_num_columns, 2.f * row + 1.f - m_num_rows, 0.f)));
+            instance->SetMaterial(materials[i]);
+            m_scene->AttachShape(instance);
+        }
+
+        m_num_materials = materials.size();
+    }
+
+    void MaterialPreviewRenderer::Render(std::vector<Material::Ptr> const& materials, std::uint32_t num_samples)
+    {
+        if (materials.empty())
+        {
+            throw std::runtime_error("MaterialPreviewRenderer: no materials to render");
+        }
+
+        CreateAtlas(materials.size());
+        BuildScene(materials);
+
+        auto& scene = m_controller->CompileScene(m_scene);
+        m_renderer->Clear(RadeonRays::float3(0.f, 0.f, 0.f), *m_atlas);
+
+        for (auto i = 0u; i < num_samples; ++i)
+        {
+            m_renderer->Render(scene);
+        }
+    }
+
+    std::vector<RadeonRays::float3> MaterialPreviewRenderer::GetAtlasData() const
+    {
+        if (!m_atlas)
+        {
+            return {};
+        }
+
+        std::vector<RadeonRays::float3> data(static_cast<std::size_t>(GetAtlasWidth()) * GetAtlasHeight());
+        m_atlas->GetData(&data[0]);
+
+        for (auto& texel : data)
+        {
+            texel = texel.w > 0.f ? texel * (1.f / texel.w) : RadeonRays::float3(0.f, 0.f, 0.f);
+        }
+
+        return data;
+    }
+
+    std::vector<std::vector<RadeonRays::float3>> MaterialPreviewRenderer::GetThumbnails() const
+    {
+        auto atlas = GetAtlasData();
+        auto width = GetAtlasWidth();
+
+        std::vector<std::vector<RadeonRays::float3>> thumbnails(m_num_materials);
+
+        for (std::size_t i = 0; i < m_num_materials; ++i)
+        {
+            auto x0 = static_cast<std::size_t>(i % m_num_columns) * m_tile_size;
+            auto y0 = static_cast<std::size_t>(i / m_num_columns) * m_tile_size;
+
+            auto& thumbnail = thumbnails[i];
+            thumbnail.reserve(static_cast<std::size_t>(m_tile_size) * m_tile_size);
+
+            for (auto y = 0u; y < m_tile_size; ++y)
+            {
+                auto row = atlas.cbegin() + (y0 + y) * width + x0;
+                thumbnail.insert(thumbnail.end(), row, row + m_tile_size);
+            }
+        }
+
+        return thumbnails;
+    }
+}
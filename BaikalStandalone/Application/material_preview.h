@@ -0,0 +1,94 @@
+/**********************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "math/float3.h"
+#include "RenderFactory/render_factory.h"
+#include "SceneGraph/camera.h"
+#include "SceneGraph/clwscene.h"
+#include "SceneGraph/light.h"
+#include "SceneGraph/material.h"
+#include "SceneGraph/scene1.h"
+#include "SceneGraph/shape.h"
+#include "SceneGraph/texture.h"
+
+namespace Baikal
+{
+    /**
+    \brief Renders thumbnails of a whole material library at once.
+
+    \details Every material gets a ball in its own tile of one output atlas, the balls are
+    instances of one sphere under an orthographic camera spanning the grid. The library
+    goes into a single scene compile, so all of its materials share one uberv2 program,
+    and a sample of every thumbnail takes one dispatch of the renderer.
+    Tiles go in material order along the rows, rows go from the bottom like outputs.
+    */
+    class MaterialPreviewRenderer
+    {
+    public:
+        MaterialPreviewRenderer(RenderFactory<ClwScene> const& factory, std::uint32_t tile_size);
+        ~MaterialPreviewRenderer();
+
+        // Environment lighting the balls, a uniform white one is used until it is set
+        void SetEnvironment(Texture::Ptr texture, float multiplier = 1.f);
+
+        // Render num_samples of every material into the atlas, throws std::runtime_error if there are none
+        void Render(std::vector<Material::Ptr> const& materials, std::uint32_t num_samples);
+
+        std::uint32_t GetTileSize() const { return m_tile_size; }
+        std::uint32_t GetNumColumns() const { return m_num_columns; }
+        std::uint32_t GetNumRows() const { return m_num_rows; }
+        std::uint32_t GetAtlasWidth() const { return m_num_columns * m_tile_size; }
+        std::uint32_t GetAtlasHeight() const { return m_num_rows * m_tile_size; }
+
+        // Atlas pixels with radiance divided by the sample count, bottom-up
+        std::vector<RadeonRays::float3> GetAtlasData() const;
+        // Atlas split into the tiles of the rendered materials, each bottom-up and tile_size wide
+        std::vector<std::vector<RadeonRays::float3>> GetThumbnails() const;
+
+        MaterialPreviewRenderer(MaterialPreviewRenderer const&) = delete;
+        MaterialPreviewRenderer& operator = (MaterialPreviewRenderer const&) = delete;
+
+    private:
+        void CreateAtlas(std::size_t num_materials);
+        void BuildScene(std::vector<Material::Ptr> const& materials);
+
+        RenderFactory<ClwScene> const& m_factory;
+        std::unique_ptr<Renderer> m_renderer;
+        std::unique_ptr<SceneController<ClwScene>> m_controller;
+        std::unique_ptr<Output> m_atlas;
+
+        Scene1::Ptr m_scene;
+        Mesh::Ptr m_sphere;
+        ImageBasedLight::Ptr m_light;
+        OrthographicCamera::Ptr m_camera;
+
+        std::uint32_t m_tile_size;
+        std::uint32_t m_num_columns = 0;
+        std::uint32_t m_num_rows = 0;
+        std::size_t m_num_materials = 0;
+    };
+}
@@ -0,0 +1,165 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#include "Application/multi_device_compositor.h"
+
+#include "Renderers/monte_carlo_renderer.h"
+
+#include <stdexcept>
+
+namespace Baikal
+{
+    namespace
+    {
+        bool IsComplete(CLWEvent const& event)
+        {
+            cl_event cl_event_handle = event;
+
+            if (!cl_event_handle)
+            {
+                return true;
+            }
+
+            cl_int execution_status = CL_QUEUED;
+            clGetEventInfo(cl_event_handle, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(execution_status), &execution_status, nullptr);
+            return execution_status == CL_COMPLETE;
+        }
+    }
+
+    MultiDeviceCompositor::MultiDeviceCompositor(std::vector<ConfigManager::Config>& configs,
+                                                 int primary,
+                                                 std::size_t num_pixels,
+                                                 std::size_t group_size)
+        : m_configs(configs)
+        , m_nodes(new Node[configs.size()])
+        , m_primary(static_cast<std::size_t>(primary))
+        , m_num_pixels(num_pixels)
+    {
+        if (group_size < 2)
+        {
+            throw std::runtime_error("MultiDeviceCompositor: group size should be at least 2");
+        }
+
+        std::vector<std::size_t> secondaries;
+        for (std::size_t i = 0; i < configs.size(); ++i)
+        {
+            m_nodes[i].state.store(kIdle);
+
+            if (i != m_primary)
+            {
+                secondaries.push_back(i);
+            }
+        }
+
+        // Two or three devices send straight to the primary
+        auto grouped = configs.size() >= 4;
+
+        for (std::size_t i = 0; i < secondaries.size(); ++i)
+        {
+            auto idx = secondaries[i];
+            auto parent = grouped && (i % group_size) != 0 ? secondaries[i - i % group_size] : m_primary;
+
+            m_nodes[parent].children.push_back(idx);
+            m_nodes[idx].readback.reset(new ClwReadback(configs[idx].context));
+            m_nodes[idx].upload = configs[parent].context.CreateBuffer<RadeonRays::float3>(num_pixels, CL_MEM_READ_ONLY);
+        }
+    }
+
+    template <typename T>
+    CLWEvent MultiDeviceCompositor::Accumulate(std::size_t idx, CLWBuffer<RadeonRays::float3> src, CLWBuffer<T> dst)
+    {
+        auto renderer = static_cast<MonteCarloRenderer*>(m_configs[idx].renderer.get());
+        auto acckernel = renderer->GetAccumulateKernel();
+
+        int argc = 0;
+        acckernel.SetArg(argc++, src);
+        acckernel.SetArg(argc++, static_cast<int>(m_num_pixels));
+        acckernel.SetArg(argc++, dst);
+
+        auto globalsize = static_cast<int>(m_num_pixels);
+        return m_configs[idx].context.Launch1D(0, ((globalsize + 63) / 64) * 64, 64, acckernel);
+    }
+
+    template <typename T>
+    void MultiDeviceCompositor::Gather(std::size_t idx, CLWBuffer<T> dst, CLWEvent& last_event)
+    {
+        auto& context = m_configs[idx].context;
+
+        for (auto child_idx : m_nodes[idx].children)
+        {
+            auto& child = m_nodes[child_idx];
+
+            if (child.state.load() != kStaged || !child.readback->IsReady())
+            {
+                continue;
+            }
+
+            // Pinned memory is read by the upload directly, child keeps it until the upload completes
+            auto data = static_cast<RadeonRays::float3*>(const_cast<void*>(child.readback->GetData()));
+            child.upload_event = context.WriteBuffer(0, child.upload, data, m_num_pixels);
+            child.state.store(kUploading);
+
+            last_event = Accumulate(idx, child.upload, dst);
+        }
+    }
+
+    bool MultiDeviceCompositor::Submit(std::size_t idx, CLWBuffer<RadeonRays::float3> output, bool consume)
+    {
+        auto& node = m_nodes[idx];
+
+        if (node.state.load() == kUploading && IsComplete(node.upload_event))
+        {
+            node.state.store(kIdle);
+        }
+
+        if (node.state.load() != kIdle)
+        {
+            return false;
+        }
+
+        auto& context = m_configs[idx].context;
+        auto size = m_num_pixels * sizeof(RadeonRays::float3);
+
+        // Snapshot so the output keeps accumulating while it is copied
+        auto staging = node.readback->GetStagingBuffer(size);
+        context.FillBuffer(0, staging, char(0), size);
+
+        auto event = Accumulate(idx, output, staging);
+
+        if (consume)
+        {
+            context.FillBuffer(0, output, RadeonRays::float3(0.f, 0.f, 0.f, 0.f), m_num_pixels);
+        }
+
+        Gather(idx, staging, event);
+
+        node.readback->Enqueue(size, event);
+        node.state.store(kStaged);
+        return true;
+    }
+
+    void MultiDeviceCompositor::Composite(CLWBuffer<RadeonRays::float3> output)
+    {
+        CLWEvent event;
+        Gather(m_primary, output, event);
+        m_configs[m_primary].context.Flush(0);
+    }
+}
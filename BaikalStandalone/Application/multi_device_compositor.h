@@ -0,0 +1,102 @@
+
+/**********************************************************************
+ Copyright (c) 2017 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "CLW.h"
+#include "math/float3.h"
+#include "Utils/clw_readback.h"
+#include "Utils/config_manager.h"
+
+namespace Baikal
+{
+    /**
+    \brief Accumulates secondary device outputs into the primary one.
+
+    \details Each secondary device resolves a snapshot of its output into a staging buffer
+    and copies it into pinned host memory on a separate queue, so neither its render thread
+    nor the primary thread waits for the transfer. The parent device then uploads the pinned
+    snapshot without an extra host copy and accumulates it on the GPU.
+
+    With 4 or more devices secondaries are grouped under leaders: a leader adds the snapshots
+    of its group to its own before sending the sum on to the primary, so the primary device
+    receives one transfer per group instead of one per device.
+
+    Devices live in separate contexts, so buffers can not be shared between them directly.
+    */
+    class MultiDeviceCompositor
+    {
+    public:
+        MultiDeviceCompositor(std::vector<ConfigManager::Config>& configs,
+                              int primary,
+                              std::size_t num_pixels,
+                              std::size_t group_size = 4);
+
+        // Called from the render thread of a secondary device: accumulate finished snapshots of the group
+        // and start copying the result to the parent device. Returns false if the previous snapshot is still in flight.
+        // Consumed output is zeroed once snapshotted, so every sample reaches the primary exactly once
+        bool Submit(std::size_t idx, CLWBuffer<RadeonRays::float3> output, bool consume = false);
+
+        // Called from the primary device thread: accumulate finished snapshots into the output
+        void Composite(CLWBuffer<RadeonRays::float3> output);
+
+        MultiDeviceCompositor(MultiDeviceCompositor const&) = delete;
+        MultiDeviceCompositor& operator = (MultiDeviceCompositor const&) = delete;
+
+    private:
+        enum State
+        {
+            // Snapshot can be taken
+            kIdle,
+            // Copy to pinned memory is in flight or waits for the parent
+            kStaged,
+            // Parent device reads pinned memory
+            kUploading
+        };
+
+        struct Node
+        {
+            std::vector<std::size_t> children;
+            std::unique_ptr<ClwReadback> readback;
+            // Snapshot copy on the parent device
+            CLWBuffer<RadeonRays::float3> upload;
+            CLWEvent upload_event;
+            std::atomic<int> state;
+        };
+
+        // Add src to dst on device idx
+        template <typename T>
+        CLWEvent Accumulate(std::size_t idx, CLWBuffer<RadeonRays::float3> src, CLWBuffer<T> dst);
+        // Upload and add finished snapshots of node children into dst
+        template <typename T>
+        void Gather(std::size_t idx, CLWBuffer<T> dst, CLWEvent& last_event);
+
+        std::vector<ConfigManager::Config>& m_configs;
+        std::unique_ptr<Node[]> m_nodes;
+        std::size_t m_primary;
+        std::size_t m_num_pixels;
+    };
+}
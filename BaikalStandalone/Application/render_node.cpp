@@ -0,0 +1,432 @@
+
+/**********************************************************************
+ Copyright (c) 2017 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#include "Application/render_node.h"
+
+#include "Utils/compile_cache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace Baikal
+{
+    namespace
+    {
+#ifdef WIN32
+        using SocketHandle = SOCKET;
+        SocketHandle const kInvalidSocket = INVALID_SOCKET;
+
+        void CloseSocket(SocketHandle socket) { closesocket(socket); }
+        void ShutdownSocket(SocketHandle socket) { shutdown(socket, SD_BOTH); }
+
+        // Winsock has to be initialized once per process before the first socket
+        void InitSockets()
+        {
+            static bool const initialized = []()
+            {
+                WSADATA data;
+                return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+            }();
+
+            if (!initialized)
+            {
+                throw std::runtime_error("Render node: failed to initialize Winsock");
+            }
+        }
+#else
+        using SocketHandle = int;
+        SocketHandle const kInvalidSocket = -1;
+
+        void CloseSocket(SocketHandle socket) { close(socket); }
+        void ShutdownSocket(SocketHandle socket) { shutdown(socket, SHUT_RDWR); }
+        void InitSockets() {}
+#endif
+
+        SocketHandle ToHandle(std::intptr_t socket)
+        {
+            return static_cast<SocketHandle>(socket);
+        }
+
+        void SendAll(SocketHandle socket, char const* data, std::size_t size)
+        {
+            while (size > 0)
+            {
+                auto chunk = static_cast<int>(std::min<std::size_t>(size, 1 << 30));
+                auto sent = send(socket, data, chunk, 0);
+
+                if (sent <= 0)
+                {
+                    throw std::runtime_error("Render node: connection lost while sending");
+                }
+
+                data += sent;
+                size -= static_cast<std::size_t>(sent);
+            }
+        }
+
+        // Returns false if the connection has been closed before all data has arrived
+        bool ReceiveAll(SocketHandle socket, char* data, std::size_t size)
+        {
+            while (size > 0)
+            {
+                auto chunk = static_cast<int>(std::min<std::size_t>(size, 1 << 30));
+                auto received = recv(socket, data, chunk, 0);
+
+                if (received <= 0)
+                {
+                    return false;
+                }
+
+                data += received;
+                size -= static_cast<std::size_t>(received);
+            }
+
+            return true;
+        }
+
+        // Sample chunks are large, jobs have to arrive without delay
+        void SetNoDelay(SocketHandle socket)
+        {
+            int flag = 1;
+            setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char const*>(&flag), sizeof(flag));
+        }
+    }
+
+    RenderConnection::RenderConnection(std::intptr_t socket)
+        : m_socket(socket)
+    {
+    }
+
+    RenderConnection::~RenderConnection()
+    {
+        CloseSocket(ToHandle(m_socket));
+    }
+
+    std::unique_ptr<RenderConnection> RenderConnection::Connect(std::string const& address)
+    {
+        InitSockets();
+
+        auto separator = address.rfind(':');
+
+        if (separator == std::string::npos)
+        {
+            throw std::runtime_error("Render node: worker address should be host:port, got " + address);
+        }
+
+        auto host = address.substr(0, separator);
+        auto port = address.substr(separator + 1);
+
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* addresses = nullptr;
+
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+        {
+            throw std::runtime_error("Render node: failed to resolve " + address);
+        }
+
+        auto socket_handle = kInvalidSocket;
+
+        for (auto info = addresses; info && socket_handle == kInvalidSocket; info = info->ai_next)
+        {
+            socket_handle = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+
+            if (socket_handle != kInvalidSocket && connect(socket_handle, info->ai_addr, static_cast<int>(info->ai_addrlen)) != 0)
+            {
+                CloseSocket(socket_handle);
+                socket_handle = kInvalidSocket;
+            }
+        }
+
+        freeaddrinfo(addresses);
+
+        if (socket_handle == kInvalidSocket)
+        {
+            throw std::runtime_error("Render node: failed to connect to " + address);
+        }
+
+        SetNoDelay(socket_handle);
+
+        return std::unique_ptr<RenderConnection>(new RenderConnection(static_cast<std::intptr_t>(socket_handle)));
+    }
+
+    void RenderConnection::Send(RenderMessageType type, std::vector<char> const& payload)
+    {
+        auto header = MakeRenderMessageHeader(type, payload.size());
+
+        std::lock_guard<std::mutex> lock(m_send_mutex);
+        SendAll(ToHandle(m_socket), reinterpret_cast<char const*>(&header), sizeof(header));
+        SendAll(ToHandle(m_socket), payload.data(), payload.size());
+    }
+
+    bool RenderConnection::Receive(RenderMessageType& type, std::vector<char>& payload)
+    {
+        RenderMessageHeader header;
+
+        if (!ReceiveAll(ToHandle(m_socket), reinterpret_cast<char*>(&header), sizeof(header)))
+        {
+            return false;
+        }
+
+        // Payload size comes from the peer, it is checked against the limit of the type before allocating
+        CheckRenderMessageHeader(header);
+
+        type = header.type;
+        payload.resize(static_cast<std::size_t>(header.payload_size));
+        return ReceiveAll(ToHandle(m_socket), payload.data(), payload.size());
+    }
+
+    void RenderConnection::Shutdown()
+    {
+        ShutdownSocket(ToHandle(m_socket));
+    }
+
+    RenderListener::RenderListener(std::uint16_t port)
+    {
+        InitSockets();
+
+        auto socket_handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+        if (socket_handle == kInvalidSocket)
+        {
+            throw std::runtime_error("Render node: failed to create socket");
+        }
+
+        // Restarted workers should not wait for the old socket to time out
+        int flag = 1;
+        setsockopt(socket_handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<char const*>(&flag), sizeof(flag));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+
+        if (bind(socket_handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(socket_handle, 1) != 0)
+        {
+            CloseSocket(socket_handle);
+            throw std::runtime_error("Render node: failed to listen on port " + std::to_string(port));
+        }
+
+        m_socket = static_cast<std::intptr_t>(socket_handle);
+    }
+
+    RenderListener::~RenderListener()
+    {
+        CloseSocket(ToHandle(m_socket));
+    }
+
+    std::unique_ptr<RenderConnection> RenderListener::Accept()
+    {
+        auto socket_handle = accept(ToHandle(m_socket), nullptr, nullptr);
+
+        if (socket_handle == kInvalidSocket)
+        {
+            throw std::runtime_error("Render node: failed to accept connection");
+        }
+
+        SetNoDelay(socket_handle);
+
+        return std::unique_ptr<RenderConnection>(new RenderConnection(static_cast<std::intptr_t>(socket_handle)));
+    }
+
+    RenderCoordinator::RenderCoordinator(std::vector<std::string> const& workers)
+    {
+        for (auto const& address : workers)
+        {
+            m_workers.push_back(RenderConnection::Connect(address));
+            std::cout << "Connected to render worker " << address << "\n";
+        }
+
+        for (std::size_t i = 0; i < m_workers.size(); ++i)
+        {
+            m_threads.push_back(std::thread(&RenderCoordinator::ReceiveThread, this, i));
+        }
+    }
+
+    RenderCoordinator::~RenderCoordinator()
+    {
+        for (auto& worker : m_workers)
+        {
+            worker->Shutdown();
+        }
+
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    void RenderCoordinator::StartJob(RenderJob const& job)
+    {
+        m_merger.Reset(job.job_id, job.width, job.height);
+
+        for (std::size_t i = 0; i < m_workers.size(); ++i)
+        {
+            // Slot 0 stays with the coordinator
+            auto worker_job = job;
+            worker_job.slot = static_cast<std::uint32_t>(i + 1);
+
+            try
+            {
+                m_workers[i]->Send(RenderMessageType::kJob, EncodeRenderJob(worker_job));
+            }
+            catch (std::runtime_error& e)
+            {
+                // Lost workers do not stop the render, the others keep contributing
+                std::cerr << e.what() << "\n";
+            }
+        }
+    }
+
+    bool RenderCoordinator::TakeSamples(std::vector<RadeonRays::float3>& data)
+    {
+        return m_merger.Take(data);
+    }
+
+    void RenderCoordinator::ReceiveThread(std::size_t idx)
+    {
+        RenderMessageType type;
+        std::vector<char> payload;
+
+        try
+        {
+            while (m_workers[idx]->Receive(type, payload))
+            {
+                if (type == RenderMessageType::kSamples)
+                {
+                    // Chunks which were on the way during a camera change are dropped
+                    m_merger.Merge(DecodeSampleChunk(payload));
+                }
+            }
+        }
+        catch (std::runtime_error& e)
+        {
+            std::cerr << e.what() << "\n";
+        }
+    }
+
+    RenderWorker::RenderWorker(std::uint16_t port)
+        : m_listener(port)
+        , m_job()
+        , m_connected(false)
+    {
+        std::cout << "Waiting for render coordinator on port " << port << "\n";
+
+        m_coordinator = m_listener.Accept();
+        m_connected.store(true);
+        m_thread = std::thread(&RenderWorker::ReceiveThread, this);
+
+        std::cout << "Render coordinator connected\n";
+    }
+
+    RenderWorker::~RenderWorker()
+    {
+        m_coordinator->Shutdown();
+        m_thread.join();
+    }
+
+    bool RenderWorker::PollJob(RenderJob& job)
+    {
+        std::lock_guard<std::mutex> lock(m_job_mutex);
+
+        if (!m_has_new_job)
+        {
+            return false;
+        }
+
+        job = m_job;
+        m_has_new_job = false;
+        return true;
+    }
+
+    void RenderWorker::SendSamples(SampleChunk const& chunk)
+    {
+        try
+        {
+            m_coordinator->Send(RenderMessageType::kSamples, EncodeSampleChunk(chunk));
+        }
+        catch (std::runtime_error& e)
+        {
+            std::cerr << e.what() << "\n";
+            m_connected.store(false);
+        }
+    }
+
+    void RenderWorker::ReceiveThread()
+    {
+        RenderMessageType type;
+        std::vector<char> payload;
+
+        try
+        {
+            while (m_coordinator->Receive(type, payload))
+            {
+                if (type == RenderMessageType::kJob)
+                {
+                    // Only the latest job matters, older ones are overwritten before being picked up
+                    std::lock_guard<std::mutex> lock(m_job_mutex);
+                    m_job = DecodeRenderJob(payload);
+                    m_has_new_job = true;
+                }
+            }
+        }
+        catch (std::runtime_error& e)
+        {
+            std::cerr << e.what() << "\n";
+        }
+
+        m_connected.store(false);
+    }
+
+    std::uint64_t HashSceneFile(std::string const& filename)
+    {
+        std::ifstream in(filename, std::ios::binary);
+
+        if (!in)
+        {
+            throw std::runtime_error("Render node: failed to open " + filename);
+        }
+
+        std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        ContentHash hash;
+        hash.Add(data);
+        return hash.Get();
+    }
+}
@@ -0,0 +1,148 @@
+
+/**********************************************************************
+ Copyright (c) 2017 Advanced Micro Devices, Inc. All rights reserved.
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in
+ all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ THE SOFTWARE.
+ ********************************************************************/
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Utils/render_protocol.h"
+
+namespace Baikal
+{
+    /**
+    \brief Blocking TCP connection carrying render protocol messages.
+
+    \details Send can be called from several threads, Receive from a single one.
+    */
+    class RenderConnection
+    {
+    public:
+        // Connect to host:port
+        static std::unique_ptr<RenderConnection> Connect(std::string const& address);
+
+        ~RenderConnection();
+
+        void Send(RenderMessageType type, std::vector<char> const& payload);
+        // Returns false once the peer has closed the connection
+        bool Receive(RenderMessageType& type, std::vector<char>& payload);
+        // Unblock Receive, the connection can not be used afterwards
+        void Shutdown();
+
+        RenderConnection(RenderConnection const&) = delete;
+        RenderConnection& operator = (RenderConnection const&) = delete;
+
+    private:
+        friend class RenderListener;
+
+        explicit RenderConnection(std::intptr_t socket);
+
+        std::intptr_t m_socket;
+        std::mutex m_send_mutex;
+    };
+
+    /**
+    \brief Listening TCP socket of a render worker.
+    */
+    class RenderListener
+    {
+    public:
+        explicit RenderListener(std::uint16_t port);
+        ~RenderListener();
+
+        // Blocks until a coordinator connects
+        std::unique_ptr<RenderConnection> Accept();
+
+        RenderListener(RenderListener const&) = delete;
+        RenderListener& operator = (RenderListener const&) = delete;
+
+    private:
+        std::intptr_t m_socket;
+    };
+
+    /**
+    \brief Sends jobs to workers and merges the samples they stream back.
+    */
+    class RenderCoordinator
+    {
+    public:
+        // Connect to all workers given as host:port
+        explicit RenderCoordinator(std::vector<std::string> const& workers);
+        ~RenderCoordinator();
+
+        // Send the job to every worker, samples of previous jobs are dropped from now on
+        void StartJob(RenderJob const& job);
+        // Move samples merged since the last call into data, returns false if there are none
+        bool TakeSamples(std::vector<RadeonRays::float3>& data);
+
+        std::size_t GetNumWorkers() const { return m_workers.size(); }
+
+        RenderCoordinator(RenderCoordinator const&) = delete;
+        RenderCoordinator& operator = (RenderCoordinator const&) = delete;
+
+    private:
+        void ReceiveThread(std::size_t idx);
+
+        std::vector<std::unique_ptr<RenderConnection>> m_workers;
+        std::vector<std::thread> m_threads;
+        SampleMerger m_merger;
+    };
+
+    /**
+    \brief Worker side of a distributed render, serves a single coordinator.
+    */
+    class RenderWorker
+    {
+    public:
+        // Blocks until the coordinator connects
+        explicit RenderWorker(std::uint16_t port);
+        ~RenderWorker();
+
+        // Returns true if a new job has arrived since the last call
+        bool PollJob(RenderJob& job);
+        void SendSamples(SampleChunk const& chunk);
+
+        bool IsConnected() const { return m_connected.load(); }
+
+        RenderWorker(RenderWorker const&) = delete;
+        RenderWorker& operator = (RenderWorker const&) = delete;
+
+    private:
+        void ReceiveThread();
+
+        RenderListener m_listener;
+        std::unique_ptr<RenderConnection> m_coordinator;
+        std::thread m_thread;
+        std::mutex m_job_mutex;
+        RenderJob m_job;
+        bool m_has_new_job = false;
+        std::atomic<bool> m_connected;
+    };
+
+    // Content hash of the file workers have to load for the job
+    std::uint64_t HashSceneFile(std::string const& filename);
+}
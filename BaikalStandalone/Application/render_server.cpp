@@ -0,0 +1,297 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#include "Application/render_server.h"
+
+#include "Application/cl_render.h"
+#include "Application/render_node.h"
+#include "SceneGraph/texture.h"
+#include "Utils/texture_compression.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+namespace Baikal
+{
+    RenderServer::RenderServer(AppSettings const& settings)
+        : m_settings(settings)
+    {
+        // There is no window to share textures with
+        m_settings.interop = false;
+        m_settings.cmd_line_mode = true;
+
+        m_render.reset(new AppClRender(m_settings, static_cast<GLuint>(-1)));
+        m_render->UpdateScene();
+    }
+
+    RenderServer::~RenderServer() = default;
+
+    void RenderServer::Run()
+    {
+        RenderListener listener(static_cast<std::uint16_t>(m_settings.server_port));
+        std::cout << "Render server listening on port " << m_settings.server_port << "\n";
+
+        for (;;)
+        {
+            auto client = listener.Accept();
+            std::cout << "Client connected\n";
+
+            Serve(*client);
+            std::cout << "Client disconnected\n";
+        }
+    }
+
+    void RenderServer::ReceiveThread(RenderConnection& client, PendingRequests& pending)
+    {
+        RenderMessageType type;
+        std::vector<char> payload;
+
+        try
+        {
+            while (client.Receive(type, payload))
+            {
+                std::lock_guard<std::mutex> lock(pending.mutex);
+
+                if (type == RenderMessageType::kLoadScene)
+                {
+                    pending.scene = DecodeSceneRequest(payload);
+                    pending.has_scene = true;
+                    // Views of the previous scene are of no use
+                    pending.has_view = false;
+                }
+                else if (type == RenderMessageType::kView)
+                {
+                    pending.view = DecodeViewRequest(payload);
+                    pending.has_view = true;
+                }
+
+                pending.changed.notify_one();
+            }
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "Render server: " << e.what() << "\n";
+        }
+
+        std::lock_guard<std::mutex> lock(pending.mutex);
+        pending.connected = false;
+        pending.changed.notify_one();
+    }
+
+    void RenderServer::Serve(RenderConnection& client)
+    {
+        PendingRequests pending;
+        std::thread receive_thread(&RenderServer::ReceiveThread, std::ref(client), std::ref(pending));
+
+        for (;;)
+        {
+            bool has_scene = false;
+            bool has_view = false;
+            SceneRequest scene;
+            ViewRequest view;
+
+            {
+                std::unique_lock<std::mutex> lock(pending.mutex);
+                pending.changed.wait(lock, [&]() { return !pending.connected || pending.has_scene || pending.has_view; });
+
+                if (!pending.connected)
+                {
+                    break;
+                }
+
+                std::swap(has_scene, pending.has_scene);
+                std::swap(has_view, pending.has_view);
+                scene = pending.scene;
+                view = pending.view;
+            }
+
+            // Failures are reported to the client, the server keeps going
+            try
+            {
+                if (has_scene)
+                {
+                    LoadScene(scene);
+                }
+
+                if (has_view && view.update_samples > 0)
+                {
+                    StreamView(view, client, pending);
+                }
+                else if (has_view)
+                {
+                    client.Send(RenderMessageType::kFrame, EncodeFrame(RenderView(view)));
+                }
+            }
+            catch (std::exception& e)
+            {
+                std::string message = e.what();
+                std::cerr << "Render server: " << message << "\n";
+
+                // Client may be gone already, then there is nobody to tell
+                try
+                {
+                    client.Send(RenderMessageType::kError, std::vector<char>(message.cbegin(), message.cend()));
+                }
+                catch (std::exception&)
+                {
+                }
+            }
+        }
+
+        client.Shutdown();
+        receive_thread.join();
+    }
+
+    void RenderServer::LoadScene(SceneRequest const& request)
+    {
+        if (m_render && request.path == m_settings.path && request.model_name == m_settings.modelname)
+        {
+            return;
+        }
+
+        // Renderer owns the outputs and the compiled scene, all of them are created for a new scene
+        auto settings = m_settings;
+        settings.path = request.path;
+        settings.modelname = request.model_name;
+
+        std::unique_ptr<AppClRender> render(new AppClRender(settings, static_cast<GLuint>(-1)));
+        render->UpdateScene();
+
+        m_render = std::move(render);
+        m_settings = settings;
+        std::cout << "Scene " << m_settings.path << m_settings.modelname << " loaded\n";
+    }
+
+    void RenderServer::BeginView(ViewRequest const& request)
+    {
+        if (!m_render)
+        {
+            throw std::runtime_error("No scene is loaded");
+        }
+
+        // Validate the format before rendering
+        GetFrameDataSize(request.format, 0u, 0u);
+
+        if (request.num_bounces > 0)
+        {
+            m_render->SetNumBounces(static_cast<int>(request.num_bounces));
+        }
+
+        // Camera only update of the compiled scene, the output is cleared
+        m_render->GetCamera()->LookAt(request.camera_position, request.camera_at, request.camera_up);
+        m_render->UpdateScene();
+    }
+
+    EncodedFrame RenderServer::RenderView(ViewRequest const& request)
+    {
+        BeginView(request);
+
+        EncodedFrame frame;
+        frame.request_id = request.request_id;
+        frame.width = m_render->GetWidth();
+        frame.height = m_render->GetHeight();
+        frame.format = request.format;
+
+        auto num_samples = std::max(request.num_samples, 1u);
+        for (std::uint32_t i = 0; i < num_samples; ++i)
+        {
+            m_render->Render(static_cast<int>(i));
+        }
+
+        auto const& rgba = m_render->ReadPreview();
+
+        if (frame.format == FrameFormat::kRgba8)
+        {
+            frame.data.assign(rgba.cbegin(), rgba.cend());
+        }
+        else
+        {
+            // Texture owns its data
+            auto texels = new char[rgba.size()];
+            std::memcpy(texels, rgba.data(), rgba.size());
+            auto texture = Texture::Create(texels, RadeonRays::int3(frame.width, frame.height, 1), Texture::Format::kRgba8);
+
+            auto compressed = TextureCompression::Compress(*texture, Texture::Format::kBc1);
+            frame.data.assign(compressed->GetData(), compressed->GetData() + compressed->GetSizeInBytes());
+        }
+
+        return frame;
+    }
+
+    void RenderServer::StreamView(ViewRequest const& request, RenderConnection& client, PendingRequests& pending)
+    {
+        BeginView(request);
+
+        FrameTiles frame;
+        frame.request_id = request.request_id;
+        frame.width = m_render->GetWidth();
+        frame.height = m_render->GetHeight();
+        frame.tile_size = TileDeltaEncoder::kTileSize;
+        frame.format = request.format;
+
+        auto num_samples = std::max(request.num_samples, 1u);
+
+        for (std::uint32_t i = 0; i < num_samples;)
+        {
+            // First update of the view has all the tiles, the output has just been cleared
+            auto first = i == 0;
+            auto last = std::min(i + request.update_samples, num_samples);
+            for (; i < last; ++i)
+            {
+                m_render->Render(static_cast<int>(i));
+            }
+
+            auto delta = m_render->ReadPreviewTiles(first);
+            auto texels = reinterpret_cast<char const*>(delta.pixels.data());
+            auto texels_size = delta.pixels.size() * sizeof(std::uint32_t);
+
+            frame.num_samples = last;
+            frame.tiles = std::move(delta.tiles);
+
+            if (frame.format == FrameFormat::kRgba8 || frame.tiles.empty())
+            {
+                frame.data.assign(texels, texels + texels_size);
+            }
+            else
+            {
+                // Tiles stacked into a column are compressed at once, blocks of each tile stay contiguous
+                auto data = new char[texels_size];
+                std::memcpy(data, texels, texels_size);
+                auto height = static_cast<int>(frame.tiles.size() * frame.tile_size);
+                auto texture = Texture::Create(data, RadeonRays::int3(frame.tile_size, height, 1), Texture::Format::kRgba8);
+
+                auto compressed = TextureCompression::Compress(*texture, Texture::Format::kBc1);
+                frame.data.assign(compressed->GetData(), compressed->GetData() + compressed->GetSizeInBytes());
+            }
+
+            client.Send(RenderMessageType::kFrameTiles, EncodeFrameTiles(frame));
+
+            std::lock_guard<std::mutex> lock(pending.mutex);
+            if (!pending.connected || pending.has_scene || pending.has_view)
+            {
+                return;
+            }
+        }
+    }
+}
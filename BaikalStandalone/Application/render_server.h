@@ -0,0 +1,86 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Application/app_utils.h"
+#include "Utils/render_protocol.h"
+
+namespace Baikal
+{
+    class AppClRender;
+    class RenderConnection;
+
+    /**
+    \brief Headless renderer answering view requests of a single client at a time.
+
+    \details Client can switch the scene and request views of it, each view is rendered with
+    its own camera and sample count and sent back as a tonemapped frame. Scene stays compiled
+    across requests and clients, a view only updates the camera. Requests arriving while a view
+    renders replace each other, so an interactive client gets the latest camera only.
+    Progressive views send the tiles which changed every few samples and are cut short by the
+    next request.
+    */
+    class RenderServer
+    {
+    public:
+        // Loads the scene of the settings right away
+        explicit RenderServer(AppSettings const& settings);
+        ~RenderServer();
+
+        // Serve clients on settings.server_port, never returns
+        void Run();
+
+        RenderServer(RenderServer const&) = delete;
+        RenderServer& operator = (RenderServer const&) = delete;
+
+    private:
+        struct PendingRequests
+        {
+            std::mutex mutex;
+            std::condition_variable changed;
+            bool has_scene = false;
+            SceneRequest scene;
+            bool has_view = false;
+            ViewRequest view = {};
+            bool connected = true;
+        };
+
+        // Render requests of the client until it disconnects
+        void Serve(RenderConnection& client);
+        static void ReceiveThread(RenderConnection& client, PendingRequests& pending);
+
+        void LoadScene(SceneRequest const& request);
+        // Set the camera of the view and clear the output
+        void BeginView(ViewRequest const& request);
+        EncodedFrame RenderView(ViewRequest const& request);
+        // Send tile updates of the view until it is complete or another request arrives
+        void StreamView(ViewRequest const& request, RenderConnection& client, PendingRequests& pending);
+
+        AppSettings m_settings;
+        std::unique_ptr<AppClRender> m_render;
+    };
+}
@@ -0,0 +1,59 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#include "Application/render_server.h"
+#include "CLW.h"
+
+#include <iostream>
+
+#ifndef WIN32
+#include <signal.h>
+#endif
+
+int main(int argc, char * argv[])
+{
+#ifndef WIN32
+    // Clients going away mid-frame fail the send instead of killing the server
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    try
+    {
+        Baikal::AppCliParser cli;
+        auto settings = cli.Parse(argc, argv);
+
+        Baikal::RenderServer server(settings);
+        server.Run();
+    }
+    catch (CLWException& ex)
+    {
+        std::cerr << ex.what() << " (OpenCL error code: "
+            << ex.errcode_ << ")" << std::endl;
+        return -1;
+    }
+    catch (std::exception& ex)
+    {
+        std::cerr << ex.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -499,3 +499,138 @@ TEST_F(AovTest, Aov_Opacity)
     SaveOutput(oss.str(), output_ws.get());
     ASSERT_TRUE(CompareToReference(oss.str()));
 }
+
+TEST_F(AovTest, Aov_FusedAlbedo)
+{
+    auto& renderer = GetMonteCarloRenderer();
+
+    auto output_ws = m_factory->CreateOutput(
+        m_output->width(), m_output->height()
+    );
+
+    m_renderer->SetOutput(Baikal::Renderer::OutputType::kAlbedo,
+        output_ws.get());
+
+    renderer.SetFusedAOVs(true);
+
+    ClearOutput();
+    ClearOutput(output_ws.get());
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    renderer.SetFusedAOVs(false);
+
+    {
+        std::ostringstream oss;
+        oss << test_name() << "_1.png";
+        SaveOutput(oss.str(), output_ws.get());
+        ASSERT_TRUE(CompareToReference(oss.str()));
+    }
+
+    {
+        std::ostringstream oss;
+        oss << test_name() << "_2.png";
+        SaveOutput(oss.str());
+        ASSERT_TRUE(CompareToReference(oss.str()));
+    }
+}
+
+TEST_F(AovTest, Aov_PackedFormats)
+{
+    auto packed_color = m_factory->CreateOutput(
+        m_output->width(), m_output->height(), Baikal::Output::Format::kRGBA16F
+    );
+
+    // Color is accumulated atomically in full precision
+    ASSERT_THROW(m_renderer->SetOutput(Baikal::Renderer::OutputType::kColor, packed_color.get()),
+        std::runtime_error);
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    auto render = [&](Baikal::Renderer::OutputType type, Baikal::Output::Format format)
+    {
+        auto output = m_factory->CreateOutput(m_output->width(), m_output->height(), format);
+        m_renderer->SetOutput(type, output.get());
+
+        ClearOutput(output.get());
+
+        for (auto i = 0u; i < kNumIterations; ++i)
+        {
+            m_renderer->Render(scene);
+        }
+
+        std::vector<RadeonRays::float3> data(output->width() * output->height());
+        output->GetData(data.data());
+        m_renderer->SetOutput(type, nullptr);
+
+        for (auto& value : data)
+        {
+            value = value.w > 0.f ? (1.f / value.w) * value : RadeonRays::float3();
+        }
+
+        return data;
+    };
+
+    // Packed normals should stay close to full precision ones
+    {
+        auto reference = render(Baikal::Renderer::OutputType::kWorldShadingNormal, Baikal::Output::Format::kRGBA32F);
+        auto packed = render(Baikal::Renderer::OutputType::kWorldShadingNormal, Baikal::Output::Format::kRG16Oct);
+
+        for (std::size_t i = 0; i < reference.size(); ++i)
+        {
+            if (reference[i].sqnorm() > 0.5f)
+            {
+                ASSERT_GT(RadeonRays::dot(RadeonRays::normalize(reference[i]), packed[i]), 0.999f);
+            }
+        }
+    }
+
+    {
+        auto reference = render(Baikal::Renderer::OutputType::kDepth, Baikal::Output::Format::kRGBA32F);
+        auto packed = render(Baikal::Renderer::OutputType::kDepth, Baikal::Output::Format::kR32F);
+
+        for (std::size_t i = 0; i < reference.size(); ++i)
+        {
+            ASSERT_NEAR(reference[i].x, packed[i].x, 1e-3f * std::max(1.f, reference[i].x));
+        }
+    }
+}
+
+TEST_F(AovTest, Aov_Cost)
+{
+    auto output_cost = m_factory->CreateOutput(
+        m_output->width(), m_output->height()
+    );
+
+    m_renderer->SetOutput(Baikal::Renderer::OutputType::kCost,
+        output_cost.get());
+
+    ClearOutput(output_cost.get());
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    std::vector<RadeonRays::float3> data(output_cost->width() * output_cost->height());
+    output_cost->GetData(data.data());
+
+    // Every sample traces its primary ray, all the rays are either bounce or shadow rays
+    for (auto const& value : data)
+    {
+        ASSERT_FLOAT_EQ(value.w, data[0].w);
+        ASSERT_GT(value.w, 0.f);
+        ASSERT_GE(value.y, value.w);
+        ASSERT_NEAR(value.x, value.y + value.z, 1e-3f * value.x);
+    }
+}
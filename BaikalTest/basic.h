@@ -25,19 +25,50 @@ THE SOFTWARE.
 
 #include "CLW.h"
 #include "Renderers/renderer.h"
+#include "Renderers/monte_carlo_renderer.h"
+#include "Renderers/adaptive_renderer.h"
+#include "Renderers/render_checkpoint.h"
+#include "Estimators/path_tracing_estimator.h"
+#include "Estimators/ao_estimator.h"
 #include "RenderFactory/clw_render_factory.h"
+#include "Controllers/clw_scene_controller.h"
+#include "Controllers/memory_budget.h"
 #include "Output/output.h"
+#include "PostEffects/post_effect.h"
+#include "PostEffects/denoise_schedule.h"
+#include "Utils/distribution1d.h"
+#include "Utils/tile_scheduler.h"
+#include "Utils/task_scheduler.h"
+#include "Utils/render_protocol.h"
+#include "PostEffects/post_effect_pipeline.h"
+#include "PostEffects/external_denoiser.h"
+#include "PostEffects/wavelet_denoiser.h"
+#include "PostEffects/temporal_accumulator.h"
 #include "SceneGraph/camera.h"
+#include "SceneGraph/shape.h"
+#include "SceneGraph/texture.h"
+#include "SceneGraph/inputmaps.h"
+#include "SceneGraph/uberv2material.h"
+#include "math/mathutils.h"
 #include "scene_io.h"
+#include "perf_record.h"
+#include "test_environment.h"
 
 #include "OpenImageIO/imageio.h"
 
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <numeric>
 #include <sstream>
 #include <iostream>
+#include <thread>
 
 extern int g_argc;
 extern char** g_argv;
@@ -52,76 +83,62 @@ public:
 
     virtual void SetUp()
     {
-        std::vector<CLWPlatform> platforms;
-
-        ASSERT_NO_THROW(CLWPlatform::CreateAllPlatforms(platforms));
-        ASSERT_GT(platforms.size(), 0u);
-
-        char* device_index_option = GetCmdOption(g_argv, g_argv + g_argc, "-device");
-        char* platform_index_option = GetCmdOption(g_argv, g_argv + g_argc, "-platform");
         char* generate_option = GetCmdOption(g_argv, g_argv + g_argc, "-genref");
         char* tolerance_option = GetCmdOption(g_argv, g_argv + g_argc, "-tolerance");
         char* refpath_option = GetCmdOption(g_argv, g_argv + g_argc, "-ref");
         char* outpath_option = GetCmdOption(g_argv, g_argv + g_argc, "-out");
+        char* perf_tolerance_option = GetCmdOption(g_argv, g_argv + g_argc, "-perftolerance");
 
-        auto platform_index = platform_index_option ? (int)atoi(platform_index_option) : -1;
-        auto device_index = device_index_option ? (int)atoi(device_index_option) : -1;
         m_generate = generate_option ? true : false;
         m_tolerance = tolerance_option ? (int)atoi(tolerance_option) : 20;
         m_reference_path = refpath_option ? refpath_option : "ReferenceImages";
         m_output_path = outpath_option ? outpath_option : "OutputImages";
         m_reference_path.append("/");
         m_output_path.append("/");
+        m_perf = CmdOptionExists(g_argv, g_argv + g_argc, "-perf");
+        m_perf_update_baseline = CmdOptionExists(g_argv, g_argv + g_argc, "-perfbaseline");
+        m_perf_tolerance = perf_tolerance_option ? (float)atof(perf_tolerance_option) : 10.f;
 
         Baikal::SceneObject::ResetId();
 
-        // Prefer GPU devices if nothing has been specified
-        if (platform_index == -1)
+        // Device, factory, renderer and output are created by the first test of the run
+        auto& environment = TestEnvironment::Get();
+        if (!environment.IsDeviceCreated())
         {
-            platform_index = 0;
-
-            for (auto j = 0u; j < platforms.size(); ++j)
-            {
-                for (auto i = 0u; i < platforms[j].GetDeviceCount(); ++i)
-                {
-                    if (platforms[j].GetDevice(i).GetType() == CL_DEVICE_TYPE_GPU)
-                    {
-                        platform_index = j;
-                        break;
-                    }
-                }
-            }
+            ASSERT_NO_FATAL_FAILURE(environment.CreateDevice());
         }
 
+        m_context = environment.GetContext();
+        m_factory = environment.GetFactory();
+        m_device_name = environment.GetDeviceName();
+        m_device_id = environment.GetDeviceId();
 
-        if (device_index == -1)
+        m_renderer = environment.TakeRenderer();
+        if (!m_renderer)
         {
-            device_index = 0;
-
-            for (auto i = 0u; i < platforms[platform_index].GetDeviceCount(); ++i)
-            {
-                if (platforms[platform_index].GetDevice(i).GetType() == CL_DEVICE_TYPE_GPU)
-                {
-                    device_index = i;
-                    break;
-                }
-            }
+            ASSERT_NO_THROW(m_renderer = m_factory->CreateRenderer(Baikal::ClwRenderFactory::RendererType::kUnidirectionalPathTracer));
         }
 
-        ASSERT_LT((std::size_t)platform_index, platforms.size());
-        ASSERT_LT((std::uint32_t)device_index, platforms[platform_index].GetDeviceCount());
+        m_output = environment.TakeOutput();
+        if (!m_output)
+        {
+            ASSERT_NO_THROW(m_output = m_factory->CreateOutput(kOutputWidth, kOutputHeight));
+        }
 
-        auto platform = platforms[platform_index];
-        auto device = platform.GetDevice(device_index);
-        auto context = CLWContext::Create(device);
+        m_shared_renderer = m_renderer.get();
+        m_shared_output = m_output.get();
+        m_renderer_changed = false;
 
-        ASSERT_NO_THROW(m_factory = std::make_unique<Baikal::ClwRenderFactory>(context, "cache"));
-        ASSERT_NO_THROW(m_renderer = m_factory->CreateRenderer(Baikal::ClwRenderFactory::RendererType::kUnidirectionalPathTracer));
         ASSERT_NO_THROW(m_controller = m_factory->CreateSceneController());
-        ASSERT_NO_THROW(m_output = m_factory->CreateOutput(kOutputWidth, kOutputHeight));
         m_output->Clear(RadeonRays::float3(0.0f));
         ASSERT_NO_THROW(m_renderer->SetOutput(Baikal::Renderer::OutputType::kColor, m_output.get()));
 
+        // Renderers created by the tests themselves are not profiled
+        if (m_perf)
+        {
+            static_cast<Baikal::MonteCarloRenderer*>(m_renderer.get())->SetProfiling(true);
+        }
+
         ASSERT_NO_THROW(LoadTestScene());
         ASSERT_NO_THROW(SetupCamera());
 
@@ -130,6 +147,117 @@ public:
 
     virtual void TearDown()
     {
+        if (m_perf)
+        {
+            CheckPerformance();
+        }
+
+        GiveBackSharedObjects();
+    }
+
+    // Tests changing renderer or estimator settings get the renderer through here,
+    // so the next test does not inherit them
+    Baikal::MonteCarloRenderer& GetMonteCarloRenderer()
+    {
+        m_renderer_changed = true;
+        return dynamic_cast<Baikal::MonteCarloRenderer&>(*m_renderer);
+    }
+
+    // Hand the renderer and output back to the environment unless the test has replaced or reconfigured them,
+    // profiled renderers are not shared since their timings would add up
+    void GiveBackSharedObjects()
+    {
+        m_controller.reset();
+
+        std::unique_ptr<Baikal::Renderer> renderer;
+        std::unique_ptr<Baikal::Output> output;
+
+        if (m_renderer && m_renderer.get() == m_shared_renderer && !m_renderer_changed && !m_perf)
+        {
+            // Outputs of the test are gone after it
+            for (auto i = 0; i < static_cast<int>(Baikal::Renderer::OutputType::kMax); ++i)
+            {
+                auto type = static_cast<Baikal::Renderer::OutputType>(i);
+                if (type != Baikal::Renderer::OutputType::kMaxMultiPassOutput)
+                {
+                    m_renderer->SetOutput(type, nullptr);
+                }
+            }
+
+            m_renderer->SetSampleIndex(0);
+            renderer = std::move(m_renderer);
+        }
+
+        if (m_output && m_output.get() == m_shared_output)
+        {
+            output = std::move(m_output);
+        }
+
+        // Objects of the test go before the factory they come from may be released
+        m_renderer.reset();
+        m_output.reset();
+
+        TestEnvironment::Get().GiveBack(std::move(renderer), std::move(output));
+    }
+
+    // Record device times of the test into the cache directory and compare them to the baseline.
+    // Tests without a baseline, or all of them with -perfbaseline, store theirs as the new one.
+    void CheckPerformance()
+    {
+        // Differences below are timer noise rather than regressions
+        static double constexpr kMinRegressionMilliseconds = 0.05;
+
+        auto renderer = dynamic_cast<Baikal::MonteCarloRenderer*>(m_renderer.get());
+        if (!renderer)
+        {
+            return;
+        }
+
+        auto& profiler = renderer->GetProfiler();
+        ASSERT_NO_THROW(profiler.Resolve(true));
+
+        auto timings = PerfRecord::GetTimings(profiler);
+        if (timings.empty())
+        {
+            return;
+        }
+
+        auto test_info = ::testing::UnitTest::GetInstance()->current_test_info();
+        auto test = std::string(test_info->test_case_name()) + "." + test_info->name();
+
+        PerfRecord results(PerfRecord::GetFileName("cache", "perf", m_device_name), m_device_id);
+        results.Set(test, timings);
+        results.Save();
+
+        PerfRecord baseline(PerfRecord::GetFileName("cache", "perf_baseline", m_device_name), m_device_id);
+        PerfRecord::Timings baseline_timings;
+
+        if (m_perf_update_baseline || !baseline.Find(test, baseline_timings))
+        {
+            baseline.Set(test, timings);
+            baseline.Save();
+            return;
+        }
+
+        auto is_slower = [this](double milliseconds, double baseline_milliseconds)
+        {
+            return milliseconds > baseline_milliseconds * (1.0 + m_perf_tolerance / 100.0) + kMinRegressionMilliseconds;
+        };
+
+        // Name the steps which have slowed down to tell where a regression comes from
+        for (auto const& step : timings)
+        {
+            auto baseline_step = baseline_timings.find(step.first);
+            if (baseline_step != baseline_timings.end() && is_slower(step.second, baseline_step->second))
+            {
+                std::cout << "[   PERF   ] " << test << " " << step.first << ": "
+                    << baseline_step->second << " ms -> " << step.second << " ms per sample\n";
+            }
+        }
+
+        EXPECT_FALSE(is_slower(timings["render"], baseline_timings["render"]))
+            << test << " renders in " << timings["render"] << " ms per sample, baseline is "
+            << baseline_timings["render"] << " ms, tolerance " << m_perf_tolerance << "%";
     }
 
     virtual void ClearOutput(Baikal::Output* optional_output = nullptr) const
@@ -279,7 +407,20 @@ public:
         return difference <= m_tolerance;
     }
 
+    // Bytes of the first count elements of a device buffer
+    template <typename T>
+    std::vector<char> ReadBufferBytes(CLWBuffer<T> buffer, std::size_t count)
+    {
+        std::vector<T> elements(count);
+
+        if (count > 0)
+        {
+            m_context.ReadBuffer(0, buffer, elements.data(), count).Wait();
+        }
 
+        auto bytes = reinterpret_cast<char const*>(elements.data());
+        return std::vector<char>(bytes, bytes + count * sizeof(T));
+    }
 
     std::string test_name() const
     {
@@ -301,9 +442,11 @@ public:
         return std::find(begin, end, option) != end;
     }
 
+    CLWContext m_context;
     std::unique_ptr<Baikal::Renderer> m_renderer;
     std::unique_ptr<Baikal::SceneController<Baikal::ClwScene>> m_controller;
-    std::unique_ptr<Baikal::RenderFactory<Baikal::ClwScene>> m_factory;
+    // Owned by the test environment
+    Baikal::RenderFactory<Baikal::ClwScene>* m_factory = nullptr;
     std::unique_ptr<Baikal::Output> m_output;
     Baikal::Scene1::Ptr m_scene;
     Baikal::PerspectiveCamera::Ptr m_camera;
@@ -313,6 +456,20 @@ public:
 
     bool m_generate;
     std::uint32_t m_tolerance;
+
+    // Perf mode, see CheckPerformance
+    bool m_perf;
+    bool m_perf_update_baseline;
+    // Allowed slow down in percent
+    float m_perf_tolerance;
+    std::string m_device_name;
+    // Device name and driver version, baselines of other drivers are not compared against
+    std::string m_device_id;
+
+    // Renderer and output lent by the test environment for the test
+    Baikal::Renderer* m_shared_renderer = nullptr;
+    Baikal::Output* m_shared_output = nullptr;
+    bool m_renderer_changed = false;
 };
 
 
@@ -322,6 +479,210 @@ TEST_F(BasicTest, Init)
     ASSERT_TRUE(true);
 }
 
+TEST_F(BasicTest, CompileStats)
+{
+    using Stats = Baikal::SceneCompileStats;
+
+    auto& stats = m_controller->CompileScene(m_scene).compile_stats;
+
+    ASSERT_TRUE(stats.full_recompile);
+    ASSERT_GT(stats.total_bytes, 0u);
+    ASSERT_EQ(stats.num_shapes, m_scene->GetNumShapes());
+    ASSERT_GT(stats.num_triangles, 0u);
+
+    std::size_t total_bytes = 0;
+    for (auto const& buffer : stats.buffers)
+    {
+        total_bytes += buffer.bytes;
+    }
+    ASSERT_EQ(total_bytes, stats.total_bytes);
+
+    // Transform only update skips the rest of the steps
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto shape = shape_iter->ItemAs<Baikal::Shape>();
+    shape->SetTransform(RadeonRays::translation(RadeonRays::float3(0.f, 0.5f, 0.f)) * shape->GetTransform());
+
+    auto& updated_stats = m_controller->CompileScene(m_scene).compile_stats;
+
+    ASSERT_FALSE(updated_stats.full_recompile);
+    ASSERT_EQ(updated_stats.step_milliseconds[Stats::kShapes], 0.0);
+    ASSERT_EQ(updated_stats.step_milliseconds[Stats::kMaterials], 0.0);
+    ASSERT_GE(updated_stats.total_milliseconds, updated_stats.step_milliseconds[Stats::kShapeTransforms]);
+}
+
+TEST_F(BasicTest, CompileUnchangedScene)
+{
+    using Stats = Baikal::SceneCompileStats;
+
+    auto& compiled = m_controller->CompileScene(m_scene);
+    ASSERT_FALSE(compiled.compile_stats.unchanged);
+    auto total_bytes = compiled.compile_stats.total_bytes;
+
+    // Nothing has been touched, so the compiled version is returned as is
+    auto& idle = m_controller->CompileScene(m_scene);
+    ASSERT_EQ(&idle, &compiled);
+    ASSERT_TRUE(idle.compile_stats.unchanged);
+    ASSERT_FALSE(idle.compile_stats.full_recompile);
+    ASSERT_EQ(idle.compile_stats.total_bytes, total_bytes);
+    for (auto runs : idle.compile_stats.step_runs)
+    {
+        ASSERT_EQ(runs, 0u);
+    }
+
+    // Edits of objects still reach the compile
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto shape = shape_iter->ItemAs<Baikal::Shape>();
+    shape->SetTransform(RadeonRays::translation(RadeonRays::float3(0.f, 0.5f, 0.f)) * shape->GetTransform());
+
+    auto& moved = m_controller->CompileScene(m_scene);
+    ASSERT_FALSE(moved.compile_stats.unchanged);
+    ASSERT_EQ(moved.compile_stats.step_runs[Stats::kShapeTransforms], 1u);
+    ASSERT_TRUE(m_controller->CompileScene(m_scene).compile_stats.unchanged);
+
+    m_camera->LookAt(
+        RadeonRays::float3(0.f, 1.f, 4.f),
+        RadeonRays::float3(0.f, 1.f, 0.f),
+        RadeonRays::float3(0.f, 1.f, 0.f));
+
+    auto& camera_moved = m_controller->CompileScene(m_scene);
+    ASSERT_FALSE(camera_moved.compile_stats.unchanged);
+    ASSERT_EQ(camera_moved.compile_stats.step_runs[Stats::kCamera], 1u);
+
+    // As well as attaching objects to the scene
+    auto light = Baikal::PointLight::Create();
+    light->SetPosition(RadeonRays::float3(0.f, 2.f, 0.f));
+    light->SetEmittedRadiance(RadeonRays::float3(1.f, 1.f, 1.f));
+    m_scene->AttachLight(light);
+    ASSERT_FALSE(m_controller->CompileScene(m_scene).compile_stats.unchanged);
+
+    ASSERT_TRUE(m_controller->CompileScene(m_scene).compile_stats.unchanged);
+}
+
+TEST_F(BasicTest, CompileMovedMeshData)
+{
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto mesh = shape_iter->ItemAs<Baikal::Mesh>();
+    ASSERT_NE(mesh, nullptr);
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    ASSERT_TRUE(m_controller->CompileScene(m_scene).compile_stats.unchanged);
+    auto aabb = mesh->GetLocalAABB();
+
+    // Data moved into an attached mesh has to reach the compile like copied one
+    std::vector<RadeonRays::float3> vertices(mesh->GetVertices(), mesh->GetVertices() + mesh->GetNumVertices());
+    for (auto& v : vertices)
+    {
+        v.y += 0.5f;
+    }
+
+    auto expected = vertices;
+    mesh->SetVertices(std::move(vertices));
+    ASSERT_TRUE(mesh->IsDirty());
+    ASSERT_FLOAT_EQ(mesh->GetLocalAABB().pmin.y, aabb.pmin.y + 0.5f);
+    ASSERT_FLOAT_EQ(mesh->GetLocalAABB().pmax.y, aabb.pmax.y + 0.5f);
+
+    auto& updated = m_controller->CompileScene(m_scene);
+    ASSERT_FALSE(updated.compile_stats.unchanged);
+    ASSERT_FALSE(mesh->IsDirty());
+
+    auto const& range = updated.geometry_ranges.at(mesh);
+    std::vector<RadeonRays::float3> uploaded(expected.size());
+    m_context.ReadBuffer(0, updated.vertices, uploaded.data(), range.vertex_offset, uploaded.size()).Wait();
+
+    for (std::size_t i = 0; i < expected.size(); ++i)
+    {
+        ASSERT_EQ(uploaded[i].x, expected[i].x);
+        ASSERT_EQ(uploaded[i].y, expected[i].y);
+        ASSERT_EQ(uploaded[i].z, expected[i].z);
+    }
+
+    ASSERT_TRUE(m_controller->CompileScene(m_scene).compile_stats.unchanged);
+}
+
+TEST_F(BasicTest, SceneMemoryBudget)
+{
+    auto other_scene = Baikal::SceneIo::LoadScene("sphere+plane.test", "");
+    other_scene->SetCamera(m_camera);
+
+    auto scene_bytes = m_controller->CompileScene(m_scene).compile_stats.total_bytes;
+    ASSERT_EQ(m_controller->GetNumCachedScenes(), 1u);
+
+    // Budget only fits one of the scenes, so the least recently used one goes
+    m_controller->SetMemoryBudget(scene_bytes + 1);
+    ASSERT_NO_THROW(m_controller->CompileScene(other_scene));
+
+    ASSERT_EQ(m_controller->GetNumCachedScenes(), 1u);
+    ASSERT_THROW(m_controller->GetCachedScene(m_scene), std::runtime_error);
+    ASSERT_NO_THROW(m_controller->GetCachedScene(other_scene));
+
+    // Evicted scene is compiled from scratch
+    ASSERT_TRUE(m_controller->CompileScene(m_scene).compile_stats.full_recompile);
+    ASSERT_THROW(m_controller->GetCachedScene(other_scene), std::runtime_error);
+
+    ASSERT_NO_THROW(m_controller->EvictScene(m_scene));
+    ASSERT_EQ(m_controller->GetNumCachedScenes(), 0u);
+    ASSERT_EQ(m_controller->GetCachedSceneMemory(), 0u);
+
+    // Evicted scene still renders after recompile
+    m_controller->SetMemoryBudget(0);
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneSharedResources)
+{
+    // Second scene uses the same meshes, so their geometry is uploaded only once
+    auto other_scene = Baikal::Scene1::Create();
+    other_scene->SetCamera(m_camera);
+
+    auto shape_iter = m_scene->CreateShapeIterator();
+
+    for (; shape_iter->IsValid(); shape_iter->Next())
+    {
+        other_scene->AttachShape(shape_iter->ItemAs<Baikal::Shape>());
+    }
+
+    auto& scene = m_controller->CompileScene(m_scene);
+    ASSERT_GT(scene.geometry_bytes_uploaded, 0u);
+
+    auto& other = m_controller->CompileScene(other_scene);
+    ASSERT_EQ(other.geometry_bytes_uploaded, 0u);
+    ASSERT_EQ(static_cast<cl_mem>(other.vertices), static_cast<cl_mem>(scene.vertices));
+    ASSERT_EQ(static_cast<cl_mem>(other.indices), static_cast<cl_mem>(scene.indices));
+
+    // Shared pools are counted once
+    ASSERT_GT(other.compile_stats.shared_bytes, 0u);
+    ASSERT_LT(m_controller->GetCachedSceneMemory(), scene.compile_stats.total_bytes + other.compile_stats.total_bytes);
+
+    // Geometry stays with the remaining scene
+    ASSERT_NO_THROW(m_controller->EvictScene(other_scene));
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
 TEST_F(BasicTest, RenderTestScene)
 {    
     ClearOutput();
@@ -342,3 +703,2872 @@ TEST_F(BasicTest, RenderTestScene)
 
 
 
+TEST_F(BasicTest, RenderTestSceneTransformOnlyUpdate)
+{
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto shape = shape_iter->ItemAs<Baikal::Shape>();
+
+    // Transform changes go through their own dirty channel
+    shape->SetTransform(RadeonRays::translation(RadeonRays::float3(0.f, 0.5f, 0.f)) * shape->GetTransform());
+    ASSERT_TRUE(shape->IsTransformDirty());
+    ASSERT_FALSE(shape->IsDirty());
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    ASSERT_FALSE(shape->IsTransformDirty());
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, IntersectorShapesKeptOnUpdate)
+{
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto mesh = shape_iter->ItemAs<Baikal::Mesh>();
+
+    auto& compiled = m_controller->CompileScene(m_scene);
+    auto rr_shape = compiled.isect_shapes[compiled.shape_slots.at(mesh.get())];
+
+    // Added instance gets its own intersector shape, the existing mesh keeps its one
+    auto instance = Baikal::Instance::Create(mesh);
+    instance->SetTransform(RadeonRays::translation(RadeonRays::float3(1.f, 0.f, 0.f)));
+    m_scene->AttachShape(instance);
+
+    auto& updated = m_controller->CompileScene(m_scene);
+    ASSERT_EQ(updated.intersector_shapes.size(), 2u);
+    ASSERT_EQ(updated.isect_shapes.size(), updated.intersector_shapes.size());
+    ASSERT_EQ(updated.isect_shapes[updated.shape_slots.at(mesh.get())], rr_shape);
+
+    // New geometry needs a new one
+    std::vector<std::uint32_t> indices(mesh->GetIndices(), mesh->GetIndices() + mesh->GetNumIndices());
+    mesh->SetIndices(indices.data(), indices.size());
+
+    auto& regenerated = m_controller->CompileScene(m_scene);
+    ASSERT_NE(regenerated.intersector_shapes.at(mesh).shape, nullptr);
+    ASSERT_EQ(regenerated.intersector_shapes.at(instance).base, regenerated.intersector_shapes.at(mesh).shape);
+
+    ClearOutput();
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(regenerated));
+    }
+}
+
+TEST_F(BasicTest, DeformedMeshKeepsGeometry)
+{
+    using Stats = Baikal::SceneCompileStats;
+
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto mesh = shape_iter->ItemAs<Baikal::Mesh>();
+
+    auto instance = Baikal::Instance::Create(mesh);
+    instance->SetTransform(RadeonRays::translation(RadeonRays::float3(1.f, 0.f, 0.f)));
+    m_scene->AttachShape(instance);
+
+    auto& compiled = m_controller->CompileScene(m_scene);
+    auto revision = mesh->GetGeometryRevision();
+    auto range = compiled.geometry_ranges.at(mesh);
+
+    std::vector<RadeonRays::float3> vertices(mesh->GetVertices(), mesh->GetVertices() + mesh->GetNumVertices());
+    for (auto& v : vertices)
+    {
+        v.y += 0.1f;
+    }
+
+    ASSERT_THROW(mesh->UpdateVertices(vertices.data(), vertices.size() + 1), std::runtime_error);
+    ASSERT_NO_THROW(mesh->UpdateVertices(vertices.data(), vertices.size()));
+    ASSERT_TRUE(mesh->IsVerticesDirty());
+    ASSERT_FALSE(mesh->IsDirty());
+    ASSERT_EQ(mesh->GetGeometryRevision(), revision);
+
+    // Positions go into the same range, only the mesh and its instance get new intersector shapes
+    auto& updated = m_controller->CompileScene(m_scene);
+    auto const& stats = updated.compile_stats;
+    ASSERT_EQ(stats.step_runs[Stats::kShapeVertices], 1u);
+    ASSERT_EQ(stats.step_runs[Stats::kShapes], 0u);
+    ASSERT_FALSE(mesh->IsVerticesDirty());
+    ASSERT_EQ(updated.geometry_ranges.at(mesh).vertex_offset, range.vertex_offset);
+    ASSERT_EQ(updated.intersector_shapes.at(instance).base, updated.intersector_shapes.at(mesh).shape);
+    ASSERT_EQ(updated.isect_shapes[updated.shape_slots.at(mesh.get())], updated.intersector_shapes.at(mesh).shape);
+
+    ClearOutput();
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(updated));
+    }
+}
+
+TEST_F(BasicTest, RenderTestSceneCurves)
+{
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto mesh = shape_iter->ItemAs<Baikal::Mesh>();
+    ASSERT_NE(mesh, nullptr);
+
+    // Row of wavy B-spline strands through the middle of the scene
+    auto aabb = m_scene->GetWorldAABB();
+    auto center = 0.5f * (aabb.pmin + aabb.pmax);
+    auto extent = aabb.pmax - aabb.pmin;
+
+    std::uint32_t const num_strands = 64;
+    std::uint32_t const points_per_strand = 8;
+
+    std::vector<RadeonRays::float3> points;
+    std::vector<float> widths;
+    std::vector<std::uint32_t> segments;
+
+    for (auto i = 0u; i < num_strands; ++i)
+    {
+        auto x = center.x + extent.x * (0.5f * i / num_strands - 0.25f);
+
+        for (auto j = 0u; j < points_per_strand; ++j)
+        {
+            auto y = center.y + extent.y * (0.5f * j / points_per_strand - 0.25f);
+            points.push_back(RadeonRays::float3(x + 0.01f * extent.x * std::sin(1.f * j + i), y, center.z));
+            widths.push_back(0.005f * extent.x * (1.f - 0.5f * j / points_per_strand));
+
+            if (j + 3 < points_per_strand)
+            {
+                segments.push_back(i * points_per_strand + j);
+            }
+        }
+    }
+
+    auto curves = Baikal::Curves::Create();
+    ASSERT_THROW(curves->SetCurves(points.data(), widths.data(), points.size(), segments.data(), segments.size() + 1, Baikal::Curves::Basis::kBSpline), std::runtime_error);
+    ASSERT_NO_THROW(curves->SetCurves(points.data(), widths.data(), points.size(), segments.data(), segments.size(), Baikal::Curves::Basis::kBSpline));
+    ASSERT_EQ(curves->GetNumSegments(), segments.size());
+    curves->SetMaterial(mesh->GetMaterial());
+    m_scene->AttachShape(curves);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    // Curves keep their shape slot, but the intersector gets no shape for them
+    auto& scene = m_controller->GetCachedScene(m_scene);
+    ASSERT_EQ(scene.num_curve_shapes, 1);
+    ASSERT_EQ(scene.isect_shapes[scene.shape_slots.at(curves.get())], nullptr);
+    ASSERT_EQ(scene.intersector_shapes.count(curves), 0u);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+
+    // Curves are intersected in object space of their shape only
+    m_scene->AttachShape(Baikal::Instance::Create(curves));
+    ASSERT_THROW(m_controller->CompileScene(m_scene), std::runtime_error);
+}
+
+TEST_F(BasicTest, RenderTestSceneInstances)
+{
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto mesh = shape_iter->ItemAs<Baikal::Mesh>();
+    ASSERT_NE(mesh, nullptr);
+
+    auto num_shapes = m_scene->GetNumShapes();
+
+    // Instances share base mesh descriptor and only get compact records
+    for (auto i = 1; i <= 2; ++i)
+    {
+        auto instance = Baikal::Instance::Create(mesh);
+        instance->SetMaterial(mesh->GetMaterial());
+        instance->SetTransform(RadeonRays::translation(RadeonRays::float3(0.f, 0.5f * i, 0.f)) * mesh->GetTransform());
+        m_scene->AttachShape(instance);
+    }
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+    ASSERT_EQ(scene.num_base_shapes, static_cast<int>(num_shapes));
+    ASSERT_EQ(scene.instance_descriptors.size(), 2u);
+    ASSERT_EQ(scene.instance_transform_data.size(), 6u);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, InstanceLodSelection)
+{
+    using Stats = Baikal::SceneCompileStats;
+
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto mesh = shape_iter->ItemAs<Baikal::Mesh>();
+    ASSERT_NE(mesh, nullptr);
+
+    // Single triangle stands for the coarse level
+    RadeonRays::float3 vertices[] = { mesh->GetVertices()[0], mesh->GetVertices()[1], mesh->GetVertices()[2] };
+    RadeonRays::float3 normals[] = { RadeonRays::float3(0.f, 1.f, 0.f), RadeonRays::float3(0.f, 1.f, 0.f), RadeonRays::float3(0.f, 1.f, 0.f) };
+    RadeonRays::float2 uvs[] = { RadeonRays::float2(0.f, 0.f), RadeonRays::float2(1.f, 0.f), RadeonRays::float2(0.f, 1.f) };
+    std::uint32_t indices[] = { 0, 1, 2 };
+
+    auto coarse = Baikal::Mesh::Create();
+    coarse->SetVertices(vertices, 3);
+    coarse->SetNormals(normals, 3);
+    coarse->SetUVs(uvs, 3);
+    coarse->SetIndices(indices, 3);
+
+    auto instance = Baikal::Instance::Create(mesh);
+    instance->SetMaterial(mesh->GetMaterial());
+    instance->SetTransform(mesh->GetTransform());
+    m_scene->AttachShape(instance);
+
+    ASSERT_THROW(instance->SetLodLevels({ { mesh, 0.f }, { coarse, 1.f } }), std::runtime_error);
+
+    // Nothing gets this large on screen, so the coarse level is bound on the first compile
+    instance->SetLodLevels({ { mesh, 1e6f }, { coarse, 0.f } });
+    ASSERT_EQ(instance->GetBaseShape(), mesh);
+
+    auto& compiled = m_controller->CompileScene(m_scene);
+    ASSERT_EQ(instance->GetCurrentLod(), 1u);
+    ASSERT_EQ(instance->GetBaseShape(), coarse);
+    ASSERT_EQ(compiled.compile_stats.num_lod_switches, 1u);
+    ASSERT_EQ(compiled.geometry_ranges.count(coarse), 1u);
+
+    // Level stays, so there is nothing to rebuild
+    auto& unchanged = m_controller->CompileScene(m_scene);
+    ASSERT_EQ(unchanged.compile_stats.num_lod_switches, 0u);
+    ASSERT_EQ(unchanged.compile_stats.step_runs[Stats::kShapes], 0u);
+
+    // Any size qualifies for the finest level now, geometry of the coarse one is dropped
+    instance->SetLodLevels({ { mesh, 0.f }, { coarse, 0.f } });
+    auto& fine = m_controller->CompileScene(m_scene);
+    ASSERT_EQ(instance->GetCurrentLod(), 0u);
+    ASSERT_EQ(fine.geometry_ranges.count(coarse), 0u);
+
+    ClearOutput();
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(fine));
+    }
+}
+
+TEST_F(BasicTest, InstanceTransformUpdate)
+{
+    using Category = Baikal::ClwUploader::Category;
+    auto& uploader = dynamic_cast<Baikal::ClwSceneController&>(*m_controller).GetUploader();
+
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto mesh = shape_iter->ItemAs<Baikal::Mesh>();
+    ASSERT_NE(mesh, nullptr);
+
+    std::vector<Baikal::Instance::Ptr> instances;
+    for (auto i = 0; i < 1000; ++i)
+    {
+        auto instance = Baikal::Instance::Create(mesh);
+        instance->SetMaterial(mesh->GetMaterial());
+        instance->SetTransform(RadeonRays::translation(RadeonRays::float3(0.01f * i, 0.f, 0.f)) * mesh->GetTransform());
+        m_scene->AttachShape(instance);
+        instances.push_back(instance);
+    }
+
+    // Attaching the same instance again is ignored
+    m_scene->AttachShape(instances.front());
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    ASSERT_EQ(m_controller->GetCachedScene(m_scene).instance_descriptors.size(), instances.size());
+
+    // Moving a single instance uploads its transform rows (and its record with motion blur) only
+    instances[500]->SetTransform(RadeonRays::translation(RadeonRays::float3(0.f, 0.5f, 0.f)) * mesh->GetTransform());
+
+    uploader.ResetStats();
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto shape_bytes = uploader.GetStats(Category::kShapes).bytes;
+    ASSERT_GE(shape_bytes, 3 * sizeof(RadeonRays::float4));
+    ASSERT_LE(shape_bytes, 3 * sizeof(RadeonRays::float4) + sizeof(Baikal::ClwScene::ShapeInstance));
+
+    // Moving a mesh rewrites its descriptor only
+    mesh->SetTransform(RadeonRays::translation(RadeonRays::float3(0.f, 0.1f, 0.f)) * mesh->GetTransform());
+
+    uploader.ResetStats();
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    ASSERT_EQ(uploader.GetStats(Category::kShapes).bytes, sizeof(Baikal::ClwScene::Shape));
+}
+
+TEST_F(BasicTest, RenderTestSceneStagedUpload)
+{
+    using Category = Baikal::ClwUploader::Category;
+    auto& uploader = dynamic_cast<Baikal::ClwSceneController&>(*m_controller).GetUploader();
+
+    uploader.ResetStats();
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    ASSERT_GT(uploader.GetStats(Category::kGeometry).bytes, 0u);
+    ASSERT_GT(uploader.GetStats(Category::kShapes).bytes, 0u);
+    ASSERT_EQ(uploader.GetStats(Category::kCamera).bytes, sizeof(Baikal::ClwScene::Camera));
+
+    // Transform only update rewrites shape descriptors, but no geometry
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto shape = shape_iter->ItemAs<Baikal::Shape>();
+    shape->SetTransform(RadeonRays::translation(RadeonRays::float3(0.f, 0.5f, 0.f)) * shape->GetTransform());
+
+    uploader.ResetStats();
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    ASSERT_EQ(uploader.GetStats(Category::kGeometry).bytes, 0u);
+    ASSERT_GT(uploader.GetStats(Category::kShapes).bytes, 0u);
+
+    ClearOutput();
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneCameraRing)
+{
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+    ASSERT_EQ(scene.camera_ring.size(), 3u);
+
+    // Every camera move writes the next buffer, kernels of queued frames keep reading theirs
+    for (auto i = 0u; i < 4u; ++i)
+    {
+        auto slot = scene.camera_slot;
+
+        m_camera->SetFocusDistance(1.f + 0.1f * (i + 1));
+        ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+        ASSERT_EQ(scene.camera_slot, (slot + 1) % scene.camera_ring.size());
+        ASSERT_EQ(static_cast<cl_mem>(scene.camera), static_cast<cl_mem>(scene.camera_ring[scene.camera_slot]));
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    // Unchanged camera is not written again
+    auto slot = scene.camera_slot;
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    ASSERT_EQ(scene.camera_slot, slot);
+
+    // Restored camera renders as if it had never moved
+    m_camera->SetFocusDistance(1.f);
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    ClearOutput();
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneCheckpointResume)
+{
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations / 2; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    // Checkpoint goes through the file format
+    std::stringstream stream;
+    {
+        Baikal::RenderCheckpoint checkpoint;
+        ASSERT_NO_THROW(m_renderer->SaveCheckpoint(checkpoint));
+        ASSERT_NO_THROW(checkpoint.Write(stream));
+    }
+
+    Baikal::RenderCheckpoint checkpoint;
+    ASSERT_NO_THROW(checkpoint.Read(stream));
+    ASSERT_TRUE(checkpoint.HasEntry("output.0"));
+    ASSERT_GE(checkpoint.GetValue<std::uint32_t>("sample_index"), kNumIterations / 2);
+
+    for (auto i = 0u; i < kNumIterations / 2; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    std::vector<RadeonRays::float3> uninterrupted(kOutputWidth * kOutputHeight);
+    m_output->GetData(uninterrupted.data());
+
+    // Fresh renderer picks up where the first one was interrupted
+    std::unique_ptr<Baikal::Renderer> renderer;
+    std::unique_ptr<Baikal::Output> output;
+    ASSERT_NO_THROW(renderer = m_factory->CreateRenderer(Baikal::ClwRenderFactory::RendererType::kUnidirectionalPathTracer));
+    ASSERT_NO_THROW(output = m_factory->CreateOutput(kOutputWidth, kOutputHeight));
+    ASSERT_NO_THROW(renderer->SetOutput(Baikal::Renderer::OutputType::kColor, output.get()));
+    ASSERT_NO_THROW(renderer->LoadCheckpoint(checkpoint));
+
+    for (auto i = 0u; i < kNumIterations / 2; ++i)
+    {
+        ASSERT_NO_THROW(renderer->Render(scene));
+    }
+
+    std::vector<RadeonRays::float3> resumed(kOutputWidth * kOutputHeight);
+    output->GetData(resumed.data());
+
+    for (std::size_t i = 0; i < resumed.size(); ++i)
+    {
+        ASSERT_EQ(resumed[i].w, uninterrupted[i].w);
+        ASSERT_NEAR(resumed[i].x, uninterrupted[i].x, 1e-3f * std::max(1.f, std::fabs(uninterrupted[i].x)));
+        ASSERT_NEAR(resumed[i].y, uninterrupted[i].y, 1e-3f * std::max(1.f, std::fabs(uninterrupted[i].y)));
+        ASSERT_NEAR(resumed[i].z, uninterrupted[i].z, 1e-3f * std::max(1.f, std::fabs(uninterrupted[i].z)));
+    }
+
+    // Outputs have to match the ones the checkpoint was saved with
+    ASSERT_NO_THROW(output = m_factory->CreateOutput(kOutputWidth / 2, kOutputHeight));
+    ASSERT_NO_THROW(renderer->SetOutput(Baikal::Renderer::OutputType::kColor, output.get()));
+    ASSERT_THROW(renderer->LoadCheckpoint(checkpoint), std::runtime_error);
+
+    // Truncated data is not a checkpoint
+    auto data = stream.str();
+    std::stringstream truncated(data.substr(0, data.size() / 2));
+    Baikal::RenderCheckpoint partial;
+    ASSERT_THROW(partial.Read(truncated), std::runtime_error);
+}
+
+TEST_F(BasicTest, RenderTestSceneSerialSerialization)
+{
+    auto& controller = dynamic_cast<Baikal::ClwSceneController&>(*m_controller);
+
+    // Buffers written at offsets computed up front, up to the part the scene uses
+    auto read_serialized = [this](Baikal::ClwScene const& scene)
+    {
+        std::vector<std::vector<char>> data;
+        data.push_back(ReadBufferBytes(scene.material_attributes, scene.material_attributes.GetElementCount()));
+        data.push_back(ReadBufferBytes(scene.lights, static_cast<std::size_t>(scene.num_lights)));
+        data.push_back(ReadBufferBytes(scene.textures, scene.collected_textures.size()));
+        data.push_back(ReadBufferBytes(scene.input_map_data, scene.input_map_data.GetElementCount()));
+        return data;
+    };
+
+    controller.SetParallelSerialization(true);
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    auto parallel = read_serialized(m_controller->GetCachedScene(m_scene));
+
+    // Single threaded serialization has to produce the same scene data
+    ASSERT_NO_THROW(m_controller->EvictScene(m_scene));
+    controller.SetParallelSerialization(false);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    ASSERT_FALSE(parallel[0].empty());
+    ASSERT_TRUE(read_serialized(scene) == parallel);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneBinaryCache)
+{
+    // Scene saved to the binary cache has to render the same as the original one
+    auto file_name = m_output_path + test_name() + ".bin";
+    ASSERT_NO_THROW(Baikal::SceneIo::SaveScene(*m_scene, file_name, ""));
+
+    Baikal::Scene1::Ptr loaded_scene;
+    ASSERT_NO_THROW(loaded_scene = Baikal::SceneIo::LoadScene(file_name, ""));
+    ASSERT_EQ(loaded_scene->GetNumShapes(), m_scene->GetNumShapes());
+    ASSERT_EQ(loaded_scene->GetNumLights(), m_scene->GetNumLights());
+
+    auto shape_iter = m_scene->CreateShapeIterator();
+    auto loaded_shape_iter = loaded_scene->CreateShapeIterator();
+    for (; shape_iter->IsValid(); shape_iter->Next(), loaded_shape_iter->Next())
+    {
+        auto mesh = std::dynamic_pointer_cast<Baikal::Mesh>(shape_iter->ItemAs<Baikal::Shape>());
+        auto loaded_mesh = std::dynamic_pointer_cast<Baikal::Mesh>(loaded_shape_iter->ItemAs<Baikal::Shape>());
+        ASSERT_TRUE(mesh && loaded_mesh);
+        ASSERT_EQ(loaded_mesh->GetNumVertices(), mesh->GetNumVertices());
+        ASSERT_EQ(loaded_mesh->GetNumIndices(), mesh->GetNumIndices());
+        ASSERT_EQ(std::memcmp(loaded_mesh->GetVertices(), mesh->GetVertices(), mesh->GetNumVertices() * sizeof(RadeonRays::float3)), 0);
+        ASSERT_EQ(std::memcmp(loaded_mesh->GetIndices(), mesh->GetIndices(), mesh->GetNumIndices() * sizeof(std::uint32_t)), 0);
+    }
+
+    m_scene = loaded_scene;
+    m_scene->SetCamera(m_camera);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneGeometryCache)
+{
+    // Size the cache for the whole scene, so rendering converges to the same image
+    std::size_t num_vertices = 0;
+    std::size_t num_triangles = 0;
+    {
+        auto const& stats = m_controller->CompileScene(m_scene).compile_stats;
+        num_vertices = stats.num_vertices;
+        num_triangles = stats.num_triangles;
+    }
+
+    ASSERT_NO_THROW(m_controller = m_factory->CreateSceneController());
+    auto& controller = dynamic_cast<Baikal::ClwSceneController&>(*m_controller);
+
+    ASSERT_THROW(controller.SetGeometryCacheSize(num_vertices, 0), std::runtime_error);
+    ASSERT_NO_THROW(controller.SetGeometryCacheSize(num_vertices, 3 * num_triangles));
+    ASSERT_TRUE(controller.IsGeometryCacheEnabled());
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+    ASSERT_EQ(scene.compile_stats.num_vertices, num_vertices);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+
+        // Everything fits, so nothing is paged
+        bool residency_changed = true;
+        ASSERT_NO_THROW(residency_changed = controller.UpdateGeometryResidency(m_scene));
+        ASSERT_FALSE(residency_changed);
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneGeometryCacheEviction)
+{
+    m_scene = Baikal::SceneIo::LoadScene("sphere+plane+area.test", "");
+    m_scene->SetCamera(m_camera);
+
+    // Area light quad is the smallest mesh, sphere the largest
+    Baikal::Mesh::Ptr sphere;
+    for (auto iter = m_scene->CreateShapeIterator(); iter->IsValid(); iter->Next())
+    {
+        auto mesh = std::dynamic_pointer_cast<Baikal::Mesh>(iter->ItemAs<Baikal::Shape>());
+        if (!sphere || mesh->GetNumVertices() > sphere->GetNumVertices())
+        {
+            sphere = mesh;
+        }
+    }
+
+    // Copy of the sphere below the floor is only reached by rays from below it
+    auto hidden = Baikal::Mesh::Create();
+    hidden->SetVertices(sphere->GetVertices(), sphere->GetNumVertices());
+    hidden->SetNormals(sphere->GetNormals(), sphere->GetNumNormals());
+    hidden->SetUVs(sphere->GetUVs(), sphere->GetNumUVs());
+    hidden->SetIndices(sphere->GetIndices(), sphere->GetNumIndices());
+    hidden->SetTransform(RadeonRays::translation(RadeonRays::float3(0.f, -50.f, 0.f)) * sphere->GetTransform());
+    hidden->SetMaterial(sphere->GetMaterial());
+    m_scene->AttachShape(hidden);
+
+    ASSERT_NO_THROW(m_controller = m_factory->CreateSceneController());
+    auto& controller = dynamic_cast<Baikal::ClwSceneController&>(*m_controller);
+
+    // Either sphere fits along with the floor and the light quad, both spheres do not
+    ASSERT_NO_THROW(controller.SetGeometryCacheSize(sphere->GetNumVertices() + 8, sphere->GetNumIndices() + 12));
+
+    // Render from the view, paging meshes as rays and light samples use them,
+    // returns the number of residency changes
+    auto render_view = [&](RadeonRays::float3 const& position, RadeonRays::float3 const& at)
+    {
+        m_camera->LookAt(position, at, RadeonRays::float3(0.f, 1.f, 0.f));
+        m_controller->CompileScene(m_scene);
+
+        auto& scene = m_controller->GetCachedScene(m_scene);
+        auto num_changes = 0u;
+
+        ClearOutput();
+
+        for (auto i = 0u; i < kNumIterations; ++i)
+        {
+            m_renderer->Render(scene);
+
+            if (controller.UpdateGeometryResidency(m_scene))
+            {
+                ++num_changes;
+                ClearOutput();
+            }
+        }
+
+        return num_changes;
+    };
+
+    auto is_resident = [&](Baikal::Mesh::Ptr const& mesh)
+    {
+        auto const& ranges = m_controller->GetCachedScene(m_scene).geometry_ranges;
+        return ranges.find(mesh) != ranges.cend();
+    };
+
+    auto const above_position = RadeonRays::float3(0.f, 2.5f, -10.f);
+    auto const above_at = RadeonRays::float3(0.f, 2.5f, 0.f);
+    auto const below_position = RadeonRays::float3(0.f, -47.5f, -10.f);
+    auto const below_at = RadeonRays::float3(0.f, -47.5f, 0.f);
+
+    ASSERT_NO_THROW(render_view(above_position, above_at));
+    ASSERT_TRUE(is_resident(sphere));
+    ASSERT_FALSE(is_resident(hidden));
+
+    // Hidden sphere evicts the one above the floor, which is paged back in once it is seen again
+    auto num_changes = 0u;
+    ASSERT_NO_THROW(num_changes = render_view(below_position, below_at));
+    ASSERT_GT(num_changes, 0u);
+    ASSERT_TRUE(is_resident(hidden));
+    ASSERT_FALSE(is_resident(sphere));
+
+    ASSERT_NO_THROW(num_changes = render_view(above_position, above_at));
+    ASSERT_GT(num_changes, 0u);
+    ASSERT_TRUE(is_resident(sphere));
+    ASSERT_FALSE(is_resident(hidden));
+
+    // Lights are sampled from resident geometry, so the view converges without further paging
+    ASSERT_NO_THROW(num_changes = render_view(above_position, above_at));
+    ASSERT_EQ(num_changes, 0u);
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneTextureCache)
+{
+    ASSERT_NO_THROW(m_controller = m_factory->CreateSceneController());
+    auto& controller = dynamic_cast<Baikal::ClwSceneController&>(*m_controller);
+
+    // Size the cache for the whole scene, so rendering converges to the same image
+    ASSERT_NO_THROW(controller.SetTextureCacheSize(std::size_t(1) << 30));
+    ASSERT_TRUE(controller.IsTextureCacheEnabled());
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+
+        // Everything fits, so nothing is paged
+        bool residency_changed = true;
+        ASSERT_NO_THROW(residency_changed = controller.UpdateTextureResidency(m_scene));
+        ASSERT_FALSE(residency_changed);
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, DeviceResidentData)
+{
+    ASSERT_NO_THROW(m_controller = m_factory->CreateSceneController());
+    auto& controller = dynamic_cast<Baikal::ClwSceneController&>(*m_controller);
+
+    // Host copies to compare restored data with
+    std::vector<Baikal::Mesh::Ptr> meshes;
+    std::vector<std::vector<RadeonRays::float3>> vertices;
+    std::vector<std::vector<std::uint32_t>> indices;
+
+    for (auto iter = m_scene->CreateShapeIterator(); iter->IsValid(); iter->Next())
+    {
+        auto mesh = std::dynamic_pointer_cast<Baikal::Mesh>(iter->ItemAs<Baikal::Shape>());
+
+        if (mesh)
+        {
+            meshes.push_back(mesh);
+            vertices.emplace_back(mesh->GetVertices(), mesh->GetVertices() + mesh->GetNumVertices());
+            indices.emplace_back(mesh->GetIndices(), mesh->GetIndices() + mesh->GetNumIndices());
+        }
+    }
+
+    ASSERT_NO_THROW(controller.SetDeviceResident(true));
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+    ASSERT_NO_THROW(m_renderer->Render(scene));
+
+    // Sizes are kept, camera changes do not need the data
+    m_camera->SetFocusDistance(2.f);
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    ASSERT_NO_THROW(m_renderer->Render(scene));
+
+    for (auto i = 0u; i < meshes.size(); ++i)
+    {
+        ASSERT_EQ(meshes[i]->GetNumVertices(), vertices[i].size());
+        ASSERT_EQ(meshes[i]->GetNumIndices(), indices[i].size());
+
+        if (meshes[i]->IsDataReleased())
+        {
+            ASSERT_EQ(meshes[i]->GetVertices(), nullptr);
+        }
+    }
+
+    ASSERT_NO_THROW(controller.SetDeviceResident(false));
+
+    for (auto i = 0u; i < meshes.size(); ++i)
+    {
+        ASSERT_FALSE(meshes[i]->IsDataReleased());
+        ASSERT_TRUE(std::equal(vertices[i].begin(), vertices[i].end(), meshes[i]->GetVertices(),
+            [](RadeonRays::float3 const& a, RadeonRays::float3 const& b) { return a.x == b.x && a.y == b.y && a.z == b.z; }));
+        ASSERT_TRUE(std::equal(indices[i].begin(), indices[i].end(), meshes[i]->GetIndices()));
+    }
+
+    m_camera->SetFocusDistance(1.f);
+}
+
+TEST_F(BasicTest, MemoryBudgetFit)
+{
+    ASSERT_NO_THROW(m_controller = m_factory->CreateSceneController());
+    auto& controller = dynamic_cast<Baikal::ClwSceneController&>(*m_controller);
+    auto& renderer = GetMonteCarloRenderer();
+
+    auto estimate = controller.EstimateSceneMemory(*m_scene);
+    ASSERT_GT(estimate.geometry_bytes, 0u);
+
+    // Everything fits, nothing is changed
+    Baikal::MemoryBudget::Report report;
+    ASSERT_NO_THROW(report = Baikal::MemoryBudget(std::size_t(1) << 40).Fit(*m_scene, controller, renderer));
+    ASSERT_TRUE(report.fits);
+    ASSERT_TRUE(report.actions.empty());
+    ASSERT_EQ(report.fitted_bytes, report.requested_bytes);
+    ASSERT_FALSE(controller.IsGeometryCacheEnabled());
+
+    // Smallest work buffer and half of the geometry
+    ASSERT_FALSE(renderer.LimitWorkBufferMemory(0));
+    auto budget = renderer.GetWorkBufferMemorySize() + estimate.texture_bytes + estimate.geometry_bytes / 2;
+
+    ASSERT_NO_THROW(report = Baikal::MemoryBudget(budget).Fit(*m_scene, controller, renderer));
+    ASSERT_TRUE(report.fits);
+    ASSERT_FALSE(report.actions.empty());
+    ASSERT_LE(report.fitted_bytes, budget);
+    ASSERT_LT(report.fitted_bytes, report.requested_bytes);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+        ASSERT_NO_THROW(controller.UpdateGeometryResidency(m_scene));
+    }
+}
+
+TEST_F(BasicTest, RenderTestSceneAsyncCompile)
+{
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    ASSERT_NO_THROW(m_controller->CompileSceneAsync(m_scene));
+    ASSERT_TRUE(m_controller->IsCompilePending(m_scene));
+
+    ClearOutput();
+
+    // Old version is rendered until the shadow one is ready
+    auto swapped = false;
+    while (!swapped)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(m_controller->GetCachedScene(m_scene)));
+        ASSERT_NO_THROW(swapped = m_controller->TrySwapScene(m_scene));
+    }
+
+    ASSERT_FALSE(m_controller->IsCompilePending(m_scene));
+
+    ClearOutput();
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, AsyncCompileDropsDirtyFlagsOnSwap)
+{
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    m_camera->LookAt(
+        RadeonRays::float3(0.f, 3.f, -9.f),
+        RadeonRays::float3(0.f, 2.f, 0.f),
+        RadeonRays::float3(0.f, 1.f, 0.f));
+    m_scene->SetDirtyFlag(Baikal::Scene1::kCamera);
+
+    ASSERT_NO_THROW(m_controller->CompileSceneAsync(m_scene));
+
+    // Worker only reads the scene, flags are dropped on this thread once the shadow version is swapped in
+    auto swapped = false;
+    while (!swapped)
+    {
+        ASSERT_TRUE(m_camera->IsDirty());
+        ASSERT_NE(m_scene->GetDirtyFlags(), 0u);
+        ASSERT_NO_THROW(swapped = m_controller->TrySwapScene(m_scene));
+    }
+
+    ASSERT_FALSE(m_camera->IsDirty());
+    ASSERT_EQ(m_scene->GetDirtyFlags(), 0u);
+}
+
+TEST_F(BasicTest, AsyncCompileIntersectorDoubleBuffered)
+{
+    auto& compiled = m_controller->CompileScene(m_scene);
+    auto front = compiled.intersector;
+    ASSERT_NE(front, nullptr);
+
+    // Every background compile builds into the intersector not being rendered with
+    for (auto i = 0u; i < 2u; ++i)
+    {
+        ASSERT_NO_THROW(m_controller->CompileSceneAsync(m_scene));
+
+        auto swapped = false;
+        while (!swapped)
+        {
+            ASSERT_NO_THROW(m_renderer->Render(m_controller->GetCachedScene(m_scene)));
+            ASSERT_NO_THROW(swapped = m_controller->TrySwapScene(m_scene));
+        }
+
+        auto& scene = m_controller->GetCachedScene(m_scene);
+        ASSERT_NE(scene.intersector, front);
+        ASSERT_TRUE(scene.intersector_attached);
+        front = scene.intersector;
+
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+}
+
+TEST_F(BasicTest, RenderTestScenePersistentThreads)
+{
+    ASSERT_NO_THROW(m_renderer = m_factory->CreateRenderer(Baikal::ClwRenderFactory::RendererType::kUnidirectionalPathTracerPersistentThreads));
+    ASSERT_NO_THROW(m_renderer->SetOutput(Baikal::Renderer::OutputType::kColor, m_output.get()));
+    ASSERT_NO_THROW(m_renderer->SetRandomSeed(0));
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneAsyncShaderCompilation)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    // Generic kernels render the same image, so frames before the swap do not differ
+    estimator.SetAsyncShaderCompilation(true);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    // Generic shaders are only used until the specialized ones are ready, never after them
+    auto num_generic_iterations = 0u;
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+
+        if (estimator.IsUsingGenericShaders())
+        {
+            ASSERT_EQ(num_generic_iterations, i);
+            ++num_generic_iterations;
+        }
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+
+    // Specialized shaders take over once their compile is done
+    for (auto i = 0u; i < 1000u && estimator.IsUsingGenericShaders(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    ASSERT_FALSE(estimator.IsUsingGenericShaders());
+}
+
+TEST_F(BasicTest, RenderTestSceneMaterialSorting)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    estimator.SetMaterialSorting(true);
+    estimator.ResetShadingDivergenceStats();
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    auto stats = estimator.GetShadingDivergenceStats();
+    ASSERT_GT(stats.unsorted_segments, 0u);
+    ASSERT_GT(stats.sorted_segments, 0u);
+    ASSERT_LE(stats.sorted_segments, stats.unsorted_segments);
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneMaterialVariants)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    // Diffuse only, diffuse with reflection and catch-all variant for the rest
+    estimator.SetMaterialVariants({
+        Baikal::UberV2Material::Layers::kDiffuseLayer,
+        Baikal::UberV2Material::Layers::kDiffuseLayer | Baikal::UberV2Material::Layers::kReflectionLayer
+    });
+    estimator.SetMaterialSorting(true);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneTextureMipmaps)
+{
+    // 4x4 checker, texture data is owned by the texture
+    auto texels = new char[4 * 4 * 4];
+
+    for (auto i = 0; i < 4 * 4; ++i)
+    {
+        auto value = static_cast<char>(((i % 4 + i / 4) & 1) ? 0xFF : 0x00);
+        std::fill(texels + 4 * i, texels + 4 * i + 4, value);
+    }
+
+    auto texture = Baikal::Texture::Create(texels, RadeonRays::int3(4, 4, 1), Baikal::Texture::Format::kRgba8);
+
+    auto material = Baikal::UberV2Material::Create();
+    material->SetInputValue("uberv2.diffuse.color", Baikal::InputMap_Sampler::Create(texture));
+    material->SetLayers(Baikal::UberV2Material::Layers::kDiffuseLayer);
+
+    for (auto iter = m_scene->CreateShapeIterator(); iter->IsValid(); iter->Next())
+    {
+        iter->ItemAs<Baikal::Shape>()->SetMaterial(material);
+    }
+
+    ClearOutput();
+
+    auto& scene = m_controller->CompileScene(m_scene);
+
+    // 2x2 and 1x1 levels follow the first one, each level is 16 bytes aligned
+#ifdef BAIKAL_TEXTURE_MIPMAPS
+    ASSERT_EQ(scene.texture_slots.at(texture).size, 64u + 16u + 16u);
+#else
+    ASSERT_EQ(scene.texture_slots.at(texture).size, 64u);
+#endif
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, CompileBackgroundAfterTextureRemoval)
+{
+    auto create_texture = [](int width, int height)
+    {
+        auto texels = new char[width * height * 4];
+        std::fill(texels, texels + width * height * 4, static_cast<char>(0x80));
+        return Baikal::Texture::Create(texels, RadeonRays::int3(width, height, 1), Baikal::Texture::Format::kRgba8);
+    };
+
+    // Material textures are collected before the image based light and the background
+    auto texture = create_texture(4, 4);
+    auto background = create_texture(8, 2);
+
+    auto textured = Baikal::UberV2Material::Create();
+    textured->SetInputValue("uberv2.diffuse.color", Baikal::InputMap_Sampler::Create(texture));
+    textured->SetLayers(Baikal::UberV2Material::Layers::kDiffuseLayer);
+
+    for (auto iter = m_scene->CreateShapeIterator(); iter->IsValid(); iter->Next())
+    {
+        iter->ItemAs<Baikal::Shape>()->SetMaterial(textured);
+    }
+
+    m_scene->SetBackgroundImage(background);
+
+    auto check_background = [this](Baikal::ClwScene const& scene)
+    {
+        ASSERT_GE(scene.background_idx, 0);
+
+        Baikal::ClwScene::Texture header;
+        m_context.ReadBuffer(0, scene.textures, &header, scene.background_idx, 1).Wait();
+        ASSERT_EQ(header.w, 8);
+        ASSERT_EQ(header.h, 2);
+    };
+
+    auto& compiled = m_controller->CompileScene(m_scene);
+    ASSERT_NO_FATAL_FAILURE(check_background(compiled));
+
+    // Removing the material texture moves the last texture into its index
+    auto plain = Baikal::UberV2Material::Create();
+    plain->SetInputValue("uberv2.diffuse.color", Baikal::InputMap_ConstantFloat3::Create(RadeonRays::float3(0.5f, 0.5f, 0.5f)));
+    plain->SetLayers(Baikal::UberV2Material::Layers::kDiffuseLayer);
+
+    for (auto iter = m_scene->CreateShapeIterator(); iter->IsValid(); iter->Next())
+    {
+        iter->ItemAs<Baikal::Shape>()->SetMaterial(plain);
+    }
+
+    auto& updated = m_controller->CompileScene(m_scene);
+    ASSERT_EQ(updated.texture_slots.count(texture), 0u);
+    ASSERT_NO_FATAL_FAILURE(check_background(updated));
+
+    ClearOutput();
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(updated));
+    }
+}
+
+TEST_F(BasicTest, RenderTestSceneRaySorting)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    // Sort after every bounce
+    estimator.SetRaySortingMask(0xffffffffu);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, EstimatorWorkBufferMemory)
+{
+    auto& renderer = GetMonteCarloRenderer();
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(renderer.GetEstimator());
+
+    ASSERT_NO_THROW(renderer.SetTileSize(RadeonRays::int2(256, 256)));
+
+    std::size_t const size = 256 * 256;
+    auto memory = estimator.GetWorkBufferMemory();
+
+    ASSERT_EQ(memory.rays, 2 * size * sizeof(RadeonRays::ray));
+    ASSERT_EQ(memory.intersections, size * sizeof(RadeonRays::Intersection));
+    ASSERT_EQ(memory.shadow_rays, size * (sizeof(RadeonRays::ray) + sizeof(int) + sizeof(RadeonRays::float3)));
+    // Sorting and transmission scratch share memory with other buffers
+    ASSERT_EQ(memory.indices, 10 * size * sizeof(int));
+    ASSERT_LE(memory.GetTotal(), renderer.GetWorkBufferMemorySize());
+}
+
+TEST_F(BasicTest, RenderProfiling)
+{
+    auto& renderer = GetMonteCarloRenderer();
+    auto& profiler = renderer.GetProfiler();
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    renderer.SetProfiling(true);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    ASSERT_NO_THROW(profiler.Resolve(true));
+
+    auto find_entry = [&profiler](char const* name, std::uint32_t pass) -> Baikal::ClwProfiler::Entry const*
+    {
+        for (auto const& entry : profiler.GetEntries())
+        {
+            if (entry.pass == pass && entry.name == name)
+            {
+                return &entry;
+            }
+        }
+
+        return nullptr;
+    };
+
+    // Primary rays cover the output once per iteration
+    auto rays = find_entry("rays", 0);
+    ASSERT_NE(rays, nullptr);
+    ASSERT_EQ(rays->num_counts, kNumIterations);
+    ASSERT_EQ(rays->count, static_cast<std::uint64_t>(kNumIterations) * kOutputWidth * kOutputHeight);
+
+    auto alive = find_entry("alive", 0);
+    ASSERT_NE(alive, nullptr);
+    ASSERT_LE(alive->count, rays->count);
+
+    if (profiler.IsTimingSupported())
+    {
+        auto intersect = find_entry("intersect", 0);
+        ASSERT_NE(intersect, nullptr);
+        ASSERT_EQ(intersect->num_spans, kNumIterations);
+        ASSERT_GE(intersect->milliseconds, 0.0);
+    }
+
+    // Disabled profiler does not record anything
+    renderer.SetProfiling(false);
+    ASSERT_NO_THROW(m_renderer->Render(scene));
+    ASSERT_EQ(rays->num_counts, kNumIterations);
+}
+
+TEST_F(BasicTest, RenderTestSceneBidirectional)
+{
+    ASSERT_NO_THROW(m_renderer = m_factory->CreateRenderer(Baikal::ClwRenderFactory::RendererType::kBidirectionalPathTracer));
+    ASSERT_NO_THROW(m_renderer->SetOutput(Baikal::Renderer::OutputType::kColor, m_output.get()));
+    ASSERT_NO_THROW(m_renderer->SetRandomSeed(0));
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestScenePhotonMap)
+{
+    ASSERT_NO_THROW(m_renderer = m_factory->CreateRenderer(Baikal::ClwRenderFactory::RendererType::kPhotonMappedPathTracer));
+    ASSERT_NO_THROW(m_renderer->SetOutput(Baikal::Renderer::OutputType::kColor, m_output.get()));
+    ASSERT_NO_THROW(m_renderer->SetRandomSeed(0));
+
+    ClearOutput();
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        // Unchanged scene keeps its revision, so the photon map is traced once
+        ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+        auto& scene = m_controller->GetCachedScene(m_scene);
+
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneAmbientOcclusion)
+{
+    ASSERT_NO_THROW(m_renderer = m_factory->CreateRenderer(Baikal::ClwRenderFactory::RendererType::kAmbientOcclusion));
+    ASSERT_NO_THROW(m_renderer->SetOutput(Baikal::Renderer::OutputType::kColor, m_output.get()));
+    ASSERT_NO_THROW(m_renderer->SetRandomSeed(0));
+
+    auto& estimator = dynamic_cast<Baikal::AoEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+    estimator.SetNumAoRays(2);
+    ASSERT_EQ(estimator.GetNumAoRays(), 2u);
+    ASSERT_THROW(estimator.SetAoRadius(-1.f), std::runtime_error);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    // Every pixel has all of its samples, misses show the environment light
+    std::vector<RadeonRays::float3> data(m_output->width() * m_output->height());
+    m_output->GetData(data.data());
+
+    ASSERT_GT(data[0].w, 0.f);
+
+    for (auto const& value : data)
+    {
+        ASSERT_FLOAT_EQ(value.w, data[0].w);
+        ASSERT_GE(value.x, 0.f);
+        ASSERT_GE(value.y, 0.f);
+        ASSERT_GE(value.z, 0.f);
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneAdaptiveConvergence)
+{
+    ASSERT_NO_THROW(m_renderer = m_factory->CreateRenderer(Baikal::ClwRenderFactory::RendererType::kAdaptivePathTracer));
+    ASSERT_NO_THROW(m_renderer->SetOutput(Baikal::Renderer::OutputType::kColor, m_output.get()));
+    ASSERT_NO_THROW(m_renderer->SetRandomSeed(0));
+
+    auto& renderer = dynamic_cast<Baikal::AdaptiveRenderer&>(GetMonteCarloRenderer());
+    ASSERT_THROW(renderer.SetConvergenceThreshold(-1.f), std::runtime_error);
+    ASSERT_EQ(renderer.GetUnconvergedFraction(), -1.f);
+
+    auto num_pixels = m_output->width() * m_output->height();
+    auto read_mask = [&]()
+    {
+        std::vector<int> mask(num_pixels);
+        m_context.ReadBuffer(0, renderer.GetConvergenceMask(), mask.data(), num_pixels).Wait();
+        return mask;
+    };
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    // The mask is refreshed along with the variance after 32 samples, lit pixels are far from such a threshold
+    renderer.SetConvergenceThreshold(1e-6f);
+    renderer.SetMinSamplesPerPixel(16u);
+    ClearOutput();
+
+    for (auto i = 0u; i <= kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    auto mask = read_mask();
+    auto num_unconverged = std::count(mask.cbegin(), mask.cend(), 0);
+    ASSERT_FALSE(renderer.IsConverged());
+    ASSERT_GT(num_unconverged, 0);
+    ASSERT_FLOAT_EQ(renderer.GetUnconvergedFraction(), static_cast<float>(num_unconverged) / num_pixels);
+
+    // Every pixel with its minimum samples passes this one
+    renderer.SetConvergenceThreshold(100.f);
+    ClearOutput();
+    ASSERT_EQ(read_mask(), std::vector<int>(num_pixels, 0));
+
+    for (auto i = 0u; i <= kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    ASSERT_TRUE(renderer.IsConverged());
+    ASSERT_EQ(renderer.GetUnconvergedFraction(), 0.f);
+    ASSERT_EQ(read_mask(), std::vector<int>(num_pixels, 1));
+
+    // Converged output does not take any more samples
+    std::vector<RadeonRays::float3> before(num_pixels);
+    std::vector<RadeonRays::float3> after(num_pixels);
+    m_output->GetData(before.data());
+    ASSERT_NO_THROW(m_renderer->Render(scene));
+    m_output->GetData(after.data());
+
+    for (auto i = 0u; i < num_pixels; ++i)
+    {
+        ASSERT_EQ(after[i].w, before[i].w);
+    }
+
+    // Clearing starts over
+    ClearOutput();
+    ASSERT_FALSE(renderer.IsConverged());
+    ASSERT_EQ(read_mask(), std::vector<int>(num_pixels, 0));
+}
+
+TEST_F(BasicTest, RenderTestSceneAdaptiveTileDistribution)
+{
+    ASSERT_NO_THROW(m_renderer = m_factory->CreateRenderer(Baikal::ClwRenderFactory::RendererType::kAdaptivePathTracer));
+    ASSERT_NO_THROW(m_renderer->SetOutput(Baikal::Renderer::OutputType::kColor, m_output.get()));
+    ASSERT_NO_THROW(m_renderer->SetRandomSeed(0));
+
+    auto& renderer = dynamic_cast<Baikal::AdaptiveRenderer&>(GetMonteCarloRenderer());
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    // Distribution is rebuilt from the variance after 32 samples
+    for (auto i = 0u; i <= kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    auto num_tiles = static_cast<std::uint32_t>(renderer.GetVarianceBuffer().GetElementCount());
+    std::vector<float> variance(num_tiles);
+    m_context.ReadBuffer(0, renderer.GetVarianceBuffer(), variance.data(), num_tiles).Wait();
+    ASSERT_GT(std::accumulate(variance.cbegin(), variance.cend(), 0.f), 0.f);
+
+    // Segment count, CDF, PDF, alias probabilities and aliases
+    std::vector<int> distribution(1 + (num_tiles + 1) + 3 * num_tiles);
+    m_context.ReadBuffer(0, renderer.GetTileDistributionBuffer(), distribution.data(), distribution.size()).Wait();
+    ASSERT_EQ(distribution[0], static_cast<int>(num_tiles));
+
+    auto cdf = reinterpret_cast<float const*>(&distribution[1]);
+    auto pdf = cdf + num_tiles + 1;
+    auto alias_probabilities = pdf + num_tiles;
+    auto aliases = reinterpret_cast<int const*>(alias_probabilities + num_tiles);
+
+    // Device has to build what the host does from the same values
+    Baikal::Distribution1D expected(variance.data(), num_tiles);
+    for (auto i = 0u; i <= num_tiles; ++i)
+    {
+        ASSERT_NEAR(cdf[i], expected.m_cdf[i], 1e-4f);
+    }
+
+    // Alias table keeps the mass of every tile
+    std::vector<float> mass(num_tiles, 0.f);
+    for (auto i = 0u; i < num_tiles; ++i)
+    {
+        ASSERT_NEAR(pdf[i], expected.m_func_values[i] / expected.m_func_sum, 1e-3f);
+        ASSERT_GE(aliases[i], 0);
+        ASSERT_LT(aliases[i], static_cast<int>(num_tiles));
+
+        mass[i] += alias_probabilities[i];
+        mass[aliases[i]] += 1.f - alias_probabilities[i];
+    }
+
+    for (auto i = 0u; i < num_tiles; ++i)
+    {
+        ASSERT_NEAR(mass[i], pdf[i], 1e-3f);
+    }
+}
+
+TEST_F(BasicTest, RenderTestSceneRussianRoulette)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    // Long paths terminated early by roulette
+    estimator.SetMaxBounces(16);
+    estimator.SetRussianRouletteMinBounce(1);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestScenePathRegeneration)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    ASSERT_THROW(estimator.SetPathRegeneration(1.f), std::runtime_error);
+    ASSERT_THROW(estimator.SetPathRegeneration(-0.5f), std::runtime_error);
+
+    // Paths terminated by roulette leave their slots to the next samples
+    estimator.SetRussianRouletteMinBounce(1);
+    ASSERT_NO_THROW(estimator.SetPathRegeneration(0.5f));
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestScenePrimaryHitCache)
+{
+    auto& renderer = GetMonteCarloRenderer();
+
+    renderer.SetPrimaryHitCache(4);
+    ASSERT_EQ(renderer.GetPrimaryHitCache(), 4u);
+
+    // Patterns traced from another view have to be dropped once the camera moves back
+    m_camera->LookAt(
+        RadeonRays::float3(0.f, 1.f, 4.f),
+        RadeonRays::float3(0.f, 1.f, 0.f),
+        RadeonRays::float3(0.f, 1.f, 0.f));
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    for (auto i = 0u; i < 8u; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(m_controller->GetCachedScene(m_scene)));
+    }
+
+    m_camera->LookAt(
+        RadeonRays::float3(0.f, 0.f, -6.f),
+        RadeonRays::float3(0.f, 0.f, 0.f),
+        RadeonRays::float3(0.f, 1.f, 0.f));
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    // Every pattern is used several times
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+
+    // Samples [0, 4) into a cleared output, four frames take the four patterns in turn
+    auto num_pixels = kOutputWidth * kOutputHeight;
+    auto render_range = [&](std::vector<RadeonRays::float3>& data)
+    {
+        ClearOutput();
+        m_renderer->SetSampleIndex(0u);
+
+        for (auto i = 0u; i < 4u; ++i)
+        {
+            m_renderer->Render(scene);
+        }
+
+        data.resize(num_pixels);
+        m_output->GetData(data.data());
+    };
+
+    std::vector<RadeonRays::float3> uncached, traced, cached;
+
+    ASSERT_NO_THROW(renderer.SetPrimaryHitCache(0));
+    ASSERT_NO_THROW(render_range(uncached));
+
+    // First range traces and stores the patterns, the second one takes rays and hits from the cache
+    ASSERT_NO_THROW(renderer.SetPrimaryHitCache(4));
+    ASSERT_NO_THROW(render_range(traced));
+    ASSERT_NO_THROW(render_range(cached));
+
+    ASSERT_EQ(std::memcmp(uncached.data(), traced.data(), num_pixels * sizeof(RadeonRays::float3)), 0);
+
+    for (auto i = 0u; i < num_pixels; ++i)
+    {
+        ASSERT_FLOAT_EQ(cached[i].w, uncached[i].w);
+        ASSERT_NEAR(cached[i].x, uncached[i].x, 1e-4f * std::max(1.f, std::fabs(uncached[i].x)));
+        ASSERT_NEAR(cached[i].y, uncached[i].y, 1e-4f * std::max(1.f, std::fabs(uncached[i].y)));
+        ASSERT_NEAR(cached[i].z, uncached[i].z, 1e-4f * std::max(1.f, std::fabs(uncached[i].z)));
+    }
+
+    ASSERT_NO_THROW(renderer.SetPrimaryHitCache(0));
+}
+
+TEST_F(BasicTest, RenderTestSceneShadowRayCulling)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    ASSERT_THROW(estimator.SetShadowRayCulling(-1.f), std::runtime_error);
+    ASSERT_THROW(estimator.SetShadowRayCulling(std::numeric_limits<float>::quiet_NaN()), std::runtime_error);
+
+    // Dim samples of several lights per vertex are rouletted before the occlusion query
+    estimator.SetLightSamplesPerVertex(4);
+    ASSERT_NO_THROW(estimator.SetShadowRayCulling(0.1f));
+    ASSERT_EQ(estimator.GetShadowRayCulling(), 0.1f);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneLightResampling)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    // Every frame reuses the reservoirs of the previous one
+    estimator.SetLightResampling(true);
+    ASSERT_TRUE(estimator.GetLightResampling());
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneInFlightBatches)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    ASSERT_THROW(estimator.SetInFlightBatches(0u), std::runtime_error);
+    ASSERT_EQ(estimator.GetInFlightBatches(), 1u);
+
+    auto memory = estimator.GetWorkBufferMemory();
+
+    // Rays of one half are traced while the other half is shaded
+    ASSERT_NO_THROW(estimator.SetInFlightBatches(2u));
+    ASSERT_EQ(estimator.GetInFlightBatches(), 2u);
+
+    // Batches hold the work buffers of their half
+    ASSERT_GT(estimator.GetWorkBufferMemory().rays, memory.rays);
+    ASSERT_LE(estimator.GetWorkBufferMemory().GetTotal(), GetMonteCarloRenderer().GetWorkBufferMemorySize());
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestScenePathGuiding)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    ASSERT_THROW(estimator.SetPathGuidingMemoryBudget(0u), std::runtime_error);
+    ASSERT_NO_THROW(estimator.SetPathGuidingMemoryBudget(4u * 1024u * 1024u));
+    estimator.SetPathGuiding(true);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneRadianceCache)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    ASSERT_THROW(estimator.SetRadianceCacheCellSize(-1.f), std::runtime_error);
+    ASSERT_NO_THROW(estimator.SetRadianceCacheCellSize(0.f));
+    estimator.SetRadianceCache(true);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneStochasticLayerSelection)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    estimator.SetStochasticLayerSelection(true);
+    ASSERT_TRUE(estimator.GetStochasticLayerSelection());
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneEnergyCompensation)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    // Compensated weights are used for layer selection too
+    estimator.SetEnergyCompensation(true);
+    estimator.SetStochasticLayerSelection(true);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneSubsurfaceDiffusion)
+{
+    auto material = Baikal::UberV2Material::Create();
+    material->SetLayers(Baikal::UberV2Material::Layers::kDiffuseLayer | Baikal::UberV2Material::Layers::kSSSLayer);
+    material->SetInputValue("uberv2.sss.scatter_color", Baikal::InputMap_ConstantFloat3::Create(RadeonRays::float3(0.9f, 0.6f, 0.4f)));
+    material->SetInputValue("uberv2.sss.scatter_distance", Baikal::InputMap_ConstantFloat::Create(0.05f));
+    material->SetSSSMode(Baikal::UberV2Material::kSSSDiffusion);
+
+    for (auto iter = m_scene->CreateShapeIterator(); iter->IsValid(); iter->Next())
+    {
+        iter->ItemAs<Baikal::Shape>()->SetMaterial(material);
+    }
+
+    ClearOutput();
+
+    auto& scene = m_controller->CompileScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestScenePixelFilter)
+{
+    auto& renderer = GetMonteCarloRenderer();
+
+    ASSERT_THROW(renderer.SetPixelFilter(Baikal::MonteCarloRenderer::PixelFilter::kGaussian, 0.f), std::runtime_error);
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto filter : { Baikal::MonteCarloRenderer::PixelFilter::kGaussian, Baikal::MonteCarloRenderer::PixelFilter::kBlackmanHarris })
+    {
+        ASSERT_NO_THROW(renderer.SetPixelFilter(filter));
+        ClearOutput();
+
+        for (auto i = 0u; i < kNumIterations; ++i)
+        {
+            ASSERT_NO_THROW(m_renderer->Render(scene));
+        }
+
+        std::ostringstream oss;
+        oss << test_name() << "_" << static_cast<int>(filter) << ".png";
+        SaveOutput(oss.str());
+        ASSERT_TRUE(CompareToReference(oss.str()));
+    }
+
+    renderer.SetPixelFilter(Baikal::MonteCarloRenderer::PixelFilter::kBox);
+}
+
+TEST_F(BasicTest, RenderTestSceneMotionBlur)
+{
+    auto shape_iter = m_scene->CreateShapeIterator();
+    ASSERT_TRUE(shape_iter->IsValid());
+    auto shape = shape_iter->ItemAs<Baikal::Shape>();
+
+    // Static shapes report their transform at shutter close
+    ASSERT_FALSE(shape->HasMotion());
+    ASSERT_EQ(shape->GetMotionTransform().m03, shape->GetTransform().m03);
+
+    // Shape moves and spins while the camera slides sideways
+    shape->SetMotionTransform(RadeonRays::translation(RadeonRays::float3(0.5f, 0.f, 0.f)) *
+        RadeonRays::rotation_y(0.5f) * shape->GetTransform());
+    ASSERT_TRUE(shape->HasMotion());
+
+    m_camera->SetMotionLookAt(
+        RadeonRays::float3(0.2f, 0.f, -6.f),
+        RadeonRays::float3(0.2f, 0.f, 0.f),
+        RadeonRays::float3(0.f, 1.f, 0.f));
+    ASSERT_TRUE(m_camera->HasMotion());
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+
+    shape->ClearMotionTransform();
+    m_camera->ClearMotion();
+}
+
+TEST_F(BasicTest, RenderTestSceneReadOutputAsync)
+{
+    auto& renderer = GetMonteCarloRenderer();
+
+    ClearOutput();
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    Baikal::ClwReadback readback(m_context);
+    auto width = static_cast<int>(m_output->width());
+    auto height = static_cast<int>(m_output->height());
+
+    ASSERT_THROW(renderer.ReadOutputAsync(*m_output, RadeonRays::int2(width / 2, 0), RadeonRays::int2(width, height),
+        Baikal::MonteCarloRenderer::ReadbackFormat::kRGBA32F, readback), std::runtime_error);
+
+    // Lower half of the image resolved on the device should match blocking read
+    auto region_origin = RadeonRays::int2(0, height / 2);
+    auto region_size = RadeonRays::int2(width, height - height / 2);
+    ASSERT_NO_THROW(renderer.ReadOutputAsync(*m_output, region_origin, region_size,
+        Baikal::MonteCarloRenderer::ReadbackFormat::kRGBA32F, readback));
+
+    std::vector<RadeonRays::float3> data(width * height);
+    m_output->GetData(data.data());
+
+    readback.Wait();
+    ASSERT_TRUE(readback.IsReady());
+    ASSERT_EQ(readback.GetSize(), region_size.x * region_size.y * 4 * sizeof(float));
+
+    auto resolved = static_cast<float const*>(readback.GetData());
+    for (auto i = 0; i < region_size.x * region_size.y; ++i)
+    {
+        auto value = data[(region_origin.y + i / width) * width + i % width];
+        ASSERT_NEAR(resolved[4 * i], value.x / value.w, 1e-4f * std::max(1.f, value.x / value.w));
+    }
+
+    ASSERT_NO_THROW(renderer.ReadOutputAsync(*m_output, RadeonRays::int2(0, 0), RadeonRays::int2(width, height),
+        Baikal::MonteCarloRenderer::ReadbackFormat::kRGBA8, readback));
+    readback.Wait();
+    ASSERT_EQ(readback.GetSize(), width * height * 4);
+}
+
+TEST_F(BasicTest, RenderTestSceneTonemapper)
+{
+    ClearOutput();
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    auto tonemapper = m_factory->CreatePostEffect(Baikal::RenderFactory<Baikal::ClwScene>::PostEffectType::kTonemapper);
+    auto output_ldr = m_factory->CreateOutput(m_output->width(), m_output->height(), Baikal::Output::Format::kRGBA8);
+
+    ASSERT_THROW(m_renderer->SetOutput(Baikal::Renderer::OutputType::kAlbedo, output_ldr.get()), std::runtime_error);
+
+    Baikal::PostEffect::InputSet input_set;
+    input_set[Baikal::Renderer::OutputType::kColor] = m_output.get();
+
+    // Plain gamma without dithering should match host conversion
+    tonemapper->SetParameter("gamma", 2.2f);
+    tonemapper->SetParameter("dither", 0.f);
+    ASSERT_NO_THROW(tonemapper->Apply(input_set, *output_ldr));
+
+    std::vector<unsigned char> ldr(4 * m_output->width() * m_output->height());
+    static_cast<Baikal::ClwOutput*>(output_ldr.get())->GetRawData(ldr.data());
+
+    std::vector<RadeonRays::float3> data(m_output->width() * m_output->height());
+    m_output->GetData(data.data());
+
+    for (std::size_t i = 0; i < data.size(); ++i)
+    {
+        auto value = data[i].w > 0.f ? data[i].x / data[i].w : 0.f;
+        auto expected = std::min(std::max(std::pow(value, 1.f / 2.2f), 0.f), 1.f) * 255.f;
+        ASSERT_NEAR(static_cast<float>(ldr[4 * i]), expected, 1.f);
+    }
+
+    for (auto tonemap_operator : { 1, 2, 3 })
+    {
+        tonemapper->SetParameter("operator", static_cast<float>(tonemap_operator));
+        tonemapper->SetParameter("gamma", 0.f);
+        tonemapper->SetParameter("dither", 1.f);
+        ASSERT_NO_THROW(tonemapper->Apply(input_set, *output_ldr));
+
+        std::ostringstream oss;
+        oss << test_name() << "_" << tonemap_operator << ".png";
+        SaveOutput(oss.str(), output_ldr.get());
+        ASSERT_TRUE(CompareToReference(oss.str()));
+    }
+}
+
+TEST_F(BasicTest, RenderTestSceneTemporalAccumulation)
+{
+    auto accumulator_effect = m_factory->CreatePostEffect(Baikal::RenderFactory<Baikal::ClwScene>::PostEffectType::kTemporalAccumulator);
+    auto accumulator = dynamic_cast<Baikal::TemporalAccumulator*>(accumulator_effect.get());
+    ASSERT_NE(accumulator, nullptr);
+
+    auto output_depth = m_factory->CreateOutput(m_output->width(), m_output->height());
+    auto output_mesh_id = m_factory->CreateOutput(m_output->width(), m_output->height());
+    auto output_accumulated = m_factory->CreateOutput(m_output->width(), m_output->height());
+
+    m_renderer->SetOutput(Baikal::Renderer::OutputType::kDepth, output_depth.get());
+    m_renderer->SetOutput(Baikal::Renderer::OutputType::kMeshID, output_mesh_id.get());
+
+    Baikal::PostEffect::InputSet input_set;
+    input_set[Baikal::Renderer::OutputType::kColor] = m_output.get();
+    ASSERT_THROW(accumulator->Apply(input_set, *output_accumulated), std::runtime_error);
+
+    input_set[Baikal::Renderer::OutputType::kDepth] = output_depth.get();
+    input_set[Baikal::Renderer::OutputType::kMeshID] = output_mesh_id.get();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    ClearOutput(output_depth.get());
+    m_renderer->Clear(RadeonRays::float3(), *output_mesh_id);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    // Without history the output is the resolved renderer output
+    accumulator->Update(m_camera.get());
+    ASSERT_NO_THROW(accumulator->Apply(input_set, *output_accumulated));
+
+    {
+        std::vector<RadeonRays::float3> color(m_output->width() * m_output->height());
+        std::vector<RadeonRays::float3> accumulated(m_output->width() * m_output->height());
+        m_output->GetData(color.data());
+        output_accumulated->GetData(accumulated.data());
+
+        for (std::size_t i = 0; i < color.size(); ++i)
+        {
+            auto expected = color[i].w > 0.f ? color[i].x / color[i].w : 0.f;
+            ASSERT_NEAR(accumulated[i].x, expected, 1e-4f);
+        }
+    }
+
+    // Small camera move restarts the renderer, history is reprojected
+    m_camera->LookAt(
+        RadeonRays::float3(0.2f, 0.f, -6.f),
+        RadeonRays::float3(0.f, 0.f, 0.f),
+        RadeonRays::float3(0.f, 1.f, 0.f));
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    ClearOutput(output_depth.get());
+    m_renderer->Clear(RadeonRays::float3(), *output_mesh_id);
+
+    ASSERT_NO_THROW(m_renderer->Render(m_controller->GetCachedScene(m_scene)));
+
+    accumulator->Update(m_camera.get());
+    ASSERT_NO_THROW(accumulator->Apply(input_set, *output_accumulated));
+
+    std::ostringstream oss;
+    oss << test_name() << ".png";
+    SaveOutput(oss.str(), output_accumulated.get());
+    ASSERT_TRUE(CompareToReference(oss.str()));
+}
+
+TEST_F(BasicTest, RenderTestSceneUpsampler)
+{
+    auto upsampler = m_factory->CreatePostEffect(Baikal::RenderFactory<Baikal::ClwScene>::PostEffectType::kUpsampler);
+
+    auto width = m_output->width() / 2;
+    auto height = m_output->height() / 2;
+    auto output_color = m_factory->CreateOutput(width, height);
+    auto output_depth = m_factory->CreateOutput(width, height);
+    auto output_normal = m_factory->CreateOutput(width, height);
+    auto output_resolved = m_factory->CreateOutput(width, height);
+    auto output_upsampled = m_factory->CreateOutput(m_output->width(), m_output->height());
+
+    // Reduced resolution render, as while the camera moves
+    m_renderer->SetOutput(Baikal::Renderer::OutputType::kColor, output_color.get());
+    m_renderer->SetOutput(Baikal::Renderer::OutputType::kDepth, output_depth.get());
+    m_renderer->SetOutput(Baikal::Renderer::OutputType::kWorldShadingNormal, output_normal.get());
+
+    Baikal::PostEffect::InputSet input_set;
+    input_set[Baikal::Renderer::OutputType::kColor] = output_color.get();
+    ASSERT_THROW(upsampler->Apply(input_set, *output_upsampled), std::runtime_error);
+
+    input_set[Baikal::Renderer::OutputType::kDepth] = output_depth.get();
+    input_set[Baikal::Renderer::OutputType::kWorldShadingNormal] = output_normal.get();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    m_renderer->Clear(RadeonRays::float3(), *output_color);
+    m_renderer->Clear(RadeonRays::float3(), *output_depth);
+    m_renderer->Clear(RadeonRays::float3(), *output_normal);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    // Same resolution only resolves the color
+    ASSERT_NO_THROW(upsampler->Apply(input_set, *output_resolved));
+
+    {
+        std::vector<RadeonRays::float3> color(width * height);
+        std::vector<RadeonRays::float3> resolved(width * height);
+        output_color->GetData(color.data());
+        output_resolved->GetData(resolved.data());
+
+        for (std::size_t i = 0; i < color.size(); ++i)
+        {
+            auto expected = color[i].w > 0.f ? color[i].x / color[i].w : 0.f;
+            ASSERT_NEAR(resolved[i].x, expected, 1e-4f);
+        }
+    }
+
+    ASSERT_NO_THROW(upsampler->Apply(input_set, *output_upsampled));
+
+    std::ostringstream oss;
+    oss << test_name() << ".png";
+    SaveOutput(oss.str(), output_upsampled.get());
+    ASSERT_TRUE(CompareToReference(oss.str()));
+}
+
+TEST_F(BasicTest, PickShape)
+{
+    auto output_shape_id = m_factory->CreateOutput(m_output->width(), m_output->height());
+    m_renderer->SetOutput(Baikal::Renderer::OutputType::kShapeId, output_shape_id.get());
+
+    ClearOutput(output_shape_id.get());
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    auto& scene = m_controller->GetCachedScene(m_scene);
+    ASSERT_NO_THROW(m_renderer->Render(scene));
+
+    std::vector<RadeonRays::float3> shape_ids(m_output->width() * m_output->height());
+    output_shape_id->GetData(shape_ids.data());
+
+    auto renderer = static_cast<Baikal::MonteCarloRenderer*>(m_renderer.get());
+    ASSERT_THROW(renderer->Pick(scene, RadeonRays::int2(m_output->width(), 0)), std::runtime_error);
+
+    // Picked shapes match the shape id output along the center row
+    auto y = static_cast<int>(m_output->height() / 2);
+    auto num_hits = 0u;
+
+    for (auto x = 0; x < static_cast<int>(m_output->width()); ++x)
+    {
+        auto hit = renderer->Pick(scene, RadeonRays::int2(x, y));
+        ASSERT_EQ(hit.shape_id, static_cast<int>(shape_ids[y * m_output->width() + x].x));
+
+        if (hit.shape_id >= 0)
+        {
+            ASSERT_GT(hit.distance, 0.f);
+            ++num_hits;
+        }
+    }
+
+    ASSERT_GT(num_hits, 0u);
+}
+
+TEST_F(BasicTest, RenderTestSceneWaveletDenoiserHalfResolution)
+{
+    auto denoiser_effect = m_factory->CreatePostEffect(Baikal::RenderFactory<Baikal::ClwScene>::PostEffectType::kWaveletDenoiser);
+    auto denoiser = dynamic_cast<Baikal::WaveletDenoiser*>(denoiser_effect.get());
+    ASSERT_NE(denoiser, nullptr);
+
+    auto width = m_output->width();
+    auto height = m_output->height();
+
+    std::map<Baikal::Renderer::OutputType, std::unique_ptr<Baikal::Output>> aovs;
+    Baikal::PostEffect::InputSet input_set;
+    input_set[Baikal::Renderer::OutputType::kColor] = m_output.get();
+
+    for (auto type : { Baikal::Renderer::OutputType::kAlbedo, Baikal::Renderer::OutputType::kWorldShadingNormal,
+        Baikal::Renderer::OutputType::kWorldPosition, Baikal::Renderer::OutputType::kMeshID })
+    {
+        aovs[type] = m_factory->CreateOutput(width, height);
+        m_renderer->SetOutput(type, aovs[type].get());
+        ClearOutput(aovs[type].get());
+        input_set[type] = aovs[type].get();
+    }
+
+    auto output_denoised = m_factory->CreateOutput(width, height);
+
+    ClearOutput();
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    denoiser->Update(m_camera.get());
+    denoiser->SetParameter("half_resolution", RadeonRays::float4(1.f, 0.f, 0.f, 0.f));
+    ASSERT_NO_THROW(denoiser->Apply(input_set, *output_denoised));
+
+    // Every full resolution pixel gets an upsampled value
+    std::vector<RadeonRays::float3> data(width * height);
+    output_denoised->GetData(data.data());
+
+    for (auto const& value : data)
+    {
+        ASSERT_EQ(value.w, 1.f);
+        ASSERT_TRUE(std::isfinite(value.x) && std::isfinite(value.y) && std::isfinite(value.z));
+    }
+
+    for (auto const& aov : aovs)
+    {
+        m_renderer->SetOutput(aov.first, nullptr);
+    }
+
+    SaveOutput(test_name() + ".png", output_denoised.get());
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneExternalDenoiser)
+{
+    // Pass-through backend, output is expected to match resolved color
+    class CopyBackend : public Baikal::DenoiserBackend
+    {
+    public:
+        void Denoise(float const* color, float const*, float const*,
+                     std::uint32_t width, std::uint32_t height, float* output) override
+        {
+            for (auto i = 0u; i < width * height; ++i)
+            {
+                output[4 * i] = color[4 * i];
+                output[4 * i + 1] = color[4 * i + 1];
+                output[4 * i + 2] = color[4 * i + 2];
+            }
+        }
+    };
+
+    auto denoiser_effect = m_factory->CreatePostEffect(Baikal::RenderFactory<Baikal::ClwScene>::PostEffectType::kExternalDenoiser);
+    auto denoiser = dynamic_cast<Baikal::ExternalDenoiser*>(denoiser_effect.get());
+    ASSERT_NE(denoiser, nullptr);
+
+    auto output_albedo = m_factory->CreateOutput(m_output->width(), m_output->height());
+    auto output_normal = m_factory->CreateOutput(m_output->width(), m_output->height());
+    auto output_denoised = m_factory->CreateOutput(m_output->width(), m_output->height());
+
+    m_renderer->SetOutput(Baikal::Renderer::OutputType::kAlbedo, output_albedo.get());
+    m_renderer->SetOutput(Baikal::Renderer::OutputType::kWorldShadingNormal, output_normal.get());
+
+    Baikal::PostEffect::InputSet input_set;
+    input_set[Baikal::Renderer::OutputType::kColor] = m_output.get();
+    input_set[Baikal::Renderer::OutputType::kAlbedo] = output_albedo.get();
+    input_set[Baikal::Renderer::OutputType::kWorldShadingNormal] = output_normal.get();
+
+    ASSERT_THROW(denoiser->Apply(input_set, *output_denoised), std::runtime_error);
+    denoiser->SetBackend(std::make_shared<CopyBackend>());
+
+    ClearOutput(output_albedo.get());
+    m_renderer->Clear(RadeonRays::float3(), *output_normal);
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    auto resolve = [this]()
+    {
+        std::vector<RadeonRays::float3> data(m_output->width() * m_output->height());
+        m_output->GetData(data.data());
+
+        for (auto& value : data)
+        {
+            value = value.w > 0.f ? (1.f / value.w) * value : RadeonRays::float3();
+        }
+
+        return data;
+    };
+
+    auto compare = [this](std::vector<RadeonRays::float3> const& expected, Baikal::Output const& output)
+    {
+        std::vector<RadeonRays::float3> data(output.width() * output.height());
+        output.GetData(data.data());
+
+        for (std::size_t i = 0; i < data.size(); ++i)
+        {
+            ASSERT_NEAR(data[i].x, expected[i].x, 1e-5f);
+            ASSERT_NEAR(data[i].y, expected[i].y, 1e-5f);
+            ASSERT_NEAR(data[i].z, expected[i].z, 1e-5f);
+        }
+    };
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    auto first_frame = resolve();
+
+    // First frame has nothing to overlap with and is waited for
+    ASSERT_NO_THROW(denoiser->Apply(input_set, *output_denoised));
+    compare(first_frame, *output_denoised);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    // Pipelined result lags one frame behind
+    ASSERT_NO_THROW(denoiser->Apply(input_set, *output_denoised));
+    compare(first_frame, *output_denoised);
+
+    denoiser->SetParameter("latency", 0.f);
+    ASSERT_NO_THROW(denoiser->Apply(input_set, *output_denoised));
+    compare(resolve(), *output_denoised);
+}
+
+TEST_F(BasicTest, RenderTestScenePostEffectPipeline)
+{
+    using PostEffectType = Baikal::RenderFactory<Baikal::ClwScene>::PostEffectType;
+    using Source = Baikal::PostEffectPipeline::Source;
+
+    auto exposure = m_factory->CreatePostEffect(PostEffectType::kTonemapper);
+    auto curve = m_factory->CreatePostEffect(PostEffectType::kTonemapper);
+    auto quantize = m_factory->CreatePostEffect(PostEffectType::kTonemapper);
+
+    exposure->SetParameter("exposure", 1.f);
+    curve->SetParameter("operator", 2.f);
+    curve->SetParameter("gamma", 1.f);
+    quantize->SetParameter("gamma", 1.f);
+
+    Baikal::PostEffectPipeline pipeline([this](std::uint32_t width, std::uint32_t height, Baikal::Output::Format format)
+    {
+        return m_factory->CreateOutput(width, height, format);
+    });
+
+    auto exposure_stage = pipeline.AddStage(*exposure, { { Baikal::Renderer::OutputType::kColor, Source::Input(Baikal::Renderer::OutputType::kColor) } });
+    auto curve_stage = pipeline.AddStage(*curve, { { Baikal::Renderer::OutputType::kColor, Source::Stage(exposure_stage) } });
+    auto quantize_stage = pipeline.AddStage(*quantize, { { Baikal::Renderer::OutputType::kColor, Source::Stage(curve_stage) } });
+
+    auto output_ldr = m_factory->CreateOutput(m_output->width(), m_output->height(), Baikal::Output::Format::kRGBA8);
+    pipeline.SetOutput(quantize_stage, output_ldr.get());
+
+    ClearOutput();
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    Baikal::PostEffect::InputSet input_set;
+    input_set[Baikal::Renderer::OutputType::kColor] = m_output.get();
+
+    ASSERT_NO_THROW(pipeline.Execute(input_set));
+    ASSERT_EQ(pipeline.GetNumExecutedStages(), 3u);
+    ASSERT_EQ(pipeline.GetNumPooledOutputs(), 2u);
+
+    // Nothing changed
+    ASSERT_NO_THROW(pipeline.Execute(input_set));
+    ASSERT_EQ(pipeline.GetNumExecutedStages(), 0u);
+
+    // Only the last stage is out of date
+    quantize->SetParameter("dither", 0.f);
+    ASSERT_NO_THROW(pipeline.Execute(input_set));
+    ASSERT_EQ(pipeline.GetNumExecutedStages(), 1u);
+
+    // New samples invalidate the whole chain
+    ASSERT_NO_THROW(m_renderer->Render(scene));
+    ASSERT_NO_THROW(pipeline.Execute(input_set));
+    ASSERT_EQ(pipeline.GetNumExecutedStages(), 3u);
+
+    std::ostringstream oss;
+    oss << test_name() << ".png";
+    SaveOutput(oss.str(), output_ldr.get());
+    ASSERT_TRUE(CompareToReference(oss.str()));
+}
+
+TEST_F(BasicTest, DenoiseSchedule)
+{
+    Baikal::DenoiseSchedule schedule(16u, 0.01f);
+
+    // Every frame first, then each time the number of samples doubles
+    auto num_denoised = 0u;
+    for (auto i = 1u; i <= 256u; ++i)
+    {
+        if (schedule.ShouldDenoise(i))
+        {
+            ++num_denoised;
+        }
+    }
+
+    ASSERT_EQ(num_denoised, 16u + 4u);
+
+    // Falling noise estimate triggers denoising earlier, converged output stops it
+    schedule.Reset();
+    ASSERT_TRUE(schedule.ShouldDenoise(16u, 0.5f));
+    ASSERT_FALSE(schedule.ShouldDenoise(17u, 0.45f));
+    ASSERT_TRUE(schedule.ShouldDenoise(18u, 0.3f));
+    ASSERT_TRUE(schedule.ShouldDenoise(19u, 0.005f));
+    ASSERT_TRUE(schedule.IsFinished());
+    ASSERT_FALSE(schedule.ShouldDenoise(1024u, 0.f));
+
+    // Restarted accumulation
+    ASSERT_TRUE(schedule.ShouldDenoise(1u, 0.f));
+    ASSERT_FALSE(schedule.IsFinished());
+}
+
+TEST_F(BasicTest, TileSchedulerStealing)
+{
+    Baikal::TileScheduler scheduler(2);
+    Baikal::TileScheduler::Tile tile;
+
+    // Second device never shows up, its share is stolen
+    scheduler.BeginFrame(RadeonRays::int2(), RadeonRays::int2(256, 256), RadeonRays::int2(64, 64));
+
+    auto num_pixels = 0;
+    while (scheduler.NextTile(0, tile))
+    {
+        num_pixels += tile.size.x * tile.size.y;
+    }
+
+    scheduler.EndFrame();
+
+    ASSERT_EQ(num_pixels, 256 * 256);
+    ASSERT_EQ(scheduler.GetNumTiles(0), 16u);
+    ASSERT_GT(scheduler.GetNumStolenTiles(), 0u);
+    ASSERT_GT(scheduler.GetThroughput(0), 0.f);
+
+    // Edge tiles are clamped to the frame
+    scheduler.BeginFrame(RadeonRays::int2(), RadeonRays::int2(100, 70), RadeonRays::int2(64, 64));
+
+    num_pixels = 0;
+    while (scheduler.NextTile(1, tile))
+    {
+        ASSERT_LE(tile.origin.x + tile.size.x, 100);
+        ASSERT_LE(tile.origin.y + tile.size.y, 70);
+        num_pixels += tile.size.x * tile.size.y;
+    }
+
+    scheduler.EndFrame();
+    ASSERT_EQ(num_pixels, 100 * 70);
+}
+
+TEST_F(BasicTest, TaskSchedulerNested)
+{
+    Baikal::TaskScheduler scheduler(3);
+
+    // Tasks split their work further, waiting callers run batches themselves
+    std::vector<std::future<std::size_t>> results;
+    for (auto i = 0u; i < 16u; ++i)
+    {
+        results.push_back(scheduler.Submit([&scheduler, i]()
+        {
+            std::atomic<std::size_t> sum(0);
+            scheduler.ParallelFor(100u, 7u, [&sum](std::size_t begin, std::size_t end)
+            {
+                for (auto j = begin; j < end; ++j)
+                {
+                    sum += j;
+                }
+            });
+            return sum + i;
+        }));
+    }
+
+    for (auto i = 0u; i < results.size(); ++i)
+    {
+        ASSERT_EQ(results[i].get(), 4950u + i);
+    }
+
+    // Exceptions reach the caller and the rest of the batches is skipped
+    ASSERT_THROW(scheduler.ParallelFor(64u, 1u, [](std::size_t begin, std::size_t)
+    {
+        if (begin == 10u)
+        {
+            throw std::runtime_error("ParallelFor");
+        }
+    }), std::runtime_error);
+
+    auto failed = scheduler.Submit([]() { throw std::runtime_error("Submit"); });
+    ASSERT_THROW(failed.get(), std::runtime_error);
+}
+
+TEST_F(BasicTest, RenderProtocolMerge)
+{
+    Baikal::RenderJob job = {};
+    job.job_id = 3u;
+    job.seed = 3u;
+    job.slot = 1u;
+    job.width = 4u;
+    job.height = 2u;
+    job.camera_position = RadeonRays::float3(0.f, 1.f, 3.f);
+
+    auto decoded_job = Baikal::DecodeRenderJob(Baikal::EncodeRenderJob(job));
+    ASSERT_EQ(decoded_job.job_id, job.job_id);
+    ASSERT_EQ(decoded_job.slot, job.slot);
+    ASSERT_EQ(decoded_job.camera_position.y, 1.f);
+
+    // Slots of a job and consecutive jobs get different seeds
+    ASSERT_NE(Baikal::GetWorkerSeed(3u, 1u), Baikal::GetWorkerSeed(3u, 2u));
+    ASSERT_NE(Baikal::GetWorkerSeed(3u, 1u), Baikal::GetWorkerSeed(4u, 1u));
+
+    Baikal::SampleChunk chunk;
+    chunk.job_id = job.job_id;
+    chunk.width = job.width;
+    chunk.height = job.height;
+    chunk.data.assign(job.width * job.height, RadeonRays::float3(1.f, 2.f, 3.f, 1.f));
+
+    auto decoded_chunk = Baikal::DecodeSampleChunk(Baikal::EncodeSampleChunk(chunk));
+    ASSERT_EQ(decoded_chunk.data.size(), chunk.data.size());
+    ASSERT_THROW(Baikal::DecodeSampleChunk(std::vector<char>(7)), std::runtime_error);
+
+    Baikal::SampleMerger merger;
+    merger.Reset(job.job_id, job.width, job.height);
+
+    std::vector<RadeonRays::float3> merged;
+    ASSERT_FALSE(merger.Take(merged));
+
+    ASSERT_TRUE(merger.Merge(decoded_chunk));
+    ASSERT_TRUE(merger.Merge(chunk));
+
+    // Chunks of a previous job are dropped
+    chunk.job_id = 2u;
+    ASSERT_FALSE(merger.Merge(chunk));
+
+    ASSERT_TRUE(merger.Take(merged));
+    ASSERT_EQ(merged[5].z, 6.f);
+    ASSERT_EQ(merged[5].w, 2.f);
+    ASSERT_FALSE(merger.Take(merged));
+}
+
+TEST_F(BasicTest, RenderProtocolServer)
+{
+    Baikal::SceneRequest scene = { "../Resources/CornellBox/", "orig.objm" };
+    auto decoded_scene = Baikal::DecodeSceneRequest(Baikal::EncodeSceneRequest(scene));
+    ASSERT_EQ(decoded_scene.path, scene.path);
+    ASSERT_EQ(decoded_scene.model_name, scene.model_name);
+    ASSERT_THROW(Baikal::DecodeSceneRequest(std::vector<char>(3)), std::runtime_error);
+
+    Baikal::ViewRequest view = {};
+    view.request_id = 7u;
+    view.num_samples = 16u;
+    view.format = Baikal::FrameFormat::kBc1;
+    view.camera_at = RadeonRays::float3(0.f, 1.f, 0.f);
+
+    auto decoded_view = Baikal::DecodeViewRequest(Baikal::EncodeViewRequest(view));
+    ASSERT_EQ(decoded_view.request_id, view.request_id);
+    ASSERT_EQ(decoded_view.format, view.format);
+    ASSERT_EQ(decoded_view.camera_at.y, 1.f);
+
+    // Partial BC1 blocks at the edges are whole
+    ASSERT_EQ(Baikal::GetFrameDataSize(Baikal::FrameFormat::kRgba8, 5u, 3u), 60u);
+    ASSERT_EQ(Baikal::GetFrameDataSize(Baikal::FrameFormat::kBc1, 5u, 3u), 16u);
+
+    Baikal::EncodedFrame frame;
+    frame.request_id = view.request_id;
+    frame.width = 5u;
+    frame.height = 3u;
+    frame.format = Baikal::FrameFormat::kBc1;
+    frame.data.assign(16u, 'x');
+
+    auto decoded_frame = Baikal::DecodeFrame(Baikal::EncodeFrame(frame));
+    ASSERT_EQ(decoded_frame.request_id, frame.request_id);
+    ASSERT_EQ(decoded_frame.data, frame.data);
+
+    frame.data.pop_back();
+    ASSERT_THROW(Baikal::EncodeFrame(frame), std::runtime_error);
+
+    // 40x20 frame has 3x2 tiles of 16
+    Baikal::FrameTiles tiles;
+    tiles.request_id = view.request_id;
+    tiles.width = 40u;
+    tiles.height = 20u;
+    tiles.tile_size = 16u;
+    tiles.num_samples = 4u;
+    tiles.format = Baikal::FrameFormat::kBc1;
+    tiles.tiles = { 5u, 0u };
+    tiles.data.assign(2u * 128u, 'y');
+
+    auto decoded_tiles = Baikal::DecodeFrameTiles(Baikal::EncodeFrameTiles(tiles));
+    ASSERT_EQ(decoded_tiles.num_samples, tiles.num_samples);
+    ASSERT_EQ(decoded_tiles.tiles, tiles.tiles);
+    ASSERT_EQ(decoded_tiles.data, tiles.data);
+
+    tiles.tiles[0] = 6u;
+    ASSERT_THROW(Baikal::EncodeFrameTiles(tiles), std::runtime_error);
+}
+
+TEST_F(BasicTest, RenderProtocolPayloadLimits)
+{
+    auto header = Baikal::MakeRenderMessageHeader(Baikal::RenderMessageType::kJob, sizeof(Baikal::RenderJob));
+    ASSERT_NO_THROW(Baikal::CheckRenderMessageHeader(header));
+
+    // Headers received from a socket are rejected before their payload is allocated
+    header.payload_size = sizeof(Baikal::RenderJob) + 1u;
+    ASSERT_THROW(Baikal::CheckRenderMessageHeader(header), std::runtime_error);
+
+    header.payload_size = std::numeric_limits<std::uint64_t>::max();
+    ASSERT_THROW(Baikal::CheckRenderMessageHeader(header), std::runtime_error);
+
+    header.type = static_cast<Baikal::RenderMessageType>(42u);
+    header.payload_size = 0u;
+    ASSERT_THROW(Baikal::CheckRenderMessageHeader(header), std::runtime_error);
+
+    ASSERT_THROW(Baikal::MakeRenderMessageHeader(Baikal::RenderMessageType::kView, sizeof(Baikal::ViewRequest) + 1u), std::runtime_error);
+
+    // Largest frames still fit
+    auto max_frame = Baikal::GetFrameDataSize(Baikal::FrameFormat::kRgba8, Baikal::kMaxRenderFrameSize, Baikal::kMaxRenderFrameSize);
+    ASSERT_GT(Baikal::GetMaxPayloadSize(Baikal::RenderMessageType::kFrame), max_frame);
+    ASSERT_GT(Baikal::GetMaxPayloadSize(Baikal::RenderMessageType::kSamples),
+              static_cast<std::size_t>(Baikal::kMaxRenderFrameSize) * Baikal::kMaxRenderFrameSize * sizeof(RadeonRays::float3));
+
+    Baikal::SceneRequest scene = { "../Resources/CornellBox/", "orig.objm" };
+    ASSERT_LE(Baikal::EncodeSceneRequest(scene).size(), Baikal::GetMaxPayloadSize(Baikal::RenderMessageType::kLoadScene));
+}
+
+TEST_F(BasicTest, RenderSampleRange)
+{
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+    auto num_pixels = kOutputWidth * kOutputHeight;
+
+    // Render samples [first, first + count) into a cleared output
+    auto render_range = [&](std::uint32_t first, std::uint32_t count, std::vector<RadeonRays::float3>& data)
+    {
+        ClearOutput();
+        m_renderer->SetSampleIndex(first);
+
+        for (auto i = 0u; i < count; ++i)
+        {
+            m_renderer->Render(scene);
+        }
+
+        data.resize(num_pixels);
+        m_output->GetData(data.data());
+    };
+
+    std::vector<RadeonRays::float3> full, head, tail, tail_again;
+    ASSERT_NO_THROW(render_range(0u, 4u, full));
+    ASSERT_NO_THROW(render_range(2u, 2u, tail));
+    ASSERT_NO_THROW(render_range(0u, 2u, head));
+    ASSERT_NO_THROW(render_range(2u, 2u, tail_again));
+
+    // Range does not depend on the renders before it
+    ASSERT_EQ(std::memcmp(tail.data(), tail_again.data(), num_pixels * sizeof(RadeonRays::float3)), 0);
+
+    for (auto i = 0u; i < num_pixels; ++i)
+    {
+        auto merged = head[i] + tail[i];
+        ASSERT_FLOAT_EQ(merged.w, full[i].w);
+        ASSERT_NEAR(merged.x, full[i].x, 1e-4f * std::max(1.f, std::fabs(full[i].x)));
+        ASSERT_NEAR(merged.y, full[i].y, 1e-4f * std::max(1.f, std::fabs(full[i].y)));
+        ASSERT_NEAR(merged.z, full[i].z, 1e-4f * std::max(1.f, std::fabs(full[i].z)));
+    }
+}
+
+TEST_F(BasicTest, RenderTestSceneRegularization)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    ASSERT_THROW(estimator.SetMaxRadiance(0.f), std::runtime_error);
+    ASSERT_NO_THROW(estimator.SetMaxRadiance(1.f));
+    estimator.SetRegularization(Baikal::PathTracingEstimator::Regularization::kClampRadianceAndRoughness);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneQualityLevels)
+{
+    auto& renderer = GetMonteCarloRenderer();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto quality : { Baikal::Estimator::QualityLevel::kRough, Baikal::Estimator::QualityLevel::kPrecise })
+    {
+        renderer.SetQualityLevel(quality);
+        ASSERT_EQ(renderer.GetQualityLevel(), quality);
+
+        ClearOutput();
+
+        for (auto i = 0u; i < kNumIterations; ++i)
+        {
+            ASSERT_NO_THROW(m_renderer->Render(scene));
+        }
+
+        auto file_name = test_name() + (quality == Baikal::Estimator::QualityLevel::kRough ? "_rough" : "_precise") + ".png";
+        SaveOutput(file_name);
+        ASSERT_TRUE(CompareToReference(file_name));
+    }
+}
+
+TEST_F(BasicTest, RenderTestSceneMultipleLightSamples)
+{
+    auto& estimator = dynamic_cast<Baikal::PathTracingEstimator&>(
+        GetMonteCarloRenderer().GetEstimator());
+
+    ASSERT_THROW(estimator.SetLightSamplesPerVertex(0), std::runtime_error);
+    ASSERT_NO_THROW(estimator.SetLightSamplesPerVertex(4));
+    ASSERT_EQ(estimator.GetLightSamplesPerVertex(), 4u);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneBlueNoiseSampler)
+{
+    auto& estimator = GetMonteCarloRenderer().GetEstimator();
+
+    ASSERT_TRUE(estimator.HasRandomBuffer(Baikal::Estimator::RandomBufferType::kBlueNoise));
+    ASSERT_NO_THROW(estimator.SetSamplerType(Baikal::Estimator::SamplerType::kBlueNoiseSobol));
+    ASSERT_EQ(estimator.GetSamplerType(), Baikal::Estimator::SamplerType::kBlueNoiseSobol);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneOwenSobolSampler)
+{
+    auto& estimator = GetMonteCarloRenderer().GetEstimator();
+
+    ASSERT_NO_THROW(estimator.SetSamplerType(Baikal::Estimator::SamplerType::kOwenSobol));
+    ASSERT_EQ(estimator.GetSamplerType(), Baikal::Estimator::SamplerType::kOwenSobol);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneMultipleSamplesPerDispatch)
+{
+    auto& renderer = GetMonteCarloRenderer();
+
+    // Same sample count as other tests in fewer calls
+    std::uint32_t constexpr kSamplesPerDispatch = 4;
+    ASSERT_NO_THROW(renderer.SetSamplesPerDispatch(kSamplesPerDispatch));
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations / kSamplesPerDispatch; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneSampleSlots)
+{
+    auto& renderer = GetMonteCarloRenderer();
+
+    // Samples of a dispatch are summed per pixel after the estimate instead of atomically
+    std::uint32_t constexpr kSamplesPerDispatch = 4;
+    ASSERT_NO_THROW(renderer.SetSamplesPerDispatch(kSamplesPerDispatch));
+    ASSERT_NO_THROW(renderer.SetSampleSlots(true));
+    ASSERT_TRUE(renderer.GetSampleSlots());
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations / kSamplesPerDispatch; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneSmallTiles)
+{
+    auto& renderer = GetMonteCarloRenderer();
+
+    // Force output to be split into several tiles
+    ASSERT_NO_THROW(renderer.SetTileSize(RadeonRays::int2(64, 48)));
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    ASSERT_GT(renderer.GetRenderStatistics().num_tiles, 1u);
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(BasicTest, RenderTestSceneRegion)
+{
+    auto& renderer = GetMonteCarloRenderer();
+    auto work_buffer_size = renderer.GetEstimator().GetWorkBufferSize();
+
+    auto region_origin = RadeonRays::int2(64, 96);
+    auto region_size = RadeonRays::int2(48, 32);
+
+    ASSERT_THROW(renderer.SetRenderRegion(RadeonRays::int2(-1, 0), region_size), std::runtime_error);
+    ASSERT_NO_THROW(renderer.SetRenderRegion(region_origin, region_size));
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    // Work buffer only holds the region
+    ASSERT_EQ(renderer.GetRenderStatistics().num_tiles, 1u);
+    ASSERT_LE(renderer.GetEstimator().GetWorkBufferSize(), static_cast<std::size_t>(region_size.x * region_size.y));
+
+    std::vector<RadeonRays::float3> data(kOutputWidth * kOutputHeight);
+    m_output->GetData(data.data());
+
+    for (auto y = 0; y < static_cast<int>(kOutputHeight); ++y)
+    {
+        for (auto x = 0; x < static_cast<int>(kOutputWidth); ++x)
+        {
+            auto inside = x >= region_origin.x && x < region_origin.x + region_size.x &&
+                y >= region_origin.y && y < region_origin.y + region_size.y;
+            ASSERT_EQ(data[y * kOutputWidth + x].w > 0.f, inside);
+        }
+    }
+
+    // Region out of the output
+    ASSERT_NO_THROW(renderer.SetRenderRegion(RadeonRays::int2(kOutputWidth - 16, 0), region_size));
+    ASSERT_THROW(m_renderer->Render(scene), std::runtime_error);
+
+    // Whole output gets the work buffer back
+    ASSERT_NO_THROW(renderer.SetRenderRegion(RadeonRays::int2(), RadeonRays::int2()));
+    ASSERT_NO_THROW(m_renderer->Render(scene));
+    ASSERT_EQ(renderer.GetEstimator().GetWorkBufferSize(), work_buffer_size);
+}
+
+TEST_F(BasicTest, RenderTestSceneStereo)
+{
+    ASSERT_THROW(m_camera->SetViews(0, 0.f), std::runtime_error);
+
+    // Views should split the output evenly
+    ASSERT_NO_THROW(m_camera->SetViews(3, 0.065f));
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    ASSERT_THROW(m_renderer->Render(m_controller->GetCachedScene(m_scene)), std::runtime_error);
+
+    ASSERT_NO_THROW(m_camera->SetViews(2, 0.065f));
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+    ASSERT_EQ(scene.camera_num_views, 2);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    // Both views are rendered in the same pass
+    std::vector<RadeonRays::float3> data(kOutputWidth * kOutputHeight);
+    m_output->GetData(data.data());
+
+    for (auto i = 0u; i < kOutputWidth * kOutputHeight; ++i)
+    {
+        ASSERT_GT(data[i].w, 0.f);
+    }
+
+    m_camera->SetViews(1, 0.f);
+}
+
+TEST_F(BasicTest, RenderTestSceneTimeBudget)
+{
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    // Sample count depends on device speed, so only check that we made progress
+    std::uint32_t num_samples = 0;
+    ASSERT_NO_THROW(num_samples = m_renderer->RenderWithTimeBudget(scene, 16.f));
+    ASSERT_GE(num_samples, 1u);
+}
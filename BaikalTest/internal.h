@@ -21,12 +21,168 @@ THE SOFTWARE.
 ********************************************************************/
 #include "gtest/gtest.h"
 
+#include "Controllers/acceleration_structure.h"
+#include "Utils/cl_inputmap_generator.h"
+#include "Utils/cl_uberv2_generator.h"
+#include "Utils/compile_cache.h"
 #include "Utils/distribution1d.h"
+#include "Utils/geometry_compression.h"
+#include "Utils/half.h"
+#include "Utils/half_conversion.h"
+#include "Utils/ies_profile.h"
+#include "Utils/light_grid.h"
+#include "Utils/majorant_grid.h"
+#include "Utils/mesh_tangents.h"
+#include "Utils/object_pool.h"
+#include "Utils/range_allocator.h"
+#include "Utils/sparse_volume_grid.h"
+#include "Utils/task_scheduler.h"
+#include "Utils/texture_compression.h"
+#include "SceneGraph/Collector/collector.h"
+#include "SceneGraph/inputmaps.h"
+#include "SceneGraph/iterator.h"
+#include "SceneGraph/scene1.h"
+#include "SceneGraph/shape.h"
+#include "SceneGraph/texture.h"
+#include "SceneGraph/uberv2material.h"
 #include "math/mathutils.h"
+#include "json.h"
+#include "material_io.h"
+#include "mesh_optimizer.h"
+#include "obj_parser.h"
+#include "scene_io.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <string>
 
 class InternalTest : public ::testing::Test
 {
+public:
+    // Files of the loader tests are written next to the output images
+    static std::string WriteTestFile(std::string const& name, std::string const& contents)
+    {
+        auto file_name = "OutputImages/" + name;
+        std::ofstream file(file_name, std::ios::binary);
+        file.write(contents.data(), contents.size());
+        return file_name;
+    }
+
+    // Triangle with positions padded to 16 bytes followed by 16 bit indices
+    static std::string MakeTriangleBuffer()
+    {
+        float const positions[] = { 0.f, 0.f, 0.f, 99.f, 1.f, 0.f, 0.f, 99.f, 0.f, 1.f, 0.f, 99.f };
+        std::uint16_t const indices[] = { 0, 1, 2 };
+
+        std::string buffer(sizeof(positions) + sizeof(indices), '\0');
+        std::memcpy(&buffer[0], positions, sizeof(positions));
+        std::memcpy(&buffer[sizeof(positions)], indices, sizeof(indices));
+        return buffer;
+    }
+
+    static std::string EncodeBase64(std::string const& data)
+    {
+        static char const digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        std::string res;
+        for (std::size_t i = 0; i < data.size(); i += 3)
+        {
+            std::uint32_t bits = static_cast<std::uint8_t>(data[i]) << 16;
+            bits |= i + 1 < data.size() ? static_cast<std::uint8_t>(data[i + 1]) << 8 : 0;
+            bits |= i + 2 < data.size() ? static_cast<std::uint8_t>(data[i + 2]) : 0;
+
+            res += digits[(bits >> 18) & 0x3f];
+            res += digits[(bits >> 12) & 0x3f];
+            res += i + 1 < data.size() ? digits[(bits >> 6) & 0x3f] : '=';
+            res += i + 2 < data.size() ? digits[bits & 0x3f] : '=';
+        }
+        return res;
+    }
+
+    // Document instancing the triangle mesh from three nodes, accessor and view properties are substituted
+    static std::string MakeGltfDocument(std::string const& buffer, std::string const& position_view = "\"byteLength\": 48, \"byteStride\": 16",
+                                        std::string const& position_count = "3")
+    {
+        return
+            "{ \"asset\": { \"version\": \"2.0\" },"
+            "  \"buffers\": [ { \"byteLength\": 54" + buffer + " } ],"
+            "  \"bufferViews\": [ { \"buffer\": 0, " + position_view + " }, { \"buffer\": 0, \"byteOffset\": 48, \"byteLength\": 6 } ],"
+            "  \"accessors\": [ { \"bufferView\": 0, \"componentType\": 5126, \"count\": " + position_count + ", \"type\": \"VEC3\" },"
+            "                   { \"bufferView\": 1, \"componentType\": 5123, \"count\": 3, \"type\": \"SCALAR\" } ],"
+            "  \"meshes\": [ { \"primitives\": [ { \"attributes\": { \"POSITION\": 0 }, \"indices\": 1 } ] } ],"
+            "  \"nodes\": [ { \"name\": \"first\", \"mesh\": 0, \"translation\": [ 1, 2, 3 ] },"
+            "               { \"name\": \"second\", \"mesh\": 0, \"children\": [ 2 ] },"
+            "               { \"name\": \"child\", \"mesh\": 0, \"scale\": [ 2, 2, 2 ] } ],"
+            "  \"scenes\": [ { \"nodes\": [ 0, 1 ] } ] }";
+    }
+
+    // Checks that both graphs have the same structure and constants
+    static void CheckSameInputMap(Baikal::InputMap::Ptr const& expected, Baikal::InputMap::Ptr const& actual)
+    {
+        ASSERT_TRUE(actual);
+        ASSERT_EQ(actual->m_type, expected->m_type);
+
+        if (auto constant = std::dynamic_pointer_cast<Baikal::InputMap_ConstantFloat>(expected))
+        {
+            ASSERT_EQ(std::static_pointer_cast<Baikal::InputMap_ConstantFloat>(actual)->GetValue(), constant->GetValue());
+        }
+        else if (auto constant3 = std::dynamic_pointer_cast<Baikal::InputMap_ConstantFloat3>(expected))
+        {
+            auto value = std::static_pointer_cast<Baikal::InputMap_ConstantFloat3>(actual)->GetValue();
+            ASSERT_EQ(value.x, constant3->GetValue().x);
+            ASSERT_EQ(value.y, constant3->GetValue().y);
+            ASSERT_EQ(value.z, constant3->GetValue().z);
+        }
+        else if (auto select = std::dynamic_pointer_cast<Baikal::InputMap_Select>(expected))
+        {
+            ASSERT_EQ(std::static_pointer_cast<Baikal::InputMap_Select>(actual)->GetSelection(), select->GetSelection());
+        }
+
+        std::vector<Baikal::InputMap::Ptr> expected_inputs;
+        std::vector<Baikal::InputMap::Ptr> actual_inputs;
+        expected->GetInputs(expected_inputs);
+        actual->GetInputs(actual_inputs);
+        ASSERT_EQ(actual_inputs.size(), expected_inputs.size());
+
+        for (std::size_t i = 0; i < expected_inputs.size(); ++i)
+        {
+            ASSERT_NO_FATAL_FAILURE(CheckSameInputMap(expected_inputs[i], actual_inputs[i]));
+        }
+    }
+
+    // Checks the scene of MakeGltfDocument
+    static void CheckGltfScene(Baikal::Scene1 const& scene)
+    {
+        ASSERT_EQ(scene.GetNumShapes(), 3u);
+        // Environment is up to the client
+        ASSERT_EQ(scene.GetNumLights(), 0u);
+
+        auto shapes = scene.GetShapes();
+        auto mesh = std::dynamic_pointer_cast<Baikal::Mesh>(shapes[0]);
+        ASSERT_TRUE(mesh);
+        ASSERT_EQ(mesh->GetName(), "first");
+        ASSERT_EQ(mesh->GetNumVertices(), 3u);
+        ASSERT_EQ(mesh->GetNumIndices(), 3u);
+        ASSERT_EQ(mesh->GetVertices()[1].x, 1.f);
+        ASSERT_EQ(mesh->GetVertices()[2].y, 1.f);
+        ASSERT_EQ(mesh->GetVertices()[2].z, 0.f);
+        ASSERT_EQ(mesh->GetTransform().m[1][3], 2.f);
 
+        // Further nodes referencing the mesh instance it with their own transforms
+        for (auto i = 1u; i < 3u; ++i)
+        {
+            auto instance = std::dynamic_pointer_cast<Baikal::Instance>(shapes[i]);
+            ASSERT_TRUE(instance);
+            ASSERT_EQ(instance->GetBaseShape(), mesh);
+        }
+        ASSERT_EQ(shapes[1]->GetName(), "second");
+        ASSERT_EQ(shapes[2]->GetName(), "child");
+        ASSERT_EQ(shapes[2]->GetTransform().m[0][0], 2.f);
+    }
 };
 
 TEST_F(InternalTest, Distribuiton1D)
@@ -47,3 +203,1214 @@ TEST_F(InternalTest, Distribuiton1D)
 
     cnts[0] += cnts[1];
 }
+
+TEST_F(InternalTest, Distribution1DAliasTable)
+{
+    float vals[] = { 0, 2, 9, 0, 1, 4, 0.5f };
+    std::uint32_t const num_segments = 7;
+    Baikal::Distribution1D dist(vals, num_segments);
+
+    // Probability of each segment to be picked from the table
+    double probabilities[num_segments]{};
+    for (auto i = 0u; i < num_segments; ++i)
+    {
+        ASSERT_LT(dist.m_aliases[i], num_segments);
+
+        auto keep = std::min(dist.m_alias_probabilities[i], 1.f);
+        probabilities[i] += keep / num_segments;
+        probabilities[dist.m_aliases[i]] += (1.f - keep) / num_segments;
+    }
+
+    for (auto i = 0u; i < num_segments; ++i)
+    {
+        ASSERT_NEAR(probabilities[i], vals[i] / (dist.m_func_sum * num_segments), 1e-5);
+    }
+
+    // Empty segments are never sampled, pdf matches CDF
+    for (auto i = 0u; i < 1000; ++i)
+    {
+        float pdf = 0.f;
+        float v = dist.Sample1D((i + 0.5f) / 1000.f, pdf);
+
+        ASSERT_GE(v, 0.f);
+        ASSERT_LT(v, 1.f);
+
+        auto segment_idx = std::min((std::uint32_t)(v * num_segments), num_segments - 1);
+        ASSERT_GT(pdf, 0.f);
+        ASSERT_NEAR(pdf, (dist.m_cdf[segment_idx + 1] - dist.m_cdf[segment_idx]) * num_segments, 1e-4f);
+    }
+}
+
+TEST_F(InternalTest, RangeAllocator)
+{
+    Baikal::RangeAllocator allocator;
+
+    ASSERT_EQ(allocator.Allocate(4), Baikal::RangeAllocator::kInvalidOffset);
+
+    allocator.Grow(12);
+
+    auto a = allocator.Allocate(4);
+    auto b = allocator.Allocate(4);
+    auto c = allocator.Allocate(4);
+    ASSERT_EQ(a, 0u);
+    ASSERT_EQ(b, 4u);
+    ASSERT_EQ(c, 8u);
+    ASSERT_EQ(allocator.Allocate(1), Baikal::RangeAllocator::kInvalidOffset);
+
+    // Freed blocks are reused and merged with neighbours
+    allocator.Free(a, 4);
+    allocator.Free(c, 4);
+    ASSERT_EQ(allocator.GetLargestFreeBlock(), 4u);
+    ASSERT_EQ(allocator.Allocate(2), 0u);
+
+    allocator.Free(0, 2);
+    allocator.Free(b, 4);
+    ASSERT_EQ(allocator.GetLargestFreeBlock(), 12u);
+
+    // Growing appends to the free tail
+    allocator.Grow(16);
+    ASSERT_EQ(allocator.GetFreeTail(), 16u);
+    ASSERT_EQ(allocator.Allocate(16), 0u);
+}
+
+TEST_F(InternalTest, ObjectPool)
+{
+    // Size class which no scene graph object falls into
+    std::size_t const size = 1000;
+    auto num_allocated = Baikal::ObjectPool::GetNumAllocated(size);
+
+    auto a = Baikal::ObjectPool::Allocate(size);
+    auto b = Baikal::ObjectPool::Allocate(size);
+    ASSERT_NE(a, b);
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(a) % Baikal::ObjectPool::kAlignment, 0u);
+    ASSERT_EQ(Baikal::ObjectPool::GetNumAllocated(size), num_allocated + 2);
+
+    // Freed blocks are reused
+    Baikal::ObjectPool::Deallocate(b, size);
+    ASSERT_EQ(Baikal::ObjectPool::Allocate(size), b);
+
+    Baikal::ObjectPool::Deallocate(a, size);
+    Baikal::ObjectPool::Deallocate(b, size);
+    ASSERT_EQ(Baikal::ObjectPool::GetNumAllocated(size), num_allocated);
+
+    // Scene graph objects and input maps are pooled together with their reference counts
+    auto scene = Baikal::Scene1::Create();
+    std::vector<Baikal::Shape::Ptr> shapes;
+
+    auto mesh = Baikal::Mesh::Create();
+    shapes.push_back(mesh);
+
+    for (auto i = 0; i < 1000; ++i)
+    {
+        shapes.push_back(Baikal::Instance::Create(mesh));
+    }
+
+    for (auto const& shape : shapes)
+    {
+        scene->AttachShape(shape);
+    }
+
+    auto input_size = sizeof(Baikal::InputMap_ConstantFloat);
+    auto num_inputs = Baikal::ObjectPool::GetNumAllocated(input_size);
+    auto input = Baikal::InputMap_ConstantFloat::Create(1.f);
+    ASSERT_FLOAT_EQ(input->GetValue(), 1.f);
+    ASSERT_EQ(Baikal::ObjectPool::GetNumAllocated(input_size), num_inputs + 1);
+    input.reset();
+    ASSERT_EQ(Baikal::ObjectPool::GetNumAllocated(input_size), num_inputs);
+
+    // Shapes are seen in attach order
+    auto scene_shapes = scene->GetShapes();
+    ASSERT_EQ(scene_shapes.size(), shapes.size());
+    ASSERT_TRUE(std::equal(scene_shapes.begin(), scene_shapes.end(), shapes.begin()));
+
+    scene->DetachShape(mesh);
+    ASSERT_EQ(scene->GetShapes()[0], shapes[1]);
+    ASSERT_TRUE(scene->GetLights().empty());
+}
+
+TEST_F(InternalTest, HalfConversion)
+{
+    // Every half value, the count is not a multiple of the vector width to cover the tail
+    std::vector<std::uint16_t> bits(65536 + 3);
+    for (std::size_t i = 0; i < bits.size(); ++i)
+    {
+        bits[i] = static_cast<std::uint16_t>(i);
+    }
+
+    std::vector<float> values(bits.size());
+    Baikal::HalfConversion::HalfToFloat(bits.data(), values.data(), bits.size());
+
+    for (std::size_t i = 0; i < bits.size(); ++i)
+    {
+        half expected;
+        expected.setBits(bits[i]);
+
+        if (expected.isNan())
+        {
+            ASSERT_TRUE(std::isnan(values[i]));
+        }
+        else
+        {
+            ASSERT_EQ(values[i], static_cast<float>(expected));
+        }
+    }
+
+    // Rounding, denormals and overflow match the half class
+    std::vector<float> floats;
+    for (auto i = 0; i < 10000; ++i)
+    {
+        auto value = (i - 5000) * 13.7f;
+        floats.push_back(value);
+        floats.push_back(value * 1e-7f);
+    }
+    floats.push_back(65504.f);
+    floats.push_back(65520.f);
+    floats.push_back(1e10f);
+
+    std::vector<std::uint16_t> packed(floats.size());
+    Baikal::HalfConversion::FloatToHalf(floats.data(), packed.data(), floats.size());
+
+    for (std::size_t i = 0; i < floats.size(); ++i)
+    {
+        ASSERT_EQ(packed[i], half(floats[i]).bits());
+    }
+}
+
+TEST_F(InternalTest, Collector)
+{
+    Baikal::Collector collector;
+    auto not_changed = [](Baikal::SceneObject::Ptr) { return false; };
+
+    auto t1 = Baikal::Texture::Create();
+    auto t2 = Baikal::Texture::Create();
+    auto t3 = Baikal::Texture::Create();
+    auto t4 = Baikal::Texture::Create();
+
+    collector.BeginCollect();
+    collector.Collect(t1);
+    collector.Collect(t2);
+    collector.Collect(t3);
+    collector.Commit();
+
+    ASSERT_EQ(collector.GetAddedItems().size(), 3u);
+    ASSERT_EQ(collector.GetItemIndex(t1), 0u);
+    ASSERT_EQ(collector.GetItemIndex(t2), 1u);
+    ASSERT_EQ(collector.GetItemIndex(t3), 2u);
+
+    std::unique_ptr<Baikal::Bundle> bundle(collector.CreateBundle());
+    ASSERT_FALSE(collector.NeedsUpdate(bundle.get(), not_changed));
+
+    // Same items give no changes
+    collector.BeginCollect();
+    collector.Collect(t3);
+    collector.Collect(t1);
+    collector.Collect(t2);
+    collector.Commit();
+
+    ASSERT_TRUE(collector.GetAddedItems().empty());
+    ASSERT_TRUE(collector.GetRemovedItems().empty());
+    ASSERT_FALSE(collector.NeedsUpdate(bundle.get(), not_changed));
+    ASSERT_FALSE(collector.IndicesChanged(bundle.get()));
+
+    // Removed item is replaced by the last one, others keep their indices
+    collector.BeginCollect();
+    collector.Collect(t1);
+    collector.Collect(t3);
+    collector.Commit();
+
+    ASSERT_EQ(collector.GetRemovedItems().size(), 1u);
+    ASSERT_EQ(collector.GetNumItems(), 2u);
+    ASSERT_EQ(collector.GetItemIndex(t1), 0u);
+    ASSERT_EQ(collector.GetItemIndex(t3), 1u);
+    ASSERT_TRUE(collector.NeedsUpdate(bundle.get(), not_changed));
+    ASSERT_TRUE(collector.IndicesChanged(bundle.get()));
+
+    // Additions are appended
+    bundle.reset(collector.CreateBundle());
+
+    collector.BeginCollect();
+    collector.Collect(t1);
+    collector.Collect(t3);
+    collector.Collect(t4);
+    collector.Commit();
+
+    ASSERT_EQ(collector.GetAddedItems().size(), 1u);
+    ASSERT_EQ(collector.GetItemIndex(t4), 2u);
+    ASSERT_TRUE(collector.NeedsUpdate(bundle.get(), not_changed));
+    ASSERT_FALSE(collector.IndicesChanged(bundle.get()));
+    ASSERT_THROW(collector.GetItemIndex(t2), std::runtime_error);
+}
+
+TEST_F(InternalTest, GeometryCompression)
+{
+    using namespace Baikal::GeometryCompression;
+
+    RadeonRays::float3 normals[] =
+    {
+        RadeonRays::float3(0.f, 0.f, 1.f),
+        RadeonRays::float3(0.f, 0.f, -1.f),
+        RadeonRays::float3(1.f, 0.f, 0.f),
+        RadeonRays::normalize(RadeonRays::float3(-1.f, 2.f, -3.f)),
+        RadeonRays::normalize(RadeonRays::float3(0.3f, -0.5f, 0.1f))
+    };
+
+    for (auto const& n : normals)
+    {
+        auto decoded = DecodeNormal(EncodeNormal(n));
+        ASSERT_NEAR(decoded.x, n.x, 1e-3f);
+        ASSERT_NEAR(decoded.y, n.y, 1e-3f);
+        ASSERT_NEAR(decoded.z, n.z, 1e-3f);
+    }
+
+    auto uv = DecodeUV(EncodeUV(RadeonRays::float2(0.25f, -3.5f)));
+    ASSERT_EQ(uv.x, 0.25f);
+    ASSERT_EQ(uv.y, -3.5f);
+
+    ASSERT_TRUE(CanUseShortIndices(kMaxShortIndexVertices));
+    ASSERT_FALSE(CanUseShortIndices(kMaxShortIndexVertices + 1));
+    ASSERT_EQ(GetIndexStorageSize(9, true), 5u);
+    ASSERT_EQ(GetIndexStorageSize(9, false), 9u);
+
+    for (auto const& t : normals)
+    {
+        float sign = 0.f;
+        auto decoded = DecodeTangent(EncodeTangent(t, -1.f), sign);
+        ASSERT_EQ(sign, -1.f);
+        ASSERT_NEAR(decoded.x, t.x, 1e-3f);
+        ASSERT_NEAR(decoded.y, t.y, 1e-3f);
+        ASSERT_NEAR(decoded.z, t.z, 1e-3f);
+
+        DecodeTangent(EncodeTangent(t, 1.f), sign);
+        ASSERT_EQ(sign, 1.f);
+    }
+}
+
+TEST_F(InternalTest, MeshTangents)
+{
+    // Two quads in z = 0 plane facing +z, the second one has mirrored u
+    RadeonRays::float3 vertices[] =
+    {
+        RadeonRays::float3(0.f, 0.f, 0.f), RadeonRays::float3(1.f, 0.f, 0.f),
+        RadeonRays::float3(1.f, 1.f, 0.f), RadeonRays::float3(0.f, 1.f, 0.f),
+        RadeonRays::float3(2.f, 0.f, 0.f), RadeonRays::float3(3.f, 0.f, 0.f),
+        RadeonRays::float3(3.f, 1.f, 0.f), RadeonRays::float3(2.f, 1.f, 0.f)
+    };
+
+    RadeonRays::float2 uvs[] =
+    {
+        RadeonRays::float2(0.f, 0.f), RadeonRays::float2(1.f, 0.f),
+        RadeonRays::float2(1.f, 1.f), RadeonRays::float2(0.f, 1.f),
+        RadeonRays::float2(1.f, 0.f), RadeonRays::float2(0.f, 0.f),
+        RadeonRays::float2(0.f, 1.f), RadeonRays::float2(1.f, 1.f)
+    };
+
+    std::uint32_t indices[] = { 0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7 };
+
+    RadeonRays::float4 tangents[8];
+    Baikal::MeshTangents::Compute(vertices, nullptr, uvs, 8, indices, 12, tangents);
+
+    for (auto i = 0u; i < 8u; ++i)
+    {
+        // Tangent follows u, bitangent = w * cross(n, t) follows v
+        auto mirrored = i >= 4u;
+        ASSERT_NEAR(tangents[i].x, mirrored ? -1.f : 1.f, 1e-5f);
+        ASSERT_NEAR(tangents[i].y, 0.f, 1e-5f);
+        ASSERT_NEAR(tangents[i].z, 0.f, 1e-5f);
+        ASSERT_EQ(tangents[i].w, mirrored ? -1.f : 1.f);
+    }
+
+    // Vertices without UV derivatives still get a tangent orthogonal to the normal
+    Baikal::MeshTangents::Compute(vertices, nullptr, nullptr, 4, indices, 6, tangents);
+
+    for (auto i = 0u; i < 4u; ++i)
+    {
+        ASSERT_NEAR(tangents[i].x * tangents[i].x + tangents[i].y * tangents[i].y + tangents[i].z * tangents[i].z, 1.f, 1e-5f);
+        ASSERT_NEAR(tangents[i].z, 0.f, 1e-5f);
+    }
+}
+
+TEST_F(InternalTest, LightGrid)
+{
+    // Row of 40 point lights along x
+    std::vector<RadeonRays::float3> positions;
+    std::vector<float> power;
+    std::vector<std::uint32_t> indices;
+
+    for (auto i = 0u; i < 40u; ++i)
+    {
+        positions.push_back(RadeonRays::float3(static_cast<float>(i), 0.f, 0.f));
+        power.push_back(1.f);
+        indices.push_back(i + 1);
+    }
+
+    Baikal::LightGrid grid;
+    grid.Build(positions.data(), positions.data(), power.data(), indices.data(), 40u);
+
+    ASSERT_EQ(grid.m_resolution[0], 8u);
+    ASSERT_EQ(grid.m_resolution[1], 1u);
+    ASSERT_EQ(grid.m_resolution[2], 1u);
+    ASSERT_EQ(grid.m_cell_offsets.size(), grid.GetNumCells() + 1);
+
+    // Points outside of the grid go to the closest cell
+    ASSERT_EQ(grid.GetCellIndex(RadeonRays::float3(-5.f, 3.f, 1.f)), 0u);
+    ASSERT_EQ(grid.GetCellIndex(RadeonRays::float3(100.f, 0.f, 0.f)), 7u);
+
+    for (auto cell = 0u; cell < grid.GetNumCells(); ++cell)
+    {
+        auto begin = grid.m_cell_offsets[cell];
+        auto end = grid.m_cell_offsets[cell + 1];
+
+        // Lists are truncated, so the power distribution keeps a share
+        ASSERT_LT(begin, end);
+        ASSERT_EQ(grid.m_cdf[end - 1], 1.f);
+        ASSERT_GT(grid.m_list_probabilities[cell], 0.f);
+        ASSERT_LE(grid.m_list_probabilities[cell], 0.9f);
+
+        for (auto i = begin + 1; i < end; ++i)
+        {
+            ASSERT_GE(grid.m_cdf[i], grid.m_cdf[i - 1]);
+        }
+    }
+
+    // Lights within the first cell are the most likely ones there
+    ASSERT_LE(grid.m_light_indices[0], 5u);
+
+    // Short lists cover all the lights
+    grid.Build(positions.data(), positions.data(), power.data(), indices.data(), 4u);
+    ASSERT_EQ(grid.m_list_probabilities[0], 1.f);
+    ASSERT_EQ(grid.m_cell_offsets[1], 4u);
+}
+
+TEST_F(InternalTest, IesProfile)
+{
+    // Bilateral web over the lower hemisphere, candela multiplier of 2
+    std::string data =
+        "IESNA:LM-63-2002\n"
+        "[TEST] Baikal\n"
+        "TILT=NONE\n"
+        "1 1000 2.0 3 3 1 1 0 0 0\n"
+        "1.0 1.0 100\n"
+        "0 45 90\n"
+        "0,90,180\n"
+        "100 50 0\n"
+        "200 100 0\n"
+        "300 150 0\n";
+
+    auto profile = Baikal::IesProfile::Parse(data);
+
+    ASSERT_EQ(profile.m_vertical_angles.size(), 3u);
+    ASSERT_EQ(profile.m_horizontal_angles.size(), 3u);
+    ASSERT_EQ(profile.GetMaxIntensity(), 600.f);
+
+    ASSERT_NEAR(profile.GetIntensity(PI / 4, PI / 2), 200.f, 1e-3f);
+    ASSERT_NEAR(profile.GetIntensity(PI / 8, PI / 4), 225.f, 1e-3f);
+    // Other half is mirrored, upper hemisphere is dark
+    ASSERT_NEAR(profile.GetIntensity(PI / 8, 1.5f * PI), 300.f, 1e-3f);
+    ASSERT_EQ(profile.GetIntensity(0.75f * PI, 0.f), 0.f);
+
+    // Texture rows go from the light direction, values are relative to the peak
+    auto texture = profile.CreateTexture(8u, 4u);
+    ASSERT_EQ(texture->GetSize().x, 8);
+    ASSERT_EQ(texture->GetSize().y, 4);
+    ASSERT_NEAR(texture->GetTexel(0u, 0u).x, profile.GetIntensity(PI / 8, PI / 8) / 600.f, 1e-5f);
+    ASSERT_EQ(texture->GetTexel(0u, 3u).x, 0.f);
+
+    ASSERT_THROW(Baikal::IesProfile::Parse("TILT=NONE\n1 1000 1 3 3 2 1 0 0 0 1 1 100"), std::runtime_error);
+    ASSERT_THROW(Baikal::IesProfile::Parse("IESNA:LM-63-2002\n"), std::runtime_error);
+    ASSERT_THROW(Baikal::IesProfile().CreateTexture(8u, 4u), std::runtime_error);
+}
+
+TEST_F(InternalTest, MajorantGrid)
+{
+    // Single dense voxel at the start of the second block along x
+    std::uint32_t const resolution[3] = { 20u, 16u, 1u };
+    std::vector<float> density(20u * 16u, 0.f);
+    density[8] = 2.f;
+
+    Baikal::MajorantGrid grid;
+    ASSERT_THROW(grid.Build(density.data(), resolution, 0u), std::runtime_error);
+    grid.Build(density.data(), resolution, 8u);
+
+    ASSERT_EQ(grid.m_resolution[0], 3u);
+    ASSERT_EQ(grid.m_resolution[1], 2u);
+    ASSERT_EQ(grid.m_resolution[2], 1u);
+    ASSERT_EQ(grid.m_majorants.size(), grid.GetNumCells());
+
+    // Interpolation spreads the voxel into the neighbouring block
+    ASSERT_EQ(grid.m_majorants[0], 2.f);
+    ASSERT_EQ(grid.m_majorants[1], 2.f);
+    ASSERT_EQ(grid.m_majorants[2], 0.f);
+    ASSERT_EQ(grid.m_majorants[3], 0.f);
+    ASSERT_EQ(grid.m_majorants[4], 0.f);
+}
+
+TEST_F(InternalTest, SparseVolumeGrid)
+{
+    // Same voxel as in MajorantGrid test stored in the second brick, the empty brick is dropped
+    std::uint32_t const resolution[3] = { 20u, 16u, 1u };
+    std::vector<std::uint32_t> bricks = { 1u, 0u, 0u, 0u, 1u, 0u };
+    std::vector<float> density(2 * 512u, 0.f);
+    density[0] = 2.f;
+
+    Baikal::SparseVolumeGrid grid;
+    grid.Build(bricks.data(), density.data(), 2u, resolution);
+
+    ASSERT_EQ(grid.m_resolution[0], 1u);
+    ASSERT_EQ(grid.m_num_nodes, 1u);
+    ASSERT_EQ(grid.m_num_leaves, 1u);
+
+    ASSERT_EQ(grid.GetVoxel(8u, 0u, 0u), 2.f);
+    ASSERT_EQ(grid.GetVoxel(0u, 0u, 0u), 0.f);
+    ASSERT_EQ(grid.GetVoxel(100u, 0u, 0u), 0.f);
+
+    // Majorants match the dense grid
+    ASSERT_EQ(grid.GetMajorant(0u, 0u, 0u), 2.f);
+    ASSERT_EQ(grid.GetMajorant(1u, 0u, 0u), 2.f);
+    ASSERT_EQ(grid.GetMajorant(2u, 0u, 0u), 0.f);
+    ASSERT_EQ(grid.GetMajorant(0u, 1u, 0u), 0.f);
+    ASSERT_EQ(grid.GetMajorant(1u, 1u, 0u), 0.f);
+
+    bricks = { 1u, 0u, 0u, 1u, 0u, 0u };
+    density[512] = 1.f;
+    ASSERT_THROW(grid.Build(bricks.data(), density.data(), 2u, resolution), std::runtime_error);
+
+    bricks = { 3u, 0u, 0u };
+    ASSERT_THROW(grid.Build(bricks.data(), density.data(), 1u, resolution), std::runtime_error);
+}
+
+TEST_F(InternalTest, TextureChannels)
+{
+    RadeonRays::int3 size(2, 2, 1);
+
+    // Single channel is replicated
+    auto r8 = Baikal::Texture::Create(new char[4] { 0, 51, 102, static_cast<char>(0xFF) }, size, Baikal::Texture::Format::kR8);
+    ASSERT_EQ(r8->GetSizeInBytes(), 4u);
+
+    auto texel = r8->GetTexel(0, 1);
+    ASSERT_NEAR(texel.x, 0.4f, 1e-6f);
+    ASSERT_NEAR(texel.z, 0.4f, 1e-6f);
+    ASSERT_NEAR(r8->ComputeAverageValue().y, 102.f / 255.f, 1e-6f);
+
+    // Two half channels
+    auto rg16 = Baikal::Texture::Create(new char[16], size, Baikal::Texture::Format::kRg16);
+    ASSERT_EQ(rg16->GetSizeInBytes(), 16u);
+
+    // Two channels, blue is zero
+    auto rg8 = Baikal::Texture::Create(new char[8] { 0, 0, 0, 0, 0, 0, static_cast<char>(0xFF), 51 }, size, Baikal::Texture::Format::kRg8);
+    ASSERT_EQ(rg8->GetSizeInBytes(), 8u);
+
+    texel = rg8->GetTexel(1, 1);
+    ASSERT_NEAR(texel.x, 1.f, 1e-6f);
+    ASSERT_NEAR(texel.y, 0.2f, 1e-6f);
+    ASSERT_EQ(texel.z, 0.f);
+
+    // Three channels as stored in image files
+    auto rgb8 = Baikal::Texture::Create(new char[12] { 0, 0, 0, 0, 0, 0, 0, 0, 0, 51, 102, static_cast<char>(0xFF) }, size, Baikal::Texture::Format::kRgb8);
+    ASSERT_EQ(rgb8->GetSizeInBytes(), 12u);
+
+    texel = rgb8->GetTexel(1, 1);
+    ASSERT_NEAR(texel.x, 0.2f, 1e-6f);
+    ASSERT_NEAR(texel.y, 0.4f, 1e-6f);
+    ASSERT_NEAR(texel.z, 1.f, 1e-6f);
+}
+
+TEST_F(InternalTest, UdimTexture)
+{
+    auto udim = Baikal::UdimTexture::Create();
+    ASSERT_EQ(udim->GetNumRows(), 0);
+
+    auto tile = Baikal::Texture::Create();
+    ASSERT_NO_THROW(udim->SetTile(1001, tile));
+    ASSERT_NO_THROW(udim->SetTile(1012, Baikal::Texture::Create()));
+    ASSERT_EQ(udim->GetTile(1001), tile);
+    ASSERT_EQ(udim->GetTile(1002), nullptr);
+
+    // Tile 1012 is in the second row
+    ASSERT_EQ(udim->GetNumRows(), 2);
+
+    ASSERT_NO_THROW(udim->SetTile(1012, nullptr));
+    ASSERT_EQ(udim->GetNumRows(), 1);
+
+    ASSERT_THROW(udim->SetTile(1000, tile), std::runtime_error);
+    ASSERT_THROW(udim->SetTile(1002, Baikal::UdimTexture::Create()), std::runtime_error);
+}
+
+TEST_F(InternalTest, BumpDerivativeMap)
+{
+    // Height ramp along x, texels are 0, 0.2, 0.4, 0.6
+    auto height = Baikal::Texture::Create(new char[8] { 0, 51, 102, static_cast<char>(153), 0, 51, 102, static_cast<char>(153) },
+        RadeonRays::int3(4, 2, 1), Baikal::Texture::Format::kR8);
+
+    auto derivatives = height->CreateDerivativeMap();
+    ASSERT_EQ(derivatives->GetFormat(), Baikal::Texture::Format::kRg16);
+    ASSERT_EQ(derivatives->GetSize().x, 4);
+    ASSERT_EQ(derivatives->GetSize().y, 2);
+
+    // Sobel kernel on clamped texels, the ramp has no gradient along y
+    ASSERT_NEAR(derivatives->GetTexel(1, 0).x, -4.f * 0.4f, 1e-3f);
+    ASSERT_NEAR(derivatives->GetTexel(0, 1).x, -4.f * 0.2f, 1e-3f);
+    ASSERT_NEAR(derivatives->GetTexel(3, 1).x, -4.f * 0.2f, 1e-3f);
+    ASSERT_EQ(derivatives->GetTexel(2, 0).y, 0.f);
+
+    // Bump samplers upload the derivative map, it is kept until height texels change
+    auto sampler = Baikal::InputMap_SamplerBumpMap::Create(height);
+
+    std::set<Baikal::Texture::Ptr> textures;
+    sampler->CollectTextures(textures);
+    ASSERT_EQ(textures.size(), 1u);
+    ASSERT_EQ(*textures.begin(), sampler->GetDerivativeTexture());
+    ASSERT_EQ(sampler->GetTexture(), height);
+
+    auto map = sampler->GetDerivativeTexture();
+    height->SetData(new char[4] { 0, 0, 0, 0 }, RadeonRays::int3(2, 2, 1), Baikal::Texture::Format::kR8);
+    ASSERT_NE(sampler->GetDerivativeTexture(), map);
+    ASSERT_EQ(sampler->GetDerivativeTexture()->GetSize().x, 2);
+
+    // UDIM sets get a set of tile derivative maps
+    auto udim = Baikal::UdimTexture::Create();
+    udim->SetTile(1001, height);
+    sampler->SetTexture(udim);
+
+    auto udim_derivatives = std::dynamic_pointer_cast<Baikal::UdimTexture>(sampler->GetDerivativeTexture());
+    ASSERT_NE(udim_derivatives, nullptr);
+    ASSERT_EQ(udim_derivatives->GetTiles().size(), 1u);
+    ASSERT_EQ(udim_derivatives->GetTile(1001)->GetFormat(), Baikal::Texture::Format::kRg16);
+    ASSERT_EQ(sampler->GetDerivativeTexture(), udim_derivatives);
+}
+
+TEST_F(InternalTest, TextureCompression)
+{
+    using namespace Baikal::TextureCompression;
+
+    // 6x5 gradients, edge blocks are partially covered.
+    // BC1 fits a line through the block colors, so color gradient goes along x only.
+    int const width = 6;
+    int const height = 5;
+    auto colors = new char[4 * width * height];
+    auto normals = new char[4 * width * height];
+
+    for (auto y = 0; y < height; ++y)
+    {
+        for (auto x = 0; x < width; ++x)
+        {
+            auto color = colors + 4 * (y * width + x);
+            color[0] = static_cast<char>(40 * x);
+            color[1] = static_cast<char>(100 + 20 * x);
+            color[2] = static_cast<char>(255 - 30 * x);
+            color[3] = static_cast<char>(0xFF);
+
+            auto normal = normals + 4 * (y * width + x);
+            normal[0] = static_cast<char>(64 + 25 * x);
+            normal[1] = static_cast<char>(64 + 30 * y);
+            normal[2] = static_cast<char>(0xFF);
+            normal[3] = static_cast<char>(0xFF);
+        }
+    }
+
+    auto color_texture = Baikal::Texture::Create(colors, RadeonRays::int3(width, height, 1), Baikal::Texture::Format::kRgba8);
+    auto normal_texture = Baikal::Texture::Create(normals, RadeonRays::int3(width, height, 1), Baikal::Texture::Format::kRgba8);
+
+    auto bc1 = Compress(*color_texture, Baikal::Texture::Format::kBc1);
+    ASSERT_TRUE(bc1->IsCompressed());
+    ASSERT_EQ(bc1->GetSizeInBytes(), 4 * GetBlockSize(Baikal::Texture::Format::kBc1));
+
+    auto bc5 = Compress(*normal_texture, Baikal::Texture::Format::kBc5);
+    ASSERT_EQ(bc5->GetSizeInBytes(), 4 * GetBlockSize(Baikal::Texture::Format::kBc5));
+
+    for (auto y = 0u; y < static_cast<std::uint32_t>(height); ++y)
+    {
+        for (auto x = 0u; x < static_cast<std::uint32_t>(width); ++x)
+        {
+            // Endpoints are quantized to 5 and 6 bits and texels snap to 4 palette entries
+            auto expected = color_texture->GetTexel(x, y);
+            auto color = bc1->GetTexel(x, y);
+            ASSERT_NEAR(color.x, expected.x, 0.05f);
+            ASSERT_NEAR(color.y, expected.y, 0.05f);
+            ASSERT_NEAR(color.z, expected.z, 0.05f);
+
+            // Channels are kept with 8 palette entries, blue is the z of the unit normal
+            expected = normal_texture->GetTexel(x, y);
+            auto normal = bc5->GetTexel(x, y);
+            ASSERT_NEAR(normal.x, expected.x, 0.02f);
+            ASSERT_NEAR(normal.y, expected.y, 0.02f);
+
+            auto nx = 2.f * normal.x - 1.f;
+            auto ny = 2.f * normal.y - 1.f;
+            auto nz = 2.f * normal.z - 1.f;
+            ASSERT_GE(nz, 0.f);
+            ASSERT_NEAR(nx * nx + ny * ny + nz * nz, 1.f, 1e-4f);
+        }
+    }
+
+    ASSERT_THROW(Compress(*bc1, Baikal::Texture::Format::kBc5), std::runtime_error);
+}
+
+TEST_F(InternalTest, CompileCache)
+{
+    std::vector<float> power = { 1.f, 2.f, 3.f };
+
+    Baikal::ContentHash hash;
+    hash.Add(power);
+
+    Baikal::ContentHash same;
+    same.Add(power);
+    ASSERT_EQ(hash.Get(), same.Get());
+
+    power[1] = 2.5f;
+    Baikal::ContentHash changed;
+    changed.Add(power);
+    ASSERT_NE(hash.Get(), changed.Get());
+
+    Baikal::CompileCache cache("cache/compile_cache_test");
+    std::vector<int> data = { 4, 8, 15, 16, 23, 42 };
+    cache.Save("test", hash.Get(), data);
+
+    std::vector<int> loaded;
+    ASSERT_TRUE(cache.Load("test", hash.Get(), loaded));
+    ASSERT_EQ(loaded, data);
+    ASSERT_FALSE(cache.Load("test", changed.Get(), loaded));
+
+    // Disabled cache never hits
+    Baikal::CompileCache disabled;
+    disabled.Save("test", hash.Get(), data);
+    ASSERT_FALSE(disabled.IsEnabled());
+    ASSERT_FALSE(disabled.Load("test", hash.Get(), loaded));
+}
+
+TEST_F(InternalTest, InputMapMatrices)
+{
+    auto leaf = Baikal::InputMap_ConstantFloat3::Create(RadeonRays::float3(1.f, 2.f, 3.f));
+    auto matmul = Baikal::InputMap_MatMul::Create(leaf, RadeonRays::matrix());
+    auto root = Baikal::InputMap_Add::Create(matmul, leaf);
+
+    Baikal::Collector input_maps;
+    input_maps.BeginCollect();
+    input_maps.Collect(root);
+    input_maps.Commit();
+
+    Baikal::Collector leafs;
+    leafs.BeginCollect();
+    leafs.Collect(leaf);
+    leafs.Commit();
+
+    // Nested matrices are found through the graph
+    auto matrices = Baikal::CLInputMapGenerator::CollectMatrices(input_maps);
+    ASSERT_EQ(matrices.size(), 1u);
+    ASSERT_EQ(matrices[0], matmul);
+
+    Baikal::CLInputMapGenerator generator;
+    generator.Generate(input_maps, leafs);
+    auto source = generator.GetGeneratedSource();
+
+    // Value edits keep the source, so programs are not rebuilt
+    matmul->SetMatrix(RadeonRays::translation(RadeonRays::float3(1.f, 0.f, 0.f)));
+    leaf->SetValue(RadeonRays::float3(4.f, 5.f, 6.f));
+
+    generator.Generate(input_maps, leafs);
+    ASSERT_EQ(generator.GetGeneratedSource(), source);
+}
+
+TEST_F(InternalTest, InputMapInterpreterCode)
+{
+    // Sampler keeps the graph from being folded into a constant
+    auto leaf = Baikal::InputMap_Sampler::Create(Baikal::Texture::Create());
+    auto matmul = Baikal::InputMap_MatMul::Create(leaf, RadeonRays::matrix());
+    auto root = Baikal::InputMap_Add::Create(matmul, leaf);
+
+    Baikal::Collector input_maps;
+    input_maps.BeginCollect();
+    input_maps.Collect(root);
+    input_maps.Commit();
+
+    Baikal::Collector leafs;
+    leafs.BeginCollect();
+    leafs.Collect(leaf);
+    leafs.Commit();
+
+    // Header, one leaf and one matrix
+    auto data_size = Baikal::CLInputMapGenerator::kLeafsOffset + 1 + 4;
+    std::vector<Baikal::ClwScene::InputMapData> data(data_size);
+    Baikal::CLInputMapGenerator::GenerateInterpreterCode(input_maps, leafs, data);
+
+    // Only the root is collected
+    ASSERT_EQ(data[0].instruction.arg0, static_cast<int>(data_size));
+    ASSERT_EQ(data[0].instruction.arg1, 1);
+    ASSERT_EQ(data[data_size].instruction.arg0, static_cast<int>(root->GetId()));
+
+    // leaf, matmul, leaf, add, return
+    auto code = static_cast<std::size_t>(data[data_size].instruction.arg1);
+    ASSERT_EQ(data.size(), code + 5);
+
+    auto leaf_entry = static_cast<int>(Baikal::CLInputMapGenerator::kLeafsOffset);
+    ASSERT_EQ(data[code].instruction.op, Baikal::ClwScene::kInputMapOpSampler);
+    ASSERT_EQ(data[code].instruction.arg0, leaf_entry);
+    ASSERT_EQ(data[code + 1].instruction.op, Baikal::ClwScene::kInputMapOpMatMul);
+    ASSERT_EQ(data[code + 1].instruction.arg0, leaf_entry + 1);
+    ASSERT_EQ(data[code + 2].instruction.op, Baikal::ClwScene::kInputMapOpSampler);
+    ASSERT_EQ(data[code + 3].instruction.op, Baikal::ClwScene::kInputMapOpAdd);
+    ASSERT_EQ(data[code + 4].instruction.op, Baikal::ClwScene::kInputMapOpReturn);
+}
+
+TEST_F(InternalTest, InputMapOptimization)
+{
+    auto sampler = Baikal::InputMap_Sampler::Create(Baikal::Texture::Create());
+    auto scale = Baikal::InputMap_ConstantFloat::Create(2.f);
+    auto color = Baikal::InputMap_ConstantFloat3::Create(RadeonRays::float3(0.f, 1.f, 2.f));
+
+    // Constant subtree, two equal products and a shuffle reading only its first input
+    auto constant = Baikal::InputMap_Cos::Create(Baikal::InputMap_Mul::Create(scale, color));
+    auto product_a = Baikal::InputMap_Mul::Create(sampler, constant);
+    auto product_b = Baikal::InputMap_Mul::Create(sampler, constant);
+    auto sum = Baikal::InputMap_Add::Create(product_a, product_b);
+    auto root = Baikal::InputMap_Shuffle2::Create(sum, Baikal::InputMap_Sin::Create(sampler), { { 2, 1, 0, 3 } });
+
+    Baikal::Collector input_maps;
+    input_maps.BeginCollect();
+    input_maps.Collect(root);
+    input_maps.Commit();
+
+    Baikal::Collector leafs;
+    leafs.BeginCollect();
+    leafs.Collect(sampler);
+    leafs.Collect(scale);
+    leafs.Collect(color);
+    leafs.Commit();
+
+    auto constants = Baikal::CLInputMapGenerator::CollectConstantSubtrees(input_maps);
+    ASSERT_EQ(constants.size(), 1u);
+    ASSERT_EQ(constants[0], constant);
+
+    auto value = Baikal::CLInputMapGenerator::EvaluateConstant(constant);
+    ASSERT_NEAR(value.x, 1.f, 1e-5f);
+    ASSERT_NEAR(value.y, std::cos(2.f), 1e-5f);
+    ASSERT_NEAR(value.z, std::cos(4.f), 1e-5f);
+    ASSERT_NEAR(value.w, 1.f, 1e-5f);
+
+    Baikal::CLInputMapGenerator generator;
+    generator.Generate(input_maps, leafs);
+    auto source = generator.GetGeneratedSource();
+
+    // Texture is fetched once, folded value is read after the leafs
+    auto CountOccurrences = [&source](std::string const& str)
+    {
+        std::size_t count = 0;
+        for (auto pos = source.find(str); pos != std::string::npos; pos = source.find(str, pos + 1))
+        {
+            ++count;
+        }
+        return count;
+    };
+
+    ASSERT_EQ(CountOccurrences("Texture_Sample2D"), 1u);
+    ASSERT_EQ(CountOccurrences("sin("), 0u);
+    ASSERT_EQ(CountOccurrences("cos("), 0u);
+    ASSERT_EQ(CountOccurrences("input_map_values[4].float4_value.value"), 1u);
+
+    // Folding depends on graph structure only
+    scale->SetValue(3.f);
+    generator.Generate(input_maps, leafs);
+    ASSERT_EQ(generator.GetGeneratedSource(), source);
+
+    // Header, three leafs and one folded constant
+    auto data_size = Baikal::CLInputMapGenerator::kLeafsOffset + 3 + 1;
+    std::vector<Baikal::ClwScene::InputMapData> data(data_size);
+    Baikal::CLInputMapGenerator::GenerateInterpreterCode(input_maps, leafs, data);
+
+    // sampler, constant, mul, sampler, constant, mul, add, shuffle, return
+    auto code = static_cast<std::size_t>(data[data_size].instruction.arg1);
+    ASSERT_EQ(data.size(), code + 9);
+    ASSERT_EQ(data[code + 1].instruction.op, Baikal::ClwScene::kInputMapOpConstant4);
+    ASSERT_EQ(data[code + 1].instruction.arg0, static_cast<int>(data_size - 1));
+    ASSERT_EQ(data[code + 7].instruction.op, Baikal::ClwScene::kInputMapOpShuffle);
+}
+
+TEST_F(InternalTest, UberV2SharedInputs)
+{
+    auto material = Baikal::UberV2Material::Create();
+    material->SetLayers(Baikal::UberV2Material::Layers::kReflectionLayer | Baikal::UberV2Material::Layers::kDiffuseLayer);
+
+    Baikal::CLUberV2Generator generator;
+    generator.AddMaterial(material);
+    auto source = generator.BuildSource();
+
+    // Diffuse color bound to the same input map as reflection color reuses its value
+    ASSERT_NE(source.find("(input_map6 == input_map0) ? data->reflection_color :"), std::string::npos);
+    // Scalar inputs reuse the first component
+    ASSERT_NE(source.find("(input_map1 == input_map0) ? data->reflection_color.x :"), std::string::npos);
+    // Only float4 inputs are reused
+    ASSERT_EQ(source.find("(input_map6 == input_map1)"), std::string::npos);
+}
+
+TEST_F(InternalTest, AccelerationStructureChoice)
+{
+    using Baikal::AccelerationStructure;
+
+    // Explicit choices are kept
+    ASSERT_EQ(Baikal::ChooseAccelerationStructure(AccelerationStructure::kBalanced, 1u << 26, true), AccelerationStructure::kBalanced);
+
+    // Small scenes get the best structure until edited, large edited ones the fastest build
+    ASSERT_EQ(Baikal::ChooseAccelerationStructure(AccelerationStructure::kAuto, 1000, false), AccelerationStructure::kHighQuality);
+    ASSERT_EQ(Baikal::ChooseAccelerationStructure(AccelerationStructure::kAuto, 1000, true), AccelerationStructure::kBalanced);
+    ASSERT_EQ(Baikal::ChooseAccelerationStructure(AccelerationStructure::kAuto, Baikal::kAutoHighQualityTriangles + 1, false), AccelerationStructure::kBalanced);
+    ASSERT_EQ(Baikal::ChooseAccelerationStructure(AccelerationStructure::kAuto, Baikal::kAutoFastBuildEditedTriangles + 1, true), AccelerationStructure::kFastBuild);
+    ASSERT_EQ(Baikal::ChooseAccelerationStructure(AccelerationStructure::kAuto, Baikal::kAutoFastBuildTriangles + 1, false), AccelerationStructure::kFastBuild);
+
+    // HLBVH only builds flat structures
+    ASSERT_EQ(Baikal::GetAccelerationStructureOptions(AccelerationStructure::kFastBuild, false).type, "hlbvh");
+    ASSERT_EQ(Baikal::GetAccelerationStructureOptions(AccelerationStructure::kFastBuild, true).type, "fatbvh");
+    ASSERT_TRUE(Baikal::GetAccelerationStructureOptions(AccelerationStructure::kHighQuality, true).use_splits);
+}
+
+TEST_F(InternalTest, ObjParser)
+{
+    std::string const obj =
+        "mtllib scene.mtl\n"
+        "v 0 0 0\n"
+        "v 1 0 0\n"
+        "v 1 1 0\n"
+        "v 0 1 0\n"
+        "vn 0 0 1\n"
+        "vt 0 0\n"
+        "vt 1 0\n"
+        "vt 1 1\n"
+        "vt 0 1\n"
+        "o quad\n"
+        "usemtl red\n"
+        "f 1/1/1 2/2/1 3/3/1 4/4/1 # fan triangulated\n"
+        "g relative\n"
+        "usemtl blue\n"
+        "f -4//1 -3//1 -2//1\n"
+        "usemtl red\n"
+        "f -4 -2 -1\n"
+        "usemtl blue\n"
+        "f 1//1 3//1 4//1\n";
+
+    Baikal::TaskScheduler scheduler(2);
+    auto data = Baikal::ParseObj(obj.data(), obj.size(), scheduler);
+
+    ASSERT_EQ(data.positions.size(), 4u);
+    ASSERT_EQ(data.normals.size(), 1u);
+    ASSERT_EQ(data.texcoords.size(), 4u);
+    ASSERT_EQ(data.corners.size(), 3u * 5u);
+    ASSERT_EQ(data.material_libraries, std::vector<std::string>({ "scene.mtl" }));
+    ASSERT_EQ(data.shape_names, std::vector<std::string>({ "", "quad", "relative" }));
+    ASSERT_EQ(data.material_names, std::vector<std::string>({ "red", "blue" }));
+
+    // Relative indices count back from the last attribute before the face, v//vn has no texcoord
+    auto const& corner = data.corners[3 * 2 + 1];
+    ASSERT_EQ(corner.position, 1);
+    ASSERT_EQ(corner.texcoord, -1);
+    ASSERT_EQ(corner.normal, 0);
+    ASSERT_EQ(data.corners[3 * 3 + 2].position, 3);
+    ASSERT_EQ(data.corners[3 * 3 + 2].normal, -1);
+
+    // Groups of a shape are split by material, later uses of a material extend its group
+    ASSERT_EQ(data.groups.size(), 3u);
+    ASSERT_EQ(data.groups[0].shape, 1u);
+    ASSERT_EQ(data.groups[0].material, 0);
+    ASSERT_EQ(data.groups[0].triangles, (std::vector<std::pair<std::size_t, std::size_t>>{ { 0u, 2u } }));
+    ASSERT_EQ(data.groups[1].shape, 2u);
+    ASSERT_EQ(data.groups[1].material, 1);
+    ASSERT_EQ(data.groups[1].triangles, (std::vector<std::pair<std::size_t, std::size_t>>{ { 2u, 3u }, { 4u, 5u } }));
+    ASSERT_EQ(data.groups[2].shape, 2u);
+    ASSERT_EQ(data.groups[2].material, 0);
+    ASSERT_EQ(data.groups[2].triangles, (std::vector<std::pair<std::size_t, std::size_t>>{ { 3u, 4u } }));
+
+    // Corners with the same indices are welded
+    auto quad = Baikal::BuildObjMesh(data, data.groups[0]);
+    ASSERT_EQ(quad.vertices.size(), 4u);
+    ASSERT_EQ(quad.indices, std::vector<std::uint32_t>({ 0u, 1u, 2u, 0u, 2u, 3u }));
+    ASSERT_EQ(quad.uvs[2].x, 1.f);
+    ASSERT_EQ(quad.uvs[2].y, 1.f);
+    ASSERT_EQ(quad.normals[3].z, 1.f);
+
+    auto welded = Baikal::BuildObjMesh(data, data.groups[1]);
+    ASSERT_EQ(welded.vertices.size(), 4u);
+    ASSERT_EQ(welded.indices, std::vector<std::uint32_t>({ 0u, 1u, 2u, 0u, 2u, 3u }));
+    ASSERT_EQ(welded.uvs[1].x, 0.f);
+
+    // Missing normals are generated from the faces
+    auto generated = Baikal::BuildObjMesh(data, data.groups[2]);
+    ASSERT_EQ(generated.vertices.size(), 3u);
+    for (auto const& normal : generated.normals)
+    {
+        ASSERT_NEAR(normal.x, 0.f, 1e-6f);
+        ASSERT_NEAR(normal.y, 0.f, 1e-6f);
+        ASSERT_NEAR(normal.z, 1.f, 1e-6f);
+        ASSERT_EQ(normal.w, 0.f);
+    }
+
+    // Indices out of range, zero and relative ones before the first attribute are rejected
+    for (auto invalid : { "v 0 0 0\nf 1 2 1\n", "v 0 0 0\nf 0 1 1\n", "v 0 0 0\nf -2 1 1\n", "v 0 0 0\nvn 0 0 1\nf 1//2 1 1\n", "v 0 0 0\nf 1 a 1\n" })
+    {
+        std::string text(invalid);
+        ASSERT_THROW(Baikal::ParseObj(text.data(), text.size(), scheduler), std::runtime_error);
+    }
+}
+
+TEST_F(InternalTest, ObjParserChunks)
+{
+    // Large enough for several chunks, every face references the vertices right before it
+    std::size_t const num_triangles = 300000;
+
+    std::string obj = "usemtl first\n";
+    for (std::size_t i = 0; i < num_triangles; ++i)
+    {
+        auto x = std::to_string(i);
+
+        if (i == num_triangles / 2)
+        {
+            obj += "usemtl second\n";
+        }
+
+        obj += "v " + x + " 0 0\nv " + x + " 1 0\nv " + x + " 0 1\nf -3 -2 -1\n";
+    }
+
+    Baikal::TaskScheduler scheduler(4);
+    auto data = Baikal::ParseObj(obj.data(), obj.size(), scheduler);
+
+    ASSERT_GT(obj.size(), 8u << 20);
+    ASSERT_EQ(data.positions.size(), 3 * num_triangles);
+    ASSERT_EQ(data.corners.size(), 3 * num_triangles);
+
+    for (std::size_t i = 0; i < num_triangles; ++i)
+    {
+        for (std::size_t c = 0; c < 3; ++c)
+        {
+            ASSERT_EQ(data.corners[3 * i + c].position, static_cast<std::int32_t>(3 * i + c));
+        }
+
+        ASSERT_EQ(data.positions[3 * i].x, static_cast<float>(i));
+    }
+
+    // Statements apply at their place in the file regardless of the chunk they are in
+    ASSERT_EQ(data.groups.size(), 2u);
+    ASSERT_EQ(data.groups[0].triangles, (std::vector<std::pair<std::size_t, std::size_t>>{ { 0u, num_triangles / 2 } }));
+    ASSERT_EQ(data.groups[1].triangles, (std::vector<std::pair<std::size_t, std::size_t>>{ { num_triangles / 2, num_triangles } }));
+}
+
+TEST_F(InternalTest, JsonParser)
+{
+    std::string const text =
+        "{ \"number\": -1.5e2, \"integer\": 42, \"flag\": true, \"nothing\": null,"
+        "  \"text\": \"a\\\"b\\\\c\\nd\\u00e9\\ud83d\\ude00\","
+        "  \"array\": [ 1, [ 2, 3 ], {} ], \"object\": { \"inner\": \"value\" } }";
+
+    auto json = Baikal::JsonValue::Parse(text.data(), text.size());
+
+    ASSERT_TRUE(json.IsObject());
+    ASSERT_EQ(json.GetSize(), 7u);
+    ASSERT_EQ(json["number"].AsNumber(), -150.0);
+    ASSERT_EQ(json["integer"].AsNumber(), 42.0);
+    ASSERT_TRUE(json["flag"].AsBool());
+    ASSERT_TRUE(json.HasMember("nothing"));
+    ASSERT_TRUE(json["nothing"].IsNull());
+    // Escapes are decoded into UTF-8, surrogate pairs into a single code point
+    ASSERT_EQ(json["text"].AsString(), "a\"b\\c\nd\xc3\xa9\xf0\x9f\x98\x80");
+    ASSERT_EQ(json["array"].GetSize(), 3u);
+    ASSERT_EQ(json["array"].At(1).At(1).AsNumber(), 3.0);
+    ASSERT_TRUE(json["array"].At(2).IsObject());
+    ASSERT_EQ(json["object"]["inner"].AsString(), "value");
+
+    // Missing members and elements are null, values of other types give the fallback
+    ASSERT_FALSE(json.HasMember("missing"));
+    ASSERT_TRUE(json["missing"]["deeper"].IsNull());
+    ASSERT_TRUE(json["array"].At(5).IsNull());
+    ASSERT_EQ(json["text"].AsNumber(7.0), 7.0);
+    ASSERT_EQ(json["number"].AsString(), "");
+
+    for (auto invalid : { "", "{ \"a\": 1, }", "[ 1 2 ]", "{ \"a\" 1 }", "\"open", "\"\\x\"", "\"\\u12\"", "01x", "1.", "1e", "tru", "{} {}" })
+    {
+        std::string invalid_text(invalid);
+        ASSERT_THROW(Baikal::JsonValue::Parse(invalid_text.data(), invalid_text.size()), std::runtime_error);
+    }
+
+    // Nesting is limited
+    std::string deep(1000, '[');
+    deep += std::string(1000, ']');
+    ASSERT_THROW(Baikal::JsonValue::Parse(deep.data(), deep.size()), std::runtime_error);
+}
+
+TEST_F(InternalTest, GltfLoader)
+{
+    auto buffer = MakeTriangleBuffer();
+    auto uri = ", \"uri\": \"data:application/octet-stream;base64," + EncodeBase64(buffer) + "\"";
+
+    // Buffer of a data URI, strided positions and 16 bit indices
+    Baikal::Scene1::Ptr scene;
+    ASSERT_NO_THROW(scene = Baikal::SceneIo::LoadScene(WriteTestFile("gltf_loader.gltf", MakeGltfDocument(uri)), "OutputImages/"));
+    ASSERT_NO_FATAL_FAILURE(CheckGltfScene(*scene));
+
+    // Positions read with a stride shorter than the element, past the view or with the view past the buffer
+    ASSERT_THROW(Baikal::SceneIo::LoadScene(WriteTestFile("gltf_loader_stride.gltf",
+        MakeGltfDocument(uri, "\"byteLength\": 48, \"byteStride\": 8")), "OutputImages/"), std::runtime_error);
+    ASSERT_THROW(Baikal::SceneIo::LoadScene(WriteTestFile("gltf_loader_count.gltf",
+        MakeGltfDocument(uri, "\"byteLength\": 48, \"byteStride\": 16", "4")), "OutputImages/"), std::runtime_error);
+    ASSERT_THROW(Baikal::SceneIo::LoadScene(WriteTestFile("gltf_loader_view.gltf",
+        MakeGltfDocument(uri, "\"byteOffset\": 16, \"byteLength\": 48, \"byteStride\": 16")), "OutputImages/"), std::runtime_error);
+
+    // Data URIs should be base64 encoded
+    auto text_uri = ", \"uri\": \"data:application/octet-stream,abc\"";
+    ASSERT_THROW(Baikal::SceneIo::LoadScene(WriteTestFile("gltf_loader_uri.gltf", MakeGltfDocument(text_uri)), "OutputImages/"), std::runtime_error);
+}
+
+TEST_F(InternalTest, GltfLoaderBinary)
+{
+    auto append_uint32 = [](std::string& str, std::uint32_t value)
+    {
+        str.append(reinterpret_cast<char const*>(&value), sizeof(value));
+    };
+
+    // Chunks are padded to 4 bytes, the JSON one with spaces and the binary one with zeros
+    auto json = MakeGltfDocument("");
+    json.resize((json.size() + 3) & ~std::size_t(3), ' ');
+    auto bin = MakeTriangleBuffer();
+    bin.resize((bin.size() + 3) & ~std::size_t(3), '\0');
+
+    std::string glb;
+    append_uint32(glb, 0x46546c67);
+    append_uint32(glb, 2);
+    append_uint32(glb, static_cast<std::uint32_t>(12 + 8 + json.size() + 8 + bin.size()));
+    append_uint32(glb, static_cast<std::uint32_t>(json.size()));
+    append_uint32(glb, 0x4e4f534a);
+    glb += json;
+    append_uint32(glb, static_cast<std::uint32_t>(bin.size()));
+    append_uint32(glb, 0x004e4942);
+    glb += bin;
+
+    Baikal::Scene1::Ptr scene;
+    ASSERT_NO_THROW(scene = Baikal::SceneIo::LoadScene(WriteTestFile("gltf_loader.glb", glb), "OutputImages/"));
+    ASSERT_NO_FATAL_FAILURE(CheckGltfScene(*scene));
+
+    // Chunks past the end of the file
+    auto truncated = glb.substr(0, glb.size() - 8);
+    ASSERT_THROW(Baikal::SceneIo::LoadScene(WriteTestFile("gltf_loader_truncated.glb", truncated), "OutputImages/"), std::runtime_error);
+
+    // Binary chunk shorter than the buffer
+    auto short_bin = glb;
+    std::uint32_t const total_size = static_cast<std::uint32_t>(glb.size() - 8);
+    std::uint32_t const bin_size = static_cast<std::uint32_t>(bin.size() - 8);
+    std::memcpy(&short_bin[8], &total_size, sizeof(total_size));
+    std::memcpy(&short_bin[12 + 8 + json.size()], &bin_size, sizeof(bin_size));
+    short_bin.resize(total_size);
+    ASSERT_THROW(Baikal::SceneIo::LoadScene(WriteTestFile("gltf_loader_short.glb", short_bin), "OutputImages/"), std::runtime_error);
+}
+
+TEST_F(InternalTest, MaterialIoRoundTrip)
+{
+    using namespace Baikal;
+
+    // Single input maps used to fall through into the lerp case when written to XML
+    auto color = InputMap_Lerp::Create(
+        InputMap_Abs::Create(InputMap_ConstantFloat3::Create(RadeonRays::float3(-0.25f, -0.5f, -0.75f))),
+        InputMap_ConstantFloat3::Create(RadeonRays::float3(1.f, 1.f, 1.f)),
+        InputMap_Floor::Create(InputMap_ConstantFloat::Create(0.5f)));
+    auto roughness = InputMap_Select::Create(
+        InputMap_Mul::Create(InputMap_ConstantFloat3::Create(RadeonRays::float3(0.1f, 0.2f, 0.3f)), InputMap_Sin::Create(InputMap_ConstantFloat::Create(1.f))),
+        InputMap_Select::Selection::kY);
+
+    auto material = UberV2Material::Create();
+    material->SetName("round_trip");
+    material->SetLayers(UberV2Material::Layers::kDiffuseLayer | UberV2Material::Layers::kReflectionLayer);
+    material->SetInputValue("uberv2.diffuse.color", color);
+    material->SetInputValue("uberv2.reflection.roughness", roughness);
+
+    std::unique_ptr<MaterialIo> ios[] = { MaterialIo::CreateMaterialIoXML(), MaterialIo::CreateMaterialIoBinary() };
+    char const* file_names[] = { "material_io_round_trip.xml", "material_io_round_trip.bin" };
+
+    for (auto i = 0u; i < 2u; ++i)
+    {
+        auto file_name = WriteTestFile(file_names[i], "");
+
+        std::set<Material::Ptr> materials = { material };
+        ContainerIterator<std::set<Material::Ptr>> iterator(std::move(materials));
+        ASSERT_NO_THROW(ios[i]->SaveMaterials(file_name, iterator));
+
+        std::unique_ptr<Iterator> loaded;
+        ASSERT_NO_THROW(loaded = ios[i]->LoadMaterials(file_name));
+        ASSERT_TRUE(loaded->IsValid());
+
+        auto loaded_material = loaded->ItemAs<UberV2Material>();
+        ASSERT_TRUE(loaded_material);
+        ASSERT_EQ(loaded_material->GetName(), "round_trip");
+        ASSERT_EQ(loaded_material->GetLayers(), material->GetLayers());
+
+        ASSERT_NO_FATAL_FAILURE(CheckSameInputMap(color, loaded_material->GetInputValue("uberv2.diffuse.color").input_map_value));
+        ASSERT_NO_FATAL_FAILURE(CheckSameInputMap(roughness, loaded_material->GetInputValue("uberv2.reflection.roughness").input_map_value));
+
+        loaded->Next();
+        ASSERT_FALSE(loaded->IsValid());
+    }
+}
+
+TEST_F(InternalTest, OptimizeMesh)
+{
+    using RadeonRays::float3;
+
+    // Quad split in two, vertex 4 is on the bottom edge and vertex 5 is never referenced
+    std::vector<float3> vertices = { float3(0.f, 0.f, 0.f), float3(1.f, 0.f, 0.f), float3(1.f, 1.f, 0.f), float3(0.f, 1.f, 0.f), float3(0.5f, 0.f, 0.f), float3(5.f, 5.f, 5.f) };
+    // Normals carry the original vertex index to check attributes follow their vertex
+    std::vector<float3> normals;
+    for (auto i = 0u; i < vertices.size(); ++i)
+    {
+        normals.push_back(float3(static_cast<float>(i), 0.f, 0.f));
+    }
+
+    std::vector<std::uint32_t> indices = {
+        0, 1, 2,
+        0, 2, 3,
+        // Same triangle as the first with a rotated winding
+        1, 2, 0,
+        // Repeated index and zero area triangles
+        0, 0, 1,
+        0, 4, 1
+    };
+
+    auto mesh = Baikal::Mesh::Create();
+    mesh->SetVertices(vertices.data(), vertices.size());
+    mesh->SetNormals(normals.data(), normals.size());
+    mesh->SetIndices(indices.data(), indices.size());
+
+    auto stats = Baikal::OptimizeMesh(*mesh);
+    ASSERT_EQ(stats.num_degenerate_triangles, 2u);
+    ASSERT_EQ(stats.num_duplicate_triangles, 1u);
+    ASSERT_EQ(stats.num_unused_vertices, 2u);
+
+    ASSERT_EQ(mesh->GetNumVertices(), 4u);
+    ASSERT_EQ(mesh->GetNumNormals(), 4u);
+    ASSERT_EQ(mesh->GetNumIndices(), 6u);
+
+    auto new_vertices = mesh->GetVertices();
+    auto new_normals = mesh->GetNormals();
+    for (auto i = 0u; i < mesh->GetNumVertices(); ++i)
+    {
+        auto original = static_cast<std::uint32_t>(new_normals[i].x);
+        ASSERT_LT(original, 4u);
+        ASSERT_EQ(new_vertices[i].x, vertices[original].x);
+        ASSERT_EQ(new_vertices[i].y, vertices[original].y);
+        ASSERT_EQ(new_vertices[i].z, vertices[original].z);
+    }
+
+    // Triangles may be reordered and renumbered, but the set with its windings has to survive
+    auto triangle_set = [](std::vector<std::uint32_t> const& triangles)
+    {
+        std::set<std::vector<std::uint32_t>> result;
+        for (auto i = 0u; i < triangles.size(); i += 3)
+        {
+            std::vector<std::uint32_t> t(triangles.begin() + i, triangles.begin() + i + 3);
+            std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+            result.insert(t);
+        }
+        return result;
+    };
+
+    std::vector<std::uint32_t> original_indices;
+    auto new_indices = mesh->GetIndices();
+    for (auto i = 0u; i < mesh->GetNumIndices(); ++i)
+    {
+        original_indices.push_back(static_cast<std::uint32_t>(new_normals[new_indices[i]].x));
+    }
+
+    std::vector<std::uint32_t> expected = { 0, 1, 2, 0, 2, 3 };
+    ASSERT_EQ(triangle_set(original_indices), triangle_set(expected));
+}
@@ -27,6 +27,7 @@ THE SOFTWARE.
 #include "SceneGraph/material.h"
 #include "SceneGraph/uberv2material.h"
 #include "SceneGraph/inputmaps.h"
+#include "Utils/ies_profile.h"
 
 #include "image_io.h"
 
@@ -164,6 +165,59 @@ TEST_F(LightTest, Light_PointLightMany)
     }
 }
 
+TEST_F(LightTest, Light_PointLightHierarchy)
+{
+    m_camera->LookAt(
+        RadeonRays::float3(0.f, 2.f, -10.f),
+        RadeonRays::float3(0.f, 2.f, 0.f),
+        RadeonRays::float3(0.f, 1.f, 0.f));
+
+
+    // Enough lights to make the controller build light hierarchy
+    auto num_lights = 128u;
+    std::vector<float3> positions;
+    std::vector<float3> colors;
+
+    float step = (float)(2.f * M_PI / num_lights);
+    for (auto i = 0u; i < num_lights; ++i)
+    {
+        auto x = 5.f * std::cos(i * step);
+        auto y = 5.f;
+        auto z = 5.f * std::sin(i * step);
+        positions.push_back(float3(x, y, z));
+
+        auto f = (float)i / num_lights;
+        auto color = f * float3(1.f, 0.f, 0.f) + (1.f - f) * float3(0.f, 1.f, 0.f);
+        colors.push_back(0.75f * color);
+    }
+
+    for (auto i = 0u; i < num_lights; ++i)
+    {
+        auto light = Baikal::PointLight::Create();
+        light->SetPosition(positions[i]);
+        light->SetEmittedRadiance(colors[i]);
+        m_scene->AttachLight(light);
+    }
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < 16 * kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    {
+        std::ostringstream oss;
+        oss << test_name() << ".png";
+        SaveOutput(oss.str());
+        ASSERT_TRUE(CompareToReference(oss.str()));
+    }
+}
+
 TEST_F(LightTest, Light_DirectionalLight)
 {
     m_camera->LookAt(
@@ -308,6 +362,81 @@ TEST_F(LightTest, Light_SpotLight)
     }
 }
 
+TEST_F(LightTest, Light_IesProfile)
+{
+    m_camera->LookAt(
+        RadeonRays::float3(0.f, 2.f, -10.f),
+        RadeonRays::float3(0.f, 2.f, 0.f),
+        RadeonRays::float3(0.f, 1.f, 0.f));
+
+    // Narrow downward beam brighter across the 90 degree plane
+    std::string data =
+        "IESNA:LM-63-2002\n"
+        "TILT=NONE\n"
+        "1 1000 1.0 4 3 1 1 0 0 0\n"
+        "1.0 1.0 100\n"
+        "0 20 40 90\n"
+        "0 90 180\n"
+        "100 80 10 0\n"
+        "100 90 40 0\n"
+        "100 80 10 0\n";
+
+    auto profile = Baikal::IesProfile::Parse(data).CreateTexture(64u, 32u);
+
+    auto point_light = Baikal::PointLight::Create();
+    point_light->SetPosition(float3(2.f, 6.f, 0.f));
+    point_light->SetEmittedRadiance(float3(6.f, 6.f, 6.f));
+    point_light->SetProfile(profile);
+    m_scene->AttachLight(point_light);
+
+    // Profile is applied within the cone of the spot light
+    auto spot_light = Baikal::SpotLight::Create();
+    spot_light->SetPosition(float3(-2.f, 6.f, -1.f));
+    spot_light->SetDirection(float3(0.f, -1.f, 0.3f));
+    spot_light->SetEmittedRadiance(float3(6.f, 3.f, 1.f));
+    spot_light->SetProfile(profile);
+    m_scene->AttachLight(spot_light);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    {
+        std::ostringstream oss;
+        oss << test_name() << "_1.png";
+        SaveOutput(oss.str());
+        ASSERT_TRUE(CompareToReference(oss.str()));
+    }
+
+    // Removing the profile goes back to uniform emission
+    point_light->SetProfile(nullptr);
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene1 = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene1));
+    }
+
+    {
+        std::ostringstream oss;
+        oss << test_name() << "_2.png";
+        SaveOutput(oss.str());
+        ASSERT_TRUE(CompareToReference(oss.str()));
+    }
+}
+
 TEST_F(LightTest, Light_AreaLight)
 {
     m_camera->LookAt(
@@ -599,6 +728,53 @@ TEST_F(LightTest, Light_DirectionalAndEmissiveSphere)
     }
 }
 
+TEST_F(LightTest, Light_LinkMask)
+{
+    m_camera->LookAt(
+        RadeonRays::float3(0.f, 2.f, -10.f),
+        RadeonRays::float3(0.f, 2.f, 0.f),
+        RadeonRays::float3(0.f, 1.f, 0.f));
+
+    // Red light illuminates everything, green one the sphere only
+    auto red_light = Baikal::PointLight::Create();
+    red_light->SetPosition(float3(3.f, 6.f, 0.f));
+    red_light->SetEmittedRadiance(float3(3.f, 0.1f, 0.1f));
+    red_light->SetLinkMask(0x1u);
+    m_scene->AttachLight(red_light);
+
+    auto green_light = Baikal::PointLight::Create();
+    green_light->SetPosition(float3(-2.f, 6.f, -1.f));
+    green_light->SetEmittedRadiance(float3(0.1f, 3.f, 0.1f));
+    green_light->SetLinkMask(0x2u);
+    m_scene->AttachLight(green_light);
+
+    auto iter = m_scene->CreateShapeIterator();
+
+    for (; iter->IsValid(); iter->Next())
+    {
+        auto mesh = iter->ItemAs<Baikal::Mesh>();
+        mesh->SetLightLinkMask(mesh->GetName() == "sphere" ? 0x3u : 0x1u);
+    }
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    {
+        std::ostringstream oss;
+        oss << test_name() << ".png";
+        SaveOutput(oss.str());
+        ASSERT_TRUE(CompareToReference(oss.str()));
+    }
+}
+
 TEST_F(LightTest, Light_ImageBasedLight)
 {
     m_camera->LookAt(
@@ -745,6 +921,114 @@ TEST_F(LightTest, Light_ImageBasedLightAndLightChanging)
     }
 }
 
+TEST_F(LightTest, Light_ImageBasedLightTextureSwap)
+{
+    LoadTestScene();
+    m_scene->SetCamera(m_camera);
+
+    auto image_io(Baikal::ImageIo::CreateImageIo());
+    auto studio_texture = image_io->LoadImage("../Resources/Textures/studio015.hdr");
+    auto sky_texture = image_io->LoadImage("../Resources/Textures/sky.hdr");
+
+    auto light = Baikal::ImageBasedLight::Create();
+    light->SetTexture(studio_texture);
+    light->SetMultiplier(1.f);
+    m_scene->AttachLight(light);
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+    ASSERT_GE(scene.texture_bytes_uploaded, studio_texture->GetSizeInBytes());
+
+    // Only the new texture is written, the rest of the pool stays in place
+    light->SetTexture(sky_texture);
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+    ASSERT_EQ(scene.texture_bytes_uploaded, sky_texture->GetSizeInBytes());
+
+    ClearOutput();
+
+    for (std::uint32_t i = 0; i < kNumIterations; i++)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(LightTest, Light_ImageBasedLightImportanceSampling)
+{
+    LoadTestScene();
+    m_scene->SetCamera(m_camera);
+
+    // Dim environment with a single bright texel, texture data is owned by the texture
+    auto const width = 16;
+    auto const height = 8;
+    auto const sun_x = 5;
+    auto const sun_y = 3;
+    auto texels = new float[width * height * 4];
+    std::fill(texels, texels + width * height * 4, 0.05f);
+    std::fill(texels + (sun_y * width + sun_x) * 4, texels + (sun_y * width + sun_x) * 4 + 4, 500.f);
+
+    auto texture = Baikal::Texture::Create(reinterpret_cast<char*>(texels), RadeonRays::int3(width, height, 1), Baikal::Texture::Format::kRgba32);
+    auto light = Baikal::ImageBasedLight::Create();
+    light->SetTexture(texture);
+    light->SetMultiplier(1.f);
+    m_scene->AttachLight(light);
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    // Width, height, marginal distribution over rows, then conditional distribution of each row:
+    // number of segments, num_segments + 1 CDF values, num_segments PDF values, alias table
+    auto distribution_size = [](std::size_t num_segments) { return 1 + (num_segments + 1) + 3 * num_segments; };
+    std::vector<int> data(2 + distribution_size(height) + height * distribution_size(width));
+    ASSERT_GE(scene.envmap_distribution.GetElementCount(), data.size());
+    m_context.ReadBuffer(0, scene.envmap_distribution, data.data(), data.size()).Wait();
+
+    ASSERT_EQ(data[0], width);
+    ASSERT_EQ(data[1], height);
+    ASSERT_EQ(data[2], height);
+
+    auto row_pdf = reinterpret_cast<float const*>(&data[2 + 1 + height + 1]);
+    ASSERT_EQ(std::max_element(row_pdf, row_pdf + height) - row_pdf, sun_y);
+    ASSERT_GT(row_pdf[sun_y], 0.5f);
+
+    auto sun_row = &data[2 + distribution_size(height) + sun_y * distribution_size(width)];
+    ASSERT_EQ(sun_row[0], width);
+
+    auto column_pdf = reinterpret_cast<float const*>(&sun_row[1 + width + 1]);
+    ASSERT_EQ(std::max_element(column_pdf, column_pdf + width) - column_pdf, sun_x);
+    ASSERT_NEAR(std::accumulate(column_pdf, column_pdf + width, 0.f), 1.f, 1e-4f);
+
+    // Uniform rows get a uniform conditional distribution
+    auto other_row = &data[2 + distribution_size(height)];
+    auto other_pdf = reinterpret_cast<float const*>(&other_row[1 + width + 1]);
+    ASSERT_NEAR(other_pdf[0], 1.f / width, 1e-5f);
+    ASSERT_NEAR(other_pdf[width - 1], 1.f / width, 1e-5f);
+
+    ClearOutput();
+
+    for (std::uint32_t i = 0; i < kNumIterations; i++)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    // Sampling the small bright texel by its pdf should not produce invalid values
+    std::vector<RadeonRays::float3> output(m_output->width() * m_output->height());
+    m_output->GetData(output.data());
+
+    for (auto const& value : output)
+    {
+        ASSERT_TRUE(std::isfinite(value.x) && std::isfinite(value.y) && std::isfinite(value.z));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
 TEST_F(LightTest, Light_ImageBasedLightAndEmissiveQuad)
 {
     m_camera->LookAt(
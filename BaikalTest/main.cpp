@@ -24,6 +24,7 @@ THE SOFTWARE.
 #include "CLW.h"
 
 #include "internal.h"
+#include "test_environment.h"
 #include "basic.h"
 #include "camera.h"
 #include "light.h"
@@ -40,6 +41,8 @@ char** g_argv;
 int main(int argc, char** argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
+    // Shared by the rendering tests, gtest owns it
+    ::testing::AddGlobalTestEnvironment(new TestEnvironment());
     g_argc = argc;
     g_argv = argv;
     return RUN_ALL_TESTS();
@@ -953,3 +953,133 @@ TEST_F(MaterialTest, Material_PhaseFunction)
     }
 }
 
+
+TEST_F(MaterialTest, Material_HeterogeneousVolume)
+{
+    using namespace Baikal;
+
+    m_camera->LookAt(
+        RadeonRays::float3(0.f, 2.f, -10.f),
+        RadeonRays::float3(0.f, 2.f, 0.f),
+        RadeonRays::float3(0.f, 1.f, 0.f));
+
+    auto material = UberV2Material::Create();
+    material->SetLayers(UberV2Material::Layers::kTransparencyLayer);
+
+    auto volume = VolumeMaterial::Create();
+
+    volume->SetInputValue("absorption", RadeonRays::float4(.5f, .5f, .5f, .5f));
+    volume->SetInputValue("scattering", RadeonRays::float4(.5f, .5f, .5f, .5f));
+    volume->SetInputValue("emission", RadeonRays::float4(.0f, .0f, .0f, .0f));
+    volume->SetInputValue("g", RadeonRays::float4(.0f, .0f, .0f, .0f));
+
+    // Density grows along y and the upper half is empty
+    VolumeMaterial::DensityGrid grid;
+    grid.resolution[0] = grid.resolution[1] = grid.resolution[2] = 16u;
+    grid.density.resize(16u * 16u * 16u);
+
+    for (auto i = 0u; i < grid.density.size(); ++i)
+    {
+        auto y = (i / 16u) % 16u;
+        grid.density[i] = y < 8u ? 0.25f * y : 0.f;
+    }
+
+    ASSERT_THROW(volume->SetDensityGrid(VolumeMaterial::DensityGrid()), std::runtime_error);
+
+    for (auto iter = m_scene->CreateShapeIterator();
+        iter->IsValid();
+        iter->Next())
+    {
+        auto mesh = iter->ItemAs<Mesh>();
+        if (mesh->GetName() == "sphere")
+        {
+            grid.bounds = mesh->GetWorldAABB();
+            ASSERT_NO_THROW(volume->SetDensityGrid(grid));
+
+            mesh->SetMaterial(material);
+            mesh->SetVolumeMaterial(volume);
+        }
+    }
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
+
+TEST_F(MaterialTest, Material_SparseHeterogeneousVolume)
+{
+    using namespace Baikal;
+
+    m_camera->LookAt(
+        RadeonRays::float3(0.f, 2.f, -10.f),
+        RadeonRays::float3(0.f, 2.f, 0.f),
+        RadeonRays::float3(0.f, 1.f, 0.f));
+
+    auto material = UberV2Material::Create();
+    material->SetLayers(UberV2Material::Layers::kTransparencyLayer);
+
+    auto volume = VolumeMaterial::Create();
+
+    volume->SetInputValue("absorption", RadeonRays::float4(.5f, .5f, .5f, .5f));
+    volume->SetInputValue("scattering", RadeonRays::float4(.5f, .5f, .5f, .5f));
+    volume->SetInputValue("emission", RadeonRays::float4(.0f, .0f, .0f, .0f));
+    volume->SetInputValue("g", RadeonRays::float4(.0f, .0f, .0f, .0f));
+
+    // Same density as in Material_HeterogeneousVolume, only the lower bricks are stored
+    VolumeMaterial::SparseDensityGrid grid;
+    grid.resolution[0] = grid.resolution[1] = grid.resolution[2] = 16u;
+
+    for (auto z = 0u; z < 2u; ++z)
+    {
+        for (auto x = 0u; x < 2u; ++x)
+        {
+            grid.bricks.insert(grid.bricks.end(), { x, 0u, z });
+
+            for (auto i = 0u; i < 512u; ++i)
+            {
+                grid.density.push_back(0.25f * ((i / 8u) % 8u));
+            }
+        }
+    }
+
+    ASSERT_THROW(volume->SetSparseDensityGrid(VolumeMaterial::SparseDensityGrid()), std::runtime_error);
+
+    for (auto iter = m_scene->CreateShapeIterator();
+        iter->IsValid();
+        iter->Next())
+    {
+        auto mesh = iter->ItemAs<Mesh>();
+        if (mesh->GetName() == "sphere")
+        {
+            grid.bounds = mesh->GetWorldAABB();
+            ASSERT_NO_THROW(volume->SetSparseDensityGrid(grid));
+
+            mesh->SetMaterial(material);
+            mesh->SetVolumeMaterial(volume);
+        }
+    }
+
+    ClearOutput();
+
+    ASSERT_NO_THROW(m_controller->CompileScene(m_scene));
+
+    auto& scene = m_controller->GetCachedScene(m_scene);
+
+    for (auto i = 0u; i < kNumIterations; ++i)
+    {
+        ASSERT_NO_THROW(m_renderer->Render(scene));
+    }
+
+    SaveOutput(test_name() + ".png");
+    ASSERT_TRUE(CompareToReference(test_name() + ".png"));
+}
@@ -0,0 +1,153 @@
+/**********************************************************************
+Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include "Utils/clw_profiler.h"
+#include "Utils/mkpath.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+// Device times of tests stored in a text file, one line per test step with its milliseconds per sample.
+// The first line names the device and driver, files of another driver are read as empty.
+class PerfRecord
+{
+public:
+    // Step name, with the pass appended for per pass steps, to milliseconds per sample. "render" is the sum of all steps.
+    using Timings = std::map<std::string, double>;
+
+    PerfRecord(std::string const& file_name, std::string const& device_id)
+        : m_file_name(file_name)
+        , m_device_id(device_id)
+    {
+        std::ifstream in(m_file_name);
+        std::string line;
+        if (!in || !std::getline(in, line) || line != m_device_id)
+        {
+            return;
+        }
+
+        std::string test;
+        std::string step;
+        double milliseconds = 0.0;
+        while (in >> test >> step >> milliseconds)
+        {
+            m_tests[test][step] = milliseconds;
+        }
+    }
+
+    // Build timings of a test out of the renderer profiler entries, empty if nothing has been rendered or timed
+    static Timings GetTimings(Baikal::ClwProfiler const& profiler)
+    {
+        Timings timings;
+        auto const& entries = profiler.GetEntries();
+
+        // Primary rays are counted once per sample
+        auto rays = std::find_if(entries.cbegin(), entries.cend(), [](Baikal::ClwProfiler::Entry const& e)
+        {
+            return e.name == "rays" && e.pass == 0;
+        });
+
+        if (!profiler.IsTimingSupported() || rays == entries.cend() || rays->num_counts == 0)
+        {
+            return timings;
+        }
+
+        auto num_samples = static_cast<double>(rays->num_counts);
+        auto& render = timings["render"];
+        render = 0.0;
+
+        for (auto const& entry : entries)
+        {
+            if (entry.num_spans == 0)
+            {
+                continue;
+            }
+
+            auto step = entry.name;
+            if (entry.pass != Baikal::ClwProfiler::kNoPass)
+            {
+                step += "_" + std::to_string(entry.pass);
+            }
+
+            timings[step] = entry.milliseconds / num_samples;
+            render += entry.milliseconds / num_samples;
+        }
+
+        return timings;
+    }
+
+    bool Find(std::string const& test, Timings& timings) const
+    {
+        auto it = m_tests.find(test);
+        if (it == m_tests.end())
+        {
+            return false;
+        }
+
+        timings = it->second;
+        return true;
+    }
+
+    void Set(std::string const& test, Timings const& timings)
+    {
+        m_tests[test] = timings;
+    }
+
+    void Save() const
+    {
+        std::ostringstream data;
+        data << m_device_id << "\n";
+        for (auto const& test : m_tests)
+        {
+            for (auto const& step : test.second)
+            {
+                data << test.first << " " << step.first << " " << step.second << "\n";
+            }
+        }
+
+        Baikal::mkfilepath(m_file_name);
+        std::ofstream out(m_file_name);
+        out << data.str();
+    }
+
+    // Name the files of a device get in the cache directory
+    static std::string GetFileName(std::string const& cache_path, std::string const& prefix, std::string const& device_name)
+    {
+        auto device_key = device_name;
+        std::replace_if(device_key.begin(), device_key.end(), [](char c)
+        {
+            return !std::isalnum(static_cast<unsigned char>(c));
+        }, '_');
+
+        return cache_path + "/" + prefix + "_" + device_key + ".txt";
+    }
+
+private:
+    std::string m_file_name;
+    std::string m_device_id;
+    std::map<std::string, Timings> m_tests;
+};
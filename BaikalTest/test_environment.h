@@ -0,0 +1,214 @@
+/**********************************************************************
+Copyright (c) 2018 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+********************************************************************/
+#pragma once
+
+#include "gtest/gtest.h"
+
+#include "CLW.h"
+#include "Renderers/renderer.h"
+#include "RenderFactory/clw_render_factory.h"
+#include "Output/output.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern int g_argc;
+extern char** g_argv;
+
+///< Device, render factory with its program manager, renderer and output shared by the
+///< rendering tests of a run, so kernels are built once rather than per test. Tests take the
+///< renderer and output in SetUp and give them back in TearDown, the ones a test has replaced
+///< or reconfigured are dropped and created again by the next test. -isolate keeps nothing
+///< between tests. Without -device the GTEST_SHARD_INDEX of a sharded run picks the GPU,
+///< so shards started with GTEST_TOTAL_SHARDS spread over all GPUs of the platform.
+///<
+class TestEnvironment : public ::testing::Environment
+{
+public:
+    TestEnvironment()
+    {
+        Instance() = this;
+    }
+
+    static TestEnvironment& Get()
+    {
+        return *Instance();
+    }
+
+    void TearDown() override
+    {
+        Release();
+    }
+
+    bool IsDeviceCreated() const
+    {
+        return m_factory != nullptr;
+    }
+
+    // Select the device of the command line options and create the factory, fails the calling test on errors
+    void CreateDevice()
+    {
+        std::vector<CLWPlatform> platforms;
+
+        ASSERT_NO_THROW(CLWPlatform::CreateAllPlatforms(platforms));
+        ASSERT_GT(platforms.size(), 0u);
+
+        char* device_index_option = GetCmdOption(g_argv, g_argv + g_argc, "-device");
+        char* platform_index_option = GetCmdOption(g_argv, g_argv + g_argc, "-platform");
+        char* shard_index_option = std::getenv("GTEST_SHARD_INDEX");
+
+        auto platform_index = platform_index_option ? (int)atoi(platform_index_option) : -1;
+        auto device_index = device_index_option ? (int)atoi(device_index_option) : -1;
+        auto shard_index = shard_index_option ? (int)atoi(shard_index_option) : 0;
+        m_share = std::find(g_argv, g_argv + g_argc, std::string("-isolate")) == g_argv + g_argc;
+
+        // Prefer GPU devices if nothing has been specified
+        if (platform_index == -1)
+        {
+            platform_index = 0;
+
+            for (auto j = 0u; j < platforms.size(); ++j)
+            {
+                for (auto i = 0u; i < platforms[j].GetDeviceCount(); ++i)
+                {
+                    if (platforms[j].GetDevice(i).GetType() == CL_DEVICE_TYPE_GPU)
+                    {
+                        platform_index = j;
+                        break;
+                    }
+                }
+            }
+        }
+
+        ASSERT_LT((std::size_t)platform_index, platforms.size());
+
+        if (device_index == -1)
+        {
+            std::vector<int> gpus;
+
+            for (auto i = 0u; i < platforms[platform_index].GetDeviceCount(); ++i)
+            {
+                if (platforms[platform_index].GetDevice(i).GetType() == CL_DEVICE_TYPE_GPU)
+                {
+                    gpus.push_back(i);
+                }
+            }
+
+            device_index = gpus.empty() ? 0 : gpus[shard_index % gpus.size()];
+        }
+
+        ASSERT_LT((std::uint32_t)device_index, platforms[platform_index].GetDeviceCount());
+
+        auto device = platforms[platform_index].GetDevice(device_index);
+        m_context = CLWContext::Create(device);
+        m_device_name = device.GetName();
+        m_device_id = m_device_name + "|" + GetDriverVersion(device);
+
+        std::unique_ptr<Baikal::ClwRenderFactory> factory;
+        ASSERT_NO_THROW(factory = std::make_unique<Baikal::ClwRenderFactory>(m_context, "cache"));
+        // Reference images should not depend on relaxed math of the device
+        factory->SetBuildProfile(Baikal::CLProgramManager::BuildProfile::kReference);
+        m_factory = std::move(factory);
+    }
+
+    CLWContext GetContext() const { return m_context; }
+    Baikal::RenderFactory<Baikal::ClwScene>* GetFactory() const { return m_factory.get(); }
+    std::string const& GetDeviceName() const { return m_device_name; }
+    std::string const& GetDeviceId() const { return m_device_id; }
+
+    // Shared objects, null if there is none to lend, e.g. the previous test has replaced it
+    std::unique_ptr<Baikal::Renderer> TakeRenderer() { return std::move(m_renderer); }
+    std::unique_ptr<Baikal::Output> TakeOutput() { return std::move(m_output); }
+
+    // Renderer should be in its initial state apart from the color output
+    void GiveBack(std::unique_ptr<Baikal::Renderer> renderer, std::unique_ptr<Baikal::Output> output)
+    {
+        if (!m_share)
+        {
+            // Programs of the renderer belong to the factory
+            renderer.reset();
+            output.reset();
+            Release();
+            return;
+        }
+
+        if (renderer)
+        {
+            m_renderer = std::move(renderer);
+        }
+
+        if (output)
+        {
+            m_output = std::move(output);
+        }
+    }
+
+    static char* GetCmdOption(char ** begin, char ** end, const std::string & option)
+    {
+        char ** itr = std::find(begin, end, option);
+        if (itr != end && ++itr != end)
+        {
+            return *itr;
+        }
+        return 0;
+    }
+
+    static std::string GetDriverVersion(CLWDevice const& device)
+    {
+        std::size_t size = 0;
+        if (clGetDeviceInfo(device.GetID(), CL_DRIVER_VERSION, 0, nullptr, &size) != CL_SUCCESS || size == 0)
+        {
+            return "";
+        }
+
+        std::string version(size, '\0');
+        clGetDeviceInfo(device.GetID(), CL_DRIVER_VERSION, size, &version[0], nullptr);
+        version.resize(version.find_last_not_of('\0') + 1);
+        return version;
+    }
+
+private:
+    static TestEnvironment*& Instance()
+    {
+        static TestEnvironment* instance = nullptr;
+        return instance;
+    }
+
+    void Release()
+    {
+        m_output.reset();
+        m_renderer.reset();
+        m_factory.reset();
+        m_context = CLWContext();
+    }
+
+    CLWContext m_context;
+    std::unique_ptr<Baikal::RenderFactory<Baikal::ClwScene>> m_factory;
+    std::unique_ptr<Baikal::Renderer> m_renderer;
+    std::unique_ptr<Baikal::Output> m_output;
+    std::string m_device_name;
+    std::string m_device_id;
+    bool m_share = true;
+};
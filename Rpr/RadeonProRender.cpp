@@ -120,6 +120,9 @@ rpr_int rprContextGetInfo(rpr_context in_context, rpr_context_info in_context_in
     case RPR_CONTEXT_RENDER_STATISTICS:
         context->GetRenderStatistics(out_data, out_size_ret);
         break;
+    case RPR_CONTEXT_PROFILING_REPORT:
+        context->GetProfilingReport(out_data, out_size_ret);
+        break;
     case RPR_CONTEXT_PARAMETER_COUNT:
         break;
     case RPR_OBJECT_NAME:
@@ -344,7 +347,14 @@ rpr_int rprContextRender(rpr_context in_context)
         return RPR_ERROR_INVALID_CONTEXT;
     }
 
-    context->Render();
+    try
+    {
+        context->Render();
+    }
+    catch (Exception& e)
+    {
+        return e.m_error;
+    }
 
     return RPR_SUCCESS;
 }
@@ -363,9 +373,106 @@ rpr_int rprContextRenderTile(rpr_context in_context, rpr_uint xmin, rpr_uint xma
     return RPR_SUCCESS;
 }
 
-rpr_int rprContextClearMemory(rpr_context context)
+rpr_int rprContextPickShape(rpr_context in_context, rpr_uint x, rpr_uint y, rpr_shape * out_shape, rpr_float * out_position)
 {
-    UNIMLEMENTED_FUNCTION
+    //cast data
+    ContextObject* context = WrapObject::Cast<ContextObject>(in_context);
+    if (!context)
+    {
+        return RPR_ERROR_INVALID_CONTEXT;
+    }
+
+    if (!out_shape)
+    {
+        return RPR_ERROR_INVALID_PARAMETER;
+    }
+
+    rpr_int result = RPR_SUCCESS;
+    try
+    {
+        RadeonRays::float3 position;
+        *out_shape = context->PickShape(x, y, &position);
+
+        if (*out_shape && out_position)
+        {
+            out_position[0] = position.x;
+            out_position[1] = position.y;
+            out_position[2] = position.z;
+        }
+    }
+    catch (Exception& e)
+    {
+        result = e.m_error;
+    }
+
+    return result;
+}
+
+rpr_int rprContextBeginSceneEdit(rpr_context in_context)
+{
+    //cast data
+    ContextObject* context = WrapObject::Cast<ContextObject>(in_context);
+    if (!context)
+    {
+        return RPR_ERROR_INVALID_CONTEXT;
+    }
+
+    rpr_int result = RPR_SUCCESS;
+    try
+    {
+        context->BeginSceneEdit();
+    }
+    catch (Exception& e)
+    {
+        result = e.m_error;
+    }
+
+    return result;
+}
+
+rpr_int rprContextEndSceneEdit(rpr_context in_context)
+{
+    //cast data
+    ContextObject* context = WrapObject::Cast<ContextObject>(in_context);
+    if (!context)
+    {
+        return RPR_ERROR_INVALID_CONTEXT;
+    }
+
+    rpr_int result = RPR_SUCCESS;
+    try
+    {
+        context->EndSceneEdit();
+    }
+    catch (Exception& e)
+    {
+        result = e.m_error;
+    }
+
+    return result;
+}
+
+rpr_int rprContextClearMemory(rpr_context in_context)
+{
+    //cast data
+    ContextObject* context = WrapObject::Cast<ContextObject>(in_context);
+
+    if (!context)
+    {
+        return RPR_ERROR_INVALID_CONTEXT;
+    }
+
+    rpr_int result = RPR_SUCCESS;
+    try
+    {
+        context->ClearMemory();
+    }
+    catch (Exception& e)
+    {
+        result = e.m_error;
+    }
+
+    return result;
 }
 
 rpr_int rprContextCreateImage(rpr_context in_context, rpr_image_format const in_format, rpr_image_desc const * in_image_desc, void const * in_data, rpr_image * out_image)
@@ -1275,7 +1382,8 @@ rpr_int rprMeshGetInfo(rpr_shape in_mesh, rpr_mesh_info in_mesh_info, size_t in_
     {
     case RPR_MESH_POLYGON_COUNT:
     {
-        uint64_t value = mesh->GetVertexCount() / 3;
+        //quads are triangulated on creation
+        uint64_t value = mesh->GetIndicesCount() / 3;
         size_ret = sizeof(value);
         data.resize(size_ret);
         memcpy(&data[0], &value, size_ret);
@@ -1640,24 +1748,72 @@ rpr_int rprSkyLightDetachPortal(rpr_light skylight, rpr_shape portal)
     UNIMLEMENTED_FUNCTION
 }
 
-rpr_int rprContextCreateIESLight(rpr_context context, rpr_light * light)
+rpr_int rprContextCreateIESLight(rpr_context in_context, rpr_light * out_light)
 {
-    UNIMLEMENTED_FUNCTION
+    //cast
+    ContextObject* context = WrapObject::Cast<ContextObject>(in_context);
+    if (!context)
+    {
+        return RPR_ERROR_INVALID_CONTEXT;
+    }
+    if (!out_light)
+    {
+        return RPR_ERROR_INVALID_PARAMETER;
+    }
+
+    *out_light = context->CreateLight(LightObject::Type::kIESLight);
+
+    return RPR_SUCCESS;
 }
 
-rpr_int rprIESLightSetRadiantPower3f(rpr_light light, rpr_float r, rpr_float g, rpr_float b)
+rpr_int rprIESLightSetRadiantPower3f(rpr_light in_light, rpr_float in_r, rpr_float in_g, rpr_float in_b)
 {
-    UNIMLEMENTED_FUNCTION
+    //cast
+    LightObject* light = WrapObject::Cast<LightObject>(in_light);
+    if (!light || light->GetType() != LightObject::Type::kIESLight)
+    {
+        return RPR_ERROR_INVALID_LIGHT;
+    }
+
+    RadeonRays::float3 radiant_power = { in_r, in_g, in_b };
+    light->SetRadiantPower(radiant_power);
+
+    return RPR_SUCCESS;
 }
 
-rpr_int rprIESLightSetImageFromFile(rpr_light env_light, rpr_char const * imagePath, rpr_int nx, rpr_int ny)
+static rpr_int SetIESLightProfile(rpr_light in_light, rpr_char const* in_data, bool is_file, rpr_int nx, rpr_int ny)
 {
-    UNIMLEMENTED_FUNCTION
+    //cast
+    LightObject* light = WrapObject::Cast<LightObject>(in_light);
+    if (!light || light->GetType() != LightObject::Type::kIESLight)
+    {
+        return RPR_ERROR_INVALID_LIGHT;
+    }
+    if (!in_data)
+    {
+        return RPR_ERROR_INVALID_PARAMETER;
+    }
+
+    rpr_int result = RPR_SUCCESS;
+    try
+    {
+        light->SetIesProfile(in_data, is_file, nx, ny);
+    }
+    catch (Exception& e)
+    {
+        result = e.m_error;
+    }
+    return result;
 }
 
-rpr_int rprIESLightSetImageFromIESdata(rpr_light env_light, rpr_char const * iesData, rpr_int nx, rpr_int ny)
+rpr_int rprIESLightSetImageFromFile(rpr_light in_light, rpr_char const * imagePath, rpr_int nx, rpr_int ny)
 {
-    UNIMLEMENTED_FUNCTION
+    return SetIESLightProfile(in_light, imagePath, true, nx, ny);
+}
+
+rpr_int rprIESLightSetImageFromIESdata(rpr_light in_light, rpr_char const * iesData, rpr_int nx, rpr_int ny)
+{
+    return SetIESLightProfile(in_light, iesData, false, nx, ny);
 }
 
 rpr_int rprLightGetInfo(rpr_light in_light, rpr_light_info in_info, size_t in_size, void * out_data, size_t * out_size_ret)
@@ -1701,6 +1857,7 @@ rpr_int rprLightGetInfo(rpr_light in_light, rpr_light_info in_info, size_t in_si
     case RPR_POINT_LIGHT_RADIANT_POWER:
     case RPR_SPOT_LIGHT_RADIANT_POWER:
     case RPR_DIRECTIONAL_LIGHT_RADIANT_POWER:
+    case RPR_IES_LIGHT_RADIANT_POWER:
     {
         RadeonRays::float3 value = light->GetRadiantPower();
         size_ret = sizeof(value);
@@ -1740,8 +1897,7 @@ rpr_int rprLightGetInfo(rpr_light in_light, rpr_light_info in_info, size_t in_si
     case RPR_SKY_LIGHT_TURBIDITY:
     case RPR_SKY_LIGHT_PORTAL_COUNT:
     case RPR_SKY_LIGHT_PORTAL_LIST:
-    case RPR_IES_LIGHT_RADIANT_POWER:
-    case RPR_IES_LIGHT_IMAGE_DESC:        
+    case RPR_IES_LIGHT_IMAGE_DESC:
         UNSUPPORTED_FUNCTION
         break;
     default:
@@ -2092,7 +2248,7 @@ rpr_int rprFrameBufferGetInfo(rpr_framebuffer in_frame_buffer, rpr_framebuffer_i
     {
         return RPR_ERROR_INVALID_PARAMETER;
     }
-    std::size_t buff_size = sizeof(RadeonRays::float3) * buff->Width() * buff->Height();
+    std::size_t buff_size = buff->GetDataSize();
     switch (in_info)
     {
     case RPR_FRAMEBUFFER_DATA:
@@ -2106,7 +2262,7 @@ rpr_int rprFrameBufferGetInfo(rpr_framebuffer in_frame_buffer, rpr_framebuffer_i
         }
         if (out_data)
         {
-            buff->GetData(static_cast<RadeonRays::float3*>(out_data));
+            buff->GetData(out_data);
         }
         break;
     default:
@@ -2150,9 +2306,31 @@ rpr_int rprFrameBufferSaveToFile(rpr_framebuffer in_frame_buffer, rpr_char const
     return RPR_SUCCESS;
 }
 
-rpr_int rprContextResolveFrameBuffer(rpr_context context, rpr_framebuffer src_frame_buffer, rpr_framebuffer dst_frame_buffer, rpr_bool normalizeOnly)
+rpr_int rprContextResolveFrameBuffer(rpr_context in_context, rpr_framebuffer in_src_frame_buffer, rpr_framebuffer in_dst_frame_buffer, rpr_bool in_normalize_only)
 {
-    UNIMLEMENTED_FUNCTION
+    //cast
+    ContextObject* context = WrapObject::Cast<ContextObject>(in_context);
+    if (!context)
+    {
+        return RPR_ERROR_INVALID_CONTEXT;
+    }
+
+    FramebufferObject* src = WrapObject::Cast<FramebufferObject>(in_src_frame_buffer);
+    FramebufferObject* dst = WrapObject::Cast<FramebufferObject>(in_dst_frame_buffer);
+    if (!src || !dst || src == dst)
+    {
+        return RPR_ERROR_INVALID_PARAMETER;
+    }
+
+    try
+    {
+        context->ResolveFrameBuffer(src, dst, in_normalize_only != RPR_FALSE);
+    }
+    catch (Exception& e)
+    {
+        return e.m_error;
+    }
+    return RPR_SUCCESS;
 }
 
 rpr_int rprContextCreateMaterialSystem(rpr_context in_context, rpr_material_system_type type, rpr_material_system * out_matsys)
@@ -186,9 +186,17 @@ extern "C" {
 #define RPR_CONTEXT_TRANSPARENT_BACKGROUND 0x13F 
 #define RPR_CONTEXT_MAX_DEPTH_SHADOW 0x140 
 #define RPR_CONTEXT_RANDOM_SEED 0x141
+#define RPR_CONTEXT_PROFILING 0x142
+#define RPR_CONTEXT_PROFILING_REPORT 0x143
+#define RPR_CONTEXT_AOV_IDLE_INTERVAL 0x144
+#define RPR_CONTEXT_ACCELERATION_STRUCTURE 0x145
+#define RPR_CONTEXT_RENDER_REGION_XMIN 0x146
+#define RPR_CONTEXT_RENDER_REGION_XMAX 0x147
+#define RPR_CONTEXT_RENDER_REGION_YMIN 0x148
+#define RPR_CONTEXT_RENDER_REGION_YMAX 0x149
 
 /* last of the RPR_CONTEXT_* */
-#define RPR_CONTEXT_MAX 0x141 
+#define RPR_CONTEXT_MAX 0x149 
 
 /*rpr_camera_info*/
 #define RPR_CAMERA_TRANSFORM 0x201 
@@ -379,6 +387,11 @@ extern "C" {
 #define RPR_TONEMAPPING_OPERATOR_MAXWHITE 0x4 
 #define RPR_TONEMAPPING_OPERATOR_REINHARD02 0x5 
 #define RPR_TONEMAPPING_OPERATOR_EXPONENTIAL 0x6 
+/*rpr_acceleration_structure*/
+#define RPR_ACCELERATION_STRUCTURE_AUTO 0x0 
+#define RPR_ACCELERATION_STRUCTURE_FAST_BUILD 0x1 
+#define RPR_ACCELERATION_STRUCTURE_BALANCED 0x2 
+#define RPR_ACCELERATION_STRUCTURE_HIGH_QUALITY 0x3 
 /*rpr_volume_type*/
 #define RPR_VOLUME_TYPE_NONE 0xFFFF 
 #define RPR_VOLUME_TYPE_HOMOGENEOUS 0x0 
@@ -1080,6 +1093,55 @@ extern RPR_API_ENTRY rpr_int rprContextRender(rpr_context context);
 extern RPR_API_ENTRY rpr_int rprContextRenderTile(rpr_context context, rpr_uint xmin, rpr_uint xmax, rpr_uint ymin, rpr_uint ymax);
 
 
+    /** @brief Find the shape seen through a pixel of the color framebuffer
+    *
+    *  A single camera ray through the pixel center is traced against the last compiled scene,
+    *  so selection costs much less than rendering an RPR_AOV_OBJECT_ID framebuffer and reading it back.
+    *  Pixels are addressed as in the framebuffer data. Possible error codes are:
+    *
+    *      RPR_ERROR_INVALID_OBJECT
+    *      RPR_ERROR_INVALID_PARAMETER
+    *
+    *  @param  context         The context object
+    *  @param  x               X coordinate of the pixel
+    *  @param  y               Y coordinate of the pixel
+    *  @param  out_shape       Shape or instance hit by the ray, NULL if the ray has missed
+    *  @param  out_position    Optional 3 floats receiving world space hit position, unchanged if the ray has missed
+    *  @return                 RPR_SUCCESS in case of success, error code otherwise
+    */
+extern RPR_API_ENTRY rpr_int rprContextPickShape(rpr_context context, rpr_uint x, rpr_uint y, rpr_shape * out_shape, rpr_float * out_position);
+
+
+    /** @brief Start a batch of edits of the current scene
+    *
+    *  Changes of the scene and its objects made until the matching rprContextEndSceneEdit are not uploaded
+    *  to the device. Render calls in between keep rendering the last committed state of the scene.
+    *  Edit batches can be nested, only the outermost one commits. Possible error codes are:
+    *
+    *      RPR_ERROR_INVALID_OBJECT
+    *
+    *  @param  context     The context object
+    *  @return             RPR_SUCCESS in case of success, error code otherwise
+    */
+extern RPR_API_ENTRY rpr_int rprContextBeginSceneEdit(rpr_context context);
+
+
+    /** @brief Finish a batch of edits started with rprContextBeginSceneEdit
+    *
+    *  When the outermost batch is finished all the accumulated changes are compiled at once.
+    *  Possible error codes are:
+    *
+    *      RPR_ERROR_INVALID_OBJECT
+    *      RPR_ERROR_INVALID_PARAMETER
+    *      RPR_ERROR_OUT_OF_VIDEO_MEMORY
+    *      RPR_ERROR_INTERNAL_ERROR
+    *
+    *  @param  context     The context object
+    *  @return             RPR_SUCCESS in case of success, error code otherwise
+    */
+extern RPR_API_ENTRY rpr_int rprContextEndSceneEdit(rpr_context context);
+
+
     /** @brief Clear all video memory used by the context
     *
     *  This function should be called after all context objects have been destroyed.
@@ -1098,6 +1160,8 @@ extern RPR_API_ENTRY rpr_int rprContextClearMemory(rpr_context context);
     /** @brief Create an image from memory data
     *
     *  Images are used as HDRI maps or inputs for various shading system nodes.
+    *  Images, meshes, instances, lights, cameras and material nodes can be created from several threads at once,
+    *  attaching them to a scene and setting their parameters has to be serialized by the caller.
     *  Possible error codes are:
     *
     *      RPR_ERROR_OUT_OF_SYSTEM_MEMORY
@@ -1194,6 +1258,7 @@ extern RPR_API_ENTRY rpr_int rprContextCreateInstance(rpr_context context, rpr_s
     /** @brief Create a mesh
     *
     *  FireRender supports mixed meshes consisting of triangles and quads.
+    *  Meshes of the same context can be created from several threads at once.
     *
     *  Possible error codes are:
     *
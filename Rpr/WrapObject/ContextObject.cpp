@@ -36,6 +36,16 @@ THE SOFTWARE.
 #include "SceneGraph/light.h"
 
 #include "RenderFactory/render_factory.h"
+#include "Controllers/clw_scene_controller.h"
+#include "Output/clwoutput.h"
+#include "image_io.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
 
 namespace
 {
@@ -94,6 +104,13 @@ namespace
     { RPR_CONTEXT_GPU7_NAME,{ "gpu7name", "Name of the GPU index 7 in context. Constant value.", RPR_PARAMETER_TYPE_STRING } },
     { RPR_CONTEXT_CPU_NAME,{ "cpuname", "Name of the CPU in context. Constant value.", RPR_PARAMETER_TYPE_STRING } },
     { RPR_CONTEXT_RANDOM_SEED,{ "randseed", "Random seed", RPR_PARAMETER_TYPE_UINT } },
+    { RPR_CONTEXT_PROFILING,{ "profiling", "Measure device time of render steps", RPR_PARAMETER_TYPE_UINT } },
+    { RPR_CONTEXT_AOV_IDLE_INTERVAL,{ "aov.idleinterval", "Single pass AOVs not read since the last render are filled every Nth render only", RPR_PARAMETER_TYPE_UINT } },
+    { RPR_CONTEXT_ACCELERATION_STRUCTURE,{ "accelerationstructure", "Intersector build speed against traversal speed, RPR_ACCELERATION_STRUCTURE_*", RPR_PARAMETER_TYPE_UINT } },
+    { RPR_CONTEXT_RENDER_REGION_XMIN,{ "renderregion.xmin", "Render region left edge, rprContextRender covers the whole framebuffer if the region is empty", RPR_PARAMETER_TYPE_UINT } },
+    { RPR_CONTEXT_RENDER_REGION_XMAX,{ "renderregion.xmax", "Render region right edge, exclusive", RPR_PARAMETER_TYPE_UINT } },
+    { RPR_CONTEXT_RENDER_REGION_YMIN,{ "renderregion.ymin", "Render region bottom edge", RPR_PARAMETER_TYPE_UINT } },
+    { RPR_CONTEXT_RENDER_REGION_YMAX,{ "renderregion.ymax", "Render region top edge, exclusive", RPR_PARAMETER_TYPE_UINT } },
     };
 
     std::map<uint32_t, Baikal::Renderer::OutputType> kOutputTypeMap = { {RPR_AOV_COLOR, Baikal::Renderer::OutputType::kColor},
@@ -107,6 +124,8 @@ namespace
                                                                         {RPR_AOV_OPACITY, Baikal::Renderer::OutputType::kOpacity},
                                                                         };
 
+    //tiles are small enough to balance between devices and fit into any work buffer
+    int constexpr kTileSize = 128;
 }// anonymous
 
 ContextObject::ContextObject(rpr_creation_flags creation_flags)
@@ -128,24 +147,31 @@ ContextObject::ContextObject(rpr_creation_flags creation_flags)
     {
         throw Exception(result, "");
     }
+
+    if (m_cfgs.size() > 1)
+    {
+        m_scheduler.reset(new Baikal::TileScheduler(m_cfgs.size()));
+        //calling thread renders on config 0
+        m_thread_pool.reset(new Baikal::ThreadPool(m_cfgs.size() - 1));
+    }
+}
+
+ContextObject::~ContextObject()
+{
+    //the loader fills textures owned by the pending list, it must not outlive the context
+    WaitForImages();
 }
 
 void ContextObject::GetRenderStatistics(void * out_data, size_t * out_size_ret) const
 {
     if (out_data)
     {
-        //TODO: more statistics
+        //only compiled scene buffers are accounted for, device times of render steps are reported by GetProfilingReport
         rpr_render_statistics* rs = static_cast<rpr_render_statistics*>(out_data);
-        rs->gpumem_usage = 0;
+        rs->gpumem_usage = static_cast<rpr_longlong>(m_scene_gpumem_usage);
         rs->gpumem_total = 0;
-        rs->gpumem_max_allocation = 0;
-        //for (const auto& cfg : m_cfgs)
-        //{
-            // TODO: implement me
-            //rs->gpumem_usage += cfg.renderer->GetWorkingSetSize();
-            //rs->gpumem_total += cfg.renderer->GetWorkingSetSize();
-            //rs->gpumem_max_allocation += cfg.renderer->GetWorkingSetSize();
-        //}
+        rs->gpumem_max_allocation = static_cast<rpr_longlong>(m_scene_gpumem_max_allocation);
+        rs->sysmem_usage = 0;
     }
     if (out_size_ret)
     {
@@ -153,6 +179,78 @@ void ContextObject::GetRenderStatistics(void * out_data, size_t * out_size_ret)
     }
 }
 
+void ContextObject::GetProfilingReport(void * out_data, size_t * out_size_ret) const
+{
+    std::ostringstream report;
+    report << "[\n";
+
+    for (std::size_t i = 0; i < m_cfgs.size(); ++i)
+    {
+        auto renderer = static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[i].renderer.get());
+        auto controller = static_cast<Baikal::ClwSceneController*>(m_cfgs[i].controller.get());
+
+        //report device times resolved so far, the device is not waited for
+        auto& profiler = renderer->GetProfiler();
+        profiler.Resolve();
+
+        report << "{ \"device\": " << i << ", \"timing_supported\": " << (profiler.IsTimingSupported() ? "true" : "false") << ",\n";
+        report << "\"steps\": ";
+        profiler.WriteJson(report);
+        report << ", \"uploads\": {";
+
+        for (std::size_t j = 0; j < static_cast<std::size_t>(Baikal::ClwUploader::Category::kCount); ++j)
+        {
+            auto category = static_cast<Baikal::ClwUploader::Category>(j);
+            report << (j > 0 ? ", " : " ") << "\"" << Baikal::ClwUploader::GetCategoryName(category) << "\": "
+                   << controller->GetUploader().GetStats(category).bytes;
+        }
+
+        report << " } }" << (i + 1 < m_cfgs.size() ? ",\n" : "\n");
+    }
+
+    report << "]\n";
+
+    std::string result = report.str();
+    if (out_data)
+    {
+        memcpy(out_data, result.c_str(), result.size() + 1);
+    }
+    if (out_size_ret)
+    {
+        *out_size_ret = result.size() + 1;
+    }
+}
+
+void ContextObject::ClearMemory()
+{
+    WaitForImages();
+
+    std::lock_guard<std::mutex> lock(m_create_mutex);
+
+    for (auto& c : m_cfgs)
+    {
+        try
+        {
+            c.controller->EvictAllScenes();
+        }
+        catch (std::runtime_error& e)
+        {
+            throw Exception(RPR_ERROR_INTERNAL_ERROR, e.what());
+        }
+
+        for (auto const& aov : kOutputTypeMap)
+        {
+            c.renderer->SetOutput(aov.second, nullptr);
+        }
+    }
+
+    m_output_framebuffers.clear();
+    m_device_outputs.clear();
+    m_current_scene = nullptr;
+    m_scene_gpumem_usage = 0;
+    m_scene_gpumem_max_allocation = 0;
+}
+
 void ContextObject::SetAOV(rpr_int in_aov, FramebufferObject* buffer)
 {
     FramebufferObject* old_buf = GetAOV(in_aov);
@@ -163,14 +261,25 @@ void ContextObject::SetAOV(rpr_int in_aov, FramebufferObject* buffer)
         throw Exception(RPR_ERROR_UNIMPLEMENTED, "Context: requested AOV not implemented.");
     }
     
-    for (auto& c : m_cfgs)
+    if (old_buf != buffer)
     {
-        c.renderer->SetOutput(aov->second, buffer->GetOutput());
+        m_device_outputs.erase(old_buf);
+    }
+
+    for (std::size_t i = 0; i < m_cfgs.size(); ++i)
+    {
+        m_cfgs[i].renderer->SetOutput(aov->second, GetDeviceOutput(i, buffer));
     }
 
     //update registered output framebuffer
     m_output_framebuffers.erase(old_buf);
     m_output_framebuffers.insert(buffer);
+
+    //newly attached AOV is filled on the next render
+    if (buffer)
+    {
+        buffer->MarkRead();
+    }
 }
 
 
@@ -204,35 +313,160 @@ FramebufferObject* ContextObject::GetAOV(rpr_int in_aov)
 void ContextObject::Render()
 {
     PrepareScene();
+    SelectAOVs();
 
-    //render
-    for (auto& c : m_cfgs)
+    auto output = m_cfgs[0].renderer->GetOutput(Baikal::Renderer::OutputType::kColor);
+    if (output && HasRenderRegion() &&
+        (m_region_max.x > (int)output->width() || m_region_max.y > (int)output->height()))
+    {
+        throw Exception(RPR_ERROR_INVALID_PARAMETER, "ContextObject: render region is out of the framebuffer.");
+    }
+
+    if (m_scheduler && output)
+    {
+        if (HasRenderRegion())
+        {
+            RenderRegion(m_region_min, GetRenderRegionSize());
+        }
+        else
+        {
+            RenderRegion(RadeonRays::int2(), RadeonRays::int2((int)output->width(), (int)output->height()));
+        }
+    }
+    else
     {
-        auto& scene = c.controller->GetCachedScene(m_current_scene->GetScene());
-        c.renderer->Render(scene);
+        for (auto& c : m_cfgs)
+        {
+            auto& scene = c.controller->GetCachedScene(m_current_scene->GetScene());
+            c.renderer->Render(scene);
+        }
     }
     PostRender();
 }
 
+bool ContextObject::HasRenderRegion() const
+{
+    return m_region_max.x > m_region_min.x && m_region_max.y > m_region_min.y;
+}
+
+RadeonRays::int2 ContextObject::GetRenderRegionSize() const
+{
+    return RadeonRays::int2(m_region_max.x - m_region_min.x, m_region_max.y - m_region_min.y);
+}
+
+void ContextObject::UpdateRenderRegion()
+{
+    //renderers keep rendering whole outputs until the region has both edges of each axis set
+    auto origin = HasRenderRegion() ? m_region_min : RadeonRays::int2();
+    auto size = HasRenderRegion() ? GetRenderRegionSize() : RadeonRays::int2();
+
+    for (auto& c : m_cfgs)
+    {
+        static_cast<Baikal::MonteCarloRenderer*>(c.renderer.get())->SetRenderRegion(origin, size);
+    }
+}
+
 void ContextObject::RenderTile(rpr_uint xmin, rpr_uint xmax, rpr_uint ymin, rpr_uint ymax)
 {
     PrepareScene();
+    SelectAOVs();
 
     const RadeonRays::int2 origin = { (int)xmin, (int)ymin };
     const RadeonRays::int2 size = { (int)xmax - (int)xmin, (int)ymax - (int)ymin };
     //render
-    for (auto& c : m_cfgs)
+    if (m_scheduler)
+    {
+        RenderRegion(origin, size);
+    }
+    else
     {
-        auto& scene = c.controller->GetCachedScene(m_current_scene->GetScene());
-        c.renderer->RenderTile(scene, origin, size);
+        for (auto& c : m_cfgs)
+        {
+            auto& scene = c.controller->GetCachedScene(m_current_scene->GetScene());
+            c.renderer->RenderTile(scene, origin, size);
+        }
     }
     PostRender();
 }
 
+void ContextObject::RenderRegion(RadeonRays::int2 const& origin, RadeonRays::int2 const& size)
+{
+    //tiles have to fit into the smallest work buffer
+    auto work_buffer_size = std::numeric_limits<std::size_t>::max();
+    for (auto& c : m_cfgs)
+    {
+        auto renderer = static_cast<Baikal::MonteCarloRenderer*>(c.renderer.get());
+        work_buffer_size = std::min(work_buffer_size, renderer->GetEstimator().GetWorkBufferSize() / renderer->GetSamplesPerDispatch());
+    }
+
+    RadeonRays::int2 tile_size;
+    tile_size.x = std::min(size.x, kTileSize);
+    tile_size.y = std::min(kTileSize, static_cast<int>(work_buffer_size / tile_size.x));
+
+    m_scheduler->BeginFrame(origin, size, tile_size);
+
+    //every config takes part in every frame, so sample counters stay in sync
+    m_thread_pool->ParallelFor(m_cfgs.size(), 1, [this](std::size_t begin, std::size_t end)
+    {
+        for (auto i = begin; i < end; ++i)
+        {
+            auto& c = m_cfgs[i];
+            auto renderer = static_cast<Baikal::MonteCarloRenderer*>(c.renderer.get());
+            auto& scene = c.controller->GetCachedScene(m_current_scene->GetScene());
+            auto first_tile = true;
+
+            renderer->RenderTiles(scene, [&](RadeonRays::int2& tile_origin, RadeonRays::int2& tile_size)
+            {
+                //scheduler measures device throughput from tile completion
+                if (!first_tile)
+                {
+                    c.context.Finish(0);
+                }
+
+                first_tile = false;
+
+                Baikal::TileScheduler::Tile tile;
+                if (!m_scheduler->NextTile(i, tile))
+                {
+                    return false;
+                }
+
+                tile_origin = tile.origin;
+                tile_size = tile.size;
+                return true;
+            });
+        }
+    });
+
+    m_scheduler->EndFrame();
+}
+
+Baikal::Output* ContextObject::GetDeviceOutput(std::size_t cfg_index, FramebufferObject* buffer)
+{
+    if (cfg_index == 0)
+    {
+        return buffer->GetOutput();
+    }
+
+    auto& outputs = m_device_outputs[buffer];
+    outputs.resize(m_cfgs.size());
+
+    if (!outputs[cfg_index])
+    {
+        auto width = static_cast<std::uint32_t>(buffer->Width());
+        auto height = static_cast<std::uint32_t>(buffer->Height());
+        outputs[cfg_index] = m_cfgs[cfg_index].factory->CreateOutput(width, height);
+        static_cast<Baikal::ClwOutput*>(outputs[cfg_index].get())->Clear(RadeonRays::float3(0.f, 0.f, 0.f, 0.f));
+    }
+
+    return outputs[cfg_index].get();
+}
+
 
 SceneObject* ContextObject::CreateScene()
 {
     auto scene = new SceneObject;
+    std::lock_guard<std::mutex> lock(m_create_mutex);
     m_current_scene = m_current_scene ? m_current_scene : scene;
     return scene;
 }
@@ -278,10 +512,92 @@ MaterialObject* ContextObject::CreateImage(rpr_image_format const in_format, rpr
 
 MaterialObject* ContextObject::CreateImageFromFile(rpr_char const * in_path)
 {
-    MaterialObject* result = MaterialObject::CreateImage(in_path);
+    //only the file is checked here, decoding overlaps with building the rest of the scene
+    if (!std::ifstream(in_path).good())
+    {
+        throw Exception(RPR_ERROR_IO_ERROR, "ContextObject: failed to load image.");
+    }
+
+    auto texture = Baikal::Texture::Create();
+    texture->SetName(in_path);
+    MaterialObject* result = MaterialObject::CreateImage(texture);
+
+    std::lock_guard<std::mutex> lock(m_image_mutex);
+    m_pending_images.emplace_back(in_path, texture);
+    if (!m_image_loader_running)
+    {
+        //previous loader has already seen an empty queue
+        if (m_image_loader.valid())
+        {
+            m_image_loader.get();
+        }
+
+        m_image_loader_running = true;
+        m_image_loader = std::async(std::launch::async, &ContextObject::LoadPendingImages, this);
+    }
+
     return result;
 }
 
+void ContextObject::LoadPendingImages()
+{
+    auto io = Baikal::ImageIo::CreateImageIo();
+
+    for (;;)
+    {
+        std::vector<std::pair<std::string, Baikal::Texture::Ptr>> images;
+        {
+            std::lock_guard<std::mutex> lock(m_image_mutex);
+            if (m_pending_images.empty())
+            {
+                m_image_loader_running = false;
+                return;
+            }
+            images.swap(m_pending_images);
+        }
+
+        //failed decodes keep the checkerboard of the placeholder
+        std::vector<char> failed(images.size(), 0);
+        Baikal::TaskScheduler::Get().ParallelFor(images.size(), 1, [&](std::size_t begin, std::size_t end)
+        {
+            for (auto i = begin; i < end; ++i)
+            {
+                try
+                {
+                    auto decoded = io->LoadImage(images[i].first);
+                    images[i].second->TakeData(*decoded);
+                }
+                catch (...)
+                {
+                    failed[i] = 1;
+                }
+            }
+        });
+
+        for (std::size_t i = 0; i < images.size(); ++i)
+        {
+            if (failed[i])
+            {
+                std::cout << "Warning: failed to load image " << images[i].first << ".\n";
+            }
+        }
+    }
+}
+
+void ContextObject::WaitForImages()
+{
+    std::future<void> loader;
+    {
+        std::lock_guard<std::mutex> lock(m_image_mutex);
+        loader = std::move(m_image_loader);
+    }
+
+    if (loader.valid())
+    {
+        loader.get();
+    }
+}
+
 CameraObject* ContextObject::CreateCamera()
 {
     return new CameraObject();
@@ -289,30 +605,38 @@ CameraObject* ContextObject::CreateCamera()
 
 FramebufferObject* ContextObject::CreateFrameBuffer(rpr_framebuffer_format const in_format, rpr_framebuffer_desc const * in_fb_desc)
 {
-    //TODO: implement
-    if (in_format.type != RPR_COMPONENT_TYPE_FLOAT32 || in_format.num_components != 4)
+    if (in_format.num_components != 4)
     {
-        throw Exception(RPR_ERROR_UNIMPLEMENTED, "ContextObject: only 4 component RPR_COMPONENT_TYPE_FLOAT32 implemented now.");
+        throw Exception(RPR_ERROR_UNIMPLEMENTED, "ContextObject: only 4 component framebuffers implemented now.");
     }
 
-    //TODO:: implement for several devices
-    if (m_cfgs.size() != 1)
-    {
-        throw Exception(RPR_ERROR_UNIMPLEMENTED, "ContextObject: invalid config count.");
-    }
+    //framebuffers live on config 0, other configs render into their own outputs composited after each render
+    std::lock_guard<std::mutex> lock(m_create_mutex);
     auto& c = m_cfgs[0];
     Baikal::Output* out = c.factory->CreateOutput(in_fb_desc->fb_width, in_fb_desc->fb_height).release();
-    FramebufferObject* result = new FramebufferObject(out);
-    return result;
+
+    switch (in_format.type)
+    {
+    case RPR_COMPONENT_TYPE_FLOAT32:
+        return new FramebufferObject(out);
+    case RPR_COMPONENT_TYPE_UINT8:
+    case RPR_COMPONENT_TYPE_FLOAT16:
+    {
+        //samples still accumulate in float, packed data is resolved on readback
+        auto format = in_format.type == RPR_COMPONENT_TYPE_UINT8 ? Baikal::Output::Format::kRGBA8 : Baikal::Output::Format::kRGBA16F;
+        auto resolved = c.factory->CreateOutput(in_fb_desc->fb_width, in_fb_desc->fb_height, format);
+        auto resolver = c.factory->CreatePostEffect(Baikal::RenderFactory<Baikal::ClwScene>::PostEffectType::kTonemapper);
+        return new FramebufferObject(c.context, out, in_format, std::move(resolved), std::move(resolver));
+    }
+    default:
+        delete out;
+        throw Exception(RPR_ERROR_UNIMPLEMENTED, "ContextObject: unsupported framebuffer component type.");
+    }
 }
 
 FramebufferObject* ContextObject::CreateFrameBufferFromGLTexture(rpr_GLenum target, rpr_GLint miplevel, rpr_GLuint texture)
 {
-    //TODO:: implement for several devices
-    if (m_cfgs.size() != 1)
-    {
-        throw Exception(RPR_ERROR_INTERNAL_ERROR, "ContextObject: invalid config count.");
-    }
+    std::lock_guard<std::mutex> lock(m_create_mutex);
     auto& c = m_cfgs[0];
     auto copykernel = static_cast<Baikal::MonteCarloRenderer*>(c.renderer.get())->GetCopyKernel();
     FramebufferObject* result = new FramebufferObject(c.context, copykernel, target, miplevel, texture);
@@ -323,6 +647,43 @@ FramebufferObject* ContextObject::CreateFrameBufferFromGLTexture(rpr_GLenum targ
     return result;
 }
 
+void ContextObject::ResolveFrameBuffer(FramebufferObject* src, FramebufferObject* dst, bool normalize_only)
+{
+    if (src->Width() != dst->Width() || src->Height() != dst->Height())
+    {
+        throw Exception(RPR_ERROR_INVALID_PARAMETER, "ContextObject: framebuffer sizes differ.");
+    }
+
+    //normalized data stays linear, tonemapped one gets the display gamma of interop framebuffers
+    auto tonemap_operator = normalize_only ? 0 : m_tonemap_operator;
+    auto gamma = normalize_only ? 1.f : 2.2f;
+    auto hdr = normalize_only && dst->GetFormat().type != RPR_COMPONENT_TYPE_UINT8;
+
+    if (dst->GetFormat().type != RPR_COMPONENT_TYPE_FLOAT32)
+    {
+        //packed framebuffers resolve their own samples on readback
+        dst->CopySamples(*src);
+        dst->SetResolveParameters(tonemap_operator, gamma, hdr);
+        return;
+    }
+
+    if (!m_resolver)
+    {
+        m_resolver = m_cfgs[0].factory->CreatePostEffect(Baikal::RenderFactory<Baikal::ClwScene>::PostEffectType::kTonemapper);
+        m_resolver->SetParameter("dither", 0.f);
+    }
+
+    m_resolver->SetParameter("operator", static_cast<float>(tonemap_operator));
+    m_resolver->SetParameter("gamma", gamma);
+    m_resolver->SetParameter("hdr", hdr ? 1.f : 0.f);
+
+    //resolved pixels have w of 1, so they read back as already normalized
+    src->MarkRead();
+    Baikal::PostEffect::InputSet input_set;
+    input_set[Baikal::Renderer::OutputType::kColor] = src->GetOutput();
+    m_resolver->Apply(input_set, *dst->GetOutput());
+}
+
 void ContextObject::SetParameter(const std::string& input, rpr_uint value)
 {
     auto it = std::find_if(kContextParameterDescriptions.begin(), kContextParameterDescriptions.end(),
@@ -345,6 +706,72 @@ void ContextObject::SetParameter(const std::string& input, rpr_uint value)
             c.renderer->SetRandomSeed(value);
         }
         break;
+    case RPR_CONTEXT_PROFILING:
+        for (auto& c : m_cfgs)
+        {
+            static_cast<Baikal::MonteCarloRenderer*>(c.renderer.get())->SetProfiling(value != 0);
+        }
+        break;
+    case RPR_CONTEXT_AOV_IDLE_INTERVAL:
+        m_aov_idle_interval = std::max(value, 1u);
+        break;
+    case RPR_CONTEXT_RENDER_REGION_XMIN:
+        m_region_min.x = static_cast<int>(value);
+        UpdateRenderRegion();
+        break;
+    case RPR_CONTEXT_RENDER_REGION_XMAX:
+        m_region_max.x = static_cast<int>(value);
+        UpdateRenderRegion();
+        break;
+    case RPR_CONTEXT_RENDER_REGION_YMIN:
+        m_region_min.y = static_cast<int>(value);
+        UpdateRenderRegion();
+        break;
+    case RPR_CONTEXT_RENDER_REGION_YMAX:
+        m_region_max.y = static_cast<int>(value);
+        UpdateRenderRegion();
+        break;
+    case RPR_CONTEXT_ACCELERATION_STRUCTURE:
+    {
+        Baikal::AccelerationStructure type;
+        switch (value)
+        {
+        case RPR_ACCELERATION_STRUCTURE_AUTO:
+            type = Baikal::AccelerationStructure::kAuto;
+            break;
+        case RPR_ACCELERATION_STRUCTURE_FAST_BUILD:
+            type = Baikal::AccelerationStructure::kFastBuild;
+            break;
+        case RPR_ACCELERATION_STRUCTURE_BALANCED:
+            type = Baikal::AccelerationStructure::kBalanced;
+            break;
+        case RPR_ACCELERATION_STRUCTURE_HIGH_QUALITY:
+            type = Baikal::AccelerationStructure::kHighQuality;
+            break;
+        default:
+            throw Exception(RPR_ERROR_INVALID_PARAMETER, "ContextObject: invalid acceleration structure.");
+        }
+
+        for (auto& c : m_cfgs)
+        {
+            static_cast<Baikal::ClwSceneController*>(c.controller.get())->SetAccelerationStructure(type);
+        }
+        break;
+    }
+    case RPR_CONTEXT_TONE_MAPPING_TYPE:
+        switch (value)
+        {
+        case RPR_TONEMAPPING_OPERATOR_NONE:
+        case RPR_TONEMAPPING_OPERATOR_LINEAR:
+            m_tonemap_operator = 0;
+            break;
+        case RPR_TONEMAPPING_OPERATOR_REINHARD02:
+            m_tonemap_operator = 1;
+            break;
+        default:
+            throw Exception(RPR_ERROR_UNIMPLEMENTED, "ContextObject: requested tonemapping operator is not implemented");
+        }
+        break;
     default:
         throw Exception(RPR_ERROR_UNIMPLEMENTED, "ContextObject: requested parameter is not implemented");
     }
@@ -380,21 +807,175 @@ void ContextObject::SetParameter(const std::string& input, const std::string& va
     }
 }
 
+void ContextObject::BeginSceneEdit()
+{
+    if (!m_current_scene)
+    {
+        throw Exception(RPR_ERROR_INVALID_OBJECT, "ContextObject: no scene to edit.");
+    }
+
+    m_current_scene->BeginTransaction();
+}
+
+void ContextObject::EndSceneEdit()
+{
+    if (!m_current_scene)
+    {
+        throw Exception(RPR_ERROR_INVALID_OBJECT, "ContextObject: no scene to edit.");
+    }
+
+    //all the edits of the batch are compiled at once
+    if (m_current_scene->EndTransaction())
+    {
+        PrepareScene();
+    }
+}
+
+ShapeObject* ContextObject::PickShape(rpr_uint x, rpr_uint y, RadeonRays::float3* position)
+{
+    if (!m_current_scene)
+    {
+        throw Exception(RPR_ERROR_INVALID_OBJECT, "ContextObject: no scene to pick from.");
+    }
+
+    auto output = m_cfgs[0].renderer->GetOutput(Baikal::Renderer::OutputType::kColor);
+    if (!output || x >= output->width() || y >= output->height())
+    {
+        throw Exception(RPR_ERROR_INVALID_PARAMETER, "ContextObject: pick pixel is outside of the color framebuffer.");
+    }
+
+    PrepareScene();
+
+    auto& scene = m_cfgs[0].controller->GetCachedScene(m_current_scene->GetScene());
+    auto renderer = static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[0].renderer.get());
+    auto hit = renderer->Pick(scene, RadeonRays::int2(static_cast<int>(x), static_cast<int>(y)));
+
+    if (hit.shape_id < 0)
+    {
+        return nullptr;
+    }
+
+    *position = hit.position;
+    return m_current_scene->FindShape(static_cast<std::uint32_t>(hit.shape_id));
+}
+
 void ContextObject::PrepareScene()
 {
+    WaitForImages();
+
+    //while edits are batched the last committed scene is rendered
+    if (m_current_scene->IsInTransaction() &&
+        std::all_of(m_cfgs.begin(), m_cfgs.end(), [this](ConfigManager::Config const& c)
+        {
+            return c.controller->IsSceneCached(m_current_scene->GetScene());
+        }))
+    {
+        return;
+    }
+
     m_current_scene->AddEmissive();
 
     //if (m_current_scene->IsDirty())
     {
+        m_scene_gpumem_usage = 0;
+        m_scene_gpumem_max_allocation = 0;
+
         for (auto& c : m_cfgs)
         {
-            c.controller->CompileScene(m_current_scene->GetScene());
+            auto first_compile = !c.controller->IsSceneCached(m_current_scene->GetScene());
+            auto const& clw_scene = c.controller->CompileScene(m_current_scene->GetScene());
+            auto const& stats = clw_scene.compile_stats;
+
+            //programs of a new scene compile on worker threads of all devices at once
+            if (first_compile)
+            {
+                static_cast<Baikal::MonteCarloRenderer*>(c.renderer.get())->CompileProgramsAsync(clw_scene);
+            }
+
+            m_scene_gpumem_usage += stats.total_bytes;
+            for (auto const& buffer : stats.buffers)
+            {
+                m_scene_gpumem_max_allocation = std::max(m_scene_gpumem_max_allocation, buffer.bytes);
+            }
+        }
+    }
+}
+
+void ContextObject::SelectAOVs()
+{
+    auto refresh = m_aov_frame++ % m_aov_idle_interval == 0;
+
+    for (auto const& aov : kOutputTypeMap)
+    {
+        //multi-pass AOVs come with the color estimate anyway
+        if (aov.second < Baikal::Renderer::OutputType::kMaxMultiPassOutput)
+        {
+            continue;
+        }
+
+        auto buffer = GetAOV(aov.first);
+        if (!buffer)
+        {
+            continue;
+        }
+
+        auto enabled = refresh || buffer->WasRead();
+        for (auto& c : m_cfgs)
+        {
+            static_cast<Baikal::MonteCarloRenderer*>(c.renderer.get())->SetAOVEnabled(aov.second, enabled);
+        }
+    }
+
+    //a framebuffer may back several AOVs, so reads are dropped once all of them are selected
+    for (auto buffer : m_output_framebuffers)
+    {
+        if (buffer)
+        {
+            buffer->ResetRead();
         }
     }
 }
 
 void ContextObject::PostRender()
 {
+    //add samples of the other configs into the framebuffers and reset them
+    for (auto& fb_outputs : m_device_outputs)
+    {
+        auto output = static_cast<Baikal::ClwOutput*>(fb_outputs.first->GetOutput());
+        auto num_pixels = output->width() * output->height();
+
+        if (m_composite_buffer.GetElementCount() < num_pixels)
+        {
+            m_composite_buffer = m_cfgs[0].context.CreateBuffer<RadeonRays::float3>(num_pixels, CL_MEM_READ_ONLY);
+        }
+
+        m_composite_data.resize(num_pixels);
+
+        for (std::size_t i = 1; i < fb_outputs.second.size(); ++i)
+        {
+            auto device_output = static_cast<Baikal::ClwOutput*>(fb_outputs.second[i].get());
+            if (!device_output)
+            {
+                continue;
+            }
+
+            device_output->GetData(m_composite_data.data());
+            device_output->Clear(RadeonRays::float3(0.f, 0.f, 0.f, 0.f));
+
+            //host data is reused for the next config
+            m_cfgs[0].context.WriteBuffer(0, m_composite_buffer, m_composite_data.data(), num_pixels).Wait();
+
+            auto acckernel = static_cast<Baikal::MonteCarloRenderer*>(m_cfgs[0].renderer.get())->GetAccumulateKernel();
+
+            int argc = 0;
+            acckernel.SetArg(argc++, m_composite_buffer);
+            acckernel.SetArg(argc++, static_cast<int>(num_pixels));
+            acckernel.SetArg(argc++, output->data());
+
+            m_cfgs[0].context.Launch1D(0, ((num_pixels + 63) / 64) * 64, 64, acckernel);
+        }
+    }
+
     // need to copy data from CL to GL for interop framebuffers
     for (auto fb : m_output_framebuffers)
     {
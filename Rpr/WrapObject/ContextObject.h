@@ -26,7 +26,16 @@ THE SOFTWARE.
 
 #include "Utils/config_manager.h"
 #include "Renderers/monte_carlo_renderer.h"
+#include "PostEffects/post_effect.h"
+#include "Utils/tile_scheduler.h"
+#include "Utils/task_scheduler.h"
+#include "Utils/thread_pool.h"
 
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 #include "RadeonProRender.h"
 #include "RadeonProRender_GL.h"
@@ -45,13 +54,15 @@ class ContextObject
 {
 public:
     ContextObject(rpr_creation_flags creation_flags);
-    virtual ~ContextObject() = default;
+    virtual ~ContextObject();
     //cur. scene
     SceneObject* GetCurrentScene() { return m_current_scene; }
     void SetCurrenScene(SceneObject* scene) { m_current_scene = scene; }
     
     //context info
     void GetRenderStatistics(void * out_data, size_t * out_size_ret) const;
+    //JSON with device times of render steps and upload bytes of every config, needs "profiling" parameter set
+    void GetProfilingReport(void * out_data, size_t * out_size_ret) const;
     void SetParameter(const std::string& input, rpr_uint value);
     void SetParameter(const std::string& input, float x, float y = 0.f, float z = 0.f, float w = 0.f);
     void SetParameter(const std::string& input, const std::string& value);
@@ -60,11 +71,22 @@ public:
     void SetAOV(rpr_int in_aov, FramebufferObject* buffer);
     FramebufferObject* GetAOV(rpr_int in_aov);
 
+    //drop compiled scenes and AOVs, all objects of the context are expected to be deleted
+    //while compiled programs are kept, so the context is reused without rebuilding kernels
+    void ClearMemory();
+
     //render
     void Render();
     void RenderTile(rpr_uint xmin, rpr_uint xmax, rpr_uint ymin, rpr_uint ymax);
 
-    //create methods
+    //shape hit by the camera ray through a pixel of the color output, nullptr on miss
+    ShapeObject* PickShape(rpr_uint x, rpr_uint y, RadeonRays::float3* position);
+
+    //batched edits of the current scene, compiled once when the outermost batch ends
+    void BeginSceneEdit();
+    void EndSceneEdit();
+
+    //create methods, safe to call from several threads at once
     SceneObject* CreateScene();
     MatSysObject* CreateMaterialSystem();
     LightObject* CreateLight(LightObject::Type type);
@@ -81,15 +103,65 @@ public:
     CameraObject* CreateCamera();
     FramebufferObject* CreateFrameBuffer(rpr_framebuffer_format const in_format, rpr_framebuffer_desc const * in_fb_desc);
     FramebufferObject* CreateFrameBufferFromGLTexture(rpr_GLenum target, rpr_GLint miplevel, rpr_GLuint texture);
+
+    //resolve accumulated samples of src into dst on the device, tonemapped unless normalize_only is set
+    void ResolveFrameBuffer(FramebufferObject* src, FramebufferObject* dst, bool normalize_only);
 private:
     void PrepareScene();
+    //decode images queued by CreateImageFromFile until the queue is empty, runs on m_image_loader
+    void LoadPendingImages();
+    //images have to be decoded before the scene using them is compiled
+    void WaitForImages();
+    //enable single pass AOVs for the next render after the reads of their framebuffers
+    void SelectAOVs();
+
+    //render region split between all configs
+    void RenderRegion(RadeonRays::int2 const& origin, RadeonRays::int2 const& size);
+    //RPR_CONTEXT_RENDER_REGION_* describe a region with a positive size
+    bool HasRenderRegion() const;
+    RadeonRays::int2 GetRenderRegionSize() const;
+    //hand RPR_CONTEXT_RENDER_REGION_* to the renderers
+    void UpdateRenderRegion();
 
     //after render update
     void PostRender();
 
+    //output of config rendering into the framebuffer, config 0 owns user framebuffers
+    Baikal::Output* GetDeviceOutput(std::size_t cfg_index, FramebufferObject* buffer);
+
     //render configs
     std::vector<ConfigManager::Config> m_cfgs;
     //know framefubbers used as AOV outputs
     std::set<FramebufferObject*> m_output_framebuffers;
+    //outputs of the other configs for each framebuffer, consumed into the framebuffer after each render
+    std::map<FramebufferObject*, std::vector<std::unique_ptr<Baikal::Output>>> m_device_outputs;
+    //hands tiles out to configs when there are several
+    std::unique_ptr<Baikal::TileScheduler> m_scheduler;
+    std::unique_ptr<Baikal::ThreadPool> m_thread_pool;
+    //host and device staging of composited outputs
+    std::vector<RadeonRays::float3> m_composite_data;
+    CLWBuffer<RadeonRays::float3> m_composite_buffer;
     SceneObject* m_current_scene;
+    //guards the current scene and config 0 resources shared by create methods,
+    //objects not touching them are created without locking
+    std::mutex m_create_mutex;
+    //files of CreateImageFromFile decoded in the background into placeholder textures, guarded by m_image_mutex
+    std::mutex m_image_mutex;
+    std::vector<std::pair<std::string, Baikal::Texture::Ptr>> m_pending_images;
+    bool m_image_loader_running = false;
+    std::future<void> m_image_loader;
+    //device memory of compiled scene summed over all configs, updated by PrepareScene
+    std::size_t m_scene_gpumem_usage = 0;
+    //largest scene buffer
+    std::size_t m_scene_gpumem_max_allocation = 0;
+    //Baikal::Tonemapper operator of RPR_CONTEXT_TONE_MAPPING_TYPE
+    int m_tonemap_operator = 0;
+    //resolve into float framebuffers, created on first use
+    std::unique_ptr<Baikal::PostEffect> m_resolver;
+    //single pass AOVs nobody read since the last render are only filled every m_aov_idle_interval renders
+    std::uint32_t m_aov_idle_interval = 1;
+    std::uint32_t m_aov_frame = 0;
+    //RPR_CONTEXT_RENDER_REGION_*, max edges are exclusive
+    RadeonRays::int2 m_region_min;
+    RadeonRays::int2 m_region_max;
 };
@@ -31,14 +31,31 @@ THE SOFTWARE.
 
 FramebufferObject::FramebufferObject(Baikal::Output* out)
     : m_output(out)
+    , m_format{ 4, RPR_COMPONENT_TYPE_FLOAT32 }
     , m_width(out->width())
     , m_height(out->height())
 {
 
 }
 
+FramebufferObject::FramebufferObject(CLWContext context, Baikal::Output* out, rpr_framebuffer_format format,
+    std::unique_ptr<Baikal::Output> resolved, std::unique_ptr<Baikal::PostEffect> resolver)
+    : m_output(out)
+    , m_format(format)
+    , m_resolved(std::move(resolved))
+    , m_resolver(std::move(resolver))
+    , m_width(out->width())
+    , m_height(out->height())
+    , m_context(context)
+{
+    // Readback is expected to be exact, 8 bit data has the display gamma of interop framebuffers
+    m_resolver->SetParameter("dither", 0.f);
+    SetResolveParameters(0, 2.2f, format.type == RPR_COMPONENT_TYPE_FLOAT16);
+}
+
 FramebufferObject::FramebufferObject(CLWContext context, CLWKernel copy_kernel, rpr_GLenum target, rpr_GLint miplevel, rpr_GLuint texture)
     : m_output(nullptr)
+    , m_format{ 4, RPR_COMPONENT_TYPE_FLOAT32 }
     , m_width(0)
     , m_height(0)
     , m_context(context)
@@ -77,13 +94,63 @@ std::size_t FramebufferObject::Height()
     return m_height;
 }
 
+std::size_t FramebufferObject::GetDataSize()
+{
+    if (!m_resolved)
+    {
+        return sizeof(RadeonRays::float3) * Width() * Height();
+    }
+
+    return Baikal::ClwOutput::GetPixelSize(m_resolved->format()) * Width() * Height();
+}
+
 void FramebufferObject::GetData(void* out_data)
 {
-    m_output->GetData(static_cast<RadeonRays::float3*>(out_data));
+    MarkRead();
+
+    if (!m_resolved)
+    {
+        m_output->GetData(static_cast<RadeonRays::float3*>(out_data));
+        return;
+    }
+
+    // Only the packed pixels are read back
+    Baikal::PostEffect::InputSet input_set;
+    input_set[Baikal::Renderer::OutputType::kColor] = m_output;
+    m_resolver->Apply(input_set, *m_resolved);
+    static_cast<Baikal::ClwOutput*>(m_resolved.get())->GetRawData(out_data);
+}
+
+void FramebufferObject::SetResolveParameters(int tonemap_operator, float gamma, bool hdr)
+{
+    if (!m_resolver)
+    {
+        throw Exception(RPR_ERROR_INTERNAL_ERROR, "FramebufferObject: framebuffer is not packed.");
+    }
+
+    m_resolver->SetParameter("operator", static_cast<float>(tonemap_operator));
+    m_resolver->SetParameter("gamma", gamma);
+    m_resolver->SetParameter("hdr", hdr ? 1.f : 0.f);
+}
+
+void FramebufferObject::CopySamples(FramebufferObject& source)
+{
+    if (source.Width() != Width() || source.Height() != Height())
+    {
+        throw Exception(RPR_ERROR_INVALID_PARAMETER, "FramebufferObject: framebuffer sizes differ.");
+    }
+
+    source.MarkRead();
+
+    auto src = static_cast<Baikal::ClwOutput*>(source.GetOutput())->data();
+    auto dst = static_cast<Baikal::ClwOutput*>(GetOutput())->data();
+    m_context.CopyBuffer(0, src, dst, 0, 0, Width() * Height());
 }
 
 void FramebufferObject::Clear()
 {
+    MarkRead();
+
     Baikal::ClwOutput* output = dynamic_cast<Baikal::ClwOutput*>(m_output);
     output->Clear(RadeonRays::float3(0.f, 0.f, 0.f, 0.f));
 }
@@ -93,6 +160,8 @@ void FramebufferObject::UpdateGlTex()
     //only if FramebufferObject was created from GL texture
     if (m_cl_interop_image)
     {
+        MarkRead();
+
         std::vector<cl_mem> objects;
         objects.push_back(m_cl_interop_image);
         m_context.AcquireGLObjects(0, objects);
@@ -120,7 +189,8 @@ void FramebufferObject::SaveToFile(const char* path)
     std::size_t width = Width();
     size_t height = Height();
     std::vector<RadeonRays::float3> tempbuf(width * height);
-    GetData(tempbuf.data());
+    MarkRead();
+    m_output->GetData(tempbuf.data());
     std::vector<RadeonRays::float3> data(tempbuf);
 
     //convert pixels
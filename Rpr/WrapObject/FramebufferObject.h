@@ -23,15 +23,22 @@ THE SOFTWARE.
 
 #include "WrapObject.h"
 #include "Output/clwoutput.h"
+#include "PostEffects/post_effect.h"
 #include "Renderers/renderer.h"
 #include "RadeonProRender_GL.h"
 
+#include <memory>
+
 //this class represent rpr_context
 class FramebufferObject
     : public WrapObject
 {
 public:
     FramebufferObject(Baikal::Output* out);
+    // Framebuffer of RPR_COMPONENT_TYPE_UINT8 or RPR_COMPONENT_TYPE_FLOAT16 format. Samples accumulate
+    // in out as usual and are resolved on the device into the packed resolved output on readback
+    FramebufferObject(CLWContext context, Baikal::Output* out, rpr_framebuffer_format format,
+        std::unique_ptr<Baikal::Output> resolved, std::unique_ptr<Baikal::PostEffect> resolver);
     FramebufferObject(CLWContext context, CLWKernel copy_cernel, rpr_GLenum target, rpr_GLint miplevel, rpr_GLuint texture);
     virtual ~FramebufferObject();
 
@@ -44,19 +51,40 @@ public:
 
     std::size_t Width();
     std::size_t Height();
+    rpr_framebuffer_format GetFormat() const { return m_format; }
+    // Bytes written by GetData
+    std::size_t GetDataSize();
+    // Float framebuffers return accumulated samples with the sample count in w,
+    // packed ones the resolved pixels
     void GetData(void* out_data);
 
+    // Tonemapping of the resolve of packed framebuffers, see Baikal::Tonemapper
+    void SetResolveParameters(int tonemap_operator, float gamma, bool hdr);
+    // Take over accumulated samples of the framebuffer of the same size
+    void CopySamples(FramebufferObject& source);
+
     void Clear();
     void SaveToFile(const char* path);
     
     //if interop this will copy CL output data to GL texture
     void UpdateGlTex();
     Baikal::Output* GetOutput() { return m_output; }
+
+    // Set by readbacks, resolves and clears, lets the context skip AOVs nobody looks at.
+    // New framebuffers start as read, so they are filled on the first render
+    void MarkRead() { m_read = true; }
+    bool WasRead() const { return m_read; }
+    void ResetRead() { m_read = false; }
 private:
     Baikal::Output* m_output;
+    rpr_framebuffer_format m_format;
+    // Packed pixels and the device resolve writing them, packed formats only
+    std::unique_ptr<Baikal::Output> m_resolved;
+    std::unique_ptr<Baikal::PostEffect> m_resolver;
     std::size_t m_width;
     std::size_t m_height;
     CLWImage2D m_cl_interop_image;
     CLWContext m_context;
     CLWKernel m_copy_cernel;
+    bool m_read = true;
 };
@@ -24,6 +24,7 @@ THE SOFTWARE.
 #include "WrapObject/Exception.h"
 #include "radeon_rays.h"
 #include "SceneGraph/light.h"
+#include "Utils/ies_profile.h"
 #include "RadeonProRender.h"
 
 void LightObject::SetTransform(const RadeonRays::matrix& t)
@@ -63,6 +64,9 @@ LightObject::LightObject(Type type)
     case Type::kSpotLight:
         m_light = Baikal::SpotLight::Create();
         break;
+    case Type::kIESLight:
+        m_light = Baikal::PointLight::Create();
+        break;
     case Type::kDirectionalLight:
         m_light = Baikal::DirectionalLight::Create();
         break;
@@ -106,6 +110,28 @@ RadeonRays::float2 LightObject::GetSpotConeShape()
 }
 
 
+void LightObject::SetIesProfile(std::string const& data, bool is_file, rpr_int nx, rpr_int ny)
+{
+    if (nx <= 0 || ny <= 0)
+    {
+        throw Exception(RPR_ERROR_INVALID_PARAMETER, "LightObject: invalid IES texture size");
+    }
+
+    Baikal::IesProfile profile;
+
+    try
+    {
+        profile = is_file ? Baikal::IesProfile::Load(data) : Baikal::IesProfile::Parse(data);
+    }
+    catch (std::runtime_error& e)
+    {
+        throw Exception(is_file ? RPR_ERROR_IO_ERROR : RPR_ERROR_INVALID_PARAMETER, e.what());
+    }
+
+    // Radiant power scales the profile peak
+    m_light->SetProfile(profile.CreateTexture(static_cast<std::uint32_t>(nx), static_cast<std::uint32_t>(ny)));
+}
+
 void LightObject::SetEnvTexture(MaterialObject* img)
 {
     auto ibl = std::dynamic_pointer_cast<Baikal::ImageBasedLight>(m_light);
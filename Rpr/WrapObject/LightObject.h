@@ -28,6 +28,8 @@ THE SOFTWARE.
 #include "RadeonProRender.h"
 #include "SceneGraph/light.h"
 
+#include <string>
+
 class MaterialObject;
 
 class LightObject
@@ -40,6 +42,7 @@ public:
         kSpotLight = RPR_LIGHT_TYPE_SPOT,
         kDirectionalLight = RPR_LIGHT_TYPE_DIRECTIONAL,
         kEnvironmentLight = RPR_LIGHT_TYPE_ENVIRONMENT,
+        kIESLight = RPR_LIGHT_TYPE_IES,
     };
     LightObject(Type type);
     virtual ~LightObject();
@@ -58,6 +61,9 @@ public:
     void SetSpotConeShape(const RadeonRays::float2& cone);
     RadeonRays::float2 GetSpotConeShape();
 
+    //ies light, profile data is LM-63 file contents or file name, resampled to nx x ny texels
+    void SetIesProfile(std::string const& data, bool is_file, rpr_int nx, rpr_int ny);
+
     //env light
     void SetEnvTexture(MaterialObject* img);
     MaterialObject* GetEnvTexture();
@@ -65,6 +65,20 @@ ImageMaterialObject::ImageMaterialObject(rpr_image_format const in_format, rpr_i
         throw Exception(RPR_ERROR_INVALID_PARAMETER, "TextureObject: invalid format type.");
     }
     pixel_bytes *= component_bytes;
+#ifdef BAIKAL_TEXTURE_CONVERSION
+    //three component data is kept as is and expanded on upload
+    if (in_format.num_components == 3)
+    {
+        int rgb_data_size = pixel_bytes * pixels_count;
+        char* rgb_data = new char[rgb_data_size];
+        memcpy(rgb_data, in_data, rgb_data_size);
+
+        data_format = component_bytes == 1 ? Texture::Format::kRgb8 :
+            (component_bytes == 2 ? Texture::Format::kRgb16 : Texture::Format::kRgb32);
+        m_tex = Texture::Create(rgb_data, tex_size, data_format);
+        return;
+    }
+#endif
     int data_size = 4 * component_bytes * pixels_count;//4 component baikal texture
     char* data = new char[data_size];
     if (in_format.num_components == 4)
@@ -112,6 +126,12 @@ ImageMaterialObject::ImageMaterialObject(const std::string& in_path)
     m_tex = texture;
 }
 
+ImageMaterialObject::ImageMaterialObject(Baikal::Texture::Ptr texture)
+    : MaterialObject(Type::kImage)
+    , m_tex(texture)
+{
+}
+
 Baikal::Texture::Ptr ImageMaterialObject::GetTexture()
 { 
     return m_tex; 
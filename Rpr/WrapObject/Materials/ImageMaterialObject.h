@@ -30,6 +30,7 @@ class ImageMaterialObject
 public:
     ImageMaterialObject(rpr_image_format const in_format, rpr_image_desc const * in_image_desc, void const * in_data);
     ImageMaterialObject(const std::string& in_path);
+    ImageMaterialObject(Baikal::Texture::Ptr texture);
 
     virtual Baikal::Texture::Ptr GetTexture() override;
 private:
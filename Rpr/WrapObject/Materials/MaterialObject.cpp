@@ -162,6 +162,11 @@ MaterialObject* MaterialObject::CreateImage(const std::string& in_path)
     return new ImageMaterialObject(in_path);
 }
 
+MaterialObject* MaterialObject::CreateImage(Baikal::Texture::Ptr texture)
+{
+    return new ImageMaterialObject(texture);
+}
+
 MaterialObject* MaterialObject::CreateMaterial(rpr_material_node_type in_type)
 {
     Type type = (Type)in_type;
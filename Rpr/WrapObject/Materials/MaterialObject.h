@@ -76,6 +76,8 @@ public:
     //initialize methods
     static MaterialObject* CreateImage(rpr_image_format const in_format, rpr_image_desc const * in_image_desc, void const * in_data);
     static MaterialObject* CreateImage(const std::string& in_path);  
+    //image of a texture filled later, e.g. decoded in the background
+    static MaterialObject* CreateImage(Baikal::Texture::Ptr texture);
     static MaterialObject* CreateMaterial(rpr_material_node_type in_type);
 
     virtual ~MaterialObject() = default;
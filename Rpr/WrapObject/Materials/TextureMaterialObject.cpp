@@ -86,6 +86,7 @@ char const* TextureMaterialObject::GetImageData() const
 rpr_image_format TextureMaterialObject::GetImageFormat() const
 {
     rpr_component_type type;
+    rpr_uint num_components = 4;
     switch (m_tex->GetFormat())
     {
     case Baikal::Texture::Format::kRgba8:
@@ -97,11 +98,38 @@ rpr_image_format TextureMaterialObject::GetImageFormat() const
     case Baikal::Texture::Format::kRgba32:
         type = RPR_COMPONENT_TYPE_FLOAT32;
         break;
+    case Baikal::Texture::Format::kR8:
+        type = RPR_COMPONENT_TYPE_UINT8;
+        num_components = 1;
+        break;
+    case Baikal::Texture::Format::kR16:
+        type = RPR_COMPONENT_TYPE_FLOAT16;
+        num_components = 1;
+        break;
+    case Baikal::Texture::Format::kRg8:
+        type = RPR_COMPONENT_TYPE_UINT8;
+        num_components = 2;
+        break;
+    case Baikal::Texture::Format::kRg16:
+        type = RPR_COMPONENT_TYPE_FLOAT16;
+        num_components = 2;
+        break;
+    case Baikal::Texture::Format::kRgb8:
+        type = RPR_COMPONENT_TYPE_UINT8;
+        num_components = 3;
+        break;
+    case Baikal::Texture::Format::kRgb16:
+        type = RPR_COMPONENT_TYPE_FLOAT16;
+        num_components = 3;
+        break;
+    case Baikal::Texture::Format::kRgb32:
+        type = RPR_COMPONENT_TYPE_FLOAT32;
+        num_components = 3;
+        break;
     default:
         throw Exception(RPR_ERROR_INTERNAL_ERROR, "MaterialObject: invalid image format.");
     }
-    //only 4component textures used
-    return{ 4, type };
+    return{ num_components, type };
 }
 
 Baikal::Texture::Ptr TextureMaterialObject::GetTexture() 
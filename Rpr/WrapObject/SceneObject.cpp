@@ -24,10 +24,13 @@ THE SOFTWARE.
 #include "WrapObject/ShapeObject.h"
 #include "WrapObject/LightObject.h"
 #include "WrapObject/CameraObject.h"
+#include "WrapObject/Materials/MaterialObject.h"
+#include "WrapObject/Exception.h"
 #include "SceneGraph/scene1.h"
 #include "SceneGraph/light.h"
 #include "SceneGraph/shape.h"
 #include "SceneGraph/material.h"
+#include "SceneGraph/camera.h"
 #include "SceneGraph/iterator.h"
 
 #include <assert.h>
@@ -44,20 +47,29 @@ SceneObject::~SceneObject()
 void SceneObject::Clear()
 {
     m_shapes.clear();
+    m_shape_set.clear();
     m_lights.clear();
 
-    //remove lights
-    for (std::unique_ptr<Baikal::Iterator> it_light(m_scene->CreateLightIterator()); it_light->IsValid();)
+    //remove lights, last ones first so the scene lists shrink at their end
+    std::vector<Baikal::Light::Ptr> lights;
+    for (std::unique_ptr<Baikal::Iterator> it_light(m_scene->CreateLightIterator()); it_light->IsValid(); it_light->Next())
     {
-        m_scene->DetachLight(it_light->ItemAs<Baikal::Light>());
-        it_light = m_scene->CreateLightIterator();
+        lights.push_back(it_light->ItemAs<Baikal::Light>());
+    }
+    for (auto it = lights.rbegin(); it != lights.rend(); ++it)
+    {
+        m_scene->DetachLight(*it);
     }
 
     //remove shapes
-    for (std::unique_ptr<Baikal::Iterator> it_shape(m_scene->CreateShapeIterator()); it_shape->IsValid();)
+    std::vector<Baikal::Shape::Ptr> shapes;
+    for (std::unique_ptr<Baikal::Iterator> it_shape(m_scene->CreateShapeIterator()); it_shape->IsValid(); it_shape->Next())
+    {
+        shapes.push_back(it_shape->ItemAs<Baikal::Shape>());
+    }
+    for (auto it = shapes.rbegin(); it != shapes.rend(); ++it)
     {
-        m_scene->DetachShape(it_shape->ItemAs<Baikal::Mesh>());
-        it_shape = m_scene->CreateShapeIterator();
+        m_scene->DetachShape(*it);
     }
 
     if (m_current_camera) m_current_camera->RemoveFromScene(this);
@@ -66,8 +78,7 @@ void SceneObject::Clear()
 void SceneObject::AttachShape(ShapeObject* shape)
 {
     //check is mesh already in scene
-    auto it = std::find(m_shapes.begin(), m_shapes.end(), shape);
-    if (it != m_shapes.end())
+    if (!m_shape_set.insert(shape).second)
     {
         return;
     }
@@ -79,12 +90,12 @@ void SceneObject::AttachShape(ShapeObject* shape)
 void SceneObject::DetachShape(ShapeObject* shape)
 {
     //check is mesh in scene
-    auto it = std::find(m_shapes.begin(), m_shapes.end(), shape);
-    if (it == m_shapes.end())
+    if (!m_shape_set.erase(shape))
     {
         return;
     }
-    m_shapes.erase(it);
+    auto it = std::find(m_shapes.rbegin(), m_shapes.rend(), shape);
+    m_shapes.erase(std::next(it).base());
     m_scene->DetachShape(shape->GetShape());
 }
 
@@ -126,6 +137,16 @@ void SceneObject::GetShapeList(void* out_list)
     memcpy(out_list, m_shapes.data(), m_shapes.size() * sizeof(ShapeObject*));
 }
 
+ShapeObject* SceneObject::FindShape(std::uint32_t id) const
+{
+    auto iter = std::find_if(m_shapes.cbegin(), m_shapes.cend(), [id](ShapeObject* shape)
+    {
+        return shape->GetShape()->GetId() == id;
+    });
+
+    return iter != m_shapes.cend() ? *iter : nullptr;
+}
+
 void SceneObject::GetLightList(void* out_list)
 {
     memcpy(out_list, m_lights.data(), m_lights.size() * sizeof(LightObject*));
@@ -139,9 +160,10 @@ RadeonRays::bbox SceneObject::GetBBox()
 
 void SceneObject::AddEmissive()
 {
-    //TODO: check scene isn't changed
-    //recreate amissives if scene is dirty
-    if (!m_scene->GetDirtyFlags())
+    //area lights only depend on the shapes of the scene and their materials,
+    //so camera, transform and light edits keep them
+    auto dirty = CollectDirty();
+    if (!dirty.shape_list && dirty.shapes.empty() && dirty.materials.empty())
     {
         return;
     }
@@ -196,6 +218,64 @@ bool SceneObject::IsDirty()
     return dirty != Baikal::Scene1::kNone;
 }
 
+bool SceneObject::DirtySet::IsEmpty() const
+{
+    return shapes.empty() && transforms.empty() && lights.empty() && materials.empty() &&
+        !shape_list && !light_list && !camera;
+}
+
+SceneObject::DirtySet SceneObject::CollectDirty() const
+{
+    DirtySet dirty;
+
+    auto flags = m_scene->GetDirtyFlags();
+    dirty.shape_list = (flags & Baikal::Scene1::kShapes) != 0;
+    dirty.light_list = (flags & Baikal::Scene1::kLights) != 0;
+
+    auto camera = m_scene->GetCamera();
+    dirty.camera = (flags & Baikal::Scene1::kCamera) != 0 || (camera && camera->IsDirty());
+
+    for (auto shape : m_shapes)
+    {
+        auto baikal_shape = shape->GetShape();
+        if (baikal_shape->IsDirty())
+        {
+            dirty.shapes.push_back(shape);
+        }
+        if (baikal_shape->IsTransformDirty())
+        {
+            dirty.transforms.push_back(shape);
+        }
+
+        auto mat = shape->GetMaterial();
+        auto baikal_mat = mat ? mat->GetMaterial() : nullptr;
+        if (baikal_mat && baikal_mat->IsDirty())
+        {
+            dirty.materials.insert(mat);
+        }
+    }
+
+    for (auto light : m_lights)
+    {
+        if (light->GetLight()->IsDirty())
+        {
+            dirty.lights.push_back(light);
+        }
+    }
+
+    return dirty;
+}
+
+bool SceneObject::EndTransaction()
+{
+    if (m_transaction_depth == 0)
+    {
+        throw Exception(RPR_ERROR_INVALID_PARAMETER, "SceneObject: no edit batch to end.");
+    }
+
+    return --m_transaction_depth == 0;
+}
+
 void SceneObject::SetBackgroundImage(MaterialObject* image)
 {
     m_background_image = image;
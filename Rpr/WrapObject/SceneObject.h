@@ -26,6 +26,8 @@ THE SOFTWARE.
 #include "SceneGraph/shape.h"
 #include "SceneGraph/light.h"
 
+#include <set>
+#include <unordered_set>
 #include <vector>
 
 class ShapeObject;
@@ -64,6 +66,8 @@ public:
     CameraObject* GetCamera() { return m_current_camera; }
 
 	void GetShapeList(void* out_list);
+    //attached shape with the id of its Baikal shape, nullptr if there is none
+    ShapeObject* FindShape(std::uint32_t id) const;
 	size_t GetShapeCount() { return m_scene->GetNumShapes(); }
     
     void GetLightList(void* out_list);
@@ -83,13 +87,37 @@ public:
 	void RemoveEmissive();
     bool IsDirty();
     Baikal::Scene1::Ptr GetScene() { return m_scene; };
+
+    //objects changed since the last compile, grouped by type
+    struct DirtySet
+    {
+        std::vector<ShapeObject*> shapes;//geometry, material or visibility changed
+        std::vector<ShapeObject*> transforms;
+        std::vector<LightObject*> lights;
+        std::set<MaterialObject*> materials;//materials of the scene shapes
+        bool shape_list = false;//shapes attached or detached
+        bool light_list = false;//lights attached or detached
+        bool camera = false;
+
+        bool IsEmpty() const;
+    };
+    DirtySet CollectDirty() const;
+
+    //edit batches, nested batches are committed with the outermost one
+    void BeginTransaction() { ++m_transaction_depth; }
+    //returns true if the outermost batch is finished and the changes have to be compiled
+    bool EndTransaction();
+    bool IsInTransaction() const { return m_transaction_depth > 0; }
 private:
     Baikal::Scene1::Ptr m_scene;
     CameraObject* m_current_camera = nullptr;
     std::vector<Baikal::AreaLight::Ptr> m_emmisive_lights;//area lights fro emissive shapes
     std::vector<ShapeObject*> m_shapes;
+    //members of m_shapes, instance scatters attach millions of shapes
+    std::unordered_set<ShapeObject*> m_shape_set;
     std::vector<LightObject*> m_lights;
     MaterialObject *m_background_image = nullptr;
+    int m_transaction_depth = 0;
 
     struct EnvironmentOverride
     {
@@ -20,8 +20,10 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 ********************************************************************/
 
+#include <algorithm>
 #include <vector>
 #include <iostream>
+#include <unordered_map>
 
 #include "WrapObject/ShapeObject.h"
 #include "WrapObject/Exception.h"
@@ -32,41 +34,61 @@ using namespace Baikal;
 
 namespace
 {
-    template<typename T, int size = 3> std::vector<T> merge(const T* in_data, size_t in_data_num, rpr_int in_data_stride,
-        rpr_int const * in_data_indices, rpr_int in_didx_stride,
-        rpr_int const * in_num_face_vertices, size_t in_num_faces)
+    //corner of a face, index of its position, normal and uv
+    struct CornerKey
+    {
+        rpr_int vertex;
+        rpr_int normal;
+        rpr_int texcoord;
+
+        bool operator == (CornerKey const& other) const
+        {
+            return vertex == other.vertex && normal == other.normal && texcoord == other.texcoord;
+        }
+    };
+
+    struct CornerKeyHash
+    {
+        std::size_t operator()(CornerKey const& key) const
+        {
+            std::size_t hash = static_cast<std::uint32_t>(key.vertex);
+            hash = hash * 0x9e3779b1u ^ static_cast<std::uint32_t>(key.normal);
+            hash = hash * 0x9e3779b1u ^ static_cast<std::uint32_t>(key.texcoord);
+            return hash;
+        }
+    };
+
+    //index of the corner into the data array, -1 if there is no data
+    rpr_int GetCornerIndex(const void* in_data, rpr_int const * in_data_indices, rpr_int in_didx_stride, std::size_t corner)
     {
-        std::vector<T> result;
         if (!in_data || !in_data_indices)
         {
-            std::cout << "Warning: missing mesh data, fill it with NULL.\n";
-            int count = 0;
-            for (std::size_t i = 0; i < in_num_faces; ++i)
-            {
-                count += in_num_face_vertices[i];
-            }
-            result.resize(count * size);
-            std::fill(result.begin(), result.end(), 0.f);
-
-            return result;
+            return -1;
+        }
+        return in_data_indices[corner * in_didx_stride / sizeof(rpr_int)];
+    }
+
+    //read the element straight into the mesh layout, missing data is zero
+    RadeonRays::float3 GetFloat3(const float* in_data, rpr_int in_data_stride, rpr_int index, float w)
+    {
+        if (index < 0)
+        {
+            return RadeonRays::float3(0.f, 0.f, 0.f, w);
         }
 
-        int indent = 0;
-        for (std::size_t i = 0; i < in_num_faces; ++i)
+        const float* data = in_data + in_data_stride / sizeof(float) * index;
+        return RadeonRays::float3(data[0], data[1], data[2], w);
+    }
+
+    RadeonRays::float2 GetFloat2(const float* in_data, rpr_int in_data_stride, rpr_int index)
+    {
+        if (index < 0)
         {
-            int face = in_num_face_vertices[i];
-            for (int f = indent; f < face + indent; ++f)
-            {
-                int index = in_data_stride / sizeof(T) * in_data_indices[f*in_didx_stride / sizeof(rpr_int)];
-                for (int s = 0; s < size; ++s)
-                {
-                    result.push_back(in_data[index + s]);
-                }
-            }
-
-            indent += face;
+            return RadeonRays::float2(0.f, 0.f);
         }
-        return result;
+
+        const float* data = in_data + in_data_stride / sizeof(float) * index;
+        return RadeonRays::float2(data[0], data[1]);
     }
 }
 
@@ -107,50 +129,99 @@ ShapeObject* ShapeObject::CreateMesh(rpr_float const * in_vertices, size_t in_nu
                         rpr_int const * in_texcoord_indices, rpr_int in_tidx_stride,
                         rpr_int const * in_num_face_vertices, size_t in_num_faces)
 {
-    //merge data
-    std::vector<float> verts = merge(in_vertices, in_num_vertices, in_vertex_stride,
-        in_vertex_indices, in_vidx_stride,
-        in_num_face_vertices, in_num_faces);
-    std::vector<float> normals = merge(in_normals, in_num_normals, in_normal_stride,
-        in_normal_indices, in_nidx_stride,
-        in_num_face_vertices, in_num_faces);
-    std::vector<float> uvs = merge<float, 2>(in_texcoords, in_num_texcoords, in_texcoord_stride,
-        in_texcoord_indices, in_tidx_stride,
-        in_num_face_vertices, in_num_faces);
+    std::size_t num_corners = 0;
+    std::size_t num_triangles = 0;
+    for (std::size_t i = 0; i < in_num_faces; ++i)
+    {
+        int face = in_num_face_vertices[i];
+
+        //only triangles and quads supported
+        if (face != 3 && face != 4)
+        {
+            throw Exception(RPR_ERROR_INVALID_PARAMETER, "ShapeObject: invalid face value.");
+        }
+
+        num_corners += face;
+        num_triangles += face - 2;
+    }
+
+    if (!in_vertices || !in_vertex_indices)
+    {
+        std::cout << "Warning: missing mesh vertices, fill them with NULL.\n";
+    }
+    if (!in_normals || !in_normal_indices)
+    {
+        std::cout << "Warning: missing mesh normals, fill them with NULL.\n";
+    }
+    if (!in_texcoords || !in_texcoord_indices)
+    {
+        std::cout << "Warning: missing mesh uvs, fill them with NULL.\n";
+    }
+
+    //welded meshes usually have about as many vertices as positions, seams grow the arrays
+    std::size_t num_welded = in_vertices ? std::min(std::max(in_num_vertices, in_num_normals), num_corners) : num_corners;
+
+    //corners sharing position, normal and uv indices become a single vertex,
+    //so the mesh keeps the size of its source instead of a vertex per corner
+    std::unordered_map<CornerKey, std::uint32_t, CornerKeyHash> vertex_map;
+    vertex_map.reserve(num_welded);
+
+    //data is gathered in the mesh layout and moved into the mesh, so it is not copied again
+    std::vector<RadeonRays::float3> verts;
+    std::vector<RadeonRays::float3> normals;
+    std::vector<RadeonRays::float2> uvs;
+    verts.reserve(num_welded);
+    normals.reserve(num_welded);
+    uvs.reserve(num_welded);
+
+    std::vector<std::uint32_t> corners(num_corners);
+    for (std::size_t c = 0; c < num_corners; ++c)
+    {
+        CornerKey key = {
+            GetCornerIndex(in_vertices, in_vertex_indices, in_vidx_stride, c),
+            GetCornerIndex(in_normals, in_normal_indices, in_nidx_stride, c),
+            GetCornerIndex(in_texcoords, in_texcoord_indices, in_tidx_stride, c)
+        };
+
+        auto vertex = vertex_map.emplace(key, static_cast<std::uint32_t>(vertex_map.size()));
+        if (vertex.second)
+        {
+            verts.push_back(GetFloat3(in_vertices, in_vertex_stride, key.vertex, 1.f));
+            normals.push_back(GetFloat3(in_normals, in_normal_stride, key.normal, 0.f));
+            uvs.push_back(GetFloat2(in_texcoords, in_texcoord_stride, key.texcoord));
+        }
+
+        corners[c] = vertex.first->second;
+    }
 
     //generate indices
     std::vector<std::uint32_t> inds;
-    std::uint32_t indent = 0;
-    for (std::uint32_t i = 0; i < in_num_faces; ++i)
+    inds.reserve(num_triangles * 3);
+    std::size_t indent = 0;
+    for (std::size_t i = 0; i < in_num_faces; ++i)
     {
-        inds.push_back(indent);
-        inds.push_back(indent + 1);
-        inds.push_back(indent + 2);
+        inds.push_back(corners[indent]);
+        inds.push_back(corners[indent + 1]);
+        inds.push_back(corners[indent + 2]);
 
         int face = in_num_face_vertices[i];
 
         //triangulation
         if (face == 4)
         {
-            inds.push_back(indent + 0);
-            inds.push_back(indent + 2);
-            inds.push_back(indent + 3);
-
-        }
-        //only triangles and quads supported
-        else if (face != 3)
-        {
-            throw Exception(RPR_ERROR_INVALID_PARAMETER, "ShapeObject: invalid face value.");
+            inds.push_back(corners[indent + 0]);
+            inds.push_back(corners[indent + 2]);
+            inds.push_back(corners[indent + 3]);
         }
         indent += face;
     }
 
     //create mesh
     auto mesh = Baikal::Mesh::Create();
-    mesh->SetVertices(verts.data(), verts.size() / 3);
-    mesh->SetNormals(normals.data(), normals.size() / 3);
-    mesh->SetUVs(uvs.data(), uvs.size() / 2);
-    mesh->SetIndices(inds.data(), inds.size());
+    mesh->SetVertices(std::move(verts));
+    mesh->SetNormals(std::move(normals));
+    mesh->SetUVs(std::move(uvs));
+    mesh->SetIndices(std::move(inds));
 
     return new ShapeObject(mesh, nullptr);
 }
@@ -32,6 +32,13 @@ THE SOFTWARE.
 #include "WrapObject/ShapeObject.h"
 #include "WrapObject/Exception.h"
 
+#include <array>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+
 //defines behavior for unimplemented API part
 //#define UNIMLEMENTED_FUNCTION return RPR_SUCCESS;
 #define UNIMPLEMENTED_FUNCTION return RPR_ERROR_UNIMPLEMENTED;
@@ -76,38 +83,95 @@ static const std::map<rprx_parameter, std::string> kRPRXInputStrings =
     { RPRX_UBER_MATERIAL_SSS_MULTISCATTER, "uberv2.sss.multiscatter" }
 };
 
-rpr_int rprxCreateContext(rpr_material_system material_system, rpr_uint flags, rprx_context* out_context)
+namespace
 {
-    if (!material_system)
-        return RPR_ERROR_INVALID_PARAMETER;
+    //parameter value as set through rprxMaterialSetParameter*
+    struct Parameter
+    {
+        enum class Kind : rpr_uint { kNode, kUint, kFloat } kind;
+        rpr_material_node node;
+        rpr_uint u;
+        std::array<rpr_float, 4> f;
+    };
 
-    // We only need material system to work with materials, so it's our rprx_context
-    *out_context = static_cast<rprx_context>(material_system);
+    struct MaterialState
+    {
+        //parameters ordered by id, so equal descriptions give equal keys
+        std::map<rprx_parameter, Parameter> parameters;
+        //key of the last commit, empty before the first one
+        std::string key;
+        //shapes the material is attached to, they get the shared translation on commit
+        std::set<rpr_shape> shapes;
+    };
+
+    //uber node shared by all the materials committed with the same parameters
+    struct Translation
+    {
+        rpr_material_node node = nullptr;
+        int refs = 0;
+    };
 
-    return RPR_SUCCESS;
-}
+    struct RprxContext : _rprxcontext
+    {
+        rpr_material_system material_system;
+        std::map<rprx_material, MaterialState> materials;
+        //keyed by parameter content, repeated materials share one Baikal material
+        //and with it material attributes and input maps
+        std::unordered_map<std::string, Translation> translations;
+    };
+
+    RprxContext* GetContext(rprx_context context)
+    {
+        return static_cast<RprxContext*>(context);
+    }
 
-rpr_int rprxCreateMaterial(rprx_context context, rprx_material_type type, rprx_material* out_material)
-{
-    if (!context || type != RPRX_MATERIAL_UBER)
-        return RPR_ERROR_INVALID_PARAMETER;
+    std::string MakeKey(std::map<rprx_parameter, Parameter> const& parameters)
+    {
+        std::string key;
+        auto append = [&key](void const* data, std::size_t size)
+        {
+            key.append(static_cast<char const*>(data), size);
+        };
 
-    return rprMaterialSystemCreateNode((rpr_material_system)(context), RPR_MATERIAL_NODE_UBERV2, (rpr_material_node*)out_material);
-}
+        for (auto const& parameter : parameters)
+        {
+            append(&parameter.first, sizeof(parameter.first));
+            append(&parameter.second.kind, sizeof(parameter.second.kind));
+
+            switch (parameter.second.kind)
+            {
+            case Parameter::Kind::kNode:
+                append(&parameter.second.node, sizeof(parameter.second.node));
+                break;
+            case Parameter::Kind::kUint:
+                append(&parameter.second.u, sizeof(parameter.second.u));
+                break;
+            case Parameter::Kind::kFloat:
+                append(parameter.second.f.data(), sizeof(parameter.second.f));
+                break;
+            }
+        }
 
-rpr_int rprxMaterialDelete(rprx_context context, rprx_material material)
-{
-    if (!context || !material)
-        return RPR_ERROR_INVALID_PARAMETER;
+        return key;
+    }
 
-    return rprObjectDelete((rpr_material_node)material);
+    //drop the reference of a committed material, the last one deletes the shared node
+    void ReleaseTranslation(RprxContext& context, std::string const& key)
+    {
+        auto it = context.translations.find(key);
+        if (it == context.translations.end() || --it->second.refs > 0)
+        {
+            return;
+        }
+
+        rprObjectDelete(it->second.node);
+        context.translations.erase(it);
+    }
 }
 
-rpr_int rprxMaterialSetParameterN(rprx_context context, rprx_material material, rprx_parameter parameter, rpr_material_node  node)
+//setters shared by user materials and their translations
+static rpr_int SetParameterN(rpr_material_node material, rprx_parameter parameter, rpr_material_node node)
 {
-    if (!material)
-        return RPR_ERROR_INVALID_PARAMETER;
-
     auto it = kRPRXInputStrings.find(parameter);
 
     if (parameter == RPRX_UBER_MATERIAL_BUMP ||
@@ -115,7 +179,7 @@ rpr_int rprxMaterialSetParameterN(rprx_context context, rprx_material material,
     {
         rpr_uint layers = 0;
 
-        rprMaterialNodeGetInputInfo((rpr_material_node)material, RPR_UBER_MATERIAL_LAYERS, RPR_MATERIAL_NODE_INPUT_VALUE, 4, &layers, 0);
+        rprMaterialNodeGetInputInfo(material, RPR_UBER_MATERIAL_LAYERS, RPR_MATERIAL_NODE_INPUT_VALUE, 4, &layers, 0);
 
         if (node)
         {
@@ -125,62 +189,56 @@ rpr_int rprxMaterialSetParameterN(rprx_context context, rprx_material material,
         {
             layers &= ~RPR_UBER_MATERIAL_LAYER_SHADING_NORMAL;
         }
-        rprMaterialNodeSetInputU_ext((rpr_material_node)material, RPR_UBER_MATERIAL_LAYERS, layers);
+        rprMaterialNodeSetInputU_ext(material, RPR_UBER_MATERIAL_LAYERS, layers);
     }
 
     return (it != kRPRXInputStrings.end()) ?
-        rprMaterialNodeSetInputN((rpr_material_node)material, it->second.c_str(), (rpr_material_node)node) :
+        rprMaterialNodeSetInputN(material, it->second.c_str(), node) :
         RPR_ERROR_INVALID_PARAMETER;
 }
 
-rpr_int rprxMaterialSetParameterU(rprx_context context, rprx_material material, rprx_parameter parameter, rpr_uint value)
+static rpr_int SetParameterU(rpr_material_node material, rprx_parameter parameter, rpr_uint value)
 {
-    if (!material)
-        return RPR_ERROR_INVALID_PARAMETER;
-
     auto it = kRPRXInputStrings.find(parameter);
 
     return (it != kRPRXInputStrings.end()) ?
-        rprMaterialNodeSetInputU((rpr_material_node)material, it->second.c_str(), value) :
+        rprMaterialNodeSetInputU(material, it->second.c_str(), value) :
         RPR_ERROR_INVALID_PARAMETER;
 }
 
-rpr_int rprxMaterialSetParameterF(rprx_context context, rprx_material material, rprx_parameter parameter, rpr_float x, rpr_float y, rpr_float z, rpr_float w)
+static rpr_int SetParameterF(rpr_material_node material, rprx_parameter parameter, rpr_float x, rpr_float y, rpr_float z, rpr_float w)
 {
-    if (!material)
-        return RPR_ERROR_INVALID_PARAMETER;
-
     rpr_uint layers = 0;
     rpr_uint status;
 
-    rprMaterialNodeGetInputInfo((rpr_material_node)material, RPR_UBER_MATERIAL_LAYERS, RPR_MATERIAL_NODE_INPUT_VALUE, 4, &layers, 0);
+    rprMaterialNodeGetInputInfo(material, RPR_UBER_MATERIAL_LAYERS, RPR_MATERIAL_NODE_INPUT_VALUE, 4, &layers, 0);
 
     switch (parameter)
     {
         case RPRX_UBER_MATERIAL_DIFFUSE_WEIGHT:
             if (x > 0.f) layers |= RPR_UBER_MATERIAL_LAYER_DIFFUSE;
             else layers &= ~RPR_UBER_MATERIAL_LAYER_DIFFUSE;
-            return rprMaterialNodeSetInputU_ext((rpr_material_node)material, RPR_UBER_MATERIAL_LAYERS, layers);
+            return rprMaterialNodeSetInputU_ext(material, RPR_UBER_MATERIAL_LAYERS, layers);
 
         case RPRX_UBER_MATERIAL_COATING_WEIGHT:
             if (x > 0.f) layers |= RPR_UBER_MATERIAL_LAYER_COATING;
             else layers &= ~RPR_UBER_MATERIAL_LAYER_COATING;
-            return rprMaterialNodeSetInputU_ext((rpr_material_node)material, RPR_UBER_MATERIAL_LAYERS, layers);
+            return rprMaterialNodeSetInputU_ext(material, RPR_UBER_MATERIAL_LAYERS, layers);
 
         case RPRX_UBER_MATERIAL_REFLECTION_WEIGHT:
             if (x > 0.f) layers |= RPR_UBER_MATERIAL_LAYER_REFLECTION;
             else layers &= ~RPR_UBER_MATERIAL_LAYER_REFLECTION;
-            return rprMaterialNodeSetInputU_ext((rpr_material_node)material, RPR_UBER_MATERIAL_LAYERS, layers);
+            return rprMaterialNodeSetInputU_ext(material, RPR_UBER_MATERIAL_LAYERS, layers);
 
         case RPRX_UBER_MATERIAL_REFRACTION_WEIGHT:
             if (x > 0.f) layers |= RPR_UBER_MATERIAL_LAYER_REFRACTION;
             else layers &= ~RPR_UBER_MATERIAL_LAYER_REFRACTION;
-            return rprMaterialNodeSetInputU_ext((rpr_material_node)material, RPR_UBER_MATERIAL_LAYERS, layers);
+            return rprMaterialNodeSetInputU_ext(material, RPR_UBER_MATERIAL_LAYERS, layers);
 
         case RPRX_UBER_MATERIAL_TRANSPARENCY:
             if (x > 0.f) layers |= RPR_UBER_MATERIAL_LAYER_TRANSPARENCY;
             else layers &= ~RPR_UBER_MATERIAL_LAYER_TRANSPARENCY;
-            status = rprMaterialNodeSetInputU_ext((rpr_material_node)material, RPR_UBER_MATERIAL_LAYERS, layers);
+            status = rprMaterialNodeSetInputU_ext(material, RPR_UBER_MATERIAL_LAYERS, layers);
             if (status != RPR_SUCCESS) return status;       
     }
 
@@ -188,10 +246,102 @@ rpr_int rprxMaterialSetParameterF(rprx_context context, rprx_material material,
     auto it = kRPRXInputStrings.find(parameter);
 
     return (it != kRPRXInputStrings.end()) ?
-        rprMaterialNodeSetInputF((rpr_material_node)material, it->second.c_str(), x, y, z, w) :
+        rprMaterialNodeSetInputF(material, it->second.c_str(), x, y, z, w) :
         RPR_ERROR_INVALID_PARAMETER;
 }
 
+rpr_int rprxCreateContext(rpr_material_system material_system, rpr_uint flags, rprx_context* out_context)
+{
+    if (!material_system)
+        return RPR_ERROR_INVALID_PARAMETER;
+
+    auto context = new RprxContext();
+    context->material_system = material_system;
+    *out_context = context;
+
+    return RPR_SUCCESS;
+}
+
+rpr_int rprxCreateMaterial(rprx_context context, rprx_material_type type, rprx_material* out_material)
+{
+    if (!context || type != RPRX_MATERIAL_UBER)
+        return RPR_ERROR_INVALID_PARAMETER;
+
+    auto status = rprMaterialSystemCreateNode(GetContext(context)->material_system, RPR_MATERIAL_NODE_UBERV2, (rpr_material_node*)out_material);
+    if (status == RPR_SUCCESS)
+    {
+        GetContext(context)->materials[*out_material] = MaterialState();
+    }
+
+    return status;
+}
+
+rpr_int rprxMaterialDelete(rprx_context context, rprx_material material)
+{
+    if (!context || !material)
+        return RPR_ERROR_INVALID_PARAMETER;
+
+    auto ctx = GetContext(context);
+    auto it = ctx->materials.find(material);
+    if (it != ctx->materials.end())
+    {
+        for (auto shape : it->second.shapes)
+        {
+            rprShapeSetMaterial(shape, nullptr);
+        }
+
+        ReleaseTranslation(*ctx, it->second.key);
+        ctx->materials.erase(it);
+    }
+
+    return rprObjectDelete((rpr_material_node)material);
+}
+
+rpr_int rprxMaterialSetParameterN(rprx_context context, rprx_material material, rprx_parameter parameter, rpr_material_node  node)
+{
+    if (!material)
+        return RPR_ERROR_INVALID_PARAMETER;
+
+    auto status = SetParameterN((rpr_material_node)material, parameter, node);
+    if (status == RPR_SUCCESS && context)
+    {
+        Parameter value = { Parameter::Kind::kNode, node, 0, {} };
+        GetContext(context)->materials[material].parameters[parameter] = value;
+    }
+
+    return status;
+}
+
+rpr_int rprxMaterialSetParameterU(rprx_context context, rprx_material material, rprx_parameter parameter, rpr_uint value)
+{
+    if (!material)
+        return RPR_ERROR_INVALID_PARAMETER;
+
+    auto status = SetParameterU((rpr_material_node)material, parameter, value);
+    if (status == RPR_SUCCESS && context)
+    {
+        Parameter parameter_value = { Parameter::Kind::kUint, nullptr, value, {} };
+        GetContext(context)->materials[material].parameters[parameter] = parameter_value;
+    }
+
+    return status;
+}
+
+rpr_int rprxMaterialSetParameterF(rprx_context context, rprx_material material, rprx_parameter parameter, rpr_float x, rpr_float y, rpr_float z, rpr_float w)
+{
+    if (!material)
+        return RPR_ERROR_INVALID_PARAMETER;
+
+    auto status = SetParameterF((rpr_material_node)material, parameter, x, y, z, w);
+    if (status == RPR_SUCCESS && context)
+    {
+        Parameter value = { Parameter::Kind::kFloat, nullptr, 0, { { x, y, z, w } } };
+        GetContext(context)->materials[material].parameters[parameter] = value;
+    }
+
+    return status;
+}
+
 rpr_int rprxMaterialGetParameterType(rprx_context context, rprx_material material, rprx_parameter parameter, rpr_parameter_type* out_type)
 {
     UNIMPLEMENTED_FUNCTION
@@ -204,16 +354,96 @@ extern RPR_API_ENTRY rpr_int rprxMaterialGetParameterValue(rprx_context context,
 
 rpr_int rprxMaterialCommit(rprx_context context, rprx_material material)
 {
-    UNSUPPORTED_FUNCTION
+    if (!context || !material)
+        return RPR_ERROR_INVALID_PARAMETER;
+
+    auto ctx = GetContext(context);
+    auto& state = ctx->materials[material];
+    auto key = MakeKey(state.parameters);
+
+    if (key == state.key)
+    {
+        return RPR_SUCCESS;
+    }
+
+    //first material with these parameters translates them into a node owned by the context,
+    //so later edits of the user material don't leak into the materials sharing it
+    auto& translation = ctx->translations[key];
+    if (!translation.node)
+    {
+        auto status = rprMaterialSystemCreateNode(ctx->material_system, RPR_MATERIAL_NODE_UBERV2, &translation.node);
+        for (auto it = state.parameters.begin(); status == RPR_SUCCESS && it != state.parameters.end(); ++it)
+        {
+            auto const& value = it->second;
+            switch (value.kind)
+            {
+            case Parameter::Kind::kNode:
+                status = SetParameterN(translation.node, it->first, value.node);
+                break;
+            case Parameter::Kind::kUint:
+                status = SetParameterU(translation.node, it->first, value.u);
+                break;
+            case Parameter::Kind::kFloat:
+                status = SetParameterF(translation.node, it->first, value.f[0], value.f[1], value.f[2], value.f[3]);
+                break;
+            }
+        }
+
+        if (status != RPR_SUCCESS)
+        {
+            if (translation.node)
+            {
+                rprObjectDelete(translation.node);
+            }
+            ctx->translations.erase(key);
+            return status;
+        }
+    }
+
+    ++translation.refs;
+
+    for (auto shape : state.shapes)
+    {
+        rprShapeSetMaterial(shape, translation.node);
+    }
+
+    //shapes have been switched, the previous translation can go
+    ReleaseTranslation(*ctx, state.key);
+    state.key = key;
+
+    return RPR_SUCCESS;
 }
 
 rpr_int rprxShapeAttachMaterial(rprx_context context, rpr_shape shape, rprx_material material)
 {
-    return rprShapeSetMaterial(shape, (rpr_material_node)material);
+    if (!context)
+        return rprShapeSetMaterial(shape, (rpr_material_node)material);
+
+    //uncommitted materials are attached as they are
+    auto ctx = GetContext(context);
+    auto& state = ctx->materials[material];
+    auto node = state.key.empty() ? (rpr_material_node)material : ctx->translations[state.key].node;
+
+    auto status = rprShapeSetMaterial(shape, node);
+    if (status == RPR_SUCCESS)
+    {
+        state.shapes.insert(shape);
+    }
+
+    return status;
 }
 
 rpr_int rprxShapeDetachMaterial(rprx_context context, rpr_shape shape, rprx_material material)
 {
+    if (context)
+    {
+        auto it = GetContext(context)->materials.find(material);
+        if (it != GetContext(context)->materials.end())
+        {
+            it->second.shapes.erase(shape);
+        }
+    }
+
     return rprShapeSetMaterial(shape, nullptr);
 }
 
@@ -229,7 +459,29 @@ rpr_int rprxMaterialDetachMaterial(rprx_context context, rpr_material_node node,
 
 rpr_int rprxDeleteContext(rprx_context context)
 {
-    UNSUPPORTED_FUNCTION
+    if (!context)
+        return RPR_ERROR_INVALID_PARAMETER;
+
+    //shapes go back to the user materials, the shared nodes are deleted with the context
+    auto ctx = GetContext(context);
+    for (auto& material : ctx->materials)
+    {
+        if (!material.second.key.empty())
+        {
+            for (auto shape : material.second.shapes)
+            {
+                rprShapeSetMaterial(shape, (rpr_material_node)material.first);
+            }
+        }
+    }
+
+    for (auto& translation : ctx->translations)
+    {
+        rprObjectDelete(translation.second.node);
+    }
+
+    delete ctx;
+    return RPR_SUCCESS;
 }
 
 rpr_int rprxIsMaterialRprx(rprx_context context, rpr_material_node node, rprx_material* out_material, rpr_bool* out_result)
@@ -126,6 +126,45 @@ TEST_F(AovTest, Aov_Background)
     TestAovImplemented(RPR_AOV_BACKGROUND);
 }
 
+TEST_F(AovTest, Aov_IdleInterval)
+{
+    CreateScene(SceneType::kSphereAndPlane);
+    AddEnvironmentLight("../Resources/Textures/studio015.hdr");
+
+    ASSERT_EQ(rprContextSetParameter1u(m_context, "aov.idleinterval", 4u), RPR_SUCCESS);
+    ASSERT_EQ(rprContextSetAOV(m_context, RPR_AOV_SHADING_NORMAL, m_framebuffer), RPR_SUCCESS);
+
+    // Reading the framebuffer makes the AOV filled on the next render
+    auto get_num_samples = [this](float& num_samples)
+    {
+        std::vector<float3> data(kOutputWidth * kOutputHeight);
+        ASSERT_EQ(rprFrameBufferGetInfo(m_framebuffer, RPR_FRAMEBUFFER_DATA, data.size() * sizeof(float3), data.data(), nullptr), RPR_SUCCESS);
+        num_samples = 0.f;
+        for (auto const& pixel : data)
+        {
+            num_samples = std::max(num_samples, pixel.w);
+        }
+    };
+
+    // Attached AOV is filled on the first render, then on every 4th one while nobody reads it
+    for (auto i = 0; i < 4; ++i)
+    {
+        ASSERT_EQ(rprContextRender(m_context), RPR_SUCCESS);
+    }
+    float num_samples = 0.f;
+    get_num_samples(num_samples);
+    ASSERT_EQ(num_samples, 1.f);
+
+    ASSERT_EQ(rprContextRender(m_context), RPR_SUCCESS);
+    get_num_samples(num_samples);
+    ASSERT_EQ(num_samples, 2.f);
+
+    ASSERT_EQ(rprContextRender(m_context), RPR_SUCCESS);
+    ASSERT_EQ(rprContextRender(m_context), RPR_SUCCESS);
+    get_num_samples(num_samples);
+    ASSERT_EQ(num_samples, 3.f);
+}
+
 // Make sure that aovs below are not implemented
 TEST_F(AovTest, Aov_MaterialIndex)
 {
@@ -39,6 +39,7 @@
 #include <cstdlib>
 #include <sstream>
 #include <iostream>
+#include <thread>
 
 using namespace RadeonRays;
 
@@ -77,8 +78,19 @@ public:
 
         Baikal::SceneObject::ResetId();
 
-        rpr_creation_flags flags = GetCreationFlags();
-        ASSERT_EQ(rprCreateContext(RPR_API_VERSION, nullptr, 0, flags, nullptr, nullptr, &m_context), RPR_SUCCESS);
+        // Context keeps its compiled programs, so it is created once per run unless -isolate is given
+        m_context = SharedContext();
+
+        if (!m_context)
+        {
+            rpr_creation_flags flags = GetCreationFlags();
+            ASSERT_EQ(rprCreateContext(RPR_API_VERSION, nullptr, 0, flags, nullptr, nullptr, &m_context), RPR_SUCCESS);
+
+            if (std::find(g_argv, g_argv + g_argc, std::string("-isolate")) == g_argv + g_argc)
+            {
+                SharedContext() = m_context;
+            }
+        }
 
         ASSERT_EQ(rprContextSetParameter1u(m_context, "randseed", 0u), RPR_SUCCESS);
 
@@ -88,12 +100,8 @@ public:
     rpr_creation_flags GetCreationFlags() const
     {
         char* device_index_option = GetCmdOption(g_argv, g_argv + g_argc, "-device");
-
-        if (!device_index_option)
-        {
-            // Use gpu0 by default
-            return RPR_CREATION_FLAGS_ENABLE_GPU0;
-        }
+        char* shard_gpus_option = GetCmdOption(g_argv, g_argv + g_argc, "-shardgpus");
+        char* shard_index_option = std::getenv("GTEST_SHARD_INDEX");
 
         static const std::vector<rpr_uint> kGpuFlags =
         {
@@ -107,6 +115,19 @@ public:
             RPR_CREATION_FLAGS_ENABLE_GPU7
         };
 
+        if (!device_index_option)
+        {
+            // Shards of a sharded run go round the given number of gpus
+            if (shard_gpus_option && shard_index_option)
+            {
+                auto num_gpus = std::min<std::size_t>(std::max(atoi(shard_gpus_option), 1), kGpuFlags.size());
+                return kGpuFlags[static_cast<std::size_t>(atoi(shard_index_option)) % num_gpus];
+            }
+
+            // Use gpu0 by default
+            return RPR_CREATION_FLAGS_ENABLE_GPU0;
+        }
+
         for (std::size_t i = 0; i < kGpuFlags.size(); ++i)
         {
             if (std::string(device_index_option + 3) == std::to_string(i))
@@ -178,11 +199,28 @@ public:
             m_framebuffer = nullptr;
         }
 
-        if (m_context)
+        if (m_context && m_context == SharedContext())
+        {
+            // Shared context goes back to its initial state, parameters set by the tests included
+            ASSERT_EQ(rprContextClearMemory(m_context), RPR_SUCCESS);
+            ASSERT_EQ(rprContextSetParameter1u(m_context, "renderregion.xmin", 0), RPR_SUCCESS);
+            ASSERT_EQ(rprContextSetParameter1u(m_context, "renderregion.xmax", 0), RPR_SUCCESS);
+            ASSERT_EQ(rprContextSetParameter1u(m_context, "renderregion.ymin", 0), RPR_SUCCESS);
+            ASSERT_EQ(rprContextSetParameter1u(m_context, "renderregion.ymax", 0), RPR_SUCCESS);
+            ASSERT_EQ(rprContextSetParameter1u(m_context, "aov.idleinterval", 1), RPR_SUCCESS);
+        }
+        else if (m_context)
         {
             ASSERT_EQ(rprObjectDelete(m_context), RPR_SUCCESS);
-            m_context = nullptr;
         }
+        m_context = nullptr;
+    }
+
+    // Context shared by the tests of a run, deleted by SharedContextEnvironment
+    static rpr_context& SharedContext()
+    {
+        static rpr_context context = nullptr;
+        return context;
     }
 
     virtual void CreateFramebuffer()
@@ -718,6 +756,20 @@ protected:
 
 };
 
+// Deletes the context shared by the tests at the end of the run
+class SharedContextEnvironment : public ::testing::Environment
+{
+public:
+    void TearDown() override
+    {
+        if (BasicTest::SharedContext())
+        {
+            rprObjectDelete(BasicTest::SharedContext());
+            BasicTest::SharedContext() = nullptr;
+        }
+    }
+};
+
 // Memstat test
 TEST_F(BasicTest, Basic_MemoryStatistics)
 {
@@ -839,3 +891,336 @@ TEST_F(BasicTest, Basic_MultiUV)
         texcoord_indices, tidx_stride,
         num_face_vertices, num_faces, &mesh), RPR_ERROR_UNIMPLEMENTED);
 }
+
+//corners sharing position, normal and uv indices are welded into a single vertex
+TEST_F(BasicTest, Basic_MeshWelding)
+{
+    struct Vertex
+    {
+        rpr_float pos[3];
+        rpr_float norm[3];
+        rpr_float tex[2];
+    };
+
+    Vertex vertices[] =
+    {
+        {{-2.0f,  2.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 0.0f}},
+        {{ 2.0f,  2.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 0.0f}},
+        {{ 2.0f, -2.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}},
+        {{-2.0f, -2.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f}}
+    };
+
+    //a quad and two triangles over the same four vertices, uv of the last corner differs
+    rpr_int indices[] =
+    {
+        3, 2, 1, 0,
+        0, 1, 2,
+        2, 3, 0
+    };
+
+    rpr_int texcoord_indices[] =
+    {
+        3, 2, 1, 0,
+        0, 1, 2,
+        2, 3, 1
+    };
+
+    rpr_int num_face_vertices[] =
+    {
+        4, 3, 3
+    };
+
+    unsigned int num_vertices = sizeof(vertices) / sizeof(vertices[0]);
+    unsigned int num_faces = sizeof(num_face_vertices) / sizeof(num_face_vertices[0]);
+
+    rpr_shape mesh = nullptr;
+    ASSERT_EQ(rprContextCreateMesh(m_context,
+        (rpr_float const*)&vertices[0], num_vertices, sizeof(Vertex),
+        (rpr_float const*)((char*)&vertices[0] + sizeof(rpr_float) * 3), num_vertices, sizeof(Vertex),
+        (rpr_float const*)((char*)&vertices[0] + sizeof(rpr_float) * 6), num_vertices, sizeof(Vertex),
+        indices, sizeof(rpr_int),
+        indices, sizeof(rpr_int),
+        texcoord_indices, sizeof(rpr_int),
+        num_face_vertices, num_faces, &mesh), RPR_SUCCESS);
+
+    std::uint64_t vertex_count = 0;
+    ASSERT_EQ(rprMeshGetInfo(mesh, RPR_MESH_VERTEX_COUNT, sizeof(vertex_count), &vertex_count, nullptr), RPR_SUCCESS);
+    ASSERT_EQ(vertex_count, num_vertices + 1);
+
+    std::uint64_t polygon_count = 0;
+    ASSERT_EQ(rprMeshGetInfo(mesh, RPR_MESH_POLYGON_COUNT, sizeof(polygon_count), &polygon_count, nullptr), RPR_SUCCESS);
+    ASSERT_EQ(polygon_count, 4);
+
+    std::vector<rpr_float> uvs((num_vertices + 1) * 2);
+    ASSERT_EQ(rprMeshGetInfo(mesh, RPR_MESH_UV_ARRAY, uvs.size() * sizeof(rpr_float), uvs.data(), nullptr), RPR_SUCCESS);
+
+    std::vector<std::uint32_t> mesh_indices(12);
+    ASSERT_EQ(rprMeshGetInfo(mesh, RPR_MESH_VERTEX_INDEX_ARRAY, mesh_indices.size() * sizeof(std::uint32_t), mesh_indices.data(), nullptr), RPR_SUCCESS);
+
+    //last corner keeps the uv it has been given
+    ASSERT_EQ(uvs[mesh_indices[11] * 2], vertices[1].tex[0]);
+    ASSERT_EQ(uvs[mesh_indices[11] * 2 + 1], vertices[1].tex[1]);
+    ASSERT_NE(mesh_indices[11], mesh_indices[6]);
+
+    ASSERT_EQ(rprObjectDelete(mesh), RPR_SUCCESS);
+}
+
+//packed framebuffers are resolved on the device and read back in their own format
+TEST_F(BasicTest, Basic_PackedFramebuffer)
+{
+    CreateScene(SceneType::kSphereAndPlane);
+    AddEnvironmentLight("../Resources/Textures/studio015.hdr");
+    Render();
+
+    rpr_framebuffer_desc desc = { kOutputWidth, kOutputHeight };
+    rpr_framebuffer ldr = nullptr;
+    rpr_framebuffer hdr = nullptr;
+    ASSERT_EQ(rprContextCreateFrameBuffer(m_context, { 4, RPR_COMPONENT_TYPE_UINT8 }, &desc, &ldr), RPR_SUCCESS);
+    ASSERT_EQ(rprContextCreateFrameBuffer(m_context, { 4, RPR_COMPONENT_TYPE_FLOAT16 }, &desc, &hdr), RPR_SUCCESS);
+
+    std::size_t num_pixels = kOutputWidth * kOutputHeight;
+    size_t size = 0;
+    ASSERT_EQ(rprFrameBufferGetInfo(ldr, RPR_FRAMEBUFFER_DATA, 0, nullptr, &size), RPR_SUCCESS);
+    ASSERT_EQ(size, num_pixels * 4);
+    ASSERT_EQ(rprFrameBufferGetInfo(hdr, RPR_FRAMEBUFFER_DATA, 0, nullptr, &size), RPR_SUCCESS);
+    ASSERT_EQ(size, num_pixels * 8);
+
+    ASSERT_EQ(rprContextResolveFrameBuffer(m_context, m_framebuffer, ldr, RPR_TRUE), RPR_SUCCESS);
+    ASSERT_EQ(rprContextResolveFrameBuffer(m_context, m_framebuffer, hdr, RPR_TRUE), RPR_SUCCESS);
+
+    std::vector<RadeonRays::float3> samples(num_pixels);
+    std::vector<std::uint8_t> ldr_data(num_pixels * 4);
+    std::vector<std::uint16_t> hdr_data(num_pixels * 4);
+    ASSERT_EQ(rprFrameBufferGetInfo(m_framebuffer, RPR_FRAMEBUFFER_DATA, samples.size() * sizeof(RadeonRays::float3), samples.data(), nullptr), RPR_SUCCESS);
+    ASSERT_EQ(rprFrameBufferGetInfo(ldr, RPR_FRAMEBUFFER_DATA, ldr_data.size(), ldr_data.data(), nullptr), RPR_SUCCESS);
+    ASSERT_EQ(rprFrameBufferGetInfo(hdr, RPR_FRAMEBUFFER_DATA, hdr_data.size() * sizeof(std::uint16_t), hdr_data.data(), nullptr), RPR_SUCCESS);
+
+    //normal and zero half values only
+    auto half_to_float = [](std::uint16_t bits)
+    {
+        int exponent = (bits >> 10) & 0x1f;
+        float mantissa = 1.f + (bits & 0x3ff) / 1024.f;
+        return exponent == 0 ? 0.f : std::ldexp(mantissa, exponent - 15) * ((bits & 0x8000) ? -1.f : 1.f);
+    };
+
+    for (std::size_t i = 0; i < num_pixels; ++i)
+    {
+        auto value = samples[i].w > 0.f ? samples[i].x / samples[i].w : 0.f;
+        ASSERT_NEAR(ldr_data[4 * i], std::min(std::max(value, 0.f), 1.f) * 255.f, 1.f);
+        ASSERT_NEAR(half_to_float(hdr_data[4 * i]), value, std::max(value, 1e-3f) * 2e-3f);
+    }
+
+    //packed framebuffers can be rendered into
+    ASSERT_EQ(rprContextSetAOV(m_context, RPR_AOV_COLOR, ldr), RPR_SUCCESS);
+    ASSERT_EQ(rprFrameBufferClear(ldr), RPR_SUCCESS);
+    ASSERT_EQ(rprContextRender(m_context), RPR_SUCCESS);
+    ASSERT_EQ(rprFrameBufferGetInfo(ldr, RPR_FRAMEBUFFER_DATA, ldr_data.size(), ldr_data.data(), nullptr), RPR_SUCCESS);
+    ASSERT_EQ(rprContextSetAOV(m_context, RPR_AOV_COLOR, m_framebuffer), RPR_SUCCESS);
+
+    ASSERT_EQ(rprObjectDelete(hdr), RPR_SUCCESS);
+    ASSERT_EQ(rprObjectDelete(ldr), RPR_SUCCESS);
+}
+
+TEST_F(BasicTest, Basic_SceneEdit)
+{
+    ASSERT_EQ(rprContextEndSceneEdit(m_context), RPR_ERROR_INVALID_OBJECT);
+
+    CreateScene(SceneType::kSphereAndPlane);
+    AddEnvironmentLight("../Resources/Textures/studio015.hdr");
+    Render();
+
+    rpr_render_statistics rs;
+    ASSERT_EQ(rprContextGetInfo(m_context, RPR_CONTEXT_RENDER_STATISTICS, sizeof(rpr_render_statistics), &rs, nullptr), RPR_SUCCESS);
+    auto committed_usage = rs.gpumem_usage;
+    ASSERT_GT(committed_usage, 0);
+
+    //edits of a batch are not compiled until the outermost batch ends
+    ASSERT_EQ(rprContextBeginSceneEdit(m_context), RPR_SUCCESS);
+    ASSERT_EQ(rprContextBeginSceneEdit(m_context), RPR_SUCCESS);
+
+    AddSphere("sphere2", 256, 128, 1.f, float3(2.f, 1.f, 0.f));
+    ApplyMaterialToObject("sphere2", "sphere_mtl");
+    matrix m = translation(float3(0.f, 0.5f, 0.f));
+    ASSERT_EQ(rprShapeSetTransform(GetShape("sphere"), true, &m.m00), RPR_SUCCESS);
+
+    Render(1);
+    ASSERT_EQ(rprContextGetInfo(m_context, RPR_CONTEXT_RENDER_STATISTICS, sizeof(rpr_render_statistics), &rs, nullptr), RPR_SUCCESS);
+    ASSERT_EQ(rs.gpumem_usage, committed_usage);
+
+    ASSERT_EQ(rprContextEndSceneEdit(m_context), RPR_SUCCESS);
+    ASSERT_EQ(rprContextGetInfo(m_context, RPR_CONTEXT_RENDER_STATISTICS, sizeof(rpr_render_statistics), &rs, nullptr), RPR_SUCCESS);
+    ASSERT_EQ(rs.gpumem_usage, committed_usage);
+
+    ASSERT_EQ(rprContextEndSceneEdit(m_context), RPR_SUCCESS);
+    ASSERT_EQ(rprContextGetInfo(m_context, RPR_CONTEXT_RENDER_STATISTICS, sizeof(rpr_render_statistics), &rs, nullptr), RPR_SUCCESS);
+    ASSERT_GT(rs.gpumem_usage, committed_usage);
+
+    ASSERT_EQ(rprContextEndSceneEdit(m_context), RPR_ERROR_INVALID_PARAMETER);
+    Render(1);
+}
+
+TEST_F(BasicTest, Basic_ParallelCreate)
+{
+    CreateScene(SceneType::kSphereAndPlane);
+    AddEnvironmentLight("../Resources/Textures/studio015.hdr");
+
+    rpr_float vertices[] =
+    {
+        -0.5f, 0.f, -0.5f,
+        0.5f, 0.f, -0.5f,
+        0.5f, 0.f, 0.5f,
+        -0.5f, 0.f, 0.5f
+    };
+    rpr_float normals[] = { 0.f, 1.f, 0.f, 0.f, 1.f, 0.f, 0.f, 1.f, 0.f, 0.f, 1.f, 0.f };
+    rpr_float uvs[] = { 0.f, 0.f, 1.f, 0.f, 1.f, 1.f, 0.f, 1.f };
+    rpr_int indices[] = { 3, 1, 0, 2, 1, 3 };
+    rpr_int num_face_vertices[] = { 3, 3 };
+    float texels[] = { 1.f, 0.f, 0.f, 1.f };
+
+    const int num_threads = 4;
+    const int shapes_per_thread = 64;
+    std::vector<rpr_shape> shapes(num_threads * shapes_per_thread, nullptr);
+    std::vector<rpr_image> images(num_threads, nullptr);
+    std::vector<rpr_int> results(num_threads, RPR_SUCCESS);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            rpr_image_format format = { 4, RPR_COMPONENT_TYPE_FLOAT32 };
+            rpr_image_desc desc = { 1, 1, 0, 4 * sizeof(float), 0 };
+            rpr_int result = rprContextCreateImage(m_context, format, &desc, texels, &images[t]);
+
+            for (int i = 0; i < shapes_per_thread && result == RPR_SUCCESS; ++i)
+            {
+                result = rprContextCreateMesh(m_context,
+                    vertices, 4, 3 * sizeof(rpr_float),
+                    normals, 4, 3 * sizeof(rpr_float),
+                    uvs, 4, 2 * sizeof(rpr_float),
+                    indices, sizeof(rpr_int),
+                    indices, sizeof(rpr_int),
+                    indices, sizeof(rpr_int),
+                    num_face_vertices, 2, &shapes[t * shapes_per_thread + i]);
+            }
+
+            results[t] = result;
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    for (auto result : results)
+    {
+        ASSERT_EQ(result, RPR_SUCCESS);
+    }
+
+    //every call got its own object, scene edits stay on one thread
+    std::vector<rpr_shape> unique_shapes(shapes);
+    std::sort(unique_shapes.begin(), unique_shapes.end());
+    ASSERT_EQ(std::unique(unique_shapes.begin(), unique_shapes.end()), unique_shapes.end());
+
+    for (std::size_t i = 0; i < shapes.size(); ++i)
+    {
+        matrix m = translation(float3((i % 16) * 0.25f - 2.f, 0.05f, (i / 16) * 0.25f - 2.f)) * scale(float3(0.2f, 0.2f, 0.2f));
+        ASSERT_EQ(rprShapeSetTransform(shapes[i], true, &m.m00), RPR_SUCCESS);
+        AddShape("parallel" + std::to_string(i), shapes[i]);
+    }
+
+    Render(1);
+
+    for (auto image : images)
+    {
+        ASSERT_EQ(rprObjectDelete(image), RPR_SUCCESS);
+    }
+}
+
+TEST_F(BasicTest, Basic_ImageFromFileAsync)
+{
+    rpr_image image = nullptr;
+    ASSERT_EQ(rprContextCreateImageFromFile(m_context, "../Resources/Textures/missing.hdr", &image), RPR_ERROR_IO_ERROR);
+
+    CreateScene(SceneType::kSphereAndPlane);
+    AddEnvironmentLight("../Resources/Textures/studio015.hdr");
+
+    //images deleted while still being decoded
+    for (int i = 0; i < 8; ++i)
+    {
+        ASSERT_EQ(rprContextCreateImageFromFile(m_context, "../Resources/Textures/studio015.hdr", &image), RPR_SUCCESS);
+        ASSERT_EQ(rprObjectDelete(image), RPR_SUCCESS);
+    }
+
+    //first render waits for the decoded environment
+    Render();
+    SaveAndCompare();
+}
+
+TEST_F(BasicTest, Basic_PickShape)
+{
+    CreateScene(SceneType::kSphereAndPlane);
+    Render(1);
+
+    rpr_shape shape = nullptr;
+    ASSERT_EQ(rprContextPickShape(m_context, kOutputWidth, 0, &shape, nullptr), RPR_ERROR_INVALID_PARAMETER);
+    ASSERT_EQ(rprContextPickShape(m_context, 0, 0, nullptr, nullptr), RPR_ERROR_INVALID_PARAMETER);
+
+    //center column goes over the sphere and the plane below it
+    auto sphere = GetShape("sphere");
+    auto num_sphere_hits = 0u;
+
+    for (std::uint32_t y = 0; y < kOutputHeight; ++y)
+    {
+        float position[3];
+        ASSERT_EQ(rprContextPickShape(m_context, kOutputWidth / 2, y, &shape, position), RPR_SUCCESS);
+
+        if (shape == sphere)
+        {
+            auto radius = std::sqrt(position[0] * position[0] + position[1] * position[1] + position[2] * position[2]);
+            ASSERT_NEAR(radius, 2.f, 0.05f);
+            ++num_sphere_hits;
+        }
+    }
+
+    ASSERT_GT(num_sphere_hits, 0u);
+}
+
+TEST_F(BasicTest, Basic_RenderRegion)
+{
+    CreateScene(SceneType::kSphereAndPlane);
+    AddEnvironmentLight("../Resources/Textures/studio015.hdr");
+
+    ASSERT_EQ(rprContextSetParameter1u(m_context, "renderregion.xmin", 32), RPR_SUCCESS);
+    ASSERT_EQ(rprContextSetParameter1u(m_context, "renderregion.xmax", 96), RPR_SUCCESS);
+    ASSERT_EQ(rprContextSetParameter1u(m_context, "renderregion.ymin", 64), RPR_SUCCESS);
+    ASSERT_EQ(rprContextSetParameter1u(m_context, "renderregion.ymax", 80), RPR_SUCCESS);
+    Render(1);
+
+    //pixels out of the region get no samples
+    std::vector<RadeonRays::float3> samples(kOutputWidth * kOutputHeight);
+    ASSERT_EQ(rprFrameBufferGetInfo(m_framebuffer, RPR_FRAMEBUFFER_DATA, samples.size() * sizeof(RadeonRays::float3), samples.data(), nullptr), RPR_SUCCESS);
+
+    for (std::uint32_t y = 0; y < kOutputHeight; ++y)
+    {
+        for (std::uint32_t x = 0; x < kOutputWidth; ++x)
+        {
+            auto inside = x >= 32 && x < 96 && y >= 64 && y < 80;
+            ASSERT_EQ(samples[y * kOutputWidth + x].w > 0.f, inside);
+        }
+    }
+
+    ASSERT_EQ(rprContextSetParameter1u(m_context, "renderregion.xmax", kOutputWidth + 1), RPR_SUCCESS);
+    ASSERT_EQ(rprContextRender(m_context), RPR_ERROR_INVALID_PARAMETER);
+
+    //empty region renders whole frames
+    ASSERT_EQ(rprContextSetParameter1u(m_context, "renderregion.xmax", 0), RPR_SUCCESS);
+    Render(1);
+
+    ASSERT_EQ(rprFrameBufferGetInfo(m_framebuffer, RPR_FRAMEBUFFER_DATA, samples.size() * sizeof(RadeonRays::float3), samples.data(), nullptr), RPR_SUCCESS);
+    for (auto const& sample : samples)
+    {
+        ASSERT_GT(sample.w, 0.f);
+    }
+}
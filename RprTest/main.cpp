@@ -33,6 +33,7 @@ char** g_argv;
 int main(int argc, char** argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
+    ::testing::AddGlobalTestEnvironment(new SharedContextEnvironment());
     g_argc = argc;
     g_argv = argv;
     return RUN_ALL_TESTS();
@@ -23,6 +23,7 @@
 #pragma once
 
 #include "basic.h"
+#include "RprSupport.h"
 
 class MaterialTest : public BasicTest
 {
@@ -375,3 +376,54 @@ TEST_F(MaterialTest, Material_BumpMapping)
     SaveAndCompare();
 
 }
+
+TEST_F(MaterialTest, Material_RprxSharedTranslation)
+{
+    rprx_context rprx = nullptr;
+    ASSERT_EQ(rprxCreateContext(m_matsys, 0, &rprx), RPR_SUCCESS);
+
+    const rpr_shape sphere = GetShape("sphere");
+    const rpr_shape plane = GetShape("plane");
+
+    rprx_material materials[2] = {};
+    for (auto& material : materials)
+    {
+        ASSERT_EQ(rprxCreateMaterial(rprx, RPRX_MATERIAL_UBER, &material), RPR_SUCCESS);
+        ASSERT_EQ(rprxMaterialSetParameterF(rprx, material, RPRX_UBER_MATERIAL_DIFFUSE_WEIGHT, 1.f, 1.f, 1.f, 1.f), RPR_SUCCESS);
+        ASSERT_EQ(rprxMaterialSetParameterF(rprx, material, RPRX_UBER_MATERIAL_DIFFUSE_COLOR, 0.9f, 0.2f, 0.1f, 0.f), RPR_SUCCESS);
+    }
+
+    ASSERT_EQ(rprxShapeAttachMaterial(rprx, sphere, materials[0]), RPR_SUCCESS);
+    ASSERT_EQ(rprxShapeAttachMaterial(rprx, plane, materials[1]), RPR_SUCCESS);
+
+    auto get_material = [](rpr_shape shape)
+    {
+        rpr_material_node node = nullptr;
+        EXPECT_EQ(rprShapeGetInfo(shape, RPR_SHAPE_MATERIAL, sizeof(node), &node, nullptr), RPR_SUCCESS);
+        return node;
+    };
+    ASSERT_NE(get_material(sphere), get_material(plane));
+
+    //equal parameters translate into one material
+    for (auto material : materials)
+    {
+        ASSERT_EQ(rprxMaterialCommit(rprx, material), RPR_SUCCESS);
+    }
+    ASSERT_EQ(get_material(sphere), get_material(plane));
+    Render(1);
+
+    //edits take effect on commit and split the shapes again
+    ASSERT_EQ(rprxMaterialSetParameterF(rprx, materials[1], RPRX_UBER_MATERIAL_DIFFUSE_COLOR, 0.1f, 0.9f, 0.1f, 0.f), RPR_SUCCESS);
+    ASSERT_EQ(get_material(sphere), get_material(plane));
+    ASSERT_EQ(rprxMaterialCommit(rprx, materials[1]), RPR_SUCCESS);
+    ASSERT_NE(get_material(sphere), get_material(plane));
+    Render(1);
+
+    ASSERT_EQ(rprxShapeDetachMaterial(rprx, sphere, materials[0]), RPR_SUCCESS);
+    ASSERT_EQ(rprxShapeDetachMaterial(rprx, plane, materials[1]), RPR_SUCCESS);
+    for (auto material : materials)
+    {
+        ASSERT_EQ(rprxMaterialDelete(rprx, material), RPR_SUCCESS);
+    }
+    ASSERT_EQ(rprxDeleteContext(rprx), RPR_SUCCESS);
+}
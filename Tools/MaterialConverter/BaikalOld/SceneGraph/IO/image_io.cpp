@@ -9,6 +9,7 @@ namespace BaikalOld
     {
     public:
         Texture::Ptr LoadImage(std::string const& filename) const override;
+        Texture::Ptr LoadImageInfo(std::string const& filename) const override;
         void SaveImage(std::string const& filename, Texture::Ptr texture) const override;
     };
 
@@ -95,6 +96,24 @@ namespace BaikalOld
         return Texture::Create(texturedata, RadeonRays::int2(spec.width, spec.height), fmt);;
     }
 
+    Texture::Ptr Oiio::LoadImageInfo(const std::string &filename) const
+    {
+        OIIO_NAMESPACE_USING
+
+        std::unique_ptr<ImageInput> input{ImageInput::open(filename)};
+
+        if (!input)
+        {
+            throw std::runtime_error("Can't load " + filename + " image");
+        }
+
+        ImageSpec const& spec = input->spec();
+        auto fmt = GetTextureForemat(spec);
+        input->close();
+
+        return Texture::Create(nullptr, RadeonRays::int2(spec.width, spec.height), fmt);
+    }
+
     void Oiio::SaveImage(std::string const& filename, Texture::Ptr texture) const
     {
         OIIO_NAMESPACE_USING;
@@ -55,6 +55,8 @@ namespace BaikalOld
         
         // Load texture from file
         virtual Texture::Ptr LoadImage(std::string const& filename) const = 0;
+        // Read image header only, the texture gets size and format of the file but no texel data
+        virtual Texture::Ptr LoadImageInfo(std::string const& filename) const = 0;
         virtual void SaveImage(std::string const& filename, Texture::Ptr texture) const = 0;
         
         // Disallow copying
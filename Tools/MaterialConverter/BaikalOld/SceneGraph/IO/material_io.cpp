@@ -5,6 +5,8 @@
 #include "BaikalOld/SceneGraph/IO/image_io.h"
 
 
+#include "Utils/log.h"
+#include "Utils/thread_pool.h"
 #include "XML/tinyxml2.h"
 
 #include <iostream>
@@ -12,6 +14,7 @@
 #include <map>
 #include <stack>
 #include <string>
+#include <vector>
 
 namespace BaikalOld
 {
@@ -36,11 +39,15 @@ namespace BaikalOld
         Material::Ptr LoadMaterial(ImageIo& io, XMLElement& element);
         // Load single input
         void LoadInput(ImageIo& io, Material::Ptr material, XMLElement& element);
+        // Read files of the textures created while loading materials
+        void LoadPendingTextures(ImageIo& io);
 
         // Texture to name map
         std::map<Texture::Ptr, std::string> m_tex2name;
 
+        // Textures are shared by file name and read once all the materials are there
         std::map<std::string, Texture::Ptr> m_name2tex;
+        std::vector<std::pair<std::string, Texture::Ptr>> m_pending_textures;
         std::map<std::uint64_t, Material::Ptr> m_id2mat;
 
         struct ResolveRequest
@@ -322,10 +329,11 @@ namespace BaikalOld
             }
             else
             {
-                auto texture = io.LoadImage(m_base_path + filename);
+                auto texture = Texture::Create();
                 texture->SetName(filename);
                 material->SetInputValue(name, texture);
-                m_name2tex[name] = texture;
+                m_name2tex[filename] = texture;
+                m_pending_textures.emplace_back(m_base_path + filename, texture);
             }
         }
         else if (type == "material")
@@ -399,10 +407,28 @@ namespace BaikalOld
         return material;
     }
 
+    void MaterialIoXML::LoadPendingTextures(ImageIo& io)
+    {
+        Baikal::ThreadPool thread_pool;
+        thread_pool.ParallelFor(m_pending_textures.size(), 1, [&](std::size_t begin, std::size_t end)
+        {
+            for (auto i = begin; i < end; ++i)
+            {
+                auto& pending = m_pending_textures[i];
+                auto texture = m_load_texels ? io.LoadImage(pending.first) : io.LoadImageInfo(pending.first);
+                pending.second->TakeData(*texture);
+            }
+        });
+
+        Baikal::LogInfo("Loaded ", m_pending_textures.size(), m_load_texels ? " textures\n" : " texture headers\n");
+        m_pending_textures.clear();
+    }
+
     std::unique_ptr<Iterator> MaterialIoXML::LoadMaterials(std::string const& file_name)
     {
         m_id2mat.clear();
         m_name2tex.clear();
+        m_pending_textures.clear();
         m_resolve_requests.clear();
 
         auto slash = file_name.find_last_of('/');
@@ -424,6 +450,8 @@ namespace BaikalOld
             materials.insert(material);
         }
 
+        LoadPendingTextures(*image_io);
+
         // Fix up non-resolved stuff
         for (auto& i : m_resolve_requests)
         {
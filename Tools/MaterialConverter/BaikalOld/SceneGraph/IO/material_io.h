@@ -73,9 +73,16 @@ namespace BaikalOld
         // Load material mapping from disk
         MaterialMap LoadMaterialMapping(std::string const& filename);
 
+        // Read only image headers of textures on load, for tools that need texture names and sizes only
+        void SetTexelLoading(bool enable) { m_load_texels = enable; }
+        bool IsTexelLoading() const { return m_load_texels; }
+
         // Disallow copying
         MaterialIo(MaterialIo const&) = delete;
         MaterialIo& operator = (MaterialIo const&) = delete;
+
+    protected:
+        bool m_load_texels = true;
     };
 
     inline MaterialIo::~MaterialIo()
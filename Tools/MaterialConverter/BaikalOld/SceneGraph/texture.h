@@ -65,6 +65,8 @@ namespace BaikalOld
 
         // Set data
         void SetData(char* data, RadeonRays::int2 size, Format format);
+        // Move data of another texture into this one, the other texture is left empty
+        void TakeData(Texture& other);
 
         // Get texture dimensions
         RadeonRays::int2 GetSize() const;
@@ -124,6 +126,11 @@ namespace BaikalOld
         SetDirty(true);
     }
 
+    inline void Texture::TakeData(Texture& other)
+    {
+        SetData(other.m_data.release(), other.m_size, other.m_format);
+    }
+
     inline RadeonRays::int2 Texture::GetSize() const
     {
         return m_size;
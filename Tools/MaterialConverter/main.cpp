@@ -37,11 +37,13 @@
 #include <algorithm>
 #include <string>
 #include <map>
+#include <cstdint>
 
 namespace
 {
     char const* kHelpMessage =
-        "MaterialConverter -p <path to materials.xml and mapping.xml folder>";
+        "MaterialConverter -p <path to materials.xml and mapping.xml folder> [-i]\n"
+        "    -i: incremental mode, reuse materials of previous materials_new.xml whose inputs are unchanged";
 }
 
 static char* GetCmdOption(char** begin, char** end, const std::string& option)
@@ -54,6 +56,39 @@ static char* GetCmdOption(char** begin, char** end, const std::string& option)
     return 0;
 }
 
+static bool HasCmdOption(char** begin, char** end, const std::string& option)
+{
+    return std::find(begin, end, option) != end;
+}
+
+// Material input hashes stored next to materials_new.xml, one "<hash> <name>" line per material
+static std::map<std::string, std::uint64_t> LoadHashes(std::string const& filename)
+{
+    std::map<std::string, std::uint64_t> hashes;
+    std::ifstream in(filename);
+    std::uint64_t hash;
+    std::string name;
+    while (in >> hash && std::getline(in >> std::ws, name))
+    {
+        hashes[name] = hash;
+    }
+    return hashes;
+}
+
+static void SaveHashes(std::string const& filename, std::map<std::string, std::uint64_t> const& hashes)
+{
+    std::ofstream out(filename);
+    if (!out)
+    {
+        throw std::runtime_error("Failed to write " + filename);
+    }
+
+    for (auto const& hash : hashes)
+    {
+        out << hash.second << " " << hash.first << "\n";
+    }
+}
+
 void Process(int argc, char** argv)
 {
     char* scene_path = GetCmdOption(argv, argv + argc, "-p");
@@ -65,6 +100,7 @@ void Process(int argc, char** argv)
     }
 
     std::string scene_path_str = std::string(scene_path);
+    bool incremental = HasCmdOption(argv, argv + argc, "-i");
 
     std::ifstream in_materials(scene_path_str + "materials.xml");
     if (!in_materials)
@@ -83,7 +119,9 @@ void Process(int argc, char** argv)
 
     std::cout << "Loading materials.xml" << std::endl;
 
+    // New materials reference textures by file name, texels are never needed
     auto material_io = BaikalOld::MaterialIo::CreateMaterialIoXML();
+    material_io->SetTexelLoading(false);
     auto mats = material_io->LoadMaterials(scene_path_str + "materials.xml");
 
     std::map<std::string, BaikalOld::Material::Ptr> all_materials;
@@ -102,14 +140,68 @@ void Process(int argc, char** argv)
         old_materials.emplace(all_materials[element->Attribute("to")]);
     }
 
-    std::cout << "Converting materials" << std::endl;
-    std::set<Baikal::UberV2Material::Ptr> new_materials = MaterialConverter::TranslateMaterials(old_materials);
-
     auto material_io_new = Baikal::MaterialIo::CreateMaterialIoXML();
+    material_io_new->SetTextureLoading(false);
+
+    auto output_file = scene_path_str + "materials_new.xml";
+    auto hashes_file = scene_path_str + "materials_new.hashes";
+    auto hashes = MaterialConverter::ComputeInputHashes(scene_path_str + "materials.xml", scene_path_str);
+
+    std::set<Baikal::UberV2Material::Ptr> new_materials;
+
+    if (incremental && std::ifstream(output_file) && std::ifstream(hashes_file))
+    {
+        std::cout << "Loading previous materials_new.xml" << std::endl;
+
+        auto previous_hashes = LoadHashes(hashes_file);
+        std::map<std::string, Baikal::UberV2Material::Ptr> previous_materials;
+        auto previous = material_io_new->LoadMaterials(output_file);
+        for (previous->Reset(); previous->IsValid(); previous->Next())
+        {
+            if (auto mtl = std::dynamic_pointer_cast<Baikal::UberV2Material>(previous->ItemAs<Baikal::Material>()))
+            {
+                previous_materials[mtl->GetName()] = mtl;
+            }
+        }
+
+        // Keep the materials which inputs did not change since the previous run
+        std::set<BaikalOld::Material::Ptr> changed_materials;
+        for (auto const& old_mtl : old_materials)
+        {
+            if (!old_mtl)
+            {
+                continue;
+            }
+
+            auto const& name = old_mtl->GetName();
+            auto hash = hashes.find(name);
+            auto previous_hash = previous_hashes.find(name);
+            auto previous_mtl = previous_materials.find(name);
+
+            if (hash != hashes.end() && previous_hash != previous_hashes.end() &&
+                previous_mtl != previous_materials.end() && hash->second == previous_hash->second)
+            {
+                new_materials.insert(previous_mtl->second);
+            }
+            else
+            {
+                changed_materials.insert(old_mtl);
+            }
+        }
+
+        std::cout << "Reusing " << new_materials.size() << " materials" << std::endl;
+        old_materials = std::move(changed_materials);
+    }
+
+    std::cout << "Converting " << old_materials.size() << " materials" << std::endl;
+    auto translated_materials = MaterialConverter::TranslateMaterials(old_materials);
+    new_materials.insert(translated_materials.begin(), translated_materials.end());
+
     auto material_new_iterator = std::make_unique<Baikal::ContainerIterator<decltype(new_materials)>>(std::move(new_materials));
 
     std::cout << "Saving to new materials xml file" << std::endl;
-    material_io_new->SaveMaterials(scene_path_str + "materials_new.xml", *material_new_iterator);
+    material_io_new->SaveMaterials(output_file, *material_new_iterator);
+    SaveHashes(hashes_file, hashes);
 
     std::cout << "Done." << std::endl;
 }
@@ -22,15 +22,24 @@
 
 #include "material_converter.h"
 
+#include "Utils/compile_cache.h"
 #include "Utils/log.h"
+#include "Utils/thread_pool.h"
 
 #include "BaikalOld/SceneGraph/iterator.h"
 
 #include "SceneGraph/iterator.h"
 #include "SceneGraph/inputmaps.h"
 
+#include "XML/tinyxml2.h"
+
+#include <sys/stat.h>
+
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <vector>
 
 Baikal::Texture::Format MaterialConverter::TranslateFormat(BaikalOld::Texture::Format old_format)
@@ -57,6 +66,10 @@ namespace
     // Used by shading normal layer
     static const Baikal::InputMap_ConstantFloat3::Ptr kNormalSrcRange = Baikal::InputMap_ConstantFloat3::Create(RadeonRays::float3(0.0f, 1.0f, 0.0f));
     static const Baikal::InputMap_ConstantFloat3::Ptr kNormalDstRange = Baikal::InputMap_ConstantFloat3::Create(RadeonRays::float3(-1.0f, 1.0f, 0.0f));
+
+    // Old textures shared by several materials are translated once per TranslateMaterials call
+    std::mutex g_texture_mutex;
+    std::map<BaikalOld::Texture const*, Baikal::Texture::Ptr> g_translated_textures;
 }
 
 Baikal::InputMap::Ptr MaterialConverter::TranslateInput(BaikalOld::Material::Ptr old_mtl, std::string const& input_name)
@@ -85,18 +98,35 @@ Baikal::InputMap::Ptr MaterialConverter::TranslateInput(BaikalOld::Material::Ptr
     {
         Baikal::LogInfo("Texture value: \"", old_input_value.tex_value->GetName(), "\"\n");
 
-        char* data = new char[old_input_value.tex_value->GetSizeInBytes()];
-        memcpy(data, old_input_value.tex_value->GetData(), old_input_value.tex_value->GetSizeInBytes());
+        auto const& old_texture = *old_input_value.tex_value;
+
+        std::unique_lock<std::mutex> lock(g_texture_mutex);
+        auto& new_texture = g_translated_textures[&old_texture];
+
+        if (!new_texture)
+        {
+            if (old_texture.GetData())
+            {
+                char* data = new char[old_texture.GetSizeInBytes()];
+                memcpy(data, old_texture.GetData(), old_texture.GetSizeInBytes());
 
-        RadeonRays::int2 old_size = old_input_value.tex_value->GetSize();
+                RadeonRays::int2 old_size = old_texture.GetSize();
 
-        auto new_texture = Baikal::Texture::Create(data,
-            RadeonRays::int3(old_size.x, old_size.y, 1),
-            TranslateFormat(old_input_value.tex_value->GetFormat()));
+                new_texture = Baikal::Texture::Create(data,
+                    RadeonRays::int3(old_size.x, old_size.y, 1),
+                    TranslateFormat(old_texture.GetFormat()));
+            }
+            else
+            {
+                // Texels were not loaded, new material only references the file by name
+                new_texture = Baikal::Texture::Create();
+            }
 
-        new_texture->SetName(old_input_value.tex_value->GetName());
+            new_texture->SetName(old_texture.GetName());
+        }
 
         input_map = Baikal::InputMap_Sampler::Create(new_texture);
+        lock.unlock();
 
         if (input_name == "albedo")
         {
@@ -662,8 +692,7 @@ Baikal::UberV2Material::Ptr MaterialConverter::TranslateMaterial(BaikalOld::Mate
 
 std::set<Baikal::UberV2Material::Ptr> MaterialConverter::TranslateMaterials(std::set<BaikalOld::Material::Ptr> const& old_materials)
 {
-    std::set<Baikal::UberV2Material::Ptr> result;
-    unsigned int i = 0;
+    std::vector<BaikalOld::Material::Ptr> materials;
     for (auto old_mtl: old_materials)
     {
         if (!old_mtl)
@@ -672,22 +701,112 @@ std::set<Baikal::UberV2Material::Ptr> MaterialConverter::TranslateMaterials(std:
             continue;
         }
 
-        Baikal::LogInfo("******************************************************\n");
-        Baikal::LogInfo(++i, ". Processing scene material: \"", old_mtl->GetName(), "\"\n");
-        Baikal::LogInfo("******************************************************\n");
+        materials.push_back(old_mtl);
+    }
+
+    g_translated_textures.clear();
+
+    // Materials are independent, translate them in parallel
+    std::vector<Baikal::UberV2Material::Ptr> new_materials(materials.size());
+    Baikal::ThreadPool pool;
+    pool.ParallelFor(materials.size(), 16, [&](std::size_t begin, std::size_t end)
+    {
+        for (auto i = begin; i < end; ++i)
+        {
+            auto const& old_mtl = materials[i];
+
+            Baikal::LogInfo(i + 1, ". Processing scene material: \"", old_mtl->GetName(), "\"\n");
+
+            try
+            {
+                auto new_mtl = TranslateMaterial(old_mtl);
+                new_mtl->SetName(old_mtl->GetName());
+                new_materials[i] = new_mtl;
+            }
+            catch (std::exception const& ex)
+            {
+                Baikal::LogInfo(">>> Caught exception: ", ex.what());
+                throw;
+            }
+        }
+    });
+
+    g_translated_textures.clear();
+
+    return std::set<Baikal::UberV2Material::Ptr>(new_materials.begin(), new_materials.end());
+}
+
+std::map<std::string, std::uint64_t> MaterialConverter::ComputeInputHashes(std::string const& filename, std::string const& basepath)
+{
+    tinyxml2::XMLDocument doc;
+    if (doc.LoadFile(filename.c_str()) != tinyxml2::XML_SUCCESS)
+    {
+        throw std::runtime_error("ComputeInputHashes: failed to open " + filename);
+    }
+
+    std::map<std::string, tinyxml2::XMLElement const*> id2element;
+    for (auto element = doc.FirstChildElement(); element; element = element->NextSiblingElement())
+    {
+        if (auto id = element->Attribute("id"))
+        {
+            id2element[id] = element;
+        }
+    }
+
+    // Material hash covers its own XML, materials it references and stamps of its texture files
+    std::function<void(tinyxml2::XMLElement const*, Baikal::ContentHash&, std::set<tinyxml2::XMLElement const*>&)> add_material;
+    add_material = [&](tinyxml2::XMLElement const* element, Baikal::ContentHash& hash, std::set<tinyxml2::XMLElement const*>& visited)
+    {
+        if (!visited.insert(element).second)
+        {
+            return;
+        }
 
-        try
+        tinyxml2::XMLPrinter printer;
+        element->Accept(&printer);
+        hash.Add(printer.CStr(), static_cast<std::size_t>(printer.CStrSize()));
+
+        for (auto input = element->FirstChildElement(); input; input = input->NextSiblingElement())
         {
-            auto new_mtl = TranslateMaterial(old_mtl);
-            new_mtl->SetName(old_mtl->GetName());
-            result.insert(new_mtl);
+            auto type = input->Attribute("type");
+            auto value = input->Attribute("value");
+
+            if (!type || !value)
+            {
+                continue;
+            }
+
+            if (std::string(type) == "material")
+            {
+                auto iter = id2element.find(value);
+                if (iter != id2element.end())
+                {
+                    add_material(iter->second, hash, visited);
+                }
+            }
+            else if (std::string(type) == "texture")
+            {
+                struct stat info = {};
+                if (stat((basepath + value).c_str(), &info) == 0)
+                {
+                    hash.Add(static_cast<std::int64_t>(info.st_size));
+                    hash.Add(static_cast<std::int64_t>(info.st_mtime));
+                }
+            }
         }
-        catch (std::exception const& ex)
+    };
+
+    std::map<std::string, std::uint64_t> hashes;
+    for (auto element = doc.FirstChildElement(); element; element = element->NextSiblingElement())
+    {
+        if (auto name = element->Attribute("name"))
         {
-            Baikal::LogInfo(">>> Caught exception: ", ex.what());
-            throw;
+            Baikal::ContentHash hash;
+            std::set<tinyxml2::XMLElement const*> visited;
+            add_material(element, hash, visited);
+            hashes[name] = hash.Get();
         }
     }
 
-    return result;
+    return hashes;
 }
@@ -26,13 +26,21 @@
 
 #include "SceneGraph/uberv2material.h"
 
+#include <cstdint>
+#include <map>
 #include <set>
+#include <string>
 
 class MaterialConverter
 {
 public:
+    // Materials are translated in parallel, textures shared between them are translated once
     static std::set<Baikal::UberV2Material::Ptr> TranslateMaterials(std::set<BaikalOld::Material::Ptr> const& old_materials);
 
+    // Hash of inputs of every material of old materials.xml by name, translation result
+    // of a material can be reused while its hash is unchanged
+    static std::map<std::string, std::uint64_t> ComputeInputHashes(std::string const& filename, std::string const& basepath);
+
 private:
     static Baikal::Texture::Format TranslateFormat(BaikalOld::Texture::Format old_format);
     static Baikal::InputMap::Ptr TranslateInput(BaikalOld::Material::Ptr old_mtl, std::string const& input_name);